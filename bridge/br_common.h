@@ -1,5 +1,7 @@
 /* SPDX-License-Identifier: GPL-2.0 */
 
+#include <stdbool.h>
+
 #include "iprt.h"
 
 #define MDB_RTA(r) \
@@ -17,16 +19,43 @@ extern int print_fdb(const struct sockaddr_nl *who,
 extern int print_mdb(const struct sockaddr_nl *who,
 		     struct nlmsghdr *n, void *arg);
 
+/* fdb and mdb sync, in sync.c */
+typedef int (*br_sync_line_fn)(int argc, char **argv, void *arg);
+
+/* what the next request counts as, see br_sync_kind() */
+enum {
+	BR_SYNC_OTHER,
+	BR_SYNC_ADD,
+	BR_SYNC_REPLACE,
+	BR_SYNC_DELETE,
+	BR_SYNC_KINDS,
+};
+
+struct br_sync_tx {
+	struct rtnl_async	*outer;	/* a batch's queue, put back at end */
+	int			flags;	/* RTNL_HANDLE_F_ASYNC as it was */
+	int			errors;
+	unsigned int		sent[BR_SYNC_KINDS];
+	unsigned int		failed[BR_SYNC_KINDS];
+};
+
+int br_sync_read(const char *name, br_sync_line_fn fn, void *arg);
+int br_sync_begin(struct br_sync_tx *tx);
+void br_sync_kind(struct br_sync_tx *tx, int kind);
+unsigned int br_sync_done(const struct br_sync_tx *tx, int kind);
+int br_sync_end(struct br_sync_tx *tx);
+unsigned int br_sync_hash(const void *key, size_t len);
+
 extern int do_fdb(int argc, char **argv);
 extern int do_mdb(int argc, char **argv);
 extern int do_monitor(int argc, char **argv);
 extern int do_vlan(int argc, char **argv);
 extern int do_link(int argc, char **argv);
 
-extern int preferred_family;
-extern int show_stats;
-extern int show_details;
-extern int timestamp;
-extern int compress_vlans;
-extern int json;
-extern struct rtnl_handle rth;
+extern __thread int preferred_family;
+extern __thread int show_stats;
+extern __thread int show_details;
+extern __thread int timestamp;
+extern __thread int compress_vlans;
+extern __thread int json;
+extern __thread struct rtnl_handle rth;
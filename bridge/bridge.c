@@ -17,30 +17,34 @@
 #include "br_common.h"
 #include "namespace.h"
 #include "color.h"
+#include "probe.h"
 
-struct rtnl_handle rth = { .fd = -1 };
-int preferred_family = AF_UNSPEC;
-int oneline;
-int show_stats;
-int show_details;
+__thread struct rtnl_handle rth = { .fd = -1 };
+__thread int preferred_family = AF_UNSPEC;
+__thread int oneline;
+__thread int show_stats;
+__thread int show_details;
 int show_pretty;
 int color;
-int compress_vlans;
-int json;
-int timestamp;
+__thread int compress_vlans;
+__thread int json;
+__thread int timestamp;
 char *batch_file;
 int force;
-const char *_SL_;
+#define BR_BATCHSIZE_MAX	1024
+static unsigned int batchsize;
+__thread const char *_SL_ = "\n";
 
 static int usage(void)
 {
 	fprintf(stderr,
 "Usage: bridge [ OPTIONS ] OBJECT { COMMAND | help }\n"
-"       bridge [ -force ] -batch filename\n"
+"       bridge [ -force ] [ -batchsize N ] -batch filename\n"
 "where	OBJECT := { link | fdb | mdb | vlan | monitor }\n"
 "	OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] |\n"
 "		     -o[neline] | -t[imestamp] | -n[etns] name |\n"
-"		     -c[ompressvlans] -color -p[retty] -j{son} }\n");
+"		     -c[ompressvlans] -color -p[retty] -j{son} | -ndjson | -cbor |\n"
+"		     -stats-netlink }\n");
 	iprt_exit(-1);
 }
 
@@ -77,46 +81,124 @@ static int do_cmd(const char *argv0, int argc, char **argv)
 	return -1;
 }
 
+/* Commands that only wait for an ack, pipelined in a batch */
+static bool batch_pipelined(int argc, char *argv[])
+{
+	static const char * const objs[] = {
+		"fdb", "mdb", "vlan", NULL,
+	};
+	static const char * const subc[] = {
+		"add", "append", "replace", "delete", NULL,
+	};
+	int i, j;
+
+	if (argc < 2)
+		return false;
+
+	if (matches(argv[0], "link") == 0)
+		return matches(argv[1], "set") == 0 ||
+		       matches(argv[1], "change") == 0;
+
+	for (i = 0; objs[i]; i++) {
+		if (matches(argv[0], objs[i]))
+			continue;
+		for (j = 0; subc[j]; j++)
+			if (matches(argv[1], subc[j]) == 0)
+				return true;
+	}
+
+	return false;
+}
+
+struct batch_async_ctx {
+	const char	*name;
+	int		ret;
+};
+
+static void batch_async_err(__u32 cookie, int error, void *arg)
+{
+	struct batch_async_ctx *ctx = arg;
+
+	fprintf(stderr, "Command failed %s:%u\n", ctx->name, cookie);
+	ctx->ret = EXIT_FAILURE;
+}
+
 static int batch(const char *name)
 {
-	char *line = NULL;
-	size_t len = 0;
+	struct batch_async_ctx async = { .name = name };
+	struct cmdfile *cf;
+	char **largv;
+	int largc, err;
 	int ret = EXIT_SUCCESS;
 
-	if (name && strcmp(name, "-") != 0) {
-		if (freopen(name, "r", stdin) == NULL) {
-			fprintf(stderr,
-				"Cannot open file \"%s\" for reading: %s\n",
-				name, strerror(errno));
-			return EXIT_FAILURE;
-		}
-	}
+	cf = cmdfile_open(name);
+	if (!cf)
+		return EXIT_FAILURE;
 
 	if (rtnl_open(&rth, 0) < 0) {
 		fprintf(stderr, "Cannot open rtnetlink\n");
+		cmdfile_close(cf);
 		return EXIT_FAILURE;
 	}
+	rtnl_set_strict_dump(&rth);
 
-	cmdlineno = 0;
-	while (getcmdline(&line, &len, stdin) != -1) {
-		char *largv[100];
-		int largc;
+	/* keep the link cache in step with what earlier lines changed */
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, cache may go stale\n");
 
-		largc = makeargs(line, largv, 100);
+	/*
+	 * Up to batchsize requests are in flight at once; without -force
+	 * those queued behind the first to fail have been applied too.
+	 */
+	if (batchsize != 1 &&
+	    rtnl_async_begin(&rth, batchsize, batch_async_err, &async) < 0)
+		fprintf(stderr, "Cannot pipeline batch, continuing without\n");
+
+	cmdlineno = 0;
+	while ((largc = cmdfile_next(cf, &largv)) != -1) {
 		if (largc == 0)
 			continue;       /* blank line */
 
-		if (do_cmd(largv[0], largc, largv)) {
+		ll_sync_map(&rth);
+
+		if (rth.async && batch_pipelined(largc, largv)) {
+			rtnl_async_cookie(&rth, cmdlineno);
+			rth.flags |= RTNL_HANDLE_F_ASYNC;
+		} else if (rth.async) {
+			rtnl_async_flush(&rth);
+			rth.flags &= ~RTNL_HANDLE_F_ASYNC;
+		}
+
+		if (!force && async.ret) {
+			ret = async.ret;
+			break;
+		}
+
+		PROBE2(batch_line_start, cmdlineno, largv[0]);
+		err = do_cmd(largv[0], largc, largv);
+		PROBE2(batch_line_end, cmdlineno, err);
+		if (err) {
 			fprintf(stderr, "Command failed %s:%d\n",
 				name, cmdlineno);
 			ret = EXIT_FAILURE;
 			if (!force)
 				break;
 		}
+
+		/* a request queued earlier failed while this one was added */
+		if (!force && async.ret) {
+			ret = async.ret;
+			break;
+		}
 	}
-	if (line)
-		free(line);
+	cmdfile_close(cf);
 
+	/* what is still queued comes after the request that failed */
+	if (!force && async.ret)
+		rtnl_async_discard(&rth);
+	rtnl_async_end(&rth);
+	if (async.ret)
+		ret = async.ret;
 	rtnl_close(&rth);
 	return ret;
 }
@@ -141,6 +223,8 @@ main(int argc, char **argv)
 		} else if (matches(opt, "-Version") == 0) {
 			printf("bridge utility, 0.0\n");
 			iprt_exit(0);
+		} else if (strcmp(opt, "-stats-netlink") == 0) {
+			rtnl_stats_enable();
 		} else if (matches(opt, "-stats") == 0 ||
 			   matches(opt, "-statistics") == 0) {
 			++show_stats;
@@ -179,8 +263,19 @@ main(int argc, char **argv)
 			++force;
 		} else if (matches(opt, "-json") == 0) {
 			++json;
+		} else if (strcmp(opt, "-ndjson") == 0) {
+			++json;
+			++ndjson;
+		} else if (strcmp(opt, "-cbor") == 0) {
+			++json;
+			++cbor;
 		} else if (matches(opt, "-pretty") == 0) {
 			++pretty;
+		} else if (strcmp(opt, "-batchsize") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&batchsize, argv[1], 0) ||
+			    !batchsize || batchsize > BR_BATCHSIZE_MAX)
+				invarg("invalid batch size", argv[1]);
 		} else if (matches(opt, "-batch") == 0) {
 			argc--;
 			argv++;
@@ -206,6 +301,7 @@ main(int argc, char **argv)
 
 	if (rtnl_open(&rth, 0) < 0)
 		iprt_exit(1);
+	rtnl_set_strict_dump(&rth);
 
 	if (argc > 1)
 		return do_cmd(argv[1], argc-1, argv+1);
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "json_print.h"
 #include "libnetlink.h"
@@ -39,13 +40,14 @@ static int usage(void)
 		"              [ self ] [ master ] [ use ] [ router ] [ extern_learn ]\n"
 		"              [ local | static | dynamic ] [ dst IPADDR ] [ vlan VID ]\n"
 		"              [ port PORT] [ vni VNI ] [ via DEV ]\n"
-		"       bridge fdb [ show [ br BRDEV ] [ brport DEV ] [ vlan VID ] [ state STATE ] ]\n");
+		"       bridge fdb [ show [ br BRDEV ] [ brport DEV ] [ vlan VID ] [ state STATE ] ]\n"
+		"       bridge fdb sync dev DEV [ self | master ] file FILE\n");
 	iprt_exit(-1);
 }
 
 static const char *state_n2a(unsigned int s)
 {
-	static char buf[32];
+	static __thread char buf[32];
 
 	if (s & NUD_PERMANENT)
 		return "permanent";
@@ -256,7 +258,8 @@ int print_fdb(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
-static int fdb_show(int argc, char **argv)
+/* only the entries of port ifindex and bridge br_ifindex, if not 0 */
+static int fdb_dump_request(int ifindex, int br_ifindex)
 {
 	struct {
 		struct nlmsghdr	n;
@@ -265,11 +268,43 @@ static int fdb_show(int argc, char **argv)
 	} req = {
 		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
 		.ifm.ifi_family = PF_BRIDGE,
+		.ifm.ifi_index = ifindex,
 	};
+	/* what a strict kernel wants instead, the same filters as attributes */
+	struct {
+		struct nlmsghdr	n;
+		struct ndmsg		ndm;
+		char			buf[256];
+	} sreq = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
+		.n.nlmsg_type = RTM_GETNEIGH,
+		.ndm.ndm_family = PF_BRIDGE,
+		.ndm.ndm_ifindex = ifindex,
+	};
+	int msg_size = sizeof(struct ifinfomsg);
+
+	if (br_ifindex) {
+		addattr32(&req.n, sizeof(req), IFLA_MASTER, br_ifindex);
+		addattr32(&sreq.n, sizeof(sreq), NDA_MASTER, br_ifindex);
+		msg_size += RTA_LENGTH(4);
+	}
 
+	/*
+	 * Either way the kernel only dumps the entries of the port and
+	 * bridge asked for, but a strict one rejects the ifinfomsg header.
+	 */
+	if (rth.flags & RTNL_HANDLE_F_STRICT_CHK)
+		return rtnl_dump_request_n(&rth, &sreq.n);
+	return rtnl_dump_request(&rth, RTM_GETNEIGH, &req.ifm, msg_size);
+}
+
+static int fdb_show(int argc, char **argv)
+{
 	char *filter_dev = NULL;
 	char *br = NULL;
-	int msg_size = sizeof(struct ifinfomsg);
+	int br_ifindex = 0;
+
+	ll_init_map(&rth);
 
 	while (argc > 0) {
 		if ((strcmp(*argv, "brport") == 0) || strcmp(*argv, "dev") == 0) {
@@ -298,14 +333,11 @@ static int fdb_show(int argc, char **argv)
 	}
 
 	if (br) {
-		int br_ifindex = ll_name_to_index(br);
-
+		br_ifindex = ll_name_to_index(br);
 		if (br_ifindex == 0) {
 			fprintf(stderr, "Cannot find bridge device \"%s\"\n", br);
 			return -1;
 		}
-		addattr32(&req.n, sizeof(req), IFLA_MASTER, br_ifindex);
-		msg_size += RTA_LENGTH(4);
 	}
 
 	/*we'll keep around filter_dev for older kernels */
@@ -313,10 +345,9 @@ static int fdb_show(int argc, char **argv)
 		filter_index = ll_name_to_index(filter_dev);
 		if (!filter_index)
 			return nodev(filter_dev);
-		req.ifm.ifi_index = filter_index;
 	}
 
-	if (rtnl_dump_request(&rth, RTM_GETNEIGH, &req.ifm, msg_size) < 0) {
+	if (fdb_dump_request(filter_index, br_ifindex) < 0) {
 		perror("Cannot send dump request");
 		iprt_exit(1);
 	}
@@ -333,21 +364,20 @@ static int fdb_show(int argc, char **argv)
 	return 0;
 }
 
-static int fdb_modify(int cmd, int flags, int argc, char **argv)
+struct fdb_req {
+	struct nlmsghdr	n;
+	struct ndmsg		ndm;
+	char			buf[256];
+};
+
+/*
+ * The arguments of fdb add and friends into req, all but the device,
+ * which need_dev says must be given and is returned in *d.
+ */
+static int fdb_parse(struct fdb_req *req, char **d, bool need_dev,
+		     int argc, char **argv)
 {
-	struct {
-		struct nlmsghdr	n;
-		struct ndmsg		ndm;
-		char			buf[256];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.ndm.ndm_family = PF_BRIDGE,
-		.ndm.ndm_state = NUD_NOARP,
-	};
 	char *addr = NULL;
-	char *d = NULL;
 	char abuf[ETH_ALEN];
 	int dst_ok = 0;
 	inet_prefix dst;
@@ -360,7 +390,7 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
-			d = *argv;
+			*d = *argv;
 		} else if (strcmp(*argv, "dst") == 0) {
 			NEXT_ARG();
 			if (dst_ok)
@@ -392,29 +422,29 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 			if (!via)
 				iprt_exit(nodev(*argv));
 		} else if (strcmp(*argv, "self") == 0) {
-			req.ndm.ndm_flags |= NTF_SELF;
+			req->ndm.ndm_flags |= NTF_SELF;
 		} else if (matches(*argv, "master") == 0) {
-			req.ndm.ndm_flags |= NTF_MASTER;
+			req->ndm.ndm_flags |= NTF_MASTER;
 		} else if (matches(*argv, "router") == 0) {
-			req.ndm.ndm_flags |= NTF_ROUTER;
+			req->ndm.ndm_flags |= NTF_ROUTER;
 		} else if (matches(*argv, "local") == 0 ||
 			   matches(*argv, "permanent") == 0) {
-			req.ndm.ndm_state |= NUD_PERMANENT;
+			req->ndm.ndm_state |= NUD_PERMANENT;
 		} else if (matches(*argv, "temp") == 0 ||
 			   matches(*argv, "static") == 0) {
-			req.ndm.ndm_state |= NUD_REACHABLE;
+			req->ndm.ndm_state |= NUD_REACHABLE;
 		} else if (matches(*argv, "dynamic") == 0) {
-			req.ndm.ndm_state |= NUD_REACHABLE;
-			req.ndm.ndm_state &= ~NUD_NOARP;
+			req->ndm.ndm_state |= NUD_REACHABLE;
+			req->ndm.ndm_state &= ~NUD_NOARP;
 		} else if (matches(*argv, "vlan") == 0) {
 			if (vid >= 0)
 				return duparg2("vlan", *argv);
 			NEXT_ARG();
 			vid = atoi(*argv);
 		} else if (matches(*argv, "use") == 0) {
-			req.ndm.ndm_flags |= NTF_USE;
+			req->ndm.ndm_flags |= NTF_USE;
 		} else if (matches(*argv, "extern_learn") == 0) {
-			req.ndm.ndm_flags |= NTF_EXT_LEARNED;
+			req->ndm.ndm_flags |= NTF_EXT_LEARNED;
 		} else {
 			if (strcmp(*argv, "to") == 0)
 				NEXT_ARG();
@@ -428,18 +458,18 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 		argc--; argv++;
 	}
 
-	if (d == NULL || addr == NULL) {
+	if ((need_dev && *d == NULL) || addr == NULL) {
 		fprintf(stderr, "Device and address are required arguments.\n");
 		return -1;
 	}
 
 	/* Assume self */
-	if (!(req.ndm.ndm_flags&(NTF_SELF|NTF_MASTER)))
-		req.ndm.ndm_flags |= NTF_SELF;
+	if (!(req->ndm.ndm_flags&(NTF_SELF|NTF_MASTER)))
+		req->ndm.ndm_flags |= NTF_SELF;
 
 	/* Assume permanent */
-	if (!(req.ndm.ndm_state&(NUD_PERMANENT|NUD_REACHABLE)))
-		req.ndm.ndm_state |= NUD_PERMANENT;
+	if (!(req->ndm.ndm_state&(NUD_PERMANENT|NUD_REACHABLE)))
+		req->ndm.ndm_state |= NUD_PERMANENT;
 
 	if (sscanf(addr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
 		   abuf, abuf+1, abuf+2,
@@ -448,23 +478,40 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 		return -1;
 	}
 
-	addattr_l(&req.n, sizeof(req), NDA_LLADDR, abuf, ETH_ALEN);
+	addattr_l(&req->n, sizeof(*req), NDA_LLADDR, abuf, ETH_ALEN);
 	if (dst_ok)
-		addattr_l(&req.n, sizeof(req), NDA_DST, &dst.data, dst.bytelen);
+		addattr_l(&req->n, sizeof(*req), NDA_DST, &dst.data, dst.bytelen);
 
 	if (vid >= 0)
-		addattr16(&req.n, sizeof(req), NDA_VLAN, vid);
+		addattr16(&req->n, sizeof(*req), NDA_VLAN, vid);
 
 	if (port) {
 		unsigned short dport;
 
 		dport = htons((unsigned short)port);
-		addattr16(&req.n, sizeof(req), NDA_PORT, dport);
+		addattr16(&req->n, sizeof(*req), NDA_PORT, dport);
 	}
 	if (vni != ~0)
-		addattr32(&req.n, sizeof(req), NDA_VNI, vni);
+		addattr32(&req->n, sizeof(*req), NDA_VNI, vni);
 	if (via)
-		addattr32(&req.n, sizeof(req), NDA_IFINDEX, via);
+		addattr32(&req->n, sizeof(*req), NDA_IFINDEX, via);
+
+	return 0;
+}
+
+static int fdb_modify(int cmd, int flags, int argc, char **argv)
+{
+	struct fdb_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST | flags,
+		.n.nlmsg_type = cmd,
+		.ndm.ndm_family = PF_BRIDGE,
+		.ndm.ndm_state = NUD_NOARP,
+	};
+	char *d = NULL;
+
+	if (fdb_parse(&req, &d, true, argc, argv))
+		return -1;
 
 	req.ndm.ndm_ifindex = ll_name_to_index(d);
 	if (!req.ndm.ndm_ifindex)
@@ -476,10 +523,430 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 	return 0;
 }
 
-int do_fdb(int argc, char **argv)
+/*
+ * fdb sync: make the entries of a device in one class, self or master,
+ * those of a file. The file is read, the device dumped once and only
+ * what differs is sent, pipelined, adds and replaces ahead of deletes
+ * so that no MAC goes missing on the way. Learned entries, those of the
+ * device's own address, and self entries with no remote, which are the
+ * device's address lists, are never deleted.
+ */
+#define FDB_SYNC_FLAGS	(NTF_ROUTER | NTF_EXT_LEARNED)
+
+struct fdb_key {
+	__u8	mac[ETH_ALEN];
+	__u16	vlan;
+	__u32	vni;		/* ~0 for the device's */
+	__u32	via;
+	__u16	port;		/* network order, 0 for the device's */
+	__u8	dst_len;
+	__u8	dst[16];
+};
+
+struct fdb_sync_ent {
+	struct fdb_sync_ent	*next;
+	struct fdb_sync_ent	*mac_next;	/* by mac and vlan only */
+	struct fdb_key		key;
+	__u16			state;
+	__u8			flags;
+	bool			seen;
+	bool			replace;
+};
+
+struct fdb_sync {
+	int			ifindex;
+	__u8			class;		/* NTF_SELF or NTF_MASTER */
+	__u32			def_vni;	/* of a vxlan device */
+	__u16			def_port;
+	bool			has_addr;
+	__u8			addr[ETH_ALEN];
+	struct fdb_sync_ent	*ents;		/* the file's */
+	unsigned int		count;
+	unsigned int		size;
+	struct fdb_sync_ent	**hash;
+	struct fdb_sync_ent	**mac_hash;
+	unsigned int		mask;
+	struct fdb_sync_ent	*del;		/* the kernel's, not wanted */
+	unsigned int		ndel;
+	unsigned int		del_size;
+};
+
+static bool fdb_sync_unicast(const __u8 *mac)
 {
-	ll_init_map(&rth);
+	static const __u8 zero[ETH_ALEN];
+
+	return !(mac[0] & 1) && memcmp(mac, zero, ETH_ALEN);
+}
+
+/* what tells entries apart: permanent, static or learned */
+static int fdb_sync_state(__u16 state)
+{
+	if (state & NUD_PERMANENT)
+		return NUD_PERMANENT;
+	if (state & NUD_NOARP)
+		return NUD_NOARP;
+	return NUD_REACHABLE;
+}
+
+/* the kernel leaves out the port and vni of a remote when the device's */
+static int fdb_sync_key_get(const struct fdb_sync *fs, struct nlmsghdr *n,
+			    struct fdb_key *k)
+{
+	struct ndmsg *ndm = NLMSG_DATA(n);
+	struct rtattr *tb[NDA_MAX + 1];
+
+	parse_rtattr(tb, NDA_MAX, NDA_RTA(ndm),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm)));
+
+	memset(k, 0, sizeof(*k));
+	if (!tb[NDA_LLADDR] || RTA_PAYLOAD(tb[NDA_LLADDR]) != ETH_ALEN)
+		return -1;
+	memcpy(k->mac, RTA_DATA(tb[NDA_LLADDR]), ETH_ALEN);
+	if (tb[NDA_VLAN])
+		k->vlan = rta_getattr_u16(tb[NDA_VLAN]);
+	k->vni = tb[NDA_VNI] ? rta_getattr_u32(tb[NDA_VNI]) : ~0U;
+	if (k->vni == fs->def_vni)
+		k->vni = ~0U;
+	if (tb[NDA_PORT])
+		k->port = rta_getattr_u16(tb[NDA_PORT]);
+	if (k->port == fs->def_port)
+		k->port = 0;
+	if (tb[NDA_IFINDEX])
+		k->via = rta_getattr_u32(tb[NDA_IFINDEX]);
+	if (tb[NDA_DST]) {
+		if (RTA_PAYLOAD(tb[NDA_DST]) > sizeof(k->dst))
+			return -1;
+		k->dst_len = RTA_PAYLOAD(tb[NDA_DST]);
+		memcpy(k->dst, RTA_DATA(tb[NDA_DST]), k->dst_len);
+	}
+	return 0;
+}
+
+static unsigned int fdb_sync_mac_hash(const struct fdb_key *k)
+{
+	return br_sync_hash(k, offsetof(struct fdb_key, vni));
+}
+
+static struct fdb_sync_ent *fdb_sync_find(const struct fdb_sync *fs,
+					  const struct fdb_key *k)
+{
+	struct fdb_sync_ent *e;
+
+	for (e = fs->hash[br_sync_hash(k, sizeof(*k)) & fs->mask]; e;
+	     e = e->next)
+		if (!memcmp(&e->key, k, sizeof(*k)))
+			return e;
+	return NULL;
+}
+
+static bool fdb_sync_find_mac(const struct fdb_sync *fs,
+			      const struct fdb_key *k)
+{
+	struct fdb_sync_ent *e;
+
+	for (e = fs->mac_hash[fdb_sync_mac_hash(k) & fs->mask]; e;
+	     e = e->mac_next)
+		if (!memcmp(&e->key, k, offsetof(struct fdb_key, vni)))
+			return true;
+	return false;
+}
+
+static int fdb_sync_line(int argc, char **argv, void *arg)
+{
+	struct fdb_sync *fs = arg;
+	struct fdb_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
+		.ndm.ndm_state = NUD_NOARP,
+		.ndm.ndm_flags = fs->class,
+	};
+	struct fdb_sync_ent *e;
+	char *d = NULL;
+
+	if (fdb_parse(&req, &d, false, argc, argv))
+		return -1;
+	if (d || (req.ndm.ndm_flags & (NTF_SELF | NTF_MASTER)) != fs->class) {
+		fprintf(stderr, "dev, self and master go on the sync command line, not in the file.\n");
+		return -1;
+	}
+
+	if (fs->count == fs->size) {
+		unsigned int size = fs->size ? 2 * fs->size : 1024;
 
+		e = realloc(fs->ents, size * sizeof(*e));
+		if (!e) {
+			fprintf(stderr, "Cannot allocate fdb entries\n");
+			return -1;
+		}
+		fs->ents = e;
+		fs->size = size;
+	}
+
+	e = &fs->ents[fs->count];
+	memset(e, 0, sizeof(*e));
+	if (fdb_sync_key_get(fs, &req.n, &e->key))
+		return -1;
+	e->state = req.ndm.ndm_state;
+	e->flags = req.ndm.ndm_flags & ~(NTF_SELF | NTF_MASTER);
+	fs->count++;
+	return 0;
+}
+
+/* hash the file's entries, once it is read and they no longer move */
+static int fdb_sync_index(struct fdb_sync *fs)
+{
+	unsigned int size = 256, i, h;
+
+	while (size < fs->count)
+		size <<= 1;
+	fs->mask = size - 1;
+	fs->hash = calloc(size, sizeof(*fs->hash));
+	fs->mac_hash = calloc(size, sizeof(*fs->mac_hash));
+	if (!fs->hash || !fs->mac_hash)
+		return -1;
+
+	for (i = 0; i < fs->count; i++) {
+		struct fdb_sync_ent *e = &fs->ents[i], *old;
+
+		/* given twice, the later line is the one that counts */
+		old = fdb_sync_find(fs, &e->key);
+		if (old) {
+			old->state = e->state;
+			old->flags = e->flags;
+			e->seen = true;
+			continue;
+		}
+		h = br_sync_hash(&e->key, sizeof(e->key)) & fs->mask;
+		e->next = fs->hash[h];
+		fs->hash[h] = e;
+		h = fdb_sync_mac_hash(&e->key) & fs->mask;
+		e->mac_next = fs->mac_hash[h];
+		fs->mac_hash[h] = e;
+	}
+	return 0;
+}
+
+static int fdb_sync_dump_cb(const struct sockaddr_nl *who,
+			    struct nlmsghdr *n, void *arg)
+{
+	struct fdb_sync *fs = arg;
+	struct ndmsg *ndm = NLMSG_DATA(n);
+	struct fdb_sync_ent *e;
+	struct fdb_key k;
+
+	if (n->nlmsg_type != RTM_NEWNEIGH ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*ndm)))
+		return 0;
+	/* older kernels dump every port, the bridge's carry no NTF_MASTER */
+	if (ndm->ndm_family != AF_BRIDGE || ndm->ndm_ifindex != fs->ifindex ||
+	    !(ndm->ndm_flags & NTF_SELF) != (fs->class == NTF_MASTER))
+		return 0;
+	if (fdb_sync_key_get(fs, n, &k))
+		return 0;
+
+	e = fdb_sync_find(fs, &k);
+	if (e) {
+		e->seen = true;
+		if (fdb_sync_state(e->state) != fdb_sync_state(ndm->ndm_state) ||
+		    (e->flags ^ ndm->ndm_flags) & FDB_SYNC_FLAGS)
+			e->replace = true;
+		return 0;
+	}
+
+	if (fdb_sync_state(ndm->ndm_state) == NUD_REACHABLE ||
+	    (fs->has_addr && !memcmp(k.mac, fs->addr, ETH_ALEN)) ||
+	    (fs->class == NTF_SELF && !k.dst_len))
+		return 0;
+	/* a unicast MAC has one remote, the replace moves it */
+	if (fdb_sync_unicast(k.mac) && fdb_sync_find_mac(fs, &k))
+		return 0;
+
+	if (fs->ndel == fs->del_size) {
+		unsigned int size = fs->del_size ? 2 * fs->del_size : 1024;
+
+		e = realloc(fs->del, size * sizeof(*e));
+		if (!e)
+			return -1;
+		fs->del = e;
+		fs->del_size = size;
+	}
+	e = &fs->del[fs->ndel++];
+	memset(e, 0, sizeof(*e));
+	e->key = k;
+	e->state = ndm->ndm_state;
+	return 0;
+}
+
+static int fdb_sync_send(const struct fdb_sync *fs,
+			 const struct fdb_sync_ent *e, int cmd, int flags)
+{
+	struct fdb_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST | flags,
+		.n.nlmsg_type = cmd,
+		.ndm.ndm_family = PF_BRIDGE,
+		.ndm.ndm_state = e->state,
+		.ndm.ndm_flags = e->flags | fs->class,
+		.ndm.ndm_ifindex = fs->ifindex,
+	};
+	const struct fdb_key *k = &e->key;
+
+	addattr_l(&req.n, sizeof(req), NDA_LLADDR, k->mac, ETH_ALEN);
+	if (k->dst_len)
+		addattr_l(&req.n, sizeof(req), NDA_DST, k->dst, k->dst_len);
+	if (k->vlan)
+		addattr16(&req.n, sizeof(req), NDA_VLAN, k->vlan);
+	if (k->port)
+		addattr16(&req.n, sizeof(req), NDA_PORT, k->port);
+	if (k->vni != ~0U)
+		addattr32(&req.n, sizeof(req), NDA_VNI, k->vni);
+	if (k->via)
+		addattr32(&req.n, sizeof(req), NDA_IFINDEX, k->via);
+
+	return rtnl_talk(&rth, &req.n, NULL) < 0 ? -1 : 0;
+}
+
+/* the address of the device, and the defaults of a vxlan one */
+static int fdb_sync_link(struct fdb_sync *fs)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	ifm;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETLINK,
+		.ifm.ifi_index = fs->ifindex,
+	};
+	struct rtattr *tb[IFLA_MAX + 1], *linkinfo[IFLA_INFO_MAX + 1];
+	struct nlmsghdr *answer;
+	struct ifinfomsg *ifi;
+
+	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK, RTEXT_FILTER_SKIP_STATS);
+	if (rtnl_talk(&rth, &req.n, &answer) < 0)
+		return -1;
+
+	ifi = NLMSG_DATA(answer);
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(answer));
+	if (tb[IFLA_ADDRESS] && RTA_PAYLOAD(tb[IFLA_ADDRESS]) == ETH_ALEN) {
+		memcpy(fs->addr, RTA_DATA(tb[IFLA_ADDRESS]), ETH_ALEN);
+		fs->has_addr = true;
+	}
+
+	if (tb[IFLA_LINKINFO]) {
+		parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+		if (linkinfo[IFLA_INFO_KIND] && linkinfo[IFLA_INFO_DATA] &&
+		    !strcmp(rta_getattr_str(linkinfo[IFLA_INFO_KIND]), "vxlan")) {
+			struct rtattr *vx[IFLA_VXLAN_MAX + 1];
+
+			parse_rtattr_nested(vx, IFLA_VXLAN_MAX,
+					    linkinfo[IFLA_INFO_DATA]);
+			if (vx[IFLA_VXLAN_ID])
+				fs->def_vni = rta_getattr_u32(vx[IFLA_VXLAN_ID]);
+			if (vx[IFLA_VXLAN_PORT])
+				fs->def_port = rta_getattr_u16(vx[IFLA_VXLAN_PORT]);
+		}
+	}
+
+	free(answer);
+	return 0;
+}
+
+static int fdb_sync(int argc, char **argv)
+{
+	struct fdb_sync fs = { .class = NTF_SELF, .def_vni = ~0U };
+	char *d = NULL, *file = NULL;
+	struct br_sync_tx tx;
+	unsigned int i;
+	int ret = -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			d = *argv;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			file = *argv;
+		} else if (strcmp(*argv, "self") == 0) {
+			fs.class = NTF_SELF;
+		} else if (matches(*argv, "master") == 0) {
+			fs.class = NTF_MASTER;
+		} else {
+			if (matches(*argv, "help") == 0)
+				return usage();
+			return invarg("unknown argument", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (d == NULL || file == NULL) {
+		fprintf(stderr, "Device and file are required arguments.\n");
+		return -1;
+	}
+
+	fs.ifindex = ll_name_to_index(d);
+	if (!fs.ifindex)
+		return nodev(d);
+	if (fdb_sync_link(&fs) < 0)
+		return -1;
+
+	if (br_sync_read(file, fdb_sync_line, &fs) < 0)
+		goto out;
+	if (fdb_sync_index(&fs) < 0) {
+		fprintf(stderr, "Cannot allocate fdb index\n");
+		goto out;
+	}
+
+	if (fdb_dump_request(fs.ifindex, 0) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, fdb_sync_dump_cb, &fs) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	if (br_sync_begin(&tx) < 0) {
+		fprintf(stderr, "Cannot pipeline requests\n");
+		goto out;
+	}
+	for (i = 0; i < fs.count; i++) {
+		struct fdb_sync_ent *e = &fs.ents[i];
+		int flags = NLM_F_CREATE;
+
+		if (e->seen && !e->replace)
+			continue;
+		/* multicast and zero MACs take a list of remotes */
+		if (e->replace || fdb_sync_unicast(e->key.mac))
+			flags |= NLM_F_REPLACE;
+		else
+			flags |= NLM_F_APPEND;
+		br_sync_kind(&tx, e->replace ? BR_SYNC_REPLACE : BR_SYNC_ADD);
+		if (fdb_sync_send(&fs, e, RTM_NEWNEIGH, flags) < 0)
+			break;
+	}
+	for (i = 0; i < fs.ndel; i++) {
+		br_sync_kind(&tx, BR_SYNC_DELETE);
+		if (fdb_sync_send(&fs, &fs.del[i], RTM_DELNEIGH, 0) < 0)
+			break;
+	}
+	ret = br_sync_end(&tx);
+
+	if (show_stats)
+		printf("added %u replaced %u deleted %u failed %u\n",
+		       br_sync_done(&tx, BR_SYNC_ADD),
+		       br_sync_done(&tx, BR_SYNC_REPLACE),
+		       br_sync_done(&tx, BR_SYNC_DELETE), tx.errors);
+out:
+	free(fs.ents);
+	free(fs.hash);
+	free(fs.mac_hash);
+	free(fs.del);
+	return ret ? -1 : 0;
+}
+
+int do_fdb(int argc, char **argv)
+{
 	if (argc > 0) {
 		if (matches(*argv, "add") == 0)
 			return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1);
@@ -489,6 +956,8 @@ int do_fdb(int argc, char **argv)
 			return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1);
 		if (matches(*argv, "delete") == 0)
 			return fdb_modify(RTM_DELNEIGH, 0, argc-1, argv+1);
+		if (matches(*argv, "sync") == 0)
+			return fdb_sync(argc-1, argv+1);
 		if (matches(*argv, "show") == 0 ||
 		    matches(*argv, "lst") == 0 ||
 		    matches(*argv, "list") == 0)
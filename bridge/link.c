@@ -11,6 +11,7 @@
 #include <linux/if_bridge.h>
 #include <string.h>
 #include <stdbool.h>
+#include <fnmatch.h>
 
 #include "json_print.h"
 #include "libnetlink.h"
@@ -18,6 +19,7 @@
 #include "br_common.h"
 
 static unsigned int filter_index;
+static unsigned int filter_master;
 
 static const char *port_states[] = {
 	[BR_STATE_DISABLED] = "disabled",
@@ -201,6 +203,10 @@ int print_linkinfo(const struct sockaddr_nl *who,
 
 	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
 
+	if (filter_master && (!tb[IFLA_MASTER] ||
+			      rta_getattr_u32(tb[IFLA_MASTER]) != filter_master))
+		return 0;
+
 	name = get_ifname_rta(ifi->ifi_index, tb[IFLA_IFNAME]);
 	if (!name)
 		return -1;
@@ -239,7 +245,7 @@ int print_linkinfo(const struct sockaddr_nl *who,
 
 static int usage(void)
 {
-	fprintf(stderr, "Usage: bridge link set dev DEV [ cost COST ] [ priority PRIO ] [ state STATE ]\n");
+	fprintf(stderr, "Usage: bridge link set PORTS [ cost COST ] [ priority PRIO ] [ state STATE ]\n");
 	fprintf(stderr, "                               [ guard {on | off} ]\n");
 	fprintf(stderr, "                               [ hairpin {on | off} ]\n");
 	fprintf(stderr, "                               [ fastleave {on | off} ]\n");
@@ -252,7 +258,8 @@ static int usage(void)
 	fprintf(stderr,	"                               [ vlan_tunnel {on | off} ]\n");
 	fprintf(stderr, "                               [ hwmode {vepa | veb} ]\n");
 	fprintf(stderr, "                               [ self ] [ master ]\n");
-	fprintf(stderr, "       bridge link show [dev DEV]\n");
+	fprintf(stderr, "       bridge link show [ dev DEV ] [ br BRIDGE ]\n");
+	fprintf(stderr, "PORTS := { dev { DEV | PATTERN } | br BRIDGE | file FILE }...\n");
 	iprt_exit(-1);
 }
 
@@ -272,6 +279,175 @@ static bool on_off(char *arg, __s8 *attr, char *val)
 	return true;
 }
 
+/*
+ * The ports a "bridge link set" is for: devices named, or matching a
+ * pattern, or listed in a file, one per line. With br BRIDGE they are
+ * taken among the ports of that bridge only, which the kernel picks
+ * out of the link dump, and without any name all of its ports are.
+ */
+struct port_set {
+	char		**names;	/* exact, sorted */
+	bool		*found;
+	unsigned int	nnames;
+	unsigned int	maxnames;
+	char		**patterns;
+	unsigned int	npatterns;
+	int		master;
+	int		*ifindex;
+	unsigned int	count;
+	unsigned int	size;
+};
+
+static __thread struct port_set *port_set_dump;
+
+static bool port_is_pattern(const char *name)
+{
+	return strpbrk(name, "*?[") != NULL;
+}
+
+static int port_set_name(struct port_set *ps, char *name)
+{
+	if (ps->nnames == ps->maxnames) {
+		unsigned int max = ps->maxnames ? 2 * ps->maxnames : 64;
+		char **names = realloc(ps->names, max * sizeof(*names));
+
+		if (!names)
+			return -1;
+		ps->names = names;
+		ps->maxnames = max;
+	}
+	ps->names[ps->nnames] = strdup(name);
+	if (!ps->names[ps->nnames])
+		return -1;
+	ps->nnames++;
+	return 0;
+}
+
+static int port_set_line(int argc, char **argv, void *arg)
+{
+	if (argc != 1 || port_is_pattern(argv[0]))
+		return -1;
+	return port_set_name(arg, argv[0]);
+}
+
+static int port_set_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int port_set_add(struct port_set *ps, int ifindex)
+{
+	if (ps->count == ps->size) {
+		unsigned int size = ps->size ? 2 * ps->size : 256;
+		int *v = realloc(ps->ifindex, size * sizeof(*v));
+
+		if (!v)
+			return -1;
+		ps->ifindex = v;
+		ps->size = size;
+	}
+	ps->ifindex[ps->count++] = ifindex;
+	return 0;
+}
+
+static bool port_set_match(struct port_set *ps, const char *name)
+{
+	unsigned int i;
+	char **p;
+
+	if (!ps->nnames && !ps->npatterns)
+		return true;
+
+	p = bsearch(&name, ps->names, ps->nnames, sizeof(*ps->names),
+		    port_set_cmp);
+	if (p) {
+		ps->found[p - ps->names] = true;
+		return true;
+	}
+	for (i = 0; i < ps->npatterns; i++)
+		if (fnmatch(ps->patterns[i], name, 0) == 0)
+			return true;
+	return false;
+}
+
+static int port_set_filter_req(struct nlmsghdr *nlh, int reqlen)
+{
+	if (port_set_dump->master)
+		return addattr32(nlh, reqlen, IFLA_MASTER,
+				 port_set_dump->master);
+	return 0;
+}
+
+static int port_set_link(const struct sockaddr_nl *who,
+			 struct nlmsghdr *n, void *arg)
+{
+	struct port_set *ps = arg;
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX+1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	if (!tb[IFLA_IFNAME])
+		return 0;
+	/* an older kernel dumps all links whatever the filter */
+	if (ps->master && (!tb[IFLA_MASTER] ||
+			   rta_getattr_u32(tb[IFLA_MASTER]) != ps->master))
+		return 0;
+	if (!port_set_match(ps, rta_getattr_str(tb[IFLA_IFNAME])))
+		return 0;
+	return port_set_add(ps, ifi->ifi_index);
+}
+
+static int port_set_resolve(struct port_set *ps)
+{
+	unsigned int i;
+	int ret = 0;
+
+	qsort(ps->names, ps->nnames, sizeof(*ps->names), port_set_cmp);
+	ps->found = calloc(ps->nnames + 1, sizeof(*ps->found));
+	if (!ps->found)
+		return -1;
+
+	port_set_dump = ps;
+	if (rtnl_wilddump_req_filter_fn(&rth, AF_UNSPEC, RTM_GETLINK,
+					port_set_filter_req) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, port_set_link, ps) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+
+	for (i = 0; i < ps->nnames; i++) {
+		if (ps->found[i])
+			continue;
+		fprintf(stderr, "Cannot find bridge port \"%s\"\n",
+			ps->names[i]);
+		ret = -1;
+	}
+	if (!ret && !ps->count) {
+		fprintf(stderr, "No port matches.\n");
+		ret = -1;
+	}
+	return ret;
+}
+
+static void port_set_free(struct port_set *ps)
+{
+	unsigned int i;
+
+	for (i = 0; i < ps->nnames; i++)
+		free(ps->names[i]);
+	free(ps->names);
+	free(ps->found);
+	free(ps->patterns);
+	free(ps->ifindex);
+}
+
 static int brlink_modify(int argc, char **argv)
 {
 	struct {
@@ -284,7 +460,10 @@ static int brlink_modify(int argc, char **argv)
 		.n.nlmsg_type = RTM_SETLINK,
 		.ifm.ifi_family = PF_BRIDGE,
 	};
-	char *d = NULL;
+	struct port_set ps = {};
+	char *d = NULL, *br = NULL, *file = NULL;
+	struct br_sync_tx tx;
+	unsigned int i;
 	__s8 neigh_suppress = -1;
 	__s8 learning = -1;
 	__s8 learning_sync = -1;
@@ -301,43 +480,62 @@ static int brlink_modify(int argc, char **argv)
 	__s16 mode = -1;
 	__u16 flags = 0;
 	struct rtattr *nest;
+	int ret = -1;
+
+	ps.patterns = calloc(argc + 1, sizeof(*ps.patterns));
+	if (!ps.patterns)
+		return -1;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
+			if (port_is_pattern(*argv))
+				ps.patterns[ps.npatterns++] = *argv;
+			else if (port_set_name(&ps, *argv))
+				goto out;
 			d = *argv;
+		} else if (strcmp(*argv, "br") == 0) {
+			NEXT_ARG();
+			if (br)
+				return duparg("br", *argv);
+			br = *argv;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (file)
+				return duparg("file", *argv);
+			file = *argv;
 		} else if (strcmp(*argv, "guard") == 0) {
 			NEXT_ARG();
 			if (!on_off("guard", &bpdu_guard, *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "hairpin") == 0) {
 			NEXT_ARG();
 			if (!on_off("hairpin", &hairpin, *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "fastleave") == 0) {
 			NEXT_ARG();
 			if (!on_off("fastleave", &fast_leave, *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "root_block") == 0) {
 			NEXT_ARG();
 			if (!on_off("root_block", &root_block, *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "learning") == 0) {
 			NEXT_ARG();
 			if (!on_off("learning", &learning, *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "learning_sync") == 0) {
 			NEXT_ARG();
 			if (!on_off("learning_sync", &learning_sync, *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "flood") == 0) {
 			NEXT_ARG();
 			if (!on_off("flood", &flood, *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "mcast_flood") == 0) {
 			NEXT_ARG();
 			if (!on_off("mcast_flood", &mcast_flood, *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "cost") == 0) {
 			NEXT_ARG();
 			cost = atoi(*argv);
@@ -357,7 +555,7 @@ static int brlink_modify(int argc, char **argv)
 				if (state == nstates) {
 					fprintf(stderr,
 						"Error: invalid STP port state\n");
-					return -1;
+					goto out;
 				}
 			}
 		} else if (strcmp(*argv, "hwmode") == 0) {
@@ -370,7 +568,7 @@ static int brlink_modify(int argc, char **argv)
 			else {
 				fprintf(stderr,
 					"Mode argument must be \"vepa\" or \"veb\".\n");
-				return -1;
+				goto out;
 			}
 		} else if (strcmp(*argv, "self") == 0) {
 			flags |= BRIDGE_FLAGS_SELF;
@@ -380,27 +578,47 @@ static int brlink_modify(int argc, char **argv)
 			NEXT_ARG();
 			if (!on_off("neigh_suppress", &neigh_suppress,
 				    *argv))
-				return -1;
+				goto out;
 		} else if (strcmp(*argv, "vlan_tunnel") == 0) {
 			NEXT_ARG();
 			if (!on_off("vlan_tunnel", &vlan_tunnel,
 				    *argv))
-				return -1;
+				goto out;
 		} else {
 			return usage();
 		}
 		argc--; argv++;
 	}
-	if (d == NULL) {
+	if (d == NULL && br == NULL && file == NULL) {
 		fprintf(stderr, "Device is a required argument.\n");
-		return -1;
+		goto out;
 	}
 
+	if (br) {
+		ps.master = ll_name_to_index(br);
+		if (!ps.master) {
+			nodev(br);
+			goto out;
+		}
+	}
+	if (file && br_sync_read(file, port_set_line, &ps) < 0)
+		goto out;
+	/* an empty file is no port, not all of them */
+	if ((d || file) && !ps.nnames && !ps.npatterns) {
+		fprintf(stderr, "No port matches.\n");
+		goto out;
+	}
 
-	req.ifm.ifi_index = ll_name_to_index(d);
-	if (req.ifm.ifi_index == 0) {
-		fprintf(stderr, "Cannot find bridge device \"%s\"\n", d);
-		return -1;
+	/* one device by name is looked up, the rest comes from a dump */
+	if (ps.nnames == 1 && !ps.npatterns && !ps.master) {
+		d = ps.names[0];
+		req.ifm.ifi_index = ll_name_to_index(d);
+		if (req.ifm.ifi_index == 0) {
+			fprintf(stderr, "Cannot find bridge device \"%s\"\n", d);
+			goto out;
+		}
+	} else if (port_set_resolve(&ps) < 0) {
+		goto out;
 	}
 
 	/* Nested PROTINFO attribute.  Contains: port flags, cost, priority and
@@ -464,15 +682,38 @@ static int brlink_modify(int argc, char **argv)
 		addattr_nest_end(&req.n, nest);
 	}
 
-	if (rtnl_talk(&rth, &req.n, NULL) < 0)
-		return -1;
+	if (!ps.count) {
+		if (rtnl_talk(&rth, &req.n, NULL) == 0)
+			ret = 0;
+		goto out;
+	}
 
-	return 0;
+	/* the same request for every port, only the index differs */
+	if (br_sync_begin(&tx) < 0) {
+		perror("Cannot pipeline requests");
+		goto out;
+	}
+	for (i = 0; i < ps.count; i++) {
+		req.ifm.ifi_index = ps.ifindex[i];
+		req.n.nlmsg_flags = NLM_F_REQUEST;
+		if (rtnl_talk(&rth, &req.n, NULL) < 0)
+			tx.errors++;
+	}
+	ret = br_sync_end(&tx);
+	if (ret > 0)
+		fprintf(stderr, "%d of %u ports were not changed\n",
+			ret, ps.count);
+	ret = ret ? -1 : 0;
+out:
+	port_set_free(&ps);
+	return ret;
 }
 
 static int brlink_show(int argc, char **argv)
 {
-	char *filter_dev = NULL;
+	char *filter_dev = NULL, *filter_br = NULL;
+
+	ll_init_map(&rth);
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
@@ -480,21 +721,31 @@ static int brlink_show(int argc, char **argv)
 			if (filter_dev)
 				return duparg("dev", *argv);
 			filter_dev = *argv;
+		} else if (strcmp(*argv, "br") == 0) {
+			NEXT_ARG();
+			if (filter_br)
+				return duparg("br", *argv);
+			filter_br = *argv;
 		}
 		argc--; argv++;
 	}
 
+	filter_index = filter_master = 0;
 	if (filter_dev) {
 		filter_index = ll_name_to_index(filter_dev);
 		if (!filter_index)
 			return nodev(filter_dev);
 	}
+	/* the bridge dump takes no filters, the ports are picked here */
+	if (filter_br) {
+		filter_master = ll_name_to_index(filter_br);
+		if (!filter_master)
+			return nodev(filter_br);
+	}
 
 	if (show_details) {
 		if (rtnl_wilddump_req_filter(&rth, PF_BRIDGE, RTM_GETLINK,
-					     (compress_vlans ?
-					      RTEXT_FILTER_BRVLAN_COMPRESSED :
-					      RTEXT_FILTER_BRVLAN)) < 0) {
+					     RTEXT_FILTER_BRVLAN_COMPRESSED) < 0) {
 			perror("Cannon send dump request");
 			iprt_exit(1);
 		}
@@ -519,7 +770,6 @@ static int brlink_show(int argc, char **argv)
 
 int do_link(int argc, char **argv)
 {
-	ll_init_map(&rth);
 	if (argc > 0) {
 		if (matches(*argv, "set") == 0 ||
 		    matches(*argv, "change") == 0)
@@ -32,6 +32,7 @@ static int usage(void)
 {
 	fprintf(stderr, "Usage: bridge mdb { add | del } dev DEV port PORT grp GROUP [permanent | temp] [vid VID]\n");
 	fprintf(stderr, "       bridge mdb {show} [ dev DEV ] [ vid VID ]\n");
+	fprintf(stderr, "       bridge mdb sync dev DEV file FILE\n");
 	iprt_exit(-1);
 }
 
@@ -43,7 +44,7 @@ static bool is_temp_mcast_rtr(__u8 type)
 static const char *format_timer(__u32 ticks)
 {
 	struct timeval tv;
-	static char tbuf[32];
+	static __thread char tbuf[32];
 
 	__jiffies_to_tv(&tv, ticks);
 	snprintf(tbuf, sizeof(tbuf), "%4lu.%.2lu",
@@ -270,6 +271,8 @@ static int mdb_show(int argc, char **argv)
 {
 	char *filter_dev = NULL;
 
+	ll_init_map(&rth);
+
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
@@ -311,26 +314,17 @@ static int mdb_show(int argc, char **argv)
 	return 0;
 }
 
-static int mdb_modify(int cmd, int flags, int argc, char **argv)
+/* an entry, with its port resolved, and the bridge it is given for */
+static int mdb_parse(struct br_mdb_entry *entry, char **d, int cmd,
+		     int argc, char **argv)
 {
-	struct {
-		struct nlmsghdr	n;
-		struct br_port_msg	bpm;
-		char			buf[1024];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct br_port_msg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.bpm.family = PF_BRIDGE,
-	};
-	struct br_mdb_entry entry = {};
-	char *d = NULL, *p = NULL, *grp = NULL;
+	char *p = NULL, *grp = NULL;
 	short vid = 0;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
-			d = *argv;
+			*d = *argv;
 		} else if (strcmp(*argv, "grp") == 0) {
 			NEXT_ARG();
 			grp = *argv;
@@ -339,7 +333,7 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 			p = *argv;
 		} else if (strcmp(*argv, "permanent") == 0) {
 			if (cmd == RTM_NEWMDB)
-				entry.state |= MDB_PERMANENT;
+				entry->state |= MDB_PERMANENT;
 		} else if (strcmp(*argv, "temp") == 0) {
 			;/* nothing */
 		} else if (strcmp(*argv, "vid") == 0) {
@@ -352,30 +346,44 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 		argc--; argv++;
 	}
 
-	if (d == NULL || grp == NULL || p == NULL) {
-		fprintf(stderr, "Device, group address and port name are required arguments.\n");
+	if (grp == NULL || p == NULL) {
+		fprintf(stderr, "Group address and port name are required arguments.\n");
 		return -1;
 	}
 
-	req.bpm.ifindex = ll_name_to_index(d);
-	if (!req.bpm.ifindex)
-		return nodev(d);
-
-	entry.ifindex = ll_name_to_index(p);
-	if (!entry.ifindex)
+	entry->ifindex = ll_name_to_index(p);
+	if (!entry->ifindex)
 		return nodev(p);
 
-	if (!inet_pton(AF_INET, grp, &entry.addr.u.ip4)) {
-		if (!inet_pton(AF_INET6, grp, &entry.addr.u.ip6)) {
+	if (!inet_pton(AF_INET, grp, &entry->addr.u.ip4)) {
+		if (!inet_pton(AF_INET6, grp, &entry->addr.u.ip6)) {
 			fprintf(stderr, "Invalid address \"%s\"\n", grp);
 			return -1;
 		} else
-			entry.addr.proto = htons(ETH_P_IPV6);
+			entry->addr.proto = htons(ETH_P_IPV6);
 	} else
-		entry.addr.proto = htons(ETH_P_IP);
+		entry->addr.proto = htons(ETH_P_IP);
 
-	entry.vid = vid;
-	addattr_l(&req.n, sizeof(req), MDBA_SET_ENTRY, &entry, sizeof(entry));
+	entry->vid = vid;
+	return 0;
+}
+
+static int mdb_send(int cmd, int flags, int br_ifindex,
+		    const struct br_mdb_entry *entry)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct br_port_msg	bpm;
+		char			buf[1024];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct br_port_msg)),
+		.n.nlmsg_flags = NLM_F_REQUEST | flags,
+		.n.nlmsg_type = cmd,
+		.bpm.family = PF_BRIDGE,
+		.bpm.ifindex = br_ifindex,
+	};
+
+	addattr_l(&req.n, sizeof(req), MDBA_SET_ENTRY, entry, sizeof(*entry));
 
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		return -1;
@@ -383,15 +391,305 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 	return 0;
 }
 
-int do_mdb(int argc, char **argv)
+static int mdb_modify(int cmd, int flags, int argc, char **argv)
 {
-	ll_init_map(&rth);
+	struct br_mdb_entry entry = {};
+	char *d = NULL;
+	int br_ifindex;
+
+	if (mdb_parse(&entry, &d, cmd, argc, argv))
+		return -1;
+
+	if (d == NULL) {
+		fprintf(stderr, "Device, group address and port name are required arguments.\n");
+		return -1;
+	}
+
+	br_ifindex = ll_name_to_index(d);
+	if (!br_ifindex)
+		return nodev(d);
+
+	return mdb_send(cmd, flags, br_ifindex, &entry);
+}
+
+/*
+ * mdb sync: make the permanent entries of a bridge those of a file.
+ * Snooped entries are left alone, but are enough for a temp line. The
+ * kernel has no replace for mdb entries, one in the wrong state is
+ * deleted and added again.
+ */
+struct mdb_key {
+	__u32	ifindex;
+	__u16	vid;
+	__u16	proto;
+	__u8	addr[16];
+};
+
+struct mdb_sync_ent {
+	struct mdb_sync_ent	*next;
+	struct mdb_key		key;
+	struct br_mdb_entry	entry;
+	bool			seen;
+	bool			replace;
+};
+
+struct mdb_sync {
+	int			ifindex;
+	struct mdb_sync_ent	*ents;
+	unsigned int		count;
+	unsigned int		size;
+	struct mdb_sync_ent	**hash;
+	unsigned int		mask;
+	struct br_mdb_entry	*del;
+	unsigned int		ndel;
+	unsigned int		del_size;
+};
+
+static void mdb_sync_key(const struct br_mdb_entry *e, struct mdb_key *k)
+{
+	memset(k, 0, sizeof(*k));
+	k->ifindex = e->ifindex;
+	k->vid = e->vid;
+	k->proto = e->addr.proto;
+	if (e->addr.proto == htons(ETH_P_IP))
+		memcpy(k->addr, &e->addr.u.ip4, sizeof(e->addr.u.ip4));
+	else
+		memcpy(k->addr, &e->addr.u.ip6, sizeof(e->addr.u.ip6));
+}
+
+static struct mdb_sync_ent *mdb_sync_find(const struct mdb_sync *ms,
+					  const struct mdb_key *k)
+{
+	struct mdb_sync_ent *e;
+
+	for (e = ms->hash[br_sync_hash(k, sizeof(*k)) & ms->mask]; e;
+	     e = e->next)
+		if (!memcmp(&e->key, k, sizeof(*k)))
+			return e;
+	return NULL;
+}
+
+static int mdb_sync_line(int argc, char **argv, void *arg)
+{
+	struct mdb_sync *ms = arg;
+	struct mdb_sync_ent *e;
+	char *d = NULL;
+
+	if (ms->count == ms->size) {
+		unsigned int size = ms->size ? 2 * ms->size : 256;
+
+		e = realloc(ms->ents, size * sizeof(*e));
+		if (!e) {
+			fprintf(stderr, "Cannot allocate mdb entries\n");
+			return -1;
+		}
+		ms->ents = e;
+		ms->size = size;
+	}
+
+	e = &ms->ents[ms->count];
+	memset(e, 0, sizeof(*e));
+	if (mdb_parse(&e->entry, &d, RTM_NEWMDB, argc, argv))
+		return -1;
+	if (d) {
+		fprintf(stderr, "dev goes on the sync command line, not in the file.\n");
+		return -1;
+	}
+	mdb_sync_key(&e->entry, &e->key);
+	ms->count++;
+	return 0;
+}
 
+static int mdb_sync_index(struct mdb_sync *ms)
+{
+	unsigned int size = 256, i, h;
+
+	while (size < ms->count)
+		size <<= 1;
+	ms->mask = size - 1;
+	ms->hash = calloc(size, sizeof(*ms->hash));
+	if (!ms->hash)
+		return -1;
+
+	for (i = 0; i < ms->count; i++) {
+		struct mdb_sync_ent *e = &ms->ents[i], *old;
+
+		old = mdb_sync_find(ms, &e->key);
+		if (old) {
+			old->entry.state = e->entry.state;
+			e->seen = true;
+			continue;
+		}
+		h = br_sync_hash(&e->key, sizeof(e->key)) & ms->mask;
+		e->next = ms->hash[h];
+		ms->hash[h] = e;
+	}
+	return 0;
+}
+
+static int mdb_sync_entry(struct mdb_sync *ms, struct br_mdb_entry *be)
+{
+	struct mdb_sync_ent *e;
+	struct mdb_key k;
+
+	mdb_sync_key(be, &k);
+	e = mdb_sync_find(ms, &k);
+	if (e) {
+		e->seen = true;
+		/* a snooped entry stands for a temp one */
+		if ((be->state & MDB_PERMANENT) != e->entry.state &&
+		    e->entry.state & MDB_PERMANENT)
+			e->replace = true;
+		return 0;
+	}
+	if (!(be->state & MDB_PERMANENT))
+		return 0;
+
+	if (ms->ndel == ms->del_size) {
+		unsigned int size = ms->del_size ? 2 * ms->del_size : 256;
+		struct br_mdb_entry *del;
+
+		del = realloc(ms->del, size * sizeof(*del));
+		if (!del)
+			return -1;
+		ms->del = del;
+		ms->del_size = size;
+	}
+	ms->del[ms->ndel] = *be;
+	ms->del[ms->ndel++].state = 0;
+	return 0;
+}
+
+static int mdb_sync_dump_cb(const struct sockaddr_nl *who,
+			    struct nlmsghdr *n, void *arg)
+{
+	struct mdb_sync *ms = arg;
+	struct br_port_msg *r = NLMSG_DATA(n);
+	struct rtattr *tb[MDBA_MAX + 1], *i, *j;
+	int rem, rem2;
+
+	if (n->nlmsg_type != RTM_GETMDB ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*r)) ||
+	    r->ifindex != ms->ifindex)
+		return 0;
+
+	parse_rtattr(tb, MDBA_MAX, MDBA_RTA(r),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (!tb[MDBA_MDB])
+		return 0;
+
+	rem = RTA_PAYLOAD(tb[MDBA_MDB]);
+	for (i = RTA_DATA(tb[MDBA_MDB]); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		rem2 = RTA_PAYLOAD(i);
+		for (j = RTA_DATA(i); RTA_OK(j, rem2); j = RTA_NEXT(j, rem2)) {
+			if (RTA_PAYLOAD(j) < sizeof(struct br_mdb_entry))
+				continue;
+			if (mdb_sync_entry(ms, RTA_DATA(j)) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int mdb_sync(int argc, char **argv)
+{
+	struct mdb_sync ms = {};
+	char *d = NULL, *file = NULL;
+	struct br_sync_tx tx;
+	unsigned int i;
+	int ret = -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			d = *argv;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			file = *argv;
+		} else {
+			if (matches(*argv, "help") == 0)
+				return usage();
+			return invarg("unknown argument", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (d == NULL || file == NULL) {
+		fprintf(stderr, "Device and file are required arguments.\n");
+		return -1;
+	}
+
+	ms.ifindex = ll_name_to_index(d);
+	if (!ms.ifindex)
+		return nodev(d);
+
+	if (br_sync_read(file, mdb_sync_line, &ms) < 0)
+		goto out;
+	if (mdb_sync_index(&ms) < 0) {
+		fprintf(stderr, "Cannot allocate mdb index\n");
+		goto out;
+	}
+
+	if (rtnl_wilddump_request(&rth, PF_BRIDGE, RTM_GETMDB) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, mdb_sync_dump_cb, &ms) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	if (br_sync_begin(&tx) < 0) {
+		fprintf(stderr, "Cannot pipeline requests\n");
+		goto out;
+	}
+	for (i = 0; i < ms.count; i++) {
+		struct mdb_sync_ent *e = &ms.ents[i];
+
+		if (e->seen && !e->replace)
+			continue;
+		/* a replace is told by its add, the delete goes uncounted */
+		if (e->replace) {
+			struct br_mdb_entry old = e->entry;
+
+			old.state = 0;
+			br_sync_kind(&tx, BR_SYNC_OTHER);
+			if (mdb_send(RTM_DELMDB, 0, ms.ifindex, &old) < 0)
+				break;
+		}
+		br_sync_kind(&tx, e->replace ? BR_SYNC_REPLACE : BR_SYNC_ADD);
+		if (mdb_send(RTM_NEWMDB, NLM_F_CREATE | NLM_F_EXCL,
+			     ms.ifindex, &e->entry) < 0)
+			break;
+	}
+	for (i = 0; i < ms.ndel; i++) {
+		br_sync_kind(&tx, BR_SYNC_DELETE);
+		if (mdb_send(RTM_DELMDB, 0, ms.ifindex, &ms.del[i]) < 0)
+			break;
+	}
+	ret = br_sync_end(&tx);
+
+	if (show_stats)
+		printf("added %u replaced %u deleted %u failed %u\n",
+		       br_sync_done(&tx, BR_SYNC_ADD),
+		       br_sync_done(&tx, BR_SYNC_REPLACE),
+		       br_sync_done(&tx, BR_SYNC_DELETE), tx.errors);
+out:
+	free(ms.ents);
+	free(ms.hash);
+	free(ms.del);
+	return ret ? -1 : 0;
+}
+
+int do_mdb(int argc, char **argv)
+{
 	if (argc > 0) {
 		if (matches(*argv, "add") == 0)
 			return mdb_modify(RTM_NEWMDB, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1);
 		if (matches(*argv, "delete") == 0)
 			return mdb_modify(RTM_DELMDB, 0, argc-1, argv+1);
+		if (matches(*argv, "sync") == 0)
+			return mdb_sync(argc-1, argv+1);
 
 		if (matches(*argv, "show") == 0 ||
 		    matches(*argv, "lst") == 0 ||
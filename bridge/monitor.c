@@ -12,6 +12,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/socket.h>
@@ -20,9 +21,12 @@
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
 #include <linux/neighbour.h>
+#include <linux/if_ether.h>
 #include <string.h>
 
 #include "utils.h"
+#include "json_print.h"
+#include "rt_names.h"
 #include "br_common.h"
 
 
@@ -30,7 +34,8 @@ int prefix_banner;
 
 static int usage(void)
 {
-	fprintf(stderr, "Usage: bridge monitor [file | link | fdb | mdb | all]\n");
+	fprintf(stderr, "Usage: bridge monitor [file | link | fdb | mdb | all] [ lag SECONDS ]\n");
+	fprintf(stderr, "       bridge monitor fdb summary [ interval SECONDS ] [ top COUNT ] [ dev DEV ] [ file FILE ]\n");
 	iprt_exit(-1);
 }
 
@@ -39,32 +44,37 @@ static int accept_msg(const struct sockaddr_nl *who,
 		      struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = arg;
+	int err;
 
-	if (timestamp)
+	if (timestamp && !is_json_context())
 		print_timestamp(fp);
 
 	switch (n->nlmsg_type) {
 	case RTM_NEWLINK:
 	case RTM_DELLINK:
-		if (prefix_banner)
+		if (prefix_banner && !is_json_context())
 			fprintf(fp, "[LINK]");
 
 		return print_linkinfo(who, n, arg);
 
 	case RTM_NEWNEIGH:
 	case RTM_DELNEIGH:
-		if (prefix_banner)
+		if (prefix_banner && !is_json_context())
 			fprintf(fp, "[NEIGH]");
 		return print_fdb(who, n, arg);
 
 	case RTM_NEWMDB:
 	case RTM_DELMDB:
-		if (prefix_banner)
+		if (prefix_banner && !is_json_context())
 			fprintf(fp, "[MDB]");
-		return print_mdb(who, n, arg);
+		open_json_object(NULL);
+		err = print_mdb(who, n, arg);
+		close_json_object();
+		return err;
 
 	case NLMSG_TSTAMP:
-		print_nlmsg_timestamp(fp, n);
+		if (!is_json_context())
+			print_nlmsg_timestamp(fp, n);
 		return 0;
 
 	default:
@@ -72,13 +82,394 @@ static int accept_msg(const struct sockaddr_nl *who,
 	}
 }
 
+/*
+ * "bridge monitor fdb summary": count fdb events per port instead of
+ * printing them. Only the ndmsg header, NDA_LLADDR, NDA_VLAN and
+ * NDA_MASTER are decoded. The port each MAC was last seen on lives in a
+ * fixed-size table, probed a few slots deep, so that a MAC turning up
+ * on another port counts as a move; when the slots are all taken the
+ * MAC that moved least gives up its slot. Each interval prints the
+ * counters and the MACs that moved most, then starts again from zero.
+ * MACs moving between ports many times a second are the sign of a loop.
+ */
+#define FSUM_SLOTS	65536	/* MACs remembered, a power of two */
+#define FSUM_PROBE	8
+
+struct fsum_port {
+	__u64		events;
+	__u64		learned;
+	__u64		aged;
+	__u64		moved_in;
+	__u64		moved_out;
+	__u64		updated;
+};
+
+struct fsum_mac {
+	int		master;		/* 0 if the slot is free */
+	int		port;
+	__u16		vlan;
+	__u8		mac[ETH_ALEN];
+	bool		present;
+	__u32		moves;		/* in this interval */
+	int		from;		/* the port of the last move */
+};
+
+struct fdb_summary {
+	struct fsum_port	*ports;
+	unsigned int		size;
+	struct fsum_mac		*macs;
+	__u64			events;
+	__u64			moves;
+	unsigned int		overflows;
+	unsigned int		top;
+	int			ifindex;
+	double			interval;
+	struct timespec		last;
+	struct timespec		next;
+};
+
+static struct fsum_port *fsum_port(struct fdb_summary *fs, int ifindex)
+{
+	if (ifindex >= fs->size) {
+		unsigned int size = fs->size ? fs->size : 1024;
+		struct fsum_port *ports;
+
+		while (size <= ifindex)
+			size *= 2;
+		ports = realloc(fs->ports, size * sizeof(*ports));
+		if (!ports)
+			return NULL;
+		memset(ports + fs->size, 0,
+		       (size - fs->size) * sizeof(*ports));
+		fs->ports = ports;
+		fs->size = size;
+	}
+	return &fs->ports[ifindex];
+}
+
+/* the slot of a MAC, NULL with *pfree set to one it may take over */
+static struct fsum_mac *fsum_mac_find(struct fdb_summary *fs, int master,
+				      __u16 vlan, const __u8 *mac,
+				      struct fsum_mac **pfree)
+{
+	__u32 h = 2166136261U ^ master ^ (vlan << 16);
+	struct fsum_mac *victim = NULL;
+	unsigned int i;
+
+	for (i = 0; i < ETH_ALEN; i++)
+		h = (h ^ mac[i]) * 16777619U;
+
+	for (i = 0; i < FSUM_PROBE; i++) {
+		struct fsum_mac *m = &fs->macs[(h + i) & (FSUM_SLOTS - 1)];
+
+		if (!m->master) {
+			*pfree = m;
+			return NULL;
+		}
+		if (m->master == master && m->vlan == vlan &&
+		    !memcmp(m->mac, mac, ETH_ALEN))
+			return m;
+		if (!victim || m->moves < victim->moves)
+			victim = m;
+	}
+	*pfree = victim;
+	return NULL;
+}
+
+static int fsum_event(struct fdb_summary *fs, struct nlmsghdr *n)
+{
+	struct ndmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	const __u8 *mac = NULL;
+	struct fsum_mac *m, *slot;
+	struct fsum_port *p, *from;
+	struct rtattr *rta;
+	int master = 0;
+	__u16 vlan = 0;
+
+	if (len < 0 || r->ndm_family != AF_BRIDGE)
+		return 0;
+	if (fs->ifindex && r->ndm_ifindex != fs->ifindex)
+		return 0;
+
+	for (rta = NDA_RTA(r); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case NDA_LLADDR:
+			if (RTA_PAYLOAD(rta) == ETH_ALEN)
+				mac = RTA_DATA(rta);
+			break;
+		case NDA_VLAN:
+			vlan = rta_getattr_u16(rta);
+			break;
+		case NDA_MASTER:
+			master = rta_getattr_u32(rta);
+			break;
+		}
+	}
+	if (!mac)
+		return 0;
+
+	p = fsum_port(fs, r->ndm_ifindex);
+	if (!p) {
+		perror("Cannot count fdb events");
+		return -1;
+	}
+	fs->events++;
+	p->events++;
+
+	/* only entries of a bridge move, those of the device itself don't */
+	if (!master || (r->ndm_flags & NTF_SELF)) {
+		if (n->nlmsg_type == RTM_DELNEIGH)
+			p->aged++;
+		else
+			p->updated++;
+		return 0;
+	}
+
+	m = fsum_mac_find(fs, master, vlan, mac, &slot);
+	if (!m) {
+		m = slot;
+		m->master = master;
+		m->vlan = vlan;
+		memcpy(m->mac, mac, ETH_ALEN);
+		m->port = r->ndm_ifindex;
+		m->present = false;
+		m->moves = 0;
+		m->from = 0;
+	}
+
+	if (n->nlmsg_type == RTM_DELNEIGH) {
+		if (m->port == r->ndm_ifindex)
+			m->present = false;
+		p->aged++;
+	} else if (!m->present) {
+		m->present = true;
+		m->port = r->ndm_ifindex;
+		p->learned++;
+	} else if (m->port != r->ndm_ifindex) {
+		from = fsum_port(fs, m->port);
+		if (!from)
+			return -1;
+		/* the table may have moved, look p up again */
+		p = &fs->ports[r->ndm_ifindex];
+		from->moved_out++;
+		p->moved_in++;
+		m->from = m->port;
+		m->port = r->ndm_ifindex;
+		m->moves++;
+		fs->moves++;
+	} else {
+		p->updated++;
+	}
+	return 0;
+}
+
+static void fsum_print_top(struct fdb_summary *fs)
+{
+	struct fsum_mac **top;
+	unsigned int i, n = 0;
+
+	if (!fs->top || !fs->moves)
+		return;
+	top = calloc(fs->top, sizeof(*top));
+	if (!top)
+		return;
+
+	/* keep the top N sorted by insertion, N is small */
+	for (i = 0; i < FSUM_SLOTS; i++) {
+		struct fsum_mac *m = &fs->macs[i];
+		unsigned int j;
+
+		if (!m->master || !m->moves)
+			continue;
+		if (n == fs->top && m->moves <= top[n - 1]->moves)
+			continue;
+		j = n < fs->top ? n++ : n - 1;
+		for (; j > 0 && top[j - 1]->moves < m->moves; j--)
+			top[j] = top[j - 1];
+		top[j] = m;
+	}
+
+	open_json_array(PRINT_JSON, "top");
+	print_string(PRINT_FP, NULL, "%s", "  top:\n");
+	for (i = 0; i < n; i++) {
+		const struct fsum_mac *m = top[i];
+		SPRINT_BUF(b1);
+
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "mac", "    %s",
+			     ll_addr_n2a(m->mac, ETH_ALEN, 0, b1, sizeof(b1)));
+		if (m->vlan)
+			print_uint(PRINT_ANY, "vlan", " vlan %u", m->vlan);
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "master",
+				   " master %s", ll_index_to_name(m->master));
+		print_uint(PRINT_ANY, "moves", " moves %u", m->moves);
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "from",
+				   " %s", ll_index_to_name(m->from));
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "to",
+				   " -> %s\n", ll_index_to_name(m->port));
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	free(top);
+}
+
+static void fsum_print(struct fdb_summary *fs, double elapsed)
+{
+	unsigned int i;
+
+	open_json_object(NULL);
+	if (timestamp && !is_json_context())
+		print_timestamp(stdout);
+	print_float(PRINT_ANY, "interval", "fdb summary %.2fs:", elapsed);
+	print_u64(PRINT_ANY, "events", " %" PRIu64 " events,", fs->events);
+	print_u64(PRINT_ANY, "moves", " %" PRIu64 " moves,", fs->moves);
+	print_uint(PRINT_ANY, "overflows", " %u overflows\n", fs->overflows);
+
+	open_json_array(PRINT_JSON, "ports");
+	for (i = 0; i < fs->size; i++) {
+		const struct fsum_port *p = &fs->ports[i];
+
+		if (!p->events && !p->moved_out)
+			continue;
+		open_json_object(NULL);
+		print_int(PRINT_JSON, "ifindex", NULL, i);
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname", "  %s:",
+				   ll_index_to_name(i));
+		print_u64(PRINT_ANY, "events", " events %" PRIu64, p->events);
+		print_u64(PRINT_ANY, "learned", " learned %" PRIu64,
+			  p->learned);
+		print_u64(PRINT_ANY, "aged", " aged %" PRIu64, p->aged);
+		print_u64(PRINT_ANY, "moved_in", " moved in %" PRIu64,
+			  p->moved_in);
+		print_u64(PRINT_ANY, "moved_out", " out %" PRIu64,
+			  p->moved_out);
+		print_u64(PRINT_ANY, "updated", " updated %" PRIu64 "\n",
+			  p->updated);
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+
+	fsum_print_top(fs);
+	close_json_object();
+	if (!is_json_context())
+		printf("\n");
+	fflush(stdout);
+}
+
+static void fsum_reset(struct fdb_summary *fs)
+{
+	unsigned int i;
+
+	if (fs->ports)
+		memset(fs->ports, 0, fs->size * sizeof(*fs->ports));
+	for (i = 0; i < FSUM_SLOTS; i++)
+		fs->macs[i].moves = 0;
+	fs->events = fs->moves = 0;
+	fs->overflows = 0;
+}
+
+static int fsum_tick(struct rtnl_handle *rth, void *arg)
+{
+	struct fdb_summary *fs = arg;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_diff(&now, &fs->next) < 0)
+		return 0;
+
+	fsum_print(fs, timespec_diff(&now, &fs->last));
+	fsum_reset(fs);
+	fs->last = now;
+	while (timespec_diff(&now, &fs->next) >= 0)
+		timespec_add(&fs->next, fs->interval);
+	return 0;
+}
+
+static int fsum_overflow(struct rtnl_handle *rth, void *arg)
+{
+	struct fdb_summary *fs = arg;
+
+	fs->overflows++;
+	return 0;
+}
+
+static int fsum_accept(const struct sockaddr_nl *who,
+		       struct rtnl_ctrl_data *ctrl,
+		       struct nlmsghdr *n, void *arg)
+{
+	if (n->nlmsg_type == RTM_NEWLINK || n->nlmsg_type == RTM_DELLINK)
+		return ll_remember_index(who, n, NULL);
+	if (n->nlmsg_type == RTM_NEWNEIGH || n->nlmsg_type == RTM_DELNEIGH)
+		return fsum_event(arg, n);
+	return 0;
+}
+
+static int fdb_summary(FILE *fp, double interval, unsigned int top,
+		       int ifindex)
+{
+	struct fdb_summary fs = {
+		.interval = interval,
+		.top = top,
+		.ifindex = ifindex,
+	};
+	struct timeval tv;
+	double wake;
+	int ret;
+
+	fs.macs = calloc(FSUM_SLOTS, sizeof(*fs.macs));
+	if (!fs.macs) {
+		perror("Cannot allocate fdb table");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &fs.last);
+
+	/* a saved stream is summed up as one interval */
+	if (fp) {
+		ret = rtnl_from_file(fp, fsum_accept, &fs);
+		if (ret == 0) {
+			struct timespec now;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			fsum_print(&fs, timespec_diff(&now, &fs.last));
+		}
+		goto out;
+	}
+
+	fs.next = fs.last;
+	timespec_add(&fs.next, interval);
+
+	wake = interval < 0.1 ? interval : 0.1;
+	tv.tv_sec = 0;
+	tv.tv_usec = wake * 1000000;
+	if (setsockopt(rth.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		perror("SO_RCVTIMEO");
+		ret = -1;
+		goto out;
+	}
+	rth.tick = fsum_tick;
+	rth.resync = fsum_overflow;
+
+	ret = rtnl_listen(&rth, fsum_accept, &fs);
+out:
+	free(fs.macs);
+	free(fs.ports);
+	return ret;
+}
+
 int do_monitor(int argc, char **argv)
 {
-	char *file = NULL;
+	char *file = NULL, *dev = NULL;
 	unsigned int groups = ~RTMGRP_TC;
 	int llink = 0;
 	int lneigh = 0;
 	int lmdb = 0;
+	int summary = 0;
+	double interval = 1;
+	unsigned int top = 10;
+	int ifindex = 0;
+	double lag = 0;
 
 	rtnl_close(&rth);
 
@@ -95,6 +486,23 @@ int do_monitor(int argc, char **argv)
 		} else if (matches(*argv, "mdb") == 0) {
 			lmdb = 1;
 			groups = 0;
+		} else if (strcmp(*argv, "summary") == 0) {
+			summary = 1;
+		} else if (summary && matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (summary && strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&top, *argv, 0))
+				return invarg("invalid top count", *argv);
+		} else if (summary && strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			dev = *argv;
+		} else if (strcmp(*argv, "lag") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&lag, *argv))
+				return invarg("invalid lag interval", *argv);
 		} else if (strcmp(*argv, "all") == 0) {
 			groups = ~RTMGRP_TC;
 			prefix_banner = 1;
@@ -118,23 +526,58 @@ int do_monitor(int argc, char **argv)
 		groups |= nl_mgrp(RTNLGRP_MDB);
 	}
 
+	if (summary) {
+		if (llink || lmdb || !lneigh) {
+			fprintf(stderr, "\"summary\" only applies to fdb events.\n");
+			iprt_exit(-1);
+		}
+		if (dev) {
+			ifindex = ll_name_to_index(dev);
+			if (!ifindex)
+				return nodev(dev);
+		}
+		/* links only to keep port names current */
+		groups = nl_mgrp(RTNLGRP_NEIGH) | nl_mgrp(RTNLGRP_LINK);
+	}
+
+	/* Events never end, so don't wrap them in an array */
+	if (json)
+		ndjson = 1;
+	new_json_obj(json);
+
 	if (file) {
 		FILE *fp;
 		int err;
 
+		if (lag) {
+			fprintf(stderr, "\"lag\" only applies to live events.\n");
+			iprt_exit(-1);
+		}
 		fp = fopen(file, "r");
 		if (fp == NULL) {
 			perror("Cannot fopen");
 			iprt_exit(-1);
 		}
-		err = rtnl_from_file(fp, accept_msg, stdout);
+		if (summary)
+			err = fdb_summary(fp, interval, top, ifindex);
+		else
+			err = rtnl_from_file(fp, accept_msg, stdout);
 		fclose(fp);
+		delete_json_obj();
 		return err;
 	}
 
 	if (rtnl_open(&rth, groups) < 0)
 		iprt_exit(1);
 	ll_init_map(&rth);
+	if (lag && rtnl_lag_enable(&rth, lag * 1000, stdout, json) < 0)
+		iprt_exit(1);
+
+	if (summary) {
+		if (fdb_summary(NULL, interval, top, ifindex) < 0)
+			iprt_exit(2);
+		return 0;
+	}
 
 	if (rtnl_listen(&rth, accept_msg, stdout) < 0)
 		iprt_exit(2);
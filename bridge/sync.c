@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Helpers shared by "fdb sync" and "mdb sync": reading the file of
+ * wanted entries, and sending the changes pipelined, which "vlan add"
+ * and "vlan del" for many ports use too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libnetlink.h"
+#include "br_common.h"
+#include "utils.h"
+
+/*
+ * Call fn for every line of the file, split into arguments as batch
+ * lines are. Stops at the first line fn fails.
+ */
+int br_sync_read(const char *name, br_sync_line_fn fn, void *arg)
+{
+	int saved_lineno = cmdlineno;
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+	FILE *f;
+
+	f = strcmp(name, "-") ? fopen(name, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, f) != -1) {
+		char *largv[100];
+		int largc;
+
+		largc = makeargs(line, largv, 100);
+		if (!largc)
+			continue;
+		if (fn(largc, largv, arg)) {
+			fprintf(stderr, "Invalid entry %s:%d\n", name,
+				cmdlineno);
+			ret = -1;
+			break;
+		}
+	}
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+	cmdlineno = saved_lineno;
+	return ret;
+}
+
+static void br_sync_err(__u32 cookie, int error, void *arg)
+{
+	struct br_sync_tx *tx = arg;
+
+	tx->errors++;
+	if (cookie < BR_SYNC_KINDS)
+		tx->failed[cookie]++;
+}
+
+/*
+ * The changes go out through an rtnl_async queue of their own, so that
+ * what the kernel rejected can be counted from the acks. A pipelined
+ * batch's queue is flushed first, and its failures are its own lines'.
+ */
+int br_sync_begin(struct br_sync_tx *tx)
+{
+	memset(tx, 0, sizeof(*tx));
+	tx->flags = rth.flags & RTNL_HANDLE_F_ASYNC;
+	tx->outer = rth.async;
+	if (tx->outer && rtnl_async_flush(&rth) < 0)
+		return -1;
+
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, br_sync_err, tx) < 0) {
+		rth.async = tx->outer;
+		return -1;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC;
+	return 0;
+}
+
+/* count the request queued next as one of kind */
+void br_sync_kind(struct br_sync_tx *tx, int kind)
+{
+	rtnl_async_cookie(&rth, kind);
+	tx->sent[kind]++;
+}
+
+/* how many requests of kind the kernel took, once br_sync_end() is done */
+unsigned int br_sync_done(const struct br_sync_tx *tx, int kind)
+{
+	return tx->sent[kind] - tx->failed[kind];
+}
+
+/* returns how many requests the kernel rejected, or -1 */
+int br_sync_end(struct br_sync_tx *tx)
+{
+	int ret = rtnl_async_flush(&rth);
+
+	rtnl_async_end(&rth);
+	rth.async = tx->outer;
+	rth.flags = (rth.flags & ~RTNL_HANDLE_F_ASYNC) | tx->flags;
+	return ret < 0 ? -1 : tx->errors;
+}
+
+unsigned int br_sync_hash(const void *key, size_t len)
+{
+	const unsigned char *p = key;
+	unsigned int h = 2166136261U;
+
+	while (len--)
+		h = (h ^ *p++) * 16777619U;
+	return h;
+}
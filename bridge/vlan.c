@@ -1,7 +1,10 @@
 /* SPDX-License-Identifier: GPL-2.0 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <net/if.h>
@@ -21,39 +24,67 @@ static int show_vlan_tunnel_info = 0;
 static int usage(void)
 {
 	fprintf(stderr,
-		"Usage: bridge vlan { add | del } vid VLAN_ID dev DEV [ tunnel_info id TUNNEL_ID ]\n"
+		"Usage: bridge vlan { add | del } vid VLAN_LIST dev DEV [ dev DEV ... ]\n"
+		"                                                     [ tunnel_info id TUNNEL_LIST ]\n"
 		"                                                     [ pvid ] [ untagged ]\n"
 		"                                                     [ self ] [ master ]\n"
 		"       bridge vlan { show } [ dev DEV ] [ vid VLAN_ID ]\n"
-		"       bridge vlan { tunnelshow } [ dev DEV ] [ vid VLAN_ID ]\n");
+		"       bridge vlan { tunnelshow } [ dev DEV ] [ vid VLAN_ID ]\n"
+		"       bridge vlan sample [ dev DEV ] [ vid VLAN_ID ] [ interval SECONDS ]\n"
+		"                          [ count COUNT ] [ top COUNT ]\n"
+		"where  VLAN_LIST, TUNNEL_LIST := { ID | ID-ID }[,...]\n");
 	iprt_exit(-1);
 }
 
-static int parse_tunnel_info(int *argcp, char ***argvp, __u32 *tun_id_start,
-			     __u32 *tun_id_end)
+#define VLAN_MOD_RANGES	4096
+#define VLAN_MOD_DEVS	512
+
+struct vlan_range {
+	__u32	start;
+	__u32	end;
+};
+
+/*
+ * A comma separated list of ids and ranges, "10,20-29,100", as given to
+ * vid and tunnel_info id. Returns how many, or -1.
+ */
+static int parse_ranges(char *arg, struct vlan_range *r, __u32 max,
+			const char *what)
+{
+	char *tok, *save = NULL;
+	int n = 0;
+
+	for (tok = strtok_r(arg, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *t = strchr(tok, '-');
+
+		if (n == VLAN_MOD_RANGES)
+			return invarg("too many ranges in", what);
+		if (t)
+			*t++ = '\0';
+		if (get_u32(&r[n].start, tok, 0) || r[n].start >= max)
+			return invarg("invalid", what);
+		r[n].end = r[n].start;
+		if (t && (get_u32(&r[n].end, t, 0) || r[n].end >= max ||
+			  r[n].end <= r[n].start))
+			return invarg("invalid range of", what);
+		n++;
+	}
+	if (!n)
+		return invarg("missing", what);
+	return n;
+}
+
+static int parse_tunnel_info(int *argcp, char ***argvp, struct vlan_range *r)
 {
 	char **argv = *argvp;
 	int argc = *argcp;
-	char *t;
+	int n;
 
 	NEXT_ARG();
 	if (!matches(*argv, "id")) {
 		NEXT_ARG();
-		t = strchr(*argv, '-');
-		if (t) {
-			*t = '\0';
-			if (get_u32(tun_id_start, *argv, 0) ||
-				    *tun_id_start >= 1u << 24)
-				return invarg("invalid tun id", *argv);
-			if (get_u32(tun_id_end, t + 1, 0) ||
-				    *tun_id_end >= 1u << 24)
-				return invarg("invalid tun id", *argv);
-
-		} else {
-			if (get_u32(tun_id_start, *argv, 0) ||
-				    *tun_id_start >= 1u << 24)
-				return invarg("invalid tun id", *argv);
-		}
+		n = parse_ranges(*argv, r, 1u << 24, "tun id");
 	} else {
 		return invarg("tunnel id expected", *argv);
 	}
@@ -61,7 +92,7 @@ static int parse_tunnel_info(int *argcp, char ***argvp, __u32 *tun_id_start,
 	*argcp = argc;
 	*argvp = argv;
 
-	return 0;
+	return n;
 }
 
 static int add_tunnel_info(struct nlmsghdr *n, int reqsize,
@@ -70,9 +101,10 @@ static int add_tunnel_info(struct nlmsghdr *n, int reqsize,
 	struct rtattr *tinfo;
 
 	tinfo = addattr_nest(n, reqsize, IFLA_BRIDGE_VLAN_TUNNEL_INFO);
-	addattr32(n, reqsize, IFLA_BRIDGE_VLAN_TUNNEL_ID, tun_id);
-	addattr32(n, reqsize, IFLA_BRIDGE_VLAN_TUNNEL_VID, vid);
-	addattr32(n, reqsize, IFLA_BRIDGE_VLAN_TUNNEL_FLAGS, flags);
+	if (addattr32(n, reqsize, IFLA_BRIDGE_VLAN_TUNNEL_ID, tun_id) ||
+	    addattr32(n, reqsize, IFLA_BRIDGE_VLAN_TUNNEL_VID, vid) ||
+	    addattr32(n, reqsize, IFLA_BRIDGE_VLAN_TUNNEL_FLAGS, flags))
+		return -1;
 
 	addattr_nest_end(n, tinfo);
 
@@ -80,88 +112,75 @@ static int add_tunnel_info(struct nlmsghdr *n, int reqsize,
 }
 
 static int add_tunnel_info_range(struct nlmsghdr *n, int reqsize,
-				 __u16 vid_start, int16_t vid_end,
-				 __u32 tun_id_start, __u32 tun_id_end)
+				 const struct vlan_range *vid,
+				 const struct vlan_range *tun)
 {
-	if (vid_end != -1 && (vid_end - vid_start) > 0) {
-		add_tunnel_info(n, reqsize, vid_start, tun_id_start,
-				BRIDGE_VLAN_INFO_RANGE_BEGIN);
+	if (vid->end > vid->start)
+		return add_tunnel_info(n, reqsize, vid->start, tun->start,
+				       BRIDGE_VLAN_INFO_RANGE_BEGIN) ||
+		       add_tunnel_info(n, reqsize, vid->end, tun->end,
+				       BRIDGE_VLAN_INFO_RANGE_END);
 
-		add_tunnel_info(n, reqsize, vid_end, tun_id_end,
-				BRIDGE_VLAN_INFO_RANGE_END);
-	} else {
-		add_tunnel_info(n, reqsize, vid_start, tun_id_start, 0);
-	}
-
-	return 0;
+	return add_tunnel_info(n, reqsize, vid->start, tun->start, 0);
 }
 
-static int add_vlan_info_range(struct nlmsghdr *n, int reqsize, __u16 vid_start,
-			       int16_t vid_end, __u16 flags)
+static int add_vlan_info_range(struct nlmsghdr *n, int reqsize,
+			       const struct vlan_range *vid, __u16 flags)
 {
 	struct bridge_vlan_info vinfo = {};
 
 	vinfo.flags = flags;
-	vinfo.vid = vid_start;
-	if (vid_end != -1) {
+	vinfo.vid = vid->start;
+	if (vid->end > vid->start) {
 		/* send vlan range start */
-		addattr_l(n, reqsize, IFLA_BRIDGE_VLAN_INFO, &vinfo,
-			  sizeof(vinfo));
+		vinfo.flags |= BRIDGE_VLAN_INFO_RANGE_BEGIN;
+		if (addattr_l(n, reqsize, IFLA_BRIDGE_VLAN_INFO, &vinfo,
+			      sizeof(vinfo)))
+			return -1;
 		vinfo.flags &= ~BRIDGE_VLAN_INFO_RANGE_BEGIN;
 
 		/* Now send the vlan range end */
 		vinfo.flags |= BRIDGE_VLAN_INFO_RANGE_END;
-		vinfo.vid = vid_end;
-		addattr_l(n, reqsize, IFLA_BRIDGE_VLAN_INFO, &vinfo,
-			  sizeof(vinfo));
-	} else {
-		addattr_l(n, reqsize, IFLA_BRIDGE_VLAN_INFO, &vinfo,
-			  sizeof(vinfo));
+		vinfo.vid = vid->end;
 	}
 
-	return 0;
+	return addattr_l(n, reqsize, IFLA_BRIDGE_VLAN_INFO, &vinfo,
+			 sizeof(vinfo));
 }
 
+/*
+ * vid and tunnel_info take lists of ranges, all of which go in the one
+ * message, and dev may be given more than once. The messages for many
+ * devices are pipelined, as a batch's are.
+ */
 static int vlan_modify(int cmd, int argc, char **argv)
 {
 	struct {
 		struct nlmsghdr	n;
 		struct ifinfomsg	ifm;
-		char			buf[1024];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST,
-		.n.nlmsg_type = cmd,
-		.ifm.ifi_family = PF_BRIDGE,
-	};
-	char *d = NULL;
-	short vid = -1;
-	short vid_end = -1;
+		char			buf[65536];
+	} *req;
+	static struct vlan_range vids[VLAN_MOD_RANGES], tuns[VLAN_MOD_RANGES];
+	char *devs[VLAN_MOD_DEVS];
+	int ndev = 0, nvid = 0, ntun = 0, i, j;
 	struct rtattr *afspec;
 	struct bridge_vlan_info vinfo = {};
 	bool tunnel_info_set = false;
 	unsigned short flags = 0;
-	__u32 tun_id_start = 0;
-	__u32 tun_id_end = 0;
+	struct br_sync_tx tx;
+	int ret = 0;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
-			d = *argv;
+			if (ndev == VLAN_MOD_DEVS)
+				return invarg("too many devices", *argv);
+			devs[ndev++] = *argv;
 		} else if (strcmp(*argv, "vid") == 0) {
-			char *p;
-
 			NEXT_ARG();
-			p = strchr(*argv, '-');
-			if (p) {
-				*p = '\0';
-				p++;
-				vid = atoi(*argv);
-				vid_end = atoi(p);
-				vinfo.flags |= BRIDGE_VLAN_INFO_RANGE_BEGIN;
-			} else {
-				vid = atoi(*argv);
-			}
+			nvid = parse_ranges(*argv, vids, 4096, "VLAN ID");
+			if (nvid < 0)
+				return -1;
 		} else if (strcmp(*argv, "self") == 0) {
 			flags |= BRIDGE_FLAGS_SELF;
 		} else if (strcmp(*argv, "master") == 0) {
@@ -171,9 +190,8 @@ static int vlan_modify(int cmd, int argc, char **argv)
 		} else if (strcmp(*argv, "untagged") == 0) {
 			vinfo.flags |= BRIDGE_VLAN_INFO_UNTAGGED;
 		} else if (strcmp(*argv, "tunnel_info") == 0) {
-				if (parse_tunnel_info(&argc, &argv,
-						      &tun_id_start,
-						      &tun_id_end))
+				ntun = parse_tunnel_info(&argc, &argv, tuns);
+				if (ntun < 0)
 					return -1;
 				tunnel_info_set = true;
 		} else {
@@ -183,53 +201,92 @@ static int vlan_modify(int cmd, int argc, char **argv)
 		argc--; argv++;
 	}
 
-	if (d == NULL || vid == -1) {
+	if (!ndev || !nvid) {
 		fprintf(stderr, "Device and VLAN ID are required arguments.\n");
 		return -1;
 	}
 
-	req.ifm.ifi_index = ll_name_to_index(d);
-	if (req.ifm.ifi_index == 0) {
-		fprintf(stderr, "Cannot find bridge device \"%s\"\n", d);
-		return -1;
-	}
-
-	if (vid >= 4096) {
-		fprintf(stderr, "Invalid VLAN ID \"%hu\"\n", vid);
+	if ((vinfo.flags & BRIDGE_VLAN_INFO_PVID) &&
+	    (nvid > 1 || vids[0].end > vids[0].start)) {
+		fprintf(stderr,
+			"pvid cannot be configured for a vlan range\n");
 		return -1;
 	}
 
-	if (vinfo.flags & BRIDGE_VLAN_INFO_RANGE_BEGIN) {
-		if (vid_end == -1 || vid_end >= 4096 || vid >= vid_end) {
-			fprintf(stderr, "Invalid VLAN range \"%hu-%hu\"\n",
-				vid, vid_end);
+	if (tunnel_info_set) {
+		if (ntun != nvid) {
+			fprintf(stderr, "Each VLAN range needs a tunnel id range.\n");
 			return -1;
 		}
-		if (vinfo.flags & BRIDGE_VLAN_INFO_PVID) {
-			fprintf(stderr,
-				"pvid cannot be configured for a vlan range\n");
-			return -1;
+		for (i = 0; i < nvid; i++) {
+			if (vids[i].end - vids[i].start !=
+			    tuns[i].end - tuns[i].start) {
+				fprintf(stderr,
+					"Invalid tunnel id range for VLAN range \"%u-%u\"\n",
+					vids[i].start, vids[i].end);
+				return -1;
+			}
 		}
 	}
 
-	afspec = addattr_nest(&req.n, sizeof(req), IFLA_AF_SPEC);
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return -1;
 
-	if (flags)
-		addattr16(&req.n, sizeof(req), IFLA_BRIDGE_FLAGS, flags);
+	if (ndev > 1 && br_sync_begin(&tx) < 0) {
+		fprintf(stderr, "Cannot pipeline requests\n");
+		free(req);
+		return -1;
+	}
 
-	if (tunnel_info_set)
-		add_tunnel_info_range(&req.n, sizeof(req), vid, vid_end,
-				      tun_id_start, tun_id_end);
-	else
-		add_vlan_info_range(&req.n, sizeof(req), vid, vid_end,
-				    vinfo.flags);
+	for (j = 0; j < ndev; j++) {
+		memset(req, 0, sizeof(*req));
+		req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+		req->n.nlmsg_flags = NLM_F_REQUEST;
+		req->n.nlmsg_type = cmd;
+		req->ifm.ifi_family = PF_BRIDGE;
+
+		req->ifm.ifi_index = ll_name_to_index(devs[j]);
+		if (req->ifm.ifi_index == 0) {
+			fprintf(stderr, "Cannot find bridge device \"%s\"\n",
+				devs[j]);
+			ret = -1;
+			break;
+		}
 
-	addattr_nest_end(&req.n, afspec);
+		afspec = addattr_nest(&req->n, sizeof(*req), IFLA_AF_SPEC);
 
-	if (rtnl_talk(&rth, &req.n, NULL) < 0)
-		return -1;
+		if (flags)
+			addattr16(&req->n, sizeof(*req), IFLA_BRIDGE_FLAGS,
+				  flags);
 
-	return 0;
+		for (i = 0; i < nvid; i++) {
+			if (tunnel_info_set)
+				ret = add_tunnel_info_range(&req->n,
+							    sizeof(*req),
+							    &vids[i], &tuns[i]);
+			else
+				ret = add_vlan_info_range(&req->n, sizeof(*req),
+							  &vids[i],
+							  vinfo.flags);
+			if (ret)
+				break;
+		}
+		if (ret)
+			break;
+
+		addattr_nest_end(&req->n, afspec);
+
+		if (rtnl_talk(&rth, &req->n, NULL) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ndev > 1 && br_sync_end(&tx))
+		ret = -1;
+	free(req);
+	return ret;
 }
 
 /* In order to use this function for both filtering and non-filtering cases
@@ -270,6 +327,22 @@ static void print_range(const char *name, __u16 start, __u16 id)
 
 }
 
+static void print_vlan_tunnel_range(FILE *fp, int ifindex,
+				    __u16 vid_start, __u16 vid,
+				    __u32 tunid_start, __u32 tunid)
+{
+	if (filter_vlan)
+		print_vlan_port(fp, ifindex);
+
+	open_json_object(NULL);
+	print_range("vlan", vid_start, vid);
+	print_range("tunid", tunid_start, tunid);
+	close_json_object();
+
+	if (!is_json_context())
+		fprintf(fp, "\n");
+}
+
 static void print_vlan_tunnel_info(FILE *fp, struct rtattr *tb, int ifindex)
 {
 	struct rtattr *i, *list = tb;
@@ -322,17 +395,21 @@ static void print_vlan_tunnel_info(FILE *fp, struct rtattr *tb, int ifindex)
 		if (tunnel_flags & BRIDGE_VLAN_INFO_RANGE_BEGIN)
 			continue;
 
-		if (filter_vlan)
-			print_vlan_port(fp, ifindex);
-
-		open_json_object(NULL);
-		print_range("vlan", last_vid_start, tunnel_vid);
-		print_range("tunid", last_tunid_start, tunnel_id);
-		close_json_object();
-
-		if (!is_json_context())
-			fprintf(fp, "\n");
-
+		if (compress_vlans) {
+			print_vlan_tunnel_range(fp, ifindex,
+						last_vid_start, tunnel_vid,
+						last_tunid_start, tunnel_id);
+			continue;
+		}
+		for (; last_vid_start <= tunnel_vid;
+		     last_vid_start++, last_tunid_start++) {
+			if (filter_vlan && filter_vlan != last_vid_start)
+				continue;
+			print_vlan_tunnel_range(fp, ifindex,
+						last_vid_start, last_vid_start,
+						last_tunid_start,
+						last_tunid_start);
+		}
 	}
 	close_json_array(PRINT_JSON, NULL);
 }
@@ -532,11 +609,318 @@ static int print_vlan_stats(const struct sockaddr_nl *who,
 	return 0;
 }
 
+/*
+ * vlan sample: the per VLAN counters of the bridges and their ports,
+ * every interval. One request, built once, asks for the xstats of
+ * masters and of ports in the same dump. The previous counters of a
+ * port live in an array indexed by VLAN ID, so a sample is a lookup
+ * per VLAN, and only the busiest ones are printed with "top".
+ */
+#ifndef VLAN_N_VID
+#define VLAN_N_VID	4096
+#endif
+
+struct vsamp_ent {
+	__u64		rx_bytes;
+	__u64		rx_packets;
+	__u64		tx_bytes;
+	__u64		tx_packets;
+	unsigned int	round;		/* sample it was last seen in */
+};
+
+struct vsamp_delta {
+	int		ifindex;
+	__u16		vid;
+	__u16		flags;
+	__u64		rx_bytes;
+	__u64		rx_packets;
+	__u64		tx_bytes;
+	__u64		tx_packets;
+};
+
+struct vlan_sampler {
+	struct vsamp_ent	**ports;	/* by ifindex, then vid */
+	unsigned int		size;
+	unsigned int		round;
+	double			elapsed;
+	unsigned int		top;
+	struct vsamp_delta	*best;		/* the top, busiest first */
+	unsigned int		nbest;
+};
+
+static void vsamp_print(const struct vsamp_delta *d, double elapsed)
+{
+	open_json_object(NULL);
+	print_int(PRINT_JSON, "ifindex", NULL, d->ifindex);
+	print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname", "%-16s",
+			   ll_index_to_name(d->ifindex));
+	print_hu(PRINT_ANY, "vid", " %4hu", d->vid);
+	print_vlan_flags(d->flags);
+	print_float(PRINT_JSON, "interval", NULL, elapsed);
+	print_u64(PRINT_ANY, "rx_bytes", " rx %" PRIu64 "B", d->rx_bytes);
+	print_u64(PRINT_ANY, "rx_packets", " %" PRIu64 "p", d->rx_packets);
+	print_float(PRINT_ANY, "rx_bps", " %.0fbit/s",
+		    d->rx_bytes * 8 / elapsed);
+	print_float(PRINT_ANY, "rx_pps", " %.0fpps", d->rx_packets / elapsed);
+	print_u64(PRINT_ANY, "tx_bytes", " tx %" PRIu64 "B", d->tx_bytes);
+	print_u64(PRINT_ANY, "tx_packets", " %" PRIu64 "p", d->tx_packets);
+	print_float(PRINT_ANY, "tx_bps", " %.0fbit/s",
+		    d->tx_bytes * 8 / elapsed);
+	print_float(PRINT_ANY, "tx_pps", " %.0fpps\n",
+		    d->tx_packets / elapsed);
+	close_json_object();
+}
+
+/* keep the top N sorted by insertion, N is small */
+static void vsamp_rank(struct vlan_sampler *s, const struct vsamp_delta *d)
+{
+	__u64 bytes = d->rx_bytes + d->tx_bytes;
+	unsigned int j;
+
+	if (s->nbest == s->top &&
+	    bytes <= s->best[s->nbest - 1].rx_bytes +
+		     s->best[s->nbest - 1].tx_bytes)
+		return;
+	j = s->nbest < s->top ? s->nbest++ : s->nbest - 1;
+	for (; j > 0 && s->best[j - 1].rx_bytes + s->best[j - 1].tx_bytes <
+			bytes; j--)
+		s->best[j] = s->best[j - 1];
+	s->best[j] = *d;
+}
+
+static int vsamp_vlan(struct vlan_sampler *s, int ifindex,
+		      const struct bridge_vlan_xstats *vstats)
+{
+	struct vsamp_ent *e, cur;
+
+	if (vstats->vid >= VLAN_N_VID)
+		return 0;
+	if (ifindex >= s->size) {
+		unsigned int size = s->size ? s->size : 1024;
+		struct vsamp_ent **ports;
+
+		while (size <= ifindex)
+			size *= 2;
+		ports = realloc(s->ports, size * sizeof(*ports));
+		if (!ports)
+			return -1;
+		memset(ports + s->size, 0, (size - s->size) * sizeof(*ports));
+		s->ports = ports;
+		s->size = size;
+	}
+	if (!s->ports[ifindex]) {
+		s->ports[ifindex] = calloc(VLAN_N_VID, sizeof(struct vsamp_ent));
+		if (!s->ports[ifindex])
+			return -1;
+	}
+	e = &s->ports[ifindex][vstats->vid];
+
+	cur = (struct vsamp_ent) {
+		.rx_bytes	= vstats->rx_bytes,
+		.rx_packets	= vstats->rx_packets,
+		.tx_bytes	= vstats->tx_bytes,
+		.tx_packets	= vstats->tx_packets,
+		.round		= s->round,
+	};
+	/* the counters went back, the VLAN was deleted and added again */
+	if (e->round && e->round + 1 == s->round &&
+	    cur.rx_bytes >= e->rx_bytes && cur.rx_packets >= e->rx_packets &&
+	    cur.tx_bytes >= e->tx_bytes && cur.tx_packets >= e->tx_packets) {
+		struct vsamp_delta d = {
+			.ifindex	= ifindex,
+			.vid		= vstats->vid,
+			.flags		= vstats->flags,
+			.rx_bytes	= cur.rx_bytes - e->rx_bytes,
+			.rx_packets	= cur.rx_packets - e->rx_packets,
+			.tx_bytes	= cur.tx_bytes - e->tx_bytes,
+			.tx_packets	= cur.tx_packets - e->tx_packets,
+		};
+
+		if (s->top)
+			vsamp_rank(s, &d);
+		else
+			vsamp_print(&d, s->elapsed);
+	}
+	*e = cur;
+	return 0;
+}
+
+static int vsamp_xstats(struct vlan_sampler *s, int ifindex,
+			struct rtattr *attr)
+{
+	struct rtattr *brtb[LINK_XSTATS_TYPE_MAX+1];
+	struct rtattr *i, *list;
+	int rem;
+
+	parse_rtattr(brtb, LINK_XSTATS_TYPE_MAX, RTA_DATA(attr),
+		     RTA_PAYLOAD(attr));
+	if (!brtb[LINK_XSTATS_TYPE_BRIDGE])
+		return 0;
+
+	list = brtb[LINK_XSTATS_TYPE_BRIDGE];
+	rem = RTA_PAYLOAD(list);
+	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		const struct bridge_vlan_xstats *vstats = RTA_DATA(i);
+
+		if (i->rta_type != BRIDGE_XSTATS_VLAN ||
+		    RTA_PAYLOAD(i) < sizeof(*vstats))
+			continue;
+		if (filter_vlan && filter_vlan != vstats->vid)
+			continue;
+		/* as in print_vlan_stats_attr(), ports come as slaves */
+		if ((vstats->flags & BRIDGE_VLAN_INFO_MASTER) &&
+		    !(vstats->flags & BRIDGE_VLAN_INFO_BRENTRY))
+			continue;
+		if (vsamp_vlan(s, ifindex, vstats) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int vsamp_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		       void *arg)
+{
+	struct vlan_sampler *s = arg;
+	struct if_stats_msg *ifsm = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_STATS_MAX+1];
+	int len = n->nlmsg_len;
+
+	if (n->nlmsg_type != RTM_NEWSTATS)
+		return 0;
+
+	len -= NLMSG_LENGTH(sizeof(*ifsm));
+	if (len < 0)
+		return -1;
+
+	if (ifsm->ifindex <= 0 ||
+	    (filter_index && filter_index != ifsm->ifindex))
+		return 0;
+
+	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
+	if (tb[IFLA_STATS_LINK_XSTATS] &&
+	    vsamp_xstats(s, ifsm->ifindex, tb[IFLA_STATS_LINK_XSTATS]) < 0)
+		return -1;
+	if (tb[IFLA_STATS_LINK_XSTATS_SLAVE] &&
+	    vsamp_xstats(s, ifsm->ifindex,
+			 tb[IFLA_STATS_LINK_XSTATS_SLAVE]) < 0)
+		return -1;
+	return 0;
+}
+
+static int vlan_sample(int argc, char **argv)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct if_stats_msg	ifsm;
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct if_stats_msg)),
+		.n.nlmsg_type = RTM_GETSTATS,
+		.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+		.ifsm.family = AF_UNSPEC,
+		.ifsm.filter_mask =
+			IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_XSTATS) |
+			IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_XSTATS_SLAVE),
+	};
+	struct vlan_sampler s = {};
+	struct timespec next, now, last;
+	char *filter_dev = NULL;
+	unsigned int count = 0, i;
+	double interval = 1;
+	int ret = 0;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (filter_dev)
+				return duparg("dev", *argv);
+			filter_dev = *argv;
+		} else if (strcmp(*argv, "vid") == 0) {
+			NEXT_ARG();
+			if (filter_vlan)
+				return duparg("vid", *argv);
+			filter_vlan = atoi(*argv);
+		} else if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				return invarg("invalid count", *argv);
+		} else if (strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&s.top, *argv, 0))
+				return invarg("invalid top count", *argv);
+		} else {
+			if (matches(*argv, "help") == 0)
+				return usage();
+			return invarg("unknown argument", *argv);
+		}
+		argc--; argv++;
+	}
+
+	ll_init_map(&rth);
+	if (filter_dev) {
+		filter_index = ll_name_to_index(filter_dev);
+		if (!filter_index)
+			return nodev(filter_dev);
+	}
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, names may go stale\n");
+
+	if (s.top) {
+		s.best = calloc(s.top, sizeof(*s.best));
+		if (!s.best)
+			return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last = next;
+	for (s.round = 1; ; s.round++) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		s.elapsed = timespec_diff(&now, &last);
+		last = now;
+		ll_sync_map(&rth);
+
+		/* the first sample only primes the counters */
+		if (s.round > 1)
+			new_json_obj(json);
+		s.nbest = 0;
+		req.n.nlmsg_seq = rth.dump = ++rth.seq;
+		if (rtnl_send(&rth, &req, sizeof(req)) < 0) {
+			perror("Cannot send dump request");
+			ret = -1;
+		} else if (rtnl_dump_filter(&rth, vsamp_nlmsg, &s) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = -1;
+		}
+		for (i = 0; i < s.nbest; i++)
+			vsamp_print(&s.best[i], s.elapsed);
+		delete_json_obj();
+		if (s.round > 1 && !json)
+			printf("\n");
+		fflush(stdout);
+
+		if (ret < 0 || (count && s.round > count))
+			break;
+
+		sample_wait(&next, interval);
+	}
+
+	for (i = 0; i < s.size; i++)
+		free(s.ports[i]);
+	free(s.ports);
+	free(s.best);
+	return ret;
+}
+
 static int vlan_show(int argc, char **argv)
 {
 	char *filter_dev = NULL;
 	int ret = 0;
 
+	ll_init_map(&rth);
+
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
@@ -563,9 +947,7 @@ static int vlan_show(int argc, char **argv)
 
 	if (!show_stats) {
 		if (rtnl_wilddump_req_filter(&rth, PF_BRIDGE, RTM_GETLINK,
-					     (compress_vlans ?
-					      RTEXT_FILTER_BRVLAN_COMPRESSED :
-					      RTEXT_FILTER_BRVLAN)) < 0) {
+					     RTEXT_FILTER_BRVLAN_COMPRESSED) < 0) {
 			perror("Cannont send dump request");
 			iprt_exit(1);
 		}
@@ -624,6 +1006,20 @@ static int vlan_show(int argc, char **argv)
 	return 0;
 }
 
+static void print_vlan_range(__u16 start, __u16 vid, __u16 flags)
+{
+	open_json_object(NULL);
+	print_range("vlan", start, vid);
+
+	print_vlan_flags(flags);
+	close_json_object();
+}
+
+/*
+ * Dumps are always requested compressed, a range per run of VLANs with
+ * the same flags; without -compressvlans the ranges are expanded here,
+ * one VLAN at a time.
+ */
 void print_vlan_info(FILE *fp, struct rtattr *tb)
 {
 	struct rtattr *i, *list = tb;
@@ -652,11 +1048,17 @@ void print_vlan_info(FILE *fp, struct rtattr *tb)
 		else if (vcheck_ret == 0)
 			continue;
 
-		open_json_object(NULL);
-		print_range("vlan", last_vid_start, vinfo->vid);
-
-		print_vlan_flags(vinfo->flags);
-		close_json_object();
+		if (compress_vlans) {
+			print_vlan_range(last_vid_start, vinfo->vid,
+					 vinfo->flags);
+			continue;
+		}
+		for (; last_vid_start <= vinfo->vid; last_vid_start++) {
+			if (filter_vlan && filter_vlan != last_vid_start)
+				continue;
+			print_vlan_range(last_vid_start, last_vid_start,
+					 vinfo->flags);
+		}
 	}
 
 	close_json_array(PRINT_ANY, "\n");
@@ -664,8 +1066,6 @@ void print_vlan_info(FILE *fp, struct rtattr *tb)
 
 int do_vlan(int argc, char **argv)
 {
-	ll_init_map(&rth);
-
 	if (argc > 0) {
 		if (matches(*argv, "add") == 0)
 			return vlan_modify(RTM_SETLINK, argc-1, argv+1);
@@ -675,6 +1075,8 @@ int do_vlan(int argc, char **argv)
 		    matches(*argv, "lst") == 0 ||
 		    matches(*argv, "list") == 0)
 			return vlan_show(argc-1, argv+1);
+		if (matches(*argv, "sample") == 0)
+			return vlan_sample(argc-1, argv+1);
 		if (matches(*argv, "tunnelshow") == 0) {
 			show_vlan_tunnel_info = 1;
 			return vlan_show(argc-1, argv+1);
@@ -27,6 +27,7 @@
 #include "mnlg.h"
 #include "json_writer.h"
 #include "utils.h"
+#include "arena.h"
 
 #define ESWITCH_MODE_LEGACY "legacy"
 #define ESWITCH_MODE_SWITCHDEV "switchdev"
@@ -107,6 +108,15 @@ static int _mnlg_socket_sndrcv(struct mnlg_socket *nlg,
 {
 	int err;
 
+	/* in a pipelined batch, what only wants an ack is acked later */
+	if (!data_cb && mnlg_socket_async(nlg)) {
+		if (mnlg_socket_queue(nlg, nlh) < 0) {
+			pr_err("Failed to queue request\n");
+			return -ENOMEM;
+		}
+		return 0;
+	}
+
 	err = mnlg_socket_send(nlg, nlh);
 	if (err < 0) {
 		pr_err("Failed to call mnlg_socket_send\n");
@@ -128,46 +138,28 @@ static int _mnlg_socket_group_add(struct mnlg_socket *nlg,
 	return 0;
 }
 
+/* Ports with a netdev, hashed both by the netdev name and by their
+ * handle. Entries and their names are carved out of an arena, freed as
+ * a whole.
+ */
 struct ifname_map {
-	struct list_head list;
+	struct ifname_map *next;	/* in the list the dump built */
+	struct ifname_map *name_next;
+	struct ifname_map *port_next;
 	char *bus_name;
 	char *dev_name;
 	uint32_t port_index;
 	char *ifname;
 };
 
-static struct ifname_map *ifname_map_alloc(const char *bus_name,
-					   const char *dev_name,
-					   uint32_t port_index,
-					   const char *ifname)
-{
-	struct ifname_map *ifname_map;
-
-	ifname_map = calloc(1, sizeof(*ifname_map));
-	if (!ifname_map)
-		return NULL;
-	ifname_map->bus_name = strdup(bus_name);
-	ifname_map->dev_name = strdup(dev_name);
-	ifname_map->port_index = port_index;
-	ifname_map->ifname = strdup(ifname);
-	if (!ifname_map->bus_name || !ifname_map->dev_name ||
-	    !ifname_map->ifname) {
-		free(ifname_map->ifname);
-		free(ifname_map->dev_name);
-		free(ifname_map->bus_name);
-		free(ifname_map);
-		return NULL;
-	}
-	return ifname_map;
-}
-
-static void ifname_map_free(struct ifname_map *ifname_map)
-{
-	free(ifname_map->ifname);
-	free(ifname_map->dev_name);
-	free(ifname_map->bus_name);
-	free(ifname_map);
-}
+struct ifname_index {
+	struct ifname_map *list;
+	unsigned int count;
+	struct ifname_map **by_name;
+	struct ifname_map **by_port;
+	unsigned int mask;
+	struct arena arena;
+};
 
 #define DL_OPT_HANDLE		BIT(0)
 #define DL_OPT_HANDLEP		BIT(1)
@@ -187,6 +179,9 @@ static void ifname_map_free(struct ifname_map *ifname_map)
 #define DL_OPT_ESWITCH_ENCAP_MODE	BIT(15)
 #define DL_OPT_RESOURCE_PATH	BIT(16)
 #define DL_OPT_RESOURCE_SIZE	BIT(17)
+#define DL_OPT_SAMPLE_INTERVAL	BIT(18)
+#define DL_OPT_SAMPLE_COUNT	BIT(19)
+#define DL_OPT_SAMPLE_WINDOW	BIT(20)
 
 struct dl_opts {
 	uint32_t present; /* flags of present items */
@@ -211,11 +206,15 @@ struct dl_opts {
 	uint32_t resource_size;
 	uint32_t resource_id;
 	bool resource_id_valid;
+	uint32_t sample_interval;	/* ms */
+	uint32_t sample_count;
+	uint32_t sample_window;
 };
 
 struct dl {
 	struct mnlg_socket *nlg;
-	struct list_head ifname_map_list;
+	struct ifname_index ifname_index;
+	bool ifname_map_stale;	/* ports were split or unsplit since */
 	int argc;
 	char **argv;
 	bool no_nice_names;
@@ -366,16 +365,37 @@ static int attr_cb(const struct nlattr *attr, void *data)
 	return MNL_CB_OK;
 }
 
+/* FNV-1a, over the strings with their terminating nul and the index */
+static uint32_t ifname_hash_str(uint32_t hash, const char *str)
+{
+	do {
+		hash ^= (unsigned char)*str;
+		hash *= 16777619;
+	} while (*str++);
+	return hash;
+}
+
+static uint32_t ifname_hash_port(const char *bus_name, const char *dev_name,
+				 uint32_t port_index)
+{
+	uint32_t hash = ifname_hash_str(2166136261u, bus_name);
+	unsigned int i;
+
+	hash = ifname_hash_str(hash, dev_name);
+	for (i = 0; i < 4; i++) {
+		hash ^= (port_index >> (8 * i)) & 0xff;
+		hash *= 16777619;
+	}
+	return hash;
+}
+
 static int ifname_map_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
 	struct dl *dl = data;
+	struct ifname_index *idx = &dl->ifname_index;
 	struct ifname_map *ifname_map;
-	const char *bus_name;
-	const char *dev_name;
-	uint32_t port_ifindex;
-	const char *port_ifname;
 
 	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
 	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
@@ -385,28 +405,69 @@ static int ifname_map_cb(const struct nlmsghdr *nlh, void *data)
 	if (!tb[DEVLINK_ATTR_PORT_NETDEV_NAME])
 		return MNL_CB_OK;
 
-	bus_name = mnl_attr_get_str(tb[DEVLINK_ATTR_BUS_NAME]);
-	dev_name = mnl_attr_get_str(tb[DEVLINK_ATTR_DEV_NAME]);
-	port_ifindex = mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]);
-	port_ifname = mnl_attr_get_str(tb[DEVLINK_ATTR_PORT_NETDEV_NAME]);
-	ifname_map = ifname_map_alloc(bus_name, dev_name,
-				      port_ifindex, port_ifname);
+	ifname_map = arena_alloc(&idx->arena, sizeof(*ifname_map));
 	if (!ifname_map)
 		return MNL_CB_ERROR;
-	list_add(&ifname_map->list, &dl->ifname_map_list);
+	ifname_map->bus_name = arena_strdup(&idx->arena,
+			mnl_attr_get_str(tb[DEVLINK_ATTR_BUS_NAME]));
+	ifname_map->dev_name = arena_strdup(&idx->arena,
+			mnl_attr_get_str(tb[DEVLINK_ATTR_DEV_NAME]));
+	ifname_map->port_index = mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]);
+	ifname_map->ifname = arena_strdup(&idx->arena,
+			mnl_attr_get_str(tb[DEVLINK_ATTR_PORT_NETDEV_NAME]));
+	if (!ifname_map->bus_name || !ifname_map->dev_name ||
+	    !ifname_map->ifname)
+		return MNL_CB_ERROR;
+	ifname_map->next = idx->list;
+	idx->list = ifname_map;
+	idx->count++;
 
 	return MNL_CB_OK;
 }
 
 static void ifname_map_fini(struct dl *dl)
 {
-	struct ifname_map *ifname_map, *tmp;
+	struct ifname_index *idx = &dl->ifname_index;
+
+	arena_free(&idx->arena);
+	free(idx->by_name);
+	free(idx->by_port);
+	memset(idx, 0, sizeof(*idx));
+}
+
+/* Hash the ports the dump found, the latest first in each chain as the
+ * list has them, so that on a duplicate name the last port dumped wins.
+ */
+static int ifname_map_index(struct ifname_index *idx)
+{
+	struct ifname_map *ifname_map, **pp;
+	unsigned int size = 16;
+	uint32_t hash;
 
-	list_for_each_entry_safe(ifname_map, tmp,
-				 &dl->ifname_map_list, list) {
-		list_del(&ifname_map->list);
-		ifname_map_free(ifname_map);
+	while (size < idx->count)
+		size <<= 1;
+	idx->by_name = calloc(size, sizeof(*idx->by_name));
+	idx->by_port = calloc(size, sizeof(*idx->by_port));
+	if (!idx->by_name || !idx->by_port)
+		return -ENOMEM;
+	idx->mask = size - 1;
+
+	for (ifname_map = idx->list; ifname_map; ifname_map = ifname_map->next) {
+		hash = ifname_hash_str(2166136261u, ifname_map->ifname);
+		for (pp = &idx->by_name[hash & idx->mask]; *pp;
+		     pp = &(*pp)->name_next)
+			;
+		*pp = ifname_map;
+
+		hash = ifname_hash_port(ifname_map->bus_name,
+					ifname_map->dev_name,
+					ifname_map->port_index);
+		for (pp = &idx->by_port[hash & idx->mask]; *pp;
+		     pp = &(*pp)->port_next)
+			;
+		*pp = ifname_map;
 	}
+	return 0;
 }
 
 static int ifname_map_init(struct dl *dl)
@@ -414,12 +475,14 @@ static int ifname_map_init(struct dl *dl)
 	struct nlmsghdr *nlh;
 	int err;
 
-	INIT_LIST_HEAD(&dl->ifname_map_list);
+	memset(&dl->ifname_index, 0, sizeof(dl->ifname_index));
 
 	nlh = mnlg_msg_prepare(dl->nlg, DEVLINK_CMD_PORT_GET,
 			       NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP);
 
 	err = _mnlg_socket_sndrcv(dl->nlg, nlh, ifname_map_cb, dl);
+	if (!err)
+		err = ifname_map_index(&dl->ifname_index);
 	if (err) {
 		ifname_map_fini(dl);
 		return err;
@@ -427,13 +490,31 @@ static int ifname_map_init(struct dl *dl)
 	return 0;
 }
 
+/* A batch splitting ports goes on with the names the split made. Not
+ * called from lookups, those may run inside a dump on the same socket.
+ */
+static void ifname_map_sync(struct dl *dl)
+{
+	if (!dl->ifname_map_stale)
+		return;
+	dl->ifname_map_stale = false;
+	ifname_map_fini(dl);
+	if (ifname_map_init(dl))
+		pr_err("Failed to refresh index map\n");
+}
+
 static int ifname_map_lookup(struct dl *dl, const char *ifname,
 			     char **p_bus_name, char **p_dev_name,
 			     uint32_t *p_port_index)
 {
+	struct ifname_index *idx = &dl->ifname_index;
 	struct ifname_map *ifname_map;
+	uint32_t hash = ifname_hash_str(2166136261u, ifname);
 
-	list_for_each_entry(ifname_map, &dl->ifname_map_list, list) {
+	if (!idx->by_name)
+		return -ENOENT;
+	for (ifname_map = idx->by_name[hash & idx->mask]; ifname_map;
+	     ifname_map = ifname_map->name_next) {
 		if (strcmp(ifname, ifname_map->ifname) == 0) {
 			*p_bus_name = ifname_map->bus_name;
 			*p_dev_name = ifname_map->dev_name;
@@ -448,12 +529,17 @@ static int ifname_map_rev_lookup(struct dl *dl, const char *bus_name,
 				 const char *dev_name, uint32_t port_index,
 				 char **p_ifname)
 {
+	struct ifname_index *idx = &dl->ifname_index;
 	struct ifname_map *ifname_map;
+	uint32_t hash = ifname_hash_port(bus_name, dev_name, port_index);
 
-	list_for_each_entry(ifname_map, &dl->ifname_map_list, list) {
-		if (strcmp(bus_name, ifname_map->bus_name) == 0 &&
-		    strcmp(dev_name, ifname_map->dev_name) == 0 &&
-		    port_index == ifname_map->port_index) {
+	if (!idx->by_port)
+		return -ENOENT;
+	for (ifname_map = idx->by_port[hash & idx->mask]; ifname_map;
+	     ifname_map = ifname_map->port_next) {
+		if (port_index == ifname_map->port_index &&
+		    strcmp(bus_name, ifname_map->bus_name) == 0 &&
+		    strcmp(dev_name, ifname_map->dev_name) == 0) {
 			*p_ifname = ifname_map->ifname;
 			return 0;
 		}
@@ -973,6 +1059,27 @@ static int dl_argv_parse(struct dl *dl, uint32_t o_required,
 			if (err)
 				return err;
 			o_found |= DL_OPT_RESOURCE_SIZE;
+		} else if (dl_argv_match(dl, "interval") &&
+			   (o_all & DL_OPT_SAMPLE_INTERVAL)) {
+			dl_arg_inc(dl);
+			err = dl_argv_uint32_t(dl, &opts->sample_interval);
+			if (err)
+				return err;
+			o_found |= DL_OPT_SAMPLE_INTERVAL;
+		} else if (dl_argv_match(dl, "count") &&
+			   (o_all & DL_OPT_SAMPLE_COUNT)) {
+			dl_arg_inc(dl);
+			err = dl_argv_uint32_t(dl, &opts->sample_count);
+			if (err)
+				return err;
+			o_found |= DL_OPT_SAMPLE_COUNT;
+		} else if (dl_argv_match(dl, "window") &&
+			   (o_all & DL_OPT_SAMPLE_WINDOW)) {
+			dl_arg_inc(dl);
+			err = dl_argv_uint32_t(dl, &opts->sample_window);
+			if (err)
+				return err;
+			o_found |= DL_OPT_SAMPLE_WINDOW;
 		} else {
 			pr_err("Unknown option \"%s\"\n", dl_argv(dl));
 			return -EINVAL;
@@ -1787,6 +1894,7 @@ static int cmd_port_split(struct dl *dl)
 	if (err)
 		return err;
 
+	dl->ifname_map_stale = true;
 	return _mnlg_socket_sndrcv(dl->nlg, nlh, NULL, NULL);
 }
 
@@ -1802,6 +1910,7 @@ static int cmd_port_unsplit(struct dl *dl)
 	if (err)
 		return err;
 
+	dl->ifname_map_stale = true;
 	return _mnlg_socket_sndrcv(dl->nlg, nlh, NULL, NULL);
 }
 
@@ -1846,6 +1955,8 @@ static void cmd_sb_help(void)
 	pr_err("       devlink sb occupancy show { DEV | DEV/PORT_INDEX } [ sb SB_INDEX ]\n");
 	pr_err("       devlink sb occupancy snapshot DEV [ sb SB_INDEX ]\n");
 	pr_err("       devlink sb occupancy clearmax DEV [ sb SB_INDEX ]\n");
+	pr_err("       devlink sb occupancy sample DEV [ sb SB_INDEX ] [ interval MS ]\n");
+	pr_err("                                       [ count N ] [ window N ]\n");
 }
 
 static void pr_out_sb(struct dl *dl, struct nlattr **tb)
@@ -2554,6 +2665,410 @@ static int cmd_sb_occ_clearmax(struct dl *dl)
 	return _mnlg_socket_sndrcv(dl->nlg, nlh, NULL, NULL);
 }
 
+/*
+ * sb occupancy sample: take a snapshot and dump the occupancy every
+ * interval ms, and print per window of samples the largest, median,
+ * 90th and 99th percentile current occupancy of every port pool and
+ * tc, and the largest watermark the device kept over the window.
+ */
+enum occ_kind {
+	OCC_POOL,
+	OCC_ITC,
+	OCC_ETC,
+};
+
+static const char * const occ_kind_name[] = {
+	[OCC_POOL] = "pool",
+	[OCC_ITC] = "itc",
+	[OCC_ETC] = "etc",
+};
+
+struct occ_sample_ent {
+	struct occ_sample_ent *next;
+	uint32_t port_index;
+	uint16_t index;
+	uint8_t kind;
+	uint32_t bound_pool_index;
+	uint32_t max;		/* the device's, over the window */
+	unsigned int n;		/* samples in cur */
+	uint32_t cur[];		/* of the window's samples */
+};
+
+struct occ_sample {
+	struct dl *dl;
+	int err;
+	unsigned int window;
+	unsigned int pos;	/* samples taken in the window */
+	struct occ_sample_ent **hash;
+	unsigned int hash_mask;
+	struct occ_sample_ent **ents;	/* sorted unless !sorted */
+	unsigned int count;
+	unsigned int size;
+	bool sorted;
+};
+
+static unsigned int occ_sample_hash(const struct occ_sample *occ,
+				    uint32_t port_index, uint8_t kind,
+				    uint16_t index)
+{
+	uint32_t key = (port_index << 18) ^ (kind << 16) ^ index;
+
+	return (key * 2654435761u) & occ->hash_mask;
+}
+
+static int occ_sample_grow(struct occ_sample *occ)
+{
+	unsigned int size = occ->size ? 2 * occ->size : 256;
+	struct occ_sample_ent **hash, **ents;
+	unsigned int i;
+
+	ents = realloc(occ->ents, size * sizeof(*ents));
+	if (!ents)
+		return -ENOMEM;
+	occ->ents = ents;
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -ENOMEM;
+	free(occ->hash);
+	occ->hash = hash;
+	occ->hash_mask = size - 1;
+	occ->size = size;
+	for (i = 0; i < occ->count; i++) {
+		struct occ_sample_ent *ent = occ->ents[i];
+		unsigned int h = occ_sample_hash(occ, ent->port_index,
+						 ent->kind, ent->index);
+
+		ent->next = hash[h];
+		hash[h] = ent;
+	}
+	return 0;
+}
+
+static struct occ_sample_ent *occ_sample_get(struct occ_sample *occ,
+					     uint32_t port_index, uint8_t kind,
+					     uint16_t index)
+{
+	struct occ_sample_ent *ent;
+	unsigned int h;
+
+	if (occ->size) {
+		h = occ_sample_hash(occ, port_index, kind, index);
+		for (ent = occ->hash[h]; ent; ent = ent->next)
+			if (ent->port_index == port_index &&
+			    ent->kind == kind && ent->index == index)
+				return ent;
+	}
+
+	if (occ->count == occ->size && occ_sample_grow(occ))
+		return NULL;
+	ent = calloc(1, sizeof(*ent) + occ->window * sizeof(ent->cur[0]));
+	if (!ent)
+		return NULL;
+	ent->port_index = port_index;
+	ent->kind = kind;
+	ent->index = index;
+	h = occ_sample_hash(occ, port_index, kind, index);
+	ent->next = occ->hash[h];
+	occ->hash[h] = ent;
+	occ->ents[occ->count++] = ent;
+	occ->sorted = false;
+	return ent;
+}
+
+static void occ_sample_put(struct occ_sample *occ, struct nlattr **tb,
+			   uint8_t kind, uint16_t index)
+{
+	struct occ_sample_ent *ent;
+	uint32_t max;
+
+	ent = occ_sample_get(occ,
+			     mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]),
+			     kind, index);
+	if (!ent) {
+		occ->err = -ENOMEM;
+		return;
+	}
+	if (kind != OCC_POOL)
+		ent->bound_pool_index =
+			mnl_attr_get_u16(tb[DEVLINK_ATTR_SB_POOL_INDEX]);
+	/* a port dumped twice in a sample would overrun the window */
+	if (ent->n == occ->window)
+		return;
+	max = mnl_attr_get_u32(tb[DEVLINK_ATTR_SB_OCC_MAX]);
+	if (!ent->n || max > ent->max)
+		ent->max = max;
+	ent->cur[ent->n++] = mnl_attr_get_u32(tb[DEVLINK_ATTR_SB_OCC_CUR]);
+}
+
+static int cmd_sb_occ_sample_port_pool_cb(const struct nlmsghdr *nlh,
+					  void *data)
+{
+	struct occ_sample *occ = data;
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    !tb[DEVLINK_ATTR_PORT_INDEX] || !tb[DEVLINK_ATTR_SB_INDEX] ||
+	    !tb[DEVLINK_ATTR_SB_POOL_INDEX] ||
+	    !tb[DEVLINK_ATTR_SB_OCC_CUR] || !tb[DEVLINK_ATTR_SB_OCC_MAX])
+		return MNL_CB_ERROR;
+	if (!occ->err && dl_dump_filter(occ->dl, tb))
+		occ_sample_put(occ, tb, OCC_POOL,
+			       mnl_attr_get_u16(tb[DEVLINK_ATTR_SB_POOL_INDEX]));
+	return MNL_CB_OK;
+}
+
+static int cmd_sb_occ_sample_tc_pool_cb(const struct nlmsghdr *nlh,
+					void *data)
+{
+	struct occ_sample *occ = data;
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	uint8_t pool_type;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    !tb[DEVLINK_ATTR_PORT_INDEX] || !tb[DEVLINK_ATTR_SB_INDEX] ||
+	    !tb[DEVLINK_ATTR_SB_TC_INDEX] || !tb[DEVLINK_ATTR_SB_POOL_TYPE] ||
+	    !tb[DEVLINK_ATTR_SB_POOL_INDEX] ||
+	    !tb[DEVLINK_ATTR_SB_OCC_CUR] || !tb[DEVLINK_ATTR_SB_OCC_MAX])
+		return MNL_CB_ERROR;
+	if (occ->err || !dl_dump_filter(occ->dl, tb))
+		return MNL_CB_OK;
+	pool_type = mnl_attr_get_u8(tb[DEVLINK_ATTR_SB_POOL_TYPE]);
+	if (pool_type == DEVLINK_SB_POOL_TYPE_INGRESS)
+		occ_sample_put(occ, tb, OCC_ITC,
+			       mnl_attr_get_u16(tb[DEVLINK_ATTR_SB_TC_INDEX]));
+	else if (pool_type == DEVLINK_SB_POOL_TYPE_EGRESS)
+		occ_sample_put(occ, tb, OCC_ETC,
+			       mnl_attr_get_u16(tb[DEVLINK_ATTR_SB_TC_INDEX]));
+	return MNL_CB_OK;
+}
+
+static int occ_sample_ent_cmp(const void *a, const void *b)
+{
+	const struct occ_sample_ent *x = *(const struct occ_sample_ent **)a;
+	const struct occ_sample_ent *y = *(const struct occ_sample_ent **)b;
+
+	if (x->port_index != y->port_index)
+		return x->port_index < y->port_index ? -1 : 1;
+	if (x->kind != y->kind)
+		return x->kind - y->kind;
+	return x->index - y->index;
+}
+
+static int occ_val_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* nearest rank */
+static uint32_t occ_percentile(const uint32_t *sorted, unsigned int n,
+			       unsigned int pct)
+{
+	unsigned int rank = (pct * n + 99) / 100;
+
+	return sorted[rank ? rank - 1 : 0];
+}
+
+static void pr_out_occ_sample_ent(struct dl *dl, struct occ_sample_ent *ent,
+				  uint32_t *vals)
+{
+	uint32_t p50, p90, p99;
+	char buf[32];
+
+	if (!ent->n)
+		return;
+	memcpy(vals, ent->cur, ent->n * sizeof(*vals));
+	qsort(vals, ent->n, sizeof(*vals), occ_val_cmp);
+	p50 = occ_percentile(vals, ent->n, 50);
+	p90 = occ_percentile(vals, ent->n, 90);
+	p99 = occ_percentile(vals, ent->n, 99);
+
+	if (dl->json_output) {
+		sprintf(buf, "%u", ent->index);
+		jsonw_name(dl->jw, buf);
+		jsonw_start_object(dl->jw);
+		if (ent->kind != OCC_POOL)
+			jsonw_uint_field(dl->jw, "bound_pool",
+					 ent->bound_pool_index);
+		jsonw_uint_field(dl->jw, "samples", ent->n);
+		jsonw_uint_field(dl->jw, "max", vals[ent->n - 1]);
+		jsonw_uint_field(dl->jw, "p50", p50);
+		jsonw_uint_field(dl->jw, "p90", p90);
+		jsonw_uint_field(dl->jw, "p99", p99);
+		jsonw_uint_field(dl->jw, "watermark", ent->max);
+		jsonw_end_object(dl->jw);
+		return;
+	}
+
+	if (ent->kind == OCC_POOL)
+		sprintf(buf, "%u", ent->index);
+	else
+		sprintf(buf, "%u(%u)", ent->index, ent->bound_pool_index);
+	pr_out("  %-4s %6s: max %u p50 %u p90 %u p99 %u watermark %u\n",
+	       occ_kind_name[ent->kind], buf, vals[ent->n - 1], p50, p90, p99,
+	       ent->max);
+}
+
+static int pr_out_occ_sample(struct occ_sample *occ)
+{
+	struct dl *dl = occ->dl;
+	struct dl_opts *opts = &dl->opts;
+	unsigned int i;
+	uint32_t *vals;
+	int kind = -1;
+
+	vals = malloc(occ->window * sizeof(*vals));
+	if (!vals)
+		return -ENOMEM;
+	if (!occ->sorted) {
+		qsort(occ->ents, occ->count, sizeof(*occ->ents),
+		      occ_sample_ent_cmp);
+		occ->sorted = true;
+	}
+
+	pr_out_section_start(dl, "occupancy");
+	for (i = 0; i < occ->count; i++) {
+		struct occ_sample_ent *ent = occ->ents[i];
+
+		if (!i || occ->ents[i - 1]->port_index != ent->port_index) {
+			__pr_out_port_handle_start(dl, opts->bus_name,
+						   opts->dev_name,
+						   ent->port_index, true, false);
+			if (!dl->json_output)
+				pr_out("\n");
+			kind = -1;
+		}
+		if (dl->json_output && ent->kind != kind) {
+			if (kind != -1)
+				jsonw_end_object(dl->jw);
+			jsonw_name(dl->jw, occ_kind_name[ent->kind]);
+			jsonw_start_object(dl->jw);
+		}
+		kind = ent->kind;
+		pr_out_occ_sample_ent(dl, ent, vals);
+		ent->n = 0;
+
+		if (i + 1 == occ->count ||
+		    occ->ents[i + 1]->port_index != ent->port_index) {
+			if (dl->json_output)
+				jsonw_end_object(dl->jw);
+			pr_out_port_handle_end(dl);
+		}
+	}
+	pr_out_section_end(dl);
+	fflush(stdout);
+	free(vals);
+	return 0;
+}
+
+static struct nlmsghdr *dl_msg_copy(const struct nlmsghdr *nlh)
+{
+	struct nlmsghdr *copy = malloc(nlh->nlmsg_len);
+
+	if (copy)
+		memcpy(copy, nlh, nlh->nlmsg_len);
+	return copy;
+}
+
+static int dl_msg_resend_run(struct mnlg_socket *nlg, struct nlmsghdr *nlh,
+			     mnl_cb_t data_cb, void *data)
+{
+	if (mnlg_socket_resend(nlg, nlh) < 0) {
+		pr_err("Failed to call mnlg_socket_send\n");
+		return -errno;
+	}
+	return _mnlg_socket_recv_run(nlg, data_cb, data);
+}
+
+static int cmd_sb_occ_sample(struct dl *dl)
+{
+	uint16_t flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP;
+	struct dl_opts *opts = &dl->opts;
+	struct nlmsghdr *snap, *port_pool, *tc_pool;
+	struct occ_sample occ = { .dl = dl };
+	struct timespec next;
+	unsigned int n;
+	int err;
+
+	err = dl_argv_parse(dl, DL_OPT_HANDLE,
+			    DL_OPT_SB | DL_OPT_SAMPLE_INTERVAL |
+			    DL_OPT_SAMPLE_COUNT | DL_OPT_SAMPLE_WINDOW);
+	if (err)
+		return err;
+	if (!(opts->present & DL_OPT_SAMPLE_INTERVAL))
+		opts->sample_interval = 100;
+	if (!(opts->present & DL_OPT_SAMPLE_WINDOW))
+		opts->sample_window = 10;
+	if (!opts->sample_interval || !opts->sample_window ||
+	    opts->sample_window > 1000000) {
+		pr_err("Sample interval and window must be positive.\n");
+		return -EINVAL;
+	}
+	occ.window = opts->sample_window;
+
+	/* built once, the socket's buffer is overwritten by every reply */
+	snap = mnlg_msg_prepare(dl->nlg, DEVLINK_CMD_SB_OCC_SNAPSHOT,
+				NLM_F_REQUEST | NLM_F_ACK);
+	dl_opts_put(snap, dl);
+	snap = dl_msg_copy(snap);
+	port_pool = dl_msg_copy(mnlg_msg_prepare(dl->nlg,
+				DEVLINK_CMD_SB_PORT_POOL_GET, flags));
+	tc_pool = dl_msg_copy(mnlg_msg_prepare(dl->nlg,
+			      DEVLINK_CMD_SB_TC_POOL_BIND_GET, flags));
+	if (!snap || !port_pool || !tc_pool) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (dl->json_output)
+		jsonw_lines(dl->jw, true);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (n = 0; !opts->sample_count || n < opts->sample_count; n++) {
+		if (n)
+			sample_wait(&next, opts->sample_interval / 1000.0);
+
+		err = dl_msg_resend_run(dl->nlg, snap, NULL, NULL);
+		if (!err)
+			err = dl_msg_resend_run(dl->nlg, port_pool,
+						cmd_sb_occ_sample_port_pool_cb,
+						&occ);
+		if (!err)
+			err = dl_msg_resend_run(dl->nlg, tc_pool,
+						cmd_sb_occ_sample_tc_pool_cb,
+						&occ);
+		if (!err)
+			err = occ.err;
+		if (err)
+			goto out;
+
+		if (++occ.pos == occ.window) {
+			occ.pos = 0;
+			err = pr_out_occ_sample(&occ);
+			if (err)
+				goto out;
+		}
+	}
+	/* what the last, partial window has */
+	if (occ.pos)
+		err = pr_out_occ_sample(&occ);
+
+out:
+	for (n = 0; n < occ.count; n++)
+		free(occ.ents[n]);
+	free(occ.ents);
+	free(occ.hash);
+	free(snap);
+	free(port_pool);
+	free(tc_pool);
+	return err;
+}
+
 static int cmd_sb_occ(struct dl *dl)
 {
 	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
@@ -2569,6 +3084,9 @@ static int cmd_sb_occ(struct dl *dl)
 	} else if (dl_argv_match(dl, "clearmax")) {
 		dl_arg_inc(dl);
 		return cmd_sb_occ_clearmax(dl);
+	} else if (dl_argv_match(dl, "sample")) {
+		dl_arg_inc(dl);
+		return cmd_sb_occ_sample(dl);
 	}
 	pr_err("Command \"%s\" not found\n", dl_argv(dl));
 	return -ENOENT;
@@ -4063,10 +4581,249 @@ out:
 	return err;
 }
 
+/*
+ * dpipe table counters: the counters of a table's entries, decoding no
+ * more than the index and counter of each. Polled, only the entries
+ * whose counter moved are printed, with the change and its rate.
+ */
+struct dpipe_counter {
+	struct dpipe_counter *next;
+	uint32_t index;
+	unsigned int gen;
+	uint64_t counter;
+};
+
+struct dpipe_counters_ctx {
+	struct dl *dl;
+	struct dpipe_counter **hash;
+	unsigned int size;
+	unsigned int count;
+	unsigned int gen;
+	double elapsed;		/* seconds since the previous poll */
+};
+
+static struct dpipe_counter **dpipe_counter_find(struct dpipe_counters_ctx *ctx,
+						 uint32_t index)
+{
+	struct dpipe_counter **pp;
+
+	pp = &ctx->hash[(index * 2654435761u) & (ctx->size - 1)];
+	while (*pp && (*pp)->index != index)
+		pp = &(*pp)->next;
+	return pp;
+}
+
+static int dpipe_counters_grow(struct dpipe_counters_ctx *ctx)
+{
+	unsigned int size = ctx->size ? 2 * ctx->size : 1024, i;
+	struct dpipe_counter **old = ctx->hash;
+	unsigned int old_size = ctx->size;
+
+	ctx->hash = calloc(size, sizeof(*ctx->hash));
+	if (!ctx->hash) {
+		ctx->hash = old;
+		return -ENOMEM;
+	}
+	ctx->size = size;
+	for (i = 0; i < old_size; i++) {
+		while (old[i]) {
+			struct dpipe_counter *c = old[i];
+			struct dpipe_counter **pp;
+
+			old[i] = c->next;
+			pp = dpipe_counter_find(ctx, c->index);
+			c->next = *pp;
+			*pp = c;
+		}
+	}
+	free(old);
+	return 0;
+}
+
+static void pr_out_dpipe_counter(struct dl *dl, const char *name, uint64_t val)
+{
+	if (dl->json_output)
+		jsonw_u64_field(dl->jw, name, val);
+	else if (g_indent_newline)
+		pr_out("%s %llu", name, (unsigned long long)val);
+	else
+		pr_out(" %s %llu", name, (unsigned long long)val);
+}
+
+static int dpipe_counter_entry(struct dpipe_counters_ctx *ctx,
+			       struct nlattr **tb, struct nlattr *nla_entry)
+{
+	struct nlattr *nla_index = NULL, *nla_counter = NULL, *attr;
+	struct dpipe_counter **pp, *c;
+	uint64_t counter, delta;
+	uint32_t index;
+
+	/* the match and action values are skipped, not parsed */
+	mnl_attr_for_each_nested(attr, nla_entry) {
+		switch (mnl_attr_get_type(attr)) {
+		case DEVLINK_ATTR_DPIPE_ENTRY_INDEX:
+			if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+				return -EINVAL;
+			nla_index = attr;
+			break;
+		case DEVLINK_ATTR_DPIPE_ENTRY_COUNTER:
+			if (mnl_attr_validate(attr, MNL_TYPE_U64) < 0)
+				return -EINVAL;
+			nla_counter = attr;
+			break;
+		}
+	}
+	if (!nla_index)
+		return -EINVAL;
+	if (!nla_counter)
+		return 0;	/* counters are not enabled on the table */
+	index = mnl_attr_get_u32(nla_index);
+	counter = mnl_attr_get_u64(nla_counter);
+
+	pp = dpipe_counter_find(ctx, index);
+	c = *pp;
+	if (!c) {
+		if (ctx->count >= ctx->size) {
+			if (dpipe_counters_grow(ctx))
+				return -ENOMEM;
+			pp = dpipe_counter_find(ctx, index);
+		}
+		c = calloc(1, sizeof(*c));
+		if (!c)
+			return -ENOMEM;
+		c->index = index;
+		*pp = c;
+		ctx->count++;
+		delta = counter;
+	} else {
+		delta = counter - c->counter;
+	}
+	c->counter = counter;
+	c->gen = ctx->gen;
+
+	/* after the first poll, what did not move is left out */
+	if (ctx->gen > 1 && !delta)
+		return 0;
+	pr_out_handle_start_arr(ctx->dl, tb);
+	pr_out_uint(ctx->dl, "index", index);
+	pr_out_dpipe_counter(ctx->dl, "counter", counter);
+	if (ctx->gen > 1) {
+		uint64_t rate = ctx->elapsed > 0 ? delta / ctx->elapsed : 0;
+
+		pr_out_dpipe_counter(ctx->dl, "delta", delta);
+		pr_out_dpipe_counter(ctx->dl, "rate", rate);
+	}
+	pr_out_handle_end(ctx->dl);
+	return 0;
+}
+
+static int cmd_dpipe_table_counters_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct dpipe_counters_ctx *ctx = data;
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *nla_entry;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    !tb[DEVLINK_ATTR_DPIPE_ENTRIES])
+		return MNL_CB_ERROR;
+
+	mnl_attr_for_each_nested(nla_entry, tb[DEVLINK_ATTR_DPIPE_ENTRIES])
+		if (dpipe_counter_entry(ctx, tb, nla_entry))
+			return MNL_CB_ERROR;
+	return MNL_CB_OK;
+}
+
+/* forget the entries the last poll did not find */
+static void dpipe_counters_sweep(struct dpipe_counters_ctx *ctx, bool all)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->size; i++) {
+		struct dpipe_counter **pp = &ctx->hash[i];
+
+		while (*pp) {
+			struct dpipe_counter *c = *pp;
+
+			if (all || c->gen != ctx->gen) {
+				*pp = c->next;
+				free(c);
+				ctx->count--;
+			} else {
+				pp = &c->next;
+			}
+		}
+	}
+}
+
+static int cmd_dpipe_table_counters(struct dl *dl)
+{
+	struct dpipe_counters_ctx ctx = { .dl = dl };
+	struct dl_opts *opts = &dl->opts;
+	struct timespec next, now, last;
+	struct nlmsghdr *nlh;
+	unsigned int n;
+	int err;
+
+	err = dl_argv_parse(dl, DL_OPT_HANDLE | DL_OPT_DPIPE_TABLE_NAME,
+			    DL_OPT_SAMPLE_INTERVAL | DL_OPT_SAMPLE_COUNT);
+	if (err)
+		return err;
+	/* a single dump unless asked to poll */
+	if (!(opts->present & DL_OPT_SAMPLE_INTERVAL)) {
+		opts->sample_count = 1;
+	} else if (!opts->sample_interval) {
+		pr_err("Poll interval must be positive.\n");
+		return -EINVAL;
+	}
+
+	nlh = mnlg_msg_prepare(dl->nlg, DEVLINK_CMD_DPIPE_ENTRIES_GET,
+			       NLM_F_REQUEST | NLM_F_ACK);
+	dl_opts_put(nlh, dl);
+	nlh = dl_msg_copy(nlh);
+	if (!nlh || dpipe_counters_grow(&ctx)) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (dl->json_output && opts->sample_count != 1)
+		jsonw_lines(dl->jw, true);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last = next;
+	for (n = 0; !opts->sample_count || n < opts->sample_count; n++) {
+		if (n)
+			sample_wait(&next, opts->sample_interval / 1000.0);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ctx.elapsed = timespec_diff(&now, &last);
+		last = now;
+		ctx.gen++;
+
+		pr_out_section_start(dl, "table_counters");
+		err = dl_msg_resend_run(dl->nlg, nlh,
+					cmd_dpipe_table_counters_cb, &ctx);
+		pr_out_section_end(dl);
+		dl->arr_last.present = false;
+		fflush(stdout);
+		if (err)
+			goto out;
+		dpipe_counters_sweep(&ctx, false);
+	}
+
+out:
+	dpipe_counters_sweep(&ctx, true);
+	free(ctx.hash);
+	free(nlh);
+	return err;
+}
+
 static void cmd_dpipe_table_help(void)
 {
 	pr_err("Usage: devlink dpipe table [ OBJECT-LIST ]\n"
-	       "where  OBJECT-LIST := { show | set | dump }\n");
+	       "where  OBJECT-LIST := { show | set | dump | counters }\n"
+	       "       devlink dpipe table counters DEV name TABLE_NAME\n"
+	       "                      [ interval MS ] [ count N ]\n");
 }
 
 static int cmd_dpipe_table(struct dl *dl)
@@ -4083,6 +4840,9 @@ static int cmd_dpipe_table(struct dl *dl)
 	}  else if (dl_argv_match(dl, "dump")) {
 		dl_arg_inc(dl);
 		return cmd_dpipe_table_dump(dl);
+	} else if (dl_argv_match(dl, "counters")) {
+		dl_arg_inc(dl);
+		return cmd_dpipe_table_counters(dl);
 	}
 	pr_err("Command \"%s\" not found\n", dl_argv(dl));
 	return -ENOENT;
@@ -4561,8 +5321,22 @@ static void dl_free(struct dl *dl)
 	free(dl);
 }
 
+struct dl_batch_async {
+	const char *name;
+	int ret;
+};
+
+static void dl_batch_async_err(uint32_t cookie, int error, void *arg)
+{
+	struct dl_batch_async *ctx = arg;
+
+	fprintf(stderr, "Command failed %s:%u\n", ctx->name, cookie);
+	ctx->ret = EXIT_FAILURE;
+}
+
 static int dl_batch(struct dl *dl, const char *name, bool force)
 {
+	struct dl_batch_async async = { .name = name, .ret = EXIT_SUCCESS };
 	char *line = NULL;
 	size_t len = 0;
 	int ret = EXIT_SUCCESS;
@@ -4576,6 +5350,14 @@ static int dl_batch(struct dl *dl, const char *name, bool force)
 		}
 	}
 
+	/*
+	 * Errors of pipelined commands show up some lines late, which is
+	 * only acceptable when the batch does not stop on the first one.
+	 */
+	if (force &&
+	    mnlg_socket_async_begin(dl->nlg, dl_batch_async_err, &async) < 0)
+		pr_err("Cannot pipeline batch, continuing without\n");
+
 	cmdlineno = 0;
 	while (getcmdline(&line, &len, stdin) != -1) {
 		char *largv[100];
@@ -4585,6 +5367,8 @@ static int dl_batch(struct dl *dl, const char *name, bool force)
 		if (!largc)
 			continue;	/* blank line */
 
+		ifname_map_sync(dl);
+		mnlg_socket_async_cookie(dl->nlg, cmdlineno);
 		if (dl_cmd(dl, largc, largv)) {
 			fprintf(stderr, "Command failed %s:%d\n",
 				name, cmdlineno);
@@ -4597,6 +5381,10 @@ static int dl_batch(struct dl *dl, const char *name, bool force)
 	if (line)
 		free(line);
 
+	mnlg_socket_async_end(dl->nlg);
+	if (async.ret != EXIT_SUCCESS)
+		ret = async.ret;
+
 	return ret;
 }
 
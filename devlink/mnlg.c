@@ -15,22 +15,62 @@
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/socket.h>
 #include <libmnl/libmnl.h>
 #include <linux/genetlink.h>
 
 #include "libnetlink.h"
+#include "libgenl.h"
 #include "utils.h"
 #include "mnlg.h"
 
+/* Requests queued to go out together, and how many bytes a datagram
+ * of them may take.
+ */
+#define MNLG_ASYNC_WINDOW	256
+#define MNLG_ASYNC_DGRAM_MAX	32768
+
+struct mnlg_async_req {
+	uint32_t seq;
+	uint32_t cookie;
+	bool done;
+};
+
+struct mnlg_async {
+	char *txbuf;
+	size_t txlen;
+	size_t txsize;
+	struct mnlg_async_req reqs[MNLG_ASYNC_WINDOW];
+	unsigned int count;
+	uint32_t seq;
+	uint32_t cookie;
+	mnlg_async_err_fn_t errfn;
+	void *arg;
+};
+
+/*
+ * Replies are read into a buffer as large as the socket's receive
+ * buffer, within these bounds, so that a dump comes in as few reads as
+ * the kernel sends datagrams however big it makes them.
+ */
+#define MNLG_RXBUF_MIN		32768
+#define MNLG_RXBUF_MAX		(1 << 20)
+
 struct mnlg_socket {
 	struct mnl_socket *nl;
-	char *buf;
+	char *buf;		/* requests are prepared here */
+	char *rxbuf;
+	size_t rxsize;
 	uint32_t id;
 	uint8_t version;
+	char family[GENL_NAMSIZ];
 	unsigned int seq;
 	unsigned int portid;
+	struct mnlg_async *async;
 };
 
+static void mnlg_async_sync(struct mnlg_socket *nlg);
+
 static struct nlmsghdr *__mnlg_msg_prepare(struct mnlg_socket *nlg, uint8_t cmd,
 					   uint16_t flags, uint32_t id,
 					   uint8_t version)
@@ -59,9 +99,19 @@ struct nlmsghdr *mnlg_msg_prepare(struct mnlg_socket *nlg, uint8_t cmd,
 
 int mnlg_socket_send(struct mnlg_socket *nlg, const struct nlmsghdr *nlh)
 {
+	mnlg_async_sync(nlg);
 	return mnl_socket_sendto(nlg->nl, nlh, nlh->nlmsg_len);
 }
 
+/* Send again a message prepared earlier and copied out of the socket's
+ * buffer, under a new sequence number so its replies are taken as fresh.
+ */
+int mnlg_socket_resend(struct mnlg_socket *nlg, struct nlmsghdr *nlh)
+{
+	nlh->nlmsg_seq = ++nlg->seq;
+	return mnlg_socket_send(nlg, nlh);
+}
+
 static int mnlg_cb_noop(const struct nlmsghdr *nlh, void *data)
 {
 	return MNL_CB_OK;
@@ -99,12 +149,12 @@ int mnlg_socket_recv_run(struct mnlg_socket *nlg, mnl_cb_t data_cb, void *data)
 {
 	int err;
 
+	mnlg_async_sync(nlg);
 	do {
-		err = mnl_socket_recvfrom(nlg->nl, nlg->buf,
-					  MNL_SOCKET_BUFFER_SIZE);
+		err = mnl_socket_recvfrom(nlg->nl, nlg->rxbuf, nlg->rxsize);
 		if (err <= 0)
 			break;
-		err = mnl_cb_run2(nlg->buf, err, nlg->seq, nlg->portid,
+		err = mnl_cb_run2(nlg->rxbuf, err, nlg->seq, nlg->portid,
 				  data_cb, data, mnlg_cb_array,
 				  ARRAY_SIZE(mnlg_cb_array));
 	} while (err > 0);
@@ -112,6 +162,203 @@ int mnlg_socket_recv_run(struct mnlg_socket *nlg, mnl_cb_t data_cb, void *data)
 	return err;
 }
 
+/*
+ * Pipelining: once begun, requests expecting nothing but an ack may be
+ * queued with mnlg_socket_queue() instead of sent. They go out in as few
+ * datagrams as fit, when the window is full, when anything else is sent
+ * or received on the socket, or on mnlg_socket_async_flush(). A request
+ * the kernel rejects is reported to errfn with the cookie that was set
+ * when it was queued.
+ */
+int mnlg_socket_async_begin(struct mnlg_socket *nlg,
+			    mnlg_async_err_fn_t errfn, void *arg)
+{
+	struct mnlg_async *async;
+
+	if (nlg->async)
+		return 0;
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return -1;
+	async->seq = nlg->seq;
+	async->errfn = errfn;
+	async->arg = arg;
+	nlg->async = async;
+	return 0;
+}
+
+bool mnlg_socket_async(const struct mnlg_socket *nlg)
+{
+	return nlg->async != NULL;
+}
+
+void mnlg_socket_async_cookie(struct mnlg_socket *nlg, uint32_t cookie)
+{
+	if (nlg->async)
+		nlg->async->cookie = cookie;
+}
+
+int mnlg_socket_queue(struct mnlg_socket *nlg, const struct nlmsghdr *nlh)
+{
+	struct mnlg_async *async = nlg->async;
+	struct mnlg_async_req *req;
+	struct nlmsghdr *copy;
+	size_t len = NLMSG_ALIGN(nlh->nlmsg_len);
+
+	if (async->count == MNLG_ASYNC_WINDOW &&
+	    mnlg_socket_async_flush(nlg) < 0)
+		return -1;
+
+	if (async->txlen + len > async->txsize) {
+		size_t size = async->txsize ? 2 * async->txsize : 65536;
+		char *buf;
+
+		while (size < async->txlen + len)
+			size *= 2;
+		buf = realloc(async->txbuf, size);
+		if (!buf)
+			return -1;
+		async->txbuf = buf;
+		async->txsize = size;
+	}
+
+	copy = (struct nlmsghdr *)(async->txbuf + async->txlen);
+	memcpy(copy, nlh, nlh->nlmsg_len);
+	copy->nlmsg_seq = ++async->seq;
+	async->txlen += len;
+
+	req = &async->reqs[async->count++];
+	req->seq = copy->nlmsg_seq;
+	req->cookie = async->cookie;
+	req->done = false;
+	return 0;
+}
+
+static int mnlg_async_send(struct mnlg_socket *nlg)
+{
+	struct mnlg_async *async = nlg->async;
+	size_t start = 0, end = 0;
+
+	while (end < async->txlen) {
+		struct nlmsghdr *nlh = (struct nlmsghdr *)(async->txbuf + end);
+		size_t len = NLMSG_ALIGN(nlh->nlmsg_len);
+
+		if (end > start && end + len - start > MNLG_ASYNC_DGRAM_MAX) {
+			if (mnl_socket_sendto(nlg->nl, async->txbuf + start,
+					      end - start) < 0)
+				return -1;
+			start = end;
+		}
+		end += len;
+	}
+	if (end > start &&
+	    mnl_socket_sendto(nlg->nl, async->txbuf + start, end - start) < 0)
+		return -1;
+	return 0;
+}
+
+/* 1 when the ack is for a request that was pending, -1 if it failed */
+static int mnlg_async_ack(struct mnlg_socket *nlg, const struct nlmsghdr *nlh)
+{
+	struct mnlg_async *async = nlg->async;
+	const struct nlmsgerr *err;
+	struct mnlg_async_req *req;
+	uint32_t n = nlh->nlmsg_seq - async->reqs[0].seq;
+
+	if (nlh->nlmsg_type != NLMSG_ERROR || n >= async->count ||
+	    nlh->nlmsg_pid != nlg->portid)
+		return 0;
+	req = &async->reqs[n];
+	if (req->done)
+		return 0;
+	req->done = true;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+		return -1;
+	err = mnl_nlmsg_get_payload(nlh);
+	nl_dump_ext_ack(nlh, NULL);
+	if (!err->error)
+		return 1;
+
+	fprintf(stderr, "devlink answers: %s\n",
+		strerror(err->error < 0 ? -err->error : err->error));
+	if (async->errfn)
+		async->errfn(req->cookie, err->error, async->arg);
+	return -1;
+}
+
+/*
+ * Send what is queued and wait for all of its acks. Returns the number
+ * of requests the kernel rejected, or -1 if the socket failed.
+ */
+int mnlg_socket_async_flush(struct mnlg_socket *nlg)
+{
+	struct mnlg_async *async = nlg->async;
+	unsigned int pending;
+	int failed = 0;
+
+	if (!async || !async->count)
+		return 0;
+
+	if (mnlg_async_send(nlg) < 0) {
+		failed = -1;
+		goto out;
+	}
+
+	pending = async->count;
+	while (pending) {
+		const struct nlmsghdr *nlh;
+		int len;
+
+		len = mnl_socket_recvfrom(nlg->nl, nlg->rxbuf, nlg->rxsize);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			failed = -1;
+			goto out;
+		}
+
+		for (nlh = (struct nlmsghdr *)nlg->rxbuf;
+		     mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len)) {
+			int ret = mnlg_async_ack(nlg, nlh);
+
+			if (ret) {
+				pending--;
+				if (ret < 0)
+					failed++;
+			}
+		}
+	}
+
+out:
+	async->txlen = 0;
+	async->count = 0;
+	return failed;
+}
+
+static void mnlg_async_sync(struct mnlg_socket *nlg)
+{
+	if (nlg->async && nlg->async->count)
+		mnlg_socket_async_flush(nlg);
+}
+
+/* Flush what is queued and go back to sending each request on its own */
+int mnlg_socket_async_end(struct mnlg_socket *nlg)
+{
+	struct mnlg_async *async = nlg->async;
+	int failed;
+
+	if (!async)
+		return 0;
+
+	failed = mnlg_socket_async_flush(nlg);
+	nlg->async = NULL;
+	free(async->txbuf);
+	free(async);
+	return failed;
+}
+
 struct group_info {
 	bool found;
 	uint32_t id;
@@ -197,6 +444,12 @@ int mnlg_socket_group_add(struct mnlg_socket *nlg, const char *group_name)
 	struct group_info group_info;
 	int err;
 
+	err = genl_cache_group(nlg->family, group_name);
+	if (err >= 0) {
+		group_info.id = err;
+		goto join;
+	}
+
 	nlh = __mnlg_msg_prepare(nlg, CTRL_CMD_GETFAMILY,
 				 NLM_F_REQUEST | NLM_F_ACK, GENL_ID_CTRL, 1);
 	mnl_attr_put_u32(nlh, CTRL_ATTR_FAMILY_ID, nlg->id);
@@ -216,6 +469,7 @@ int mnlg_socket_group_add(struct mnlg_socket *nlg, const char *group_name)
 		return -1;
 	}
 
+join:
 	err = mnl_socket_setsockopt(nlg->nl, NETLINK_ADD_MEMBERSHIP,
 				    &group_info.id, sizeof(group_info.id));
 	if (err < 0)
@@ -249,17 +503,21 @@ static int get_family_id_cb(const struct nlmsghdr *nlh, void *data)
 	if (!tb[CTRL_ATTR_FAMILY_ID])
 		return MNL_CB_ERROR;
 	*p_id = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	genl_cache_add(nlh);
 	return MNL_CB_OK;
 }
 
 struct mnlg_socket *mnlg_socket_open(const char *family_name, uint8_t version)
 {
+	const struct genl_family *family;
 	struct mnlg_socket *nlg;
 	struct nlmsghdr *nlh;
+	socklen_t optlen;
+	int rcvbuf = 0;
 	int one = 1;
 	int err;
 
-	nlg = malloc(sizeof(*nlg));
+	nlg = calloc(1, sizeof(*nlg));
 	if (!nlg)
 		return NULL;
 
@@ -281,6 +539,26 @@ struct mnlg_socket *mnlg_socket_open(const char *family_name, uint8_t version)
 
 	nlg->portid = mnl_socket_get_portid(nlg->nl);
 
+	optlen = sizeof(rcvbuf);
+	getsockopt(mnl_socket_get_fd(nlg->nl), SOL_SOCKET, SO_RCVBUF,
+		   &rcvbuf, &optlen);
+	nlg->rxsize = rcvbuf;
+	if (nlg->rxsize < MNLG_RXBUF_MIN)
+		nlg->rxsize = MNLG_RXBUF_MIN;
+	if (nlg->rxsize > MNLG_RXBUF_MAX)
+		nlg->rxsize = MNLG_RXBUF_MAX;
+	nlg->rxbuf = malloc(nlg->rxsize);
+	if (!nlg->rxbuf)
+		goto err_rxbuf_alloc;
+
+	strncpy(nlg->family, family_name, sizeof(nlg->family) - 1);
+	family = genl_cache_find(family_name);
+	if (family) {
+		nlg->id = family->id;
+		nlg->version = version;
+		return nlg;
+	}
+
 	nlh = __mnlg_msg_prepare(nlg, CTRL_CMD_GETFAMILY,
 				 NLM_F_REQUEST | NLM_F_ACK, GENL_ID_CTRL, 1);
 	mnl_attr_put_strz(nlh, CTRL_ATTR_FAMILY_NAME, family_name);
@@ -298,6 +576,8 @@ struct mnlg_socket *mnlg_socket_open(const char *family_name, uint8_t version)
 
 err_mnlg_socket_recv_run:
 err_mnlg_socket_send:
+	free(nlg->rxbuf);
+err_rxbuf_alloc:
 err_mnl_socket_bind:
 	mnl_socket_close(nlg->nl);
 err_mnl_socket_open:
@@ -309,7 +589,9 @@ err_buf_alloc:
 
 void mnlg_socket_close(struct mnlg_socket *nlg)
 {
+	mnlg_socket_async_end(nlg);
 	mnl_socket_close(nlg->nl);
+	free(nlg->rxbuf);
 	free(nlg->buf);
 	free(nlg);
 }
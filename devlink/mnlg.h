@@ -16,10 +16,20 @@
 
 struct mnlg_socket;
 
+typedef void (*mnlg_async_err_fn_t)(uint32_t cookie, int error, void *arg);
+
 struct nlmsghdr *mnlg_msg_prepare(struct mnlg_socket *nlg, uint8_t cmd,
 				  uint16_t flags);
 int mnlg_socket_send(struct mnlg_socket *nlg, const struct nlmsghdr *nlh);
+int mnlg_socket_resend(struct mnlg_socket *nlg, struct nlmsghdr *nlh);
 int mnlg_socket_recv_run(struct mnlg_socket *nlg, mnl_cb_t data_cb, void *data);
+int mnlg_socket_async_begin(struct mnlg_socket *nlg,
+			    mnlg_async_err_fn_t errfn, void *arg);
+bool mnlg_socket_async(const struct mnlg_socket *nlg);
+void mnlg_socket_async_cookie(struct mnlg_socket *nlg, uint32_t cookie);
+int mnlg_socket_queue(struct mnlg_socket *nlg, const struct nlmsghdr *nlh);
+int mnlg_socket_async_flush(struct mnlg_socket *nlg);
+int mnlg_socket_async_end(struct mnlg_socket *nlg);
 int mnlg_socket_group_add(struct mnlg_socket *nlg, const char *group_name);
 struct mnlg_socket *mnlg_socket_open(const char *family_name, uint8_t version);
 void mnlg_socket_close(struct mnlg_socket *nlg);
@@ -20,6 +20,7 @@
 #include <string.h>
 
 #include "utils.h"
+#include "libgenl.h"
 #include "genl_utils.h"
 
 #define GENL_MAX_FAM_OPS	256
@@ -55,6 +56,10 @@ int genl_ctrl_resolve_family(const char *family)
 	struct nlmsghdr *nlh = &req.n;
 	struct genlmsghdr *ghdr = &req.g;
 	struct nlmsghdr *answer = NULL;
+	const struct genl_family *f = genl_cache_find(family);
+
+	if (f)
+		return f->id;
 
 	if (rtnl_open_byproto(&rth, 0, NETLINK_GENERIC) < 0) {
 		fprintf(stderr, "Cannot open generic netlink socket\n");
@@ -101,6 +106,7 @@ int genl_ctrl_resolve_family(const char *family)
 		}
 
 		ret = rta_getattr_u16(tb[CTRL_ATTR_FAMILY_ID]);
+		genl_cache_add(answer);
 	}
 
 errout:
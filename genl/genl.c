@@ -26,9 +26,9 @@
 #include "utils.h"
 #include "genl_utils.h"
 
-int show_stats = 0;
-int show_details = 0;
-int show_raw = 0;
+__thread int show_stats = 0;
+__thread int show_details = 0;
+__thread int show_raw = 0;
 
 static void *BODY;
 static struct genl_util * genl_list;
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __ARENA_H__
+#define __ARENA_H__ 1
+
+#include <stddef.h>
+
+/*
+ * Objects that all die together, at the end of a dump or of the
+ * command: they are carved in turn from chunks and only freed all at
+ * once, by arena_free(). A zeroed struct arena is an empty one.
+ */
+#define ARENA_ALIGN	8
+
+struct arena_chunk;
+
+struct arena {
+	char			*cur;
+	char			*end;
+	struct arena_chunk	*chunks;
+	size_t			next_size;
+};
+
+void *arena_alloc_chunk(struct arena *a, size_t size);
+
+static inline void *arena_alloc(struct arena *a, size_t size)
+{
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if ((size_t)(a->end - a->cur) < size)
+		return arena_alloc_chunk(a, size);
+	p = a->cur;
+	a->cur += size;
+	return p;
+}
+
+void *arena_zalloc(struct arena *a, size_t size);
+void *arena_memdup(struct arena *a, const void *src, size_t size);
+char *arena_strdup(struct arena *a, const char *str);
+void arena_free(struct arena *a);
+
+#endif /* __ARENA_H__ */
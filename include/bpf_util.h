@@ -72,6 +72,8 @@ struct bpf_cfg_in {
 	enum bpf_mode mode;
 	__u32 ifindex;
 	bool verbose;
+	bool timing;
+	__u32 log_size;
 	int argc;
 	char **argv;
 	struct sock_filter opcodes[BPF_MAXINSNS];
@@ -269,7 +271,10 @@ int bpf_parse_and_load_common(struct bpf_cfg_in *cfg,
 const char *bpf_prog_to_default_section(enum bpf_prog_type type);
 
 int bpf_graft_map(const char *map_path, uint32_t *key, int argc, char **argv);
+int bpf_map_update_file(const char *map_path, const char *file,
+			unsigned int batch, uint64_t flags, bool verbose);
 int bpf_trace_pipe(void);
+int bpf_perf_map(const char *map_path, unsigned int pages, bool raw);
 
 void bpf_print_ops(FILE *f, struct rtattr *bpf_ops, __u16 len);
 
@@ -277,6 +282,12 @@ int bpf_prog_load(enum bpf_prog_type type, const struct bpf_insn *insns,
 		  size_t size_insns, const char *license, char *log,
 		  size_t size_log);
 
+/* The bpf fs, or the directory of type in it, with a trailing slash */
+const char *bpf_get_work_dir(enum bpf_prog_type type);
+int bpf_obj_get(const char *pathname, enum bpf_prog_type type);
+int bpf_obj_pin(int fd, const char *pathname);
+int bpf_prog_get_pinned(const char *pathname, enum bpf_prog_type type);
+
 int bpf_prog_attach_fd(int prog_fd, int target_fd, enum bpf_attach_type type);
 int bpf_prog_detach_fd(int target_fd, enum bpf_attach_type type);
 
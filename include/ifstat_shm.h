@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __IFSTAT_SHM_H__
+#define __IFSTAT_SHM_H__ 1
+
+#include <linux/types.h>
+#include <linux/if.h>
+
+/*
+ * The ifstat daemon (ifstat -d) exports its table in a POSIX shared
+ * memory object, IFSTAT_SHM_NAME with the daemon's uid, owned by that
+ * uid and readable by it only. The object is this header followed by
+ * room for size entries, of which the first count are in use.
+ *
+ * seq is a sequence lock: it is odd while the daemon rewrites the
+ * table. A reader takes seq, copies what it needs if seq was even,
+ * then takes seq again and retries unless it is unchanged. The object
+ * only ever grows, the daemon extends it before it raises size, so a
+ * reader seeing a larger size than it has mapped maps it again.
+ *
+ * A daemon reading other namespaces (ifstat -d -N NAME) exports the
+ * table of each in an object of its own, IFSTAT_SHM_NETNS_NAME with
+ * the uid and the name of the namespace.
+ */
+#define IFSTAT_SHM_NAME		"/ifstat.u%d"
+#define IFSTAT_SHM_NETNS_NAME	"/ifstat.u%d.%s"
+#define IFSTAT_SHM_MAGIC	0x54534649	/* "IFST" */
+#define IFSTAT_SHM_VERSION	1
+
+/* counters come in the order of struct rtnl_link_stats */
+#define IFSTAT_SHM_NSTATS	23
+
+struct ifstat_shm_ent {
+	__s32		ifindex;
+	char		name[IFNAMSIZ];
+	__u32		pad;
+	__u64		val[IFSTAT_SHM_NSTATS];
+	double		rate[IFSTAT_SHM_NSTATS];	/* per second, averaged */
+};
+
+struct ifstat_shm_hdr {
+	__u32		magic;
+	__u32		version;
+	__u32		seq;
+	__u32		count;
+	__u32		size;
+	__u32		nstats;		/* IFSTAT_SHM_NSTATS */
+	__s32		pid;		/* of the daemon */
+	__u32		pad;
+	char		info_source[128];
+	struct ifstat_shm_ent	ent[];
+};
+
+#endif /* __IFSTAT_SHM_H__ */
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __JOBS_H__
+#define __JOBS_H__ 1
+
+#include "libnetlink.h"
+
+/*
+ * Work shared between child processes, each with netlink sockets of
+ * its own, and what they print put back together in the order of the
+ * work, see lib/jobs.c.
+ *
+ * Two environment variables tune all the tools that use it:
+ * RTNL_JOBS_MAX caps how many children run at once, by default the
+ * number of CPUs the tool may run on, and RTNL_JOBS_CPUS pins each child
+ * to a CPU of its own: "spread" over the NUMA nodes in turn, "local" on
+ * the node of the parent first, or "none", the default.
+ */
+#define JOBS_F_STDERR	0x1	/* a child's stderr goes with its output */
+
+struct jobs_ops {
+	/* in a child, before its tasks: nonzero fails the child */
+	int (*setup)(unsigned int first, void *arg);
+	/* in a child, tasks [first, first + count): its exit status */
+	int (*run)(unsigned int first, unsigned int count, void *arg);
+	/* in the parent, right before the output of the tasks at first */
+	void (*emit)(unsigned int first, void *arg);
+};
+
+unsigned int jobs_limit(unsigned int wanted);
+void jobs_pin(unsigned int worker);
+int jobs_run(unsigned int tasks, unsigned int chunk, unsigned int jobs,
+	     const struct jobs_ops *ops, void *arg, int flags);
+
+/* sends the dump request for family on rth */
+typedef int (*jobs_dump_req_t)(struct rtnl_handle *rth, int family);
+
+int jobs_dump_families(struct rtnl_handle *rth, const int *family,
+		       unsigned int count, unsigned int jobs,
+		       jobs_dump_req_t req, rtnl_filter_t filter, void *arg);
+
+#endif /* __JOBS_H__ */
@@ -25,6 +25,15 @@ void jsonw_destroy(json_writer_t **self_p);
 /* Cause output to have pretty whitespace */
 void jsonw_pretty(json_writer_t *self, bool on);
 
+/* Write top level values as separate lines (NDJSON) flushed one by one */
+void jsonw_lines(json_writer_t *self, bool on);
+
+/* With lines, leave those to the stdio buffer rather than flush each */
+void jsonw_lines_buffered(json_writer_t *self, bool on);
+
+/* Encode as CBOR (RFC 7049) rather than JSON text */
+void jsonw_cbor(json_writer_t *self, bool on);
+
 /* Add property name */
 void jsonw_name(json_writer_t *self, const char *name);
 
@@ -2,6 +2,8 @@
 #ifndef __LIBGENL_H__
 #define __LIBGENL_H__
 
+#include <linux/genetlink.h>
+
 #include "libnetlink.h"
 
 #define GENL_REQUEST(_req, _bufsiz, _family, _hdrsiz, _ver, _cmd, _flags) \
@@ -21,6 +23,30 @@ struct {								\
 	},								\
 }
 
+#define GENL_CACHE_GROUPS	16
+
+struct genl_group {
+	char	name[GENL_NAMSIZ];
+	__u32	id;
+};
+
+struct genl_family {
+	struct genl_family	*next;
+	char			name[GENL_NAMSIZ];
+	__u16			id;
+	__u32			version;
+	__u32			hdrsize;
+	__u32			maxattr;
+	unsigned int		ngroups;
+	struct genl_group	groups[GENL_CACHE_GROUPS];
+};
+
+int genl_cache_add(const struct nlmsghdr *n);
+const struct genl_family *genl_cache_find(const char *name);
+int genl_cache_group(const char *family, const char *group);
+int genl_cache_watch(void);
+void genl_cache_sync(void);
+
 extern int genl_resolve_family(struct rtnl_handle *grth, const char *family);
 extern int genl_init_handle(struct rtnl_handle *grth, const char *family,
 			    int *genl_family);
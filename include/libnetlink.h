@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <asm/types.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -13,6 +14,7 @@
 #include <linux/netconf.h>
 #include <arpa/inet.h>
 #include "iprt.h"
+#include "arena.h"
 
 struct rtnl_handle {
 	int			fd;
@@ -24,17 +26,91 @@ struct rtnl_handle {
 	FILE		       *dump_fp;
 #define RTNL_HANDLE_F_LISTEN_ALL_NSID		0x01
 #define RTNL_HANDLE_F_SUPPRESS_NLERR		0x02
+#define RTNL_HANDLE_F_RECVBUF_BUSY		0x04
+#define RTNL_HANDLE_F_ASYNC			0x08
+#define RTNL_HANDLE_F_STRICT_CHK		0x10
+#define RTNL_HANDLE_F_REPLAY			0x20
 	int			flags;
+	/* receive buffer reused for the lifetime of the handle */
+	char		       *recvbuf;
+	size_t			recvbuf_len;
+	struct rtnl_async      *async;
+	struct rtnl_loop       *loop;
+	struct rtnl_uring      *uring;
+	struct rtnl_stats      *stats;
+	struct rtnl_dump_cache *dcache;
+	struct rtnl_lag	       *lag;
+	/*
+	 * Called by rtnl_listen() when the socket overflowed and events
+	 * were lost, to let the caller dump the current state again.
+	 */
+	int			(*resync)(struct rtnl_handle *rth, void *arg);
+	/*
+	 * Called by rtnl_listen() after every datagram, and whenever a
+	 * receive times out (see SO_RCVTIMEO), for periodic work.
+	 * Returning a negative value ends the listen.
+	 */
+	int			(*tick)(struct rtnl_handle *rth, void *arg);
+	/*
+	 * If set, requests passed to rtnl_talk() that only want an ack are
+	 * handed to capture() instead of the kernel and succeed unless it
+	 * fails. Requests that want an answer fail.
+	 */
+	int			(*capture)(const struct nlmsghdr *n, void *arg);
+	void			*capture_arg;
 };
 
+/*
+ * Opt-in traffic counters, shared by every handle opened after
+ * rtnl_stats_enable(). Latency bucket i counts replies that arrived
+ * less than 2^(i+1) microseconds after their request was sent.
+ */
+#define RTNL_STATS_LAT_BUCKETS	24
+
+struct rtnl_stats {
+	__u64	syscalls;
+	__u64	enobufs;
+	__u64	tx_msgs;
+	__u64	tx_dgrams;
+	__u64	tx_bytes;
+	__u64	rx_msgs;
+	__u64	rx_dgrams;
+	__u64	rx_bytes;
+	__u64	acks;
+	__u64	ack_usec[RTNL_STATS_LAT_BUCKETS];
+};
+
+void rtnl_stats_enable(void);
+void rtnl_stats_get(struct rtnl_stats *st);
+void rtnl_stats_print(FILE *fp);
+
+/*
+ * Opt-in wall clock profile: init runs until the first handle is open,
+ * netlink covers the socket calls, print the dump and event callbacks
+ * and parse everything else.
+ */
+enum {
+	RTNL_TIME_INIT,
+	RTNL_TIME_PARSE,
+	RTNL_TIME_NETLINK,
+	RTNL_TIME_PRINT,
+	RTNL_TIME_MAX
+};
+
+void rtnl_timing_enable(void);
+int rtnl_timing_phase(int phase);
+void rtnl_timing_print(FILE *fp);
+
 struct nlmsg_list {
 	struct nlmsg_list *next;
 	struct nlmsghdr   h;
 };
 
+/* nodes are carved from the arena, which free_nlmsg_chain() releases */
 struct nlmsg_chain {
 	struct nlmsg_list *head;
 	struct nlmsg_list *tail;
+	struct arena arena;
 };
 
 extern int rcvbuf;
@@ -45,7 +121,52 @@ int rtnl_open(struct rtnl_handle *rth, unsigned int subscriptions)
 int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 			     int protocol)
 	__attribute__((warn_unused_result));
+int rtnl_reopen(struct rtnl_handle *rth)
+	__attribute__((warn_unused_result));
+int rtnl_open_fd(struct rtnl_handle *rth, int fd, unsigned int subscriptions,
+		 int protocol)
+	__attribute__((warn_unused_result));
 
+/* a handle in another network namespace, see lib/rtnl_netns.c */
+int rtnl_open_netns(struct rtnl_handle *rth, const char *name,
+		    unsigned int subscriptions, int protocol)
+	__attribute__((warn_unused_result));
+
+/* $RTNL_REPLAY_DIR and $RTNL_RECORD_DIR, see lib/rtnl_replay.c */
+int rtnl_replay_open(struct rtnl_handle *rth);
+
+/* Dumps repeated while nothing changed, see lib/rtnl_dump_cache.c */
+int rtnl_dump_cache_enable(struct rtnl_handle *rth);
+void rtnl_dump_cache_free(struct rtnl_handle *rth);
+void rtnl_dump_cache_drop(struct rtnl_handle *rth);
+int rtnl_dump_cache_send(struct rtnl_handle *rth, const struct iovec *iov,
+			 size_t iovlen);
+int rtnl_dump_cache_recv(struct rtnl_handle *rth, struct msghdr *msg,
+			 char **answer);
+void rtnl_dump_cache_record(struct rtnl_handle *rth, const char *buf, int len);
+
+/* Receiving and batches through io_uring, see lib/rtnl_uring.c */
+int rtnl_uring_enable(struct rtnl_handle *rth, unsigned int bufs, int wq_fd);
+void rtnl_uring_free(struct rtnl_handle *rth);
+int rtnl_uring_recv(struct rtnl_handle *rth, struct msghdr *msg,
+		    char **answer);
+int rtnl_uring_owns(const struct rtnl_handle *rth, const char *buf);
+int rtnl_uring_put(struct rtnl_handle *rth, const char *buf);
+int rtnl_uring_sendmsg(struct rtnl_handle *rth, struct mmsghdr *msgs,
+		       unsigned int vlen);
+
+/* How stale a listener's view is, see lib/rtnl_lag.c */
+int rtnl_lag_enable(struct rtnl_handle *rth, unsigned int interval_ms,
+		    FILE *fp, int json);
+void rtnl_lag_free(struct rtnl_handle *rth);
+unsigned int rtnl_lag_sockq(const struct rtnl_handle *rth);
+__u64 rtnl_lag_stamp(unsigned int sockq, __u64 *arrived);
+void rtnl_lag_account(struct rtnl_handle *rth, __u64 arrived, __u64 received,
+		      unsigned int sockq, unsigned int ringq);
+void rtnl_lag_idle(struct rtnl_handle *rth);
+void rtnl_lag_wait(struct rtnl_handle *rth);
+void rtnl_lag_recv(struct rtnl_handle *rth);
+void rtnl_lag_done(struct rtnl_handle *rth);
 void rtnl_close(struct rtnl_handle *rth);
 int rtnl_wilddump_request(struct rtnl_handle *rth, int fam, int type)
 	__attribute__((warn_unused_result));
@@ -58,6 +179,14 @@ typedef int (*req_filter_fn_t)(struct nlmsghdr *nlh, int reqlen);
 int rtnl_wilddump_req_filter_fn(struct rtnl_handle *rth, int fam, int type,
 				req_filter_fn_t fn)
 	__attribute__((warn_unused_result));
+/* Ask the kernel to apply dump filters, if it knows how to */
+int rtnl_set_strict_dump(struct rtnl_handle *rth);
+int rtnl_routedump_req(struct rtnl_handle *rth, int family,
+		       req_filter_fn_t filter_fn)
+	__attribute__((warn_unused_result));
+int rtnl_addrdump_req(struct rtnl_handle *rth, int family,
+		      req_filter_fn_t filter_fn)
+	__attribute__((warn_unused_result));
 int rtnl_wilddump_stats_req_filter(struct rtnl_handle *rth, int fam, int type,
 				   __u32 filt_mask)
 	__attribute__((warn_unused_result));
@@ -94,18 +223,117 @@ int rtnl_dump_filter_nc(struct rtnl_handle *rth,
 			void *arg, __u16 nc_flags);
 #define rtnl_dump_filter(rth, filter, arg) \
 	rtnl_dump_filter_nc(rth, filter, arg, 0)
+
+/*
+ * Pull style dump: after sending the dump request, rtnl_dump_next()
+ * returns the messages one by one from the handle's receive buffer.
+ * They stay valid until the next rtnl_dump_next()/rtnl_dump_end() call.
+ * rtnl_dump_end() may be called before the dump is complete, the rest
+ * of it is then read and discarded.
+ */
+struct rtnl_dump_iter {
+	struct rtnl_handle	*rth;
+	struct sockaddr_nl	nladdr;
+	char			*buf;
+	struct nlmsghdr		*h;
+	int			len;
+	int			err;
+	unsigned int		done:1,
+				intr:1;
+};
+
+void rtnl_dump_begin(struct rtnl_handle *rth, struct rtnl_dump_iter *it);
+struct nlmsghdr *rtnl_dump_next(struct rtnl_dump_iter *it);
+int rtnl_dump_end(struct rtnl_dump_iter *it);
+
 int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 	      struct nlmsghdr **answer)
 	__attribute__((warn_unused_result));
 int rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iovec, size_t iovlen,
 		  struct nlmsghdr **answer)
 	__attribute__((warn_unused_result));
+struct nlmsg_refs;
+int rtnl_talk_refs(struct rtnl_handle *rtnl, struct nlmsghdr *n,
+		   const struct nlmsg_refs *refs, struct nlmsghdr **answer)
+	__attribute__((warn_unused_result));
 int rtnl_talk_extack(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 	      struct nlmsghdr **answer, nl_ext_ack_fn_t errfn)
 	__attribute__((warn_unused_result));
 int rtnl_talk_suppress_rtnl_errmsg(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 				   struct nlmsghdr **answer)
 	__attribute__((warn_unused_result));
+/*
+ * Pipelined requests: while RTNL_HANDLE_F_ASYNC is set on a handle set up
+ * with rtnl_async_begin(), rtnl_talk() calls that only want an ack are
+ * queued and sent together. Acks are matched by sequence number when the
+ * queue fills up, before anything else is sent on the handle, or on
+ * rtnl_async_flush(). Failures are passed to errfn with the cookie that
+ * was current when the request was queued.
+ */
+typedef void (*rtnl_async_err_fn_t)(__u32 cookie, int error, void *arg);
+
+/*
+ * Once rtnl_async_replies() is called, what the kernel answers ahead of
+ * an ack is passed to fn, with the cookie of the request, instead of
+ * being unexpected. Requests such as gets can be pipelined that way.
+ */
+typedef void (*rtnl_async_reply_fn_t)(__u32 cookie, struct nlmsghdr *n,
+				      void *arg);
+
+/* Transmit queue that packs messages into datagrams sent with sendmmsg() */
+struct rtnl_txq {
+	char		*buf;
+	size_t		len;
+	size_t		size;
+	size_t		*ends;
+	unsigned int	count;
+	unsigned int	max;
+};
+
+int rtnl_txq_add(struct rtnl_txq *txq, const struct nlmsghdr *n);
+int rtnl_txq_send(struct rtnl_handle *rth, struct rtnl_txq *txq);
+void rtnl_txq_reset(struct rtnl_txq *txq);
+void rtnl_txq_free(struct rtnl_txq *txq);
+
+int rtnl_async_begin(struct rtnl_handle *rth, unsigned int window,
+		     rtnl_async_err_fn_t errfn, void *arg);
+void rtnl_async_cookie(struct rtnl_handle *rth, __u32 cookie);
+void rtnl_async_replies(struct rtnl_handle *rth, rtnl_async_reply_fn_t fn);
+int rtnl_async_flush(struct rtnl_handle *rth);
+void rtnl_async_discard(struct rtnl_handle *rth);
+int rtnl_async_end(struct rtnl_handle *rth);
+
+/*
+ * For an event loop: requests are submitted without waiting, and the
+ * replies, acks and dump records read by rtnl_async_on_readable() when
+ * rtnl_async_fd() is readable, each handed to the callbacks of its
+ * request. Many operations can be in flight on a handle, dumps are
+ * sent one after the other. The dump cache, recording and replaying do
+ * not apply, and no blocking call is to be made on the handle while
+ * operations are in flight, but from the callbacks.
+ */
+typedef int (*rtnl_async_msg_fn_t)(struct nlmsghdr *n, void *arg);
+typedef void (*rtnl_async_done_fn_t)(int error, const struct nlmsghdr *n,
+				     void *arg);
+
+int rtnl_async_submit(struct rtnl_handle *rth, struct nlmsghdr *n,
+		      rtnl_async_msg_fn_t msgfn, rtnl_async_done_fn_t donefn,
+		      void *arg);
+void rtnl_async_events(struct rtnl_handle *rth, rtnl_listen_filter_t fn,
+		       void *arg);
+int rtnl_async_fd(const struct rtnl_handle *rth);
+unsigned int rtnl_async_inflight(const struct rtnl_handle *rth);
+int rtnl_async_on_readable(struct rtnl_handle *rth);
+
+/*
+ * Flushing: the requests deleting what a dump returns are collected with
+ * rtnl_flush_add() while it is read, and sent by rtnl_flush_send() once
+ * it is complete, pipelined with their acks checked. Deleting something
+ * that is already gone is not an error. Returns the number of requests
+ * the kernel rejected, or -1.
+ */
+int rtnl_flush_add(struct rtnl_txq *q, const struct nlmsghdr *n, __u16 type);
+int rtnl_flush_send(struct rtnl_handle *rth, struct rtnl_txq *q);
 int rtnl_send(struct rtnl_handle *rth, const void *buf, int)
 	__attribute__((warn_unused_result));
 int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int)
@@ -122,6 +350,28 @@ int addattrstrz(struct nlmsghdr *n, int maxlen, int type, const char *data);
 int addattr_l(struct nlmsghdr *n, int maxlen, int type,
 	      const void *data, int alen);
 int addraw_l(struct nlmsghdr *n, int maxlen, const void *data, int len);
+
+/*
+ * Attributes whose payload is sent from the caller's memory instead of
+ * being copied into the request: addattr_ref() only reserves the room,
+ * rtnl_talk_refs() sends each payload as its own iovec entry. The data
+ * must stay valid until the request has been sent.
+ */
+#define NLMSG_REFS_MAX	4
+
+struct nlmsg_ref {
+	int		off;
+	const void	*data;
+	int		len;
+};
+
+struct nlmsg_refs {
+	int			count;
+	struct nlmsg_ref	ref[NLMSG_REFS_MAX];
+};
+
+int addattr_ref(struct nlmsghdr *n, int maxlen, struct nlmsg_refs *refs,
+		int type, const void *data, int alen);
 struct rtattr *addattr_nest(struct nlmsghdr *n, int maxlen, int type);
 int addattr_nest_end(struct nlmsghdr *n, struct rtattr *nest);
 struct rtattr *addattr_nest_compat(struct nlmsghdr *n, int maxlen, int type,
@@ -137,6 +387,9 @@ int rta_addattr_l(struct rtattr *rta, int maxlen, int type,
 int parse_rtattr(struct rtattr *tb[], int max, struct rtattr *rta, int len);
 int parse_rtattr_flags(struct rtattr *tb[], int max, struct rtattr *rta,
 			      int len, unsigned short flags);
+#define RTA_WANT(type)	(1ULL << (type))
+int parse_rtattr_want(struct rtattr *tb[], int max, __u64 want,
+		      struct rtattr *rta, int len);
 int parse_rtattr_byindex(struct rtattr *tb[], int max,
 			 struct rtattr *rta, int len);
 struct rtattr *parse_rtattr_one(int type, struct rtattr *rta, int len);
@@ -194,6 +447,35 @@ static inline const char *rta_getattr_str(const struct rtattr *rta)
 int rtnl_listen_all_nsid(struct rtnl_handle *);
 int rtnl_listen(struct rtnl_handle *, rtnl_listen_filter_t handler,
 		void *jarg);
+/*
+ * rtnl_listen() with a thread that only receives, into a ring of up to
+ * slots datagrams, while the handler runs on the caller's thread.
+ */
+int rtnl_listen_ring(struct rtnl_handle *, unsigned int slots,
+		     rtnl_listen_filter_t handler, void *jarg);
+
+/* Events shared with other processes, see lib/rtnl_shmring.c */
+struct rtnl_shmring;
+struct rtnl_shmring *rtnl_shmring_publish(const char *name, unsigned int size);
+int rtnl_shmring_write(struct rtnl_shmring *r, const struct nlmsghdr *n,
+		       int nsid);
+int rtnl_shmring_lost(struct rtnl_shmring *r);
+void rtnl_shmring_flush(struct rtnl_shmring *r);
+struct rtnl_shmring *rtnl_shmring_subscribe(const char *name);
+int rtnl_shmring_listen(struct rtnl_shmring *r, struct rtnl_handle *rth,
+			rtnl_listen_filter_t handler, void *jarg);
+void rtnl_shmring_close(struct rtnl_shmring *r);
+
+/* What rtnl_snapshot() dumps, see lib/rtnl_snapshot.c */
+struct rtnl_snapshot_dump {
+	int	family;
+	int	type;
+};
+
+int rtnl_snapshot(struct rtnl_handle *rth,
+		  const struct rtnl_snapshot_dump *dumps, unsigned int count,
+		  rtnl_listen_filter_t handler, void *jarg);
+void rtnl_grow_rcvbuf(struct rtnl_handle *rth);
 int rtnl_from_file(FILE *, rtnl_listen_filter_t handler,
 		   void *jarg);
 
@@ -8,13 +8,28 @@ int ll_remember_index(const struct sockaddr_nl *who,
 		      struct nlmsghdr *n, void *arg);
 
 int ll_init_map(struct rtnl_handle *rth);
+int ll_watch_map(void);
+void ll_sync_map(struct rtnl_handle *rth);
 unsigned ll_name_to_index(const char *name);
 const char *ll_index_to_name(unsigned idx);
 int ll_index_to_type(unsigned idx);
 int ll_index_to_flags(unsigned idx);
 unsigned namehash(const char *str);
+unsigned int *ll_index_list(unsigned int *count);
 
 const char *ll_idx_n2a(unsigned int idx);
 unsigned int ll_idx_a2n(const char *name);
 
+/*
+ * Symbolic mode, for requests that are built now and sent later: names
+ * not in the cache are not looked up but given indexes from LL_SYM_BASE
+ * on, which ll_sym_name() maps back to the name.
+ */
+#define LL_SYM_BASE	0x7fff0000U
+#define LL_SYM_MAX	0xffffU
+
+void ll_set_symbolic(int on);
+const char *ll_sym_name(unsigned int idx);
+unsigned int ll_sym_count(void);
+
 #endif /* __LL_MAP_H__ */
@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #ifndef NETNS_RUN_DIR
 #define NETNS_RUN_DIR "/var/run/netns"
@@ -52,6 +53,16 @@ static inline int setns(int fd, int nstype)
 int netns_switch(char *netns);
 int netns_get_fd(const char *netns);
 int netns_foreach(int (*func)(char *nsname, void *arg), void *arg);
+char **netns_names(unsigned int *count);
+void netns_names_free(char **names, unsigned int count);
+int netns_foreach_jobs(int (*func)(char *nsname, void *arg), void *arg,
+		       unsigned int jobs, bool show_label);
+
+/* in libnetlink, see lib/rtnl_netns.c */
+int netns_get_fd_cached(const char *netns);
+void netns_fd_cache_flush(void);
+int netns_socket(const char *netns, int domain, int type, int protocol);
+int netns_open_proc(const char *netns, const char *path, int flags);
 
 struct netns_func {
 	int (*func)(char *nsname, void *arg);
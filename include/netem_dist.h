@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __NETEM_DIST_H__
+#define __NETEM_DIST_H__ 1
+
+#include <linux/types.h>
+
+/*
+ * TYPE.distb: a netem distribution table ready to be sent, this header
+ * followed by entries __s16 values in the byte order of the host that
+ * made it. tc looks for it before TYPE.dist, the same table as text.
+ */
+#define NETEM_DISTB_MAGIC	0x424d454e	/* "NEMB" */
+#define NETEM_DISTB_VERSION	1
+
+/* the most entries the kernel takes, NETEM_DIST_MAX */
+#define NETEM_DIST_ENTRIES_MAX	16384
+
+struct netem_distb_hdr {
+	__u32	magic;
+	__u32	version;
+	__u32	entries;
+	__u32	flags;		/* 0 */
+};
+
+#endif /* __NETEM_DIST_H__ */
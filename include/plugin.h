@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __PLUGIN_H__
+#define __PLUGIN_H__ 1
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+ * Cache of resolved plugins (link_util, qdisc_util, ...) keyed by kind.
+ * Kinds that resolved to nothing are remembered too, so that each one
+ * is looked up once. The plugin directory is listed on first use, and
+ * only files found there are ever passed to dlopen().
+ *
+ * A cache is shared by all threads, unlike the rest of the tool state:
+ * a lookup holds plugin_lock() from plugin_find() to plugin_add(), and
+ * a util, once handed out, is never changed or freed.
+ */
+struct plugin_entry;
+
+struct plugin_cache {
+	pthread_mutex_t		lock;
+	struct plugin_entry	*table;
+	unsigned int		size;
+	unsigned int		count;
+	char			**files;
+	unsigned int		nfiles;
+	bool			scanned;
+};
+
+#define PLUGIN_CACHE_INIT	{ .lock = PTHREAD_MUTEX_INITIALIZER }
+
+void plugin_lock(struct plugin_cache *pc);
+void plugin_unlock(struct plugin_cache *pc);
+bool plugin_find(const struct plugin_cache *pc, const char *id, void **util);
+void plugin_add(struct plugin_cache *pc, const char *id, void *util);
+bool plugin_dir_has(struct plugin_cache *pc, const char *dir,
+		    const char *file);
+
+#endif /* __PLUGIN_H__ */
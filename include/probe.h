@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __PROBE_H__
+#define __PROBE_H__ 1
+
+/*
+ * USDT probes of provider iproute2, for bpftrace or perf to attach to a
+ * running program, e.g. bpftrace -e 'usdt:./ip:iproute2:send { ... }'.
+ * A probe that nothing is attached to is a nop; without <sys/sdt.h>
+ * they are compiled out. libnetlink has the message probes; ip, tc and
+ * bridge fire batch_line_start and batch_line_end around each command
+ * of a batch, with its line number.
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PROBE0(name)			DTRACE_PROBE(iproute2, name)
+#define PROBE1(name, a)			DTRACE_PROBE1(iproute2, name, a)
+#define PROBE2(name, a, b)		DTRACE_PROBE2(iproute2, name, a, b)
+#define PROBE3(name, a, b, c)		DTRACE_PROBE3(iproute2, name, a, b, c)
+#define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(iproute2, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e)	\
+	DTRACE_PROBE5(iproute2, name, a, b, c, d, e)
+#define PROBE6(name, a, b, c, d, e, f)	\
+	DTRACE_PROBE6(iproute2, name, a, b, c, d, e, f)
+#else
+/* type checked, but never evaluated */
+static inline void __probe_args(int dummy, ...) { }
+
+#define PROBE0(name)			do { } while (0)
+#define PROBE1(name, ...)		__PROBE_ARGS(__VA_ARGS__)
+#define PROBE2(name, ...)		__PROBE_ARGS(__VA_ARGS__)
+#define PROBE3(name, ...)		__PROBE_ARGS(__VA_ARGS__)
+#define PROBE4(name, ...)		__PROBE_ARGS(__VA_ARGS__)
+#define PROBE5(name, ...)		__PROBE_ARGS(__VA_ARGS__)
+#define PROBE6(name, ...)		__PROBE_ARGS(__VA_ARGS__)
+#define __PROBE_ARGS(...)		\
+	do { if (0) __probe_args(0, __VA_ARGS__); } while (0)
+#endif
+
+#endif /* __PROBE_H__ */
@@ -18,6 +18,9 @@ int rtnl_rtrealm_a2n(__u32 *id, const char *arg);
 int rtnl_dsfield_a2n(__u32 *id, const char *arg);
 int rtnl_group_a2n(int *id, const char *arg);
 
+/* Load every names database now, e.g. before forking workers */
+void rtnl_names_preload(void);
+
 const char *inet_proto_n2a(int proto, char *buf, int len);
 int inet_proto_a2n(const char *buf);
 
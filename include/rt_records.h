@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __RT_RECORDS_H__
+#define __RT_RECORDS_H__ 1
+
+#include <linux/pkt_sched.h>
+
+#include "libnetlink.h"
+
+/*
+ * Parsed views of rtnetlink objects for callers that want the data
+ * rather than text. Pointers refer into the netlink message, so a
+ * record is only valid as long as the message it was parsed from.
+ * The full attribute table is kept in tb[] for anything not decoded.
+ */
+
+struct rt_link {
+	const struct nlmsghdr		*n;
+	const struct ifinfomsg		*ifi;
+	struct rtattr			*tb[IFLA_MAX + 1];
+	int				index;
+	unsigned int			flags;
+	unsigned short			type;
+	const char			*name;
+	unsigned int			mtu;
+	int				master;		/* 0 if none */
+	int				link;		/* 0 if none */
+	__u8				operstate;
+	const __u8			*addr;
+	int				addr_len;
+	const char			*kind;		/* IFLA_INFO_KIND */
+	const struct rtnl_link_stats64	*stats64;
+};
+
+struct rt_addr {
+	const struct nlmsghdr		*n;
+	const struct ifaddrmsg		*ifa;
+	struct rtattr			*tb[IFA_MAX + 1];
+	int				family;
+	int				index;
+	__u8				prefixlen;
+	__u8				scope;
+	__u32				flags;		/* includes IFA_FLAGS */
+	const void			*local;
+	const void			*address;
+	int				addr_len;
+	const char			*label;
+	const struct ifa_cacheinfo	*cinfo;
+};
+
+struct rt_route {
+	const struct nlmsghdr		*n;
+	const struct rtmsg		*rtm;
+	struct rtattr			*tb[RTA_MAX + 1];
+	int				family;
+	__u8				type;
+	__u8				protocol;
+	__u8				scope;
+	__u8				dst_len;
+	__u8				src_len;
+	__u32				table;		/* includes RTA_TABLE */
+	const void			*dst;
+	const void			*src;
+	const void			*gateway;
+	const void			*prefsrc;
+	int				addr_len;	/* of dst, src, ... */
+	int				oif;
+	int				iif;
+	__u32				priority;
+	const struct rtattr		*multipath;	/* RTA_MULTIPATH */
+};
+
+struct rt_neigh {
+	const struct nlmsghdr		*n;
+	const struct ndmsg		*ndm;
+	struct rtattr			*tb[NDA_MAX + 1];
+	int				family;
+	int				index;
+	__u16				state;
+	__u8				flags;
+	__u8				type;
+	const void			*dst;
+	int				dst_len;
+	const __u8			*lladdr;
+	int				lladdr_len;
+};
+
+/* qdiscs, classes and filters */
+struct rt_tc {
+	const struct nlmsghdr		*n;
+	const struct tcmsg		*t;
+	struct rtattr			*tb[TCA_MAX + 1];
+	int				ifindex;
+	__u32				handle;
+	__u32				parent;
+	__u32				info;		/* filter prio/protocol */
+	const char			*kind;
+	const struct rtattr		*options;	/* TCA_OPTIONS */
+	const struct rtattr		*stats2;	/* TCA_STATS2 */
+	const struct tc_stats		*stats;		/* TCA_STATS */
+};
+
+/* return 0, or -1 if n is not a message of that kind */
+int rt_link_parse(const struct nlmsghdr *n, struct rt_link *l);
+int rt_addr_parse(const struct nlmsghdr *n, struct rt_addr *a);
+int rt_route_parse(const struct nlmsghdr *n, struct rt_route *r);
+int rt_neigh_parse(const struct nlmsghdr *n, struct rt_neigh *nb);
+int rt_tc_parse(const struct nlmsghdr *n, struct rt_tc *tc);
+
+/*
+ * Dump helpers: request the table and hand every record to the callback.
+ * A negative return from the callback stops the dump and is returned.
+ */
+typedef int (*rt_link_fn)(const struct rt_link *l, void *arg);
+typedef int (*rt_addr_fn)(const struct rt_addr *a, void *arg);
+typedef int (*rt_route_fn)(const struct rt_route *r, void *arg);
+typedef int (*rt_neigh_fn)(const struct rt_neigh *nb, void *arg);
+typedef int (*rt_tc_fn)(const struct rt_tc *tc, void *arg);
+
+int rt_link_dump(struct rtnl_handle *rth, int family,
+		 rt_link_fn fn, void *arg);
+int rt_addr_dump(struct rtnl_handle *rth, int family,
+		 rt_addr_fn fn, void *arg);
+int rt_route_dump(struct rtnl_handle *rth, int family,
+		  rt_route_fn fn, void *arg);
+int rt_neigh_dump(struct rtnl_handle *rth, int family,
+		  rt_neigh_fn fn, void *arg);
+/* ifindex 0 dumps all devices, a filter dump needs ifindex and parent */
+int rt_qdisc_dump(struct rtnl_handle *rth, int ifindex,
+		  rt_tc_fn fn, void *arg);
+int rt_class_dump(struct rtnl_handle *rth, int ifindex,
+		  rt_tc_fn fn, void *arg);
+int rt_filter_dump(struct rtnl_handle *rth, int ifindex, __u32 parent,
+		   rt_tc_fn fn, void *arg);
+
+#endif /* __RT_RECORDS_H__ */
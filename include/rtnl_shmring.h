@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __RTNL_SHMRING_H__
+#define __RTNL_SHMRING_H__ 1
+
+#include <linux/types.h>
+
+/*
+ * "ip monitor publish NAME" writes the netlink messages it receives
+ * into a POSIX shared memory object, RTNL_SHMRING_NAME with its uid and
+ * NAME, owned by that uid and readable by all, as the events are. The
+ * object is this header, then size bytes of ring, a power of two.
+ *
+ * The ring holds records of struct rtnl_shmring_rec and the message,
+ * each padded to 8 bytes. head and tail count the bytes ever written:
+ * the records between them are whole, the one at head is next. A record
+ * never wraps around the end of the ring: where less than a record
+ * header is left the next one starts at the beginning, and where less
+ * than the record is left a RTNL_SHMRING_F_PAD record fills it up.
+ *
+ * There is one writer and any number of readers, which map the object
+ * read only. The writer moves tail past what it is going to overwrite
+ * before it does, and head past what it wrote after. A reader keeps its
+ * own position, copies the record at it while it is below head, and
+ * only keeps the copy if tail has not gone past the position meanwhile.
+ * If it has, the reader was overrun: it goes on at tail, and the gap in
+ * seq, which counts the messages from 1, tells how many it missed.
+ *
+ * wake is a futex for the readers to sleep on, bumped and woken after
+ * head has moved. A RTNL_SHMRING_F_LOST record without a message says
+ * that the writer lost events itself.
+ */
+#define RTNL_SHMRING_NAME	"/ipmonitor.u%d.%s"
+#define RTNL_SHMRING_MAGIC	0x474e5252	/* "RRNG" */
+#define RTNL_SHMRING_VERSION	1
+
+#define RTNL_SHMRING_F_PAD	0x1
+#define RTNL_SHMRING_F_LOST	0x2
+
+struct rtnl_shmring_rec {
+	__u64		seq;
+	__u32		len;		/* of the record, from here, padded */
+	__s32		nsid;		/* of the message, -1 for none */
+	__u32		flags;
+	__u32		pad;
+};
+
+struct rtnl_shmring_hdr {
+	__u32		magic;
+	__u32		version;
+	__u32		size;
+	__s32		pid;		/* of the writer */
+	__u64		head;
+	__u64		tail;
+	__u64		seq;		/* of the last message written */
+	__u32		wake;
+	__u32		pad1;
+	__u64		pad[2];
+	char		data[];		/* the ring, from 64 bytes in */
+};
+
+#endif /* __RTNL_SHMRING_H__ */
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __SS_SAMPLE_H__
+#define __SS_SAMPLE_H__ 1
+
+#include <linux/types.h>
+
+/*
+ * The records "ss --sample --sample-binary" writes: this header once,
+ * then one record per TCP socket and sample, in host byte order. A
+ * reader skips past reclen bytes per record, so later versions may add
+ * fields at the end.
+ */
+#define SS_SAMPLE_MAGIC		0x4d415353	/* "SSAM" */
+#define SS_SAMPLE_VERSION	1
+
+struct ss_sample_hdr {
+	__u32		magic;
+	__u16		version;
+	__u16		reclen;		/* sizeof(struct ss_sample_rec) */
+	__u64		interval_ns;
+};
+
+struct ss_sample_rec {
+	__u64		cookie;
+	__u64		time_ns;	/* CLOCK_REALTIME */
+	__u8		family;
+	__u8		state;		/* of the socket, as in linux/tcp.h */
+	__u8		ca_state;
+	__u8		pad;
+	__u16		sport;
+	__u16		dport;
+	__u8		src[16];	/* IPv4 in the first 4 bytes */
+	__u8		dst[16];
+	__u32		rtt_us;
+	__u32		rttvar_us;
+	__u32		min_rtt_us;
+	__u32		snd_cwnd;
+	__u32		snd_ssthresh;
+	__u32		unacked;
+	__u32		lost;
+	__u32		total_retrans;
+	__u32		segs_out;
+	__u32		segs_in;
+	__u64		pacing_rate;	/* bytes per second */
+	__u64		delivery_rate;
+	__u64		bytes_acked;
+	__u64		bytes_received;
+};
+
+#endif /* __SS_SAMPLE_H__ */
@@ -15,28 +15,40 @@
 #include "rtm_map.h"
 #include "json_print.h"
 
-extern int preferred_family;
-extern int human_readable;
-extern int use_iec;
-extern int show_stats;
-extern int show_details;
-extern int show_raw;
-extern int resolve_hosts;
-extern int oneline;
-extern int brief;
-extern int json;
-extern int pretty;
-extern int timestamp;
-extern int timestamp_short;
-extern const char * _SL_;
-extern int max_flush_loops;
-extern int batch_mode;
-extern bool do_all;
+/*
+ * Options and other tool state are per thread, so that a program embedding
+ * the tools can run independent commands concurrently, one per thread.
+ * The registries of link, qdisc, filter, action and ematch kinds are the
+ * exception: they are shared, and filled on first use under a lock.
+ */
+extern __thread int preferred_family;
+extern __thread int human_readable;
+extern __thread int use_iec;
+extern __thread int show_stats;
+extern __thread int show_details;
+extern __thread int show_raw;
+extern __thread int resolve_hosts;
+extern __thread int oneline;
+extern __thread int brief;
+extern __thread int json;
+extern __thread int pretty;
+extern __thread int ndjson;
+extern __thread int cbor;
+extern __thread int timestamp;
+extern __thread int timestamp_short;
+extern __thread const char *_SL_;
+extern __thread int max_flush_loops;
+extern __thread int batch_mode;
+extern __thread bool do_all;
 
 #ifndef CONFDIR
 #define CONFDIR		"/etc/iproute2"
 #endif
 
+#ifndef NAMES_CACHEDIR
+#define NAMES_CACHEDIR	"/var/run/iproute2"
+#endif
+
 #define SPRINT_BSIZE 64
 #define SPRINT_BUF(x)	char x[SPRINT_BSIZE]
 
@@ -137,6 +149,10 @@ int get_hex(char c);
 int get_integer(int *val, const char *arg, int base);
 int get_unsigned(unsigned *val, const char *arg, int base);
 int get_time_rtt(unsigned *val, const char *arg, int *raw);
+int get_sample_interval(double *val, const char *arg);
+double timespec_diff(const struct timespec *a, const struct timespec *b);
+void timespec_add(struct timespec *t, double sec);
+void sample_wait(struct timespec *next, double interval);
 #define get_byte get_u8
 #define get_ushort get_u16
 #define get_short get_s16
@@ -168,6 +184,8 @@ const char *format_host_r(int af, int len, const void *addr,
 		      buf, buflen)
 
 const char *format_host(int af, int lne, const void *addr);
+void resolve_host_queue(int af, int len, const void *addr);
+void resolve_host_flush(void);
 #define format_host_rta(af, rta) \
 	format_host(af, RTA_PAYLOAD(rta), RTA_DATA(rta))
 const char *rt_addr_n2a_r(int af, int len, const void *addr,
@@ -285,10 +303,17 @@ unsigned int print_name_and_link(const char *fmt,
 #define htonll(x) ((1==htonl(1)) ? (x) : ((uint64_t)htonl((x) & 0xFFFFFFFF) << 32) | htonl((x) >> 32))
 #define ntohll(x) ((1==ntohl(1)) ? (x) : ((uint64_t)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32))
 
-extern int cmdlineno;
+extern __thread int cmdlineno;
 ssize_t getcmdline(char **line, size_t *len, FILE *in);
 int makeargs(char *line, char *argv[], int maxargs);
 
+struct cmdfile;
+struct cmdfile *cmdfile_open(const char *name);
+int cmdfile_next(struct cmdfile *cf, char ***argvp);
+void cmdfile_close(struct cmdfile *cf);
+/* words of a batch line, enough for a route with 128 nexthops */
+#define BATCH_MAX_ARGS	1024
+
 int do_each_netns(int (*func)(char *nsname, void *arg), void *arg,
 		bool show_label);
 
@@ -297,6 +322,45 @@ int get_guid(__u64 *guid, const char *arg);
 int get_real_family(int rtm_type, int rtm_family);
 
 int cmd_exec(const char *cmd, char **argv, bool do_fork);
+
+typedef int (*serve_cmd_fn)(int argc, char **argv);
+typedef void (*serve_sync_fn)(void);
+int serve_cmdlines(const char *path, serve_cmd_fn cmd, serve_sync_fn sync);
+
+/* seconds between the samples of an exporter, unless told otherwise */
+#define EXPORTER_INTERVAL	5
+typedef void (*exporter_tick_fn)(FILE *fp, int elapsed);
+int exporter_run(const char *addr, int interval, exporter_tick_fn tick);
+const char *exporter_name(char *buf, size_t len, const char *prefix,
+			  const char *id);
+void exporter_type(FILE *fp, const char *family, const char *type);
+void exporter_sample(FILE *fp, const char *family, const char *suffix,
+		     const char *label, const char *value,
+		     unsigned long long val);
+void exporter_sample_labels(FILE *fp, const char *family, const char *suffix,
+			    const char *const *labels, unsigned long long val);
+/* a family of counters served by statsd_run() */
+struct statsd_collector {
+	const char	*name;		/* of its socket, "<name><uid>" */
+	char		*source;	/* takes the signature of the daemon */
+	size_t		source_len;
+	int		(*sample)(int interval);	/* ms, 0 the first time */
+	void		(*dump)(FILE *fp);	/* what its clients read */
+};
+
+struct statsd_rate {
+	int		scan_interval;	/* ms */
+	int		time_constant;	/* ms */
+	double		w;
+};
+
+int statsd_run(struct statsd_collector *c, unsigned int count,
+	       int scan_interval, int time_constant);
+int statsd_connect(const char *name);
+void statsd_rate_init(struct statsd_rate *r, int scan_interval,
+		      int time_constant);
+void statsd_rate_update(const struct statsd_rate *r, double *rate,
+			unsigned long long incr, int interval);
 int make_path(const char *path, mode_t mode);
 char *find_cgroup2_mount(void);
 int get_command_name(const char *pid, char *comm, size_t len);
@@ -20,43 +20,54 @@
 
 #include "SNAPSHOT.h"
 #include "utils.h"
+#include "libgenl.h"
 #include "ip_common.h"
 #include "namespace.h"
+#include "rt_names.h"
 #include "color.h"
-
-int preferred_family = AF_UNSPEC;
-int human_readable;
-int use_iec;
-int show_stats;
-int show_details;
-int oneline;
-int brief;
-int json;
-int timestamp;
-const char *_SL_;
+#include "probe.h"
+
+__thread int preferred_family = AF_UNSPEC;
+__thread int human_readable;
+__thread int use_iec;
+__thread int show_stats;
+__thread int show_details;
+__thread int oneline;
+__thread int brief;
+__thread int json;
+__thread int timestamp;
+__thread const char *_SL_ = "\n";
 int force;
-int max_flush_loops = 10;
-int batch_mode;
-bool do_all;
+__thread int max_flush_loops = 10;
+__thread int batch_mode;
+__thread bool do_all;
+unsigned int all_jobs = 1;
+unsigned int dump_jobs = 1;
+static bool batch_cache;
+static bool use_uring;
 
-struct rtnl_handle rth = { .fd = -1 };
+__thread struct rtnl_handle rth = { .fd = -1 };
 
 static int usage(void)
 {
 	fprintf(stderr,
 "Usage: ip [ OPTIONS ] OBJECT { COMMAND | help }\n"
-"       ip [ -force ] -batch filename\n"
+"       ip [ -force ] -batch filename [ -batch-jobs N | -batch-cache |\n"
+"                                        -compile out ]\n"
+"       ip [ -force ] -replay file\n"
 "where  OBJECT := { link | address | addrlabel | route | rule | neigh | ntable |\n"
 "                   tunnel | tuntap | maddress | mroute | mrule | monitor | xfrm |\n"
 "                   netns | l2tp | fou | macsec | tcp_metrics | token | netconf | ila |\n"
 "                   vrf | sr }\n"
 "       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] | -r[esolve] |\n"
-"                    -h[uman-readable] | -iec | -j[son] | -p[retty] |\n"
+"                    -h[uman-readable] | -iec | -j[son] | -ndjson | -cbor | -p[retty] |\n"
 "                    -f[amily] { inet | inet6 | ipx | dnet | mpls | bridge | link } |\n"
 "                    -4 | -6 | -I | -D | -B | -0 |\n"
 "                    -l[oops] { maximum-addr-flush-attempts } | -br[ief] |\n"
 "                    -o[neline] | -t[imestamp] | -ts[hort] | -b[atch] [filename] |\n"
-"                    -rc[vbuf] [size] | -n[etns] name | -a[ll] | -c[olor]}\n");
+"                    -rc[vbuf] [size] | -n[etns] name | -a[ll] | -all-jobs N | -c[olor] |\n"
+"                    -dump-jobs N | -daemon socket | -stats-netlink | -timing |\n"
+"                    -uring }\n");
 	iprt_exit(-1);
 }
 
@@ -103,7 +114,7 @@ static const struct cmd {
 	{ 0 }
 };
 
-static int do_cmd(const char *argv0, int argc, char **argv)
+int do_cmd(const char *argv0, int argc, char **argv)
 {
 	const struct cmd *c;
 
@@ -116,41 +127,130 @@ static int do_cmd(const char *argv0, int argc, char **argv)
 	return EXIT_FAILURE;
 }
 
+#define IP_MAX_SUBC	8
+/*
+ * Commands that only send requests and wait for an ack, and whose
+ * argument parsing does not depend on the kernel state created by
+ * earlier commands in the same batch, can be pipelined.
+ */
+static bool batch_pipelined(int argc, char *argv[])
+{
+	static const char * const modify[IP_MAX_SUBC] = {
+		"add", "change", "replace", "append", "prepend", "delete",
+		NULL,
+	};
+	static const char * const objs[] = {
+		"address", "route", "rule", "neighbor", "neighbour", NULL,
+	};
+	int i, j;
+
+	if (argc < 2)
+		return false;
+
+	/*
+	 * Links are looked up by name, so only pipeline the commands that
+	 * cannot make a device appear under a new name.
+	 */
+	if (matches(argv[0], "link") == 0) {
+		if (matches(argv[1], "delete") == 0)
+			return true;
+		if (matches(argv[1], "set") && matches(argv[1], "change"))
+			return false;
+		for (i = 2; i < argc; i++)
+			if (strcmp(argv[i], "name") == 0 ||
+			    strcmp(argv[i], "netns") == 0)
+				return false;
+		return true;
+	}
+
+	for (i = 0; objs[i]; i++) {
+		if (matches(argv[0], objs[i]))
+			continue;
+		for (j = 0; modify[j]; j++)
+			if (matches(argv[1], modify[j]) == 0)
+				return true;
+	}
+
+	return false;
+}
+
+struct batch_async_ctx {
+	const char	*name;
+	int		ret;
+};
+
+static void batch_async_err(__u32 cookie, int error, void *arg)
+{
+	struct batch_async_ctx *ctx = arg;
+
+	fprintf(stderr, "Command failed %s:%u\n", ctx->name, cookie);
+	ctx->ret = EXIT_FAILURE;
+}
+
 static int batch(const char *name)
 {
-	char *line = NULL;
-	size_t len = 0;
+	struct batch_async_ctx async = { .name = name, .ret = EXIT_SUCCESS };
+	struct cmdfile *cf;
+	char **largv;
+	int largc, err;
 	int ret = EXIT_SUCCESS;
 	int orig_family = preferred_family;
 
 	batch_mode = 1;
+	/* generic netlink families may be reloaded while the batch runs */
+	genl_cache_watch();
 
-	if (name && strcmp(name, "-") != 0) {
-		if (freopen(name, "r", stdin) == NULL) {
-			fprintf(stderr,
-				"Cannot open file \"%s\" for reading: %s\n",
-				name, strerror(errno));
-			return EXIT_FAILURE;
-		}
-	}
+	cf = cmdfile_open(name);
+	if (!cf)
+		return EXIT_FAILURE;
 
 	if (rtnl_open(&rth, 0) < 0) {
 		fprintf(stderr, "Cannot open rtnetlink\n");
+		cmdfile_close(cf);
 		return EXIT_FAILURE;
 	}
+	rtnl_set_strict_dump(&rth);
+
+	/* the counters -s prints change without a notification */
+	if (batch_cache && show_stats)
+		fprintf(stderr, "Not caching dumps with -s\n");
+	else if (batch_cache && rtnl_dump_cache_enable(&rth) < 0)
+		fprintf(stderr, "Cannot watch for changes, not caching dumps\n");
+	if (use_uring && rtnl_uring_enable(&rth, 0, -1) < 0)
+		fprintf(stderr, "Cannot use io_uring: %s\n", strerror(errno));
+
+	/* keep the link cache in step with what earlier lines changed */
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, cache may go stale\n");
+
+	/*
+	 * Errors of pipelined commands show up a few lines late, which is
+	 * only acceptable when the batch does not stop on the first one.
+	 */
+	if (force && rtnl_async_begin(&rth, 0, batch_async_err, &async) < 0)
+		fprintf(stderr, "Cannot pipeline batch, continuing without\n");
 
 	cmdlineno = 0;
-	while (getcmdline(&line, &len, stdin) != -1) {
-		char *largv[100];
-		int largc;
-
+	while ((largc = cmdfile_next(cf, &largv)) != -1) {
 		preferred_family = orig_family;
 
-		largc = makeargs(line, largv, 100);
 		if (largc == 0)
 			continue;	/* blank line */
 
-		if (do_cmd(largv[0], largc, largv)) {
+		ll_sync_map(&rth);
+
+		if (rth.async && batch_pipelined(largc, largv)) {
+			rtnl_async_cookie(&rth, cmdlineno);
+			rth.flags |= RTNL_HANDLE_F_ASYNC;
+		} else if (rth.async) {
+			rtnl_async_flush(&rth);
+			rth.flags &= ~RTNL_HANDLE_F_ASYNC;
+		}
+
+		PROBE2(batch_line_start, cmdlineno, largv[0]);
+		err = do_cmd(largv[0], largc, largv);
+		PROBE2(batch_line_end, cmdlineno, err);
+		if (err) {
 			fprintf(stderr, "Command failed %s:%d\n",
 				name, cmdlineno);
 			ret = EXIT_FAILURE;
@@ -158,18 +258,70 @@ static int batch(const char *name)
 				break;
 		}
 	}
-	if (line)
-		free(line);
+	cmdfile_close(cf);
+
+	rtnl_async_end(&rth);
+	if (async.ret != EXIT_SUCCESS)
+		ret = async.ret;
 
 	rtnl_close(&rth);
 	return ret;
 }
 
+/*
+ * Each command runs in a child of the server, so what is only defined
+ * in the process, as nexthop groups and encap templates are, would be
+ * gone at its end.
+ */
+static int serve_cmd(int argc, char **argv)
+{
+	if (argc > 1 && matches(argv[0], "route") == 0 &&
+	    (strcmp(argv[1], "nhgroup") == 0 ||
+	     strcmp(argv[1], "encap") == 0)) {
+		fprintf(stderr,
+			"Error: \"route %s\" does not outlive a command of \"ip -daemon\"\n",
+			argv[1]);
+		return -1;
+	}
+	return do_cmd(argv[0], argc, argv);
+}
+
+static void serve_sync(void)
+{
+	ll_sync_map(&rth);
+	/* replies to a command that was killed halfway must not match */
+	rth.seq += 1 << 16;
+}
+
+static int serve(const char *path)
+{
+	batch_mode = 1;
+
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return EXIT_FAILURE;
+	}
+	rtnl_set_strict_dump(&rth);
+
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, cache may go stale\n");
+	ll_init_map(&rth);
+	rtnl_names_preload();
+
+	serve_cmdlines(path, serve_cmd, serve_sync);
+	rtnl_close(&rth);
+	return EXIT_FAILURE;
+}
+
 
 int main(int argc, char **argv)
 {
 	char *basename;
 	char *batch_file = NULL;
+	char *serve_path = NULL;
+	unsigned int jobs = 0;
+	char *compile_out = NULL;
+	char *replay_file = NULL;
 	int color = 0;
 
 	/* to run vrf exec without root, capabilities might be set, drop them
@@ -237,6 +389,12 @@ int main(int argc, char **argv)
 			++human_readable;
 		} else if (matches(opt, "-iec") == 0) {
 			++use_iec;
+		} else if (strcmp(opt, "-stats-netlink") == 0) {
+			rtnl_stats_enable();
+		} else if (strcmp(opt, "-timing") == 0) {
+			rtnl_timing_enable();
+		} else if (strcmp(opt, "-uring") == 0) {
+			use_uring = true;
 		} else if (matches(opt, "-stats") == 0 ||
 			   matches(opt, "-statistics") == 0) {
 			++show_stats;
@@ -262,10 +420,47 @@ int main(int argc, char **argv)
 			if (argc <= 1)
 				return usage();
 			batch_file = argv[1];
+		} else if (strcmp(opt, "-batch-jobs") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				return usage();
+			if (get_unsigned(&jobs, argv[1], 0) ||
+			    jobs < 1 || jobs > 1024) {
+				fprintf(stderr, "Invalid batch jobs '%s'\n",
+					argv[1]);
+				iprt_exit(-1);
+			}
+		} else if (strcmp(opt, "-batch-cache") == 0) {
+			batch_cache = true;
+		} else if (strcmp(opt, "-compile") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				return usage();
+			compile_out = argv[1];
+		} else if (strcmp(opt, "-replay") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				return usage();
+			replay_file = argv[1];
+		} else if (matches(opt, "-daemon") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				return usage();
+			serve_path = argv[1];
 		} else if (matches(opt, "-brief") == 0) {
 			++brief;
 		} else if (matches(opt, "-json") == 0) {
 			++json;
+		} else if (strcmp(opt, "-ndjson") == 0) {
+			++json;
+			++ndjson;
+		} else if (strcmp(opt, "-cbor") == 0) {
+			++json;
+			++cbor;
 		} else if (matches(opt, "-pretty") == 0) {
 			++pretty;
 		} else if (matches(opt, "-rcvbuf") == 0) {
@@ -289,6 +484,22 @@ int main(int argc, char **argv)
 			NEXT_ARG();
 			if (netns_switch(argv[1]))
 				iprt_exit(-1);
+		} else if (strcmp(opt, "-all-jobs") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&all_jobs, argv[1], 0) ||
+			    all_jobs < 1 || all_jobs > 1024) {
+				fprintf(stderr, "Invalid -all-jobs '%s'\n",
+					argv[1]);
+				iprt_exit(-1);
+			}
+		} else if (strcmp(opt, "-dump-jobs") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&dump_jobs, argv[1], 0) ||
+			    dump_jobs < 1 || dump_jobs > 1024) {
+				fprintf(stderr, "Invalid -dump-jobs '%s'\n",
+					argv[1]);
+				iprt_exit(-1);
+			}
 		} else if (matches(opt, "-all") == 0) {
 			do_all = true;
 		} else {
@@ -305,12 +516,28 @@ int main(int argc, char **argv)
 	if (color && !json)
 		enable_color();
 
+	/* the -batch-* modifiers mean nothing without a batch */
+	if (!batch_file && (compile_out || jobs || batch_cache))
+		return usage();
+	if (batch_file && compile_out)
+		return batch_compile(batch_file, compile_out);
+	if (replay_file)
+		return batch_replay(replay_file);
+	if (batch_file && jobs > 1)
+		return batch_jobs(batch_file, jobs);
 	if (batch_file)
 		return batch(batch_file);
 
+	if (serve_path)
+		return serve(serve_path);
+
 	if (rtnl_open(&rth, 0) < 0)
 		iprt_exit(1);
 
+	rtnl_set_strict_dump(&rth);
+	if (use_uring && rtnl_uring_enable(&rth, 0, -1) < 0)
+		fprintf(stderr, "Cannot use io_uring: %s\n", strerror(errno));
+
 	if (strlen(basename) > 2)
 		return do_cmd(basename+2, argc, argv);
 
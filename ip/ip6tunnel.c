@@ -54,7 +54,7 @@ static int usage(void)
 	fprintf(stderr, "          [ [i|o]seq ] [ [i|o]key KEY ] [ [i|o]csum ]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Where: NAME      := STRING\n");
-	fprintf(stderr, "       ADDR      := IPV6_ADDRESS\n");
+	fprintf(stderr, "       ADDR      := { IPV6_ADDRESS | IPV6_ADDRESS+NUMBER }\n");
 	fprintf(stderr, "       ELIM      := { none | 0..255 }(default=%d)\n",
 		IPV6_DEFAULT_TNL_ENCAP_LIMIT);
 	fprintf(stderr, "       TTL       := 0..255 (default=%d)\n",
@@ -62,6 +62,8 @@ static int usage(void)
 	fprintf(stderr, "       TCLASS    := { 0x0..0xff | inherit }\n");
 	fprintf(stderr, "       FLOWLABEL := { 0x0..0xfffff | inherit }\n");
 	fprintf(stderr, "       KEY       := { DOTTED_QUAD | NUMBER }\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "One argument of add may hold a range {FIRST..LAST}, as with \"ip link add\".\n");
 	iprt_exit(-1);
 }
 
@@ -172,13 +174,13 @@ static int parse_args(int argc, char **argv, int cmd, struct ip6_tnl_parm2 *p)
 			inet_prefix raddr;
 
 			NEXT_ARG();
-			get_addr(&raddr, *argv, AF_INET6);
+			tnl_get_addr(&raddr, *argv, AF_INET6);
 			memcpy(&p->raddr, &raddr.data, sizeof(p->raddr));
 		} else if (strcmp(*argv, "local") == 0) {
 			inet_prefix laddr;
 
 			NEXT_ARG();
-			get_addr(&laddr, *argv, AF_INET6);
+			tnl_get_addr(&laddr, *argv, AF_INET6);
 			memcpy(&p->laddr, &laddr.data, sizeof(p->laddr));
 		} else if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
@@ -374,40 +376,88 @@ static int do_show(int argc, char **argv)
 	return 0;
 }
 
+static const char *tnl_defname(const struct ip6_tnl_parm2 *p)
+{
+	if (p->proto == IPPROTO_GRE)
+		return "ip6gre0";
+	if (p->i_flags & VTI_ISVTI)
+		return "ip6_vti0";
+	return "ip6tnl0";
+}
+
+static int do_add_newlink(int argc, char **argv, void *arg)
+{
+	struct tnl_newlink_req req;
+	struct rtattr *linkinfo, *data;
+	struct ip6_tnl_parm2 p;
+
+	ip6_tnl_parm_init(&p, 1);
+
+	if (parse_args(argc, argv, SIOCADDTUNNEL, &p) < 0)
+		return -1;
+
+	if (p.i_flags & VTI_ISVTI) {
+		data = tnl_newlink_init(&req, p.name, "vti6", &linkinfo);
+		addattr32(&req.n, sizeof(req), IFLA_VTI_LINK, p.link);
+		addattr32(&req.n, sizeof(req), IFLA_VTI_IKEY, p.i_key);
+		addattr32(&req.n, sizeof(req), IFLA_VTI_OKEY, p.o_key);
+		addattr_l(&req.n, sizeof(req), IFLA_VTI_LOCAL, &p.laddr, 16);
+		addattr_l(&req.n, sizeof(req), IFLA_VTI_REMOTE, &p.raddr, 16);
+	} else if (p.proto == IPPROTO_GRE) {
+		data = tnl_newlink_init(&req, p.name, "ip6gre", &linkinfo);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_LINK, p.link);
+		addattr16(&req.n, sizeof(req), IFLA_GRE_IFLAGS, p.i_flags);
+		addattr16(&req.n, sizeof(req), IFLA_GRE_OFLAGS, p.o_flags);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_IKEY, p.i_key);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_OKEY, p.o_key);
+		addattr_l(&req.n, sizeof(req), IFLA_GRE_LOCAL, &p.laddr, 16);
+		addattr_l(&req.n, sizeof(req), IFLA_GRE_REMOTE, &p.raddr, 16);
+		addattr8(&req.n, sizeof(req), IFLA_GRE_TTL, p.hop_limit);
+		addattr8(&req.n, sizeof(req), IFLA_GRE_ENCAP_LIMIT,
+			 p.encap_limit);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_FLOWINFO, p.flowinfo);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_FLAGS, p.flags);
+	} else {
+		data = tnl_newlink_init(&req, p.name, "ip6tnl", &linkinfo);
+		addattr32(&req.n, sizeof(req), IFLA_IPTUN_LINK, p.link);
+		addattr_l(&req.n, sizeof(req), IFLA_IPTUN_LOCAL, &p.laddr, 16);
+		addattr_l(&req.n, sizeof(req), IFLA_IPTUN_REMOTE, &p.raddr, 16);
+		addattr8(&req.n, sizeof(req), IFLA_IPTUN_TTL, p.hop_limit);
+		addattr8(&req.n, sizeof(req), IFLA_IPTUN_ENCAP_LIMIT,
+			 p.encap_limit);
+		addattr32(&req.n, sizeof(req), IFLA_IPTUN_FLOWINFO, p.flowinfo);
+		addattr32(&req.n, sizeof(req), IFLA_IPTUN_FLAGS, p.flags);
+		addattr8(&req.n, sizeof(req), IFLA_IPTUN_PROTO, p.proto);
+	}
+
+	return tnl_newlink_add(&req, linkinfo, data, tnl_defname(&p), &p);
+}
+
 static int do_add(int cmd, int argc, char **argv)
 {
 	struct ip6_tnl_parm2 p;
-	const char *basedev = "ip6tnl0";
+
+	if (cmd == SIOCADDTUNNEL)
+		return iplink_range_cmd(argc, argv, do_add_newlink, NULL);
 
 	ip6_tnl_parm_init(&p, 1);
 
 	if (parse_args(argc, argv, cmd, &p) < 0)
 		return -1;
 
-	if (p.proto == IPPROTO_GRE)
-		basedev = "ip6gre0";
-	else if (p.i_flags & VTI_ISVTI)
-		basedev = "ip6_vti0";
-
-	return tnl_add_ioctl(cmd, basedev, p.name, &p);
+	return tnl_add_ioctl(cmd, tnl_defname(&p), p.name, &p);
 }
 
 static int do_del(int argc, char **argv)
 {
 	struct ip6_tnl_parm2 p;
-	const char *basedev = "ip6tnl0";
 
 	ip6_tnl_parm_init(&p, 1);
 
 	if (parse_args(argc, argv, SIOCDELTUNNEL, &p) < 0)
 		return -1;
 
-	if (p.proto == IPPROTO_GRE)
-		basedev = "ip6gre0";
-	else if (p.i_flags & VTI_ISVTI)
-		basedev = "ip6_vti0";
-
-	return tnl_del_ioctl(basedev, p.name, &p);
+	return tnl_del_ioctl(tnl_defname(&p), p.name, &p);
 }
 
 int do_ip6tunnel(int argc, char **argv)
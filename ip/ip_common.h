@@ -18,15 +18,17 @@ struct link_filter {
 	int up;
 	char *label;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_txq *flushq;
 	int group;
 	int master;
 	char *kind;
 	char *slave_kind;
+	int vf;		/* VF to show, or one of FILTER_VF_* */
 };
 
+#define FILTER_VF_NONE	-1	/* don't ask for VF info in dumps */
+#define FILTER_VF_ALL	-2
+
 int get_operstate(const char *name);
 int print_linkinfo(const struct sockaddr_nl *who,
 		   struct nlmsghdr *n, void *arg);
@@ -38,6 +40,7 @@ int print_neigh(const struct sockaddr_nl *who,
 		struct nlmsghdr *n, void *arg);
 int ipaddr_list_link(int argc, char **argv);
 int ipaddr_get_vf_rate(int, int *, int *, const char *);
+void ipaddr_set_vf_rate(int, int, int, const char *);
 int iplink_usage(void);
 
 void iproute_reset_filter(int ifindex);
@@ -58,12 +61,38 @@ int print_netconf(const struct sockaddr_nl *who,
 		  struct rtnl_ctrl_data *ctrl,
 		  struct nlmsghdr *n, void *arg);
 void netns_map_init(void);
+int netns_map_assign(void);
+void netns_map_forget(const char *name);
 int netns_nsid_socket_init(void);
 int print_nsid(const struct sockaddr_nl *who,
 	       struct nlmsghdr *n, void *arg);
 char *get_name_from_nsid(int nsid);
 int get_netnsid_from_name(const char *name);
 int set_netnsid_from_name(const char *name, int nsid);
+int do_cmd(const char *argv0, int argc, char **argv);
+int batch_jobs(const char *name, int jobs);
+int batch_compile(const char *name, const char *out);
+int batch_replay(const char *name);
+
+/* save files of ip route and ip address, see ipsave.c */
+struct ipsave_ops {
+	const char	*what;
+	__u32		magic;
+	int		nclasses;	/* restored one after the other */
+	int		(*classify)(const struct nlmsghdr *n);
+	void		(*edit)(struct nlmsghdr *n, void *arg);
+};
+
+struct ipsave_writer;
+struct ipsave_writer *ipsave_begin(const struct ipsave_ops *ops);
+int ipsave_add(struct ipsave_writer *w, struct nlmsghdr *n);
+int ipsave_end(struct ipsave_writer *w);
+void ipsave_abort(struct ipsave_writer *w);
+int ipsave_restore(const struct ipsave_ops *ops, void *arg);
+int ipsave_show(const struct ipsave_ops *ops, int fd,
+		rtnl_listen_filter_t fn, void *arg);
+int do_iproute_lookup(int argc, char **argv);
+
 int do_ipaddr(int argc, char **argv);
 int do_ipaddrlabel(int argc, char **argv);
 int do_iproute(int argc, char **argv);
@@ -93,7 +122,20 @@ int netns_identify_pid(const char *pidstr, char *name, int len);
 int do_seg6(int argc, char **argv);
 
 int iplink_get(unsigned int flags, char *name, __u32 filt_mask);
+int iplink_range_cmd(int argc, char **argv,
+		     int (*fn)(int argc, char **argv, void *arg), void *arg);
 int iplink_ifla_xstats(int argc, char **argv);
+int iplink_stats(int argc, char **argv);
+int ipmonitor_neigh_summary(FILE *fp, double interval, unsigned int top,
+			    int ifindex);
+
+typedef int (*route_emit_fn)(struct rtnl_ctrl_data *ctrl, struct nlmsghdr *n,
+			     unsigned int suppressed, void *arg);
+void ipmonitor_route_coalesce(unsigned int ms, route_emit_fn emit, void *arg);
+int ipmonitor_route_hold(struct rtnl_ctrl_data *ctrl, struct nlmsghdr *n);
+int ipmonitor_route_flush(int all);
+int print_route_coalesced(struct nlmsghdr *n, FILE *fp,
+			  unsigned int suppressed);
 
 int ip_linkaddr_list(int family, req_filter_fn_t filter_fn,
 		     struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo);
@@ -108,7 +150,9 @@ static inline int rtm_get_table(struct rtmsg *r, struct rtattr **tb)
 	return table;
 }
 
-extern struct rtnl_handle rth;
+extern __thread struct rtnl_handle rth;
+extern unsigned int all_jobs;
+extern unsigned int dump_jobs;
 
 struct iplink_req {
 	struct nlmsghdr		n;
@@ -147,6 +191,7 @@ int bridge_print_xstats(const struct sockaddr_nl *who,
 /* iproute_lwtunnel.c */
 int lwt_parse_encap(struct rtattr *rta, size_t len, int *argcp, char ***argvp);
 void lwt_print_encap(FILE *fp, struct rtattr *encap_type, struct rtattr *encap);
+int do_lwt_template(int argc, char **argv);
 
 /* iplink_xdp.c */
 int xdp_parse(int *argc, char ***argv, struct iplink_req *req, const char *ifname,
@@ -23,6 +23,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <fnmatch.h>
+#include <limits.h>
 
 #include <linux/netdevice.h>
 #include <linux/if_arp.h>
@@ -42,8 +43,8 @@ enum {
 	IPADD_SAVE,
 };
 
-static struct link_filter filter;
-static int do_link;
+static __thread struct link_filter filter;
+static __thread int do_link;
 
 static int usage(void)
 {
@@ -53,11 +54,13 @@ static int usage(void)
 	fprintf(stderr, "Usage: ip address {add|change|replace} IFADDR dev IFNAME [ LIFETIME ]\n");
 	fprintf(stderr, "                                                      [ CONFFLAG-LIST ]\n");
 	fprintf(stderr, "       ip address del IFADDR dev IFNAME [mngtmpaddr]\n");
+	fprintf(stderr, "       ip address {add|replace|del} { PREFIX split PLEN | file FILE }\n");
+	fprintf(stderr, "                  dev IFNAME [ LIFETIME ] [ CONFFLAG-LIST ]\n");
 	fprintf(stderr, "       ip address {save|flush} [ dev IFNAME ] [ scope SCOPE-ID ]\n");
 	fprintf(stderr, "                            [ to PREFIX ] [ FLAG-LIST ] [ label LABEL ] [up]\n");
 	fprintf(stderr, "       ip address [ show [ dev IFNAME ] [ scope SCOPE-ID ] [ master DEVICE ]\n");
 	fprintf(stderr, "                         [ type TYPE ] [ to PREFIX ] [ FLAG-LIST ]\n");
-	fprintf(stderr, "                         [ label LABEL ] [up] [ vrf NAME ] ]\n");
+	fprintf(stderr, "                         [ label LABEL ] [up] [ vrf NAME ] [ vf { NUM | all } ] ]\n");
 	fprintf(stderr, "       ip address {showdump|restore}\n");
 	fprintf(stderr, "IFADDR := PREFIX | ADDR peer PREFIX\n");
 	fprintf(stderr, "          [ broadcast ADDR ] [ anycast ADDR ]\n");
@@ -345,6 +348,19 @@ static void print_af_spec(FILE *fp, struct rtattr *af_spec_attr)
 
 static void print_vf_stats64(FILE *fp, struct rtattr *vfstats);
 
+/* the number of the VF an IFLA_VF_INFO nest describes, without parsing it */
+static int vfinfo_vf(const struct rtattr *vfinfo)
+{
+	const struct rtattr *rta = RTA_DATA(vfinfo);
+	int len = RTA_PAYLOAD(vfinfo);
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type == IFLA_VF_MAC &&
+		    RTA_PAYLOAD(rta) >= sizeof(struct ifla_vf_mac))
+			return ((struct ifla_vf_mac *)RTA_DATA(rta))->vf;
+	return -1;
+}
+
 static void print_vfinfo(FILE *fp, struct rtattr *vfinfo)
 {
 	struct ifla_vf_mac *vf_mac;
@@ -747,9 +763,16 @@ static void print_link_stats(FILE *fp, struct nlmsghdr *n)
 	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi),
 		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)));
 	__print_link_stats(fp, tb);
-	fprintf(fp, "%s", _SL_);
+	print_string(PRINT_FP, NULL, "%s", _SL_);
 }
 
+/* what the filters in print_linkinfo() and the brief output need */
+#define PRINT_LINK_BRIEF_IFLA					\
+	(RTA_WANT(IFLA_IFNAME) | RTA_WANT(IFLA_GROUP) |		\
+	 RTA_WANT(IFLA_MASTER) | RTA_WANT(IFLA_LINKINFO) |	\
+	 RTA_WANT(IFLA_LINK) | RTA_WANT(IFLA_LINK_NETNSID) |	\
+	 RTA_WANT(IFLA_OPERSTATE) | RTA_WANT(IFLA_ADDRESS))
+
 static int print_linkinfo_brief(FILE *fp, const char *name,
 				const struct ifinfomsg *ifi,
 				struct rtattr *tb[])
@@ -779,8 +802,6 @@ static int print_linkinfo_brief(FILE *fp, const char *name,
 		print_link_flags(fp, ifi->ifi_flags, m_flag);
 		print_string(PRINT_FP, NULL, "%s", "\n");
 	}
-
-	fflush(fp);
 	return 0;
 }
 
@@ -829,7 +850,11 @@ int print_linkinfo(const struct sockaddr_nl *who,
 	if (filter.up && !(ifi->ifi_flags&IFF_UP))
 		return -1;
 
-	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	if (brief)
+		parse_rtattr_want(tb, IFLA_MAX, PRINT_LINK_BRIEF_IFLA,
+				  IFLA_RTA(ifi), len);
+	else
+		parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
 
 	name = get_ifname_rta(ifi->ifi_index, tb[IFLA_IFNAME]);
 	if (!name)
@@ -1068,12 +1093,15 @@ int print_linkinfo(const struct sockaddr_nl *who,
 		__print_link_stats(fp, tb);
 	}
 
-	if ((do_link || show_details) && tb[IFLA_VFINFO_LIST] && tb[IFLA_NUM_VF]) {
+	if ((do_link || show_details || filter.vf != FILTER_VF_NONE) &&
+	    tb[IFLA_VFINFO_LIST] && tb[IFLA_NUM_VF]) {
 		struct rtattr *i, *vflist = tb[IFLA_VFINFO_LIST];
 		int rem = RTA_PAYLOAD(vflist);
 
 		open_json_array(PRINT_JSON, "vfinfo_list");
 		for (i = RTA_DATA(vflist); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+			if (filter.vf >= 0 && vfinfo_vf(i) != filter.vf)
+				continue;
 			open_json_object(NULL);
 			print_vfinfo(fp, i);
 			close_json_object();
@@ -1082,7 +1110,6 @@ int print_linkinfo(const struct sockaddr_nl *who,
 	}
 
 	print_string(PRINT_FP, NULL, "%s", "\n");
-	fflush(fp);
 	return 1;
 }
 
@@ -1094,15 +1121,13 @@ static int flush_update(void)
 	 * delete request (e.g. if ipv4 address promotion is disabled).
 	 * Since a flush operation is really a series of delete requests
 	 * its possible that we may request an address delete that has
-	 * already been done by the kernel. Therefore, ignore EADDRNOTAVAIL
-	 * errors returned from a flush request
+	 * already been done by the kernel. rtnl_flush_send() ignores the
+	 * EADDRNOTAVAIL errors this returns.
 	 */
-	if ((rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) &&
-	    (errno != EADDRNOTAVAIL)) {
-		perror("Failed to send flush request");
+	if (rtnl_flush_send(&rth, filter.flushq)) {
+		fprintf(stderr, "Failed to flush addresses\n");
 		return -1;
 	}
-	filter.flushp = 0;
 	return 0;
 }
 
@@ -1235,6 +1260,12 @@ static int ifa_label_match_rta(int ifindex, const struct rtattr *rta)
 	return fnmatch(filter.label, label, 0);
 }
 
+#define PRINT_ADDR_IFA						\
+	(RTA_WANT(IFA_ADDRESS) | RTA_WANT(IFA_LOCAL) |		\
+	 RTA_WANT(IFA_LABEL) | RTA_WANT(IFA_BROADCAST) |	\
+	 RTA_WANT(IFA_ANYCAST) | RTA_WANT(IFA_CACHEINFO) |	\
+	 RTA_WANT(IFA_FLAGS))
+
 int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		   void *arg)
 {
@@ -1254,11 +1285,11 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWADDR)
+	if (filter.flushq && n->nlmsg_type != RTM_NEWADDR)
 		return 0;
 
-	parse_rtattr(rta_tb, IFA_MAX, IFA_RTA(ifa),
-		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)));
+	parse_rtattr_want(rta_tb, IFA_MAX, PRINT_ADDR_IFA, IFA_RTA(ifa),
+			  n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)));
 
 	ifa_flags = get_ifa_flags(ifa, rta_tb[IFA_FLAGS]);
 
@@ -1283,19 +1314,9 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	if (inet_addr_match_rta(&filter.pfx, rta_tb[IFA_LOCAL]))
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELADDR;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flushq) {
+		if (rtnl_flush_add(filter.flushq, n, RTM_DELADDR) < 0)
+			return -1;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -1307,7 +1328,7 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	if (!brief) {
 		const char *name;
 
-		if (filter.oneline || filter.flushb) {
+		if (filter.oneline || filter.flushq) {
 			const char *dev = ll_index_to_name(ifa->ifa_index);
 
 			if (is_json_context()) {
@@ -1422,10 +1443,81 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	}
 	print_string(PRINT_FP, NULL, "%s", "\n");
 brief_exit:
-	fflush(fp);
 	return 0;
 }
 
+/* the addresses of a dump bucketed by ifa_index, each in dump order */
+struct addr_bucket {
+	int			ifindex;	/* 0 if free */
+	struct nlmsg_list	*head;
+	struct nlmsg_list	*tail;
+};
+
+struct addr_index {
+	struct addr_bucket	*buckets;
+	unsigned int		mask;
+};
+
+static struct addr_bucket *addr_index_slot(const struct addr_index *ai,
+					   int ifindex)
+{
+	unsigned int i = ifindex * 0x9e3779b1U;
+
+	for (;; i++) {
+		struct addr_bucket *b = &ai->buckets[i & ai->mask];
+
+		if (b->ifindex == ifindex || b->ifindex == 0)
+			return b;
+	}
+}
+
+/* relink the RTM_NEWADDR messages of ainfo into a list per device */
+static int addr_index_build(struct addr_index *ai, struct nlmsg_chain *ainfo)
+{
+	struct nlmsg_list *a, *next;
+	unsigned int count = 0, size = 16;
+
+	for (a = ainfo->head; a; a = a->next)
+		count++;
+	while (size < 2 * count)
+		size *= 2;
+
+	ai->buckets = calloc(size, sizeof(*ai->buckets));
+	if (!ai->buckets)
+		return -1;
+	ai->mask = size - 1;
+
+	for (a = ainfo->head; a; a = next) {
+		struct nlmsghdr *n = &a->h;
+		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+		struct addr_bucket *b;
+
+		next = a->next;
+		if (n->nlmsg_type != RTM_NEWADDR ||
+		    n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)) ||
+		    ifa->ifa_index == 0)
+			continue;
+
+		b = addr_index_slot(ai, ifa->ifa_index);
+		b->ifindex = ifa->ifa_index;
+		a->next = NULL;
+		if (b->tail)
+			b->tail->next = a;
+		else
+			b->head = a;
+		b->tail = a;
+	}
+	/* the chain is only good for free_nlmsg_chain() now */
+	ainfo->head = ainfo->tail = NULL;
+	return 0;
+}
+
+static struct nlmsg_list *addr_index_get(const struct addr_index *ai,
+					 int ifindex)
+{
+	return addr_index_slot(ai, ifindex)->head;
+}
+
 static int print_selected_addrinfo(struct ifinfomsg *ifi,
 				   struct nlmsg_list *ainfo, FILE *fp)
 {
@@ -1434,14 +1526,7 @@ static int print_selected_addrinfo(struct ifinfomsg *ifi,
 		struct nlmsghdr *n = &ainfo->h;
 		struct ifaddrmsg *ifa = NLMSG_DATA(n);
 
-		if (n->nlmsg_type != RTM_NEWADDR)
-			continue;
-
-		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
-			return -1;
-
-		if (ifa->ifa_index != ifi->ifi_index ||
-		    (filter.family && filter.family != ifa->ifa_family))
+		if (filter.family && filter.family != ifa->ifa_family)
 			continue;
 
 		if (filter.up && !(ifi->ifi_flags&IFF_UP))
@@ -1453,10 +1538,8 @@ static int print_selected_addrinfo(struct ifinfomsg *ifi,
 	}
 	close_json_array(PRINT_JSON, NULL);
 
-	if (brief) {
+	if (brief)
 		print_string(PRINT_FP, NULL, "%s", "\n");
-		fflush(fp);
-	}
 	return 0;
 }
 
@@ -1467,7 +1550,8 @@ static int store_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	struct nlmsg_chain *lchain = (struct nlmsg_chain *)arg;
 	struct nlmsg_list *h;
 
-	h = malloc(n->nlmsg_len+sizeof(void *));
+	h = arena_alloc(&lchain->arena,
+			offsetof(struct nlmsg_list, h) + n->nlmsg_len);
 	if (h == NULL)
 		return -1;
 
@@ -1484,57 +1568,15 @@ static int store_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	return 0;
 }
 
-static __u32 ipadd_dump_magic = 0x47361222;
-
-static int ipadd_save_prep(void)
-{
-	int ret;
-
-	if (isatty(STDOUT_FILENO)) {
-		fprintf(stderr, "Not sending a binary stream to stdout\n");
-		return -1;
-	}
-
-	ret = write(STDOUT_FILENO, &ipadd_dump_magic, sizeof(ipadd_dump_magic));
-	if (ret != sizeof(ipadd_dump_magic)) {
-		fprintf(stderr, "Can't write magic to dump file\n");
-		return -1;
-	}
-
-	return 0;
-}
-
-static int ipadd_dump_check_magic(void)
-{
-	int ret;
-	__u32 magic = 0;
-
-	if (isatty(STDIN_FILENO)) {
-		fprintf(stderr, "Can't restore address dump from a terminal\n");
-		return -1;
-	}
-
-	ret = fread(&magic, sizeof(magic), 1, stdin);
-	if (magic != ipadd_dump_magic) {
-		fprintf(stderr, "Magic mismatch (%d elems, %x magic)\n", ret, magic);
-		return -1;
-	}
-
-	return 0;
-}
+static const struct ipsave_ops ipaddr_save_ops = {
+	.what		= "address",
+	.magic		= 0x47361222,
+};
 
 static int save_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		       void *arg)
 {
-	int ret;
-
-	ret = write(STDOUT_FILENO, n, n->nlmsg_len);
-	if ((ret > 0) && (ret != n->nlmsg_len)) {
-		fprintf(stderr, "Short write while saving nlmsg\n");
-		ret = -EIO;
-	}
-
-	return ret == n->nlmsg_len ? 0 : ret;
+	return ipsave_add(arg, n);
 }
 
 static int show_handler(const struct sockaddr_nl *nl,
@@ -1554,15 +1596,12 @@ static int ipaddr_showdump(void)
 {
 	int err;
 
-	if (ipadd_dump_check_magic())
-		iprt_exit(-1);
-
 	if (new_json_obj(json))
 		return -1;
 	open_json_object(NULL);
 	open_json_array(PRINT_JSON, "addr_info");
 
-	err = rtnl_from_file(stdin, &show_handler, NULL);
+	err = ipsave_show(&ipaddr_save_ops, STDIN_FILENO, show_handler, NULL);
 
 	close_json_array(PRINT_JSON, NULL);
 	close_json_object();
@@ -1571,45 +1610,23 @@ static int ipaddr_showdump(void)
 	iprt_exit(err);
 }
 
-static int restore_handler(const struct sockaddr_nl *nl,
-			   struct rtnl_ctrl_data *ctrl,
-			   struct nlmsghdr *n, void *arg)
-{
-	int ret;
-
-	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
-
-	ll_init_map(&rth);
-
-	ret = rtnl_talk(&rth, n, NULL);
-	if ((ret < 0) && (errno == EEXIST))
-		ret = 0;
-
-	return ret;
-}
-
 static int ipaddr_restore(void)
 {
-	if (ipadd_dump_check_magic())
-		iprt_exit(-1);
-
-	iprt_exit(rtnl_from_file(stdin, &restore_handler, NULL));
+	iprt_exit(ipsave_restore(&ipaddr_save_ops, NULL));
 }
 
 void free_nlmsg_chain(struct nlmsg_chain *info)
 {
-	struct nlmsg_list *l, *n;
-
-	for (l = info->head; l; l = n) {
-		n = l->next;
-		free(l);
-	}
+	arena_free(&info->arena);
+	info->head = info->tail = NULL;
 }
 
-static void ipaddr_filter(struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
+static void ipaddr_filter(struct nlmsg_chain *linfo,
+			  const struct addr_index *ai)
 {
 	struct nlmsg_list *l, **lp;
 
+	linfo->tail = NULL;
 	lp = &linfo->head;
 	while ((l = *lp) != NULL) {
 		int ok = 0;
@@ -1617,14 +1634,12 @@ static void ipaddr_filter(struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
 		struct ifinfomsg *ifi = NLMSG_DATA(&l->h);
 		struct nlmsg_list *a;
 
-		for (a = ainfo->head; a; a = a->next) {
+		for (a = addr_index_get(ai, ifi->ifi_index); a; a = a->next) {
 			struct nlmsghdr *n = &a->h;
 			struct ifaddrmsg *ifa = NLMSG_DATA(n);
 			struct rtattr *tb[IFA_MAX + 1];
 			unsigned int ifa_flags;
 
-			if (ifa->ifa_index != ifi->ifi_index)
-				continue;
 			missing_net_address = 0;
 			if (filter.family && filter.family != ifa->ifa_family)
 				continue;
@@ -1653,23 +1668,28 @@ static void ipaddr_filter(struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
 			ok = 1;
 		if (!ok) {
 			*lp = l->next;
-			free(l);
-		} else
+		} else {
+			linfo->tail = l;
 			lp = &l->next;
+		}
 	}
 }
 
-static int ipaddr_flush(void)
+static int ipaddr_dump_filter(struct nlmsghdr *nlh, int reqlen)
 {
-	int round = 0;
-	char flushb[4096-512];
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
 
-	filter.flushb = flushb;
-	filter.flushp = 0;
-	filter.flushe = sizeof(flushb);
+	ifa->ifa_index = filter.ifindex;
+	return 0;
+}
+
+static int ipaddr_flush_rounds(void)
+{
+	int round = 0;
 
 	while ((max_flush_loops == 0) || (round < max_flush_loops)) {
-		if (rtnl_wilddump_request(&rth, filter.family, RTM_GETADDR) < 0) {
+		if (rtnl_addrdump_req(&rth, filter.family,
+				      ipaddr_dump_filter) < 0) {
 			perror("Cannot send dump request");
 			iprt_exit(1);
 		}
@@ -1712,11 +1732,39 @@ static int ipaddr_flush(void)
 	return 1;
 }
 
+static int ipaddr_flush(void)
+{
+	struct rtnl_txq flushq = {};
+	int ret;
+
+	filter.flushq = &flushq;
+	ret = ipaddr_flush_rounds();
+	filter.flushq = NULL;
+	rtnl_txq_free(&flushq);
+	return ret;
+}
+
+/*
+ * Only have VF info sent when it is asked for, it can be most of the
+ * dump on SR-IOV hosts, and counters only with -s. Brief output prints
+ * neither.
+ */
+static __u32 iplink_ext_mask(void)
+{
+	__u32 mask = 0;
+
+	if (!brief && (show_details || filter.vf != FILTER_VF_NONE))
+		mask |= RTEXT_FILTER_VF;
+	if (brief || !show_stats)
+		mask |= RTEXT_FILTER_SKIP_STATS;
+	return mask;
+}
+
 static int iplink_filter_req(struct nlmsghdr *nlh, int reqlen)
 {
 	int err;
 
-	err = addattr32(nlh, reqlen, IFLA_EXT_MASK, RTEXT_FILTER_VF);
+	err = addattr32(nlh, reqlen, IFLA_EXT_MASK, iplink_ext_mask());
 	if (err)
 		return err;
 
@@ -1742,12 +1790,30 @@ static int iplink_filter_req(struct nlmsghdr *nlh, int reqlen)
 	return 0;
 }
 
-/* fills in linfo with link data and optionally ainfo with address info
- * caller can walk lists as desired and must call free_nlmsg_chain for
- * both when done
- */
-int ip_linkaddr_list(int family, req_filter_fn_t filter_fn,
-		     struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
+/* fetch the one link ifindex into linfo rather than dumping them all */
+static int ip_link_get_one(int ifindex, struct nlmsg_chain *linfo)
+{
+	struct iplink_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETLINK,
+		.i.ifi_family = preferred_family,
+		.i.ifi_index = ifindex,
+	};
+	struct nlmsghdr *answer;
+	int ret;
+
+	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK, iplink_ext_mask());
+
+	if (rtnl_talk(&rth, &req.n, &answer) < 0)
+		return 1;
+
+	ret = store_nlmsg(NULL, answer, linfo);
+	free(answer);
+	return ret < 0 ? 1 : 0;
+}
+
+static int ip_link_list(req_filter_fn_t filter_fn, struct nlmsg_chain *linfo)
 {
 	if (rtnl_wilddump_req_filter_fn(&rth, preferred_family, RTM_GETLINK,
 					filter_fn) < 0) {
@@ -1759,18 +1825,36 @@ int ip_linkaddr_list(int family, req_filter_fn_t filter_fn,
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
+	return 0;
+}
 
-	if (ainfo) {
-		if (rtnl_wilddump_request(&rth, family, RTM_GETADDR) < 0) {
-			perror("Cannot send dump request");
-			return 1;
-		}
+/* a strict kernel only returns the addresses of filter.ifindex, if set */
+static int ip_addr_list(int family, struct nlmsg_chain *ainfo)
+{
+	if (rtnl_addrdump_req(&rth, family, ipaddr_dump_filter) < 0) {
+		perror("Cannot send dump request");
+		return 1;
+	}
 
-		if (rtnl_dump_filter(&rth, store_nlmsg, ainfo) < 0) {
-			fprintf(stderr, "Dump terminated\n");
-			return 1;
-		}
+	if (rtnl_dump_filter(&rth, store_nlmsg, ainfo) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return 1;
 	}
+	return 0;
+}
+
+/* fills in linfo with link data and optionally ainfo with address info
+ * caller can walk lists as desired and must call free_nlmsg_chain for
+ * both when done
+ */
+int ip_linkaddr_list(int family, req_filter_fn_t filter_fn,
+		     struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
+{
+	if (ip_link_list(filter_fn, linfo))
+		return 1;
+
+	if (ainfo && ip_addr_list(family, ainfo))
+		return 1;
 
 	return 0;
 }
@@ -1779,6 +1863,7 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 {
 	struct nlmsg_chain linfo = { NULL, NULL};
 	struct nlmsg_chain _ainfo = { NULL, NULL}, *ainfo = NULL;
+	struct addr_index ai = { NULL, 0 };
 	struct nlmsg_list *l;
 	char *filter_dev = NULL;
 	int no_link = 0;
@@ -1787,6 +1872,7 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 	filter.showqueue = 1;
 	filter.family = preferred_family;
 	filter.group = -1;
+	filter.vf = FILTER_VF_NONE;
 
 	if (action == IPADD_FLUSH) {
 		if (argc <= 0) {
@@ -1848,6 +1934,16 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 			if (!name_is_vrf(*argv))
 				return invarg("Not a valid VRF name\n", *argv);
 			filter.master = ifindex;
+		} else if (strcmp(*argv, "vf") == 0) {
+			unsigned int vf;
+
+			NEXT_ARG();
+			if (strcmp(*argv, "all") == 0)
+				filter.vf = FILTER_VF_ALL;
+			else if (get_unsigned(&vf, *argv, 0) || vf > INT_MAX)
+				return invarg("Invalid \"vf\" value\n", *argv);
+			else
+				filter.vf = vf;
 		} else if (strcmp(*argv, "type") == 0) {
 			int soff;
 
@@ -1883,20 +1979,23 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 		return ipaddr_flush();
 
 	if (action == IPADD_SAVE) {
-		if (ipadd_save_prep())
+		struct ipsave_writer *save = ipsave_begin(&ipaddr_save_ops);
+
+		if (!save)
 			iprt_exit(1);
 
-		if (rtnl_wilddump_request(&rth, preferred_family, RTM_GETADDR) < 0) {
+		if (rtnl_addrdump_req(&rth, preferred_family, NULL) < 0) {
 			perror("Cannot send dump request");
 			iprt_exit(1);
 		}
 
-		if (rtnl_dump_filter(&rth, save_nlmsg, stdout) < 0) {
+		if (rtnl_dump_filter(&rth, save_nlmsg, save) < 0) {
 			fprintf(stderr, "Save terminated\n");
+			ipsave_abort(save);
 			iprt_exit(1);
 		}
 
-		iprt_exit(0);
+		iprt_exit(ipsave_end(save) ? 1 : 0);
 	}
 
 	/*
@@ -1912,13 +2011,13 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 	 * the link device
 	 */
 	if (filter_dev && filter.group == -1 && do_link == 1) {
-		if (iplink_get(0, filter_dev, RTEXT_FILTER_VF) < 0) {
+		if (iplink_get(0, filter_dev, iplink_ext_mask()) < 0) {
 			perror("Cannot send link get request");
 			delete_json_obj();
 			iprt_exit(1);
 		}
 		delete_json_obj();
-		iprt_exit(0);
+		return 0;
 	}
 
 	if (filter.family != AF_PACKET) {
@@ -1928,12 +2027,23 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 			no_link = 1;
 	}
 
-	if (ip_linkaddr_list(filter.family, iplink_filter_req,
-			     &linfo, ainfo) != 0)
+	/* -6 keeps the reduced link info of the inet6 link dump */
+	if (filter.ifindex && preferred_family != AF_INET6) {
+		if (ip_link_get_one(filter.ifindex, &linfo))
+			goto out;
+	} else if (ip_link_list(iplink_filter_req, &linfo)) {
+		goto out;
+	}
+	if (ainfo && ip_addr_list(filter.family, ainfo))
 		goto out;
 
-	if (filter.family != AF_PACKET)
-		ipaddr_filter(&linfo, ainfo);
+	if (filter.family != AF_PACKET) {
+		if (addr_index_build(&ai, ainfo) < 0) {
+			perror("Cannot index addresses");
+			goto out;
+		}
+		ipaddr_filter(&linfo, &ai);
+	}
 
 	for (l = linfo.head; l; l = l->next) {
 		struct nlmsghdr *n = &l->h;
@@ -1944,7 +2054,8 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 		if (brief || !no_link)
 			res = print_linkinfo(NULL, n, stdout);
 		if (res >= 0 && filter.family != AF_PACKET)
-			print_selected_addrinfo(ifi, ainfo->head, stdout);
+			print_selected_addrinfo(ifi,
+				addr_index_get(&ai, ifi->ifi_index), stdout);
 		if (res > 0 && !do_link && show_stats)
 			print_link_stats(stdout, n);
 		close_json_object();
@@ -1952,6 +2063,7 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 	fflush(stdout);
 
 out:
+	free(ai.buckets);
 	if (ainfo)
 		free_nlmsg_chain(ainfo);
 	free_nlmsg_chain(&linfo);
@@ -1959,43 +2071,116 @@ out:
 	return 0;
 }
 
-static int
-ipaddr_loop_each_vf(struct rtattr *tb[], int vfnum, int *min, int *max)
+/*
+ * The min/max rates of the VFs of a PF, read with the first rate change
+ * that leaves one of them out and kept up to date with the rates asked
+ * for since, so a batch setting many VFs of a PF fetches it once.
+ */
+struct vf_rates {
+	struct vf_rates		*next;
+	int			ifindex;
+	int			count;
+	struct ifla_vf_rate	rate[];
+};
+
+static struct vf_rates *vf_rates_cache;
+
+static const struct rtattr *vfinfo_rate(const struct rtattr *vfinfo)
+{
+	const struct rtattr *rta = RTA_DATA(vfinfo);
+	int len = RTA_PAYLOAD(vfinfo);
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type == IFLA_VF_RATE &&
+		    RTA_PAYLOAD(rta) >= sizeof(struct ifla_vf_rate))
+			return rta;
+	return NULL;
+}
+
+static struct vf_rates *vf_rates_fetch(int ifindex)
 {
-	struct rtattr *vflist = tb[IFLA_VFINFO_LIST];
-	struct rtattr *i, *vf[IFLA_VF_MAX+1];
-	struct ifla_vf_rate *vf_rate;
-	int rem;
+	struct iplink_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETLINK,
+		.i.ifi_family = AF_UNSPEC,
+		.i.ifi_index = ifindex,
+	};
+	struct rtattr *tb[IFLA_MAX+1], *i;
+	struct nlmsghdr *answer;
+	struct ifinfomsg *ifi;
+	struct vf_rates *vr;
+	int len, rem, count = 0;
 
-	rem = RTA_PAYLOAD(vflist);
+	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK,
+		  RTEXT_FILTER_VF | RTEXT_FILTER_SKIP_STATS);
+	if (rtnl_talk(&rth, &req.n, &answer) < 0)
+		iprt_exit(1);
 
-	for (i = RTA_DATA(vflist); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
-		parse_rtattr_nested(vf, IFLA_VF_MAX, i);
+	ifi = NLMSG_DATA(answer);
+	len = answer->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	parse_rtattr_want(tb, IFLA_MAX, RTA_WANT(IFLA_VFINFO_LIST),
+			  IFLA_RTA(ifi), len < 0 ? 0 : len);
 
-		if (!vf[IFLA_VF_RATE]) {
-			fprintf(stderr, "VF min/max rate API not supported\n");
-			iprt_exit(1);
-		}
+	if (tb[IFLA_VFINFO_LIST]) {
+		rem = RTA_PAYLOAD(tb[IFLA_VFINFO_LIST]);
+		for (i = RTA_DATA(tb[IFLA_VFINFO_LIST]); RTA_OK(i, rem);
+		     i = RTA_NEXT(i, rem))
+			count++;
+	}
 
-		vf_rate = RTA_DATA(vf[IFLA_VF_RATE]);
-		if (vf_rate->vf == vfnum) {
-			*min = vf_rate->min_tx_rate;
-			*max = vf_rate->max_tx_rate;
-			return 0;
+	vr = malloc(sizeof(*vr) + count * sizeof(vr->rate[0]));
+	if (!vr) {
+		perror("malloc");
+		iprt_exit(1);
+	}
+	vr->ifindex = ifindex;
+	vr->count = 0;
+
+	if (tb[IFLA_VFINFO_LIST]) {
+		rem = RTA_PAYLOAD(tb[IFLA_VFINFO_LIST]);
+		for (i = RTA_DATA(tb[IFLA_VFINFO_LIST]); RTA_OK(i, rem);
+		     i = RTA_NEXT(i, rem)) {
+			const struct rtattr *rate = vfinfo_rate(i);
+
+			if (!rate) {
+				fprintf(stderr, "VF min/max rate API not supported\n");
+				iprt_exit(1);
+			}
+			vr->rate[vr->count++] = *(struct ifla_vf_rate *)RTA_DATA(rate);
 		}
 	}
-	fprintf(stderr, "Cannot find VF %d\n", vfnum);
-	iprt_exit(1);
+	free(answer);
+
+	vr->next = vf_rates_cache;
+	vf_rates_cache = vr;
+	return vr;
+}
+
+static struct ifla_vf_rate *vf_rate_find(int ifindex, int vfnum, int fetch)
+{
+	struct vf_rates *vr;
+	int i;
+
+	for (vr = vf_rates_cache; vr; vr = vr->next)
+		if (vr->ifindex == ifindex)
+			break;
+	if (!vr) {
+		if (!fetch)
+			return NULL;
+		vr = vf_rates_fetch(ifindex);
+	}
+
+	for (i = 0; i < vr->count; i++)
+		if (vr->rate[i].vf == vfnum)
+			return &vr->rate[i];
+	return NULL;
 }
 
 int ipaddr_get_vf_rate(int vfnum, int *min, int *max, const char *dev)
 {
-	struct nlmsg_chain linfo = { NULL, NULL};
-	struct rtattr *tb[IFLA_MAX+1];
-	struct ifinfomsg *ifi;
-	struct nlmsg_list *l;
-	struct nlmsghdr *n;
-	int idx, len;
+	struct ifla_vf_rate *rate;
+	int idx;
 
 	idx = ll_name_to_index(dev);
 	if (idx == 0) {
@@ -2003,30 +2188,27 @@ int ipaddr_get_vf_rate(int vfnum, int *min, int *max, const char *dev)
 		iprt_exit(1);
 	}
 
-	if (rtnl_wilddump_request(&rth, AF_UNSPEC, RTM_GETLINK) < 0) {
-		perror("Cannot send dump request");
+	rate = vf_rate_find(idx, vfnum, 1);
+	if (!rate) {
+		fprintf(stderr, "Cannot find VF %d\n", vfnum);
 		iprt_exit(1);
 	}
-	if (rtnl_dump_filter(&rth, store_nlmsg, &linfo) < 0) {
-		fprintf(stderr, "Dump terminated\n");
-		iprt_exit(1);
-	}
-	for (l = linfo.head; l; l = l->next) {
-		n = &l->h;
-		ifi = NLMSG_DATA(n);
-
-		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
-		if (len < 0 || (idx && idx != ifi->ifi_index))
-			continue;
+	*min = rate->min_tx_rate;
+	*max = rate->max_tx_rate;
+	return 0;
+}
 
-		parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+/* what a request is about to set, for the next ipaddr_get_vf_rate() */
+void ipaddr_set_vf_rate(int vfnum, int min, int max, const char *dev)
+{
+	struct ifla_vf_rate *rate;
+	int idx = ll_name_to_index(dev);
 
-		if ((tb[IFLA_VFINFO_LIST] && tb[IFLA_NUM_VF])) {
-			ipaddr_loop_each_vf(tb, vfnum, min, max);
-			return 0;
-		}
+	rate = idx ? vf_rate_find(idx, vfnum, 0) : NULL;
+	if (rate) {
+		rate->min_tx_rate = min;
+		rate->max_tx_rate = max;
 	}
-	return 0;
 }
 
 int ipaddr_list_link(int argc, char **argv)
@@ -2041,6 +2223,7 @@ void ipaddr_reset_filter(int oneline, int ifindex)
 	memset(&filter, 0, sizeof(filter));
 	filter.oneline = oneline;
 	filter.ifindex = ifindex;
+	filter.vf = FILTER_VF_ALL;
 }
 
 static int default_scope(inet_prefix *lcl)
@@ -2062,6 +2245,255 @@ static bool ipaddr_is_multicast(inet_prefix *a)
 		return false;
 }
 
+/*
+ * Many addresses sharing everything but the address itself, from a
+ * prefix split into smaller ones or from a file, go out as copies of one
+ * request with IFA_LOCAL, IFA_ADDRESS and the prefix length patched,
+ * pipelined.
+ */
+#define IPADDR_BULK_MAX_SPLIT	24
+#define IPADDR_BULK_MAX_ERRORS	10
+
+struct ipaddr_bulk {
+	const char	*file;
+	inet_prefix	*addrs;		/* read from file */
+	unsigned int	count;
+	inet_prefix	base;		/* or split into count */
+	unsigned int	split;
+	unsigned int	failed;
+};
+
+static int ipaddr_bulk_read(struct ipaddr_bulk *b, int family)
+{
+	int saved_lineno = cmdlineno;
+	unsigned int size = 0;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp = stdin;
+	int ret = 0;
+
+	if (strcmp(b->file, "-") != 0) {
+		fp = fopen(b->file, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				b->file, strerror(errno));
+			return -1;
+		}
+	}
+
+	/* nothing is sent unless the whole file makes sense */
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[2];
+		inet_prefix *p;
+
+		if (makeargs(line, largv, 2) == 0)
+			continue;
+
+		if (b->count == size) {
+			size = size ? size * 2 : 1024;
+			p = realloc(b->addrs, size * sizeof(*p));
+			if (!p) {
+				perror("Cannot read addresses");
+				ret = -1;
+				break;
+			}
+			b->addrs = p;
+		}
+		p = &b->addrs[b->count];
+		if (get_prefix_1(p, largv[0], family) ||
+		    (p->family != AF_INET && p->family != AF_INET6)) {
+			fprintf(stderr, "%s:%d: invalid address \"%s\"\n",
+				b->file, cmdlineno, largv[0]);
+			ret = -1;
+			break;
+		}
+		if (!family)
+			family = p->family;
+		else if (p->family != family) {
+			fprintf(stderr, "%s:%d: \"%s\" is not of the family of the others\n",
+				b->file, cmdlineno, largv[0]);
+			ret = -1;
+			break;
+		}
+		/* errors are told by line */
+		p->flags = cmdlineno;
+		b->count++;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = saved_lineno;
+
+	if (!ret && !b->count) {
+		fprintf(stderr, "No addresses in \"%s\"\n", b->file);
+		ret = -1;
+	}
+	return ret;
+}
+
+/* The i-th prefix of the split: the base with i in its bits base..split */
+static void ipaddr_bulk_nth(const struct ipaddr_bulk *b, unsigned int i,
+			    inet_prefix *p)
+{
+	int shift = b->base.bytelen * 8 - b->split;
+	int byte = b->base.bytelen - 1 - shift / 8;
+	__u64 v = (__u64)i << (shift % 8);
+	__u8 *data = (__u8 *)p->data;
+
+	if (b->addrs) {
+		*p = b->addrs[i];
+		return;
+	}
+
+	*p = b->base;
+	p->bitlen = b->split;
+	for (; v && byte >= 0; byte--) {
+		v += data[byte];
+		data[byte] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+static void ipaddr_bulk_err(__u32 cookie, int error, void *arg)
+{
+	struct ipaddr_bulk *b = arg;
+	inet_prefix p;
+
+	if (b->failed++ >= IPADDR_BULK_MAX_ERRORS)
+		return;
+
+	ipaddr_bulk_nth(b, cookie - 1, &p);
+	if (b->addrs)
+		fprintf(stderr, "%s:%d: ", b->file, p.flags);
+	fprintf(stderr, "%s/%d: RTNETLINK answers: %s\n",
+		format_host(p.family, p.bytelen, p.data), p.bitlen,
+		strerror(-error));
+}
+
+static void *ipaddr_bulk_attr(struct nlmsghdr *n, int type)
+{
+	struct rtattr *rta = IFA_RTA(NLMSG_DATA(n));
+	int len = IFA_PAYLOAD(n);
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type == type)
+			return RTA_DATA(rta);
+	return NULL;
+}
+
+static int ipaddr_bulk_prepare(struct ipaddr_bulk *b, struct nlmsghdr *n,
+			       int maxlen, const inet_prefix *lcl)
+{
+	static const __u8 zero[16];
+	int i;
+
+	if (b->split && b->file) {
+		fprintf(stderr, "\"split\" and \"file\" exclude each other.\n");
+		return -1;
+	}
+
+	if (b->file) {
+		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+
+		if (lcl->family) {
+			fprintf(stderr, "The addresses of \"file\" replace the local one.\n");
+			return -1;
+		}
+		if (ipaddr_bulk_read(b, ifa->ifa_family) < 0)
+			return -1;
+		ifa->ifa_family = b->addrs[0].family;
+		addattr_l(n, maxlen, IFA_LOCAL, zero, b->addrs[0].bytelen);
+		addattr_l(n, maxlen, IFA_ADDRESS, zero, b->addrs[0].bytelen);
+		return 0;
+	}
+
+	if (!lcl->family || !(lcl->flags & PREFIXLEN_SPECIFIED)) {
+		fprintf(stderr, "\"split\" needs a prefix to split.\n");
+		return -1;
+	}
+	if (b->split < lcl->bitlen || b->split > lcl->bytelen * 8 ||
+	    b->split - lcl->bitlen > IPADDR_BULK_MAX_SPLIT) {
+		fprintf(stderr, "Cannot split a /%d into /%u.\n",
+			lcl->bitlen, b->split);
+		return -1;
+	}
+
+	/* host bits are counted up from zero */
+	b->base = *lcl;
+	for (i = 0; i < b->base.bytelen; i++) {
+		__u8 *byte = (__u8 *)b->base.data + i;
+
+		if (i * 8 >= lcl->bitlen)
+			*byte = 0;
+		else if (i * 8 + 8 > lcl->bitlen)
+			*byte &= 0xff << (8 - (lcl->bitlen - i * 8));
+	}
+	b->count = 1U << (b->split - lcl->bitlen);
+	return 0;
+}
+
+static int ipaddr_bulk_send(struct nlmsghdr *n, struct ipaddr_bulk *b,
+			    int scoped, unsigned int ifa_flags)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	struct rtnl_async *outer = rth.async;
+	int flags = rth.flags;
+	void *local, *address;
+	unsigned int i;
+	int ret = 0;
+
+	local = ipaddr_bulk_attr(n, IFA_LOCAL);
+	address = ipaddr_bulk_attr(n, IFA_ADDRESS);
+
+	/* what a batch queued before goes first, and is told as its own */
+	if (outer && rtnl_async_flush(&rth) < 0)
+		return -2;
+
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, ipaddr_bulk_err, b) < 0) {
+		rth.async = outer;
+		perror("Cannot pipeline addresses");
+		return -2;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (i = 0; i < b->count; i++) {
+		inet_prefix p;
+
+		ipaddr_bulk_nth(b, i, &p);
+		if ((ifa_flags & IFA_F_MCAUTOJOIN) && !ipaddr_is_multicast(&p)) {
+			fprintf(stderr, "autojoin needs multicast address\n");
+			ret = -1;
+			break;
+		}
+
+		memcpy(local, p.data, p.bytelen);
+		memcpy(address, p.data, p.bytelen);
+		ifa->ifa_prefixlen = p.bitlen;
+		if (!scoped && n->nlmsg_type != RTM_DELADDR)
+			ifa->ifa_scope = default_scope(&p);
+
+		rtnl_async_cookie(&rth, i + 1);
+		if (rtnl_talk(&rth, n, NULL) < 0)
+			ret = -2;
+	}
+
+	if (rtnl_async_end(&rth) < 0)
+		ret = -2;
+	rth.async = outer;
+	rth.flags = flags;
+
+	if (b->failed > IPADDR_BULK_MAX_ERRORS)
+		fprintf(stderr, "... %u more failed\n",
+			b->failed - IPADDR_BULK_MAX_ERRORS);
+	if (b->failed)
+		ret = -2;
+	if (show_stats)
+		printf("%u addresses, %u failed\n", b->count, b->failed);
+	return ret;
+}
+
 static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 {
 	struct {
@@ -2074,6 +2506,7 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 		.n.nlmsg_type = cmd,
 		.ifa.ifa_family = preferred_family,
 	};
+	struct ipaddr_bulk bulk = {};
 	char  *d = NULL;
 	char  *l = NULL;
 	char  *lcl_arg = NULL;
@@ -2171,6 +2604,17 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 			ifa_flags |= IFA_F_NOPREFIXROUTE;
 		} else if (strcmp(*argv, "autojoin") == 0) {
 			ifa_flags |= IFA_F_MCAUTOJOIN;
+		} else if (strcmp(*argv, "split") == 0) {
+			NEXT_ARG();
+			if (bulk.split)
+				return duparg("split", *argv);
+			if (get_unsigned(&bulk.split, *argv, 0) || !bulk.split)
+				return invarg("invalid split prefix length", *argv);
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (bulk.file)
+				return duparg("file", *argv);
+			bulk.file = *argv;
 		} else {
 			if (strcmp(*argv, "local") == 0)
 				NEXT_ARG();
@@ -2200,6 +2644,10 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 		fprintf(stderr, "\"dev\" (%s) must match \"label\" (%s).\n", d, l);
 		return -1;
 	}
+	if ((bulk.split || bulk.file) && (peer_len || brd_len)) {
+		fprintf(stderr, "\"split\" and \"file\" take no peer or broadcast.\n");
+		return -1;
+	}
 
 	if (peer_len == 0 && local_len) {
 		if (cmd == RTM_DELADDR && lcl.family == AF_INET && !(lcl.flags & PREFIXLEN_SPECIFIED)) {
@@ -2261,6 +2709,15 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 			  sizeof(cinfo));
 	}
 
+	if (bulk.split || bulk.file) {
+		int ret = ipaddr_bulk_prepare(&bulk, &req.n, sizeof(req), &lcl);
+
+		if (!ret)
+			ret = ipaddr_bulk_send(&req.n, &bulk, scoped, ifa_flags);
+		free(bulk.addrs);
+		return ret;
+	}
+
 	if ((ifa_flags & IFA_F_MCAUTOJOIN) && !ipaddr_is_multicast(&lcl)) {
 		fprintf(stderr, "autojoin needs multicast address\n");
 		return -1;
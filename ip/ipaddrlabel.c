@@ -43,7 +43,7 @@
 #define IFAL_RTA(r)	((struct rtattr *)(((char *)(r)) + NLMSG_ALIGN(sizeof(struct ifaddrlblmsg))))
 #define IFAL_PAYLOAD(n)	NLMSG_PAYLOAD(n, sizeof(struct ifaddrlblmsg))
 
-extern struct rtnl_handle rth;
+extern __thread struct rtnl_handle rth;
 
 static int usage(void)
 {
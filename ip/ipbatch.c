@@ -0,0 +1,667 @@
+/*
+ * ipbatch.c	Run a batch file on several worker processes.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The file is read up front and cut into segments of link, address and
+ * neighbour lines, of route lines, and of anything else. Lines of a
+ * segment are grouped by the devices or route prefixes they name, a
+ * line naming several of them joins their groups, and the groups are
+ * spread over the workers. A worker runs its lines in file order with
+ * its own netlink socket while the next segment waits for all of them.
+ * Lines that cannot be attributed, and those of the third kind, run on
+ * one worker on their own segment. Lines defining what later lines use,
+ * nexthop groups, run in the parent so that workers inherit it.
+ *
+ * Workers are forked so that exit() from a parser stops only the worker,
+ * and their output is kept in files and replayed in line order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "ip_common.h"
+#include "rt_names.h"
+#include "rtm_map.h"
+#include "jobs.h"
+
+extern int force;
+
+#define BATCH_MAX_KEYS		8
+#define BATCH_KEY_LEN		48
+#define BATCH_KEY_HASH		(1 << 16)
+
+enum {
+	BATCH_ALONE,
+	BATCH_LINK,
+	BATCH_ROUTE,
+	BATCH_GATEWAY,	/* a route through a gateway, once the others are in */
+	BATCH_PARENT,
+};
+
+struct batch_cmd {
+	char	*line;
+	char	**argv;
+	int	argc;
+	int	lineno;
+	int	group;
+	int	worker;
+};
+
+/* written by the workers, in memory shared with the parent */
+struct batch_res {
+	off_t	out_off, out_end;
+	off_t	err_off, err_end;
+	int	status;
+	int	state;
+};
+
+enum {
+	BATCH_PENDING,
+	BATCH_STARTED,
+	BATCH_DONE,
+};
+
+struct batch_key {
+	struct batch_key	*next;
+	int			group;
+	char			name[BATCH_KEY_LEN];
+};
+
+static struct batch_key *key_hash[BATCH_KEY_HASH];
+static int *group_up;
+
+static int batch_group_find(int g)
+{
+	while (group_up[g] != g) {
+		group_up[g] = group_up[group_up[g]];
+		g = group_up[g];
+	}
+	return g;
+}
+
+static int batch_key_group(const char *name, int new)
+{
+	unsigned int h = 5381;
+	const char *p;
+	struct batch_key *k;
+
+	for (p = name; *p; p++)
+		h = h * 33 + *p;
+	h &= BATCH_KEY_HASH - 1;
+
+	for (k = key_hash[h]; k; k = k->next)
+		if (strcmp(k->name, name) == 0)
+			return batch_group_find(k->group);
+
+	k = malloc(sizeof(*k));
+	if (!k) {
+		perror("malloc");
+		exit(1);
+	}
+	strncpy(k->name, name, sizeof(k->name) - 1);
+	k->name[sizeof(k->name) - 1] = '\0';
+	k->group = new;
+	k->next = key_hash[h];
+	key_hash[h] = k;
+	return new;
+}
+
+static void batch_keys_reset(void)
+{
+	int i;
+
+	for (i = 0; i < BATCH_KEY_HASH; i++) {
+		while (key_hash[i]) {
+			struct batch_key *k = key_hash[i];
+
+			key_hash[i] = k->next;
+			free(k);
+		}
+	}
+}
+
+/* objects as matched by do_cmd(), up to the last one of interest */
+static const char * const batch_objs[] = {
+	"address", "addrlabel", "maddress", "route", "rule", "neighbor",
+	"neighbour", "ntable", "ntbl", "link", NULL,
+};
+
+static const char *batch_obj(const char *arg)
+{
+	int i;
+
+	for (i = 0; batch_objs[i]; i++)
+		if (matches(arg, batch_objs[i]) == 0)
+			return batch_objs[i];
+	return "";
+}
+
+static int batch_verb(const char *arg, const char * const *verbs)
+{
+	int i;
+
+	for (i = 0; verbs[i]; i++)
+		if (matches(arg, verbs[i]) == 0)
+			return 1;
+	return 0;
+}
+
+static int batch_dev_keys(int argc, char **argv, int start,
+			  char keys[][BATCH_KEY_LEN], int nkeys)
+{
+	static const char * const devkw[] = {
+		"dev", "name", "link", "master", "vrf", NULL,
+	};
+	int i, j;
+
+	for (i = start; i < argc; i++) {
+		if (strcmp(argv[i], "netns") == 0 ||
+		    strcmp(argv[i], "group") == 0)
+			return -1;
+		for (j = 0; devkw[j]; j++)
+			if (strcmp(argv[i], devkw[j]) == 0)
+				break;
+		if (!devkw[j] || i + 1 == argc)
+			continue;
+		if (nkeys == BATCH_MAX_KEYS)
+			return -1;
+		snprintf(keys[nkeys++], BATCH_KEY_LEN, "d%s", argv[++i]);
+	}
+	return nkeys;
+}
+
+static int batch_route_key(int argc, char **argv, char *key)
+{
+	inet_prefix dst;
+	int i = 2, type;
+
+	if (i < argc && strcmp(argv[i], "to") == 0)
+		i++;
+	else if (i < argc && rtnl_rtntype_a2n(&type, argv[i]) == 0)
+		i++;
+	if (i < argc && strcmp(argv[i], "to") == 0)
+		i++;
+	if (i >= argc || get_prefix_1(&dst, argv[i], preferred_family))
+		return -1;
+
+	/* the same route in every table, so no table in the key */
+	if (dst.bitlen <= 0) {
+		strcpy(key, "rdefault");
+	} else {
+		int n, j;
+
+		n = snprintf(key, BATCH_KEY_LEN, "r%d/%d/",
+			     dst.family, dst.bitlen);
+		for (j = 0; j < dst.bytelen && n < BATCH_KEY_LEN - 2; j++)
+			n += sprintf(key + n, "%02x",
+				     ((__u8 *)dst.data)[j]);
+	}
+	return 1;
+}
+
+/*
+ * The gateway of a route must be reachable when it is added, through a
+ * route without a gateway, so routes with one go in a segment of their
+ * own, after the routes before them rather than alongside.
+ */
+static int batch_route_gateway(int argc, char **argv)
+{
+	int i;
+
+	for (i = 2; i < argc; i++)
+		if (strcmp(argv[i], "via") == 0 ||
+		    strcmp(argv[i], "nexthop") == 0)
+			return 1;
+	return 0;
+}
+
+/* kind of line, filling keys[] with the objects it touches */
+static int batch_classify(int argc, char **argv,
+			  char keys[][BATCH_KEY_LEN], int *nkeys)
+{
+	static const char * const modify[] = {
+		"add", "change", "replace", "append", "prepend", "delete",
+		NULL,
+	};
+	static const char * const link_modify[] = {
+		"add", "set", "change", "delete", NULL,
+	};
+	const char *obj;
+	int n = 0;
+
+	if (argc < 3)
+		return BATCH_ALONE;
+	obj = batch_obj(argv[0]);
+
+	if (strcmp(obj, "route") == 0) {
+		/* definitions the lines after them look up in the process */
+		if (strcmp(argv[1], "nhgroup") == 0 ||
+		    strcmp(argv[1], "encap") == 0)
+			return BATCH_PARENT;
+		if (!batch_verb(argv[1], modify))
+			return BATCH_ALONE;
+		n = batch_route_key(argc, argv, keys[0]);
+		if (n < 0)
+			return BATCH_ALONE;
+		*nkeys = n;
+		if (batch_route_gateway(argc, argv))
+			return BATCH_GATEWAY;
+		return BATCH_ROUTE;
+	}
+
+	if (strcmp(obj, "address") == 0 || strcmp(obj, "neighbor") == 0 ||
+	    strcmp(obj, "neighbour") == 0) {
+		if (!batch_verb(argv[1], modify))
+			return BATCH_ALONE;
+	} else if (strcmp(obj, "link") == 0) {
+		if (!batch_verb(argv[1], link_modify))
+			return BATCH_ALONE;
+		/* ip link { set | add } NAME ..., but not add link DEV NAME */
+		if (strcmp(argv[2], "dev") && strcmp(argv[2], "name") &&
+		    strcmp(argv[2], "link") && strcmp(argv[2], "type"))
+			snprintf(keys[n++], BATCH_KEY_LEN, "d%s", argv[2]);
+	} else {
+		return BATCH_ALONE;
+	}
+
+	n = batch_dev_keys(argc, argv, 2, keys, n);
+	if (n <= 0)
+		return BATCH_ALONE;
+	*nkeys = n;
+	return BATCH_LINK;
+}
+
+static int batch_read(const char *name, struct batch_cmd **cmdsp)
+{
+	struct batch_cmd *cmds = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	int ncmds = 0, size = 0;
+
+	if (name && strcmp(name, "-") != 0) {
+		if (freopen(name, "r", stdin) == NULL) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return -1;
+		}
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, stdin) != -1) {
+		struct batch_cmd *c;
+		char *largv[BATCH_MAX_ARGS];
+		int largc;
+		char *copy;
+
+		copy = strdup(line);
+		if (!copy)
+			goto oom;
+		largc = makeargs(copy, largv, BATCH_MAX_ARGS);
+		if (largc == 0) {
+			free(copy);
+			continue;	/* blank line */
+		}
+
+		if (ncmds == size) {
+			size = size ? 2 * size : 1024;
+			c = realloc(cmds, size * sizeof(*cmds));
+			if (!c)
+				goto oom;
+			cmds = c;
+		}
+		c = &cmds[ncmds++];
+		c->line = copy;
+		c->argc = largc;
+		c->lineno = cmdlineno;
+		c->argv = malloc((largc + 1) * sizeof(char *));
+		if (!c->argv)
+			goto oom;
+		memcpy(c->argv, largv, largc * sizeof(char *));
+		c->argv[largc] = NULL;
+	}
+	free(line);
+
+	*cmdsp = cmds;
+	return ncmds;
+oom:
+	perror("Cannot read batch");
+	exit(1);
+}
+
+static void batch_worker(struct batch_cmd *cmds, int first, int last,
+			 int me, struct batch_res *res, int *stop,
+			 FILE *out, FILE *err)
+{
+	int orig_family = preferred_family;
+	int i, ret;
+
+	dup2(fileno(out), STDOUT_FILENO);
+	dup2(fileno(err), STDERR_FILENO);
+	jobs_pin(me);
+
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		_iprt_exit(1);
+	}
+	rtnl_set_strict_dump(&rth);
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, cache may go stale\n");
+
+	for (i = first; i < last; i++) {
+		struct batch_cmd *c = &cmds[i];
+
+		if (c->worker != me)
+			continue;
+		if (*stop)
+			break;
+
+		fflush(stdout);
+		fflush(stderr);
+		res[i].out_off = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+		res[i].err_off = lseek(STDERR_FILENO, 0, SEEK_CUR);
+		res[i].state = BATCH_STARTED;
+
+		preferred_family = orig_family;
+		cmdlineno = c->lineno;
+		ll_sync_map(&rth);
+		ret = do_cmd(c->argv[0], c->argc, c->argv);
+
+		fflush(stdout);
+		fflush(stderr);
+		res[i].out_end = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+		res[i].err_end = lseek(STDERR_FILENO, 0, SEEK_CUR);
+		res[i].status = ret;
+		res[i].state = BATCH_DONE;
+
+		if (ret && !force) {
+			*stop = 1;
+			break;
+		}
+	}
+
+	rtnl_close(&rth);
+	_iprt_exit(0);
+}
+
+static void batch_copy(FILE *from, off_t off, off_t end, FILE *to)
+{
+	char buf[4096];
+
+	if (fseeko(from, off, SEEK_SET))
+		return;
+	while (off < end) {
+		size_t n = end - off < sizeof(buf) ? end - off : sizeof(buf);
+
+		n = fread(buf, 1, n, from);
+		if (n == 0)
+			break;
+		fwrite(buf, 1, n, to);
+		off += n;
+	}
+}
+
+/* assign groups to workers, largest first, return the workers used */
+static int batch_shard(struct batch_cmd *cmds, int first, int last,
+		       int jobs, int ngroups)
+{
+	int *size, *order, *load, *owner;
+	int i, j, used = 0;
+
+	size = calloc(ngroups, sizeof(int));
+	order = calloc(ngroups, sizeof(int));
+	owner = calloc(ngroups, sizeof(int));
+	load = calloc(jobs, sizeof(int));
+	if (!size || !order || !owner || !load) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = first; i < last; i++)
+		size[cmds[i].group]++;
+
+	/* insertion sort keeps it deterministic, groups come sorted often */
+	for (i = 0, j = 0; i < ngroups; i++)
+		if (size[i])
+			order[j++] = i;
+	ngroups = j;
+	for (i = 1; i < ngroups; i++) {
+		int g = order[i];
+
+		for (j = i; j > 0 && size[order[j - 1]] < size[g]; j--)
+			order[j] = order[j - 1];
+		order[j] = g;
+	}
+
+	for (i = 0; i < ngroups; i++) {
+		int w = 0, g = order[i];
+
+		for (j = 1; j < jobs; j++)
+			if (load[j] < load[w])
+				w = j;
+		load[w] += size[g];
+		owner[g] = w;
+		if (w >= used)
+			used = w + 1;
+	}
+
+	for (i = first; i < last; i++)
+		cmds[i].worker = owner[cmds[i].group];
+
+	free(size);
+	free(order);
+	free(owner);
+	free(load);
+	return used;
+}
+
+/*
+ * Run cmds[first, last) on up to jobs workers, and report what they
+ * did in line order. Returns -1 when the batch must not go on.
+ */
+static int batch_segment(const char *name, struct batch_cmd *cmds,
+			 int first, int last, int jobs, int ngroups,
+			 struct batch_res *res, int *stop, int *ret)
+{
+	FILE *out[jobs], *err[jobs];
+	pid_t pid[jobs];
+	int status[jobs];
+	int i, w, nw, fatal = 0;
+
+	nw = batch_shard(cmds, first, last, jobs, ngroups);
+
+	fflush(NULL);
+	for (w = 0; w < nw; w++) {
+		out[w] = tmpfile();
+		err[w] = tmpfile();
+		if (!out[w] || !err[w]) {
+			perror("Cannot create worker output");
+			exit(1);
+		}
+		pid[w] = fork();
+		if (pid[w] < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid[w] == 0)
+			batch_worker(cmds, first, last, w, res, stop,
+				     out[w], err[w]);
+	}
+
+	for (w = 0; w < nw; w++) {
+		while (waitpid(pid[w], &status[w], 0) < 0) {
+			if (errno != EINTR) {
+				status[w] = 0xff00;
+				break;
+			}
+		}
+	}
+
+	for (i = first; i < last; i++) {
+		struct batch_res *r = &res[i];
+
+		w = cmds[i].worker;
+		if (r->state == BATCH_PENDING)
+			continue;
+
+		/*
+		 * The worker exited, or died, inside the command, which ends
+		 * the batch with that status as it would without workers.
+		 */
+		if (r->state == BATCH_STARTED) {
+			struct stat st;
+
+			r->out_end = fstat(fileno(out[w]), &st) ? 0 : st.st_size;
+			r->err_end = fstat(fileno(err[w]), &st) ? 0 : st.st_size;
+			batch_copy(out[w], r->out_off, r->out_end, stdout);
+			fflush(stdout);
+			batch_copy(err[w], r->err_off, r->err_end, stderr);
+			*ret = WIFEXITED(status[w]) ?
+				WEXITSTATUS(status[w]) : 128 + WTERMSIG(status[w]);
+			fatal = 1;
+			break;
+		}
+
+		batch_copy(out[w], r->out_off, r->out_end, stdout);
+		fflush(stdout);
+		batch_copy(err[w], r->err_off, r->err_end, stderr);
+		if (r->status) {
+			fprintf(stderr, "Command failed %s:%d\n",
+				name, cmds[i].lineno);
+			*ret = EXIT_FAILURE;
+		}
+	}
+
+	for (w = 0; w < nw; w++) {
+		fclose(out[w]);
+		fclose(err[w]);
+	}
+
+	return fatal || *stop ? -1 : 0;
+}
+
+/* run cmds[first, last) in this process, for the workers to inherit */
+static int batch_parent(const char *name, struct batch_cmd *cmds,
+			int first, int last, int *ret)
+{
+	int orig_family = preferred_family;
+	int i;
+
+	for (i = first; i < last; i++) {
+		struct batch_cmd *c = &cmds[i];
+
+		preferred_family = orig_family;
+		cmdlineno = c->lineno;
+		if (do_cmd(c->argv[0], c->argc, c->argv)) {
+			fprintf(stderr, "Command failed %s:%d\n",
+				name, c->lineno);
+			*ret = EXIT_FAILURE;
+			if (!force)
+				return -1;
+		}
+		fflush(stdout);
+	}
+	preferred_family = orig_family;
+	return 0;
+}
+
+int batch_jobs(const char *name, int jobs)
+{
+	char keys[BATCH_MAX_KEYS][BATCH_KEY_LEN];
+	struct batch_cmd *cmds = NULL;
+	struct batch_res *res;
+	int *stop;
+	int ncmds, first, i, ret = EXIT_SUCCESS;
+
+	batch_mode = 1;
+	jobs = jobs_limit(jobs);
+
+	ncmds = batch_read(name, &cmds);
+	if (ncmds <= 0)
+		return ncmds < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	group_up = calloc(ncmds, sizeof(int));
+	res = mmap(NULL, ncmds * sizeof(*res) + sizeof(int),
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (!group_up || res == MAP_FAILED) {
+		perror("Cannot allocate batch");
+		return EXIT_FAILURE;
+	}
+	stop = (int *)&res[ncmds];
+
+	/* name tables are read once here rather than in every worker */
+	rtnl_names_preload();
+
+	for (first = 0; first < ncmds; first = i) {
+		int kind, ngroups = 0;
+
+		kind = BATCH_ALONE;
+		for (i = first; i < ncmds; i++) {
+			struct batch_cmd *c = &cmds[i];
+			int k, nkeys = 0, g;
+
+			k = batch_classify(c->argc, c->argv, keys, &nkeys);
+			if (i == first)
+				kind = k;
+			else if (k != kind)
+				break;
+
+			if (kind == BATCH_ALONE || kind == BATCH_PARENT) {
+				c->group = 0;
+				ngroups = 1;
+				continue;
+			}
+
+			group_up[ngroups] = ngroups;
+			g = batch_key_group(keys[0], ngroups);
+			for (k = 1; k < nkeys; k++) {
+				int h = batch_key_group(keys[k], g);
+
+				if (h != g)
+					group_up[h] = g;
+			}
+			c->group = g;
+			if (g == ngroups)
+				ngroups++;
+		}
+
+		if (kind == BATCH_PARENT) {
+			if (batch_parent(name, cmds, first, i, &ret) < 0)
+				break;
+			continue;
+		}
+
+		/* number the joined groups by their roots */
+		if (kind != BATCH_ALONE) {
+			int j;
+
+			for (j = first; j < i; j++)
+				cmds[j].group = batch_group_find(cmds[j].group);
+			batch_keys_reset();
+		}
+
+		if (batch_segment(name, cmds, first, i, jobs, ngroups,
+				  res, stop, &ret) < 0)
+			break;
+	}
+
+	for (i = 0; i < ncmds; i++) {
+		free(cmds[i].argv);
+		free(cmds[i].line);
+	}
+	free(cmds);
+	free(group_up);
+	munmap(res, ncmds * sizeof(*res) + sizeof(int));
+	return ret;
+}
@@ -0,0 +1,524 @@
+/*
+ * ipcompile.c	Compile a batch file to netlink requests, and replay them.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Compiling runs every line with a handle that captures the requests
+ * instead of sending them, so only lines that do nothing but change
+ * state can be compiled. Device names are not resolved but numbered,
+ * and every place a request carries a device index is recorded, to be
+ * patched with the real index when the request is replayed.
+ *
+ * The file is a sequence of records in host byte order, a header first:
+ *
+ *	struct ipnl_rec, then for
+ *	IPNL_HDR:	__u32 version, source file name
+ *	IPNL_SYM:	__u32 symbol, device name
+ *	IPNL_MSG:	struct ipnl_msg, nfix * struct ipnl_fix, request
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "utils.h"
+#include "ip_common.h"
+#include "ll_map.h"
+
+extern int force;
+
+#define IPNL_MAGIC	0x4c4e5049	/* "IPNL" */
+#define IPNL_VERSION	1
+#define IPNL_MAX_FIX	64
+#define IPNL_REC_MAX	(1 << 20)
+
+enum {
+	IPNL_HDR = IPNL_MAGIC,
+	IPNL_SYM = 2,
+	IPNL_MSG,
+};
+
+struct ipnl_rec {
+	__u32	type;
+	__u32	len;	/* of what follows */
+};
+
+struct ipnl_msg {
+	__u32	lineno;
+	__u32	nfix;
+};
+
+struct ipnl_fix {
+	__u32	off;	/* of a __u32 device index in the request */
+	__u32	sym;
+};
+
+struct compile_ctx {
+	FILE		*fp;
+	const char	*out;
+	const char	*name;
+	int		lineno;
+	int		done;
+	unsigned int	nsyms;
+	unsigned int	nfix;
+	struct ipnl_fix	fix[IPNL_MAX_FIX];
+};
+
+static struct compile_ctx compile;
+
+static int ipnl_write(FILE *fp, __u32 type, const struct iovec *iov,
+		      int iovlen)
+{
+	struct ipnl_rec rec = { .type = type };
+	int i;
+
+	for (i = 0; i < iovlen; i++)
+		rec.len += iov[i].iov_len;
+	if (fwrite(&rec, sizeof(rec), 1, fp) != 1)
+		return -1;
+	for (i = 0; i < iovlen; i++)
+		if (iov[i].iov_len &&
+		    fwrite(iov[i].iov_base, 1, iov[i].iov_len, fp) !=
+		    iov[i].iov_len)
+			return -1;
+	return 0;
+}
+
+static int compile_fix(struct compile_ctx *ctx, const struct nlmsghdr *n,
+		       const void *field)
+{
+	__u32 idx;
+
+	memcpy(&idx, field, sizeof(idx));
+	if (!ll_sym_name(idx))
+		return 0;
+	if (ctx->nfix == IPNL_MAX_FIX)
+		return -1;
+
+	ctx->fix[ctx->nfix].off = (const char *)field - (const char *)n;
+	ctx->fix[ctx->nfix].sym = idx - LL_SYM_BASE;
+	ctx->nfix++;
+	return 0;
+}
+
+static int compile_fix_attr(struct compile_ctx *ctx, const struct nlmsghdr *n,
+			    const struct rtattr *rta)
+{
+	if (!rta || RTA_PAYLOAD(rta) < sizeof(__u32))
+		return 0;
+	return compile_fix(ctx, n, RTA_DATA(rta));
+}
+
+/* Find the device indexes in the requests ip sends */
+static int compile_fixups(struct compile_ctx *ctx, const struct nlmsghdr *n)
+{
+	int len = n->nlmsg_len;
+	const __u32 *w;
+	int err = 0;
+	unsigned int i;
+
+	ctx->nfix = 0;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+	case RTM_SETLINK: {
+		struct ifinfomsg *ifi = NLMSG_DATA(n);
+		struct rtattr *tb[IFLA_MAX + 1];
+
+		if (len < NLMSG_LENGTH(sizeof(*ifi)))
+			break;
+		parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
+		err |= compile_fix(ctx, n, &ifi->ifi_index);
+		err |= compile_fix_attr(ctx, n, tb[IFLA_LINK]);
+		err |= compile_fix_attr(ctx, n, tb[IFLA_MASTER]);
+		break;
+	}
+	case RTM_NEWADDR:
+	case RTM_DELADDR: {
+		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+
+		if (len < NLMSG_LENGTH(sizeof(*ifa)))
+			break;
+		err |= compile_fix(ctx, n, &ifa->ifa_index);
+		break;
+	}
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE: {
+		struct rtmsg *r = NLMSG_DATA(n);
+		struct rtattr *tb[RTA_MAX + 1];
+		struct rtnexthop *nh;
+		int nhlen;
+
+		if (len < NLMSG_LENGTH(sizeof(*r)))
+			break;
+		parse_rtattr(tb, RTA_MAX, RTM_RTA(r), RTM_PAYLOAD(n));
+		err |= compile_fix_attr(ctx, n, tb[RTA_OIF]);
+		err |= compile_fix_attr(ctx, n, tb[RTA_IIF]);
+		if (!tb[RTA_MULTIPATH])
+			break;
+
+		nh = RTA_DATA(tb[RTA_MULTIPATH]);
+		nhlen = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+		while (nhlen >= (int)sizeof(*nh) && nh->rtnh_len >= sizeof(*nh) &&
+		       nh->rtnh_len <= nhlen) {
+			err |= compile_fix(ctx, n, &nh->rtnh_ifindex);
+			nhlen -= RTNH_ALIGN(nh->rtnh_len);
+			nh = RTNH_NEXT(nh);
+		}
+		break;
+	}
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH: {
+		struct ndmsg *ndm = NLMSG_DATA(n);
+		struct rtattr *tb[NDA_MAX + 1];
+
+		if (len < NLMSG_LENGTH(sizeof(*ndm)))
+			break;
+		parse_rtattr(tb, NDA_MAX, NDA_RTA(ndm),
+			     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm)));
+		err |= compile_fix(ctx, n, &ndm->ndm_ifindex);
+		err |= compile_fix_attr(ctx, n, tb[NDA_MASTER]);
+		break;
+	}
+	}
+	if (err) {
+		fprintf(stderr, "Too many device references\n");
+		return -1;
+	}
+
+	/* a device index anywhere else could not be patched on replay */
+	for (w = NLMSG_DATA(n); (const char *)(w + 1) <= (const char *)n + len;
+	     w++) {
+		__u32 off = (const char *)w - (const char *)n;
+
+		if (!ll_sym_name(*w))
+			continue;
+		for (i = 0; i < ctx->nfix; i++)
+			if (ctx->fix[i].off == off)
+				break;
+		if (i == ctx->nfix) {
+			fprintf(stderr,
+				"Device \"%s\" is used where it cannot be compiled\n",
+				ll_sym_name(*w));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int compile_msg(const struct nlmsghdr *n, void *arg)
+{
+	struct compile_ctx *ctx = arg;
+	struct ipnl_msg m;
+	struct iovec iov[] = {
+		{ &m, sizeof(m) },
+		{ ctx->fix, 0 },
+		{ (void *)n, n->nlmsg_len },
+	};
+
+	if (compile_fixups(ctx, n) < 0)
+		return -1;
+
+	for (; ctx->nsyms < ll_sym_count(); ctx->nsyms++) {
+		const char *name = ll_sym_name(LL_SYM_BASE + ctx->nsyms);
+		__u32 sym = ctx->nsyms;
+		struct iovec sym_iov[] = {
+			{ &sym, sizeof(sym) },
+			{ (void *)name, strlen(name) + 1 },
+		};
+
+		if (ipnl_write(ctx->fp, IPNL_SYM, sym_iov,
+			       ARRAY_SIZE(sym_iov)) < 0)
+			goto err;
+	}
+
+	m.lineno = ctx->lineno;
+	m.nfix = ctx->nfix;
+	iov[1].iov_len = ctx->nfix * sizeof(ctx->fix[0]);
+	if (ipnl_write(ctx->fp, IPNL_MSG, iov, ARRAY_SIZE(iov)) < 0)
+		goto err;
+	return 0;
+err:
+	perror("Cannot write compiled batch");
+	return -1;
+}
+
+/* parsers exit() on bad arguments, say where that was */
+static void compile_atexit(void)
+{
+	if (compile.done)
+		return;
+	fprintf(stderr, "Cannot compile %s:%d\n", compile.name, compile.lineno);
+	unlink(compile.out);
+}
+
+int batch_compile(const char *name, const char *out)
+{
+	struct compile_ctx *ctx = &compile;
+	char *line = NULL;
+	size_t len = 0;
+	int ret = EXIT_SUCCESS;
+	int orig_family = preferred_family;
+	__u32 version = IPNL_VERSION;
+	struct iovec hdr[2] = { { &version, sizeof(version) } };
+
+	batch_mode = 1;
+
+	if (name && strcmp(name, "-") != 0) {
+		if (freopen(name, "r", stdin) == NULL) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	} else {
+		name = "-";
+	}
+
+	ctx->fp = fopen(out, "w");
+	if (!ctx->fp) {
+		fprintf(stderr, "Cannot open \"%s\" for writing: %s\n",
+			out, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	ctx->out = out;
+	ctx->name = name;
+	hdr[1].iov_base = (void *)name;
+	hdr[1].iov_len = strlen(name) + 1;
+	ctx->done = 1;
+	atexit(compile_atexit);
+
+	if (ipnl_write(ctx->fp, IPNL_HDR, hdr, ARRAY_SIZE(hdr)) < 0) {
+		perror("Cannot write compiled batch");
+		return EXIT_FAILURE;
+	}
+
+	/* rth is never opened, anything but a captured request fails */
+	rth.capture = compile_msg;
+	rth.capture_arg = ctx;
+	ll_set_symbolic(1);
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, stdin) != -1) {
+		char *largv[BATCH_MAX_ARGS];
+		int largc;
+
+		preferred_family = orig_family;
+
+		largc = makeargs(line, largv, BATCH_MAX_ARGS);
+		if (largc == 0)
+			continue;	/* blank line */
+
+		ctx->lineno = cmdlineno;
+		ctx->done = 0;
+		if (do_cmd(largv[0], largc, largv)) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+		ctx->done = 1;
+	}
+	free(line);
+
+	ll_set_symbolic(0);
+	rth.capture = NULL;
+
+	if (fclose(ctx->fp) && ret == EXIT_SUCCESS) {
+		perror("Cannot write compiled batch");
+		ctx->done = 0;
+		ret = EXIT_FAILURE;
+	}
+	if (ret != EXIT_SUCCESS) {
+		compile_atexit();
+		ctx->done = 1;
+	}
+	return ret;
+}
+
+struct replay_ctx {
+	char		*name;
+	char		**syms;
+	unsigned int	*idx;
+	unsigned int	*gen;
+	unsigned int	nsyms;
+	unsigned int	cur;	/* generation of the resolved indexes */
+	int		ret;
+};
+
+static void replay_err(__u32 cookie, int error, void *arg)
+{
+	struct replay_ctx *ctx = arg;
+
+	fprintf(stderr, "Command failed %s:%u\n", ctx->name, cookie);
+	ctx->ret = EXIT_FAILURE;
+}
+
+static int replay_sym(struct replay_ctx *ctx, const char *p, __u32 len)
+{
+	__u32 sym;
+
+	if (len <= sizeof(sym) || p[len - 1] != '\0')
+		return -1;
+	memcpy(&sym, p, sizeof(sym));
+	if (sym != ctx->nsyms)
+		return -1;
+
+	ctx->syms = realloc(ctx->syms, (sym + 1) * sizeof(*ctx->syms));
+	ctx->idx = realloc(ctx->idx, (sym + 1) * sizeof(*ctx->idx));
+	ctx->gen = realloc(ctx->gen, (sym + 1) * sizeof(*ctx->gen));
+	if (!ctx->syms || !ctx->idx || !ctx->gen)
+		return -1;
+	ctx->syms[sym] = strdup(p + sizeof(sym));
+	ctx->gen[sym] = 0;
+	ctx->nsyms++;
+	return ctx->syms[sym] ? 0 : -1;
+}
+
+/*
+ * Names are resolved when first needed, after the requests before them
+ * have been acked since those may create the device. Anything that
+ * changes links makes them resolve again.
+ */
+static unsigned int replay_resolve(struct replay_ctx *ctx, __u32 sym)
+{
+	if (ctx->gen[sym] == ctx->cur)
+		return ctx->idx[sym];
+
+	rtnl_async_flush(&rth);
+	ll_sync_map(&rth);
+	ctx->idx[sym] = ll_name_to_index(ctx->syms[sym]);
+	ctx->gen[sym] = ctx->cur;
+	return ctx->idx[sym];
+}
+
+static int replay_msg(struct replay_ctx *ctx, char *p, __u32 len)
+{
+	struct ipnl_msg m;
+	struct ipnl_fix *fix;
+	struct nlmsghdr *n;
+	unsigned int i;
+
+	if (len < sizeof(m))
+		return -1;
+	memcpy(&m, p, sizeof(m));
+	if (m.nfix > IPNL_MAX_FIX ||
+	    len < sizeof(m) + m.nfix * sizeof(*fix) + sizeof(*n))
+		return -1;
+
+	fix = (struct ipnl_fix *)(p + sizeof(m));
+	n = (struct nlmsghdr *)(fix + m.nfix);
+	if (n->nlmsg_len != len - ((char *)n - p))
+		return -1;
+
+	for (i = 0; i < m.nfix; i++) {
+		__u32 idx;
+
+		if (fix[i].sym >= ctx->nsyms ||
+		    fix[i].off + sizeof(idx) > n->nlmsg_len)
+			return -1;
+		idx = replay_resolve(ctx, fix[i].sym);
+		if (!idx) {
+			fprintf(stderr, "Cannot find device \"%s\"\n",
+				ctx->syms[fix[i].sym]);
+			replay_err(m.lineno, ENODEV, ctx);
+			return 0;
+		}
+		memcpy((char *)n + fix[i].off, &idx, sizeof(idx));
+	}
+
+	rtnl_async_cookie(&rth, m.lineno);
+	if (rtnl_talk(&rth, n, NULL) < 0)
+		replay_err(m.lineno, errno, ctx);
+
+	if (n->nlmsg_type == RTM_NEWLINK || n->nlmsg_type == RTM_DELLINK ||
+	    n->nlmsg_type == RTM_SETLINK)
+		ctx->cur++;
+	return 0;
+}
+
+int batch_replay(const char *name)
+{
+	struct replay_ctx ctx = { .ret = EXIT_FAILURE, .cur = 1 };
+	struct ipnl_rec rec;
+	char *buf = NULL;
+	__u32 version;
+	unsigned int i;
+	FILE *fp;
+	int err = 0;
+
+	fp = fopen(name, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (fread(&rec, sizeof(rec), 1, fp) != 1 || rec.type != IPNL_HDR ||
+	    rec.len <= sizeof(version) || rec.len > IPNL_REC_MAX ||
+	    !(buf = malloc(IPNL_REC_MAX)) ||
+	    fread(buf, 1, rec.len, fp) != rec.len ||
+	    buf[rec.len - 1] != '\0') {
+		fprintf(stderr, "\"%s\" is not a compiled batch\n", name);
+		goto out;
+	}
+	memcpy(&version, buf, sizeof(version));
+	if (version != IPNL_VERSION) {
+		fprintf(stderr, "\"%s\" has unknown version %u\n",
+			name, version);
+		goto out;
+	}
+	ctx.name = strdup(buf + sizeof(version));
+
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		goto out;
+	}
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, cache may go stale\n");
+	if (rtnl_async_begin(&rth, 0, replay_err, &ctx) < 0) {
+		fprintf(stderr, "Cannot pipeline requests\n");
+		goto close;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC;
+
+	ctx.ret = EXIT_SUCCESS;
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		if (rec.len > IPNL_REC_MAX ||
+		    fread(buf, 1, rec.len, fp) != rec.len) {
+			err = -1;
+			break;
+		}
+		if (rec.type == IPNL_SYM)
+			err = replay_sym(&ctx, buf, rec.len);
+		else if (rec.type == IPNL_MSG)
+			err = replay_msg(&ctx, buf, rec.len);
+		else
+			err = -1;
+		if (err || (ctx.ret != EXIT_SUCCESS && !force))
+			break;
+	}
+	if (err || ferror(fp)) {
+		fprintf(stderr, "\"%s\" is corrupt\n", name);
+		ctx.ret = EXIT_FAILURE;
+	}
+
+	rtnl_async_end(&rth);
+close:
+	rtnl_close(&rth);
+out:
+	for (i = 0; i < ctx.nsyms; i++)
+		free(ctx.syms[i]);
+	free(ctx.syms);
+	free(ctx.idx);
+	free(ctx.gen);
+	free(ctx.name);
+	free(buf);
+	fclose(fp);
+	return ctx.ret;
+}
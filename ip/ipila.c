@@ -10,6 +10,7 @@
  */
 
 #include <netdb.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +31,8 @@ static int usage(void)
 	fprintf(stderr,
 "Usage: ip ila add loc_match LOCATOR_MATCH loc LOCATOR [ dev DEV ] OPTIONS\n"
 "       ip ila del loc_match LOCATOR_MATCH [ loc LOCATOR ] [ dev DEV ]\n"
+"       ip ila { add | del } file FILE\n"
+"       ip ila sync [ file FILE ]\n"
 "       ip ila list\n"
 "OPTIONS := [ csum-mode { adj-transport | neutral-map | neutral-map-auto | no-action } ]\n"
 "           [ ident-type { luid | use-format } ]\n");
@@ -163,68 +166,68 @@ static int do_list(int argc, char **argv)
 	return 0;
 }
 
-static int ila_parse_opt(int argc, char **argv, struct nlmsghdr *n,
+struct ila_map {
+	__u64		locator_match;
+	__u64		locator;
+	int		ifindex;
+	int		csum_mode;	/* -1 when not given */
+	int		ident_type;
+	bool		loc_set;
+	bool		loc_match_set;
+};
+
+static int ila_parse_opt(int argc, char **argv, struct ila_map *m,
 			 bool adding)
 {
-	__u64 locator = 0;
-	__u64 locator_match = 0;
-	int ifindex = 0;
-	int csum_mode = 0;
-	int ident_type = 0;
-	bool loc_set = false;
-	bool loc_match_set = false;
-	bool ifindex_set = false;
-	bool csum_mode_set = false;
-	bool ident_type_set = false;
+	memset(m, 0, sizeof(*m));
+	m->csum_mode = -1;
+	m->ident_type = -1;
 
 	while (argc > 0) {
 		if (!matches(*argv, "loc")) {
 			NEXT_ARG();
 
-			if (get_addr64(&locator, *argv) < 0) {
+			if (get_addr64(&m->locator, *argv) < 0) {
 				fprintf(stderr, "Bad locator: %s\n", *argv);
 				return -1;
 			}
-			loc_set = true;
+			m->loc_set = true;
 		} else if (!matches(*argv, "loc_match")) {
 			NEXT_ARG();
 
-			if (get_addr64(&locator_match, *argv) < 0) {
+			if (get_addr64(&m->locator_match, *argv) < 0) {
 				fprintf(stderr, "Bad locator to match: %s\n",
 					*argv);
 				return -1;
 			}
-			loc_match_set = true;
+			m->loc_match_set = true;
 		} else if (!matches(*argv, "csum-mode")) {
 			NEXT_ARG();
 
-			csum_mode = ila_csum_name2mode(*argv);
-			if (csum_mode < 0) {
+			m->csum_mode = ila_csum_name2mode(*argv);
+			if (m->csum_mode < 0) {
 				fprintf(stderr, "Bad csum-mode: %s\n",
 					*argv);
 				return -1;
 			}
-			csum_mode_set = true;
 		} else if (!matches(*argv, "ident-type")) {
 			NEXT_ARG();
 
-			ident_type = ila_ident_name2type(*argv);
-			if (ident_type < 0) {
+			m->ident_type = ila_ident_name2type(*argv);
+			if (m->ident_type < 0) {
 				fprintf(stderr, "Bad ident-type: %s\n",
 					*argv);
 				return -1;
 			}
-			ident_type_set = true;
 		} else if (!matches(*argv, "dev")) {
 			NEXT_ARG();
 
-			ifindex = ll_name_to_index(*argv);
-			if (ifindex == 0) {
+			m->ifindex = ll_name_to_index(*argv);
+			if (m->ifindex == 0) {
 				fprintf(stderr, "No such interface: %s\n",
 					*argv);
 				return -1;
 			}
-			ifindex_set = true;
 		} else {
 			usage();
 			return -1;
@@ -233,51 +236,409 @@ static int ila_parse_opt(int argc, char **argv, struct nlmsghdr *n,
 	}
 
 	if (adding) {
-		if (!loc_set) {
+		if (!m->loc_set) {
 			fprintf(stderr, "ila: missing locator\n");
 			return -1;
 		}
-		if (!loc_match_set) {
+		if (!m->loc_match_set) {
 			fprintf(stderr, "ila: missing locator0match\n");
 			return -1;
 		}
 	}
 
-	if (loc_match_set)
-		addattr64(n, 1024, ILA_ATTR_LOCATOR_MATCH, locator_match);
+	return 0;
+}
 
-	if (loc_set)
-		addattr64(n, 1024, ILA_ATTR_LOCATOR, locator);
+static void ila_map_req(struct nlmsghdr *n, const struct ila_map *m)
+{
+	if (m->loc_match_set)
+		addattr64(n, 1024, ILA_ATTR_LOCATOR_MATCH, m->locator_match);
 
-	if (ifindex_set)
-		addattr32(n, 1024, ILA_ATTR_IFINDEX, ifindex);
+	if (m->loc_set)
+		addattr64(n, 1024, ILA_ATTR_LOCATOR, m->locator);
 
-	if (csum_mode_set)
-		addattr8(n, 1024, ILA_ATTR_CSUM_MODE, csum_mode);
+	if (m->ifindex)
+		addattr32(n, 1024, ILA_ATTR_IFINDEX, m->ifindex);
 
-	if (ident_type_set)
-		addattr8(n, 1024, ILA_ATTR_IDENT_TYPE, ident_type);
+	if (m->csum_mode >= 0)
+		addattr8(n, 1024, ILA_ATTR_CSUM_MODE, m->csum_mode);
+
+	if (m->ident_type >= 0)
+		addattr8(n, 1024, ILA_ATTR_IDENT_TYPE, m->ident_type);
+}
+
+/*
+ * Many mappings at once: "add file" and "del file" take the arguments of
+ * one add or del per line, and "sync" makes the mappings those of the
+ * file. For sync the mappings are dumped once into an index by what the
+ * kernel tells them apart by, the locator to match and the device, and
+ * only those missing, different or no longer wanted are sent. A changed
+ * mapping is deleted and added again, one after the other on the socket.
+ * Nothing goes out unless the whole file makes sense, then the requests
+ * are pipelined and their errors told by line.
+ */
+struct ila_sync_entry {
+	struct ila_map	m;
+	unsigned int	next;		/* hash chain, index + 1 */
+	int		wanted;		/* line asking for it, 0 if none */
+};
+
+struct ila_sync {
+	const char		*name;
+	int			cmd;	/* ILA_CMD_ADD or _DEL, 0 to sync */
+	struct ila_sync_entry	*ents;
+	unsigned int		count;
+	unsigned int		max;
+	unsigned int		*hash;
+	unsigned int		hmask;
+	struct rtnl_txq		changes;
+	unsigned int		requests, failed;
+	unsigned int		added, changed, deleted, unchanged;
+	int			del_failed;
+};
+
+static unsigned int ila_key_hash(__u64 locator_match, int ifindex)
+{
+	__u64 h = (locator_match ^ (__u64)ifindex << 32) *
+		  0x9e3779b97f4a7c15ULL;
 
+	return h ^ h >> 32;
+}
+
+static int ila_sync_dump(const struct sockaddr_nl *who,
+			 struct nlmsghdr *n, void *arg)
+{
+	struct ila_sync *is = arg;
+	struct rtattr *tb[ILA_ATTR_MAX + 1];
+	struct ila_sync_entry *e;
+	int len = n->nlmsg_len;
+
+	if (n->nlmsg_type != genl_family)
+		return 0;
+
+	len -= NLMSG_LENGTH(GENL_HDRLEN);
+	if (len < 0)
+		return -1;
+
+	parse_rtattr(tb, ILA_ATTR_MAX, ILA_RTA(NLMSG_DATA(n)), len);
+	if (!tb[ILA_ATTR_LOCATOR_MATCH])
+		return 0;
+
+	if (is->count == is->max) {
+		unsigned int max = is->max ? 2 * is->max : 1024;
+
+		e = realloc(is->ents, max * sizeof(*e));
+		if (!e) {
+			perror("Cannot index mappings");
+			return -1;
+		}
+		is->ents = e;
+		is->max = max;
+	}
+
+	e = &is->ents[is->count++];
+	memset(e, 0, sizeof(*e));
+	e->m.locator_match = rta_getattr_u64(tb[ILA_ATTR_LOCATOR_MATCH]);
+	e->m.loc_match_set = true;
+	if (tb[ILA_ATTR_LOCATOR]) {
+		e->m.locator = rta_getattr_u64(tb[ILA_ATTR_LOCATOR]);
+		e->m.loc_set = true;
+	}
+	if (tb[ILA_ATTR_IFINDEX])
+		e->m.ifindex = rta_getattr_u32(tb[ILA_ATTR_IFINDEX]);
+	e->m.csum_mode = tb[ILA_ATTR_CSUM_MODE] ?
+		rta_getattr_u8(tb[ILA_ATTR_CSUM_MODE]) : -1;
+	e->m.ident_type = tb[ILA_ATTR_IDENT_TYPE] ?
+		rta_getattr_u8(tb[ILA_ATTR_IDENT_TYPE]) : -1;
 	return 0;
 }
 
-static int do_add(int argc, char **argv)
+static int ila_sync_index(struct ila_sync *is)
 {
-	ILA_REQUEST(req, 1024, ILA_CMD_ADD, NLM_F_REQUEST);
+	unsigned int size = 16, i;
+
+	while (size < 2 * is->count)
+		size *= 2;
+	free(is->hash);
+	is->hash = calloc(size, sizeof(*is->hash));
+	if (!is->hash) {
+		perror("Cannot index mappings");
+		return -1;
+	}
+	is->hmask = size - 1;
 
-	ila_parse_opt(argc, argv, &req.n, true);
+	for (i = 0; i < is->count; i++) {
+		struct ila_sync_entry *e = &is->ents[i];
+		unsigned int h = ila_key_hash(e->m.locator_match,
+					      e->m.ifindex) & is->hmask;
 
-	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
-		return -2;
+		e->next = is->hash[h];
+		is->hash[h] = i + 1;
+	}
+	return 0;
+}
+
+static struct ila_sync_entry *ila_sync_find(struct ila_sync *is,
+					    const struct ila_map *m)
+{
+	unsigned int i;
+
+	i = is->hash[ila_key_hash(m->locator_match, m->ifindex) & is->hmask];
+	while (i) {
+		struct ila_sync_entry *e = &is->ents[i - 1];
+
+		if (e->m.locator_match == m->locator_match &&
+		    e->m.ifindex == m->ifindex)
+			return e;
+		i = e->next;
+	}
+	return NULL;
+}
+
+/* lines for mappings the kernel does not have yet are indexed too */
+static int ila_sync_insert(struct ila_sync *is, const struct ila_map *m,
+			   int lineno)
+{
+	struct ila_sync_entry *e;
+	unsigned int h;
+
+	if (is->count == is->max) {
+		unsigned int max = is->max ? 2 * is->max : 1024;
+
+		e = realloc(is->ents, max * sizeof(*e));
+		if (!e) {
+			perror("Cannot index mappings");
+			return -1;
+		}
+		is->ents = e;
+		is->max = max;
+	}
 
+	e = &is->ents[is->count++];
+	memset(e, 0, sizeof(*e));
+	e->m = *m;
+	e->wanted = lineno;
+	if (2 * is->count > is->hmask + 1)
+		return ila_sync_index(is);
+
+	h = ila_key_hash(m->locator_match, m->ifindex) & is->hmask;
+	e->next = is->hash[h];
+	is->hash[h] = is->count;
+	return 0;
+}
+
+/* what the line did not ask for is whatever the kernel has */
+static bool ila_map_same(const struct ila_map *have, const struct ila_map *m)
+{
+	return have->locator == m->locator &&
+	       (m->csum_mode < 0 || have->csum_mode == m->csum_mode) &&
+	       (m->ident_type < 0 || have->ident_type == m->ident_type);
+}
+
+static int ila_sync_queue(struct ila_sync *is, int cmd,
+			  const struct ila_map *m, int lineno)
+{
+	ILA_REQUEST(req, 1024, cmd, NLM_F_REQUEST);
+
+	ila_map_req(&req.n, m);
+	/* the line it comes from rides in nlmsg_seq until it is sent */
+	req.n.nlmsg_seq = lineno;
+	if (rtnl_txq_add(&is->changes, &req.n) < 0) {
+		perror("Cannot queue mapping");
+		return -1;
+	}
+	is->requests++;
 	return 0;
 }
 
-static int do_del(int argc, char **argv)
+static int ila_sync_line(struct ila_sync *is, int argc, char **argv)
 {
-	ILA_REQUEST(req, 1024, ILA_CMD_DEL, NLM_F_REQUEST);
+	struct ila_sync_entry *e;
+	struct ila_map m;
 
-	ila_parse_opt(argc, argv, &req.n, false);
+	if (ila_parse_opt(argc, argv, &m, is->cmd != ILA_CMD_DEL) < 0) {
+		fprintf(stderr, "%s:%d: bad mapping\n", is->name, cmdlineno);
+		return -1;
+	}
+	if (is->cmd)
+		return ila_sync_queue(is, is->cmd, &m, cmdlineno);
+
+	e = ila_sync_find(is, &m);
+	if (e && e->wanted) {
+		fprintf(stderr, "%s:%d: mapping already given on line %d\n",
+			is->name, cmdlineno, e->wanted);
+		return -1;
+	}
+	if (e) {
+		e->wanted = cmdlineno;
+		if (ila_map_same(&e->m, &m)) {
+			is->unchanged++;
+			return 0;
+		}
+		if (ila_sync_queue(is, ILA_CMD_DEL, &e->m, cmdlineno) < 0)
+			return -1;
+		is->changed++;
+	} else {
+		if (ila_sync_insert(is, &m, cmdlineno) < 0)
+			return -1;
+		is->added++;
+	}
+	return ila_sync_queue(is, ILA_CMD_ADD, &m, cmdlineno);
+}
+
+static int ila_sync_lines(struct ila_sync *is)
+{
+	int saved_lineno = cmdlineno;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp = stdin;
+	int ret = 0;
+
+	if (strcmp(is->name, "-") != 0) {
+		fp = fopen(is->name, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				is->name, strerror(errno));
+			return -1;
+		}
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[32];
+		int largc;
+
+		largc = makeargs(line, largv, ARRAY_SIZE(largv));
+		if (largc == 0)
+			continue;	/* blank line */
+
+		ret = ila_sync_line(is, largc, largv);
+		if (ret < 0)
+			break;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = saved_lineno;
+	return ret;
+}
+
+static int ila_sync_deletes(struct ila_sync *is)
+{
+	unsigned int i;
+
+	for (i = 0; i < is->count; i++) {
+		struct ila_sync_entry *e = &is->ents[i];
+
+		if (e->wanted)
+			continue;
+		if (ila_sync_queue(is, ILA_CMD_DEL, &e->m, 0) < 0)
+			return -1;
+		is->deleted++;
+	}
+	return 0;
+}
+
+static void ila_sync_err(__u32 cookie, int error, void *arg)
+{
+	struct ila_sync *is = arg;
+
+	if (cookie) {
+		fprintf(stderr, "%s:%u: RTNETLINK answers: %s\n",
+			is->name, cookie, strerror(-error));
+		is->failed++;
+		return;
+	}
+
+	/* a delete, the mapping may well have gone meanwhile */
+	if (error == -ENOENT)
+		return;
+	is->failed++;
+	if (!is->del_failed++)
+		fprintf(stderr, "Cannot delete mapping: %s\n",
+			strerror(-error));
+}
+
+static int ila_sync_send(struct ila_sync *is)
+{
+	int hflags = genl_rth.flags;
+	size_t off;
+	int ret = 0;
+
+	if (rtnl_async_begin(&genl_rth, 0, ila_sync_err, is) < 0) {
+		perror("Cannot pipeline mappings");
+		return -1;
+	}
+	genl_rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (off = 0; off < is->changes.len; ) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(is->changes.buf + off);
+
+		off += NLMSG_ALIGN(n->nlmsg_len);
+		rtnl_async_cookie(&genl_rth, n->nlmsg_seq);
+		n->nlmsg_seq = 0;
+		if (rtnl_talk(&genl_rth, n, NULL) < 0)
+			ret = -2;
+	}
+
+	if (rtnl_async_end(&genl_rth) < 0)
+		ret = -2;
+	genl_rth.flags = hflags;
+	return ret ? ret : is->failed ? -2 : 0;
+}
+
+static int ila_sync(int cmd, const char *name)
+{
+	ILA_REQUEST(req, 1024, ILA_CMD_GET, NLM_F_REQUEST | NLM_F_DUMP);
+	struct ila_sync is = { .name = name, .cmd = cmd };
+	int ret = -2;
+
+	if (!cmd) {
+		if (rtnl_send(&genl_rth, (void *)&req, req.n.nlmsg_len) < 0) {
+			perror("Cannot send dump request");
+			goto out;
+		}
+		if (rtnl_dump_filter(&genl_rth, ila_sync_dump, &is) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			goto out;
+		}
+		if (ila_sync_index(&is) < 0)
+			goto out;
+	}
+
+	if (ila_sync_lines(&is) < 0) {
+		ret = -1;
+		goto out;
+	}
+	if (!cmd && ila_sync_deletes(&is) < 0)
+		goto out;
+
+	ret = ila_sync_send(&is);
+
+	if (show_stats && cmd)
+		printf("%u requests, %u failed\n", is.requests, is.failed);
+	else if (show_stats)
+		printf("%u added, %u changed, %u deleted, %u unchanged\n",
+		       is.added, is.changed, is.deleted, is.unchanged);
+
+out:
+	rtnl_txq_free(&is.changes);
+	free(is.hash);
+	free(is.ents);
+	return ret;
+}
+
+static int do_modify(int cmd, int argc, char **argv)
+{
+	ILA_REQUEST(req, 1024, cmd, NLM_F_REQUEST);
+	struct ila_map m;
+
+	if (argc == 2 && strcmp(argv[0], "file") == 0)
+		return ila_sync(cmd, argv[1]);
+
+	if (ila_parse_opt(argc, argv, &m, cmd == ILA_CMD_ADD) < 0)
+		return -1;
+	ila_map_req(&req.n, &m);
 
 	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
 		return -2;
@@ -285,6 +646,25 @@ static int do_del(int argc, char **argv)
 	return 0;
 }
 
+static int do_sync(int argc, char **argv)
+{
+	const char *name = "-";
+
+	while (argc > 0) {
+		if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			name = *argv;
+		} else if (matches(*argv, "help") == 0) {
+			return usage();
+		} else {
+			return invarg("unknown argument", *argv);
+		}
+		argc--; argv++;
+	}
+
+	return ila_sync(0, name);
+}
+
 int do_ipila(int argc, char **argv)
 {
 	if (argc < 1)
@@ -297,11 +677,13 @@ int do_ipila(int argc, char **argv)
 		iprt_exit(1);
 
 	if (matches(*argv, "add") == 0)
-		return do_add(argc-1, argv+1);
+		return do_modify(ILA_CMD_ADD, argc-1, argv+1);
 	if (matches(*argv, "delete") == 0)
-		return do_del(argc-1, argv+1);
+		return do_modify(ILA_CMD_DEL, argc-1, argv+1);
 	if (matches(*argv, "list") == 0)
 		return do_list(argc-1, argv+1);
+	if (matches(*argv, "sync") == 0)
+		return do_sync(argc-1, argv+1);
 
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip ila help\".\n",
 		*argv);
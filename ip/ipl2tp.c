@@ -450,31 +450,89 @@ static int get_response(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/* what a dump of sessions is narrowed to, the kernel dumps them all */
+static struct {
+	uint32_t tunnel_id;
+	uint32_t session_id;
+} filter;
+
 static int session_nlmsg(const struct sockaddr_nl *who,
 			 struct nlmsghdr *n, void *arg)
+{
+	struct l2tp_data *data = arg;
+	int ret = get_response(n, arg);
+
+	if (ret)
+		return ret;
+	if (filter.tunnel_id && filter.tunnel_id != data->config.tunnel_id)
+		return 0;
+	if (filter.session_id && filter.session_id != data->config.session_id)
+		return 0;
+	print_session(arg);
+	return 0;
+}
+
+static int tunnel_nlmsg(const struct sockaddr_nl *who,
+			struct nlmsghdr *n, void *arg)
 {
 	int ret = get_response(n, arg);
 
 	if (ret == 0)
-		print_session(arg);
+		print_tunnel(arg);
 
 	return ret;
 }
 
-static int get_session(struct l2tp_data *p)
+/* Asks for the one tunnel or session of the id, or of the name, in p */
+static int get_one(int cmd, struct l2tp_data *p, rtnl_filter_t print)
 {
-	GENL_REQUEST(req, 128, genl_family, 0, L2TP_GENL_VERSION,
-		     L2TP_CMD_SESSION_GET,
-		     NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST);
+	struct nlmsghdr *answer;
 
-	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
+	GENL_REQUEST(req, 128, genl_family, 0, L2TP_GENL_VERSION,
+		     cmd, NLM_F_REQUEST);
 
-	if (p->config.tunnel_id && p->config.session_id) {
+	if (p->config.ifname)
+		addattrstrz(&req.n, 128, L2TP_ATTR_IFNAME, p->config.ifname);
+	if (p->config.tunnel_id)
 		addattr32(&req.n, 128, L2TP_ATTR_CONN_ID, p->config.tunnel_id);
+	if (p->config.session_id)
 		addattr32(&req.n, 128, L2TP_ATTR_SESSION_ID,
 			  p->config.session_id);
+
+	if (rtnl_talk_suppress_rtnl_errmsg(&genl_rth, &req.n, &answer) < 0) {
+		/* there is nothing to show, as a dump would have found */
+		if (errno == ENOENT)
+			return 0;
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(errno));
+		return -2;
 	}
 
+	if (new_json_obj(json)) {
+		free(answer);
+		return -1;
+	}
+	print(NULL, answer, p);
+	delete_json_obj();
+	fflush(stdout);
+	free(answer);
+
+	return 0;
+}
+
+static int get_session(struct l2tp_data *p)
+{
+	GENL_REQUEST(req, 128, genl_family, 0, L2TP_GENL_VERSION,
+		     L2TP_CMD_SESSION_GET,
+		     NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST);
+
+	if ((p->config.tunnel_id && p->config.session_id) || p->config.ifname)
+		return get_one(L2TP_CMD_SESSION_GET, p, session_nlmsg);
+
+	filter.tunnel_id = p->config.tunnel_id;
+	filter.session_id = p->config.session_id;
+
+	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
+
 	if (rtnl_send(&genl_rth, &req, req.n.nlmsg_len) < 0)
 		return -2;
 
@@ -490,27 +548,16 @@ static int get_session(struct l2tp_data *p)
 	return 0;
 }
 
-static int tunnel_nlmsg(const struct sockaddr_nl *who,
-			struct nlmsghdr *n, void *arg)
-{
-	int ret = get_response(n, arg);
-
-	if (ret == 0)
-		print_tunnel(arg);
-
-	return ret;
-}
-
 static int get_tunnel(struct l2tp_data *p)
 {
 	GENL_REQUEST(req, 1024, genl_family, 0, L2TP_GENL_VERSION,
 		     L2TP_CMD_TUNNEL_GET,
 		     NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST);
 
-	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
-
 	if (p->config.tunnel_id)
-		addattr32(&req.n, 1024, L2TP_ATTR_CONN_ID, p->config.tunnel_id);
+		return get_one(L2TP_CMD_TUNNEL_GET, p, tunnel_nlmsg);
+
+	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
 
 	if (rtnl_send(&genl_rth, &req, req.n.nlmsg_len) < 0)
 		return -2;
@@ -549,8 +596,10 @@ static int usage(void)
 		"          [ l2spec_type L2SPEC ]\n"
 		"       ip l2tp del tunnel tunnel_id ID\n"
 		"       ip l2tp del session tunnel_id ID session_id ID\n"
+		"       ip l2tp { add | del } { tunnel | session } file FILE [ ARGS ]\n"
 		"       ip l2tp show tunnel [ tunnel_id ID ]\n"
 		"       ip l2tp show session [ tunnel_id ID ] [ session_id ID ]\n"
+		"                            [ name NAME ]\n"
 		"\n"
 		"Where: NAME   := STRING\n"
 		"       ADDR   := { IP_ADDRESS | any }\n"
@@ -748,78 +797,310 @@ static int parse_args(int argc, char **argv, int cmd, struct l2tp_parm *p)
 }
 
 
-static int do_add(int argc, char **argv)
+/* the argument an add lacks, if any */
+static const char *add_missing(const struct l2tp_parm *p)
+{
+	if (!p->tunnel && !p->session)
+		return "tunnel or session";
+
+	if (p->tunnel_id == 0)
+		return "tunnel_id";
+
+	/* session_id and peer_session_id must be provided for sessions */
+	if ((p->session) && (p->peer_session_id == 0))
+		return "peer_session_id";
+	if ((p->session) && (p->session_id == 0))
+		return "session_id";
+
+	/* peer_tunnel_id is needed for tunnels */
+	if ((p->tunnel) && (p->peer_tunnel_id == 0))
+		return "peer_tunnel_id";
+
+	if (p->tunnel) {
+		if (p->local_ip.family == AF_UNSPEC)
+			return "local";
+
+		if (p->peer_ip.family == AF_UNSPEC)
+			return "remote";
+
+		if (p->encap == L2TP_ENCAPTYPE_UDP) {
+			if (p->local_udp_port == 0)
+				return "udp_sport";
+			if (p->peer_udp_port == 0)
+				return "udp_dport";
+		}
+	}
+	return NULL;
+}
+
+static const char *del_missing(const struct l2tp_parm *p)
+{
+	if (!p->tunnel && !p->session)
+		return "tunnel or session";
+
+	if ((p->tunnel) && (p->tunnel_id == 0))
+		return "tunnel_id";
+	if ((p->session) && (p->session_id == 0))
+		return "session_id";
+	return NULL;
+}
+
+static int add_send(struct l2tp_parm *p)
 {
-	struct l2tp_parm p;
 	int ret = 0;
 
-	if (parse_args(argc, argv, L2TP_ADD, &p) < 0)
-		return -1;
+	if (p->tunnel)
+		ret = create_tunnel(p);
 
-	if (!p.tunnel && !p.session)
-		return missarg("tunnel or session");
+	if (p->session) {
+		/* Only ethernet pseudowires supported */
+		p->pw_type = L2TP_PWTYPE_ETH;
 
-	if (p.tunnel_id == 0)
-		return missarg("tunnel_id");
+		ret = create_session(p);
+	}
 
-	/* session_id and peer_session_id must be provided for sessions */
-	if ((p.session) && (p.peer_session_id == 0))
-		return missarg("peer_session_id");
-	if ((p.session) && (p.session_id == 0))
-		return missarg("session_id");
+	return ret;
+}
 
-	/* peer_tunnel_id is needed for tunnels */
-	if ((p.tunnel) && (p.peer_tunnel_id == 0))
-		return missarg("peer_tunnel_id");
+static int del_send(struct l2tp_parm *p)
+{
+	if (p->session_id)
+		return delete_session(p);
+	else
+		return delete_tunnel(p);
+}
 
-	if (p.tunnel) {
-		if (p.local_ip.family == AF_UNSPEC)
-			return missarg("local");
+/*
+ * "file FILE" adds or deletes a tunnel or session for each line of FILE,
+ * which holds the arguments that come after those of the command. All
+ * lines are checked before the first request goes out, the requests are
+ * then pipelined on the one socket and their errors told by line.
+ */
+#define L2TP_FILE_MAX_ARGS	64
+
+struct l2tp_file {
+	const char	*name;
+	int		argc;		/* of the command, without "file" */
+	char		**argv;
+	char		**lines;
+	int		*lineno;
+	unsigned int	count;
+	unsigned int	failed;
+};
 
-		if (p.peer_ip.family == AF_UNSPEC)
-			return missarg("remote");
+static void l2tp_file_free(struct l2tp_file *f)
+{
+	unsigned int i;
 
-		if (p.encap == L2TP_ENCAPTYPE_UDP) {
-			if (p.local_udp_port == 0)
-				return missarg("udp_sport");
-			if (p.peer_udp_port == 0)
-				return missarg("udp_dport");
+	for (i = 0; i < f->count; i++)
+		free(f->lines[i]);
+	free(f->lines);
+	free(f->lineno);
+	free(f->argv);
+}
+
+/* parses the command with line i of the file after it */
+static int l2tp_file_parse(struct l2tp_file *f, unsigned int i, int cmd,
+			   struct l2tp_parm *p, char *buf, size_t size)
+{
+	char *largv[L2TP_FILE_MAX_ARGS];
+	int largc;
+
+	memcpy(largv, f->argv, f->argc * sizeof(*largv));
+	strlcpy(buf, f->lines[i], size);
+	largc = f->argc + makeargs(buf, largv + f->argc,
+				   L2TP_FILE_MAX_ARGS - f->argc);
+	return parse_args(largc, largv, cmd, p);
+}
+
+static int l2tp_file_read(struct l2tp_file *f, int cmd)
+{
+	int saved_lineno = cmdlineno;
+	unsigned int size = 0;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp = stdin;
+	int ret = 0;
+
+	if (strcmp(f->name, "-") != 0) {
+		fp = fopen(f->name, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				f->name, strerror(errno));
+			return -1;
+		}
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char buf[strlen(line) + 1];
+		struct l2tp_parm p;
+		const char *miss;
+
+		if (line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		if (f->count == size) {
+			char **lines;
+			int *lineno;
+
+			size = size ? size * 2 : 1024;
+			lines = realloc(f->lines, size * sizeof(*lines));
+			if (lines)
+				f->lines = lines;
+			lineno = realloc(f->lineno, size * sizeof(*lineno));
+			if (lineno)
+				f->lineno = lineno;
+			if (!lines || !lineno) {
+				perror("Cannot read file");
+				ret = -1;
+				break;
+			}
+		}
+		f->lines[f->count] = strdup(line);
+		if (!f->lines[f->count]) {
+			perror("Cannot read file");
+			ret = -1;
+			break;
+		}
+		f->lineno[f->count++] = cmdlineno;
+
+		if (l2tp_file_parse(f, f->count - 1, cmd, &p, buf,
+				    sizeof(buf)) < 0) {
+			ret = -1;
+			break;
+		}
+		miss = cmd == L2TP_ADD ? add_missing(&p) : del_missing(&p);
+		if (miss) {
+			fprintf(stderr, "%s:%d: argument \"%s\" is required\n",
+				f->name, cmdlineno, miss);
+			ret = -1;
+			break;
 		}
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = saved_lineno;
+	return ret;
+}
+
+static void l2tp_file_err(__u32 cookie, int error, void *arg)
+{
+	struct l2tp_file *f = arg;
+
+	fprintf(stderr, "%s:%u: RTNETLINK answers: %s\n",
+		f->name, cookie, strerror(-error));
+	f->failed++;
+}
+
+static int l2tp_file_run(struct l2tp_file *f, int cmd)
+{
+	int hflags = genl_rth.flags;
+	unsigned int i;
+	int ret = 0;
 
-		ret = create_tunnel(&p);
+	if (rtnl_async_begin(&genl_rth, 0, l2tp_file_err, f) < 0) {
+		perror("Cannot pipeline requests");
+		return -1;
+	}
+	genl_rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (i = 0; i < f->count && ret == 0; i++) {
+		char buf[strlen(f->lines[i]) + 1];
+		struct l2tp_parm p;
+
+		/* checked while reading, this cannot fail anymore */
+		l2tp_file_parse(f, i, cmd, &p, buf, sizeof(buf));
+		rtnl_async_cookie(&genl_rth, f->lineno[i]);
+		if (cmd == L2TP_ADD)
+			ret = add_send(&p);
+		else
+			ret = del_send(&p);
 	}
 
-	if (p.session) {
-		/* Only ethernet pseudowires supported */
-		p.pw_type = L2TP_PWTYPE_ETH;
+	if (rtnl_async_end(&genl_rth) < 0 && ret == 0)
+		ret = -2;
+	genl_rth.flags = hflags;
+
+	if (show_stats)
+		printf("%u requests, %u failed\n", f->count, f->failed);
+	return ret ? ret : f->failed ? -2 : 0;
+}
 
-		ret = create_session(&p);
+/* Runs cmd for each line of the file named in argv, if one is */
+static int l2tp_file_cmd(int cmd, int argc, char **argv)
+{
+	struct l2tp_file f = {};
+	int i, ret;
+
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "file") == 0)
+			break;
 	}
+	if (i == argc)
+		return 1;
+
+	if (i + 1 == argc)
+		return missarg("FILE");
+	if (argc - 2 >= L2TP_FILE_MAX_ARGS)
+		return invarg("too many arguments", argv[0]);
+
+	f.name = argv[i + 1];
+	f.argv = malloc((argc - 2 + 1) * sizeof(*f.argv));
+	if (!f.argv) {
+		perror("Cannot read file");
+		return -1;
+	}
+	memcpy(f.argv, argv, i * sizeof(*argv));
+	memcpy(f.argv + i, argv + i + 2, (argc - i - 2) * sizeof(*argv));
+	f.argc = argc - 2;
 
+	ret = l2tp_file_read(&f, cmd);
+	if (ret == 0)
+		ret = l2tp_file_run(&f, cmd);
+	l2tp_file_free(&f);
 	return ret;
 }
 
-static int do_del(int argc, char **argv)
+static int do_add(int argc, char **argv)
 {
 	struct l2tp_parm p;
+	const char *miss;
+	int ret;
 
-	if (parse_args(argc, argv, L2TP_DEL, &p) < 0)
+	ret = l2tp_file_cmd(L2TP_ADD, argc, argv);
+	if (ret <= 0)
+		return ret;
+
+	if (parse_args(argc, argv, L2TP_ADD, &p) < 0)
 		return -1;
 
-	if (!p.tunnel && !p.session)
-		return missarg("tunnel or session");
+	miss = add_missing(&p);
+	if (miss)
+		return missarg(miss);
+
+	return add_send(&p);
+}
 
-	if ((p.tunnel) && (p.tunnel_id == 0))
-		return missarg("tunnel_id");
-	if ((p.session) && (p.session_id == 0))
-		return missarg("session_id");
+static int do_del(int argc, char **argv)
+{
+	struct l2tp_parm p;
+	const char *miss;
+	int ret;
 
-	if (p.session_id)
-		return delete_session(&p);
-	else
-		return delete_tunnel(&p);
+	ret = l2tp_file_cmd(L2TP_DEL, argc, argv);
+	if (ret <= 0)
+		return ret;
+
+	if (parse_args(argc, argv, L2TP_DEL, &p) < 0)
+		return -1;
+
+	miss = del_missing(&p);
+	if (miss)
+		return missarg(miss);
 
-	return -1;
+	return del_send(&p);
 }
 
 static int do_show(int argc, char **argv)
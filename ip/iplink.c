@@ -24,6 +24,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <ctype.h>
+#include <fnmatch.h>
 #include <sys/ioctl.h>
 #include <stdbool.h>
 #include <linux/mpls.h>
@@ -32,6 +34,7 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "namespace.h"
+#include "plugin.h"
 
 #define IPLINK_IOCTL_COMPAT	1
 #ifndef LIBDIR
@@ -106,10 +109,20 @@ int iplink_usage(void)
 		"			  [ protodown { on | off } ]\n"
 		"			  [ gso_max_size BYTES ] | [ gso_max_segs PACKETS ]\n"
 		"\n"
-		"       ip link show [ DEVICE | group GROUP ] [up] [master DEV] [vrf NAME] [type TYPE]\n");
+		"       ip link set select SELECTOR [ SELECTOR ... ] set ARGS\n"
+		"       SELECTOR := { group DEVGROUP | name PATTERN | master DEVICE |\n"
+		"                     type TYPE }\n"
+		"\n"
+		"       One argument of add, set, replace and delete may hold a range\n"
+		"       {FIRST..LAST}, repeating the command with each number in place of\n"
+		"       the range, or of every %%d if that argument has one.\n"
+		"\n"
+		"       ip link show [ DEVICE | group GROUP ] [up] [master DEV] [vrf NAME] [type TYPE]\n"
+		"                    [ vf { NUM | all } ]\n");
 
 	fprintf(stderr, "\n       ip link xstats type TYPE [ ARGS ]\n");
 	fprintf(stderr, "\n       ip link afstats [ dev DEVICE ]\n");
+	fprintf(stderr, "\n       ip link stats sample [ dev DEVICE ] [ interval SECONDS ] [ count COUNT ]\n");
 
 	if (iplink_have_newlink()) {
 		fprintf(stderr,
@@ -139,20 +152,22 @@ static int on_off(const char *msg, const char *realval)
 }
 
 static void *BODY;		/* cached dlopen(NULL) handle */
-static struct link_util *linkutil_list;
+static struct plugin_cache link_plugins = PLUGIN_CACHE_INIT;
 
-struct link_util *get_link_kind(const char *id)
+static struct link_util *__get_link_kind(const char *id)
 {
-	void *dlh;
+	void *dlh = NULL;
 	char buf[256];
 	struct link_util *l;
 
-	for (l = linkutil_list; l; l = l->next)
-		if (strcmp(l->id, id) == 0)
-			return l;
+	if (plugin_find(&link_plugins, id, (void **)&l))
+		return l;
 
-	snprintf(buf, sizeof(buf), LIBDIR "/ip/link_%s.so", id);
-	dlh = dlopen(buf, RTLD_LAZY);
+	snprintf(buf, sizeof(buf), "link_%s.so", id);
+	if (plugin_dir_has(&link_plugins, LIBDIR "/ip", buf)) {
+		snprintf(buf, sizeof(buf), LIBDIR "/ip/link_%s.so", id);
+		dlh = dlopen(buf, RTLD_LAZY);
+	}
 	if (dlh == NULL) {
 		/* look in current binary, only open once */
 		dlh = BODY;
@@ -165,11 +180,17 @@ struct link_util *get_link_kind(const char *id)
 
 	snprintf(buf, sizeof(buf), "%s_link_util", id);
 	l = dlsym(dlh, buf);
-	if (l == NULL)
-		return NULL;
+	plugin_add(&link_plugins, id, l);
+	return l;
+}
 
-	l->next = linkutil_list;
-	linkutil_list = l;
+struct link_util *get_link_kind(const char *id)
+{
+	struct link_util *l;
+
+	plugin_lock(&link_plugins);
+	l = __get_link_kind(id);
+	plugin_unlock(&link_plugins);
 	return l;
 }
 
@@ -225,6 +246,14 @@ static int iplink_have_newlink(void)
 		.i.ifi_family = AF_UNSPEC,
 	};
 
+	/*
+	 * Captured requests are for a kernel that is not there to ask, and
+	 * one that took strict dumps (4.20) has had RTM_NEWLINK for ages.
+	 */
+	if (have_rtnl_newlink < 0 &&
+	    (rth.capture || rth.flags & RTNL_HANDLE_F_STRICT_CHK))
+		return 1;
+
 	if (have_rtnl_newlink < 0) {
 		if (rtnl_send(&rth, &req.n, req.n.nlmsg_len) < 0) {
 			perror("request send failed");
@@ -562,6 +591,8 @@ static int iplink_parse_vf(int vf, int *argcp, char ***argvp,
 			return -1;
 		}
 
+		ipaddr_set_vf_rate(tivt.vf, tivt.min_tx_rate,
+				   tivt.max_tx_rate, dev);
 		addattr_l(&req->n, sizeof(*req), IFLA_VF_RATE, &tivt,
 			  sizeof(tivt));
 	}
@@ -1024,7 +1055,9 @@ int iplink_parse(int argc, char **argv, struct iplink_req *req, char **type)
 	return ret;
 }
 
-static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
+/* the request of a command, up to sending it */
+static int iplink_build(int cmd, unsigned int flags, int argc, char **argv,
+			struct iplink_req *r)
 {
 	char *type = NULL;
 	struct iplink_req req = {
@@ -1083,12 +1116,494 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 		return -1;
 	}
 
+	memcpy(r, &req, req.n.nlmsg_len);
+	return 0;
+}
+
+static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
+{
+	struct iplink_req req;
+	int ret;
+
+	ret = iplink_build(cmd, flags, argc, argv, &req);
+	if (ret < 0)
+		return ret;
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		return -2;
 
 	return 0;
 }
 
+/*
+ * Templates: one argument of add, set, replace or delete may hold a
+ * range "{FIRST..LAST}", and the command is then run for every number
+ * in it. The number takes the place of the range, or of every "%d" in
+ * the arguments if that argument has one. The requests are pipelined.
+ */
+struct iplink_range {
+	int		arg;		/* the argument holding the range */
+	const char	*open;		/* its "{" */
+	const char	*close;		/* just past its "}" */
+	bool		pct;		/* the argument has a "%d" */
+	unsigned int	first;
+	unsigned int	last;
+	int		argc;
+	char		**argv;
+	int		ret;
+};
+
+static bool iplink_range_parse(const char *p, struct iplink_range *r)
+{
+	char *end;
+
+	if (!isdigit(p[1]))
+		return false;
+	r->first = strtoul(p + 1, &end, 10);
+	if (strncmp(end, "..", 2) || !isdigit(end[2]))
+		return false;
+	r->last = strtoul(end + 2, &end, 10);
+	if (*end != '}')
+		return false;
+	r->open = p;
+	r->close = end + 1;
+	return true;
+}
+
+/* returns 1 with r filled in, 0 without a range, -1 on a bad one */
+static int iplink_range_find(int argc, char **argv, struct iplink_range *r)
+{
+	int i, found = 0;
+
+	for (i = 0; i < argc; i++) {
+		const char *p;
+
+		for (p = strchr(argv[i], '{'); p; p = strchr(p + 1, '{')) {
+			if (!iplink_range_parse(p, r))
+				continue;
+			if (found++) {
+				fprintf(stderr, "Only one range \"{FIRST..LAST}\" is allowed\n");
+				return -1;
+			}
+			r->arg = i;
+		}
+	}
+	if (!found)
+		return 0;
+
+	if (r->last < r->first) {
+		fprintf(stderr, "Range \"%s\" is empty\n", argv[r->arg]);
+		return -1;
+	}
+	r->pct = strstr(argv[r->arg], "%d") != NULL;
+	r->argc = argc;
+	r->argv = argv;
+	r->ret = 0;
+	return 1;
+}
+
+/* bytes needed to expand any number into argument i */
+static size_t iplink_range_len(const char *arg)
+{
+	size_t len = strlen(arg) + 1 + 10;
+	const char *p;
+
+	for (p = strstr(arg, "%d"); p; p = strstr(p + 2, "%d"))
+		len += 10;
+	return len;
+}
+
+static char *iplink_range_subst(const struct iplink_range *r, int i,
+				unsigned int n, char *out)
+{
+	const char *p = r->argv[i];
+	char num[16];
+	int len;
+
+	len = snprintf(num, sizeof(num), "%u", n);
+	while (*p) {
+		if (i == r->arg && p == r->open) {
+			if (!r->pct) {
+				memcpy(out, num, len);
+				out += len;
+			}
+			p = r->close;
+		} else if (p[0] == '%' && p[1] == 'd') {
+			memcpy(out, num, len);
+			out += len;
+			p += 2;
+		} else {
+			*out++ = *p++;
+		}
+	}
+	*out++ = '\0';
+	return out;
+}
+
+static void iplink_range_err(__u32 cookie, int error, void *arg)
+{
+	struct iplink_range *r = arg;
+	char name[iplink_range_len(r->argv[r->arg])];
+
+	iplink_range_subst(r, r->arg, r->first + cookie - 1, name);
+	fprintf(stderr, "%s: RTNETLINK answers: %s\n", name, strerror(-error));
+	r->ret = -2;
+}
+
+static int iplink_range_run(struct iplink_range *r,
+			    int (*fn)(int argc, char **argv, void *arg),
+			    void *arg)
+{
+	struct rtnl_async *outer = rth.async;
+	int hflags = rth.flags;
+	char **largv, *buf;
+	size_t size = 0;
+	unsigned int n;
+	int i, ret = 0;
+
+	for (i = 0; i < r->argc; i++)
+		size += iplink_range_len(r->argv[i]);
+	largv = malloc(r->argc * sizeof(*largv));
+	buf = malloc(size);
+	if (!largv || !buf) {
+		free(largv);
+		free(buf);
+		fprintf(stderr, "Cannot expand \"%s\"\n", r->argv[r->arg]);
+		return -1;
+	}
+
+	/* what a batch queued before this line is acked under its cookies */
+	if (outer)
+		rtnl_async_flush(&rth);
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, iplink_range_err, r) < 0) {
+		rth.async = outer;
+		free(largv);
+		free(buf);
+		perror("Cannot pipeline links");
+		return -1;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (n = r->first; ; n++) {
+		char *out = buf;
+
+		for (i = 0; i < r->argc; i++) {
+			largv[i] = out;
+			out = iplink_range_subst(r, i, n, out);
+		}
+		rtnl_async_cookie(&rth, n - r->first + 1);
+		ret = fn(r->argc, largv, arg);
+		if (ret == -1 || n == r->last)
+			break;
+	}
+
+	if (rtnl_async_end(&rth) < 0 && ret == 0)
+		ret = -2;
+	rth.async = outer;
+	rth.flags = hflags;
+	free(largv);
+	free(buf);
+	return ret ? ret : r->ret;
+}
+
+/*
+ * Runs fn once for the arguments as they are, or, when they hold a
+ * range, pipelined for every number in it.
+ */
+int iplink_range_cmd(int argc, char **argv,
+		     int (*fn)(int argc, char **argv, void *arg), void *arg)
+{
+	struct iplink_range r;
+
+	switch (iplink_range_find(argc, argv, &r)) {
+	case 1:
+		return iplink_range_run(&r, fn, arg);
+	case 0:
+		return fn(argc, argv, arg);
+	}
+	return -1;
+}
+
+struct iplink_modify_args {
+	int		cmd;
+	unsigned int	flags;
+};
+
+static int iplink_modify_one(int argc, char **argv, void *arg)
+{
+	const struct iplink_modify_args *m = arg;
+
+	return iplink_modify(m->cmd, m->flags, argc, argv);
+}
+
+static int iplink_modify_cmd(int cmd, unsigned int flags,
+			     int argc, char **argv)
+{
+	struct iplink_modify_args m = { .cmd = cmd, .flags = flags };
+
+	return iplink_range_cmd(argc, argv, iplink_modify_one, &m);
+}
+
+/*
+ * "ip link set select SELECTOR... set ARGS": the devices the selectors
+ * all match are listed once, from the link cache for a name pattern
+ * alone and from one filtered dump otherwise. ARGS are parsed once into
+ * the request for the first of them, and that request goes to each
+ * device with only the ifindex changed, pipelined. Whatever ARGS load,
+ * such as an XDP program, is thereby loaded once and shared.
+ */
+struct iplink_select {
+	int		group;		/* -1 for any */
+	const char	*pattern;
+	int		master;
+	const char	*kind;
+	unsigned int	*idx;
+	unsigned int	count;
+	unsigned int	size;
+	int		ret;
+};
+
+static __thread const struct iplink_select *select_filter;
+
+static int iplink_select_req(struct nlmsghdr *nlh, int reqlen)
+{
+	const struct iplink_select *sel = select_filter;
+	int err;
+
+	err = addattr32(nlh, reqlen, IFLA_EXT_MASK, RTEXT_FILTER_SKIP_STATS);
+	if (err)
+		return err;
+	if (sel->master) {
+		err = addattr32(nlh, reqlen, IFLA_MASTER, sel->master);
+		if (err)
+			return err;
+	}
+	if (sel->kind) {
+		struct rtattr *linkinfo;
+
+		linkinfo = addattr_nest(nlh, reqlen, IFLA_LINKINFO);
+		err = addattr_l(nlh, reqlen, IFLA_INFO_KIND, sel->kind,
+				strlen(sel->kind));
+		if (err)
+			return err;
+		addattr_nest_end(nlh, linkinfo);
+	}
+	return 0;
+}
+
+static int iplink_select_add(struct iplink_select *sel, unsigned int idx)
+{
+	if (sel->count == sel->size) {
+		unsigned int size = sel->size ? 2 * sel->size : 64;
+		unsigned int *p = realloc(sel->idx, size * sizeof(*p));
+
+		if (!p)
+			return -1;
+		sel->idx = p;
+		sel->size = size;
+	}
+	sel->idx[sel->count++] = idx;
+	return 0;
+}
+
+/* what a kernel not dumping strictly leaves to be checked here */
+static int iplink_select_link(const struct sockaddr_nl *who,
+			      struct nlmsghdr *n, void *arg)
+{
+	struct iplink_select *sel = arg;
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+
+	if (sel->group != -1 &&
+	    (!tb[IFLA_GROUP] || rta_getattr_u32(tb[IFLA_GROUP]) != sel->group))
+		return 0;
+	if (sel->master &&
+	    (!tb[IFLA_MASTER] || rta_getattr_u32(tb[IFLA_MASTER]) != sel->master))
+		return 0;
+	if (sel->kind) {
+		struct rtattr *li[IFLA_INFO_MAX + 1];
+
+		if (!tb[IFLA_LINKINFO])
+			return 0;
+		parse_rtattr_nested(li, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+		if (!li[IFLA_INFO_KIND] ||
+		    strcmp(rta_getattr_str(li[IFLA_INFO_KIND]), sel->kind))
+			return 0;
+	}
+	if (sel->pattern &&
+	    (!tb[IFLA_IFNAME] ||
+	     fnmatch(sel->pattern, rta_getattr_str(tb[IFLA_IFNAME]), 0)))
+		return 0;
+
+	return iplink_select_add(sel, ifi->ifi_index);
+}
+
+static int iplink_select_resolve(struct iplink_select *sel)
+{
+	unsigned int *list, count, i;
+
+	if (sel->group == -1 && !sel->master && !sel->kind) {
+		ll_init_map(&rth);
+		list = ll_index_list(&count);
+		if (!list)
+			return -1;
+		for (i = 0; i < count; i++)
+			if (!fnmatch(sel->pattern, ll_index_to_name(list[i]), 0) &&
+			    iplink_select_add(sel, list[i]) < 0)
+				break;
+		free(list);
+		return i == count ? 0 : -1;
+	}
+
+	select_filter = sel;
+	if (rtnl_wilddump_req_filter_fn(&rth, AF_UNSPEC, RTM_GETLINK,
+					iplink_select_req) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, iplink_select_link, sel) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void iplink_select_err(__u32 cookie, int error, void *arg)
+{
+	struct iplink_select *sel = arg;
+
+	fprintf(stderr, "%s: RTNETLINK answers: %s\n",
+		ll_index_to_name(sel->idx[cookie - 1]), strerror(-error));
+	sel->ret = -2;
+}
+
+static int iplink_select_run(struct iplink_select *sel, struct iplink_req *req)
+{
+	struct rtnl_async *outer = rth.async;
+	int hflags = rth.flags;
+	unsigned int i;
+	int ret = 0;
+
+	/* what a batch queued before this line is acked under its cookies */
+	if (outer)
+		rtnl_async_flush(&rth);
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, iplink_select_err, sel) < 0) {
+		rth.async = outer;
+		perror("Cannot pipeline links");
+		return -1;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (i = 0; i < sel->count; i++) {
+		req->i.ifi_index = sel->idx[i];
+		rtnl_async_cookie(&rth, i + 1);
+		if (rtnl_talk(&rth, &req->n, NULL) < 0)
+			iplink_select_err(i + 1, -errno, sel);
+	}
+
+	if (rtnl_async_end(&rth) < 0)
+		ret = -2;
+	rth.async = outer;
+	rth.flags = hflags;
+	return ret ? ret : sel->ret;
+}
+
+/* "select" followed by a selector, rather than a device called select */
+static bool iplink_select_verb(const char *arg, const char *next)
+{
+	return strcmp(arg, "select") == 0 &&
+	       (strcmp(next, "group") == 0 || strcmp(next, "name") == 0 ||
+		strcmp(next, "master") == 0 || strcmp(next, "type") == 0);
+}
+
+static int iplink_select_cmd(int argc, char **argv)
+{
+	struct iplink_select sel = { .group = -1 };
+	struct iplink_req req;
+	char **largv = NULL;
+	int i, ret = -1;
+
+	while (argc > 0 && strcmp(*argv, "set") != 0) {
+		if (strcmp(*argv, "group") == 0) {
+			NEXT_ARG();
+			if (sel.group != -1)
+				return duparg("group", *argv);
+			if (rtnl_group_a2n(&sel.group, *argv))
+				return invarg("Invalid \"group\" value\n", *argv);
+		} else if (strcmp(*argv, "name") == 0) {
+			NEXT_ARG();
+			if (sel.pattern)
+				return duparg("name", *argv);
+			sel.pattern = *argv;
+		} else if (strcmp(*argv, "master") == 0) {
+			NEXT_ARG();
+			if (sel.master)
+				return duparg("master", *argv);
+			sel.master = ll_name_to_index(*argv);
+			if (!sel.master)
+				return invarg("Device does not exist\n", *argv);
+		} else if (strcmp(*argv, "type") == 0) {
+			NEXT_ARG();
+			if (sel.kind)
+				return duparg("type", *argv);
+			sel.kind = *argv;
+		} else {
+			fprintf(stderr, "Unknown selector \"%s\", try \"ip link help\".\n",
+				*argv);
+			return -1;
+		}
+		argc--; argv++;
+	}
+	if (argc < 2 || (sel.group == -1 && !sel.pattern && !sel.master &&
+			 !sel.kind)) {
+		fprintf(stderr,
+			"Usage: ip link set select SELECTOR [ SELECTOR ... ] set ARGS\n");
+		return -1;
+	}
+	argc--; argv++;
+
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "dev") == 0 || strcmp(argv[i], "name") == 0 ||
+		    strcmp(argv[i], "xdpoffload") == 0) {
+			fprintf(stderr, "\"%s\" cannot be set on a selection of devices.\n",
+				argv[i]);
+			return -1;
+		}
+	}
+
+	if (iplink_select_resolve(&sel) < 0) {
+		fprintf(stderr, "Cannot list the selected devices\n");
+		goto out;
+	}
+	if (!sel.count) {
+		ret = 0;
+		goto out;
+	}
+
+	/* parsed for the first device, as "dev NAME ARGS" */
+	largv = malloc((argc + 2) * sizeof(*largv));
+	if (!largv)
+		goto out;
+	largv[0] = "dev";
+	largv[1] = (char *)ll_index_to_name(sel.idx[0]);
+	memcpy(largv + 2, argv, argc * sizeof(*largv));
+
+	ret = iplink_build(RTM_NEWLINK, 0, argc + 2, largv, &req);
+	if (ret == 0)
+		ret = iplink_select_run(&sel, &req);
+out:
+	free(largv);
+	free(sel.idx);
+	return ret;
+}
+
 int iplink_get(unsigned int flags, char *name, __u32 filt_mask)
 {
 	struct iplink_req req = {
@@ -1634,27 +2149,41 @@ static int do_help(int argc, char **argv)
 	return 0;
 }
 
+static bool iplink_modify_verb(const char *verb)
+{
+	return matches(verb, "add") == 0 || matches(verb, "set") == 0 ||
+	       matches(verb, "change") == 0 || matches(verb, "replace") == 0 ||
+	       matches(verb, "delete") == 0;
+}
+
 int do_iplink(int argc, char **argv)
 {
 	if (argc < 1)
 		return ipaddr_list_link(0, NULL);
 
-	if (iplink_have_newlink()) {
+	/* only the verbs that change links need to know how to */
+	if (!iplink_modify_verb(*argv)) {
+		/* fall through to the others */
+	} else if (iplink_have_newlink()) {
 		if (matches(*argv, "add") == 0)
-			return iplink_modify(RTM_NEWLINK,
-					     NLM_F_CREATE|NLM_F_EXCL,
-					     argc-1, argv+1);
+			return iplink_modify_cmd(RTM_NEWLINK,
+						 NLM_F_CREATE|NLM_F_EXCL,
+						 argc-1, argv+1);
+		if ((matches(*argv, "set") == 0 ||
+		     matches(*argv, "change") == 0) &&
+		    argc > 2 && iplink_select_verb(argv[1], argv[2]))
+			return iplink_select_cmd(argc-2, argv+2);
 		if (matches(*argv, "set") == 0 ||
 		    matches(*argv, "change") == 0)
-			return iplink_modify(RTM_NEWLINK, 0,
-					     argc-1, argv+1);
+			return iplink_modify_cmd(RTM_NEWLINK, 0,
+						 argc-1, argv+1);
 		if (matches(*argv, "replace") == 0)
-			return iplink_modify(RTM_NEWLINK,
-					     NLM_F_CREATE|NLM_F_REPLACE,
-					     argc-1, argv+1);
+			return iplink_modify_cmd(RTM_NEWLINK,
+						 NLM_F_CREATE|NLM_F_REPLACE,
+						 argc-1, argv+1);
 		if (matches(*argv, "delete") == 0)
-			return iplink_modify(RTM_DELLINK, 0,
-					     argc-1, argv+1);
+			return iplink_modify_cmd(RTM_DELLINK, 0,
+						 argc-1, argv+1);
 	} else {
 #if IPLINK_IOCTL_COMPAT
 		if (matches(*argv, "set") == 0)
@@ -1670,6 +2199,9 @@ int do_iplink(int argc, char **argv)
 	if (matches(*argv, "xstats") == 0)
 		return iplink_ifla_xstats(argc-1, argv+1);
 
+	if (matches(*argv, "stats") == 0)
+		return iplink_stats(argc-1, argv+1);
+
 	if (matches(*argv, "afstats") == 0) {
 		iplink_afstats(argc-1, argv+1);
 		return 0;
@@ -0,0 +1,291 @@
+/*
+ * iplink_stats.c	Periodic link counter sampling with RTM_GETSTATS.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Each sample asks the kernel for IFLA_STATS_LINK_64 alone, which is a
+ * small fraction of a full RTM_GETLINK dump. The counters of the last
+ * sample are kept in an array indexed by ifindex, and every device seen
+ * in two samples in a row gets its deltas and rates printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/if_link.h>
+
+#include "utils.h"
+#include "ip_common.h"
+
+struct link_sample {
+	__u64		rx_packets;
+	__u64		tx_packets;
+	__u64		rx_bytes;
+	__u64		tx_bytes;
+	__u64		rx_errors;
+	__u64		tx_errors;
+	__u64		rx_dropped;
+	__u64		tx_dropped;
+	unsigned int	round;		/* sample it was last seen in */
+};
+
+struct stats_sampler {
+	struct link_sample	*links;
+	unsigned int		size;
+	unsigned int		round;
+	double			elapsed;
+	int			ifindex;
+};
+
+static void print_explain(FILE *f)
+{
+	fprintf(f,
+		"Usage: ip link stats sample [ dev DEVICE ] [ interval SECONDS ] [ count COUNT ]\n");
+}
+
+static int sampler_grow(struct stats_sampler *s, unsigned int ifindex)
+{
+	unsigned int size = s->size ? s->size : 1024;
+	struct link_sample *links;
+
+	while (size <= ifindex)
+		size *= 2;
+
+	links = realloc(s->links, size * sizeof(*links));
+	if (!links)
+		return -1;
+	memset(links + s->size, 0, (size - s->size) * sizeof(*links));
+	s->links = links;
+	s->size = size;
+	return 0;
+}
+
+static void print_delta(const char *dir, __u64 bytes, __u64 packets,
+			__u64 errors, __u64 dropped, double elapsed)
+{
+	open_json_object(dir);
+	print_string(PRINT_FP, NULL, " %s", dir);
+	print_u64(PRINT_ANY, "bytes", " bytes %" PRIu64, bytes);
+	print_u64(PRINT_ANY, "packets", " packets %" PRIu64, packets);
+	print_u64(PRINT_ANY, "errors", " errors %" PRIu64, errors);
+	print_u64(PRINT_ANY, "dropped", " dropped %" PRIu64, dropped);
+	print_float(PRINT_ANY, "bytes_rate", " rate %.0fB/s", bytes / elapsed);
+	print_float(PRINT_ANY, "packets_rate", " %.0fpps", packets / elapsed);
+	close_json_object();
+}
+
+static void print_sample(int ifindex, const struct link_sample *old,
+			 const struct link_sample *cur, double elapsed)
+{
+	/* the counters went back, the device was reset or replaced */
+	if (cur->rx_packets < old->rx_packets ||
+	    cur->tx_packets < old->tx_packets ||
+	    cur->rx_bytes < old->rx_bytes ||
+	    cur->tx_bytes < old->tx_bytes ||
+	    cur->rx_errors < old->rx_errors ||
+	    cur->tx_errors < old->tx_errors ||
+	    cur->rx_dropped < old->rx_dropped ||
+	    cur->tx_dropped < old->tx_dropped)
+		return;
+
+	open_json_object(NULL);
+	print_int(PRINT_JSON, "ifindex", NULL, ifindex);
+	print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname", "%s:",
+			   ll_index_to_name(ifindex));
+	print_float(PRINT_JSON, "interval", NULL, elapsed);
+	print_delta("rx", cur->rx_bytes - old->rx_bytes,
+		    cur->rx_packets - old->rx_packets,
+		    cur->rx_errors - old->rx_errors,
+		    cur->rx_dropped - old->rx_dropped, elapsed);
+	print_delta("tx", cur->tx_bytes - old->tx_bytes,
+		    cur->tx_packets - old->tx_packets,
+		    cur->tx_errors - old->tx_errors,
+		    cur->tx_dropped - old->tx_dropped, elapsed);
+	print_string(PRINT_FP, NULL, "%s", "\n");
+	close_json_object();
+}
+
+static int sample_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	struct stats_sampler *s = arg;
+	struct if_stats_msg *ifsm = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_STATS_MAX + 1];
+	struct rtnl_link_stats64 st = {};
+	struct link_sample cur, *l;
+	int len = n->nlmsg_len;
+
+	if (n->nlmsg_type != RTM_NEWSTATS)
+		return 0;
+
+	len -= NLMSG_LENGTH(sizeof(*ifsm));
+	if (len < 0)
+		return -1;
+
+	if (ifsm->ifindex <= 0 || (s->ifindex && ifsm->ifindex != s->ifindex))
+		return 0;
+
+	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
+	if (!tb[IFLA_STATS_LINK_64])
+		return 0;
+	memcpy(&st, RTA_DATA(tb[IFLA_STATS_LINK_64]),
+	       MIN(RTA_PAYLOAD(tb[IFLA_STATS_LINK_64]), sizeof(st)));
+
+	if (ifsm->ifindex >= s->size && sampler_grow(s, ifsm->ifindex) < 0)
+		return -1;
+	l = &s->links[ifsm->ifindex];
+
+	cur = (struct link_sample) {
+		.rx_packets	= st.rx_packets,
+		.tx_packets	= st.tx_packets,
+		.rx_bytes	= st.rx_bytes,
+		.tx_bytes	= st.tx_bytes,
+		.rx_errors	= st.rx_errors,
+		.tx_errors	= st.tx_errors,
+		.rx_dropped	= st.rx_dropped,
+		.tx_dropped	= st.tx_dropped,
+		.round		= s->round,
+	};
+	if (l->round && l->round + 1 == s->round)
+		print_sample(ifsm->ifindex, l, &cur, s->elapsed);
+	*l = cur;
+	return 0;
+}
+
+static int sample_one(struct stats_sampler *s, __u32 filt_mask)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct if_stats_msg	ifsm;
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct if_stats_msg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETSTATS,
+		.ifsm.family = AF_UNSPEC,
+		.ifsm.ifindex = s->ifindex,
+		.ifsm.filter_mask = filt_mask,
+	};
+	struct nlmsghdr *answer;
+	int ret;
+
+	if (rtnl_talk(&rth, &req.n, &answer) < 0)
+		return -1;
+
+	ret = sample_nlmsg(NULL, answer, s);
+	free(answer);
+	return ret;
+}
+
+static int sample_all(struct stats_sampler *s, __u32 filt_mask)
+{
+	if (rtnl_wilddump_stats_req_filter(&rth, AF_UNSPEC, RTM_GETSTATS,
+					   filt_mask) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+
+	if (rtnl_dump_filter(&rth, sample_nlmsg, s) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int iplink_stats_sample(int argc, char **argv)
+{
+	__u32 filt_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+	struct stats_sampler s = {};
+	struct timespec next, now, last;
+	const char *filter_dev = NULL;
+	unsigned int count = 0;
+	double interval = 1;
+	int ret = 0;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (filter_dev)
+				return duparg2("dev", *argv);
+			filter_dev = *argv;
+		} else if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				return invarg("invalid count", *argv);
+		} else if (matches(*argv, "help") == 0) {
+			print_explain(stdout);
+			return 0;
+		} else {
+			return invarg("unknown argument", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (filter_dev) {
+		s.ifindex = ll_name_to_index(filter_dev);
+		if (s.ifindex <= 0) {
+			fprintf(stderr, "Device \"%s\" does not exist.\n",
+				filter_dev);
+			return -1;
+		}
+	} else {
+		ll_init_map(&rth);
+	}
+	/* names of devices that come, go or are renamed meanwhile */
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, names may go stale\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last = next;
+	for (s.round = 1; ; s.round++) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		s.elapsed = timespec_diff(&now, &last);
+		last = now;
+		ll_sync_map(&rth);
+
+		/* the first sample only primes the counters */
+		if (s.round > 1)
+			new_json_obj(json);
+		if (s.ifindex)
+			ret = sample_one(&s, filt_mask);
+		else
+			ret = sample_all(&s, filt_mask);
+		delete_json_obj();
+		if (s.round > 1 && !json)
+			printf("\n");
+		fflush(stdout);
+
+		/* count samples after the one the first deltas are taken to */
+		if (ret < 0 || (count && s.round > count))
+			break;
+
+		sample_wait(&next, interval);
+	}
+
+	free(s.links);
+	return ret < 0 ? 1 : 0;
+}
+
+int iplink_stats(int argc, char **argv)
+{
+	if (argc < 1 || matches(*argv, "help") == 0) {
+		print_explain(argc < 1 ? stderr : stdout);
+		return argc < 1 ? -1 : 0;
+	}
+
+	if (matches(*argv, "sample") == 0)
+		return iplink_stats_sample(argc - 1, argv + 1);
+
+	fprintf(stderr, "Command \"%s\" is unknown, try \"ip link stats help\".\n",
+		*argv);
+	return -1;
+}
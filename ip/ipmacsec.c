@@ -91,12 +91,15 @@ static int ipmacsec_usage(void)
 		"       ip macsec add DEV rx SCI sa { 0..3 } [ OPTS ] key ID KEY\n"
 		"       ip macsec set DEV rx SCI sa { 0..3 } [ OPTS ]\n"
 		"       ip macsec del DEV rx SCI sa { 0..3 }\n"
+		"       ip macsec rotate file FILE\n"
 		"       ip macsec show\n"
 		"       ip macsec show DEV\n"
 		"where  OPTS := [ pn <u32> ] [ on | off ]\n"
 		"       ID   := 128-bit hex string\n"
 		"       KEY  := 128-bit hex string\n"
-		"       SCI  := { sci <u64> | port { 1..2^16-1 } address <lladdr> }\n");
+		"       SCI  := { sci <u64> | port { 1..2^16-1 } address <lladdr> }\n"
+		"FILE lines := DEV tx sa { 0..3 } [ pn <u32> ] key ID KEY [ retire { 0..3 } ]\n"
+		"            | DEV rx SCI sa { 0..3 } [ pn <u32> ] key ID KEY [ retire { 0..3 } ]\n");
 
 	iprt_exit(-1);
 }
@@ -530,8 +533,274 @@ static int do_modify(enum cmd c, int argc, char **argv)
 	return -1;
 }
 
+/*
+ * "ip macsec rotate file FILE" puts in a new key for each line of FILE,
+ *
+ *	DEV tx sa AN [ pn PN ] key ID KEY [ retire AN ]
+ *	DEV rx SCI sa AN [ pn PN ] key ID KEY [ retire AN ]
+ *
+ * in three steps, each pipelined over all lines and waited for before
+ * the next: the new SAs are installed, the TX SCs then encode with
+ * theirs, and the old SAs are deleted. Rx SAs go in before any TX SA is
+ * switched to, and a line that failed is left out of the later steps.
+ */
+struct rotate_entry {
+	int		lineno;
+	int		ifindex;
+	bool		rx;
+	__u8		retire;		/* 0xff to keep the old SA */
+	bool		failed;
+	struct rxsc_desc rxsc;
+	struct sa_desc	sa;
+};
+
+struct rotate {
+	const char		*file;
+	struct rotate_entry	*e;
+	unsigned int		count;
+	unsigned int		failed;
+	const char		*step;
+};
+
+static int rotate_parse(struct rotate_entry *e, int argc, char **argv)
+{
+	int i;
+
+	e->ifindex = ll_name_to_index(argv[0]);
+	if (!e->ifindex) {
+		fprintf(stderr, "Device \"%s\" does not exist.\n", argv[0]);
+		return -1;
+	}
+	argc--; argv++;
+
+	e->rxsc.active = 0xff;
+	e->sa.an = 0xff;
+	e->sa.active = 0xff;
+	e->retire = 0xff;
+
+	/* take "retire AN" out of what is left to the SA parser */
+	for (i = 0; i < argc - 1; i++) {
+		if (strcmp(argv[i], "retire") != 0)
+			continue;
+		if (get_an(&e->retire, argv[i + 1]))
+			return invarg("expected an { 0..3 }", argv[i + 1]);
+		memmove(argv + i, argv + i + 2,
+			(argc - i - 2) * sizeof(*argv));
+		argc -= 2;
+		break;
+	}
+
+	if (argc > 0 && strcmp(*argv, "tx") == 0) {
+		argc--; argv++;
+		if (!get_sa(&argc, &argv, &e->sa.an))
+			return ipmacsec_usage();
+	} else if (argc > 0 && strcmp(*argv, "rx") == 0) {
+		argc--; argv++;
+		e->rx = true;
+		if (!parse_rxsci(&argc, &argv, &e->rxsc, &e->sa))
+			return ipmacsec_usage();
+	} else {
+		return ipmacsec_usage();
+	}
+
+	if (parse_sa_args(&argc, &argv, &e->sa))
+		return -1;
+	/* a new key starts counting packets afresh, and in use */
+	if (!e->sa.pn)
+		e->sa.pn = 1;
+	if (e->sa.active == 0xff)
+		e->sa.active = true;
+	if (check_sa_args(CMD_ADD, &e->sa))
+		return -1;
+	if (e->retire == e->sa.an)
+		return invarg("cannot retire the new SA", "retire");
+	return 0;
+}
+
+static int rotate_read(struct rotate *r)
+{
+	int saved_lineno = cmdlineno;
+	unsigned int size = 0;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp = stdin;
+	int ret = 0;
+
+	if (strcmp(r->file, "-") != 0) {
+		fp = fopen(r->file, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				r->file, strerror(errno));
+			return -1;
+		}
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[64];
+		int largc;
+
+		largc = makeargs(line, largv, ARRAY_SIZE(largv));
+		if (largc == 0)
+			continue;
+
+		if (r->count == size) {
+			struct rotate_entry *e;
+
+			size = size ? size * 2 : 256;
+			e = realloc(r->e, size * sizeof(*e));
+			if (!e) {
+				perror("Cannot read file");
+				ret = -1;
+				break;
+			}
+			r->e = e;
+		}
+		memset(&r->e[r->count], 0, sizeof(r->e[r->count]));
+		r->e[r->count].lineno = cmdlineno;
+		if (rotate_parse(&r->e[r->count], largc, largv) < 0) {
+			fprintf(stderr, "%s:%d: bad rotation\n",
+				r->file, cmdlineno);
+			ret = -1;
+			break;
+		}
+		r->count++;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = saved_lineno;
+	return ret;
+}
+
+static void rotate_err(__u32 cookie, int error, void *arg)
+{
+	struct rotate *r = arg;
+	struct rotate_entry *e = &r->e[cookie - 1];
+
+	fprintf(stderr, "%s:%d: %s: %s failed: %s\n", r->file, e->lineno,
+		ll_index_to_name(e->ifindex), r->step, strerror(-error));
+	if (!e->failed)
+		r->failed++;
+	e->failed = true;
+}
+
+static int rotate_encoding_sa(struct rotate_entry *e)
+{
+	struct iplink_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_NEWLINK,
+		.i.ifi_family = AF_UNSPEC,
+		.i.ifi_index = e->ifindex,
+	};
+	struct rtattr *linkinfo, *data;
+
+	linkinfo = addattr_nest(&req.n, sizeof(req), IFLA_LINKINFO);
+	addattr_l(&req.n, sizeof(req), IFLA_INFO_KIND, "macsec",
+		  strlen("macsec"));
+	data = addattr_nest(&req.n, sizeof(req), IFLA_INFO_DATA);
+	addattr8(&req.n, sizeof(req), IFLA_MACSEC_ENCODING_SA, e->sa.an);
+	addattr_nest_end(&req.n, data);
+	addattr_nest_end(&req.n, linkinfo);
+
+	return rtnl_talk(&rth, &req.n, NULL);
+}
+
+enum {
+	ROTATE_INSTALL,
+	ROTATE_ACTIVATE,
+	ROTATE_RETIRE,
+};
+
+/* Sends one step for all lines still in the game and waits for them */
+static int rotate_step(struct rotate *r, int step)
+{
+	static const char * const names[] = {
+		[ROTATE_INSTALL]	= "install",
+		[ROTATE_ACTIVATE]	= "activate",
+		[ROTATE_RETIRE]		= "retire",
+	};
+	struct rtnl_handle *h = step == ROTATE_ACTIVATE ? &rth : &genl_rth;
+	struct rtnl_async *outer = h->async;
+	int hflags = h->flags;
+	unsigned int i;
+	int ret = 0;
+
+	r->step = names[step];
+	/* what a batch queued before this line is acked under its cookies */
+	if (outer)
+		rtnl_async_flush(h);
+	h->async = NULL;
+	if (rtnl_async_begin(h, 0, rotate_err, r) < 0) {
+		h->async = outer;
+		perror("Cannot pipeline requests");
+		return -1;
+	}
+	h->flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (i = 0; i < r->count && ret == 0; i++) {
+		struct rotate_entry *e = &r->e[i];
+		struct sa_desc old = {
+			.an = e->retire,
+			.active = 0xff,
+		};
+
+		if (e->failed)
+			continue;
+
+		rtnl_async_cookie(h, i + 1);
+		switch (step) {
+		case ROTATE_INSTALL:
+			ret = do_modify_nl(CMD_ADD,
+					   macsec_commands[CMD_ADD][1][e->rx],
+					   e->ifindex, e->rx ? &e->rxsc : NULL,
+					   &e->sa);
+			break;
+		case ROTATE_ACTIVATE:
+			if (!e->rx)
+				ret = rotate_encoding_sa(e);
+			break;
+		case ROTATE_RETIRE:
+			if (e->retire != 0xff)
+				ret = do_modify_nl(CMD_DEL,
+						   macsec_commands[CMD_DEL][1][e->rx],
+						   e->ifindex,
+						   e->rx ? &e->rxsc : NULL, &old);
+			break;
+		}
+	}
+
+	if (rtnl_async_end(h) < 0 && ret == 0)
+		ret = -2;
+	h->async = outer;
+	h->flags = hflags;
+	return ret;
+}
+
+static int do_rotate(int argc, char **argv)
+{
+	struct rotate r = {};
+	int ret, step;
+
+	if (argc != 2 || strcmp(argv[0], "file") != 0)
+		return ipmacsec_usage();
+	r.file = argv[1];
+
+	ret = rotate_read(&r);
+	for (step = ROTATE_INSTALL; ret == 0 && step <= ROTATE_RETIRE; step++)
+		ret = rotate_step(&r, step);
+
+	if (ret == 0 && show_stats)
+		printf("%u rotations, %u failed\n", r.count, r.failed);
+	free(r.e);
+	if (ret)
+		return ret;
+	return r.failed ? -2 : 0;
+}
+
 /* dump/show */
-static struct {
+static __thread struct {
 	int ifindex;
 	__u64 sci;
 } filter;
@@ -1063,6 +1332,8 @@ int do_ipmacsec(int argc, char **argv)
 		return do_modify(CMD_UPD, argc-1, argv+1);
 	if (matches(*argv, "delete") == 0)
 		return do_modify(CMD_DEL, argc-1, argv+1);
+	if (matches(*argv, "rotate") == 0)
+		return do_rotate(argc-1, argv+1);
 
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip macsec help\".\n",
 		*argv);
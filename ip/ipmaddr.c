@@ -19,6 +19,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
 
 #include <linux/netdevice.h>
 #include <linux/if.h>
@@ -30,8 +31,9 @@
 #include "ip_common.h"
 #include "json_print.h"
 
-static struct {
+static __thread struct {
 	char *dev;
+	int  ifindex;
 	int  family;
 } filter;
 
@@ -42,26 +44,8 @@ static int usage(void)
 	iprt_exit(-1);
 }
 
-static int parse_hex(char *str, unsigned char *addr, size_t size)
-{
-	int len = 0;
-
-	while (*str && (len < 2 * size)) {
-		int tmp;
-
-		if (str[1] == 0)
-			return -1;
-		if (sscanf(str, "%02x", &tmp) != 1)
-			return -1;
-		addr[len] = tmp;
-		len++;
-		str += 2;
-	}
-	return len;
-}
-
 struct ma_info {
-	struct ma_info *next;
+	unsigned int	seq;		/* in the order read, per index */
 	int		index;
 	int		users;
 	char		*features;
@@ -69,125 +53,292 @@ struct ma_info {
 	inet_prefix	addr;
 };
 
-static void maddr_ins(struct ma_info **lst, struct ma_info *m)
+/*
+ * The groups of all the files are taken into one array and sorted by
+ * interface index once, rather than each being inserted into a sorted
+ * list. The files are read whole, each with a few preads, and split
+ * into fields here, not by sscanf(). With a device asked for, a line
+ * whose index is another is skipped without looking past the index.
+ */
+struct ma_list {
+	struct ma_info	*v;
+	size_t		n;
+	size_t		size;
+	char		*buf;
+	size_t		bufsize;
+};
+
+static struct ma_info *maddr_new(struct ma_list *l)
 {
-	struct ma_info *mp;
+	struct ma_info *m;
 
-	for (; (mp = *lst) != NULL; lst = &mp->next) {
-		if (mp->index > m->index)
-			break;
+	if (l->n == l->size) {
+		size_t size = l->size ? 2 * l->size : 256;
+
+		m = realloc(l->v, size * sizeof(*m));
+		if (!m)
+			return NULL;
+		l->v = m;
+		l->size = size;
 	}
-	m->next = *lst;
-	*lst = m;
+	m = &l->v[l->n];
+	memset(m, 0, sizeof(*m));
+	m->seq = l->n;
+	return m;
 }
 
-static void read_dev_mcast(struct ma_info **result_p)
+/* the whole of the file, NUL terminated, in l->buf */
+static const char *maddr_read(struct ma_list *l, const char *path)
 {
-	char buf[256];
-	FILE *fp = fopen("/proc/net/dev_mcast", "r");
+	size_t len = 0;
+	ssize_t n;
+	int fd;
 
-	if (!fp)
-		return;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
 
-	while (fgets(buf, sizeof(buf), fp)) {
-		char hexa[256];
-		struct ma_info m = { .addr.family = AF_PACKET };
-		int len;
-		int st;
+	for (;;) {
+		if (len + 1 >= l->bufsize) {
+			size_t size = l->bufsize ? 2 * l->bufsize : 65536;
+			char *buf = realloc(l->buf, size);
 
-		sscanf(buf, "%d%s%d%d%s", &m.index, m.name, &m.users, &st,
-		       hexa);
-		if (filter.dev && strcmp(filter.dev, m.name))
+			if (!buf) {
+				n = -1;
+				break;
+			}
+			l->buf = buf;
+			l->bufsize = size;
+		}
+		n = pread(fd, l->buf + len, l->bufsize - len - 1, len);
+		if (n < 0 && errno == EINTR)
 			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close(fd);
+	if (n < 0)
+		return NULL;
+	l->buf[len] = '\0';
+	return l->buf;
+}
 
-		len = parse_hex(hexa, (unsigned char *)&m.addr.data, sizeof(m.addr.data));
-		if (len >= 0) {
-			struct ma_info *ma = malloc(sizeof(m));
+static const char *ma_space(const char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
 
-			memcpy(ma, &m, sizeof(m));
-			ma->addr.bytelen = len;
-			ma->addr.bitlen = len<<3;
-			if (st)
-				ma->features = "static";
-			maddr_ins(result_p, ma);
-		}
+static const char *ma_eol(const char *p)
+{
+	const char *eol = strchr(p, '\n');
+
+	return eol ? eol + 1 : p + strlen(p);
+}
+
+static int ma_int(const char **p)
+{
+	const char *s = ma_space(*p);
+	int neg = (*s == '-');
+	int val = 0;
+
+	if (neg)
+		s++;
+	while (*s >= '0' && *s <= '9')
+		val = val * 10 + (*s++ - '0');
+	*p = s;
+	return neg ? -val : val;
+}
+
+/* the next field, cut to fit name */
+static void ma_name(const char **p, char *name, size_t size)
+{
+	const char *s = ma_space(*p);
+	size_t len = 0;
+
+	while (*s && *s != ' ' && *s != '\t' && *s != '\n') {
+		if (len + 1 < size)
+			name[len++] = *s;
+		s++;
 	}
-	fclose(fp);
+	name[len] = '\0';
+	*p = s;
 }
 
-static void read_igmp(struct ma_info **result_p)
+static int ma_xdigit(char c)
 {
-	struct ma_info m = {
-		.addr.family = AF_INET,
-		.addr.bitlen = 32,
-		.addr.bytelen = 4,
-	};
-	char buf[256];
-	FILE *fp = fopen("/proc/net/igmp", "r");
-
-	if (!fp)
-		return;
-	if (!fgets(buf, sizeof(buf), fp)) {
-		fclose(fp);
-		return;
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* the next field, pairs of hex digits, into addr; its length or -1 */
+static int ma_hex(const char **p, unsigned char *addr, size_t size)
+{
+	const char *s = ma_space(*p);
+	size_t len = 0;
+	int hi, lo;
+
+	while ((hi = ma_xdigit(s[0])) >= 0 && len < size) {
+		lo = ma_xdigit(s[1]);
+		if (lo < 0)
+			return -1;
+		addr[len++] = hi << 4 | lo;
+		s += 2;
 	}
+	*p = s;
+	return len;
+}
 
-	while (fgets(buf, sizeof(buf), fp)) {
-		struct ma_info *ma;
+static bool maddr_dev_skip(int index, const char *name)
+{
+	if (!filter.dev)
+		return false;
+	if (filter.ifindex)
+		return index != filter.ifindex;
+	return strcmp(filter.dev, name);
+}
 
-		if (buf[0] != '\t') {
-			size_t len;
+static bool maddr_index_skip(int index)
+{
+	return filter.dev && filter.ifindex && index != filter.ifindex;
+}
 
-			sscanf(buf, "%d%s", &m.index, m.name);
-			len = strlen(m.name);
-			if (m.name[len - 1] == ':')
-				m.name[len - 1] = '\0';
-			continue;
-		}
+static void read_dev_mcast(struct ma_list *l)
+{
+	const char *p = maddr_read(l, "/proc/net/dev_mcast");
+
+	for (; p && *p; p = ma_eol(p)) {
+		const char *q = p;
+		struct ma_info *m;
+		int index, len;
 
-		if (filter.dev && strcmp(filter.dev, m.name))
+		index = ma_int(&q);
+		if (maddr_index_skip(index))
 			continue;
 
-		sscanf(buf, "%08x%d", (__u32 *)&m.addr.data, &m.users);
+		m = maddr_new(l);
+		if (!m)
+			return;
+		m->index = index;
+		m->addr.family = AF_PACKET;
+		ma_name(&q, m->name, sizeof(m->name));
+		if (maddr_dev_skip(index, m->name))
+			continue;
+		m->users = ma_int(&q);
+		if (ma_int(&q))
+			m->features = "static";
 
-		ma = malloc(sizeof(m));
-		memcpy(ma, &m, sizeof(m));
-		maddr_ins(result_p, ma);
+		len = ma_hex(&q, (unsigned char *)&m->addr.data,
+			     sizeof(m->addr.data));
+		if (len < 0)
+			continue;
+		m->addr.bytelen = len;
+		m->addr.bitlen = len << 3;
+		l->n++;
 	}
-	fclose(fp);
 }
 
-
-static void read_igmp6(struct ma_info **result_p)
+/* a line per device, then a line per group starting with a tab */
+static void read_igmp(struct ma_list *l)
 {
-	char buf[256];
-	FILE *fp = fopen("/proc/net/igmp6", "r");
+	const char *p = maddr_read(l, "/proc/net/igmp");
+	char name[IFNAMSIZ] = "";
+	bool skip = true;
+	int index = 0;
+
+	if (p)
+		p = ma_eol(p);
+	for (; p && *p; p = ma_eol(p)) {
+		const char *q = p;
+		struct ma_info *m;
+		__u32 group = 0;
+		int d;
+
+		if (*p != '\t') {
+			size_t len;
 
-	if (!fp)
-		return;
+			index = ma_int(&q);
+			skip = maddr_index_skip(index);
+			if (skip)
+				continue;
+			ma_name(&q, name, sizeof(name));
+			len = strlen(name);
+			if (len && name[len - 1] == ':')
+				name[len - 1] = '\0';
+			skip = maddr_dev_skip(index, name);
+			continue;
+		}
+		if (skip)
+			continue;
 
-	while (fgets(buf, sizeof(buf), fp)) {
-		char hexa[256];
-		struct ma_info m = { .addr.family = AF_INET6 };
-		int len;
+		m = maddr_new(l);
+		if (!m)
+			return;
+		m->index = index;
+		strcpy(m->name, name);
+		m->addr.family = AF_INET;
+		m->addr.bitlen = 32;
+		m->addr.bytelen = 4;
+
+		/* the group as the kernel prints it, the address in memory */
+		q = ma_space(q);
+		while ((d = ma_xdigit(*q)) >= 0) {
+			group = group << 4 | d;
+			q++;
+		}
+		memcpy(m->addr.data, &group, sizeof(group));
+		m->users = ma_int(&q);
+		l->n++;
+	}
+}
+
+static void read_igmp6(struct ma_list *l)
+{
+	const char *p = maddr_read(l, "/proc/net/igmp6");
 
-		sscanf(buf, "%d%s%s%d", &m.index, m.name, hexa, &m.users);
+	for (; p && *p; p = ma_eol(p)) {
+		const char *q = p;
+		struct ma_info *m;
+		int index, len;
 
-		if (filter.dev && strcmp(filter.dev, m.name))
+		index = ma_int(&q);
+		if (maddr_index_skip(index))
 			continue;
 
-		len = parse_hex(hexa, (unsigned char *)&m.addr.data, sizeof(m.addr.data));
-		if (len >= 0) {
-			struct ma_info *ma = malloc(sizeof(m));
-
-			memcpy(ma, &m, sizeof(m));
+		m = maddr_new(l);
+		if (!m)
+			return;
+		m->index = index;
+		m->addr.family = AF_INET6;
+		ma_name(&q, m->name, sizeof(m->name));
+		if (maddr_dev_skip(index, m->name))
+			continue;
 
-			ma->addr.bytelen = len;
-			ma->addr.bitlen = len<<3;
-			maddr_ins(result_p, ma);
-		}
+		len = ma_hex(&q, (unsigned char *)&m->addr.data,
+			     sizeof(m->addr.data));
+		if (len < 0)
+			continue;
+		m->addr.bytelen = len;
+		m->addr.bitlen = len << 3;
+		m->users = ma_int(&q);
+		l->n++;
 	}
-	fclose(fp);
+}
+
+static int maddr_cmp(const void *a, const void *b)
+{
+	const struct ma_info *ma = a, *mb = b;
+
+	if (ma->index != mb->index)
+		return ma->index < mb->index ? -1 : 1;
+	return ma->seq < mb->seq ? -1 : ma->seq > mb->seq;
 }
 
 static void print_maddr(FILE *fp, struct ma_info *list)
@@ -221,13 +372,14 @@ static void print_maddr(FILE *fp, struct ma_info *list)
 	close_json_object();
 }
 
-static int print_mlist(FILE *fp, struct ma_info *list)
+static int print_mlist(FILE *fp, struct ma_list *l)
 {
+	struct ma_info *list;
 	int cur_index = 0;
 
 	if (new_json_obj(json))
 		return -1;
-	for (; list; list = list->next) {
+	for (list = l->v; list < l->v + l->n; list++) {
 
 		if (list->index != cur_index || oneline) {
 			if (cur_index) {
@@ -259,7 +411,7 @@ static int print_mlist(FILE *fp, struct ma_info *list)
 
 static int multiaddr_list(int argc, char **argv)
 {
-	struct ma_info *list = NULL;
+	struct ma_list list = {};
 
 	if (!filter.family)
 		filter.family = preferred_family;
@@ -277,13 +429,19 @@ static int multiaddr_list(int argc, char **argv)
 		argv++; argc--;
 	}
 
+	if (filter.dev)
+		filter.ifindex = ll_name_to_index(filter.dev);
+
 	if (!filter.family || filter.family == AF_PACKET)
 		read_dev_mcast(&list);
 	if (!filter.family || filter.family == AF_INET)
 		read_igmp(&list);
 	if (!filter.family || filter.family == AF_INET6)
 		read_igmp6(&list);
-	print_mlist(stdout, list);
+	qsort(list.v, list.n, sizeof(*list.v), maddr_cmp);
+	print_mlist(stdout, &list);
+	free(list.v);
+	free(list.buf);
 	return 0;
 }
 
@@ -19,28 +19,57 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 
 #include "utils.h"
 #include "ip_common.h"
+#include "rtmon_log.h"
+#include "rtnl_shmring.h"
 
 int prefix_banner;
 int listen_all_nsid;
+static int listen_all_netns;
+static unsigned int route_coalesce;	/* ms a route event is held */
+static int snapshot;			/* the state is dumped first */
 
 static int usage(void)
 {
-	fprintf(stderr, "Usage: ip monitor [ all | LISTofOBJECTS ] [ FILE ] [ label ] [all-nsid] [dev DEVICE]\n");
+	fprintf(stderr, "Usage: ip monitor [ all | LISTofOBJECTS ] [ FILE ] [ label ] [ all-nsid | all-netns ]\n");
+	fprintf(stderr, "                  [dev DEVICE] [ coalesce MS ] [ ring SLOTS ]\n");
+	fprintf(stderr, "                  [ lag SECONDS ] [ snapshot ]\n");
+	fprintf(stderr, "                  [ publish NAME [ size BYTES ] | subscribe NAME ]\n");
 	fprintf(stderr, "LISTofOBJECTS := link | address | route | mroute | prefix |\n");
 	fprintf(stderr, "                 neigh | netconf | rule | nsid\n");
-	fprintf(stderr, "FILE := file FILENAME\n");
+	fprintf(stderr, "FILE := file FILENAME [ since TIME ] [ until TIME ]\n");
+	fprintf(stderr, "TIME := { SECONDS | YYYY-MM-DD[THH:MM[:SS]] }\n");
+	fprintf(stderr, "       ip monitor neigh summary [ interval SECONDS ] [ top COUNT ] [ FILE ] [dev DEVICE]\n");
 	iprt_exit(-1);
 }
 
 static void print_headers(FILE *fp, char *label, struct rtnl_ctrl_data *ctrl)
 {
+	if (is_json_context())
+		return;
+
 	if (timestamp)
 		print_timestamp(fp);
 
-	if (listen_all_nsid) {
+	if (listen_all_netns) {
+		const char *name = NULL;
+
+		if (ctrl && ctrl->nsid >= 0)
+			name = get_name_from_nsid(ctrl->nsid);
+		if (ctrl == NULL || ctrl->nsid < 0)
+			fprintf(fp, "[netns current]");
+		else if (name)
+			fprintf(fp, "[netns %s]", name);
+		else
+			fprintf(fp, "[nsid %d]", ctrl->nsid);
+	} else if (listen_all_nsid) {
 		if (ctrl == NULL || ctrl->nsid < 0)
 			fprintf(fp, "[nsid current]");
 		else
@@ -74,6 +103,8 @@ static int accept_msg(const struct sockaddr_nl *who,
 			print_headers(fp, "[MROUTE]", ctrl);
 			print_mroute(who, n, arg);
 			return 0;
+		} else if (route_coalesce) {
+			return ipmonitor_route_hold(ctrl, n);
 		} else {
 			print_headers(fp, "[ROUTE]", ctrl);
 			print_route(who, n, arg);
@@ -84,12 +115,18 @@ static int accept_msg(const struct sockaddr_nl *who,
 	if (n->nlmsg_type == RTM_NEWLINK || n->nlmsg_type == RTM_DELLINK) {
 		ll_remember_index(who, n, NULL);
 		print_headers(fp, "[LINK]", ctrl);
+		open_json_object(NULL);
 		print_linkinfo(who, n, arg);
+		close_json_object();
+		fflush(fp);
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWADDR || n->nlmsg_type == RTM_DELADDR) {
 		print_headers(fp, "[ADDR]", ctrl);
+		open_json_object(NULL);
 		print_addrinfo(who, n, arg);
+		close_json_object();
+		fflush(fp);
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWADDRLABEL || n->nlmsg_type == RTM_DELADDRLABEL) {
@@ -112,7 +149,9 @@ static int accept_msg(const struct sockaddr_nl *who,
 	}
 	if (n->nlmsg_type == RTM_NEWPREFIX) {
 		print_headers(fp, "[PREFIX]", ctrl);
+		open_json_object(NULL);
 		print_prefix(who, n, arg);
+		close_json_object();
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWRULE || n->nlmsg_type == RTM_DELRULE) {
@@ -126,7 +165,8 @@ static int accept_msg(const struct sockaddr_nl *who,
 		return 0;
 	}
 	if (n->nlmsg_type == NLMSG_TSTAMP) {
-		print_nlmsg_timestamp(fp, n);
+		if (!is_json_context())
+			print_nlmsg_timestamp(fp, n);
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWNSID || n->nlmsg_type == RTM_DELNSID) {
@@ -134,8 +174,18 @@ static int accept_msg(const struct sockaddr_nl *who,
 		print_nsid(who, n, arg);
 		return 0;
 	}
+	if (n->nlmsg_type == NLMSG_DONE && snapshot) {
+		print_headers(fp, "[SNAPSHOT]", ctrl);
+		open_json_object(NULL);
+		print_bool(PRINT_JSON, "snapshot_done", NULL, true);
+		print_string(PRINT_FP, NULL, "%s\n",
+			     "Snapshot done, following changes");
+		close_json_object();
+		fflush(fp);
+		return 0;
+	}
 	if (n->nlmsg_type != NLMSG_ERROR && n->nlmsg_type != NLMSG_NOOP &&
-	    n->nlmsg_type != NLMSG_DONE) {
+	    n->nlmsg_type != NLMSG_DONE && !is_json_context()) {
 		fprintf(fp, "Unknown message: type=0x%08x(%d) flags=0x%08x(%d)len=0x%08x(%d)\n",
 			n->nlmsg_type, n->nlmsg_type,
 			n->nlmsg_flags, n->nlmsg_flags, n->nlmsg_len,
@@ -144,9 +194,271 @@ static int accept_msg(const struct sockaddr_nl *who,
 	return 0;
 }
 
+/* Names for the links of a capture that is read from the middle */
+static int remember_link(const struct sockaddr_nl *who,
+			 struct rtnl_ctrl_data *ctrl,
+			 struct nlmsghdr *n, void *arg)
+{
+	return ll_remember_index(who, n, NULL);
+}
+
+/* Seconds since the epoch or a local date and time, in usec */
+static int get_log_time(__u64 *usec, const char *arg)
+{
+	static const char * const fmts[] = {
+		"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%d %H:%M", "%Y-%m-%d",
+	};
+	struct tm tm;
+	double secs;
+	char *end;
+	int i;
+
+	secs = strtod(arg, &end);
+	if (end != arg && !*end && secs >= 0) {
+		*usec = secs * 1000000;
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(fmts); i++) {
+		time_t t;
+
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(arg, fmts[i], &tm);
+		if (!end || *end)
+			continue;
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+		if (t == (time_t)-1)
+			return -1;
+		*usec = (__u64)t * 1000000;
+		return 0;
+	}
+	return -1;
+}
+
+static int coalesced_route(struct rtnl_ctrl_data *ctrl, struct nlmsghdr *n,
+			   unsigned int suppressed, void *arg)
+{
+	FILE *fp = arg;
+
+	print_headers(fp, "[ROUTE]", ctrl);
+	print_route_coalesced(n, fp, suppressed);
+	fflush(fp);
+	return 0;
+}
+
+static int resync_msg(const struct sockaddr_nl *who,
+		      struct nlmsghdr *n, void *arg)
+{
+	return accept_msg(who, NULL, n, arg);
+}
+
+static unsigned int monitor_groups;
+
+/*
+ * With publish, the events only go into the ring, for the subscribers
+ * to print; their resync() is called when the publisher loses some.
+ */
+static struct rtnl_shmring *publish_ring;
+static char publish_path[NAME_MAX];
+static struct rtmon_log_filter subscribe_filter;
+
+static int publish_msg(const struct sockaddr_nl *who,
+		       struct rtnl_ctrl_data *ctrl,
+		       struct nlmsghdr *n, void *arg)
+{
+	int nsid = listen_all_nsid && ctrl ? ctrl->nsid : -1;
+
+	if (rtnl_shmring_write(publish_ring, n, nsid) < 0)
+		fprintf(stderr, "Event of %u bytes is too large to publish\n",
+			n->nlmsg_len);
+	return 0;
+}
+
+static int publish_tick(struct rtnl_handle *rth, void *arg)
+{
+	rtnl_shmring_flush(publish_ring);
+	return 0;
+}
+
+static int publish_resync(struct rtnl_handle *rth, void *arg)
+{
+	rtnl_shmring_lost(publish_ring);
+	rtnl_shmring_flush(publish_ring);
+	return 0;
+}
+
+static void publish_stop(int sig)
+{
+	shm_unlink(publish_path);
+	_exit(0);
+}
+
+static int subscribe_msg(const struct sockaddr_nl *who,
+			 struct rtnl_ctrl_data *ctrl,
+			 struct nlmsghdr *n, void *arg)
+{
+	if (!rtmon_log_wanted(&subscribe_filter, n->nlmsg_type))
+		return 0;
+	return accept_msg(who, ctrl, n, arg);
+}
+
+/* The dumps that give the state of what we watch, at most 5 */
+static unsigned int monitor_dumps(struct rtnl_snapshot_dump *d)
+{
+	const struct {
+		unsigned int	groups;
+		int		type;
+	} dumps[] = {
+		{ nl_mgrp(RTNLGRP_LINK), RTM_GETLINK },
+		{ nl_mgrp(RTNLGRP_IPV4_IFADDR) | nl_mgrp(RTNLGRP_IPV6_IFADDR),
+		  RTM_GETADDR },
+		{ nl_mgrp(RTNLGRP_IPV4_ROUTE) | nl_mgrp(RTNLGRP_IPV6_ROUTE) |
+		  nl_mgrp(RTNLGRP_MPLS_ROUTE), RTM_GETROUTE },
+		{ nl_mgrp(RTNLGRP_NEIGH), RTM_GETNEIGH },
+		{ nl_mgrp(RTNLGRP_IPV4_RULE) | nl_mgrp(RTNLGRP_IPV6_RULE),
+		  RTM_GETRULE },
+	};
+	unsigned int i, n = 0;
+
+	for (i = 0; i < ARRAY_SIZE(dumps); i++) {
+		if (!(monitor_groups & dumps[i].groups))
+			continue;
+		d[n].type = dumps[i].type;
+		d[n].family = dumps[i].type == RTM_GETLINK ?
+			      AF_UNSPEC : preferred_family;
+		n++;
+	}
+	return n;
+}
+
+/* The listener overflowed: print the current state of what we watch */
+static int monitor_resync(struct rtnl_handle *listener, void *arg)
+{
+	struct rtnl_snapshot_dump dumps[5];
+	unsigned int i, n = monitor_dumps(dumps);
+	FILE *fp = (FILE *)arg;
+	struct rtnl_handle dump_rth;
+	int ret = 0;
+
+	print_headers(fp, "[RESYNC]", NULL);
+	open_json_object(NULL);
+	print_bool(PRINT_JSON, "events_lost", NULL, true);
+	print_string(PRINT_FP, NULL, "%s\n",
+		     "Events lost, dumping current state");
+	close_json_object();
+
+	if (rtnl_open(&dump_rth, 0) < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (rtnl_wilddump_request(&dump_rth, dumps[i].family,
+					  dumps[i].type) < 0 ||
+		    rtnl_dump_filter(&dump_rth, resync_msg, fp) < 0) {
+			fprintf(stderr, "Resync dump failed\n");
+			ret = -1;
+			break;
+		}
+	}
+
+	rtnl_close(&dump_rth);
+	fflush(fp);
+	return ret;
+}
+
+/*
+ * With all-netns, namespaces named after the start get an nsid as well,
+ * and the names of deleted ones are forgotten before their nsid is
+ * reused. NETNS_RUN_DIR is watched from the listen loop, which wakes up
+ * at least once a second for it.
+ */
+static int netns_watch_fd = -1;
+static int netns_watch_retries;
+static time_t netns_watch_last;
+
+static int monitor_netns_tick(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct timespec now;
+	ssize_t len;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec == netns_watch_last)
+		return 0;
+	netns_watch_last = now.tv_sec;
+
+	while ((len = read(netns_watch_fd, buf, sizeof(buf))) > 0) {
+		char *p;
+
+		for (p = buf; p < buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+
+			if (ev->len && (ev->mask & (IN_DELETE | IN_MOVED_FROM)))
+				netns_map_forget(ev->name);
+			/* it is bound to a namespace only after creation */
+			if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+				netns_watch_retries = 3;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+
+	if (netns_watch_retries && netns_map_assign() == 0)
+		netns_watch_retries = 0;
+	else if (netns_watch_retries)
+		netns_watch_retries--;
+	return 0;
+}
+
+static int monitor_netns_watch(void)
+{
+	if (netns_map_assign() < 0)
+		return -1;
+
+	netns_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (netns_watch_fd < 0 ||
+	    inotify_add_watch(netns_watch_fd, NETNS_RUN_DIR,
+			      IN_CREATE | IN_DELETE |
+			      IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+		fprintf(stderr, "Cannot watch %s: %s\n", NETNS_RUN_DIR,
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int monitor_tick(struct rtnl_handle *rth, void *arg)
+{
+	if (netns_watch_fd >= 0 && monitor_netns_tick() < 0)
+		return -1;
+	if (route_coalesce && ipmonitor_route_flush(0) < 0)
+		return -1;
+	return 0;
+}
+
+/* Wake up the listen loop for the netns watch and the coalesced routes */
+static int monitor_tick_init(void)
+{
+	struct timeval tv = { .tv_sec = 1 };
+
+	if (route_coalesce) {
+		unsigned int ms = route_coalesce < 100 ? route_coalesce : 100;
+
+		tv.tv_sec = 0;
+		tv.tv_usec = ms * 1000;
+	}
+	if (setsockopt(rth.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		perror("SO_RCVTIMEO");
+		return -1;
+	}
+	rth.tick = monitor_tick;
+	return 0;
+}
+
 int do_ipmonitor(int argc, char **argv)
 {
 	char *file = NULL;
+	struct rtmon_log_filter lf = { .until = ~0ULL };
 	unsigned int groups = 0;
 	int llink = 0;
 	int laddr = 0;
@@ -158,6 +470,13 @@ int do_ipmonitor(int argc, char **argv)
 	int lrule = 0;
 	int lnsid = 0;
 	int ifindex = 0;
+	int summary = 0;
+	double interval = 1;
+	unsigned int top = 10;
+	unsigned int ring = 0;
+	double lag = 0;
+	const char *publish = NULL, *subscribe = NULL;
+	unsigned int publish_size = 4 << 20;
 
 	groups |= nl_mgrp(RTNLGRP_LINK);
 	groups |= nl_mgrp(RTNLGRP_IPV4_IFADDR);
@@ -182,6 +501,14 @@ int do_ipmonitor(int argc, char **argv)
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (file && strcmp(*argv, "since") == 0) {
+			NEXT_ARG();
+			if (get_log_time(&lf.since, *argv))
+				return invarg("invalid time", *argv);
+		} else if (file && strcmp(*argv, "until") == 0) {
+			NEXT_ARG();
+			if (get_log_time(&lf.until, *argv))
+				return invarg("invalid time", *argv);
 		} else if (matches(*argv, "label") == 0) {
 			prefix_banner = 1;
 		} else if (matches(*argv, "link") == 0) {
@@ -211,12 +538,51 @@ int do_ipmonitor(int argc, char **argv)
 		} else if (matches(*argv, "nsid") == 0) {
 			lnsid = 1;
 			groups = 0;
+		} else if (strcmp(*argv, "summary") == 0) {
+			summary = 1;
+		} else if (summary && matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (summary && strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&top, *argv, 0))
+				return invarg("invalid top count", *argv);
 		} else if (strcmp(*argv, "all") == 0) {
 			prefix_banner = 1;
+		} else if (strcmp(*argv, "all-netns") == 0) {
+			listen_all_nsid = 1;
+			listen_all_netns = 1;
 		} else if (matches(*argv, "all-nsid") == 0) {
 			listen_all_nsid = 1;
 		} else if (matches(*argv, "help") == 0) {
 			return usage();
+		} else if (strcmp(*argv, "coalesce") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&route_coalesce, *argv, 0) ||
+			    !route_coalesce || route_coalesce > 3600000)
+				return invarg("invalid coalescing window", *argv);
+		} else if (strcmp(*argv, "ring") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&ring, *argv, 0) || !ring)
+				return invarg("invalid ring size", *argv);
+		} else if (strcmp(*argv, "snapshot") == 0) {
+			snapshot = 1;
+		} else if (strcmp(*argv, "publish") == 0) {
+			NEXT_ARG();
+			publish = *argv;
+		} else if (publish && strcmp(*argv, "size") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&publish_size, *argv, 0) ||
+			    !publish_size)
+				return invarg("invalid ring size", *argv);
+		} else if (strcmp(*argv, "subscribe") == 0) {
+			NEXT_ARG();
+			subscribe = *argv;
+		} else if (strcmp(*argv, "lag") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&lag, *argv))
+				return invarg("invalid lag interval", *argv);
 		} else if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
 
@@ -282,7 +648,49 @@ int do_ipmonitor(int argc, char **argv)
 	if (lnsid) {
 		groups |= nl_mgrp(RTNLGRP_NSID);
 	}
-	if (file) {
+	if (summary) {
+		if (llink || laddr || lroute || lmroute || lprefix ||
+		    lnetconf || lrule || lnsid) {
+			fprintf(stderr, "\"summary\" only applies to neigh events.\n");
+			iprt_exit(-1);
+		}
+		/* links only to keep device names current */
+		groups = nl_mgrp(RTNLGRP_NEIGH) | nl_mgrp(RTNLGRP_LINK);
+	}
+
+	if (route_coalesce && (file || summary)) {
+		fprintf(stderr, "\"coalesce\" only applies to live route events.\n");
+		iprt_exit(-1);
+	}
+	if (lag && file) {
+		fprintf(stderr, "\"lag\" only applies to live events.\n");
+		iprt_exit(-1);
+	}
+	if (snapshot && (file || summary)) {
+		fprintf(stderr, "\"snapshot\" only applies to live events.\n");
+		iprt_exit(-1);
+	}
+	if (ring && (file || summary)) {
+		fprintf(stderr, "\"ring\" only applies to live events.\n");
+		iprt_exit(-1);
+	}
+	if (publish && (file || summary || subscribe || route_coalesce ||
+			snapshot || ring || lag || listen_all_netns)) {
+		fprintf(stderr, "\"publish\" only receives the events for the subscribers.\n");
+		iprt_exit(-1);
+	}
+	if (subscribe && (file || summary || snapshot || ring || lag ||
+			  listen_all_netns)) {
+		fprintf(stderr, "\"subscribe\" reads the live events of a publisher only.\n");
+		iprt_exit(-1);
+	}
+
+	/* Events never end, so don't wrap them in an array */
+	if (json)
+		ndjson = 1;
+	new_json_obj(json);
+
+	if (file && summary) {
 		FILE *fp;
 		int err;
 
@@ -291,19 +699,146 @@ int do_ipmonitor(int argc, char **argv)
 			perror("Cannot fopen");
 			iprt_exit(-1);
 		}
-		err = rtnl_from_file(fp, accept_msg, stdout);
+		err = ipmonitor_neigh_summary(fp, interval, top, ifindex);
 		fclose(fp);
+		delete_json_obj();
 		return err;
 	}
 
+	/* what the objects asked for stand for in a capture, or a ring */
+	if (file || subscribe) {
+		lf.all_types = !(llink || laddr || lroute || lmroute ||
+				 lprefix || lneigh || lnetconf || lrule ||
+				 lnsid);
+		if (llink) {
+			rtmon_log_want(&lf, RTM_NEWLINK);
+			rtmon_log_want(&lf, RTM_DELLINK);
+		}
+		if (laddr) {
+			rtmon_log_want(&lf, RTM_NEWADDR);
+			rtmon_log_want(&lf, RTM_DELADDR);
+		}
+		if (lroute || lmroute) {
+			rtmon_log_want(&lf, RTM_NEWROUTE);
+			rtmon_log_want(&lf, RTM_DELROUTE);
+		}
+		if (lprefix)
+			rtmon_log_want(&lf, RTM_NEWPREFIX);
+		if (lneigh) {
+			rtmon_log_want(&lf, RTM_NEWNEIGH);
+			rtmon_log_want(&lf, RTM_DELNEIGH);
+			rtmon_log_want(&lf, RTM_GETNEIGH);
+		}
+		if (lnetconf) {
+			rtmon_log_want(&lf, RTM_NEWNETCONF);
+			rtmon_log_want(&lf, RTM_DELNETCONF);
+		}
+		if (lrule) {
+			rtmon_log_want(&lf, RTM_NEWRULE);
+			rtmon_log_want(&lf, RTM_DELRULE);
+		}
+		if (lnsid) {
+			rtmon_log_want(&lf, RTM_NEWNSID);
+			rtmon_log_want(&lf, RTM_DELNSID);
+		}
+	}
+
+	if (file) {
+		int err;
+
+		lf.quiet = remember_link;
+
+		err = rtmon_log_replay(file, &lf, accept_msg, stdout);
+		if (err == -ENOENT)
+			iprt_exit(-1);
+		delete_json_obj();
+		return err;
+	}
+
+	if (subscribe) {
+		struct rtnl_shmring *r;
+		int err;
+
+		/* a socket for names and dumps, not for the events */
+		if (rtnl_open(&rth, 0) < 0)
+			iprt_exit(1);
+		monitor_groups = groups;
+		rth.resync = monitor_resync;
+		ll_init_map(&rth);
+		if (route_coalesce) {
+			ipmonitor_route_coalesce(route_coalesce,
+						 coalesced_route, stdout);
+			rth.tick = monitor_tick;
+		}
+
+		subscribe_filter = lf;
+		r = rtnl_shmring_subscribe(subscribe);
+		if (!r)
+			iprt_exit(1);
+		err = rtnl_shmring_listen(r, &rth, subscribe_msg, stdout);
+		rtnl_shmring_close(r);
+		if (err < 0)
+			iprt_exit(2);
+		return 0;
+	}
+
 	if (rtnl_open(&rth, groups) < 0)
 		iprt_exit(1);
 	if (listen_all_nsid && rtnl_listen_all_nsid(&rth) < 0)
 		iprt_exit(1);
+	monitor_groups = groups;
+	rth.resync = monitor_resync;
 
 	ll_init_map(&rth);
 	netns_nsid_socket_init();
 	netns_map_init();
+	if (listen_all_netns && monitor_netns_watch() < 0)
+		iprt_exit(1);
+	if (route_coalesce)
+		ipmonitor_route_coalesce(route_coalesce, coalesced_route,
+					 stdout);
+	if ((listen_all_netns || route_coalesce) && monitor_tick_init() < 0)
+		iprt_exit(1);
+	if (lag && rtnl_lag_enable(&rth, lag * 1000, stdout, json) < 0)
+		iprt_exit(1);
+
+	if (publish) {
+		publish_ring = rtnl_shmring_publish(publish, publish_size);
+		if (!publish_ring)
+			iprt_exit(1);
+		snprintf(publish_path, sizeof(publish_path),
+			 RTNL_SHMRING_NAME, (int)getuid(), publish);
+		signal(SIGINT, publish_stop);
+		signal(SIGTERM, publish_stop);
+		signal(SIGHUP, publish_stop);
+		rth.tick = publish_tick;
+		rth.resync = publish_resync;
+		if (rtnl_listen(&rth, publish_msg, NULL) < 0) {
+			rtnl_shmring_close(publish_ring);
+			iprt_exit(2);
+		}
+		return 0;
+	}
+
+	if (summary) {
+		if (ipmonitor_neigh_summary(NULL, interval, top, ifindex) < 0)
+			iprt_exit(2);
+		return 0;
+	}
+
+	if (snapshot) {
+		struct rtnl_snapshot_dump dumps[5];
+
+		if (rtnl_snapshot(&rth, dumps, monitor_dumps(dumps),
+				  accept_msg, stdout) < 0)
+			iprt_exit(2);
+	}
+
+	if (ring) {
+		if (rtnl_listen_ring(&rth, ring, accept_msg, stdout) < 0)
+			iprt_exit(2);
+		return 0;
+	}
 
 	if (rtnl_listen(&rth, accept_msg, stdout) < 0)
 		iprt_exit(2);
@@ -0,0 +1,377 @@
+/*
+ * ipmonitor_neigh.c	"ip monitor neigh summary", aggregated events.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Rather than printing every neighbour event, only the header and the
+ * NDA_DST attribute of each one are decoded, and events and state
+ * changes are counted per device and per state. The last known state of
+ * each address lives in a fixed-size table, probed a few slots deep;
+ * when all of them are taken the address that changed least gives up
+ * its slot. Each interval prints the counters and the addresses that
+ * changed state the most, then starts again from zero.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/neighbour.h>
+
+#include "utils.h"
+#include "ip_common.h"
+
+#define NSUM_SLOTS	16384	/* addresses remembered, a power of two */
+#define NSUM_PROBE	8
+#define NSUM_DELETED	9	/* state index of RTM_DELNEIGH */
+#define NSUM_STATES	10
+
+static const char *nsum_state_names[NSUM_STATES] = {
+	"none", "incomplete", "reachable", "stale", "delay",
+	"probe", "failed", "noarp", "permanent", "deleted",
+};
+
+struct nsum_link {
+	__u64		events;
+	__u64		changes;
+	__u64		states[NSUM_STATES];
+};
+
+struct nsum_addr {
+	int		ifindex;	/* 0 if the slot is free */
+	__u8		family;
+	__u8		state;		/* index into nsum_state_names */
+	__u8		dst[16];
+	__u32		changes;	/* in this interval */
+};
+
+struct neigh_summary {
+	struct nsum_link	*links;
+	unsigned int		size;
+	struct nsum_addr	*addrs;
+	__u64			events;
+	__u64			changes;
+	unsigned int		overflows;
+	unsigned int		top;
+	int			ifindex;
+	double			interval;
+	struct timespec		last;
+	struct timespec		next;
+};
+
+static unsigned int nsum_state_index(__u16 state)
+{
+	unsigned int i;
+
+	for (i = 1; i < NSUM_DELETED; i++)
+		if (state & (1 << (i - 1)))
+			return i;
+	return 0;
+}
+
+static struct nsum_link *nsum_link(struct neigh_summary *ns, int ifindex)
+{
+	if (ifindex >= ns->size) {
+		unsigned int size = ns->size ? ns->size : 1024;
+		struct nsum_link *links;
+
+		while (size <= ifindex)
+			size *= 2;
+		links = realloc(ns->links, size * sizeof(*links));
+		if (!links)
+			return NULL;
+		memset(links + ns->size, 0,
+		       (size - ns->size) * sizeof(*links));
+		ns->links = links;
+		ns->size = size;
+	}
+	return &ns->links[ifindex];
+}
+
+/* the slot of an address, NULL with *pfree set to one it may take over */
+static struct nsum_addr *nsum_addr_find(struct neigh_summary *ns, int ifindex,
+					int family, const __u8 *dst,
+					struct nsum_addr **pfree)
+{
+	__u32 h = 2166136261U ^ ifindex ^ (family << 24);
+	struct nsum_addr *victim = NULL;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		h = (h ^ dst[i]) * 16777619U;
+
+	for (i = 0; i < NSUM_PROBE; i++) {
+		struct nsum_addr *a = &ns->addrs[(h + i) & (NSUM_SLOTS - 1)];
+
+		if (!a->ifindex) {
+			*pfree = a;
+			return NULL;
+		}
+		if (a->ifindex == ifindex && a->family == family &&
+		    !memcmp(a->dst, dst, 16))
+			return a;
+		if (!victim || a->changes < victim->changes)
+			victim = a;
+	}
+	*pfree = victim;
+	return NULL;
+}
+
+static int nsum_event(struct neigh_summary *ns, struct nlmsghdr *n)
+{
+	struct ndmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct nsum_addr *a, *slot;
+	struct nsum_link *l;
+	struct rtattr *rta;
+	unsigned int state;
+	__u8 dst[16] = {};
+
+	if (len < 0 || (r->ndm_flags & NTF_PROXY))
+		return 0;
+	if (r->ndm_family != AF_INET && r->ndm_family != AF_INET6)
+		return 0;
+	if (preferred_family && r->ndm_family != preferred_family)
+		return 0;
+	if (ns->ifindex && r->ndm_ifindex != ns->ifindex)
+		return 0;
+
+	for (rta = NDA_RTA(r); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type == NDA_DST)
+			break;
+	if (!RTA_OK(rta, len) || RTA_PAYLOAD(rta) > sizeof(dst))
+		return 0;
+	memcpy(dst, RTA_DATA(rta), RTA_PAYLOAD(rta));
+
+	l = nsum_link(ns, r->ndm_ifindex);
+	if (!l) {
+		perror("Cannot count neighbour events");
+		return -1;
+	}
+
+	state = n->nlmsg_type == RTM_DELNEIGH ?
+		NSUM_DELETED : nsum_state_index(r->ndm_state);
+	ns->events++;
+	l->events++;
+	l->states[state]++;
+
+	a = nsum_addr_find(ns, r->ndm_ifindex, r->ndm_family, dst, &slot);
+	if (!a) {
+		/* first seen here, there is nothing to compare it to */
+		a = slot;
+		a->ifindex = r->ndm_ifindex;
+		a->family = r->ndm_family;
+		memcpy(a->dst, dst, sizeof(dst));
+		a->changes = 0;
+	} else if (a->state != state) {
+		ns->changes++;
+		l->changes++;
+		a->changes++;
+	}
+	a->state = state;
+	return 0;
+}
+
+static void nsum_print_top(struct neigh_summary *ns)
+{
+	struct nsum_addr **top;
+	unsigned int i, n = 0;
+
+	if (!ns->top || !ns->changes)
+		return;
+	top = calloc(ns->top, sizeof(*top));
+	if (!top)
+		return;
+
+	/* keep the top N sorted by insertion, N is small */
+	for (i = 0; i < NSUM_SLOTS; i++) {
+		struct nsum_addr *a = &ns->addrs[i];
+		unsigned int j;
+
+		if (!a->ifindex || !a->changes)
+			continue;
+		if (n == ns->top && a->changes <= top[n - 1]->changes)
+			continue;
+		j = n < ns->top ? n++ : n - 1;
+		for (; j > 0 && top[j - 1]->changes < a->changes; j--)
+			top[j] = top[j - 1];
+		top[j] = a;
+	}
+
+	open_json_array(PRINT_JSON, "top");
+	print_string(PRINT_FP, NULL, "%s", "  top:\n");
+	for (i = 0; i < n; i++) {
+		const struct nsum_addr *a = top[i];
+
+		open_json_object(NULL);
+		print_color_string(PRINT_ANY, ifa_family_color(a->family),
+				   "dst", "    %s",
+				   format_host(a->family,
+					       af_byte_len(a->family), a->dst));
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname",
+				   " dev %s", ll_index_to_name(a->ifindex));
+		print_uint(PRINT_ANY, "changes", " changes %u", a->changes);
+		print_string(PRINT_ANY, "state", " %s\n",
+			     nsum_state_names[a->state]);
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	free(top);
+}
+
+static void nsum_print(struct neigh_summary *ns, double elapsed)
+{
+	unsigned int i, s;
+
+	open_json_object(NULL);
+	if (timestamp && !is_json_context())
+		print_timestamp(stdout);
+	print_float(PRINT_ANY, "interval", "neigh summary %.2fs:", elapsed);
+	print_u64(PRINT_ANY, "events", " %" PRIu64 " events,", ns->events);
+	print_u64(PRINT_ANY, "changes", " %" PRIu64 " changes,", ns->changes);
+	print_uint(PRINT_ANY, "overflows", " %u overflows\n", ns->overflows);
+
+	open_json_array(PRINT_JSON, "links");
+	for (i = 0; i < ns->size; i++) {
+		const struct nsum_link *l = &ns->links[i];
+
+		if (!l->events)
+			continue;
+		open_json_object(NULL);
+		print_int(PRINT_JSON, "ifindex", NULL, i);
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname", "  %s:",
+				   ll_index_to_name(i));
+		print_u64(PRINT_ANY, "events", " events %" PRIu64, l->events);
+		print_u64(PRINT_ANY, "changes", " changes %" PRIu64, l->changes);
+		open_json_object("states");
+		for (s = 0; s < NSUM_STATES; s++) {
+			char fmt[32];
+
+			if (!l->states[s])
+				continue;
+			snprintf(fmt, sizeof(fmt), " %s %%" PRIu64,
+				 nsum_state_names[s]);
+			print_u64(PRINT_ANY, nsum_state_names[s], fmt,
+				  l->states[s]);
+		}
+		close_json_object();
+		print_string(PRINT_FP, NULL, "%s", "\n");
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+
+	nsum_print_top(ns);
+	close_json_object();
+	if (!is_json_context())
+		printf("\n");
+	fflush(stdout);
+}
+
+static void nsum_reset(struct neigh_summary *ns)
+{
+	unsigned int i;
+
+	if (ns->links)
+		memset(ns->links, 0, ns->size * sizeof(*ns->links));
+	for (i = 0; i < NSUM_SLOTS; i++)
+		ns->addrs[i].changes = 0;
+	ns->events = ns->changes = 0;
+	ns->overflows = 0;
+}
+
+static int nsum_tick(struct rtnl_handle *rth, void *arg)
+{
+	struct neigh_summary *ns = arg;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_diff(&now, &ns->next) < 0)
+		return 0;
+
+	nsum_print(ns, timespec_diff(&now, &ns->last));
+	nsum_reset(ns);
+	ns->last = now;
+	/* a summary that ran late doesn't make the next ones come sooner */
+	while (timespec_diff(&now, &ns->next) >= 0)
+		timespec_add(&ns->next, ns->interval);
+	return 0;
+}
+
+static int nsum_overflow(struct rtnl_handle *rth, void *arg)
+{
+	struct neigh_summary *ns = arg;
+
+	ns->overflows++;
+	return 0;
+}
+
+static int nsum_accept(const struct sockaddr_nl *who,
+		       struct rtnl_ctrl_data *ctrl,
+		       struct nlmsghdr *n, void *arg)
+{
+	if (n->nlmsg_type == RTM_NEWLINK || n->nlmsg_type == RTM_DELLINK)
+		return ll_remember_index(who, n, NULL);
+	if (n->nlmsg_type == RTM_NEWNEIGH || n->nlmsg_type == RTM_DELNEIGH)
+		return nsum_event(arg, n);
+	return 0;
+}
+
+int ipmonitor_neigh_summary(FILE *fp, double interval, unsigned int top,
+			    int ifindex)
+{
+	struct neigh_summary ns = {
+		.interval = interval,
+		.top = top,
+		.ifindex = ifindex,
+	};
+	struct timeval tv;
+	double wake;
+	int ret;
+
+	ns.addrs = calloc(NSUM_SLOTS, sizeof(*ns.addrs));
+	if (!ns.addrs) {
+		perror("Cannot allocate neighbour table");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ns.last);
+
+	/* a saved stream is summed up as one interval */
+	if (fp) {
+		ret = rtnl_from_file(fp, nsum_accept, &ns);
+		if (ret == 0) {
+			struct timespec now;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			nsum_print(&ns, timespec_diff(&now, &ns.last));
+		}
+		goto out;
+	}
+
+	ns.next = ns.last;
+	timespec_add(&ns.next, interval);
+
+	/* wake up often enough to be on time when nothing happens */
+	wake = interval < 0.1 ? interval : 0.1;
+	tv.tv_sec = 0;
+	tv.tv_usec = wake * 1000000;
+	if (setsockopt(rth.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		perror("SO_RCVTIMEO");
+		ret = -1;
+		goto out;
+	}
+	rth.tick = nsum_tick;
+	rth.resync = nsum_overflow;
+
+	ret = rtnl_listen(&rth, nsum_accept, &ns);
+out:
+	free(ns.addrs);
+	free(ns.links);
+	return ret;
+}
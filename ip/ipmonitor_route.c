@@ -0,0 +1,235 @@
+/*
+ * ipmonitor_route.c	"ip monitor route coalesce", collapsed route churn.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * A route event is held back for the coalescing window rather than
+ * printed. Later events for the same route within the window replace
+ * the one held, so that when the window ends only the final state is
+ * printed, along with how many events it superseded. Routes are told
+ * apart as the kernel does: by table, destination, source, TOS and
+ * metric. Held events are found through a hash table and kept in a
+ * list in the order their windows end, which is the order they arrived.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "ip_common.h"
+
+struct rc_key {
+	__u32		table;
+	__u32		priority;
+	int		nsid;
+	__u8		family;
+	__u8		dst_len;
+	__u8		src_len;
+	__u8		tos;
+	__u8		dst[16];
+	__u8		src[16];
+};
+
+struct rc_route {
+	struct rc_route	*hnext;
+	struct rc_route	*next;
+	struct rc_key	key;
+	__u32		hash;
+	unsigned int	events;
+	struct timespec	due;
+	struct nlmsghdr	*n;
+};
+
+static struct route_coalesce {
+	struct rc_route		**hash;
+	unsigned int		size;	/* buckets, a power of two */
+	unsigned int		count;
+	struct rc_route		*head;
+	struct rc_route		**tail;
+	struct timespec		window;
+	route_emit_fn		emit;
+	void			*arg;
+} rc;
+
+static int rc_key_init(struct rc_key *key, struct rtnl_ctrl_data *ctrl,
+		       struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX + 1];
+
+	if (len < 0)
+		return -1;
+	parse_rtattr_want(tb, RTA_MAX,
+			  RTA_WANT(RTA_DST) | RTA_WANT(RTA_SRC) |
+			  RTA_WANT(RTA_TABLE) | RTA_WANT(RTA_PRIORITY),
+			  RTM_RTA(r), len);
+
+	memset(key, 0, sizeof(*key));
+	key->table = rtm_get_table(r, tb);
+	if (tb[RTA_PRIORITY])
+		key->priority = rta_getattr_u32(tb[RTA_PRIORITY]);
+	key->nsid = ctrl ? ctrl->nsid : -1;
+	key->family = r->rtm_family;
+	key->dst_len = r->rtm_dst_len;
+	key->src_len = r->rtm_src_len;
+	key->tos = r->rtm_tos;
+	if (tb[RTA_DST])
+		memcpy(key->dst, RTA_DATA(tb[RTA_DST]),
+		       MIN(RTA_PAYLOAD(tb[RTA_DST]), sizeof(key->dst)));
+	if (tb[RTA_SRC])
+		memcpy(key->src, RTA_DATA(tb[RTA_SRC]),
+		       MIN(RTA_PAYLOAD(tb[RTA_SRC]), sizeof(key->src)));
+	return 0;
+}
+
+static __u32 rc_hash(const struct rc_key *key)
+{
+	const __u8 *p = (const __u8 *)key;
+	__u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+static int rc_grow(void)
+{
+	unsigned int size = rc.size ? 2 * rc.size : 1024, i;
+	struct rc_route **hash;
+
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+	for (i = 0; i < rc.size; i++) {
+		struct rc_route *e, *next;
+
+		for (e = rc.hash[i]; e; e = next) {
+			next = e->hnext;
+			e->hnext = hash[e->hash & (size - 1)];
+			hash[e->hash & (size - 1)] = e;
+		}
+	}
+	free(rc.hash);
+	rc.hash = hash;
+	rc.size = size;
+	return 0;
+}
+
+static void rc_unhash(struct rc_route *e)
+{
+	struct rc_route **pe = &rc.hash[e->hash & (rc.size - 1)];
+
+	while (*pe != e)
+		pe = &(*pe)->hnext;
+	*pe = e->hnext;
+	rc.count--;
+}
+
+static int rc_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+	       (a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec);
+}
+
+void ipmonitor_route_coalesce(unsigned int ms, route_emit_fn emit, void *arg)
+{
+	rc.window.tv_sec = ms / 1000;
+	rc.window.tv_nsec = (ms % 1000) * 1000000L;
+	rc.emit = emit;
+	rc.arg = arg;
+	rc.tail = &rc.head;
+}
+
+int ipmonitor_route_hold(struct rtnl_ctrl_data *ctrl, struct nlmsghdr *n)
+{
+	struct rc_route *e;
+	struct nlmsghdr *copy;
+	struct rc_key key;
+	__u32 hash;
+
+	if (rc_key_init(&key, ctrl, n) < 0) {
+		fprintf(stderr, "BUG: wrong nlmsg len %d\n", n->nlmsg_len);
+		return -1;
+	}
+	hash = rc_hash(&key);
+
+	if (rc.size) {
+		for (e = rc.hash[hash & (rc.size - 1)]; e; e = e->hnext) {
+			if (e->hash == hash && !memcmp(&e->key, &key, sizeof(key)))
+				break;
+		}
+	} else {
+		e = NULL;
+	}
+
+	copy = malloc(n->nlmsg_len);
+	if (!copy)
+		return -1;
+	memcpy(copy, n, n->nlmsg_len);
+
+	/* superseded within the window */
+	if (e) {
+		free(e->n);
+		e->n = copy;
+		e->events++;
+		return 0;
+	}
+
+	if (rc.count >= rc.size && rc_grow() < 0)
+		goto fail;
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		goto fail;
+	e->key = key;
+	e->hash = hash;
+	e->events = 1;
+	e->n = copy;
+	clock_gettime(CLOCK_MONOTONIC, &e->due);
+	e->due.tv_sec += rc.window.tv_sec;
+	e->due.tv_nsec += rc.window.tv_nsec;
+	if (e->due.tv_nsec >= 1000000000L) {
+		e->due.tv_sec++;
+		e->due.tv_nsec -= 1000000000L;
+	}
+
+	e->hnext = rc.hash[hash & (rc.size - 1)];
+	rc.hash[hash & (rc.size - 1)] = e;
+	rc.count++;
+	*rc.tail = e;
+	rc.tail = &e->next;
+	return 0;
+fail:
+	free(copy);
+	return -1;
+}
+
+/* Print the routes whose window has ended, or all of them */
+int ipmonitor_route_flush(int all)
+{
+	struct timespec now;
+	int ret = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (rc.head && (all || rc_before(&rc.head->due, &now))) {
+		struct rc_route *e = rc.head;
+		struct rtnl_ctrl_data ctrl = { .nsid = e->key.nsid };
+
+		rc.head = e->next;
+		if (!rc.head)
+			rc.tail = &rc.head;
+		rc_unhash(e);
+
+		if (ret == 0)
+			ret = rc.emit(&ctrl, e->n, e->events - 1, rc.arg);
+		free(e->n);
+		free(e);
+	}
+	return ret;
+}
@@ -20,6 +20,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include <linux/netdevice.h>
 #include <linux/if.h>
@@ -35,6 +37,9 @@ static int usage(void)
 {
 	fprintf(stderr, "Usage: ip mroute show [ [ to ] PREFIX ] [ from PREFIX ] [ iif DEVICE ]\n");
 	fprintf(stderr, "                      [ table TABLE_ID ]\n");
+	fprintf(stderr, "       ip mroute sample [ [ to ] PREFIX ] [ from PREFIX ] [ iif DEVICE ]\n");
+	fprintf(stderr, "                        [ table TABLE_ID ] [ interval SECONDS ] [ count COUNT ]\n");
+	fprintf(stderr, "                        [ top N ] [ sort { bytes | packets | wrong_if } ]\n");
 	fprintf(stderr, "TABLE_ID := [ local | main | default | all | NUMBER ]\n");
 #if 0
 	fprintf(stderr, "Usage: ip mroute [ add | del ] DESTINATION from SOURCE [ iif DEVICE ] [ oif DEVICE ]\n");
@@ -48,7 +53,9 @@ struct rtfilter {
 	int iif;
 	inet_prefix mdst;
 	inet_prefix msrc;
-} filter;
+};
+
+static __thread struct rtfilter filter;
 
 int print_mroute(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
@@ -218,9 +225,8 @@ void ipmroute_reset_filter(int ifindex)
 	filter.iif = ifindex;
 }
 
-static int mroute_list(int argc, char **argv)
+static int mroute_filter_init(void)
 {
-	char *id = NULL;
 	int family;
 
 	ipmroute_reset_filter(0);
@@ -235,41 +241,55 @@ static int mroute_list(int argc, char **argv)
 		filter.af = RTNL_FAMILY_IP6MR;
 
 	filter.msrc.family = filter.mdst.family = family;
+	return family;
+}
 
-	while (argc > 0) {
-		if (matches(*argv, "table") == 0) {
-			__u32 tid;
-
-			NEXT_ARG();
-			if (rtnl_rttable_a2n(&tid, *argv)) {
-				if (strcmp(*argv, "all") == 0) {
-					filter.tb = 0;
-				} else if (strcmp(*argv, "help") == 0) {
-					return usage();
-				} else {
-					return invarg("table id value is invalid\n", *argv);
-				}
-			} else
-				filter.tb = tid;
-		} else if (strcmp(*argv, "iif") == 0) {
-			NEXT_ARG();
-			id = *argv;
-		} else if (matches(*argv, "from") == 0) {
-			NEXT_ARG();
-			if (get_prefix(&filter.msrc, *argv, family))
-				return invarg("from value is invalid\n", *argv);
-		} else {
-			if (strcmp(*argv, "to") == 0) {
-				NEXT_ARG();
-			}
-			if (matches(*argv, "help") == 0)
+/* one selector of "show" and "sample", with its value */
+static int mroute_filter_arg(int family, int *argcp, char ***argvp,
+			     char **id)
+{
+	int argc = *argcp;
+	char **argv = *argvp;
+	int ret = 0;
+
+	if (matches(*argv, "table") == 0) {
+		__u32 tid;
+
+		NEXT_ARG();
+		if (rtnl_rttable_a2n(&tid, *argv)) {
+			if (strcmp(*argv, "all") == 0) {
+				filter.tb = 0;
+			} else if (strcmp(*argv, "help") == 0) {
 				return usage();
-			if (get_prefix(&filter.mdst, *argv, family))
-				return invarg("to value is invalid\n", *argv);
+			} else {
+				ret = invarg("table id value is invalid\n", *argv);
+			}
+		} else
+			filter.tb = tid;
+	} else if (strcmp(*argv, "iif") == 0) {
+		NEXT_ARG();
+		*id = *argv;
+	} else if (matches(*argv, "from") == 0) {
+		NEXT_ARG();
+		if (get_prefix(&filter.msrc, *argv, family))
+			ret = invarg("from value is invalid\n", *argv);
+	} else {
+		if (strcmp(*argv, "to") == 0) {
+			NEXT_ARG();
 		}
-		argc--; argv++;
+		if (matches(*argv, "help") == 0)
+			return usage();
+		if (get_prefix(&filter.mdst, *argv, family))
+			ret = invarg("to value is invalid\n", *argv);
 	}
 
+	*argcp = argc;
+	*argvp = argv;
+	return ret;
+}
+
+static int mroute_filter_iif(const char *id)
+{
 	ll_init_map(&rth);
 
 	if (id)  {
@@ -280,6 +300,24 @@ static int mroute_list(int argc, char **argv)
 			return nodev(id);
 		filter.iif = idx;
 	}
+	return 0;
+}
+
+static int mroute_list(int argc, char **argv)
+{
+	char *id = NULL;
+	int family;
+
+	family = mroute_filter_init();
+
+	while (argc > 0) {
+		if (mroute_filter_arg(family, &argc, &argv, &id))
+			return -1;
+		argc--; argv++;
+	}
+
+	if (mroute_filter_iif(id))
+		return -1;
 
 	if (rtnl_wilddump_request(&rth, filter.af, RTM_GETROUTE) < 0) {
 		perror("Cannot send dump request");
@@ -298,6 +336,412 @@ static int mroute_list(int argc, char **argv)
 	return 0;
 }
 
+/*
+ * "ip mroute sample" dumps the cache every interval and keeps the
+ * counters of each (S,G) by table, source and group in a hash, taking
+ * only the attributes that key and filter it and RTA_MFC_STATS from
+ * each route. The entries seen in two dumps in a row are printed with
+ * their deltas and rates, busiest first.
+ */
+struct mfc_key {
+	__u32		table;
+	__u8		family;
+	__u8		src[16];
+	__u8		grp[16];
+};
+
+struct mfc_sample {
+	struct mfc_sample	*next;
+	struct mfc_key		key;
+	__u32			hash;
+	int			iif;
+	__u64			packets;
+	__u64			bytes;
+	__u64			wrong_if;
+	unsigned int		round;	/* sample it was last seen in */
+};
+
+struct mfc_rate {
+	const struct mfc_sample	*mfc;
+	__u64			packets;
+	__u64			bytes;
+	__u64			wrong_if;
+};
+
+enum {
+	MFC_SORT_BYTES,
+	MFC_SORT_PACKETS,
+	MFC_SORT_WRONG_IF,
+};
+
+struct mfc_sampler {
+	struct mfc_sample	**hash;
+	unsigned int		size;	/* buckets, a power of two */
+	unsigned int		count;
+	unsigned int		round;
+	struct mfc_rate		*rates;
+	unsigned int		nrates;
+	unsigned int		rates_size;
+	double			elapsed;
+};
+
+static int mfc_sort;
+
+static __u32 mfc_hash(const struct mfc_key *key)
+{
+	const __u8 *p = (const __u8 *)key;
+	__u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+static int mfc_sampler_grow(struct mfc_sampler *s)
+{
+	unsigned int size = s->size ? 2 * s->size : 1024, i;
+	struct mfc_sample **hash;
+
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+	for (i = 0; i < s->size; i++) {
+		struct mfc_sample *e, *next;
+
+		for (e = s->hash[i]; e; e = next) {
+			next = e->next;
+			e->next = hash[e->hash & (size - 1)];
+			hash[e->hash & (size - 1)] = e;
+		}
+	}
+	free(s->hash);
+	s->hash = hash;
+	s->size = size;
+	return 0;
+}
+
+static int mfc_sampler_rate(struct mfc_sampler *s, const struct mfc_sample *e,
+			    const struct rta_mfc_stats *mfcs)
+{
+	if (s->nrates == s->rates_size) {
+		unsigned int size = s->rates_size ? 2 * s->rates_size : 1024;
+		struct mfc_rate *rates;
+
+		rates = realloc(s->rates, size * sizeof(*rates));
+		if (!rates)
+			return -1;
+		s->rates = rates;
+		s->rates_size = size;
+	}
+	s->rates[s->nrates++] = (struct mfc_rate) {
+		.mfc		= e,
+		.packets	= mfcs->mfcs_packets - e->packets,
+		.bytes		= mfcs->mfcs_bytes - e->bytes,
+		.wrong_if	= mfcs->mfcs_wrong_if - e->wrong_if,
+	};
+	return 0;
+}
+
+static int mfc_sample_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			    void *arg)
+{
+	struct mfc_sampler *s = arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+	const struct rta_mfc_stats *mfcs = NULL;
+	struct rtattr *src = NULL, *dst = NULL, *rta;
+	int len = n->nlmsg_len;
+	struct mfc_sample *e;
+	struct mfc_key key;
+	__u32 table = r->rtm_table;
+	__u32 hash;
+	int iif = 0;
+
+	if (n->nlmsg_type != RTM_NEWROUTE)
+		return 0;
+	len -= NLMSG_LENGTH(sizeof(*r));
+	if (len < 0)
+		return -1;
+	if (r->rtm_type != RTN_MULTICAST)
+		return 0;
+	if (filter.af && filter.af != r->rtm_family)
+		return 0;
+
+	for (rta = RTM_RTA(r); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case RTA_TABLE:
+			table = rta_getattr_u32(rta);
+			break;
+		case RTA_SRC:
+			src = rta;
+			break;
+		case RTA_DST:
+			dst = rta;
+			break;
+		case RTA_IIF:
+			iif = rta_getattr_u32(rta);
+			break;
+		case RTA_MFC_STATS:
+			if (RTA_PAYLOAD(rta) >= sizeof(*mfcs))
+				mfcs = RTA_DATA(rta);
+			break;
+		}
+	}
+
+	if (!mfcs)
+		return 0;
+	if (filter.tb > 0 && filter.tb != table)
+		return 0;
+	if (filter.iif && filter.iif != iif)
+		return 0;
+	if (inet_addr_match_rta(&filter.mdst, dst) ||
+	    inet_addr_match_rta(&filter.msrc, src))
+		return 0;
+
+	memset(&key, 0, sizeof(key));
+	key.table = table;
+	key.family = r->rtm_family;
+	if (src && RTA_PAYLOAD(src) <= sizeof(key.src))
+		memcpy(key.src, RTA_DATA(src), RTA_PAYLOAD(src));
+	if (dst && RTA_PAYLOAD(dst) <= sizeof(key.grp))
+		memcpy(key.grp, RTA_DATA(dst), RTA_PAYLOAD(dst));
+	hash = mfc_hash(&key);
+
+	e = NULL;
+	if (s->size) {
+		for (e = s->hash[hash & (s->size - 1)]; e; e = e->next) {
+			if (e->hash == hash && !memcmp(&e->key, &key, sizeof(key)))
+				break;
+		}
+	}
+
+	if (!e) {
+		if (s->count >= s->size && mfc_sampler_grow(s) < 0)
+			return -1;
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			return -1;
+		e->key = key;
+		e->hash = hash;
+		e->next = s->hash[hash & (s->size - 1)];
+		s->hash[hash & (s->size - 1)] = e;
+		s->count++;
+	} else if (e->round + 1 == s->round &&
+		   mfcs->mfcs_packets >= e->packets &&
+		   mfcs->mfcs_bytes >= e->bytes &&
+		   mfcs->mfcs_wrong_if >= e->wrong_if) {
+		/* the counters going back would be an entry added again */
+		if (mfc_sampler_rate(s, e, mfcs) < 0)
+			return -1;
+	}
+
+	e->iif = iif;
+	e->packets = mfcs->mfcs_packets;
+	e->bytes = mfcs->mfcs_bytes;
+	e->wrong_if = mfcs->mfcs_wrong_if;
+	e->round = s->round;
+	return 0;
+}
+
+/* Forget the entries that were not in the last sample */
+static void mfc_sampler_expire(struct mfc_sampler *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->size; i++) {
+		struct mfc_sample **pe = &s->hash[i];
+
+		while (*pe) {
+			struct mfc_sample *e = *pe;
+
+			if (e->round == s->round) {
+				pe = &e->next;
+				continue;
+			}
+			*pe = e->next;
+			free(e);
+			s->count--;
+		}
+	}
+}
+
+static int mfc_rate_cmp(const void *a, const void *b)
+{
+	const struct mfc_rate *ra = a, *rb = b;
+	__u64 x, y;
+
+	switch (mfc_sort) {
+	case MFC_SORT_PACKETS:
+		x = ra->packets, y = rb->packets;
+		break;
+	case MFC_SORT_WRONG_IF:
+		x = ra->wrong_if, y = rb->wrong_if;
+		break;
+	default:
+		x = ra->bytes, y = rb->bytes;
+		break;
+	}
+	if (x != y)
+		return x < y ? 1 : -1;
+	if (ra->bytes != rb->bytes)
+		return ra->bytes < rb->bytes ? 1 : -1;
+	return 0;
+}
+
+static void print_mfc_rate(const struct mfc_rate *r, double elapsed)
+{
+	const struct mfc_sample *e = r->mfc;
+	int family = e->key.family == RTNL_FAMILY_IP6MR ? AF_INET6 : AF_INET;
+	int len = family == AF_INET6 ? 16 : 4;
+	char sbuf[64], gbuf[64];
+	SPRINT_BUF(b1);
+
+	rt_addr_n2a_r(family, len, e->key.src, sbuf, sizeof(sbuf));
+	rt_addr_n2a_r(family, len, e->key.grp, gbuf, sizeof(gbuf));
+
+	open_json_object(NULL);
+	if (is_json_context()) {
+		print_string(PRINT_JSON, "src", NULL, sbuf);
+		print_string(PRINT_JSON, "dst", NULL, gbuf);
+	} else {
+		char obuf[256];
+
+		snprintf(obuf, sizeof(obuf), "(%s,%s)", sbuf, gbuf);
+		print_string(PRINT_FP, NULL, "%-32s", obuf);
+	}
+	if (e->iif)
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "iif", " Iif: %-10s",
+				   ll_index_to_name(e->iif));
+	else
+		print_string(PRINT_ANY, "iif", " Iif: %-10s", "unresolved");
+	print_float(PRINT_JSON, "interval", NULL, elapsed);
+	print_u64(PRINT_ANY, "packets", " packets %" PRIu64, r->packets);
+	print_u64(PRINT_ANY, "bytes", " bytes %" PRIu64, r->bytes);
+	print_float(PRINT_ANY, "packets_rate", " rate %.0fpps",
+		    r->packets / elapsed);
+	print_float(PRINT_ANY, "bits_rate", " %.0fbps",
+		    r->bytes * 8 / elapsed);
+	if (r->wrong_if || is_json_context()) {
+		print_u64(PRINT_ANY, "wrong_if", " wrong_if %" PRIu64,
+			  r->wrong_if);
+		print_float(PRINT_ANY, "wrong_if_rate", " (%.0f/s)",
+			    r->wrong_if / elapsed);
+	}
+	if (e->key.table && e->key.table != RT_TABLE_DEFAULT && !filter.tb)
+		print_string(PRINT_ANY, "table", " Table: %s",
+			     rtnl_rttable_n2a(e->key.table, b1, sizeof(b1)));
+	print_string(PRINT_FP, NULL, "%s", "\n");
+	close_json_object();
+}
+
+static int mfc_sample_one(struct mfc_sampler *s, unsigned int top)
+{
+	unsigned int i;
+
+	s->nrates = 0;
+	if (rtnl_wilddump_request(&rth, filter.af, RTM_GETROUTE) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, mfc_sample_nlmsg, s) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	mfc_sampler_expire(s);
+
+	qsort(s->rates, s->nrates, sizeof(*s->rates), mfc_rate_cmp);
+	if (top && top < s->nrates)
+		s->nrates = top;
+	for (i = 0; i < s->nrates; i++)
+		print_mfc_rate(&s->rates[i], s->elapsed);
+	return 0;
+}
+
+static int mroute_sample(int argc, char **argv)
+{
+	struct mfc_sampler s = {};
+	struct timespec next, now, last;
+	unsigned int count = 0, top = 0, i;
+	double interval = 1;
+	char *id = NULL;
+	int family;
+	int ret = 0;
+
+	family = mroute_filter_init();
+	mfc_sort = MFC_SORT_BYTES;
+
+	while (argc > 0) {
+		if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				return invarg("invalid count", *argv);
+		} else if (strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&top, *argv, 0))
+				return invarg("invalid top", *argv);
+		} else if (strcmp(*argv, "sort") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "bytes") == 0)
+				mfc_sort = MFC_SORT_BYTES;
+			else if (strcmp(*argv, "packets") == 0)
+				mfc_sort = MFC_SORT_PACKETS;
+			else if (strcmp(*argv, "wrong_if") == 0)
+				mfc_sort = MFC_SORT_WRONG_IF;
+			else
+				return invarg("invalid sort", *argv);
+		} else if (mroute_filter_arg(family, &argc, &argv, &id)) {
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	if (mroute_filter_iif(id))
+		return -1;
+	/* names of devices that come, go or are renamed meanwhile */
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, names may go stale\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last = next;
+	for (s.round = 1; ; s.round++) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		s.elapsed = timespec_diff(&now, &last);
+		last = now;
+		ll_sync_map(&rth);
+
+		/* the first sample only primes the counters */
+		if (s.round > 1)
+			new_json_obj(json);
+		ret = mfc_sample_one(&s, top);
+		delete_json_obj();
+		if (s.round > 1 && !json)
+			printf("\n");
+		fflush(stdout);
+
+		/* count samples after the one the first rates are taken to */
+		if (ret < 0 || (count && s.round > count))
+			break;
+
+		sample_wait(&next, interval);
+	}
+
+	for (i = 0; i < s.size; i++) {
+		while (s.hash[i]) {
+			struct mfc_sample *e = s.hash[i];
+
+			s.hash[i] = e->next;
+			free(e);
+		}
+	}
+	free(s.hash);
+	free(s.rates);
+	return ret < 0 ? 1 : 0;
+}
+
 int do_multiroute(int argc, char **argv)
 {
 	if (argc < 1)
@@ -313,6 +757,8 @@ int do_multiroute(int argc, char **argv)
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
 		return mroute_list(argc-1, argv+1);
+	if (matches(*argv, "sample") == 0)
+		return mroute_sample(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		return usage();
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip mroute help\".\n", *argv);
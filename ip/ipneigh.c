@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -28,7 +29,7 @@
 #define NUD_VALID	(NUD_PERMANENT|NUD_NOARP|NUD_REACHABLE|NUD_PROBE|NUD_STALE|NUD_DELAY)
 #define MAX_ROUNDS	10
 
-static struct
+static __thread struct
 {
 	int family;
 	int index;
@@ -36,9 +37,7 @@ static struct
 	int unused_only;
 	inet_prefix pfx;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_txq *flushq;
 	int master;
 } filter;
 
@@ -47,7 +46,9 @@ static int usage(void)
 	fprintf(stderr, "Usage: ip neigh { add | del | change | replace }\n"
 			"                { ADDR [ lladdr LLADDR ] [ nud STATE ] | proxy ADDR } [ dev DEV ]\n");
 	fprintf(stderr, "       ip neigh { show | flush } [ proxy ] [ to PREFIX ] [ dev DEV ] [ nud STATE ]\n");
-	fprintf(stderr, "                                 [ vrf NAME ]\n\n");
+	fprintf(stderr, "                                 [ vrf NAME ]\n");
+	fprintf(stderr, "       ip neigh sync dev DEV [ file FILE ]\n\n");
+	fprintf(stderr, "FILE := lines of ADDR { LLADDR | null } [ STATE ]\n");
 	fprintf(stderr, "STATE := { permanent | noarp | stale | reachable | none |\n"
 			"           incomplete | delay | probe | failed }\n");
 	iprt_exit(-1);
@@ -84,11 +85,10 @@ static int nud_state_a2n(unsigned int *state, const char *arg)
 
 static int flush_update(void)
 {
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
+	if (rtnl_flush_send(&rth, filter.flushq)) {
+		fprintf(stderr, "Failed to flush neighbours\n");
 		return -1;
 	}
-	filter.flushp = 0;
 	return 0;
 }
 
@@ -175,8 +175,6 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 			return -1;
 	}
 
-	ll_init_map(&rth);
-
 	if (dev) {
 		req.ndm.ndm_ifindex = ll_name_to_index(dev);
 		if (!req.ndm.ndm_ifindex)
@@ -251,7 +249,7 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWNEIGH)
+	if (filter.flushq && n->nlmsg_type != RTM_NEWNEIGH)
 		return 0;
 
 	if (filter.family && filter.family != r->ndm_family)
@@ -284,19 +282,9 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 			return 0;
 	}
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELNEIGH;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flushq) {
+		if (rtnl_flush_add(filter.flushq, n, RTM_DELNEIGH) < 0)
+			return -1;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -475,12 +463,10 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 	req.ndm.ndm_family = filter.family;
 
 	if (flush) {
+		struct rtnl_txq flushq = {};
 		int round = 0;
-		char flushb[4096-512];
 
-		filter.flushb = flushb;
-		filter.flushp = 0;
-		filter.flushe = sizeof(flushb);
+		filter.flushq = &flushq;
 
 		while (round < MAX_ROUNDS) {
 			if (rtnl_dump_request_n(&rth, &req.n) < 0) {
@@ -500,6 +486,7 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 						printf("*** Flush is complete after %d round%s ***\n", round, round > 1?"s":"");
 				}
 				fflush(stdout);
+				rtnl_txq_free(&flushq);
 				return 0;
 			}
 			round++;
@@ -513,6 +500,7 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 		}
 		printf("*** Flush not complete bailing out after %d rounds\n",
 			MAX_ROUNDS);
+		rtnl_txq_free(&flushq);
 		return 1;
 	}
 
@@ -532,6 +520,391 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 	return 0;
 }
 
+/*
+ * ip neigh sync makes the neighbours of a device match a file with as
+ * few requests as possible. The device is dumped once into an index by
+ * address, and only entries that are missing or different are replaced.
+ * Permanent entries missing from the file are deleted, while the ones
+ * the kernel resolved by itself are left alone.
+ */
+struct neigh_sync_entry {
+	__u8		family;
+	__u8		lladdr_len;
+	__u16		state;
+	__u8		dst[16];
+	__u8		lladdr[32];
+	unsigned int	next;		/* hash chain, index + 1 */
+	int		wanted;		/* line asking for it, 0 if none */
+};
+
+struct neigh_sync {
+	const char		*name;
+	int			ifindex;
+	struct neigh_sync_entry	*ents;
+	unsigned int		count;
+	unsigned int		max;
+	unsigned int		*hash;
+	unsigned int		hmask;
+	struct rtnl_txq		changes;
+	unsigned int		added, changed, deleted, unchanged;
+	int			del_failed;
+	int			ret;
+};
+
+struct neigh_req {
+	struct nlmsghdr		n;
+	struct ndmsg		ndm;
+	char			buf[64];
+};
+
+static unsigned int neigh_key_hash(int family, const __u8 *dst)
+{
+	__u32 h = 2166136261U ^ family;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		h = (h ^ dst[i]) * 16777619U;
+	return h;
+}
+
+static int neigh_sync_dump(const struct sockaddr_nl *who,
+			   struct nlmsghdr *n, void *arg)
+{
+	struct neigh_sync *ns = arg;
+	struct ndmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[NDA_MAX+1];
+	struct neigh_sync_entry *e;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+	if (n->nlmsg_type != RTM_NEWNEIGH || len < 0)
+		return 0;
+	if (r->ndm_ifindex != ns->ifindex || (r->ndm_flags & NTF_PROXY))
+		return 0;
+	if (r->ndm_family != AF_INET && r->ndm_family != AF_INET6)
+		return 0;
+
+	parse_rtattr(tb, NDA_MAX, NDA_RTA(r), len);
+	if (!tb[NDA_DST] || RTA_PAYLOAD(tb[NDA_DST]) > 16)
+		return 0;
+
+	if (ns->count == ns->max) {
+		unsigned int max = ns->max ? 2 * ns->max : 1024;
+
+		e = realloc(ns->ents, max * sizeof(*e));
+		if (!e) {
+			perror("Cannot index neighbours");
+			return -1;
+		}
+		ns->ents = e;
+		ns->max = max;
+	}
+
+	e = &ns->ents[ns->count++];
+	memset(e, 0, sizeof(*e));
+	e->family = r->ndm_family;
+	e->state = r->ndm_state;
+	memcpy(e->dst, RTA_DATA(tb[NDA_DST]), RTA_PAYLOAD(tb[NDA_DST]));
+	if (tb[NDA_LLADDR] && RTA_PAYLOAD(tb[NDA_LLADDR]) <= sizeof(e->lladdr)) {
+		e->lladdr_len = RTA_PAYLOAD(tb[NDA_LLADDR]);
+		memcpy(e->lladdr, RTA_DATA(tb[NDA_LLADDR]), e->lladdr_len);
+	}
+	return 0;
+}
+
+static int neigh_sync_index(struct neigh_sync *ns)
+{
+	unsigned int size = 16, i;
+
+	while (size < 2 * ns->count)
+		size *= 2;
+	ns->hash = calloc(size, sizeof(*ns->hash));
+	if (!ns->hash) {
+		perror("Cannot index neighbours");
+		return -1;
+	}
+	ns->hmask = size - 1;
+
+	for (i = 0; i < ns->count; i++) {
+		struct neigh_sync_entry *e = &ns->ents[i];
+		unsigned int h = neigh_key_hash(e->family, e->dst) & ns->hmask;
+
+		e->next = ns->hash[h];
+		ns->hash[h] = i + 1;
+	}
+	return 0;
+}
+
+static struct neigh_sync_entry *neigh_sync_find(struct neigh_sync *ns,
+						int family, const __u8 *dst)
+{
+	unsigned int i = ns->hash[neigh_key_hash(family, dst) & ns->hmask];
+
+	while (i) {
+		struct neigh_sync_entry *e = &ns->ents[i - 1];
+
+		if (e->family == family && !memcmp(e->dst, dst, 16))
+			return e;
+		i = e->next;
+	}
+	return NULL;
+}
+
+static void neigh_req_init(struct neigh_req *req, int cmd, int flags,
+			   int ifindex, int family, const __u8 *dst)
+{
+	memset(req, 0, sizeof(*req));
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST | flags;
+	req->n.nlmsg_type = cmd;
+	req->ndm.ndm_family = family;
+	req->ndm.ndm_ifindex = ifindex;
+	addattr_l(&req->n, sizeof(*req), NDA_DST, dst, af_byte_len(family));
+}
+
+/* a line is "ADDR { LLADDR | null } [ STATE ]" */
+static int neigh_sync_line(struct neigh_sync *ns, int argc, char **argv)
+{
+	struct neigh_sync_entry *e;
+	struct neigh_req req;
+	unsigned int state = NUD_PERMANENT;
+	char lladdr[32];
+	int lladdr_len = 0;
+	__u8 dst[16] = {};
+	inet_prefix addr;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "%s:%d: expected ADDR LLADDR [ STATE ]\n",
+			ns->name, cmdlineno);
+		return -1;
+	}
+	if (get_addr_1(&addr, argv[0], preferred_family) ||
+	    (addr.family != AF_INET && addr.family != AF_INET6)) {
+		fprintf(stderr, "%s:%d: invalid address \"%s\"\n",
+			ns->name, cmdlineno, argv[0]);
+		return -1;
+	}
+	memcpy(dst, addr.data, addr.bytelen);
+	if (strcmp(argv[1], "null")) {
+		lladdr_len = ll_addr_a2n(lladdr, sizeof(lladdr), argv[1]);
+		if (lladdr_len < 0)
+			return -1;
+	}
+	if (argc > 2 && nud_state_a2n(&state, argv[2])) {
+		fprintf(stderr, "%s:%d: invalid state \"%s\"\n",
+			ns->name, cmdlineno, argv[2]);
+		return -1;
+	}
+
+	e = neigh_sync_find(ns, addr.family, dst);
+	if (e && !e->wanted) {
+		e->wanted = cmdlineno;
+		if (e->state == state && e->lladdr_len == lladdr_len &&
+		    !memcmp(e->lladdr, lladdr, lladdr_len)) {
+			ns->unchanged++;
+			return 0;
+		}
+		ns->changed++;
+	} else if (!e) {
+		ns->added++;
+	}
+
+	neigh_req_init(&req, RTM_NEWNEIGH, NLM_F_CREATE | NLM_F_REPLACE,
+		       ns->ifindex, addr.family, dst);
+	req.ndm.ndm_state = state;
+	if (lladdr_len)
+		addattr_l(&req.n, sizeof(req), NDA_LLADDR, lladdr, lladdr_len);
+	if (rtnl_txq_add(&ns->changes, &req.n) < 0) {
+		perror("Cannot queue neighbour");
+		return -1;
+	}
+	/* the line it comes from rides in nlmsg_seq until it is sent */
+	((struct nlmsghdr *)(ns->changes.buf + ns->changes.len -
+			     NLMSG_ALIGN(req.n.nlmsg_len)))->nlmsg_seq = cmdlineno;
+	return 0;
+}
+
+static int neigh_sync_lines(struct neigh_sync *ns, FILE *fp)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[4];
+		int largc;
+
+		largc = makeargs(line, largv, 4);
+		if (largc == 0)
+			continue;	/* blank line */
+
+		ret = neigh_sync_line(ns, largc, largv);
+		if (ret < 0)
+			break;
+	}
+	free(line);
+	return ret;
+}
+
+static void neigh_sync_deletes(struct neigh_sync *ns)
+{
+	unsigned int i;
+
+	for (i = 0; i < ns->count; i++) {
+		struct neigh_sync_entry *e = &ns->ents[i];
+		struct neigh_req req;
+
+		if (e->wanted || !(e->state & NUD_PERMANENT))
+			continue;
+
+		neigh_req_init(&req, RTM_DELNEIGH, 0, ns->ifindex,
+			       e->family, e->dst);
+		if (rtnl_txq_add(&ns->changes, &req.n) < 0) {
+			perror("Cannot queue neighbour");
+			ns->ret = -2;
+			return;
+		}
+		ns->deleted++;
+	}
+}
+
+static void neigh_sync_err(__u32 cookie, int error, void *arg)
+{
+	struct neigh_sync *ns = arg;
+
+	ns->ret = -2;
+	if (cookie) {
+		fprintf(stderr, "%s:%u: RTNETLINK answers: %s\n",
+			ns->name, cookie, strerror(-error));
+		return;
+	}
+
+	/* a delete, the entry may well have gone meanwhile */
+	if (error == -ENOENT) {
+		ns->ret = 0;
+		return;
+	}
+	if (!ns->del_failed++)
+		fprintf(stderr, "Cannot delete neighbour: %s\n",
+			strerror(-error));
+}
+
+static int neigh_sync_send(struct neigh_sync *ns)
+{
+	struct rtnl_async *outer = rth.async;
+	int flags = rth.flags;
+	size_t off;
+
+	/* the dump left a batch's own queue, if any, empty */
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, neigh_sync_err, ns) < 0) {
+		rth.async = outer;
+		perror("Cannot pipeline neighbours");
+		return -1;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (off = 0; off < ns->changes.len; ) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(ns->changes.buf + off);
+
+		off += NLMSG_ALIGN(n->nlmsg_len);
+		rtnl_async_cookie(&rth, n->nlmsg_seq);
+		n->nlmsg_seq = 0;
+		if (rtnl_talk(&rth, n, NULL) < 0)
+			ns->ret = -2;
+	}
+
+	if (rtnl_async_end(&rth) < 0)
+		ns->ret = -2;
+	rth.async = outer;
+	rth.flags = flags;
+	return ns->ret;
+}
+
+static int ipneigh_sync(int argc, char **argv)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct ndmsg		ndm;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_type = RTM_GETNEIGH,
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
+		.ndm.ndm_family = preferred_family,
+	};
+	struct neigh_sync ns = { .name = "-" };
+	int saved_lineno = cmdlineno;
+	char *dev = NULL;
+	FILE *fp = stdin;
+	int ret = -2;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (dev)
+				return duparg("dev", *argv);
+			dev = *argv;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			ns.name = *argv;
+		} else if (matches(*argv, "help") == 0) {
+			return usage();
+		} else {
+			return invarg("unknown argument\n", *argv);
+		}
+		argc--; argv++;
+	}
+	if (!dev) {
+		fprintf(stderr, "Device is a required argument.\n");
+		return -1;
+	}
+	ns.ifindex = ll_name_to_index(dev);
+	if (!ns.ifindex)
+		return nodev(dev);
+
+	if (strcmp(ns.name, "-") != 0) {
+		fp = fopen(ns.name, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				ns.name, strerror(errno));
+			return -1;
+		}
+	}
+
+	addattr32(&req.n, sizeof(req), NDA_IFINDEX, ns.ifindex);
+	if (rtnl_dump_request_n(&rth, &req.n) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, neigh_sync_dump, &ns) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+	if (neigh_sync_index(&ns) < 0)
+		goto out;
+
+	/* nothing is changed unless the whole file makes sense */
+	if (neigh_sync_lines(&ns, fp) < 0)
+		goto out;
+
+	neigh_sync_deletes(&ns);
+	if (ns.ret == 0)
+		ret = neigh_sync_send(&ns);
+
+	if (show_stats)
+		printf("%u added, %u changed, %u deleted, %u unchanged\n",
+		       ns.added, ns.changed, ns.deleted, ns.unchanged);
+
+out:
+	cmdlineno = saved_lineno;
+	if (fp != stdin)
+		fclose(fp);
+	rtnl_txq_free(&ns.changes);
+	free(ns.hash);
+	free(ns.ents);
+	return ret;
+}
+
 int do_ipneigh(int argc, char **argv)
 {
 	if (argc > 0) {
@@ -554,6 +927,8 @@ int do_ipneigh(int argc, char **argv)
 			return do_show_or_flush(argc-1, argv+1, 0);
 		if (matches(*argv, "flush") == 0)
 			return do_show_or_flush(argc-1, argv+1, 1);
+		if (strcmp(*argv, "sync") == 0)
+			return ipneigh_sync(argc-1, argv+1);
 		if (matches(*argv, "help") == 0)
 			return usage();
 	} else
@@ -24,21 +24,69 @@
 #include "utils.h"
 #include "ip_common.h"
 
-static struct {
+/*
+ * ip netconf summary: how many devices have each value of each setting,
+ * per family. Values beyond the ones with names are counted together.
+ */
+#define NETCONF_VALUES	4
+
+struct netconf_summary {
+	int		family;
+	unsigned int	devices;
+	unsigned int	count[NETCONFA_MAX + 1][NETCONF_VALUES];
+};
+
+#define NETCONF_FAMILIES	4
+
+static __thread struct {
 	int family;
 	int ifindex;
+	__u32 attrs;		/* (1 << NETCONFA_x) to show, 0 for all */
+	struct netconf_summary *summary;
 } filter;
 
 static const char * const rp_filter_names[] = {
 	"off", "strict", "loose"
 };
 
+static const char * const onoff_names[] = {
+	"off", "on"
+};
+
+static const char * const netconf_attr_names[NETCONFA_MAX + 1] = {
+	[NETCONFA_FORWARDING]		= "forwarding",
+	[NETCONFA_RP_FILTER]		= "rp_filter",
+	[NETCONFA_MC_FORWARDING]	= "mc_forwarding",
+	[NETCONFA_PROXY_NEIGH]		= "proxy_neigh",
+	[NETCONFA_IGNORE_ROUTES_WITH_LINKDOWN] = "ignore_routes_with_linkdown",
+	[NETCONFA_INPUT]		= "input",
+};
+
 static int usage(void)
 {
-	fprintf(stderr, "Usage: ip netconf show [ dev STRING ]\n");
+	fprintf(stderr,
+		"Usage: ip netconf show [ dev STRING ]... [ SETTING ]... [ summary ]\n"
+		"SETTING := { forwarding | rp_filter | mc_forwarding | proxy_neigh |\n"
+		"             ignore_routes_with_linkdown | input }\n");
 	iprt_exit(-1);
 }
 
+static int netconf_attr_a2n(const char *name)
+{
+	int i;
+
+	for (i = 0; i <= NETCONFA_MAX; i++)
+		if (netconf_attr_names[i] && strcmp(name, netconf_attr_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+/* the setting is in the message and is one asked for */
+static bool netconf_show(struct rtattr *tb[], int type)
+{
+	return tb[type] && (!filter.attrs || filter.attrs & (1U << type));
+}
+
 static void print_onoff(FILE *fp, const char *flag, __u32 val)
 {
 	if (is_json_context())
@@ -53,6 +101,93 @@ static struct rtattr *netconf_rta(struct netconfmsg *ncm)
 				 + NLMSG_ALIGN(sizeof(struct netconfmsg)));
 }
 
+/* the devices themselves are counted, not "all" and "default" */
+static int netconf_count(int family, int ifindex, struct rtattr *tb[])
+{
+	struct netconf_summary *sum;
+	int i;
+
+	if (ifindex == NETCONFA_IFINDEX_ALL ||
+	    ifindex == NETCONFA_IFINDEX_DEFAULT)
+		return 0;
+
+	for (i = 0; i < NETCONF_FAMILIES; i++) {
+		sum = &filter.summary[i];
+		if (sum->family == family)
+			break;
+		if (!sum->family) {
+			sum->family = family;
+			break;
+		}
+	}
+	if (i == NETCONF_FAMILIES)
+		return 0;
+
+	sum->devices++;
+	for (i = NETCONFA_FORWARDING; i <= NETCONFA_MAX; i++) {
+		__u32 val;
+
+		if (!netconf_attr_names[i] || !netconf_show(tb, i))
+			continue;
+		val = rta_getattr_u32(tb[i]);
+		if (i != NETCONFA_RP_FILTER)
+			val = !!val;
+		sum->count[i][val < NETCONF_VALUES ? val : NETCONF_VALUES - 1]++;
+	}
+	return 0;
+}
+
+static void netconf_summary_print(void)
+{
+	const struct netconf_summary *sum;
+	int f, i, v;
+
+	for (f = 0; f < NETCONF_FAMILIES; f++) {
+		sum = &filter.summary[f];
+		if (!sum->family)
+			break;
+
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "family",
+			     "%s ", family_name(sum->family));
+		print_uint(PRINT_ANY, "devices", "devices %u ", sum->devices);
+
+		for (i = NETCONFA_FORWARDING; i <= NETCONFA_MAX; i++) {
+			const char * const *names = onoff_names;
+			int nnames = ARRAY_SIZE(onoff_names);
+			unsigned int seen = 0;
+
+			if (!netconf_attr_names[i])
+				continue;
+			for (v = 0; v < NETCONF_VALUES; v++)
+				seen += sum->count[i][v];
+			if (!seen)
+				continue;
+
+			if (i == NETCONFA_RP_FILTER) {
+				names = rp_filter_names;
+				nnames = ARRAY_SIZE(rp_filter_names);
+			}
+			open_json_object(netconf_attr_names[i]);
+			print_string(PRINT_FP, NULL, "%s ",
+				     netconf_attr_names[i]);
+			for (v = 0; v < NETCONF_VALUES; v++) {
+				const char *name = v < nnames ? names[v] : "other";
+				char fmt[32];
+
+				if (v >= nnames && !sum->count[i][v])
+					continue;
+				snprintf(fmt, sizeof(fmt), "%s %%u ", name);
+				print_uint(PRINT_ANY, name, fmt,
+					   sum->count[i][v]);
+			}
+			close_json_object();
+		}
+		close_json_object();
+		print_string(PRINT_FP, NULL, "\n", NULL);
+	}
+}
+
 int print_netconf(const struct sockaddr_nl *who, struct rtnl_ctrl_data *ctrl,
 		  struct nlmsghdr *n, void *arg)
 {
@@ -88,6 +223,9 @@ int print_netconf(const struct sockaddr_nl *who, struct rtnl_ctrl_data *ctrl,
 	if (filter.ifindex && filter.ifindex != ifindex)
 		return 0;
 
+	if (filter.summary)
+		return netconf_count(ncm->ncm_family, ifindex, tb);
+
 	open_json_object(NULL);
 	print_string(PRINT_ANY, "family",
 		     "%s ", family_name(ncm->ncm_family));
@@ -110,11 +248,11 @@ int print_netconf(const struct sockaddr_nl *who, struct rtnl_ctrl_data *ctrl,
 				   "interface", "%s ", dev);
 	}
 
-	if (tb[NETCONFA_FORWARDING])
+	if (netconf_show(tb, NETCONFA_FORWARDING))
 		print_onoff(fp, "forwarding",
 				rta_getattr_u32(tb[NETCONFA_FORWARDING]));
 
-	if (tb[NETCONFA_RP_FILTER]) {
+	if (netconf_show(tb, NETCONFA_RP_FILTER)) {
 		__u32 rp_filter = rta_getattr_u32(tb[NETCONFA_RP_FILTER]);
 
 		if (rp_filter < ARRAY_SIZE(rp_filter_names))
@@ -126,19 +264,19 @@ int print_netconf(const struct sockaddr_nl *who, struct rtnl_ctrl_data *ctrl,
 				   "rp_filter %u ", rp_filter);
 	}
 
-	if (tb[NETCONFA_MC_FORWARDING])
+	if (netconf_show(tb, NETCONFA_MC_FORWARDING))
 		print_onoff(fp, "mc_forwarding",
 				rta_getattr_u32(tb[NETCONFA_MC_FORWARDING]));
 
-	if (tb[NETCONFA_PROXY_NEIGH])
+	if (netconf_show(tb, NETCONFA_PROXY_NEIGH))
 		print_onoff(fp, "proxy_neigh",
 				rta_getattr_u32(tb[NETCONFA_PROXY_NEIGH]));
 
-	if (tb[NETCONFA_IGNORE_ROUTES_WITH_LINKDOWN])
+	if (netconf_show(tb, NETCONFA_IGNORE_ROUTES_WITH_LINKDOWN))
 		print_onoff(fp, "ignore_routes_with_linkdown",
 		     rta_getattr_u32(tb[NETCONFA_IGNORE_ROUTES_WITH_LINKDOWN]));
 
-	if (tb[NETCONFA_INPUT])
+	if (netconf_show(tb, NETCONFA_INPUT))
 		print_onoff(fp, "input", rta_getattr_u32(tb[NETCONFA_INPUT]));
 
 	close_json_object();
@@ -159,79 +297,187 @@ void ipnetconf_reset_filter(int ifindex)
 	filter.ifindex = ifindex;
 }
 
+/*
+ * The settings of a list of devices are asked for one by one, but with
+ * the requests pipelined on the socket rather than one round trip each,
+ * and in the order of the dump: all the devices of a family, then the
+ * next family.
+ */
+struct netconf_get {
+	int		*ifindex;
+	const char	**name;
+	int		count;
+	int		family;		/* asked for, AF_UNSPEC for all */
+	int		failed;
+};
+
+static void netconf_get_reply(__u32 cookie, struct nlmsghdr *n, void *arg)
+{
+	print_netconf(NULL, NULL, n, stdout);
+}
+
+static void netconf_get_err(__u32 cookie, int error, void *arg)
+{
+	struct netconf_get *g = arg;
+
+	/* asked of every family, the device need not have them all */
+	if (g->family == AF_UNSPEC)
+		return;
+	fprintf(stderr, "Device \"%s\": %s\n",
+		g->name[cookie % g->count], strerror(-error));
+	g->failed++;
+}
+
+static int netconf_get_devs(struct netconf_get *g)
+{
+	static const int families[] = { AF_INET, AF_INET6 };
+	struct rtnl_async *outer = rth.async;
+	int hflags = rth.flags;
+	int ret = 0;
+	int f, i;
+
+	if (outer)
+		rtnl_async_flush(&rth);
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, netconf_get_err, g) < 0) {
+		rth.async = outer;
+		perror("Cannot pipeline requests");
+		return -1;
+	}
+	rtnl_async_replies(&rth, netconf_get_reply);
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (f = 0; f < ARRAY_SIZE(families); f++) {
+		int family = g->family ? g->family : families[f];
+
+		for (i = 0; i < g->count; i++) {
+			struct {
+				struct nlmsghdr		n;
+				struct netconfmsg	ncm;
+				char			buf[64];
+			} req = {
+				.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct netconfmsg)),
+				.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK,
+				.n.nlmsg_type = RTM_GETNETCONF,
+				.ncm.ncm_family = family,
+			};
+
+			addattr32(&req.n, sizeof(req), NETCONFA_IFINDEX,
+				  g->ifindex[i]);
+			rtnl_async_cookie(&rth, f * g->count + i);
+			if (rtnl_talk(&rth, &req.n, NULL) < 0)
+				ret = -1;
+		}
+		if (g->family)
+			break;
+	}
+
+	if (rtnl_async_end(&rth) < 0)
+		ret = -1;
+	rth.async = outer;
+	rth.flags = hflags;
+	return ret || g->failed ? -1 : 0;
+}
+
+static int netconf_dump(void)
+{
+	rth.flags |= RTNL_HANDLE_F_SUPPRESS_NLERR;
+dump:
+	if (rtnl_wilddump_request(&rth, filter.family, RTM_GETNETCONF) < 0) {
+		perror("Cannot send dump request");
+		iprt_exit(1);
+	}
+
+	if (rtnl_dump_filter(&rth, print_netconf2, stdout) < 0) {
+		/* kernel does not support netconf dump on AF_UNSPEC;
+		 * fall back to requesting by family
+		 */
+		if (errno == EOPNOTSUPP && filter.family == AF_UNSPEC) {
+			filter.family = AF_INET;
+			goto dump;
+		}
+		perror("RTNETLINK answers");
+		fprintf(stderr, "Dump terminated\n");
+		iprt_exit(1);
+	}
+	if (preferred_family == AF_UNSPEC && filter.family == AF_INET) {
+		filter.family = AF_INET6;
+		goto dump;
+	}
+	return 0;
+}
+
 static int do_show(int argc, char **argv)
 {
-	struct {
-		struct nlmsghdr		n;
-		struct netconfmsg	ncm;
-		char			buf[1024];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct netconfmsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK,
-		.n.nlmsg_type = RTM_GETNETCONF,
-	};
+	struct netconf_summary summary[NETCONF_FAMILIES] = {};
+	struct netconf_get g = {};
+	int ret;
 
 	ipnetconf_reset_filter(0);
 	filter.family = preferred_family;
 
+	g.ifindex = calloc(argc + 1, sizeof(*g.ifindex));
+	g.name = calloc(argc + 1, sizeof(*g.name));
+	if (!g.ifindex || !g.name) {
+		perror("Cannot allocate device list");
+		iprt_exit(1);
+	}
+
 	while (argc > 0) {
+		int attr;
+
 		if (strcmp(*argv, "dev") == 0) {
+			int ifindex;
+
 			NEXT_ARG();
-			filter.ifindex = ll_name_to_index(*argv);
-			if (filter.ifindex <= 0) {
+			ifindex = ll_name_to_index(*argv);
+			if (ifindex <= 0 && strcmp(*argv, "all") == 0)
+				ifindex = NETCONFA_IFINDEX_ALL;
+			else if (ifindex <= 0 && strcmp(*argv, "default") == 0)
+				ifindex = NETCONFA_IFINDEX_DEFAULT;
+			else if (ifindex <= 0) {
 				fprintf(stderr,
 					"Device \"%s\" does not exist.\n",
 					*argv);
-				return -1;
+				ret = -1;
+				goto out;
 			}
+			g.ifindex[g.count] = ifindex;
+			g.name[g.count++] = *argv;
+		} else if (strcmp(*argv, "summary") == 0) {
+			filter.summary = summary;
+		} else if ((attr = netconf_attr_a2n(*argv)) > 0) {
+			filter.attrs |= 1U << attr;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown argument", *argv);
 		}
 		argv++; argc--;
 	}
 
-	ll_init_map(&rth);
+	/* names for a whole dump at once, the listed ones are looked up */
+	if (!g.count && !filter.summary)
+		ll_init_map(&rth);
 
-	if (filter.ifindex && filter.family != AF_UNSPEC) {
-		req.ncm.ncm_family = filter.family;
-		addattr_l(&req.n, sizeof(req), NETCONFA_IFINDEX,
-			  &filter.ifindex, sizeof(filter.ifindex));
-
-		if (rtnl_send(&rth, &req.n, req.n.nlmsg_len) < 0) {
-			perror("Can not send request");
-			iprt_exit(1);
-		}
-		rtnl_listen(&rth, print_netconf, stdout);
+	if (new_json_obj(json)) {
+		ret = -1;
+		goto out;
+	}
+	if (g.count) {
+		g.family = filter.family;
+		ret = netconf_get_devs(&g);
 	} else {
-		rth.flags = RTNL_HANDLE_F_SUPPRESS_NLERR;
-dump:
-		if (rtnl_wilddump_request(&rth, filter.family,
-					  RTM_GETNETCONF) < 0) {
-			perror("Cannot send dump request");
-			iprt_exit(1);
-		}
-
-		if (new_json_obj(json))
-			return -1;
-		if (rtnl_dump_filter(&rth, print_netconf2, stdout) < 0) {
-			/* kernel does not support netconf dump on AF_UNSPEC;
-			 * fall back to requesting by family
-			 */
-			if (errno == EOPNOTSUPP &&
-			    filter.family == AF_UNSPEC) {
-				filter.family = AF_INET;
-				goto dump;
-			}
-			perror("RTNETLINK answers");
-			fprintf(stderr, "Dump terminated\n");
-			iprt_exit(1);
-		}
-		delete_json_obj();
-		if (preferred_family == AF_UNSPEC && filter.family == AF_INET) {
-			preferred_family = AF_INET6;
-			filter.family = AF_INET6;
-			goto dump;
-		}
+		ret = netconf_dump();
 	}
-	return 0;
+	if (filter.summary)
+		netconf_summary_print();
+	delete_json_obj();
+	filter.summary = NULL;
+out:
+	free(g.ifindex);
+	free(g.name);
+	return ret;
 }
 
 int do_ipnetconf(int argc, char **argv)
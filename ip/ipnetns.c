@@ -27,12 +27,12 @@
 static int usage(void)
 {
 	fprintf(stderr, "Usage: ip netns list\n");
-	fprintf(stderr, "       ip netns add NAME\n");
+	fprintf(stderr, "       ip [-all-jobs N] netns add NAME...\n");
 	fprintf(stderr, "       ip netns set NAME NETNSID\n");
-	fprintf(stderr, "       ip [-all] netns delete [NAME]\n");
+	fprintf(stderr, "       ip [-all] [-all-jobs N] netns delete [NAME...]\n");
 	fprintf(stderr, "       ip netns identify [PID]\n");
 	fprintf(stderr, "       ip netns pids NAME\n");
-	fprintf(stderr, "       ip [-all] netns exec [NAME] cmd ...\n");
+	fprintf(stderr, "       ip [-all [-all-jobs N]] netns exec [NAME] cmd ...\n");
 	fprintf(stderr, "       ip netns monitor\n");
 	fprintf(stderr, "       ip netns list-id\n");
 	iprt_exit(-1);
@@ -144,28 +144,34 @@ err_out:
 }
 
 struct nsid_cache {
-	struct hlist_node	nsid_hash;
 	struct hlist_node	name_hash;
 	int			nsid;
 	char			name[0];
 };
 
-#define NSIDMAP_SIZE		128
-#define NSID_HASH_NSID(nsid)	(nsid & (NSIDMAP_SIZE - 1))
+/* nsids are allocated from 0 up, so they index an array */
+#define NSIDMAP_SIZE		1024
 #define NSID_HASH_NAME(name)	(namehash(name) & (NSIDMAP_SIZE - 1))
 
-static struct hlist_head	nsid_head[NSIDMAP_SIZE];
+static struct nsid_cache	**nsid_map;
+static unsigned int		nsid_map_size;
 static struct hlist_head	name_head[NSIDMAP_SIZE];
 
 static struct nsid_cache *netns_map_get_by_nsid(int nsid)
 {
-	uint32_t h = NSID_HASH_NSID(nsid);
+	if (nsid < 0 || nsid >= nsid_map_size)
+		return NULL;
+	return nsid_map[nsid];
+}
+
+static struct nsid_cache *netns_map_get_by_name(const char *name)
+{
 	struct hlist_node *n;
 
-	hlist_for_each(n, &nsid_head[h]) {
+	hlist_for_each(n, &name_head[NSID_HASH_NAME(name)]) {
 		struct nsid_cache *c = container_of(n, struct nsid_cache,
-						    nsid_hash);
-		if (c->nsid == nsid)
+						    name_hash);
+		if (strcmp(c->name, name) == 0)
 			return c;
 	}
 
@@ -190,11 +196,29 @@ char *get_name_from_nsid(int nsid)
 static int netns_map_add(int nsid, const char *name)
 {
 	struct nsid_cache *c;
-	uint32_t h;
 
+	if (nsid < 0)
+		return -EINVAL;
 	if (netns_map_get_by_nsid(nsid) != NULL)
 		return -EEXIST;
 
+	if (nsid >= nsid_map_size) {
+		unsigned int size = nsid_map_size ? nsid_map_size : 256;
+		struct nsid_cache **map;
+
+		while (size <= nsid)
+			size *= 2;
+		map = realloc(nsid_map, size * sizeof(*map));
+		if (map == NULL) {
+			perror("realloc");
+			return -ENOMEM;
+		}
+		memset(map + nsid_map_size, 0,
+		       (size - nsid_map_size) * sizeof(*map));
+		nsid_map = map;
+		nsid_map_size = size;
+	}
+
 	c = malloc(sizeof(*c) + strlen(name) + 1);
 	if (c == NULL) {
 		perror("malloc");
@@ -203,11 +227,8 @@ static int netns_map_add(int nsid, const char *name)
 	c->nsid = nsid;
 	strcpy(c->name, name);
 
-	h = NSID_HASH_NSID(nsid);
-	hlist_add_head(&c->nsid_hash, &nsid_head[h]);
-
-	h = NSID_HASH_NAME(name);
-	hlist_add_head(&c->name_hash, &name_head[h]);
+	nsid_map[nsid] = c;
+	hlist_add_head(&c->name_hash, &name_head[NSID_HASH_NAME(name)]);
 
 	return 0;
 }
@@ -215,7 +236,7 @@ static int netns_map_add(int nsid, const char *name)
 static void netns_map_del(struct nsid_cache *c)
 {
 	hlist_del(&c->name_hash);
-	hlist_del(&c->nsid_hash);
+	nsid_map[c->nsid] = NULL;
 	free(c);
 }
 
@@ -231,59 +252,223 @@ int netns_nsid_socket_init(void)
 	return 0;
 }
 
+#define NSID_PIPELINE	256	/* requests, and namespace fds, at a time */
+
+/*
+ * Send an RTM_GETNSID, or an RTM_NEWNSID asking the kernel to pick the
+ * nsid, for each of names, many per datagram, and collect the answers.
+ * res[i] is the nsid of names[i] (-1 if it has none) for RTM_GETNSID,
+ * and 0 or a negative error for RTM_NEWNSID.
+ */
+static int netns_nsid_pipeline(char **names, unsigned int count, int type,
+			       int *res)
+{
+	unsigned int base, i, sent;
+	int fds[NSID_PIPELINE];
+	unsigned int idx[NSID_PIPELINE];
+	char buf[NSID_PIPELINE * NLMSG_SPACE(sizeof(struct rtgenmsg) + 16)];
+	char rbuf[16384];
+	__u32 seq0;
+
+	if (rtnsh.fd < 0)
+		return -1;
+
+	for (base = 0; base < count; base += NSID_PIPELINE) {
+		unsigned int n = MIN(count - base, NSID_PIPELINE);
+		unsigned int pending;
+		size_t len = 0;
+
+		seq0 = rtnsh.seq + 1;
+		for (i = 0, sent = 0; i < n; i++) {
+			struct nlmsghdr *h = (struct nlmsghdr *)(buf + len);
+			struct rtgenmsg *g = NLMSG_DATA(h);
+			int maxlen = sizeof(buf) - len;
+
+			res[base + i] = type == RTM_GETNSID ? -1 : -ENOENT;
+			fds[i] = netns_get_fd(names[base + i]);
+			if (fds[i] < 0)
+				continue;
+
+			memset(h, 0, NLMSG_SPACE(sizeof(*g)));
+			h->nlmsg_len = NLMSG_LENGTH(sizeof(*g));
+			h->nlmsg_type = type;
+			h->nlmsg_flags = NLM_F_REQUEST;
+			if (type == RTM_NEWNSID)
+				h->nlmsg_flags |= NLM_F_ACK;
+			h->nlmsg_seq = ++rtnsh.seq;
+			g->rtgen_family = AF_UNSPEC;
+			addattr32(h, maxlen, NETNSA_FD, fds[i]);
+			if (type == RTM_NEWNSID)
+				addattr32(h, maxlen, NETNSA_NSID, -1);
+			len += NLMSG_ALIGN(h->nlmsg_len);
+			idx[sent++] = base + i;
+		}
+
+		if (sent && send(rtnsh.fd, buf, len, 0) < 0) {
+			perror("Cannot send nsid requests");
+			sent = 0;
+		}
+
+		for (pending = sent; pending; ) {
+			struct nlmsghdr *h = (struct nlmsghdr *)rbuf;
+			int status = recv(rtnsh.fd, rbuf, sizeof(rbuf), 0);
+
+			if (status < 0) {
+				if (errno == EINTR)
+					continue;
+				perror("Cannot receive nsid answers");
+				break;
+			}
+
+			for (; NLMSG_OK(h, status); h = NLMSG_NEXT(h, status)) {
+				unsigned int j = h->nlmsg_seq - seq0;
+				struct rtattr *tb[NETNSA_MAX + 1];
+				int alen;
+
+				if (j >= sent)
+					continue;
+				pending--;
+
+				if (h->nlmsg_type == NLMSG_ERROR) {
+					struct nlmsgerr *err = NLMSG_DATA(h);
+
+					if (type == RTM_NEWNSID)
+						res[idx[j]] = err->error;
+					continue;
+				}
+				alen = h->nlmsg_len -
+				       NLMSG_SPACE(sizeof(struct rtgenmsg));
+				if (h->nlmsg_type != RTM_NEWNSID || alen < 0)
+					continue;
+				parse_rtattr(tb, NETNSA_MAX,
+					     NETNS_RTA(NLMSG_DATA(h)), alen);
+				if (tb[NETNSA_NSID])
+					res[idx[j]] = rta_getattr_u32(tb[NETNSA_NSID]);
+			}
+		}
+
+		for (i = 0; i < n; i++)
+			if (fds[i] >= 0)
+				close(fds[i]);
+	}
+	return 0;
+}
+
 void netns_map_init(void)
 {
 	static int initialized;
-	struct dirent *entry;
-	DIR *dir;
-	int nsid;
+	unsigned int count, i;
+	char **names;
+	int *nsids;
 
 	if (initialized || !ipnetns_have_nsid())
 		return;
-
-	dir = opendir(NETNS_RUN_DIR);
-	if (!dir)
+	if (netns_nsid_socket_init())
 		return;
 
-	while ((entry = readdir(dir)) != NULL) {
-		if (strcmp(entry->d_name, ".") == 0)
-			continue;
-		if (strcmp(entry->d_name, "..") == 0)
-			continue;
-		nsid = get_netnsid_from_name(entry->d_name);
+	names = netns_names(&count);
+	if (!names)
+		return;
 
-		if (nsid >= 0)
-			netns_map_add(nsid, entry->d_name);
+	nsids = calloc(count ? count : 1, sizeof(*nsids));
+	if (nsids && netns_nsid_pipeline(names, count, RTM_GETNSID, nsids) == 0) {
+		for (i = 0; i < count; i++)
+			netns_map_add(nsids[i], names[i]);
+		initialized = 1;
 	}
-	closedir(dir);
-	initialized = 1;
+	free(nsids);
+	netns_names_free(names, count);
 }
 
-static int netns_get_name(int nsid, char *name)
+/*
+ * The names under NETNS_RUN_DIR, the *missing first of them those
+ * the map has no nsid for.
+ */
+static char **netns_map_missing(unsigned int *count, unsigned int *missing)
 {
-	struct dirent *entry;
-	DIR *dir;
-	int id;
+	char **names;
+	unsigned int i;
 
-	dir = opendir(NETNS_RUN_DIR);
-	if (!dir)
-		return -ENOENT;
+	names = netns_names(count);
+	if (!names)
+		return NULL;
 
-	while ((entry = readdir(dir)) != NULL) {
-		if (strcmp(entry->d_name, ".") == 0)
-			continue;
-		if (strcmp(entry->d_name, "..") == 0)
+	*missing = 0;
+	for (i = 0; i < *count; i++) {
+		char *name = names[i];
+
+		if (netns_map_get_by_name(name))
 			continue;
-		id = get_netnsid_from_name(entry->d_name);
+		names[i] = names[*missing];
+		names[(*missing)++] = name;
+	}
+	return names;
+}
 
-		if (nsid == id) {
-			strcpy(name, entry->d_name);
-			closedir(dir);
-			return 0;
-		}
+/*
+ * Have the kernel pick an nsid for every named namespace that has none
+ * yet, and add them to the map. Returns how many are still without one.
+ */
+int netns_map_assign(void)
+{
+	unsigned int count, missing, i;
+	char **names;
+	int *res;
+	int left = 0;
+
+	netns_map_init();
+
+	names = netns_map_missing(&count, &missing);
+	if (!names)
+		return -1;
+
+	res = calloc(missing ? missing : 1, sizeof(*res));
+	if (!res) {
+		netns_names_free(names, count);
+		return -1;
 	}
-	closedir(dir);
-	return -ENOENT;
+
+	netns_nsid_pipeline(names, missing, RTM_NEWNSID, res);
+	netns_nsid_pipeline(names, missing, RTM_GETNSID, res);
+	for (i = 0; i < missing; i++)
+		if (netns_map_add(res[i], names[i]) < 0)
+			left++;
+
+	free(res);
+	netns_names_free(names, count);
+	return left;
+}
+
+/*
+ * An nsid the map does not know was given to a namespace after the map
+ * was made: ask again for the names that had none, and only for those.
+ */
+static void netns_map_refresh(void)
+{
+	unsigned int count, missing, i;
+	char **names;
+	int *nsids;
+
+	names = netns_map_missing(&count, &missing);
+	if (!names)
+		return;
+
+	nsids = calloc(missing ? missing : 1, sizeof(*nsids));
+	if (nsids &&
+	    netns_nsid_pipeline(names, missing, RTM_GETNSID, nsids) == 0) {
+		for (i = 0; i < missing; i++)
+			netns_map_add(nsids[i], names[i]);
+	}
+	free(nsids);
+	netns_names_free(names, count);
+}
+
+void netns_map_forget(const char *name)
+{
+	struct nsid_cache *c = netns_map_get_by_name(name);
+
+	if (c)
+		netns_map_del(c);
 }
 
 int print_nsid(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
@@ -293,7 +478,6 @@ int print_nsid(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	int len = n->nlmsg_len;
 	FILE *fp = (FILE *)arg;
 	struct nsid_cache *c;
-	char name[NAME_MAX];
 	int nsid;
 
 	if (n->nlmsg_type != RTM_NEWNSID && n->nlmsg_type != RTM_DELNSID)
@@ -320,20 +504,19 @@ int print_nsid(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	print_uint(PRINT_ANY, "nsid", "nsid %u ", nsid);
 
 	c = netns_map_get_by_nsid(nsid);
+	/* During 'ip monitor nsid', no chance to have new nsid in cache. */
+	if (c == NULL && n->nlmsg_type == RTM_NEWNSID &&
+	    !(n->nlmsg_flags & NLM_F_MULTI)) {
+		netns_map_refresh();
+		c = netns_map_get_by_nsid(nsid);
+	}
 	if (c != NULL) {
 		print_string(PRINT_ANY, "name",
 			     "(iproute2 netns name: %s)", c->name);
-		netns_map_del(c);
+		if (n->nlmsg_type == RTM_DELNSID)
+			netns_map_del(c);
 	}
 
-	/* During 'ip monitor nsid', no chance to have new nsid in cache. */
-	if (c == NULL && n->nlmsg_type == RTM_NEWNSID)
-		if (netns_get_name(nsid, name) == 0) {
-			print_string(PRINT_ANY, "name",
-				     "(iproute2 netns name: %s)", name);
-			netns_map_add(nsid, name);
-		}
-
 	print_string(PRINT_FP, NULL, "\n", NULL);
 	close_json_object();
 	fflush(fp);
@@ -347,6 +530,7 @@ static int netns_list_id(int argc, char **argv)
 			"RTM_GETNSID is not supported by the kernel.\n");
 		return -ENOTSUP;
 	}
+	netns_map_init();
 
 	if (rtnl_wilddump_request(&rth, AF_UNSPEC, RTM_GETNSID) < 0) {
 		perror("Cannot send dump request");
@@ -367,13 +551,16 @@ static int netns_list_id(int argc, char **argv)
 static int netns_list(int argc, char **argv)
 {
 	struct dirent *entry;
+	struct nsid_cache *c;
 	DIR *dir;
-	int id;
 
 	dir = opendir(NETNS_RUN_DIR);
 	if (!dir)
 		return 0;
 
+	/* one pipelined round for all the nsids */
+	netns_map_init();
+
 	if (new_json_obj(json))
 		return -1;
 	while ((entry = readdir(dir)) != NULL) {
@@ -385,12 +572,9 @@ static int netns_list(int argc, char **argv)
 		open_json_object(NULL);
 		print_string(PRINT_ANY, "name",
 			     "%s", entry->d_name);
-		if (ipnetns_have_nsid()) {
-			id = get_netnsid_from_name(entry->d_name);
-			if (id >= 0)
-				print_uint(PRINT_ANY, "id",
-					   " (id: %d)", id);
-		}
+		c = netns_map_get_by_name(entry->d_name);
+		if (c)
+			print_uint(PRINT_ANY, "id", " (id: %d)", c->nsid);
 		print_string(PRINT_FP, NULL, "\n", NULL);
 		close_json_object();
 	}
@@ -407,6 +591,14 @@ static int on_netns_exec(char *nsname, void *arg)
 	return 0;
 }
 
+/* already in a child of its own, so exec right away */
+static int on_netns_exec_job(char *nsname, void *arg)
+{
+	char **argv = arg;
+
+	return cmd_exec(argv[1], argv + 1, false);
+}
+
 static int netns_exec(int argc, char **argv)
 {
 	/* Setup the proper environment for apps that are not netns
@@ -423,6 +615,9 @@ static int netns_exec(int argc, char **argv)
 		return -1;
 	}
 
+	if (do_all && all_jobs > 1)
+		return netns_foreach_jobs(on_netns_exec_job, --argv,
+					  all_jobs, true);
 	if (do_all)
 		return do_each_netns(on_netns_exec, --argv, 1);
 
@@ -609,17 +804,76 @@ static int on_netns_del(char *nsname, void *arg)
 	return 0;
 }
 
+/*
+ * Run func on each of names, in up to all_jobs children at a time, each
+ * taking every all_jobs'th name. Returns -1 if it failed on any.
+ */
+static int netns_each_name(char **names, unsigned int count,
+			   int (*func)(char *nsname, void *arg))
+{
+	unsigned int jobs = MIN(all_jobs, count), started, i, k;
+	int ret = 0;
+
+	fflush(NULL);
+	for (started = 0; jobs > 1 && started < jobs; started++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		if (pid == 0) {
+			int failed = 0;
+
+			for (i = started; i < count; i += jobs)
+				if (func(names[i], NULL))
+					failed = 1;
+			fflush(stderr);
+			_iprt_exit(failed);
+		}
+	}
+
+	/* what no child could be started for */
+	for (k = started; k < MAX(jobs, 1); k++)
+		for (i = k; i < count; i += MAX(jobs, 1))
+			if (func(names[i], NULL))
+				ret = -1;
+
+	while (started) {
+		int status;
+
+		if (wait(&status) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+		started--;
+	}
+	return ret;
+}
+
 static int netns_delete(int argc, char **argv)
 {
+	unsigned int count;
+	char **names;
+	int ret;
+
 	if (argc < 1 && !do_all) {
 		fprintf(stderr, "No netns name specified\n");
 		return -1;
 	}
 
-	if (do_all)
-		return netns_foreach(on_netns_del, NULL);
+	if (!do_all)
+		return netns_each_name(argv, argc, on_netns_del);
 
-	return on_netns_del(argv[0], NULL);
+	names = netns_names(&count);
+	if (!names)
+		return 0;
+	ret = netns_each_name(names, count, on_netns_del);
+	netns_names_free(names, count);
+	return ret;
 }
 
 static int create_netns_dir(void)
@@ -636,29 +890,11 @@ static int create_netns_dir(void)
 	return 0;
 }
 
-static int netns_add(int argc, char **argv)
+/* done once for all the namespaces an "ip netns add" creates */
+static int prepare_netns_dir(void)
 {
-	/* This function creates a new network namespace and
-	 * a new mount namespace and bind them into a well known
-	 * location in the filesystem based on the name provided.
-	 *
-	 * The mount namespace is created so that any necessary
-	 * userspace tweaks like remounting /sys, or bind mounting
-	 * a new /etc/resolv.conf can be shared between uers.
-	 */
-	char netns_path[PATH_MAX];
-	const char *name;
-	int fd;
 	int made_netns_run_dir_mount = 0;
 
-	if (argc < 1) {
-		fprintf(stderr, "No netns name specified\n");
-		return -1;
-	}
-	name = argv[0];
-
-	snprintf(netns_path, sizeof(netns_path), "%s/%s", NETNS_RUN_DIR, name);
-
 	if (create_netns_dir())
 		return -1;
 
@@ -685,6 +921,17 @@ static int netns_add(int argc, char **argv)
 		made_netns_run_dir_mount = 1;
 	}
 
+	return 0;
+}
+
+/* leaves the caller in the new network namespace */
+static int on_netns_add(char *name, void *arg)
+{
+	char netns_path[PATH_MAX];
+	int fd;
+
+	snprintf(netns_path, sizeof(netns_path), "%s/%s", NETNS_RUN_DIR, name);
+
 	/* Create the filesystem state */
 	fd = open(netns_path, O_RDONLY|O_CREAT|O_EXCL, 0);
 	if (fd < 0) {
@@ -707,10 +954,31 @@ static int netns_add(int argc, char **argv)
 	}
 	return 0;
 out_delete:
-	netns_delete(argc, argv);
+	on_netns_del(name, NULL);
 	return -1;
 }
 
+static int netns_add(int argc, char **argv)
+{
+	/* This function creates a new network namespace and
+	 * a new mount namespace and bind them into a well known
+	 * location in the filesystem based on the name provided.
+	 *
+	 * The mount namespace is created so that any necessary
+	 * userspace tweaks like remounting /sys, or bind mounting
+	 * a new /etc/resolv.conf can be shared between uers.
+	 */
+	if (argc < 1) {
+		fprintf(stderr, "No netns name specified\n");
+		return -1;
+	}
+
+	if (prepare_netns_dir())
+		return -1;
+
+	return netns_each_name(argv, argc, on_netns_add);
+}
+
 int set_netnsid_from_name(const char *name, int nsid)
 {
 	struct {
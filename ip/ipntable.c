@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <time.h>
@@ -33,7 +34,7 @@
 #include "ip_common.h"
 #include "json_print.h"
 
-static struct
+static __thread struct
 {
 	int family;
 	int index;
@@ -48,6 +49,8 @@ static int usage(void)
 		"          [ thresh1 VAL ] [ thresh2 VAL ] [ thresh3 VAL ] [ gc_int MSEC ]\n"
 		"          [ PARMS ]\n"
 		"Usage: ip ntable show [ dev DEV ] [ name NAME ]\n"
+		"Usage: ip ntable sample [ name NAME ] [ interval SECONDS ] [ count N ]\n"
+		"          [ percpu ] [ alert COUNTER RATE ]...\n"
 
 		"PARMS := [ base_reachable MSEC ] [ retrans MSEC ] [ gc_stale MSEC ]\n"
 		"         [ delay_probe MSEC ] [ queue LEN ]\n"
@@ -672,6 +675,355 @@ static int ipntable_show(int argc, char **argv)
 	return 0;
 }
 
+/*
+ * "ip ntable sample" dumps the tables every interval and tells the rates
+ * of the counters in their NDTA_STATS that show pressure on a table, with
+ * percpu those of the per CPU rows of /proc/net/stat/NAME too. A rate, or
+ * the number of entries, above an alert threshold is flagged and makes
+ * the exit status 2.
+ */
+enum {
+	NTS_ENTRIES,
+	NTS_ALLOCS,
+	NTS_DESTROYS,
+	NTS_LOOKUPS,
+	NTS_HITS,
+	NTS_RES_FAILED,
+	NTS_PERIODIC_GC_RUNS,
+	NTS_FORCED_GC_RUNS,
+	NTS_TABLE_FULLS,
+	NTS_MAX
+};
+
+static const char * const nts_names[NTS_MAX] = {
+	[NTS_ENTRIES]		= "entries",
+	[NTS_ALLOCS]		= "allocs",
+	[NTS_DESTROYS]		= "destroys",
+	[NTS_LOOKUPS]		= "lookups",
+	[NTS_HITS]		= "hits",
+	[NTS_RES_FAILED]	= "res_failed",
+	[NTS_PERIODIC_GC_RUNS]	= "periodic_gc_runs",
+	[NTS_FORCED_GC_RUNS]	= "forced_gc_runs",
+	[NTS_TABLE_FULLS]	= "table_fulls",
+};
+
+struct ntable_sample {
+	struct ntable_sample	*next;
+	int			family;
+	char			name[32];
+	unsigned int		round;		/* of the last time seen */
+	__u64			val[NTS_MAX];
+	unsigned int		ncpus;
+	__u64			*cpu;		/* ncpus rows of NTS_MAX */
+};
+
+struct ntable_sampler {
+	struct ntable_sample	*tables;
+	unsigned int		round;
+	double			elapsed;
+	bool			percpu;
+	bool			alerted;
+	double			alert[NTS_MAX];	/* negative when not set */
+};
+
+static int nts_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NTS_MAX; i++)
+		if (strcmp(name, nts_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+static void ntable_stats_val(__u64 *val, const struct ndt_stats *ndts)
+{
+	val[NTS_ALLOCS] = ndts->ndts_allocs;
+	val[NTS_DESTROYS] = ndts->ndts_destroys;
+	val[NTS_LOOKUPS] = ndts->ndts_lookups;
+	val[NTS_HITS] = ndts->ndts_hits;
+	val[NTS_RES_FAILED] = ndts->ndts_res_failed;
+	val[NTS_PERIODIC_GC_RUNS] = ndts->ndts_periodic_gc_runs;
+	val[NTS_FORCED_GC_RUNS] = ndts->ndts_forced_gc_runs;
+	val[NTS_TABLE_FULLS] = ndts->ndts_table_fulls;
+}
+
+/* The rows of /proc/net/stat/NAME, one per possible CPU, in hex */
+static __u64 *ntable_read_percpu(const char *name, unsigned int *ncpus)
+{
+	int col[NTS_MAX * 2], ncol = 0, i;
+	char path[128], line[1024], *tok, *save;
+	__u64 *cpu = NULL, *row;
+	unsigned int n = 0;
+	FILE *fp;
+
+	if (strchr(name, '/'))
+		return NULL;
+	snprintf(path, sizeof(path), "/proc/net/stat/%s", name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+
+	if (!fgets(line, sizeof(line), fp))
+		goto out;
+	for (tok = strtok_r(line, " \t\n", &save);
+	     tok && ncol < ARRAY_SIZE(col);
+	     tok = strtok_r(NULL, " \t\n", &save))
+		col[ncol++] = nts_lookup(tok);
+
+	while (fgets(line, sizeof(line), fp)) {
+		row = realloc(cpu, (n + 1) * sizeof(*row) * NTS_MAX);
+		if (!row)
+			break;
+		cpu = row;
+		row += n++ * NTS_MAX;
+		memset(row, 0, sizeof(*row) * NTS_MAX);
+
+		tok = strtok_r(line, " \t\n", &save);
+		for (i = 0; tok && i < ncol; i++) {
+			if (col[i] >= 0)
+				row[col[i]] = strtoull(tok, NULL, 16);
+			tok = strtok_r(NULL, " \t\n", &save);
+		}
+	}
+out:
+	fclose(fp);
+	*ncpus = n;
+	return cpu;
+}
+
+static void print_ntable_rates(struct ntable_sampler *s, const __u64 *val,
+			       const __u64 *prev, bool alerts)
+{
+	bool alert[NTS_MAX] = {};
+	bool any = false;
+	int i;
+
+	for (i = NTS_ALLOCS; i < NTS_MAX; i++) {
+		__u64 delta = val[i] - prev[i];
+		double rate = delta / s->elapsed;
+		char fmt[64];
+
+		alert[i] = alerts && s->alert[i] >= 0 && rate > s->alert[i];
+		any |= alert[i];
+		if (!delta && !alert[i] && !is_json_context())
+			continue;
+		snprintf(fmt, sizeof(fmt), " %s %%llu", nts_names[i]);
+		print_u64(PRINT_ANY, nts_names[i], fmt, delta);
+		snprintf(fmt, sizeof(fmt), "%s_rate", nts_names[i]);
+		print_float(PRINT_ANY, fmt, " (%.1f/s)", rate);
+	}
+
+	if (alerts) {
+		alert[NTS_ENTRIES] = s->alert[NTS_ENTRIES] >= 0 &&
+				     val[NTS_ENTRIES] > s->alert[NTS_ENTRIES];
+		any |= alert[NTS_ENTRIES];
+	}
+	if (!any)
+		return;
+
+	s->alerted = true;
+	open_json_array(PRINT_JSON, "alerts");
+	print_string(PRINT_FP, NULL, "%s", " ALERT");
+	for (i = 0; i < NTS_MAX; i++)
+		if (alert[i])
+			print_string(PRINT_ANY, NULL, " %s", nts_names[i]);
+	close_json_array(PRINT_JSON, NULL);
+}
+
+static void ntable_sample_percpu(struct ntable_sampler *s,
+				 struct ntable_sample *e, bool rates)
+{
+	unsigned int ncpus = 0, i;
+	__u64 *cpu;
+
+	cpu = ntable_read_percpu(e->name, &ncpus);
+	if (rates && cpu && e->cpu && ncpus == e->ncpus) {
+		open_json_array(PRINT_JSON, "cpus");
+		for (i = 0; i < ncpus; i++) {
+			const __u64 *val = cpu + i * NTS_MAX;
+			const __u64 *prev = e->cpu + i * NTS_MAX;
+
+			if (!is_json_context() &&
+			    !memcmp(val + NTS_ALLOCS, prev + NTS_ALLOCS,
+				    sizeof(*val) * (NTS_MAX - NTS_ALLOCS)))
+				continue;
+			open_json_object(NULL);
+			print_string(PRINT_FP, NULL, "%s", "\n   ");
+			print_uint(PRINT_ANY, "cpu", " cpu %u", i);
+			print_ntable_rates(s, val, prev, false);
+			close_json_object();
+		}
+		close_json_array(PRINT_JSON, NULL);
+	}
+	free(e->cpu);
+	e->cpu = cpu;
+	e->ncpus = ncpus;
+}
+
+static int ntable_sample_nlmsg(const struct sockaddr_nl *who,
+			       struct nlmsghdr *n, void *arg)
+{
+	struct ntable_sampler *s = arg;
+	struct ndtmsg *ndtm = NLMSG_DATA(n);
+	struct rtattr *tb[NDTA_MAX+1];
+	struct ntable_sample *e;
+	struct ndt_stats ndts = {};
+	__u64 val[NTS_MAX] = {};
+	const char *name;
+	bool rates;
+	int len;
+
+	if (n->nlmsg_type != RTM_NEWNEIGHTBL ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*ndtm)))
+		return 0;
+	if (preferred_family && preferred_family != ndtm->ndtm_family)
+		return 0;
+
+	parse_rtattr(tb, NDTA_MAX, NDTA_RTA(ndtm),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndtm)));
+	/* the parameters of each device come in messages without stats */
+	if (!tb[NDTA_NAME] || !tb[NDTA_STATS])
+		return 0;
+	name = rta_getattr_str(tb[NDTA_NAME]);
+	if (filter.name && strcmp(filter.name, name))
+		return 0;
+
+	/* older kernels have a shorter struct */
+	len = RTA_PAYLOAD(tb[NDTA_STATS]);
+	memcpy(&ndts, RTA_DATA(tb[NDTA_STATS]),
+	       len < sizeof(ndts) ? len : sizeof(ndts));
+	ntable_stats_val(val, &ndts);
+	if (tb[NDTA_CONFIG] &&
+	    RTA_PAYLOAD(tb[NDTA_CONFIG]) >= sizeof(struct ndt_config)) {
+		const struct ndt_config *ndtc = RTA_DATA(tb[NDTA_CONFIG]);
+
+		val[NTS_ENTRIES] = ndtc->ndtc_entries;
+	}
+
+	for (e = s->tables; e; e = e->next)
+		if (e->family == ndtm->ndtm_family && !strcmp(e->name, name))
+			break;
+	if (!e) {
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			return -1;
+		e->family = ndtm->ndtm_family;
+		strlcpy(e->name, name, sizeof(e->name));
+		e->next = s->tables;
+		s->tables = e;
+	}
+
+	rates = e->round && e->round + 1 == s->round;
+	if (rates) {
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "family", "%s",
+			     family_name(e->family));
+		print_string(PRINT_ANY, "name", " %s", e->name);
+		print_float(PRINT_JSON, "interval", NULL, s->elapsed);
+		print_uint(PRINT_ANY, "entries", " entries %u",
+			   val[NTS_ENTRIES]);
+		print_ntable_rates(s, val, e->val, true);
+	}
+	if (s->percpu)
+		ntable_sample_percpu(s, e, rates);
+	if (rates) {
+		print_string(PRINT_FP, NULL, "%s", "\n");
+		close_json_object();
+	}
+
+	memcpy(e->val, val, sizeof(val));
+	e->round = s->round;
+	return 0;
+}
+
+static int ipntable_sample(int argc, char **argv)
+{
+	struct ntable_sampler s = {};
+	struct timespec next, now, last;
+	unsigned int count = 0;
+	double interval = 1;
+	int ret = 0, i;
+
+	ipntable_reset_filter();
+	for (i = 0; i < NTS_MAX; i++)
+		s.alert[i] = -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "name") == 0) {
+			NEXT_ARG();
+			filter.name = *argv;
+		} else if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				return invarg("invalid count", *argv);
+		} else if (strcmp(*argv, "percpu") == 0) {
+			s.percpu = true;
+		} else if (strcmp(*argv, "alert") == 0) {
+			char *end;
+			int k;
+
+			NEXT_ARG();
+			k = nts_lookup(*argv);
+			if (k < 0)
+				return invarg("unknown counter", *argv);
+			NEXT_ARG();
+			s.alert[k] = strtod(*argv, &end);
+			if (*end || !(s.alert[k] >= 0))
+				return invarg("invalid alert threshold", *argv);
+		} else
+			return invarg("unknown", *argv);
+
+		argc--; argv++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last = next;
+	for (s.round = 1; ; s.round++) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		s.elapsed = timespec_diff(&now, &last);
+		last = now;
+
+		/* the first sample only primes the counters */
+		if (s.round > 1)
+			new_json_obj(json);
+		if (rtnl_wilddump_request(&rth, preferred_family,
+					  RTM_GETNEIGHTBL) < 0) {
+			perror("Cannot send dump request");
+			ret = -1;
+		} else if (rtnl_dump_filter(&rth, ntable_sample_nlmsg, &s) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = -1;
+		}
+		delete_json_obj();
+		if (s.round > 1 && !json)
+			printf("\n");
+		fflush(stdout);
+
+		/* count samples after the one the first rates are taken to */
+		if (ret < 0 || (count && s.round > count))
+			break;
+
+		sample_wait(&next, interval);
+	}
+
+	while (s.tables) {
+		struct ntable_sample *e = s.tables;
+
+		s.tables = e->next;
+		free(e->cpu);
+		free(e);
+	}
+	if (ret < 0)
+		return -1;
+	/* ip exits with the negated value */
+	return s.alerted ? -2 : 0;
+}
+
 int do_ipntable(int argc, char **argv)
 {
 	ll_init_map(&rth);
@@ -686,6 +1038,8 @@ int do_ipntable(int argc, char **argv)
 		    matches(*argv, "lst") == 0 ||
 		    matches(*argv, "list") == 0)
 			return ipntable_show(argc-1, argv+1);
+		if (matches(*argv, "sample") == 0)
+			return ipntable_sample(argc-1, argv+1);
 		if (matches(*argv, "help") == 0)
 			return usage();
 	} else
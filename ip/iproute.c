@@ -23,11 +23,14 @@
 #include <arpa/inet.h>
 #include <linux/in_route.h>
 #include <linux/icmpv6.h>
+#include <linux/mpls.h>
 #include <errno.h>
 
 #include "rt_names.h"
 #include "utils.h"
 #include "ip_common.h"
+#include "rt_records.h"
+#include "jobs.h"
 
 #ifndef RTAX_RTTVAR
 #define RTAX_RTTVAR RTAX_HOPS
@@ -37,7 +40,11 @@ enum list_action {
 	IPROUTE_LIST,
 	IPROUTE_FLUSH,
 	IPROUTE_SAVE,
+	IPROUTE_SUMMARY,
 };
+/* RTA_MULTIPATH of a route, room for 128 IPv6 nexthops with an encap */
+#define NH_MAX_LEN	8192
+
 static const char *mx_names[RTAX_MAX+1] = {
 	[RTAX_MTU]			= "mtu",
 	[RTAX_WINDOW]			= "window",
@@ -61,28 +68,39 @@ static int usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip route { list | flush } SELECTOR\n"
+		"       ip -f mpls route list SELECTOR compact\n"
 		"       ip route save SELECTOR\n"
-		"       ip route restore\n"
+		"       ip route restore [ table TABLE_ID ]\n"
 		"       ip route showdump\n"
+		"       ip route summary [ by KEY[,KEY]... ] SELECTOR\n"
+		"       ip route sync [ table TABLE_ID ] [ proto RTPROTO ] [ file FILE ]\n"
+		"       ip route lookup [ snapshot FILE ] [ rules FILE ] [ QUERY ]\n"
+		"       ip route get -batch FILE\n"
 		"       ip route get [ ROUTE_GET_FLAGS ] ADDRESS\n"
 		"                            [ from ADDRESS iif STRING ]\n"
 		"                            [ oif STRING ] [ tos TOS ]\n"
 		"                            [ mark NUMBER ] [ vrf NAME ]\n"
 		"                            [ uid NUMBER ]\n"
 		"       ip route { add | del | change | append | replace } ROUTE\n"
+		"       ip route nhgroup { add | replace } NAME nexthop NH [ nexthop NH ]...\n"
+		"       ip route nhgroup { show [ NAME ] | del NAME | flush }\n"
+		"       ip route encap { add | replace } NAME ENCAPTYPE ENCAPHDR\n"
+		"       ip route encap { show [ NAME ] | del NAME | flush }\n"
 		"SELECTOR := [ root PREFIX ] [ match PREFIX ] [ exact PREFIX ]\n"
 		"            [ table TABLE_ID ] [ vrf NAME ] [ proto RTPROTO ]\n"
 		"            [ type TYPE ] [ scope SCOPE ]\n"
 		"ROUTE := NODE_SPEC [ INFO_SPEC ]\n"
-		"NODE_SPEC := [ TYPE ] PREFIX [ tos TOS ]\n"
+		"NODE_SPEC := [ TYPE ] { PREFIX | LABEL-LABEL } [ tos TOS ]\n"
 		"             [ table TABLE_ID ] [ proto RTPROTO ]\n"
 		"             [ scope SCOPE ] [ metric METRIC ]\n"
 		"             [ ttl-propagate { enabled | disabled } ]\n"
-		"INFO_SPEC := NH OPTIONS FLAGS [ nexthop NH ]...\n"
-		"NH := [ encap ENCAPTYPE ENCAPHDR ] [ via [ FAMILY ] ADDRESS ]\n"
+		"INFO_SPEC := NH OPTIONS FLAGS [ { nexthop NH }... | nhgroup NAME ]\n"
+		"NH := [ encap { ENCAPTYPE ENCAPHDR | template NAME } ]\n"
+		"	    [ via [ FAMILY ] ADDRESS ]\n"
 		"	    [ dev STRING ] [ weight NUMBER ] NHFLAGS\n"
 		"FAMILY := [ inet | inet6 | ipx | dnet | mpls | bridge | link ]\n"
-		"OPTIONS := FLAGS [ mtu NUMBER ] [ advmss NUMBER ] [ as [ to ] ADDRESS ]\n"
+		"OPTIONS := FLAGS [ mtu NUMBER ] [ advmss NUMBER ]\n"
+		"           [ as [ offset ] [ to ] ADDRESS ]\n"
 		"           [ rtt TIME ] [ rttvar TIME ] [ reordering NUMBER ]\n"
 		"           [ window NUMBER ] [ cwnd NUMBER ] [ initcwnd NUMBER ]\n"
 		"           [ ssthresh NUMBER ] [ realms REALM ] [ src ADDRESS ]\n"
@@ -103,19 +121,18 @@ static int usage(void)
 		"ENCAPHDR := [ MPLSLABEL | SEG6HDR ]\n"
 		"SEG6HDR := [ mode SEGMODE ] segs ADDR1,ADDRi,ADDRn [hmac HMACKEYID] [cleanup]\n"
 		"SEGMODE := [ encap | inline ]\n"
-		"ROUTE_GET_FLAGS := [ fibmatch ]\n");
+		"ROUTE_GET_FLAGS := [ fibmatch ]\n"
+		"KEY := [ table | proto | type | scope | dev | family ]\n");
 	iprt_exit(-1);
 }
 
 
-static struct
+static __thread struct
 {
 	unsigned int tb;
 	int cloned;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_txq *flushq;
 	int protocol, protocolmask;
 	int scope, scopemask;
 	__u64 typemask;
@@ -131,15 +148,29 @@ static struct
 	inet_prefix mdst;
 	inet_prefix rsrc;
 	inet_prefix msrc;
+	unsigned int suppressed;
+	__u32 label_last;
+	int label_offset;
 } filter;
 
+/* A route that stands for @suppressed earlier events, say so too */
+int print_route_coalesced(struct nlmsghdr *n, FILE *fp,
+			  unsigned int suppressed)
+{
+	int ret;
+
+	filter.suppressed = suppressed;
+	ret = print_route(NULL, n, fp);
+	filter.suppressed = 0;
+	return ret;
+}
+
 static int flush_update(void)
 {
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
+	if (rtnl_flush_send(&rth, filter.flushq)) {
+		fprintf(stderr, "Failed to flush routes\n");
 		return -2;
 	}
-	filter.flushp = 0;
 	return 0;
 }
 
@@ -322,7 +353,7 @@ static int filter_nlmsg(struct nlmsghdr *n, struct rtattr **tb, int host_len)
 		if ((metric ^ filter.metric) & filter.metricmask)
 			return 0;
 	}
-	if (filter.flushb &&
+	if (filter.flushq &&
 	    r->rtm_family == AF_INET6 &&
 	    r->rtm_dst_len == 0 &&
 	    r->rtm_type == RTN_UNREACHABLE &&
@@ -518,14 +549,16 @@ static void print_rta_flow(FILE *fp, const struct rtattr *rta)
 }
 
 static void print_rta_newdst(FILE *fp, const struct rtmsg *r,
-			     const struct rtattr *rta)
+			     const struct rtattr *rta, int offset)
 {
 	const char *newdst = format_host_rta(r->rtm_family, rta);
 
+	if (offset)
+		print_bool(PRINT_JSON, "offset", NULL, true);
 	if (is_json_context())
 		print_string(PRINT_JSON, "to", NULL, newdst);
 	else {
-		fprintf(fp, "as to ");
+		fprintf(fp, offset ? "as offset to " : "as to ");
 		print_color_string(PRINT_FP,
 				   ifa_family_color(r->rtm_family),
 				   NULL, "%s ", newdst);
@@ -642,6 +675,33 @@ static void print_rta_metrics(FILE *fp, const struct rtattr *rta)
 	close_json_array(PRINT_JSON, NULL);
 }
 
+/*
+ * The few attributes a nexthop carries, without clearing a table of
+ * RTA_MAX for each of the nexthops of a wide multipath route.
+ */
+static void nh_parse_rtattr(struct rtattr **tb, const struct rtnexthop *nh)
+{
+	struct rtattr *rta = RTNH_DATA(nh);
+	int len = nh->rtnh_len - sizeof(*nh);
+
+	tb[RTA_ENCAP] = tb[RTA_ENCAP_TYPE] = NULL;
+	tb[RTA_NEWDST] = tb[RTA_GATEWAY] = tb[RTA_VIA] = tb[RTA_FLOW] = NULL;
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case RTA_ENCAP:
+		case RTA_ENCAP_TYPE:
+		case RTA_NEWDST:
+		case RTA_GATEWAY:
+		case RTA_VIA:
+		case RTA_FLOW:
+			if (!tb[rta->rta_type])
+				tb[rta->rta_type] = rta;
+			break;
+		}
+	}
+}
+
 static void print_rta_multipath(FILE *fp, const struct rtmsg *r,
 				struct rtattr *rta)
 {
@@ -669,15 +729,14 @@ static void print_rta_multipath(FILE *fp, const struct rtmsg *r,
 		}
 
 		if (nh->rtnh_len > sizeof(*nh)) {
-			parse_rtattr(tb, RTA_MAX, RTNH_DATA(nh),
-				     nh->rtnh_len - sizeof(*nh));
+			nh_parse_rtattr(tb, nh);
 
 			if (tb[RTA_ENCAP])
 				lwt_print_encap(fp,
 						tb[RTA_ENCAP_TYPE],
 						tb[RTA_ENCAP]);
 			if (tb[RTA_NEWDST])
-				print_rta_newdst(fp, r, tb[RTA_NEWDST]);
+				print_rta_newdst(fp, r, tb[RTA_NEWDST], 0);
 			if (tb[RTA_GATEWAY])
 				print_rta_gateway(fp, r, tb[RTA_GATEWAY]);
 			if (tb[RTA_VIA])
@@ -706,6 +765,18 @@ static void print_rta_multipath(FILE *fp, const struct rtmsg *r,
 	}
 }
 
+/* everything print_route() and filter_nlmsg() look at */
+#define PRINT_ROUTE_RTA							\
+	(RTA_WANT(RTA_DST) | RTA_WANT(RTA_SRC) | RTA_WANT(RTA_IIF) |	\
+	 RTA_WANT(RTA_OIF) | RTA_WANT(RTA_GATEWAY) |			\
+	 RTA_WANT(RTA_PRIORITY) | RTA_WANT(RTA_PREFSRC) |		\
+	 RTA_WANT(RTA_METRICS) | RTA_WANT(RTA_MULTIPATH) |		\
+	 RTA_WANT(RTA_FLOW) | RTA_WANT(RTA_CACHEINFO) |			\
+	 RTA_WANT(RTA_TABLE) | RTA_WANT(RTA_MARK) |			\
+	 RTA_WANT(RTA_VIA) | RTA_WANT(RTA_NEWDST) | RTA_WANT(RTA_PREF) |	\
+	 RTA_WANT(RTA_ENCAP_TYPE) | RTA_WANT(RTA_ENCAP) |		\
+	 RTA_WANT(RTA_TTL_PROPAGATE) | RTA_WANT(RTA_UID))
+
 int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE *)arg;
@@ -714,7 +785,6 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	struct rtattr *tb[RTA_MAX+1];
 	int family, color, host_len;
 	__u32 table;
-	int ret;
 
 	SPRINT_BUF(b1);
 
@@ -723,7 +793,7 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 			n->nlmsg_len, n->nlmsg_type, n->nlmsg_flags);
 		return -1;
 	}
-	if (filter.flushb && n->nlmsg_type != RTM_NEWROUTE)
+	if (filter.flushq && n->nlmsg_type != RTM_NEWROUTE)
 		return 0;
 	len -= NLMSG_LENGTH(sizeof(*r));
 	if (len < 0) {
@@ -733,38 +803,30 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 
 	host_len = af_bit_len(r->rtm_family);
 
-	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	parse_rtattr_want(tb, RTA_MAX, PRINT_ROUTE_RTA, RTM_RTA(r), len);
 	table = rtm_get_table(r, tb);
 
 	if (!filter_nlmsg(n, tb, host_len))
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			ret = flush_update();
-			if (ret < 0)
-				return ret;
-		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELROUTE;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
+	if (filter.flushq) {
+		if (rtnl_flush_add(filter.flushq, n, RTM_DELROUTE) < 0)
+			return -2;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
 	}
 
 	open_json_object(NULL);
+	if (filter.suppressed)
+		print_uint(PRINT_ANY, "suppressed", "[%u suppressed] ",
+			   filter.suppressed);
 	if (n->nlmsg_type == RTM_DELROUTE)
 		print_bool(PRINT_ANY, "deleted", "Deleted ", true);
 
 	if ((r->rtm_type != RTN_UNICAST || show_details > 0) &&
 	    (!filter.typemask || (filter.typemask & (1 << r->rtm_type))))
-		print_string(PRINT_ANY, NULL, "%s ",
+		print_string(PRINT_ANY, "type", "%s ",
 			     rtnl_rtntype_n2a(r->rtm_type, b1, sizeof(b1)));
 
 	color = COLOR_NONE;
@@ -781,6 +843,13 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 					  b1, sizeof(b1));
 
 		}
+		/* a run of labels from "compact" */
+		if (filter.label_last) {
+			size_t len = strlen(b1);
+
+			snprintf(b1 + len, sizeof(b1) - len, "-%u",
+				 filter.label_last);
+		}
 	} else if (r->rtm_dst_len) {
 		snprintf(b1, sizeof(b1), "0/%d ", r->rtm_dst_len);
 	} else {
@@ -811,7 +880,7 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	}
 
 	if (tb[RTA_NEWDST])
-		print_rta_newdst(fp, r, tb[RTA_NEWDST]);
+		print_rta_newdst(fp, r, tb[RTA_NEWDST], filter.label_offset);
 
 	if (tb[RTA_ENCAP])
 		lwt_print_encap(fp, tb[RTA_ENCAP_TYPE], tb[RTA_ENCAP]);
@@ -963,10 +1032,10 @@ static int parse_one_nh(struct nlmsghdr *n, struct rtmsg *r,
 			if (r->rtm_family == AF_UNSPEC)
 				r->rtm_family = addr.family;
 			if (addr.family == r->rtm_family) {
-				rta_addattr_l(rta, 4096, RTA_GATEWAY, &addr.data, addr.bytelen);
+				rta_addattr_l(rta, NH_MAX_LEN, RTA_GATEWAY, &addr.data, addr.bytelen);
 				rtnh->rtnh_len += sizeof(struct rtattr) + addr.bytelen;
 			} else {
-				rta_addattr_l(rta, 4096, RTA_VIA, &addr.family, addr.bytelen+2);
+				rta_addattr_l(rta, NH_MAX_LEN, RTA_VIA, &addr.family, addr.bytelen+2);
 				rtnh->rtnh_len += RTA_SPACE(addr.bytelen+2);
 			}
 		} else if (strcmp(*argv, "dev") == 0) {
@@ -989,12 +1058,12 @@ static int parse_one_nh(struct nlmsghdr *n, struct rtmsg *r,
 			NEXT_ARG();
 			if (get_rt_realms_or_raw(&realm, *argv))
 				return invarg("\"realm\" value is invalid\n", *argv);
-			rta_addattr32(rta, 4096, RTA_FLOW, realm);
+			rta_addattr32(rta, NH_MAX_LEN, RTA_FLOW, realm);
 			rtnh->rtnh_len += sizeof(struct rtattr) + 4;
 		} else if (strcmp(*argv, "encap") == 0) {
 			int len = rta->rta_len;
 
-			lwt_parse_encap(rta, 4096, &argc, &argv);
+			lwt_parse_encap(rta, NH_MAX_LEN, &argc, &argv);
 			rtnh->rtnh_len += rta->rta_len - len;
 		} else if (strcmp(*argv, "as") == 0) {
 			inet_prefix addr;
@@ -1003,7 +1072,7 @@ static int parse_one_nh(struct nlmsghdr *n, struct rtmsg *r,
 			if (strcmp(*argv, "to") == 0)
 				NEXT_ARG();
 			get_addr(&addr, *argv, r->rtm_family);
-			rta_addattr_l(rta, 4096, RTA_NEWDST, &addr.data,
+			rta_addattr_l(rta, NH_MAX_LEN, RTA_NEWDST, &addr.data,
 				      addr.bytelen);
 			rtnh->rtnh_len += sizeof(struct rtattr) + addr.bytelen;
 		} else
@@ -1014,11 +1083,10 @@ static int parse_one_nh(struct nlmsghdr *n, struct rtmsg *r,
 	return 0;
 }
 
+/* build RTA_MULTIPATH of the nexthops in argv in rta, NH_MAX_LEN long */
 static int parse_nexthops(struct nlmsghdr *n, struct rtmsg *r,
-			  int argc, char **argv)
+			  struct rtattr *rta, int argc, char **argv)
 {
-	char buf[1024];
-	struct rtattr *rta = (void *)buf;
 	struct rtnexthop *rtnh;
 
 	rta->rta_type = RTA_MULTIPATH;
@@ -1044,17 +1112,260 @@ static int parse_nexthops(struct nlmsghdr *n, struct rtmsg *r,
 		rtnh = RTNH_NEXT(rtnh);
 	}
 
-	if (rta->rta_len > RTA_LENGTH(0))
-		addattr_l(n, 1024, RTA_MULTIPATH, RTA_DATA(rta), RTA_PAYLOAD(rta));
 	return 0;
 }
 
+/*
+ * Nexthop groups of "ip route nhgroup", kept for as long as the ip
+ * process runs, so for the rest of a batch. The RTA_MULTIPATH of a
+ * group is built once and copied as it is into every route using it;
+ * devices are looked up when the group is defined.
+ */
+struct nh_group {
+	struct nh_group	*next;
+	char		*name;
+	int		family;		/* AF_UNSPEC if it has no gateways */
+	int		len;		/* of the RTA_MULTIPATH payload */
+	char		data[];
+};
+
+static __thread struct nh_group *nh_groups;
+
+static struct nh_group *nh_group_find(const char *name)
+{
+	struct nh_group *g;
+
+	for (g = nh_groups; g; g = g->next)
+		if (strcmp(g->name, name) == 0)
+			return g;
+	return NULL;
+}
+
+static void nh_group_free(struct nh_group *g)
+{
+	free(g->name);
+	free(g);
+}
+
+static int nh_group_del(const char *name)
+{
+	struct nh_group **pg, *g;
+
+	for (pg = &nh_groups; (g = *pg); pg = &g->next) {
+		if (strcmp(g->name, name) == 0) {
+			*pg = g->next;
+			nh_group_free(g);
+			return 0;
+		}
+	}
+	fprintf(stderr, "Nexthop group \"%s\" does not exist\n", name);
+	return -1;
+}
+
+static int nhgroup_usage(void)
+{
+	fprintf(stderr,
+		"Usage: ip route nhgroup { add | replace } NAME nexthop NH [ nexthop NH ]...\n"
+		"       ip route nhgroup { show [ NAME ] | del NAME | flush }\n");
+	iprt_exit(-1);
+}
+
+static int nh_group_add(int replace, int argc, char **argv)
+{
+	char buf[NH_MAX_LEN];
+	struct rtattr *rta = (void *)buf;
+	struct rtmsg r = { .rtm_family = preferred_family };
+	struct nh_group *g, *old;
+	const char *name;
+
+	if (argc < 1)
+		return nhgroup_usage();
+	name = *argv;
+	argc--; argv++;
+	if (argc < 1) {
+		fprintf(stderr, "Nexthop group \"%s\" needs a nexthop\n", name);
+		return -1;
+	}
+
+	old = nh_group_find(name);
+	if (old && !replace) {
+		fprintf(stderr, "Nexthop group \"%s\" exists\n", name);
+		return -1;
+	}
+
+	parse_nexthops(NULL, &r, rta, argc, argv);
+
+	g = malloc(sizeof(*g) + RTA_PAYLOAD(rta));
+	if (!g || !(g->name = strdup(name))) {
+		free(g);
+		perror("Cannot add nexthop group");
+		return -1;
+	}
+	g->family = r.rtm_family;
+	g->len = RTA_PAYLOAD(rta);
+	memcpy(g->data, RTA_DATA(rta), g->len);
+
+	if (old)
+		nh_group_del(name);
+	g->next = nh_groups;
+	nh_groups = g;
+	return 0;
+}
+
+static int nh_group_show(int argc, char **argv)
+{
+	struct nh_group *g;
+
+	for (g = nh_groups; g; g = g->next) {
+		struct rtmsg r = { .rtm_family = g->family };
+		struct {
+			struct rtattr	rta;
+			char		data[NH_MAX_LEN];
+		} mp = {
+			.rta.rta_type = RTA_MULTIPATH,
+			.rta.rta_len = RTA_LENGTH(g->len),
+		};
+
+		if (argc > 0 && strcmp(*argv, g->name))
+			continue;
+		memcpy(mp.data, g->data, g->len);
+		fprintf(stdout, "%s", g->name);
+		print_rta_multipath(stdout, &r, &mp.rta);
+		fprintf(stdout, "\n");
+	}
+	return 0;
+}
+
+static int iproute_nhgroup(int argc, char **argv)
+{
+	if (argc < 1 || matches(*argv, "show") == 0 ||
+	    matches(*argv, "list") == 0)
+		return nh_group_show(argc - !!argc, argv + !!argc);
+
+	if (matches(*argv, "add") == 0)
+		return nh_group_add(0, argc-1, argv+1);
+	if (matches(*argv, "replace") == 0)
+		return nh_group_add(1, argc-1, argv+1);
+	if (matches(*argv, "delete") == 0) {
+		if (argc != 2)
+			return nhgroup_usage();
+		return nh_group_del(argv[1]);
+	}
+	if (matches(*argv, "flush") == 0) {
+		while (nh_groups) {
+			struct nh_group *g = nh_groups;
+
+			nh_groups = g->next;
+			nh_group_free(g);
+		}
+		return 0;
+	}
+	return nhgroup_usage();
+}
+
+/* The entry at the bottom of the label stack in rta */
+static struct mpls_label *mpls_bottom(const struct rtattr *rta)
+{
+	return (struct mpls_label *)RTA_DATA(rta) +
+		RTA_PAYLOAD(rta) / sizeof(struct mpls_label) - 1;
+}
+
+static __u32 mpls_label_get(const struct mpls_label *l)
+{
+	return (ntohl(l->entry) & MPLS_LS_LABEL_MASK) >> MPLS_LS_LABEL_SHIFT;
+}
+
+static void mpls_label_set(struct mpls_label *l, __u32 label)
+{
+	__u32 entry = ntohl(l->entry) & ~MPLS_LS_LABEL_MASK;
+
+	l->entry = htonl(entry | label << MPLS_LS_LABEL_SHIFT);
+}
+
+/* "FIRST-LAST": dst gets FIRST, which is one label, last LAST */
+static void mpls_label_range(inet_prefix *dst, __u32 *last, char *arg)
+{
+	char *dash = strchr(arg, '-');
+
+	*dash = '\0';
+	get_prefix(dst, arg, AF_MPLS);
+	*dash = '-';
+	if (strchr(arg, '/') || dst->bytelen != sizeof(struct mpls_label) ||
+	    get_u32(last, dash + 1, 0) ||
+	    *last > MPLS_LS_LABEL_MASK >> MPLS_LS_LABEL_SHIFT ||
+	    *last < mpls_label_get((struct mpls_label *)dst->data))
+		invarg("invalid label range", arg);
+}
+
+static void label_range_err(__u32 cookie, int error, void *arg)
+{
+	unsigned int *failed = arg;
+
+	if (!(*failed)++)
+		fprintf(stderr, "label %u: RTNETLINK answers: %s\n",
+			cookie, strerror(-error));
+}
+
+/*
+ * The route in n once for every label from that in dst to last, all
+ * sent before the acks are read. With newdst, the bottom label it swaps
+ * in goes up with the label of the route.
+ */
+static int iproute_modify_labels(struct nlmsghdr *n, struct rtattr *dst,
+				 struct rtattr *newdst, __u32 last)
+{
+	__u32 first = mpls_label_get(RTA_DATA(dst)), label, as = 0;
+	struct rtnl_async *outer = rth.async;
+	unsigned int failed = 0;
+	int hflags = rth.flags;
+	int ret = 0;
+
+	if (newdst) {
+		as = mpls_label_get(mpls_bottom(newdst));
+		if (as + (last - first) >
+		    MPLS_LS_LABEL_MASK >> MPLS_LS_LABEL_SHIFT) {
+			fprintf(stderr, "Error: \"as offset\" goes past the last label.\n");
+			return -1;
+		}
+	}
+
+	/* what a batch queued before this line is acked under its cookies */
+	if (outer)
+		rtnl_async_flush(&rth);
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, label_range_err, &failed) < 0) {
+		rth.async = outer;
+		perror("Cannot pipeline routes");
+		return -1;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (label = first; label <= last; label++) {
+		mpls_label_set(RTA_DATA(dst), label);
+		if (newdst)
+			mpls_label_set(mpls_bottom(newdst), as + label - first);
+		rtnl_async_cookie(&rth, label);
+		if (rtnl_talk(&rth, n, NULL) < 0)
+			ret = -2;
+	}
+
+	if (rtnl_async_end(&rth) < 0)
+		ret = -2;
+	rth.async = outer;
+	rth.flags = hflags;
+
+	if (failed > 1)
+		fprintf(stderr, "%u of %u labels failed\n",
+			failed, last - first + 1);
+	return failed ? -2 : ret;
+}
+
 static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 {
 	struct {
 		struct nlmsghdr	n;
 		struct rtmsg		r;
-		char			buf[1024];
+		char			buf[1024 + NH_MAX_LEN];
 	} req = {
 		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)),
 		.n.nlmsg_flags = NLM_F_REQUEST | flags,
@@ -1066,6 +1377,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 	char  mxbuf[256];
 	struct rtattr *mxrta = (void *)mxbuf;
 	unsigned int mxlock = 0;
+	struct nh_group *nhg = NULL;
 	char  *d = NULL;
 	int gw_ok = 0;
 	int dst_ok = 0;
@@ -1074,6 +1386,9 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 	int table_ok = 0;
 	int raw = 0;
 	int type_ok = 0;
+	int as_offset = 0;
+	struct rtattr *dst_rta = NULL, *newdst = NULL;
+	__u32 dst_last = 0;
 
 	if (cmd != RTM_DELROUTE) {
 		req.r.rtm_protocol = RTPROT_BOOT;
@@ -1098,12 +1413,17 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			inet_prefix addr;
 
 			NEXT_ARG();
+			if (strcmp(*argv, "offset") == 0) {
+				NEXT_ARG();
+				as_offset = 1;
+			}
 			if (strcmp(*argv, "to") == 0) {
 				NEXT_ARG();
 			}
 			get_addr(&addr, *argv, req.r.rtm_family);
 			if (req.r.rtm_family == AF_UNSPEC)
 				req.r.rtm_family = addr.family;
+			newdst = NLMSG_TAIL(&req.n);
 			addattr_l(&req.n, sizeof(req),
 				  RTA_NEWDST, &addr.data, addr.bytelen);
 		} else if (strcmp(*argv, "via") == 0) {
@@ -1350,8 +1670,26 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 		} else if (strcmp(*argv, "onlink") == 0) {
 			req.r.rtm_flags |= RTNH_F_ONLINK;
 		} else if (strcmp(*argv, "nexthop") == 0) {
+			if (nhg)
+				return invarg("use either nexthop or nhgroup\n",
+					      *argv);
 			nhs_ok = 1;
 			break;
+		} else if (strcmp(*argv, "nhgroup") == 0) {
+			NEXT_ARG();
+			if (nhg)
+				return duparg("nhgroup", *argv);
+			nhg = nh_group_find(*argv);
+			if (!nhg)
+				return invarg("nexthop group is not defined\n",
+					      *argv);
+			if (req.r.rtm_family == AF_UNSPEC)
+				req.r.rtm_family = nhg->family;
+			else if (nhg->family != AF_UNSPEC &&
+				 nhg->family != req.r.rtm_family)
+				return invarg("nexthop group is of another family\n",
+					      *argv);
+			nhs_ok = 1;
 		} else if (matches(*argv, "protocol") == 0) {
 			__u32 prot;
 
@@ -1456,20 +1794,29 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				return usage();
 			if (dst_ok)
 				return duparg2("to", *argv);
-			get_prefix(&dst, *argv, req.r.rtm_family);
+			if (req.r.rtm_family == AF_MPLS && strchr(*argv, '-'))
+				mpls_label_range(&dst, &dst_last, *argv);
+			else
+				get_prefix(&dst, *argv, req.r.rtm_family);
 			if (req.r.rtm_family == AF_UNSPEC)
 				req.r.rtm_family = dst.family;
 			req.r.rtm_dst_len = dst.bitlen;
 			dst_ok = 1;
-			if (dst.bytelen)
+			if (dst.bytelen) {
+				dst_rta = NLMSG_TAIL(&req.n);
 				addattr_l(&req.n, sizeof(req),
 					  RTA_DST, &dst.data, dst.bytelen);
+			}
 		}
 		argc--; argv++;
 	}
 
 	if (!dst_ok)
 		return usage();
+	if (as_offset && (!dst_last || !newdst)) {
+		fprintf(stderr, "\"as offset\" is for a range of labels swapped\n");
+		return -1;
+	}
 
 	if (d) {
 		int idx = ll_name_to_index(d);
@@ -1485,8 +1832,18 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 		addattr_l(&req.n, sizeof(req), RTA_METRICS, RTA_DATA(mxrta), RTA_PAYLOAD(mxrta));
 	}
 
-	if (nhs_ok)
-		parse_nexthops(&req.n, &req.r, argc, argv);
+	if (nhg) {
+		addattr_l(&req.n, sizeof(req), RTA_MULTIPATH,
+			  nhg->data, nhg->len);
+	} else if (nhs_ok) {
+		char buf[NH_MAX_LEN];
+		struct rtattr *rta = (void *)buf;
+
+		parse_nexthops(&req.n, &req.r, rta, argc, argv);
+		if (rta->rta_len > RTA_LENGTH(0))
+			addattr_l(&req.n, sizeof(req), RTA_MULTIPATH,
+				  RTA_DATA(rta), RTA_PAYLOAD(rta));
+	}
 
 	if (req.r.rtm_family == AF_UNSPEC)
 		req.r.rtm_family = AF_INET;
@@ -1521,6 +1878,11 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 	if (!type_ok && req.r.rtm_family == AF_MPLS)
 		req.r.rtm_type = RTN_UNICAST;
 
+	if (dst_last)
+		return iproute_modify_labels(&req.n, dst_rta,
+					     as_offset ? newdst : NULL,
+					     dst_last);
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		return -2;
 
@@ -1570,12 +1932,78 @@ static int iproute_flush_cache(void)
 	return 0;
 }
 
-static __u32 route_dump_magic = 0x45311224;
+static int rtattr_cmp(const struct rtattr *rta1, const struct rtattr *rta2)
+{
+	if (!rta1 || !rta2 || rta1->rta_len != rta2->rta_len)
+		return 1;
+
+	return memcmp(RTA_DATA(rta1), RTA_DATA(rta2), RTA_PAYLOAD(rta1));
+}
+
+/* Restore routes in correct order:
+ * 0. ones for local addresses,
+ * 1. ones for local networks,
+ * 2. others (remote networks/hosts).
+ */
+static int route_save_class(const struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	if (tb[RTA_GATEWAY])
+		return 2;
+	if (tb[RTA_PREFSRC] && rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST]))
+		return 1;
+	return 0;
+}
+
+/* nexthop state dumps report, but the kernel takes no route with it */
+#define ROUTE_NH_STATE	(RTNH_F_DEAD | RTNH_F_LINKDOWN)
+
+/* "ip route restore table ID" also moves the routes to another table */
+static void route_restore_edit(struct nlmsghdr *n, void *arg)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	__u32 table = *(__u32 *)arg;
+	struct rtattr *tb[RTA_MAX+1];
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+
+	r->rtm_flags &= ~ROUTE_NH_STATE;
+	if (tb[RTA_MULTIPATH]) {
+		struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
+		int len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+
+		while (len >= sizeof(*nh) && nh->rtnh_len >= sizeof(*nh) &&
+		       nh->rtnh_len <= len) {
+			nh->rtnh_flags &= ~ROUTE_NH_STATE;
+			len -= RTNH_ALIGN(nh->rtnh_len);
+			nh = RTNH_NEXT(nh);
+		}
+	}
+
+	if (!table)
+		return;
+	r->rtm_table = table < 256 ? table : RT_TABLE_UNSPEC;
+	if (tb[RTA_TABLE] && RTA_PAYLOAD(tb[RTA_TABLE]) == sizeof(__u32))
+		memcpy(RTA_DATA(tb[RTA_TABLE]), &table, sizeof(table));
+}
+
+static const struct ipsave_ops route_save_ops = {
+	.what		= "route",
+	.magic		= 0x45311224,
+	.nclasses	= 3,
+	.classify	= route_save_class,
+	.edit		= route_restore_edit,
+};
 
 static int save_route(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		      void *arg)
 {
-	int ret;
 	int len = n->nlmsg_len;
 	struct rtmsg *r = NLMSG_DATA(n);
 	struct rtattr *tb[RTA_MAX+1];
@@ -1588,56 +2016,70 @@ static int save_route(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	if (!filter_nlmsg(n, tb, host_len))
 		return 0;
 
-	ret = write(STDOUT_FILENO, n, n->nlmsg_len);
-	if ((ret > 0) && (ret != n->nlmsg_len)) {
-		fprintf(stderr, "Short write while saving nlmsg\n");
-		ret = -EIO;
+	return ipsave_add(arg, n);
+}
+
+/* let the kernel drop what filter_nlmsg() would throw away anyway */
+static int iproute_dump_filter(struct nlmsghdr *nlh, int reqlen)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	int err;
+
+	if (filter.protocolmask == -1)
+		rtm->rtm_protocol = filter.protocol;
+
+	if (filter.typemask && !(filter.typemask & (filter.typemask - 1)))
+		rtm->rtm_type = ffsll(filter.typemask) - 1;
+
+	if (filter.tb) {
+		err = addattr32(nlh, reqlen, RTA_TABLE, filter.tb);
+		if (err)
+			return err;
+	}
+
+	if (filter.oifmask == -1) {
+		err = addattr32(nlh, reqlen, RTA_OIF, filter.oif);
+		if (err)
+			return err;
 	}
 
-	return ret == n->nlmsg_len ? 0 : ret;
+	return 0;
 }
 
-static int save_route_prep(void)
+/* the families an AF_UNSPEC route dump covers, in the order it does */
+static const int route_dump_families[] = {
+	AF_INET, AF_INET6, AF_MPLS, RTNL_FAMILY_IPMR, RTNL_FAMILY_IP6MR,
+};
+
+static int iproute_dump_req(struct rtnl_handle *rth, int family)
 {
-	int ret;
+	return rtnl_routedump_req(rth, family, iproute_dump_filter);
+}
 
-	if (isatty(STDOUT_FILENO)) {
-		fprintf(stderr, "Not sending a binary stream to stdout\n");
+/* 'ip -dump-jobs N route show table all': one dump per family at once */
+static int iproute_list_jobs(rtnl_filter_t filter_fn)
+{
+	if (new_json_obj(json))
 		return -1;
-	}
 
-	ret = write(STDOUT_FILENO, &route_dump_magic, sizeof(route_dump_magic));
-	if (ret != sizeof(route_dump_magic)) {
-		fprintf(stderr, "Can't write magic to dump file\n");
-		return -1;
-	}
+	if (jobs_dump_families(&rth, route_dump_families,
+			       ARRAY_SIZE(route_dump_families), dump_jobs,
+			       iproute_dump_req, filter_fn, stdout) < 0)
+		return -2;
 
+	delete_json_obj();
+	fflush(stdout);
 	return 0;
 }
 
-static int iproute_flush(int do_ipv6, rtnl_filter_t filter_fn)
+static int iproute_flush_rounds(int do_ipv6, rtnl_filter_t filter_fn)
 {
 	time_t start = time(0);
-	char flushb[4096-512];
 	int round = 0;
 	int ret;
 
-	if (filter.cloned) {
-		if (do_ipv6 != AF_INET6) {
-			iproute_flush_cache();
-			if (show_stats)
-				printf("*** IPv4 routing cache is flushed.\n");
-		}
-		if (do_ipv6 == AF_INET)
-			return 0;
-	}
-
-	filter.flushb = flushb;
-	filter.flushp = 0;
-	filter.flushe = sizeof(flushb);
-
 	for (;;) {
-		if (rtnl_wilddump_request(&rth, do_ipv6, RTM_GETROUTE) < 0) {
+		if (rtnl_routedump_req(&rth, do_ipv6, iproute_dump_filter) < 0) {
 			perror("Cannot send dump request");
 			return -2;
 		}
@@ -1677,56 +2119,469 @@ static int iproute_flush(int do_ipv6, rtnl_filter_t filter_fn)
 	}
 }
 
-static int iproute_list_flush_or_save(int argc, char **argv, int action)
+/*
+ * Each round collects the routes of a whole dump before deleting them,
+ * so they are not deleted under the dump, and a second round normally
+ * only confirms that nothing is left.
+ */
+static int iproute_flush(int do_ipv6, rtnl_filter_t filter_fn)
 {
-	int do_ipv6 = preferred_family;
-	char *id = NULL;
-	char *od = NULL;
-	unsigned int mark = 0;
-	rtnl_filter_t filter_fn;
+	struct rtnl_txq flushq = {};
+	int ret;
 
-	if (action == IPROUTE_SAVE) {
-		if (save_route_prep())
-			return -1;
+	if (filter.cloned) {
+		if (do_ipv6 != AF_INET6) {
+			iproute_flush_cache();
+			if (show_stats)
+				printf("*** IPv4 routing cache is flushed.\n");
+		}
+		if (do_ipv6 == AF_INET)
+			return 0;
+	}
 
-		filter_fn = save_route;
-	} else
-		filter_fn = print_route;
+	filter.flushq = &flushq;
+	ret = iproute_flush_rounds(do_ipv6, filter_fn);
+	filter.flushq = NULL;
+	rtnl_txq_free(&flushq);
+	return ret;
+}
 
-	iproute_reset_filter(0);
-	filter.tb = RT_TABLE_MAIN;
+/*
+ * ip route show compact: MPLS routes of consecutive labels that differ
+ * in nothing else, but the bottom label they swap in going up along
+ * with theirs, are printed once for the run as FIRST-LAST.
+ */
+enum {
+	COMPACT_AS_ANY,		/* nothing swapped in, or one route so far */
+	COMPACT_AS_SAME,
+	COMPACT_AS_OFFSET,
+};
 
-	if ((action == IPROUTE_FLUSH) && argc <= 0) {
-		fprintf(stderr, "\"ip route flush\" requires arguments.\n");
-		return -1;
-	}
+struct route_compact {
+	struct nlmsghdr	*first;		/* copy of the first route of the run */
+	size_t		size;
+	__u32		label;		/* of the first route */
+	__u32		last;		/* of the last route so far */
+	int		as;
+	FILE		*fp;
+};
 
-	while (argc > 0) {
-		if (matches(*argv, "table") == 0) {
-			__u32 tid;
+/* the label of a route to one MPLS label */
+static bool route_label(const struct rtmsg *r, struct rtattr **tb,
+			__u32 *label)
+{
+	if (r->rtm_family != AF_MPLS || !tb[RTA_DST] ||
+	    RTA_PAYLOAD(tb[RTA_DST]) != sizeof(struct mpls_label))
+		return false;
+	*label = mpls_label_get(RTA_DATA(tb[RTA_DST]));
+	return true;
+}
 
-			NEXT_ARG();
-			if (rtnl_rttable_a2n(&tid, *argv)) {
-				if (strcmp(*argv, "all") == 0) {
-					filter.tb = 0;
-				} else if (strcmp(*argv, "cache") == 0) {
-					filter.cloned = 1;
-				} else if (strcmp(*argv, "help") == 0) {
-					return usage();
-				} else {
-					return invarg("table id value is invalid\n", *argv);
-				}
-			} else
-				filter.tb = tid;
-		} else if (matches(*argv, "vrf") == 0) {
-			__u32 tid;
+/* x the first route's RTA_NEWDST, y that of the one delta labels on */
+static bool route_compact_as(const struct rtattr *x, const struct rtattr *y,
+			     __u32 delta, int *as)
+{
+	size_t len = RTA_PAYLOAD(x);
+	__u32 a, b;
+
+	if (len < sizeof(struct mpls_label) ||
+	    memcmp(RTA_DATA(x), RTA_DATA(y), len - sizeof(struct mpls_label)))
+		return false;
+	a = ntohl(mpls_bottom(x)->entry);
+	b = ntohl(mpls_bottom(y)->entry);
+	if ((a ^ b) & ~MPLS_LS_LABEL_MASK)
+		return false;
+
+	a = (a & MPLS_LS_LABEL_MASK) >> MPLS_LS_LABEL_SHIFT;
+	b = (b & MPLS_LS_LABEL_MASK) >> MPLS_LS_LABEL_SHIFT;
+	if (b == a && *as != COMPACT_AS_OFFSET)
+		*as = COMPACT_AS_SAME;
+	else if (b - a == delta && *as != COMPACT_AS_SAME)
+		*as = COMPACT_AS_OFFSET;
+	else
+		return false;
+	return true;
+}
 
-			NEXT_ARG();
-			tid = ipvrf_get_table(*argv);
-			if (tid == 0)
-				return invarg("Invalid VRF\n", *argv);
-			filter.tb = tid;
-			filter.typemask = ~(1 << RTN_LOCAL | 1<<RTN_BROADCAST);
+static bool route_compact_next(struct route_compact *c,
+			       const struct nlmsghdr *n, __u32 label)
+{
+	const struct rtmsg *a = NLMSG_DATA(c->first), *b = NLMSG_DATA(n);
+	const struct rtattr *x = RTM_RTA(a), *y = RTM_RTA(b);
+	int len = RTM_PAYLOAD(c->first);
+	int as = c->as;
+
+	if (label != c->last + 1 || n->nlmsg_len != c->first->nlmsg_len ||
+	    n->nlmsg_type != c->first->nlmsg_type || memcmp(a, b, sizeof(*a)))
+		return false;
+
+	for (; RTA_OK(x, len); x = RTA_NEXT(x, len)) {
+		if (x->rta_type != y->rta_type || x->rta_len != y->rta_len)
+			return false;
+		if (x->rta_type == RTA_NEWDST) {
+			if (!route_compact_as(x, y, label - c->label, &as))
+				return false;
+		} else if (x->rta_type != RTA_DST &&
+			   memcmp(RTA_DATA(x), RTA_DATA(y), RTA_PAYLOAD(x))) {
+			return false;
+		}
+		y = (const void *)y + RTA_ALIGN(x->rta_len);
+	}
+
+	c->as = as;
+	c->last = label;
+	return true;
+}
+
+static int route_compact_flush(struct route_compact *c)
+{
+	int ret;
+
+	if (!c->first || !c->first->nlmsg_len)
+		return 0;
+
+	filter.label_last = c->last != c->label ? c->last : 0;
+	filter.label_offset = c->as == COMPACT_AS_OFFSET;
+	ret = print_route(NULL, c->first, c->fp);
+	filter.label_last = 0;
+	filter.label_offset = 0;
+	c->first->nlmsg_len = 0;
+	return ret;
+}
+
+static int compact_route(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			 void *arg)
+{
+	struct route_compact *c = arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX+1];
+	__u32 label;
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return print_route(who, n, c->fp);
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	if (!filter_nlmsg(n, tb, af_bit_len(r->rtm_family)))
+		return 0;
+
+	if (!route_label(r, tb, &label)) {
+		if (route_compact_flush(c) < 0)
+			return -1;
+		return print_route(who, n, c->fp);
+	}
+	if (c->first && c->first->nlmsg_len && route_compact_next(c, n, label))
+		return 0;
+
+	if (route_compact_flush(c) < 0)
+		return -1;
+	if (c->size < n->nlmsg_len) {
+		struct nlmsghdr *p = realloc(c->first, n->nlmsg_len);
+
+		if (!p)
+			return -1;
+		c->first = p;
+		c->size = n->nlmsg_len;
+	}
+	memcpy(c->first, n, n->nlmsg_len);
+	c->label = c->last = label;
+	c->as = COMPACT_AS_ANY;
+	return 0;
+}
+
+/* ip route summary: how many routes there are of each kind */
+#define SUMMARY_TABLE		0x01
+#define SUMMARY_PROTO		0x02
+#define SUMMARY_TYPE		0x04
+#define SUMMARY_SCOPE		0x08
+#define SUMMARY_DEV		0x10
+#define SUMMARY_FAMILY		0x20
+
+#define SUMMARY_HASH		1024
+
+/* all that filter_nlmsg() looks at, and the nexthops for "by dev" */
+#define SUMMARY_RTA							\
+	(RTA_WANT(RTA_DST) | RTA_WANT(RTA_SRC) | RTA_WANT(RTA_IIF) |	\
+	 RTA_WANT(RTA_OIF) | RTA_WANT(RTA_GATEWAY) |			\
+	 RTA_WANT(RTA_PRIORITY) | RTA_WANT(RTA_PREFSRC) |		\
+	 RTA_WANT(RTA_MULTIPATH) | RTA_WANT(RTA_FLOW) |			\
+	 RTA_WANT(RTA_TABLE) | RTA_WANT(RTA_MARK) | RTA_WANT(RTA_VIA))
+
+struct summary_key {
+	__u32	table;
+	__u32	oif;
+	__u8	family;
+	__u8	protocol;
+	__u8	type;
+	__u8	scope;
+};
+
+struct summary_ent {
+	struct summary_ent	*next;
+	struct summary_key	key;
+	unsigned long long	count;
+};
+
+struct route_summary {
+	unsigned int		by;
+	unsigned int		groups;
+	unsigned long long	total;
+	struct summary_ent	*hash[SUMMARY_HASH];
+	struct arena		arena;
+};
+
+static const struct {
+	const char	*name;
+	unsigned int	bit;
+} summary_keys[] = {
+	{ "table",	SUMMARY_TABLE },
+	{ "proto",	SUMMARY_PROTO },
+	{ "protocol",	SUMMARY_PROTO },
+	{ "type",	SUMMARY_TYPE },
+	{ "scope",	SUMMARY_SCOPE },
+	{ "dev",	SUMMARY_DEV },
+	{ "family",	SUMMARY_FAMILY },
+};
+
+static int summary_parse_by(unsigned int *by, char *arg)
+{
+	char *key, *save = NULL;
+	unsigned int i;
+
+	*by = 0;
+	for (key = strtok_r(arg, ",", &save); key;
+	     key = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < ARRAY_SIZE(summary_keys); i++)
+			if (strcmp(key, summary_keys[i].name) == 0)
+				break;
+		if (i == ARRAY_SIZE(summary_keys))
+			return invarg("unknown summary key\n", key);
+		*by |= summary_keys[i].bit;
+	}
+	return 0;
+}
+
+static void summary_count(struct route_summary *sum,
+			  const struct summary_key *key)
+{
+	unsigned int h;
+	struct summary_ent *e;
+
+	h = key->table * 31 + key->oif;
+	h = h * 31 + ((key->family << 24) | (key->protocol << 16) |
+		      (key->type << 8) | key->scope);
+	h = (h ^ (h >> 16)) % SUMMARY_HASH;
+
+	for (e = sum->hash[h]; e; e = e->next)
+		if (memcmp(&e->key, key, sizeof(*key)) == 0)
+			break;
+	if (!e) {
+		e = arena_alloc(&sum->arena, sizeof(*e));
+		if (!e)
+			return;
+		e->key = *key;
+		e->count = 0;
+		e->next = sum->hash[h];
+		sum->hash[h] = e;
+		sum->groups++;
+	}
+	e->count++;
+}
+
+static int summarize_route(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			   void *arg)
+{
+	struct route_summary *sum = arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX+1];
+	struct summary_key key = {};
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return 0;
+
+	parse_rtattr_want(tb, RTA_MAX, SUMMARY_RTA, RTM_RTA(r), len);
+	if (!filter_nlmsg(n, tb, af_bit_len(r->rtm_family)))
+		return 0;
+
+	sum->total++;
+	if (sum->by & SUMMARY_TABLE)
+		key.table = rtm_get_table(r, tb);
+	if (sum->by & SUMMARY_PROTO)
+		key.protocol = r->rtm_protocol;
+	if (sum->by & SUMMARY_TYPE)
+		key.type = r->rtm_type;
+	if (sum->by & SUMMARY_SCOPE)
+		key.scope = r->rtm_scope;
+	if (sum->by & SUMMARY_FAMILY)
+		key.family = r->rtm_family;
+
+	/* a multipath route counts once for each device it goes out of */
+	if ((sum->by & SUMMARY_DEV) && tb[RTA_MULTIPATH]) {
+		struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
+		int nhlen = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+
+		while (nhlen >= (int)sizeof(*nh) && nh->rtnh_len >= sizeof(*nh) &&
+		       nh->rtnh_len <= nhlen) {
+			key.oif = nh->rtnh_ifindex;
+			summary_count(sum, &key);
+			nhlen -= NLMSG_ALIGN(nh->rtnh_len);
+			nh = RTNH_NEXT(nh);
+		}
+		return 0;
+	}
+	if ((sum->by & SUMMARY_DEV) && tb[RTA_OIF])
+		key.oif = rta_getattr_u32(tb[RTA_OIF]);
+	summary_count(sum, &key);
+	return 0;
+}
+
+static int summary_cmp(const void *a, const void *b)
+{
+	const struct summary_key *x = &(*(const struct summary_ent **)a)->key;
+	const struct summary_key *y = &(*(const struct summary_ent **)b)->key;
+
+	if (x->family != y->family)
+		return x->family < y->family ? -1 : 1;
+	if (x->table != y->table)
+		return x->table < y->table ? -1 : 1;
+	if (x->protocol != y->protocol)
+		return x->protocol < y->protocol ? -1 : 1;
+	if (x->type != y->type)
+		return x->type < y->type ? -1 : 1;
+	if (x->scope != y->scope)
+		return x->scope < y->scope ? -1 : 1;
+	if (x->oif != y->oif)
+		return x->oif < y->oif ? -1 : 1;
+	return 0;
+}
+
+static void print_summary_ent(const struct route_summary *sum,
+			      const struct summary_ent *e)
+{
+	const struct summary_key *k = &e->key;
+
+	SPRINT_BUF(b1);
+
+	open_json_object(NULL);
+	if (sum->by & SUMMARY_FAMILY)
+		print_string(PRINT_ANY, "family", "family %s ",
+			     family_name(k->family));
+	if (sum->by & SUMMARY_TABLE)
+		print_string(PRINT_ANY, "table", "table %s ",
+			     rtnl_rttable_n2a(k->table, b1, sizeof(b1)));
+	if (sum->by & SUMMARY_PROTO)
+		print_string(PRINT_ANY, "protocol", "proto %s ",
+			     rtnl_rtprot_n2a(k->protocol, b1, sizeof(b1)));
+	if (sum->by & SUMMARY_TYPE)
+		print_string(PRINT_ANY, "type", "type %s ",
+			     rtnl_rtntype_n2a(k->type, b1, sizeof(b1)));
+	if (sum->by & SUMMARY_SCOPE)
+		print_string(PRINT_ANY, "scope", "scope %s ",
+			     rtnl_rtscope_n2a(k->scope, b1, sizeof(b1)));
+	if (sum->by & SUMMARY_DEV) {
+		if (k->oif)
+			print_string(PRINT_ANY, "dev", "dev %s ",
+				     ll_index_to_name(k->oif));
+		else
+			print_null(PRINT_ANY, "dev", "dev %s ", "none");
+	}
+	print_u64(PRINT_ANY, "count", "count %llu", e->count);
+	print_string(PRINT_FP, NULL, "\n", NULL);
+	close_json_object();
+}
+
+static int print_route_summary(struct route_summary *sum)
+{
+	struct summary_ent **ents, *e;
+	unsigned int h, i = 0;
+
+	ents = malloc((sum->groups ? : 1) * sizeof(*ents));
+	if (!ents) {
+		perror("malloc");
+		return -1;
+	}
+	for (h = 0; h < SUMMARY_HASH; h++)
+		for (e = sum->hash[h]; e; e = e->next)
+			ents[i++] = e;
+	qsort(ents, sum->groups, sizeof(*ents), summary_cmp);
+
+	if (new_json_obj(json)) {
+		free(ents);
+		return -1;
+	}
+	open_json_object(NULL);
+	open_json_array(PRINT_JSON, "groups");
+	for (i = 0; i < sum->groups; i++)
+		print_summary_ent(sum, ents[i]);
+	close_json_array(PRINT_JSON, NULL);
+	print_u64(PRINT_ANY, "total", "total %llu\n", sum->total);
+	close_json_object();
+	delete_json_obj();
+	free(ents);
+	return 0;
+}
+
+static int iproute_list_flush_or_save(int argc, char **argv, int action)
+{
+	int do_ipv6 = preferred_family;
+	char *id = NULL;
+	char *od = NULL;
+	unsigned int mark = 0;
+	struct ipsave_writer *save = NULL;
+	struct route_summary summary = {
+		.by = SUMMARY_TABLE | SUMMARY_PROTO | SUMMARY_TYPE,
+	};
+	struct route_compact compact = { .fp = stdout };
+	int do_compact = 0;
+	rtnl_filter_t filter_fn;
+
+	if (action == IPROUTE_SAVE)
+		filter_fn = save_route;
+	else
+		filter_fn = print_route;
+
+	iproute_reset_filter(0);
+	filter.tb = RT_TABLE_MAIN;
+
+	if ((action == IPROUTE_FLUSH) && argc <= 0) {
+		fprintf(stderr, "\"ip route flush\" requires arguments.\n");
+		return -1;
+	}
+
+	while (argc > 0) {
+		if (action == IPROUTE_SUMMARY && strcmp(*argv, "by") == 0) {
+			NEXT_ARG();
+			if (summary_parse_by(&summary.by, *argv))
+				return -1;
+		} else if (action == IPROUTE_LIST &&
+			   strcmp(*argv, "compact") == 0) {
+			do_compact = 1;
+		} else if (matches(*argv, "table") == 0) {
+			__u32 tid;
+
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&tid, *argv)) {
+				if (strcmp(*argv, "all") == 0) {
+					filter.tb = 0;
+				} else if (strcmp(*argv, "cache") == 0) {
+					filter.cloned = 1;
+				} else if (strcmp(*argv, "help") == 0) {
+					return usage();
+				} else {
+					return invarg("table id value is invalid\n", *argv);
+				}
+			} else
+				filter.tb = tid;
+		} else if (matches(*argv, "vrf") == 0) {
+			__u32 tid;
+
+			NEXT_ARG();
+			tid = ipvrf_get_table(*argv);
+			if (tid == 0)
+				return invarg("Invalid VRF\n", *argv);
+			filter.tb = tid;
+			filter.typemask = ~(1 << RTN_LOCAL | 1<<RTN_BROADCAST);
 		} else if (matches(*argv, "cached") == 0 ||
 			   matches(*argv, "cloned") == 0) {
 			filter.cloned = 1;
@@ -1882,8 +2737,19 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 	if (action == IPROUTE_FLUSH)
 		return iproute_flush(do_ipv6, filter_fn);
 
+	/* children can neither share a JSON array nor take part in a batch */
+	if (action == IPROUTE_LIST && do_ipv6 == AF_UNSPEC && dump_jobs > 1 &&
+	    !filter.cloned && !do_compact && (!json || ndjson) && !batch_mode)
+		return iproute_list_jobs(filter_fn);
+
+	if (action == IPROUTE_SAVE) {
+		save = ipsave_begin(&route_save_ops);
+		if (!save)
+			return -1;
+	}
+
 	if (!filter.cloned) {
-		if (rtnl_wilddump_request(&rth, do_ipv6, RTM_GETROUTE) < 0) {
+		if (rtnl_routedump_req(&rth, do_ipv6, iproute_dump_filter) < 0) {
 			perror("Cannot send dump request");
 			return -2;
 		}
@@ -1894,10 +2760,41 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 		}
 	}
 
+	if (save) {
+		if (rtnl_dump_filter(&rth, filter_fn, save) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ipsave_abort(save);
+			return -2;
+		}
+		return ipsave_end(save);
+	}
+
+	if (action == IPROUTE_SUMMARY) {
+		int ret = -2;
+
+		if (rtnl_dump_filter(&rth, summarize_route, &summary) < 0)
+			fprintf(stderr, "Dump terminated\n");
+		else
+			ret = print_route_summary(&summary);
+		arena_free(&summary.arena);
+		return ret;
+	}
+
 	if (new_json_obj(json))
 		return -1;
 
-	if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
+	if (do_compact) {
+		int ret = 0;
+
+		if (rtnl_dump_filter(&rth, compact_route, &compact) < 0 ||
+		    route_compact_flush(&compact) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = -2;
+		}
+		free(compact.first);
+		if (ret)
+			return ret;
+	} else if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return -2;
 	}
@@ -1908,13 +2805,23 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 }
 
 
-static int iproute_get(int argc, char **argv)
+struct route_get_req {
+	struct nlmsghdr		n;
+	struct rtmsg		r;
+	char			buf[1024];
+};
+
+struct route_get_args {
+	char	*idev;
+	char	*odev;
+	int	connected;
+	int	from_ok;
+};
+
+static int iproute_get_parse(int argc, char **argv, struct route_get_req *r,
+			     struct route_get_args *a)
 {
-	struct {
-		struct nlmsghdr	n;
-		struct rtmsg		r;
-		char			buf[1024];
-	} req = {
+	struct route_get_req req = {
 		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)),
 		.n.nlmsg_flags = NLM_F_REQUEST,
 		.n.nlmsg_type = RTM_GETROUTE,
@@ -1922,15 +2829,12 @@ static int iproute_get(int argc, char **argv)
 	};
 	char  *idev = NULL;
 	char  *odev = NULL;
-	struct nlmsghdr *answer;
 	int connected = 0;
 	int fib_match = 0;
 	int from_ok = 0;
+	int dst_ok = 0;
 	unsigned int mark = 0;
 
-	iproute_reset_filter(0);
-	filter.cloned = 2;
-
 	while (argc > 0) {
 		if (strcmp(*argv, "tos") == 0 ||
 		    matches(*argv, "dsfield") == 0) {
@@ -2009,11 +2913,12 @@ static int iproute_get(int argc, char **argv)
 				addattr_l(&req.n, sizeof(req),
 					  RTA_DST, &addr.data, addr.bytelen);
 			req.r.rtm_dst_len = addr.bitlen;
+			dst_ok = addr.bitlen > 0;
 		}
 		argc--; argv++;
 	}
 
-	if (req.r.rtm_dst_len == 0) {
+	if (!dst_ok) {
 		fprintf(stderr, "need at least a destination address\n");
 		return -1;
 	}
@@ -2040,14 +2945,237 @@ static int iproute_get(int argc, char **argv)
 	if (req.r.rtm_family == AF_UNSPEC)
 		req.r.rtm_family = AF_INET;
 
-	req.r.rtm_flags |= RTM_F_LOOKUP_TABLE;
+	/*
+	 * The kernel looks up the address whatever the length, and a strict
+	 * one takes none but the full one, and the table flag only for IPv4.
+	 */
+	req.r.rtm_dst_len = af_bit_len(req.r.rtm_family);
+	if (req.r.rtm_src_len)
+		req.r.rtm_src_len = af_bit_len(req.r.rtm_family);
+	if (req.r.rtm_family == AF_INET)
+		req.r.rtm_flags |= RTM_F_LOOKUP_TABLE;
 	if (fib_match)
 		req.r.rtm_flags |= RTM_F_FIB_MATCH;
 
+	*r = req;
+	a->idev = idev;
+	a->odev = odev;
+	a->connected = connected;
+	a->from_ok = from_ok;
+	return 0;
+}
+
+/*
+ * ip route get -batch FILE asks the kernel about one query per line, in
+ * the syntax of ip route get, with up to RTGET_WINDOW requests in flight
+ * on the one socket. The kernel answers them in the order they were
+ * sent, so the results come out in the order of the file, one line each
+ * with the table, type, gateway, device and preferred source.
+ */
+#define RTGET_WINDOW	256
+
+struct route_get_batch {
+	char		*query[RTGET_WINDOW];
+	unsigned int	count;
+	unsigned int	failed;
+};
+
+static void route_get_batch_query(struct route_get_batch *b, __u32 cookie)
+{
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "query", "%s ->", b->query[cookie % RTGET_WINDOW]);
+}
+
+static void route_get_batch_done(struct route_get_batch *b, __u32 cookie)
+{
+	print_string(PRINT_FP, NULL, "\n", NULL);
+	close_json_object();
+	free(b->query[cookie % RTGET_WINDOW]);
+	b->query[cookie % RTGET_WINDOW] = NULL;
+}
+
+static void route_get_batch_reply(__u32 cookie, struct nlmsghdr *n, void *arg)
+{
+	struct route_get_batch *b = arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX+1];
+	SPRINT_BUF(b1);
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0 ||
+	    !b->query[cookie % RTGET_WINDOW])
+		return;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	route_get_batch_query(b, cookie);
+	print_string(PRINT_ANY, "table", " table %s",
+		     rtnl_rttable_n2a(rtm_get_table(r, tb), b1, sizeof(b1)));
+	if (r->rtm_type != RTN_UNICAST)
+		print_string(PRINT_ANY, "type", " type %s",
+			     rtnl_rtntype_n2a(r->rtm_type, b1, sizeof(b1)));
+	if (tb[RTA_GATEWAY])
+		print_color_string(PRINT_ANY, ifa_family_color(r->rtm_family),
+				   "gateway", " via %s",
+				   format_host_rta(r->rtm_family,
+						   tb[RTA_GATEWAY]));
+	if (tb[RTA_OIF])
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "dev", " dev %s",
+				   ll_index_to_name(rta_getattr_u32(tb[RTA_OIF])));
+	if (tb[RTA_PREFSRC])
+		print_color_string(PRINT_ANY, ifa_family_color(r->rtm_family),
+				   "prefsrc", " src %s",
+				   format_host_rta(r->rtm_family,
+						   tb[RTA_PREFSRC]));
+	route_get_batch_done(b, cookie);
+}
+
+static void route_get_batch_err(__u32 cookie, int error, void *arg)
+{
+	struct route_get_batch *b = arg;
+
+	b->failed++;
+	if (!b->query[cookie % RTGET_WINDOW])
+		return;
+	route_get_batch_query(b, cookie);
+	print_string(PRINT_ANY, "error", " error %s", strerror(-error));
+	route_get_batch_done(b, cookie);
+}
+
+/* the query as the kernel will be asked it, for the results */
+static char *route_get_batch_text(int argc, char **argv)
+{
+	size_t len = 0;
+	char *text;
+	int i;
+
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	text = malloc(len);
+	if (!text)
+		return NULL;
+	for (len = 0, i = 0; i < argc; i++) {
+		strcpy(text + len, argv[i]);
+		len += strlen(argv[i]);
+		text[len++] = ' ';
+	}
+	text[len - 1] = '\0';
+	return text;
+}
+
+static int iproute_get_batch(const char *name)
+{
+	struct route_get_batch b = {};
+	struct rtnl_async *outer = rth.async;
+	int saved_lineno = cmdlineno;
+	int hflags = rth.flags;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp = stdin;
+	int ret = 0;
+	unsigned int i;
+
+	if (strcmp(name, "-") != 0) {
+		fp = fopen(name, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				name, strerror(errno));
+			return -1;
+		}
+	}
+
+	/* what a batch queued before this line is acked under its cookies */
+	if (outer)
+		rtnl_async_flush(&rth);
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, RTGET_WINDOW, route_get_batch_err, &b) < 0) {
+		rth.async = outer;
+		perror("Cannot pipeline requests");
+		ret = -1;
+		goto out;
+	}
+	rtnl_async_replies(&rth, route_get_batch_reply);
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+	new_json_obj(json);
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		struct route_get_req req;
+		struct route_get_args a;
+		char *largv[64];
+		int largc;
+
+		largc = makeargs(line, largv, ARRAY_SIZE(largv));
+		if (largc == 0)
+			continue;	/* blank line */
+
+		if (iproute_get_parse(largc, largv, &req, &a) < 0) {
+			fprintf(stderr, "%s:%d: bad query\n", name, cmdlineno);
+			ret = -1;
+			break;
+		}
+		if (a.connected) {
+			fprintf(stderr, "%s:%d: \"connected\" is not for batches\n",
+				name, cmdlineno);
+			ret = -1;
+			break;
+		}
+
+		/* the slot of the query is taken until its result is out */
+		if (b.count && b.count % RTGET_WINDOW == 0)
+			rtnl_async_flush(&rth);
+		b.query[b.count % RTGET_WINDOW] = route_get_batch_text(largc,
+								       largv);
+		if (!b.query[b.count % RTGET_WINDOW]) {
+			perror("Cannot read file");
+			ret = -1;
+			break;
+		}
+		rtnl_async_cookie(&rth, b.count++);
+		if (rtnl_talk(&rth, &req.n, NULL) < 0)
+			ret = -2;
+	}
+
+	if (rtnl_async_end(&rth) < 0 && ret == 0)
+		ret = -2;
+	rth.async = outer;
+	rth.flags = hflags;
+	delete_json_obj();
+	fflush(stdout);
+
+	if (show_stats)
+		fprintf(stderr, "%u queries, %u failed\n", b.count, b.failed);
+	if (ret == 0 && b.failed)
+		ret = -2;
+	for (i = 0; i < RTGET_WINDOW; i++)
+		free(b.query[i]);
+out:
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = saved_lineno;
+	return ret;
+}
+
+static int iproute_get(int argc, char **argv)
+{
+	struct route_get_req req;
+	struct route_get_args a;
+	struct nlmsghdr *answer;
+
+	iproute_reset_filter(0);
+	filter.cloned = 2;
+
+	if (argc == 2 && (strcmp(argv[0], "-batch") == 0 ||
+			  strcmp(argv[0], "batch") == 0))
+		return iproute_get_batch(argv[1]);
+
+	if (iproute_get_parse(argc, argv, &req, &a) < 0)
+		return -1;
+
 	if (rtnl_talk(&rth, &req.n, &answer) < 0)
 		return -2;
 
-	if (connected && !from_ok) {
+	if (a.connected && !a.from_ok) {
 		struct rtmsg *r = NLMSG_DATA(answer);
 		int len = answer->nlmsg_len;
 		struct rtattr *tb[RTA_MAX+1];
@@ -2080,13 +3208,13 @@ static int iproute_get(int argc, char **argv)
 			free(answer);
 			return -1;
 		}
-		if (!odev && tb[RTA_OIF])
+		if (!a.odev && tb[RTA_OIF])
 			tb[RTA_OIF]->rta_type = 0;
 		if (tb[RTA_GATEWAY])
 			tb[RTA_GATEWAY]->rta_type = 0;
 		if (tb[RTA_VIA])
 			tb[RTA_VIA]->rta_type = 0;
-		if (!idev && tb[RTA_IIF])
+		if (!a.idev && tb[RTA_IIF])
 			tb[RTA_IIF]->rta_type = 0;
 		req.n.nlmsg_flags = NLM_F_REQUEST;
 		req.n.nlmsg_type = RTM_GETROUTE;
@@ -2106,118 +3234,579 @@ static int iproute_get(int argc, char **argv)
 	return 0;
 }
 
-static int rtattr_cmp(const struct rtattr *rta1, const struct rtattr *rta2)
+static int iproute_restore(int argc, char **argv)
 {
-	if (!rta1 || !rta2 || rta1->rta_len != rta2->rta_len)
-		return 1;
+	__u32 table = 0;
 
-	return memcmp(RTA_DATA(rta1), RTA_DATA(rta2), RTA_PAYLOAD(rta1));
+	while (argc > 0) {
+		if (matches(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&table, *argv) || !table)
+				invarg("table id value is invalid\n", *argv);
+		} else {
+			invarg("unknown argument\n", *argv);
+		}
+		argc--; argv++;
+	}
+
+	return ipsave_restore(&route_save_ops, &table);
+}
+
+static int show_handler(const struct sockaddr_nl *nl,
+			struct rtnl_ctrl_data *ctrl,
+			struct nlmsghdr *n, void *arg)
+{
+	print_route(nl, n, stdout);
+	return 0;
+}
+
+static int iproute_showdump(void)
+{
+	if (ipsave_show(&route_save_ops, STDIN_FILENO, show_handler, NULL))
+		return -2;
+
+	return 0;
 }
 
-static int restore_handler(const struct sockaddr_nl *nl,
-			   struct rtnl_ctrl_data *ctrl,
+/*
+ * ip route sync makes a table look like a file of routes with as few
+ * changes as possible: the table is dumped once into an index keyed by
+ * what the kernel tells routes apart by, every line of the file is made
+ * into the request "ip route replace" would send, and only routes that
+ * are missing, different or no longer wanted are touched.
+ */
+#define ROUTE_SYNC_PRIO_IP6	1024	/* IP6_RT_PRIO_USER */
+
+/* nexthop flags a route is configured with, the rest is state */
+#define ROUTE_SYNC_NH_FLAGS	(RTNH_F_ONLINK | RTNH_F_PERVASIVE)
+
+struct route_key {
+	__u8	family;
+	__u8	dst_len;
+	__u8	src_len;
+	__u8	tos;
+	__u32	priority;
+	__u8	dst[16];
+	__u8	src[16];
+};
+
+struct route_sync_entry {
+	struct route_key	key;
+	size_t			off;	/* of the dumped message */
+	unsigned int		next;	/* hash chain, index + 1 */
+	int			wanted;	/* line asking for it, 0 if none */
+};
+
+struct route_sync {
+	const char		*name;
+	__u32			table;
+	int			any_proto;
+	struct route_sync_entry	*routes;
+	unsigned int		count;
+	unsigned int		max;
+	unsigned int		*hash;
+	unsigned int		hmask;
+	char			*msgs;
+	size_t			len;
+	size_t			size;
+	struct rtnl_txq		changes;
+	unsigned int		added, changed, deleted, unchanged;
+	int			del_failed;
+	int			ret;
+	/* the families routes may be deleted from */
+	bool			inet, inet6;
+};
+
+static void route_key_get(const struct rt_route *r, struct route_key *k)
+{
+	const struct rtattr *dst = r->tb[RTA_DST], *src = r->tb[RTA_SRC];
+
+	memset(k, 0, sizeof(*k));
+	k->family = r->family;
+	k->dst_len = r->dst_len;
+	k->src_len = r->src_len;
+	k->tos = r->rtm->rtm_tos;
+	k->priority = r->priority;
+	if (k->family == AF_INET6 && !k->priority)
+		k->priority = ROUTE_SYNC_PRIO_IP6;
+	if (dst && RTA_PAYLOAD(dst) <= sizeof(k->dst))
+		memcpy(k->dst, RTA_DATA(dst), RTA_PAYLOAD(dst));
+	if (src && RTA_PAYLOAD(src) <= sizeof(k->src))
+		memcpy(k->src, RTA_DATA(src), RTA_PAYLOAD(src));
+}
+
+static unsigned int route_key_hash(const struct route_key *k)
+{
+	const __u8 *p = (const __u8 *)k;
+	__u32 h = 2166136261U;
+	int i;
+
+	for (i = 0; i < sizeof(*k); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+static int route_sync_dump(const struct sockaddr_nl *who,
 			   struct nlmsghdr *n, void *arg)
 {
-	struct rtmsg *r = NLMSG_DATA(n);
-	struct rtattr *tb[RTA_MAX+1];
-	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
-	int ret, prio = *(int *)arg;
+	struct route_sync *rs = arg;
+	struct route_sync_entry *e;
+	struct rt_route r;
 
-	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	if (n->nlmsg_type != RTM_NEWROUTE || rt_route_parse(n, &r) < 0)
+		return 0;
+	if (r.family != AF_INET && r.family != AF_INET6)
+		return 0;
+	if (!filter_nlmsg(n, r.tb, af_bit_len(r.family)))
+		return 0;
 
-	/* Restore routes in correct order:
-	 * 0. ones for local addresses,
-	 * 1. ones for local networks,
-	 * 2. others (remote networks/hosts).
-	 */
-	if (!prio && !tb[RTA_GATEWAY] && (!tb[RTA_PREFSRC] ||
-	    !rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST])))
-		goto restore;
-	else if (prio == 1 && !tb[RTA_GATEWAY] && tb[RTA_PREFSRC] &&
-		 rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST]))
-		goto restore;
-	else if (prio == 2 && tb[RTA_GATEWAY])
-		goto restore;
+	if (rs->count == rs->max) {
+		unsigned int max = rs->max ? 2 * rs->max : 1024;
+
+		e = realloc(rs->routes, max * sizeof(*e));
+		if (!e)
+			goto oom;
+		rs->routes = e;
+		rs->max = max;
+	}
+	if (rs->len + n->nlmsg_len > rs->size) {
+		size_t size = rs->size ? 2 * rs->size : 65536;
+		char *msgs;
+
+		while (size < rs->len + n->nlmsg_len)
+			size *= 2;
+		msgs = realloc(rs->msgs, size);
+		if (!msgs)
+			goto oom;
+		rs->msgs = msgs;
+		rs->size = size;
+	}
+
+	e = &rs->routes[rs->count++];
+	route_key_get(&r, &e->key);
+	e->off = rs->len;
+	e->wanted = 0;
+	memcpy(rs->msgs + rs->len, n, n->nlmsg_len);
+	rs->len += NLMSG_ALIGN(n->nlmsg_len);
+	return 0;
+
+oom:
+	fprintf(stderr, "Cannot index routes: %s\n", strerror(errno));
+	return -1;
+}
+
+static int route_sync_index(struct route_sync *rs)
+{
+	unsigned int size = 16, i;
 
+	while (size < 2 * rs->count)
+		size *= 2;
+	rs->hash = calloc(size, sizeof(*rs->hash));
+	if (!rs->hash) {
+		perror("Cannot index routes");
+		return -1;
+	}
+	rs->hmask = size - 1;
+
+	for (i = 0; i < rs->count; i++) {
+		struct route_sync_entry *e = &rs->routes[i];
+		unsigned int h = route_key_hash(&e->key) & rs->hmask;
+
+		e->next = rs->hash[h];
+		rs->hash[h] = i + 1;
+	}
 	return 0;
+}
 
-restore:
-	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
+static struct route_sync_entry *route_sync_find(struct route_sync *rs,
+						const struct route_key *k)
+{
+	unsigned int i = rs->hash[route_key_hash(k) & rs->hmask];
 
-	ll_init_map(&rth);
+	while (i) {
+		struct route_sync_entry *e = &rs->routes[i - 1];
 
-	ret = rtnl_talk(&rth, n, NULL);
-	if ((ret < 0) && (errno == EEXIST))
-		ret = 0;
+		if (!memcmp(&e->key, k, sizeof(*k)))
+			return e;
+		i = e->next;
+	}
+	return NULL;
+}
 
-	return ret;
+/* an attribute that is not there is as good as one of zeroes */
+static int route_attr_same(const struct rtattr *a, const struct rtattr *b)
+{
+	const struct rtattr *rta = a ? : b;
+	const __u8 *p;
+	int i;
+
+	if (a && b)
+		return RTA_PAYLOAD(a) == RTA_PAYLOAD(b) &&
+		       !memcmp(RTA_DATA(a), RTA_DATA(b), RTA_PAYLOAD(a));
+	if (!rta)
+		return 1;
+
+	p = RTA_DATA(rta);
+	for (i = 0; i < RTA_PAYLOAD(rta); i++)
+		if (p[i])
+			return 0;
+	return 1;
 }
 
-static int route_dump_check_magic(void)
+static int route_metrics_same(const struct rtattr *a, const struct rtattr *b)
 {
-	int ret;
-	__u32 magic = 0;
+	struct rtattr *ma[RTAX_MAX + 1] = {}, *mb[RTAX_MAX + 1] = {};
+	int i;
 
-	if (isatty(STDIN_FILENO)) {
-		fprintf(stderr, "Can't restore route dump from a terminal\n");
-		return -1;
+	if (a)
+		parse_rtattr_nested(ma, RTAX_MAX, (struct rtattr *)a);
+	if (b)
+		parse_rtattr_nested(mb, RTAX_MAX, (struct rtattr *)b);
+
+	for (i = 1; i <= RTAX_MAX; i++)
+		if (!route_attr_same(ma[i], mb[i]))
+			return 0;
+	return 1;
+}
+
+static int route_nexthops_same(const struct rtattr *a, const struct rtattr *b)
+{
+	const struct rtnexthop *x, *y;
+	int xlen, ylen;
+
+	if (!a || !b)
+		return a == b;
+
+	x = RTA_DATA(a);
+	xlen = RTA_PAYLOAD(a);
+	y = RTA_DATA(b);
+	ylen = RTA_PAYLOAD(b);
+	while (xlen >= sizeof(*x) && ylen >= sizeof(*y)) {
+		if (x->rtnh_len < sizeof(*x) || x->rtnh_len != y->rtnh_len ||
+		    x->rtnh_hops != y->rtnh_hops ||
+		    (x->rtnh_ifindex && x->rtnh_ifindex != y->rtnh_ifindex) ||
+		    ((x->rtnh_flags ^ y->rtnh_flags) & ROUTE_SYNC_NH_FLAGS))
+			return 0;
+		if (memcmp(RTNH_DATA(x), RTNH_DATA(y),
+			   x->rtnh_len - sizeof(*x)))
+			return 0;
+		xlen -= RTNH_ALIGN(x->rtnh_len);
+		x = RTNH_NEXT(x);
+		ylen -= RTNH_ALIGN(y->rtnh_len);
+		y = RTNH_NEXT(y);
 	}
+	return xlen <= 0 && ylen <= 0;
+}
 
-	ret = fread(&magic, sizeof(magic), 1, stdin);
-	if (magic != route_dump_magic) {
-		fprintf(stderr, "Magic mismatch (%d elems, %x magic)\n", ret, magic);
-		return -1;
+/* would replacing have with want change anything? */
+static int route_same(const struct rt_route *want, const struct rt_route *have)
+{
+	const struct rtmsg *w = want->rtm, *h = have->rtm;
+	int i;
+
+	if (w->rtm_type != h->rtm_type ||
+	    w->rtm_protocol != h->rtm_protocol ||
+	    w->rtm_scope != h->rtm_scope ||
+	    ((w->rtm_flags ^ h->rtm_flags) & ROUTE_SYNC_NH_FLAGS))
+		return 0;
+
+	for (i = 1; i <= RTA_MAX; i++) {
+		switch (i) {
+		case RTA_DST:
+		case RTA_SRC:
+		case RTA_PRIORITY:
+		case RTA_TABLE:
+		case RTA_CACHEINFO:
+			continue;	/* the key, or the kernel's own */
+		case RTA_OIF:
+		case RTA_EXPIRES:
+			if (!want->tb[i])
+				continue;	/* up to the kernel */
+			break;
+		case RTA_METRICS:
+			if (!route_metrics_same(want->tb[i], have->tb[i]))
+				return 0;
+			continue;
+		case RTA_MULTIPATH:
+			if (!route_nexthops_same(want->tb[i], have->tb[i]))
+				return 0;
+			continue;
+		}
+		if (!route_attr_same(want->tb[i], have->tb[i]))
+			return 0;
 	}
+	return 1;
+}
 
+static int route_sync_queue(struct route_sync *rs, const struct nlmsghdr *n,
+			    __u32 lineno)
+{
+	struct nlmsghdr *q;
+
+	if (rtnl_txq_add(&rs->changes, n) < 0) {
+		perror("Cannot queue route");
+		return -1;
+	}
+	/* the line it comes from rides in nlmsg_seq until it is sent */
+	q = (struct nlmsghdr *)(rs->changes.buf + rs->changes.len -
+				NLMSG_ALIGN(n->nlmsg_len));
+	q->nlmsg_seq = lineno;
 	return 0;
 }
 
-static int iproute_restore(void)
+/* capture hook, gets the request each line of the file makes */
+static int route_sync_want(const struct nlmsghdr *n, void *arg)
 {
-	int pos, prio;
+	struct route_sync *rs = arg;
+	struct route_sync_entry *e;
+	struct route_key key;
+	struct rt_route want;
 
-	if (route_dump_check_magic())
+	if (rt_route_parse(n, &want) < 0)
+		return -1;
+	if (want.family != AF_INET && want.family != AF_INET6) {
+		fprintf(stderr, "%s:%d: only IPv4 and IPv6 routes can be synced\n",
+			rs->name, cmdlineno);
+		return -1;
+	}
+	if (want.table != rs->table) {
+		fprintf(stderr, "%s:%d: route is not in table %u\n",
+			rs->name, cmdlineno, rs->table);
 		return -1;
+	}
+	if (want.family == AF_INET)
+		rs->inet = true;
+	else
+		rs->inet6 = true;
+
+	route_key_get(&want, &key);
+	e = route_sync_find(rs, &key);
+	if (e && !e->wanted) {
+		struct rt_route have;
+
+		e->wanted = cmdlineno;
+		rt_route_parse((struct nlmsghdr *)(rs->msgs + e->off), &have);
+		if (route_same(&want, &have)) {
+			rs->unchanged++;
+			return 0;
+		}
+		rs->changed++;
+	} else if (!e) {
+		rs->added++;
+	}
 
-	pos = ftell(stdin);
-	if (pos == -1) {
-		perror("Failed to restore: ftell");
+	/* a route asked for again: the last line wins, as in a batch */
+	return route_sync_queue(rs, n, cmdlineno);
+}
+
+static void route_sync_err(__u32 cookie, int error, void *arg)
+{
+	struct route_sync *rs = arg;
+
+	rs->ret = -2;
+	if (cookie) {
+		fprintf(stderr, "%s:%u: RTNETLINK answers: %s\n",
+			rs->name, cookie, strerror(-error));
+		return;
+	}
+
+	/* a delete, the route may well have gone meanwhile */
+	if (error == -ESRCH || error == -ENOENT) {
+		rs->ret = 0;
+		return;
+	}
+	if (!rs->del_failed++)
+		fprintf(stderr, "Cannot delete route: %s\n", strerror(-error));
+}
+
+static int route_sync_send(struct route_sync *rs)
+{
+	struct rtnl_async *outer = rth.async;
+	int flags = rth.flags;
+	size_t off;
+
+	/* the dump left a batch's own queue, if any, empty */
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, route_sync_err, rs) < 0) {
+		rth.async = outer;
+		perror("Cannot pipeline routes");
 		return -1;
 	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
 
-	for (prio = 0; prio < 3; prio++) {
-		int err;
+	for (off = 0; off < rs->changes.len; ) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(rs->changes.buf + off);
 
-		err = rtnl_from_file(stdin, &restore_handler, &prio);
-		if (err)
-			return -2;
+		off += NLMSG_ALIGN(n->nlmsg_len);
+		rtnl_async_cookie(&rth, n->nlmsg_seq);
+		if (rtnl_talk(&rth, n, NULL) < 0)
+			rs->ret = -2;
+	}
 
-		if (fseek(stdin, pos, SEEK_SET) == -1) {
-			perror("Failed to restore: fseek");
-			return -1;
+	if (rtnl_async_end(&rth) < 0)
+		rs->ret = -2;
+	rth.async = outer;
+	rth.flags = flags;
+	return rs->ret;
+}
+
+static int route_sync_lines(struct route_sync *rs, FILE *fp,
+			    const char *table, const char *proto)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	rth.capture = route_sync_want;
+	rth.capture_arg = rs;
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[BATCH_MAX_ARGS];
+		int largc = 0;
+
+		/* the line may name the table again, but not another one */
+		largv[largc++] = "table";
+		largv[largc++] = (char *)table;
+		if (proto) {
+			largv[largc++] = "proto";
+			largv[largc++] = (char *)proto;
+		}
+		ret = makeargs(line, largv + largc, BATCH_MAX_ARGS - largc);
+		if (ret == 0)
+			continue;	/* blank line */
+
+		ret = iproute_modify(RTM_NEWROUTE, NLM_F_CREATE|NLM_F_REPLACE,
+				     largc + ret, largv);
+		if (ret < 0) {
+			fprintf(stderr, "Cannot sync %s:%d\n",
+				rs->name, cmdlineno);
+			break;
 		}
 	}
+	free(line);
 
-	return 0;
+	rth.capture = NULL;
+	return ret;
 }
 
-static int show_handler(const struct sockaddr_nl *nl,
-			struct rtnl_ctrl_data *ctrl,
-			struct nlmsghdr *n, void *arg)
+static void route_sync_deletes(struct route_sync *rs)
 {
-	print_route(nl, n, stdout);
-	return 0;
+	unsigned int i;
+
+	for (i = 0; i < rs->count; i++) {
+		struct route_sync_entry *e = &rs->routes[i];
+		struct nlmsghdr *n = (struct nlmsghdr *)(rs->msgs + e->off);
+		struct rtmsg *r = NLMSG_DATA(n);
+
+		if (e->wanted)
+			continue;
+		if (!(r->rtm_family == AF_INET ? rs->inet : rs->inet6))
+			continue;
+		/* the kernel puts those back only when addresses change */
+		if (r->rtm_protocol == RTPROT_KERNEL && rs->any_proto)
+			continue;
+		if (rtnl_flush_add(&rs->changes, n, RTM_DELROUTE) < 0) {
+			rs->ret = -2;
+			return;
+		}
+		n = (struct nlmsghdr *)(rs->changes.buf + rs->changes.len -
+					NLMSG_ALIGN(n->nlmsg_len));
+		n->nlmsg_seq = 0;
+		rs->deleted++;
+	}
 }
 
-static int iproute_showdump(void)
+static int iproute_sync(int argc, char **argv)
 {
-	if (route_dump_check_magic())
-		return -1;
+	struct route_sync rs = { .table = RT_TABLE_MAIN, .any_proto = 1 };
+	const char *table = "main", *proto = NULL;
+	int saved_lineno = cmdlineno;
+	FILE *fp = stdin;
+	int ret = -2;
 
-	if (rtnl_from_file(stdin, &show_handler, NULL))
-		return -2;
+	iproute_reset_filter(0);
+	rs.name = "-";
 
-	return 0;
+	while (argc > 0) {
+		if (matches(*argv, "table") == 0) {
+			__u32 tid;
+
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&tid, *argv) || !tid)
+				invarg("table id value is invalid\n", *argv);
+			rs.table = tid;
+			table = *argv;
+		} else if (matches(*argv, "protocol") == 0) {
+			__u32 prot;
+
+			NEXT_ARG();
+			if (rtnl_rtprot_a2n(&prot, *argv))
+				invarg("invalid \"protocol\"\n", *argv);
+			filter.protocol = prot;
+			filter.protocolmask = -1;
+			rs.any_proto = 0;
+			proto = *argv;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			rs.name = *argv;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown argument\n", *argv);
+		}
+		argc--; argv++;
+	}
+	filter.tb = rs.table;
+	/* without -4 or -6, only the families the file has routes of */
+	rs.inet = preferred_family == AF_INET;
+	rs.inet6 = preferred_family == AF_INET6;
+
+	if (strcmp(rs.name, "-") != 0) {
+		fp = fopen(rs.name, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				rs.name, strerror(errno));
+			return -1;
+		}
+	}
+
+	/* devices are looked up while requests are being captured */
+	ll_init_map(&rth);
+
+	if (rtnl_routedump_req(&rth, preferred_family, iproute_dump_filter) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, route_sync_dump, &rs) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+	if (route_sync_index(&rs) < 0)
+		goto out;
+
+	/* nothing is changed unless the whole file makes sense */
+	if (route_sync_lines(&rs, fp, table, proto) < 0)
+		goto out;
+
+	/* new routes go in before old ones go away */
+	route_sync_deletes(&rs);
+	if (rs.ret == 0)
+		ret = route_sync_send(&rs);
+
+	if (show_stats)
+		printf("%u added, %u changed, %u deleted, %u unchanged\n",
+		       rs.added, rs.changed, rs.deleted, rs.unchanged);
+
+out:
+	cmdlineno = saved_lineno;
+	if (fp != stdin)
+		fclose(fp);
+	rtnl_txq_free(&rs.changes);
+	free(rs.hash);
+	free(rs.routes);
+	free(rs.msgs);
+	return ret;
 }
 
 void iproute_reset_filter(int ifindex)
@@ -2261,14 +3850,25 @@ int do_iproute(int argc, char **argv)
 		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_LIST);
 	if (matches(*argv, "get") == 0)
 		return iproute_get(argc-1, argv+1);
+	if (strcmp(*argv, "lookup") == 0)
+		return do_iproute_lookup(argc-1, argv+1);
+	if (strcmp(*argv, "nhgroup") == 0)
+		return iproute_nhgroup(argc-1, argv+1);
+	if (strcmp(*argv, "encap") == 0)
+		return do_lwt_template(argc-1, argv+1);
 	if (matches(*argv, "flush") == 0)
 		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_FLUSH);
 	if (matches(*argv, "save") == 0)
 		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_SAVE);
 	if (matches(*argv, "restore") == 0)
-		return iproute_restore();
+		return iproute_restore(argc-1, argv+1);
 	if (matches(*argv, "showdump") == 0)
 		return iproute_showdump();
+	if (strcmp(*argv, "summary") == 0)
+		return iproute_list_flush_or_save(argc-1, argv+1,
+						  IPROUTE_SUMMARY);
+	if (strcmp(*argv, "sync") == 0)
+		return iproute_sync(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		return usage();
 
@@ -0,0 +1,1204 @@
+/*
+ * iproute_lookup.c	"ip route lookup", policy routing decisions computed
+ *			from a route dump rather than asked of the kernel.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The routes, live or from an "ip route save" file, are indexed per
+ * table in a poptrie: nodes of 64 slots, 6 bits of the address each,
+ * with a bitmap of the slots that have a child and one of the slots
+ * where a new run of equal leaves starts, so both children and leaves
+ * are found by counting bits. A leaf is the longest prefix covering
+ * it; the routes of a prefix are kept in the order the kernel tries
+ * them, and a prefix none of whose routes fit the query falls back to
+ * the next shorter one. Rules, live, from an "ip rule save" file, or
+ * the kernel's defaults, are evaluated in priority order like
+ * fib_rules_lookup() does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+#include <linux/fib_rules.h>
+
+#include "rt_names.h"
+#include "utils.h"
+#include "ip_common.h"
+#include "json_print.h"
+
+#define LPM_NONE	(~0U)
+#define LPM_STRIDE	6
+
+struct lpm_route {
+	size_t		off;		/* of the message */
+	int		family;
+	__u32		table;
+	__u8		dst[16];	/* masked to dst_len */
+	__u8		src[16];
+	__u8		dst_len;
+	__u8		src_len;
+	__u8		tos;
+	__u8		type;
+	__u32		priority;
+	int		dead;		/* so is every nexthop */
+};
+
+struct lpm_prefix {
+	__u8		addr[16];
+	int		len;
+	unsigned int	first;		/* of its routes */
+	unsigned int	count;
+	__u32		parent;		/* next shorter prefix covering it */
+};
+
+struct lpm_node {
+	__u64		vector;		/* slots with a child */
+	__u64		leafvec;	/* slots starting a run of leaves */
+	__u32		base1;		/* first child */
+	__u32		base0;		/* first leaf */
+};
+
+struct lpm_table {
+	int			family;
+	__u32			id;
+	struct lpm_route	*routes;
+	struct lpm_prefix	*prefixes;
+	unsigned int		nprefixes;
+	struct lpm_node		*nodes;
+	unsigned int		nnodes;
+	unsigned int		maxnodes;
+	__u32			*leaves;	/* prefix indexes */
+	unsigned int		nleaves;
+	unsigned int		maxleaves;
+};
+
+struct lpm_rule {
+	size_t		off;		/* of the message, if any */
+	unsigned int	seq;
+	int		family;
+	__u32		prio;
+	__u8		action;
+	__u8		dst_len;
+	__u8		src_len;
+	__u8		tos;
+	int		invert;
+	__u8		dst[16];
+	__u8		src[16];
+	__u32		mark;
+	__u32		mask;
+	const char	*iif;		/* NULL for any */
+	const char	*oif;
+	__u32		uid_start;
+	__u32		uid_end;
+	__u8		ipproto;
+	__u16		sport[2];
+	__u16		dport[2];
+	__u32		table;
+	__u32		target;		/* of FR_ACT_GOTO */
+	int		suppress_len;
+	unsigned int	jump;		/* rule FR_ACT_GOTO lands on */
+	struct lpm_table *tbl;
+};
+
+struct lpm_query {
+	int		family;
+	int		bytes;
+	__u8		dst[16];
+	__u8		src[16];
+	int		has_src;
+	const char	*iif;
+	const char	*oif;
+	int		oif_index;
+	__u32		mark;
+	__u8		tos;
+	__u32		uid;
+	__u8		ipproto;
+	__u16		sport;
+	__u16		dport;
+};
+
+struct lpm {
+	char			*msgs;
+	size_t			len;
+	size_t			size;
+	struct lpm_route	*routes;
+	unsigned int		nroutes;
+	unsigned int		maxroutes;
+	struct lpm_table	*tables;
+	unsigned int		ntables;
+	struct lpm_rule		*rules;
+	unsigned int		nrules;
+	unsigned int		maxrules;
+	int			loading_rules;
+};
+
+struct lpm_result {
+	const struct lpm_rule	*rule;
+	const struct lpm_table	*tbl;
+	const struct lpm_route	*route;
+	const struct rtnexthop	*nh;	/* of a multipath route */
+	__u32			hash;
+	int			hashed;
+	int			error;
+};
+
+static const struct ipsave_ops lookup_route_ops = {
+	.what	= "route",
+	.magic	= 0x45311224,
+};
+
+static const struct ipsave_ops lookup_rule_ops = {
+	.what	= "rule",
+	.magic	= 0x71706986,
+};
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: ip route lookup [ snapshot FILE ] [ rules FILE ] [ QUERY ]\n"
+		"QUERY := [ to ] ADDRESS [ from ADDRESS ] [ iif STRING ] [ oif STRING ]\n"
+		"         [ mark NUMBER ] [ tos TOS ] [ uid NUMBER ]\n"
+		"         [ ipproto PROTOCOL ] [ sport NUMBER ] [ dport NUMBER ]\n"
+		"Without a QUERY, one is read from each line of stdin.\n");
+	iprt_exit(-1);
+}
+
+static void lpm_oom(void)
+{
+	fprintf(stderr, "Cannot allocate memory for route lookup\n");
+	iprt_exit(1);
+}
+
+static void *lpm_grow(void *p, unsigned int *max, size_t size)
+{
+	unsigned int n = *max ? 2 * *max : 1024;
+
+	p = realloc(p, n * size);
+	if (!p)
+		lpm_oom();
+	*max = n;
+	return p;
+}
+
+static size_t lpm_copy(struct lpm *lk, const struct nlmsghdr *n)
+{
+	size_t off = lk->len;
+
+	if (lk->len + n->nlmsg_len > lk->size) {
+		size_t size = lk->size ? 2 * lk->size : 65536;
+
+		while (size < lk->len + n->nlmsg_len)
+			size *= 2;
+		lk->msgs = realloc(lk->msgs, size);
+		if (!lk->msgs)
+			lpm_oom();
+		lk->size = size;
+	}
+	memcpy(lk->msgs + off, n, n->nlmsg_len);
+	lk->len += NLMSG_ALIGN(n->nlmsg_len);
+	return off;
+}
+
+static struct nlmsghdr *lpm_msg(const struct lpm *lk, size_t off)
+{
+	return (struct nlmsghdr *)(lk->msgs + off);
+}
+
+static void lpm_mask(__u8 *addr, int len)
+{
+	int i;
+
+	for (i = len / 8; i < 16; i++) {
+		if (i == len / 8 && len % 8)
+			addr[i] &= 0xff << (8 - len % 8);
+		else
+			addr[i] = 0;
+	}
+}
+
+static int lpm_match(const __u8 *a, const __u8 *b, int len)
+{
+	int bytes = len / 8, bits = len % 8;
+
+	if (memcmp(a, b, bytes))
+		return 0;
+	return !bits || !((a[bytes] ^ b[bytes]) & (0xff << (8 - bits)));
+}
+
+/* the LPM_STRIDE bits of addr at bit off, those past its end as zeroes */
+static unsigned int lpm_bits(const __u8 *a, int off)
+{
+	int byte = off / 8;
+	unsigned int v = a[byte] << 8;
+
+	if (byte + 1 < 16)
+		v |= a[byte + 1];
+	return (v >> (16 - LPM_STRIDE - off % 8)) & ((1 << LPM_STRIDE) - 1);
+}
+
+static void lpm_copy_addr(__u8 *to, const struct rtattr *rta)
+{
+	if (rta && RTA_PAYLOAD(rta) <= 16)
+		memcpy(to, RTA_DATA(rta), RTA_PAYLOAD(rta));
+}
+
+static int lpm_route_dead(const struct rtmsg *r, struct rtattr **tb)
+{
+	const struct rtnexthop *nh;
+	int len;
+
+	if (r->rtm_flags & RTNH_F_DEAD)
+		return 1;
+	if (!tb[RTA_MULTIPATH])
+		return 0;
+
+	nh = RTA_DATA(tb[RTA_MULTIPATH]);
+	len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+	for (; RTNH_OK(nh, len); len -= RTNH_ALIGN(nh->rtnh_len),
+				 nh = RTNH_NEXT(nh)) {
+		if (!(nh->rtnh_flags & RTNH_F_DEAD))
+			return 0;
+	}
+	return 1;
+}
+
+static void lpm_add_route(struct lpm *lk, struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX + 1];
+	struct lpm_route *e;
+
+	if (len < 0 || (r->rtm_family != AF_INET && r->rtm_family != AF_INET6))
+		return;
+	if (r->rtm_flags & RTM_F_CLONED)
+		return;
+	if (r->rtm_dst_len > af_bit_len(r->rtm_family) ||
+	    r->rtm_src_len > af_bit_len(r->rtm_family))
+		return;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	if (lk->nroutes == lk->maxroutes)
+		lk->routes = lpm_grow(lk->routes, &lk->maxroutes,
+				      sizeof(*lk->routes));
+	e = &lk->routes[lk->nroutes++];
+	memset(e, 0, sizeof(*e));
+	e->family = r->rtm_family;
+	e->table = rtm_get_table(r, tb);
+	e->dst_len = r->rtm_dst_len;
+	e->src_len = r->rtm_src_len;
+	e->tos = r->rtm_tos;
+	e->type = r->rtm_type;
+	e->dead = lpm_route_dead(r, tb);
+	if (tb[RTA_PRIORITY])
+		e->priority = rta_getattr_u32(tb[RTA_PRIORITY]);
+	lpm_copy_addr(e->dst, tb[RTA_DST]);
+	lpm_copy_addr(e->src, tb[RTA_SRC]);
+	lpm_mask(e->dst, e->dst_len);
+	lpm_mask(e->src, e->src_len);
+	e->off = lpm_copy(lk, n);
+}
+
+static void lpm_add_rule(struct lpm *lk, struct nlmsghdr *n)
+{
+	struct fib_rule_hdr *frh = NLMSG_DATA(n);
+	struct lpm_rule *e;
+
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*frh)))
+		return;
+	if (frh->family != AF_INET && frh->family != AF_INET6)
+		return;
+
+	if (lk->nrules == lk->maxrules)
+		lk->rules = lpm_grow(lk->rules, &lk->maxrules,
+				     sizeof(*lk->rules));
+	e = &lk->rules[lk->nrules];
+	memset(e, 0, sizeof(*e));
+	e->seq = lk->nrules++;
+	e->off = lpm_copy(lk, n);
+}
+
+static int lpm_save_cb(const struct sockaddr_nl *who,
+		       struct rtnl_ctrl_data *ctrl,
+		       struct nlmsghdr *n, void *arg)
+{
+	struct lpm *lk = arg;
+
+	if (n->nlmsg_type == RTM_NEWROUTE && !lk->loading_rules)
+		lpm_add_route(lk, n);
+	else if (n->nlmsg_type == RTM_NEWRULE && lk->loading_rules)
+		lpm_add_rule(lk, n);
+	return 0;
+}
+
+static int lpm_dump_cb(const struct sockaddr_nl *who,
+		       struct nlmsghdr *n, void *arg)
+{
+	return lpm_save_cb(who, NULL, n, arg);
+}
+
+static int lpm_load_file(struct lpm *lk, const char *name,
+			 const struct ipsave_ops *ops)
+{
+	int fd, ret;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+	ret = ipsave_show(ops, fd, lpm_save_cb, lk);
+	close(fd);
+	return ret < 0 ? -1 : 0;
+}
+
+static int lpm_load_live(struct lpm *lk, int type)
+{
+	if (rtnl_wilddump_request(&rth, preferred_family, type) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, lpm_dump_cb, lk) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* the order the kernel tries the routes of a prefix in */
+static int lpm_route_cmp(const void *a, const void *b)
+{
+	const struct lpm_route *x = a, *y = b;
+	int ret;
+
+	if (x->family != y->family)
+		return x->family - y->family;
+	if (x->table != y->table)
+		return x->table < y->table ? -1 : 1;
+	ret = memcmp(x->dst, y->dst, sizeof(x->dst));
+	if (ret)
+		return ret;
+	if (x->dst_len != y->dst_len)
+		return x->dst_len - y->dst_len;
+	if (x->src_len != y->src_len)
+		return y->src_len - x->src_len;
+	ret = memcmp(x->src, y->src, sizeof(x->src));
+	if (ret)
+		return ret;
+	if (x->tos != y->tos)
+		return y->tos - x->tos;
+	if (x->priority != y->priority)
+		return x->priority < y->priority ? -1 : 1;
+	return x->off < y->off ? -1 : 1;
+}
+
+static unsigned int lpm_new_nodes(struct lpm_table *t, unsigned int count)
+{
+	unsigned int first = t->nnodes;
+
+	while (t->nnodes + count > t->maxnodes)
+		t->nodes = lpm_grow(t->nodes, &t->maxnodes, sizeof(*t->nodes));
+	memset(&t->nodes[first], 0, count * sizeof(*t->nodes));
+	t->nnodes += count;
+	return first;
+}
+
+/*
+ * Fill node, which covers the addresses sharing their first off bits
+ * with prefixes lo to hi, from those longer than off. inherit is the
+ * longest prefix covering all of it.
+ */
+static void lpm_build(struct lpm_table *t, unsigned int node, int off,
+		      unsigned int lo, unsigned int hi, __u32 inherit)
+{
+	__u32 leaf[1 << LPM_STRIDE];
+	unsigned int start[1 << LPM_STRIDE], end[1 << LPM_STRIDE];
+	__u64 vector = 0, leafvec = 0;
+	unsigned int i, nchild = 0, base1, base0;
+	int s, len;
+	__u32 prev = LPM_NONE;
+
+	for (s = 0; s < 1 << LPM_STRIDE; s++)
+		leaf[s] = inherit;
+
+	/* prefixes ending in this node, shorter ones overwritten */
+	for (len = off + 1; len <= off + LPM_STRIDE; len++) {
+		for (i = lo; i < hi; i++) {
+			const struct lpm_prefix *p = &t->prefixes[i];
+			int n;
+
+			if (p->len != len)
+				continue;
+			s = lpm_bits(p->addr, off);
+			for (n = 1 << (off + LPM_STRIDE - len); n > 0; n--)
+				leaf[s++] = i;
+		}
+	}
+
+	/* longer ones go to children, in address order */
+	for (i = lo; i < hi; i++) {
+		const struct lpm_prefix *p = &t->prefixes[i];
+
+		if (p->len <= off + LPM_STRIDE)
+			continue;
+		s = lpm_bits(p->addr, off);
+		if (!(vector & (1ULL << s))) {
+			vector |= 1ULL << s;
+			start[s] = i;
+			nchild++;
+		}
+		end[s] = i + 1;
+	}
+
+	base0 = t->nleaves;
+	for (s = 0; s < 1 << LPM_STRIDE; s++) {
+		/* slots with a child never read their leaf */
+		__u32 v = vector & (1ULL << s) && s ? prev : leaf[s];
+
+		if (s && v == prev)
+			continue;
+		if (t->nleaves == t->maxleaves)
+			t->leaves = lpm_grow(t->leaves, &t->maxleaves,
+					     sizeof(*t->leaves));
+		t->leaves[t->nleaves++] = v;
+		leafvec |= 1ULL << s;
+		prev = v;
+	}
+
+	base1 = lpm_new_nodes(t, nchild);
+	t->nodes[node].vector = vector;
+	t->nodes[node].leafvec = leafvec;
+	t->nodes[node].base1 = base1;
+	t->nodes[node].base0 = base0;
+
+	for (s = 0; s < 1 << LPM_STRIDE; s++) {
+		if (vector & (1ULL << s))
+			lpm_build(t, base1++, off + LPM_STRIDE,
+				  start[s], end[s], leaf[s]);
+	}
+}
+
+static __u32 lpm_find(const struct lpm_table *t, const __u8 *addr)
+{
+	const struct lpm_node *nd = t->nodes;
+	int off = 0;
+
+	for (;;) {
+		unsigned int s = lpm_bits(addr, off);
+		__u64 m = ~0ULL >> (63 - s);
+
+		if (!(nd->vector & (1ULL << s)))
+			return t->leaves[nd->base0 +
+					 __builtin_popcountll(nd->leafvec & m) - 1];
+		nd = &t->nodes[nd->base1 + __builtin_popcountll(nd->vector & m) - 1];
+		off += LPM_STRIDE;
+	}
+}
+
+static void lpm_index(struct lpm_table *t, struct lpm_route *routes,
+		      unsigned int count)
+{
+	__u32 stack[129];
+	unsigned int i, depth = 0;
+
+	t->routes = routes;
+	t->prefixes = calloc(count ? : 1, sizeof(*t->prefixes));
+	if (!t->prefixes)
+		lpm_oom();
+
+	for (i = 0; i < count; i++) {
+		struct lpm_prefix *p;
+
+		if (t->nprefixes) {
+			p = &t->prefixes[t->nprefixes - 1];
+			if (p->len == routes[i].dst_len &&
+			    !memcmp(p->addr, routes[i].dst, sizeof(p->addr))) {
+				p->count++;
+				continue;
+			}
+		}
+
+		p = &t->prefixes[t->nprefixes];
+		memcpy(p->addr, routes[i].dst, sizeof(p->addr));
+		p->len = routes[i].dst_len;
+		p->first = i;
+		p->count = 1;
+
+		while (depth) {
+			const struct lpm_prefix *up =
+				&t->prefixes[stack[depth - 1]];
+
+			if (up->len < p->len &&
+			    lpm_match(up->addr, p->addr, up->len))
+				break;
+			depth--;
+		}
+		p->parent = depth ? stack[depth - 1] : LPM_NONE;
+		stack[depth++] = t->nprefixes++;
+	}
+
+	lpm_new_nodes(t, 1);
+	if (t->nprefixes && t->prefixes[0].len == 0)
+		lpm_build(t, 0, 0, 1, t->nprefixes, 0);
+	else
+		lpm_build(t, 0, 0, 0, t->nprefixes, LPM_NONE);
+}
+
+static struct lpm_table *lpm_table(const struct lpm *lk, int family,
+				   __u32 id)
+{
+	unsigned int i;
+
+	for (i = 0; i < lk->ntables; i++) {
+		if (lk->tables[i].family == family && lk->tables[i].id == id)
+			return &lk->tables[i];
+	}
+	return NULL;
+}
+
+static void lpm_build_tables(struct lpm *lk)
+{
+	unsigned int i, first;
+
+	qsort(lk->routes, lk->nroutes, sizeof(*lk->routes), lpm_route_cmp);
+
+	lk->tables = calloc(lk->nroutes ? : 1, sizeof(*lk->tables));
+	if (!lk->tables)
+		lpm_oom();
+
+	for (first = 0; first < lk->nroutes; first = i) {
+		struct lpm_table *t = &lk->tables[lk->ntables++];
+
+		for (i = first; i < lk->nroutes; i++) {
+			if (lk->routes[i].family != lk->routes[first].family ||
+			    lk->routes[i].table != lk->routes[first].table)
+				break;
+		}
+		t->family = lk->routes[first].family;
+		t->id = lk->routes[first].table;
+		lpm_index(t, &lk->routes[first], i - first);
+	}
+}
+
+static void lpm_parse_rule(struct lpm *lk, struct lpm_rule *e)
+{
+	struct nlmsghdr *n = lpm_msg(lk, e->off);
+	struct fib_rule_hdr *frh = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*frh));
+	struct rtattr *tb[FRA_MAX + 1];
+
+	parse_rtattr(tb, FRA_MAX, RTM_RTA(frh), len);
+
+	e->family = frh->family;
+	e->action = frh->action;
+	e->dst_len = frh->dst_len;
+	e->src_len = frh->src_len;
+	e->tos = frh->tos;
+	e->invert = !!(frh->flags & FIB_RULE_INVERT);
+	e->table = frh->table;
+	e->uid_end = ~0U;
+	e->suppress_len = -1;
+	e->jump = LPM_NONE;
+
+	if (tb[FRA_PRIORITY])
+		e->prio = rta_getattr_u32(tb[FRA_PRIORITY]);
+	if (tb[FRA_TABLE])
+		e->table = rta_getattr_u32(tb[FRA_TABLE]);
+	if (tb[FRA_GOTO])
+		e->target = rta_getattr_u32(tb[FRA_GOTO]);
+	lpm_copy_addr(e->dst, tb[FRA_DST]);
+	lpm_copy_addr(e->src, tb[FRA_SRC]);
+	if (tb[FRA_FWMARK]) {
+		e->mark = rta_getattr_u32(tb[FRA_FWMARK]);
+		if (e->mark)
+			e->mask = ~0U;
+	}
+	if (tb[FRA_FWMASK])
+		e->mask = rta_getattr_u32(tb[FRA_FWMASK]);
+	if (tb[FRA_IIFNAME])
+		e->iif = rta_getattr_str(tb[FRA_IIFNAME]);
+	if (tb[FRA_OIFNAME])
+		e->oif = rta_getattr_str(tb[FRA_OIFNAME]);
+	if (tb[FRA_UID_RANGE] &&
+	    RTA_PAYLOAD(tb[FRA_UID_RANGE]) >= sizeof(struct fib_rule_uid_range)) {
+		struct fib_rule_uid_range *u = RTA_DATA(tb[FRA_UID_RANGE]);
+
+		e->uid_start = u->start;
+		e->uid_end = u->end;
+	}
+	if (tb[FRA_IP_PROTO])
+		e->ipproto = rta_getattr_u8(tb[FRA_IP_PROTO]);
+	if (tb[FRA_SPORT_RANGE] &&
+	    RTA_PAYLOAD(tb[FRA_SPORT_RANGE]) >= sizeof(struct fib_rule_port_range)) {
+		struct fib_rule_port_range *p = RTA_DATA(tb[FRA_SPORT_RANGE]);
+
+		e->sport[0] = p->start;
+		e->sport[1] = p->end;
+	}
+	if (tb[FRA_DPORT_RANGE] &&
+	    RTA_PAYLOAD(tb[FRA_DPORT_RANGE]) >= sizeof(struct fib_rule_port_range)) {
+		struct fib_rule_port_range *p = RTA_DATA(tb[FRA_DPORT_RANGE]);
+
+		e->dport[0] = p->start;
+		e->dport[1] = p->end;
+	}
+	if (tb[FRA_SUPPRESS_PREFIXLEN])
+		e->suppress_len = (int)rta_getattr_u32(tb[FRA_SUPPRESS_PREFIXLEN]);
+
+	if (tb[FRA_L3MDEV] && rta_getattr_u8(tb[FRA_L3MDEV])) {
+		fprintf(stderr,
+			"Warning: rule %u: l3mdev is not simulated, skipping the rule\n",
+			e->prio);
+		e->action = FR_ACT_NOP;
+	}
+	if (tb[FRA_SUPPRESS_IFGROUP] &&
+	    rta_getattr_u32(tb[FRA_SUPPRESS_IFGROUP]) != ~0U)
+		fprintf(stderr,
+			"Warning: rule %u: suppress_ifgroup is not simulated, ignoring it\n",
+			e->prio);
+}
+
+static int lpm_rule_cmp(const void *a, const void *b)
+{
+	const struct lpm_rule *x = a, *y = b;
+
+	if (x->prio != y->prio)
+		return x->prio < y->prio ? -1 : 1;
+	return x->seq < y->seq ? -1 : 1;
+}
+
+static void lpm_default_rule(struct lpm *lk, int family, __u32 prio,
+			     __u32 table)
+{
+	struct lpm_rule *e;
+
+	if (lk->nrules == lk->maxrules)
+		lk->rules = lpm_grow(lk->rules, &lk->maxrules,
+				     sizeof(*lk->rules));
+	e = &lk->rules[lk->nrules];
+	memset(e, 0, sizeof(*e));
+	e->seq = lk->nrules++;
+	e->off = (size_t)-1;
+	e->family = family;
+	e->prio = prio;
+	e->action = FR_ACT_TO_TBL;
+	e->table = table;
+	e->uid_end = ~0U;
+	e->suppress_len = -1;
+	e->jump = LPM_NONE;
+}
+
+static void lpm_build_rules(struct lpm *lk)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < lk->nrules; i++) {
+		if (lk->rules[i].off != (size_t)-1)
+			lpm_parse_rule(lk, &lk->rules[i]);
+	}
+	qsort(lk->rules, lk->nrules, sizeof(*lk->rules), lpm_rule_cmp);
+
+	for (i = 0; i < lk->nrules; i++) {
+		struct lpm_rule *e = &lk->rules[i];
+
+		e->tbl = lpm_table(lk, e->family, e->table);
+		if (e->action != FR_ACT_GOTO)
+			continue;
+		/* the kernel only lets a rule jump forward */
+		for (j = i + 1; j < lk->nrules; j++) {
+			if (lk->rules[j].family == e->family &&
+			    lk->rules[j].prio == e->target) {
+				e->jump = j;
+				break;
+			}
+		}
+	}
+}
+
+static int lpm_rule_match(const struct lpm_rule *r, const struct lpm_query *q)
+{
+	int match = 0;
+
+	if (r->iif && strcmp(r->iif, q->iif))
+		goto out;
+	if (r->oif && (!q->oif || strcmp(r->oif, q->oif)))
+		goto out;
+	if ((r->mark ^ q->mark) & r->mask)
+		goto out;
+	if (q->uid < r->uid_start || q->uid > r->uid_end)
+		goto out;
+	if (r->ipproto && r->ipproto != q->ipproto)
+		goto out;
+	if ((r->sport[0] || r->sport[1]) &&
+	    (q->sport < r->sport[0] || q->sport > r->sport[1]))
+		goto out;
+	if ((r->dport[0] || r->dport[1]) &&
+	    (q->dport < r->dport[0] || q->dport > r->dport[1]))
+		goto out;
+	if (r->src_len && !lpm_match(r->src, q->src, r->src_len))
+		goto out;
+	if (r->dst_len && !lpm_match(r->dst, q->dst, r->dst_len))
+		goto out;
+	if (r->tos && r->tos != q->tos)
+		goto out;
+	match = 1;
+out:
+	return r->invert ? !match : match;
+}
+
+static int lpm_route_has_oif(const struct lpm *lk, const struct lpm_route *e,
+			     int oif)
+{
+	struct nlmsghdr *n = lpm_msg(lk, e->off);
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX + 1];
+	const struct rtnexthop *nh;
+	int len;
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb[RTA_OIF])
+		return rta_getattr_u32(tb[RTA_OIF]) == oif;
+	if (!tb[RTA_MULTIPATH])
+		return 0;
+
+	nh = RTA_DATA(tb[RTA_MULTIPATH]);
+	len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+	for (; RTNH_OK(nh, len); len -= RTNH_ALIGN(nh->rtnh_len),
+				 nh = RTNH_NEXT(nh)) {
+		if (nh->rtnh_ifindex == oif && !(nh->rtnh_flags & RTNH_F_DEAD))
+			return 1;
+	}
+	return 0;
+}
+
+static const struct lpm_route *lpm_table_lookup(const struct lpm *lk,
+						const struct lpm_table *t,
+						const struct lpm_query *q)
+{
+	__u32 pfx = lpm_find(t, q->dst);
+
+	for (; pfx != LPM_NONE; pfx = t->prefixes[pfx].parent) {
+		const struct lpm_prefix *p = &t->prefixes[pfx];
+		unsigned int i;
+
+		for (i = p->first; i < p->first + p->count; i++) {
+			const struct lpm_route *e = &t->routes[i];
+
+			if (e->tos && e->tos != q->tos)
+				continue;
+			if (e->src_len && !lpm_match(e->src, q->src, e->src_len))
+				continue;
+			if (e->dead)
+				continue;
+			if (q->oif_index && e->type == RTN_UNICAST &&
+			    !lpm_route_has_oif(lk, e, q->oif_index))
+				continue;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The kernel hashes with a key chosen at boot, so which path it takes
+ * can't be known offline; this stands in for it with FNV-1a over the
+ * addresses and a final mix so that neighbouring ones spread, the same
+ * for every run, and picks a path by the weighted upper bounds the
+ * kernel uses.
+ */
+static __u32 lpm_hash(const struct lpm_query *q)
+{
+	__u32 h = 2166136261U;
+	int i;
+
+	for (i = 0; i < q->bytes; i++)
+		h = (h ^ q->src[i]) * 16777619U;
+	for (i = 0; i < q->bytes; i++)
+		h = (h ^ q->dst[i]) * 16777619U;
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h >> 1;
+}
+
+static void lpm_select_path(const struct lpm *lk, struct lpm_result *res,
+			    const struct lpm_query *q)
+{
+	struct nlmsghdr *n = lpm_msg(lk, res->route->off);
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX + 1];
+	const struct rtnexthop *nh;
+	__u64 total = 0, w = 0;
+	int len;
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (!tb[RTA_MULTIPATH])
+		return;
+
+	nh = RTA_DATA(tb[RTA_MULTIPATH]);
+	len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+	for (; RTNH_OK(nh, len); len -= RTNH_ALIGN(nh->rtnh_len),
+				 nh = RTNH_NEXT(nh)) {
+		if (nh->rtnh_flags & RTNH_F_DEAD)
+			continue;
+		/* with an oif the path is the one through it */
+		if (q->oif_index) {
+			if (nh->rtnh_ifindex == q->oif_index) {
+				res->nh = nh;
+				return;
+			}
+			continue;
+		}
+		total += nh->rtnh_hops + 1;
+	}
+	if (!total)
+		return;
+
+	res->hash = lpm_hash(q);
+	res->hashed = 1;
+	nh = RTA_DATA(tb[RTA_MULTIPATH]);
+	len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+	for (; RTNH_OK(nh, len); len -= RTNH_ALIGN(nh->rtnh_len),
+				 nh = RTNH_NEXT(nh)) {
+		if (nh->rtnh_flags & RTNH_F_DEAD)
+			continue;
+		w += nh->rtnh_hops + 1;
+		if (res->hash <= ((w << 31) + total / 2) / total - 1) {
+			res->nh = nh;
+			return;
+		}
+	}
+}
+
+static int lpm_route_error(int type)
+{
+	switch (type) {
+	case RTN_UNREACHABLE:
+		return EHOSTUNREACH;
+	case RTN_PROHIBIT:
+		return EACCES;
+	case RTN_BLACKHOLE:
+		return EINVAL;
+	}
+	return 0;
+}
+
+static void lpm_resolve(const struct lpm *lk, const struct lpm_query *q,
+			struct lpm_result *res)
+{
+	unsigned int i;
+
+	memset(res, 0, sizeof(*res));
+	res->error = ENETUNREACH;
+
+	for (i = 0; i < lk->nrules; i++) {
+		const struct lpm_rule *r = &lk->rules[i];
+		const struct lpm_route *e;
+
+		if (r->family != q->family || !lpm_rule_match(r, q))
+			continue;
+
+		switch (r->action) {
+		case FR_ACT_GOTO:
+			if (r->jump != LPM_NONE)
+				i = r->jump - 1;
+			continue;
+		case FR_ACT_NOP:
+			continue;
+		case FR_ACT_TO_TBL:
+			break;
+		case FR_ACT_UNREACHABLE:
+			res->rule = r;
+			res->error = ENETUNREACH;
+			return;
+		case FR_ACT_PROHIBIT:
+			res->rule = r;
+			res->error = EACCES;
+			return;
+		default:
+			res->rule = r;
+			res->error = EINVAL;
+			return;
+		}
+
+		if (!r->tbl)
+			continue;
+		e = lpm_table_lookup(lk, r->tbl, q);
+		if (!e || e->type == RTN_THROW)
+			continue;
+		if (!lpm_route_error(e->type) &&
+		    (int)e->dst_len <= r->suppress_len)
+			continue;
+
+		res->rule = r;
+		res->tbl = r->tbl;
+		res->route = e;
+		res->error = lpm_route_error(e->type);
+		if (!res->error)
+			lpm_select_path(lk, res, q);
+		return;
+	}
+}
+
+static void lpm_print_nexthop(const struct lpm_result *res, int family)
+{
+	const struct rtnexthop *nh = res->nh;
+	struct rtattr *tb[RTA_MAX + 1];
+
+	parse_rtattr(tb, RTA_MAX, RTNH_DATA(nh),
+		     nh->rtnh_len - sizeof(*nh));
+
+	open_json_object("nexthop");
+	print_string(PRINT_FP, NULL, "\tselected", NULL);
+	if (tb[RTA_GATEWAY])
+		print_string(PRINT_ANY, "gateway", " via %s",
+			     format_host_rta(family, tb[RTA_GATEWAY]));
+	print_string(PRINT_ANY, "dev", " dev %s",
+		     ll_index_to_name(nh->rtnh_ifindex));
+	if (res->hashed)
+		print_0xhex(PRINT_ANY, "hash", " hash 0x%08x", res->hash);
+	print_string(PRINT_FP, NULL, "\n", NULL);
+	close_json_object();
+}
+
+static void lpm_print(const struct lpm *lk, const struct lpm_query *q,
+		      const struct lpm_result *res)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	SPRINT_BUF(b1);
+
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "dst", "to %s",
+		     format_host(q->family, q->bytes, q->dst));
+	if (q->has_src)
+		print_string(PRINT_ANY, "from", " from %s",
+			     format_host(q->family, q->bytes, q->src));
+	if (res->rule)
+		print_uint(PRINT_ANY, "rule", " rule %u", res->rule->prio);
+	if (res->tbl)
+		print_string(PRINT_ANY, "table", " table %s",
+			     rtnl_rttable_n2a(res->tbl->id, b1, sizeof(b1)));
+	else if (res->rule && res->rule->action != FR_ACT_TO_TBL)
+		print_string(PRINT_ANY, "action", " %s",
+			     res->rule->action == FR_ACT_UNREACHABLE ?
+			     "unreachable" :
+			     res->rule->action == FR_ACT_PROHIBIT ?
+			     "prohibit" : "blackhole");
+	if (res->error)
+		print_string(PRINT_ANY, "error", ": %s", strerror(res->error));
+	print_string(PRINT_FP, NULL, "\n", NULL);
+
+	if (res->route) {
+		open_json_array(PRINT_JSON, "route");
+		print_route(&nladdr, lpm_msg(lk, res->route->off), stdout);
+		close_json_array(PRINT_JSON, NULL);
+		if (res->nh)
+			lpm_print_nexthop(res, q->family);
+	}
+	close_json_object();
+}
+
+/* a bad query is reported, not fatal to the ones after it */
+#define LPM_NEXT_ARG() do {			\
+		if (--argc <= 0)		\
+			goto missing;		\
+		argv++;				\
+	} while (0)
+
+static int lpm_parse_query(struct lpm_query *q, int argc, char **argv)
+{
+	inet_prefix addr;
+	int has_dst = 0;
+
+	memset(q, 0, sizeof(*q));
+	q->iif = "lo";
+
+	while (argc > 0) {
+		if (strcmp(*argv, "from") == 0) {
+			LPM_NEXT_ARG();
+			if (get_addr_1(&addr, *argv, preferred_family))
+				goto bad;
+			if (q->family && q->family != addr.family)
+				goto other;
+			q->family = addr.family;
+			memcpy(q->src, addr.data, addr.bytelen);
+			q->has_src = 1;
+		} else if (strcmp(*argv, "iif") == 0) {
+			LPM_NEXT_ARG();
+			q->iif = *argv;
+		} else if (strcmp(*argv, "oif") == 0) {
+			LPM_NEXT_ARG();
+			q->oif = *argv;
+			q->oif_index = ll_name_to_index(*argv);
+			if (!q->oif_index) {
+				fprintf(stderr, "Cannot find device \"%s\"\n",
+					*argv);
+				return -1;
+			}
+		} else if (strcmp(*argv, "mark") == 0) {
+			LPM_NEXT_ARG();
+			if (get_u32(&q->mark, *argv, 0))
+				goto bad;
+		} else if (strcmp(*argv, "tos") == 0 ||
+			   matches(*argv, "dsfield") == 0) {
+			__u32 tos;
+
+			LPM_NEXT_ARG();
+			if (rtnl_dsfield_a2n(&tos, *argv))
+				goto bad;
+			q->tos = tos;
+		} else if (strcmp(*argv, "uid") == 0) {
+			LPM_NEXT_ARG();
+			if (get_u32(&q->uid, *argv, 0))
+				goto bad;
+		} else if (strcmp(*argv, "ipproto") == 0) {
+			int proto;
+
+			LPM_NEXT_ARG();
+			proto = inet_proto_a2n(*argv);
+			if (proto < 0)
+				goto bad;
+			q->ipproto = proto;
+		} else if (strcmp(*argv, "sport") == 0) {
+			LPM_NEXT_ARG();
+			if (get_u16(&q->sport, *argv, 0))
+				goto bad;
+		} else if (strcmp(*argv, "dport") == 0) {
+			LPM_NEXT_ARG();
+			if (get_u16(&q->dport, *argv, 0))
+				goto bad;
+		} else {
+			if (strcmp(*argv, "to") == 0)
+				LPM_NEXT_ARG();
+			if (has_dst || get_addr_1(&addr, *argv, preferred_family))
+				goto bad;
+			if (q->family && q->family != addr.family)
+				goto other;
+			q->family = addr.family;
+			memcpy(q->dst, addr.data, addr.bytelen);
+			has_dst = 1;
+		}
+		argc--; argv++;
+	}
+
+	if (!has_dst) {
+		fprintf(stderr, "Need a destination address to look up\n");
+		return -1;
+	}
+	if (q->family != AF_INET && q->family != AF_INET6) {
+		fprintf(stderr, "Only IPv4 and IPv6 routes can be looked up\n");
+		return -1;
+	}
+	q->bytes = af_byte_len(q->family);
+	return 0;
+
+missing:
+	fprintf(stderr, "Argument missing after \"%s\"\n", *argv);
+	return -1;
+bad:
+	fprintf(stderr, "Invalid query argument \"%s\"\n", *argv);
+	return -1;
+other:
+	fprintf(stderr, "\"%s\" is of another family than the query\n", *argv);
+	return -1;
+}
+
+static int lpm_query(const struct lpm *lk, int argc, char **argv)
+{
+	struct lpm_result res;
+	struct lpm_query q;
+
+	if (lpm_parse_query(&q, argc, argv) < 0)
+		return -1;
+	lpm_resolve(lk, &q, &res);
+	lpm_print(lk, &q, &res);
+	return 0;
+}
+
+int do_iproute_lookup(int argc, char **argv)
+{
+	const char *snapshot = NULL, *rules = NULL;
+	struct lpm lk = {};
+	int ret = 0;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "snapshot") == 0) {
+			NEXT_ARG();
+			snapshot = *argv;
+		} else if (strcmp(*argv, "rules") == 0) {
+			NEXT_ARG();
+			rules = *argv;
+		} else if (strcmp(*argv, "help") == 0) {
+			usage();
+		} else {
+			break;
+		}
+		argc--; argv++;
+	}
+
+	ll_init_map(&rth);
+
+	if (snapshot ? lpm_load_file(&lk, snapshot, &lookup_route_ops) :
+		       lpm_load_live(&lk, RTM_GETROUTE))
+		return -1;
+
+	lk.loading_rules = 1;
+	if (rules) {
+		if (lpm_load_file(&lk, rules, &lookup_rule_ops) < 0)
+			return -1;
+	} else if (!snapshot) {
+		if (lpm_load_live(&lk, RTM_GETRULE) < 0)
+			return -1;
+	} else {
+		/* what a kernel starts with */
+		lpm_default_rule(&lk, AF_INET, 0, RT_TABLE_LOCAL);
+		lpm_default_rule(&lk, AF_INET, 32766, RT_TABLE_MAIN);
+		lpm_default_rule(&lk, AF_INET, 32767, RT_TABLE_DEFAULT);
+		lpm_default_rule(&lk, AF_INET6, 0, RT_TABLE_LOCAL);
+		lpm_default_rule(&lk, AF_INET6, 32766, RT_TABLE_MAIN);
+	}
+
+	lpm_build_tables(&lk);
+	lpm_build_rules(&lk);
+	iproute_reset_filter(0);
+
+	new_json_obj(json);
+	if (argc > 0) {
+		ret = lpm_query(&lk, argc, argv);
+	} else {
+		char *line = NULL;
+		size_t len = 0;
+
+		cmdlineno = 0;
+		while (getcmdline(&line, &len, stdin) != -1) {
+			char *largv[BATCH_MAX_ARGS];
+			int largc;
+
+			largc = makeargs(line, largv, BATCH_MAX_ARGS);
+			if (largc == 0)
+				continue;	/* blank line */
+			if (lpm_query(&lk, largc, largv) < 0) {
+				fprintf(stderr, "Bad query at line %d\n",
+					cmdlineno);
+				ret = -1;
+			}
+		}
+		free(line);
+	}
+	delete_json_obj();
+	return ret;
+}
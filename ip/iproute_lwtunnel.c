@@ -90,8 +90,55 @@ static int read_encap_type(const char *name)
 	return LWTUNNEL_ENCAP_NONE;
 }
 
+/*
+ * The routes of an SR policy share their SRH, so the segments of the
+ * last SRHs seen are kept formatted, in a small table indexed by a hash
+ * of the whole header.
+ */
+#define SRH_MEMO_SIZE	64
+
+struct srh_memo {
+	struct ipv6_sr_hdr	*srh;	/* copy, as long as hdrlen says */
+	int			nsegs;
+	char			(*segs)[INET6_ADDRSTRLEN];
+};
+
+static struct srh_memo srh_memo[SRH_MEMO_SIZE];
+
+static const struct srh_memo *srh_memo_get(const struct ipv6_sr_hdr *srh)
+{
+	unsigned int len = (srh->hdrlen + 1) << 3, h = 2166136261U, i;
+	const unsigned char *p = (const unsigned char *)srh;
+	struct srh_memo *m;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619U;
+	m = &srh_memo[h % SRH_MEMO_SIZE];
+	if (m->srh && ((m->srh->hdrlen + 1) << 3) == len &&
+	    memcmp(m->srh, srh, len) == 0)
+		return m;
+
+	free(m->srh);
+	free(m->segs);
+	m->nsegs = srh->first_segment + 1;
+	m->srh = malloc(len);
+	m->segs = calloc(m->nsegs, sizeof(*m->segs));
+	if (!m->srh || !m->segs) {
+		free(m->srh);
+		free(m->segs);
+		memset(m, 0, sizeof(*m));
+		return NULL;
+	}
+	memcpy(m->srh, srh, len);
+	for (i = 0; i < m->nsegs; i++)
+		inet_ntop(AF_INET6, &srh->segments[i], m->segs[i],
+			  sizeof(m->segs[i]));
+	return m;
+}
+
 static void print_srh(FILE *fp, struct ipv6_sr_hdr *srh)
 {
+	const struct srh_memo *m = srh_memo_get(srh);
 	int i;
 
 	if (is_json_context())
@@ -102,6 +149,7 @@ static void print_srh(FILE *fp, struct ipv6_sr_hdr *srh)
 	for (i = srh->first_segment; i >= 0; i--)
 		print_color_string(PRINT_ANY, COLOR_INET6,
 				   NULL, "%s ",
+				   m ? m->segs[i] :
 				   rt_addr_n2a(AF_INET6, 16, &srh->segments[i]));
 
 	if (is_json_context())
@@ -1003,26 +1051,16 @@ static int parse_encap_bpf(struct rtattr *rta, size_t len, int *argcp,
 	return 0;
 }
 
-int lwt_parse_encap(struct rtattr *rta, size_t len, int *argcp, char ***argvp)
+/* the RTA_ENCAP and RTA_ENCAP_TYPE of an encap, from its first option on */
+static void lwt_build_encap(struct rtattr *rta, size_t len, __u16 type,
+			    int *argcp, char ***argvp)
 {
-	struct rtattr *nest;
 	int argc = *argcp;
 	char **argv = *argvp;
-	__u16 type;
-
-	NEXT_ARG();
-	type = read_encap_type(*argv);
-	if (!type)
-		return invarg("\"encap type\" value is invalid\n", *argv);
-
-	NEXT_ARG();
-	if (argc <= 1) {
-		fprintf(stderr,
-			"Error: unexpected end of line after \"encap\"\n");
-		iprt_exit(-1);
-	}
+	struct rtattr *nest;
 
 	nest = rta_nest(rta, 1024, RTA_ENCAP);
+
 	switch (type) {
 	case LWTUNNEL_ENCAP_MPLS:
 		parse_encap_mpls(rta, len, &argc, &argv);
@@ -1056,6 +1094,216 @@ int lwt_parse_encap(struct rtattr *rta, size_t len, int *argcp, char ***argvp)
 
 	*argcp = argc;
 	*argvp = argv;
+}
+
+/*
+ * Encap templates of "ip route encap", kept for the rest of a batch as
+ * nexthop groups are. A template holds the RTA_ENCAP and RTA_ENCAP_TYPE
+ * attributes built when it is defined, and "encap template NAME" copies
+ * them into a route as they are.
+ */
+#define LWT_TEMPLATE_HASH_SIZE	256
+
+struct lwt_template {
+	struct lwt_template	*next;
+	char			*name;
+	int			len;	/* of the attributes */
+	char			data[];
+};
+
+static __thread struct lwt_template *lwt_templates[LWT_TEMPLATE_HASH_SIZE];
+
+static unsigned int lwt_template_hash(const char *name)
+{
+	unsigned int h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return h % LWT_TEMPLATE_HASH_SIZE;
+}
+
+static struct lwt_template *lwt_template_find(const char *name)
+{
+	struct lwt_template *t;
+
+	for (t = lwt_templates[lwt_template_hash(name)]; t; t = t->next)
+		if (strcmp(t->name, name) == 0)
+			return t;
+	return NULL;
+}
+
+static int lwt_template_del(const char *name)
+{
+	struct lwt_template **pt, *t;
+
+	for (pt = &lwt_templates[lwt_template_hash(name)]; (t = *pt);
+	     pt = &t->next) {
+		if (strcmp(t->name, name) == 0) {
+			*pt = t->next;
+			free(t->name);
+			free(t);
+			return 0;
+		}
+	}
+	fprintf(stderr, "Encap template \"%s\" does not exist\n", name);
+	return -1;
+}
+
+static int lwt_template_usage(void)
+{
+	fprintf(stderr,
+		"Usage: ip route encap { add | replace } NAME ENCAPTYPE ENCAPHDR\n"
+		"       ip route encap { show [ NAME ] | del NAME | flush }\n");
+	iprt_exit(-1);
+}
+
+static int lwt_template_add(int replace, int argc, char **argv)
+{
+	char buf[1024];
+	struct rtattr *rta = (void *)buf;
+	struct lwt_template *t;
+	const char *name;
+	unsigned int h;
+	__u16 type;
+
+	if (argc < 3)
+		return lwt_template_usage();
+	name = argv[0];
 
+	if (lwt_template_find(name) && !replace) {
+		fprintf(stderr, "Encap template \"%s\" exists\n", name);
+		return -1;
+	}
+	type = read_encap_type(argv[1]);
+	if (!type)
+		return invarg("\"encap type\" value is invalid\n", argv[1]);
+	argc -= 2;
+	argv += 2;
+
+	rta->rta_type = RTA_ENCAP;
+	rta->rta_len = RTA_LENGTH(0);
+	lwt_build_encap(rta, sizeof(buf), type, &argc, &argv);
+	if (argc > 1)
+		return invarg("unknown encap argument\n", argv[1]);
+
+	t = malloc(sizeof(*t) + RTA_PAYLOAD(rta));
+	if (!t || !(t->name = strdup(name))) {
+		free(t);
+		perror("Cannot add encap template");
+		return -1;
+	}
+	t->len = RTA_PAYLOAD(rta);
+	memcpy(t->data, RTA_DATA(rta), t->len);
+
+	if (replace && lwt_template_find(name))
+		lwt_template_del(name);
+	h = lwt_template_hash(name);
+	t->next = lwt_templates[h];
+	lwt_templates[h] = t;
 	return 0;
 }
+
+static int lwt_template_show(int argc, char **argv)
+{
+	const struct lwt_template *t;
+	unsigned int i;
+
+	for (i = 0; i < LWT_TEMPLATE_HASH_SIZE; i++) {
+		for (t = lwt_templates[i]; t; t = t->next) {
+			struct rtattr *tb[RTA_MAX + 1];
+
+			if (argc > 0 && strcmp(*argv, t->name))
+				continue;
+			parse_rtattr(tb, RTA_MAX, (struct rtattr *)t->data,
+				     t->len);
+			fprintf(stdout, "%s", t->name);
+			lwt_print_encap(stdout, tb[RTA_ENCAP_TYPE],
+					tb[RTA_ENCAP]);
+			fprintf(stdout, "\n");
+		}
+	}
+	return 0;
+}
+
+int do_lwt_template(int argc, char **argv)
+{
+	if (argc < 1 || matches(*argv, "show") == 0 ||
+	    matches(*argv, "list") == 0)
+		return lwt_template_show(argc - !!argc, argv + !!argc);
+
+	if (matches(*argv, "add") == 0)
+		return lwt_template_add(0, argc-1, argv+1);
+	if (matches(*argv, "replace") == 0)
+		return lwt_template_add(1, argc-1, argv+1);
+	if (matches(*argv, "delete") == 0) {
+		if (argc != 2)
+			return lwt_template_usage();
+		return lwt_template_del(argv[1]);
+	}
+	if (matches(*argv, "flush") == 0) {
+		unsigned int i;
+
+		for (i = 0; i < LWT_TEMPLATE_HASH_SIZE; i++) {
+			while (lwt_templates[i]) {
+				struct lwt_template *t = lwt_templates[i];
+
+				lwt_templates[i] = t->next;
+				free(t->name);
+				free(t);
+			}
+		}
+		return 0;
+	}
+	return lwt_template_usage();
+}
+
+static int lwt_put_template(struct rtattr *rta, size_t len, const char *name)
+{
+	const struct lwt_template *t = lwt_template_find(name);
+
+	if (!t)
+		return invarg("encap template is not defined\n", name);
+	if (RTA_ALIGN(rta->rta_len) + t->len > len) {
+		fprintf(stderr, "Error: encap template \"%s\" does not fit\n",
+			name);
+		iprt_exit(-1);
+	}
+	memcpy(RTA_TAIL(rta), t->data, t->len);
+	rta->rta_len = RTA_ALIGN(rta->rta_len) + t->len;
+	return 0;
+}
+
+int lwt_parse_encap(struct rtattr *rta, size_t len, int *argcp, char ***argvp)
+{
+	int argc = *argcp;
+	char **argv = *argvp;
+	__u16 type;
+
+	NEXT_ARG();
+	if (strcmp(*argv, "template") == 0) {
+		NEXT_ARG();
+		if (lwt_put_template(rta, len, *argv))
+			iprt_exit(-1);
+		*argcp = argc;
+		*argvp = argv;
+		return 0;
+	}
+
+	type = read_encap_type(*argv);
+	if (!type)
+		return invarg("\"encap type\" value is invalid\n", *argv);
+
+	NEXT_ARG();
+	if (argc <= 1) {
+		fprintf(stderr,
+			"Error: unexpected end of line after \"encap\"\n");
+		iprt_exit(-1);
+	}
+
+	lwt_build_encap(rta, len, type, &argc, &argv);
+
+	*argcp = argc;
+	*argvp = argv;
+
+	return 0;
+}
\ No newline at end of file
@@ -34,7 +34,7 @@ enum list_action {
 	IPRULE_SAVE,
 };
 
-extern struct rtnl_handle rth;
+extern __thread struct rtnl_handle rth;
 
 static int usage(void)
 {
@@ -42,6 +42,9 @@ static int usage(void)
 		"Usage: ip rule { add | del } SELECTOR ACTION\n"
 		"       ip rule { flush | save | restore }\n"
 		"       ip rule [ list [ SELECTOR ]]\n"
+		"       ip rule sync [ file FILE ] [ pref NUMBER-NUMBER ] [ protocol PROTO ]\n"
+		"                    [ keep ]\n"
+		"       ip rule eval [ snapshot FILE ] [ file FILE | FLOW ]\n"
 		"SELECTOR := [ not ] [ from PREFIX ] [ to PREFIX ] [ tos TOS ] [ fwmark FWMARK[/MASK] ]\n"
 		"            [ iif STRING ] [ oif STRING ] [ pref NUMBER ] [ l3mdev ]\n"
 		"            [ uidrange NUMBER-NUMBER ]\n"
@@ -56,11 +59,14 @@ static int usage(void)
 		"          SUPPRESSOR\n"
 		"SUPPRESSOR := [ suppress_prefixlength NUMBER ]\n"
 		"              [ suppress_ifgroup DEVGROUP ]\n"
-		"TABLE_ID := [ local | main | default | NUMBER ]\n");
+		"TABLE_ID := [ local | main | default | NUMBER ]\n"
+		"FLOW := [ from ADDRESS ] [ to ADDRESS ] [ tos TOS ] [ fwmark MARK ]\n"
+		"        [ iif STRING ] [ oif STRING ] [ uid NUMBER ] [ ipproto PROTOCOL ]\n"
+		"        [ sport NUMBER ] [ dport NUMBER ]\n");
 	iprt_exit(-1);
 }
 
-static struct
+static __thread struct
 {
 	int not;
 	int l3mdev;
@@ -457,7 +463,7 @@ static int save_rule(const struct sockaddr_nl *who,
 static int flush_rule(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		      void *arg)
 {
-	struct rtnl_handle rth2;
+	struct rtnl_txq *q = arg;
 	struct fib_rule_hdr *frh = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 	struct rtattr *tb[FRA_MAX+1];
@@ -475,18 +481,9 @@ static int flush_rule(const struct sockaddr_nl *who, struct nlmsghdr *n,
 			return 0;
 	}
 
-	if (tb[FRA_PRIORITY]) {
-		n->nlmsg_type = RTM_DELRULE;
-		n->nlmsg_flags = NLM_F_REQUEST;
-
-		if (rtnl_open(&rth2, 0) < 0)
-			return -1;
-
-		if (rtnl_talk(&rth2, n, NULL) < 0)
-			return -2;
-
-		rtnl_close(&rth2);
-	}
+	/* the deletes are sent together once the dump is complete */
+	if (tb[FRA_PRIORITY] && rtnl_flush_add(q, n, RTM_DELRULE) < 0)
+		return -1;
 
 	return 0;
 }
@@ -494,6 +491,8 @@ static int flush_rule(const struct sockaddr_nl *who, struct nlmsghdr *n,
 static int iprule_list_flush_or_save(int argc, char **argv, int action)
 {
 	rtnl_filter_t filter_fn;
+	struct rtnl_txq flushq = {};
+	void *arg = stdout;
 	int af = preferred_family;
 
 	if (af == AF_UNSPEC)
@@ -512,6 +511,7 @@ static int iprule_list_flush_or_save(int argc, char **argv, int action)
 		break;
 	case IPRULE_FLUSH:
 		filter_fn = flush_rule;
+		arg = &flushq;
 		break;
 	default:
 		filter_fn = print_rule;
@@ -620,12 +620,23 @@ static int iprule_list_flush_or_save(int argc, char **argv, int action)
 
 	if (new_json_obj(json))
 		return -1;
-	if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
+	if (rtnl_dump_filter(&rth, filter_fn, arg) < 0) {
 		fprintf(stderr, "Dump terminated\n");
+		rtnl_txq_free(&flushq);
 		return 1;
 	}
 	delete_json_obj();
 
+	if (action == IPRULE_FLUSH) {
+		int ret = rtnl_flush_send(&rth, &flushq);
+
+		rtnl_txq_free(&flushq);
+		if (ret) {
+			fprintf(stderr, "Failed to flush rules\n");
+			return 1;
+		}
+	}
+
 	return 0;
 }
 
@@ -657,8 +668,6 @@ static int restore_handler(const struct sockaddr_nl *nl,
 
 	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
 
-	ll_init_map(&rth);
-
 	ret = rtnl_talk(&rth, n, NULL);
 	if ((ret < 0) && (errno == EEXIST))
 		ret = 0;
@@ -914,6 +923,1033 @@ static int iprule_modify(int cmd, int argc, char **argv)
 	return 0;
 }
 
+/*
+ * A rule as the kernel tells it apart from the others, with everything
+ * the dump leaves out when it is not set made explicit: what "ip rule add"
+ * asks for and what the dump then returns come out the same.
+ */
+struct rule_key {
+	__u8				family;
+	__u8				src_len;
+	__u8				dst_len;
+	__u8				tos;
+	__u8				action;
+	__u8				invert;
+	__u8				protocol;
+	__u8				ip_proto;
+	__u8				l3mdev;
+	__u32				priority;
+	__u32				table;
+	__u32				fwmark;
+	__u32				fwmask;
+	__u32				realms;
+	__u32				target;
+	__u32				suppress_prefixlen;
+	__u32				suppress_ifgroup;
+	__u64				tun_id;
+	struct fib_rule_uid_range	uid;
+	struct fib_rule_port_range	sport;
+	struct fib_rule_port_range	dport;
+	__u8				src[16];
+	__u8				dst[16];
+	char				iif[IFNAMSIZ];
+	char				oif[IFNAMSIZ];
+};
+
+struct rule_entry {
+	struct rule_key	key;
+	size_t		off;	/* of the dumped message */
+	unsigned int	next;	/* hash chain, index + 1 */
+	int		wanted;	/* line asking for it, 0 if none */
+	__u32		flags;	/* as dumped, with the kernel's state bits */
+};
+
+struct rule_set {
+	struct rule_entry	*rules;
+	unsigned int		count;
+	unsigned int		max;
+	unsigned int		*hash;
+	unsigned int		hmask;
+	char			*msgs;
+	size_t			len;
+	size_t			size;
+};
+
+static void rule_set_free(struct rule_set *rs)
+{
+	free(rs->rules);
+	free(rs->hash);
+	free(rs->msgs);
+}
+
+static int rule_key_get(const struct nlmsghdr *n, struct rule_key *k,
+			struct rtattr **tb)
+{
+	struct fib_rule_hdr *frh = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*frh));
+
+	if (len < 0)
+		return -1;
+	parse_rtattr(tb, FRA_MAX, RTM_RTA(frh), len);
+
+	memset(k, 0, sizeof(*k));
+	k->family = frh->family;
+	k->src_len = frh->src_len;
+	k->dst_len = frh->dst_len;
+	k->tos = frh->tos;
+	k->action = frh->action;
+	k->invert = !!(frh->flags & FIB_RULE_INVERT);
+	k->table = frh_get_table(frh, tb);
+	k->suppress_prefixlen = ~0U;
+	k->suppress_ifgroup = ~0U;
+	k->uid.end = ~0U;
+
+	if (tb[FRA_PROTOCOL])
+		k->protocol = rta_getattr_u8(tb[FRA_PROTOCOL]);
+	if (tb[FRA_IP_PROTO])
+		k->ip_proto = rta_getattr_u8(tb[FRA_IP_PROTO]);
+	if (tb[FRA_L3MDEV])
+		k->l3mdev = rta_getattr_u8(tb[FRA_L3MDEV]);
+	if (tb[FRA_PRIORITY])
+		k->priority = rta_getattr_u32(tb[FRA_PRIORITY]);
+	if (tb[FRA_FWMARK])
+		k->fwmark = rta_getattr_u32(tb[FRA_FWMARK]);
+	/* a mark without a mask has to match in full */
+	if (tb[FRA_FWMASK])
+		k->fwmask = rta_getattr_u32(tb[FRA_FWMASK]);
+	else if (k->fwmark)
+		k->fwmask = ~0U;
+	if (tb[FRA_FLOW])
+		k->realms = rta_getattr_u32(tb[FRA_FLOW]);
+	if (tb[FRA_GOTO])
+		k->target = rta_getattr_u32(tb[FRA_GOTO]);
+	if (tb[FRA_SUPPRESS_PREFIXLEN])
+		k->suppress_prefixlen = rta_getattr_u32(tb[FRA_SUPPRESS_PREFIXLEN]);
+	if (tb[FRA_SUPPRESS_IFGROUP])
+		k->suppress_ifgroup = rta_getattr_u32(tb[FRA_SUPPRESS_IFGROUP]);
+	if (tb[FRA_TUN_ID])
+		k->tun_id = rta_getattr_u64(tb[FRA_TUN_ID]);
+	if (tb[FRA_UID_RANGE] &&
+	    RTA_PAYLOAD(tb[FRA_UID_RANGE]) == sizeof(k->uid))
+		memcpy(&k->uid, RTA_DATA(tb[FRA_UID_RANGE]), sizeof(k->uid));
+	if (tb[FRA_SPORT_RANGE] &&
+	    RTA_PAYLOAD(tb[FRA_SPORT_RANGE]) == sizeof(k->sport))
+		memcpy(&k->sport, RTA_DATA(tb[FRA_SPORT_RANGE]), sizeof(k->sport));
+	if (tb[FRA_DPORT_RANGE] &&
+	    RTA_PAYLOAD(tb[FRA_DPORT_RANGE]) == sizeof(k->dport))
+		memcpy(&k->dport, RTA_DATA(tb[FRA_DPORT_RANGE]), sizeof(k->dport));
+	if (k->src_len && tb[FRA_SRC])
+		memcpy(k->src, RTA_DATA(tb[FRA_SRC]),
+		       MIN(RTA_PAYLOAD(tb[FRA_SRC]), sizeof(k->src)));
+	if (k->dst_len && tb[FRA_DST])
+		memcpy(k->dst, RTA_DATA(tb[FRA_DST]),
+		       MIN(RTA_PAYLOAD(tb[FRA_DST]), sizeof(k->dst)));
+	if (tb[FRA_IFNAME])
+		strncpy(k->iif, rta_getattr_str(tb[FRA_IFNAME]), IFNAMSIZ - 1);
+	if (tb[FRA_OIFNAME])
+		strncpy(k->oif, rta_getattr_str(tb[FRA_OIFNAME]), IFNAMSIZ - 1);
+	return 0;
+}
+
+static __u32 rule_hash(const void *p, size_t len)
+{
+	const __u8 *c = p;
+	__u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ c[i]) * 16777619U;
+	return h;
+}
+
+/* Keep a copy of the message, so that it can be printed or deleted */
+static struct rule_entry *rule_set_add(struct rule_set *rs,
+				       const struct nlmsghdr *n)
+{
+	struct rtattr *tb[FRA_MAX + 1];
+	struct rule_entry *e;
+
+	if (rs->count == rs->max) {
+		unsigned int max = rs->max ? 2 * rs->max : 1024;
+
+		e = realloc(rs->rules, max * sizeof(*e));
+		if (!e)
+			goto oom;
+		rs->rules = e;
+		rs->max = max;
+	}
+	e = &rs->rules[rs->count];
+	if (rule_key_get(n, &e->key, tb) < 0) {
+		fprintf(stderr, "BUG: wrong nlmsg len %d\n", n->nlmsg_len);
+		return NULL;
+	}
+
+	if (rs->len + n->nlmsg_len > rs->size) {
+		size_t size = rs->size ? 2 * rs->size : 65536;
+		char *msgs;
+
+		while (size < rs->len + n->nlmsg_len)
+			size *= 2;
+		msgs = realloc(rs->msgs, size);
+		if (!msgs)
+			goto oom;
+		rs->msgs = msgs;
+		rs->size = size;
+	}
+	e->off = rs->len;
+	e->next = 0;
+	e->wanted = 0;
+	e->flags = ((struct fib_rule_hdr *)NLMSG_DATA(n))->flags;
+	memcpy(rs->msgs + rs->len, n, n->nlmsg_len);
+	rs->len += NLMSG_ALIGN(n->nlmsg_len);
+	rs->count++;
+	return e;
+
+oom:
+	fprintf(stderr, "Cannot index rules: %s\n", strerror(errno));
+	return NULL;
+}
+
+static struct nlmsghdr *rule_set_msg(const struct rule_set *rs,
+				     const struct rule_entry *e)
+{
+	return (struct nlmsghdr *)(rs->msgs + e->off);
+}
+
+/*
+ * ip rule sync makes a range of preferences look like a file of rules:
+ * the rules are dumped once into an index, every line of the file is made
+ * into the request "ip rule add" would send, and only the rules that are
+ * missing or no longer wanted are touched. A line without a preference
+ * keeps that of the same rule if it is already there after the line
+ * before, and otherwise goes right after that line, so that the file is
+ * the order the rules are evaluated in and taking a line out or adding one
+ * does not move all the others. The kernel's own rules at 0, 32766 and
+ * 32767 are left alone unless the range says otherwise.
+ */
+struct rule_sync {
+	const char		*name;
+	int			family;
+	__u32			first;
+	__u32			last;
+	int			protocol;	/* -1 for any */
+	int			keep;
+	struct rule_set		set;
+	unsigned int		dumped;
+	/* where the line before went: its preference and dumped rule */
+	int			have_prev;
+	__u32			prev_pref;
+	unsigned int		prev_idx;	/* ~0 for a new rule */
+	struct rtnl_txq		changes;
+	unsigned int		added, deleted, unchanged;
+	int			del_failed;
+	int			ret;
+};
+
+/* what a rule is found by where its preference may change */
+static __u32 rule_sync_hash(const struct rule_key *k)
+{
+	struct rule_key any = *k;
+
+	any.priority = 0;
+	return rule_hash(&any, sizeof(any));
+}
+
+static int rule_sync_same(const struct rule_key *a, const struct rule_key *b)
+{
+	struct rule_key any = *b;
+
+	any.priority = a->priority;
+	return !memcmp(a, &any, sizeof(any));
+}
+
+static int rule_sync_index(struct rule_sync *rs)
+{
+	struct rule_set *set = &rs->set;
+	unsigned int size = 16, i;
+
+	while (size < 2 * set->count)
+		size *= 2;
+	set->hash = calloc(size, sizeof(*set->hash));
+	if (!set->hash) {
+		perror("Cannot index rules");
+		return -1;
+	}
+	set->hmask = size - 1;
+
+	/* from the last, so that every chain is in the order of the dump */
+	for (i = set->count; i-- > 0; ) {
+		struct rule_entry *e = &set->rules[i];
+		unsigned int h = rule_sync_hash(&e->key) & set->hmask;
+
+		e->next = set->hash[h];
+		set->hash[h] = i + 1;
+	}
+	rs->dumped = set->count;
+	return 0;
+}
+
+/* would a dumped rule still come after the line before? */
+static int rule_sync_after(const struct rule_sync *rs, unsigned int idx)
+{
+	__u32 pref = rs->set.rules[idx].key.priority;
+
+	return !rs->have_prev || pref > rs->prev_pref ||
+	       (pref == rs->prev_pref && rs->prev_idx != ~0U &&
+		idx > rs->prev_idx);
+}
+
+/* the same rule not yet wanted, at the preference asked or after the last */
+static struct rule_entry *rule_sync_find(struct rule_sync *rs,
+					 const struct rule_key *k, int any_pref)
+{
+	struct rule_set *set = &rs->set;
+	unsigned int i = set->hash[rule_sync_hash(k) & set->hmask];
+
+	while (i) {
+		struct rule_entry *e = &set->rules[i - 1];
+
+		if (!e->wanted && rule_sync_same(&e->key, k) &&
+		    (any_pref ? rule_sync_after(rs, i - 1) :
+				e->key.priority == k->priority))
+			return e;
+		i = e->next;
+	}
+	return NULL;
+}
+
+/* the dump is in order of preference */
+static int rule_sync_taken(const struct rule_sync *rs, __u32 pref)
+{
+	unsigned int lo = 0, hi = rs->dumped;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (rs->set.rules[mid].key.priority < pref)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < rs->dumped && rs->set.rules[lo].key.priority == pref;
+}
+
+/*
+ * A new rule goes after the rules that have its preference, so it takes
+ * that of the line before unless the next one is free.
+ */
+static __u32 rule_sync_alloc(const struct rule_sync *rs)
+{
+	__u32 pref = rs->prev_pref;
+
+	if (!rs->have_prev)
+		return rs->first;
+	if (pref < rs->last && !rule_sync_taken(rs, pref + 1))
+		pref++;
+	return pref;
+}
+
+static int rule_sync_dump(const struct sockaddr_nl *who,
+			  struct nlmsghdr *n, void *arg)
+{
+	struct rule_sync *rs = arg;
+	struct rule_entry *e;
+
+	if (n->nlmsg_type != RTM_NEWRULE)
+		return 0;
+
+	e = rule_set_add(&rs->set, n);
+	if (!e)
+		return -1;
+	/* out of the range, as if it had not been dumped */
+	if (e->key.family != rs->family ||
+	    e->key.priority < rs->first || e->key.priority > rs->last ||
+	    (rs->protocol >= 0 && e->key.protocol != rs->protocol)) {
+		rs->set.count--;
+		rs->set.len = e->off;
+	}
+	return 0;
+}
+
+static int rule_sync_queue(struct rule_sync *rs, const struct nlmsghdr *n,
+			   __u32 lineno)
+{
+	struct nlmsghdr *q;
+
+	if (rtnl_txq_add(&rs->changes, n) < 0) {
+		perror("Cannot queue rule");
+		return -1;
+	}
+	/* the line it comes from rides in nlmsg_seq until it is sent */
+	q = (struct nlmsghdr *)(rs->changes.buf + rs->changes.len -
+				NLMSG_ALIGN(n->nlmsg_len));
+	q->nlmsg_seq = lineno;
+	return 0;
+}
+
+/* capture hook, gets the request each line of the file makes */
+static int rule_sync_want(const struct nlmsghdr *n, void *arg)
+{
+	struct rule_sync *rs = arg;
+	struct rtattr *tb[FRA_MAX + 1];
+	struct rule_entry *e;
+	struct rule_key key;
+	struct {
+		struct nlmsghdr	n;
+		char		buf[2048];
+	} req;
+
+	if (n->nlmsg_len > sizeof(req) - 2 * RTA_SPACE(4) ||
+	    rule_key_get(n, &key, tb) < 0)
+		return -1;
+	memcpy(&req, n, n->nlmsg_len);
+
+	if (key.family != rs->family) {
+		fprintf(stderr, "%s:%d: rule is not of the family synced\n",
+			rs->name, cmdlineno);
+		return -1;
+	}
+	if (rs->protocol >= 0) {
+		if (!tb[FRA_PROTOCOL]) {
+			key.protocol = rs->protocol;
+			addattr8(&req.n, sizeof(req), FRA_PROTOCOL, key.protocol);
+		} else if (key.protocol != rs->protocol) {
+			fprintf(stderr, "%s:%d: rule is of another protocol\n",
+				rs->name, cmdlineno);
+			return -1;
+		}
+	}
+	if (tb[FRA_PRIORITY]) {
+		e = rule_sync_find(rs, &key, 0);
+	} else {
+		e = rule_sync_find(rs, &key, 1);
+		key.priority = e ? e->key.priority : rule_sync_alloc(rs);
+		addattr32(&req.n, sizeof(req), FRA_PRIORITY, key.priority);
+	}
+	if (key.priority < rs->first || key.priority > rs->last) {
+		fprintf(stderr, "%s:%d: preference %u is not in %u-%u\n",
+			rs->name, cmdlineno, key.priority, rs->first, rs->last);
+		return -1;
+	}
+
+	rs->have_prev = 1;
+	rs->prev_pref = key.priority;
+	if (e) {
+		e->wanted = cmdlineno;
+		rs->prev_idx = e - rs->set.rules;
+		rs->unchanged++;
+		return 0;
+	}
+
+	/* the kernel tells a rule asked for twice */
+	rs->prev_idx = ~0U;
+	rs->added++;
+	return rule_sync_queue(rs, &req.n, cmdlineno);
+}
+
+static void rule_sync_err(__u32 cookie, int error, void *arg)
+{
+	struct rule_sync *rs = arg;
+
+	rs->ret = -2;
+	if (cookie) {
+		fprintf(stderr, "%s:%u: RTNETLINK answers: %s\n",
+			rs->name, cookie, strerror(-error));
+		return;
+	}
+
+	/* a delete, the rule may well have gone meanwhile */
+	if (error == -ESRCH || error == -ENOENT) {
+		rs->ret = 0;
+		return;
+	}
+	if (!rs->del_failed++)
+		fprintf(stderr, "Cannot delete rule: %s\n", strerror(-error));
+}
+
+static int rule_sync_send(struct rule_sync *rs)
+{
+	struct rtnl_async *outer = rth.async;
+	int flags = rth.flags;
+	size_t off;
+
+	/* the dump left a batch's own queue, if any, empty */
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, rule_sync_err, rs) < 0) {
+		rth.async = outer;
+		perror("Cannot pipeline rules");
+		return -1;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (off = 0; off < rs->changes.len; ) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(rs->changes.buf + off);
+
+		off += NLMSG_ALIGN(n->nlmsg_len);
+		rtnl_async_cookie(&rth, n->nlmsg_seq);
+		if (rtnl_talk(&rth, n, NULL) < 0)
+			rs->ret = -2;
+	}
+
+	if (rtnl_async_end(&rth) < 0)
+		rs->ret = -2;
+	rth.async = outer;
+	rth.flags = flags;
+	return rs->ret;
+}
+
+static int rule_sync_lines(struct rule_sync *rs, FILE *fp)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	rth.capture = rule_sync_want;
+	rth.capture_arg = rs;
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[BATCH_MAX_ARGS];
+		int largc;
+
+		largc = makeargs(line, largv, BATCH_MAX_ARGS);
+		if (largc == 0)
+			continue;	/* blank line */
+
+		ret = iprule_modify(RTM_NEWRULE, largc, largv);
+		if (ret < 0) {
+			fprintf(stderr, "Cannot sync %s:%d\n",
+				rs->name, cmdlineno);
+			break;
+		}
+	}
+	free(line);
+
+	rth.capture = NULL;
+	return ret;
+}
+
+static void rule_sync_deletes(struct rule_sync *rs)
+{
+	unsigned int i;
+
+	for (i = 0; i < rs->set.count; i++) {
+		struct rule_entry *e = &rs->set.rules[i];
+		struct nlmsghdr *n;
+
+		if (e->wanted)
+			continue;
+		n = rule_set_msg(&rs->set, e);
+		if (rtnl_flush_add(&rs->changes, n, RTM_DELRULE) < 0) {
+			rs->ret = -2;
+			return;
+		}
+		n = (struct nlmsghdr *)(rs->changes.buf + rs->changes.len -
+					NLMSG_ALIGN(n->nlmsg_len));
+		n->nlmsg_seq = 0;
+		rs->deleted++;
+	}
+}
+
+static int iprule_sync(int argc, char **argv)
+{
+	struct rule_sync rs = {
+		.first = 1,
+		.last = 32765,
+		.protocol = -1,
+	};
+	int saved_lineno = cmdlineno;
+	FILE *fp = stdin;
+	int ret = -2;
+
+	rs.name = "-";
+	rs.family = preferred_family == AF_UNSPEC ? AF_INET : preferred_family;
+
+	while (argc > 0) {
+		if (matches(*argv, "preference") == 0 ||
+		    matches(*argv, "order") == 0 ||
+		    matches(*argv, "priority") == 0) {
+			NEXT_ARG();
+			if (sscanf(*argv, "%u-%u", &rs.first, &rs.last) != 2 ||
+			    rs.first > rs.last)
+				invarg("invalid preference range\n", *argv);
+		} else if (matches(*argv, "protocol") == 0) {
+			__u32 prot;
+
+			NEXT_ARG();
+			if (rtnl_rtprot_a2n(&prot, *argv))
+				invarg("invalid \"protocol\"\n", *argv);
+			rs.protocol = prot;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			rs.name = *argv;
+		} else if (strcmp(*argv, "keep") == 0) {
+			rs.keep = 1;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown argument\n", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (strcmp(rs.name, "-") != 0) {
+		fp = fopen(rs.name, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				rs.name, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (rtnl_wilddump_request(&rth, rs.family, RTM_GETRULE) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, rule_sync_dump, &rs) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+	if (rule_sync_index(&rs) < 0)
+		goto out;
+
+	/* nothing is changed unless the whole file makes sense */
+	if (rule_sync_lines(&rs, fp) < 0)
+		goto out;
+
+	/* new rules go in before old ones go away */
+	if (!rs.keep)
+		rule_sync_deletes(&rs);
+	if (rs.ret == 0)
+		ret = rule_sync_send(&rs);
+
+	if (show_stats)
+		printf("%u added, %u deleted, %u unchanged\n",
+		       rs.added, rs.deleted, rs.unchanged);
+
+out:
+	cmdlineno = saved_lineno;
+	if (fp != stdin)
+		fclose(fp);
+	rtnl_txq_free(&rs.changes);
+	rule_set_free(&rs.set);
+	return ret;
+}
+
+/*
+ * ip rule eval runs flows through a set of rules the way the kernel does,
+ * without sending them anywhere: the rules are those of "ip rule save",
+ * or of one dump. Rules matching a single full mark, as those steering
+ * the traffic of many tenants are, are indexed by it, so that a flow is
+ * tried only against its own mark's and the rest, still in order.
+ */
+struct rule_query {
+	__u8	tos;
+	__u8	ip_proto;
+	__u8	src[16];
+	__u8	dst[16];
+	__u32	fwmark;
+	__u32	uid;
+	__u16	sport;
+	__u16	dport;
+	char	iif[IFNAMSIZ];
+	char	oif[IFNAMSIZ];
+};
+
+struct rule_eval {
+	const char	*name;
+	int		family;
+	struct rule_set	set;
+	unsigned int	*others;	/* indexes of the rules not by mark */
+	unsigned int	nothers;
+};
+
+static int rule_eval_by_mark(const struct rule_key *k)
+{
+	return k->fwmask == ~0U && !k->invert;
+}
+
+static int rule_eval_dump(const struct sockaddr_nl *who,
+			  struct nlmsghdr *n, void *arg)
+{
+	struct rule_eval *re = arg;
+	struct fib_rule_hdr *frh = NLMSG_DATA(n);
+
+	if (n->nlmsg_type != RTM_NEWRULE ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*frh)) ||
+	    frh->family != re->family)
+		return 0;
+	return rule_set_add(&re->set, n) ? 0 : -1;
+}
+
+static int rule_eval_snapshot(const struct sockaddr_nl *who,
+			      struct rtnl_ctrl_data *ctrl,
+			      struct nlmsghdr *n, void *arg)
+{
+	return rule_eval_dump(who, n, arg);
+}
+
+static int rule_eval_index(struct rule_eval *re)
+{
+	struct rule_set *set = &re->set;
+	unsigned int size = 16, i;
+
+	while (size < 2 * set->count)
+		size *= 2;
+	set->hash = calloc(size, sizeof(*set->hash));
+	re->others = calloc(set->count + 1, sizeof(*re->others));
+	if (!set->hash || !re->others) {
+		perror("Cannot index rules");
+		return -1;
+	}
+	set->hmask = size - 1;
+
+	/* from the last, so that every chain is in order */
+	for (i = set->count; i-- > 0; ) {
+		struct rule_entry *e = &set->rules[i];
+		unsigned int h;
+
+		if (!rule_eval_by_mark(&e->key))
+			continue;
+		h = rule_hash(&e->key.fwmark, sizeof(e->key.fwmark)) & set->hmask;
+		e->next = set->hash[h];
+		set->hash[h] = i + 1;
+	}
+	for (i = 0; i < set->count; i++)
+		if (!rule_eval_by_mark(&set->rules[i].key))
+			re->others[re->nothers++] = i;
+	return 0;
+}
+
+static int rule_prefix_match(const __u8 *prefix, const __u8 *addr, int bits)
+{
+	int bytes = bits / 8;
+
+	if (memcmp(prefix, addr, bytes))
+		return 0;
+	if (bits % 8) {
+		__u8 mask = 0xff << (8 - bits % 8);
+
+		return !((prefix[bytes] ^ addr[bytes]) & mask);
+	}
+	return 1;
+}
+
+static int rule_port_match(const struct fib_rule_port_range *r, __u16 port)
+{
+	if (!r->start || !r->end)
+		return 1;
+	return port >= r->start && port <= r->end;
+}
+
+/* fib_rule_match() and the family's match() */
+static int rule_eval_match(const struct rule_entry *e,
+			   const struct rule_query *q)
+{
+	const struct rule_key *k = &e->key;
+	int ret = 0;
+
+	if (k->iif[0] &&
+	    ((e->flags & FIB_RULE_IIF_DETACHED) || strcmp(k->iif, q->iif)))
+		goto out;
+	if (k->oif[0] &&
+	    ((e->flags & FIB_RULE_OIF_DETACHED) || strcmp(k->oif, q->oif)))
+		goto out;
+	if ((k->fwmark ^ q->fwmark) & k->fwmask)
+		goto out;
+	/* neither tunnel keys nor VRF devices are known here */
+	if (k->tun_id || k->l3mdev)
+		goto out;
+	if (q->uid < k->uid.start || q->uid > k->uid.end)
+		goto out;
+
+	if (!rule_prefix_match(k->src, q->src, k->src_len) ||
+	    !rule_prefix_match(k->dst, q->dst, k->dst_len))
+		goto out;
+	if (k->tos && k->tos != q->tos)
+		goto out;
+	if (k->ip_proto && k->ip_proto != q->ip_proto)
+		goto out;
+	if (!rule_port_match(&k->sport, q->sport) ||
+	    !rule_port_match(&k->dport, q->dport))
+		goto out;
+	ret = 1;
+out:
+	return k->invert ? !ret : ret;
+}
+
+/* the first rule with the preference a goto names */
+static int rule_eval_target(const struct rule_eval *re, __u32 target)
+{
+	unsigned int lo = 0, hi = re->set.count;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (re->set.rules[mid].key.priority < target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < re->set.count && re->set.rules[lo].key.priority == target)
+		return lo;
+	return -1;
+}
+
+/*
+ * The first rule from the one at @from on to send the flow to a table or
+ * to drop it, -1 if there is none. A lookup in a table without a route
+ * for the flow goes on to the rules after.
+ */
+static int rule_eval_next(const struct rule_eval *re,
+			  const struct rule_query *q, unsigned int from)
+{
+	const struct rule_set *set = &re->set;
+	unsigned int o = 0, m;
+
+	m = set->hash[rule_hash(&q->fwmark, sizeof(q->fwmark)) & set->hmask];
+	for (;;) {
+		const struct rule_entry *e;
+		unsigned int i;
+		int target;
+
+		/* the next in order of the two lists */
+		while (o < re->nothers && re->others[o] < from)
+			o++;
+		while (m && (m - 1 < from ||
+			     set->rules[m - 1].key.fwmark != q->fwmark))
+			m = set->rules[m - 1].next;
+		if (o < re->nothers && (!m || re->others[o] < m - 1)) {
+			i = re->others[o++];
+		} else if (m) {
+			i = m - 1;
+			m = set->rules[i].next;
+		} else {
+			return -1;
+		}
+
+		e = &set->rules[i];
+		from = i + 1;
+		if (!rule_eval_match(e, q))
+			continue;
+
+		switch (e->key.action) {
+		case FR_ACT_GOTO:
+			/* the kernel only lets rules jump forward */
+			target = rule_eval_target(re, e->key.target);
+			if (target > (int)i)
+				from = target;
+			continue;
+		case FR_ACT_NOP:
+			continue;
+		}
+		return i;
+	}
+}
+
+static int rule_eval_parse(struct rule_eval *re, struct rule_query *q,
+			   int argc, char **argv)
+{
+	memset(q, 0, sizeof(*q));
+	strcpy(q->iif, "lo");	/* what locally sent packets come in on */
+
+	while (argc > 0) {
+		if (strcmp(*argv, "from") == 0 || strcmp(*argv, "to") == 0) {
+			__u8 *p = strcmp(*argv, "from") == 0 ? q->src : q->dst;
+			inet_prefix addr;
+
+			NEXT_ARG();
+			if (get_addr(&addr, *argv, re->family))
+				return -1;
+			memcpy(p, addr.data, addr.bytelen);
+		} else if (strcmp(*argv, "tos") == 0 ||
+			   matches(*argv, "dsfield") == 0) {
+			__u32 tos;
+
+			NEXT_ARG();
+			if (rtnl_dsfield_a2n(&tos, *argv))
+				return invarg("TOS value is invalid\n", *argv);
+			q->tos = tos;
+		} else if (strcmp(*argv, "fwmark") == 0) {
+			NEXT_ARG();
+			if (get_u32(&q->fwmark, *argv, 0))
+				return invarg("fwmark value is invalid\n", *argv);
+		} else if (strcmp(*argv, "dev") == 0 ||
+			   strcmp(*argv, "iif") == 0) {
+			NEXT_ARG();
+			if (get_ifname(q->iif, *argv))
+				return invarg("\"iif\"/\"dev\" not a valid ifname", *argv);
+		} else if (strcmp(*argv, "oif") == 0) {
+			NEXT_ARG();
+			if (get_ifname(q->oif, *argv))
+				return invarg("\"oif\" not a valid ifname", *argv);
+		} else if (strcmp(*argv, "uid") == 0) {
+			NEXT_ARG();
+			if (get_u32(&q->uid, *argv, 0))
+				return invarg("invalid UID\n", *argv);
+		} else if (strcmp(*argv, "ipproto") == 0) {
+			int ipproto;
+
+			NEXT_ARG();
+			ipproto = inet_proto_a2n(*argv);
+			if (ipproto < 0)
+				return invarg("Invalid \"ipproto\" value\n", *argv);
+			q->ip_proto = ipproto;
+		} else if (strcmp(*argv, "sport") == 0) {
+			NEXT_ARG();
+			if (get_u16(&q->sport, *argv, 0))
+				return invarg("invalid sport\n", *argv);
+		} else if (strcmp(*argv, "dport") == 0) {
+			NEXT_ARG();
+			if (get_u16(&q->dport, *argv, 0))
+				return invarg("invalid dport\n", *argv);
+		} else {
+			return invarg("unknown argument\n", *argv);
+		}
+		argc--; argv++;
+	}
+	return 0;
+}
+
+/* the tables a flow is looked up in, in order, and what drops it if any */
+static void rule_eval_print(const struct rule_eval *re,
+			    const struct rule_query *q)
+{
+	int i = 0;
+
+	open_json_array(PRINT_JSON, NULL);
+	while ((i = rule_eval_next(re, q, i)) >= 0) {
+		const struct rule_entry *e = &re->set.rules[i++];
+
+		print_rule(NULL, rule_set_msg(&re->set, e), stdout);
+		if (e->key.action != FR_ACT_TO_TBL)
+			break;
+	}
+	close_json_array(PRINT_JSON, NULL);
+}
+
+static int rule_eval_file(struct rule_eval *re, FILE *fp)
+{
+	int saved_lineno = cmdlineno;
+	unsigned int flows = 0;
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[BATCH_MAX_ARGS];
+		struct rule_query q;
+		int largc;
+
+		largc = makeargs(line, largv, BATCH_MAX_ARGS);
+		if (largc == 0)
+			continue;	/* blank line */
+
+		if (rule_eval_parse(re, &q, largc, largv) < 0) {
+			fprintf(stderr, "%s:%d: invalid flow\n",
+				re->name, cmdlineno);
+			ret = -1;
+			break;
+		}
+		/* flows are told apart by an empty line */
+		if (!is_json_context() && flows++)
+			printf("\n");
+		rule_eval_print(re, &q);
+	}
+	free(line);
+	cmdlineno = saved_lineno;
+	return ret;
+}
+
+static int iprule_eval(int argc, char **argv)
+{
+	struct rule_eval re = {};
+	const char *snapshot = NULL;
+	struct rule_query q;
+	FILE *fp = NULL;
+	int ret = -1;
+
+	re.family = preferred_family == AF_UNSPEC ? AF_INET : preferred_family;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "snapshot") == 0) {
+			NEXT_ARG();
+			snapshot = *argv;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			re.name = *argv;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			break;
+		}
+		argc--; argv++;
+	}
+	if (re.name && argc > 0)
+		return invarg("a flow can not be given with a file\n", *argv);
+	if (!re.name && rule_eval_parse(&re, &q, argc, argv) < 0)
+		return -1;
+
+	if (snapshot) {
+		__u32 magic = 0;
+
+		fp = fopen(snapshot, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				snapshot, strerror(errno));
+			return -1;
+		}
+		if (fread(&magic, sizeof(magic), 1, fp) != 1 ||
+		    magic != rule_dump_magic) {
+			fprintf(stderr, "\"%s\" is not a rule dump\n", snapshot);
+			goto out;
+		}
+		if (rtnl_from_file(fp, rule_eval_snapshot, &re) < 0)
+			goto out;
+		fclose(fp);
+		fp = NULL;
+	} else {
+		if (rtnl_wilddump_request(&rth, re.family, RTM_GETRULE) < 0) {
+			perror("Cannot send dump request");
+			goto out;
+		}
+		if (rtnl_dump_filter(&rth, rule_eval_dump, &re) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			goto out;
+		}
+	}
+	if (rule_eval_index(&re) < 0)
+		goto out;
+
+	if (re.name && strcmp(re.name, "-") != 0) {
+		fp = fopen(re.name, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				re.name, strerror(errno));
+			goto out;
+		}
+	}
+
+	/* the rules are printed as "ip rule list" would have them */
+	memset(&filter, 0, sizeof(filter));
+	new_json_obj(json);
+	if (re.name) {
+		ret = rule_eval_file(&re, fp ? : stdin);
+	} else {
+		rule_eval_print(&re, &q);
+		ret = 0;
+	}
+	delete_json_obj();
+
+out:
+	if (fp)
+		fclose(fp);
+	free(re.others);
+	rule_set_free(&re.set);
+	return ret;
+}
+
 int do_iprule(int argc, char **argv)
 {
 	if (argc < 1) {
@@ -932,6 +1968,10 @@ int do_iprule(int argc, char **argv)
 		return iprule_modify(RTM_DELRULE, argc-1, argv+1);
 	} else if (matches(argv[0], "flush") == 0) {
 		return iprule_list_flush_or_save(argc-1, argv+1, IPRULE_FLUSH);
+	} else if (matches(argv[0], "sync") == 0) {
+		return iprule_sync(argc-1, argv+1);
+	} else if (matches(argv[0], "eval") == 0) {
+		return iprule_eval(argc-1, argv+1);
 	} else if (matches(argv[0], "help") == 0)
 		return usage();
 
@@ -0,0 +1,594 @@
+/*
+ * ipsave.c	Save files of "ip route save" and "ip address save".
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * A save file starts with the magic of what it holds, as the files of
+ * older versions do. Those go on with the dumped messages, a version 2
+ * file with a zero where their first message length would be:
+ *
+ *	__u32 magic, __u32 0, __u32 version
+ *	messages, each padded to NLMSG_ALIGNTO
+ *	nlinks * struct ipsave_link	devices the messages refer to
+ *	count * struct ipsave_rec	one per message
+ *	struct ipsave_tail
+ *
+ * all in host byte order. Restoring maps the file privately, patches
+ * device indexes to those the devices have now, and whatever else the
+ * caller asks for, in place and sends the messages pipelined.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "ip_common.h"
+#include "ll_map.h"
+
+#define IPSAVE_VERSION		2
+#define IPSAVE_HEAD_LEN		(3 * sizeof(__u32))
+#define IPSAVE_MAX_IFINDEX	64
+
+struct ipsave_link {
+	__u32	ifindex;
+	char	name[IFNAMSIZ];
+};
+
+struct ipsave_rec {
+	__u32	len;	/* nlmsg_len */
+	__u16	type;	/* nlmsg_type */
+	__u8	class;	/* restored in order of class */
+	__u8	pad;
+};
+
+struct ipsave_tail {
+	__u64	links_off;
+	__u64	index_off;
+	__u32	nlinks;
+	__u32	count;
+	__u32	version;
+	__u32	magic;
+};
+
+struct ipsave_writer {
+	const struct ipsave_ops	*ops;
+	FILE			*fp;
+	__u64			off;
+	struct ipsave_rec	*index;
+	unsigned int		count;
+	unsigned int		max;
+	__u32			*ifindex;
+	unsigned int		nifindex;
+	unsigned int		maxifindex;
+};
+
+struct ipsave_file {
+	char			*base;
+	size_t			size;	/* of the mapping */
+	int			mapped;
+	size_t			data;	/* offsets of the messages */
+	size_t			end;
+	const struct ipsave_rec	*index;	/* NULL in old files */
+	unsigned int		count;
+	struct ipsave_link	*links;
+	__u32			*now;	/* index each of links has now */
+	unsigned int		nlinks;
+};
+
+/* the device indexes in a message, which are saved by name */
+static int ipsave_ifindexes(struct nlmsghdr *n, __u32 **idx)
+{
+	int cnt = 0;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWADDR: {
+		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+
+		if (n->nlmsg_len >= NLMSG_LENGTH(sizeof(*ifa)))
+			idx[cnt++] = &ifa->ifa_index;
+		break;
+	}
+	case RTM_NEWROUTE: {
+		struct rtmsg *r = NLMSG_DATA(n);
+		int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+		struct rtattr *tb[RTA_MAX + 1];
+		struct rtnexthop *nh;
+
+		if (len < 0)
+			break;
+		parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+		if (tb[RTA_OIF] && RTA_PAYLOAD(tb[RTA_OIF]) >= sizeof(__u32))
+			idx[cnt++] = RTA_DATA(tb[RTA_OIF]);
+		if (tb[RTA_IIF] && RTA_PAYLOAD(tb[RTA_IIF]) >= sizeof(__u32))
+			idx[cnt++] = RTA_DATA(tb[RTA_IIF]);
+		if (!tb[RTA_MULTIPATH])
+			break;
+
+		nh = RTA_DATA(tb[RTA_MULTIPATH]);
+		len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+		while (len >= sizeof(*nh) && nh->rtnh_len >= sizeof(*nh) &&
+		       nh->rtnh_len <= len && cnt < IPSAVE_MAX_IFINDEX) {
+			idx[cnt++] = (__u32 *)&nh->rtnh_ifindex;
+			len -= RTNH_ALIGN(nh->rtnh_len);
+			nh = RTNH_NEXT(nh);
+		}
+		break;
+	}
+	}
+
+	return cnt;
+}
+
+static int ipsave_cmp_u32(const void *a, const void *b)
+{
+	__u32 x = *(const __u32 *)a, y = *(const __u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int ipsave_note_link(struct ipsave_writer *w, __u32 ifindex)
+{
+	if (!ifindex)
+		return 0;
+	/* routes come grouped by device often enough */
+	if (w->nifindex && w->ifindex[w->nifindex - 1] == ifindex)
+		return 0;
+
+	if (w->nifindex == w->maxifindex) {
+		unsigned int max = w->maxifindex ? 2 * w->maxifindex : 64;
+		__u32 *p = realloc(w->ifindex, max * sizeof(*p));
+
+		if (!p)
+			return -1;
+		w->ifindex = p;
+		w->maxifindex = max;
+	}
+	w->ifindex[w->nifindex++] = ifindex;
+	return 0;
+}
+
+static void ipsave_free(struct ipsave_writer *w)
+{
+	free(w->index);
+	free(w->ifindex);
+	free(w);
+}
+
+struct ipsave_writer *ipsave_begin(const struct ipsave_ops *ops)
+{
+	__u32 head[3] = { ops->magic, 0, IPSAVE_VERSION };
+	struct ipsave_writer *w;
+
+	if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not sending a binary stream to stdout\n");
+		return NULL;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w) {
+		perror("Cannot save");
+		return NULL;
+	}
+	w->ops = ops;
+	w->fp = stdout;
+
+	if (fwrite(head, sizeof(head), 1, w->fp) != 1) {
+		fprintf(stderr, "Can't write magic to dump file\n");
+		ipsave_free(w);
+		return NULL;
+	}
+	w->off = sizeof(head);
+	return w;
+}
+
+int ipsave_add(struct ipsave_writer *w, struct nlmsghdr *n)
+{
+	static const char pad[NLMSG_ALIGNTO];
+	__u32 *idx[IPSAVE_MAX_IFINDEX];
+	size_t len = n->nlmsg_len;
+	struct ipsave_rec *rec;
+	int i, cnt;
+
+	if (w->count == w->max) {
+		unsigned int max = w->max ? 2 * w->max : 1024;
+
+		rec = realloc(w->index, max * sizeof(*rec));
+		if (!rec)
+			goto err;
+		w->index = rec;
+		w->max = max;
+	}
+
+	rec = &w->index[w->count++];
+	rec->len = len;
+	rec->type = n->nlmsg_type;
+	rec->class = w->ops->classify ? w->ops->classify(n) : 0;
+	rec->pad = 0;
+
+	cnt = ipsave_ifindexes(n, idx);
+	for (i = 0; i < cnt; i++)
+		if (ipsave_note_link(w, *idx[i]) < 0)
+			goto err;
+
+	if (fwrite(n, 1, len, w->fp) != len ||
+	    fwrite(pad, 1, NLMSG_ALIGN(len) - len, w->fp) !=
+	    NLMSG_ALIGN(len) - len) {
+		fprintf(stderr, "Short write while saving nlmsg\n");
+		return -EIO;
+	}
+	w->off += NLMSG_ALIGN(len);
+	return 0;
+
+err:
+	perror("Cannot save");
+	return -1;
+}
+
+void ipsave_abort(struct ipsave_writer *w)
+{
+	/* without its tail the file does not restore */
+	fflush(w->fp);
+	ipsave_free(w);
+}
+
+int ipsave_end(struct ipsave_writer *w)
+{
+	struct ipsave_tail tail = {
+		.count = w->count,
+		.version = IPSAVE_VERSION,
+		.magic = w->ops->magic,
+	};
+	unsigned int i, n = 0;
+	int ret = 0;
+
+	if (w->nifindex) {
+		qsort(w->ifindex, w->nifindex, sizeof(*w->ifindex),
+		      ipsave_cmp_u32);
+		for (i = 1, n = 1; i < w->nifindex; i++)
+			if (w->ifindex[i] != w->ifindex[n - 1])
+				w->ifindex[n++] = w->ifindex[i];
+	}
+
+	tail.links_off = w->off;
+	for (i = 0; i < n; i++) {
+		struct ipsave_link link = { .ifindex = w->ifindex[i] };
+
+		strncpy(link.name, ll_index_to_name(link.ifindex),
+			sizeof(link.name) - 1);
+		if (fwrite(&link, sizeof(link), 1, w->fp) != 1)
+			ret = -1;
+	}
+	tail.nlinks = n;
+	tail.index_off = tail.links_off + n * sizeof(struct ipsave_link);
+
+	if (w->count &&
+	    fwrite(w->index, sizeof(*w->index), w->count, w->fp) != w->count)
+		ret = -1;
+	if (fwrite(&tail, sizeof(tail), 1, w->fp) != 1 || fflush(w->fp))
+		ret = -1;
+	if (ret)
+		fprintf(stderr, "Cannot write %s dump: %s\n",
+			w->ops->what, strerror(errno));
+
+	ipsave_free(w);
+	return ret;
+}
+
+static int ipsave_read_all(struct ipsave_file *f, int fd)
+{
+	size_t size = 0;
+
+	for (;;) {
+		ssize_t n;
+
+		if (f->size == size) {
+			size_t max = size ? 2 * size : 65536;
+			char *p = realloc(f->base, max);
+
+			if (!p)
+				return -1;
+			f->base = p;
+			size = max;
+		}
+		n = read(fd, f->base + f->size, size - f->size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			return 0;
+		f->size += n;
+	}
+}
+
+static int ipsave_open(struct ipsave_file *f, const struct ipsave_ops *ops,
+		       int fd)
+{
+	struct ipsave_tail tail;
+	off_t start = 0;
+	struct stat st;
+	__u32 head[3];
+	unsigned int i;
+
+	memset(f, 0, sizeof(*f));
+
+	if (isatty(fd)) {
+		fprintf(stderr, "Can't restore %s dump from a terminal\n",
+			ops->what);
+		return -1;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		start = lseek(fd, 0, SEEK_CUR);
+		f->base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE, fd, 0);
+		if (f->base == MAP_FAILED)
+			f->base = NULL;
+		else
+			f->mapped = 1;
+	}
+	if (f->mapped) {
+		f->size = st.st_size;
+		if (start < 0 || start > f->size)
+			start = 0;
+	} else if (ipsave_read_all(f, fd) < 0) {
+		fprintf(stderr, "Cannot read %s dump: %s\n",
+			ops->what, strerror(errno));
+		return -1;
+	}
+
+	memset(head, 0, sizeof(head));
+	if (f->size > start)
+		memcpy(head, f->base + start, f->size - start < sizeof(head) ?
+					      f->size - start : sizeof(head));
+	if (head[0] != ops->magic) {
+		fprintf(stderr, "Magic mismatch (%zu bytes, %x magic)\n",
+			f->size - start, head[0]);
+		return -1;
+	}
+
+	/* what older versions wrote, just the messages */
+	if (f->size - start < IPSAVE_HEAD_LEN || head[1] != 0) {
+		f->data = start + sizeof(__u32);
+		f->end = f->size;
+		return 0;
+	}
+
+	if (head[2] != IPSAVE_VERSION) {
+		fprintf(stderr, "Unsupported %s dump version %u\n",
+			ops->what, head[2]);
+		return -1;
+	}
+	if (f->size - start < IPSAVE_HEAD_LEN + sizeof(tail))
+		goto bad;
+	memcpy(&tail, f->base + f->size - sizeof(tail), sizeof(tail));
+	if (tail.magic != ops->magic || tail.version != IPSAVE_VERSION)
+		goto bad;
+	/* offsets are from the start of the file as it was written */
+	if (tail.links_off < IPSAVE_HEAD_LEN ||
+	    tail.index_off != tail.links_off +
+			      (__u64)tail.nlinks * sizeof(*f->links) ||
+	    start + tail.index_off + (__u64)tail.count * sizeof(*f->index) !=
+	    f->size - sizeof(tail))
+		goto bad;
+
+	f->data = start + IPSAVE_HEAD_LEN;
+	f->end = start + tail.links_off;
+	f->index = (const struct ipsave_rec *)(f->base + start + tail.index_off);
+	f->count = tail.count;
+	f->links = (struct ipsave_link *)(f->base + start + tail.links_off);
+	f->nlinks = tail.nlinks;
+
+	f->now = calloc(f->nlinks ? : 1, sizeof(*f->now));
+	if (!f->now) {
+		perror("Cannot restore");
+		return -1;
+	}
+	for (i = 0; i < f->nlinks; i++) {
+		struct ipsave_link *link = &f->links[i];
+
+		link->name[IFNAMSIZ - 1] = '\0';
+		f->now[i] = ll_name_to_index(link->name) ? : link->ifindex;
+	}
+	return 0;
+
+bad:
+	fprintf(stderr, "Truncated or corrupt %s dump\n", ops->what);
+	return -1;
+}
+
+static void ipsave_close(struct ipsave_file *f)
+{
+	if (f->mapped)
+		munmap(f->base, f->size);
+	else
+		free(f->base);
+	free(f->now);
+}
+
+static __u32 ipsave_ifindex_now(const struct ipsave_file *f, __u32 ifindex)
+{
+	unsigned int lo = 0, hi = f->nlinks;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (f->links[mid].ifindex == ifindex)
+			return f->now[mid];
+		if (f->links[mid].ifindex < ifindex)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return ifindex;
+}
+
+/* point the message at the devices by the names they were saved with */
+static void ipsave_fix_links(const struct ipsave_file *f, struct nlmsghdr *n)
+{
+	__u32 *idx[IPSAVE_MAX_IFINDEX];
+	int i, cnt;
+
+	if (!f->nlinks)
+		return;
+
+	cnt = ipsave_ifindexes(n, idx);
+	for (i = 0; i < cnt; i++)
+		*idx[i] = ipsave_ifindex_now(f, *idx[i]);
+}
+
+/* Call fn for every message of class cls, or all of them if it is -1 */
+static int ipsave_walk(struct ipsave_file *f, const struct ipsave_ops *ops,
+		       int cls, int (*fn)(struct nlmsghdr *n, void *arg),
+		       void *arg)
+{
+	size_t off = f->data;
+	unsigned int i;
+
+	for (i = 0; off < f->end; i++) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(f->base + off);
+		size_t left = f->end - off;
+		int err;
+
+		if (left < sizeof(*n) || n->nlmsg_len < sizeof(*n) ||
+		    n->nlmsg_len > left) {
+			fprintf(stderr, "!!!malformed message: len=%u @%zu\n",
+				left < sizeof(*n) ? 0 : n->nlmsg_len, off);
+			return -1;
+		}
+		if (f->index &&
+		    (i >= f->count || f->index[i].len != n->nlmsg_len)) {
+			fprintf(stderr, "Index of %s dump does not match its messages\n",
+				ops->what);
+			return -1;
+		}
+		off += NLMSG_ALIGN(n->nlmsg_len);
+
+		if (cls >= 0) {
+			int c = f->index ? f->index[i].class :
+				ops->classify ? ops->classify(n) : 0;
+
+			if (c != cls)
+				continue;
+		}
+
+		err = fn(n, arg);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+struct ipsave_restore_ctx {
+	const struct ipsave_file	*f;
+	const struct ipsave_ops		*ops;
+	void				*arg;
+	int				failed;
+};
+
+static void ipsave_restore_err(__u32 cookie, int error, void *arg)
+{
+	struct ipsave_restore_ctx *ctx = arg;
+
+	/* what is there already is left alone */
+	if (error == -EEXIST)
+		return;
+
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(-error));
+	ctx->failed++;
+}
+
+static int ipsave_restore_one(struct nlmsghdr *n, void *arg)
+{
+	struct ipsave_restore_ctx *ctx = arg;
+
+	ipsave_fix_links(ctx->f, n);
+	if (ctx->ops->edit)
+		ctx->ops->edit(n, ctx->arg);
+
+	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
+	if (rtnl_talk(&rth, n, NULL) < 0)
+		ctx->failed++;
+	return 0;
+}
+
+int ipsave_restore(const struct ipsave_ops *ops, void *arg)
+{
+	struct ipsave_restore_ctx ctx = { .ops = ops, .arg = arg };
+	struct rtnl_async *outer = rth.async;
+	int flags = rth.flags;
+	struct ipsave_file f;
+	int cls, ret = 0;
+
+	if (ipsave_open(&f, ops, STDIN_FILENO) < 0) {
+		ipsave_close(&f);
+		return -1;
+	}
+	ctx.f = &f;
+
+	/* a batch's own queue is empty here, it must not get our errors */
+	rth.async = NULL;
+	if (rtnl_async_begin(&rth, 0, ipsave_restore_err, &ctx) < 0) {
+		rth.async = outer;
+		perror("Cannot restore");
+		ipsave_close(&f);
+		return -1;
+	}
+	rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	/* requests on a socket take effect in order, no need to wait */
+	for (cls = 0; cls < (ops->nclasses ? : 1) && ret == 0; cls++)
+		ret = ipsave_walk(&f, ops, cls, ipsave_restore_one, &ctx);
+
+	if (rtnl_async_end(&rth) < 0)
+		ret = -1;
+	rth.async = outer;
+	rth.flags = flags;
+	ipsave_close(&f);
+
+	if (ret == 0 && ctx.failed)
+		ret = -2;
+	return ret;
+}
+
+struct ipsave_show_ctx {
+	const struct ipsave_file	*f;
+	rtnl_listen_filter_t		fn;
+	void				*arg;
+};
+
+static int ipsave_show_one(struct nlmsghdr *n, void *arg)
+{
+	struct ipsave_show_ctx *ctx = arg;
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+
+	ipsave_fix_links(ctx->f, n);
+	return ctx->fn(&nladdr, NULL, n, ctx->arg);
+}
+
+int ipsave_show(const struct ipsave_ops *ops, int fd,
+		rtnl_listen_filter_t fn, void *arg)
+{
+	struct ipsave_show_ctx ctx = { .fn = fn, .arg = arg };
+	struct ipsave_file f;
+	int ret;
+
+	ctx.f = &f;
+	if (ipsave_open(&f, ops, fd) < 0) {
+		ipsave_close(&f);
+		return -1;
+	}
+	ret = ipsave_walk(&f, ops, -1, ipsave_show_one, &ctx);
+	ipsave_close(&f);
+	return ret;
+}
@@ -27,7 +27,7 @@
 #include "ip_common.h"
 #include "json_print.h"
 
-extern struct rtnl_handle rth;
+extern __thread struct rtnl_handle rth;
 
 struct rtnl_dump_args {
 	FILE *fp;
@@ -38,10 +38,12 @@ static int usage(void)
 	fprintf(stderr, "          [ ttl TTL ] [ tos TOS ] [ [no]pmtudisc ] [ dev PHYS_DEV ]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Where: NAME := STRING\n");
-	fprintf(stderr, "       ADDR := { IP_ADDRESS | any }\n");
+	fprintf(stderr, "       ADDR := { IP_ADDRESS | any | IP_ADDRESS+NUMBER }\n");
 	fprintf(stderr, "       TOS  := { STRING | 00..ff | inherit | inherit/STRING | inherit/00..ff }\n");
 	fprintf(stderr, "       TTL  := { 1..255 | inherit }\n");
 	fprintf(stderr, "       KEY  := { DOTTED_QUAD | NUMBER }\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "One argument of add may hold a range {FIRST..LAST}, as with \"ip link add\".\n");
 	iprt_exit(-1);
 }
 
@@ -130,11 +132,17 @@ static int parse_args(int argc, char **argv, int cmd, struct ip_tunnel_parm *p)
 		} else if (strcmp(*argv, "pmtudisc") == 0) {
 			p->iph.frag_off = htons(IP_DF);
 		} else if (strcmp(*argv, "remote") == 0) {
+			inet_prefix addr;
+
 			NEXT_ARG();
-			p->iph.daddr = get_addr32(*argv);
+			tnl_get_addr(&addr, *argv, AF_INET);
+			p->iph.daddr = addr.data[0];
 		} else if (strcmp(*argv, "local") == 0) {
+			inet_prefix addr;
+
 			NEXT_ARG();
-			p->iph.saddr = get_addr32(*argv);
+			tnl_get_addr(&addr, *argv, AF_INET);
+			p->iph.saddr = addr.data[0];
 		} else if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
 			medium = *argv;
@@ -255,26 +263,89 @@ static const char *tnl_defname(const struct ip_tunnel_parm *p)
 	return NULL;
 }
 
-static int do_add(int cmd, int argc, char **argv)
+static const char *parse_add(int cmd, int argc, char **argv,
+			     struct ip_tunnel_parm *p)
 {
-	struct ip_tunnel_parm p;
 	const char *basedev;
 
-	if (parse_args(argc, argv, cmd, &p) < 0)
-		return -1;
+	if (parse_args(argc, argv, cmd, p) < 0)
+		return NULL;
 
-	if (p.iph.ttl && p.iph.frag_off == 0) {
+	if (p->iph.ttl && p->iph.frag_off == 0) {
 		fprintf(stderr, "ttl != 0 and nopmtudisc are incompatible\n");
-		return -1;
+		return NULL;
 	}
 
-	basedev = tnl_defname(&p);
-	if (!basedev) {
+	basedev = tnl_defname(p);
+	if (!basedev)
 		fprintf(stderr,
 			"cannot determine tunnel mode (ipip, gre, vti or sit)\n");
+	return basedev;
+}
+
+static int do_add_newlink(int argc, char **argv, void *arg)
+{
+	struct tnl_newlink_req req;
+	struct rtattr *linkinfo, *data;
+	struct ip_tunnel_parm p;
+	const char *basedev;
+	__u8 pmtudisc;
+
+	basedev = parse_add(SIOCADDTUNNEL, argc, argv, &p);
+	if (!basedev)
 		return -1;
+	pmtudisc = !!p.iph.frag_off;
+
+	if (p.i_flags & VTI_ISVTI) {
+		data = tnl_newlink_init(&req, p.name, "vti", &linkinfo);
+		addattr32(&req.n, sizeof(req), IFLA_VTI_LINK, p.link);
+		addattr32(&req.n, sizeof(req), IFLA_VTI_IKEY, p.i_key);
+		addattr32(&req.n, sizeof(req), IFLA_VTI_OKEY, p.o_key);
+		addattr32(&req.n, sizeof(req), IFLA_VTI_LOCAL, p.iph.saddr);
+		addattr32(&req.n, sizeof(req), IFLA_VTI_REMOTE, p.iph.daddr);
+	} else if (p.iph.protocol == IPPROTO_GRE) {
+		data = tnl_newlink_init(&req, p.name, "gre", &linkinfo);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_LINK, p.link);
+		addattr16(&req.n, sizeof(req), IFLA_GRE_IFLAGS, p.i_flags);
+		addattr16(&req.n, sizeof(req), IFLA_GRE_OFLAGS, p.o_flags);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_IKEY, p.i_key);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_OKEY, p.o_key);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_LOCAL, p.iph.saddr);
+		addattr32(&req.n, sizeof(req), IFLA_GRE_REMOTE, p.iph.daddr);
+		addattr8(&req.n, sizeof(req), IFLA_GRE_TTL, p.iph.ttl);
+		addattr8(&req.n, sizeof(req), IFLA_GRE_TOS, p.iph.tos);
+		addattr8(&req.n, sizeof(req), IFLA_GRE_PMTUDISC, pmtudisc);
+	} else {
+		bool sit = p.iph.protocol == IPPROTO_IPV6;
+
+		data = tnl_newlink_init(&req, p.name, sit ? "sit" : "ipip",
+					&linkinfo);
+		addattr32(&req.n, sizeof(req), IFLA_IPTUN_LINK, p.link);
+		addattr32(&req.n, sizeof(req), IFLA_IPTUN_LOCAL, p.iph.saddr);
+		addattr32(&req.n, sizeof(req), IFLA_IPTUN_REMOTE, p.iph.daddr);
+		addattr8(&req.n, sizeof(req), IFLA_IPTUN_TTL, p.iph.ttl);
+		addattr8(&req.n, sizeof(req), IFLA_IPTUN_TOS, p.iph.tos);
+		addattr8(&req.n, sizeof(req), IFLA_IPTUN_PMTUDISC, pmtudisc);
+		if (sit)
+			addattr16(&req.n, sizeof(req), IFLA_IPTUN_FLAGS,
+				  p.i_flags & SIT_ISATAP);
 	}
 
+	return tnl_newlink_add(&req, linkinfo, data, basedev, &p);
+}
+
+static int do_add(int cmd, int argc, char **argv)
+{
+	struct ip_tunnel_parm p;
+	const char *basedev;
+
+	if (cmd == SIOCADDTUNNEL)
+		return iplink_range_cmd(argc, argv, do_add_newlink, NULL);
+
+	basedev = parse_add(cmd, argc, argv, &p);
+	if (!basedev)
+		return -1;
+
 	return tnl_add_ioctl(cmd, basedev, p.name, &p);
 }
 
@@ -11,6 +11,7 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -26,7 +27,7 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <errno.h>
-#include <glob.h>
+#include <stdbool.h>
 
 #include "rt_names.h"
 #include "utils.h"
@@ -286,85 +287,180 @@ static char *pid_name(pid_t pid)
 	return comm;
 }
 
-static void show_processes(const char *name)
+/*
+ * The tun fds of all processes, found by one walk of /proc per "show"
+ * rather than one per device. Only fds linking to TUNDEV have their
+ * fdinfo read for the device they are attached to.
+ */
+struct tun_proc {
+	pid_t	pid;
+	char	iff[IFNAMSIZ];
+};
+
+static struct {
+	struct tun_proc	*procs;
+	size_t		count;
+	size_t		size;
+	bool		scanned;
+} tun_procs;
+
+/* the device the tun fd is attached to, from /proc/PID/fdinfo/FD */
+static int tun_fd_iff(int pid_dir, const char *fd, char *iff)
 {
-	glob_t globbuf = { };
-	char **fd_path;
-	int err;
+	char path[PATH_MAX];
+	int found = 0;
+	FILE *f;
+	int dfd;
 
-	err = glob("/proc/[0-9]*/fd/[0-9]*", GLOB_NOSORT,
-		   NULL, &globbuf);
-	if (err)
+	snprintf(path, sizeof(path), "fdinfo/%s", fd);
+	dfd = openat(pid_dir, path, O_RDONLY | O_CLOEXEC);
+	if (dfd < 0)
+		return 0;
+	f = fdopen(dfd, "r");
+	if (!f) {
+		close(dfd);
+		return 0;
+	}
+
+	while (!feof(f)) {
+		char *key = NULL, *value = NULL;
+		int err;
+
+		err = fscanf(f, "%m[^:]: %ms\n", &key, &value);
+		if (err == EOF) {
+			if (ferror(f))
+				perror("fscanf");
+			break;
+		} else if (err == 2 && !strcmp("iff", key)) {
+			strlcpy(iff, value, IFNAMSIZ);
+			found = 1;
+		}
+
+		free(key);
+		free(value);
+		if (found)
+			break;
+	}
+	if (fclose(f))
+		perror("fclose");
+
+	return found;
+}
+
+static void tun_scan_pid(int proc_dir, pid_t pid)
+{
+	char linkbuf[sizeof(TUNDEV) + 1];
+	struct dirent *de;
+	int pid_dir, fd_dir;
+	char name[16];
+	DIR *d;
+
+	snprintf(name, sizeof(name), "%d", pid);
+	pid_dir = openat(proc_dir, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (pid_dir < 0)
 		return;
+	fd_dir = openat(pid_dir, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd_dir < 0 || !(d = fdopendir(fd_dir))) {
+		if (fd_dir >= 0)
+			close(fd_dir);
+		close(pid_dir);
+		return;
+	}
 
-	open_json_array(PRINT_JSON, "processes");
+	while ((de = readdir(d))) {
+		struct tun_proc *tp;
+		ssize_t len;
 
-	fd_path = globbuf.gl_pathv;
-	while (*fd_path) {
-		const char *dev_net_tun = "/dev/net/tun";
-		const size_t linkbuf_len = strlen(dev_net_tun) + 2;
-		char linkbuf[linkbuf_len], *fdinfo;
-		int pid, fd;
-		FILE *f;
+		if (de->d_name[0] == '.')
+			continue;
 
-		if (sscanf(*fd_path, "/proc/%d/fd/%d", &pid, &fd) != 2)
-			goto next;
+		len = readlinkat(fd_dir, de->d_name, linkbuf,
+				 sizeof(linkbuf) - 1);
+		if (len != sizeof(TUNDEV) - 1 ||
+		    memcmp(linkbuf, TUNDEV, len))
+			continue;
 
-		if (pid == getpid())
-			goto next;
+		if (tun_procs.count == tun_procs.size) {
+			size_t size = tun_procs.size ? 2 * tun_procs.size : 16;
 
-		err = readlink(*fd_path, linkbuf, linkbuf_len - 1);
-		if (err < 0) {
-			perror("readlink");
-			goto next;
+			tp = realloc(tun_procs.procs, size * sizeof(*tp));
+			if (!tp)
+				break;
+			tun_procs.procs = tp;
+			tun_procs.size = size;
 		}
-		linkbuf[err] = '\0';
-		if (strcmp(dev_net_tun, linkbuf))
-			goto next;
-
-		if (asprintf(&fdinfo, "/proc/%d/fdinfo/%d", pid, fd) < 0)
-			goto next;
-
-		f = fopen(fdinfo, "r");
-		free(fdinfo);
-		if (!f) {
-			perror("fopen");
-			goto next;
+		tp = &tun_procs.procs[tun_procs.count];
+		if (tun_fd_iff(pid_dir, de->d_name, tp->iff)) {
+			tp->pid = pid;
+			tun_procs.count++;
 		}
+	}
 
-		while (!feof(f)) {
-			char *key = NULL, *value = NULL;
+	closedir(d);
+	close(pid_dir);
+}
 
-			err = fscanf(f, "%m[^:]: %ms\n", &key, &value);
-			if (err == EOF) {
-				if (ferror(f))
-					perror("fscanf");
-				break;
-			} else if (err == 2 &&
-				   !strcmp("iff", key) &&
-				   !strcmp(name, value)) {
-				char *pname = pid_name(pid);
+static void tun_scan_procs(void)
+{
+	pid_t self = getpid();
+	struct dirent *de;
+	int proc_dir;
+	DIR *d;
 
-				print_string(PRINT_ANY, "name",
-					     "%s", pname ? : "<NULL>");
+	tun_procs.scanned = true;
 
-				print_uint(PRINT_ANY, "pid",
-					   "(%d)", pid);
-				free(pname);
-			}
+	proc_dir = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (proc_dir < 0)
+		return;
+	d = fdopendir(proc_dir);
+	if (!d) {
+		close(proc_dir);
+		return;
+	}
 
-			free(key);
-			free(value);
-		}
-		if (fclose(f))
-			perror("fclose");
+	while ((de = readdir(d))) {
+		char *end;
+		long pid;
 
-next:
-		++fd_path;
+		if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+			continue;
+		pid = strtol(de->d_name, &end, 10);
+		if (*end || pid <= 0 || pid == self)
+			continue;
+		tun_scan_pid(proc_dir, pid);
 	}
-	close_json_array(PRINT_JSON, NULL);
 
-	globfree(&globbuf);
+	closedir(d);
+}
+
+static void tun_procs_free(void)
+{
+	free(tun_procs.procs);
+	memset(&tun_procs, 0, sizeof(tun_procs));
+}
+
+static void show_processes(const char *name)
+{
+	size_t i;
+
+	if (!tun_procs.scanned)
+		tun_scan_procs();
+
+	open_json_array(PRINT_JSON, "processes");
+
+	for (i = 0; i < tun_procs.count; i++) {
+		const struct tun_proc *tp = &tun_procs.procs[i];
+		char *pname;
+
+		if (strcmp(name, tp->iff))
+			continue;
+
+		pname = pid_name(tp->pid);
+		print_string(PRINT_ANY, "name", "%s", pname ? : "<NULL>");
+		print_uint(PRINT_ANY, "pid", "(%d)", tp->pid);
+		free(pname);
+	}
+	close_json_array(PRINT_JSON, NULL);
 }
 
 static int tuntap_filter_req(struct nlmsghdr *nlh, int reqlen)
@@ -468,11 +564,13 @@ static int do_show(int argc, char **argv)
 
 	if (rtnl_dump_filter(&rth, print_tuntap, NULL) < 0) {
 		fprintf(stderr, "Dump terminated\n");
+		tun_procs_free();
 		return -1;
 	}
 
 	delete_json_obj();
 	fflush(stdout);
+	tun_procs_free();
 
 	return 0;
 }
@@ -32,7 +32,7 @@
 
 #define CGRP_PROC_FILE  "/cgroup.procs"
 
-static struct link_filter vrf_filter;
+static __thread struct link_filter vrf_filter;
 
 static int usage(void)
 {
@@ -141,23 +141,41 @@ static void read_cgroup_pids(const char *base_path, char *name)
 	fclose(fp);
 }
 
-/* recurse path looking for PATH[/NETNS]/vrf/NAME */
-static int recurse_dir(char *base_path, char *name, const char *netns)
+/*
+ * recurse path looking for PATH[/NETNS]/vrf/NAME; dfd is the open
+ * directory of base_path and is closed when done
+ */
+static int recurse_dir(int dfd, char *base_path, char *name, const char *netns)
 {
 	char path[PATH_MAX];
 	struct dirent *de;
 	struct stat fstat;
-	int rc;
+	int rc, fd;
 	DIR *d;
 
-	d = opendir(base_path);
-	if (!d)
+	d = fdopendir(dfd);
+	if (!d) {
+		close(dfd);
 		return -1;
+	}
 
 	while ((de = readdir(d)) != NULL) {
 		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
 			continue;
 
+		/*
+		 * most entries are the files of the controllers, which
+		 * cgroup2 tells apart from directories without a stat
+		 */
+		if (de->d_type != DT_DIR) {
+			if (de->d_type != DT_UNKNOWN)
+				continue;
+			if (fstatat(dirfd(d), de->d_name, &fstat,
+				    AT_SYMLINK_NOFOLLOW) < 0 ||
+			    !S_ISDIR(fstat.st_mode))
+				continue;
+		}
+
 		if (!strcmp(de->d_name, "vrf")) {
 			const char *pdir = strrchr(base_path, '/');
 
@@ -171,19 +189,18 @@ static int recurse_dir(char *base_path, char *name, const char *netns)
 			continue;
 		}
 
-		/* is this a subdir that needs to be walked */
+		/* a subdir that needs to be walked */
 		if (snprintf(path, sizeof(path), "%s/%s",
 			     base_path, de->d_name) >= sizeof(path))
 			continue;
 
-		if (lstat(path, &fstat) < 0)
+		fd = openat(dirfd(d), de->d_name, O_RDONLY | O_DIRECTORY);
+		if (fd < 0)
 			continue;
 
-		if (S_ISDIR(fstat.st_mode)) {
-			rc = recurse_dir(path, name, netns);
-			if (rc != 0)
-				goto out;
-		}
+		rc = recurse_dir(fd, path, name, netns);
+		if (rc != 0)
+			goto out;
 	}
 
 	rc = 0;
@@ -231,7 +248,9 @@ static int ipvrf_pids(int argc, char **argv)
 	if (ipvrf_get_netns(netns, sizeof(netns)) < 0)
 		goto out;
 
-	ret = recurse_dir(mnt, vrf, netns);
+	ret = open(mnt, O_RDONLY | O_DIRECTORY);
+	if (ret >= 0)
+		ret = recurse_dir(ret, mnt, vrf, netns);
 
 out:
 	free(mnt);
@@ -259,6 +278,43 @@ static int prog_load(int idx)
 			     "GPL", bpf_log_buf, sizeof(bpf_log_buf));
 }
 
+/*
+ * The program depends on nothing but the index of the VRF, so the first
+ * exec for a VRF pins it in the bpf fs under ip/vrf/INDEX, and later
+ * ones take it from there instead of having the verifier go over it
+ * again. Where there is no bpf fs or the pin fails, each exec loads
+ * its own program as before.
+ */
+static int prog_get(int idx)
+{
+	const char *mnt = bpf_get_work_dir(BPF_PROG_TYPE_UNSPEC);
+	char path[PATH_MAX];
+	int prog_fd;
+
+	if (!mnt)
+		return prog_load(idx);
+
+	snprintf(path, sizeof(path), "%sip/vrf/%d", mnt, idx);
+	prog_fd = bpf_prog_get_pinned(path, BPF_PROG_TYPE_CGROUP_SOCK);
+	if (prog_fd >= 0)
+		return prog_fd;
+
+	prog_fd = prog_load(idx);
+	if (prog_fd < 0)
+		return prog_fd;
+
+	/* losing a race to pin it is fine, the other one is the same */
+	snprintf(path, sizeof(path), "%sip", mnt);
+	if (mkdir(path, S_IRWXU) && errno != EEXIST)
+		return prog_fd;
+	snprintf(path, sizeof(path), "%sip/vrf", mnt);
+	if (mkdir(path, S_IRWXU) && errno != EEXIST)
+		return prog_fd;
+	snprintf(path, sizeof(path), "%sip/vrf/%d", mnt, idx);
+	bpf_obj_pin(prog_fd, path);
+	return prog_fd;
+}
+
 static int vrf_configure_cgroup(const char *path, int ifindex)
 {
 	int rc = -1, cg_fd, prog_fd = -1;
@@ -275,7 +331,7 @@ static int vrf_configure_cgroup(const char *path, int ifindex)
 	 * Load bpf program into kernel and attach to cgroup to affect
 	 * socket creates
 	 */
-	prog_fd = prog_load(ifindex);
+	prog_fd = prog_get(ifindex);
 	if (prog_fd < 0) {
 		fprintf(stderr, "Failed to load BPF prog: '%s'\n",
 			strerror(errno));
@@ -41,13 +41,13 @@
 
 #define STRBUF_SIZE	(128)
 
-struct xfrm_filter filter;
+__thread struct xfrm_filter filter;
 
 static int usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip xfrm XFRM-OBJECT { COMMAND | help }\n"
-		"where  XFRM-OBJECT := state | policy | monitor\n");
+		"where  XFRM-OBJECT := state | policy | monitor | bulk\n");
 	iprt_exit(-1);
 }
 
@@ -1512,6 +1512,8 @@ int do_xfrm(int argc, char **argv)
 		return do_xfrm_policy(argc-1, argv+1);
 	else if (matches(*argv, "monitor") == 0)
 		return do_xfrm_monitor(argc-1, argv+1);
+	else if (strcmp(*argv, "bulk") == 0)
+		return do_xfrm_bulk(argc-1, argv+1);
 	else if (matches(*argv, "help") == 0) {
 		return usage();
 		fprintf(stderr, "xfrm Object \"%s\" is unknown.\n", *argv);
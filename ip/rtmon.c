@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netinet/in.h>
@@ -23,10 +24,12 @@
 
 #include "utils.h"
 #include "libnetlink.h"
+#include "rtmon_log.h"
 
 static int init_phase = 1;
+static volatile sig_atomic_t stop;
 
-static void write_stamp(FILE *fp)
+static int write_stamp(struct rtmon_log *log)
 {
 	char buf[128];
 	struct nlmsghdr *n1 = (void *)buf;
@@ -40,18 +43,30 @@ static void write_stamp(FILE *fp)
 	gettimeofday(&tv, NULL);
 	((__u32 *)NLMSG_DATA(n1))[0] = tv.tv_sec;
 	((__u32 *)NLMSG_DATA(n1))[1] = tv.tv_usec;
-	fwrite((void *)n1, 1, NLMSG_ALIGN(n1->nlmsg_len), fp);
+	return rtmon_log_write(log, n1);
 }
 
+static int dump_links(struct rtmon_log *log);
+
 static int dump_msg(const struct sockaddr_nl *who, struct rtnl_ctrl_data *ctrl,
 		    struct nlmsghdr *n, void *arg)
 {
-	FILE *fp = (FILE *)arg;
+	struct rtmon_log *log = arg;
+
+	if (!init_phase && write_stamp(log) < 0)
+		return -1;
+	if (rtmon_log_write(log, n) < 0)
+		return -1;
 
-	if (!init_phase)
-		write_stamp(fp);
-	fwrite((void *)n, 1, NLMSG_ALIGN(n->nlmsg_len), fp);
-	fflush(fp);
+	/* a new segment starts with the links, to be read on its own */
+	if (!init_phase && rtmon_log_full(log)) {
+		if (rtmon_log_rotate(log) < 0)
+			return -1;
+		init_phase = 1;
+		if (write_stamp(log) < 0 || dump_links(log) < 0)
+			return -1;
+		init_phase = 0;
+	}
 	return 0;
 }
 
@@ -61,9 +76,47 @@ static int dump_msg2(const struct sockaddr_nl *who,
 	return dump_msg(who, NULL, n, arg);
 }
 
+static int dump_links(struct rtmon_log *log)
+{
+	struct rtnl_handle rth;
+	int ret = 0;
+
+	if (rtnl_open(&rth, 0) < 0)
+		return -1;
+
+	if (rtnl_wilddump_request(&rth, AF_UNSPEC, RTM_GETLINK) < 0 ||
+	    rtnl_dump_filter(&rth, dump_msg2, log) < 0) {
+		fprintf(stderr, "Link dump failed\n");
+		ret = -1;
+	}
+
+	rtnl_close(&rth);
+	return ret;
+}
+
+/* Events were lost, record the links again like at startup */
+static int resync(struct rtnl_handle *listener, void *arg)
+{
+	return dump_links(arg);
+}
+
+/* Once a second or after events: hand compressed data to the file */
+static int tick(struct rtnl_handle *listener, void *arg)
+{
+	if (stop)
+		return -1;
+	return rtmon_log_flush(arg);
+}
+
+static void sig_stop(int sig)
+{
+	stop = 1;
+}
+
 static int usage(void)
 {
-	fprintf(stderr, "Usage: rtmon file FILE [ all | LISTofOBJECTS]\n");
+	fprintf(stderr, "Usage: rtmon file FILE [ size MBYTES [ count COUNT ] ] [ compress ]\n");
+	fprintf(stderr, "             [ all | LISTofOBJECTS]\n");
 	fprintf(stderr, "LISTofOBJECTS := [ link ] [ address ] [ route ]\n");
 	iprt_exit(-1);
 }
@@ -71,7 +124,7 @@ static int usage(void)
 int
 main(int argc, char **argv)
 {
-	FILE *fp;
+	struct rtmon_log *log;
 	struct rtnl_handle rth;
 	int family = AF_UNSPEC;
 	unsigned int groups = ~0U;
@@ -79,6 +132,8 @@ main(int argc, char **argv)
 	int laddr = 0;
 	int lroute = 0;
 	char *file = NULL;
+	unsigned int size = 0, count = 0;
+	int compress = 0;
 
 	while (argc > 1) {
 		if (matches(argv[1], "-family") == 0) {
@@ -113,6 +168,27 @@ main(int argc, char **argv)
 			if (argc <= 1)
 				return usage();
 			file = argv[1];
+		} else if (strcmp(argv[1], "size") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				return usage();
+			if (get_unsigned(&size, argv[1], 0) || !size ||
+			    size > 1024 * 1024) {
+				fprintf(stderr, "Invalid segment size \"%s\"\n", argv[1]);
+				iprt_exit(-1);
+			}
+		} else if (strcmp(argv[1], "count") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				return usage();
+			if (get_unsigned(&count, argv[1], 0)) {
+				fprintf(stderr, "Invalid segment count \"%s\"\n", argv[1]);
+				iprt_exit(-1);
+			}
+		} else if (strcmp(argv[1], "compress") == 0) {
+			compress = 1;
 		} else if (matches(argv[1], "link") == 0) {
 			llink = 1;
 			groups = 0;
@@ -137,6 +213,10 @@ main(int argc, char **argv)
 		fprintf(stderr, "Not enough information: argument \"file\" is required\n");
 		iprt_exit(-1);
 	}
+	if (count && !size) {
+		fprintf(stderr, "\"count\" needs a segment \"size\"\n");
+		iprt_exit(-1);
+	}
 	if (llink)
 		groups |= nl_mgrp(RTNLGRP_LINK);
 	if (laddr) {
@@ -152,11 +232,9 @@ main(int argc, char **argv)
 			groups |= nl_mgrp(RTNLGRP_IPV6_ROUTE);
 	}
 
-	fp = fopen(file, "w");
-	if (fp == NULL) {
-		perror("Cannot fopen");
+	log = rtmon_log_open(file, (__u64)size << 20, count, compress);
+	if (log == NULL)
 		iprt_exit(-1);
-	}
 
 	if (rtnl_open(&rth, groups) < 0)
 		iprt_exit(1);
@@ -166,17 +244,30 @@ main(int argc, char **argv)
 		iprt_exit(1);
 	}
 
-	write_stamp(fp);
+	write_stamp(log);
 
-	if (rtnl_dump_filter(&rth, dump_msg2, fp) < 0) {
+	if (rtnl_dump_filter(&rth, dump_msg2, log) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
 
 	init_phase = 0;
+	rth.resync = resync;
 
-	if (rtnl_listen(&rth, dump_msg, (void *)fp) < 0)
+	/* the last segment gets its index, compressed data its trailer */
+	if (size || compress) {
+		struct timeval tv = { .tv_sec = 1 };
+
+		signal(SIGINT, sig_stop);
+		signal(SIGTERM, sig_stop);
+		setsockopt(rth.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		rth.tick = tick;
+	}
+
+	if (rtnl_listen(&rth, dump_msg, log) < 0 && !stop)
 		iprt_exit(2);
 
+	if (rtmon_log_close(log) < 0)
+		iprt_exit(1);
 	iprt_exit(0);
 }
@@ -0,0 +1,712 @@
+/*
+ * rtmon_log.c	Segmented rtmon captures and indexed replay.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * "rtmon file FILE size MBYTES" writes FILE.000000, FILE.000001, ...
+ * and moves on to the next segment, starting it with a fresh dump of
+ * the links, once the current one has grown past the size. Closing a
+ * segment writes SEGMENT.idx next to it: the time range it covers, how
+ * many events of each type it holds and every RTMON_INDEX_STEP bytes
+ * of the stream a stamp with its offset. "ip monitor file" passes over
+ * segments that have nothing it asks for and in the others only looks
+ * at link messages, for the device names, up to the last entry before
+ * the time wanted. Uncompressed segments are mapped, so that costs a
+ * walk over the message headers. A segment without an index, such as
+ * the one being written, is read in full.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#else
+#define Z_NO_FLUSH	0
+#endif
+
+#include "utils.h"
+#include "rtmon_log.h"
+
+struct rtmon_log {
+	const char		*prefix;
+	__u64			size;	/* rotate past this, 0 for one file */
+	unsigned int		keep;	/* newest segments kept, 0 for all */
+	int			gzip;
+	unsigned int		seq;
+	char			path[PATH_MAX];
+	FILE			*fp;
+#ifdef HAVE_ZLIB
+	z_stream		zs;
+	int			zdirty;
+#endif
+	__u64			raw;	/* bytes of the stream */
+	__u64			off;	/* bytes of the file */
+	__u64			base;	/* off after the link dump */
+	unsigned int		stamps;
+	struct rtmon_index_hdr	hdr;
+	struct rtmon_index_entry *ent;
+	unsigned int		nent;
+	unsigned int		aent;
+};
+
+static int seq_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sequence numbers of the segments of @prefix, sorted */
+static int log_segments(const char *prefix, unsigned int **seqs)
+{
+	char *dcopy = strdup(prefix), *bcopy = strdup(prefix);
+	unsigned int *s = NULL, n = 0, alloc = 0, i, j;
+	struct dirent *de;
+	const char *base;
+	size_t blen;
+	DIR *d = NULL;
+	int ret = -1;
+
+	if (!dcopy || !bcopy)
+		goto out;
+	base = basename(bcopy);
+	blen = strlen(base);
+	d = opendir(dirname(dcopy));
+	if (!d)
+		goto out;
+
+	while ((de = readdir(d)) != NULL) {
+		const char *p = de->d_name;
+		unsigned long seq;
+		char *end;
+
+		if (strncmp(p, base, blen) || p[blen] != '.' ||
+		    !isdigit((unsigned char)p[blen + 1]))
+			continue;
+		seq = strtoul(p + blen + 1, &end, 10);
+		if (end - (p + blen + 1) < 6 || seq > UINT_MAX ||
+		    (*end && strcmp(end, ".gz")))
+			continue;
+
+		if (n == alloc) {
+			unsigned int *t;
+
+			alloc = alloc ? 2 * alloc : 64;
+			t = realloc(s, alloc * sizeof(*s));
+			if (!t)
+				goto out;
+			s = t;
+		}
+		s[n++] = seq;
+	}
+
+	qsort(s, n, sizeof(*s), seq_cmp);
+	for (i = j = 0; i < n; i++)
+		if (!j || s[j - 1] != s[i])
+			s[j++] = s[i];
+	*seqs = s;
+	s = NULL;
+	ret = j;
+out:
+	if (d)
+		closedir(d);
+	free(s);
+	free(dcopy);
+	free(bcopy);
+	return ret;
+}
+
+static void seg_path(char *buf, size_t len, const char *prefix,
+		     unsigned int seq, int gzip)
+{
+	snprintf(buf, len, "%s.%06u%s", prefix, seq, gzip ? ".gz" : "");
+}
+
+static int log_put(struct rtmon_log *log, const void *buf, size_t len,
+		   int flush)
+{
+#ifdef HAVE_ZLIB
+	if (log->gzip) {
+		unsigned char out[16384];
+
+		log->zs.next_in = (void *)buf;
+		log->zs.avail_in = len;
+		do {
+			size_t have;
+
+			log->zs.next_out = out;
+			log->zs.avail_out = sizeof(out);
+			if (deflate(&log->zs, flush) == Z_STREAM_ERROR)
+				return -1;
+			have = sizeof(out) - log->zs.avail_out;
+			if (have && fwrite(out, 1, have, log->fp) != have)
+				return -1;
+			log->off += have;
+		} while (log->zs.avail_out == 0);
+
+		log->zdirty = flush == Z_NO_FLUSH;
+		return fflush(log->fp);
+	}
+#endif
+	if (fwrite(buf, 1, len, log->fp) != len)
+		return -1;
+	log->off += len;
+	return fflush(log->fp);
+}
+
+static int log_add_entry(struct rtmon_log *log, __u64 usec)
+{
+	if (log->nent == log->aent) {
+		unsigned int alloc = log->aent ? 2 * log->aent : 256;
+		struct rtmon_index_entry *ent;
+
+		ent = realloc(log->ent, alloc * sizeof(*ent));
+		if (!ent)
+			return -1;
+		log->ent = ent;
+		log->aent = alloc;
+	}
+
+	if (!log->nent)
+		log->base = log->off;
+	log->ent[log->nent++] = (struct rtmon_index_entry) {
+		.usec	= usec,
+		.raw	= log->raw,
+	};
+	return 0;
+}
+
+static int log_write_index(struct rtmon_log *log)
+{
+	char path[PATH_MAX + 8], tmp[PATH_MAX + 16];
+	int err = 0;
+	FILE *fp;
+
+	log->hdr.magic = RTMON_INDEX_MAGIC;
+	log->hdr.version = RTMON_INDEX_VERSION;
+	log->hdr.flags = log->gzip ? RTMON_INDEX_GZIP : 0;
+	log->hdr.entries = log->nent;
+
+	snprintf(path, sizeof(path), "%s.idx", log->path);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp)
+		goto fail;
+	if (fwrite(&log->hdr, sizeof(log->hdr), 1, fp) != 1 ||
+	    fwrite(log->ent, sizeof(*log->ent), log->nent, fp) != log->nent)
+		err = -1;
+	if (fclose(fp) || err || rename(tmp, path) < 0) {
+		unlink(tmp);
+		goto fail;
+	}
+	return 0;
+fail:
+	fprintf(stderr, "Cannot write index \"%s\": %s\n",
+		path, strerror(errno));
+	return -1;
+}
+
+static int log_open_segment(struct rtmon_log *log)
+{
+	if (log->size)
+		seg_path(log->path, sizeof(log->path), log->prefix,
+			 log->seq, log->gzip);
+	else
+		snprintf(log->path, sizeof(log->path), "%s", log->prefix);
+
+	log->fp = fopen(log->path, "w");
+	if (!log->fp) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n",
+			log->path, strerror(errno));
+		return -1;
+	}
+	log->raw = log->off = 0;
+	log->stamps = 0;
+	log->nent = 0;
+	memset(&log->hdr, 0, sizeof(log->hdr));
+
+#ifdef HAVE_ZLIB
+	if (log->gzip &&
+	    deflateInit2(&log->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		fprintf(stderr, "Cannot set up compression\n");
+		fclose(log->fp);
+		log->fp = NULL;
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+static int log_close_segment(struct rtmon_log *log)
+{
+	int ret = 0;
+
+	if (!log->fp)
+		return 0;
+#ifdef HAVE_ZLIB
+	if (log->gzip) {
+		ret = log_put(log, NULL, 0, Z_FINISH);
+		deflateEnd(&log->zs);
+	}
+#endif
+	if (fclose(log->fp))
+		ret = -1;
+	log->fp = NULL;
+	if (ret < 0)
+		fprintf(stderr, "Cannot write \"%s\": %s\n",
+			log->path, strerror(errno));
+	if (log->size && log_write_index(log) < 0)
+		ret = -1;
+	return ret;
+}
+
+/* Remove all but the newest log->keep segments */
+static void log_expire(struct rtmon_log *log)
+{
+	char path[PATH_MAX], idx[PATH_MAX + 8];
+	unsigned int *seqs, i;
+	int n, gzip;
+
+	n = log_segments(log->prefix, &seqs);
+	if (n <= 0)
+		return;
+	for (i = 0; i + log->keep < n; i++) {
+		for (gzip = 0; gzip < 2; gzip++) {
+			seg_path(path, sizeof(path), log->prefix, seqs[i], gzip);
+			snprintf(idx, sizeof(idx), "%s.idx", path);
+			unlink(path);
+			unlink(idx);
+		}
+	}
+	free(seqs);
+}
+
+struct rtmon_log *rtmon_log_open(const char *file, __u64 size,
+				 unsigned int keep, int gzip)
+{
+	struct rtmon_log *log;
+	unsigned int *seqs;
+	int n;
+
+#ifndef HAVE_ZLIB
+	if (gzip) {
+		fprintf(stderr, "rtmon was built without zlib, \"compress\" is not available\n");
+		return NULL;
+	}
+#endif
+	log = calloc(1, sizeof(*log));
+	if (!log)
+		return NULL;
+	log->prefix = file;
+	log->size = size;
+	log->keep = keep;
+	log->gzip = gzip;
+
+	/* carry on after the segments of an earlier run */
+	if (size && (n = log_segments(file, &seqs)) >= 0) {
+		if (n)
+			log->seq = seqs[n - 1] + 1;
+		free(seqs);
+	}
+
+	if (log_open_segment(log) < 0) {
+		free(log);
+		return NULL;
+	}
+	if (keep)
+		log_expire(log);
+	return log;
+}
+
+int rtmon_log_write(struct rtmon_log *log, const struct nlmsghdr *n)
+{
+	size_t len = NLMSG_ALIGN(n->nlmsg_len);
+
+	if (n->nlmsg_type == NLMSG_TSTAMP) {
+		const __u32 *ts = NLMSG_DATA(n);
+		__u64 usec = ts[0] * 1000000ULL + ts[1];
+
+		/* the first stamp is that of the link dump, not an event */
+		if (log->stamps++ && log->size &&
+		    (!log->nent ||
+		     log->raw - log->ent[log->nent - 1].raw >= RTMON_INDEX_STEP) &&
+		    log_add_entry(log, usec) < 0)
+			goto fail;
+		if (!log->hdr.first)
+			log->hdr.first = usec;
+		log->hdr.last = usec;
+	} else if (log->stamps > 1 && n->nlmsg_type < RTMON_INDEX_TYPES) {
+		log->hdr.counts[n->nlmsg_type]++;
+	}
+
+	if (log_put(log, n, len, Z_NO_FLUSH) < 0)
+		goto fail;
+	log->raw += len;
+	return 0;
+fail:
+	fprintf(stderr, "Cannot write \"%s\": %s\n", log->path, strerror(errno));
+	return -1;
+}
+
+/* The link dump a segment starts with does not count towards its size */
+int rtmon_log_full(const struct rtmon_log *log)
+{
+	return log->size && log->nent && log->off - log->base >= log->size;
+}
+
+int rtmon_log_rotate(struct rtmon_log *log)
+{
+	int ret = log_close_segment(log);
+
+	log->seq++;
+	if (log_open_segment(log) < 0)
+		return -1;
+	if (log->keep)
+		log_expire(log);
+	return ret;
+}
+
+/* Make what was compressed so far readable, for a quiet moment */
+int rtmon_log_flush(struct rtmon_log *log)
+{
+#ifdef HAVE_ZLIB
+	if (log->gzip && log->zdirty)
+		return log_put(log, NULL, 0, Z_SYNC_FLUSH);
+#endif
+	return 0;
+}
+
+int rtmon_log_close(struct rtmon_log *log)
+{
+	int ret = log_close_segment(log);
+
+	free(log->ent);
+	free(log);
+	return ret;
+}
+
+struct seg_reader {
+	int		fd;
+	char		*map;
+	size_t		size;
+	__u64		raw;
+#ifdef HAVE_ZLIB
+	gzFile		gz;
+	char		buf[65536];
+#endif
+};
+
+static int reader_open(struct seg_reader *r, const char *path, int gzip)
+{
+	struct stat st;
+
+	r->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (r->fd < 0 || fstat(r->fd, &st) < 0) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	if (!gzip) {
+		unsigned char magic[2];
+
+		gzip = pread(r->fd, magic, 2, 0) == 2 &&
+		       magic[0] == 0x1f && magic[1] == 0x8b;
+	}
+	if (gzip) {
+#ifdef HAVE_ZLIB
+		int fd = dup(r->fd);
+
+		r->gz = fd < 0 ? NULL : gzdopen(fd, "r");
+		if (!r->gz) {
+			if (fd >= 0)
+				close(fd);
+			fprintf(stderr, "Cannot read \"%s\"\n", path);
+			return -1;
+		}
+		return 0;
+#else
+		fprintf(stderr, "\"%s\" is compressed, but ip was built without zlib\n",
+			path);
+		return -1;
+#endif
+	}
+
+	r->size = st.st_size;
+	if (!r->size)
+		return 0;
+	/* private and writable, the printers get a struct nlmsghdr * */
+	r->map = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		      r->fd, 0);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		fprintf(stderr, "Cannot map \"%s\": %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+	madvise(r->map, r->size, MADV_SEQUENTIAL);
+	return 0;
+}
+
+static int reader_rewind(struct seg_reader *r)
+{
+	r->raw = 0;
+#ifdef HAVE_ZLIB
+	if (r->gz)
+		return gzrewind(r->gz);
+#endif
+	return 0;
+}
+
+/* 1 and the next message in @h, 0 at the end, -1 if malformed */
+static int reader_next(struct seg_reader *r, struct nlmsghdr **h)
+{
+	struct nlmsghdr *n;
+	size_t len;
+
+	if (r->map) {
+		if (r->size - r->raw < sizeof(*n))
+			return 0;
+		n = (struct nlmsghdr *)(r->map + r->raw);
+		len = NLMSG_ALIGN(n->nlmsg_len);
+		if (n->nlmsg_len < sizeof(*n))
+			goto bad;
+		/* the tail of a segment still being written */
+		if (len > r->size - r->raw)
+			return 0;
+		r->raw += len;
+		*h = n;
+		return 1;
+	}
+
+#ifdef HAVE_ZLIB
+	if (r->gz) {
+		n = (struct nlmsghdr *)r->buf;
+		if (gzread(r->gz, n, sizeof(*n)) != sizeof(*n))
+			return 0;
+		len = NLMSG_ALIGN(n->nlmsg_len);
+		if (n->nlmsg_len < sizeof(*n) || len > sizeof(r->buf))
+			goto bad;
+		if (gzread(r->gz, n + 1, len - sizeof(*n)) != len - sizeof(*n))
+			return 0;
+		r->raw += len;
+		*h = n;
+		return 1;
+	}
+#endif
+	return 0;
+bad:
+	fprintf(stderr, "!!!malformed message: len=%u @%llu\n",
+		n->nlmsg_len, (unsigned long long)r->raw);
+	return -1;
+}
+
+static void reader_close(struct seg_reader *r)
+{
+#ifdef HAVE_ZLIB
+	if (r->gz)
+		gzclose(r->gz);
+#endif
+	if (r->map)
+		munmap(r->map, r->size);
+	if (r->fd >= 0)
+		close(r->fd);
+}
+
+/* The entries of @path's index, NULL if it has none that is usable */
+static struct rtmon_index_entry *load_index(const char *path,
+					    struct rtmon_index_hdr *hdr)
+{
+	struct rtmon_index_entry *ent = NULL;
+	char idx[PATH_MAX + 8];
+	struct stat st;
+	FILE *fp;
+
+	snprintf(idx, sizeof(idx), "%s.idx", path);
+	fp = fopen(idx, "r");
+	if (!fp)
+		return NULL;
+	if (fread(hdr, sizeof(*hdr), 1, fp) != 1 ||
+	    hdr->magic != RTMON_INDEX_MAGIC ||
+	    hdr->version != RTMON_INDEX_VERSION ||
+	    fstat(fileno(fp), &st) < 0 ||
+	    st.st_size != sizeof(*hdr) + (off_t)hdr->entries * sizeof(*ent))
+		goto out;
+
+	/* one spare so that an empty index still reads as found */
+	ent = malloc((hdr->entries + 1) * sizeof(*ent));
+	if (ent && fread(ent, sizeof(*ent), hdr->entries, fp) != hdr->entries) {
+		free(ent);
+		ent = NULL;
+	}
+out:
+	fclose(fp);
+	return ent;
+}
+
+struct replay {
+	const struct rtmon_log_filter	*f;
+	rtnl_listen_filter_t		handler;
+	void				*arg;
+	int				all;	/* no filter, pass stamps on */
+	int				primed;	/* device names are known */
+	int				done;
+	__u64				now;
+	int				pending;
+	__u32				stamp[NLMSG_LENGTH(8) / 4];
+};
+
+static int index_wanted(const struct rtmon_log_filter *f,
+			const struct rtmon_index_hdr *hdr)
+{
+	int t;
+
+	if (hdr->last && (hdr->last < f->since || hdr->first > f->until))
+		return 0;
+	if (f->all_types)
+		return 1;
+	for (t = 0; t < RTMON_INDEX_TYPES; t++)
+		if (hdr->counts[t] && rtmon_log_wanted(f, t))
+			return 1;
+	return 0;
+}
+
+static int replay_segment(struct replay *rp, const char *path)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	const struct rtmon_log_filter *f = rp->f;
+	struct rtmon_index_entry *ent;
+	struct rtmon_index_hdr hdr;
+	struct seg_reader *r;
+	struct nlmsghdr *n;
+	int ret = -1;
+
+	ent = load_index(path, &hdr);
+	if (ent && !index_wanted(f, &hdr)) {
+		free(ent);
+		return 0;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r || reader_open(r, path, ent && (hdr.flags & RTMON_INDEX_GZIP)) < 0)
+		goto out;
+
+	/*
+	 * Only the device names matter up to the last entry at or before
+	 * since, or the end of the link dump the segment starts with: that
+	 * lists a device before the peer or master it refers to.
+	 */
+	if (ent && hdr.entries && !rp->primed) {
+		unsigned int lo = 0, hi = hdr.entries;
+		int skip = f->since > ent[0].usec;
+
+		while (skip && hi - lo > 1) {
+			unsigned int mid = (lo + hi) / 2;
+
+			if (ent[mid].usec <= f->since)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		ret = 0;
+		while (r->raw < ent[lo].raw && (ret = reader_next(r, &n)) > 0) {
+			if (f->quiet && (n->nlmsg_type == RTM_NEWLINK ||
+					 n->nlmsg_type == RTM_DELLINK) &&
+			    f->quiet(&nladdr, NULL, n, rp->arg) < 0)
+				goto out;
+		}
+		if (ret < 0 || (!skip && reader_rewind(r) < 0))
+			goto out;
+		if (skip)
+			rp->now = ent[lo].usec;
+	}
+	rp->primed = 1;
+
+	while ((ret = reader_next(r, &n)) > 0) {
+		if (n->nlmsg_type == NLMSG_TSTAMP) {
+			const __u32 *ts = NLMSG_DATA(n);
+
+			rp->now = ts[0] * 1000000ULL + ts[1];
+			if (rp->now > f->until) {
+				rp->done = 1;
+				break;
+			}
+			if (!rp->all && n->nlmsg_len <= sizeof(rp->stamp)) {
+				memcpy(rp->stamp, n, n->nlmsg_len);
+				rp->pending = 1;
+				continue;
+			}
+		} else {
+			if (rp->now < f->since ||
+			    !rtmon_log_wanted(f, n->nlmsg_type))
+				continue;
+			if (rp->pending) {
+				rp->pending = 0;
+				ret = rp->handler(&nladdr, NULL,
+						  (struct nlmsghdr *)rp->stamp,
+						  rp->arg);
+				if (ret < 0)
+					break;
+			}
+		}
+		ret = rp->handler(&nladdr, NULL, n, rp->arg);
+		if (ret < 0)
+			break;
+	}
+out:
+	if (r)
+		reader_close(r);
+	free(r);
+	free(ent);
+	return ret < 0 ? -1 : 0;
+}
+
+int rtmon_log_replay(const char *file, const struct rtmon_log_filter *f,
+		     rtnl_listen_filter_t handler, void *arg)
+{
+	struct replay rp = {
+		.f		= f,
+		.handler	= handler,
+		.arg		= arg,
+		.all		= f->all_types && !f->since && f->until == ~0ULL,
+	};
+	char path[PATH_MAX];
+	unsigned int *seqs;
+	struct stat st;
+	int i, n, ret = 0;
+
+	if (stat(file, &st) == 0)
+		return replay_segment(&rp, file);
+
+	n = log_segments(file, &seqs);
+	if (n <= 0) {
+		errno = ENOENT;
+		perror("Cannot fopen");
+		return -ENOENT;
+	}
+
+	for (i = 0; i < n && !rp.done && ret == 0; i++) {
+		seg_path(path, sizeof(path), file, seqs[i], 0);
+		if (stat(path, &st) < 0)
+			seg_path(path, sizeof(path), file, seqs[i], 1);
+		ret = replay_segment(&rp, path);
+	}
+	free(seqs);
+	return ret;
+}
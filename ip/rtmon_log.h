@@ -0,0 +1,70 @@
+#ifndef _RTMON_LOG_H_
+#define _RTMON_LOG_H_ 1
+
+#include <linux/types.h>
+#include <linux/rtnetlink.h>
+
+#include "libnetlink.h"
+
+#define RTMON_INDEX_MAGIC	0x494d5452	/* "RTMI" */
+#define RTMON_INDEX_VERSION	1
+#define RTMON_INDEX_GZIP	0x1		/* segment is compressed */
+#define RTMON_INDEX_TYPES	(RTM_MAX + 1)
+#define RTMON_INDEX_STEP	(64 * 1024)	/* stream bytes per entry */
+
+/* SEGMENT.idx: this header followed by hdr.entries entries */
+struct rtmon_index_hdr {
+	__u32	magic;
+	__u32	version;
+	__u32	flags;
+	__u32	entries;
+	__u64	first;		/* usec of the first and the last stamp */
+	__u64	last;
+	__u64	counts[RTMON_INDEX_TYPES];	/* events by nlmsg_type */
+};
+
+/* A stamp @raw bytes into the stream of messages */
+struct rtmon_index_entry {
+	__u64	usec;
+	__u64	raw;
+};
+
+struct rtmon_log;
+
+struct rtmon_log *rtmon_log_open(const char *file, __u64 size,
+				 unsigned int keep, int gzip);
+int rtmon_log_write(struct rtmon_log *log, const struct nlmsghdr *n);
+int rtmon_log_full(const struct rtmon_log *log);
+int rtmon_log_rotate(struct rtmon_log *log);
+int rtmon_log_flush(struct rtmon_log *log);
+int rtmon_log_close(struct rtmon_log *log);
+
+struct rtmon_log_filter {
+	__u64			since;	/* usec, 0 and ~0 for no limit */
+	__u64			until;
+	int			all_types;
+	__u8			types[(RTMON_INDEX_TYPES + 7) / 8];
+	/* sees the link messages of what is skipped to reach since */
+	rtnl_listen_filter_t	quiet;
+};
+
+static inline void rtmon_log_want(struct rtmon_log_filter *f, __u16 type)
+{
+	if (type < RTMON_INDEX_TYPES)
+		f->types[type / 8] |= 1 << (type % 8);
+}
+
+static inline int rtmon_log_wanted(const struct rtmon_log_filter *f,
+				   __u16 type)
+{
+	if (f->all_types)
+		return 1;
+	return type < RTMON_INDEX_TYPES &&
+	       (f->types[type / 8] & (1 << (type % 8)));
+}
+
+/* -ENOENT if there is neither FILE nor any FILE.NNNNNN */
+int rtmon_log_replay(const char *file, const struct rtmon_log_filter *f,
+		     rtnl_listen_filter_t handler, void *arg);
+
+#endif /* _RTMON_LOG_H_ */
@@ -29,7 +29,7 @@
 static int usage(void)
 {
 	fprintf(stderr, "Usage: ip tcp_metrics/tcpmetrics { COMMAND | help }\n");
-	fprintf(stderr, "       ip tcp_metrics { show | flush } SELECTOR\n");
+	fprintf(stderr, "       ip tcp_metrics { show | flush | summary } SELECTOR\n");
 	fprintf(stderr, "       ip tcp_metrics delete [ address ] ADDRESS\n");
 	fprintf(stderr, "SELECTOR := [ [ address ] PREFIX ]\n");
 	iprt_exit(-1);
@@ -47,6 +47,7 @@ static const double usec_per_sec = 1000000.;
 #define CMD_LIST	0x0001	/* list, lst, show		*/
 #define CMD_DEL		0x0002	/* delete, remove		*/
 #define CMD_FLUSH	0x0004	/* flush			*/
+#define CMD_SUMMARY	0x0008	/* summary			*/
 
 static const struct {
 	const char *name;
@@ -58,6 +59,7 @@ static const struct {
 	{	"delete",	CMD_DEL		},
 	{	"remove",	CMD_DEL		},
 	{	"flush",	CMD_FLUSH	},
+	{	"summary",	CMD_SUMMARY	},
 };
 
 static const char *metric_name[TCP_METRIC_MAX + 1] = {
@@ -68,26 +70,196 @@ static const char *metric_name[TCP_METRIC_MAX + 1] = {
 	[TCP_METRIC_REORDERING]		= "reordering",
 };
 
+/*
+ * "summary" groups the entries by the /24 (IPv4) or /64 (IPv6) of their
+ * destination while the dump is read, keeping only the rtt of each.
+ */
+#define TCPM_GROUP_HASH_SIZE	4096
+
+struct tcpm_group {
+	struct tcpm_group	*next;
+	int			family;
+	__u8			prefix[8];
+	unsigned int		entries;
+	unsigned int		nrtt;
+	unsigned int		rtt_size;
+	__u32			*rtt;	/* us */
+};
+
 static struct {
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_txq *flushq;
 	int cmd;
 	inet_prefix daddr;
 	inet_prefix saddr;
+	struct tcpm_group **groups;
+	unsigned int ngroups;
 } f;
 
 static int flush_update(void)
 {
-	if (rtnl_send_check(&grth, f.flushb, f.flushp) < 0) {
-		perror("Failed to send flush request\n");
+	if (rtnl_flush_send(&grth, f.flushq)) {
+		fprintf(stderr, "Failed to flush TCP metrics\n");
 		return -1;
 	}
-	f.flushp = 0;
 	return 0;
 }
 
+/* rtt in us, 0 if the entry has none */
+static unsigned long tcpm_rtt(struct rtattr *a)
+{
+	struct rtattr *m[TCP_METRIC_MAX + 1 + 1];
+
+	if (!a)
+		return 0;
+	parse_rtattr_nested(m, TCP_METRIC_MAX + 1, a);
+	if (m[TCP_METRIC_RTT_US + 1])
+		return rta_getattr_u32(m[TCP_METRIC_RTT_US + 1]) >> 3;
+	if (m[TCP_METRIC_RTT + 1])
+		return (rta_getattr_u32(m[TCP_METRIC_RTT + 1]) * 1000UL) >> 3;
+	return 0;
+}
+
+static int tcpm_group_add(const inet_prefix *daddr, struct rtattr *vals)
+{
+	unsigned int plen = daddr->family == AF_INET ? 3 : 8;
+	struct tcpm_group *g;
+	unsigned int h = 2166136261U, i;
+	unsigned long rtt;
+
+	if (!f.groups) {
+		f.groups = calloc(TCPM_GROUP_HASH_SIZE, sizeof(*f.groups));
+		if (!f.groups)
+			return -1;
+	}
+
+	for (i = 0; i < plen; i++)
+		h = (h ^ ((__u8 *)daddr->data)[i]) * 16777619U;
+	h &= TCPM_GROUP_HASH_SIZE - 1;
+
+	for (g = f.groups[h]; g; g = g->next)
+		if (g->family == daddr->family &&
+		    !memcmp(g->prefix, daddr->data, plen))
+			break;
+	if (!g) {
+		g = calloc(1, sizeof(*g));
+		if (!g)
+			return -1;
+		g->family = daddr->family;
+		memcpy(g->prefix, daddr->data, plen);
+		g->next = f.groups[h];
+		f.groups[h] = g;
+		f.ngroups++;
+	}
+	g->entries++;
+
+	rtt = tcpm_rtt(vals);
+	if (!rtt)
+		return 0;
+	if (g->nrtt == g->rtt_size) {
+		unsigned int size = g->rtt_size ? 2 * g->rtt_size : 8;
+		__u32 *p = realloc(g->rtt, size * sizeof(*p));
+
+		if (!p)
+			return -1;
+		g->rtt = p;
+		g->rtt_size = size;
+	}
+	g->rtt[g->nrtt++] = rtt;
+	return 0;
+}
+
+static int u32_cmp(const void *a, const void *b)
+{
+	__u32 x = *(const __u32 *)a, y = *(const __u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int tcpm_group_cmp(const void *a, const void *b)
+{
+	const struct tcpm_group *x = *(struct tcpm_group * const *)a;
+	const struct tcpm_group *y = *(struct tcpm_group * const *)b;
+
+	if (x->entries != y->entries)
+		return x->entries < y->entries ? 1 : -1;
+	if (x->family != y->family)
+		return x->family - y->family;
+	return memcmp(x->prefix, y->prefix, sizeof(x->prefix));
+}
+
+static void print_rtt_pct(const struct tcpm_group *g, const char *name,
+			  unsigned int pct)
+{
+	__u32 rtt = g->rtt[(g->nrtt - 1) * pct / 100];
+	char key[16];
+
+	snprintf(key, sizeof(key), "rtt_%s", name);
+	print_float(PRINT_JSON, key, NULL, (double)rtt / usec_per_sec);
+	print_string(PRINT_FP, NULL, " %s", name);
+	print_uint(PRINT_FP, NULL, " %uus", rtt);
+}
+
+static void tcpm_summary_print(void)
+{
+	struct tcpm_group **v, *g;
+	unsigned int i, n = 0;
+
+	v = malloc((f.ngroups ? : 1) * sizeof(*v));
+	if (!v) {
+		perror("malloc");
+		return;
+	}
+	for (i = 0; f.groups && i < TCPM_GROUP_HASH_SIZE; i++)
+		for (g = f.groups[i]; g; g = g->next)
+			v[n++] = g;
+	qsort(v, n, sizeof(*v), tcpm_group_cmp);
+
+	for (i = 0; i < n; i++) {
+		__u8 addr[16] = {};
+		char pfx[64];
+
+		g = v[i];
+		memcpy(addr, g->prefix, g->family == AF_INET ? 3 : 8);
+		snprintf(pfx, sizeof(pfx), "%s/%d",
+			 format_host(g->family, g->family == AF_INET ? 4 : 16,
+				     addr),
+			 g->family == AF_INET ? 24 : 64);
+
+		open_json_object(NULL);
+		print_color_string(PRINT_ANY, ifa_family_color(g->family),
+				   "prefix", "%s", pfx);
+		print_uint(PRINT_ANY, "entries", " entries %u", g->entries);
+		if (g->nrtt) {
+			qsort(g->rtt, g->nrtt, sizeof(*g->rtt), u32_cmp);
+			print_string(PRINT_FP, NULL, " rtt", NULL);
+			print_rtt_pct(g, "p50", 50);
+			print_rtt_pct(g, "p90", 90);
+			print_rtt_pct(g, "p99", 99);
+		}
+		print_string(PRINT_FP, NULL, "\n", "");
+		close_json_object();
+	}
+	free(v);
+}
+
+static void tcpm_summary_free(void)
+{
+	struct tcpm_group *g;
+	unsigned int i;
+
+	for (i = 0; f.groups && i < TCPM_GROUP_HASH_SIZE; i++) {
+		while ((g = f.groups[i])) {
+			f.groups[i] = g->next;
+			free(g->rtt);
+			free(g);
+		}
+	}
+	free(f.groups);
+	f.groups = NULL;
+	f.ngroups = 0;
+}
+
 static void print_tcp_metrics(struct rtattr *a)
 {
 	struct rtattr *m[TCP_METRIC_MAX + 1 + 1];
@@ -231,9 +403,15 @@ static int process_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 			return 0;
 	}
 
-	if (f.flushb) {
-		struct nlmsghdr *fn;
+	if (f.cmd & CMD_SUMMARY) {
+		if (tcpm_group_add(&daddr, attrs[TCP_METRICS_ATTR_VALS]) < 0) {
+			perror("Cannot account entry");
+			return -1;
+		}
+		return 0;
+	}
 
+	if (f.flushq) {
 		TCPM_REQUEST(req2, 128, TCP_METRICS_CMD_DEL, NLM_F_REQUEST);
 
 		addattr_l(&req2.n, sizeof(req2), atype, daddr.data,
@@ -242,14 +420,8 @@ static int process_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 			addattr_l(&req2.n, sizeof(req2), stype, saddr.data,
 				  saddr.bytelen);
 
-		if (NLMSG_ALIGN(f.flushp) + req2.n.nlmsg_len > f.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr *) (f.flushb + NLMSG_ALIGN(f.flushp));
-		memcpy(fn, &req2.n, req2.n.nlmsg_len);
-		fn->nlmsg_seq = ++grth.seq;
-		f.flushp = (((char *) fn) + req2.n.nlmsg_len) - f.flushb;
+		if (rtnl_flush_add(f.flushq, &req2.n, genl_family) < 0)
+			return -1;
 		f.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -441,7 +613,8 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 		iprt_exit(1);
 	req.n.nlmsg_type = genl_family;
 
-	if (!(cmd & CMD_FLUSH) && (atype >= 0 || (cmd & CMD_DEL))) {
+	if (!(cmd & (CMD_FLUSH | CMD_SUMMARY)) &&
+	    (atype >= 0 || (cmd & CMD_DEL))) {
 		if (ack)
 			req.n.nlmsg_flags |= NLM_F_ACK;
 		if (atype >= 0)
@@ -455,13 +628,16 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 	}
 
 	f.cmd = cmd;
+	/*
+	 * The kernel dumps the whole cache whatever the request holds, so
+	 * prefixes are matched here. Each round deletes what a whole dump
+	 * matched, pipelined, and the next one normally finds nothing.
+	 */
 	if (cmd & CMD_FLUSH) {
+		struct rtnl_txq flushq = {};
 		int round = 0;
-		char flushb[4096-512];
 
-		f.flushb = flushb;
-		f.flushp = 0;
-		f.flushe = sizeof(flushb);
+		f.flushq = &flushq;
 
 		for (;;) {
 			req.n.nlmsg_seq = grth.dump = ++grth.seq;
@@ -481,6 +657,8 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 					printf("*** Flush is complete after %d round%s ***\n",
 					       round, round > 1 ? "s" : "");
 				fflush(stdout);
+				rtnl_txq_free(&flushq);
+				f.flushq = NULL;
 				return 0;
 			}
 			round++;
@@ -498,7 +676,7 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 	if (ack) {
 		if (rtnl_talk(&grth, &req.n, NULL) < 0)
 			return -2;
-	} else if (atype >= 0) {
+	} else if (atype >= 0 && !(cmd & CMD_SUMMARY)) {
 		if (rtnl_talk(&grth, &req.n, &answer) < 0)
 			return -2;
 		if (process_msg(NULL, answer, stdout) < 0) {
@@ -519,6 +697,10 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 			fprintf(stderr, "Dump terminated\n");
 			iprt_exit(1);
 		}
+		if (cmd & CMD_SUMMARY) {
+			tcpm_summary_print();
+			tcpm_summary_free();
+		}
 		delete_json_obj();
 	}
 	return 0;
@@ -192,6 +192,82 @@ __be32 tnl_parse_key(const char *name, const char *key)
 	return htonl(uval);
 }
 
+/*
+ * "ADDR+N" is the address N after ADDR, so that the tunnels of a range
+ * can count their endpoints up with "remote ADDR+%d".
+ */
+void tnl_get_addr(inet_prefix *addr, const char *arg, int family)
+{
+	const char *plus = strchr(arg, '+');
+	char base[64];
+	unsigned int n;
+	__u8 *b;
+	int i;
+
+	if (!plus) {
+		get_addr(addr, arg, family);
+		return;
+	}
+	if (plus - arg >= sizeof(base) || get_unsigned(&n, plus + 1, 0)) {
+		fprintf(stderr, "Invalid address \"%s\"\n", arg);
+		iprt_exit(1);
+	}
+	memcpy(base, arg, plus - arg);
+	base[plus - arg] = '\0';
+	get_addr(addr, base, family);
+
+	b = (__u8 *)addr->data;
+	for (i = addr->bytelen - 1; i >= 0 && n; i--) {
+		n += b[i];
+		b[i] = n & 0xff;
+		n >>= 8;
+	}
+	if (n) {
+		fprintf(stderr, "Address \"%s\" is out of range\n", arg);
+		iprt_exit(1);
+	}
+}
+
+/*
+ * Tunnels are added with an RTM_NEWLINK of their link kind, which a
+ * range pipelines. The ioctl on the fallback device is left for kernels
+ * that do not know the kind.
+ */
+struct rtattr *tnl_newlink_init(struct tnl_newlink_req *req, const char *name,
+				const char *kind, struct rtattr **linkinfo)
+{
+	memset(req, 0, sizeof(*req));
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL;
+	req->n.nlmsg_type = RTM_NEWLINK;
+	req->i.ifi_family = AF_UNSPEC;
+
+	if (name[0])
+		addattr_l(&req->n, sizeof(*req), IFLA_IFNAME, name,
+			  strlen(name) + 1);
+	*linkinfo = addattr_nest(&req->n, sizeof(*req), IFLA_LINKINFO);
+	addattr_l(&req->n, sizeof(*req), IFLA_INFO_KIND, kind, strlen(kind));
+	return addattr_nest(&req->n, sizeof(*req), IFLA_INFO_DATA);
+}
+
+int tnl_newlink_add(struct tnl_newlink_req *req, struct rtattr *linkinfo,
+		    struct rtattr *data, const char *basedev, void *p)
+{
+	const char *name = p;	/* both parms start with the name */
+
+	addattr_nest_end(&req->n, data);
+	addattr_nest_end(&req->n, linkinfo);
+
+	if (rtnl_talk_suppress_rtnl_errmsg(&rth, &req->n, NULL) == 0)
+		return 0;
+	if (errno == EOPNOTSUPP)
+		return tnl_add_ioctl(SIOCADDTUNNEL, basedev, name, p) ? -2 : 0;
+
+	fprintf(stderr, "add tunnel \"%s\" failed: %s\n",
+		name[0] ? name : basedev, strerror(errno));
+	return -2;
+}
+
 static const char *tnl_encap_str(const char *name, int enabled, int port)
 {
 	static const char ne[][sizeof("no")] = {
@@ -24,11 +24,14 @@
 #include "iprt.h"
 #include <stdbool.h>
 #include <linux/types.h>
+#include <linux/rtnetlink.h>
+
+#include "utils.h"
 
 struct rtattr;
 struct ifinfomsg;
 
-extern struct rtnl_handle rth;
+extern __thread struct rtnl_handle rth;
 
 struct tnl_print_nlmsg_info {
 	const struct ifinfomsg *ifi;
@@ -51,6 +54,18 @@ int tnl_prl_ioctl(int cmd, const char *name, void *p);
 int tnl_6rd_ioctl(int cmd, const char *name, void *p);
 int tnl_ioctl_get_6rd(const char *name, void *p);
 __be32 tnl_parse_key(const char *name, const char *key);
+void tnl_get_addr(inet_prefix *addr, const char *arg, int family);
+
+struct tnl_newlink_req {
+	struct nlmsghdr		n;
+	struct ifinfomsg	i;
+	char			buf[1024];
+};
+
+struct rtattr *tnl_newlink_init(struct tnl_newlink_req *req, const char *name,
+				const char *kind, struct rtattr **linkinfo);
+int tnl_newlink_add(struct tnl_newlink_req *req, struct rtattr *linkinfo,
+		    struct rtattr *data, const char *basedev, void *p);
 void tnl_print_encap(struct rtattr *tb[],
 		     int encap_type, int encap_flags,
 		     int encap_sport, int encap_dport);
@@ -29,6 +29,7 @@
 #include <linux/in.h>
 #include <linux/xfrm.h>
 #include <linux/ipsec.h>
+#include "libnetlink.h"
 
 #ifndef IPPROTO_MH
 #define IPPROTO_MH              135
@@ -61,13 +62,10 @@
 		} \
 	} while(0)
 
-struct xfrm_buffer {
-	char *buf;
-	int size;
-	int offset;
-
+/* the deletes of a deleteall, queued while the dump is read */
+struct xfrm_deleteall {
+	struct rtnl_txq q;
 	int nlmsg_count;
-	struct rtnl_handle *rth;
 };
 
 struct xfrm_filter {
@@ -102,7 +100,13 @@ struct xfrm_filter {
 };
 #define XFRM_FILTER_MASK_FULL (~0)
 
-extern struct xfrm_filter filter;
+extern __thread struct xfrm_filter filter;
+
+struct xfrm_state_req {
+	struct nlmsghdr		n;
+	struct xfrm_usersa_info	xsinfo;
+	char			buf[2048];
+};
 
 int xfrm_state_print(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		     void *arg);
@@ -111,6 +115,18 @@ int xfrm_policy_print(const struct sockaddr_nl *who, struct nlmsghdr *n,
 int do_xfrm_state(int argc, char **argv);
 int do_xfrm_policy(int argc, char **argv);
 int do_xfrm_monitor(int argc, char **argv);
+int do_xfrm_bulk(int argc, char **argv);
+int xfrm_policy_lookup(int argc, char **argv);
+
+/* "ip xfrm policy save" files, see ipsave.c */
+extern const struct ipsave_ops xfrm_policy_save_ops;
+
+int xfrm_state_parse(struct xfrm_state_req *req, int cmd, unsigned int flags,
+		     int argc, char **argv);
+int xfrm_state_set_key(struct nlmsghdr *n, int type, char *key);
+int xfrm_state_filter_match(struct xfrm_usersa_info *xsinfo);
+void xfrm_state_dump_request(struct rtnl_handle *rth);
+int xfrm_state_stats(int argc, char **argv);
 
 int xfrm_addr_match(xfrm_address_t *x1, xfrm_address_t *x2, int bits);
 int xfrm_xfrmproto_is_ipsec(__u8 proto);
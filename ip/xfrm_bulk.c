@@ -0,0 +1,498 @@
+/*
+ * xfrm_bulk.c	"ip xfrm bulk", SAs and policies of many tunnels at once.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The file names templates, each the arguments of "ip xfrm state add"
+ * less the addresses and SPI, and then lists tunnels made from them.
+ * A template is parsed and serialized once; every SA of its tunnels is a
+ * copy of it with the addresses, SPI and reqid patched in and, if the
+ * tunnel has keys of its own, the key material overwritten in place. The
+ * SAs and policies of all tunnels are pipelined on one socket, and the
+ * kernel's answers are reported by line of the file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "xfrm.h"
+#include "ip_common.h"
+
+#define BULK_HASH_SIZE	256
+#define BULK_MAX_KEYS	4
+
+/* cookie of an item: its line << BULK_ITEM_BITS | its number */
+#define BULK_ITEM_BITS	3
+
+enum {
+	BULK_SA_OUT,
+	BULK_SA_IN,
+	BULK_POLICY_OUT,
+	BULK_POLICY_IN,
+	BULK_POLICY_FWD,
+};
+
+static const char *bulk_items[] = {
+	[BULK_SA_OUT]		= "outbound SA",
+	[BULK_SA_IN]		= "inbound SA",
+	[BULK_POLICY_OUT]	= "out policy",
+	[BULK_POLICY_IN]	= "in policy",
+	[BULK_POLICY_FWD]	= "fwd policy",
+};
+
+struct bulk_template {
+	struct bulk_template	*next;
+	char			*name;
+	struct xfrm_mark	mark;
+	struct xfrm_state_req	req;
+};
+
+struct bulk_key {
+	int			type;
+	char			*key;
+};
+
+struct bulk_tunnel {
+	struct bulk_template	*t;
+	__u16			family;
+	xfrm_address_t		local;
+	xfrm_address_t		remote;
+	__u32			spi_out;	/* network order */
+	__u32			spi_in;
+	__u32			reqid;
+	inet_prefix		local_net;
+	inet_prefix		remote_net;
+	__u32			priority;
+	struct bulk_key		keys_out[BULK_MAX_KEYS];
+	struct bulk_key		keys_in[BULK_MAX_KEYS];
+	unsigned int		nkeys_out;
+	unsigned int		nkeys_in;
+};
+
+struct xfrm_bulk {
+	const char		*name;
+	struct rtnl_handle	rth;
+	struct bulk_template	*hash[BULK_HASH_SIZE];
+	unsigned int		sas;
+	unsigned int		policies;
+	unsigned int		sas_failed;
+	unsigned int		policies_failed;
+	int			ret;
+};
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"Usage: ip xfrm bulk FILE\n"
+		"where  FILE holds lines of\n"
+		"       template NAME XFRM-PROTO-AND-ALGOS [ STATE-OPTIONS ]\n"
+		"       tunnel NAME local ADDR remote ADDR spi-out SPI spi-in SPI\n"
+		"              [ reqid REQID ] [ key-out ALGO-TYPE ALGO-KEYMAT ]\n"
+		"              [ key-in ALGO-TYPE ALGO-KEYMAT ]\n"
+		"              [ local-net PREFIX remote-net PREFIX [ priority PRIORITY ] ]\n"
+		"STATE-OPTIONS are those of \"ip xfrm state add\" other than ID.\n");
+	iprt_exit(-1);
+}
+
+static unsigned int bulk_hash(const char *name)
+{
+	__u32 h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (__u8)*name++) * 16777619U;
+	return h & (BULK_HASH_SIZE - 1);
+}
+
+static struct bulk_template *bulk_find(struct xfrm_bulk *b, const char *name)
+{
+	struct bulk_template *t;
+
+	for (t = b->hash[bulk_hash(name)]; t; t = t->next) {
+		if (strcmp(t->name, name) == 0)
+			return t;
+	}
+	return NULL;
+}
+
+static int bulk_error(struct xfrm_bulk *b, const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s:%d: %s", b->name, cmdlineno, msg);
+	if (arg)
+		fprintf(stderr, " \"%s\"", arg);
+	fprintf(stderr, "\n");
+	return -1;
+}
+
+static void bulk_err(__u32 cookie, int error, void *arg)
+{
+	struct xfrm_bulk *b = arg;
+	unsigned int item = cookie & ((1 << BULK_ITEM_BITS) - 1);
+
+	if (item <= BULK_SA_IN)
+		b->sas_failed++;
+	else
+		b->policies_failed++;
+	b->ret = -2;
+	fprintf(stderr, "%s:%u: Cannot add %s: %s\n", b->name,
+		cookie >> BULK_ITEM_BITS, bulk_items[item], strerror(-error));
+}
+
+static int bulk_send(struct xfrm_bulk *b, struct nlmsghdr *n, int item)
+{
+	rtnl_async_cookie(&b->rth, (cmdlineno << BULK_ITEM_BITS) | item);
+	if (rtnl_talk(&b->rth, n, NULL) < 0)
+		b->ret = -2;
+	return 0;
+}
+
+static int bulk_template(struct xfrm_bulk *b, int argc, char **argv)
+{
+	struct bulk_template *t;
+	struct rtattr *rta;
+	int family = preferred_family;
+	unsigned int h;
+	int len;
+
+	if (argc < 2)
+		return bulk_error(b, "template wants a name and arguments", NULL);
+	if (bulk_find(b, argv[0]))
+		return bulk_error(b, "duplicate template", argv[0]);
+
+	t = calloc(1, sizeof(*t));
+	if (!t || !(t->name = strdup(argv[0]))) {
+		free(t);
+		return bulk_error(b, "Out of memory", NULL);
+	}
+
+	xfrm_state_parse(&t->req, XFRM_MSG_NEWSA, 0, argc - 1, argv + 1);
+	preferred_family = family;
+
+	if (!xfrm_xfrmproto_is_ipsec(t->req.xsinfo.id.proto)) {
+		free(t->name);
+		free(t);
+		return bulk_error(b, "template wants an IPsec XFRM-PROTO", argv[0]);
+	}
+
+	/* the policies of its tunnels carry the same mark */
+	rta = XFRMS_RTA(NLMSG_DATA(&t->req.n));
+	len = XFRMS_PAYLOAD(&t->req.n);
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == XFRMA_MARK)
+			memcpy(&t->mark, RTA_DATA(rta), sizeof(t->mark));
+	}
+
+	h = bulk_hash(t->name);
+	t->next = b->hash[h];
+	b->hash[h] = t;
+	return 0;
+}
+
+static int bulk_addr(struct xfrm_bulk *b, struct bulk_tunnel *tu,
+		     xfrm_address_t *addr, const char *arg)
+{
+	inet_prefix p;
+
+	if (get_addr_1(&p, arg, tu->family ? : preferred_family) < 0 ||
+	    p.family == AF_UNSPEC)
+		return bulk_error(b, "invalid address", arg);
+	if (tu->family && tu->family != p.family)
+		return bulk_error(b, "address family differs", arg);
+	tu->family = p.family;
+	memset(addr, 0, sizeof(*addr));
+	memcpy(addr, p.data, p.bytelen);
+	return 0;
+}
+
+static int bulk_key(struct xfrm_bulk *b, struct bulk_key *keys,
+		    unsigned int *nkeys, char *type, char *key)
+{
+	int t = xfrm_algotype_getbyname(type);
+
+	switch (t) {
+	case XFRMA_ALG_AEAD:
+	case XFRMA_ALG_CRYPT:
+	case XFRMA_ALG_AUTH:
+	case XFRMA_ALG_AUTH_TRUNC:
+		break;
+	default:
+		return bulk_error(b, "invalid ALGO-TYPE", type);
+	}
+	if (*nkeys >= BULK_MAX_KEYS)
+		return bulk_error(b, "too many keys", key);
+
+	keys[*nkeys].type = t;
+	keys[*nkeys].key = key;
+	(*nkeys)++;
+	return 0;
+}
+
+static int bulk_sa(struct xfrm_bulk *b, const struct bulk_tunnel *tu, int item)
+{
+	const struct bulk_template *t = tu->t;
+	const struct bulk_key *keys;
+	struct xfrm_state_req req;
+	unsigned int i, nkeys;
+
+	memcpy(&req, &t->req, t->req.n.nlmsg_len);
+	req.xsinfo.family = tu->family;
+	if (tu->reqid)
+		req.xsinfo.reqid = tu->reqid;
+	if (item == BULK_SA_OUT) {
+		req.xsinfo.saddr = tu->local;
+		req.xsinfo.id.daddr = tu->remote;
+		req.xsinfo.id.spi = tu->spi_out;
+		keys = tu->keys_out;
+		nkeys = tu->nkeys_out;
+	} else {
+		req.xsinfo.saddr = tu->remote;
+		req.xsinfo.id.daddr = tu->local;
+		req.xsinfo.id.spi = tu->spi_in;
+		keys = tu->keys_in;
+		nkeys = tu->nkeys_in;
+	}
+
+	for (i = 0; i < nkeys; i++) {
+		if (xfrm_state_set_key(&req.n, keys[i].type, keys[i].key) < 0)
+			return bulk_error(b, "cannot set the key of",
+					  bulk_items[item]);
+	}
+
+	b->sas++;
+	return bulk_send(b, &req.n, item);
+}
+
+static int bulk_policy(struct xfrm_bulk *b, const struct bulk_tunnel *tu,
+		       int item)
+{
+	const struct bulk_template *t = tu->t;
+	const inet_prefix *src, *dst;
+	struct {
+		struct nlmsghdr			n;
+		struct xfrm_userpolicy_info	xpinfo;
+		char				buf[256];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.xpinfo)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_NEWPOLICY,
+		.xpinfo.sel.family = tu->family,
+		.xpinfo.priority = tu->priority,
+		.xpinfo.action = XFRM_POLICY_ALLOW,
+		.xpinfo.lft.soft_byte_limit = XFRM_INF,
+		.xpinfo.lft.hard_byte_limit = XFRM_INF,
+		.xpinfo.lft.soft_packet_limit = XFRM_INF,
+		.xpinfo.lft.hard_packet_limit = XFRM_INF,
+	};
+	struct xfrm_user_tmpl tmpl = {
+		.family = tu->family,
+		.id.proto = t->req.xsinfo.id.proto,
+		.mode = t->req.xsinfo.mode,
+		.reqid = tu->reqid ? : t->req.xsinfo.reqid,
+		.aalgos = ~(__u32)0,
+		.ealgos = ~(__u32)0,
+		.calgos = ~(__u32)0,
+	};
+
+	if (item == BULK_POLICY_OUT) {
+		req.xpinfo.dir = XFRM_POLICY_OUT;
+		src = &tu->local_net;
+		dst = &tu->remote_net;
+		tmpl.saddr = tu->local;
+		tmpl.id.daddr = tu->remote;
+	} else {
+		req.xpinfo.dir = item == BULK_POLICY_IN ?
+				 XFRM_POLICY_IN : XFRM_POLICY_FWD;
+		src = &tu->remote_net;
+		dst = &tu->local_net;
+		tmpl.saddr = tu->remote;
+		tmpl.id.daddr = tu->local;
+	}
+	memcpy(&req.xpinfo.sel.saddr, src->data, src->bytelen);
+	req.xpinfo.sel.prefixlen_s = src->bitlen;
+	memcpy(&req.xpinfo.sel.daddr, dst->data, dst->bytelen);
+	req.xpinfo.sel.prefixlen_d = dst->bitlen;
+
+	addattr_l(&req.n, sizeof(req), XFRMA_TMPL, &tmpl, sizeof(tmpl));
+	if (t->mark.m)
+		addattr_l(&req.n, sizeof(req), XFRMA_MARK,
+			  &t->mark, sizeof(t->mark));
+
+	b->policies++;
+	return bulk_send(b, &req.n, item);
+}
+
+static int bulk_tunnel(struct xfrm_bulk *b, int argc, char **argv)
+{
+	struct bulk_tunnel tu = {};
+	int have_local = 0, have_remote = 0, have_out = 0, have_in = 0;
+	int have_nets = 0;
+
+	if (argc < 1)
+		return bulk_error(b, "tunnel wants a template", NULL);
+	tu.t = bulk_find(b, *argv);
+	if (!tu.t)
+		return bulk_error(b, "unknown template", *argv);
+	argc--; argv++;
+
+	while (argc > 0) {
+		if (argc < 2)
+			return bulk_error(b, "missing value after", *argv);
+
+		if (strcmp(*argv, "local") == 0) {
+			if (bulk_addr(b, &tu, &tu.local, argv[1]) < 0)
+				return -1;
+			have_local = 1;
+		} else if (strcmp(*argv, "remote") == 0) {
+			if (bulk_addr(b, &tu, &tu.remote, argv[1]) < 0)
+				return -1;
+			have_remote = 1;
+		} else if (strcmp(*argv, "spi-out") == 0) {
+			if (get_be32(&tu.spi_out, argv[1], 0) || !tu.spi_out)
+				return bulk_error(b, "invalid SPI", argv[1]);
+			have_out = 1;
+		} else if (strcmp(*argv, "spi-in") == 0) {
+			if (get_be32(&tu.spi_in, argv[1], 0) || !tu.spi_in)
+				return bulk_error(b, "invalid SPI", argv[1]);
+			have_in = 1;
+		} else if (strcmp(*argv, "reqid") == 0) {
+			if (get_u32(&tu.reqid, argv[1], 0))
+				return bulk_error(b, "invalid REQID", argv[1]);
+		} else if (strcmp(*argv, "local-net") == 0) {
+			if (get_prefix_1(&tu.local_net, argv[1],
+					 tu.family ? : preferred_family))
+				return bulk_error(b, "invalid PREFIX", argv[1]);
+			have_nets |= 1;
+		} else if (strcmp(*argv, "remote-net") == 0) {
+			if (get_prefix_1(&tu.remote_net, argv[1],
+					 tu.family ? : preferred_family))
+				return bulk_error(b, "invalid PREFIX", argv[1]);
+			have_nets |= 2;
+		} else if (strcmp(*argv, "priority") == 0) {
+			if (get_u32(&tu.priority, argv[1], 0))
+				return bulk_error(b, "invalid PRIORITY", argv[1]);
+		} else if (strcmp(*argv, "key-out") == 0 ||
+			   strcmp(*argv, "key-in") == 0) {
+			int out = strcmp(*argv, "key-out") == 0;
+
+			if (argc < 3)
+				return bulk_error(b, "missing ALGO-KEYMAT after",
+						  argv[1]);
+			if (bulk_key(b, out ? tu.keys_out : tu.keys_in,
+				     out ? &tu.nkeys_out : &tu.nkeys_in,
+				     argv[1], argv[2]) < 0)
+				return -1;
+			argc--; argv++;
+		} else {
+			return bulk_error(b, "unknown argument", *argv);
+		}
+		argc -= 2; argv += 2;
+	}
+
+	if (!have_local || !have_remote || !have_out || !have_in)
+		return bulk_error(b, "tunnel wants local, remote, spi-out and spi-in",
+				  NULL);
+	if (have_nets && have_nets != 3)
+		return bulk_error(b, "local-net and remote-net go together", NULL);
+	if (have_nets && (tu.local_net.family != tu.family ||
+			  tu.remote_net.family != tu.family))
+		return bulk_error(b, "address family of the nets differs", NULL);
+
+	if (bulk_sa(b, &tu, BULK_SA_OUT) < 0 ||
+	    bulk_sa(b, &tu, BULK_SA_IN) < 0)
+		return -1;
+	if (have_nets &&
+	    (bulk_policy(b, &tu, BULK_POLICY_OUT) < 0 ||
+	     bulk_policy(b, &tu, BULK_POLICY_IN) < 0 ||
+	     bulk_policy(b, &tu, BULK_POLICY_FWD) < 0))
+		return -1;
+	return 0;
+}
+
+/* Lines are sent as they are read, as "ip -batch" would run them */
+static int bulk_lines(struct xfrm_bulk *b, FILE *fp)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[100];
+		int largc;
+
+		largc = makeargs(line, largv, 100);
+		if (largc == 0)
+			continue;	/* blank line */
+
+		if (strcmp(largv[0], "template") == 0)
+			ret = bulk_template(b, largc - 1, largv + 1);
+		else if (strcmp(largv[0], "tunnel") == 0)
+			ret = bulk_tunnel(b, largc - 1, largv + 1);
+		else
+			ret = bulk_error(b, "unknown line", largv[0]);
+		if (ret < 0)
+			break;
+	}
+	free(line);
+	return ret;
+}
+
+int do_xfrm_bulk(int argc, char **argv)
+{
+	struct xfrm_bulk b = { .name = "-" };
+	int saved_lineno = cmdlineno;
+	FILE *fp = stdin;
+	unsigned int i;
+
+	if (argc != 1 || matches(*argv, "help") == 0)
+		return usage();
+
+	b.name = *argv;
+	if (strcmp(b.name, "-") != 0) {
+		fp = fopen(b.name, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n",
+				b.name, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (rtnl_open_byproto(&b.rth, 0, NETLINK_XFRM) < 0)
+		iprt_exit(1);
+	if (rtnl_async_begin(&b.rth, 0, bulk_err, &b) < 0) {
+		perror("Cannot pipeline requests");
+		iprt_exit(1);
+	}
+	b.rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	if (bulk_lines(&b, fp) < 0)
+		b.ret = -1;
+
+	if (rtnl_async_end(&b.rth) < 0 && b.ret == 0)
+		b.ret = -2;
+	rtnl_close(&b.rth);
+
+	if (show_stats)
+		printf("%u SAs and %u policies added, %u and %u failed\n",
+		       b.sas - b.sas_failed, b.policies - b.policies_failed,
+		       b.sas_failed, b.policies_failed);
+
+	cmdlineno = saved_lineno;
+	if (fp != stdin)
+		fclose(fp);
+	for (i = 0; i < BULK_HASH_SIZE; i++) {
+		while (b.hash[i]) {
+			struct bulk_template *t = b.hash[i];
+
+			b.hash[i] = t->next;
+			free(t->name);
+			free(t);
+		}
+	}
+	return b.ret;
+}
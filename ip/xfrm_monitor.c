@@ -26,19 +26,24 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
+#include <time.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 
 #include "utils.h"
 #include "xfrm.h"
 #include "ip_common.h"
+#include "json_print.h"
 
 int listen_all_nsid;
 
 static int usage(void)
 {
-	fprintf(stderr, "Usage: ip xfrm monitor [all-nsid] [ all | OBJECTS | help ]\n");
+	fprintf(stderr, "Usage: ip xfrm monitor [all-nsid] [ SUMMARY ] [ all | OBJECTS | help ]\n");
 	fprintf(stderr, "OBJECTS := { acquire | expire | SA | aevent | policy | report }\n");
+	fprintf(stderr, "SUMMARY := summary [ interval SECONDS ] [ top COUNT ] [ peer PREFIX ] [ spi SPI ]\n");
 	iprt_exit(-1);
 }
 
@@ -339,7 +344,432 @@ static int xfrm_accept_msg(const struct sockaddr_nl *who,
 	return 0;
 }
 
-extern struct rtnl_handle rth;
+extern __thread struct rtnl_handle rth;
+
+/*
+ * "ip xfrm monitor summary" counts events instead of printing them. Only
+ * the fixed header of each one is read, for the peer, protocol and SPI
+ * it is about, and events are counted per type and per peer and type in
+ * a fixed-size table probed a few slots deep, where the pair seen least
+ * gives up its slot when all of them are taken. Each interval prints the
+ * counters and the pairs seen most, then starts again from zero. Events
+ * that match "peer" and "spi" are printed as they come as well.
+ */
+#define XSUM_SLOTS	16384	/* pairs remembered, a power of two */
+#define XSUM_PROBE	8
+
+enum {
+	XSUM_ACQUIRE,
+	XSUM_EXPIRE,
+	XSUM_NEWSA,
+	XSUM_DELSA,
+	XSUM_UPDSA,
+	XSUM_NEWPOLICY,
+	XSUM_DELPOLICY,
+	XSUM_UPDPOLICY,
+	XSUM_POLEXPIRE,
+	XSUM_FLUSHSA,
+	XSUM_FLUSHPOLICY,
+	XSUM_REPORT,
+	XSUM_AEVENT,
+	XSUM_MAPPING,
+	XSUM_TYPES
+};
+
+static const char *xsum_type_names[XSUM_TYPES] = {
+	"acquire", "expire", "newsa", "delsa", "updsa",
+	"newpolicy", "delpolicy", "updpolicy", "polexpire",
+	"flushsa", "flushpolicy", "report", "aevent", "mapping",
+};
+
+struct xsum_key {
+	__u8		family;		/* AF_UNSPEC when there is no peer */
+	__u8		type;
+	__u8		proto;
+	__be32		spi;		/* the last one seen for the pair */
+	xfrm_address_t	peer;
+};
+
+struct xsum_pair {
+	struct xsum_key	key;
+	__u32		events;		/* in this interval, 0 if free */
+};
+
+struct xfrm_summary {
+	struct xsum_pair	*pairs;
+	__u64			types[XSUM_TYPES];
+	__u64			events;
+	__u64			hard_expires;
+	unsigned int		overflows;
+	unsigned int		top;
+	inet_prefix		peer;	/* filter, bitlen -1 if unset */
+	__be32			spi;
+	bool			spi_set;
+	double			interval;
+	struct timespec		last;
+	struct timespec		next;
+};
+
+/* what an event is about, false if it is not one that is counted */
+static bool xsum_key(struct nlmsghdr *n, struct xsum_key *k)
+{
+	const struct xfrm_usersa_info *sa = NULL;
+	const struct xfrm_usersa_id *id = NULL;
+	const struct xfrm_selector *sel = NULL;
+	void *p = NLMSG_DATA(n);
+	size_t len;
+
+	memset(k, 0, sizeof(*k));
+	switch (n->nlmsg_type) {
+	case XFRM_MSG_ACQUIRE: {
+		const struct xfrm_user_acquire *xacq = p;
+
+		len = sizeof(*xacq);
+		k->type = XSUM_ACQUIRE;
+		if (n->nlmsg_len < NLMSG_LENGTH(len))
+			return false;
+		k->family = xacq->sel.family ? : xacq->policy.sel.family;
+		k->proto = xacq->id.proto;
+		k->spi = xacq->id.spi;
+		k->peer = xacq->id.daddr;
+		return true;
+	}
+	case XFRM_MSG_EXPIRE:
+		len = sizeof(struct xfrm_user_expire);
+		k->type = XSUM_EXPIRE;
+		sa = &((struct xfrm_user_expire *)p)->state;
+		break;
+	case XFRM_MSG_NEWSA:
+	case XFRM_MSG_UPDSA:
+		len = sizeof(*sa);
+		k->type = n->nlmsg_type == XFRM_MSG_NEWSA ?
+			XSUM_NEWSA : XSUM_UPDSA;
+		sa = p;
+		break;
+	case XFRM_MSG_DELSA:
+		len = sizeof(*id);
+		k->type = XSUM_DELSA;
+		id = p;
+		break;
+	case XFRM_MSG_NEWAE:
+		len = sizeof(struct xfrm_aevent_id);
+		k->type = XSUM_AEVENT;
+		id = &((struct xfrm_aevent_id *)p)->sa_id;
+		break;
+	case XFRM_MSG_MAPPING:
+		len = sizeof(struct xfrm_user_mapping);
+		k->type = XSUM_MAPPING;
+		id = &((struct xfrm_user_mapping *)p)->id;
+		break;
+	case XFRM_MSG_NEWPOLICY:
+	case XFRM_MSG_UPDPOLICY:
+		len = sizeof(struct xfrm_userpolicy_info);
+		k->type = n->nlmsg_type == XFRM_MSG_NEWPOLICY ?
+			XSUM_NEWPOLICY : XSUM_UPDPOLICY;
+		sel = &((struct xfrm_userpolicy_info *)p)->sel;
+		break;
+	case XFRM_MSG_DELPOLICY:
+		len = sizeof(struct xfrm_userpolicy_id);
+		k->type = XSUM_DELPOLICY;
+		sel = &((struct xfrm_userpolicy_id *)p)->sel;
+		break;
+	case XFRM_MSG_POLEXPIRE:
+		len = sizeof(struct xfrm_user_polexpire);
+		k->type = XSUM_POLEXPIRE;
+		sel = &((struct xfrm_user_polexpire *)p)->pol.sel;
+		break;
+	case XFRM_MSG_REPORT:
+		len = sizeof(struct xfrm_user_report);
+		k->type = XSUM_REPORT;
+		sel = &((struct xfrm_user_report *)p)->sel;
+		k->proto = ((struct xfrm_user_report *)p)->proto;
+		break;
+	case XFRM_MSG_FLUSHSA:
+		k->type = XSUM_FLUSHSA;
+		return true;
+	case XFRM_MSG_FLUSHPOLICY:
+		k->type = XSUM_FLUSHPOLICY;
+		return true;
+	default:
+		return false;
+	}
+
+	if (n->nlmsg_len < NLMSG_LENGTH(len))
+		return false;
+	if (sa) {
+		k->family = sa->family;
+		k->proto = sa->id.proto;
+		k->spi = sa->id.spi;
+		k->peer = sa->id.daddr;
+	} else if (id) {
+		k->family = id->family;
+		k->proto = id->proto;
+		k->spi = id->spi;
+		k->peer = id->daddr;
+	} else {
+		k->family = sel->family;
+		k->peer = sel->daddr;
+	}
+	return true;
+}
+
+static bool xsum_match(const struct xfrm_summary *xs, const struct xsum_key *k)
+{
+	inet_prefix a = { .family = k->family };
+
+	if (xs->peer.bitlen < 0 && !xs->spi_set)
+		return false;
+	if (xs->spi_set && k->spi != xs->spi)
+		return false;
+	if (xs->peer.bitlen < 0)
+		return true;
+	if (k->family != xs->peer.family)
+		return false;
+	a.bytelen = af_byte_len(k->family);
+	memcpy(a.data, &k->peer, a.bytelen);
+	return inet_addr_match(&a, &xs->peer, xs->peer.bitlen) == 0;
+}
+
+static struct xsum_pair *xsum_pair(struct xfrm_summary *xs,
+				   const struct xsum_key *k)
+{
+	const __u8 *peer = (const __u8 *)&k->peer;
+	__u32 h = 2166136261U ^ (k->family << 16) ^ (k->type << 8) ^ k->proto;
+	struct xsum_pair *victim = NULL;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(k->peer); i++)
+		h = (h ^ peer[i]) * 16777619U;
+
+	for (i = 0; i < XSUM_PROBE; i++) {
+		struct xsum_pair *x = &xs->pairs[(h + i) & (XSUM_SLOTS - 1)];
+
+		if (!x->events)
+			return x;
+		if (x->key.family == k->family && x->key.type == k->type &&
+		    x->key.proto == k->proto &&
+		    !memcmp(&x->key.peer, &k->peer, sizeof(k->peer)))
+			return x;
+		if (!victim || x->events < victim->events)
+			victim = x;
+	}
+	victim->events = 0;
+	return victim;
+}
+
+static void xsum_event(struct xfrm_summary *xs, struct nlmsghdr *n,
+		       const struct xsum_key *k)
+{
+	struct xsum_pair *x;
+
+	xs->events++;
+	xs->types[k->type]++;
+	if (k->type == XSUM_EXPIRE &&
+	    ((struct xfrm_user_expire *)NLMSG_DATA(n))->hard)
+		xs->hard_expires++;
+	if (k->family != AF_INET && k->family != AF_INET6)
+		return;
+
+	x = xsum_pair(xs, k);
+	if (!x->events)
+		x->key = *k;
+	x->key.spi = k->spi;
+	x->events++;
+}
+
+static void xsum_print_key(const struct xsum_key *k)
+{
+	print_string(PRINT_ANY, "type", "%s", xsum_type_names[k->type]);
+	print_color_string(PRINT_ANY, ifa_family_color(k->family), "peer",
+			   " peer %s", format_host(k->family,
+						    af_byte_len(k->family),
+						    &k->peer));
+	if (k->proto)
+		print_string(PRINT_ANY, "proto", " proto %s",
+			     strxf_xfrmproto(k->proto));
+	if (k->spi)
+		print_0xhex(PRINT_ANY, "spi", " spi 0x%08x", ntohl(k->spi));
+}
+
+static void xsum_print_top(struct xfrm_summary *xs)
+{
+	struct xsum_pair **top;
+	unsigned int i, n = 0;
+
+	if (!xs->top || !xs->events)
+		return;
+	top = calloc(xs->top, sizeof(*top));
+	if (!top)
+		return;
+
+	/* keep the top N sorted by insertion, N is small */
+	for (i = 0; i < XSUM_SLOTS; i++) {
+		struct xsum_pair *x = &xs->pairs[i];
+		unsigned int j;
+
+		if (!x->events)
+			continue;
+		if (n == xs->top && x->events <= top[n - 1]->events)
+			continue;
+		j = n < xs->top ? n++ : n - 1;
+		for (; j > 0 && top[j - 1]->events < x->events; j--)
+			top[j] = top[j - 1];
+		top[j] = x;
+	}
+
+	open_json_array(PRINT_JSON, "top");
+	print_string(PRINT_FP, NULL, "%s", n ? "  top:\n" : "");
+	for (i = 0; i < n; i++) {
+		open_json_object(NULL);
+		print_string(PRINT_FP, NULL, "%s", "    ");
+		xsum_print_key(&top[i]->key);
+		print_uint(PRINT_ANY, "events", " events %u\n",
+			   top[i]->events);
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	free(top);
+}
+
+static void xsum_print(struct xfrm_summary *xs, double elapsed)
+{
+	unsigned int t;
+
+	open_json_object(NULL);
+	if (timestamp && !is_json_context())
+		print_timestamp(stdout);
+	print_float(PRINT_ANY, "interval", "xfrm summary %.2fs:", elapsed);
+	print_u64(PRINT_ANY, "events", " %" PRIu64 " events,", xs->events);
+	print_uint(PRINT_ANY, "overflows", " %u overflows\n", xs->overflows);
+
+	open_json_object("types");
+	print_string(PRINT_FP, NULL, "%s", xs->events ? " " : "");
+	for (t = 0; t < XSUM_TYPES; t++) {
+		char fmt[32];
+
+		if (!xs->types[t])
+			continue;
+		snprintf(fmt, sizeof(fmt), " %s %%" PRIu64, xsum_type_names[t]);
+		print_u64(PRINT_ANY, xsum_type_names[t], fmt, xs->types[t]);
+		if (t == XSUM_EXPIRE)
+			print_u64(PRINT_ANY, "hard_expire", " (%" PRIu64 " hard)",
+				  xs->hard_expires);
+	}
+	close_json_object();
+	print_string(PRINT_FP, NULL, "%s", xs->events ? "\n" : "");
+
+	xsum_print_top(xs);
+	close_json_object();
+	if (!is_json_context())
+		printf("\n");
+	fflush(stdout);
+}
+
+static void xsum_reset(struct xfrm_summary *xs)
+{
+	memset(xs->pairs, 0, XSUM_SLOTS * sizeof(*xs->pairs));
+	memset(xs->types, 0, sizeof(xs->types));
+	xs->events = xs->hard_expires = 0;
+	xs->overflows = 0;
+}
+
+static int xsum_tick(struct rtnl_handle *h, void *arg)
+{
+	struct xfrm_summary *xs = arg;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_diff(&now, &xs->next) < 0)
+		return 0;
+
+	xsum_print(xs, timespec_diff(&now, &xs->last));
+	xsum_reset(xs);
+	xs->last = now;
+	/* a summary that ran late doesn't make the next ones come sooner */
+	while (timespec_diff(&now, &xs->next) >= 0)
+		timespec_add(&xs->next, xs->interval);
+	return 0;
+}
+
+static int xsum_overflow(struct rtnl_handle *h, void *arg)
+{
+	struct xfrm_summary *xs = arg;
+
+	xs->overflows++;
+	return 0;
+}
+
+static int xsum_accept(const struct sockaddr_nl *who,
+		       struct rtnl_ctrl_data *ctrl,
+		       struct nlmsghdr *n, void *arg)
+{
+	struct xfrm_summary *xs = arg;
+	struct xsum_key k;
+
+	if (!xsum_key(n, &k))
+		return 0;
+	xsum_event(xs, n, &k);
+	if (!xsum_match(xs, &k))
+		return 0;
+
+	/* there is no JSON for the full events, the key has to do */
+	if (is_json_context()) {
+		open_json_object(NULL);
+		xsum_print_key(&k);
+		close_json_object();
+		fflush(stdout);
+		return 0;
+	}
+	return xfrm_accept_msg(who, ctrl, n, stdout);
+}
+
+static int xfrm_monitor_summary(struct xfrm_summary *xs, FILE *fp)
+{
+	struct timeval tv;
+	double wake;
+	int ret;
+
+	xs->pairs = calloc(XSUM_SLOTS, sizeof(*xs->pairs));
+	if (!xs->pairs) {
+		perror("Cannot allocate event table");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &xs->last);
+
+	/* a saved stream is summed up as one interval */
+	if (fp) {
+		ret = rtnl_from_file(fp, xsum_accept, xs);
+		if (ret == 0) {
+			struct timespec now;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			xsum_print(xs, timespec_diff(&now, &xs->last));
+		}
+		goto out;
+	}
+
+	xs->next = xs->last;
+	timespec_add(&xs->next, xs->interval);
+
+	/* wake up often enough to be on time when nothing happens */
+	wake = xs->interval < 0.1 ? xs->interval : 0.1;
+	tv.tv_sec = 0;
+	tv.tv_usec = wake * 1000000;
+	if (setsockopt(rth.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		perror("SO_RCVTIMEO");
+		ret = -1;
+		goto out;
+	}
+	rth.tick = xsum_tick;
+	rth.resync = xsum_overflow;
+
+	ret = rtnl_listen(&rth, xsum_accept, xs);
+out:
+	free(xs->pairs);
+	return ret;
+}
+
 
 int do_xfrm_monitor(int argc, char **argv)
 {
@@ -351,6 +781,12 @@ int do_xfrm_monitor(int argc, char **argv)
 	int lpolicy = 0;
 	int lsa = 0;
 	int lreport = 0;
+	int summary = 0;
+	struct xfrm_summary xs = {
+		.interval = 1,
+		.top = 10,
+		.peer.bitlen = -1,
+	};
 
 	rtnl_close(&rth);
 
@@ -362,6 +798,27 @@ int do_xfrm_monitor(int argc, char **argv)
 			/* fall out */
 		} else if (matches(*argv, "all-nsid") == 0) {
 			listen_all_nsid = 1;
+		} else if (strcmp(*argv, "summary") == 0) {
+			summary = 1;
+		} else if (summary && matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&xs.interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (summary && strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&xs.top, *argv, 0))
+				return invarg("invalid top count", *argv);
+		} else if (summary && strcmp(*argv, "peer") == 0) {
+			NEXT_ARG();
+			get_prefix(&xs.peer, *argv, preferred_family);
+		} else if (summary && strcmp(*argv, "spi") == 0) {
+			__u32 spi;
+
+			NEXT_ARG();
+			if (get_u32(&spi, *argv, 0))
+				return invarg("invalid spi", *argv);
+			xs.spi = htonl(spi);
+			xs.spi_set = true;
 		} else if (matches(*argv, "acquire") == 0) {
 			lacquire = 1;
 			groups = 0;
@@ -402,6 +859,13 @@ int do_xfrm_monitor(int argc, char **argv)
 	if (lreport)
 		groups |= nl_mgrp(XFRMNLGRP_REPORT);
 
+	/* Events never end, so don't wrap them in an array */
+	if (summary) {
+		if (json)
+			ndjson = 1;
+		new_json_obj(json);
+	}
+
 	if (file) {
 		FILE *fp;
 		int err;
@@ -411,8 +875,12 @@ int do_xfrm_monitor(int argc, char **argv)
 			perror("Cannot fopen");
 			iprt_exit(-1);
 		}
-		err = rtnl_from_file(fp, xfrm_accept_msg, stdout);
+		if (summary)
+			err = xfrm_monitor_summary(&xs, fp);
+		else
+			err = rtnl_from_file(fp, xfrm_accept_msg, stdout);
 		fclose(fp);
+		delete_json_obj();
 		return err;
 	}
 
@@ -421,6 +889,12 @@ int do_xfrm_monitor(int argc, char **argv)
 	if (listen_all_nsid && rtnl_listen_all_nsid(&rth) < 0)
 		iprt_exit(1);
 
+	if (summary) {
+		if (xfrm_monitor_summary(&xs, NULL) < 0)
+			iprt_exit(2);
+		return 0;
+	}
+
 	if (rtnl_listen(&rth, xfrm_accept_msg, (void *)stdout) < 0)
 		iprt_exit(2);
 
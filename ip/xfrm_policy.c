@@ -33,9 +33,6 @@
 #include "xfrm.h"
 #include "ip_common.h"
 
-/* #define NLMSG_DELETEALL_BUF_SIZE (4096-512) */
-#define NLMSG_DELETEALL_BUF_SIZE 8192
-
 /*
  * Receiving buffer defines:
  * nlmsg
@@ -59,6 +56,8 @@ static int usage(void)
 	fprintf(stderr, "Usage: ip xfrm policy { deleteall | list } [ nosock ] [ SELECTOR ] [ dir DIR ]\n");
 	fprintf(stderr, "        [ index INDEX ] [ ptype PTYPE ] [ action ACTION ] [ priority PRIORITY ]\n");
 	fprintf(stderr, "        [ flag FLAG-LIST ]\n");
+	fprintf(stderr, "Usage: ip xfrm policy save\n");
+	fprintf(stderr, "Usage: ip xfrm policy lookup [ snapshot FILE ] [ QUERY ]\n");
 	fprintf(stderr, "Usage: ip xfrm policy flush [ ptype PTYPE ]\n");
 	fprintf(stderr, "Usage: ip xfrm policy count\n");
 	fprintf(stderr, "Usage: ip xfrm policy set [ hthresh4 LBITS RBITS ] [ hthresh6 LBITS RBITS ]\n");
@@ -690,20 +689,26 @@ static int xfrm_policy_get(int argc, char **argv)
 
 /*
  * With an existing policy of nlmsg, make new nlmsg for deleting the policy
- * and store it to buffer.
+ * and queue it.
  */
 static int xfrm_policy_keep(const struct sockaddr_nl *who,
 			    struct nlmsghdr *n,
 			    void *arg)
 {
-	struct xfrm_buffer *xb = (struct xfrm_buffer *)arg;
-	struct rtnl_handle *rth = xb->rth;
+	struct xfrm_deleteall *xd = arg;
 	struct xfrm_userpolicy_info *xpinfo = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 	struct rtattr *tb[XFRMA_MAX+1];
 	__u8 ptype = XFRM_POLICY_TYPE_MAIN;
-	struct nlmsghdr *new_n;
-	struct xfrm_userpolicy_id *xpid;
+	struct {
+		struct nlmsghdr			n;
+		struct xfrm_userpolicy_id	xpid;
+		char				buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.xpid)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_DELPOLICY,
+	};
 
 	if (n->nlmsg_type != XFRM_MSG_NEWPOLICY) {
 		fprintf(stderr, "Not a policy: %08x %08x %08x\n",
@@ -737,31 +742,20 @@ static int xfrm_policy_keep(const struct sockaddr_nl *who,
 	if (xpinfo->dir >= XFRM_POLICY_MAX)
 		return 0;
 
-	if (xb->offset + NLMSG_LENGTH(sizeof(*xpid)) > xb->size)
-		return 0;
+	memcpy(&req.xpid.sel, &xpinfo->sel, sizeof(req.xpid.sel));
+	req.xpid.dir = xpinfo->dir;
+	req.xpid.index = xpinfo->index;
 
-	new_n = (struct nlmsghdr *)(xb->buf + xb->offset);
-	new_n->nlmsg_len = NLMSG_LENGTH(sizeof(*xpid));
-	new_n->nlmsg_flags = NLM_F_REQUEST;
-	new_n->nlmsg_type = XFRM_MSG_DELPOLICY;
-	new_n->nlmsg_seq = ++rth->seq;
+	if (tb[XFRMA_MARK])
+		addattr_l(&req.n, sizeof(req), XFRMA_MARK,
+			  RTA_DATA(tb[XFRMA_MARK]),
+			  RTA_PAYLOAD(tb[XFRMA_MARK]));
 
-	xpid = NLMSG_DATA(new_n);
-	memcpy(&xpid->sel, &xpinfo->sel, sizeof(xpid->sel));
-	xpid->dir = xpinfo->dir;
-	xpid->index = xpinfo->index;
-
-	if (tb[XFRMA_MARK]) {
-		int r = addattr_l(new_n, xb->size, XFRMA_MARK,
-				(void *)RTA_DATA(tb[XFRMA_MARK]), tb[XFRMA_MARK]->rta_len);
-		if (r < 0) {
-			fprintf(stderr, "%s: XFRMA_MARK failed\n", __func__);
-			iprt_exit(1);
-		}
+	if (rtnl_txq_add(&xd->q, &req.n) < 0) {
+		perror("Cannot queue delete-all request");
+		return -1;
 	}
-
-	xb->offset += new_n->nlmsg_len;
-	xb->nlmsg_count++;
+	xd->nlmsg_count++;
 
 	return 0;
 }
@@ -841,56 +835,36 @@ static int xfrm_policy_list_or_deleteall(int argc, char **argv, int deleteall)
 		iprt_exit(1);
 
 	if (deleteall) {
-		struct xfrm_buffer xb;
-		char buf[NLMSG_DELETEALL_BUF_SIZE];
-		int i;
-
-		xb.buf = buf;
-		xb.size = sizeof(buf);
-		xb.rth = &rth;
-
-		for (i = 0; ; i++) {
-			struct {
-				struct nlmsghdr n;
-				char buf[NLMSG_BUF_SIZE];
-			} req = {
-				.n.nlmsg_len = NLMSG_HDRLEN,
-				.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
-				.n.nlmsg_type = XFRM_MSG_GETPOLICY,
-				.n.nlmsg_seq = rth.dump = ++rth.seq,
-			};
-
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
-
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all round = %d\n", i);
-
-			if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
-				perror("Cannot send dump request");
-				iprt_exit(1);
-			}
+		struct {
+			struct nlmsghdr n;
+			char buf[NLMSG_BUF_SIZE];
+		} req = {
+			.n.nlmsg_len = NLMSG_HDRLEN,
+			.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+			.n.nlmsg_type = XFRM_MSG_GETPOLICY,
+			.n.nlmsg_seq = rth.dump = ++rth.seq,
+		};
+		struct xfrm_deleteall xd = {};
 
-			if (rtnl_dump_filter(&rth, xfrm_policy_keep, &xb) < 0) {
-				fprintf(stderr, "Delete-all terminated\n");
-				iprt_exit(1);
-			}
-			if (xb.nlmsg_count == 0) {
-				if (show_stats > 1)
-					fprintf(stderr, "Delete-all completed\n");
-				break;
-			}
+		if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
+			perror("Cannot send dump request");
+			iprt_exit(1);
+		}
 
-			if (rtnl_send_check(&rth, xb.buf, xb.offset) < 0) {
-				perror("Failed to send delete-all request");
-				iprt_exit(1);
-			}
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
+		/* one dump, then the deletes pipelined */
+		if (rtnl_dump_filter(&rth, xfrm_policy_keep, &xd) < 0) {
+			fprintf(stderr, "Delete-all terminated\n");
+			iprt_exit(1);
+		}
+		if (show_stats > 1)
+			fprintf(stderr, "Delete-all nlmsg count = %d\n",
+				xd.nlmsg_count);
 
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
+		if (rtnl_flush_send(&rth, &xd.q)) {
+			fprintf(stderr, "Failed to send delete-all request\n");
+			iprt_exit(1);
 		}
+		rtnl_txq_free(&xd.q);
 	} else {
 		struct {
 			struct nlmsghdr n;
@@ -918,6 +892,57 @@ static int xfrm_policy_list_or_deleteall(int argc, char **argv, int deleteall)
 	iprt_exit(0);
 }
 
+const struct ipsave_ops xfrm_policy_save_ops = {
+	.what	= "policy",
+	.magic	= 0x58661917,
+};
+
+static int xfrm_policy_save_one(const struct sockaddr_nl *who,
+				struct nlmsghdr *n, void *arg)
+{
+	if (n->nlmsg_type != XFRM_MSG_NEWPOLICY)
+		return 0;
+	return ipsave_add(arg, n);
+}
+
+static int xfrm_policy_save(int argc, char **argv)
+{
+	struct rtnl_handle rth;
+	struct {
+		struct nlmsghdr n;
+	} req = {
+		.n.nlmsg_len = NLMSG_HDRLEN,
+		.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_GETPOLICY,
+	};
+	struct ipsave_writer *w;
+
+	if (argc > 0)
+		return invarg("unknown", *argv);
+
+	w = ipsave_begin(&xfrm_policy_save_ops);
+	if (!w)
+		iprt_exit(1);
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		iprt_exit(1);
+
+	req.n.nlmsg_seq = rth.dump = ++rth.seq;
+	if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		iprt_exit(1);
+	}
+
+	if (rtnl_dump_filter(&rth, xfrm_policy_save_one, w) < 0) {
+		fprintf(stderr, "Save terminated\n");
+		ipsave_abort(w);
+		iprt_exit(1);
+	}
+	rtnl_close(&rth);
+
+	return ipsave_end(w) < 0 ? 1 : 0;
+}
+
 static int print_spdinfo(struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE *)arg;
@@ -1171,6 +1196,10 @@ int do_xfrm_policy(int argc, char **argv)
 		return xfrm_policy_get(argc-1, argv+1);
 	if (matches(*argv, "flush") == 0)
 		return xfrm_policy_flush(argc-1, argv+1);
+	if (strcmp(*argv, "save") == 0)
+		return xfrm_policy_save(argc-1, argv+1);
+	if (strcmp(*argv, "lookup") == 0)
+		return xfrm_policy_lookup(argc-1, argv+1);
 	if (matches(*argv, "count") == 0)
 		return xfrm_spd_getinfo(argc, argv);
 	if (matches(*argv, "set") == 0)
@@ -0,0 +1,679 @@
+/*
+ * xfrm_policy_lookup.c	"ip xfrm policy lookup", the policy the kernel would
+ *			pick for a flow, computed from a policy dump.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The policies, live or from an "ip xfrm policy save" file, are indexed
+ * per type, direction and family in a path compressed binary trie on
+ * the destination prefix, each node of which holds a second such trie
+ * on the source prefix of the policies it got. The policies of a source
+ * node are kept in the order the kernel prefers them, lowest priority
+ * first and then as they were added, which is the order of the dump. A
+ * lookup walks the destination prefixes covering the flow, and under
+ * each the source prefixes covering it, trying the policies of a node
+ * until one matches the rest of the selector, the mark and the device,
+ * or one is no better than what was found already. Sub policies are
+ * looked at before the main ones, as xfrm_policy_lookup() does.
+ * Security contexts are not evaluated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+
+#include "utils.h"
+#include "xfrm.h"
+#include "ip_common.h"
+
+#define SPD_NONE	(~0U)
+#define SPD_TYPES	2		/* main, sub */
+
+struct spd_policy {
+	size_t		off;		/* of the message */
+	unsigned int	seq;		/* in the dump */
+	__u32		leaf;		/* source node it is kept at */
+	__u32		priority;
+	__u32		mark;
+	__u32		mask;
+	struct xfrm_selector sel;
+};
+
+struct spd_node {
+	__u8		addr[16];	/* masked to len */
+	int		len;
+	__u32		child[2];
+	__u32		inner;		/* source trie of a destination node */
+	unsigned int	first;		/* of the policies, in order */
+	unsigned int	count;
+};
+
+struct spd_query {
+	__u8		dir;
+	int		family;
+	int		bytes;
+	__u8		src[16];
+	__u8		dst[16];
+	__u8		proto;
+	__be16		sport;		/* ICMP type, as in a flow */
+	__be16		dport;		/* ICMP code */
+	int		ifindex;
+	__u32		mark;
+};
+
+struct spd {
+	char			*msgs;
+	size_t			len;
+	size_t			size;
+	struct spd_policy	*pols;
+	unsigned int		npols;
+	unsigned int		maxpols;
+	struct spd_node		*nodes;
+	unsigned int		nnodes;
+	unsigned int		maxnodes;
+	/* destination tries */
+	__u32			root[SPD_TYPES][XFRM_POLICY_MAX][2];
+};
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: ip xfrm policy lookup [ snapshot FILE ] [ QUERY ]\n"
+		"QUERY := [ dir DIR ] src ADDR dst ADDR [ proto PROTO ]\n"
+		"         [ sport PORT ] [ dport PORT ] [ type NUMBER ] [ code NUMBER ]\n"
+		"         [ dev DEV ] [ mark MARK ]\n"
+		"DIR := in | out | fwd\n"
+		"Without a QUERY, one is read from each line of stdin.\n");
+	iprt_exit(-1);
+}
+
+static void spd_oom(void)
+{
+	fprintf(stderr, "Cannot allocate memory for policy lookup\n");
+	iprt_exit(1);
+}
+
+static void *spd_grow(void *p, unsigned int *max, size_t size)
+{
+	unsigned int n = *max ? 2 * *max : 1024;
+
+	p = realloc(p, n * size);
+	if (!p)
+		spd_oom();
+	*max = n;
+	return p;
+}
+
+static size_t spd_copy(struct spd *s, const struct nlmsghdr *n)
+{
+	size_t off = s->len;
+
+	if (s->len + n->nlmsg_len > s->size) {
+		size_t size = s->size ? 2 * s->size : 65536;
+
+		while (size < s->len + n->nlmsg_len)
+			size *= 2;
+		s->msgs = realloc(s->msgs, size);
+		if (!s->msgs)
+			spd_oom();
+		s->size = size;
+	}
+	memcpy(s->msgs + off, n, n->nlmsg_len);
+	s->len += NLMSG_ALIGN(n->nlmsg_len);
+	return off;
+}
+
+static struct nlmsghdr *spd_msg(const struct spd *s, size_t off)
+{
+	return (struct nlmsghdr *)(s->msgs + off);
+}
+
+static int spd_bit(const __u8 *a, int i)
+{
+	return (a[i / 8] >> (7 - i % 8)) & 1;
+}
+
+/* the number of leading bits a and b share, up to max */
+static int spd_common(const __u8 *a, const __u8 *b, int max)
+{
+	int i;
+
+	for (i = 0; i < max; i++) {
+		if (i % 8 == 0 && i + 8 <= max && a[i / 8] == b[i / 8]) {
+			i += 7;
+			continue;
+		}
+		if (spd_bit(a, i) != spd_bit(b, i))
+			break;
+	}
+	return i;
+}
+
+static __u32 spd_new_node(struct spd *s, const __u8 *addr, int len)
+{
+	struct spd_node *n;
+	int i;
+
+	if (s->nnodes == s->maxnodes)
+		s->nodes = spd_grow(s->nodes, &s->maxnodes, sizeof(*s->nodes));
+	n = &s->nodes[s->nnodes];
+	memset(n, 0, sizeof(*n));
+	memcpy(n->addr, addr, sizeof(n->addr));
+	for (i = len / 8; i < 16; i++) {
+		if (i == len / 8 && len % 8)
+			n->addr[i] &= 0xff << (8 - len % 8);
+		else
+			n->addr[i] = 0;
+	}
+	n->len = len;
+	n->child[0] = n->child[1] = SPD_NONE;
+	n->inner = SPD_NONE;
+	return s->nnodes++;
+}
+
+static void spd_link(struct spd *s, __u32 *root, __u32 parent, int b,
+		     __u32 node)
+{
+	if (parent == SPD_NONE)
+		*root = node;
+	else
+		s->nodes[parent].child[b] = node;
+}
+
+/*
+ * The node of prefix addr/len in the trie at *root, made if it has none.
+ * Nodes come from one array, so they are kept by index, not pointer.
+ */
+static __u32 spd_insert(struct spd *s, __u32 *root, const __u8 *addr,
+			int len)
+{
+	__u32 parent = SPD_NONE, cur = *root, n, glue;
+	int b = 0, common;
+
+	while (cur != SPD_NONE) {
+		const struct spd_node *c = &s->nodes[cur];
+		int clen = c->len;
+
+		common = spd_common(c->addr, addr, clen < len ? clen : len);
+		if (common < clen) {
+			n = spd_new_node(s, addr, len);
+			if (common == len) {
+				/* the new prefix covers cur */
+				s->nodes[n].child[spd_bit(s->nodes[cur].addr,
+							  len)] = cur;
+				spd_link(s, root, parent, b, n);
+				return n;
+			}
+			glue = spd_new_node(s, addr, common);
+			s->nodes[glue].child[spd_bit(addr, common)] = n;
+			s->nodes[glue].child[spd_bit(s->nodes[cur].addr,
+						     common)] = cur;
+			spd_link(s, root, parent, b, glue);
+			return n;
+		}
+		if (clen == len)
+			return cur;
+		parent = cur;
+		b = spd_bit(addr, clen);
+		cur = c->child[b];
+	}
+
+	n = spd_new_node(s, addr, len);
+	spd_link(s, root, parent, b, n);
+	return n;
+}
+
+static int spd_ptype(struct rtattr **tb)
+{
+	struct xfrm_userpolicy_type *upt;
+
+	if (!tb[XFRMA_POLICY_TYPE])
+		return XFRM_POLICY_TYPE_MAIN;
+	if (RTA_PAYLOAD(tb[XFRMA_POLICY_TYPE]) < sizeof(*upt))
+		return -1;
+	upt = RTA_DATA(tb[XFRMA_POLICY_TYPE]);
+	return upt->type;
+}
+
+static void spd_add_policy(struct spd *s, struct nlmsghdr *n)
+{
+	struct xfrm_userpolicy_info *xpinfo = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*xpinfo));
+	struct xfrm_selector *sel = &xpinfo->sel;
+	struct rtattr *tb[XFRMA_MAX + 1];
+	struct spd_policy *p;
+	__u32 dnode, snode;
+	int ptype, af, bits;
+
+	if (len < 0)
+		return;
+	/* socket policies are not looked up by flow */
+	if (xpinfo->dir >= XFRM_POLICY_MAX)
+		return;
+	if (sel->family != AF_INET && sel->family != AF_INET6)
+		return;
+	bits = af_bit_len(sel->family);
+	if (sel->prefixlen_d > bits || sel->prefixlen_s > bits)
+		return;
+	parse_rtattr(tb, XFRMA_MAX, XFRMP_RTA(xpinfo), len);
+	ptype = spd_ptype(tb);
+	if (ptype < 0 || ptype >= SPD_TYPES)
+		return;
+
+	if (s->npols == s->maxpols)
+		s->pols = spd_grow(s->pols, &s->maxpols, sizeof(*s->pols));
+	p = &s->pols[s->npols];
+	memset(p, 0, sizeof(*p));
+	p->seq = s->npols++;
+	p->priority = xpinfo->priority;
+	p->sel = *sel;
+	if (tb[XFRMA_MARK] &&
+	    RTA_PAYLOAD(tb[XFRMA_MARK]) >= sizeof(struct xfrm_mark)) {
+		struct xfrm_mark *m = RTA_DATA(tb[XFRMA_MARK]);
+
+		p->mark = m->v;
+		p->mask = m->m;
+	}
+
+	af = sel->family == AF_INET6;
+	dnode = spd_insert(s, &s->root[ptype][xpinfo->dir][af],
+			   (__u8 *)&sel->daddr, sel->prefixlen_d);
+	snode = s->nodes[dnode].inner;
+	p->leaf = spd_insert(s, &snode, (__u8 *)&sel->saddr,
+			     sel->prefixlen_s);
+	s->nodes[dnode].inner = snode;
+	p->off = spd_copy(s, n);
+}
+
+static int spd_save_cb(const struct sockaddr_nl *who,
+		       struct rtnl_ctrl_data *ctrl,
+		       struct nlmsghdr *n, void *arg)
+{
+	if (n->nlmsg_type == XFRM_MSG_NEWPOLICY)
+		spd_add_policy(arg, n);
+	return 0;
+}
+
+static int spd_dump_cb(const struct sockaddr_nl *who,
+		       struct nlmsghdr *n, void *arg)
+{
+	return spd_save_cb(who, NULL, n, arg);
+}
+
+static int spd_load_file(struct spd *s, const char *name)
+{
+	int fd, ret;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+	ret = ipsave_show(&xfrm_policy_save_ops, fd, spd_save_cb, s);
+	close(fd);
+	return ret < 0 ? -1 : 0;
+}
+
+static int spd_load_live(struct spd *s)
+{
+	struct rtnl_handle rth;
+	struct {
+		struct nlmsghdr n;
+	} req = {
+		.n.nlmsg_len = NLMSG_HDRLEN,
+		.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_GETPOLICY,
+	};
+	int ret = 0;
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		return -1;
+	req.n.nlmsg_seq = rth.dump = ++rth.seq;
+	if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		ret = -1;
+	} else if (rtnl_dump_filter(&rth, spd_dump_cb, s) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		ret = -1;
+	}
+	rtnl_close(&rth);
+	return ret;
+}
+
+/* the order the kernel prefers the policies of a node in */
+static int spd_policy_cmp(const void *a, const void *b)
+{
+	const struct spd_policy *x = a, *y = b;
+
+	if (x->leaf != y->leaf)
+		return x->leaf < y->leaf ? -1 : 1;
+	if (x->priority != y->priority)
+		return x->priority < y->priority ? -1 : 1;
+	return x->seq < y->seq ? -1 : 1;
+}
+
+static void spd_build(struct spd *s)
+{
+	unsigned int i;
+
+	qsort(s->pols, s->npols, sizeof(*s->pols), spd_policy_cmp);
+	for (i = 0; i < s->npols; i++) {
+		struct spd_node *n = &s->nodes[s->pols[i].leaf];
+
+		if (!n->count)
+			n->first = i;
+		n->count++;
+	}
+}
+
+static int spd_prefix_match(const __u8 *a, const struct spd_node *n)
+{
+	int bytes = n->len / 8, bits = n->len % 8;
+
+	if (memcmp(a, n->addr, bytes))
+		return 0;
+	return !bits || !((a[bytes] ^ n->addr[bytes]) & (0xff << (8 - bits)));
+}
+
+/* the rest of what xfrm_policy_match() and xfrm_selector_match() check */
+static int spd_policy_match(const struct spd_policy *p,
+			    const struct spd_query *q)
+{
+	const struct xfrm_selector *sel = &p->sel;
+
+	if ((q->mark & p->mask) != p->mark)
+		return 0;
+	if (sel->proto && sel->proto != q->proto)
+		return 0;
+	if ((q->sport ^ sel->sport) & sel->sport_mask)
+		return 0;
+	if ((q->dport ^ sel->dport) & sel->dport_mask)
+		return 0;
+	return !sel->ifindex || sel->ifindex == q->ifindex;
+}
+
+static int spd_before(const struct spd_policy *x, const struct spd_policy *y)
+{
+	if (x->priority != y->priority)
+		return x->priority < y->priority;
+	return x->seq < y->seq;
+}
+
+static const struct spd_policy *spd_lookup_type(const struct spd *s,
+						int ptype,
+						const struct spd_query *q)
+{
+	const struct spd_policy *best = NULL;
+	int bits = q->bytes * 8;
+	__u32 d, i;
+
+	d = s->root[ptype][q->dir][q->family == AF_INET6];
+	while (d != SPD_NONE) {
+		const struct spd_node *dn = &s->nodes[d];
+
+		if (!spd_prefix_match(q->dst, dn))
+			break;
+		for (i = dn->inner; i != SPD_NONE; ) {
+			const struct spd_node *sn = &s->nodes[i];
+			unsigned int k;
+
+			if (!spd_prefix_match(q->src, sn))
+				break;
+			for (k = 0; k < sn->count; k++) {
+				const struct spd_policy *p;
+
+				p = &s->pols[sn->first + k];
+				if (best && !spd_before(p, best))
+					break;
+				if (spd_policy_match(p, q)) {
+					best = p;
+					break;
+				}
+			}
+			if (sn->len == bits)
+				break;
+			i = sn->child[spd_bit(q->src, sn->len)];
+		}
+		if (dn->len == bits)
+			break;
+		d = dn->child[spd_bit(q->dst, dn->len)];
+	}
+	return best;
+}
+
+static const struct spd_policy *spd_lookup(const struct spd *s,
+					   const struct spd_query *q)
+{
+	const struct spd_policy *p;
+
+	p = spd_lookup_type(s, XFRM_POLICY_TYPE_SUB, q);
+	if (!p)
+		p = spd_lookup_type(s, XFRM_POLICY_TYPE_MAIN, q);
+	return p;
+}
+
+static const char *spd_dir_name(__u8 dir)
+{
+	switch (dir) {
+	case XFRM_POLICY_IN:
+		return "in";
+	case XFRM_POLICY_FWD:
+		return "fwd";
+	}
+	return "out";
+}
+
+static void spd_print(const struct spd *s, const struct spd_query *q,
+		      const struct spd_policy *p)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct nlmsghdr *n;
+
+	printf("dir %s src %s", spd_dir_name(q->dir),
+	       format_host(q->family, q->bytes, q->src));
+	printf(" dst %s", format_host(q->family, q->bytes, q->dst));
+	if (q->proto)
+		printf(" proto %s", strxf_proto(q->proto));
+	if (q->sport)
+		printf(" sport %u", ntohs(q->sport));
+	if (q->dport)
+		printf(" dport %u", ntohs(q->dport));
+	if (q->ifindex)
+		printf(" dev %s", ll_index_to_name(q->ifindex));
+	if (q->mark)
+		printf(" mark 0x%x", q->mark);
+
+	if (!p) {
+		printf(": no policy\n");
+		return;
+	}
+
+	n = spd_msg(s, p->off);
+	printf(": index %u priority %u\n",
+	       ((struct xfrm_userpolicy_info *)NLMSG_DATA(n))->index,
+	       p->priority);
+	xfrm_policy_print(&nladdr, n, stdout);
+}
+
+/* a bad query is reported, not fatal to the ones after it */
+#define SPD_NEXT_ARG() do {			\
+		if (--argc <= 0)		\
+			goto missing;		\
+		argv++;				\
+	} while (0)
+
+static int spd_parse_addr(struct spd_query *q, __u8 *to, const char *arg)
+{
+	inet_prefix addr;
+
+	if (get_addr_1(&addr, arg, preferred_family))
+		return -1;
+	if (q->family && q->family != addr.family)
+		return -1;
+	q->family = addr.family;
+	memcpy(to, addr.data, addr.bytelen);
+	return 0;
+}
+
+static int spd_parse_query(struct spd_query *q, int argc, char **argv)
+{
+	int has_src = 0, has_dst = 0;
+	__u16 v;
+
+	memset(q, 0, sizeof(*q));
+	q->dir = XFRM_POLICY_OUT;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dir") == 0) {
+			SPD_NEXT_ARG();
+			if (strcmp(*argv, "in") == 0)
+				q->dir = XFRM_POLICY_IN;
+			else if (strcmp(*argv, "out") == 0)
+				q->dir = XFRM_POLICY_OUT;
+			else if (strcmp(*argv, "fwd") == 0)
+				q->dir = XFRM_POLICY_FWD;
+			else
+				goto bad;
+		} else if (strcmp(*argv, "src") == 0) {
+			SPD_NEXT_ARG();
+			if (spd_parse_addr(q, q->src, *argv))
+				goto bad;
+			has_src = 1;
+		} else if (strcmp(*argv, "dst") == 0) {
+			SPD_NEXT_ARG();
+			if (spd_parse_addr(q, q->dst, *argv))
+				goto bad;
+			has_dst = 1;
+		} else if (strcmp(*argv, "proto") == 0) {
+			struct protoent *pp;
+			__u8 proto;
+
+			SPD_NEXT_ARG();
+			pp = getprotobyname(*argv);
+			if (pp)
+				q->proto = pp->p_proto;
+			else if (get_u8(&proto, *argv, 0))
+				goto bad;
+			else
+				q->proto = proto;
+		} else if (strcmp(*argv, "sport") == 0 ||
+			   strcmp(*argv, "type") == 0) {
+			SPD_NEXT_ARG();
+			if (get_u16(&v, *argv, 0))
+				goto bad;
+			q->sport = htons(v);
+		} else if (strcmp(*argv, "dport") == 0 ||
+			   strcmp(*argv, "code") == 0) {
+			SPD_NEXT_ARG();
+			if (get_u16(&v, *argv, 0))
+				goto bad;
+			q->dport = htons(v);
+		} else if (strcmp(*argv, "dev") == 0) {
+			SPD_NEXT_ARG();
+			q->ifindex = ll_name_to_index(*argv);
+			if (!q->ifindex) {
+				fprintf(stderr, "Cannot find device \"%s\"\n",
+					*argv);
+				return -1;
+			}
+		} else if (strcmp(*argv, "mark") == 0) {
+			SPD_NEXT_ARG();
+			if (get_u32(&q->mark, *argv, 0))
+				goto bad;
+		} else {
+			goto bad;
+		}
+		argc--; argv++;
+	}
+
+	if (!has_src || !has_dst) {
+		fprintf(stderr, "Need a source and a destination address to look up\n");
+		return -1;
+	}
+	if (q->family != AF_INET && q->family != AF_INET6) {
+		fprintf(stderr, "Only IPv4 and IPv6 flows can be looked up\n");
+		return -1;
+	}
+	q->bytes = af_byte_len(q->family);
+	return 0;
+
+missing:
+	fprintf(stderr, "Argument missing after \"%s\"\n", *argv);
+	return -1;
+bad:
+	fprintf(stderr, "Invalid query argument \"%s\"\n", *argv);
+	return -1;
+}
+
+static int spd_query(const struct spd *s, int argc, char **argv)
+{
+	struct spd_query q;
+
+	if (spd_parse_query(&q, argc, argv) < 0)
+		return -1;
+	spd_print(s, &q, spd_lookup(s, &q));
+	return 0;
+}
+
+int xfrm_policy_lookup(int argc, char **argv)
+{
+	const char *snapshot = NULL;
+	struct spd s = {};
+	int ret = 0;
+
+	memset(s.root, 0xff, sizeof(s.root));
+
+	while (argc > 0) {
+		if (strcmp(*argv, "snapshot") == 0) {
+			NEXT_ARG();
+			snapshot = *argv;
+		} else if (strcmp(*argv, "help") == 0) {
+			usage();
+		} else {
+			break;
+		}
+		argc--; argv++;
+	}
+
+	if (snapshot ? spd_load_file(&s, snapshot) : spd_load_live(&s))
+		return -1;
+	spd_build(&s);
+	if (show_stats)
+		fprintf(stderr, "%u policies, %u trie nodes\n",
+			s.npols, s.nnodes);
+
+	if (argc > 0) {
+		ret = spd_query(&s, argc, argv);
+	} else {
+		char *line = NULL;
+		size_t len = 0;
+
+		cmdlineno = 0;
+		while (getcmdline(&line, &len, stdin) != -1) {
+			char *largv[BATCH_MAX_ARGS];
+			int largc;
+
+			largc = makeargs(line, largv, BATCH_MAX_ARGS);
+			if (largc == 0)
+				continue;	/* blank line */
+			if (spd_query(&s, largc, largv) < 0) {
+				fprintf(stderr, "Bad query at line %d\n",
+					cmdlineno);
+				ret = -1;
+			}
+		}
+		free(line);
+	}
+	fflush(stdout);
+	return ret;
+}
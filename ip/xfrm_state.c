@@ -32,9 +32,6 @@
 #include "xfrm.h"
 #include "ip_common.h"
 
-/* #define NLMSG_DELETEALL_BUF_SIZE (4096-512) */
-#define NLMSG_DELETEALL_BUF_SIZE 8192
-
 /*
  * Receiving buffer defines:
  * nlmsg
@@ -66,6 +63,8 @@ static int usage(void)
 	fprintf(stderr, "        [ flag FLAG-LIST ]\n");
 	fprintf(stderr, "Usage: ip xfrm state flush [ proto XFRM-PROTO ]\n");
 	fprintf(stderr, "Usage: ip xfrm state count\n");
+	fprintf(stderr, "Usage: ip xfrm state stats sample [ ID ] [ reqid REQID ]\n");
+	fprintf(stderr, "        [ interval SECONDS ] [ count COUNT ] [ top N ]\n");
 	fprintf(stderr, "ID := [ src ADDR ] [ dst ADDR ] [ proto XFRM-PROTO ] [ spi SPI ]\n");
 	fprintf(stderr, "XFRM-PROTO := ");
 	fprintf(stderr, "%s | ", strxf_xfrmproto(IPPROTO_ESP));
@@ -282,23 +281,13 @@ static int xfrm_offload_dir_parse(__u8 *dir, int *argcp, char ***argvp)
 	return 0;
 }
 
-static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
+/*
+ * Parse the arguments of "ip xfrm state { add | update }" into a request,
+ * without sending it. The family stays AF_UNSPEC if no address set it.
+ */
+int xfrm_state_parse(struct xfrm_state_req *req, int cmd, unsigned int flags,
+		     int argc, char **argv)
 {
-	struct rtnl_handle rth;
-	struct {
-		struct nlmsghdr	n;
-		struct xfrm_usersa_info xsinfo;
-		char			buf[RTA_BUF_SIZE];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.xsinfo)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.xsinfo.family = preferred_family,
-		.xsinfo.lft.soft_byte_limit = XFRM_INF,
-		.xsinfo.lft.hard_byte_limit = XFRM_INF,
-		.xsinfo.lft.soft_packet_limit = XFRM_INF,
-		.xsinfo.lft.hard_packet_limit = XFRM_INF,
-	};
 	struct xfrm_replay_state replay = {};
 	struct xfrm_replay_state_esn replay_esn = {};
 	struct xfrm_user_offload xuo = {};
@@ -321,18 +310,29 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 		char    str[CTX_BUF_SIZE];
 	} ctx = {};
 
+	*req = (struct xfrm_state_req) {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(req->xsinfo)),
+		.n.nlmsg_flags = NLM_F_REQUEST | flags,
+		.n.nlmsg_type = cmd,
+		.xsinfo.family = preferred_family,
+		.xsinfo.lft.soft_byte_limit = XFRM_INF,
+		.xsinfo.lft.hard_byte_limit = XFRM_INF,
+		.xsinfo.lft.soft_packet_limit = XFRM_INF,
+		.xsinfo.lft.hard_packet_limit = XFRM_INF,
+	};
+
 	while (argc > 0) {
 		if (strcmp(*argv, "mode") == 0) {
 			NEXT_ARG();
-			xfrm_mode_parse(&req.xsinfo.mode, &argc, &argv);
+			xfrm_mode_parse(&req->xsinfo.mode, &argc, &argv);
 		} else if (strcmp(*argv, "mark") == 0) {
 			xfrm_parse_mark(&mark, &argc, &argv);
 		} else if (strcmp(*argv, "reqid") == 0) {
 			NEXT_ARG();
-			xfrm_reqid_parse(&req.xsinfo.reqid, &argc, &argv);
+			xfrm_reqid_parse(&req->xsinfo.reqid, &argc, &argv);
 		} else if (strcmp(*argv, "seq") == 0) {
 			NEXT_ARG();
-			xfrm_seq_parse(&req.xsinfo.seq, &argc, &argv);
+			xfrm_seq_parse(&req->xsinfo.seq, &argc, &argv);
 		} else if (strcmp(*argv, "replay-window") == 0) {
 			NEXT_ARG();
 			if (get_u32(&replay_window, *argv, 0))
@@ -355,18 +355,18 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 				return invarg("value after \"replay-oseq-hi\" is invalid", *argv);
 		} else if (strcmp(*argv, "flag") == 0) {
 			NEXT_ARG();
-			xfrm_state_flag_parse(&req.xsinfo.flags, &argc, &argv);
+			xfrm_state_flag_parse(&req->xsinfo.flags, &argc, &argv);
 		} else if (strcmp(*argv, "extra-flag") == 0) {
 			NEXT_ARG();
 			xfrm_state_extra_flag_parse(&extra_flags, &argc, &argv);
 		} else if (strcmp(*argv, "sel") == 0) {
 			NEXT_ARG();
 			preferred_family = AF_UNSPEC;
-			xfrm_selector_parse(&req.xsinfo.sel, &argc, &argv);
-			preferred_family = req.xsinfo.sel.family;
+			xfrm_selector_parse(&req->xsinfo.sel, &argc, &argv);
+			preferred_family = req->xsinfo.sel.family;
 		} else if (strcmp(*argv, "limit") == 0) {
 			NEXT_ARG();
-			xfrm_lifetime_cfg_parse(&req.xsinfo.lft, &argc, &argv);
+			xfrm_lifetime_cfg_parse(&req->xsinfo.lft, &argc, &argv);
 		} else if (strcmp(*argv, "encap") == 0) {
 			struct xfrm_encap_tmpl encap;
 			inet_prefix oa;
@@ -381,7 +381,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 			NEXT_ARG();
 			get_addr(&oa, *argv, AF_UNSPEC);
 			memcpy(&encap.encap_oa, &oa.data, sizeof(encap.encap_oa));
-			addattr_l(&req.n, sizeof(req.buf), XFRMA_ENCAP,
+			addattr_l(&req->n, sizeof(req->buf), XFRMA_ENCAP,
 				  (void *)&encap, sizeof(encap));
 		} else if (strcmp(*argv, "coa") == 0) {
 			inet_prefix coa;
@@ -401,7 +401,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 
 			memcpy(&xcoa, &coa.data, coa.bytelen);
 
-			addattr_l(&req.n, sizeof(req.buf), XFRMA_COADDR,
+			addattr_l(&req->n, sizeof(req->buf), XFRMA_COADDR,
 				  (void *)&xcoa, sizeof(xcoa));
 		} else if (strcmp(*argv, "ctx") == 0) {
 			char *context;
@@ -414,7 +414,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 			context = *argv;
 
 			xfrm_sctx_parse((char *)&ctx.str, context, &ctx.sctx);
-			addattr_l(&req.n, sizeof(req.buf), XFRMA_SEC_CTX,
+			addattr_l(&req->n, sizeof(req->buf), XFRMA_SEC_CTX,
 				  (void *)&ctx, ctx.sctx.len);
 		} else if (strcmp(*argv, "offload") == 0) {
 			is_offload = true;
@@ -539,7 +539,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 						buf, sizeof(alg.buf));
 				len += alg.u.alg.alg_key_len / 8;
 
-				addattr_l(&req.n, sizeof(req.buf), type,
+				addattr_l(&req->n, sizeof(req->buf), type,
 					  (void *)&alg, len);
 				break;
 			}
@@ -550,16 +550,16 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 				idp = *argv;
 
 				/* ID */
-				xfrm_id_parse(&req.xsinfo.saddr, &req.xsinfo.id,
-					      &req.xsinfo.family, 0, &argc, &argv);
+				xfrm_id_parse(&req->xsinfo.saddr, &req->xsinfo.id,
+					      &req->xsinfo.family, 0, &argc, &argv);
 				if (preferred_family == AF_UNSPEC)
-					preferred_family = req.xsinfo.family;
+					preferred_family = req->xsinfo.family;
 			}
 		}
 		argc--; argv++;
 	}
 
-	if (req.xsinfo.flags & XFRM_STATE_ESN &&
+	if (req->xsinfo.flags & XFRM_STATE_ESN &&
 	    replay_window == 0) {
 		fprintf(stderr, "Error: esn flag set without replay-window.\n");
 		iprt_exit(-1);
@@ -575,10 +575,10 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 	if (is_offload) {
 		xuo.ifindex = ifindex;
 		xuo.flags = dir;
-		addattr_l(&req.n, sizeof(req.buf), XFRMA_OFFLOAD_DEV, &xuo,
+		addattr_l(&req->n, sizeof(req->buf), XFRMA_OFFLOAD_DEV, &xuo,
 			  sizeof(xuo));
 	}
-	if (req.xsinfo.flags & XFRM_STATE_ESN ||
+	if (req->xsinfo.flags & XFRM_STATE_ESN ||
 	    replay_window > (sizeof(replay.bitmap) * 8)) {
 		replay_esn.seq = seq;
 		replay_esn.oseq = oseq;
@@ -587,20 +587,20 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 		replay_esn.replay_window = replay_window;
 		replay_esn.bmp_len = (replay_window + sizeof(__u32) * 8 - 1) /
 				     (sizeof(__u32) * 8);
-		addattr_l(&req.n, sizeof(req.buf), XFRMA_REPLAY_ESN_VAL,
+		addattr_l(&req->n, sizeof(req->buf), XFRMA_REPLAY_ESN_VAL,
 			  &replay_esn, sizeof(replay_esn));
 	} else {
 		if (seq || oseq) {
 			replay.seq = seq;
 			replay.oseq = oseq;
-			addattr_l(&req.n, sizeof(req.buf), XFRMA_REPLAY_VAL,
+			addattr_l(&req->n, sizeof(req->buf), XFRMA_REPLAY_VAL,
 				  &replay, sizeof(replay));
 		}
-		req.xsinfo.replay_window = replay_window;
+		req->xsinfo.replay_window = replay_window;
 	}
 
 	if (extra_flags)
-		addattr32(&req.n, sizeof(req.buf), XFRMA_SA_EXTRA_FLAGS,
+		addattr32(&req->n, sizeof(req->buf), XFRMA_SA_EXTRA_FLAGS,
 			  extra_flags);
 
 	if (!idp) {
@@ -609,7 +609,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (mark.m) {
-		int r = addattr_l(&req.n, sizeof(req.buf), XFRMA_MARK,
+		int r = addattr_l(&req->n, sizeof(req->buf), XFRMA_MARK,
 				  (void *)&mark, sizeof(mark));
 		if (r < 0) {
 			fprintf(stderr, "XFRMA_MARK failed\n");
@@ -617,33 +617,33 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 		}
 	}
 
-	if (xfrm_xfrmproto_is_ipsec(req.xsinfo.id.proto)) {
-		switch (req.xsinfo.mode) {
+	if (xfrm_xfrmproto_is_ipsec(req->xsinfo.id.proto)) {
+		switch (req->xsinfo.mode) {
 		case XFRM_MODE_TRANSPORT:
 		case XFRM_MODE_TUNNEL:
 			break;
 		case XFRM_MODE_BEET:
-			if (req.xsinfo.id.proto == IPPROTO_ESP)
+			if (req->xsinfo.id.proto == IPPROTO_ESP)
 				break;
 		default:
 			fprintf(stderr, "MODE value is invalid with XFRM-PROTO value \"%s\"\n",
-				strxf_xfrmproto(req.xsinfo.id.proto));
+				strxf_xfrmproto(req->xsinfo.id.proto));
 			iprt_exit(1);
 		}
 
-		switch (req.xsinfo.id.proto) {
+		switch (req->xsinfo.id.proto) {
 		case IPPROTO_ESP:
 			if (calgop) {
 				fprintf(stderr, "ALGO-TYPE value \"%s\" is invalid with XFRM-PROTO value \"%s\"\n",
 					strxf_algotype(XFRMA_ALG_COMP),
-					strxf_xfrmproto(req.xsinfo.id.proto));
+					strxf_xfrmproto(req->xsinfo.id.proto));
 				iprt_exit(1);
 			}
 			if (!ealgop && !aeadop) {
 				fprintf(stderr, "ALGO-TYPE value \"%s\" or \"%s\" is required with XFRM-PROTO value \"%s\"\n",
 					strxf_algotype(XFRMA_ALG_CRYPT),
 					strxf_algotype(XFRMA_ALG_AEAD),
-					strxf_xfrmproto(req.xsinfo.id.proto));
+					strxf_xfrmproto(req->xsinfo.id.proto));
 				iprt_exit(1);
 			}
 			break;
@@ -653,14 +653,14 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 					strxf_algotype(XFRMA_ALG_CRYPT),
 					strxf_algotype(XFRMA_ALG_AEAD),
 					strxf_algotype(XFRMA_ALG_COMP),
-					strxf_xfrmproto(req.xsinfo.id.proto));
+					strxf_xfrmproto(req->xsinfo.id.proto));
 				iprt_exit(1);
 			}
 			if (!aalgop) {
 				fprintf(stderr, "ALGO-TYPE value \"%s\" or \"%s\" is required with XFRM-PROTO value \"%s\"\n",
 					strxf_algotype(XFRMA_ALG_AUTH),
 					strxf_algotype(XFRMA_ALG_AUTH_TRUNC),
-					strxf_xfrmproto(req.xsinfo.id.proto));
+					strxf_xfrmproto(req->xsinfo.id.proto));
 				iprt_exit(1);
 			}
 			break;
@@ -671,13 +671,13 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 					strxf_algotype(XFRMA_ALG_AUTH),
 					strxf_algotype(XFRMA_ALG_AUTH_TRUNC),
 					strxf_algotype(XFRMA_ALG_AEAD),
-					strxf_xfrmproto(req.xsinfo.id.proto));
+					strxf_xfrmproto(req->xsinfo.id.proto));
 				iprt_exit(1);
 			}
 			if (!calgop) {
 				fprintf(stderr, "ALGO-TYPE value \"%s\" is required with XFRM-PROTO value \"%s\"\n",
 					strxf_algotype(XFRMA_ALG_COMP),
-					strxf_xfrmproto(req.xsinfo.id.proto));
+					strxf_xfrmproto(req->xsinfo.id.proto));
 				iprt_exit(1);
 			}
 			break;
@@ -685,39 +685,99 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 	} else {
 		if (ealgop || aalgop || aeadop || calgop) {
 			fprintf(stderr, "ALGO is invalid with XFRM-PROTO value \"%s\"\n",
-				strxf_xfrmproto(req.xsinfo.id.proto));
+				strxf_xfrmproto(req->xsinfo.id.proto));
 			iprt_exit(1);
 		}
 	}
 
-	if (xfrm_xfrmproto_is_ro(req.xsinfo.id.proto)) {
-		switch (req.xsinfo.mode) {
+	if (xfrm_xfrmproto_is_ro(req->xsinfo.id.proto)) {
+		switch (req->xsinfo.mode) {
 		case XFRM_MODE_ROUTEOPTIMIZATION:
 		case XFRM_MODE_IN_TRIGGER:
 			break;
 		case 0:
 			fprintf(stderr, "\"mode\" is required with XFRM-PROTO value \"%s\"\n",
-				strxf_xfrmproto(req.xsinfo.id.proto));
+				strxf_xfrmproto(req->xsinfo.id.proto));
 			iprt_exit(1);
 		default:
 			fprintf(stderr, "MODE value is invalid with XFRM-PROTO value \"%s\"\n",
-				strxf_xfrmproto(req.xsinfo.id.proto));
+				strxf_xfrmproto(req->xsinfo.id.proto));
 			iprt_exit(1);
 		}
 
 		if (!coap) {
 			fprintf(stderr, "\"coa\" is required with XFRM-PROTO value \"%s\"\n",
-				strxf_xfrmproto(req.xsinfo.id.proto));
+				strxf_xfrmproto(req->xsinfo.id.proto));
 			iprt_exit(1);
 		}
 	} else {
 		if (coap) {
 			fprintf(stderr, "\"coa\" is invalid with XFRM-PROTO value \"%s\"\n",
-				strxf_xfrmproto(req.xsinfo.id.proto));
+				strxf_xfrmproto(req->xsinfo.id.proto));
 			iprt_exit(1);
 		}
 	}
 
+	return 0;
+}
+
+/*
+ * Replace the key of the algorithm of @type in a request from
+ * xfrm_state_parse(), with one of the same length.
+ */
+int xfrm_state_set_key(struct nlmsghdr *n, int type, char *key)
+{
+	struct rtattr *rta = XFRMS_RTA(NLMSG_DATA(n));
+	int len = XFRMS_PAYLOAD(n);
+	char buf[XFRM_ALGO_KEY_BUF_SIZE];
+	struct xfrm_algo alg = {};
+	char *old;
+	__u32 old_len;
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == type ||
+		    (type == XFRMA_ALG_AUTH &&
+		     rta->rta_type == XFRMA_ALG_AUTH_TRUNC))
+			break;
+	}
+	if (!RTA_OK(rta, len)) {
+		fprintf(stderr, "Error: no \"%s\" algorithm to set the key of\n",
+			strxf_algotype(type));
+		return -1;
+	}
+
+	switch (rta->rta_type) {
+	case XFRMA_ALG_AEAD:
+		old = ((struct xfrm_algo_aead *)RTA_DATA(rta))->alg_key;
+		old_len = ((struct xfrm_algo_aead *)RTA_DATA(rta))->alg_key_len;
+		break;
+	case XFRMA_ALG_AUTH_TRUNC:
+		old = ((struct xfrm_algo_auth *)RTA_DATA(rta))->alg_key;
+		old_len = ((struct xfrm_algo_auth *)RTA_DATA(rta))->alg_key_len;
+		break;
+	default:
+		old = ((struct xfrm_algo *)RTA_DATA(rta))->alg_key;
+		old_len = ((struct xfrm_algo *)RTA_DATA(rta))->alg_key_len;
+		break;
+	}
+
+	xfrm_algo_parse(&alg, type, "", key, buf, sizeof(buf));
+	if (alg.alg_key_len != old_len) {
+		fprintf(stderr, "Error: key is %u bits, \"%s\" wants %u\n",
+			alg.alg_key_len, strxf_algotype(type), old_len);
+		return -1;
+	}
+	memcpy(old, buf, old_len / 8);
+	return 0;
+}
+
+static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
+{
+	struct rtnl_handle rth;
+	struct xfrm_state_req req;
+
+	xfrm_state_parse(&req, cmd, flags, argc, argv);
+
 	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
 		iprt_exit(1);
 
@@ -869,7 +929,7 @@ static int xfrm_state_allocspi(int argc, char **argv)
 	return 0;
 }
 
-static int xfrm_state_filter_match(struct xfrm_usersa_info *xsinfo)
+int xfrm_state_filter_match(struct xfrm_usersa_info *xsinfo)
 {
 	if (!filter.use)
 		return 1;
@@ -1067,18 +1127,24 @@ static int xfrm_state_get_or_delete(int argc, char **argv, int delete)
 
 /*
  * With an existing state of nlmsg, make new nlmsg for deleting the state
- * and store it to buffer.
+ * and queue it.
  */
 static int xfrm_state_keep(const struct sockaddr_nl *who,
 			   struct nlmsghdr *n,
 			   void *arg)
 {
-	struct xfrm_buffer *xb = (struct xfrm_buffer *)arg;
-	struct rtnl_handle *rth = xb->rth;
+	struct xfrm_deleteall *xd = arg;
 	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct nlmsghdr *new_n;
-	struct xfrm_usersa_id *xsid;
+	struct {
+		struct nlmsghdr		n;
+		struct xfrm_usersa_id	xsid;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.xsid)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_DELSA,
+	};
 	struct rtattr *tb[XFRMA_MAX+1];
 
 	if (n->nlmsg_type != XFRM_MSG_NEWSA) {
@@ -1096,43 +1162,66 @@ static int xfrm_state_keep(const struct sockaddr_nl *who,
 	if (!xfrm_state_filter_match(xsinfo))
 		return 0;
 
-	if (xb->offset > xb->size) {
-		fprintf(stderr, "State buffer overflow\n");
-		return -1;
-	}
-
-	new_n = (struct nlmsghdr *)(xb->buf + xb->offset);
-	new_n->nlmsg_len = NLMSG_LENGTH(sizeof(*xsid));
-	new_n->nlmsg_flags = NLM_F_REQUEST;
-	new_n->nlmsg_type = XFRM_MSG_DELSA;
-	new_n->nlmsg_seq = ++rth->seq;
+	req.xsid.family = xsinfo->family;
+	memcpy(&req.xsid.daddr, &xsinfo->id.daddr, sizeof(req.xsid.daddr));
+	req.xsid.spi = xsinfo->id.spi;
+	req.xsid.proto = xsinfo->id.proto;
 
-	xsid = NLMSG_DATA(new_n);
-	xsid->family = xsinfo->family;
-	memcpy(&xsid->daddr, &xsinfo->id.daddr, sizeof(xsid->daddr));
-	xsid->spi = xsinfo->id.spi;
-	xsid->proto = xsinfo->id.proto;
+	addattr_l(&req.n, sizeof(req), XFRMA_SRCADDR, &xsinfo->saddr,
+		  sizeof(req.xsid.daddr));
 
-	addattr_l(new_n, xb->size, XFRMA_SRCADDR, &xsinfo->saddr,
-		  sizeof(xsid->daddr));
+	parse_rtattr_want(tb, XFRMA_MAX, RTA_WANT(XFRMA_MARK),
+			  XFRMS_RTA(xsinfo), len);
 
-	parse_rtattr(tb, XFRMA_MAX, XFRMS_RTA(xsinfo), len);
+	if (tb[XFRMA_MARK])
+		addattr_l(&req.n, sizeof(req), XFRMA_MARK,
+			  RTA_DATA(tb[XFRMA_MARK]),
+			  RTA_PAYLOAD(tb[XFRMA_MARK]));
 
-	if (tb[XFRMA_MARK]) {
-		int r = addattr_l(new_n, xb->size, XFRMA_MARK,
-				(void *)RTA_DATA(tb[XFRMA_MARK]), tb[XFRMA_MARK]->rta_len);
-		if (r < 0) {
-			fprintf(stderr, "%s: XFRMA_MARK failed\n", __func__);
-			iprt_exit(1);
-		}
+	if (rtnl_txq_add(&xd->q, &req.n) < 0) {
+		perror("Cannot queue delete-all request");
+		return -1;
 	}
-
-	xb->offset += new_n->nlmsg_len;
-	xb->nlmsg_count++;
+	xd->nlmsg_count++;
 
 	return 0;
 }
 
+/*
+ * Ask for the states that match the source and destination prefixes and
+ * the protocol of the filter, the kernel leaves out the others.
+ */
+void xfrm_state_dump_request(struct rtnl_handle *rth)
+{
+	struct xfrm_address_filter addrfilter = {
+		.saddr = filter.xsinfo.saddr,
+		.daddr = filter.xsinfo.id.daddr,
+		.family = filter.xsinfo.family,
+		.splen = filter.id_src_mask,
+		.dplen = filter.id_dst_mask,
+	};
+	struct {
+		struct nlmsghdr n;
+		char buf[NLMSG_BUF_SIZE];
+	} req = {
+		.n.nlmsg_len = NLMSG_HDRLEN,
+		.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_GETSA,
+		.n.nlmsg_seq = rth->dump = ++rth->seq,
+	};
+
+	if (filter.xsinfo.id.proto)
+		addattr8(&req.n, sizeof(req), XFRMA_PROTO,
+			 filter.xsinfo.id.proto);
+	addattr_l(&req.n, sizeof(req), XFRMA_ADDRESS_FILTER,
+		  &addrfilter, sizeof(addrfilter));
+
+	if (rtnl_send(rth, (void *)&req, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		iprt_exit(1);
+	}
+}
+
 static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 {
 	char *idp = NULL;
@@ -1178,87 +1267,26 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
 		iprt_exit(1);
 
-	if (deleteall) {
-		struct xfrm_buffer xb;
-		char buf[NLMSG_DELETEALL_BUF_SIZE];
-		int i;
-
-		xb.buf = buf;
-		xb.size = sizeof(buf);
-		xb.rth = &rth;
-
-		for (i = 0; ; i++) {
-			struct {
-				struct nlmsghdr n;
-				char buf[NLMSG_BUF_SIZE];
-			} req = {
-				.n.nlmsg_len = NLMSG_HDRLEN,
-				.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
-				.n.nlmsg_type = XFRM_MSG_GETSA,
-				.n.nlmsg_seq = rth.dump = ++rth.seq,
-			};
-
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
-
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all round = %d\n", i);
-
-			if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
-				perror("Cannot send dump request");
-				iprt_exit(1);
-			}
+	xfrm_state_dump_request(&rth);
 
-			if (rtnl_dump_filter(&rth, xfrm_state_keep, &xb) < 0) {
-				fprintf(stderr, "Delete-all terminated\n");
-				iprt_exit(1);
-			}
-			if (xb.nlmsg_count == 0) {
-				if (show_stats > 1)
-					fprintf(stderr, "Delete-all completed\n");
-				break;
-			}
-
-			if (rtnl_send_check(&rth, xb.buf, xb.offset) < 0) {
-				perror("Failed to send delete-all request\n");
-				iprt_exit(1);
-			}
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
+	if (deleteall) {
+		struct xfrm_deleteall xd = {};
 
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
+		/* one dump, then the deletes pipelined */
+		if (rtnl_dump_filter(&rth, xfrm_state_keep, &xd) < 0) {
+			fprintf(stderr, "Delete-all terminated\n");
+			iprt_exit(1);
 		}
+		if (show_stats > 1)
+			fprintf(stderr, "Delete-all nlmsg count = %d\n",
+				xd.nlmsg_count);
 
-	} else {
-		struct xfrm_address_filter addrfilter = {
-			.saddr = filter.xsinfo.saddr,
-			.daddr = filter.xsinfo.id.daddr,
-			.family = filter.xsinfo.family,
-			.splen = filter.id_src_mask,
-			.dplen = filter.id_dst_mask,
-		};
-		struct {
-			struct nlmsghdr n;
-			char buf[NLMSG_BUF_SIZE];
-		} req = {
-			.n.nlmsg_len = NLMSG_HDRLEN,
-			.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
-			.n.nlmsg_type = XFRM_MSG_GETSA,
-			.n.nlmsg_seq = rth.dump = ++rth.seq,
-		};
-
-		if (filter.xsinfo.id.proto)
-			addattr8(&req.n, sizeof(req), XFRMA_PROTO,
-				 filter.xsinfo.id.proto);
-		addattr_l(&req.n, sizeof(req), XFRMA_ADDRESS_FILTER,
-			  &addrfilter, sizeof(addrfilter));
-
-		if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
-			perror("Cannot send dump request");
+		if (rtnl_flush_send(&rth, &xd.q)) {
+			fprintf(stderr, "Failed to send delete-all request\n");
 			iprt_exit(1);
 		}
-
+		rtnl_txq_free(&xd.q);
+	} else {
 		if (rtnl_dump_filter(&rth, xfrm_state_print, stdout) < 0) {
 			fprintf(stderr, "Dump terminated\n");
 			iprt_exit(1);
@@ -1423,6 +1451,8 @@ int do_xfrm_state(int argc, char **argv)
 	if (matches(*argv, "count") == 0) {
 		return xfrm_sad_getinfo(argc, argv);
 	}
+	if (matches(*argv, "stats") == 0)
+		return xfrm_state_stats(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		return usage();
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip xfrm state help\".\n", *argv);
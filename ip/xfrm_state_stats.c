@@ -0,0 +1,364 @@
+/*
+ * xfrm_state_stats.c	Periodic SA traffic counter sampling.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Each sample dumps the SAD, with the same kernel side filters as
+ * "ip xfrm state list", and takes only the current lifetime counters of
+ * every SA, leaving its attributes unparsed. The counters of the last
+ * sample are kept in a hash table keyed by destination, SPI and
+ * protocol, and the SAs seen in two samples in a row are printed by
+ * byte rate, busiest first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "utils.h"
+#include "xfrm.h"
+#include "ip_common.h"
+
+struct sa_key {
+	xfrm_address_t	daddr;
+	__u32		spi;
+	__u16		family;
+	__u8		proto;
+};
+
+struct sa_sample {
+	struct sa_sample	*next;
+	struct sa_key		key;
+	__u32			hash;
+	xfrm_address_t		saddr;
+	__u64			bytes;
+	__u64			packets;
+	unsigned int		round;	/* sample it was last seen in */
+};
+
+struct sa_rate {
+	const struct sa_sample	*sa;
+	__u64			bytes;
+	__u64			packets;
+};
+
+struct sa_sampler {
+	struct sa_sample	**hash;
+	unsigned int		size;	/* buckets, a power of two */
+	unsigned int		count;
+	unsigned int		round;
+	struct sa_rate		*rates;
+	unsigned int		nrates;
+	unsigned int		rates_size;
+	double			elapsed;
+};
+
+static void print_explain(FILE *f)
+{
+	fprintf(f,
+		"Usage: ip xfrm state stats sample [ ID ] [ reqid REQID ]\n"
+		"        [ interval SECONDS ] [ count COUNT ] [ top N ]\n"
+		"ID := [ src ADDR ] [ dst ADDR ] [ proto XFRM-PROTO ] [ spi SPI ]\n");
+}
+
+static __u32 sa_hash(const struct sa_key *key)
+{
+	const __u8 *p = (const __u8 *)key;
+	__u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+static int sampler_grow(struct sa_sampler *s)
+{
+	unsigned int size = s->size ? 2 * s->size : 1024, i;
+	struct sa_sample **hash;
+
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+	for (i = 0; i < s->size; i++) {
+		struct sa_sample *e, *next;
+
+		for (e = s->hash[i]; e; e = next) {
+			next = e->next;
+			e->next = hash[e->hash & (size - 1)];
+			hash[e->hash & (size - 1)] = e;
+		}
+	}
+	free(s->hash);
+	s->hash = hash;
+	s->size = size;
+	return 0;
+}
+
+static int sampler_rate(struct sa_sampler *s, const struct sa_sample *e,
+			__u64 bytes, __u64 packets)
+{
+	if (s->nrates == s->rates_size) {
+		unsigned int size = s->rates_size ? 2 * s->rates_size : 1024;
+		struct sa_rate *rates;
+
+		rates = realloc(s->rates, size * sizeof(*rates));
+		if (!rates)
+			return -1;
+		s->rates = rates;
+		s->rates_size = size;
+	}
+	s->rates[s->nrates++] = (struct sa_rate) {
+		.sa		= e,
+		.bytes		= bytes,
+		.packets	= packets,
+	};
+	return 0;
+}
+
+static int sample_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	struct sa_sampler *s = arg;
+	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
+	struct sa_sample *e;
+	struct sa_key key;
+	__u32 hash;
+
+	if (n->nlmsg_type != XFRM_MSG_NEWSA)
+		return 0;
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*xsinfo)))
+		return -1;
+
+	if (!xfrm_state_filter_match(xsinfo))
+		return 0;
+
+	memset(&key, 0, sizeof(key));
+	key.daddr = xsinfo->id.daddr;
+	key.spi = xsinfo->id.spi;
+	key.family = xsinfo->family;
+	key.proto = xsinfo->id.proto;
+	hash = sa_hash(&key);
+
+	e = NULL;
+	if (s->size) {
+		for (e = s->hash[hash & (s->size - 1)]; e; e = e->next) {
+			if (e->hash == hash && !memcmp(&e->key, &key, sizeof(key)))
+				break;
+		}
+	}
+
+	if (!e) {
+		if (s->count >= s->size && sampler_grow(s) < 0)
+			return -1;
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			return -1;
+		e->key = key;
+		e->hash = hash;
+		e->next = s->hash[hash & (s->size - 1)];
+		s->hash[hash & (s->size - 1)] = e;
+		s->count++;
+	} else if (e->round + 1 == s->round &&
+		   xsinfo->curlft.bytes >= e->bytes &&
+		   xsinfo->curlft.packets >= e->packets) {
+		/* the counters going back would be a new SA on the same ID */
+		if (sampler_rate(s, e, xsinfo->curlft.bytes - e->bytes,
+				 xsinfo->curlft.packets - e->packets) < 0)
+			return -1;
+	}
+
+	e->saddr = xsinfo->saddr;
+	e->bytes = xsinfo->curlft.bytes;
+	e->packets = xsinfo->curlft.packets;
+	e->round = s->round;
+	return 0;
+}
+
+/* Forget the SAs that were not in the last sample */
+static void sampler_expire(struct sa_sampler *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->size; i++) {
+		struct sa_sample **pe = &s->hash[i];
+
+		while (*pe) {
+			struct sa_sample *e = *pe;
+
+			if (e->round == s->round) {
+				pe = &e->next;
+				continue;
+			}
+			*pe = e->next;
+			free(e);
+			s->count--;
+		}
+	}
+}
+
+static int rate_cmp(const void *a, const void *b)
+{
+	const struct sa_rate *ra = a, *rb = b;
+
+	if (ra->bytes != rb->bytes)
+		return ra->bytes < rb->bytes ? 1 : -1;
+	if (ra->packets != rb->packets)
+		return ra->packets < rb->packets ? 1 : -1;
+	return 0;
+}
+
+static void print_rate(const struct sa_rate *r, double elapsed)
+{
+	const struct sa_sample *e = r->sa;
+	int len = e->key.family == AF_INET6 ? 16 : 4;
+	char abuf[256];
+
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "src", "src %s",
+		     rt_addr_n2a_r(e->key.family, len, &e->saddr,
+				   abuf, sizeof(abuf)));
+	print_string(PRINT_ANY, "dst", " dst %s",
+		     rt_addr_n2a_r(e->key.family, len, &e->key.daddr,
+				   abuf, sizeof(abuf)));
+	print_string(PRINT_ANY, "proto", " proto %s",
+		     strxf_xfrmproto(e->key.proto));
+	print_0xhex(PRINT_ANY, "spi", " spi 0x%08x", ntohl(e->key.spi));
+	print_float(PRINT_JSON, "interval", NULL, elapsed);
+	print_u64(PRINT_ANY, "bytes", " bytes %" PRIu64, r->bytes);
+	print_u64(PRINT_ANY, "packets", " packets %" PRIu64, r->packets);
+	print_float(PRINT_ANY, "bytes_rate", " rate %.0fB/s",
+		    r->bytes / elapsed);
+	print_float(PRINT_ANY, "packets_rate", " %.0fpps",
+		    r->packets / elapsed);
+	print_string(PRINT_FP, NULL, "%s", "\n");
+	close_json_object();
+}
+
+static int sample_one(struct rtnl_handle *rth, struct sa_sampler *s,
+		      unsigned int top)
+{
+	unsigned int i;
+
+	s->nrates = 0;
+	xfrm_state_dump_request(rth);
+	if (rtnl_dump_filter(rth, sample_nlmsg, s) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	sampler_expire(s);
+
+	qsort(s->rates, s->nrates, sizeof(*s->rates), rate_cmp);
+	if (top && top < s->nrates)
+		s->nrates = top;
+	for (i = 0; i < s->nrates; i++)
+		print_rate(&s->rates[i], s->elapsed);
+	return 0;
+}
+
+static int xfrm_state_stats_sample(int argc, char **argv)
+{
+	struct sa_sampler s = {};
+	struct timespec next, now, last;
+	struct rtnl_handle rth;
+	unsigned int count = 0, top = 0, i;
+	double interval = 1;
+	char *idp = NULL;
+	int ret = 0;
+
+	filter.xsinfo.family = preferred_family;
+	while (argc > 0) {
+		if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				return invarg("invalid count", *argv);
+		} else if (strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&top, *argv, 0))
+				return invarg("invalid top", *argv);
+		} else if (strcmp(*argv, "reqid") == 0) {
+			NEXT_ARG();
+			xfrm_reqid_parse(&filter.xsinfo.reqid, &argc, &argv);
+			filter.reqid_mask = XFRM_FILTER_MASK_FULL;
+			filter.use = 1;
+		} else if (matches(*argv, "help") == 0) {
+			print_explain(stdout);
+			return 0;
+		} else {
+			if (idp)
+				return invarg("unknown argument", *argv);
+			idp = *argv;
+
+			xfrm_id_parse(&filter.xsinfo.saddr, &filter.xsinfo.id,
+				      &filter.xsinfo.family, 1, &argc, &argv);
+			if (preferred_family == AF_UNSPEC)
+				preferred_family = filter.xsinfo.family;
+			filter.use = 1;
+		}
+		argc--; argv++;
+	}
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last = next;
+	for (s.round = 1; ; s.round++) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		s.elapsed = timespec_diff(&now, &last);
+		last = now;
+
+		/* the first sample only primes the counters */
+		if (s.round > 1)
+			new_json_obj(json);
+		ret = sample_one(&rth, &s, top);
+		delete_json_obj();
+		if (s.round > 1 && !json)
+			printf("\n");
+		fflush(stdout);
+
+		/* count samples after the one the first rates are taken to */
+		if (ret < 0 || (count && s.round > count))
+			break;
+
+		sample_wait(&next, interval);
+	}
+
+	rtnl_close(&rth);
+	for (i = 0; i < s.size; i++) {
+		while (s.hash[i]) {
+			struct sa_sample *e = s.hash[i];
+
+			s.hash[i] = e->next;
+			free(e);
+		}
+	}
+	free(s.hash);
+	free(s.rates);
+	return ret < 0 ? 1 : 0;
+}
+
+int xfrm_state_stats(int argc, char **argv)
+{
+	if (argc < 1 || matches(*argv, "help") == 0) {
+		print_explain(argc < 1 ? stderr : stdout);
+		return argc < 1 ? -1 : 0;
+	}
+
+	if (matches(*argv, "sample") == 0)
+		return xfrm_state_stats_sample(argc - 1, argv + 1);
+
+	fprintf(stderr, "Command \"%s\" is unknown, try \"ip xfrm state stats help\".\n",
+		*argv);
+	return -1;
+}
@@ -0,0 +1,88 @@
+/*
+ * arena.c	Bump allocation for objects freed all at once.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Chunks start small and double up to ARENA_CHUNK_MAX, so that an arena
+ * holding a handful of objects costs no more than a page, and one
+ * holding a million of them a few hundred mallocs. An object too big
+ * for a chunk gets one to itself, behind the current chunk, whose room
+ * is kept for what comes next.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_MIN		4096
+#define ARENA_CHUNK_MAX		(1024 * 1024)
+
+struct arena_chunk {
+	struct arena_chunk	*next;
+	char			data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+void *arena_alloc_chunk(struct arena *a, size_t size)
+{
+	size_t len = a->next_size ? : ARENA_CHUNK_MIN;
+	struct arena_chunk *c;
+
+	if (size > len / 4 && a->chunks) {
+		c = malloc(sizeof(*c) + size);
+		if (!c)
+			return NULL;
+		c->next = a->chunks->next;
+		a->chunks->next = c;
+		return c->data;
+	}
+
+	while (len < size)
+		len *= 2;
+	c = malloc(sizeof(*c) + len);
+	if (!c)
+		return NULL;
+	c->next = a->chunks;
+	a->chunks = c;
+	a->cur = c->data + size;
+	a->end = c->data + len;
+	a->next_size = len < ARENA_CHUNK_MAX ? 2 * len : len;
+	return c->data;
+}
+
+void *arena_zalloc(struct arena *a, size_t size)
+{
+	void *p = arena_alloc(a, size);
+
+	if (p)
+		memset(p, 0, size);
+	return p;
+}
+
+void *arena_memdup(struct arena *a, const void *src, size_t size)
+{
+	void *p = arena_alloc(a, size);
+
+	if (p)
+		memcpy(p, src, size);
+	return p;
+}
+
+char *arena_strdup(struct arena *a, const char *str)
+{
+	return arena_memdup(a, str, strlen(str) + 1);
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	memset(a, 0, sizeof(*a));
+}
@@ -22,6 +22,8 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <assert.h>
+#include <ctype.h>
+#include <signal.h>
 
 #ifdef HAVE_ELF
 #include <libelf.h>
@@ -36,6 +38,11 @@
 #include <sys/syscall.h>
 #include <sys/sendfile.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#include <linux/perf_event.h>
 
 #include <arpa/inet.h>
 
@@ -112,11 +119,9 @@ const char *bpf_prog_to_default_section(enum bpf_prog_type type)
 }
 
 #ifdef HAVE_ELF
-static int bpf_obj_open(const char *path, enum bpf_prog_type type,
-			const char *sec, __u32 ifindex, bool verbose);
+static int bpf_obj_open(const struct bpf_cfg_in *cfg, bool cache);
 #else
-static int bpf_obj_open(const char *path, enum bpf_prog_type type,
-			const char *sec, __u32 ifindex, bool verbose)
+static int bpf_obj_open(const struct bpf_cfg_in *cfg, bool cache)
 {
 	fprintf(stderr, "No ELF library support compiled in.\n");
 	errno = ENOSYS;
@@ -722,7 +727,7 @@ static int bpf_gen_hierarchy(const char *base)
 	return ret;
 }
 
-static const char *bpf_get_work_dir(enum bpf_prog_type type)
+const char *bpf_get_work_dir(enum bpf_prog_type type)
 {
 	static char bpf_tmp[PATH_MAX] = BPF_DIR_MNT;
 	static char bpf_wrk_dir[PATH_MAX];
@@ -778,7 +783,7 @@ out:
 	return mnt;
 }
 
-static int bpf_obj_get(const char *pathname, enum bpf_prog_type type)
+int bpf_obj_get(const char *pathname, enum bpf_prog_type type)
 {
 	union bpf_attr attr = {};
 	char tmp[PATH_MAX];
@@ -795,6 +800,36 @@ static int bpf_obj_get(const char *pathname, enum bpf_prog_type type)
 	return bpf(BPF_OBJ_GET, &attr, sizeof(attr));
 }
 
+int bpf_obj_pin(int fd, const char *pathname)
+{
+	union bpf_attr attr = {};
+
+	attr.pathname = bpf_ptr_to_u64(pathname);
+	attr.bpf_fd = fd;
+
+	return bpf(BPF_OBJ_PIN, &attr, sizeof(attr));
+}
+
+/* The program pinned at pathname, if it is one of the type expected */
+int bpf_prog_get_pinned(const char *pathname, enum bpf_prog_type type)
+{
+	struct bpf_prog_info info = {};
+	uint32_t len = sizeof(info);
+	int fd;
+
+	fd = bpf_obj_get(pathname, type);
+	if (fd < 0)
+		return fd;
+
+	if (bpf_prog_info_by_fd(fd, &info, &len) || !len ||
+	    info.type != type) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	return fd;
+}
+
 static int bpf_obj_pinned(const char *pathname, enum bpf_prog_type type)
 {
 	int prog_fd = bpf_obj_get(pathname, type);
@@ -808,7 +843,8 @@ static int bpf_obj_pinned(const char *pathname, enum bpf_prog_type type)
 static int bpf_do_parse(struct bpf_cfg_in *cfg, const bool *opt_tbl)
 {
 	const char *file, *section, *uds_name;
-	bool verbose = false;
+	bool verbose = false, timing = false;
+	__u32 log_size = 0;
 	int i, ret, argc;
 	char **argv;
 
@@ -890,6 +926,19 @@ static int bpf_do_parse(struct bpf_cfg_in *cfg, const bool *opt_tbl)
 			NEXT_ARG_FWD();
 		}
 
+		if (argc > 0 && matches(*argv, "timing") == 0) {
+			timing = true;
+			NEXT_ARG_FWD();
+		}
+
+		if (argc > 0 && strcmp(*argv, "log-size") == 0) {
+			NEXT_ARG();
+			if (get_u32(&log_size, *argv, 0) || !log_size ||
+			    log_size > UINT_MAX >> 8)
+				invarg("invalid log-size", *argv);
+			NEXT_ARG_FWD();
+		}
+
 		PREV_ARG();
 	}
 
@@ -912,6 +961,8 @@ static int bpf_do_parse(struct bpf_cfg_in *cfg, const bool *opt_tbl)
 	cfg->argc    = argc;
 	cfg->argv    = argv;
 	cfg->verbose = verbose;
+	cfg->timing  = timing;
+	cfg->log_size = log_size;
 
 	return ret;
 }
@@ -919,9 +970,11 @@ static int bpf_do_parse(struct bpf_cfg_in *cfg, const bool *opt_tbl)
 static int bpf_do_load(struct bpf_cfg_in *cfg)
 {
 	if (cfg->mode == EBPF_OBJECT) {
-		cfg->prog_fd = bpf_obj_open(cfg->object, cfg->type,
-					    cfg->section, cfg->ifindex,
-					    cfg->verbose);
+		/* an export wants the maps, verbose the verifier's log,
+		 * timing what loading takes
+		 */
+		cfg->prog_fd = bpf_obj_open(cfg, !cfg->uds && !cfg->verbose &&
+					    !cfg->timing);
 		return cfg->prog_fd;
 	}
 	return 0;
@@ -1045,6 +1098,546 @@ out_prog:
 	return ret;
 }
 
+#ifndef BPF_MAP_UPDATE_BATCH
+#define BPF_MAP_UPDATE_BATCH	26
+#endif
+
+/* The batch member of union bpf_attr, which our header predates */
+struct bpf_map_batch_attr {
+	__aligned_u64	in_batch;
+	__aligned_u64	out_batch;
+	__aligned_u64	keys;
+	__aligned_u64	values;
+	__u32		count;
+	__u32		map_fd;
+	__u64		elem_flags;
+	__u64		flags;
+};
+
+/* On failure, count is how many went in before the one that failed,
+ * or left as it was when the kernel did not even try.
+ */
+static int bpf_map_update_batch(int fd, const void *keys, const void *values,
+				uint32_t *count, uint64_t flags)
+{
+	struct bpf_map_batch_attr attr = {};
+	int ret;
+
+	attr.keys = bpf_ptr_to_u64(keys);
+	attr.values = bpf_ptr_to_u64(values);
+	attr.count = *count;
+	attr.map_fd = fd;
+	attr.elem_flags = flags;
+
+	ret = bpf(BPF_MAP_UPDATE_BATCH, (union bpf_attr *)&attr, sizeof(attr));
+	*count = attr.count;
+	return ret;
+}
+
+struct bpf_map_file {
+	const char	*name;
+	unsigned int	lineno;
+	int		fd;
+	uint64_t	flags;
+	unsigned int	size_key;
+	unsigned int	size_value;
+	unsigned int	batch;
+	unsigned int	num;
+	bool		batch_ok;
+	uint8_t		*keys;
+	uint8_t		*values;
+	unsigned int	*lines;
+	unsigned long	done;
+};
+
+/* Parse one field of a record into at most len bytes at buf */
+static int bpf_map_field_parse(const char *arg, uint8_t *buf,
+			       unsigned int len)
+{
+	const char *val = strchr(arg, ':');
+	__u64 u;
+	int n;
+
+	if (!val) {
+		unsigned int cnt;
+
+		/* raw bytes, in memory order */
+		if (!strncmp(arg, "0x", 2))
+			arg += 2;
+		n = strlen(arg) / 2;
+		if (!n || n > len || !hexstring_a2n(arg, buf, n, &cnt))
+			return -1;
+		return n;
+	}
+	val++;
+
+	if (!strncmp(arg, "ip:", 3)) {
+		n = strchr(val, ':') ? 16 : 4;
+		if (n > len ||
+		    inet_pton(n == 4 ? AF_INET : AF_INET6, val, buf) != 1)
+			return -1;
+		return n;
+	}
+	if (!strncmp(arg, "mac:", 4)) {
+		if (len < 6 || sscanf(val, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%n",
+				      &buf[0], &buf[1], &buf[2], &buf[3],
+				      &buf[4], &buf[5], &n) != 6 || val[n])
+			return -1;
+		return 6;
+	}
+
+	if (!strncmp(arg, "u8:", 3))
+		n = 1;
+	else if (!strncmp(arg, "u16:", 4) || !strncmp(arg, "be16:", 5))
+		n = 2;
+	else if (!strncmp(arg, "u32:", 4) || !strncmp(arg, "be32:", 5))
+		n = 4;
+	else if (!strncmp(arg, "u64:", 4) || !strncmp(arg, "be64:", 5))
+		n = 8;
+	else
+		return -1;
+	if (n > len || get_u64(&u, val, 0) ||
+	    (n < 8 && u >> (8 * n)))
+		return -1;
+
+	switch (n) {
+	case 1:
+		*buf = u;
+		break;
+	case 2: {
+		__u16 v = arg[0] == 'b' ? htons(u) : u;
+
+		memcpy(buf, &v, n);
+		break;
+	}
+	case 4: {
+		__u32 v = arg[0] == 'b' ? htonl(u) : u;
+
+		memcpy(buf, &v, n);
+		break;
+	}
+	default:
+		if (arg[0] == 'b')
+			u = htonll(u);
+		memcpy(buf, &u, n);
+		break;
+	}
+	return n;
+}
+
+/* Fields fill the key, then the value, none may straddle both */
+static int bpf_map_record_parse(struct bpf_map_file *mf, char *line)
+{
+	unsigned int size = mf->size_key + mf->size_value, off = 0;
+	uint8_t *key = mf->keys + mf->num * mf->size_key;
+	uint8_t *value = mf->values + mf->num * mf->size_value;
+	char *arg, *save;
+	int n;
+
+	for (arg = strtok_r(line, " \t\r\n", &save); arg;
+	     arg = strtok_r(NULL, " \t\r\n", &save)) {
+		if (off < mf->size_key)
+			n = bpf_map_field_parse(arg, key + off,
+						mf->size_key - off);
+		else
+			n = bpf_map_field_parse(arg, value + off - mf->size_key,
+						size - off);
+		if (n < 0) {
+			fprintf(stderr, "%s:%u: invalid field \"%s\" at byte %u of the %s\n",
+				mf->name, mf->lineno, arg,
+				off < mf->size_key ? off : off - mf->size_key,
+				off < mf->size_key ? "key" : "value");
+			return -1;
+		}
+		off += n;
+	}
+
+	if (off != size) {
+		fprintf(stderr, "%s:%u: record has %u bytes, the map takes %u byte keys and %u byte values\n",
+			mf->name, mf->lineno, off, mf->size_key,
+			mf->size_value);
+		return -1;
+	}
+
+	mf->lines[mf->num++] = mf->lineno;
+	return 0;
+}
+
+static int bpf_map_file_flush(struct bpf_map_file *mf, bool verbose)
+{
+	uint32_t i = 0, count = mf->num;
+
+	if (mf->batch_ok) {
+		if (!bpf_map_update_batch(mf->fd, mf->keys, mf->values,
+					  &count, mf->flags))
+			i = mf->num;
+		else if (count < mf->num)
+			i = count;
+		else
+			/* no batches for this map type, or at all */
+			mf->batch_ok = false;
+	}
+
+	for (; !mf->batch_ok && i < mf->num; i++) {
+		if (bpf_map_update(mf->fd, mf->keys + i * mf->size_key,
+				   mf->values + i * mf->size_value,
+				   mf->flags) < 0)
+			break;
+	}
+
+	mf->done += i;
+	if (i < mf->num) {
+		fprintf(stderr, "%s:%u: map update failed: %s (%lu entries updated)\n",
+			mf->name, mf->lines[i], strerror(errno), mf->done);
+		return -1;
+	}
+
+	mf->num = 0;
+	if (verbose)
+		fprintf(stderr, "%s: %lu entries updated\n", mf->name,
+			mf->done);
+	return 0;
+}
+
+int bpf_map_update_file(const char *map_path, const char *file,
+			unsigned int batch, uint64_t flags, bool verbose)
+{
+	struct bpf_map_file mf = {
+		.name		= file,
+		.flags		= flags,
+		.batch		= batch,
+		.batch_ok	= true,
+	};
+	struct bpf_elf_map map;
+	size_t len = 0;
+	char *line = NULL;
+	int ret = -1;
+	FILE *fp;
+
+	mf.fd = bpf_obj_get(map_path, BPF_PROG_TYPE_SCHED_CLS);
+	if (mf.fd < 0) {
+		fprintf(stderr, "Couldn\'t retrieve pinned map \'%s\': %s\n",
+			map_path, strerror(errno));
+		return -1;
+	}
+
+	if (bpf_derive_elf_map_from_fdinfo(mf.fd, &map, NULL) < 0)
+		goto out_map;
+	if (!map.size_key || !map.size_value) {
+		fprintf(stderr, "Cannot tell the key and value sizes of map \'%s\'!\n",
+			map_path);
+		goto out_map;
+	}
+
+	switch (map.type) {
+	case BPF_MAP_TYPE_PERCPU_HASH:
+	case BPF_MAP_TYPE_PERCPU_ARRAY:
+	case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+		fprintf(stderr, "Map \'%s\' is per-CPU, not supported!\n",
+			map_path);
+		goto out_map;
+	case BPF_MAP_TYPE_PROG_ARRAY:
+	case BPF_MAP_TYPE_PERF_EVENT_ARRAY:
+	case BPF_MAP_TYPE_CGROUP_ARRAY:
+	case BPF_MAP_TYPE_ARRAY_OF_MAPS:
+	case BPF_MAP_TYPE_HASH_OF_MAPS:
+		fprintf(stderr, "Map \'%s\' takes file descriptors, not supported!\n",
+			map_path);
+		goto out_map;
+	}
+	mf.size_key = map.size_key;
+	mf.size_value = map.size_value;
+
+	mf.keys = calloc(batch, mf.size_key);
+	mf.values = calloc(batch, mf.size_value);
+	mf.lines = calloc(batch, sizeof(*mf.lines));
+	if (!mf.keys || !mf.values || !mf.lines) {
+		fprintf(stderr, "Cannot allocate %u map records!\n", batch);
+		goto out_free;
+	}
+
+	if (strcmp(file, "-") == 0) {
+		fp = stdin;
+		mf.name = "stdin";
+	} else {
+		fp = fopen(file, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open %s: %s\n", file,
+				strerror(errno));
+			goto out_free;
+		}
+	}
+
+	ret = 0;
+	while (getline(&line, &len, fp) >= 0) {
+		char *cp = strchr(line, '#');
+
+		mf.lineno++;
+		if (cp)
+			*cp = '\0';
+		if (line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		ret = bpf_map_record_parse(&mf, line);
+		if (!ret && mf.num == mf.batch)
+			ret = bpf_map_file_flush(&mf, verbose);
+		if (ret < 0)
+			break;
+	}
+	if (!ret && mf.num)
+		ret = bpf_map_file_flush(&mf, verbose);
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+out_free:
+	free(mf.keys);
+	free(mf.values);
+	free(mf.lines);
+out_map:
+	close(mf.fd);
+	return ret;
+}
+
+struct bpf_perf_ring {
+	int				fd;
+	unsigned int			cpu;
+	struct perf_event_mmap_page	*page;
+	uint8_t				*data;
+	uint64_t			lost;
+};
+
+struct bpf_perf {
+	struct bpf_perf_ring	*rings;
+	unsigned int		count;
+	size_t			size;
+	uint8_t			*wrapped;
+	bool			raw;
+	uint64_t		records;
+	uint64_t		lost;
+};
+
+static volatile sig_atomic_t bpf_perf_stop;
+
+static void bpf_perf_sig(int sig)
+{
+	bpf_perf_stop = 1;
+}
+
+static int bpf_perf_event_open(unsigned int cpu, unsigned int watermark)
+{
+	struct perf_event_attr attr = {
+		.size			= sizeof(attr),
+		.type			= PERF_TYPE_SOFTWARE,
+		.config			= PERF_COUNT_SW_BPF_OUTPUT,
+		.sample_type		= PERF_SAMPLE_RAW,
+		.sample_period		= 1,
+		.watermark		= 1,
+		.wakeup_watermark	= watermark,
+	};
+
+#ifdef __NR_perf_event_open
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, -1,
+		       PERF_FLAG_FD_CLOEXEC);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static void bpf_perf_print(const struct bpf_perf *p, unsigned int cpu,
+			   const uint8_t *data, uint32_t size)
+{
+	static const char hex[] = "0123456789abcdef";
+	char buf[3 * 64];
+	uint32_t i, j;
+
+	if (p->raw) {
+		fwrite(&size, sizeof(size), 1, stdout);
+		fwrite(data, size, 1, stdout);
+		return;
+	}
+
+	printf("cpu %u size %u:", cpu, size);
+	for (i = 0; i < size; ) {
+		for (j = 0; j < sizeof(buf) && i < size; i++, j += 3) {
+			buf[j] = ' ';
+			buf[j + 1] = hex[data[i] >> 4];
+			buf[j + 2] = hex[data[i] & 0xf];
+		}
+		fwrite(buf, j, 1, stdout);
+	}
+	putchar('\n');
+}
+
+static void bpf_perf_drain(struct bpf_perf *p, struct bpf_perf_ring *r)
+{
+	uint64_t head = __atomic_load_n(&r->page->data_head, __ATOMIC_ACQUIRE);
+	uint64_t tail = r->page->data_tail;
+
+	while (tail != head) {
+		size_t off = tail & (p->size - 1);
+		struct perf_event_header *eh = (void *)(r->data + off);
+		uint8_t *rec = r->data + off;
+		uint32_t size;
+		uint64_t lost;
+
+		if (eh->size < sizeof(*eh))
+			break;
+		/* records are 8 byte aligned, so only the header never wraps */
+		if (off + eh->size > p->size) {
+			size_t part = p->size - off;
+
+			memcpy(p->wrapped, rec, part);
+			memcpy(p->wrapped + part, r->data, eh->size - part);
+			rec = p->wrapped;
+		}
+
+		switch (eh->type) {
+		case PERF_RECORD_SAMPLE:
+			memcpy(&size, rec + sizeof(*eh), sizeof(size));
+			if (sizeof(*eh) + sizeof(size) + size > eh->size)
+				break;
+			bpf_perf_print(p, r->cpu, rec + sizeof(*eh) +
+				       sizeof(size), size);
+			p->records++;
+			break;
+		case PERF_RECORD_LOST:
+			/* followed by the id of the event, then the count */
+			memcpy(&lost, rec + sizeof(*eh) + sizeof(uint64_t),
+			       sizeof(lost));
+			r->lost += lost;
+			p->lost += lost;
+			break;
+		}
+		tail += eh->size;
+	}
+
+	__atomic_store_n(&r->page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+int bpf_perf_map(const char *map_path, unsigned int pages, bool raw)
+{
+	struct bpf_perf p = { .raw = raw };
+	long page_size = sysconf(_SC_PAGESIZE);
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	struct epoll_event *events = NULL;
+	struct bpf_elf_map map;
+	int map_fd, epfd = -1, ret = -1;
+	unsigned int cpu, i;
+
+	map_fd = bpf_obj_get(map_path, BPF_PROG_TYPE_SCHED_CLS);
+	if (map_fd < 0) {
+		fprintf(stderr, "Couldn\'t retrieve pinned map \'%s\': %s\n",
+			map_path, strerror(errno));
+		return -1;
+	}
+	if (bpf_derive_elf_map_from_fdinfo(map_fd, &map, NULL) < 0)
+		goto out;
+	if (map.type != BPF_MAP_TYPE_PERF_EVENT_ARRAY) {
+		fprintf(stderr, "Map \'%s\' is not a perf event array!\n",
+			map_path);
+		goto out;
+	}
+
+	if (cpus > map.max_elem)
+		cpus = map.max_elem;
+	p.size = pages * page_size;
+	p.rings = calloc(cpus, sizeof(*p.rings));
+	p.wrapped = malloc(p.size);
+	events = calloc(cpus, sizeof(*events));
+	if (!p.rings || !p.wrapped || !events) {
+		fprintf(stderr, "Cannot allocate %ld perf rings!\n", cpus);
+		goto out;
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		goto out;
+	}
+
+	for (cpu = 0; cpu < cpus; cpu++) {
+		struct bpf_perf_ring *r = &p.rings[p.count];
+		struct epoll_event ev = { .events = EPOLLIN };
+		void *base;
+
+		/* woken up when half full, read at least every 100ms */
+		r->fd = bpf_perf_event_open(cpu, p.size / 2);
+		if (r->fd < 0) {
+			if (errno == ENODEV)
+				continue;
+			fprintf(stderr, "Cannot open a perf event on CPU %u: %s\n",
+				cpu, strerror(errno));
+			goto out;
+		}
+		base = mmap(NULL, p.size + page_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, r->fd, 0);
+		if (base == MAP_FAILED) {
+			fprintf(stderr, "Cannot map the perf ring of CPU %u: %s\n",
+				cpu, strerror(errno));
+			close(r->fd);
+			goto out;
+		}
+		r->cpu = cpu;
+		r->page = base;
+		r->data = (uint8_t *)base + page_size;
+		p.count++;
+
+		ev.data.ptr = r;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, r->fd, &ev) < 0 ||
+		    ioctl(r->fd, PERF_EVENT_IOC_ENABLE, 0) < 0 ||
+		    bpf_map_update(map_fd, &cpu, &r->fd, BPF_ANY) < 0) {
+			fprintf(stderr, "Cannot attach the perf event of CPU %u: %s\n",
+				cpu, strerror(errno));
+			goto out;
+		}
+	}
+
+	signal(SIGINT, bpf_perf_sig);
+	signal(SIGTERM, bpf_perf_sig);
+	fprintf(stderr, "Running! Hang up with ^C!\n\n");
+
+	while (!bpf_perf_stop) {
+		if (epoll_wait(epfd, events, p.count, 100) < 0 &&
+		    errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		for (i = 0; i < p.count; i++)
+			bpf_perf_drain(&p, &p.rings[i]);
+		fflush(stdout);
+	}
+
+	/* what came since, and the lost records the kernel still owes */
+	for (i = 0; i < p.count; i++) {
+		ioctl(p.rings[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+		bpf_perf_drain(&p, &p.rings[i]);
+	}
+	fflush(stdout);
+
+	fprintf(stderr, "\n%llu records, %llu lost\n",
+		(unsigned long long)p.records, (unsigned long long)p.lost);
+	for (i = 0; i < p.count; i++)
+		if (p.rings[i].lost)
+			fprintf(stderr, "  cpu %u: %llu lost\n", p.rings[i].cpu,
+				(unsigned long long)p.rings[i].lost);
+	ret = 0;
+out:
+	/* closing the map drops the events it was given */
+	for (i = 0; p.rings && i < p.count; i++) {
+		munmap(p.rings[i].page, p.size + page_size);
+		close(p.rings[i].fd);
+	}
+	if (epfd >= 0)
+		close(epfd);
+	free(events);
+	free(p.wrapped);
+	free(p.rings);
+	close(map_fd);
+	return ret;
+}
+
 int bpf_prog_attach_fd(int prog_fd, int target_fd, enum bpf_attach_type type)
 {
 	union bpf_attr attr = {};
@@ -1114,6 +1707,16 @@ struct bpf_config {
 	unsigned int		jit_enabled;
 };
 
+struct bpf_elf_timing {
+	double			elf;
+	double			maps;
+	double			relo;
+	double			verify;
+	unsigned int		progs;
+	unsigned int		insns;
+	unsigned int		retries;
+};
+
 struct bpf_elf_ctx {
 	struct bpf_config	cfg;
 	Elf			*elf_fd;
@@ -1133,12 +1736,23 @@ struct bpf_elf_ctx {
 	enum bpf_prog_type	type;
 	__u32			ifindex;
 	bool			verbose;
+	bool			timing;
+	struct bpf_elf_timing	time;
 	struct bpf_elf_st	stat;
 	struct bpf_hash_entry	*ht[256];
 	char			*log;
 	size_t			log_size;
+	size_t			log_init;
 };
 
+static double bpf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 struct bpf_elf_sec_data {
 	GElf_Shdr		sec_hdr;
 	Elf_Data		*sec_data;
@@ -1186,7 +1800,7 @@ static int bpf_log_realloc(struct bpf_elf_ctx *ctx)
 	char *ptr;
 
 	if (!ctx->log) {
-		log_size = 65536;
+		log_size = ctx->log_init ? : 65536;
 	} else if (log_size < log_max) {
 		log_size <<= 1;
 		if (log_size > log_max)
@@ -1223,16 +1837,6 @@ static int bpf_map_create(enum bpf_map_type type, uint32_t size_key,
 	return bpf(BPF_MAP_CREATE, &attr, sizeof(attr));
 }
 
-static int bpf_obj_pin(int fd, const char *pathname)
-{
-	union bpf_attr attr = {};
-
-	attr.pathname = bpf_ptr_to_u64(pathname);
-	attr.bpf_fd = fd;
-
-	return bpf(BPF_OBJ_PIN, &attr, sizeof(attr));
-}
-
 static int bpf_obj_hash(const char *object, uint8_t *out, size_t len)
 {
 	struct sockaddr_alg alg = {
@@ -1308,16 +1912,40 @@ out_cfd:
 	return ret;
 }
 
+/* Same file, and not written to since */
+static bool bpf_obj_same(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+	       a->st_size == b->st_size &&
+	       a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	       a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+	       a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+	       a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
 static const char *bpf_get_obj_uid(const char *pathname)
 {
+	static struct stat bpf_uid_st;
 	static bool bpf_uid_cached;
 	static char bpf_uid[64];
+	struct stat st = {};
 	uint8_t tmp[20];
 	int ret;
 
-	if (bpf_uid_cached)
+	/* A batch may load other objects, or reload this one rewritten.
+	 * The file is stat'ed before hashing, so a write while it is read
+	 * only costs hashing it again the next time.
+	 */
+	if (pathname) {
+		if (stat(pathname, &st))
+			memset(&st, 0, sizeof(st));
+		else if (bpf_uid_cached && bpf_obj_same(&st, &bpf_uid_st))
+			goto done;
+	} else if (bpf_uid_cached) {
 		goto done;
+	}
 
+	bpf_uid_cached = false;
 	ret = bpf_obj_hash(pathname, tmp, sizeof(tmp));
 	if (ret) {
 		fprintf(stderr, "Object hashing failed!\n");
@@ -1325,6 +1953,7 @@ static const char *bpf_get_obj_uid(const char *pathname)
 	}
 
 	hexstring_n2a(tmp, sizeof(tmp), bpf_uid, sizeof(bpf_uid));
+	bpf_uid_st = st;
 	bpf_uid_cached = true;
 done:
 	return bpf_uid;
@@ -1498,16 +2127,49 @@ static void bpf_prog_report(int fd, const char *section,
 	bpf_dump_error(ctx, "Verifier analysis:\n\n");
 }
 
+static void bpf_prog_timing(int fd, const char *section,
+			    const struct bpf_elf_prog *prog,
+			    struct bpf_elf_ctx *ctx, double secs, int tries)
+{
+	unsigned int insns = prog->size / sizeof(struct bpf_insn);
+	int err = errno;
+
+	ctx->time.verify += secs;
+	if (tries) {
+		ctx->time.retries++;
+	} else {
+		ctx->time.progs++;
+		ctx->time.insns += insns;
+	}
+
+	fprintf(stderr, "Prog section \'%s\': %u insns, %s in %.3fs",
+		section, insns, fd < 0 ? "rejected" : "verified", secs);
+	if (ctx->log_size)
+		fprintf(stderr, ", log %zu of %zu bytes%s",
+			strnlen(ctx->log, ctx->log_size), ctx->log_size,
+			fd < 0 && err == ENOSPC ? ", full" : "");
+	if (tries)
+		fprintf(stderr, " (try %d)", tries + 1);
+	fprintf(stderr, "\n");
+	errno = err;
+}
+
 static int bpf_prog_attach(const char *section,
 			   const struct bpf_elf_prog *prog,
 			   struct bpf_elf_ctx *ctx)
 {
+	double start = bpf_now();
 	int tries = 0, fd;
 retry:
 	errno = 0;
 	fd = bpf_prog_load_dev(prog->type, prog->insns, prog->size,
 			       prog->license, ctx->ifindex,
 			       ctx->log, ctx->log_size);
+	if (ctx->timing) {
+		bpf_prog_timing(fd, section, prog, ctx, bpf_now() - start,
+				tries);
+		start = bpf_now();
+	}
 	if (fd < 0 || ctx->verbose) {
 		/* The verifier log is pretty chatty, sometimes so chatty
 		 * on larger programs, that we could fail to dump everything
@@ -1931,6 +2593,7 @@ static int bpf_fetch_ancillary(struct bpf_elf_ctx *ctx)
 {
 	struct bpf_elf_sec_data data;
 	int i, ret = -1;
+	double start;
 
 	for (i = 1; i < ctx->elf_hdr.e_shnum; i++) {
 		ret = bpf_fill_section_data(ctx, i, &data);
@@ -1963,7 +2626,9 @@ static int bpf_fetch_ancillary(struct bpf_elf_ctx *ctx)
 			return ret;
 		}
 
+		start = bpf_now();
 		ret = bpf_maps_attach_all(ctx);
+		ctx->time.maps = bpf_now() - start;
 		if (ret < 0) {
 			fprintf(stderr, "Error loading maps into kernel!\n");
 			return ret;
@@ -2085,6 +2750,7 @@ static int bpf_fetch_prog_relo(struct bpf_elf_ctx *ctx, const char *section,
 	struct bpf_elf_sec_data data_relo, data_insn;
 	struct bpf_elf_prog prog;
 	int ret, idx, i, fd = -1;
+	double start;
 
 	for (i = 1; i < ctx->elf_hdr.e_shnum; i++) {
 		struct bpf_tail_call_props props = {};
@@ -2104,7 +2770,9 @@ static int bpf_fetch_prog_relo(struct bpf_elf_ctx *ctx, const char *section,
 
 		*sseen = true;
 
+		start = bpf_now();
 		ret = bpf_apply_relo_data(ctx, &data_relo, &data_insn, &props);
+		ctx->time.relo += bpf_now() - start;
 		if (ret < 0) {
 			*lderr = true;
 			return ret;
@@ -2437,23 +3105,24 @@ static void bpf_get_cfg(struct bpf_elf_ctx *ctx)
 	}
 }
 
-static int bpf_elf_ctx_init(struct bpf_elf_ctx *ctx, const char *pathname,
-			    enum bpf_prog_type type, __u32 ifindex,
-			    bool verbose)
+static int bpf_elf_ctx_init(struct bpf_elf_ctx *ctx,
+			    const struct bpf_cfg_in *cfg)
 {
 	int ret = -EINVAL;
 
 	if (elf_version(EV_CURRENT) == EV_NONE ||
-	    bpf_init_env(pathname))
+	    bpf_init_env(cfg->object))
 		return ret;
 
 	memset(ctx, 0, sizeof(*ctx));
 	bpf_get_cfg(ctx);
-	ctx->verbose = verbose;
-	ctx->type    = type;
-	ctx->ifindex = ifindex;
+	ctx->verbose  = cfg->verbose;
+	ctx->timing   = cfg->timing;
+	ctx->log_init = cfg->log_size;
+	ctx->type     = cfg->type;
+	ctx->ifindex  = cfg->ifindex;
 
-	ctx->obj_fd = open(pathname, O_RDONLY);
+	ctx->obj_fd = open(cfg->object, O_RDONLY);
 	if (ctx->obj_fd < 0)
 		return ctx->obj_fd;
 
@@ -2485,7 +3154,8 @@ static int bpf_elf_ctx_init(struct bpf_elf_ctx *ctx, const char *pathname,
 		goto out_elf;
 	}
 
-	if (ctx->verbose && bpf_log_realloc(ctx)) {
+	/* with a log from the start, a rejection is reported as it is */
+	if ((ctx->verbose || ctx->log_init) && bpf_log_realloc(ctx)) {
 		ret = -ENOMEM;
 		goto out_free;
 	}
@@ -2540,15 +3210,111 @@ static void bpf_elf_ctx_destroy(struct bpf_elf_ctx *ctx, bool failure)
 	close(ctx->obj_fd);
 }
 
+/*
+ * Once an object is loaded, its program is pinned next to the object's
+ * own maps as "prog:TYPE:SECTION", and loading the same object again
+ * takes it from there, without going through the ELF file. Only done
+ * when all maps of the object are pinned anyway, so that it makes no
+ * difference which load the program comes from. Removing the object's
+ * directory in the bpf fs drops it, along with the maps.
+ */
+static bool bpf_prog_cache_name(char *pathname, size_t len,
+				enum bpf_prog_type type, const char *section)
+{
+	const char *p;
+
+	/* pinned names may not have dots, maps have no colons */
+	for (p = section; *p; p++) {
+		if (!isalnum((unsigned char)*p) && *p != '_' && *p != '-')
+			return false;
+	}
+
+	snprintf(pathname, len, "%s/%s/prog:%s:%s", bpf_get_work_dir(type),
+		 bpf_get_obj_uid(NULL), __bpf_prog_meta[type].type, section);
+	return true;
+}
+
+static int bpf_prog_cache_get(const char *pathname, enum bpf_prog_type type,
+			      const char *section)
+{
+	struct bpf_prog_data prog;
+	char name[PATH_MAX];
+	int fd;
+
+	if (!bpf_get_work_dir(BPF_PROG_TYPE_UNSPEC) ||
+	    !bpf_get_obj_uid(pathname) ||
+	    !bpf_prog_cache_name(name, sizeof(name), type, section))
+		return -1;
+
+	fd = bpf_obj_get(name, type);
+	if (fd < 0)
+		return fd;
+
+	if (bpf_derive_prog_from_fdinfo(fd, &prog) < 0 ||
+	    prog.type != type) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void bpf_prog_cache_put(const struct bpf_elf_ctx *ctx, int fd,
+			       const char *section)
+{
+	char name[PATH_MAX];
+	int i;
+
+	for (i = 0; i < ctx->map_num; i++) {
+		if (bpf_no_pinning(ctx, ctx->maps[i].pinning))
+			return;
+	}
+
+	if (!bpf_get_work_dir(ctx->type) ||
+	    !bpf_prog_cache_name(name, sizeof(name), ctx->type, section) ||
+	    bpf_make_obj_path(ctx) < 0)
+		return;
+
+	if (bpf_obj_pin(fd, name) < 0 && errno != EEXIST)
+		fprintf(stderr, "Could not pin program '%s': %s\n", name,
+			strerror(errno));
+}
+
 static struct bpf_elf_ctx __ctx;
 
-static int bpf_obj_open(const char *pathname, enum bpf_prog_type type,
-			const char *section, __u32 ifindex, bool verbose)
+static void bpf_obj_timing(const struct bpf_elf_ctx *ctx, double secs)
+{
+	const struct bpf_elf_timing *t = &ctx->time;
+
+	fprintf(stderr, "\nLoaded %u prog sections, %u insns, in %.3fs:\n",
+		t->progs, t->insns, secs);
+	fprintf(stderr, " - ELF:          %.3fs\n",
+		secs - t->maps - t->relo - t->verify);
+	fprintf(stderr, " - Maps:         %.3fs\n", t->maps);
+	fprintf(stderr, " - Relocation:   %.3fs\n", t->relo);
+	fprintf(stderr, " - Verification: %.3fs\n", t->verify);
+	if (t->retries)
+		fprintf(stderr, "Verified %u more times for a larger log, log-size %zu would have done without\n",
+			t->retries, ctx->log_size);
+}
+
+static int bpf_obj_open(const struct bpf_cfg_in *cfg, bool cache)
 {
 	struct bpf_elf_ctx *ctx = &__ctx;
+	const char *section = cfg->section;
+	double start = bpf_now();
 	int fd = 0, ret;
 
-	ret = bpf_elf_ctx_init(ctx, pathname, type, ifindex, verbose);
+	/* offloaded programs belong to their device */
+	cache = cache && !cfg->ifindex;
+	if (cache) {
+		fd = bpf_prog_cache_get(cfg->object, cfg->type, section);
+		if (fd >= 0)
+			return fd;
+		fd = 0;
+	}
+
+	ret = bpf_elf_ctx_init(ctx, cfg);
 	if (ret < 0) {
 		fprintf(stderr, "Cannot initialize ELF context!\n");
 		return ret;
@@ -2570,7 +3336,11 @@ static int bpf_obj_open(const char *pathname, enum bpf_prog_type type,
 	ret = bpf_fill_prog_arrays(ctx);
 	if (ret < 0)
 		fprintf(stderr, "Error filling program arrays!\n");
+	else if (cache)
+		bpf_prog_cache_put(ctx, fd, section);
 out:
+	if (ctx->timing)
+		bpf_obj_timing(ctx, bpf_now() - start);
 	bpf_elf_ctx_destroy(ctx, ret < 0);
 	if (ret < 0) {
 		if (fd)
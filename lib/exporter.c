@@ -0,0 +1,467 @@
+/*
+ * exporter.c	Serve counters over HTTP in the OpenMetrics text format.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The page is rendered once per sampling tick, response header and all,
+ * into a buffer of its own. A scrape takes a reference on the page that
+ * is current when its request is complete and is answered from it, so
+ * neither a tick nor the other scrapers ever wait for a slow one. All
+ * connections are served from one poll() loop and closed after their
+ * response.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+#define EXPORTER_CONNS		64
+#define EXPORTER_REQ_MAX	2048
+#define EXPORTER_TIMEOUT	10000	/* ms a scrape may take in all */
+
+struct exporter_page {
+	unsigned int	refs;
+	size_t		hlen;		/* of the header, all a HEAD gets */
+	size_t		len;
+	char		data[];
+};
+
+struct exporter_conn {
+	int			fd;
+	long long		deadline;
+	size_t			rlen;
+	char			req[EXPORTER_REQ_MAX];
+	struct exporter_page	*page;
+	const char		*out;	/* once the request is in */
+	size_t			left;
+};
+
+static const char exporter_bad[] =
+	"HTTP/1.1 400 Bad Request\r\n"
+	"Content-Length: 0\r\nConnection: close\r\n\r\n";
+static const char exporter_notfound[] =
+	"HTTP/1.1 404 Not Found\r\n"
+	"Content-Length: 0\r\nConnection: close\r\n\r\n";
+static const char exporter_method[] =
+	"HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\n"
+	"Content-Length: 0\r\nConnection: close\r\n\r\n";
+static const char exporter_unavail[] =
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Content-Length: 0\r\nConnection: close\r\n\r\n";
+
+static long long exporter_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void exporter_page_put(struct exporter_page *page)
+{
+	if (page && --page->refs == 0)
+		free(page);
+}
+
+static struct exporter_page *exporter_page_new(const char *body, size_t len)
+{
+	struct exporter_page *page;
+	char hdr[256];
+	int hlen;
+
+	hlen = snprintf(hdr, sizeof(hdr),
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n", len);
+
+	page = malloc(sizeof(*page) + hlen + len);
+	if (!page)
+		return NULL;
+	page->refs = 1;
+	page->hlen = hlen;
+	page->len = hlen + len;
+	memcpy(page->data, hdr, hlen);
+	memcpy(page->data + hlen, body, len);
+	return page;
+}
+
+/* the next page, or NULL to keep serving the one before */
+static struct exporter_page *exporter_render(exporter_tick_fn tick,
+					     int elapsed)
+{
+	struct exporter_page *page;
+	size_t len = 0;
+	char *body = NULL;
+	FILE *fp;
+
+	fp = open_memstream(&body, &len);
+	if (!fp) {
+		perror("exporter: open_memstream");
+		return NULL;
+	}
+	tick(fp, elapsed);
+	fputs("# EOF\n", fp);
+	if (fclose(fp)) {
+		perror("exporter: render");
+		free(body);
+		return NULL;
+	}
+
+	page = exporter_page_new(body, len);
+	free(body);
+	return page;
+}
+
+static int exporter_listen(const char *addr)
+{
+	struct addrinfo hints = {
+		.ai_flags = AI_PASSIVE,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct addrinfo *res, *ai;
+	char *host = NULL, *port;
+	char *buf = strdup(addr);
+	int fd = -1, err;
+
+	if (!buf)
+		return -1;
+
+	/* PORT, :PORT, HOST:PORT or [ADDR6]:PORT */
+	port = strrchr(buf, ':');
+	if (buf[0] == '[') {
+		char *end = strchr(buf, ']');
+
+		if (!end || end[1] != ':') {
+			fprintf(stderr, "exporter: \"%s\" is not [ADDR]:PORT\n",
+				addr);
+			goto out;
+		}
+		*end = 0;
+		host = buf + 1;
+		port = end + 2;
+	} else if (port) {
+		*port++ = 0;
+		if (buf[0])
+			host = buf;
+	} else {
+		port = buf;
+	}
+	/* unless told otherwise listen on both families */
+	if (!host)
+		hints.ai_family = AF_INET6;
+
+	err = getaddrinfo(host, port, &hints, &res);
+	if (err && !host) {
+		hints.ai_family = AF_INET;
+		err = getaddrinfo(host, port, &hints, &res);
+	}
+	if (err) {
+		fprintf(stderr, "exporter: %s: %s\n", addr, gai_strerror(err));
+		goto out;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		int one = 1, zero = 0;
+
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (!host && ai->ai_family == AF_INET6)
+			setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY,
+				   &zero, sizeof(zero));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+		    listen(fd, EXPORTER_CONNS) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		fprintf(stderr, "exporter: cannot listen on %s: %s\n",
+			addr, strerror(errno));
+	else
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+	freeaddrinfo(res);
+out:
+	free(buf);
+	return fd;
+}
+
+/* Request line and headers are all in: pick the response */
+static void exporter_respond(struct exporter_conn *c,
+			     struct exporter_page *page)
+{
+	char *method = c->req, *path, *end;
+	bool head;
+
+	c->req[c->rlen] = 0;
+	path = strchr(method, ' ');
+	end = path ? strpbrk(path + 1, " \r\n") : NULL;
+	if (!end) {
+		c->out = exporter_bad;
+		c->left = sizeof(exporter_bad) - 1;
+		return;
+	}
+	*path++ = 0;
+	*end = 0;
+	end = strchr(path, '?');
+	if (end)
+		*end = 0;
+
+	head = strcmp(method, "HEAD") == 0;
+	if (!head && strcmp(method, "GET")) {
+		c->out = exporter_method;
+		c->left = sizeof(exporter_method) - 1;
+	} else if (strcmp(path, "/metrics") && strcmp(path, "/")) {
+		c->out = exporter_notfound;
+		c->left = sizeof(exporter_notfound) - 1;
+	} else if (!page) {
+		c->out = exporter_unavail;
+		c->left = sizeof(exporter_unavail) - 1;
+	} else {
+		page->refs++;
+		c->page = page;
+		c->out = page->data;
+		c->left = head ? page->hlen : page->len;
+	}
+}
+
+/* returns < 0 once the connection is done with */
+static int exporter_io(struct exporter_conn *c, struct exporter_page *page)
+{
+	ssize_t n;
+
+	if (!c->out) {
+		n = recv(c->fd, c->req + c->rlen,
+			 sizeof(c->req) - 1 - c->rlen, 0);
+		if (n < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		if (n == 0)
+			return -1;
+		c->rlen += n;
+		c->req[c->rlen] = 0;
+		if (strstr(c->req, "\r\n\r\n") || strstr(c->req, "\n\n"))
+			exporter_respond(c, page);
+		else if (c->rlen == sizeof(c->req) - 1)
+			return -1;
+		else
+			return 0;
+	}
+
+	while (c->left) {
+		n = send(c->fd, c->out, c->left, MSG_NOSIGNAL);
+		if (n < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		c->out += n;
+		c->left -= n;
+	}
+	return -1;
+}
+
+static void exporter_drop(struct exporter_conn *conns, unsigned int *nconns,
+			  unsigned int i)
+{
+	struct exporter_conn *c = &conns[i];
+
+	shutdown(c->fd, SHUT_WR);
+	close(c->fd);
+	exporter_page_put(c->page);
+	*c = conns[--*nconns];
+}
+
+/* the connection longest without a complete request, -1 if none */
+static int exporter_idlest(const struct exporter_conn *conns,
+			   unsigned int nconns)
+{
+	int idlest = -1;
+	unsigned int i;
+
+	for (i = 0; i < nconns; i++) {
+		if (conns[i].out)
+			continue;
+		if (idlest < 0 || conns[i].deadline < conns[idlest].deadline)
+			idlest = i;
+	}
+	return idlest;
+}
+
+/*
+ * Listen on addr and serve what tick() writes, calling it every
+ * interval ms with the time since the call before, 0 the first time.
+ * Only returns if there is no listening on addr.
+ */
+int exporter_run(const char *addr, int interval, exporter_tick_fn tick)
+{
+	struct pollfd pfds[EXPORTER_CONNS + 1];
+	struct exporter_conn *conns;
+	struct exporter_page *page = NULL;
+	unsigned int nconns = 0, i;
+	long long snaptime = 0;
+	bool listening;
+	int lfd;
+
+	lfd = exporter_listen(addr);
+	if (lfd < 0)
+		return -1;
+	conns = calloc(EXPORTER_CONNS, sizeof(*conns));
+	if (!conns) {
+		perror("exporter");
+		close(lfd);
+		return -1;
+	}
+
+	for (;;) {
+		long long now = exporter_now(), wait;
+		unsigned int npfd = 0;
+
+		if (!page || now - snaptime >= interval) {
+			struct exporter_page *next;
+
+			next = exporter_render(tick, page ? now - snaptime : 0);
+			if (next) {
+				exporter_page_put(page);
+				page = next;
+			}
+			snaptime = now;
+		}
+
+		wait = snaptime + interval - now;
+		for (i = 0; i < nconns; i++) {
+			if (conns[i].deadline - now < wait)
+				wait = conns[i].deadline - now;
+			pfds[i].fd = conns[i].fd;
+			pfds[i].events = conns[i].out ? POLLOUT : POLLIN;
+		}
+		npfd = nconns;
+		listening = nconns < EXPORTER_CONNS ||
+			    exporter_idlest(conns, nconns) >= 0;
+		if (listening) {
+			pfds[npfd].fd = lfd;
+			pfds[npfd++].events = POLLIN;
+		}
+		if (wait < 0)
+			wait = 0;
+
+		if (poll(pfds, npfd, wait) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("exporter: poll");
+			sleep(1);
+			continue;
+		}
+		now = exporter_now();
+
+		/* backwards, dropping one moves the last into its slot */
+		for (i = nconns; i-- > 0; ) {
+			if ((pfds[i].revents && exporter_io(&conns[i], page) < 0) ||
+			    now >= conns[i].deadline)
+				exporter_drop(conns, &nconns, i);
+		}
+
+		if (listening && pfds[npfd - 1].revents) {
+			for (;;) {
+				struct exporter_conn *c;
+				int fd, idle;
+
+				/* room is made by who has been silent longest */
+				if (nconns == EXPORTER_CONNS) {
+					idle = exporter_idlest(conns, nconns);
+					if (idle < 0)
+						break;
+					exporter_drop(conns, &nconns, idle);
+				}
+				fd = accept4(lfd, NULL, NULL,
+					     SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd < 0)
+					break;
+				c = &conns[nconns++];
+				c->fd = fd;
+				c->deadline = now + EXPORTER_TIMEOUT;
+				c->rlen = 0;
+				c->page = NULL;
+				c->out = NULL;
+				c->left = 0;
+			}
+		}
+	}
+}
+
+/* prefix and id as a metric name, what may not be in one as '_' */
+const char *exporter_name(char *buf, size_t len, const char *prefix,
+			  const char *id)
+{
+	char *p;
+
+	snprintf(buf, len, "%s%s", prefix, id);
+	for (p = buf; *p; p++) {
+		if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+		      (*p >= '0' && *p <= '9' && p != buf) ||
+		      *p == '_' || *p == ':'))
+			*p = '_';
+	}
+	return buf;
+}
+
+void exporter_type(FILE *fp, const char *family, const char *type)
+{
+	fprintf(fp, "# TYPE %s %s\n", family, type);
+}
+
+static void exporter_label(FILE *fp, const char *label, const char *value)
+{
+	fprintf(fp, "%s=\"", label);
+	for (; *value; value++) {
+		if (*value == '\\' || *value == '"')
+			fputc('\\', fp);
+		if (*value == '\n')
+			fputs("\\n", fp);
+		else
+			fputc(*value, fp);
+	}
+	fputc('"', fp);
+}
+
+/*
+ * One sample of family, "_total" being the suffix of a counter's, with
+ * the labels of labels[], names and values in turn up to a NULL name.
+ */
+void exporter_sample_labels(FILE *fp, const char *family, const char *suffix,
+			    const char *const *labels, unsigned long long val)
+{
+	int i;
+
+	fprintf(fp, "%s%s", family, suffix);
+	for (i = 0; labels && labels[i]; i += 2) {
+		fputc(i ? ',' : '{', fp);
+		exporter_label(fp, labels[i], labels[i + 1]);
+	}
+	if (i)
+		fputc('}', fp);
+	fprintf(fp, " %llu\n", val);
+}
+
+/* with a label if label is not NULL */
+void exporter_sample(FILE *fp, const char *family, const char *suffix,
+		     const char *label, const char *value,
+		     unsigned long long val)
+{
+	const char *labels[] = { label, value, NULL };
+
+	exporter_sample_labels(fp, family, suffix, labels, val);
+}
@@ -24,8 +24,8 @@
 
 const char *inet_proto_n2a(int proto, char *buf, int len)
 {
-	static char *ncache;
-	static int icache = -1;
+	static __thread char *ncache;
+	static __thread int icache = -1;
 	struct protoent *pe;
 
 	if (proto == icache)
@@ -46,8 +46,8 @@ const char *inet_proto_n2a(int proto, char *buf, int len)
 
 int inet_proto_a2n(const char *buf)
 {
-	static char *ncache;
-	static int icache = -1;
+	static __thread char *ncache;
+	static __thread int icache = -1;
 	struct protoent *pe;
 	__u8 ret;
 
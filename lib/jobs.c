@@ -0,0 +1,521 @@
+/*
+ * jobs.c	Work shared between children, output in the order of the work.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The tasks are cut in chunks, of chunk tasks each or, with a chunk of
+ * 0, in as many ranges of about the same size as there are jobs. Each
+ * chunk is run by a child, with up to jobs of them at once, writing
+ * into a pipe. What the first unfinished chunk writes goes straight
+ * out, the later ones are held until it is their turn, so the output
+ * reads as one sequential pass whatever order the children end in.
+ *
+ * The children are processes rather than threads: each gets its own
+ * copy of the tool's state and opens its own sockets, rtnl_reopen() for
+ * a netlink handle it inherited, so nothing is shared but the pipe. How
+ * many run at once is bounded by the CPUs the tool may use, and more
+ * would only queue up at the rtnl mutex, which serializes the kernel
+ * side of every rtnetlink dump.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "jobs.h"
+
+#define JOBS_NODE_DIR	"/sys/devices/system/node"
+
+struct job {
+	unsigned int	first;
+	unsigned int	count;
+	unsigned int	worker;
+	pid_t		pid;
+	int		fd;	/* read end of its output, -1 once closed */
+	char		*out;
+	size_t		len;
+	size_t		size;
+	int		status;
+	bool		emitted;
+	bool		done;
+};
+
+/* the CPUs workers are pinned to, by worker number, if they are */
+static int *jobs_cpus;
+static unsigned int jobs_ncpus;
+static bool jobs_cpus_ready;
+
+/* "0-3,8-11" into set */
+static void jobs_cpulist(const char *s, cpu_set_t *set)
+{
+	char *end;
+
+	CPU_ZERO(set);
+	while (*s >= '0' && *s <= '9') {
+		unsigned long lo = strtoul(s, &end, 10), hi = lo;
+
+		if (*end == '-')
+			hi = strtoul(end + 1, &end, 10);
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+			CPU_SET(lo, set);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+}
+
+/* the NUMA node of every CPU, all on node 0 without the sysfs files */
+static void jobs_cpu_nodes(short *node)
+{
+	struct dirent *de;
+	DIR *dir;
+
+	memset(node, 0, CPU_SETSIZE * sizeof(*node));
+	dir = opendir(JOBS_NODE_DIR);
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir)) != NULL) {
+		char path[PATH_MAX], buf[4096];
+		cpu_set_t set;
+		ssize_t len;
+		int n, fd, cpu;
+
+		if (sscanf(de->d_name, "node%d", &n) != 1)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/cpulist",
+			 JOBS_NODE_DIR, de->d_name);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		len = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (len <= 0)
+			continue;
+		buf[len] = '\0';
+
+		jobs_cpulist(buf, &set);
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &set))
+				node[cpu] = n;
+	}
+	closedir(dir);
+}
+
+/*
+ * The order in which workers take the CPUs allowed: across the nodes
+ * in turn for "spread", those of the parent's node first for "local".
+ */
+static void jobs_cpu_order(void)
+{
+	static short node[CPU_SETSIZE];
+	const char *policy = getenv("RTNL_JOBS_CPUS");
+	int cpu, n, mine, round, maxnode = 0;
+	cpu_set_t allowed;
+	bool spread;
+
+	jobs_cpus_ready = true;
+	if (!policy || strcmp(policy, "none") == 0)
+		return;
+	if (strcmp(policy, "spread") == 0) {
+		spread = true;
+	} else if (strcmp(policy, "local") == 0) {
+		spread = false;
+	} else {
+		fprintf(stderr, "RTNL_JOBS_CPUS \"%s\" is none of none, spread or local\n",
+			policy);
+		return;
+	}
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+		return;
+	jobs_cpus = calloc(CPU_COUNT(&allowed), sizeof(*jobs_cpus));
+	if (!jobs_cpus)
+		return;
+
+	jobs_cpu_nodes(node);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &allowed) && node[cpu] > maxnode)
+			maxnode = node[cpu];
+
+	if (!spread) {
+		cpu = sched_getcpu();
+		mine = cpu >= 0 && cpu < CPU_SETSIZE ? node[cpu] : 0;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &allowed) && node[cpu] == mine)
+				jobs_cpus[jobs_ncpus++] = cpu;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &allowed) && node[cpu] != mine)
+				jobs_cpus[jobs_ncpus++] = cpu;
+		return;
+	}
+
+	/* the round-th CPU of every node, as long as one has that many */
+	for (round = 0; jobs_ncpus < CPU_COUNT(&allowed); round++) {
+		for (n = 0; n <= maxnode; n++) {
+			int seen = 0;
+
+			for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+				if (!CPU_ISSET(cpu, &allowed) || node[cpu] != n)
+					continue;
+				if (seen++ == round) {
+					jobs_cpus[jobs_ncpus++] = cpu;
+					break;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * How many children to run at once for wanted: RTNL_JOBS_MAX, or the
+ * number of CPUs allowed, at most. To be called in the parent, which
+ * also works out the CPUs for jobs_pin() then.
+ */
+unsigned int jobs_limit(unsigned int wanted)
+{
+	const char *env = getenv("RTNL_JOBS_MAX");
+	unsigned int max = 0;
+	cpu_set_t allowed;
+
+	if (!jobs_cpus_ready)
+		jobs_cpu_order();
+
+	if (env) {
+		if (get_unsigned(&max, env, 0) || !max) {
+			fprintf(stderr, "RTNL_JOBS_MAX \"%s\" is not a number of jobs\n",
+				env);
+			max = 0;
+		}
+	}
+	if (!max && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+		max = CPU_COUNT(&allowed);
+
+	if (max && wanted > max)
+		wanted = max;
+	return wanted ? wanted : 1;
+}
+
+/* In a child: onto its CPU, if RTNL_JOBS_CPUS asks for it */
+void jobs_pin(unsigned int worker)
+{
+	cpu_set_t set;
+
+	if (!jobs_cpus_ready)
+		jobs_cpu_order();
+	if (!jobs_ncpus)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(jobs_cpus[worker % jobs_ncpus], &set);
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+static int job_start(struct job *jobs, unsigned int n, unsigned int from,
+		     const struct jobs_ops *ops, void *arg, int flags)
+{
+	struct job *job = &jobs[n];
+	int pfd[2];
+
+	if (pipe2(pfd, O_CLOEXEC) < 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	fflush(NULL);
+	job->pid = fork();
+	if (job->pid < 0) {
+		perror("fork");
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+
+	if (job->pid == 0) {
+		int ret = 0;
+
+		/* only the parent may read, or writers outlive it blocked */
+		for (; from < n; from++)
+			if (jobs[from].fd >= 0)
+				close(jobs[from].fd);
+		close(pfd[0]);
+		dup2(pfd[1], STDOUT_FILENO);
+		if (flags & JOBS_F_STDERR)
+			dup2(pfd[1], STDERR_FILENO);
+		close(pfd[1]);
+
+		jobs_pin(job->worker);
+		if (ops->setup)
+			ret = ops->setup(job->first, arg);
+		if (!ret)
+			ret = ops->run(job->first, job->count, arg);
+		fflush(stdout);
+		fflush(stderr);
+		_iprt_exit(ret);
+	}
+
+	close(pfd[1]);
+	job->fd = pfd[0];
+	return 0;
+}
+
+/* read what there is, returns 1 when the job has finished */
+static int job_read(struct job *job)
+{
+	ssize_t n;
+
+	if (job->len == job->size) {
+		size_t size = job->size ? 2 * job->size : 65536;
+		char *p = realloc(job->out, size);
+
+		if (!p) {
+			perror("Cannot buffer job output");
+			goto eof;
+		}
+		job->out = p;
+		job->size = size;
+	}
+
+	n = read(job->fd, job->out + job->len, job->size - job->len);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	if (n > 0) {
+		job->len += n;
+		return 0;
+	}
+
+eof:
+	close(job->fd);
+	job->fd = -1;
+	while (waitpid(job->pid, &job->status, 0) < 0 && errno == EINTR)
+		;
+	job->done = true;
+	return 1;
+}
+
+/* the output of the first unfinished job, so far */
+static int job_flush(struct job *job, const struct jobs_ops *ops, void *arg)
+{
+	int ret = 0;
+
+	if (!job->emitted) {
+		job->emitted = true;
+		if (ops->emit) {
+			ops->emit(job->first, arg);
+			fflush(stdout);
+		}
+	}
+	if (job->len && write(STDOUT_FILENO, job->out, job->len) < 0)
+		ret = -1;
+	job->len = 0;
+	return ret;
+}
+
+/*
+ * Run ops->run() over tasks [0, tasks) in children, up to jobs at once.
+ * Returns -1 if the work could not all be run, else how many children
+ * failed, that is exited with a status other than 0.
+ */
+int jobs_run(unsigned int tasks, unsigned int chunk, unsigned int jobs,
+	     const struct jobs_ops *ops, void *arg, int flags)
+{
+	unsigned int nchunks, started = 0, emitted = 0, running = 0, i;
+	struct pollfd *pfds = NULL;
+	unsigned int *pjob = NULL;
+	struct job *job = NULL;
+	bool *busy = NULL;
+	int failed = 0, ret = 0;
+
+	if (!tasks)
+		return 0;
+
+	jobs = jobs_limit(jobs);
+	if (chunk)
+		nchunks = (tasks + chunk - 1) / chunk;
+	else
+		nchunks = jobs < tasks ? jobs : tasks;
+	if (jobs > nchunks)
+		jobs = nchunks;
+
+	job = calloc(nchunks, sizeof(*job));
+	pfds = calloc(jobs, sizeof(*pfds));
+	pjob = calloc(jobs, sizeof(*pjob));
+	busy = calloc(jobs, sizeof(*busy));
+	if (!job || !pfds || !pjob || !busy) {
+		perror("Cannot allocate jobs");
+		ret = -1;
+		goto out;
+	}
+	for (i = 0; i < nchunks; i++) {
+		if (chunk) {
+			job[i].first = i * chunk;
+			job[i].count = tasks - job[i].first < chunk ?
+				       tasks - job[i].first : chunk;
+		} else {
+			job[i].first = (unsigned long)tasks * i / nchunks;
+			job[i].count = (unsigned long)tasks * (i + 1) / nchunks -
+				       job[i].first;
+		}
+		job[i].fd = -1;
+	}
+
+	while (emitted < nchunks) {
+		unsigned int npfd = 0;
+
+		while (ret == 0 && running < jobs && started < nchunks) {
+			for (i = 0; busy[i]; i++)
+				;
+			job[started].worker = i;
+			if (job_start(job, started, emitted, ops, arg,
+				      flags) < 0) {
+				/* those started still run to the end */
+				ret = -1;
+				break;
+			}
+			busy[i] = true;
+			started++;
+			running++;
+		}
+		if (ret && !running)
+			break;
+
+		for (i = emitted; i < started && npfd < jobs; i++) {
+			if (job[i].fd < 0)
+				continue;
+			pfds[npfd].fd = job[i].fd;
+			pfds[npfd].events = POLLIN;
+			pjob[npfd++] = i;
+		}
+		if (npfd && poll(pfds, npfd, -1) < 0 && errno != EINTR) {
+			perror("poll");
+			ret = -1;
+			break;
+		}
+		for (i = 0; i < npfd; i++) {
+			struct job *j = &job[pjob[i]];
+
+			if (pfds[i].revents && job_read(j)) {
+				busy[j->worker] = false;
+				running--;
+			}
+		}
+
+		for (; emitted < started; emitted++) {
+			if (job_flush(&job[emitted], ops, arg) < 0)
+				ret = -1;
+			if (!job[emitted].done)
+				break;
+			if (job[emitted].status)
+				failed++;
+			free(job[emitted].out);
+			job[emitted].out = NULL;
+		}
+	}
+
+out:
+	/* only left running if poll() failed */
+	for (i = 0; job && i < started; i++) {
+		if (job[i].fd >= 0) {
+			close(job[i].fd);
+			waitpid(job[i].pid, NULL, 0);
+		}
+		free(job[i].out);
+	}
+	free(job);
+	free(pfds);
+	free(pjob);
+	free(busy);
+	return ret < 0 ? -1 : failed;
+}
+
+struct dump_jobs {
+	struct rtnl_handle	*rth;
+	const int		*family;
+	jobs_dump_req_t		req;
+	rtnl_filter_t		filter;
+	void			*arg;
+	int			cur;
+};
+
+/*
+ * Every rtnetlink message starts with the family. A kernel without the
+ * family asked for falls back to dumping all of them: stop at the first
+ * message of another, the family it meant to dump does not exist.
+ */
+static int dump_job_filter(const struct sockaddr_nl *who,
+			   struct nlmsghdr *n, void *arg)
+{
+	struct dump_jobs *d = arg;
+
+	if (n->nlmsg_len < NLMSG_LENGTH(1) ||
+	    *(unsigned char *)NLMSG_DATA(n) != d->cur)
+		return -EAFNOSUPPORT;
+	return d->filter(who, n, d->arg);
+}
+
+static int dump_job_setup(unsigned int first, void *arg)
+{
+	struct dump_jobs *d = arg;
+
+	if (rtnl_reopen(d->rth) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int dump_job_run(unsigned int first, unsigned int count, void *arg)
+{
+	struct dump_jobs *d = arg;
+	int err;
+
+	d->cur = d->family[first];
+	if (d->req(d->rth, d->cur) < 0) {
+		perror("Cannot send dump request");
+		return 1;
+	}
+	err = rtnl_dump_filter(d->rth, dump_job_filter, d);
+	if (err < 0 && err != -EAFNOSUPPORT) {
+		fprintf(stderr, "Dump terminated\n");
+		return 1;
+	}
+	return 0;
+}
+
+static const struct jobs_ops dump_jobs_ops = {
+	.setup	= dump_job_setup,
+	.run	= dump_job_run,
+};
+
+/*
+ * Dump each of family[0, count) on a socket of its own, up to jobs at
+ * once, and print it all as one dump in that order would: the order an
+ * AF_UNSPEC dump takes them in, when family is sorted. filter() runs in
+ * the children, so it may print but what else it keeps is lost. Returns
+ * 0, or -1 if a dump failed.
+ */
+int jobs_dump_families(struct rtnl_handle *rth, const int *family,
+		       unsigned int count, unsigned int jobs,
+		       jobs_dump_req_t req, rtnl_filter_t filter, void *arg)
+{
+	struct dump_jobs d = {
+		.rth	= rth,
+		.family	= family,
+		.req	= req,
+		.filter	= filter,
+		.arg	= arg,
+	};
+
+	return jobs_run(count, 1, jobs, &dump_jobs_ops, &d, 0) ? -1 : 0;
+}
@@ -11,12 +11,51 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "iprt.h"
 #include "utils.h"
 #include "json_print.h"
 
-static json_writer_t *_jw;
+static __thread json_writer_t *_jw;
+
+/*
+ * Each thread prints through one of two sets of emitters, the one for
+ * text or the one for JSON, which new_json_obj() picks for the dump.
+ * Neither has to find out again for every field which kind of output
+ * it is producing.
+ */
+struct print_ops {
+	void (*p_int)(enum output_type, enum color_attr, const char *,
+		      const char *, int);
+	void (*p_s64)(enum output_type, enum color_attr, const char *,
+		      const char *, int64_t);
+	void (*p_hu)(enum output_type, enum color_attr, const char *,
+		     const char *, unsigned short);
+	void (*p_uint)(enum output_type, enum color_attr, const char *,
+		       const char *, unsigned int);
+	void (*p_u64)(enum output_type, enum color_attr, const char *,
+		      const char *, uint64_t);
+	void (*p_luint)(enum output_type, enum color_attr, const char *,
+			const char *, unsigned long int);
+	void (*p_lluint)(enum output_type, enum color_attr, const char *,
+			 const char *, unsigned long long int);
+	void (*p_float)(enum output_type, enum color_attr, const char *,
+			const char *, double);
+	void (*p_string)(enum output_type, enum color_attr, const char *,
+			 const char *, const char *);
+	void (*p_bool)(enum output_type, enum color_attr, const char *,
+		       const char *, bool);
+	void (*p_0xhex)(enum output_type, enum color_attr, const char *,
+			const char *, unsigned int);
+	void (*p_hex)(enum output_type, enum color_attr, const char *,
+		      const char *, unsigned int);
+	void (*p_null)(enum output_type, enum color_attr, const char *,
+		       const char *, const char *);
+};
+
+static const struct print_ops json_ops, fp_ops;
+static __thread const struct print_ops *_ops = &fp_ops;
 
 #define _IS_JSON_CONTEXT(type) ((type & PRINT_JSON || type & PRINT_ANY) && _jw)
 #define _IS_FP_CONTEXT(type) (!_jw && (type & PRINT_FP || type & PRINT_ANY))
@@ -29,9 +68,15 @@ int new_json_obj(int json)
 			perror("json object");
 			iprt_exit(1);
 		}
-		if (pretty)
+		if (ndjson)
+			jsonw_lines(_jw, true);
+		else if (pretty)
 			jsonw_pretty(_jw, true);
-		jsonw_start_array(_jw);
+		if (cbor)
+			jsonw_cbor(_jw, true);
+		if (!ndjson)
+			jsonw_start_array(_jw);
+		_ops = &json_ops;
 	}
 	return 0;
 }
@@ -39,8 +84,10 @@ int new_json_obj(int json)
 void delete_json_obj(void)
 {
 	if (_jw) {
-		jsonw_end_array(_jw);
+		if (!ndjson)
+			jsonw_end_array(_jw);
 		jsonw_destroy(&_jw);
+		_ops = &fp_ops;
 	}
 }
 
@@ -97,52 +144,162 @@ void close_json_array(enum output_type type, const char *str)
 	}
 }
 
+#define _IS_JSON_TYPE(type) (type & (PRINT_JSON | PRINT_ANY))
+#define _IS_FP_TYPE(type) (type & (PRINT_FP | PRINT_ANY))
+
+/*
+ * Nearly every format is one plain conversion, with no flags, width or
+ * precision, between two literals: " mtu %u ", "%s", "%llu". Those are
+ * written here in pieces, the number converted by hand; whatever else,
+ * and anything colored, still goes through color_fprintf().
+ */
+struct fp_fmt {
+	size_t		prefix;
+	const char	*suffix;
+	size_t		suffix_len;
+	char		conv;
+};
+
+static bool fp_parse(const char *fmt, struct fp_fmt *f)
+{
+	const char *p = fmt, *q;
+
+	for (; *p != '%'; p++)
+		if (!*p)
+			return false;
+	f->prefix = p - fmt;
+	for (p++; *p == 'l' || *p == 'j' || *p == 'z' || *p == 't'; p++)
+		;
+	f->conv = *p;
+	if (!*p++)
+		return false;
+	for (q = p; *q; q++)
+		if (*q == '%')
+			return false;
+	f->suffix = p;
+	f->suffix_len = q - p;
+	return true;
+}
+
+/*
+ * Fields are a few characters each, which putc_unlocked() puts into the
+ * stdio buffer of stdout more cheaply than a call to fwrite() could.
+ * Like the JSON writer, it does not take the lock of the FILE: only one
+ * thread prints.
+ */
+static void fp_write(const char *str, size_t len)
+{
+	while (len--)
+		putc_unlocked(*str++, stdout);
+}
+
+static void fp_pieces(const char *fmt, const struct fp_fmt *f,
+		      const char *val, size_t len)
+{
+	fp_write(fmt, f->prefix);
+	fp_write(val, len);
+	fp_write(f->suffix, f->suffix_len);
+}
+
+static bool fp_num(enum color_attr color, const char *fmt, bool sign,
+		   uint64_t num, bool neg)
+{
+	char buf[24], *p = buf + sizeof(buf);
+	struct fp_fmt f;
+
+	if (color != COLOR_NONE || !fmt || !fp_parse(fmt, &f))
+		return false;
+	if (sign ? f.conv != 'd' && f.conv != 'i' : f.conv != 'u')
+		return false;
+	do {
+		*--p = '0' + num % 10;
+		num /= 10;
+	} while (num);
+	if (neg)
+		*--p = '-';
+	fp_pieces(fmt, &f, p, buf + sizeof(buf) - p);
+	return true;
+}
+
+static bool fp_str(enum color_attr color, const char *fmt, const char *str)
+{
+	struct fp_fmt f;
+
+	if (color != COLOR_NONE || !fmt || !str || !fp_parse(fmt, &f) ||
+	    f.conv != 's')
+		return false;
+	fp_pieces(fmt, &f, str, strlen(str));
+	return true;
+}
+
+#define _FP_SIGNED(value) (fp_num(color, fmt, true,			\
+				  value < 0 ? -(uint64_t)value : value,	\
+				  value < 0))
+#define _FP_UNSIGNED(value) (fp_num(color, fmt, false, value, false))
+#define _FP_NONE(value) false
+
 /*
  * pre-processor directive to generate similar
  * functions handling different types
  */
-#define _PRINT_FUNC(type_name, type)					\
-	void print_color_##type_name(enum output_type t,		\
-				     enum color_attr color,		\
-				     const char *key,			\
-				     const char *fmt,			\
-				     type value)			\
+#define _PRINT_FUNC(type_name, type, fast)				\
+	static void print_json_##type_name(enum output_type t,		\
+					   enum color_attr color,	\
+					   const char *key,		\
+					   const char *fmt,		\
+					   type value)			\
+	{								\
+		if (!_IS_JSON_TYPE(t))					\
+			return;						\
+		if (!key)						\
+			jsonw_##type_name(_jw, value);			\
+		else							\
+			jsonw_##type_name##_field(_jw, key, value);	\
+	}								\
+									\
+	static void print_fp_##type_name(enum output_type t,		\
+					 enum color_attr color,		\
+					 const char *key,		\
+					 const char *fmt,		\
+					 type value)			\
 	{								\
-		if (_IS_JSON_CONTEXT(t)) {				\
-			if (!key)					\
-				jsonw_##type_name(_jw, value);		\
-			else						\
-				jsonw_##type_name##_field(_jw, key, value); \
-		} else if (_IS_FP_CONTEXT(t)) {				\
-			color_fprintf(stdout, color, fmt, value);          \
-		}							\
+		if (_IS_FP_TYPE(t) && !fast(value))			\
+			color_fprintf(stdout, color, fmt, value);	\
 	}
-_PRINT_FUNC(int, int);
-_PRINT_FUNC(s64, int64_t);
-_PRINT_FUNC(hu, unsigned short);
-_PRINT_FUNC(uint, unsigned int);
-_PRINT_FUNC(u64, uint64_t);
-_PRINT_FUNC(luint, unsigned long int);
-_PRINT_FUNC(lluint, unsigned long long int);
-_PRINT_FUNC(float, double);
+_PRINT_FUNC(int, int, _FP_SIGNED);
+_PRINT_FUNC(s64, int64_t, _FP_SIGNED);
+_PRINT_FUNC(hu, unsigned short, _FP_NONE);
+_PRINT_FUNC(uint, unsigned int, _FP_UNSIGNED);
+_PRINT_FUNC(u64, uint64_t, _FP_UNSIGNED);
+_PRINT_FUNC(luint, unsigned long int, _FP_UNSIGNED);
+_PRINT_FUNC(lluint, unsigned long long int, _FP_UNSIGNED);
+_PRINT_FUNC(float, double, _FP_NONE);
 #undef _PRINT_FUNC
 
-void print_color_string(enum output_type type,
-			enum color_attr color,
-			const char *key,
-			const char *fmt,
-			const char *value)
+static void print_json_string(enum output_type type,
+			      enum color_attr color,
+			      const char *key,
+			      const char *fmt,
+			      const char *value)
 {
-	if (_IS_JSON_CONTEXT(type)) {
-		if (key && !value)
-			jsonw_name(_jw, key);
-		else if (!key && value)
-			jsonw_string(_jw, value);
-		else
-			jsonw_string_field(_jw, key, value);
-	} else if (_IS_FP_CONTEXT(type)) {
+	if (!_IS_JSON_TYPE(type))
+		return;
+	if (key && !value)
+		jsonw_name(_jw, key);
+	else if (!key && value)
+		jsonw_string(_jw, value);
+	else
+		jsonw_string_field(_jw, key, value);
+}
+
+static void print_fp_string(enum output_type type,
+			    enum color_attr color,
+			    const char *key,
+			    const char *fmt,
+			    const char *value)
+{
+	if (_IS_FP_TYPE(type) && !fp_str(color, fmt, value))
 		color_fprintf(stdout, color, fmt, value);
-	}
 }
 
 /*
@@ -150,76 +307,143 @@ void print_color_string(enum output_type type,
  * a value to it, you will need to use "is_json_context()" to have different
  * branch for json and regular output. grep -r "print_bool" for example
  */
-void print_color_bool(enum output_type type,
-		      enum color_attr color,
-		      const char *key,
-		      const char *fmt,
-		      bool value)
+static void print_json_bool(enum output_type type,
+			    enum color_attr color,
+			    const char *key,
+			    const char *fmt,
+			    bool value)
 {
-	if (_IS_JSON_CONTEXT(type)) {
-		if (key)
-			jsonw_bool_field(_jw, key, value);
-		else
-			jsonw_bool(_jw, value);
-	} else if (_IS_FP_CONTEXT(type)) {
-		color_fprintf(stdout, color, fmt, value ? "true" : "false");
-	}
+	if (!_IS_JSON_TYPE(type))
+		return;
+	if (key)
+		jsonw_bool_field(_jw, key, value);
+	else
+		jsonw_bool(_jw, value);
+}
+
+static void print_fp_bool(enum output_type type,
+			  enum color_attr color,
+			  const char *key,
+			  const char *fmt,
+			  bool value)
+{
+	print_fp_string(type, color, key, fmt, value ? "true" : "false");
 }
 
 /*
  * In JSON context uses hardcode %#x format: 42 -> 0x2a
  */
-void print_color_0xhex(enum output_type type,
-		       enum color_attr color,
-		       const char *key,
-		       const char *fmt,
-		       unsigned int hex)
+static void print_json_0xhex(enum output_type type,
+			     enum color_attr color,
+			     const char *key,
+			     const char *fmt,
+			     unsigned int hex)
 {
-	if (_IS_JSON_CONTEXT(type)) {
-		SPRINT_BUF(b1);
+	SPRINT_BUF(b1);
 
-		snprintf(b1, sizeof(b1), "%#x", hex);
-		print_string(PRINT_JSON, key, NULL, b1);
-	} else if (_IS_FP_CONTEXT(type)) {
-		color_fprintf(stdout, color, fmt, hex);
-	}
+	if (!_IS_JSON_TYPE(type))
+		return;
+	snprintf(b1, sizeof(b1), "%#x", hex);
+	print_json_string(PRINT_JSON, color, key, NULL, b1);
 }
 
-void print_color_hex(enum output_type type,
-		     enum color_attr color,
-		     const char *key,
-		     const char *fmt,
-		     unsigned int hex)
+static void print_json_hex(enum output_type type,
+			   enum color_attr color,
+			   const char *key,
+			   const char *fmt,
+			   unsigned int hex)
 {
-	if (_IS_JSON_CONTEXT(type)) {
-		SPRINT_BUF(b1);
+	SPRINT_BUF(b1);
 
-		snprintf(b1, sizeof(b1), "%x", hex);
-		if (key)
-			jsonw_string_field(_jw, key, b1);
-		else
-			jsonw_string(_jw, b1);
-	} else if (_IS_FP_CONTEXT(type)) {
+	if (!_IS_JSON_TYPE(type))
+		return;
+	snprintf(b1, sizeof(b1), "%x", hex);
+	if (key)
+		jsonw_string_field(_jw, key, b1);
+	else
+		jsonw_string(_jw, b1);
+}
+
+static void print_fp_hex(enum output_type type,
+			 enum color_attr color,
+			 const char *key,
+			 const char *fmt,
+			 unsigned int hex)
+{
+	if (_IS_FP_TYPE(type))
 		color_fprintf(stdout, color, fmt, hex);
-	}
 }
 
 /*
  * In JSON context we don't use the argument "value" we simply call jsonw_null
  * whereas FP context can use "value" to output anything
  */
-void print_color_null(enum output_type type,
-		      enum color_attr color,
-		      const char *key,
-		      const char *fmt,
-		      const char *value)
+static void print_json_null(enum output_type type,
+			    enum color_attr color,
+			    const char *key,
+			    const char *fmt,
+			    const char *value)
 {
-	if (_IS_JSON_CONTEXT(type)) {
-		if (key)
-			jsonw_null_field(_jw, key);
-		else
-			jsonw_null(_jw);
-	} else if (_IS_FP_CONTEXT(type)) {
-		color_fprintf(stdout, color, fmt, value);
-	}
+	if (!_IS_JSON_TYPE(type))
+		return;
+	if (key)
+		jsonw_null_field(_jw, key);
+	else
+		jsonw_null(_jw);
 }
+
+static const struct print_ops json_ops = {
+	.p_int		= print_json_int,
+	.p_s64		= print_json_s64,
+	.p_hu		= print_json_hu,
+	.p_uint		= print_json_uint,
+	.p_u64		= print_json_u64,
+	.p_luint	= print_json_luint,
+	.p_lluint	= print_json_lluint,
+	.p_float	= print_json_float,
+	.p_string	= print_json_string,
+	.p_bool		= print_json_bool,
+	.p_0xhex	= print_json_0xhex,
+	.p_hex		= print_json_hex,
+	.p_null		= print_json_null,
+};
+
+static const struct print_ops fp_ops = {
+	.p_int		= print_fp_int,
+	.p_s64		= print_fp_s64,
+	.p_hu		= print_fp_hu,
+	.p_uint		= print_fp_uint,
+	.p_u64		= print_fp_u64,
+	.p_luint	= print_fp_luint,
+	.p_lluint	= print_fp_lluint,
+	.p_float	= print_fp_float,
+	.p_string	= print_fp_string,
+	.p_bool		= print_fp_bool,
+	.p_0xhex	= print_fp_hex,
+	.p_hex		= print_fp_hex,
+	.p_null		= print_fp_string,
+};
+
+#define _PRINT_FUNC(type_name, type)					\
+	void print_color_##type_name(enum output_type t,		\
+				     enum color_attr color,		\
+				     const char *key,			\
+				     const char *fmt,			\
+				     type value)			\
+	{								\
+		_ops->p_##type_name(t, color, key, fmt, value);		\
+	}
+_PRINT_FUNC(int, int);
+_PRINT_FUNC(s64, int64_t);
+_PRINT_FUNC(hu, unsigned short);
+_PRINT_FUNC(uint, unsigned int);
+_PRINT_FUNC(u64, uint64_t);
+_PRINT_FUNC(luint, unsigned long int);
+_PRINT_FUNC(lluint, unsigned long long int);
+_PRINT_FUNC(float, double);
+_PRINT_FUNC(string, const char *);
+_PRINT_FUNC(bool, bool);
+_PRINT_FUNC(0xhex, unsigned int);
+_PRINT_FUNC(hex, unsigned int);
+_PRINT_FUNC(null, const char *);
+#undef _PRINT_FUNC
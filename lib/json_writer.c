@@ -9,6 +9,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <assert.h>
@@ -22,15 +24,167 @@ struct json_writer {
 	FILE		*out;	/* output file */
 	unsigned	depth;  /* nesting */
 	bool		pretty; /* optional whitepace */
+	bool		lines;	/* one flushed line per top level value */
+	bool		buffered; /* the lines not flushed after all */
+	bool		cbor;	/* binary CBOR (RFC 7049) instead of text */
 	char		sep;	/* either nul or comma */
 };
 
+/*
+ * Tokens are written straight into the stdio buffer, so that the output
+ * stays ordered with whatever else the caller prints to the same FILE,
+ * but without going through vfprintf() or taking the FILE lock for
+ * every character.
+ */
+static void jsonw_putc(json_writer_t *self, int c)
+{
+	putc_unlocked(c, self->out);
+}
+
+/* keys, numbers and most values are short enough not to call fwrite() */
+static void jsonw_write(json_writer_t *self, const char *str, size_t len)
+{
+	if (len > 32) {
+		fwrite_unlocked(str, 1, len, self->out);
+		return;
+	}
+	while (len--)
+		putc_unlocked(*str++, self->out);
+}
+
+static void jsonw_u64_raw(json_writer_t *self, uint64_t num, bool neg)
+{
+	char buf[24], *p = buf + sizeof(buf);
+
+	do {
+		*--p = '0' + num % 10;
+		num /= 10;
+	} while (num);
+	if (neg)
+		*--p = '-';
+	jsonw_write(self, p, buf + sizeof(buf) - p);
+}
+
+static void jsonw_s64_raw(json_writer_t *self, int64_t num)
+{
+	if (num < 0)
+		jsonw_u64_raw(self, -(uint64_t)num, true);
+	else
+		jsonw_u64_raw(self, num, false);
+}
+
+static void jsonw_x64_raw(json_writer_t *self, uint64_t num)
+{
+	static const char hex[] = "0123456789abcdef";
+	char buf[16], *p = buf + sizeof(buf);
+
+	do {
+		*--p = hex[num & 0xf];
+		num >>= 4;
+	} while (num);
+	jsonw_write(self, p, buf + sizeof(buf) - p);
+}
+
+/*
+ * CBOR encoding. Containers use the indefinite length forms, so that
+ * nothing has to be buffered or counted in advance and the writer stays
+ * as streaming as the text one.
+ */
+#define CBOR_UINT	0
+#define CBOR_NINT	1
+#define CBOR_TEXT	3
+#define CBOR_ARRAY	4
+#define CBOR_MAP	5
+#define CBOR_INDEF	31
+#define CBOR_FALSE	0xf4
+#define CBOR_TRUE	0xf5
+#define CBOR_NULL	0xf6
+#define CBOR_DOUBLE	0xfb
+#define CBOR_BREAK	0xff
+
+static void cbor_head(json_writer_t *self, int major, uint64_t val)
+{
+	unsigned char buf[9];
+	int i, len;
+
+	if (val < 24) {
+		jsonw_putc(self, major << 5 | val);
+		return;
+	}
+
+	if (val <= UINT8_MAX) {
+		buf[0] = major << 5 | 24;
+		len = 1;
+	} else if (val <= UINT16_MAX) {
+		buf[0] = major << 5 | 25;
+		len = 2;
+	} else if (val <= UINT32_MAX) {
+		buf[0] = major << 5 | 26;
+		len = 4;
+	} else {
+		buf[0] = major << 5 | 27;
+		len = 8;
+	}
+	for (i = len; i > 0; i--, val >>= 8)
+		buf[i] = val & 0xff;
+	jsonw_write(self, (char *)buf, len + 1);
+}
+
+static void cbor_text(json_writer_t *self, const char *str)
+{
+	size_t len = strlen(str);
+
+	cbor_head(self, CBOR_TEXT, len);
+	jsonw_write(self, str, len);
+}
+
+static void cbor_s64(json_writer_t *self, int64_t num)
+{
+	if (num < 0)
+		cbor_head(self, CBOR_NINT, -(num + 1));
+	else
+		cbor_head(self, CBOR_UINT, num);
+}
+
+static void cbor_double(json_writer_t *self, double num)
+{
+	unsigned char buf[9];
+	uint64_t bits;
+	int i;
+
+	memcpy(&bits, &num, sizeof(bits));
+	buf[0] = CBOR_DOUBLE;
+	for (i = 8; i > 0; i--, bits >>= 8)
+		buf[i] = bits & 0xff;
+	jsonw_write(self, (char *)buf, sizeof(buf));
+}
+
+/* jsonw_printf() output is untyped, keep numbers numeric */
+static void cbor_scalar(json_writer_t *self, const char *str)
+{
+	char *end;
+	long long ll;
+	double d;
+
+	ll = strtoll(str, &end, 10);
+	if (end != str && *end == '\0') {
+		cbor_s64(self, ll);
+		return;
+	}
+	d = strtod(str, &end);
+	if (end != str && *end == '\0') {
+		cbor_double(self, d);
+		return;
+	}
+	cbor_text(self, str);
+}
+
 /* indentation for pretty print */
 static void jsonw_indent(json_writer_t *self)
 {
 	unsigned i;
 	for (i = 0; i < self->depth; ++i)
-		fputs("    ", self->out);
+		jsonw_write(self, "    ", 4);
 }
 
 /* end current line and indent if pretty printing */
@@ -39,7 +193,7 @@ static void jsonw_eol(json_writer_t *self)
 	if (!self->pretty)
 		return;
 
-	putc('\n', self->out);
+	jsonw_putc(self, '\n');
 	jsonw_indent(self);
 }
 
@@ -47,46 +201,39 @@ static void jsonw_eol(json_writer_t *self)
 static void jsonw_eor(json_writer_t *self)
 {
 	if (self->sep != '\0')
-		putc(self->sep, self->out);
+		jsonw_putc(self, self->sep);
 	self->sep = ',';
 }
 
+static const char *const jsonw_escapes[256] = {
+	['\t']	= "\\t",
+	['\n']	= "\\n",
+	['\r']	= "\\r",
+	['\f']	= "\\f",
+	['\b']	= "\\b",
+	['\\']	= "\\n",
+	['"']	= "\\\"",
+	['\'']	= "\\\'",
+};
 
 /* Output JSON encoded string */
 /* Handles C escapes, does not do Unicode */
 static void jsonw_puts(json_writer_t *self, const char *str)
 {
-	putc('"', self->out);
-	for (; *str; ++str)
-		switch (*str) {
-		case '\t':
-			fputs("\\t", self->out);
-			break;
-		case '\n':
-			fputs("\\n", self->out);
-			break;
-		case '\r':
-			fputs("\\r", self->out);
-			break;
-		case '\f':
-			fputs("\\f", self->out);
-			break;
-		case '\b':
-			fputs("\\b", self->out);
-			break;
-		case '\\':
-			fputs("\\n", self->out);
-			break;
-		case '"':
-			fputs("\\\"", self->out);
-			break;
-		case '\'':
-			fputs("\\\'", self->out);
-			break;
-		default:
-			putc(*str, self->out);
-		}
-	putc('"', self->out);
+	const char *run = str;
+
+	jsonw_putc(self, '"');
+	for (; *str; ++str) {
+		const char *esc = jsonw_escapes[(unsigned char)*str];
+
+		if (!esc)
+			continue;
+		jsonw_write(self, run, str - run);
+		jsonw_write(self, esc, 2);
+		run = str + 1;
+	}
+	jsonw_write(self, run, str - run);
+	jsonw_putc(self, '"');
 }
 
 /* Create a new JSON stream */
@@ -97,6 +244,9 @@ json_writer_t *jsonw_new(FILE *f)
 		self->out = f;
 		self->depth = 0;
 		self->pretty = false;
+		self->lines = false;
+		self->buffered = false;
+		self->cbor = false;
 		self->sep = '\0';
 	}
 	return self;
@@ -108,7 +258,8 @@ void jsonw_destroy(json_writer_t **self_p)
 	json_writer_t *self = *self_p;
 
 	assert(self->depth == 0);
-	fputs("\n", self->out);
+	if (!self->lines && !self->cbor)
+		fputs("\n", self->out);
 	fflush(self->out);
 	free(self);
 	*self_p = NULL;
@@ -119,11 +270,35 @@ void jsonw_pretty(json_writer_t *self, bool on)
 	self->pretty = on;
 }
 
+void jsonw_lines(json_writer_t *self, bool on)
+{
+	self->lines = on;
+}
+
+void jsonw_lines_buffered(json_writer_t *self, bool on)
+{
+	self->buffered = on;
+}
+
+void jsonw_cbor(json_writer_t *self, bool on)
+{
+	self->cbor = on;
+	if (on)
+		self->pretty = false;
+}
+
 /* Basic blocks */
 static void jsonw_begin(json_writer_t *self, int c)
 {
+	if (self->cbor) {
+		jsonw_putc(self, (c == '{' ? CBOR_MAP : CBOR_ARRAY) << 5 |
+				 CBOR_INDEF);
+		++self->depth;
+		return;
+	}
+
 	jsonw_eor(self);
-	putc(c, self->out);
+	jsonw_putc(self, c);
 	++self->depth;
 	self->sep = '\0';
 }
@@ -133,23 +308,42 @@ static void jsonw_end(json_writer_t *self, int c)
 	assert(self->depth > 0);
 
 	--self->depth;
+	if (self->cbor) {
+		jsonw_putc(self, CBOR_BREAK);
+		if (self->lines && self->depth == 0 && !self->buffered)
+			fflush(self->out);
+		return;
+	}
+
 	if (self->sep != '\0')
 		jsonw_eol(self);
-	putc(c, self->out);
+	jsonw_putc(self, c);
 	self->sep = ',';
+
+	if (self->lines && self->depth == 0) {
+		jsonw_putc(self, '\n');
+		if (!self->buffered)
+			fflush(self->out);
+		self->sep = '\0';
+	}
 }
 
 
 /* Add a JSON property name */
 void jsonw_name(json_writer_t *self, const char *name)
 {
+	if (self->cbor) {
+		cbor_text(self, name);
+		return;
+	}
+
 	jsonw_eor(self);
 	jsonw_eol(self);
 	self->sep = '\0';
 	jsonw_puts(self, name);
-	putc(':', self->out);
+	jsonw_putc(self, ':');
 	if (self->pretty)
-		putc(' ', self->out);
+		jsonw_putc(self, ' ');
 }
 
 void jsonw_printf(json_writer_t *self, const char *fmt, ...)
@@ -157,8 +351,15 @@ void jsonw_printf(json_writer_t *self, const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	jsonw_eor(self);
-	vfprintf(self->out, fmt, ap);
+	if (self->cbor) {
+		char buf[256];
+
+		vsnprintf(buf, sizeof(buf), fmt, ap);
+		cbor_scalar(self, buf);
+	} else {
+		jsonw_eor(self);
+		vfprintf(self->out, fmt, ap);
+	}
 	va_end(ap);
 }
 
@@ -177,13 +378,13 @@ void jsonw_start_array(json_writer_t *self)
 {
 	jsonw_begin(self, '[');
 	if (self->pretty)
-		putc(' ', self->out);
+		jsonw_putc(self, ' ');
 }
 
 void jsonw_end_array(json_writer_t *self)
 {
 	if (self->pretty && self->sep)
-		putc(' ', self->out);
+		jsonw_putc(self, ' ');
 	self->sep = '\0';
 	jsonw_end(self, ']');
 }
@@ -191,68 +392,120 @@ void jsonw_end_array(json_writer_t *self)
 /* JSON value types */
 void jsonw_string(json_writer_t *self, const char *value)
 {
+	if (self->cbor) {
+		cbor_text(self, value);
+		return;
+	}
+
 	jsonw_eor(self);
 	jsonw_puts(self, value);
 }
 
 void jsonw_bool(json_writer_t *self, bool val)
 {
-	jsonw_printf(self, "%s", val ? "true" : "false");
+	if (self->cbor) {
+		jsonw_putc(self, val ? CBOR_TRUE : CBOR_FALSE);
+		return;
+	}
+
+	jsonw_eor(self);
+	if (val)
+		jsonw_write(self, "true", 4);
+	else
+		jsonw_write(self, "false", 5);
 }
 
 void jsonw_null(json_writer_t *self)
 {
-	jsonw_printf(self, "null");
+	if (self->cbor) {
+		jsonw_putc(self, CBOR_NULL);
+		return;
+	}
+
+	jsonw_eor(self);
+	jsonw_write(self, "null", 4);
 }
 
+/* CBOR doubles are exact, the format only matters for text */
 void jsonw_float_fmt(json_writer_t *self, const char *fmt, double num)
 {
-	jsonw_printf(self, fmt, num);
+	if (self->cbor)
+		cbor_double(self, num);
+	else
+		jsonw_printf(self, fmt, num);
 }
 
 void jsonw_float(json_writer_t *self, double num)
 {
-	jsonw_printf(self, "%g", num);
+	jsonw_float_fmt(self, "%g", num);
+}
+
+static void jsonw_unsigned(json_writer_t *self, uint64_t num)
+{
+	if (self->cbor) {
+		cbor_head(self, CBOR_UINT, num);
+		return;
+	}
+
+	jsonw_eor(self);
+	jsonw_u64_raw(self, num, false);
+}
+
+static void jsonw_signed(json_writer_t *self, int64_t num)
+{
+	if (self->cbor) {
+		cbor_s64(self, num);
+		return;
+	}
+
+	jsonw_eor(self);
+	jsonw_s64_raw(self, num);
 }
 
 void jsonw_hu(json_writer_t *self, unsigned short num)
 {
-	jsonw_printf(self, "%hu", num);
+	jsonw_unsigned(self, num);
 }
 
 void jsonw_uint(json_writer_t *self, unsigned int num)
 {
-	jsonw_printf(self, "%u", num);
+	jsonw_unsigned(self, num);
 }
 
 void jsonw_u64(json_writer_t *self, uint64_t num)
 {
-	jsonw_printf(self, "%"PRIu64, num);
+	jsonw_unsigned(self, num);
 }
 
 void jsonw_xint(json_writer_t *self, uint64_t num)
 {
-	jsonw_printf(self, "%"PRIx64, num);
+	if (self->cbor) {
+		cbor_head(self, CBOR_UINT, num);
+		return;
+	}
+
+	jsonw_eor(self);
+	jsonw_x64_raw(self, num);
 }
 
 void jsonw_luint(json_writer_t *self, unsigned long int num)
 {
-	jsonw_printf(self, "%lu", num);
+	jsonw_unsigned(self, num);
 }
 
 void jsonw_lluint(json_writer_t *self, unsigned long long int num)
 {
-	jsonw_printf(self, "%llu", num);
+	jsonw_unsigned(self, num);
 }
 
 void jsonw_int(json_writer_t *self, int num)
 {
-	jsonw_printf(self, "%d", num);
+	jsonw_signed(self, num);
 }
 
 void jsonw_s64(json_writer_t *self, int64_t num)
 {
-	jsonw_printf(self, "%"PRId64, num);
+	jsonw_signed(self, num);
 }
 
 /* Basic name/value objects */
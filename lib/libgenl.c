@@ -5,11 +5,196 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <linux/genetlink.h>
 #include "libgenl.h"
 
+/*
+ * What the controller said of each family: its id, version, header size
+ * and multicast groups, kept for the life of the process. Users of
+ * libnetlink and of libmnl alike hand the controller's replies to
+ * genl_cache_add(), whatever socket they came on, and look families up
+ * before asking. Families come and go with their modules; a batch or a
+ * daemon calls genl_cache_watch() to have the cache follow the
+ * controller's notifications, as ll_watch_map() does for links.
+ */
+static __thread struct genl_family *genl_cache;
+static __thread struct rtnl_handle genl_watch = { .fd = -1 };
+
+static void genl_cache_forget(const char *name)
+{
+	struct genl_family **fp, *f;
+
+	for (fp = &genl_cache; (f = *fp); fp = &f->next) {
+		if (!strcmp(f->name, name)) {
+			*fp = f->next;
+			free(f);
+			return;
+		}
+	}
+}
+
+static void genl_cache_flush(void)
+{
+	struct genl_family *f;
+
+	while ((f = genl_cache)) {
+		genl_cache = f->next;
+		free(f);
+	}
+}
+
+static void genl_parse_groups(struct genl_family *f, struct rtattr *groups)
+{
+	struct rtattr *i;
+	int rem = RTA_PAYLOAD(groups);
+
+	for (i = RTA_DATA(groups); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		struct rtattr *tb[CTRL_ATTR_MCAST_GRP_MAX + 1];
+		struct genl_group *g;
+
+		if (f->ngroups == GENL_CACHE_GROUPS)
+			break;
+		parse_rtattr_nested(tb, CTRL_ATTR_MCAST_GRP_MAX, i);
+		if (!tb[CTRL_ATTR_MCAST_GRP_NAME] || !tb[CTRL_ATTR_MCAST_GRP_ID])
+			continue;
+		g = &f->groups[f->ngroups++];
+		strncpy(g->name, rta_getattr_str(tb[CTRL_ATTR_MCAST_GRP_NAME]),
+			sizeof(g->name) - 1);
+		g->id = rta_getattr_u32(tb[CTRL_ATTR_MCAST_GRP_ID]);
+	}
+}
+
+/* remember a CTRL_CMD_NEWFAMILY message, returns the family id or -1 */
+int genl_cache_add(const struct nlmsghdr *n)
+{
+	const struct genlmsghdr *ghdr = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	struct rtattr *tb[CTRL_ATTR_MAX + 1];
+	struct genl_family *f;
+
+	if (n->nlmsg_type != GENL_ID_CTRL || len < 0 ||
+	    ghdr->cmd != CTRL_CMD_NEWFAMILY)
+		return -1;
+
+	parse_rtattr(tb, CTRL_ATTR_MAX,
+		     (struct rtattr *)((char *)ghdr + GENL_HDRLEN), len);
+	if (!tb[CTRL_ATTR_FAMILY_ID] || !tb[CTRL_ATTR_FAMILY_NAME])
+		return -1;
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return -1;
+	strncpy(f->name, rta_getattr_str(tb[CTRL_ATTR_FAMILY_NAME]),
+		sizeof(f->name) - 1);
+	f->id = rta_getattr_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	if (tb[CTRL_ATTR_VERSION])
+		f->version = rta_getattr_u32(tb[CTRL_ATTR_VERSION]);
+	if (tb[CTRL_ATTR_HDRSIZE])
+		f->hdrsize = rta_getattr_u32(tb[CTRL_ATTR_HDRSIZE]);
+	if (tb[CTRL_ATTR_MAXATTR])
+		f->maxattr = rta_getattr_u32(tb[CTRL_ATTR_MAXATTR]);
+	if (tb[CTRL_ATTR_MCAST_GROUPS])
+		genl_parse_groups(f, tb[CTRL_ATTR_MCAST_GROUPS]);
+
+	genl_cache_forget(f->name);
+	f->next = genl_cache;
+	genl_cache = f;
+	return f->id;
+}
+
+const struct genl_family *genl_cache_find(const char *name)
+{
+	struct genl_family *f;
+
+	genl_cache_sync();
+	for (f = genl_cache; f; f = f->next)
+		if (!strcmp(f->name, name))
+			return f;
+	return NULL;
+}
+
+/* the id of a multicast group of a cached family, or -1 */
+int genl_cache_group(const char *family, const char *group)
+{
+	const struct genl_family *f = genl_cache_find(family);
+	unsigned int i;
+
+	for (i = 0; f && i < f->ngroups; i++)
+		if (!strcmp(f->groups[i].name, group))
+			return f->groups[i].id;
+	return -1;
+}
+
+/* the controller's "notify" group has kept the id of the controller */
+int genl_cache_watch(void)
+{
+	if (genl_watch.fd >= 0)
+		return 0;
+
+	if (rtnl_open_byproto(&genl_watch, 1 << (GENL_ID_CTRL - 1),
+			      NETLINK_GENERIC) < 0)
+		return -1;
+
+	fcntl(genl_watch.fd, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+/*
+ * Apply the notifications queued on the watch socket: families that
+ * went away are forgotten, those that changed are taken as they are
+ * now, and a changed group makes its family be asked for again. If
+ * notifications were lost, the whole cache goes.
+ */
+void genl_cache_sync(void)
+{
+	char buf[16384];
+
+	if (genl_watch.fd < 0)
+		return;
+
+	for (;;) {
+		struct nlmsghdr *h;
+		int len;
+
+		len = recv(genl_watch.fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				genl_cache_flush();
+				continue;
+			}
+			return;
+		}
+		if (len == 0)
+			return;
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+		     h = NLMSG_NEXT(h, len)) {
+			const struct genlmsghdr *ghdr = NLMSG_DATA(h);
+			struct rtattr *tb[CTRL_ATTR_MAX + 1];
+			int alen = h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+
+			if (h->nlmsg_type != GENL_ID_CTRL || alen < 0)
+				continue;
+			if (ghdr->cmd == CTRL_CMD_NEWFAMILY) {
+				genl_cache_add(h);
+				continue;
+			}
+			parse_rtattr(tb, CTRL_ATTR_MAX,
+				     (struct rtattr *)((char *)ghdr +
+						       GENL_HDRLEN), alen);
+			if (tb[CTRL_ATTR_FAMILY_NAME])
+				genl_cache_forget(rta_getattr_str(tb[CTRL_ATTR_FAMILY_NAME]));
+		}
+	}
+}
+
 static int genl_parse_getfamily(struct nlmsghdr *nlh)
 {
 	struct rtattr *tb[CTRL_ATTR_MAX + 1];
@@ -50,9 +235,13 @@ int genl_resolve_family(struct rtnl_handle *grth, const char *family)
 {
 	GENL_REQUEST(req, 1024, GENL_ID_CTRL, 0, 0, CTRL_CMD_GETFAMILY,
 		     NLM_F_REQUEST);
+	const struct genl_family *f = genl_cache_find(family);
 	struct nlmsghdr *answer;
 	int fnum;
 
+	if (f)
+		return f->id;
+
 	addattr_l(&req.n, sizeof(req), CTRL_ATTR_FAMILY_NAME,
 		  family, strlen(family) + 1);
 
@@ -62,6 +251,8 @@ int genl_resolve_family(struct rtnl_handle *grth, const char *family)
 	}
 
 	fnum = genl_parse_getfamily(answer);
+	if (fnum >= 0)
+		genl_cache_add(answer);
 	free(answer);
 
 	return fnum;
@@ -70,8 +261,11 @@ int genl_resolve_family(struct rtnl_handle *grth, const char *family)
 int genl_init_handle(struct rtnl_handle *grth, const char *family,
 		     int *genl_family)
 {
-	if (*genl_family >= 0)
-		return 0;
+	/* the cache has it unless the family went away meanwhile */
+	if (*genl_family >= 0) {
+		*genl_family = genl_resolve_family(grth, family);
+		return *genl_family < 0 ? -1 : 0;
+	}
 
 	if (rtnl_open_byproto(grth, 0, NETLINK_GENERIC) < 0) {
 		fprintf(stderr, "Cannot open generic netlink socket\n");
@@ -22,19 +22,354 @@
 #include <errno.h>
 #include <time.h>
 #include <sys/uio.h>
+#include <linux/fib_rules.h>
+#include <linux/if_addrlabel.h>
+#include <linux/if_bridge.h>
 
 #include "libnetlink.h"
+#include "probe.h"
 
 #ifndef SOL_NETLINK
 #define SOL_NETLINK 270
 #endif
 
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
 int rcvbuf = 1024 * 1024;
 
+/* Listener buffers grow on overflow, but not without bound */
+#define RTNL_RCVBUF_MAX		(64 * 1024 * 1024)
+
+/* Kernel sizes dump skbs to at most 32k unless a single object is larger */
+#define RTNL_RECVBUF_MIN	32768
+
+/* Each queued datagram becomes one skb, keep it inside our SO_SNDBUF */
+#define RTNL_TXQ_DGRAM_MAX	32768
+#define RTNL_TXQ_SENDMMSG	64
+#define RTNL_ASYNC_WINDOW	256
+#define RTNL_LOOP_HASH		256
+
+struct rtnl_async_req {
+	__u32	seq;
+	__u32	cookie;
+	int	done;
+};
+
+struct rtnl_async {
+	struct rtnl_txq		txq;
+	size_t			maxmsg;
+	struct timespec		sent;
+	struct rtnl_async_req	*reqs;
+	unsigned int		count;
+	unsigned int		window;
+	__u32			cookie;
+	rtnl_async_err_fn_t	errfn;
+	rtnl_async_reply_fn_t	replyfn;
+	void			*arg;
+};
+
+/* An operation of rtnl_async_submit(), until its ack, error or done */
+struct rtnl_loop_op {
+	struct rtnl_loop_op	*next;		/* in its hash chain */
+	struct rtnl_loop_op	*queued;	/* dumps waiting their turn */
+	__u32			seq;
+	bool			dump;
+	bool			failing;
+	int			error;		/* what msgfn returned */
+	rtnl_async_msg_fn_t	msgfn;
+	rtnl_async_done_fn_t	donefn;
+	void			*arg;
+	struct nlmsghdr		req[];		/* a dump not sent yet */
+};
+
+struct rtnl_loop {
+	struct rtnl_loop_op	*hash[RTNL_LOOP_HASH];
+	struct rtnl_loop_op	*last;		/* the one the last message was for */
+	struct rtnl_loop_op	*dump;		/* the dump the kernel is doing */
+	struct rtnl_loop_op	*queue;
+	struct rtnl_loop_op	**queue_tail;
+	unsigned int		count;
+	rtnl_listen_filter_t	eventfn;
+	void			*eventarg;
+};
+
+static void rtnl_async_sync(struct rtnl_handle *rth);
+static void rtnl_async_free(struct rtnl_handle *rth);
+static void rtnl_loop_free(struct rtnl_handle *rth);
+
+static struct rtnl_stats rtnl_total_stats;
+static bool rtnl_stats_on;
+
+static bool rtnl_timing_on;
+static int rtnl_timing_cur = RTNL_TIME_INIT;
+static struct timespec rtnl_timing_last;
+static __u64 rtnl_timing_ns[RTNL_TIME_MAX];
+
+static unsigned int rtnl_nlmsg_count(const void *buf, int len)
+{
+	const struct nlmsghdr *h;
+	unsigned int count = 0;
+
+	for (h = buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len))
+		count++;
+	return count;
+}
+
+static void rtnl_stats_tx(struct rtnl_handle *rth, ssize_t ret,
+			  unsigned int msgs)
+{
+	struct rtnl_stats *st = rth->stats;
+
+	if (!st)
+		return;
+
+	st->syscalls++;
+	if (ret < 0)
+		return;
+	st->tx_bytes += ret;
+	st->tx_msgs += msgs;
+	st->tx_dgrams++;
+}
+
+static void rtnl_stats_rx(struct rtnl_handle *rth, ssize_t ret,
+			  const void *buf)
+{
+	struct rtnl_stats *st = rth->stats;
+
+	if (!st)
+		return;
+
+	st->syscalls++;
+	if (ret < 0) {
+		if (errno == ENOBUFS)
+			st->enobufs++;
+		return;
+	}
+	if (!buf)
+		return;
+	st->rx_bytes += ret;
+	st->rx_msgs += rtnl_nlmsg_count(buf, ret);
+	st->rx_dgrams++;
+}
+
+/*
+ * The probes: send and recv for each datagram, with the first message
+ * of it; ack for each ack or error of a request; dump_start and
+ * dump_end around rtnl_dump_filter_l(), and cb_entry and cb_exit
+ * around each message it hands to a filter.
+ */
+static void rtnl_probe_send(const struct rtnl_handle *rth, const void *buf,
+			    ssize_t ret, unsigned int msgs)
+{
+	const struct nlmsghdr *h = buf;
+
+	PROBE6(send, rth->fd, h->nlmsg_seq, h->nlmsg_type, h->nlmsg_len,
+	       msgs, ret);
+}
+
+static void rtnl_probe_recv(const struct rtnl_handle *rth, const void *buf,
+			    ssize_t len)
+{
+	const struct nlmsghdr *h = buf;
+
+	if (len >= (ssize_t)sizeof(*h))
+		PROBE4(recv, rth->fd, h->nlmsg_seq, h->nlmsg_type, len);
+}
+
+static void rtnl_stats_ack(struct rtnl_handle *rth,
+			   const struct timespec *sent)
+{
+	struct rtnl_stats *st = rth->stats;
+	struct timespec now;
+	__u64 usec;
+	int b = 0;
+
+	if (!st)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = (now.tv_sec - sent->tv_sec) * 1000000ULL +
+		(now.tv_nsec - sent->tv_nsec) / 1000;
+	while (b < RTNL_STATS_LAT_BUCKETS - 1 && usec >= (2ULL << b))
+		b++;
+	st->acks++;
+	st->ack_usec[b]++;
+}
+
+static void rtnl_stats_stamp(const struct rtnl_handle *rth,
+			     struct timespec *ts)
+{
+	if (rth->stats)
+		clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+/* A dump the cache answers is not sent, but looks sent to the caller */
+static bool rtnl_dump_cached(struct rtnl_handle *rth, const struct iovec *iov,
+			     size_t iovlen)
+{
+	return rth->dcache && rtnl_dump_cache_send(rth, iov, iovlen);
+}
+
+static int rtnl_send_one(struct rtnl_handle *rth, const void *buf, int len)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+	int phase, status;
+
+	if (rtnl_dump_cached(rth, &iov, 1))
+		return len;
+
+	phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
+	status = send(rth->fd, buf, len, 0);
+	rtnl_timing_phase(phase);
+	rtnl_stats_tx(rth, status, 1);
+	rtnl_probe_send(rth, buf, status, 1);
+	return status;
+}
+
+static int rtnl_sendmsg_one(struct rtnl_handle *rth, const struct msghdr *msg)
+{
+	int phase, status;
+
+	if (rtnl_dump_cached(rth, msg->msg_iov, msg->msg_iovlen)) {
+		size_t i, len = 0;
+
+		for (i = 0; i < msg->msg_iovlen; i++)
+			len += msg->msg_iov[i].iov_len;
+		return len;
+	}
+
+	phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
+	status = sendmsg(rth->fd, msg, 0);
+	rtnl_timing_phase(phase);
+	rtnl_stats_tx(rth, status, 1);
+	rtnl_probe_send(rth, msg->msg_iov->iov_base, status, 1);
+	return status;
+}
+
+void rtnl_stats_get(struct rtnl_stats *st)
+{
+	*st = rtnl_total_stats;
+}
+
+void rtnl_stats_print(FILE *fp)
+{
+	const struct rtnl_stats *st = &rtnl_total_stats;
+	int i;
+
+	fprintf(fp, "netlink: %llu syscalls, %llu ENOBUFS\n",
+		(unsigned long long)st->syscalls,
+		(unsigned long long)st->enobufs);
+	fprintf(fp, "netlink: sent %llu messages in %llu datagrams, %llu bytes\n",
+		(unsigned long long)st->tx_msgs,
+		(unsigned long long)st->tx_dgrams,
+		(unsigned long long)st->tx_bytes);
+	fprintf(fp, "netlink: received %llu messages in %llu datagrams, %llu bytes\n",
+		(unsigned long long)st->rx_msgs,
+		(unsigned long long)st->rx_dgrams,
+		(unsigned long long)st->rx_bytes);
+	if (!st->acks)
+		return;
+
+	fprintf(fp, "netlink: %llu replies, send to reply latency:\n",
+		(unsigned long long)st->acks);
+	for (i = 0; i < RTNL_STATS_LAT_BUCKETS; i++) {
+		if (!st->ack_usec[i])
+			continue;
+		if (i == RTNL_STATS_LAT_BUCKETS - 1)
+			fprintf(fp, "  >= %8lluus", 1ULL << i);
+		else
+			fprintf(fp, "  < %9lluus", 2ULL << i);
+		fprintf(fp, " %llu\n", (unsigned long long)st->ack_usec[i]);
+	}
+}
+
+static void rtnl_stats_atexit(void)
+{
+	rtnl_stats_print(stderr);
+}
+
+/* Account all handles opened from now on, and print a summary at exit */
+void rtnl_stats_enable(void)
+{
+	if (rtnl_stats_on)
+		return;
+
+	rtnl_stats_on = true;
+	atexit(rtnl_stats_atexit);
+}
+
+static void rtnl_timing_charge(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	rtnl_timing_ns[rtnl_timing_cur] +=
+		(now.tv_sec - rtnl_timing_last.tv_sec) * 1000000000ULL +
+		now.tv_nsec - rtnl_timing_last.tv_nsec;
+	rtnl_timing_last = now;
+}
+
+/*
+ * Charge the time since the last switch to the current phase and make
+ * @phase the current one. Returns the phase that was current, for the
+ * caller to switch back to.
+ */
+int rtnl_timing_phase(int phase)
+{
+	int old = rtnl_timing_cur;
+
+	if (!rtnl_timing_on || phase == old)
+		return old;
+
+	rtnl_timing_charge();
+	rtnl_timing_cur = phase;
+	return old;
+}
+
+void rtnl_timing_print(FILE *fp)
+{
+	static const char * const names[RTNL_TIME_MAX] = {
+		[RTNL_TIME_INIT]	= "init",
+		[RTNL_TIME_PARSE]	= "parse",
+		[RTNL_TIME_NETLINK]	= "netlink",
+		[RTNL_TIME_PRINT]	= "print",
+	};
+	__u64 total = 0;
+	int i;
+
+	if (rtnl_timing_on)
+		rtnl_timing_charge();
+	fprintf(fp, "timing:");
+	for (i = 0; i < RTNL_TIME_MAX; i++) {
+		fprintf(fp, " %s %.3fms", names[i], rtnl_timing_ns[i] / 1e6);
+		total += rtnl_timing_ns[i];
+	}
+	fprintf(fp, " total %.3fms\n", total / 1e6);
+}
+
+static void rtnl_timing_atexit(void)
+{
+	rtnl_timing_print(stderr);
+}
+
+/* Start the clock in the init phase, and print the phases at exit */
+void rtnl_timing_enable(void)
+{
+	if (rtnl_timing_on)
+		return;
+
+	rtnl_timing_on = true;
+	rtnl_timing_cur = RTNL_TIME_INIT;
+	clock_gettime(CLOCK_MONOTONIC, &rtnl_timing_last);
+	atexit(rtnl_timing_atexit);
+}
+
 #ifdef HAVE_LIBMNL
 #include <libmnl/libmnl.h>
 
@@ -132,10 +467,59 @@ void rtnl_close(struct rtnl_handle *rth)
 		close(rth->fd);
 		rth->fd = -1;
 	}
+	free(rth->recvbuf);
+	rth->recvbuf = NULL;
+	rth->recvbuf_len = 0;
+	rtnl_async_free(rth);
+	rtnl_loop_free(rth);
+	rtnl_uring_free(rth);
+	rtnl_dump_cache_free(rth);
+	rtnl_lag_free(rth);
 }
 
-int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
-		      int protocol)
+/*
+ * SO_RCVBUFFORCE lets a privileged caller go past net.core.rmem_max,
+ * everybody else gets whatever SO_RCVBUF allows.
+ */
+static int rtnl_set_rcvbuf(struct rtnl_handle *rth, int size)
+{
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &size, sizeof(size)) == 0)
+		return 0;
+
+	return setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF,
+			  &size, sizeof(size));
+}
+
+/* The socket overflowed, double its receive buffer. */
+void rtnl_grow_rcvbuf(struct rtnl_handle *rth)
+{
+	socklen_t len = sizeof(int);
+	int size;
+
+	/* the kernel reports twice what was asked for */
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0)
+		return;
+
+	if (size > RTNL_RCVBUF_MAX)
+		size = RTNL_RCVBUF_MAX;
+	rtnl_set_rcvbuf(rth, size);
+}
+
+static int rtnl_opened(struct rtnl_handle *rth)
+{
+	rth->seq = time(NULL);
+	if (rtnl_stats_on)
+		rth->stats = &rtnl_total_stats;
+	/* startup ends with the first socket */
+	if (rtnl_timing_cur == RTNL_TIME_INIT)
+		rtnl_timing_phase(RTNL_TIME_PARSE);
+	return 0;
+}
+
+/* a handle around fd, a netlink socket of protocol made by the caller */
+int rtnl_open_fd(struct rtnl_handle *rth, int fd, unsigned int subscriptions,
+		 int protocol)
 {
 	socklen_t addr_len;
 	int sndbuf = 32768;
@@ -144,11 +528,7 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 	memset(rth, 0, sizeof(*rth));
 
 	rth->proto = protocol;
-	rth->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
-	if (rth->fd < 0) {
-		perror("Cannot open netlink socket");
-		return -1;
-	}
+	rth->fd = fd;
 
 	if (setsockopt(rth->fd, SOL_SOCKET, SO_SNDBUF,
 		       &sndbuf, sizeof(sndbuf)) < 0) {
@@ -156,8 +536,7 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 		return -1;
 	}
 
-	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF,
-		       &rcvbuf, sizeof(rcvbuf)) < 0) {
+	if (rtnl_set_rcvbuf(rth, rcvbuf) < 0) {
 		perror("SO_RCVBUF");
 		return -1;
 	}
@@ -190,8 +569,32 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 			rth->local.nl_family);
 		return -1;
 	}
-	rth->seq = time(NULL);
-	return 0;
+	return rtnl_opened(rth);
+}
+
+int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
+		      int protocol)
+{
+	int fd;
+
+	memset(rth, 0, sizeof(*rth));
+
+	rth->proto = protocol;
+	if (!subscriptions) {
+		int ret = rtnl_replay_open(rth);
+
+		if (ret < 0)
+			return -1;
+		if (ret > 0)
+			return rtnl_opened(rth);
+	}
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	if (fd < 0) {
+		perror("Cannot open netlink socket");
+		return -1;
+	}
+	return rtnl_open_fd(rth, fd, subscriptions, protocol);
 }
 
 int rtnl_open(struct rtnl_handle *rth, unsigned int subscriptions)
@@ -199,6 +602,117 @@ int rtnl_open(struct rtnl_handle *rth, unsigned int subscriptions)
 	return rtnl_open_byproto(rth, subscriptions, NETLINK_ROUTE);
 }
 
+/*
+ * A handle like rth on a socket of its own, for a child that inherited
+ * rth: the socket it shares with the parent has the parent's port.
+ */
+int rtnl_reopen(struct rtnl_handle *rth)
+{
+	unsigned int groups = rth->local.nl_groups;
+	bool strict = rth->flags & RTNL_HANDLE_F_STRICT_CHK;
+	int proto = rth->proto;
+
+	rtnl_close(rth);
+	if (rtnl_open_byproto(rth, groups, proto) < 0)
+		return -1;
+	if (strict && rtnl_set_strict_dump(rth) < 0)
+		return -1;
+	return 0;
+}
+
+int rtnl_set_strict_dump(struct rtnl_handle *rth)
+{
+	int one = 1;
+
+	/* Older kernels silently ignore dump filters, keep doing it here */
+	if (setsockopt(rth->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+		       &one, sizeof(one)) < 0)
+		return -1;
+
+	rth->flags |= RTNL_HANDLE_F_STRICT_CHK;
+	return 0;
+}
+
+/* Header a strict kernel expects in front of the dump attributes */
+static int rtnl_dump_hdrlen(int type)
+{
+	switch (type) {
+	case RTM_GETROUTE:
+		return sizeof(struct rtmsg);
+	case RTM_GETADDR:
+		return sizeof(struct ifaddrmsg);
+	case RTM_GETNEIGH:
+		return sizeof(struct ndmsg);
+	case RTM_GETRULE:
+		return sizeof(struct fib_rule_hdr);
+	case RTM_GETNETCONF:
+		return sizeof(struct netconfmsg);
+	case RTM_GETNSID:
+		return sizeof(struct rtgenmsg);
+	case RTM_GETADDRLABEL:
+		return sizeof(struct ifaddrlblmsg);
+	case RTM_GETNEIGHTBL:
+		return sizeof(struct ndtmsg);
+	case RTM_GETMDB:
+		return sizeof(struct br_port_msg);
+	}
+	return 0;
+}
+
+/* AF_INET6 has its own link dump which takes no attributes at all */
+static bool rtnl_strict_bare_dump(const struct rtnl_handle *rth,
+				  int family, int type)
+{
+	return (rth->flags & RTNL_HANDLE_F_STRICT_CHK) &&
+		type == RTM_GETLINK && family == AF_INET6;
+}
+
+/* all the headers above start with the address family */
+static int rtnl_strict_dump_req(struct rtnl_handle *rth, int family, int type,
+				req_filter_fn_t filter_fn)
+{
+	int hdrlen = NLMSG_ALIGN(rtnl_dump_hdrlen(type));
+	struct {
+		struct nlmsghdr nlh;
+		char buf[1024];
+	} req = {
+		.nlh.nlmsg_len = NLMSG_LENGTH(hdrlen),
+		.nlh.nlmsg_type = type,
+		.nlh.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+		.nlh.nlmsg_seq = rth->dump = ++rth->seq,
+	};
+	int err;
+
+	*(__u8 *)NLMSG_DATA(&req.nlh) = family;
+
+	if (filter_fn) {
+		err = filter_fn(&req.nlh, sizeof(req));
+		if (err)
+			return err;
+	}
+
+	rtnl_async_sync(rth);
+	return rtnl_send_one(rth, &req, req.nlh.nlmsg_len);
+}
+
+int rtnl_routedump_req(struct rtnl_handle *rth, int family,
+		       req_filter_fn_t filter_fn)
+{
+	if (!(rth->flags & RTNL_HANDLE_F_STRICT_CHK))
+		return rtnl_wilddump_request(rth, family, RTM_GETROUTE);
+
+	return rtnl_strict_dump_req(rth, family, RTM_GETROUTE, filter_fn);
+}
+
+int rtnl_addrdump_req(struct rtnl_handle *rth, int family,
+		      req_filter_fn_t filter_fn)
+{
+	if (!(rth->flags & RTNL_HANDLE_F_STRICT_CHK))
+		return rtnl_wilddump_request(rth, family, RTM_GETADDR);
+
+	return rtnl_strict_dump_req(rth, family, RTM_GETADDR, filter_fn);
+}
+
 int rtnl_wilddump_request(struct rtnl_handle *rth, int family, int type)
 {
 	return rtnl_wilddump_req_filter(rth, family, type, RTEXT_FILTER_VF);
@@ -224,7 +738,15 @@ int rtnl_wilddump_req_filter(struct rtnl_handle *rth, int family, int type,
 		.ext_filter_mask = filt_mask,
 	};
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	/* the legacy ifinfomsg header fails strict checks for other types */
+	if ((rth->flags & RTNL_HANDLE_F_STRICT_CHK) && rtnl_dump_hdrlen(type))
+		return rtnl_strict_dump_req(rth, family, type, NULL);
+
+	if (rtnl_strict_bare_dump(rth, family, type))
+		req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+
+	rtnl_async_sync(rth);
+	return rtnl_send_one(rth, &req, req.nlh.nlmsg_len);
 }
 
 int rtnl_wilddump_req_filter_fn(struct rtnl_handle *rth, int family, int type,
@@ -250,7 +772,11 @@ int rtnl_wilddump_req_filter_fn(struct rtnl_handle *rth, int family, int type,
 	if (err)
 		return err;
 
-	return send(rth->fd, &req, req.nlh.nlmsg_len, 0);
+	if (rtnl_strict_bare_dump(rth, family, type))
+		req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+
+	rtnl_async_sync(rth);
+	return rtnl_send_one(rth, &req, req.nlh.nlmsg_len);
 }
 
 int rtnl_wilddump_stats_req_filter(struct rtnl_handle *rth, int fam, int type,
@@ -270,26 +796,55 @@ int rtnl_wilddump_stats_req_filter(struct rtnl_handle *rth, int fam, int type,
 	req.ifsm.family = fam;
 	req.ifsm.filter_mask = filt_mask;
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	rtnl_async_sync(rth);
+	return rtnl_send_one(rth, &req, sizeof(req));
 }
 
 int rtnl_send(struct rtnl_handle *rth, const void *buf, int len)
 {
-	return send(rth->fd, buf, len, 0);
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+	unsigned int msgs;
+	int status, phase;
+
+	rtnl_async_sync(rth);
+	if (rtnl_dump_cached(rth, &iov, 1))
+		return len;
+
+	phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
+	status = send(rth->fd, buf, len, 0);
+	rtnl_timing_phase(phase);
+	msgs = rtnl_nlmsg_count(buf, len);
+	rtnl_stats_tx(rth, status, msgs);
+	rtnl_probe_send(rth, buf, status, msgs);
+	return status;
 }
 
 int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int len)
 {
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+	unsigned int msgs;
 	struct nlmsghdr *h;
-	int status;
+	int status, phase;
 	char resp[1024];
 
+	rtnl_async_sync(rth);
+	if (rtnl_dump_cached(rth, &iov, 1))
+		return 0;
+
+	phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
 	status = send(rth->fd, buf, len, 0);
-	if (status < 0)
+	msgs = rtnl_nlmsg_count(buf, len);
+	rtnl_stats_tx(rth, status, msgs);
+	rtnl_probe_send(rth, buf, status, msgs);
+	if (status < 0) {
+		rtnl_timing_phase(phase);
 		return status;
+	}
 
 	/* Check for immediate errors */
 	status = recv(rth->fd, resp, sizeof(resp), MSG_DONTWAIT|MSG_PEEK);
+	rtnl_timing_phase(phase);
+	rtnl_stats_rx(rth, status, NULL);
 	if (status < 0) {
 		if (errno == EAGAIN)
 			return 0;
@@ -332,7 +887,8 @@ int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len)
 		.msg_iovlen = 2,
 	};
 
-	return sendmsg(rth->fd, &msg, 0);
+	rtnl_async_sync(rth);
+	return rtnl_sendmsg_one(rth, &msg);
 }
 
 int rtnl_dump_request_n(struct rtnl_handle *rth, struct nlmsghdr *n)
@@ -353,10 +909,11 @@ int rtnl_dump_request_n(struct rtnl_handle *rth, struct nlmsghdr *n)
 	n->nlmsg_pid = 0;
 	n->nlmsg_seq = rth->dump = ++rth->seq;
 
-	return sendmsg(rth->fd, &msg, 0);
+	rtnl_async_sync(rth);
+	return rtnl_sendmsg_one(rth, &msg);
 }
 
-static int rtnl_dump_done(struct nlmsghdr *h)
+static int rtnl_dump_done(const struct rtnl_handle *rth, struct nlmsghdr *h)
 {
 	int len = *(int *)NLMSG_DATA(h);
 
@@ -369,6 +926,10 @@ static int rtnl_dump_done(struct nlmsghdr *h)
 		errno = -len;
 		switch (errno) {
 		case ENOENT:
+			/* filtering on a table that does not exist */
+			if (rth->flags & RTNL_HANDLE_F_STRICT_CHK)
+				return 0;
+			return -1;
 		case EOPNOTSUPP:
 			return -1;
 		case EMSGSIZE:
@@ -402,215 +963,1360 @@ static void rtnl_dump_error(const struct rtnl_handle *rth,
 		     errno == EOPNOTSUPP))
 			return;
 
-		if (!(rth->flags & RTNL_HANDLE_F_SUPPRESS_NLERR))
-			perror("RTNETLINK answers");
+		if (!(rth->flags & RTNL_HANDLE_F_SUPPRESS_NLERR))
+			perror("RTNETLINK answers");
+	}
+}
+
+/* everything on a replay socket comes from the kernel, so to say */
+static void rtnl_replay_sender(const struct rtnl_handle *rth,
+			       struct msghdr *msg)
+{
+	struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+
+	if ((rth->flags & RTNL_HANDLE_F_REPLAY) && msg->msg_name) {
+		memcpy(msg->msg_name, &kernel, sizeof(kernel));
+		msg->msg_namelen = sizeof(kernel);
+	}
+}
+
+static int __rtnl_recvmsg(struct rtnl_handle *rth, struct msghdr *msg,
+			  int flags)
+{
+	int phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
+	int len;
+
+	do {
+		len = recvmsg(rth->fd, msg, flags);
+		rtnl_stats_rx(rth, len, flags & MSG_PEEK ?
+			      NULL : msg->msg_iov->iov_base);
+	} while (len < 0 && (errno == EINTR || errno == EAGAIN));
+	rtnl_timing_phase(phase);
+	if (!(flags & MSG_PEEK))
+		rtnl_probe_recv(rth, msg->msg_iov->iov_base, len);
+
+	rtnl_replay_sender(rth, msg);
+
+	if (len < 0) {
+		fprintf(stderr, "netlink receive error %s (%d)\n",
+			strerror(errno), errno);
+		return -errno;
+	}
+
+	if (len == 0) {
+		fprintf(stderr, "EOF on netlink\n");
+		return -ENODATA;
+	}
+
+	return len;
+}
+
+static int rtnl_recvmsg(struct rtnl_handle *rth, struct msghdr *msg,
+			char **answer)
+{
+	struct iovec *iov = msg->msg_iov;
+	char *buf;
+	int len;
+
+	iov->iov_base = NULL;
+	iov->iov_len = 0;
+
+	len = __rtnl_recvmsg(rth, msg, MSG_PEEK | MSG_TRUNC);
+	if (len < 0)
+		return len;
+
+	buf = malloc(len);
+	if (!buf) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		return -ENOMEM;
+	}
+
+	iov->iov_base = buf;
+	iov->iov_len = len;
+
+	len = __rtnl_recvmsg(rth, msg, 0);
+	if (len < 0) {
+		free(buf);
+		return len;
+	}
+
+	if (answer)
+		*answer = buf;
+	else
+		free(buf);
+
+	return len;
+}
+
+static int rtnl_recvbuf_grow(struct rtnl_handle *rth, size_t len)
+{
+	size_t size = rth->recvbuf_len ? : RTNL_RECVBUF_MIN;
+	char *buf;
+
+	while (size < len)
+		size <<= 1;
+
+	buf = realloc(rth->recvbuf, size);
+	if (!buf)
+		return -ENOMEM;
+
+	rth->recvbuf = buf;
+	rth->recvbuf_len = size;
+	return 0;
+}
+
+/*
+ * Receive one datagram into the buffer owned by the handle. The buffer
+ * is grown only when a datagram larger than it shows up. If the caller
+ * knows that nothing bigger than @expect can arrive (acks of its own
+ * requests) the size probe is skipped and a single recvmsg() is done;
+ * should a bigger datagram come anyway, -EMSGSIZE is returned.
+ *
+ * A nested receive on the same handle, e.g. a dump filter calling
+ * rtnl_talk(), falls back to a private malloc()ed buffer. Release the
+ * result with rtnl_recvbuf_put().
+ */
+static int __rtnl_recv(struct rtnl_handle *rth, struct msghdr *msg,
+		       char **answer, size_t expect)
+{
+	struct iovec *iov = msg->msg_iov;
+	int len;
+
+	/* each datagram has a buffer of the ring to itself */
+	if (rth->uring) {
+		int phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
+
+		len = rtnl_uring_recv(rth, msg, answer);
+		rtnl_timing_phase(phase);
+		if (len < 0) {
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(-len), -len);
+			return len;
+		}
+		if (rth->stats) {
+			rth->stats->rx_bytes += len;
+			rth->stats->rx_msgs += rtnl_nlmsg_count(*answer, len);
+			rth->stats->rx_dgrams++;
+		}
+		rtnl_probe_recv(rth, *answer, len);
+		return len;
+	}
+
+	if (rth->flags & RTNL_HANDLE_F_RECVBUF_BUSY)
+		return rtnl_recvmsg(rth, msg, answer);
+
+	if (!expect || expect > rth->recvbuf_len) {
+		iov->iov_base = NULL;
+		iov->iov_len = 0;
+
+		len = __rtnl_recvmsg(rth, msg, MSG_PEEK | MSG_TRUNC);
+		if (len < 0)
+			return len;
+
+		if (len > rth->recvbuf_len &&
+		    rtnl_recvbuf_grow(rth, len) < 0)
+			return rtnl_recvmsg(rth, msg, answer);
+	}
+
+	iov->iov_base = rth->recvbuf;
+	iov->iov_len = rth->recvbuf_len;
+
+	len = __rtnl_recvmsg(rth, msg, 0);
+	if (len < 0)
+		return len;
+
+	/*
+	 * Unprobed, a datagram bigger than @expect is gone once cut short:
+	 * fail rather than wait for an answer it held, with a bigger buffer
+	 * for the next try.
+	 */
+	if (msg->msg_flags & MSG_TRUNC) {
+		fprintf(stderr, "Message truncated\n");
+		rtnl_recvbuf_grow(rth, 2 * rth->recvbuf_len);
+		return -EMSGSIZE;
+	}
+
+	rth->flags |= RTNL_HANDLE_F_RECVBUF_BUSY;
+	*answer = rth->recvbuf;
+	return len;
+}
+
+static int rtnl_recv(struct rtnl_handle *rth, struct msghdr *msg,
+		     char **answer, size_t expect)
+{
+	int len;
+
+	if (!rth->dcache)
+		return __rtnl_recv(rth, msg, answer, expect);
+
+	len = rtnl_dump_cache_recv(rth, msg, answer);
+	if (len)
+		return len;
+
+	len = __rtnl_recv(rth, msg, answer, expect);
+	if (len > 0)
+		rtnl_dump_cache_record(rth, *answer, len);
+	return len;
+}
+
+static void rtnl_recvbuf_put(struct rtnl_handle *rth, char *buf)
+{
+	if (rtnl_uring_put(rth, buf))
+		return;
+	if (buf && buf == rth->recvbuf)
+		rth->flags &= ~RTNL_HANDLE_F_RECVBUF_BUSY;
+	else
+		free(buf);
+}
+
+/* Hand a reply to a caller that will free() it */
+static struct nlmsghdr *rtnl_recvbuf_detach(struct rtnl_handle *rth,
+					    char *buf, int len)
+{
+	char *copy;
+
+	if (buf != rth->recvbuf && !rtnl_uring_owns(rth, buf))
+		return (struct nlmsghdr *)buf;
+
+	copy = malloc(len);
+	if (copy)
+		memcpy(copy, buf, len);
+	else
+		fprintf(stderr, "malloc error: not enough buffer\n");
+	rtnl_recvbuf_put(rth, buf);
+	return (struct nlmsghdr *)copy;
+}
+
+static int __rtnl_dump_filter_l(struct rtnl_handle *rth,
+				const struct rtnl_dump_filter_arg *arg,
+				unsigned int *msgs)
+{
+	struct sockaddr_nl nladdr;
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	char *buf;
+	int dump_intr = 0;
+
+	while (1) {
+		int status;
+		const struct rtnl_dump_filter_arg *a;
+		int found_done = 0;
+		int msglen = 0;
+
+		status = rtnl_recv(rth, &msg, &buf, 0);
+		if (status < 0)
+			return status;
+
+		if (rth->dump_fp)
+			fwrite(buf, 1, NLMSG_ALIGN(status), rth->dump_fp);
+
+		for (a = arg; a->filter; a++) {
+			struct nlmsghdr *h = (struct nlmsghdr *)buf;
+
+			msglen = status;
+
+			while (NLMSG_OK(h, msglen)) {
+				int err = 0;
+
+				h->nlmsg_flags &= ~a->nc_flags;
+
+				if (nladdr.nl_pid != 0 ||
+				    h->nlmsg_pid != rth->local.nl_pid ||
+				    h->nlmsg_seq != rth->dump)
+					goto skip_it;
+
+				if (h->nlmsg_flags & NLM_F_DUMP_INTR)
+					dump_intr = 1;
+
+				if (h->nlmsg_type == NLMSG_DONE) {
+					err = rtnl_dump_done(rth, h);
+					if (err < 0) {
+						rtnl_recvbuf_put(rth, buf);
+						return -1;
+					}
+
+					found_done = 1;
+					break; /* process next filter */
+				}
+
+				if (h->nlmsg_type == NLMSG_ERROR) {
+					rtnl_dump_error(rth, h);
+					rtnl_recvbuf_put(rth, buf);
+					return -1;
+				}
+
+				if (!rth->dump_fp) {
+					int phase;
+
+					PROBE3(cb_entry, h->nlmsg_seq,
+					       h->nlmsg_type, h->nlmsg_len);
+					phase = rtnl_timing_phase(RTNL_TIME_PRINT);
+					err = a->filter(&nladdr, h, a->arg1);
+					rtnl_timing_phase(phase);
+					PROBE3(cb_exit, h->nlmsg_seq,
+					       h->nlmsg_type, err);
+					(*msgs)++;
+					if (err < 0) {
+						rtnl_recvbuf_put(rth, buf);
+						return err;
+					}
+				}
+
+skip_it:
+				h = NLMSG_NEXT(h, msglen);
+			}
+		}
+		rtnl_recvbuf_put(rth, buf);
+
+		if (found_done) {
+			if (dump_intr)
+				fprintf(stderr,
+					"Dump was interrupted and may be inconsistent.\n");
+			return 0;
+		}
+
+		if (msg.msg_flags & MSG_TRUNC) {
+			fprintf(stderr, "Message truncated\n");
+			continue;
+		}
+		if (msglen) {
+			fprintf(stderr, "!!!Remnant of size %d\n", msglen);
+			iprt_exit(1);
+		}
+	}
+}
+
+int rtnl_dump_filter_l(struct rtnl_handle *rth,
+		       const struct rtnl_dump_filter_arg *arg)
+{
+	unsigned int msgs = 0;
+	int ret;
+
+	PROBE2(dump_start, rth->fd, rth->dump);
+	ret = __rtnl_dump_filter_l(rth, arg, &msgs);
+	PROBE4(dump_end, rth->fd, rth->dump, msgs, ret);
+	return ret;
+}
+
+int rtnl_dump_filter_nc(struct rtnl_handle *rth,
+		     rtnl_filter_t filter,
+		     void *arg1, __u16 nc_flags)
+{
+	const struct rtnl_dump_filter_arg a[2] = {
+		{ .filter = filter, .arg1 = arg1, .nc_flags = nc_flags, },
+		{ .filter = NULL,   .arg1 = NULL, .nc_flags = 0, },
+	};
+
+	return rtnl_dump_filter_l(rth, a);
+}
+
+void rtnl_dump_begin(struct rtnl_handle *rth, struct rtnl_dump_iter *it)
+{
+	memset(it, 0, sizeof(*it));
+	it->rth = rth;
+}
+
+static int rtnl_dump_iter_fill(struct rtnl_dump_iter *it)
+{
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &it->nladdr,
+		.msg_namelen = sizeof(it->nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	int status;
+
+	rtnl_recvbuf_put(it->rth, it->buf);
+	it->buf = NULL;
+
+	status = rtnl_recv(it->rth, &msg, &it->buf, 0);
+	if (status < 0) {
+		it->buf = NULL;
+		return status;
+	}
+
+	if (msg.msg_flags & MSG_TRUNC)
+		fprintf(stderr, "Message truncated\n");
+
+	it->h = (struct nlmsghdr *)it->buf;
+	it->len = status;
+	return 0;
+}
+
+struct nlmsghdr *rtnl_dump_next(struct rtnl_dump_iter *it)
+{
+	struct rtnl_handle *rth = it->rth;
+
+	while (!it->done && !it->err) {
+		struct nlmsghdr *h;
+
+		if (!it->buf || !NLMSG_OK(it->h, it->len)) {
+			if (it->buf && it->len) {
+				fprintf(stderr, "!!!Remnant of size %d\n",
+					it->len);
+				it->err = -EINVAL;
+				break;
+			}
+			it->err = rtnl_dump_iter_fill(it);
+			continue;
+		}
+
+		h = it->h;
+		it->h = NLMSG_NEXT(it->h, it->len);
+
+		if (it->nladdr.nl_pid != 0 ||
+		    h->nlmsg_pid != rth->local.nl_pid ||
+		    h->nlmsg_seq != rth->dump)
+			continue;
+
+		if (h->nlmsg_flags & NLM_F_DUMP_INTR)
+			it->intr = 1;
+
+		if (h->nlmsg_type == NLMSG_DONE) {
+			if (rtnl_dump_done(rth, h) < 0)
+				it->err = -1;
+			it->done = 1;
+			break;
+		}
+
+		if (h->nlmsg_type == NLMSG_ERROR) {
+			rtnl_dump_error(rth, h);
+			it->err = -1;
+			break;
+		}
+
+		return h;
+	}
+
+	return NULL;
+}
+
+int rtnl_dump_end(struct rtnl_dump_iter *it)
+{
+	/* drain whatever the kernel still has for us */
+	while (!it->done && !it->err)
+		rtnl_dump_next(it);
+
+	rtnl_recvbuf_put(it->rth, it->buf);
+	it->buf = NULL;
+
+	if (it->intr && !it->err)
+		fprintf(stderr,
+			"Dump was interrupted and may be inconsistent.\n");
+
+	return it->err;
+}
+
+static void rtnl_talk_error(struct nlmsghdr *h, struct nlmsgerr *err,
+			    nl_ext_ack_fn_t errfn)
+{
+	if (nl_dump_ext_ack(h, errfn))
+		return;
+
+	fprintf(stderr, "RTNETLINK answers: %s\n",
+		strerror(-err->error));
+}
+
+
+void rtnl_txq_reset(struct rtnl_txq *txq)
+{
+	txq->len = 0;
+	txq->count = 0;
+}
+
+void rtnl_txq_free(struct rtnl_txq *txq)
+{
+	free(txq->buf);
+	free(txq->ends);
+	memset(txq, 0, sizeof(*txq));
+}
+
+/*
+ * Append a copy of n to the queue. Messages are packed back to back into
+ * datagrams of up to RTNL_TXQ_DGRAM_MAX bytes; the kernel processes every
+ * message in a datagram, so only the number of datagrams matters for the
+ * syscall count.
+ */
+int rtnl_txq_add(struct rtnl_txq *txq, const struct nlmsghdr *n)
+{
+	size_t len = NLMSG_ALIGN(n->nlmsg_len);
+	size_t start;
+
+	if (len > RTNL_TXQ_DGRAM_MAX) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (txq->len + len > txq->size) {
+		size_t size = txq->size ? txq->size : RTNL_TXQ_DGRAM_MAX;
+		char *buf;
+
+		while (size < txq->len + len)
+			size *= 2;
+		buf = realloc(txq->buf, size);
+		if (!buf)
+			return -1;
+		txq->buf = buf;
+		txq->size = size;
+	}
+
+	start = txq->count > 1 ? txq->ends[txq->count - 2] : 0;
+	if (!txq->count || txq->len + len - start > RTNL_TXQ_DGRAM_MAX) {
+		if (txq->count == txq->max) {
+			unsigned int max = txq->max ? txq->max * 2 : 16;
+			size_t *ends;
+
+			ends = realloc(txq->ends, max * sizeof(*ends));
+			if (!ends)
+				return -1;
+			txq->ends = ends;
+			txq->max = max;
+		}
+		txq->count++;
+	}
+
+	memcpy(txq->buf + txq->len, n, n->nlmsg_len);
+	memset(txq->buf + txq->len + n->nlmsg_len, 0, len - n->nlmsg_len);
+	txq->len += len;
+	txq->ends[txq->count - 1] = txq->len;
+	return 0;
+}
+
+/* Push all queued datagrams to the kernel, RTNL_TXQ_SENDMMSG per syscall */
+int rtnl_txq_send(struct rtnl_handle *rth, struct rtnl_txq *txq)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct mmsghdr msgs[RTNL_TXQ_SENDMMSG];
+	struct iovec iov[RTNL_TXQ_SENDMMSG];
+	unsigned int sent = 0;
+	int phase;
+
+	/* queued requests are there to change things */
+	if (rth->dcache && txq->count)
+		rtnl_dump_cache_drop(rth);
+
+	while (sent < txq->count) {
+		unsigned int i, vlen = txq->count - sent;
+		int ret;
+
+		if (vlen > RTNL_TXQ_SENDMMSG)
+			vlen = RTNL_TXQ_SENDMMSG;
+
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < vlen; i++) {
+			unsigned int d = sent + i;
+			size_t start = d ? txq->ends[d - 1] : 0;
+
+			iov[i].iov_base = txq->buf + start;
+			iov[i].iov_len = txq->ends[d] - start;
+			msgs[i].msg_hdr.msg_name = &nladdr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(nladdr);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
+		if (rth->uring)
+			ret = rtnl_uring_sendmsg(rth, msgs, vlen);
+		else
+			ret = sendmmsg(rth->fd, msgs, vlen, 0);
+		rtnl_timing_phase(phase);
+		if (rth->stats) {
+			if (!rth->uring)
+				rth->stats->syscalls++;
+			for (i = 0; ret > 0 && i < ret; i++) {
+				rth->stats->tx_bytes += msgs[i].msg_len;
+				rth->stats->tx_msgs +=
+					rtnl_nlmsg_count(iov[i].iov_base,
+							 iov[i].iov_len);
+				rth->stats->tx_dgrams++;
+			}
+		}
+		for (i = 0; ret > 0 && i < ret; i++)
+			rtnl_probe_send(rth, iov[i].iov_base, msgs[i].msg_len,
+					rtnl_nlmsg_count(iov[i].iov_base,
+							 iov[i].iov_len));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Cannot talk to rtnetlink");
+			return -1;
+		}
+		sent += ret;
+	}
+
+	return 0;
+}
+
+static void rtnl_async_free(struct rtnl_handle *rth)
+{
+	struct rtnl_async *async = rth->async;
+
+	if (!async)
+		return;
+
+	rtnl_txq_free(&async->txq);
+	free(async->reqs);
+	free(async);
+	rth->async = NULL;
+}
+
+int rtnl_async_begin(struct rtnl_handle *rth, unsigned int window,
+		     rtnl_async_err_fn_t errfn, void *arg)
+{
+	struct rtnl_async *async;
+
+	if (rth->async)
+		return 0;
+
+	if (!window)
+		window = RTNL_ASYNC_WINDOW;
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return -1;
+
+	async->reqs = calloc(window, sizeof(*async->reqs));
+	if (!async->reqs) {
+		free(async);
+		return -1;
+	}
+
+	async->window = window;
+	async->errfn = errfn;
+	async->arg = arg;
+	rth->async = async;
+	return 0;
+}
+
+void rtnl_async_cookie(struct rtnl_handle *rth, __u32 cookie)
+{
+	if (rth->async)
+		rth->async->cookie = cookie;
+}
+
+void rtnl_async_replies(struct rtnl_handle *rth, rtnl_async_reply_fn_t fn)
+{
+	if (rth->async)
+		rth->async->replyfn = fn;
+}
+
+static int rtnl_async_ack(struct rtnl_handle *rth, struct nlmsghdr *h)
+{
+	struct rtnl_async *async = rth->async;
+	struct rtnl_async_req *req;
+	struct nlmsgerr *err;
+	__u32 first = async->reqs[0].seq;
+
+	if (h->nlmsg_seq - first >= async->count)
+		return 0;
+
+	req = &async->reqs[h->nlmsg_seq - first];
+	if (req->done)
+		return 0;
+
+	if (h->nlmsg_type != NLMSG_ERROR) {
+		/* the answer comes ahead of the ack */
+		if (async->replyfn) {
+			int phase = rtnl_timing_phase(RTNL_TIME_PRINT);
+
+			async->replyfn(req->cookie, h, async->arg);
+			rtnl_timing_phase(phase);
+		} else
+			fprintf(stderr, "Unexpected reply!!!\n");
+		return 0;
+	}
+
+	req->done = 1;
+	rtnl_stats_ack(rth, &async->sent);
+	if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+		fprintf(stderr, "ERROR truncated\n");
+		return 1;
+	}
+
+	err = NLMSG_DATA(h);
+	PROBE3(ack, rth->fd, h->nlmsg_seq, err->error);
+	if (!err->error) {
+		nl_dump_ext_ack(h, NULL);
+		return 1;
+	}
+
+	if (rth->proto != NETLINK_SOCK_DIAG &&
+	    !(rth->flags & RTNL_HANDLE_F_SUPPRESS_NLERR))
+		rtnl_talk_error(h, err, NULL);
+	if (async->errfn)
+		async->errfn(req->cookie, err->error, async->arg);
+	return -1;
+}
+
+/*
+ * Send everything that is queued in one go and wait for all the acks.
+ * Returns the number of requests the kernel rejected.
+ */
+int rtnl_async_flush(struct rtnl_handle *rth)
+{
+	struct rtnl_async *async = rth->async;
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct iovec iov = {};
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	unsigned int pending;
+	size_t expect;
+	int failed = 0;
+	char *buf;
+
+	if (!async || !async->count)
+		return 0;
+
+	rtnl_stats_stamp(rth, &async->sent);
+	if (rtnl_txq_send(rth, &async->txq) < 0) {
+		failed = -1;
+		goto out;
+	}
+
+	/* answers can be of any size, acks are no bigger than the requests */
+	expect = async->replyfn ? 0 :
+		 async->maxmsg + NLMSG_LENGTH(sizeof(struct nlmsgerr)) + 4096;
+	pending = async->count;
+	while (pending) {
+		struct nlmsghdr *h;
+		int status;
+
+		msg.msg_namelen = sizeof(nladdr);
+		status = rtnl_recv(rth, &msg, &buf, expect);
+		if (status < 0) {
+			failed = -1;
+			goto out;
+		}
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, status);
+		     h = NLMSG_NEXT(h, status)) {
+			int ret;
+
+			if (nladdr.nl_pid != 0 ||
+			    h->nlmsg_pid != rth->local.nl_pid)
+				continue;
+
+			ret = rtnl_async_ack(rth, h);
+			if (ret) {
+				pending--;
+				if (ret < 0)
+					failed++;
+			}
+		}
+		rtnl_recvbuf_put(rth, buf);
+	}
+
+out:
+	rtnl_txq_reset(&async->txq);
+	async->maxmsg = 0;
+	async->count = 0;
+	return failed;
+}
+
+/* Drop what is queued and not sent yet, as when giving up on a batch */
+void rtnl_async_discard(struct rtnl_handle *rth)
+{
+	struct rtnl_async *async = rth->async;
+
+	if (!async)
+		return;
+
+	rtnl_txq_reset(&async->txq);
+	async->maxmsg = 0;
+	async->count = 0;
+}
+
+static void rtnl_async_sync(struct rtnl_handle *rth)
+{
+	if (rth->async && rth->async->count)
+		rtnl_async_flush(rth);
+}
+
+static int rtnl_async_queue(struct rtnl_handle *rth, struct iovec *iov,
+			     size_t iovlen)
+{
+	struct rtnl_async *async = rth->async;
+	int i;
+
+	for (i = 0; i < iovlen; i++) {
+		struct nlmsghdr *n = iov[i].iov_base;
+		size_t len = NLMSG_ALIGN(n->nlmsg_len);
+		struct rtnl_async_req *req;
+
+		if (len > RTNL_TXQ_DGRAM_MAX) {
+			int ret;
+
+			/* too big to share an skb, do it the slow way */
+			rtnl_async_flush(rth);
+			rth->flags &= ~RTNL_HANDLE_F_ASYNC;
+			ret = rtnl_talk(rth, n, NULL);
+			rth->flags |= RTNL_HANDLE_F_ASYNC;
+			if (ret < 0 && async->errfn)
+				async->errfn(async->cookie, -errno, async->arg);
+			continue;
+		}
+
+		if (async->count == async->window)
+			rtnl_async_flush(rth);
+
+		n->nlmsg_seq = ++rth->seq;
+		n->nlmsg_flags |= NLM_F_ACK;
+		if (rtnl_txq_add(&async->txq, n) < 0) {
+			perror("Cannot queue netlink request");
+			if (async->errfn)
+				async->errfn(async->cookie, -ENOMEM,
+					     async->arg);
+			continue;
+		}
+		if (len > async->maxmsg)
+			async->maxmsg = len;
+
+		req = &async->reqs[async->count++];
+		req->seq = n->nlmsg_seq;
+		req->cookie = async->cookie;
+		req->done = 0;
+	}
+
+	return 0;
+}
+
+int rtnl_async_end(struct rtnl_handle *rth)
+{
+	int ret = rtnl_async_flush(rth);
+
+	rth->flags &= ~RTNL_HANDLE_F_ASYNC;
+	rtnl_async_free(rth);
+	return ret;
+}
+
+/*
+ * Event loop driven operations. Nothing here blocks: requests are sent
+ * as they are submitted, except for dumps, of which the kernel does one
+ * at a time per socket, so further ones wait for it to be done. What
+ * comes back is read by rtnl_async_on_readable() once poll() says the
+ * fd is readable, and dispatched by sequence number.
+ */
+static unsigned int rtnl_loop_hash(__u32 seq)
+{
+	return seq & (RTNL_LOOP_HASH - 1);
+}
+
+static struct rtnl_loop *rtnl_loop_get(struct rtnl_handle *rth)
+{
+	struct rtnl_loop *loop = rth->loop;
+
+	if (!loop) {
+		loop = calloc(1, sizeof(*loop));
+		if (!loop)
+			return NULL;
+		loop->queue_tail = &loop->queue;
+		rth->loop = loop;
+	}
+	return loop;
+}
+
+static struct rtnl_loop_op *rtnl_loop_find(struct rtnl_loop *loop, __u32 seq)
+{
+	struct rtnl_loop_op *op = loop->last;
+
+	if (op && op->seq == seq)
+		return op;
+	for (op = loop->hash[rtnl_loop_hash(seq)]; op; op = op->next)
+		if (op->seq == seq)
+			break;
+	loop->last = op;
+	return op;
+}
+
+static int rtnl_loop_send(struct rtnl_handle *rth, struct nlmsghdr *n)
+{
+	int status = send(rth->fd, n, n->nlmsg_len, MSG_DONTWAIT);
+
+	rtnl_stats_tx(rth, status, 1);
+	rtnl_probe_send(rth, n, status, 1);
+	return status < 0 ? -errno : 0;
+}
+
+static void rtnl_loop_done(struct rtnl_handle *rth, struct rtnl_loop_op *op,
+			   int error, const struct nlmsghdr *n);
+
+/* Start the next of the dumps waiting, failing those that cannot be sent */
+static void rtnl_loop_next_dump(struct rtnl_handle *rth)
+{
+	struct rtnl_loop *loop = rth->loop;
+	struct rtnl_loop_op *op;
+	int err;
+
+	while (!loop->dump && (op = loop->queue) != NULL) {
+		loop->queue = op->queued;
+		if (!loop->queue)
+			loop->queue_tail = &loop->queue;
+
+		err = rtnl_loop_send(rth, op->req);
+		if (err < 0) {
+			rtnl_loop_done(rth, op, err, NULL);
+			continue;
+		}
+		loop->dump = op;
+	}
+}
+
+static void rtnl_loop_done(struct rtnl_handle *rth, struct rtnl_loop_op *op,
+			   int error, const struct nlmsghdr *n)
+{
+	struct rtnl_loop *loop = rth->loop;
+	struct rtnl_loop_op **pp;
+
+	for (pp = &loop->hash[rtnl_loop_hash(op->seq)]; *pp != op;
+	     pp = &(*pp)->next)
+		;
+	*pp = op->next;
+	if (loop->last == op)
+		loop->last = NULL;
+	loop->count--;
+
+	if (op->donefn)
+		op->donefn(op->error ? : error, n, op->arg);
+	if (loop->dump == op) {
+		loop->dump = NULL;
+		rtnl_loop_next_dump(rth);
+	}
+	free(op);
+}
+
+/*
+ * Send request n, or with NLM_F_DUMP in its flags queue it as a dump,
+ * and return its sequence number. The messages that answer it are
+ * passed to msgfn, then donefn gets the result: 0 or a negative errno,
+ * with the NLMSG_ERROR or NLMSG_DONE that ended it, if any. A dump
+ * that was interrupted has NLM_F_DUMP_INTR set in the flags of that
+ * NLMSG_DONE. A negative return of msgfn is the result of a dump,
+ * although the dump still goes on to its end.
+ */
+int rtnl_async_submit(struct rtnl_handle *rth, struct nlmsghdr *n,
+		      rtnl_async_msg_fn_t msgfn, rtnl_async_done_fn_t donefn,
+		      void *arg)
+{
+	struct rtnl_loop *loop = rtnl_loop_get(rth);
+	bool dump = (n->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+	struct rtnl_loop_op *op;
+	unsigned int h;
+	int err;
+
+	if (!loop)
+		return -1;
+
+	op = calloc(1, sizeof(*op) + (dump ? n->nlmsg_len : 0));
+	if (!op)
+		return -1;
+
+	/* a sequence of 0 is that of events */
+	if (!++rth->seq)
+		++rth->seq;
+	n->nlmsg_seq = rth->seq;
+	n->nlmsg_flags |= NLM_F_REQUEST;
+	if (!dump)
+		n->nlmsg_flags |= NLM_F_ACK;
+
+	op->seq = n->nlmsg_seq;
+	op->dump = dump;
+	op->msgfn = msgfn;
+	op->donefn = donefn;
+	op->arg = arg;
+
+	if (dump && (loop->dump || loop->queue)) {
+		memcpy(op->req, n, n->nlmsg_len);
+		*loop->queue_tail = op;
+		loop->queue_tail = &op->queued;
+	} else {
+		err = rtnl_loop_send(rth, n);
+		if (err < 0) {
+			free(op);
+			errno = -err;
+			return -1;
+		}
+		if (dump)
+			loop->dump = op;
 	}
+
+	h = rtnl_loop_hash(op->seq);
+	op->next = loop->hash[h];
+	loop->hash[h] = op;
+	loop->count++;
+	return op->seq;
 }
 
-static int __rtnl_recvmsg(int fd, struct msghdr *msg, int flags)
+/* what is not a reply to a request is passed to fn, as rtnl_listen() does */
+void rtnl_async_events(struct rtnl_handle *rth, rtnl_listen_filter_t fn,
+		       void *arg)
 {
-	int len;
-
-	do {
-		len = recvmsg(fd, msg, flags);
-	} while (len < 0 && (errno == EINTR || errno == EAGAIN));
-
-	if (len < 0) {
-		fprintf(stderr, "netlink receive error %s (%d)\n",
-			strerror(errno), errno);
-		return -errno;
-	}
+	struct rtnl_loop *loop = rtnl_loop_get(rth);
 
-	if (len == 0) {
-		fprintf(stderr, "EOF on netlink\n");
-		return -ENODATA;
+	if (loop) {
+		loop->eventfn = fn;
+		loop->eventarg = arg;
 	}
+}
 
-	return len;
+/* the fd to poll for POLLIN */
+int rtnl_async_fd(const struct rtnl_handle *rth)
+{
+	return rth->fd;
 }
 
-static int rtnl_recvmsg(int fd, struct msghdr *msg, char **answer)
+/* operations submitted and not done */
+unsigned int rtnl_async_inflight(const struct rtnl_handle *rth)
 {
-	struct iovec *iov = msg->msg_iov;
-	char *buf;
-	int len;
+	return rth->loop ? rth->loop->count : 0;
+}
 
-	iov->iov_base = NULL;
-	iov->iov_len = 0;
+static void rtnl_loop_dispatch(struct rtnl_handle *rth,
+			       const struct sockaddr_nl *nladdr,
+			       struct nlmsghdr *h, int *completed)
+{
+	struct rtnl_loop *loop = rth->loop;
+	struct rtnl_loop_op *op;
+	int err;
 
-	len = __rtnl_recvmsg(fd, msg, MSG_PEEK | MSG_TRUNC);
-	if (len < 0)
-		return len;
+	/* events come to groups, replies to us */
+	if (nladdr->nl_groups || h->nlmsg_pid != rth->local.nl_pid ||
+	    !(op = rtnl_loop_find(loop, h->nlmsg_seq))) {
+		struct rtnl_ctrl_data ctrl = { .nsid = -1 };
 
-	buf = malloc(len);
-	if (!buf) {
-		fprintf(stderr, "malloc error: not enough buffer\n");
-		return -ENOMEM;
+		if (loop->eventfn && (nladdr->nl_groups || !h->nlmsg_seq))
+			loop->eventfn(nladdr, &ctrl, h, loop->eventarg);
+		return;
 	}
 
-	iov->iov_base = buf;
-	iov->iov_len = len;
-
-	len = __rtnl_recvmsg(fd, msg, 0);
-	if (len < 0) {
-		free(buf);
-		return len;
+	if (h->nlmsg_type == NLMSG_DONE && op->dump) {
+		err = 0;
+		if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(int)))
+			err = *(int *)NLMSG_DATA(h);
+	} else if (h->nlmsg_type == NLMSG_ERROR) {
+		const struct nlmsgerr *e = NLMSG_DATA(h);
+
+		err = -EBADMSG;
+		if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(*e)))
+			err = e->error;
+		PROBE3(ack, rth->fd, h->nlmsg_seq, err);
+	} else {
+		if (op->msgfn && !op->error) {
+			int phase = rtnl_timing_phase(RTNL_TIME_PRINT);
+
+			PROBE3(cb_entry, h->nlmsg_seq, h->nlmsg_type,
+			       h->nlmsg_len);
+			err = op->msgfn(h, op->arg);
+			PROBE3(cb_exit, h->nlmsg_seq, h->nlmsg_type, err);
+			rtnl_timing_phase(phase);
+			if (err < 0)
+				op->error = err;
+		}
+		return;
 	}
 
-	if (answer)
-		*answer = buf;
-	else
-		free(buf);
+	rtnl_loop_done(rth, op, err, h);
+	(*completed)++;
+}
 
-	return len;
+/* Fail all that is in flight, as when the socket lost some of it */
+static int rtnl_loop_fail(struct rtnl_handle *rth, int error)
+{
+	struct rtnl_loop *loop = rth->loop;
+	struct rtnl_loop_op *op, *next;
+	int completed = 0;
+	unsigned int h;
+
+	/* not the dumps queued: they start, one by one, once these are done */
+	for (h = 0; h < RTNL_LOOP_HASH; h++)
+		for (op = loop->hash[h]; op; op = op->next)
+			op->failing = !op->dump || op == loop->dump;
+
+	for (h = 0; h < RTNL_LOOP_HASH; h++) {
+		for (op = loop->hash[h]; op; op = next) {
+			next = op->next;
+			if (!op->failing)
+				continue;
+			rtnl_loop_done(rth, op, error, NULL);
+			completed++;
+			/* the next dump went in the hash, maybe just before */
+			next = loop->hash[h];
+		}
+	}
+	return completed;
 }
 
-int rtnl_dump_filter_l(struct rtnl_handle *rth,
-		       const struct rtnl_dump_filter_arg *arg)
+/*
+ * Read all the datagrams there are and dispatch them, without blocking.
+ * Returns how many operations completed, or -1 on a socket error. An
+ * overflow of the socket fails all that was in flight with -ENOBUFS.
+ */
+int rtnl_async_on_readable(struct rtnl_handle *rth)
 {
 	struct sockaddr_nl nladdr;
 	struct iovec iov;
 	struct msghdr msg = {
 		.msg_name = &nladdr,
-		.msg_namelen = sizeof(nladdr),
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
-	char *buf;
-	int dump_intr = 0;
+	int completed = 0;
 
-	while (1) {
-		int status;
-		const struct rtnl_dump_filter_arg *a;
-		int found_done = 0;
-		int msglen = 0;
-
-		status = rtnl_recvmsg(rth->fd, &msg, &buf);
-		if (status < 0)
-			return status;
+	if (!rtnl_loop_get(rth))
+		return -1;
 
-		if (rth->dump_fp)
-			fwrite(buf, 1, NLMSG_ALIGN(status), rth->dump_fp);
+	for (;;) {
+		struct nlmsghdr *h;
+		int len;
 
-		for (a = arg; a->filter; a++) {
-			struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		iov.iov_base = NULL;
+		iov.iov_len = 0;
+		msg.msg_namelen = sizeof(nladdr);
+		len = recvmsg(rth->fd, &msg, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+		if (len > 0 && len > rth->recvbuf_len &&
+		    rtnl_recvbuf_grow(rth, len) < 0)
+			return -1;
+		if (len > 0) {
+			iov.iov_base = rth->recvbuf;
+			iov.iov_len = rth->recvbuf_len;
+			msg.msg_namelen = sizeof(nladdr);
+			len = recvmsg(rth->fd, &msg, MSG_DONTWAIT);
+		}
+		rtnl_stats_rx(rth, len, len > 0 ? rth->recvbuf : NULL);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return completed;
+			if (errno == ENOBUFS) {
+				completed += rtnl_loop_fail(rth, -ENOBUFS);
+				continue;
+			}
+			return -1;
+		}
+		if (len == 0) {
+			errno = ENODATA;
+			return -1;
+		}
+		rtnl_probe_recv(rth, rth->recvbuf, len);
+
+		/* a callback doing a blocking call gets a buffer of its own */
+		rth->flags |= RTNL_HANDLE_F_RECVBUF_BUSY;
+		for (h = (struct nlmsghdr *)rth->recvbuf; NLMSG_OK(h, len);
+		     h = NLMSG_NEXT(h, len))
+			rtnl_loop_dispatch(rth, &nladdr, h, &completed);
+		rth->flags &= ~RTNL_HANDLE_F_RECVBUF_BUSY;
+	}
+}
 
-			msglen = status;
+static void rtnl_loop_free(struct rtnl_handle *rth)
+{
+	struct rtnl_loop *loop = rth->loop;
+	unsigned int h;
 
-			while (NLMSG_OK(h, msglen)) {
-				int err = 0;
+	if (!loop)
+		return;
 
-				h->nlmsg_flags &= ~a->nc_flags;
+	/* the queued dumps are in the hash too */
+	loop->queue = NULL;
+	loop->dump = NULL;
+	for (h = 0; h < RTNL_LOOP_HASH; h++)
+		while (loop->hash[h])
+			rtnl_loop_done(rth, loop->hash[h], -ECANCELED, NULL);
+	free(loop);
+	rth->loop = NULL;
+}
 
-				if (nladdr.nl_pid != 0 ||
-				    h->nlmsg_pid != rth->local.nl_pid ||
-				    h->nlmsg_seq != rth->dump)
-					goto skip_it;
+int rtnl_flush_add(struct rtnl_txq *q, const struct nlmsghdr *n, __u16 type)
+{
+	struct nlmsghdr *fn;
 
-				if (h->nlmsg_flags & NLM_F_DUMP_INTR)
-					dump_intr = 1;
+	if (rtnl_txq_add(q, n) < 0) {
+		perror("Cannot queue flush request");
+		return -1;
+	}
+	fn = (struct nlmsghdr *)(q->buf + q->len - NLMSG_ALIGN(n->nlmsg_len));
+	fn->nlmsg_type = type;
+	fn->nlmsg_flags = NLM_F_REQUEST;
+	return 0;
+}
 
-				if (h->nlmsg_type == NLMSG_DONE) {
-					err = rtnl_dump_done(h);
-					if (err < 0) {
-						free(buf);
-						return -1;
-					}
+struct rtnl_flush_ctx {
+	int	failed;
+};
 
-					found_done = 1;
-					break; /* process next filter */
-				}
+static void rtnl_flush_err(__u32 cookie, int error, void *arg)
+{
+	struct rtnl_flush_ctx *ctx = arg;
 
-				if (h->nlmsg_type == NLMSG_ERROR) {
-					rtnl_dump_error(rth, h);
-					free(buf);
-					return -1;
-				}
+	switch (-error) {
+	case ENOENT:
+	case ESRCH:
+	case ENODEV:
+	case EADDRNOTAVAIL:
+		return;
+	}
 
-				if (!rth->dump_fp) {
-					err = a->filter(&nladdr, h, a->arg1);
-					if (err < 0) {
-						free(buf);
-						return err;
-					}
-				}
+	/* one message is enough when a million deletes fail alike */
+	if (!ctx->failed++)
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(-error));
+}
 
-skip_it:
-				h = NLMSG_NEXT(h, msglen);
-			}
-		}
-		free(buf);
+int rtnl_flush_send(struct rtnl_handle *rth, struct rtnl_txq *q)
+{
+	struct rtnl_flush_ctx ctx = {};
+	struct rtnl_async *outer;
+	int flags = rth->flags;
+	size_t off;
+	int ret;
+
+	/* the dump that filled q left a batch's own queue, if any, empty */
+	outer = rth->async;
+	rth->async = NULL;
+	if (rtnl_async_begin(rth, 0, rtnl_flush_err, &ctx) < 0) {
+		rth->async = outer;
+		return -1;
+	}
+	rth->flags |= RTNL_HANDLE_F_SUPPRESS_NLERR;
 
-		if (found_done) {
-			if (dump_intr)
-				fprintf(stderr,
-					"Dump was interrupted and may be inconsistent.\n");
-			return 0;
-		}
+	for (off = 0; off < q->len; ) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(q->buf + off);
+		struct iovec iov = {
+			.iov_base = n,
+			.iov_len = n->nlmsg_len,
+		};
 
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
-			continue;
-		}
-		if (msglen) {
-			fprintf(stderr, "!!!Remnant of size %d\n", msglen);
-			iprt_exit(1);
-		}
+		off += NLMSG_ALIGN(n->nlmsg_len);
+		rtnl_async_queue(rth, &iov, 1);
 	}
+
+	ret = rtnl_async_end(rth);
+	rth->async = outer;
+	rth->flags = flags;
+	rtnl_txq_reset(q);
+	return ret < 0 ? -1 : ctx.failed;
 }
 
-int rtnl_dump_filter_nc(struct rtnl_handle *rth,
-		     rtnl_filter_t filter,
-		     void *arg1, __u16 nc_flags)
+static int rtnl_capture(struct rtnl_handle *rtnl, struct iovec *iov,
+			size_t iovlen, struct iovec *wire, size_t wirelen,
+			struct nlmsghdr **answer)
 {
-	const struct rtnl_dump_filter_arg a[2] = {
-		{ .filter = filter, .arg1 = arg1, .nc_flags = nc_flags, },
-		{ .filter = NULL,   .arg1 = NULL, .nc_flags = 0, },
-	};
+	struct iovec whole;
+	char *buf = NULL;
+	int i, ret = 0;
 
-	return rtnl_dump_filter_l(rth, a);
-}
+	if (answer) {
+		fprintf(stderr, "Request wants a reply, cannot capture it\n");
+		errno = EOPNOTSUPP;
+		return -1;
+	}
 
-static void rtnl_talk_error(struct nlmsghdr *h, struct nlmsgerr *err,
-			    nl_ext_ack_fn_t errfn)
-{
-	if (nl_dump_ext_ack(h, errfn))
-		return;
+	/* a single request with references, put it together */
+	if (wire) {
+		size_t len = 0;
 
-	fprintf(stderr, "RTNETLINK answers: %s\n",
-		strerror(-err->error));
-}
+		for (i = 0; i < wirelen; i++)
+			len += wire[i].iov_len;
+		buf = malloc(len);
+		if (!buf)
+			return -1;
+		for (len = 0, i = 0; i < wirelen; i++) {
+			memcpy(buf + len, wire[i].iov_base, wire[i].iov_len);
+			len += wire[i].iov_len;
+		}
+		whole.iov_base = buf;
+		whole.iov_len = len;
+		iov = &whole;
+		iovlen = 1;
+	}
 
+	for (i = 0; i < iovlen && ret == 0; i++) {
+		struct nlmsghdr *h = iov[i].iov_base;
 
-static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
-			   size_t iovlen, struct nlmsghdr **answer,
-			   bool show_rtnl_err, nl_ext_ack_fn_t errfn)
+		h->nlmsg_seq = 0;
+		h->nlmsg_flags |= NLM_F_ACK;
+		ret = rtnl->capture(h, rtnl->capture_arg) < 0 ? -1 : 0;
+	}
+
+	free(buf);
+	return ret;
+}
+
+/*
+ * iov holds one request per entry. If wire is given, it describes how
+ * those requests are laid out in memory for sendmsg() instead.
+ */
+static int __rtnl_talk_sg(struct rtnl_handle *rtnl, struct iovec *iov,
+			  size_t iovlen, struct iovec *wire, size_t wirelen,
+			  struct nlmsghdr **answer,
+			  bool show_rtnl_err, nl_ext_ack_fn_t errfn)
 {
 	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
 	struct iovec riov;
 	struct msghdr msg = {
 		.msg_name = &nladdr,
 		.msg_namelen = sizeof(nladdr),
-		.msg_iov = iov,
-		.msg_iovlen = iovlen,
+		.msg_iov = wire ? wire : iov,
+		.msg_iovlen = wire ? wirelen : iovlen,
 	};
 	unsigned int seq = 0;
+	struct timespec sent;
 	struct nlmsghdr *h;
-	int i, status;
+	size_t expect = 0;
+	int i, status, recvlen, phase;
 	char *buf;
 
+	if (rtnl->capture)
+		return rtnl_capture(rtnl, iov, iovlen, wire, wirelen, answer);
+
+	if (rtnl->async) {
+		if ((rtnl->flags & RTNL_HANDLE_F_ASYNC) && !answer &&
+		    show_rtnl_err && !errfn && !wire)
+			return rtnl_async_queue(rtnl, iov, iovlen);
+		rtnl_async_sync(rtnl);
+	}
+
 	for (i = 0; i < iovlen; i++) {
 		h = iov[i].iov_base;
 		h->nlmsg_seq = seq = ++rtnl->seq;
 		if (answer == NULL)
 			h->nlmsg_flags |= NLM_F_ACK;
+		if (iov[i].iov_len > expect)
+			expect = iov[i].iov_len;
 	}
 
+	/*
+	 * An ack carries at most the request it answers plus extack
+	 * attributes, so its size is known up front.
+	 */
+	if (answer == NULL)
+		expect += NLMSG_LENGTH(sizeof(struct nlmsgerr)) + 4096;
+	else
+		expect = 0;
+
+	if (rtnl->dcache)
+		rtnl_dump_cache_send(rtnl, msg.msg_iov, msg.msg_iovlen);
+
+	phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
 	status = sendmsg(rtnl->fd, &msg, 0);
+	rtnl_timing_phase(phase);
+	rtnl_stats_tx(rtnl, status, iovlen);
+	rtnl_probe_send(rtnl, iov[0].iov_base, status, iovlen);
 	if (status < 0) {
 		perror("Cannot talk to rtnetlink");
 		return -1;
 	}
+	rtnl_stats_stamp(rtnl, &sent);
 
 	/* change msg to use the response iov */
 	msg.msg_iov = &riov;
@@ -618,11 +2324,12 @@ static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
 	i = 0;
 	while (1) {
 next:
-		status = rtnl_recvmsg(rtnl->fd, &msg, &buf);
+		status = rtnl_recv(rtnl, &msg, &buf, expect);
 		++i;
 
 		if (status < 0)
 			return status;
+		recvlen = status;
 
 		if (msg.msg_namelen != sizeof(nladdr)) {
 			fprintf(stderr,
@@ -637,7 +2344,7 @@ next:
 			if (l < 0 || len > status) {
 				if (msg.msg_flags & MSG_TRUNC) {
 					fprintf(stderr, "Truncated message\n");
-					free(buf);
+					rtnl_recvbuf_put(rtnl, buf);
 					return -1;
 				}
 				fprintf(stderr,
@@ -655,9 +2362,15 @@ next:
 				continue;
 			}
 
+			rtnl_stats_ack(rtnl, &sent);
+
 			if (h->nlmsg_type == NLMSG_ERROR) {
 				struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(h);
 
+				if (l >= sizeof(struct nlmsgerr))
+					PROBE3(ack, rtnl->fd, h->nlmsg_seq,
+					       err->error);
+
 				if (l < sizeof(struct nlmsgerr)) {
 					fprintf(stderr, "ERROR truncated\n");
 				} else if (!err->error) {
@@ -665,9 +2378,11 @@ next:
 					nl_dump_ext_ack(h, errfn);
 
 					if (answer)
-						*answer = (struct nlmsghdr *)buf;
+						*answer = rtnl_recvbuf_detach(rtnl,
+									      buf,
+									      recvlen);
 					else
-						free(buf);
+						rtnl_recvbuf_put(rtnl, buf);
 					if (h->nlmsg_seq == seq)
 						return 0;
 					else if (i < iovlen)
@@ -680,13 +2395,14 @@ next:
 					rtnl_talk_error(h, err, errfn);
 
 				errno = -err->error;
-				free(buf);
+				rtnl_recvbuf_put(rtnl, buf);
 				return -i;
 			}
 
 			if (answer) {
-				*answer = (struct nlmsghdr *)buf;
-				return 0;
+				*answer = rtnl_recvbuf_detach(rtnl, buf,
+							      recvlen);
+				return *answer ? 0 : -1;
 			}
 
 			fprintf(stderr, "Unexpected reply!!!\n");
@@ -694,7 +2410,7 @@ next:
 			status -= NLMSG_ALIGN(len);
 			h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
 		}
-		free(buf);
+		rtnl_recvbuf_put(rtnl, buf);
 
 		if (msg.msg_flags & MSG_TRUNC) {
 			fprintf(stderr, "Message truncated\n");
@@ -708,6 +2424,14 @@ next:
 	}
 }
 
+static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
+			   size_t iovlen, struct nlmsghdr **answer,
+			   bool show_rtnl_err, nl_ext_ack_fn_t errfn)
+{
+	return __rtnl_talk_sg(rtnl, iov, iovlen, NULL, 0, answer,
+			      show_rtnl_err, errfn);
+}
+
 static int __rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 		       struct nlmsghdr **answer,
 		       bool show_rtnl_err, nl_ext_ack_fn_t errfn)
@@ -732,6 +2456,32 @@ int rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iovec, size_t iovlen,
 	return __rtnl_talk_iov(rtnl, iovec, iovlen, answer, true, NULL);
 }
 
+int rtnl_talk_refs(struct rtnl_handle *rtnl, struct nlmsghdr *n,
+		   const struct nlmsg_refs *refs, struct nlmsghdr **answer)
+{
+	struct iovec iov = {
+		.iov_base = n,
+		.iov_len = n->nlmsg_len
+	};
+	struct iovec wire[2 * NLMSG_REFS_MAX + 1];
+	int i, w = 0, off = 0;
+
+	if (!refs || !refs->count)
+		return __rtnl_talk(rtnl, n, answer, true, NULL);
+
+	for (i = 0; i < refs->count; i++) {
+		wire[w].iov_base = (char *)n + off;
+		wire[w++].iov_len = refs->ref[i].off - off;
+		wire[w].iov_base = (void *)refs->ref[i].data;
+		wire[w++].iov_len = refs->ref[i].len;
+		off = refs->ref[i].off + refs->ref[i].len;
+	}
+	wire[w].iov_base = (char *)n + off;
+	wire[w++].iov_len = n->nlmsg_len - off;
+
+	return __rtnl_talk_sg(rtnl, &iov, 1, wire, w, answer, true, NULL);
+}
+
 int rtnl_talk_extack(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 		     struct nlmsghdr **answer,
 		     nl_ext_ack_fn_t errfn)
@@ -762,7 +2512,7 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 		rtnl_listen_filter_t handler,
 		void *jarg)
 {
-	int status;
+	int status, phase;
 	struct nlmsghdr *h;
 	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
 	struct iovec iov;
@@ -775,22 +2525,49 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 	char   buf[16384];
 	char   cmsgbuf[BUFSIZ];
 
-	if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
+	/* events are read here, not by the ring */
+	rtnl_uring_free(rtnl);
+
+	if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID)
 		msg.msg_control = &cmsgbuf;
-		msg.msg_controllen = sizeof(cmsgbuf);
-	}
 
 	iov.iov_base = buf;
 	while (1) {
 		struct rtnl_ctrl_data ctrl;
 		struct cmsghdr *cmsg;
 
+		/* recvmsg() shrinks it to what the last message carried */
+		if (msg.msg_control)
+			msg.msg_controllen = sizeof(cmsgbuf);
 		iov.iov_len = sizeof(buf);
+		if (rtnl->lag)
+			rtnl_lag_wait(rtnl);
+		phase = rtnl_timing_phase(RTNL_TIME_NETLINK);
 		status = recvmsg(rtnl->fd, &msg, 0);
+		rtnl_timing_phase(phase);
+		rtnl_stats_rx(rtnl, status, buf);
+		rtnl_probe_recv(rtnl, buf, status);
+		rtnl_replay_sender(rtnl, &msg);
 
 		if (status < 0) {
+			if (errno == EAGAIN && rtnl->lag)
+				rtnl_lag_idle(rtnl);
+			if (errno == EAGAIN && rtnl->tick) {
+				if (rtnl->tick(rtnl, jarg) < 0)
+					return -1;
+				continue;
+			}
 			if (errno == EINTR || errno == EAGAIN)
 				continue;
+			if (errno == ENOBUFS) {
+				rtnl_grow_rcvbuf(rtnl);
+				errno = ENOBUFS;
+				if (rtnl->resync) {
+					if (rtnl->resync(rtnl, jarg) < 0)
+						return -1;
+					continue;
+				}
+			}
 			fprintf(stderr, "netlink receive error %s (%d)\n",
 				strerror(errno), errno);
 			if (errno == ENOBUFS)
@@ -807,6 +2584,8 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 				msg.msg_namelen);
 			iprt_exit(1);
 		}
+		if (rtnl->lag)
+			rtnl_lag_recv(rtnl);
 
 		if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
 			memset(&ctrl, 0, sizeof(ctrl));
@@ -838,13 +2617,19 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 				iprt_exit(1);
 			}
 
+			phase = rtnl_timing_phase(RTNL_TIME_PRINT);
 			err = handler(&nladdr, &ctrl, h, jarg);
+			rtnl_timing_phase(phase);
 			if (err < 0)
 				return err;
 
 			status -= NLMSG_ALIGN(len);
 			h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
 		}
+		if (rtnl->lag)
+			rtnl_lag_done(rtnl);
+		if (rtnl->tick && rtnl->tick(rtnl, jarg) < 0)
+			return -1;
 		if (msg.msg_flags & MSG_TRUNC) {
 			fprintf(stderr, "Message truncated\n");
 			continue;
@@ -865,7 +2650,7 @@ int rtnl_from_file(FILE *rtnl, rtnl_listen_filter_t handler,
 	struct nlmsghdr *h = (struct nlmsghdr *)buf;
 
 	while (1) {
-		int err, len;
+		int err, len, phase;
 		int l;
 
 		status = fread(&buf, 1, sizeof(*h), rtnl);
@@ -899,7 +2684,9 @@ int rtnl_from_file(FILE *rtnl, rtnl_listen_filter_t handler,
 			return -1;
 		}
 
+		phase = rtnl_timing_phase(RTNL_TIME_PRINT);
 		err = handler(&nladdr, NULL, h, jarg);
+		rtnl_timing_phase(phase);
 		if (err < 0)
 			return err;
 	}
@@ -956,6 +2743,41 @@ int addattr_l(struct nlmsghdr *n, int maxlen, int type, const void *data,
 	return 0;
 }
 
+/*
+ * Like addattr_l(), but the payload is left where it is and only its
+ * place in the message is reserved. Falls back to copying when there
+ * is no room left in refs.
+ */
+int addattr_ref(struct nlmsghdr *n, int maxlen, struct nlmsg_refs *refs,
+		int type, const void *data, int alen)
+{
+	int len = RTA_LENGTH(alen);
+	struct nlmsg_ref *ref;
+	struct rtattr *rta;
+
+	if (!refs || refs->count == NLMSG_REFS_MAX)
+		return addattr_l(n, maxlen, type, data, alen);
+
+	if (NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(len) > maxlen) {
+		fprintf(stderr,
+			"addattr_ref ERROR: message exceeded bound of %d\n",
+			maxlen);
+		return -1;
+	}
+	rta = NLMSG_TAIL(n);
+	rta->rta_type = type;
+	rta->rta_len = len;
+	memset((char *)RTA_DATA(rta) + alen, 0, RTA_ALIGN(len) - len);
+
+	ref = &refs->ref[refs->count++];
+	ref->off = (char *)RTA_DATA(rta) - (char *)n;
+	ref->data = data;
+	ref->len = alen;
+
+	n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(len);
+	return 0;
+}
+
 int addraw_l(struct nlmsghdr *n, int maxlen, const void *data, int len)
 {
 	if (NLMSG_ALIGN(n->nlmsg_len) + NLMSG_ALIGN(len) > maxlen) {
@@ -1098,6 +2920,40 @@ int parse_rtattr_flags(struct rtattr *tb[], int max, struct rtattr *rta,
 	return 0;
 }
 
+/*
+ * Like parse_rtattr() but only indexes the attribute types set in @want
+ * (see RTA_WANT()).  Only those entries of tb[] are cleared and filled in,
+ * everything else is left untouched and must not be used by the caller.
+ * The walk stops as soon as every wanted type has been seen.
+ */
+int parse_rtattr_want(struct rtattr *tb[], int max, __u64 want,
+		      struct rtattr *rta, int len)
+{
+	__u64 left, bit;
+	unsigned short type;
+
+	if (max < 63)
+		want &= (2ULL << max) - 1;
+
+	for (left = want; left; left &= left - 1)
+		tb[ffsll(left) - 1] = NULL;
+
+	left = want;
+	while (left && RTA_OK(rta, len)) {
+		type = rta->rta_type;
+		bit = type < 64 ? 1ULL << type : 0;
+		if (left & bit) {
+			tb[type] = rta;
+			left &= ~bit;
+		}
+		rta = RTA_NEXT(rta, len);
+	}
+	if (left && len)
+		fprintf(stderr, "!!!Deficit %d, rta_len=%d\n",
+			len, rta->rta_len);
+	return 0;
+}
+
 int parse_rtattr_byindex(struct rtattr *tb[], int max,
 			 struct rtattr *rta, int len)
 {
@@ -20,12 +20,22 @@
 #include <string.h>
 
 #include <linux/netdevice.h>
+#include <linux/if_ether.h>
 #include <linux/if_arp.h>
 #include <linux/sockios.h>
 
 #include "rt_names.h"
 #include "utils.h"
 
+static const char ll_hex[] = "0123456789abcdef";
+
+/* the value of a hex digit plus one, 0 for any other character */
+static const unsigned char ll_hexval[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
 
 const char *ll_addr_n2a(const unsigned char *addr, int alen, int type, char *buf, int blen)
 {
@@ -40,15 +50,50 @@ const char *ll_addr_n2a(const unsigned char *addr, int alen, int type, char *buf
 	    (type == ARPHRD_TUNNEL6 || type == ARPHRD_IP6GRE)) {
 		return inet_ntop(AF_INET6, addr, buf, blen);
 	}
+	if (alen > 0 && blen >= 3 * alen) {
+		char *p = buf;
+
+		for (i = 0; i < alen; i++) {
+			*p++ = ll_hex[addr[i] >> 4];
+			*p++ = ll_hex[addr[i] & 0xf];
+			*p++ = ':';
+		}
+		p[-1] = '\0';
+		return buf;
+	}
 	snprintf(buf, blen, "%02x", addr[0]);
 	for (i = 1, l = 2; i < alen && l < blen; i++, l += 3)
 		snprintf(buf + l, blen - l, ":%02x", addr[i]);
 	return buf;
 }
 
+/* an Ethernet address, with one or two hex digits to a byte */
+static int ll_addr_a2n_eth(unsigned char *mac, const char *arg)
+{
+	int i;
+
+	for (i = 0; i < ETH_ALEN; i++) {
+		unsigned int hi = ll_hexval[(unsigned char)*arg++];
+		unsigned int lo;
+
+		if (!hi)
+			return -1;
+		lo = ll_hexval[(unsigned char)*arg];
+		arg += !!lo;
+		mac[i] = lo ? (hi - 1) << 4 | (lo - 1) : hi - 1;
+		if (*arg++ != (i == ETH_ALEN - 1 ? '\0' : ':'))
+			return -1;
+	}
+	return 0;
+}
+
 /*NB: lladdr is char * (rather than u8 *) because sa_data is char * (1003.1g) */
 int ll_addr_a2n(char *lladdr, int len, const char *arg)
 {
+	if (len >= ETH_ALEN &&
+	    ll_addr_a2n_eth((unsigned char *)lladdr, arg) == 0)
+		return ETH_ALEN;
+
 	if (strchr(arg, '.')) {
 		inet_prefix pfx;
 		if (get_addr_1(&pfx, arg, AF_INET)) {
@@ -17,38 +17,298 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <errno.h>
 #include <net/if.h>
+#include <net/if_arp.h>
 
 #include "libnetlink.h"
 #include "ll_map.h"
-#include "list.h"
 
+/*
+ * Entries live in fixed-size chunks so that their addresses stay valid
+ * (ll_index_to_name() hands out pointers into them) while the chunks
+ * themselves are contiguous. They are found through two open-addressing
+ * tables that grow with the number of links: one keyed by name, one by
+ * ifindex. Dense ifindex ranges, the common case, skip the latter and
+ * use a plain array instead.
+ */
 struct ll_cache {
-	struct hlist_node idx_hash;
-	struct hlist_node name_hash;
 	unsigned	flags;
-	unsigned 	index;
+	unsigned	index;
+	unsigned	hash;
 	unsigned short	type;
-	char		name[];
+	char		name[IFNAMSIZ];
 };
 
-#define IDXMAP_SIZE	1024
-static struct hlist_head idx_head[IDXMAP_SIZE];
-static struct hlist_head name_head[IDXMAP_SIZE];
+#define LL_CHUNK_SHIFT	8
+#define LL_CHUNK_SIZE	(1 << LL_CHUNK_SHIFT)
 
-static struct ll_cache *ll_get_by_index(unsigned index)
+#define LL_EMPTY	(-1)
+#define LL_DELETED	(-2)
+
+#define LL_TAB_MIN	64
+#define LL_DIRECT_MIN	1024
+
+struct ll_slot {
+	unsigned	key;
+	int		entry;
+};
+
+struct ll_table {
+	struct ll_slot	*slots;
+	unsigned	size;
+	unsigned	used;	/* live plus deleted */
+};
+
+/* The cache belongs to the thread, like the handle that it is loaded from */
+static __thread struct ll_cache **ll_chunks;
+static __thread int ll_nchunks;
+static __thread int ll_nentries;
+static __thread int ll_free = LL_EMPTY;
+static __thread unsigned ll_count;
+
+static __thread struct ll_table name_tab;
+static __thread struct ll_table idx_tab;
+static __thread int *idx_direct;
+static __thread unsigned idx_direct_len;
+
+static struct ll_cache *ll_entry(int entry)
+{
+	return &ll_chunks[entry >> LL_CHUNK_SHIFT][entry & (LL_CHUNK_SIZE - 1)];
+}
+
+static int ll_entry_alloc(void)
+{
+	int entry;
+
+	if (ll_free != LL_EMPTY) {
+		entry = ll_free;
+		ll_free = ll_entry(entry)->flags;
+		return entry;
+	}
+
+	if (ll_nentries == ll_nchunks * LL_CHUNK_SIZE) {
+		struct ll_cache **chunks;
+
+		chunks = realloc(ll_chunks, (ll_nchunks + 1) * sizeof(*chunks));
+		if (!chunks)
+			return LL_EMPTY;
+		ll_chunks = chunks;
+		ll_chunks[ll_nchunks] = malloc(LL_CHUNK_SIZE *
+					       sizeof(struct ll_cache));
+		if (!ll_chunks[ll_nchunks])
+			return LL_EMPTY;
+		ll_nchunks++;
+	}
+
+	return ll_nentries++;
+}
+
+static void ll_entry_free(int entry)
+{
+	ll_entry(entry)->flags = ll_free;
+	ll_free = entry;
+}
+
+static unsigned idxhash(unsigned index)
+{
+	index *= 2654435761U;
+	return index ^ (index >> 16);
+}
+
+/*
+ * Linear probing. Returns the slot holding key/entry, or if it is not
+ * there, the slot it should go to. match() tells whether an entry with
+ * the right key hash is what the caller looks for.
+ */
+static struct ll_slot *ll_tab_probe(const struct ll_table *tab, unsigned key,
+				    int (*match)(int entry, const void *arg),
+				    const void *arg)
+{
+	struct ll_slot *reuse = NULL;
+	unsigned mask = tab->size - 1;
+	unsigned h = key & mask;
+
+	for (;; h = (h + 1) & mask) {
+		struct ll_slot *slot = &tab->slots[h];
+
+		if (slot->entry == LL_EMPTY)
+			return reuse ? : slot;
+		if (slot->entry == LL_DELETED) {
+			if (!reuse)
+				reuse = slot;
+			continue;
+		}
+		if (slot->key == key && match(slot->entry, arg))
+			return slot;
+	}
+}
+
+static int ll_tab_resize(struct ll_table *tab, unsigned size)
+{
+	struct ll_table old = *tab;
+	unsigned i;
+
+	tab->slots = malloc(size * sizeof(*tab->slots));
+	if (!tab->slots) {
+		*tab = old;
+		return -1;
+	}
+	tab->size = size;
+	tab->used = 0;
+	for (i = 0; i < size; i++)
+		tab->slots[i].entry = LL_EMPTY;
+
+	for (i = 0; i < old.size; i++) {
+		unsigned h;
+
+		if (old.slots[i].entry < 0)
+			continue;
+		for (h = old.slots[i].key & (size - 1);
+		     tab->slots[h].entry != LL_EMPTY; h = (h + 1) & (size - 1))
+			;
+		tab->slots[h] = old.slots[i];
+		tab->used++;
+	}
+	free(old.slots);
+	return 0;
+}
+
+/* keep the load factor, deleted slots included, under one half */
+static int ll_tab_reserve(struct ll_table *tab)
+{
+	unsigned size = tab->size ? : LL_TAB_MIN;
+
+	if (2 * (tab->used + 1) <= tab->size)
+		return 0;
+
+	while (size < 4 * (ll_count + 1))
+		size <<= 1;
+	return ll_tab_resize(tab, size);
+}
+
+static int ll_tab_insert(struct ll_table *tab, unsigned key, int entry,
+			 int (*match)(int entry, const void *arg),
+			 const void *arg)
 {
-	struct hlist_node *n;
-	unsigned h = index & (IDXMAP_SIZE - 1);
+	struct ll_slot *slot;
 
-	hlist_for_each(n, &idx_head[h]) {
-		struct ll_cache *im
-			= container_of(n, struct ll_cache, idx_hash);
-		if (im->index == index)
-			return im;
+	if (ll_tab_reserve(tab) < 0)
+		return -1;
+
+	slot = ll_tab_probe(tab, key, match, arg);
+	if (slot->entry == LL_EMPTY)
+		tab->used++;
+	slot->key = key;
+	slot->entry = entry;
+	return 0;
+}
+
+static int ll_tab_find(const struct ll_table *tab, unsigned key,
+		       int (*match)(int entry, const void *arg),
+		       const void *arg)
+{
+	if (!tab->size)
+		return LL_EMPTY;
+
+	return ll_tab_probe(tab, key, match, arg)->entry;
+}
+
+static void ll_tab_remove(struct ll_table *tab, unsigned key,
+			  int (*match)(int entry, const void *arg),
+			  const void *arg)
+{
+	struct ll_slot *slot;
+
+	if (!tab->size)
+		return;
+
+	slot = ll_tab_probe(tab, key, match, arg);
+	if (slot->entry >= 0)
+		slot->entry = LL_DELETED;
+}
+
+static int match_index(int entry, const void *arg)
+{
+	return ll_entry(entry)->index == *(const unsigned *)arg;
+}
+
+static int match_name(int entry, const void *arg)
+{
+	return strncmp(ll_entry(entry)->name, arg, IFNAMSIZ) == 0;
+}
+
+static int match_entry(int entry, const void *arg)
+{
+	return entry == *(const int *)arg;
+}
+
+/*
+ * Grow the direct map to cover index if that keeps it reasonably dense,
+ * moving over whatever the hashed map had in the new range.
+ */
+static int idx_direct_grow(unsigned index)
+{
+	unsigned len = idx_direct_len ? : LL_DIRECT_MIN;
+	unsigned i;
+	int *map;
+
+	while (len <= index)
+		len <<= 1;
+	if (len > LL_DIRECT_MIN && len > 4 * (ll_count + 1))
+		return -1;
+
+	map = realloc(idx_direct, len * sizeof(*map));
+	if (!map)
+		return -1;
+	for (i = idx_direct_len; i < len; i++)
+		map[i] = LL_EMPTY;
+	idx_direct = map;
+	idx_direct_len = len;
+
+	for (i = 0; i < idx_tab.size; i++) {
+		struct ll_slot *slot = &idx_tab.slots[i];
+
+		if (slot->entry < 0 || ll_entry(slot->entry)->index >= len)
+			continue;
+		idx_direct[ll_entry(slot->entry)->index] = slot->entry;
+		slot->entry = LL_DELETED;
+	}
+	return 0;
+}
+
+static int ll_idx_insert(unsigned index, int entry)
+{
+	if (index < idx_direct_len || idx_direct_grow(index) == 0) {
+		idx_direct[index] = entry;
+		return 0;
 	}
 
-	return NULL;
+	return ll_tab_insert(&idx_tab, idxhash(index), entry,
+			     match_index, &index);
+}
+
+static void ll_idx_remove(unsigned index)
+{
+	if (index < idx_direct_len)
+		idx_direct[index] = LL_EMPTY;
+	else
+		ll_tab_remove(&idx_tab, idxhash(index), match_index, &index);
+}
+
+static int ll_find_index(unsigned index)
+{
+	if (index < idx_direct_len)
+		return idx_direct[index];
+
+	return ll_tab_find(&idx_tab, idxhash(index), match_index, &index);
+}
+
+static struct ll_cache *ll_get_by_index(unsigned index)
+{
+	int entry = ll_find_index(index);
+
+	return entry >= 0 ? ll_entry(entry) : NULL;
 }
 
 unsigned namehash(const char *str)
@@ -63,28 +323,42 @@ unsigned namehash(const char *str)
 
 static struct ll_cache *ll_get_by_name(const char *name)
 {
-	struct hlist_node *n;
-	unsigned h = namehash(name) & (IDXMAP_SIZE - 1);
+	int entry = ll_tab_find(&name_tab, namehash(name), match_name, name);
 
-	hlist_for_each(n, &name_head[h]) {
-		struct ll_cache *im
-			= container_of(n, struct ll_cache, name_hash);
+	return entry >= 0 ? ll_entry(entry) : NULL;
+}
 
-		if (strncmp(im->name, name, IFNAMSIZ) == 0)
-			return im;
-	}
+static void ll_forget(int entry)
+{
+	struct ll_cache *im = ll_entry(entry);
+
+	ll_tab_remove(&name_tab, im->hash, match_entry, &entry);
+	ll_idx_remove(im->index);
+	ll_entry_free(entry);
+	ll_count--;
+}
+
+/* Names are unique, an entry still holding this one is stale */
+static int ll_name_insert(int entry)
+{
+	struct ll_cache *im = ll_entry(entry);
+	int old;
+
+	old = ll_tab_find(&name_tab, im->hash, match_name, im->name);
+	if (old >= 0 && old != entry)
+		ll_forget(old);
 
-	return NULL;
+	return ll_tab_insert(&name_tab, im->hash, entry, match_entry, &entry);
 }
 
 int ll_remember_index(const struct sockaddr_nl *who,
 		      struct nlmsghdr *n, void *arg)
 {
-	unsigned int h;
 	const char *ifname;
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
 	struct ll_cache *im;
 	struct rtattr *tb[IFLA_MAX+1];
+	int entry;
 
 	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
 		return 0;
@@ -92,53 +366,65 @@ int ll_remember_index(const struct sockaddr_nl *who,
 	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
 		return -1;
 
-	im = ll_get_by_index(ifi->ifi_index);
+	entry = ll_find_index(ifi->ifi_index);
 	if (n->nlmsg_type == RTM_DELLINK) {
-		if (im) {
-			hlist_del(&im->name_hash);
-			hlist_del(&im->idx_hash);
-			free(im);
-		}
+		if (entry >= 0)
+			ll_forget(entry);
 		return 0;
 	}
 
-	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
+	parse_rtattr_want(tb, IFLA_MAX, RTA_WANT(IFLA_IFNAME),
+			  IFLA_RTA(ifi), IFLA_PAYLOAD(n));
 	ifname = rta_getattr_str(tb[IFLA_IFNAME]);
 	if (ifname == NULL)
 		return 0;
 
-	if (im) {
+	if (entry >= 0) {
+		im = ll_entry(entry);
+
 		/* change to existing entry */
 		if (strcmp(im->name, ifname) != 0) {
-			hlist_del(&im->name_hash);
-			h = namehash(ifname) & (IDXMAP_SIZE - 1);
-			hlist_add_head(&im->name_hash, &name_head[h]);
+			ll_tab_remove(&name_tab, im->hash, match_entry, &entry);
+			memset(im->name, 0, IFNAMSIZ);
+			strncpy(im->name, ifname, IFNAMSIZ - 1);
+			im->hash = namehash(im->name);
+			if (ll_name_insert(entry) < 0)
+				ll_forget(entry);
 		}
 
 		im->flags = ifi->ifi_flags;
 		return 0;
 	}
 
-	im = malloc(sizeof(*im) + strlen(ifname) + 1);
-	if (im == NULL)
+	entry = ll_entry_alloc();
+	if (entry == LL_EMPTY)
 		return 0;
+	im = ll_entry(entry);
 	im->index = ifi->ifi_index;
-	strcpy(im->name, ifname);
+	memset(im->name, 0, IFNAMSIZ);
+	strncpy(im->name, ifname, IFNAMSIZ - 1);
+	im->hash = namehash(im->name);
 	im->type = ifi->ifi_type;
 	im->flags = ifi->ifi_flags;
+	ll_count++;
 
-	h = ifi->ifi_index & (IDXMAP_SIZE - 1);
-	hlist_add_head(&im->idx_hash, &idx_head[h]);
-
-	h = namehash(ifname) & (IDXMAP_SIZE - 1);
-	hlist_add_head(&im->name_hash, &name_head[h]);
+	if (ll_idx_insert(im->index, entry) < 0) {
+		ll_entry_free(entry);
+		ll_count--;
+		return 0;
+	}
+	if (ll_name_insert(entry) < 0) {
+		ll_idx_remove(im->index);
+		ll_entry_free(entry);
+		ll_count--;
+	}
 
 	return 0;
 }
 
 const char *ll_idx_n2a(unsigned int idx)
 {
-	static char buf[IFNAMSIZ];
+	static __thread char buf[IFNAMSIZ];
 
 	snprintf(buf, sizeof(buf), "if%u", idx);
 	return buf;
@@ -153,15 +439,70 @@ unsigned int ll_idx_a2n(const char *name)
 	return idx;
 }
 
+/*
+ * Resolve a single link with a targeted RTM_GETLINK and cache the answer,
+ * so that callers needing one or two names don't have to dump every link
+ * through ll_init_map(). The query socket is private: the callers' handle
+ * may be in the middle of a dump, and the watch socket must not have its
+ * notifications skipped by rtnl_talk().
+ */
+static __thread struct rtnl_handle ll_query = { .fd = -1 };
+
+static int ll_link_get(const char *name, unsigned index)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	ifm;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETLINK,
+		.ifm.ifi_index = index,
+	};
+	__u32 filt_mask = RTEXT_FILTER_SKIP_STATS;
+	struct nlmsghdr *answer;
+	int ret;
+
+	if (ll_query.fd < 0 && rtnl_open(&ll_query, 0) < 0)
+		return -1;
+
+	if (name) {
+		if (strlen(name) >= IFNAMSIZ)
+			return -1;
+		addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name,
+			  strlen(name) + 1);
+	}
+	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK, filt_mask);
+
+	if (rtnl_talk_suppress_rtnl_errmsg(&ll_query, &req.n, &answer) < 0)
+		return -1;
+
+	ret = ll_remember_index(NULL, answer, NULL);
+	if (ret == 0)
+		ret = ((struct ifinfomsg *)NLMSG_DATA(answer))->ifi_index;
+	free(answer);
+	return ret;
+}
+
+static struct ll_cache *ll_lookup_index(unsigned index)
+{
+	struct ll_cache *im = ll_get_by_index(index);
+
+	if (im == NULL && ll_link_get(NULL, index) > 0)
+		im = ll_get_by_index(index);
+	return im;
+}
+
 const char *ll_index_to_name(unsigned int idx)
 {
-	static char buf[IFNAMSIZ];
+	static __thread char buf[IFNAMSIZ];
 	const struct ll_cache *im;
 
 	if (idx == 0)
 		return "*";
 
-	im = ll_get_by_index(idx);
+	im = ll_lookup_index(idx);
 	if (im)
 		return im->name;
 
@@ -178,7 +519,7 @@ int ll_index_to_type(unsigned idx)
 	if (idx == 0)
 		return -1;
 
-	im = ll_get_by_index(idx);
+	im = ll_lookup_index(idx);
 	return im ? im->type : -1;
 }
 
@@ -189,10 +530,60 @@ int ll_index_to_flags(unsigned idx)
 	if (idx == 0)
 		return 0;
 
-	im = ll_get_by_index(idx);
+	im = ll_lookup_index(idx);
 	return im ? im->flags : -1;
 }
 
+static __thread int ll_symbolic;
+static __thread unsigned ll_nsyms;
+
+void ll_set_symbolic(int on)
+{
+	ll_symbolic = on;
+}
+
+unsigned int ll_sym_count(void)
+{
+	return ll_nsyms;
+}
+
+const char *ll_sym_name(unsigned int idx)
+{
+	const struct ll_cache *im;
+
+	if (idx < LL_SYM_BASE || idx - LL_SYM_BASE >= ll_nsyms)
+		return NULL;
+	im = ll_get_by_index(idx);
+	return im ? im->name : NULL;
+}
+
+/* enter the name like a link the kernel told us about */
+static unsigned ll_sym_add(const char *name)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	ifm;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_type = RTM_NEWLINK,
+		.ifm.ifi_type = ARPHRD_VOID,
+	};
+	unsigned idx = LL_SYM_BASE + ll_nsyms;
+
+	if (strlen(name) >= IFNAMSIZ || ll_nsyms == LL_SYM_MAX)
+		return 0;
+
+	req.ifm.ifi_index = idx;
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name, strlen(name) + 1);
+	ll_remember_index(NULL, &req.n, NULL);
+	if (!ll_get_by_index(idx))
+		return 0;
+
+	ll_nsyms++;
+	return idx;
+}
+
 unsigned ll_name_to_index(const char *name)
 {
 	const struct ll_cache *im;
@@ -205,16 +596,56 @@ unsigned ll_name_to_index(const char *name)
 	if (im)
 		return im->index;
 
+	if (ll_symbolic)
+		return ll_sym_add(name);
+
+	if (ll_link_get(name, 0) > 0) {
+		im = ll_get_by_name(name);
+		if (im)
+			return im->index;
+	}
+
 	idx = if_nametoindex(name);
 	if (idx == 0)
 		idx = ll_idx_a2n(name);
 	return idx;
 }
 
-int ll_init_map(struct rtnl_handle *rth)
+static int ll_index_cmp(const void *a, const void *b)
+{
+	unsigned int ia = *(const unsigned int *)a;
+	unsigned int ib = *(const unsigned int *)b;
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+/* the indexes of the links in the cache, ascending, for free() */
+unsigned int *ll_index_list(unsigned int *count)
 {
-	static int initialized;
+	unsigned int *list, n = 0;
+	int entry;
 
+	list = malloc((ll_count ? ll_count : 1) * sizeof(*list));
+	if (!list)
+		return NULL;
+
+	/* free entries are those the index no longer leads to */
+	for (entry = 0; entry < ll_nentries && n < ll_count; entry++) {
+		struct ll_cache *im = ll_entry(entry);
+
+		if (ll_find_index(im->index) == entry)
+			list[n++] = im->index;
+	}
+
+	qsort(list, n, sizeof(*list), ll_index_cmp);
+	*count = n;
+	return list;
+}
+
+static __thread int initialized;
+
+int ll_init_map(struct rtnl_handle *rth)
+{
 	if (initialized)
 		return 0;
 
@@ -231,3 +662,90 @@ int ll_init_map(struct rtnl_handle *rth)
 	initialized = 1;
 	return 0;
 }
+
+/*
+ * Optional link notification socket keeping the cache current for
+ * long-running users, e.g. batch mode, without dumping all links again.
+ */
+static __thread struct rtnl_handle ll_watch = { .fd = -1 };
+
+static void ll_drop_map(void)
+{
+	unsigned i;
+
+	for (i = 0; i < name_tab.size; i++)
+		name_tab.slots[i].entry = LL_EMPTY;
+	name_tab.used = 0;
+	for (i = 0; i < idx_tab.size; i++)
+		idx_tab.slots[i].entry = LL_EMPTY;
+	idx_tab.used = 0;
+	for (i = 0; i < idx_direct_len; i++)
+		idx_direct[i] = LL_EMPTY;
+
+	ll_nentries = 0;
+	ll_free = LL_EMPTY;
+	ll_count = 0;
+	initialized = 0;
+}
+
+int ll_watch_map(void)
+{
+	if (ll_watch.fd >= 0)
+		return 0;
+
+	if (rtnl_open(&ll_watch, RTMGRP_LINK) < 0)
+		return -1;
+
+	fcntl(ll_watch.fd, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+/*
+ * Apply the link changes queued on the watch socket. If some were lost,
+ * start over, re-dumping on rth if the full map had been loaded before.
+ */
+void ll_sync_map(struct rtnl_handle *rth)
+{
+	static __thread char *buf;
+	static __thread int buflen;
+	int was_initialized;
+
+	if (ll_watch.fd < 0)
+		return;
+
+	for (;;) {
+		struct nlmsghdr *h;
+		int len;
+
+		len = recv(ll_watch.fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS)
+				break;
+			return;
+		}
+
+		if (len > buflen) {
+			char *nbuf = realloc(buf, len);
+
+			if (!nbuf)
+				return;
+			buf = nbuf;
+			buflen = len;
+		}
+
+		len = recv(ll_watch.fd, buf, buflen, 0);
+		if (len <= 0)
+			return;
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+		     h = NLMSG_NEXT(h, len))
+			ll_remember_index(NULL, h, NULL);
+	}
+
+	was_initialized = initialized;
+	ll_drop_map();
+	if (was_initialized && rth)
+		ll_init_map(rth);
+}
@@ -14,6 +14,7 @@
 
 #include "utils.h"
 #include "namespace.h"
+#include "jobs.h"
 
 static void bind_etc(const char *name)
 {
@@ -143,3 +144,115 @@ int netns_foreach(int (*func)(char *nsname, void *arg), void *arg)
 	closedir(dir);
 	return 0;
 }
+
+void netns_names_free(char **names, unsigned int count)
+{
+	while (count)
+		free(names[--count]);
+	free(names);
+}
+
+static int netns_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* the names under NETNS_RUN_DIR, sorted, for netns_names_free() */
+char **netns_names(unsigned int *count)
+{
+	struct dirent *entry;
+	char **names = NULL;
+	unsigned int n = 0, max = 0;
+	DIR *dir;
+
+	dir = opendir(NETNS_RUN_DIR);
+	if (!dir)
+		return NULL;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0)
+			continue;
+		if (strcmp(entry->d_name, "..") == 0)
+			continue;
+		if (n == max) {
+			char **p;
+
+			max = max ? 2 * max : 64;
+			p = realloc(names, max * sizeof(*names));
+			if (!p)
+				goto err;
+			names = p;
+		}
+		names[n] = strdup(entry->d_name);
+		if (!names[n])
+			goto err;
+		n++;
+	}
+	closedir(dir);
+
+	qsort(names, n, sizeof(*names), netns_name_cmp);
+	*count = n;
+	return names ? names : calloc(1, sizeof(*names));
+
+err:
+	netns_names_free(names, n);
+	closedir(dir);
+	return NULL;
+}
+
+struct netns_jobs {
+	char	**names;
+	int	(*func)(char *nsname, void *arg);
+	void	*arg;
+	bool	show_label;
+};
+
+static int netns_job_run(unsigned int first, unsigned int count, void *arg)
+{
+	struct netns_jobs *n = arg;
+
+	if (netns_switch(n->names[first]))
+		return 1;
+	return n->func(n->names[first], n->arg);
+}
+
+static void netns_job_emit(unsigned int first, void *arg)
+{
+	struct netns_jobs *n = arg;
+
+	if (n->show_label)
+		printf("\nnetns: %s\n", n->names[first]);
+}
+
+static const struct jobs_ops netns_jobs_ops = {
+	.run	= netns_job_run,
+	.emit	= netns_job_emit,
+};
+
+/*
+ * Like netns_foreach(), but func runs in a child switched to the
+ * namespace, and up to jobs children run at a time. The caller's own
+ * namespaces are left alone. The output of the children, stderr too,
+ * comes out in namespace name order, labelled like do_each_netns() does
+ * if show_label is set. func's return value is the child's exit status
+ * and does not stop the others.
+ */
+int netns_foreach_jobs(int (*func)(char *nsname, void *arg), void *arg,
+		       unsigned int jobs, bool show_label)
+{
+	struct netns_jobs n = {
+		.func		= func,
+		.arg		= arg,
+		.show_label	= show_label,
+	};
+	unsigned int count;
+	int ret;
+
+	n.names = netns_names(&count);
+	if (!n.names)
+		return -1;
+
+	ret = jobs_run(count, 1, jobs, &netns_jobs_ops, &n, JOBS_F_STDERR);
+	netns_names_free(n.names, count);
+	return ret < 0 ? -1 : 0;
+}
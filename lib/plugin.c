@@ -0,0 +1,160 @@
+/*
+ * plugin.c	Lookup cache for the dynamically resolved kind helpers.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plugin.h"
+
+struct plugin_entry {
+	char		*id;		/* NULL if free */
+	void		*util;		/* NULL if the kind has none */
+};
+
+static unsigned int plugin_hash(const char *id)
+{
+	unsigned int h = 2166136261U;
+
+	while (*id)
+		h = (h ^ (unsigned char)*id++) * 16777619U;
+	return h;
+}
+
+static struct plugin_entry *plugin_slot(struct plugin_entry *table,
+					unsigned int size, const char *id)
+{
+	unsigned int i = plugin_hash(id);
+
+	for (;; i++) {
+		struct plugin_entry *e = &table[i & (size - 1)];
+
+		if (!e->id || strcmp(e->id, id) == 0)
+			return e;
+	}
+}
+
+void plugin_lock(struct plugin_cache *pc)
+{
+	pthread_mutex_lock(&pc->lock);
+}
+
+void plugin_unlock(struct plugin_cache *pc)
+{
+	pthread_mutex_unlock(&pc->lock);
+}
+
+bool plugin_find(const struct plugin_cache *pc, const char *id, void **util)
+{
+	struct plugin_entry *e;
+
+	if (!pc->table)
+		return false;
+
+	e = plugin_slot(pc->table, pc->size, id);
+	if (!e->id)
+		return false;
+	*util = e->util;
+	return true;
+}
+
+static int plugin_grow(struct plugin_cache *pc)
+{
+	unsigned int size = pc->size ? 2 * pc->size : 64;
+	struct plugin_entry *table;
+	unsigned int i;
+
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return -1;
+
+	for (i = 0; i < pc->size; i++) {
+		struct plugin_entry *e = &pc->table[i];
+
+		if (e->id)
+			*plugin_slot(table, size, e->id) = *e;
+	}
+	free(pc->table);
+	pc->table = table;
+	pc->size = size;
+	return 0;
+}
+
+/* a failure only costs the lookup being repeated next time */
+void plugin_add(struct plugin_cache *pc, const char *id, void *util)
+{
+	struct plugin_entry *e;
+
+	if (2 * (pc->count + 1) > pc->size && plugin_grow(pc) < 0)
+		return;
+
+	e = plugin_slot(pc->table, pc->size, id);
+	if (!e->id) {
+		e->id = strdup(id);
+		if (!e->id)
+			return;
+		pc->count++;
+	}
+	e->util = util;
+}
+
+static int plugin_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void plugin_scan(struct plugin_cache *pc, const char *dir)
+{
+	unsigned int max = 0;
+	struct dirent *de;
+	DIR *d;
+
+	pc->scanned = true;
+	d = opendir(dir);
+	if (!d)
+		return;
+
+	while ((de = readdir(d)) != NULL) {
+		size_t len = strlen(de->d_name);
+		char *name;
+
+		if (len < 3 || strcmp(de->d_name + len - 3, ".so"))
+			continue;
+
+		if (pc->nfiles == max) {
+			char **files;
+
+			max = max ? 2 * max : 16;
+			files = realloc(pc->files, max * sizeof(*files));
+			if (!files)
+				break;
+			pc->files = files;
+		}
+		name = strdup(de->d_name);
+		if (!name)
+			break;
+		pc->files[pc->nfiles++] = name;
+	}
+	closedir(d);
+
+	if (pc->nfiles)
+		qsort(pc->files, pc->nfiles, sizeof(*pc->files), plugin_cmp);
+}
+
+/* whether dir, listed once and for all on the first call, holds file */
+bool plugin_dir_has(struct plugin_cache *pc, const char *dir,
+		    const char *file)
+{
+	if (!pc->scanned)
+		plugin_scan(pc, dir);
+
+	return pc->nfiles &&
+		bsearch(&file, pc->files, pc->nfiles, sizeof(*pc->files),
+			plugin_cmp) != NULL;
+}
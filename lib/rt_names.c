@@ -14,8 +14,11 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <limits.h>
 
@@ -58,7 +61,7 @@ static int fread_id_name(FILE *fp, int *id, char *namebuf)
 	return 0;
 }
 
-static void
+static int
 rtnl_hash_initialize(const char *file, struct rtnl_hash_entry **hash, int size)
 {
 	struct rtnl_hash_entry *entry;
@@ -69,14 +72,14 @@ rtnl_hash_initialize(const char *file, struct rtnl_hash_entry **hash, int size)
 
 	fp = fopen(file, "r");
 	if (!fp)
-		return;
+		return 0;
 
 	while ((ret = fread_id_name(fp, &id, &namebuf[0]))) {
 		if (ret == -1) {
 			fprintf(stderr, "Database %s is corrupted at %s\n",
 					file, namebuf);
 			fclose(fp);
-			return;
+			return -1;
 		}
 
 		if (id < 0)
@@ -89,9 +92,10 @@ rtnl_hash_initialize(const char *file, struct rtnl_hash_entry **hash, int size)
 		hash[id & (size - 1)] = entry;
 	}
 	fclose(fp);
+	return 0;
 }
 
-static void rtnl_tab_initialize(const char *file, char **tab, int size)
+static int rtnl_tab_initialize(const char *file, char **tab, int size)
 {
 	FILE *fp;
 	int id;
@@ -100,57 +104,162 @@ static void rtnl_tab_initialize(const char *file, char **tab, int size)
 
 	fp = fopen(file, "r");
 	if (!fp)
-		return;
+		return 0;
 
 	while ((ret = fread_id_name(fp, &id, &namebuf[0]))) {
 		if (ret == -1) {
 			fprintf(stderr, "Database %s is corrupted at %s\n",
 					file, namebuf);
 			fclose(fp);
-			return;
+			return -1;
 		}
-		if (id < 0 || id > size)
+		if (id < 0 || id >= size)
 			continue;
 
 		tab[id] = strdup(namebuf);
 	}
 	fclose(fp);
+	return 0;
 }
 
-static char *rtnl_rtprot_tab[256] = {
-	[RTPROT_UNSPEC]   = "unspec",
-	[RTPROT_REDIRECT] = "redirect",
-	[RTPROT_KERNEL]	  = "kernel",
-	[RTPROT_BOOT]	  = "boot",
-	[RTPROT_STATIC]	  = "static",
 
-	[RTPROT_GATED]	  = "gated",
-	[RTPROT_RA]	  = "ra",
-	[RTPROT_MRT]	  = "mrt",
-	[RTPROT_ZEBRA]	  = "zebra",
-	[RTPROT_BIRD]	  = "bird",
-	[RTPROT_BABEL]	  = "babel",
-	[RTPROT_DNROUTED] = "dnrouted",
-	[RTPROT_XORP]	  = "xorp",
-	[RTPROT_NTK]	  = "ntk",
-	[RTPROT_DHCP]	  = "dhcp",
+/*
+ * Each names DB is a main file, optionally a directory of *.conf
+ * fragments, and the builtin entries. Once parsed it is compiled into a
+ * flat image of two hash tables (id -> name, name -> id) that is saved
+ * under NAMES_CACHEDIR and mmap'd by later runs, as long as none of
+ * the sources changed since.
+ */
+struct rtnl_db {
+	const char		*file;
+	const char		*dir;
+	const char		*cache;
+	char			**tab;
+	struct rtnl_hash_entry	**hash;
+	int			size;
+	int			init;
+	struct rtnl_names_hdr	*img;
 };
 
+#define RTNL_NAMES_MAGIC	0x4e4c5452
+#define RTNL_NAMES_VERSION	1
+
+struct rtnl_names_hdr {
+	__u32	magic;
+	__u32	version;
+	__u64	key;
+	__u32	nbuckets;
+	__u32	nentries;
+	__u32	strsize;
+	__u32	pad;
+	/*
+	 * followed by __u32 id_heads[nbuckets], __u32 name_heads[nbuckets],
+	 * struct rtnl_names_ent ents[nentries] and char strs[strsize].
+	 * Chains hold entry numbers plus one, zero terminates them.
+	 */
+};
 
-static int rtnl_rtprot_init;
+struct rtnl_names_ent {
+	__u32	id;
+	__u32	name;
+	__u32	id_next;
+	__u32	name_next;
+};
 
-static void rtnl_rtprot_initialize(void)
+static __u32 *img_heads(const struct rtnl_names_hdr *h)
+{
+	return (__u32 *)(h + 1);
+}
+
+static struct rtnl_names_ent *img_ents(const struct rtnl_names_hdr *h)
+{
+	return (struct rtnl_names_ent *)(img_heads(h) + 2 * h->nbuckets);
+}
+
+static char *img_strs(const struct rtnl_names_hdr *h)
+{
+	return (char *)(img_ents(h) + h->nentries);
+}
+
+static size_t img_size(__u32 nbuckets, __u32 nentries, __u32 strsize)
+{
+	return sizeof(struct rtnl_names_hdr) + 2 * nbuckets * sizeof(__u32) +
+		nentries * sizeof(struct rtnl_names_ent) + strsize;
+}
+
+static __u32 strhash(const char *str)
+{
+	__u32 hash = 2166136261u;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static const struct rtnl_names_ent *
+img_find_id(const struct rtnl_names_hdr *h, __u32 id)
+{
+	const struct rtnl_names_ent *ents = img_ents(h);
+	__u32 i, n = 0;
+
+	for (i = img_heads(h)[id & (h->nbuckets - 1)];
+	     i && n < h->nentries; i = ents[i - 1].id_next, n++) {
+		if (ents[i - 1].id == id)
+			return &ents[i - 1];
+	}
+	return NULL;
+}
+
+static const struct rtnl_names_ent *
+img_find_name(const struct rtnl_names_hdr *h, const char *name)
+{
+	const struct rtnl_names_ent *ents = img_ents(h);
+	const char *strs = img_strs(h);
+	__u32 i, n = 0;
+
+	for (i = img_heads(h)[h->nbuckets + (strhash(name) & (h->nbuckets - 1))];
+	     i && n < h->nentries; i = ents[i - 1].name_next, n++) {
+		if (strcmp(strs + ents[i - 1].name, name) == 0)
+			return &ents[i - 1];
+	}
+	return NULL;
+}
+
+/* Entries of the parsed tables, in the order the plain lookups see them */
+static void rtnl_db_walk(const struct rtnl_db *db,
+			 void (*fn)(void *arg, __u32 id, const char *name),
+			 void *arg)
+{
+	struct rtnl_hash_entry *entry;
+	int i;
+
+	for (i = 0; i < db->size; i++) {
+		if (db->tab) {
+			if (db->tab[i])
+				fn(arg, i, db->tab[i]);
+			continue;
+		}
+		for (entry = db->hash[i]; entry; entry = entry->next)
+			fn(arg, entry->id, entry->name);
+	}
+}
+
+static int rtnl_db_sources(const struct rtnl_db *db,
+			   int (*fn)(void *arg, const char *path), void *arg)
 {
 	struct dirent *de;
+	int ret;
 	DIR *d;
 
-	rtnl_rtprot_init = 1;
-	rtnl_tab_initialize(CONFDIR "/rt_protos",
-			    rtnl_rtprot_tab, 256);
+	ret = fn(arg, db->file);
+	if (!db->dir)
+		return ret;
 
-	d = opendir(CONFDIR "/rt_protos.d");
+	d = opendir(db->dir);
 	if (!d)
-		return;
+		return ret;
 
 	while ((de = readdir(d)) != NULL) {
 		char path[PATH_MAX];
@@ -166,52 +275,405 @@ static void rtnl_rtprot_initialize(void)
 		if (strcmp(de->d_name + len - 5, ".conf"))
 			continue;
 
-		snprintf(path, sizeof(path), CONFDIR "/rt_protos.d/%s",
-			 de->d_name);
-		rtnl_tab_initialize(path, rtnl_rtprot_tab, 256);
+		snprintf(path, sizeof(path), "%s/%s", db->dir, de->d_name);
+		if (fn(arg, path) < 0)
+			ret = -1;
 	}
 	closedir(d);
+	return ret;
+}
+
+static __u64 fnv64(__u64 hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static void key_entry(void *arg, __u32 id, const char *name)
+{
+	__u64 *key = arg;
+
+	*key = fnv64(*key, &id, sizeof(id));
+	*key = fnv64(*key, name, strlen(name) + 1);
+}
+
+static int key_source(void *arg, const char *path)
+{
+	__u64 *key = arg;
+	struct stat st;
+	__u64 v[7] = {};
+
+	if (stat(path, &st) == 0) {
+		v[0] = st.st_dev;
+		v[1] = st.st_ino;
+		v[2] = st.st_size;
+		v[3] = st.st_mtim.tv_sec;
+		v[4] = st.st_mtim.tv_nsec;
+		v[5] = st.st_ctim.tv_sec;
+		v[6] = st.st_ctim.tv_nsec;
+	}
+	*key = fnv64(*key, path, strlen(path) + 1);
+	*key = fnv64(*key, v, sizeof(v));
+	return 0;
+}
+
+/* Identifies the builtin entries and the state of every source file */
+static __u64 rtnl_db_key(const struct rtnl_db *db)
+{
+	__u64 key = 14695981039346656037ull;
+	__u32 version = RTNL_NAMES_VERSION;
+
+	key = fnv64(key, &version, sizeof(version));
+	rtnl_db_walk(db, key_entry, &key);
+	if (db->dir)
+		key_source(&key, db->dir);
+	rtnl_db_sources(db, key_source, &key);
+	return key;
+}
+
+static int parse_source(void *arg, const char *path)
+{
+	struct rtnl_db *db = arg;
+
+	if (db->tab)
+		return rtnl_tab_initialize(path, db->tab, db->size);
+	return rtnl_hash_initialize(path, db->hash, db->size);
+}
+
+struct rtnl_names_build {
+	struct rtnl_names_hdr	*h;
+	__u32			count;
+	__u32			strsize;
+	__u32			used;
+	__u32			strused;
+};
+
+static void build_count(void *arg, __u32 id, const char *name)
+{
+	struct rtnl_names_build *b = arg;
+
+	b->count++;
+	b->strsize += strlen(name) + 1;
+}
+
+/* Keep the first entry seen for each id and for each name */
+static void build_entry(void *arg, __u32 id, const char *name)
+{
+	struct rtnl_names_build *b = arg;
+	struct rtnl_names_hdr *h = b->h;
+	struct rtnl_names_ent *e;
+	__u32 *heads = img_heads(h);
+	int new_id = !img_find_id(h, id);
+	int new_name = !img_find_name(h, name);
+	size_t len = strlen(name) + 1;
+
+	if (!new_id && !new_name)
+		return;
+
+	e = &img_ents(h)[b->used++];
+	e->id = id;
+	e->name = b->strused;
+	memcpy(img_strs(h) + b->strused, name, len);
+	b->strused += len;
+
+	if (new_id) {
+		__u32 *head = &heads[id & (h->nbuckets - 1)];
+
+		e->id_next = *head;
+		*head = b->used;
+	}
+	if (new_name) {
+		__u32 *head = &heads[h->nbuckets +
+				     (strhash(name) & (h->nbuckets - 1))];
+
+		e->name_next = *head;
+		*head = b->used;
+	}
+}
+
+static struct rtnl_names_hdr *rtnl_db_build(const struct rtnl_db *db,
+					     __u64 key, size_t *lenp)
+{
+	struct rtnl_names_build b = {};
+	struct rtnl_names_hdr *h;
+	__u32 nbuckets = 16;
+
+	rtnl_db_walk(db, build_count, &b);
+	while (nbuckets < b.count)
+		nbuckets <<= 1;
+
+	h = calloc(1, img_size(nbuckets, b.count, b.strsize));
+	if (!h)
+		return NULL;
+
+	h->magic = RTNL_NAMES_MAGIC;
+	h->version = RTNL_NAMES_VERSION;
+	h->key = key;
+	h->nbuckets = nbuckets;
+	h->nentries = b.count;
+	h->strsize = b.strsize;
+
+	b.h = h;
+	rtnl_db_walk(db, build_entry, &b);
+
+	/* trim the unused entries, the strings follow the used ones */
+	memmove(img_ents(h) + b.used, img_strs(h), b.strused);
+	h->nentries = b.used;
+	h->strsize = b.strused;
+
+	*lenp = img_size(h->nbuckets, h->nentries, h->strsize);
+	return h;
+}
+
+static int rtnl_db_valid(const struct rtnl_names_hdr *h, size_t len)
+{
+	const struct rtnl_names_ent *ents;
+	const __u32 *heads;
+	__u32 i;
+
+	if (len < sizeof(*h) ||
+	    h->magic != RTNL_NAMES_MAGIC ||
+	    h->version != RTNL_NAMES_VERSION ||
+	    !h->nbuckets || (h->nbuckets & (h->nbuckets - 1)) ||
+	    h->nbuckets > len || h->nentries > len || h->strsize > len ||
+	    img_size(h->nbuckets, h->nentries, h->strsize) != len)
+		return 0;
+
+	if (h->strsize && img_strs(h)[h->strsize - 1] != '\0')
+		return 0;
+
+	heads = img_heads(h);
+	for (i = 0; i < 2 * h->nbuckets; i++)
+		if (heads[i] > h->nentries)
+			return 0;
+
+	ents = img_ents(h);
+	for (i = 0; i < h->nentries; i++)
+		if (ents[i].name >= h->strsize ||
+		    ents[i].id_next > h->nentries ||
+		    ents[i].name_next > h->nentries)
+			return 0;
+
+	return 1;
+}
+
+static int rtnl_db_map(struct rtnl_db *db, __u64 key)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	void *img;
+	int fd;
+
+	snprintf(path, sizeof(path), NAMES_CACHEDIR "/%s", db->cache);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    (st.st_uid != 0 && st.st_uid != geteuid()) ||
+	    st.st_size < (off_t)sizeof(struct rtnl_names_hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (img == MAP_FAILED)
+		return -1;
+
+	if (!rtnl_db_valid(img, st.st_size) ||
+	    ((struct rtnl_names_hdr *)img)->key != key) {
+		munmap(img, st.st_size);
+		return -1;
+	}
+
+	db->img = img;
+	return 0;
+}
+
+/* Best effort, the cache is only an optimization */
+static void rtnl_db_store(const struct rtnl_db *db,
+			  const struct rtnl_names_hdr *h, size_t len)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	int fd, ok;
+
+	if (mkdir(NAMES_CACHEDIR, 0755) < 0 && errno != EEXIST)
+		return;
+
+	snprintf(path, sizeof(path), NAMES_CACHEDIR "/%s", db->cache);
+	snprintf(tmp, sizeof(tmp), NAMES_CACHEDIR "/%s.XXXXXX", db->cache);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+
+	ok = write(fd, h, len) == (ssize_t)len && fchmod(fd, 0644) == 0;
+	if (close(fd) < 0)
+		ok = 0;
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+static void rtnl_db_init(struct rtnl_db *db)
+{
+	struct rtnl_names_hdr *h;
+	__u64 key;
+	size_t len;
+	int ret;
+
+	if (db->init)
+		return;
+	db->init = 1;
+
+	key = rtnl_db_key(db);
+	if (rtnl_db_map(db, key) == 0)
+		return;
+
+	ret = rtnl_db_sources(db, parse_source, db);
+
+	/*
+	 * Index what was parsed even if a file is corrupted, so that
+	 * lookups never fall back to scanning the tables, but only save
+	 * good images: the corruption must be reported on every run.
+	 */
+	h = rtnl_db_build(db, key, &len);
+	if (!h)
+		return;
+
+	if (ret == 0)
+		rtnl_db_store(db, h, len);
+	db->img = h;
+}
+
+static const char *rtnl_db_id2name(const struct rtnl_db *db, __u32 id)
+{
+	struct rtnl_hash_entry *entry;
+	const struct rtnl_names_ent *e;
+
+	if (db->img) {
+		e = img_find_id(db->img, id);
+		return e ? img_strs(db->img) + e->name : NULL;
+	}
+
+	if (db->tab)
+		return id < (__u32)db->size ? db->tab[id] : NULL;
+
+	for (entry = db->hash[id & (db->size - 1)]; entry; entry = entry->next)
+		if (entry->id == id)
+			return entry->name;
+	return NULL;
+}
+
+static const char *rtnl_db_name2id(const struct rtnl_db *db,
+				   const char *name, __u32 *id)
+{
+	struct rtnl_hash_entry *entry;
+	const struct rtnl_names_ent *e;
+	int i;
+
+	if (db->img) {
+		e = img_find_name(db->img, name);
+		if (!e)
+			return NULL;
+		*id = e->id;
+		return img_strs(db->img) + e->name;
+	}
+
+	for (i = 0; i < db->size; i++) {
+		if (db->tab) {
+			if (db->tab[i] && strcmp(db->tab[i], name) == 0) {
+				*id = i;
+				return db->tab[i];
+			}
+			continue;
+		}
+		for (entry = db->hash[i]; entry; entry = entry->next)
+			if (strcmp(entry->name, name) == 0) {
+				*id = entry->id;
+				return entry->name;
+			}
+	}
+	return NULL;
+}
+
+static char *rtnl_rtprot_tab[256] = {
+	[RTPROT_UNSPEC]   = "unspec",
+	[RTPROT_REDIRECT] = "redirect",
+	[RTPROT_KERNEL]	  = "kernel",
+	[RTPROT_BOOT]	  = "boot",
+	[RTPROT_STATIC]	  = "static",
+
+	[RTPROT_GATED]	  = "gated",
+	[RTPROT_RA]	  = "ra",
+	[RTPROT_MRT]	  = "mrt",
+	[RTPROT_ZEBRA]	  = "zebra",
+	[RTPROT_BIRD]	  = "bird",
+	[RTPROT_BABEL]	  = "babel",
+	[RTPROT_DNROUTED] = "dnrouted",
+	[RTPROT_XORP]	  = "xorp",
+	[RTPROT_NTK]	  = "ntk",
+	[RTPROT_DHCP]	  = "dhcp",
+};
+
+static __thread struct rtnl_db rtnl_rtprot_db = {
+	.file	= CONFDIR "/rt_protos",
+	.dir	= CONFDIR "/rt_protos.d",
+	.cache	= "rt_protos",
+	.tab	= rtnl_rtprot_tab,
+	.size	= 256,
+};
+
+/* Builtin names are used without reading the DB */
+static const char *rtnl_tab_n2a(struct rtnl_db *db, int id)
+{
+	const char *name = rtnl_db_id2name(db, id);
+
+	if (!name && !db->init) {
+		rtnl_db_init(db);
+		name = rtnl_db_id2name(db, id);
+	}
+	return name;
 }
 
 const char *rtnl_rtprot_n2a(int id, char *buf, int len)
 {
+	const char *name;
+
 	if (id < 0 || id >= 256) {
 		snprintf(buf, len, "%u", id);
 		return buf;
 	}
-	if (!rtnl_rtprot_tab[id]) {
-		if (!rtnl_rtprot_init)
-			rtnl_rtprot_initialize();
-	}
-	if (rtnl_rtprot_tab[id])
-		return rtnl_rtprot_tab[id];
+	name = rtnl_tab_n2a(&rtnl_rtprot_db, id);
+	if (name)
+		return name;
 	snprintf(buf, len, "%u", id);
 	return buf;
 }
 
 int rtnl_rtprot_a2n(__u32 *id, const char *arg)
 {
-	static char *cache;
-	static unsigned long res;
+	static __thread const char *cache;
+	static __thread unsigned long res;
 	char *end;
-	int i;
+	__u32 i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rtprot_init)
-		rtnl_rtprot_initialize();
+	rtnl_db_init(&rtnl_rtprot_db);
 
-	for (i = 0; i < 256; i++) {
-		if (rtnl_rtprot_tab[i] &&
-		    strcmp(rtnl_rtprot_tab[i], arg) == 0) {
-			cache = rtnl_rtprot_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	cache = rtnl_db_name2id(&rtnl_rtprot_db, arg, &i);
+	if (cache) {
+		res = i;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 0);
@@ -230,29 +692,25 @@ static char *rtnl_rtscope_tab[256] = {
 	[RT_SCOPE_SITE]		= "site",
 };
 
-static int rtnl_rtscope_init;
-
-static void rtnl_rtscope_initialize(void)
-{
-	rtnl_rtscope_init = 1;
-	rtnl_tab_initialize(CONFDIR "/rt_scopes",
-			    rtnl_rtscope_tab, 256);
-}
+static __thread struct rtnl_db rtnl_rtscope_db = {
+	.file	= CONFDIR "/rt_scopes",
+	.cache	= "rt_scopes",
+	.tab	= rtnl_rtscope_tab,
+	.size	= 256,
+};
 
 const char *rtnl_rtscope_n2a(int id, char *buf, int len)
 {
+	const char *name;
+
 	if (id < 0 || id >= 256) {
 		snprintf(buf, len, "%d", id);
 		return buf;
 	}
 
-	if (!rtnl_rtscope_tab[id]) {
-		if (!rtnl_rtscope_init)
-			rtnl_rtscope_initialize();
-	}
-
-	if (rtnl_rtscope_tab[id])
-		return rtnl_rtscope_tab[id];
+	name = rtnl_tab_n2a(&rtnl_rtscope_db, id);
+	if (name)
+		return name;
 
 	snprintf(buf, len, "%d", id);
 	return buf;
@@ -260,27 +718,23 @@ const char *rtnl_rtscope_n2a(int id, char *buf, int len)
 
 int rtnl_rtscope_a2n(__u32 *id, const char *arg)
 {
-	static const char *cache;
-	static unsigned long res;
+	static __thread const char *cache;
+	static __thread unsigned long res;
 	char *end;
-	int i;
+	__u32 i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rtscope_init)
-		rtnl_rtscope_initialize();
+	rtnl_db_init(&rtnl_rtscope_db);
 
-	for (i = 0; i < 256; i++) {
-		if (rtnl_rtscope_tab[i] &&
-		    strcmp(rtnl_rtscope_tab[i], arg) == 0) {
-			cache = rtnl_rtscope_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	cache = rtnl_db_name2id(&rtnl_rtscope_db, arg, &i);
+	if (cache) {
+		res = i;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 0);
@@ -295,27 +749,24 @@ static char *rtnl_rtrealm_tab[256] = {
 	"unknown",
 };
 
-static int rtnl_rtrealm_init;
-
-static void rtnl_rtrealm_initialize(void)
-{
-	rtnl_rtrealm_init = 1;
-	rtnl_tab_initialize(CONFDIR "/rt_realms",
-			    rtnl_rtrealm_tab, 256);
-}
+static __thread struct rtnl_db rtnl_rtrealm_db = {
+	.file	= CONFDIR "/rt_realms",
+	.cache	= "rt_realms",
+	.tab	= rtnl_rtrealm_tab,
+	.size	= 256,
+};
 
 const char *rtnl_rtrealm_n2a(int id, char *buf, int len)
 {
+	const char *name;
+
 	if (id < 0 || id >= 256) {
 		snprintf(buf, len, "%d", id);
 		return buf;
 	}
-	if (!rtnl_rtrealm_tab[id]) {
-		if (!rtnl_rtrealm_init)
-			rtnl_rtrealm_initialize();
-	}
-	if (rtnl_rtrealm_tab[id])
-		return rtnl_rtrealm_tab[id];
+	name = rtnl_tab_n2a(&rtnl_rtrealm_db, id);
+	if (name)
+		return name;
 	snprintf(buf, len, "%d", id);
 	return buf;
 }
@@ -323,27 +774,23 @@ const char *rtnl_rtrealm_n2a(int id, char *buf, int len)
 
 int rtnl_rtrealm_a2n(__u32 *id, const char *arg)
 {
-	static char *cache;
-	static unsigned long res;
+	static __thread const char *cache;
+	static __thread unsigned long res;
 	char *end;
-	int i;
+	__u32 i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rtrealm_init)
-		rtnl_rtrealm_initialize();
+	rtnl_db_init(&rtnl_rtrealm_db);
 
-	for (i = 0; i < 256; i++) {
-		if (rtnl_rtrealm_tab[i] &&
-		    strcmp(rtnl_rtrealm_tab[i], arg) == 0) {
-			cache = rtnl_rtrealm_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	cache = rtnl_db_name2id(&rtnl_rtrealm_db, arg, &i);
+	if (cache) {
+		res = i;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 0);
@@ -354,9 +801,15 @@ int rtnl_rtrealm_a2n(__u32 *id, const char *arg)
 }
 
 
-static struct rtnl_hash_entry dflt_table_entry  = { .name = "default" };
-static struct rtnl_hash_entry main_table_entry  = { .name = "main" };
-static struct rtnl_hash_entry local_table_entry = { .name = "local" };
+static struct rtnl_hash_entry dflt_table_entry  = {
+	.id = RT_TABLE_DEFAULT, .name = "default"
+};
+static struct rtnl_hash_entry main_table_entry  = {
+	.id = RT_TABLE_MAIN, .name = "main"
+};
+static struct rtnl_hash_entry local_table_entry = {
+	.id = RT_TABLE_LOCAL, .name = "local"
+};
 
 static struct rtnl_hash_entry *rtnl_rttable_hash[256] = {
 	[RT_TABLE_DEFAULT] = &dflt_table_entry,
@@ -364,88 +817,46 @@ static struct rtnl_hash_entry *rtnl_rttable_hash[256] = {
 	[RT_TABLE_LOCAL]   = &local_table_entry,
 };
 
-static int rtnl_rttable_init;
-
-static void rtnl_rttable_initialize(void)
-{
-	struct dirent *de;
-	DIR *d;
-	int i;
-
-	rtnl_rttable_init = 1;
-	for (i = 0; i < 256; i++) {
-		if (rtnl_rttable_hash[i])
-			rtnl_rttable_hash[i]->id = i;
-	}
-	rtnl_hash_initialize(CONFDIR "/rt_tables",
-			     rtnl_rttable_hash, 256);
-
-	d = opendir(CONFDIR "/rt_tables.d");
-	if (!d)
-		return;
-
-	while ((de = readdir(d)) != NULL) {
-		char path[PATH_MAX];
-		size_t len;
-
-		if (*de->d_name == '.')
-			continue;
-
-		/* only consider filenames ending in '.conf' */
-		len = strlen(de->d_name);
-		if (len <= 5)
-			continue;
-		if (strcmp(de->d_name + len - 5, ".conf"))
-			continue;
-
-		snprintf(path, sizeof(path),
-			 CONFDIR "/rt_tables.d/%s", de->d_name);
-		rtnl_hash_initialize(path, rtnl_rttable_hash, 256);
-	}
-	closedir(d);
-}
+static __thread struct rtnl_db rtnl_rttable_db = {
+	.file	= CONFDIR "/rt_tables",
+	.dir	= CONFDIR "/rt_tables.d",
+	.cache	= "rt_tables",
+	.hash	= rtnl_rttable_hash,
+	.size	= 256,
+};
 
 const char *rtnl_rttable_n2a(__u32 id, char *buf, int len)
 {
-	struct rtnl_hash_entry *entry;
+	const char *name;
 
-	if (!rtnl_rttable_init)
-		rtnl_rttable_initialize();
-	entry = rtnl_rttable_hash[id & 255];
-	while (entry && entry->id != id)
-		entry = entry->next;
-	if (entry)
-		return entry->name;
+	rtnl_db_init(&rtnl_rttable_db);
+	name = rtnl_db_id2name(&rtnl_rttable_db, id);
+	if (name)
+		return name;
 	snprintf(buf, len, "%u", id);
 	return buf;
 }
 
 int rtnl_rttable_a2n(__u32 *id, const char *arg)
 {
-	static const char *cache;
-	static unsigned long res;
-	struct rtnl_hash_entry *entry;
+	static __thread const char *cache;
+	static __thread unsigned long res;
 	char *end;
 	unsigned long i;
+	__u32 n;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rttable_init)
-		rtnl_rttable_initialize();
+	rtnl_db_init(&rtnl_rttable_db);
 
-	for (i = 0; i < 256; i++) {
-		entry = rtnl_rttable_hash[i];
-		while (entry && strcmp(entry->name, arg))
-			entry = entry->next;
-		if (entry) {
-			cache = entry->name;
-			res = entry->id;
-			*id = res;
-			return 0;
-		}
+	cache = rtnl_db_name2id(&rtnl_rttable_db, arg, &n);
+	if (cache) {
+		res = n;
+		*id = res;
+		return 0;
 	}
 
 	i = strtoul(arg, &end, 0);
@@ -460,27 +871,24 @@ static char *rtnl_rtdsfield_tab[256] = {
 	"0",
 };
 
-static int rtnl_rtdsfield_init;
-
-static void rtnl_rtdsfield_initialize(void)
-{
-	rtnl_rtdsfield_init = 1;
-	rtnl_tab_initialize(CONFDIR "/rt_dsfield",
-			    rtnl_rtdsfield_tab, 256);
-}
+static __thread struct rtnl_db rtnl_rtdsfield_db = {
+	.file	= CONFDIR "/rt_dsfield",
+	.cache	= "rt_dsfield",
+	.tab	= rtnl_rtdsfield_tab,
+	.size	= 256,
+};
 
 const char *rtnl_dsfield_n2a(int id, char *buf, int len)
 {
+	const char *name;
+
 	if (id < 0 || id >= 256) {
 		snprintf(buf, len, "%d", id);
 		return buf;
 	}
-	if (!rtnl_rtdsfield_tab[id]) {
-		if (!rtnl_rtdsfield_init)
-			rtnl_rtdsfield_initialize();
-	}
-	if (rtnl_rtdsfield_tab[id])
-		return rtnl_rtdsfield_tab[id];
+	name = rtnl_tab_n2a(&rtnl_rtdsfield_db, id);
+	if (name)
+		return name;
 	snprintf(buf, len, "0x%02x", id);
 	return buf;
 }
@@ -488,27 +896,23 @@ const char *rtnl_dsfield_n2a(int id, char *buf, int len)
 
 int rtnl_dsfield_a2n(__u32 *id, const char *arg)
 {
-	static char *cache;
-	static unsigned long res;
+	static __thread const char *cache;
+	static __thread unsigned long res;
 	char *end;
-	int i;
+	__u32 i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rtdsfield_init)
-		rtnl_rtdsfield_initialize();
+	rtnl_db_init(&rtnl_rtdsfield_db);
 
-	for (i = 0; i < 256; i++) {
-		if (rtnl_rtdsfield_tab[i] &&
-		    strcmp(rtnl_rtdsfield_tab[i], arg) == 0) {
-			cache = rtnl_rtdsfield_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	cache = rtnl_db_name2id(&rtnl_rtdsfield_db, arg, &i);
+	if (cache) {
+		res = i;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 16);
@@ -527,21 +931,19 @@ static struct rtnl_hash_entry *rtnl_group_hash[256] = {
 	[0] = &dflt_group_entry,
 };
 
-static int rtnl_group_init;
-
-static void rtnl_group_initialize(void)
-{
-	rtnl_group_init = 1;
-	rtnl_hash_initialize(CONFDIR "/group",
-			     rtnl_group_hash, 256);
-}
+static __thread struct rtnl_db rtnl_group_db = {
+	.file	= CONFDIR "/group",
+	.cache	= "group",
+	.hash	= rtnl_group_hash,
+	.size	= 256,
+};
 
 int rtnl_group_a2n(int *id, const char *arg)
 {
-	static const char *cache;
-	static unsigned long res;
-	struct rtnl_hash_entry *entry;
+	static __thread const char *cache;
+	static __thread unsigned long res;
 	char *end;
+	__u32 n;
 	int i;
 
 	if (cache && strcmp(cache, arg) == 0) {
@@ -549,19 +951,13 @@ int rtnl_group_a2n(int *id, const char *arg)
 		return 0;
 	}
 
-	if (!rtnl_group_init)
-		rtnl_group_initialize();
+	rtnl_db_init(&rtnl_group_db);
 
-	for (i = 0; i < 256; i++) {
-		entry = rtnl_group_hash[i];
-		while (entry && strcmp(entry->name, arg))
-			entry = entry->next;
-		if (entry) {
-			cache = entry->name;
-			res = entry->id;
-			*id = res;
-			return 0;
-		}
+	cache = rtnl_db_name2id(&rtnl_group_db, arg, &n);
+	if (cache) {
+		res = n;
+		*id = res;
+		return 0;
 	}
 
 	i = strtol(arg, &end, 0);
@@ -573,21 +969,12 @@ int rtnl_group_a2n(int *id, const char *arg)
 
 const char *rtnl_group_n2a(int id, char *buf, int len)
 {
-	struct rtnl_hash_entry *entry;
-	int i;
-
-	if (!rtnl_group_init)
-		rtnl_group_initialize();
+	const char *name;
 
-	for (i = 0; i < 256; i++) {
-		entry = rtnl_group_hash[i];
-
-		while (entry) {
-			if (entry->id == id)
-				return entry->name;
-			entry = entry->next;
-		}
-	}
+	rtnl_db_init(&rtnl_group_db);
+	name = rtnl_db_id2name(&rtnl_group_db, id);
+	if (name)
+		return name;
 
 	snprintf(buf, len, "%d", id);
 	return buf;
@@ -617,27 +1004,38 @@ static char *nl_proto_tab[256] = {
 	[NETLINK_CRYPTO]         = "crypto",
 };
 
-static int nl_proto_init;
+static __thread struct rtnl_db nl_proto_db = {
+	.file	= CONFDIR "/nl_protos",
+	.cache	= "nl_protos",
+	.tab	= nl_proto_tab,
+	.size	= 256,
+};
 
-static void nl_proto_initialize(void)
+void rtnl_names_preload(void)
 {
-	nl_proto_init = 1;
-	rtnl_tab_initialize(CONFDIR "/nl_protos",
-			    nl_proto_tab, 256);
+	rtnl_db_init(&rtnl_rtprot_db);
+	rtnl_db_init(&rtnl_rtscope_db);
+	rtnl_db_init(&rtnl_rtrealm_db);
+	rtnl_db_init(&rtnl_rttable_db);
+	rtnl_db_init(&rtnl_rtdsfield_db);
+	rtnl_db_init(&rtnl_group_db);
+	rtnl_db_init(&nl_proto_db);
 }
 
 const char *nl_proto_n2a(int id, char *buf, int len)
 {
+	const char *name;
+
 	if (id < 0 || id >= 256) {
 		snprintf(buf, len, "%u", id);
 		return buf;
 	}
 
-	if (!nl_proto_init)
-		nl_proto_initialize();
+	rtnl_db_init(&nl_proto_db);
 
-	if (nl_proto_tab[id])
-		return nl_proto_tab[id];
+	name = rtnl_db_id2name(&nl_proto_db, id);
+	if (name)
+		return name;
 
 	snprintf(buf, len, "%u", id);
 	return buf;
@@ -645,27 +1043,23 @@ const char *nl_proto_n2a(int id, char *buf, int len)
 
 int nl_proto_a2n(__u32 *id, const char *arg)
 {
-	static char *cache;
-	static unsigned long res;
+	static __thread const char *cache;
+	static __thread unsigned long res;
 	char *end;
-	int i;
+	__u32 i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!nl_proto_init)
-		nl_proto_initialize();
+	rtnl_db_init(&nl_proto_db);
 
-	for (i = 0; i < 256; i++) {
-		if (nl_proto_tab[i] &&
-		    strcmp(nl_proto_tab[i], arg) == 0) {
-			cache = nl_proto_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	cache = rtnl_db_name2id(&nl_proto_db, arg, &i);
+	if (cache) {
+		res = i;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 0);
@@ -0,0 +1,321 @@
+/*
+ * rt_records.c		Typed views of rtnetlink messages.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "libnetlink.h"
+#include "rt_records.h"
+
+static const void *rta_data_or_null(const struct rtattr *rta)
+{
+	return rta ? RTA_DATA(rta) : NULL;
+}
+
+static int rt_addr_len(int family, const struct rtattr *rta)
+{
+	switch (family) {
+	case AF_INET:
+		return 4;
+	case AF_INET6:
+		return 16;
+	}
+	return rta ? RTA_PAYLOAD(rta) : 0;
+}
+
+int rt_link_parse(const struct nlmsghdr *n, struct rt_link *l)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	struct rtattr **tb = l->tb;
+
+	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
+		return -1;
+	if (len < 0)
+		return -1;
+
+	memset(l, 0, sizeof(*l));
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+
+	l->n = n;
+	l->ifi = ifi;
+	l->index = ifi->ifi_index;
+	l->flags = ifi->ifi_flags;
+	l->type = ifi->ifi_type;
+	if (tb[IFLA_IFNAME])
+		l->name = rta_getattr_str(tb[IFLA_IFNAME]);
+	if (tb[IFLA_MTU])
+		l->mtu = rta_getattr_u32(tb[IFLA_MTU]);
+	if (tb[IFLA_MASTER])
+		l->master = rta_getattr_u32(tb[IFLA_MASTER]);
+	if (tb[IFLA_LINK])
+		l->link = rta_getattr_u32(tb[IFLA_LINK]);
+	if (tb[IFLA_OPERSTATE])
+		l->operstate = rta_getattr_u8(tb[IFLA_OPERSTATE]);
+	if (tb[IFLA_ADDRESS]) {
+		l->addr = RTA_DATA(tb[IFLA_ADDRESS]);
+		l->addr_len = RTA_PAYLOAD(tb[IFLA_ADDRESS]);
+	}
+	if (tb[IFLA_LINKINFO]) {
+		struct rtattr *linkinfo[IFLA_INFO_MAX + 1];
+
+		parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+		if (linkinfo[IFLA_INFO_KIND])
+			l->kind = rta_getattr_str(linkinfo[IFLA_INFO_KIND]);
+	}
+	if (tb[IFLA_STATS64] &&
+	    RTA_PAYLOAD(tb[IFLA_STATS64]) >= sizeof(*l->stats64))
+		l->stats64 = RTA_DATA(tb[IFLA_STATS64]);
+	return 0;
+}
+
+int rt_addr_parse(const struct nlmsghdr *n, struct rt_addr *a)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+	struct rtattr **tb = a->tb;
+	const struct rtattr *local, *address;
+
+	if (n->nlmsg_type != RTM_NEWADDR && n->nlmsg_type != RTM_DELADDR)
+		return -1;
+	if (len < 0)
+		return -1;
+
+	memset(a, 0, sizeof(*a));
+	parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), len);
+
+	a->n = n;
+	a->ifa = ifa;
+	a->family = ifa->ifa_family;
+	a->index = ifa->ifa_index;
+	a->prefixlen = ifa->ifa_prefixlen;
+	a->scope = ifa->ifa_scope;
+	a->flags = tb[IFA_FLAGS] ? rta_getattr_u32(tb[IFA_FLAGS]) :
+				   ifa->ifa_flags;
+
+	/* as in "ip addr", each stands in for the other if missing */
+	local = tb[IFA_LOCAL] ? : tb[IFA_ADDRESS];
+	address = tb[IFA_ADDRESS] ? : tb[IFA_LOCAL];
+	a->local = rta_data_or_null(local);
+	a->address = rta_data_or_null(address);
+	a->addr_len = rt_addr_len(a->family, local);
+
+	if (tb[IFA_LABEL])
+		a->label = rta_getattr_str(tb[IFA_LABEL]);
+	if (tb[IFA_CACHEINFO] &&
+	    RTA_PAYLOAD(tb[IFA_CACHEINFO]) >= sizeof(*a->cinfo))
+		a->cinfo = RTA_DATA(tb[IFA_CACHEINFO]);
+	return 0;
+}
+
+int rt_route_parse(const struct nlmsghdr *n, struct rt_route *r)
+{
+	struct rtmsg *rtm = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*rtm));
+	struct rtattr **tb = r->tb;
+
+	if (n->nlmsg_type != RTM_NEWROUTE && n->nlmsg_type != RTM_DELROUTE)
+		return -1;
+	if (len < 0)
+		return -1;
+
+	memset(r, 0, sizeof(*r));
+	parse_rtattr_flags(tb, RTA_MAX, RTM_RTA(rtm), len, NLA_F_NESTED);
+
+	r->n = n;
+	r->rtm = rtm;
+	r->family = rtm->rtm_family;
+	r->type = rtm->rtm_type;
+	r->protocol = rtm->rtm_protocol;
+	r->scope = rtm->rtm_scope;
+	r->dst_len = rtm->rtm_dst_len;
+	r->src_len = rtm->rtm_src_len;
+	r->table = tb[RTA_TABLE] ? rta_getattr_u32(tb[RTA_TABLE]) :
+				   rtm->rtm_table;
+	r->dst = rta_data_or_null(tb[RTA_DST]);
+	r->src = rta_data_or_null(tb[RTA_SRC]);
+	r->gateway = rta_data_or_null(tb[RTA_GATEWAY]);
+	r->prefsrc = rta_data_or_null(tb[RTA_PREFSRC]);
+	r->addr_len = rt_addr_len(r->family, tb[RTA_DST] ? : tb[RTA_GATEWAY]);
+	if (tb[RTA_OIF])
+		r->oif = rta_getattr_u32(tb[RTA_OIF]);
+	if (tb[RTA_IIF])
+		r->iif = rta_getattr_u32(tb[RTA_IIF]);
+	if (tb[RTA_PRIORITY])
+		r->priority = rta_getattr_u32(tb[RTA_PRIORITY]);
+	r->multipath = tb[RTA_MULTIPATH];
+	return 0;
+}
+
+int rt_neigh_parse(const struct nlmsghdr *n, struct rt_neigh *nb)
+{
+	struct ndmsg *ndm = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+	struct rtattr **tb = nb->tb;
+
+	if (n->nlmsg_type != RTM_NEWNEIGH && n->nlmsg_type != RTM_DELNEIGH)
+		return -1;
+	if (len < 0)
+		return -1;
+
+	memset(nb, 0, sizeof(*nb));
+	parse_rtattr(tb, NDA_MAX, NDA_RTA(ndm), len);
+
+	nb->n = n;
+	nb->ndm = ndm;
+	nb->family = ndm->ndm_family;
+	nb->index = ndm->ndm_ifindex;
+	nb->state = ndm->ndm_state;
+	nb->flags = ndm->ndm_flags;
+	nb->type = ndm->ndm_type;
+	if (tb[NDA_DST]) {
+		nb->dst = RTA_DATA(tb[NDA_DST]);
+		nb->dst_len = RTA_PAYLOAD(tb[NDA_DST]);
+	}
+	if (tb[NDA_LLADDR]) {
+		nb->lladdr = RTA_DATA(tb[NDA_LLADDR]);
+		nb->lladdr_len = RTA_PAYLOAD(tb[NDA_LLADDR]);
+	}
+	return 0;
+}
+
+int rt_tc_parse(const struct nlmsghdr *n, struct rt_tc *tc)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr **tb = tc->tb;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+	case RTM_DELQDISC:
+	case RTM_NEWTCLASS:
+	case RTM_DELTCLASS:
+	case RTM_NEWTFILTER:
+	case RTM_DELTFILTER:
+		break;
+	default:
+		return -1;
+	}
+	if (len < 0)
+		return -1;
+
+	memset(tc, 0, sizeof(*tc));
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len, NLA_F_NESTED);
+
+	tc->n = n;
+	tc->t = t;
+	tc->ifindex = t->tcm_ifindex;
+	tc->handle = t->tcm_handle;
+	tc->parent = t->tcm_parent;
+	tc->info = t->tcm_info;
+	if (tb[TCA_KIND])
+		tc->kind = rta_getattr_str(tb[TCA_KIND]);
+	tc->options = tb[TCA_OPTIONS];
+	tc->stats2 = tb[TCA_STATS2];
+	if (tb[TCA_STATS] && RTA_PAYLOAD(tb[TCA_STATS]) >= sizeof(*tc->stats))
+		tc->stats = RTA_DATA(tb[TCA_STATS]);
+	return 0;
+}
+
+/*
+ * Walk the dump already requested on rth and hand each parsed record to
+ * fn. Messages of another kind are skipped.
+ */
+#define _RT_DUMP_FUNC(name, rec)					\
+	static int rt_##name##_walk(struct rtnl_handle *rth,		\
+				    rt_##name##_fn fn, void *arg)	\
+	{								\
+		struct rtnl_dump_iter it;				\
+		struct nlmsghdr *n;					\
+		struct rec r;						\
+		int ret = 0, err;					\
+									\
+		rtnl_dump_begin(rth, &it);				\
+		while ((n = rtnl_dump_next(&it)) != NULL) {		\
+			if (rt_##name##_parse(n, &r))			\
+				continue;				\
+			ret = fn(&r, arg);				\
+			if (ret < 0)					\
+				break;					\
+		}							\
+		err = rtnl_dump_end(&it);				\
+		return ret < 0 ? ret : err;				\
+	}
+_RT_DUMP_FUNC(link, rt_link);
+_RT_DUMP_FUNC(addr, rt_addr);
+_RT_DUMP_FUNC(route, rt_route);
+_RT_DUMP_FUNC(neigh, rt_neigh);
+_RT_DUMP_FUNC(tc, rt_tc);
+#undef _RT_DUMP_FUNC
+
+int rt_link_dump(struct rtnl_handle *rth, int family,
+		 rt_link_fn fn, void *arg)
+{
+	if (rtnl_wilddump_request(rth, family, RTM_GETLINK) < 0)
+		return -1;
+	return rt_link_walk(rth, fn, arg);
+}
+
+int rt_addr_dump(struct rtnl_handle *rth, int family,
+		 rt_addr_fn fn, void *arg)
+{
+	if (rtnl_addrdump_req(rth, family, NULL) < 0)
+		return -1;
+	return rt_addr_walk(rth, fn, arg);
+}
+
+int rt_route_dump(struct rtnl_handle *rth, int family,
+		  rt_route_fn fn, void *arg)
+{
+	if (rtnl_routedump_req(rth, family, NULL) < 0)
+		return -1;
+	return rt_route_walk(rth, fn, arg);
+}
+
+int rt_neigh_dump(struct rtnl_handle *rth, int family,
+		  rt_neigh_fn fn, void *arg)
+{
+	if (rtnl_wilddump_request(rth, family, RTM_GETNEIGH) < 0)
+		return -1;
+	return rt_neigh_walk(rth, fn, arg);
+}
+
+static int rt_tc_dump(struct rtnl_handle *rth, int type, int ifindex,
+		      __u32 parent, rt_tc_fn fn, void *arg)
+{
+	struct tcmsg t = {
+		.tcm_family = AF_UNSPEC,
+		.tcm_ifindex = ifindex,
+		.tcm_parent = parent,
+	};
+
+	if (rtnl_dump_request(rth, type, &t, sizeof(t)) < 0)
+		return -1;
+	return rt_tc_walk(rth, fn, arg);
+}
+
+int rt_qdisc_dump(struct rtnl_handle *rth, int ifindex,
+		  rt_tc_fn fn, void *arg)
+{
+	return rt_tc_dump(rth, RTM_GETQDISC, ifindex, 0, fn, arg);
+}
+
+int rt_class_dump(struct rtnl_handle *rth, int ifindex,
+		  rt_tc_fn fn, void *arg)
+{
+	return rt_tc_dump(rth, RTM_GETTCLASS, ifindex, 0, fn, arg);
+}
+
+int rt_filter_dump(struct rtnl_handle *rth, int ifindex, __u32 parent,
+		   rt_tc_fn fn, void *arg)
+{
+	return rt_tc_dump(rth, RTM_GETTFILTER, ifindex, parent, fn, arg);
+}
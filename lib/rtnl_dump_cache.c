@@ -0,0 +1,353 @@
+/*
+ * rtnl_dump_cache.c	Repeated dumps answered from memory.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Once rtnl_dump_cache_enable() was called on a handle, every dump
+ * request going out on it is looked up by its bytes, sequence number and
+ * port id aside. A miss goes to the kernel and the answer is kept as it
+ * is read, a hit is handed the kept answer, renumbered, without a
+ * syscall. All of it is dropped when a request other than a GET goes out
+ * on the handle, and when a socket listening to the groups of links,
+ * addresses, routes, neighbours, rules, netconf and tc heard anything
+ * since the last lookup, whoever made the change. Counters move without
+ * a notification, so dumps of statistics and neighbour tables always go
+ * to the kernel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "libnetlink.h"
+#include "utils.h"
+
+/* at most this many dumps, none of them larger than this, are kept */
+#define RTNL_DUMP_CACHE_ENTRIES	32
+#define RTNL_DUMP_CACHE_BYTES	(64 << 20)
+
+struct rtnl_dump_entry {
+	struct rtnl_dump_entry	*next;
+	char			*req;
+	int			reqlen;
+	/* the datagrams of the answer, each behind its length as an int */
+	char			*data;
+	size_t			len;
+	size_t			size;
+};
+
+struct rtnl_dump_cache {
+	struct rtnl_handle	watch;
+	struct rtnl_dump_entry	*entries;	/* most recent first */
+	unsigned int		count;
+	struct rtnl_dump_entry	*rec;		/* filled by what is read */
+	struct rtnl_dump_entry	*play;		/* handed out instead */
+	size_t			off;
+};
+
+static void rtnl_dump_entry_free(struct rtnl_dump_entry *e)
+{
+	if (!e)
+		return;
+	free(e->req);
+	free(e->data);
+	free(e);
+}
+
+static void rtnl_dump_cache_flush(struct rtnl_dump_cache *dc)
+{
+	while (dc->entries) {
+		struct rtnl_dump_entry *e = dc->entries;
+
+		dc->entries = e->next;
+		rtnl_dump_entry_free(e);
+	}
+	dc->count = 0;
+	dc->play = NULL;
+}
+
+/* Has anything changed since the last look? */
+static bool rtnl_dump_cache_stale(struct rtnl_dump_cache *dc)
+{
+	char buf[8192];
+	bool stale = false;
+
+	for (;;) {
+		int len = recv(dc->watch.fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+		if (len > 0) {
+			stale = true;
+			continue;
+		}
+		if (len < 0 && errno == EINTR)
+			continue;
+		/* lost notifications are changes too */
+		if (len < 0 && errno == ENOBUFS)
+			stale = true;
+		else
+			return stale;
+	}
+}
+
+static __u32 rtnl_dump_cache_groups(void)
+{
+	static const int groups[] = {
+		RTNLGRP_LINK, RTNLGRP_NEIGH, RTNLGRP_TC, RTNLGRP_NSID,
+		RTNLGRP_IPV4_IFADDR, RTNLGRP_IPV6_IFADDR, RTNLGRP_IPV6_PREFIX,
+		RTNLGRP_IPV4_ROUTE, RTNLGRP_IPV6_ROUTE, RTNLGRP_MPLS_ROUTE,
+		RTNLGRP_IPV4_MROUTE, RTNLGRP_IPV6_MROUTE,
+		RTNLGRP_IPV4_RULE, RTNLGRP_IPV6_RULE,
+		RTNLGRP_IPV4_NETCONF, RTNLGRP_IPV6_NETCONF,
+		RTNLGRP_MPLS_NETCONF,
+	};
+	__u32 mask = 0;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(groups); i++)
+		mask |= nl_mgrp(groups[i]);
+	return mask;
+}
+
+static bool rtnl_dump_is_get(const struct nlmsghdr *h)
+{
+	return h->nlmsg_type >= RTM_BASE &&
+	       (h->nlmsg_type - RTM_BASE) % 4 == 2;
+}
+
+static bool rtnl_dump_is_counters(const struct nlmsghdr *h)
+{
+	return h->nlmsg_type == RTM_GETSTATS ||
+	       h->nlmsg_type == RTM_GETNEIGHTBL;
+}
+
+/*
+ * Called with every request about to go out on @rth. Returns 1 when it
+ * is a dump that is answered from the cache and must not be sent.
+ */
+int rtnl_dump_cache_send(struct rtnl_handle *rth, const struct iovec *iov,
+			 size_t iovlen)
+{
+	struct rtnl_dump_cache *dc = rth->dcache;
+	struct rtnl_dump_entry *e, **pe;
+	struct nlmsghdr *h;
+	size_t i, len = 0;
+	char *req;
+	int l;
+
+	for (i = 0; i < iovlen; i++)
+		len += iov[i].iov_len;
+	req = malloc(len);
+	if (!req) {
+		rtnl_dump_cache_flush(dc);
+		return 0;
+	}
+	for (len = 0, i = 0; i < iovlen; i++) {
+		memcpy(req + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+
+	/* whatever was being read or replayed was left half way */
+	rtnl_dump_entry_free(dc->rec);
+	dc->rec = NULL;
+	dc->play = NULL;
+
+	h = (struct nlmsghdr *)req;
+	l = len;
+	if (!NLMSG_OK(h, l) || NLMSG_NEXT(h, l) != (void *)(req + len) ||
+	    !(h->nlmsg_flags & NLM_F_DUMP) || rtnl_dump_is_counters(h)) {
+		for (h = (struct nlmsghdr *)req, l = len; NLMSG_OK(h, l);
+		     h = NLMSG_NEXT(h, l)) {
+			if (!rtnl_dump_is_get(h)) {
+				rtnl_dump_cache_flush(dc);
+				break;
+			}
+		}
+		free(req);
+		return 0;
+	}
+
+	if (rtnl_dump_cache_stale(dc))
+		rtnl_dump_cache_flush(dc);
+
+	h = (struct nlmsghdr *)req;
+	h->nlmsg_seq = 0;
+	h->nlmsg_pid = 0;
+	for (pe = &dc->entries; (e = *pe) != NULL; pe = &e->next) {
+		if (e->reqlen != len || memcmp(e->req, req, len))
+			continue;
+
+		/* move to the front, the last one goes first */
+		*pe = e->next;
+		e->next = dc->entries;
+		dc->entries = e;
+		dc->play = e;
+		dc->off = 0;
+		free(req);
+		return 1;
+	}
+
+	dc->rec = calloc(1, sizeof(*dc->rec));
+	if (!dc->rec) {
+		free(req);
+		return 0;
+	}
+	dc->rec->req = req;
+	dc->rec->reqlen = len;
+	return 0;
+}
+
+/*
+ * Hands out the next datagram of a replayed dump in a buffer to free(),
+ * returns 0 when there is none and the kernel has to be asked.
+ */
+int rtnl_dump_cache_recv(struct rtnl_handle *rth, struct msghdr *msg,
+			 char **answer)
+{
+	struct rtnl_dump_cache *dc = rth->dcache;
+	struct sockaddr_nl *nladdr = msg->msg_name;
+	struct rtnl_dump_entry *e = dc->play;
+	struct nlmsghdr *h;
+	char *buf;
+	int len, l;
+
+	if (!e)
+		return 0;
+
+	memcpy(&len, e->data + dc->off, sizeof(len));
+	buf = malloc(len);
+	if (!buf)
+		return -ENOMEM;
+	memcpy(buf, e->data + dc->off + sizeof(len), len);
+	dc->off += sizeof(len) + len;
+	if (dc->off >= e->len)
+		dc->play = NULL;
+
+	for (h = (struct nlmsghdr *)buf, l = len; NLMSG_OK(h, l);
+	     h = NLMSG_NEXT(h, l)) {
+		h->nlmsg_seq = rth->dump;
+		h->nlmsg_pid = rth->local.nl_pid;
+	}
+
+	memset(nladdr, 0, sizeof(*nladdr));
+	nladdr->nl_family = AF_NETLINK;
+	msg->msg_flags = 0;
+	*answer = buf;
+	return len;
+}
+
+static void rtnl_dump_cache_keep(struct rtnl_dump_cache *dc,
+				 struct rtnl_dump_entry *e)
+{
+	struct rtnl_dump_entry **pe;
+
+	e->next = dc->entries;
+	dc->entries = e;
+	if (++dc->count <= RTNL_DUMP_CACHE_ENTRIES)
+		return;
+
+	for (pe = &dc->entries; (*pe)->next; pe = &(*pe)->next)
+		;
+	rtnl_dump_entry_free(*pe);
+	*pe = NULL;
+	dc->count--;
+}
+
+/* Keeps a datagram read from the kernel if it answers a dump */
+void rtnl_dump_cache_record(struct rtnl_handle *rth, const char *buf, int len)
+{
+	struct rtnl_dump_cache *dc = rth->dcache;
+	struct rtnl_dump_entry *e = dc->rec;
+	const struct nlmsghdr *h;
+	bool done = false;
+	int l;
+
+	if (!e)
+		return;
+
+	for (h = (const struct nlmsghdr *)buf, l = len; NLMSG_OK(h, l);
+	     h = NLMSG_NEXT(h, l)) {
+		if (h->nlmsg_seq != rth->dump)
+			continue;
+		/* errors and inconsistent dumps are asked for again */
+		if (h->nlmsg_type == NLMSG_ERROR ||
+		    h->nlmsg_flags & NLM_F_DUMP_INTR)
+			goto drop;
+		if (h->nlmsg_type == NLMSG_DONE)
+			done = true;
+	}
+
+	if (e->len + sizeof(len) + len > e->size) {
+		size_t size = e->size ? e->size * 2 : 65536;
+		char *data;
+
+		while (size < e->len + sizeof(len) + len)
+			size *= 2;
+		if (size > RTNL_DUMP_CACHE_BYTES)
+			goto drop;
+		data = realloc(e->data, size);
+		if (!data)
+			goto drop;
+		e->data = data;
+		e->size = size;
+	}
+	memcpy(e->data + e->len, &len, sizeof(len));
+	memcpy(e->data + e->len + sizeof(len), buf, len);
+	e->len += sizeof(len) + len;
+
+	if (done) {
+		dc->rec = NULL;
+		rtnl_dump_cache_keep(dc, e);
+	}
+	return;
+
+drop:
+	rtnl_dump_entry_free(e);
+	dc->rec = NULL;
+}
+
+/* For requests that change things and are sent some other way */
+void rtnl_dump_cache_drop(struct rtnl_handle *rth)
+{
+	rtnl_dump_cache_flush(rth->dcache);
+}
+
+int rtnl_dump_cache_enable(struct rtnl_handle *rth)
+{
+	struct rtnl_dump_cache *dc;
+
+	if (rth->dcache)
+		return 0;
+
+	dc = calloc(1, sizeof(*dc));
+	if (!dc)
+		return -1;
+
+	if (rtnl_open(&dc->watch, rtnl_dump_cache_groups()) < 0) {
+		free(dc);
+		return -1;
+	}
+
+	rth->dcache = dc;
+	return 0;
+}
+
+void rtnl_dump_cache_free(struct rtnl_handle *rth)
+{
+	struct rtnl_dump_cache *dc = rth->dcache;
+
+	if (!dc)
+		return;
+
+	rth->dcache = NULL;
+	rtnl_dump_cache_flush(dc);
+	rtnl_dump_entry_free(dc->rec);
+	rtnl_close(&dc->watch);
+	free(dc);
+}
@@ -0,0 +1,291 @@
+/*
+ * rtnl_lag.c	How far behind the kernel a listener is.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Netlink does not timestamp datagrams, SO_TIMESTAMP is accepted on the
+ * socket but no time ever comes with them. What a listener sees instead
+ * is how much is queued on the socket (SO_MEMINFO) when it goes to read.
+ * A datagram read off an empty queue arrived as the read returned. One
+ * that was already waiting arrived no earlier than the one read before
+ * it, so it is taken to have arrived with it, and the lag of a backlog
+ * is at most what is reported. The lag of a datagram runs from its
+ * arrival until everything in it was handled, the handling from its
+ * read. Every interval the percentiles of both, and the most that was
+ * queued, are printed and counting starts over.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/sock_diag.h>
+
+#include "libnetlink.h"
+#include "utils.h"
+
+/* the microseconds below 2^i are split in 8, up to 2^32 */
+#define RTNL_LAG_SUB		8
+#define RTNL_LAG_BUCKETS	(30 * RTNL_LAG_SUB)
+
+struct rtnl_lag_hist {
+	__u32	count[RTNL_LAG_BUCKETS];
+	__u64	max;
+};
+
+struct rtnl_lag {
+	FILE			*fp;
+	int			json;
+	__u64			interval;	/* usec */
+	__u64			start;
+	__u64			datagrams;
+	struct rtnl_lag_hist	lag;
+	struct rtnl_lag_hist	handling;
+	unsigned int		sockq_max;	/* bytes */
+	unsigned int		ringq_max;	/* datagrams */
+	/* for rtnl_listen(), of the datagram being handled */
+	unsigned int		sockq;
+	__u64			arrived;
+	__u64			received;
+};
+
+static __u64 rtnl_lag_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static unsigned int rtnl_lag_bucket(__u64 usec)
+{
+	unsigned int msb = 0, b;
+
+	if (usec < RTNL_LAG_SUB)
+		return usec;
+	while (usec >> (msb + 1))
+		msb++;
+	b = (msb - 2) * RTNL_LAG_SUB +
+	    ((usec >> (msb - 3)) & (RTNL_LAG_SUB - 1));
+	return b < RTNL_LAG_BUCKETS ? b : RTNL_LAG_BUCKETS - 1;
+}
+
+/* the smallest value the next bucket starts with */
+static __u64 rtnl_lag_bucket_end(unsigned int b)
+{
+	unsigned int msb = b / RTNL_LAG_SUB + 2;
+
+	if (b < RTNL_LAG_SUB)
+		return b + 1;
+	return (1ULL << msb) + ((__u64)(b % RTNL_LAG_SUB + 1) << (msb - 3));
+}
+
+static void rtnl_lag_add(struct rtnl_lag_hist *h, __u64 usec)
+{
+	h->count[rtnl_lag_bucket(usec)]++;
+	if (usec > h->max)
+		h->max = usec;
+}
+
+/* at most this many usec, for the permille @pm of @n values */
+static __u64 rtnl_lag_pct(const struct rtnl_lag_hist *h, __u64 n,
+			  unsigned int pm)
+{
+	__u64 want = (n * pm + 999) / 1000, seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < RTNL_LAG_BUCKETS; b++) {
+		seen += h->count[b];
+		if (seen >= want)
+			break;
+	}
+	if (b == RTNL_LAG_BUCKETS)
+		return h->max;
+	return min(rtnl_lag_bucket_end(b), h->max);
+}
+
+static void rtnl_lag_print_hist(const struct rtnl_lag *l, const char *name,
+				const struct rtnl_lag_hist *h)
+{
+	static const unsigned int pms[] = { 500, 900, 990, 999 };
+	static const char * const names[] = { "p50", "p90", "p99", "p999" };
+	unsigned int i;
+
+	if (l->json)
+		fprintf(l->fp, ",\"%s_usec\":{", name);
+	else
+		fprintf(l->fp, " %s", name);
+	for (i = 0; i < ARRAY_SIZE(pms); i++) {
+		unsigned long long v = rtnl_lag_pct(h, l->datagrams, pms[i]);
+
+		if (l->json)
+			fprintf(l->fp, "\"%s\":%llu,", names[i], v);
+		else
+			fprintf(l->fp, " %s %lluus", names[i], v);
+	}
+	if (l->json)
+		fprintf(l->fp, "\"max\":%llu}", (unsigned long long)h->max);
+	else
+		fprintf(l->fp, " max %lluus", (unsigned long long)h->max);
+}
+
+static void rtnl_lag_report(struct rtnl_lag *l, __u64 now)
+{
+	double secs = (now - l->start) / 1e6;
+
+	if (!l->datagrams)
+		goto out;
+
+	if (l->json)
+		fprintf(l->fp, "{\"lag\":{\"seconds\":%.3f,\"datagrams\":%llu",
+			secs, (unsigned long long)l->datagrams);
+	else
+		fprintf(l->fp, "Lag over %.3fs, %llu datagrams:",
+			secs, (unsigned long long)l->datagrams);
+	rtnl_lag_print_hist(l, "lag", &l->lag);
+	rtnl_lag_print_hist(l, "handling", &l->handling);
+	if (l->json) {
+		fprintf(l->fp, ",\"socket_queue_max_bytes\":%u", l->sockq_max);
+		if (l->ringq_max)
+			fprintf(l->fp, ",\"ring_queue_max\":%u", l->ringq_max);
+		fprintf(l->fp, "}}\n");
+	} else {
+		fprintf(l->fp, " socket queue max %u bytes", l->sockq_max);
+		if (l->ringq_max)
+			fprintf(l->fp, ", ring queue max %u", l->ringq_max);
+		fprintf(l->fp, "\n");
+	}
+	fflush(l->fp);
+
+	memset(&l->lag, 0, sizeof(l->lag));
+	memset(&l->handling, 0, sizeof(l->handling));
+	l->datagrams = 0;
+	l->sockq_max = 0;
+	l->ringq_max = 0;
+out:
+	l->start = now;
+}
+
+/* Bytes queued on the socket, or 0 if the kernel does not tell */
+unsigned int rtnl_lag_sockq(const struct rtnl_handle *rth)
+{
+	__u32 mem[SK_MEMINFO_VARS] = {};
+	socklen_t len = sizeof(mem);
+
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_MEMINFO, mem, &len) < 0)
+		return 0;
+	return mem[SK_MEMINFO_RMEM_ALLOC];
+}
+
+/*
+ * Called once a datagram was read, with what rtnl_lag_sockq() said
+ * before. Sets @arrived to its arrival at the earliest, @arrived holding
+ * that of the datagram read before it, and returns the time of the read.
+ */
+__u64 rtnl_lag_stamp(unsigned int sockq, __u64 *arrived)
+{
+	__u64 now = rtnl_lag_now();
+
+	if (!sockq || !*arrived)
+		*arrived = now;
+	return now;
+}
+
+/* Accounts for a datagram of which everything was handled just now */
+void rtnl_lag_account(struct rtnl_handle *rth, __u64 arrived, __u64 received,
+		      unsigned int sockq, unsigned int ringq)
+{
+	struct rtnl_lag *l = rth->lag;
+	__u64 now = rtnl_lag_now();
+
+	l->datagrams++;
+	rtnl_lag_add(&l->lag, now - arrived);
+	rtnl_lag_add(&l->handling, now - received);
+	if (sockq > l->sockq_max)
+		l->sockq_max = sockq;
+	if (ringq > l->ringq_max)
+		l->ringq_max = ringq;
+	if (now - l->start >= l->interval)
+		rtnl_lag_report(l, now);
+}
+
+/* Called when a read timed out, to report even if nothing arrives */
+void rtnl_lag_idle(struct rtnl_handle *rth)
+{
+	struct rtnl_lag *l = rth->lag;
+	__u64 now = rtnl_lag_now();
+
+	if (now - l->start >= l->interval)
+		rtnl_lag_report(l, now);
+}
+
+/* What rtnl_listen() calls before it reads, after that and once handled */
+void rtnl_lag_wait(struct rtnl_handle *rth)
+{
+	rth->lag->sockq = rtnl_lag_sockq(rth);
+}
+
+void rtnl_lag_recv(struct rtnl_handle *rth)
+{
+	struct rtnl_lag *l = rth->lag;
+
+	l->received = rtnl_lag_stamp(l->sockq, &l->arrived);
+}
+
+void rtnl_lag_done(struct rtnl_handle *rth)
+{
+	struct rtnl_lag *l = rth->lag;
+
+	rtnl_lag_account(rth, l->arrived, l->received, l->sockq, 0);
+}
+
+/*
+ * Reports to @fp every @interval_ms milliseconds, as a line of JSON if
+ * @json is set. Reads on the socket time out at least that often.
+ */
+int rtnl_lag_enable(struct rtnl_handle *rth, unsigned int interval_ms,
+		    FILE *fp, int json)
+{
+	struct timeval tv = {};
+	socklen_t len = sizeof(tv);
+	struct rtnl_lag *l;
+
+	if (rth->lag)
+		return 0;
+
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, &len) < 0) {
+		perror("SO_RCVTIMEO");
+		return -1;
+	}
+	if ((!tv.tv_sec && !tv.tv_usec) ||
+	    tv.tv_sec * 1000ULL + tv.tv_usec / 1000 > interval_ms) {
+		tv.tv_sec = interval_ms / 1000;
+		tv.tv_usec = interval_ms % 1000 * 1000;
+		if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVTIMEO,
+			       &tv, sizeof(tv)) < 0) {
+			perror("SO_RCVTIMEO");
+			return -1;
+		}
+	}
+
+	l = calloc(1, sizeof(*l));
+	if (!l)
+		return -1;
+	l->fp = fp;
+	l->json = json;
+	l->interval = interval_ms * 1000ULL;
+	l->start = rtnl_lag_now();
+	rth->lag = l;
+	return 0;
+}
+
+void rtnl_lag_free(struct rtnl_handle *rth)
+{
+	free(rth->lag);
+	rth->lag = NULL;
+}
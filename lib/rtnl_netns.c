@@ -0,0 +1,275 @@
+/*
+ * rtnl_netns.c	Sockets in other network namespaces, without switching.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * A socket belongs to the network namespace it was created in, for its
+ * whole life, whatever namespace the process is in later. So all that
+ * opening a netlink handle in some namespace takes is a socket() call
+ * made there, and that is done by a helper thread: it setns()es into the
+ * namespace asked for, creates the socket and hands it back. Neither the
+ * caller's namespaces nor the mounts are touched, which netns_switch()
+ * has to do for a process that goes on to run commands in there. The
+ * namespace files are kept open by name, so that asking again for the
+ * same namespace does not look it up again.
+ *
+ * Files under /proc/net are the same: they show the namespace of the
+ * task that opened them, so the helper opens those too, through
+ * /proc/thread-self where it is the task.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "libnetlink.h"
+#include "namespace.h"
+
+#define NETNS_FD_HASH	1024
+
+struct netns_fd {
+	struct netns_fd	*next;
+	int		fd;
+	char		name[];
+};
+
+struct netns_sock_req {
+	int		nsfd;
+	const char	*path;		/* to open, instead of a socket */
+	int		flags;
+	int		domain;
+	int		type;
+	int		protocol;
+	int		fd;
+	int		err;
+	bool		done;
+};
+
+static struct netns_fd *netns_fds[NETNS_FD_HASH];
+static pthread_mutex_t netns_fds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct netns_sock_req	*req;
+	bool			started;
+	bool			atfork;
+} nsh = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned int netns_fd_hash(const char *name)
+{
+	unsigned int h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+	return h % NETNS_FD_HASH;
+}
+
+/*
+ * The file of the namespace called name, or at the path name if it has
+ * a slash, like netns_get_fd(). It is the cache's, not to be closed.
+ */
+int netns_get_fd_cached(const char *name)
+{
+	unsigned int h = netns_fd_hash(name);
+	char pathbuf[PATH_MAX];
+	const char *path = name;
+	struct netns_fd *f;
+	int fd;
+
+	pthread_mutex_lock(&netns_fds_lock);
+	for (f = netns_fds[h]; f; f = f->next)
+		if (strcmp(f->name, name) == 0)
+			break;
+	pthread_mutex_unlock(&netns_fds_lock);
+	if (f)
+		return f->fd;
+
+	if (!strchr(name, '/')) {
+		snprintf(pathbuf, sizeof(pathbuf), "%s/%s",
+			 NETNS_RUN_DIR, name);
+		path = pathbuf;
+	}
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	f = malloc(sizeof(*f) + strlen(name) + 1);
+	if (!f) {
+		close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	f->fd = fd;
+	strcpy(f->name, name);
+
+	pthread_mutex_lock(&netns_fds_lock);
+	f->next = netns_fds[h];
+	netns_fds[h] = f;
+	pthread_mutex_unlock(&netns_fds_lock);
+	return fd;
+}
+
+/* for when namespaces may have been deleted, or created again */
+void netns_fd_cache_flush(void)
+{
+	struct netns_fd *f;
+	unsigned int h;
+
+	pthread_mutex_lock(&netns_fds_lock);
+	for (h = 0; h < NETNS_FD_HASH; h++) {
+		while ((f = netns_fds[h]) != NULL) {
+			netns_fds[h] = f->next;
+			close(f->fd);
+			free(f);
+		}
+	}
+	pthread_mutex_unlock(&netns_fds_lock);
+}
+
+static void *netns_helper(void *arg)
+{
+	struct netns_sock_req *r;
+
+	pthread_mutex_lock(&nsh.lock);
+	for (;;) {
+		while (!nsh.req || nsh.req->done)
+			pthread_cond_wait(&nsh.cond, &nsh.lock);
+		r = nsh.req;
+		pthread_mutex_unlock(&nsh.lock);
+
+		/* the helper stays where the last request took it */
+		r->fd = -1;
+		if (setns(r->nsfd, CLONE_NEWNET) == 0)
+			r->fd = r->path ? open(r->path, r->flags) :
+				socket(r->domain, r->type, r->protocol);
+		r->err = errno;
+
+		pthread_mutex_lock(&nsh.lock);
+		r->done = true;
+		pthread_cond_broadcast(&nsh.cond);
+	}
+	return NULL;
+}
+
+/* a child has none of the threads, in particular not the helper */
+static void netns_helper_atfork(void)
+{
+	pthread_mutex_init(&nsh.lock, NULL);
+	pthread_cond_init(&nsh.cond, NULL);
+	nsh.req = NULL;
+	nsh.started = false;
+	pthread_mutex_init(&netns_fds_lock, NULL);
+}
+
+/* with nsh.lock held */
+static int netns_helper_start(void)
+{
+	sigset_t all, old;
+	pthread_t t;
+	int err;
+
+	if (!nsh.atfork) {
+		if (pthread_atfork(NULL, NULL, netns_helper_atfork))
+			return -1;
+		nsh.atfork = true;
+	}
+
+	/* signals are for the threads of the program */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&t, NULL, netns_helper, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	pthread_detach(t);
+	nsh.started = true;
+	return 0;
+}
+
+/* r done by the helper in the namespace called name */
+static int netns_helper_call(const char *name, struct netns_sock_req *r)
+{
+	r->nsfd = netns_get_fd_cached(name);
+	if (r->nsfd < 0)
+		return -1;
+
+	pthread_mutex_lock(&nsh.lock);
+	if (!nsh.started && netns_helper_start() < 0) {
+		pthread_mutex_unlock(&nsh.lock);
+		return -1;
+	}
+	while (nsh.req)
+		pthread_cond_wait(&nsh.cond, &nsh.lock);
+	nsh.req = r;
+	pthread_cond_broadcast(&nsh.cond);
+	while (!r->done)
+		pthread_cond_wait(&nsh.cond, &nsh.lock);
+	nsh.req = NULL;
+	pthread_cond_broadcast(&nsh.cond);
+	pthread_mutex_unlock(&nsh.lock);
+
+	if (r->fd < 0)
+		errno = r->err;
+	return r->fd;
+}
+
+/* socket(domain, type, protocol) as made in the namespace called name */
+int netns_socket(const char *name, int domain, int type, int protocol)
+{
+	struct netns_sock_req r = {
+		.domain = domain,
+		.type = type,
+		.protocol = protocol,
+	};
+
+	return netns_helper_call(name, &r);
+}
+
+/*
+ * open(path, flags) done in the namespace called name, path being taken
+ * under /proc/thread-self: "net/snmp" is the snmp file of that namespace.
+ */
+int netns_open_proc(const char *name, const char *path, int flags)
+{
+	struct netns_sock_req r = {
+		.flags = flags | O_CLOEXEC,
+	};
+	char pathbuf[PATH_MAX];
+
+	snprintf(pathbuf, sizeof(pathbuf), "/proc/thread-self/%s", path);
+	r.path = pathbuf;
+	return netns_helper_call(name, &r);
+}
+
+/*
+ * rtnl_open_byproto() in the namespace called name. Recording and
+ * replaying, which know nothing of namespaces, do not apply.
+ */
+int rtnl_open_netns(struct rtnl_handle *rth, const char *name,
+		    unsigned int subscriptions, int protocol)
+{
+	int fd;
+
+	fd = netns_socket(name, AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open netlink socket in \"%s\": %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+	return rtnl_open_fd(rth, fd, subscriptions, protocol);
+}
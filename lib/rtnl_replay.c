@@ -0,0 +1,460 @@
+/*
+ * rtnl_replay.c	Netlink transport answering dumps from files.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * With RTNL_REPLAY_DIR in the environment, a handle opened without
+ * multicast groups gets one end of a socketpair instead of a netlink
+ * socket. A process of its own holds the other end and answers every
+ * dump request from a file in that directory, or with an empty dump if
+ * there is none. A device asked for by index or name is looked up in
+ * the dump of links, every other request gets EOPNOTSUPP. Dumps of a
+ * million objects can so be parsed and printed, without privileges and
+ * without the kernel's share of the time.
+ *
+ * With RTNL_RECORD_DIR, the process passes the requests on to the kernel
+ * and the answers back, and writes every dump to a file of that
+ * directory, as rth->dump_fp would.
+ *
+ * The file of a dump is named after the protocol, the message type and
+ * the family of the request, "0-26-2" for RTM_GETROUTE of IPv4, and for
+ * sock_diag the protocol too, "4-20-2-6" for TCP over IPv4. A replay
+ * without such a file falls back to "0-26". It holds the messages as
+ * they came, the end of the dump, if it is there, ends the replay: what
+ * "ss -D" writes is such a file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "libnetlink.h"
+
+#define REPLAY_DGRAM	32768
+#define REPLAY_REQ_MAX	65536
+#define RECORD_DUMPS	16
+
+static int replay_key(char *buf, size_t len, const char *dir, int proto,
+		      const struct nlmsghdr *n, int depth)
+{
+	const unsigned char *p = NLMSG_DATA(n);
+	int hdr = n->nlmsg_len - NLMSG_HDRLEN;
+
+	if (depth > 1 && (proto != NETLINK_SOCK_DIAG || hdr < 2))
+		depth = 1;
+	if (depth > 0 && hdr < 1)
+		depth = 0;
+
+	switch (depth) {
+	case 2:
+		return snprintf(buf, len, "%s/%d-%u-%u-%u", dir, proto,
+				n->nlmsg_type, p[0], p[1]);
+	case 1:
+		return snprintf(buf, len, "%s/%d-%u-%u", dir, proto,
+				n->nlmsg_type, p[0]);
+	default:
+		return snprintf(buf, len, "%s/%d-%u", dir, proto,
+				n->nlmsg_type);
+	}
+}
+
+static int replay_send(int fd, const void *buf, size_t len)
+{
+	while (send(fd, buf, len, 0) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+static int replay_error(int fd, const struct nlmsghdr *req, __u32 pid,
+			int error)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct nlmsgerr	err;
+	} ack = {
+		.n.nlmsg_len	= sizeof(ack),
+		.n.nlmsg_type	= NLMSG_ERROR,
+		.n.nlmsg_seq	= req->nlmsg_seq,
+		.n.nlmsg_pid	= pid,
+		.err.error	= error,
+		.err.msg	= *req,
+	};
+
+	return replay_send(fd, &ack, sizeof(ack));
+}
+
+/* the file answering a request, mapped, or NULL if there is none */
+static char *replay_map(const char *dir, int proto,
+			const struct nlmsghdr *req, size_t *size)
+{
+	char path[4096], *map = NULL;
+	struct stat st;
+	int depth, f = -1;
+
+	for (depth = 2; depth >= 0 && f < 0; depth--) {
+		replay_key(path, sizeof(path), dir, proto, req, depth);
+		f = open(path, O_RDONLY | O_CLOEXEC);
+	}
+	if (f < 0)
+		return NULL;
+
+	if (fstat(f, &st) == 0 && st.st_size > 0) {
+		*size = st.st_size;
+		map = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			   f, 0);
+		if (map == MAP_FAILED)
+			map = NULL;
+	}
+	close(f);
+	return map;
+}
+
+static const char *replay_ifname(const struct nlmsghdr *n)
+{
+	const struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+	if (len < 0)
+		return NULL;
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	return tb[IFLA_IFNAME] ? rta_getattr_str(tb[IFLA_IFNAME]) : NULL;
+}
+
+/* ll_map asks for the devices it has not seen by index or name */
+static int replay_getlink(int fd, const char *dir, int proto, __u32 pid,
+			  const struct nlmsghdr *req)
+{
+	const struct ifinfomsg *want = NLMSG_DATA(req);
+	const char *name = replay_ifname(req);
+	size_t size = 0;
+	char *map, *p;
+	int ret = 1;
+
+	if (req->nlmsg_len < NLMSG_LENGTH(sizeof(*want)))
+		return replay_error(fd, req, pid, -EINVAL);
+
+	/* the link dump of any family lists the same devices */
+	map = replay_map(dir, proto, req, &size);
+	if (!map && want->ifi_family != AF_UNSPEC) {
+		struct {
+			struct nlmsghdr		n;
+			struct ifinfomsg	i;
+		} any = { .n = *req, .i = *want };
+
+		any.n.nlmsg_len = sizeof(any);
+		any.i.ifi_family = AF_UNSPEC;
+		map = replay_map(dir, proto, &any.n, &size);
+	}
+	for (p = map; p && ret > 0 && p + NLMSG_HDRLEN <= map + size; ) {
+		struct nlmsghdr *n = (struct nlmsghdr *)p;
+		const struct ifinfomsg *ifi = NLMSG_DATA(n);
+		size_t len = NLMSG_ALIGN(n->nlmsg_len);
+		const char *ifname;
+
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)) ||
+		    p + len > map + size || n->nlmsg_type != RTM_NEWLINK)
+			break;
+		p += len;
+
+		ifname = replay_ifname(n);
+		if (want->ifi_index ? ifi->ifi_index != want->ifi_index :
+		    !name || !ifname || strcmp(name, ifname))
+			continue;
+
+		/* the mapping is private, the copy on write stays here */
+		n->nlmsg_seq = req->nlmsg_seq;
+		n->nlmsg_pid = pid;
+		n->nlmsg_flags = 0;
+		ret = replay_send(fd, n, n->nlmsg_len);
+	}
+	if (map)
+		munmap(map, size);
+	return ret > 0 ? replay_error(fd, req, pid, -ENODEV) : ret;
+}
+
+static int replay_dump(int fd, const char *dir, int proto, __u32 pid,
+		       const struct nlmsghdr *req)
+{
+	struct nlmsghdr *done;
+	char *out, *map, *p;
+	size_t size = 0, max = REPLAY_DGRAM, used = 0;
+	int ret = -1;
+
+	map = replay_map(dir, proto, req, &size);
+	out = malloc(max);
+	if (!out)
+		goto out;
+
+	for (p = map; p && p + NLMSG_HDRLEN <= map + size; ) {
+		const struct nlmsghdr *n = (struct nlmsghdr *)p;
+		size_t len = NLMSG_ALIGN(n->nlmsg_len);
+		struct nlmsghdr *h;
+
+		if (n->nlmsg_len < NLMSG_HDRLEN || p + len > map + size ||
+		    n->nlmsg_type == NLMSG_DONE)
+			break;
+
+		if (used + len > max) {
+			if (used && replay_send(fd, out, used) < 0)
+				goto out;
+			used = 0;
+			if (len > max) {
+				char *bigger = realloc(out, len);
+
+				if (!bigger)
+					goto out;
+				out = bigger;
+				max = len;
+			}
+		}
+
+		h = (struct nlmsghdr *)(out + used);
+		memcpy(h, n, len);
+		h->nlmsg_seq = req->nlmsg_seq;
+		h->nlmsg_pid = pid;
+		h->nlmsg_flags |= NLM_F_MULTI;
+		used += len;
+		p += len;
+	}
+
+	if (used + NLMSG_LENGTH(sizeof(int)) > max) {
+		if (replay_send(fd, out, used) < 0)
+			goto out;
+		used = 0;
+	}
+	done = (struct nlmsghdr *)(out + used);
+	memset(done, 0, NLMSG_LENGTH(sizeof(int)));
+	done->nlmsg_len = NLMSG_LENGTH(sizeof(int));
+	done->nlmsg_type = NLMSG_DONE;
+	done->nlmsg_flags = NLM_F_MULTI;
+	done->nlmsg_seq = req->nlmsg_seq;
+	done->nlmsg_pid = pid;
+	used += done->nlmsg_len;
+	ret = replay_send(fd, out, used);
+out:
+	free(out);
+	if (map)
+		munmap(map, size);
+	return ret;
+}
+
+static void replay_serve(int fd, const char *dir, int proto, __u32 pid)
+{
+	char *req = malloc(REPLAY_REQ_MAX);
+	int len;
+
+	while (req && (len = recv(fd, req, REPLAY_REQ_MAX, 0)) != 0) {
+		struct nlmsghdr *n;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (n = (struct nlmsghdr *)req; NLMSG_OK(n, len);
+		     n = NLMSG_NEXT(n, len)) {
+			int err;
+
+			if (n->nlmsg_flags & NLM_F_DUMP)
+				err = replay_dump(fd, dir, proto, pid, n);
+			else if (proto == NETLINK_ROUTE &&
+				 n->nlmsg_type == RTM_GETLINK)
+				err = replay_getlink(fd, dir, proto, pid, n);
+			else
+				err = replay_error(fd, n, pid, -EOPNOTSUPP);
+			if (err < 0)
+				return;
+		}
+	}
+}
+
+struct record_dump {
+	__u32	seq;
+	FILE	*fp;
+};
+
+static void record_start(struct record_dump *rec, const char *dir,
+			 int proto, const struct nlmsghdr *n)
+{
+	char path[4096];
+	int i;
+
+	for (i = 0; i < RECORD_DUMPS; i++) {
+		if (!rec[i].fp)
+			break;
+	}
+	if (i == RECORD_DUMPS)
+		return;
+
+	replay_key(path, sizeof(path), dir, proto, n, 2);
+	rec[i].fp = fopen(path, "w");
+	rec[i].seq = n->nlmsg_seq;
+	if (!rec[i].fp)
+		fprintf(stderr, "Cannot record dump to \"%s\": %s\n", path,
+			strerror(errno));
+}
+
+static void record_msgs(struct record_dump *rec, const char *buf, int len)
+{
+	const struct nlmsghdr *n;
+	int i;
+
+	for (n = (const struct nlmsghdr *)buf; NLMSG_OK(n, len);
+	     n = NLMSG_NEXT(n, len)) {
+		for (i = 0; i < RECORD_DUMPS; i++) {
+			if (rec[i].fp && rec[i].seq == n->nlmsg_seq)
+				break;
+		}
+		if (i == RECORD_DUMPS)
+			continue;
+
+		fwrite(n, 1, NLMSG_ALIGN(n->nlmsg_len), rec[i].fp);
+		if (n->nlmsg_type == NLMSG_DONE ||
+		    n->nlmsg_type == NLMSG_ERROR) {
+			fclose(rec[i].fp);
+			rec[i].fp = NULL;
+		}
+	}
+}
+
+static void record_serve(int fd, int nl, const char *dir, int proto)
+{
+	struct record_dump rec[RECORD_DUMPS] = {};
+	struct pollfd pfd[2] = {
+		{ .fd = fd, .events = POLLIN },
+		{ .fd = nl, .events = POLLIN },
+	};
+	size_t max = REPLAY_REQ_MAX;
+	char *buf = malloc(max);
+	int len, i;
+
+	while (buf) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[0].revents) {
+			struct nlmsghdr *n = (struct nlmsghdr *)buf;
+
+			len = recv(fd, buf, max, 0);
+			if (len <= 0)
+				break;
+			for (i = len; NLMSG_OK(n, i); n = NLMSG_NEXT(n, i)) {
+				if (n->nlmsg_flags & NLM_F_DUMP)
+					record_start(rec, dir, proto, n);
+			}
+			if (send(nl, buf, len, 0) < 0)
+				break;
+		}
+
+		if (pfd[1].revents) {
+			len = recv(nl, NULL, 0, MSG_PEEK | MSG_TRUNC);
+			if (len > max) {
+				char *bigger = realloc(buf, len);
+
+				if (!bigger)
+					break;
+				buf = bigger;
+				max = len;
+			}
+			len = recv(nl, buf, max, 0);
+			if (len < 0 && errno == EINTR)
+				continue;
+			if (len <= 0 || replay_send(fd, buf, len) < 0)
+				break;
+			record_msgs(rec, buf, len);
+		}
+	}
+
+	for (i = 0; i < RECORD_DUMPS; i++) {
+		if (rec[i].fp)
+			fclose(rec[i].fp);
+	}
+	free(buf);
+}
+
+/*
+ * Returns 1 if the handle was given a replay or record transport, 0 if
+ * none is wanted, -1 on errors.
+ */
+int rtnl_replay_open(struct rtnl_handle *rth)
+{
+	const char *replay = getenv("RTNL_REPLAY_DIR");
+	const char *record = getenv("RTNL_RECORD_DIR");
+	socklen_t addr_len = sizeof(rth->local);
+	int sv[2], nl = -1;
+	pid_t pid;
+
+	if (!replay && !record)
+		return 0;
+
+	rth->local.nl_family = AF_NETLINK;
+	if (replay) {
+		rth->local.nl_pid = getpid();
+	} else {
+		nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, rth->proto);
+		if (nl < 0 ||
+		    bind(nl, (struct sockaddr *)&rth->local,
+			 sizeof(rth->local)) < 0 ||
+		    getsockname(nl, (struct sockaddr *)&rth->local,
+				&addr_len) < 0) {
+			perror("Cannot open netlink socket");
+			if (nl >= 0)
+				close(nl);
+			return -1;
+		}
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("socketpair");
+		if (nl >= 0)
+			close(nl);
+		return -1;
+	}
+
+	/* the server is a grandchild, nobody is left to reap it */
+	pid = fork();
+	if (pid == 0) {
+		close(sv[0]);
+		if (fork() == 0) {
+			close(STDIN_FILENO);
+			close(STDOUT_FILENO);
+			if (replay)
+				replay_serve(sv[1], replay, rth->proto,
+					     rth->local.nl_pid);
+			else
+				record_serve(sv[1], nl, record, rth->proto);
+		}
+		_exit(0);
+	}
+
+	close(sv[1]);
+	if (nl >= 0)
+		close(nl);
+	if (pid < 0 || waitpid(pid, NULL, 0) < 0) {
+		perror("fork");
+		close(sv[0]);
+		return -1;
+	}
+
+	rth->fd = sv[0];
+	rth->flags |= RTNL_HANDLE_F_REPLAY;
+	return 1;
+}
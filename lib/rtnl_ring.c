@@ -0,0 +1,294 @@
+/*
+ * rtnl_ring.c	Listening with a thread of its own to drain the socket.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * rtnl_listen_ring() behaves like rtnl_listen(), except that a thread
+ * does nothing but receive datagrams into a ring of slots, while the
+ * caller's thread parses and prints them. A printer held up by a slow
+ * pipe then no longer keeps the socket from being read, only the ring
+ * fills up. The ring has one writer and one reader, each moves its own
+ * index and only reads the other's, and a side that finds nothing to do
+ * sleeps until the other tells it there is. Receive errors and timeouts
+ * go through the ring like datagrams, so the handler, tick() and
+ * resync() all run on the caller's thread, in the order of events.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "libnetlink.h"
+#include "utils.h"
+
+#define RTNL_RING_DGRAM		16384
+
+struct rtnl_ring_slot {
+	int		len;		/* of the datagram, or -errno */
+	int		nsid;
+	int		msg_flags;
+	bool		waited;		/* the ring was full before it */
+	unsigned int	sockq;		/* see lib/rtnl_lag.c */
+	__u64		arrived;
+	__u64		received;
+	char		buf[RTNL_RING_DGRAM];
+};
+
+struct rtnl_ring {
+	struct rtnl_handle	*rtnl;
+	struct rtnl_ring_slot	*slots;
+	unsigned int		mask;
+	atomic_uint		head;	/* written by the receiver */
+	atomic_uint		tail;	/* written by the reader */
+	atomic_bool		reader_sleeps;
+	atomic_bool		receiver_sleeps;
+	atomic_bool		stop;
+	__u64			arrived;	/* of the last datagram read */
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+};
+
+static void rtnl_ring_wake(struct rtnl_ring *r, atomic_bool *sleeps)
+{
+	if (!atomic_load(sleeps))
+		return;
+	pthread_mutex_lock(&r->lock);
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* sleeps until busy() is false, the other side wakes it up */
+static void rtnl_ring_sleep(struct rtnl_ring *r, atomic_bool *sleeps,
+			    bool (*busy)(struct rtnl_ring *r))
+{
+	pthread_mutex_lock(&r->lock);
+	atomic_store(sleeps, true);
+	while (busy(r) && !atomic_load(&r->stop))
+		pthread_cond_wait(&r->cond, &r->lock);
+	atomic_store(sleeps, false);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static bool rtnl_ring_full(struct rtnl_ring *r)
+{
+	return atomic_load(&r->head) - atomic_load(&r->tail) > r->mask;
+}
+
+static bool rtnl_ring_empty(struct rtnl_ring *r)
+{
+	return atomic_load(&r->head) == atomic_load(&r->tail);
+}
+
+static void rtnl_ring_recv(struct rtnl_ring *r, struct rtnl_ring_slot *s)
+{
+	struct sockaddr_nl nladdr;
+	char cmsgbuf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {
+		.iov_base = s->buf,
+		.iov_len = sizeof(s->buf),
+	};
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct cmsghdr *cmsg;
+	int oldstate;
+
+	if (r->rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
+		msg.msg_control = cmsgbuf;
+		msg.msg_controllen = sizeof(cmsgbuf);
+	}
+
+	do {
+		if (r->rtnl->lag)
+			s->sockq = rtnl_lag_sockq(r->rtnl);
+		/* only ever cancelled while it waits for the kernel */
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
+		s->len = recvmsg(r->rtnl->fd, &msg, 0);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+	} while (s->len < 0 && errno == EINTR);
+
+	if (s->len < 0) {
+		s->len = -errno;
+		/* grown right away, the reader may be a while */
+		if (errno == ENOBUFS)
+			rtnl_grow_rcvbuf(r->rtnl);
+		return;
+	}
+	if (msg.msg_namelen != sizeof(nladdr)) {
+		s->len = -EPROTO;
+		return;
+	}
+
+	if (r->rtnl->lag)
+		s->received = rtnl_lag_stamp(s->sockq, &r->arrived);
+	s->arrived = r->arrived;
+	s->msg_flags = msg.msg_flags;
+	s->nsid = -1;
+	if (!msg.msg_control)
+		return;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_NETLINK &&
+		    cmsg->cmsg_type == NETLINK_LISTEN_ALL_NSID &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			memcpy(&s->nsid, CMSG_DATA(cmsg), sizeof(int));
+}
+
+static void *rtnl_ring_receiver(void *arg)
+{
+	struct rtnl_ring *r = arg;
+	int oldstate;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+	while (!atomic_load(&r->stop)) {
+		unsigned int head = atomic_load(&r->head);
+		struct rtnl_ring_slot *s;
+		bool waited = false;
+
+		if (rtnl_ring_full(r)) {
+			waited = true;
+			rtnl_ring_sleep(r, &r->receiver_sleeps,
+					rtnl_ring_full);
+			if (atomic_load(&r->stop))
+				break;
+		}
+
+		s = &r->slots[head & r->mask];
+		rtnl_ring_recv(r, s);
+		s->waited = waited;
+		atomic_store(&r->head, head + 1);
+		rtnl_ring_wake(r, &r->reader_sleeps);
+	}
+	return NULL;
+}
+
+/* what rtnl_listen() does with a datagram, or with a failed receive */
+static int rtnl_ring_handle(struct rtnl_ring *r, struct rtnl_ring_slot *s,
+			    rtnl_listen_filter_t handler, void *jarg)
+{
+	struct rtnl_handle *rtnl = r->rtnl;
+	unsigned int ringq = atomic_load(&r->head) - atomic_load(&r->tail);
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct rtnl_ctrl_data ctrl = { .nsid = s->nsid };
+	int status = s->len;
+	struct nlmsghdr *h;
+
+	if (status < 0) {
+		if (status == -EAGAIN) {
+			if (rtnl->lag)
+				rtnl_lag_idle(rtnl);
+			if (rtnl->tick && rtnl->tick(rtnl, jarg) < 0)
+				return -1;
+			return 0;
+		}
+		if (status == -ENOBUFS && rtnl->resync)
+			return rtnl->resync(rtnl, jarg) < 0 ? -1 : 0;
+		fprintf(stderr, "netlink receive error %s (%d)\n",
+			strerror(-status), -status);
+		return status == -ENOBUFS ? 0 : -1;
+	}
+	if (status == 0) {
+		fprintf(stderr, "EOF on netlink\n");
+		return -1;
+	}
+
+	for (h = (struct nlmsghdr *)s->buf; status >= sizeof(*h); ) {
+		int len = h->nlmsg_len;
+		int err;
+
+		if (len < sizeof(*h) || len > status) {
+			if (s->msg_flags & MSG_TRUNC) {
+				fprintf(stderr, "Truncated message\n");
+				return -1;
+			}
+			fprintf(stderr, "!!!malformed message: len=%d\n", len);
+			iprt_exit(1);
+		}
+
+		err = handler(&nladdr, &ctrl, h, jarg);
+		if (err < 0)
+			return err;
+
+		status -= NLMSG_ALIGN(len);
+		h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
+	}
+	if (rtnl->lag)
+		rtnl_lag_account(rtnl, s->arrived, s->received, s->sockq,
+				 ringq);
+	if (rtnl->tick && rtnl->tick(rtnl, jarg) < 0)
+		return -1;
+	if (s->msg_flags & MSG_TRUNC)
+		fprintf(stderr, "Message truncated\n");
+	return 0;
+}
+
+int rtnl_listen_ring(struct rtnl_handle *rtnl, unsigned int slots,
+		     rtnl_listen_filter_t handler, void *jarg)
+{
+	struct rtnl_ring r = {
+		.rtnl = rtnl,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	unsigned int size = 2, full = 0;
+	pthread_t receiver;
+	int err, ret = 0;
+
+	rtnl_uring_free(rtnl);
+
+	while (size < slots && size < (1U << 20))
+		size *= 2;
+	r.mask = size - 1;
+	r.slots = malloc(size * sizeof(*r.slots));
+	if (!r.slots) {
+		perror("Cannot allocate event ring");
+		return -1;
+	}
+
+	err = pthread_create(&receiver, NULL, rtnl_ring_receiver, &r);
+	if (err) {
+		fprintf(stderr, "Cannot start receiver: %s\n", strerror(err));
+		free(r.slots);
+		return -1;
+	}
+
+	while (ret >= 0) {
+		unsigned int tail = atomic_load(&r.tail);
+		struct rtnl_ring_slot *s;
+
+		if (rtnl_ring_empty(&r)) {
+			/* the output is as far as the events are */
+			fflush(stdout);
+			rtnl_ring_sleep(&r, &r.reader_sleeps, rtnl_ring_empty);
+			continue;
+		}
+
+		s = &r.slots[tail & r.mask];
+		if (s->waited)
+			fprintf(stderr,
+				"Event ring of %u datagrams full, %u times\n",
+				size, ++full);
+		ret = rtnl_ring_handle(&r, s, handler, jarg);
+		atomic_store(&r.tail, tail + 1);
+		rtnl_ring_wake(&r, &r.receiver_sleeps);
+	}
+
+	atomic_store(&r.stop, true);
+	pthread_mutex_lock(&r.lock);
+	pthread_cond_broadcast(&r.cond);
+	pthread_mutex_unlock(&r.lock);
+	pthread_cancel(receiver);
+	pthread_join(receiver, NULL);
+	free(r.slots);
+	return ret;
+}
@@ -0,0 +1,481 @@
+/*
+ * rtnl_shmring.c	Events shared with other processes through memory.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * One process receives the events and writes them into a ring in shared
+ * memory, any number of others read them from there, each at its own
+ * pace and without a socket of its own. The layout and the protocol are
+ * in rtnl_shmring.h. The writer never waits for the readers: one that
+ * falls a whole ring behind finds out from tail and from seq, and gets
+ * its resync() called, like a listener whose socket overflowed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "libnetlink.h"
+#include "utils.h"
+#include "rtnl_shmring.h"
+
+#define SHMRING_REC		sizeof(struct rtnl_shmring_rec)
+#define SHMRING_ALIGN(len)	(((len) + 7) & ~7U)
+#define SHMRING_MAX_MSG		65536
+#define SHMRING_MIN_SIZE	(1U << 16)
+#define SHMRING_MAX_SIZE	(1U << 30)
+
+struct rtnl_shmring {
+	struct rtnl_shmring_hdr	*hdr;
+	size_t			len;		/* mapped */
+	__u32			size;
+	int			writer;
+	char			name[NAME_MAX];
+	/* the writer's */
+	__u64			woken;		/* head when wake was bumped */
+	/* a reader's */
+	__u64			pos;
+	__u64			next_seq;	/* 0 until the first record */
+	int			overrun;
+	char			*buf;
+};
+
+static void shmring_name(char *buf, size_t len, uid_t uid, const char *name)
+{
+	snprintf(buf, len, RTNL_SHMRING_NAME, (int)uid, name);
+}
+
+static int shmring_futex(__u32 *addr, int op, __u32 val,
+			 const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static int shmring_name_ok(const char *name)
+{
+	return *name && strlen(name) < NAME_MAX - 32 && !strchr(name, '/');
+}
+
+/*
+ * The ring called name for the events to be written into, of about size
+ * bytes, owned by this process until rtnl_shmring_close(). A ring left by
+ * a writer that is gone is taken over.
+ */
+struct rtnl_shmring *rtnl_shmring_publish(const char *name, unsigned int size)
+{
+	struct rtnl_shmring_hdr *hdr;
+	struct rtnl_shmring *r;
+	unsigned int ring = SHMRING_MIN_SIZE;
+	char path[NAME_MAX];
+	size_t len;
+	int fd;
+
+	if (!shmring_name_ok(name)) {
+		fprintf(stderr, "Invalid event ring name \"%s\"\n", name);
+		return NULL;
+	}
+	while (ring < size && ring < SHMRING_MAX_SIZE)
+		ring *= 2;
+	len = sizeof(*hdr) + ring;
+
+	shmring_name(path, sizeof(path), getuid(), name);
+	fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0 && errno == EEXIST) {
+		int old = shm_open(path, O_RDONLY | O_CLOEXEC, 0);
+		pid_t pid = 0;
+
+		if (old >= 0) {
+			if (pread(old, &pid, sizeof(pid),
+				  offsetof(struct rtnl_shmring_hdr, pid)) !=
+			    sizeof(pid))
+				pid = 0;
+			close(old);
+		}
+		if (pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH)) {
+			fprintf(stderr,
+				"Events are published as \"%s\" by %d already\n",
+				name, pid);
+			return NULL;
+		}
+		shm_unlink(path);
+		fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+			      0644);
+	}
+	if (fd < 0) {
+		fprintf(stderr, "Cannot create event ring \"%s\": %s\n",
+			name, strerror(errno));
+		return NULL;
+	}
+	/* the mode is not left to the umask */
+	fchmod(fd, 0644);
+
+	if (ftruncate(fd, len) < 0) {
+		perror("Cannot size event ring");
+		goto err;
+	}
+	hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		perror("Cannot map event ring");
+		goto err;
+	}
+	close(fd);
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		munmap(hdr, len);
+		shm_unlink(path);
+		return NULL;
+	}
+	hdr->version = RTNL_SHMRING_VERSION;
+	hdr->size = ring;
+	hdr->pid = getpid();
+	/* readers check the magic last */
+	__atomic_store_n(&hdr->magic, RTNL_SHMRING_MAGIC, __ATOMIC_RELEASE);
+
+	r->hdr = hdr;
+	r->len = len;
+	r->size = ring;
+	r->writer = 1;
+	strcpy(r->name, path);
+	return r;
+
+err:
+	close(fd);
+	shm_unlink(path);
+	return NULL;
+}
+
+/* move tail past the records the next bytes overwrite */
+static void shmring_reserve(struct rtnl_shmring *r, __u64 head, __u32 bytes)
+{
+	struct rtnl_shmring_hdr *hdr = r->hdr;
+	__u64 tail = hdr->tail;
+
+	while (head + bytes - tail > r->size) {
+		__u32 off = tail & (r->size - 1);
+		const struct rtnl_shmring_rec *rec;
+
+		if (r->size - off < SHMRING_REC) {
+			tail += r->size - off;
+			continue;
+		}
+		rec = (const void *)(hdr->data + off);
+		tail += rec->len;
+	}
+	__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+	/* the stores to the ring go after it */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static int shmring_put(struct rtnl_shmring *r, const struct nlmsghdr *n,
+		       int nsid, __u32 flags)
+{
+	struct rtnl_shmring_hdr *hdr = r->hdr;
+	__u32 msglen = n ? n->nlmsg_len : 0;
+	__u32 len = SHMRING_ALIGN(SHMRING_REC + msglen);
+	__u64 head = hdr->head;
+	__u32 off = head & (r->size - 1), skip = 0;
+	struct rtnl_shmring_rec *rec;
+
+	if (msglen > SHMRING_MAX_MSG)
+		return -EMSGSIZE;
+
+	if (r->size - off < len)
+		skip = r->size - off;
+	shmring_reserve(r, head, skip + len);
+
+	if (skip >= SHMRING_REC) {
+		rec = (void *)(hdr->data + off);
+		memset(rec, 0, sizeof(*rec));
+		rec->len = skip;
+		rec->flags = RTNL_SHMRING_F_PAD;
+	}
+	head += skip;
+	off = head & (r->size - 1);
+
+	rec = (void *)(hdr->data + off);
+	rec->seq = ++hdr->seq;
+	rec->len = len;
+	rec->nsid = nsid;
+	rec->flags = flags;
+	rec->pad = 0;
+	if (msglen)
+		memcpy(rec + 1, n, msglen);
+
+	__atomic_store_n(&hdr->head, head + len, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* n, received in namespace nsid or -1, for the readers */
+int rtnl_shmring_write(struct rtnl_shmring *r, const struct nlmsghdr *n,
+		       int nsid)
+{
+	return shmring_put(r, n, nsid, 0);
+}
+
+/* tell the readers that the writer lost events */
+int rtnl_shmring_lost(struct rtnl_shmring *r)
+{
+	return shmring_put(r, NULL, -1, RTNL_SHMRING_F_LOST);
+}
+
+/* wake up the readers waiting for what was written since last time */
+void rtnl_shmring_flush(struct rtnl_shmring *r)
+{
+	struct rtnl_shmring_hdr *hdr = r->hdr;
+
+	if (hdr->head == r->woken)
+		return;
+	r->woken = hdr->head;
+	/* readers write nothing, so there is no telling whether one sleeps */
+	__atomic_add_fetch(&hdr->wake, 1, __ATOMIC_SEQ_CST);
+	shmring_futex(&hdr->wake, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static struct rtnl_shmring_hdr *shmring_map(const char *path, uid_t uid,
+					    size_t *lenp)
+{
+	struct rtnl_shmring_hdr *hdr;
+	struct stat st;
+	size_t len;
+	int fd;
+
+	fd = shm_open(path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	/* what the name says the owner is */
+	if (fstat(fd, &st) || st.st_uid != uid || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+	len = st.st_size;
+	hdr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) !=
+	    RTNL_SHMRING_MAGIC ||
+	    hdr->version != RTNL_SHMRING_VERSION ||
+	    hdr->size < SHMRING_MIN_SIZE || hdr->size > SHMRING_MAX_SIZE ||
+	    (hdr->size & (hdr->size - 1)) ||
+	    len < sizeof(*hdr) + hdr->size) {
+		munmap(hdr, len);
+		return NULL;
+	}
+	*lenp = len;
+	return hdr;
+}
+
+/* map the ring of name, from the next event on */
+static int shmring_attach(struct rtnl_shmring *r, const char *name)
+{
+	uid_t owners[] = { getuid(), 0 };
+	struct rtnl_shmring_hdr *hdr = NULL;
+	char path[NAME_MAX];
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(owners) && !hdr; i++) {
+		shmring_name(path, sizeof(path), owners[i], name);
+		hdr = shmring_map(path, owners[i], &len);
+	}
+	if (!hdr)
+		return -1;
+
+	if (r->hdr)
+		munmap(r->hdr, r->len);
+	r->hdr = hdr;
+	r->len = len;
+	r->size = hdr->size;
+	r->pos = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	r->next_seq = 0;
+	return 0;
+}
+
+/* Reading the events published as name */
+struct rtnl_shmring *rtnl_shmring_subscribe(const char *name)
+{
+	struct rtnl_shmring *r;
+
+	if (!shmring_name_ok(name)) {
+		fprintf(stderr, "Invalid event ring name \"%s\"\n", name);
+		return NULL;
+	}
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+	r->buf = malloc(SHMRING_MAX_MSG);
+	if (!r->buf || shmring_attach(r, name) < 0) {
+		fprintf(stderr, "No events are published as \"%s\"\n", name);
+		free(r->buf);
+		free(r);
+		return NULL;
+	}
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	return r;
+}
+
+/*
+ * The next record into r->buf: its length, 0 if there is none yet, or
+ * -EPROTO for a ring that makes no sense. *rec gets its header.
+ */
+static int shmring_read(struct rtnl_shmring *r, struct rtnl_shmring_rec *rec)
+{
+	const struct rtnl_shmring_hdr *hdr = r->hdr;
+
+	for (;;) {
+		__u64 head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		__u64 pos = r->pos;
+		__u32 off, msglen;
+
+		if (pos == head)
+			return 0;
+		if (pos < __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) ||
+		    pos > head)
+			goto overrun;
+
+		off = pos & (r->size - 1);
+		if (r->size - off < SHMRING_REC) {
+			r->pos += r->size - off;
+			continue;
+		}
+		memcpy(rec, hdr->data + off, sizeof(*rec));
+		msglen = rec->len - SHMRING_REC;
+		if (rec->len >= SHMRING_REC && rec->len <= r->size - off &&
+		    msglen <= SHMRING_MAX_MSG && !(rec->flags & RTNL_SHMRING_F_PAD))
+			memcpy(r->buf, hdr->data + off + SHMRING_REC, msglen);
+
+		/* whatever was copied is only good if it was not overwritten */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (pos < __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE))
+			goto overrun;
+
+		if (rec->len < SHMRING_REC || rec->len > r->size - off ||
+		    msglen > SHMRING_MAX_MSG || pos + rec->len > head)
+			return -EPROTO;
+		r->pos += rec->len;
+		if (rec->flags & RTNL_SHMRING_F_PAD)
+			continue;
+		if (!(rec->flags & RTNL_SHMRING_F_LOST) &&
+		    (msglen < sizeof(struct nlmsghdr) ||
+		     ((struct nlmsghdr *)r->buf)->nlmsg_len > msglen))
+			return -EPROTO;
+		if (r->next_seq && rec->seq != r->next_seq)
+			r->overrun = 1;
+		r->next_seq = rec->seq + 1;
+		return rec->len;
+
+overrun:
+		r->pos = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+		r->overrun = 1;
+	}
+}
+
+/* sleep until head moves or timeout ms are over */
+static void shmring_wait(struct rtnl_shmring *r, int timeout)
+{
+	const struct rtnl_shmring_hdr *hdr = r->hdr;
+	struct timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (timeout % 1000) * 1000000L,
+	};
+	__u32 wake;
+
+	wake = __atomic_load_n(&hdr->wake, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST) == r->pos)
+		shmring_futex((__u32 *)&hdr->wake, FUTEX_WAIT, wake, &ts);
+}
+
+/* a writer gone may have been replaced by another one, with a new ring */
+static int shmring_writer_gone(struct rtnl_shmring *r)
+{
+	if (kill(r->hdr->pid, 0) == 0 || errno != ESRCH)
+		return 0;
+	return shmring_attach(r, r->name) == 0 &&
+	       (kill(r->hdr->pid, 0) == 0 || errno != ESRCH);
+}
+
+/*
+ * rtnl_listen() on the events of the ring. Of rth only resync() and
+ * tick() are used: resync() when events were missed, tick() after every
+ * run of events and at least every 100ms if it is set, every second
+ * otherwise.
+ */
+int rtnl_shmring_listen(struct rtnl_shmring *r, struct rtnl_handle *rth,
+			rtnl_listen_filter_t handler, void *jarg)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	int timeout = rth && rth->tick ? 100 : 1000;
+	unsigned int idle = 0;
+
+	for (;;) {
+		struct rtnl_shmring_rec rec;
+		struct rtnl_ctrl_data ctrl;
+		int len, err;
+
+		len = shmring_read(r, &rec);
+		if (len < 0) {
+			fprintf(stderr, "Event ring \"%s\" is corrupted\n",
+				r->name);
+			return -1;
+		}
+		if (len && (r->overrun || (rec.flags & RTNL_SHMRING_F_LOST))) {
+			r->overrun = 0;
+			if (rth && rth->resync && rth->resync(rth, jarg) < 0)
+				return -1;
+		}
+		if (len && !(rec.flags & RTNL_SHMRING_F_LOST)) {
+			memset(&ctrl, 0, sizeof(ctrl));
+			ctrl.nsid = rec.nsid;
+			err = handler(&nladdr, &ctrl,
+				      (struct nlmsghdr *)r->buf, jarg);
+			if (err < 0)
+				return err;
+			idle = 0;
+			continue;
+		}
+		if (len)
+			continue;
+
+		/* caught up */
+		fflush(stdout);
+		if (rth && rth->tick && rth->tick(rth, jarg) < 0)
+			return -1;
+		shmring_wait(r, timeout);
+		if (__atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE) != r->pos)
+			continue;
+		if (++idle * timeout >= 1000) {
+			idle = 0;
+			/* what it wrote before going is read still */
+			if (shmring_writer_gone(r) && rth && rth->resync &&
+			    rth->resync(rth, jarg) < 0)
+				return -1;
+		}
+	}
+}
+
+void rtnl_shmring_close(struct rtnl_shmring *r)
+{
+	if (!r)
+		return;
+	if (r->writer)
+		shm_unlink(r->name);
+	munmap(r->hdr, r->len);
+	free(r->buf);
+	free(r);
+}
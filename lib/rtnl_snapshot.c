@@ -0,0 +1,256 @@
+/*
+ * rtnl_snapshot.c	A dump of the current state, for a listener to go on.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The listening socket is subscribed before anything is dumped, so no
+ * change made after the dump started goes unheard. What it heard before
+ * is thrown away, the dump already reflects it. The dumps are read
+ * whole into memory, and so are the notifications queued while they
+ * ran, before anything is handed out, and all of it is done over when a
+ * dump was interrupted (NLM_F_DUMP_INTR) or notifications were lost.
+ * The handler then gets the dumped objects, a NLMSG_DONE, and the queued
+ * notifications, in order, except those of them at the start that
+ * repeat a dumped object byte for byte and therefore change nothing.
+ * Objects changed while being dumped may be handed out twice, the last
+ * of it is always what the kernel has.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "libnetlink.h"
+#include "utils.h"
+
+#define RTNL_SNAPSHOT_TRIES	10
+
+/* messages one after the other, each NLMSG_ALIGN()ed */
+struct rtnl_snapshot_buf {
+	char	*data;
+	size_t	len;
+	size_t	size;
+};
+
+static int rtnl_snapshot_keep(struct rtnl_snapshot_buf *b,
+			      const struct nlmsghdr *h)
+{
+	size_t len = NLMSG_ALIGN(h->nlmsg_len);
+
+	if (b->len + len > b->size) {
+		size_t size = b->size ? b->size * 2 : 65536;
+		char *data;
+
+		while (size < b->len + len)
+			size *= 2;
+		data = realloc(b->data, size);
+		if (!data)
+			return -1;
+		b->data = data;
+		b->size = size;
+	}
+	memcpy(b->data + b->len, h, h->nlmsg_len);
+	b->len += len;
+	return 0;
+}
+
+#define rtnl_snapshot_for_each(h, b)					\
+	for (h = (struct nlmsghdr *)(b)->data;				\
+	     (char *)h < (b)->data + (b)->len;				\
+	     h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(h->nlmsg_len)))
+
+/*
+ * Reads what is queued on @rth into @b, or throws it away without @b.
+ * Returns -ENOBUFS if notifications were lost.
+ */
+static int rtnl_snapshot_drain(struct rtnl_handle *rth,
+			       struct rtnl_snapshot_buf *b)
+{
+	char buf[16384];
+	int ret = 0;
+
+	for (;;) {
+		struct nlmsghdr *h;
+		int len = recv(rth->fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				rtnl_grow_rcvbuf(rth);
+				ret = -ENOBUFS;
+				continue;
+			}
+			if (errno == EAGAIN)
+				return ret;
+			perror("Cannot receive notifications");
+			return -1;
+		}
+		if (!b)
+			continue;
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+		     h = NLMSG_NEXT(h, len))
+			if (rtnl_snapshot_keep(b, h) < 0)
+				return -1;
+	}
+}
+
+static int rtnl_snapshot_dump(struct rtnl_handle *d,
+			      const struct rtnl_snapshot_dump *dumps,
+			      unsigned int count, struct rtnl_snapshot_buf *b)
+{
+	unsigned int i;
+	int intr = 0;
+
+	b->len = 0;
+	for (i = 0; i < count; i++) {
+		struct rtnl_dump_iter it;
+		struct nlmsghdr *h;
+
+		if (rtnl_wilddump_request(d, dumps[i].family,
+					  dumps[i].type) < 0) {
+			perror("Cannot send dump request");
+			return -1;
+		}
+		rtnl_dump_begin(d, &it);
+		while ((h = rtnl_dump_next(&it)) != NULL)
+			if (rtnl_snapshot_keep(b, h) < 0)
+				it.err = -1;
+		intr |= it.intr;
+		it.intr = 0;
+		if (rtnl_dump_end(&it) < 0)
+			return -1;
+	}
+	return intr ? -EINTR : 0;
+}
+
+static __u32 rtnl_snapshot_hash(const struct nlmsghdr *h)
+{
+	const unsigned char *p = NLMSG_DATA(h);
+	__u32 hash = 2166136261U ^ h->nlmsg_type;
+	int i;
+
+	for (i = 0; i < NLMSG_PAYLOAD(h, 0); i++)
+		hash = (hash ^ p[i]) * 16777619U;
+	return hash;
+}
+
+static bool rtnl_snapshot_same(const struct nlmsghdr *a,
+			       const struct nlmsghdr *b)
+{
+	return a->nlmsg_type == b->nlmsg_type &&
+	       a->nlmsg_len == b->nlmsg_len &&
+	       !memcmp(NLMSG_DATA(a), NLMSG_DATA(b), NLMSG_PAYLOAD(a, 0));
+}
+
+/* Hands out the dump and the notifications, which repeat the former */
+static int rtnl_snapshot_play(struct rtnl_snapshot_buf *dump,
+			      struct rtnl_snapshot_buf *notes,
+			      rtnl_listen_filter_t handler, void *jarg)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct rtnl_ctrl_data ctrl = { .nsid = -1 };
+	struct nlmsghdr done = {
+		.nlmsg_len = NLMSG_LENGTH(0),
+		.nlmsg_type = NLMSG_DONE,
+	};
+	struct nlmsghdr **index, *h;
+	unsigned int n = 0, mask = 1;
+	bool repeats = true;
+	int err = 0;
+
+	rtnl_snapshot_for_each(h, dump)
+		n++;
+	while (mask < 2 * n)
+		mask *= 2;
+	mask--;
+	index = calloc(mask + 1, sizeof(*index));
+	if (!index)
+		return -1;
+
+	rtnl_snapshot_for_each(h, dump) {
+		__u32 i = rtnl_snapshot_hash(h);
+
+		while (index[i & mask])
+			i++;
+		index[i & mask] = h;
+		err = handler(&nladdr, &ctrl, h, jarg);
+		if (err < 0)
+			goto out;
+	}
+	err = handler(&nladdr, &ctrl, &done, jarg);
+	if (err < 0)
+		goto out;
+
+	rtnl_snapshot_for_each(h, notes) {
+		if (repeats) {
+			__u32 i = rtnl_snapshot_hash(h);
+			struct nlmsghdr *d;
+
+			while ((d = index[i & mask]) != NULL &&
+			       !rtnl_snapshot_same(d, h))
+				i++;
+			if (d)
+				continue;
+			repeats = false;
+		}
+		err = handler(&nladdr, &ctrl, h, jarg);
+		if (err < 0)
+			break;
+	}
+out:
+	free(index);
+	return err;
+}
+
+/*
+ * Hands to @handler the objects of @count dumps and then what @rth, which
+ * has to be subscribed to their notifications, heard while they were
+ * dumped. rtnl_listen() on @rth goes on from there.
+ */
+int rtnl_snapshot(struct rtnl_handle *rth,
+		  const struct rtnl_snapshot_dump *dumps, unsigned int count,
+		  rtnl_listen_filter_t handler, void *jarg)
+{
+	struct rtnl_snapshot_buf dump = {}, notes = {};
+	struct rtnl_handle d;
+	int tries, lost, err = -1;
+
+	if (rtnl_open(&d, 0) < 0)
+		return -1;
+
+	for (tries = 0; tries < RTNL_SNAPSHOT_TRIES; tries++) {
+		/* what was heard so far is in the dump that follows */
+		if (rtnl_snapshot_drain(rth, NULL) == -1)
+			break;
+		err = rtnl_snapshot_dump(&d, dumps, count, &dump);
+		if (err == -1)
+			break;
+		notes.len = 0;
+		lost = rtnl_snapshot_drain(rth, &notes);
+		if (lost == -1) {
+			err = -1;
+			break;
+		}
+		if (!err && !lost)
+			break;
+		err = -EAGAIN;
+	}
+	rtnl_close(&d);
+
+	if (err == -EAGAIN)
+		fprintf(stderr,
+			"Dump kept being interrupted, gave up after %d tries\n",
+			tries);
+	else if (!err)
+		err = rtnl_snapshot_play(&dump, &notes, handler, jarg);
+
+	free(dump.data);
+	free(notes.data);
+	return err < 0 ? -1 : 0;
+}
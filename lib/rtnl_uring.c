@@ -0,0 +1,527 @@
+/*
+ * rtnl_uring.c	Receiving dumps and sending batches through io_uring.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * With rtnl_uring_enable(), a handle receives with a single multishot
+ * recv that stays armed: the kernel copies each datagram into a buffer
+ * it takes from a ring of them, and posts a completion for it. Reading
+ * a dump of many datagrams then takes an io_uring_enter() only when
+ * none is waiting, instead of two recvmsg() calls for each. A datagram
+ * stays in its buffer until the caller is done with it, then the buffer
+ * goes back to the ring. The datagrams of rtnl_txq_send() are sent as
+ * one chain of linked sendmsg, which stops at the first that fails, as
+ * sendmmsg() does.
+ *
+ * Only that and what goes through rtnl_recv() know of the ring, which
+ * takes whatever arrives: rtnl_listen() drops it to read events itself,
+ * and the event loop API is not for such a handle. The ring is created
+ * by the library; that of a program can lend it its workers through
+ * wq_fd.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "libnetlink.h"
+
+#ifdef HAVE_IO_URING
+/* older linux/stddef.h have not got it */
+#ifndef __DECLARE_FLEX_ARRAY
+#define __DECLARE_FLEX_ARRAY(T, member)	T member[0]
+#endif
+#include <linux/io_uring.h>
+
+#define RTNL_URING_BUFS		32
+#define RTNL_URING_BUFSZ	65536
+#define RTNL_URING_SQ		128	/* room for a chain of RTNL_TXQ_SENDMMSG */
+
+#define RTNL_URING_RECV		1ULL
+#define RTNL_URING_SEND		2ULL
+
+struct rtnl_uring_cqe {
+	int		res;
+	unsigned int	flags;
+};
+
+struct rtnl_uring {
+	int			fd;
+	void			*sq_ring;
+	size_t			sq_ring_len;
+	void			*cq_ring;
+	size_t			cq_ring_len;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_len;
+	unsigned int		*sq_tail;
+	unsigned int		sq_mask;
+	unsigned int		*sq_array;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		cq_mask;
+	struct io_uring_cqe	*cqes;
+	unsigned int		sqe_tail;	/* of the sqes written */
+	unsigned int		pending;	/* sqes not submitted yet */
+	bool			armed;		/* the recv is */
+
+	struct io_uring_buf_ring *br;
+	size_t			br_len;
+	char			*bufs;
+	unsigned int		nbufs;
+	__u16			br_tail;
+
+	/* receives completed while rtnl_uring_sendmsg() waited for sends */
+	struct rtnl_uring_cqe	*backlog;
+	unsigned int		bl_head;
+	unsigned int		bl_count;
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg,
+			     unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void rtnl_uring_destroy(struct rtnl_uring *u)
+{
+	if (u->br)
+		munmap(u->br, u->br_len);
+	if (u->bufs)
+		munmap(u->bufs, (size_t)u->nbufs * RTNL_URING_BUFSZ);
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_len);
+	if (u->cq_ring && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_len);
+	if (u->sq_ring)
+		munmap(u->sq_ring, u->sq_ring_len);
+	if (u->fd >= 0)
+		close(u->fd);
+	free(u->backlog);
+	free(u);
+}
+
+static int rtnl_uring_map(struct rtnl_uring *u, struct io_uring_params *p)
+{
+	u->sq_ring_len = p->sq_off.array + p->sq_entries * sizeof(__u32);
+	u->cq_ring_len = p->cq_off.cqes +
+			 p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_len > u->sq_ring_len)
+			u->sq_ring_len = u->cq_ring_len;
+		u->cq_ring_len = u->sq_ring_len;
+	}
+
+	u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED) {
+		u->sq_ring = NULL;
+		return -1;
+	}
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ring = u->sq_ring;
+	} else {
+		u->cq_ring = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, u->fd,
+				  IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED) {
+			u->cq_ring = NULL;
+			return -1;
+		}
+	}
+	u->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		return -1;
+	}
+
+	u->sq_tail = u->sq_ring + p->sq_off.tail;
+	u->sq_mask = *(unsigned int *)(u->sq_ring + p->sq_off.ring_mask);
+	u->sq_array = u->sq_ring + p->sq_off.array;
+	u->cq_head = u->cq_ring + p->cq_off.head;
+	u->cq_tail = u->cq_ring + p->cq_off.tail;
+	u->cq_mask = *(unsigned int *)(u->cq_ring + p->cq_off.ring_mask);
+	u->cqes = u->cq_ring + p->cq_off.cqes;
+	u->sqe_tail = *u->sq_tail;
+	return 0;
+}
+
+static void rtnl_uring_recycle(struct rtnl_uring *u, unsigned int bid)
+{
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (u->nbufs - 1)];
+
+	b->addr = (unsigned long)(u->bufs + (size_t)bid * RTNL_URING_BUFSZ);
+	b->len = RTNL_URING_BUFSZ;
+	b->bid = bid;
+	__atomic_store_n(&u->br->tail, ++u->br_tail, __ATOMIC_RELEASE);
+}
+
+static int rtnl_uring_bufs(struct rtnl_uring *u)
+{
+	struct io_uring_buf_reg reg = {};
+	unsigned int i;
+
+	u->br_len = u->nbufs * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->br == MAP_FAILED) {
+		u->br = NULL;
+		return -1;
+	}
+	u->bufs = mmap(NULL, (size_t)u->nbufs * RTNL_URING_BUFSZ,
+		       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		       -1, 0);
+	if (u->bufs == MAP_FAILED) {
+		u->bufs = NULL;
+		return -1;
+	}
+
+	reg.ring_addr = (unsigned long)u->br;
+	reg.ring_entries = u->nbufs;
+	reg.bgid = 0;
+	if (io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return -1;
+
+	for (i = 0; i < u->nbufs; i++)
+		rtnl_uring_recycle(u, i);
+	return 0;
+}
+
+static struct io_uring_sqe *rtnl_uring_sqe(struct rtnl_uring *u)
+{
+	unsigned int idx = u->sqe_tail++ & u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	u->pending++;
+	return sqe;
+}
+
+static void rtnl_uring_publish(struct rtnl_uring *u)
+{
+	__atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+}
+
+static void rtnl_uring_arm(struct rtnl_uring *u, int fd)
+{
+	struct io_uring_sqe *sqe = rtnl_uring_sqe(u);
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	/* the length of what did not fit, as recvmsg() tells */
+	sqe->msg_flags = MSG_TRUNC;
+	sqe->user_data = RTNL_URING_RECV;
+	u->armed = true;
+}
+
+/* submit what is pending and wait for min completions */
+static int rtnl_uring_enter(struct rtnl_handle *rth, unsigned int min)
+{
+	struct rtnl_uring *u = rth->uring;
+	int ret;
+
+	rtnl_uring_publish(u);
+	ret = io_uring_enter(u->fd, u->pending, min,
+			     min ? IORING_ENTER_GETEVENTS : 0);
+	if (rth->stats)
+		rth->stats->syscalls++;
+	if (ret < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : -errno;
+	u->pending -= ret;
+	return 0;
+}
+
+/* the oldest completion, if there is one */
+static bool rtnl_uring_cqe(struct rtnl_uring *u, __u64 *user_data,
+			   struct rtnl_uring_cqe *c)
+{
+	unsigned int head = *u->cq_head;
+	struct io_uring_cqe *cqe;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	cqe = &u->cqes[head & u->cq_mask];
+	*user_data = cqe->user_data;
+	c->res = cqe->res;
+	c->flags = cqe->flags;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/*
+ * Switch the receiving and the batches sent on rth to io_uring, with
+ * bufs receive buffers (RTNL_URING_BUFS if 0) of 64k each. If wq_fd
+ * is that of a ring the caller has, the two share their async workers.
+ */
+int rtnl_uring_enable(struct rtnl_handle *rth, unsigned int bufs, int wq_fd)
+{
+	struct io_uring_params p = {};
+	struct rtnl_uring *u;
+
+	if (rth->uring)
+		return 0;
+	/* replaying reads no socket, and the dump cache stores datagrams */
+	if ((rth->flags & RTNL_HANDLE_F_REPLAY) || rth->dcache) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (!bufs)
+		bufs = RTNL_URING_BUFS;
+	if (bufs & (bufs - 1) || bufs > 32768) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	u = calloc(1, sizeof(*u));
+	if (!u)
+		return -1;
+	u->fd = -1;
+	u->nbufs = bufs;
+	/* every buffer can have its datagram waiting, plus an error or two */
+	u->backlog = calloc(bufs + 2, sizeof(*u->backlog));
+	if (!u->backlog)
+		goto err;
+
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = 2 * (bufs + RTNL_URING_SQ);
+	if (wq_fd >= 0) {
+		p.flags |= IORING_SETUP_ATTACH_WQ;
+		p.wq_fd = wq_fd;
+	}
+	u->fd = io_uring_setup(RTNL_URING_SQ, &p);
+	if (u->fd < 0)
+		goto err;
+	if (rtnl_uring_map(u, &p) < 0 || rtnl_uring_bufs(u) < 0)
+		goto err;
+
+	rth->uring = u;
+	return 0;
+
+err:
+	rtnl_uring_destroy(u);
+	return -1;
+}
+
+void rtnl_uring_free(struct rtnl_handle *rth)
+{
+	if (!rth->uring)
+		return;
+	rtnl_uring_destroy(rth->uring);
+	rth->uring = NULL;
+}
+
+/*
+ * The next datagram, in one of the buffers of the ring, which goes back
+ * to it with rtnl_uring_put(). One that did not fit is cut short and has
+ * MSG_TRUNC set in msg_flags, as from recvmsg().
+ */
+int rtnl_uring_recv(struct rtnl_handle *rth, struct msghdr *msg,
+		    char **answer)
+{
+	struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+	struct rtnl_uring *u = rth->uring;
+	struct rtnl_uring_cqe c;
+	unsigned int bid;
+	int err;
+
+	for (;;) {
+		__u64 user_data = RTNL_URING_RECV;
+
+		if (u->bl_count) {
+			c = u->backlog[u->bl_head];
+			u->bl_head = (u->bl_head + 1) % (u->nbufs + 2);
+			u->bl_count--;
+		} else if (!rtnl_uring_cqe(u, &user_data, &c)) {
+			if (!u->armed)
+				rtnl_uring_arm(u, rth->fd);
+			err = rtnl_uring_enter(rth, 1);
+			if (err < 0)
+				return err;
+			continue;
+		}
+
+		/* a stray send, of a chain that was given up on */
+		if (user_data != RTNL_URING_RECV)
+			continue;
+		if (!(c.flags & IORING_CQE_F_MORE))
+			u->armed = false;
+		if (c.res == -ENOBUFS && !(c.flags & IORING_CQE_F_BUFFER))
+			continue;	/* all the buffers were taken, arm again */
+		if (c.res < 0) {
+			errno = -c.res;
+			return c.res;
+		}
+		if (!(c.flags & IORING_CQE_F_BUFFER)) {
+			errno = ENODATA;
+			return -ENODATA;
+		}
+		break;
+	}
+
+	bid = c.flags >> IORING_CQE_BUFFER_SHIFT;
+	*answer = u->bufs + (size_t)bid * RTNL_URING_BUFSZ;
+	msg->msg_flags = 0;
+	if (c.res > RTNL_URING_BUFSZ) {
+		msg->msg_flags = MSG_TRUNC;
+		c.res = RTNL_URING_BUFSZ;
+	}
+	if (msg->msg_name) {
+		/* it is only ever the kernel that answers */
+		memcpy(msg->msg_name, &kernel, sizeof(kernel));
+		msg->msg_namelen = sizeof(kernel);
+	}
+	return c.res;
+}
+
+int rtnl_uring_owns(const struct rtnl_handle *rth, const char *buf)
+{
+	const struct rtnl_uring *u = rth->uring;
+
+	return u && buf >= u->bufs &&
+	       buf < u->bufs + (size_t)u->nbufs * RTNL_URING_BUFSZ;
+}
+
+/* if buf is one of the ring's, give it back */
+int rtnl_uring_put(struct rtnl_handle *rth, const char *buf)
+{
+	struct rtnl_uring *u = rth->uring;
+
+	if (!rtnl_uring_owns(rth, buf))
+		return false;
+
+	rtnl_uring_recycle(u, (buf - u->bufs) / RTNL_URING_BUFSZ);
+	return true;
+}
+
+/*
+ * sendmmsg() as a chain of linked sendmsg: returns how many of the vlen
+ * messages were sent, each with its msg_len set, or -1 and errno if the
+ * first was not.
+ */
+int rtnl_uring_sendmsg(struct rtnl_handle *rth, struct mmsghdr *msgs,
+		       unsigned int vlen)
+{
+	struct rtnl_uring *u = rth->uring;
+	unsigned int i, left = vlen, sent;
+	int err = 0;
+
+	if (vlen > RTNL_URING_SQ - 1)
+		vlen = left = RTNL_URING_SQ - 1;
+
+	for (i = 0; i < vlen; i++) {
+		struct io_uring_sqe *sqe = rtnl_uring_sqe(u);
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = rth->fd;
+		sqe->addr = (unsigned long)&msgs[i].msg_hdr;
+		sqe->len = 1;
+		if (i + 1 < vlen)
+			sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = RTNL_URING_SEND | ((__u64)i << 8);
+		msgs[i].msg_len = 0;
+	}
+
+	sent = vlen;
+	while (left) {
+		struct rtnl_uring_cqe c;
+		__u64 user_data;
+
+		if (!rtnl_uring_cqe(u, &user_data, &c)) {
+			err = rtnl_uring_enter(rth, 1);
+			if (err < 0)
+				break;
+			continue;
+		}
+
+		if (user_data == RTNL_URING_RECV) {
+			unsigned int tail = (u->bl_head + u->bl_count) %
+					    (u->nbufs + 2);
+
+			u->backlog[tail] = c;
+			u->bl_count++;
+			continue;
+		}
+
+		i = user_data >> 8;
+		left--;
+		if (c.res < 0) {
+			if (i < sent) {
+				sent = i;
+				err = c.res;
+			}
+			continue;
+		}
+		msgs[i].msg_len = c.res;
+	}
+
+	if (err < 0 && !sent) {
+		errno = -err;
+		return -1;
+	}
+	return sent;
+}
+
+#else
+
+int rtnl_uring_enable(struct rtnl_handle *rth, unsigned int bufs, int wq_fd)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+void rtnl_uring_free(struct rtnl_handle *rth)
+{
+}
+
+int rtnl_uring_recv(struct rtnl_handle *rth, struct msghdr *msg,
+		    char **answer)
+{
+	return -EOPNOTSUPP;
+}
+
+int rtnl_uring_owns(const struct rtnl_handle *rth, const char *buf)
+{
+	return false;
+}
+
+int rtnl_uring_put(struct rtnl_handle *rth, const char *buf)
+{
+	return false;
+}
+
+int rtnl_uring_sendmsg(struct rtnl_handle *rth, struct mmsghdr *msgs,
+		       unsigned int vlen)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * serve.c	Run batch command lines received on a UNIX socket.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Every command runs in a child forked from the server, so it starts
+ * with the server's open netlink handle and warm caches, while its
+ * exit() calls, crashes and option changes stay its own. The reply to
+ * each command line is a header line "<exit status> <length>\n"
+ * followed by that many bytes of the command's stdout and stderr.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iprt.h"
+#include "utils.h"
+
+static int serve_write(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int serve_one(int conn, serve_cmd_fn cmd, int argc, char **argv)
+{
+	char *out = NULL, hdr[32];
+	size_t outlen = 0, size = 0;
+	int pfd[2], status, code, ret;
+	pid_t pid;
+
+	if (pipe2(pfd, O_CLOEXEC) < 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		dup2(pfd[1], STDOUT_FILENO);
+		dup2(pfd[1], STDERR_FILENO);
+		ret = cmd(argc, argv);
+		fflush(stdout);
+		fflush(stderr);
+		_iprt_exit(ret);
+	}
+
+	close(pfd[1]);
+	for (;;) {
+		ssize_t n;
+
+		if (outlen == size) {
+			char *p = realloc(out, size ? 2 * size : 4096);
+
+			if (!p)
+				break;
+			out = p;
+			size = size ? 2 * size : 4096;
+		}
+		n = read(pfd[0], out + outlen, size - outlen);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		outlen += n;
+	}
+	close(pfd[0]);
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			status = 0xff00;
+			break;
+		}
+	}
+	if (WIFEXITED(status))
+		code = WEXITSTATUS(status);
+	else
+		code = 128 + WTERMSIG(status);
+
+	snprintf(hdr, sizeof(hdr), "%d %zu\n", code, outlen);
+	ret = serve_write(conn, hdr, strlen(hdr));
+	if (ret == 0)
+		ret = serve_write(conn, out, outlen);
+	free(out);
+	return ret;
+}
+
+static void serve_conn(int conn, serve_cmd_fn cmd, serve_sync_fn sync)
+{
+	char *line = NULL;
+	size_t len = 0;
+	FILE *in;
+	int fd;
+
+	fd = dup(conn);
+	in = fd < 0 ? NULL : fdopen(fd, "r");
+	if (!in) {
+		perror("fdopen");
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, in) != -1) {
+		char *largv[BATCH_MAX_ARGS];
+		int largc;
+
+		largc = makeargs(line, largv, BATCH_MAX_ARGS);
+		if (largc == 0)
+			continue;	/* blank line */
+
+		if (sync)
+			sync();
+		if (serve_one(conn, cmd, largc, largv) < 0)
+			break;
+	}
+	free(line);
+	fclose(in);
+}
+
+int serve_cmdlines(const char *path, serve_cmd_fn cmd, serve_sync_fn sync)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	struct stat st;
+	mode_t mask;
+	int fd, err;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path \"%s\" is too long\n", path);
+		return -1;
+	}
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Cannot create socket");
+		return -1;
+	}
+
+	/* replace a socket left over by an earlier server, nothing else */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	/* whoever can connect runs commands with our privileges */
+	mask = umask(077);
+	err = bind(fd, (struct sockaddr *)&sun, sizeof(sun));
+	umask(mask);
+	if (err < 0 || listen(fd, 16) < 0) {
+		fprintf(stderr, "Cannot listen on \"%s\": %s\n",
+			path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			break;
+		}
+		serve_conn(conn, cmd, sync);
+		close(conn);
+	}
+
+	close(fd);
+	return -1;
+}
@@ -0,0 +1,292 @@
+/*
+ * statsd.c	The daemon of nstat, ifstat and rtacct: counters sampled
+ *		on a timer and served to the tools over a unix socket.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Each collector keeps a family of counters in tables of its own and
+ * answers on an abstract socket named after it. All of them are sampled
+ * together on one timer. What a client reads is rendered once per
+ * sample, for the first client that asks, and written from that buffer
+ * to all of them; only a client the socket buffer cannot take at once
+ * is finished by a child, which has the snapshot as it was.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+#define STATSD_MAX		8
+#define STATSD_CHILDREN		5
+
+struct statsd_page {
+	bool		valid;
+	char		*data;
+	size_t		len;
+};
+
+static int statsd_children;
+
+static void statsd_sigchild(int signo)
+{
+}
+
+static long long statsd_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void statsd_rate_init(struct statsd_rate *r, int scan_interval,
+		      int time_constant)
+{
+	r->scan_interval = scan_interval;
+	r->time_constant = time_constant;
+	r->w = 1 - 1/exp(log(10)*(double)scan_interval/time_constant);
+}
+
+void statsd_rate_update(const struct statsd_rate *r, double *rate,
+			unsigned long long incr, int interval)
+{
+	double sample = (double)incr * 1000.0 / interval;
+
+	if (interval >= r->scan_interval) {
+		*rate += r->w*(sample-*rate);
+	} else if (interval >= 1000) {
+		if (interval >= r->time_constant) {
+			*rate = sample;
+		} else {
+			double w = r->w*(double)interval/r->scan_interval;
+
+			*rate += w*(sample-*rate);
+		}
+	}
+}
+
+static socklen_t statsd_addr(struct sockaddr_un *sun, const char *name,
+			     uid_t uid)
+{
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1, "%s%u",
+		 name, (unsigned int)uid);
+	return offsetof(struct sockaddr_un, sun_path) + 1 +
+	       strlen(sun->sun_path + 1);
+}
+
+static int statsd_listen(const char *name)
+{
+	struct sockaddr_un sun;
+	socklen_t len = statsd_addr(&sun, name, getuid());
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "%s: socket: %s\n", name, strerror(errno));
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *)&sun, len) < 0) {
+		fprintf(stderr, "%s: bind: %s\n", name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (listen(fd, 5) < 0) {
+		fprintf(stderr, "%s: listen: %s\n", name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int verify_forging(int fd)
+{
+	struct ucred cred;
+	socklen_t olen = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, (void *)&cred, &olen) ||
+	    olen < sizeof(cred))
+		return -1;
+	if (cred.uid == getuid() || cred.uid == 0)
+		return 0;
+	return -1;
+}
+
+/* The daemon of the user, else that of root, as long as it is one of them */
+int statsd_connect(const char *name)
+{
+	uid_t owners[] = { getuid(), 0 };
+	struct sockaddr_un sun;
+	int fd, i;
+
+	for (i = 0; i < ARRAY_SIZE(owners); i++) {
+		socklen_t len = statsd_addr(&sun, name, owners[i]);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		if (connect(fd, (struct sockaddr *)&sun, len) == 0) {
+			if (verify_forging(fd) == 0)
+				return fd;
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+	return -1;
+}
+
+static int statsd_render(const struct statsd_collector *c,
+			 struct statsd_page *page)
+{
+	FILE *fp;
+
+	free(page->data);
+	page->data = NULL;
+	page->len = 0;
+	page->valid = false;
+
+	fp = open_memstream(&page->data, &page->len);
+	if (!fp)
+		return -1;
+	c->dump(fp);
+	if (fclose(fp))
+		return -1;
+	page->valid = true;
+	return 0;
+}
+
+static void statsd_write(int fd, const char *data, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, data, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		data += n;
+		len -= n;
+	}
+}
+
+static void statsd_serve(const struct statsd_collector *c,
+			 struct statsd_page *page, int lfd)
+{
+	const char *data;
+	size_t len;
+	ssize_t n;
+	pid_t pid;
+	int clnt;
+
+	clnt = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (clnt < 0)
+		return;
+	if (!page->valid && statsd_render(c, page) < 0) {
+		close(clnt);
+		return;
+	}
+
+	data = page->data;
+	len = page->len;
+	do {
+		n = send(clnt, data, len, MSG_NOSIGNAL);
+		if (n > 0) {
+			data += n;
+			len -= n;
+		}
+	} while (len && (n > 0 || (n < 0 && errno == EINTR)));
+
+	if (len && n < 0 && errno == EAGAIN &&
+	    statsd_children < STATSD_CHILDREN) {
+		pid = fork();
+		if (pid == 0) {
+			int flags = fcntl(clnt, F_GETFL);
+
+			fcntl(clnt, F_SETFL, flags & ~O_NONBLOCK);
+			statsd_write(clnt, data, len);
+			_exit(0);
+		}
+		if (pid > 0)
+			statsd_children++;
+	}
+	close(clnt);
+}
+
+int statsd_run(struct statsd_collector *c, unsigned int count,
+	       int scan_interval, int time_constant)
+{
+	struct statsd_page pages[STATSD_MAX] = {};
+	struct pollfd pfds[STATSD_MAX];
+	long long snaptime;
+	unsigned int i;
+
+	if (count > STATSD_MAX)
+		count = STATSD_MAX;
+	for (i = 0; i < count; i++) {
+		pfds[i].fd = statsd_listen(c[i].name);
+		pfds[i].events = POLLIN;
+		if (pfds[i].fd < 0)
+			return -1;
+	}
+
+	if (daemon(0, 0)) {
+		perror("daemon");
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGCHLD, statsd_sigchild);
+
+	for (i = 0; i < count; i++) {
+		if (c[i].source)
+			snprintf(c[i].source, c[i].source_len,
+				 "%d.%lu sampling_interval=%d time_const=%d",
+				 getpid(), (unsigned long)random(),
+				 scan_interval/1000, time_constant/1000);
+		if (c[i].sample(0) < 0)
+			return -1;
+	}
+	snaptime = statsd_now();
+
+	for (;;) {
+		long long now = statsd_now(), wait;
+		int status;
+
+		if (now - snaptime >= scan_interval) {
+			for (i = 0; i < count; i++) {
+				if (c[i].sample(now - snaptime) < 0)
+					return -1;
+				pages[i].valid = false;
+			}
+			snaptime = now;
+		}
+
+		wait = snaptime + scan_interval - now;
+		if (poll(pfds, count, wait < 0 ? 0 : wait) > 0) {
+			for (i = 0; i < count; i++)
+				if (pfds[i].revents & POLLIN)
+					statsd_serve(&c[i], &pages[i],
+						     pfds[i].fd);
+		}
+		while (statsd_children && waitpid(-1, &status, WNOHANG) > 0)
+			statsd_children--;
+	}
+}
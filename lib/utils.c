@@ -30,6 +30,12 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #ifdef HAVE_LIBCAP
 #include <sys/capability.h>
 #endif
@@ -40,9 +46,11 @@
 #include "ll_map.h"
 #include "namespace.h"
 
-int resolve_hosts;
-int timestamp_short;
-int pretty;
+__thread int resolve_hosts;
+__thread int timestamp_short;
+__thread int pretty;
+__thread int ndjson;
+__thread int cbor;
 
 int read_prop(const char *dev, char *prop, long *value)
 {
@@ -284,6 +292,46 @@ int get_time_rtt(unsigned int *val, const char *arg, int *raw)
 
 }
 
+/* seconds between samples, 1ms up to a day */
+int get_sample_interval(double *val, const char *arg)
+{
+	double t;
+	char *p;
+
+	t = strtod(arg, &p);
+	if (p == arg || *p || !(t >= 0.001 && t <= 86400))
+		return -1;
+
+	*val = t;
+	return 0;
+}
+
+double timespec_diff(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+void timespec_add(struct timespec *t, double sec)
+{
+	long nsec = t->tv_nsec + (long)((sec - (long)sec) * 1e9);
+
+	t->tv_sec += (long)sec + nsec / 1000000000L;
+	t->tv_nsec = nsec % 1000000000L;
+}
+
+/*
+ * Move the deadline of the next sample on by interval seconds and sleep
+ * until it. Deadlines are absolute, so time spent sampling does not add
+ * up into drift.
+ */
+void sample_wait(struct timespec *next, double interval)
+{
+	timespec_add(next, interval);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			       next, NULL) == EINTR)
+		;
+}
+
 int get_u64(__u64 *val, const char *arg, int base)
 {
 	unsigned long long res;
@@ -505,6 +553,137 @@ static int get_addr_ipv4(__u8 *ap, const char *cp)
 	return 1;
 }
 
+static inline int dec_digit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+/*
+ * Single pass parser for the common case of plain decimal octets, which
+ * get_addr_ipv4() would parse the same way. Anything else (octal or hex
+ * octets, whitespace, signs or bogus values) is left to the latter, so
+ * this only returns 0 on success and -1 when it does not apply. *cpp is
+ * advanced past the address, which must end the string or a prefix.
+ */
+static int get_addr_ipv4_fast(__u8 *ap, const char **cpp)
+{
+	const char *cp = *cpp;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		unsigned int n;
+
+		if (!dec_digit(cp[0]) || (cp[0] == '0' && dec_digit(cp[1])))
+			return -1;
+
+		n = *cp++ - '0';
+		if (dec_digit(*cp)) {
+			n = n * 10 + *cp++ - '0';
+			if (dec_digit(*cp))
+				n = n * 10 + *cp++ - '0';
+		}
+		if (n > 255 || dec_digit(*cp))
+			return -1;
+
+		ap[i] = n;
+
+		if (*cp != '.')
+			break;
+		if (i == 3)
+			return -1;
+		cp++;
+	}
+
+	if (*cp != '\0' && *cp != '/')
+		return -1;
+
+	*cpp = cp;
+	return 0;
+}
+
+static inline int hex_digit(char c)
+{
+	if (dec_digit(c))
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/*
+ * Same as get_addr_ipv4_fast() for IPv6 addresses without an embedded
+ * IPv4 part, accepting exactly what inet_pton() does for those.
+ */
+static int get_addr_ipv6_fast(__u8 *ap, const char **cpp)
+{
+	const char *cp = *cpp;
+	__u16 grp[8];
+	int i, n = 0, gap = -1;
+
+	if (cp[0] == ':') {
+		if (cp[1] != ':')
+			return -1;
+		cp += 2;
+		gap = 0;
+		if (hex_digit(*cp) < 0)
+			goto done;
+	}
+
+	for (;;) {
+		unsigned int v = 0;
+		int d, h;
+
+		for (d = 0; d < 5 && (h = hex_digit(*cp)) >= 0; d++, cp++)
+			v = v << 4 | h;
+		if (d == 0 || d > 4 || *cp == '.' || n == 8)
+			return -1;
+
+		grp[n++] = v;
+
+		if (*cp != ':')
+			break;
+		cp++;
+		if (*cp == ':') {
+			if (gap >= 0)
+				return -1;
+			gap = n;
+			cp++;
+			if (hex_digit(*cp) < 0)
+				break;
+		}
+	}
+
+done:
+	if (gap < 0 ? n != 8 : n > 7)
+		return -1;
+	if (*cp != '\0' && *cp != '/')
+		return -1;
+
+	memset(ap, 0, 16);
+	for (i = 0; i < n; i++) {
+		int pos = (gap >= 0 && i >= gap) ? 8 - n + i : i;
+
+		ap[2 * pos] = grp[i] >> 8;
+		ap[2 * pos + 1] = grp[i];
+	}
+
+	*cpp = cp;
+	return 0;
+}
+
+/* Either of the above, as family permits. Returns the family or -1. */
+static int get_addr_fast(__u8 *ap, const char **cpp, int family)
+{
+	if ((family == AF_UNSPEC || family == AF_INET) &&
+	    !get_addr_ipv4_fast(ap, cpp))
+		return AF_INET;
+	if ((family == AF_UNSPEC || family == AF_INET6) &&
+	    !get_addr_ipv6_fast(ap, cpp))
+		return AF_INET6;
+	return -1;
+}
+
 int get_addr64(__u64 *ap, const char *cp)
 {
 	int i;
@@ -566,6 +745,21 @@ static int __get_addr_1(inet_prefix *addr, const char *name, int family)
 {
 	memset(addr, 0, sizeof(*addr));
 
+	if (family == AF_UNSPEC || family == AF_INET || family == AF_INET6) {
+		const char *cp = name;
+		__u8 ap[16] = {};
+		int af;
+
+		af = get_addr_fast(ap, &cp, family);
+		if (af > 0 && *cp == '\0') {
+			addr->family = af;
+			addr->bytelen = af_byte_len(af);
+			memcpy(addr->data, ap, addr->bytelen);
+			addr->bitlen = -1;
+			return 0;
+		}
+	}
+
 	if (strcmp(name, "default") == 0) {
 		if ((family == AF_DECnet) || (family == AF_MPLS))
 			return -1;
@@ -691,11 +885,55 @@ int af_byte_len(int af)
 	return af_bit_len(af) / 8;
 }
 
+/*
+ * Plain IPv4 and IPv6 prefixes, e.g. from route files, in one pass without
+ * the generic family probing. Returns -1 to fall back to the latter.
+ */
+static int get_prefix_fast(inet_prefix *dst, const char *arg, int family)
+{
+	const char *cp = arg;
+	unsigned int plen;
+	int af, flags = 0;
+	__u8 ap[16] = {};
+
+	af = get_addr_fast(ap, &cp, family);
+	if (af < 0)
+		return -1;
+
+	plen = af_bit_len(af);
+	if (*cp == '/') {
+		cp++;
+		if (!dec_digit(cp[0]) || (cp[0] == '0' && dec_digit(cp[1])))
+			return -1;
+		plen = *cp++ - '0';
+		while (dec_digit(*cp) && plen < 100)
+			plen = plen * 10 + *cp++ - '0';
+		if (plen > af_bit_len(af))
+			return -1;
+		flags |= PREFIXLEN_SPECIFIED;
+	}
+	if (*cp != '\0')
+		return -1;
+
+	memset(dst, 0, sizeof(*dst));
+	dst->family = af;
+	dst->bytelen = af_byte_len(af);
+	memcpy(dst->data, ap, dst->bytelen);
+	set_address_type(dst);
+	dst->flags |= flags;
+	dst->bitlen = plen;
+	return 0;
+}
+
 int get_prefix_1(inet_prefix *dst, char *arg, int family)
 {
 	char *slash;
 	int err, bitlen, flags;
 
+	if ((family == AF_UNSPEC || family == AF_INET ||
+	     family == AF_INET6) && !get_prefix_fast(dst, arg, family))
+		return 0;
+
 	slash = strchr(arg, '/');
 	if (slash)
 		*slash = 0;
@@ -1002,13 +1240,65 @@ int __get_user_hz(void)
 	return sysconf(_SC_CLK_TCK);
 }
 
+/*
+ * Route dumps print the same gateways and sources over and over, so keep
+ * the last formatted string per slot of a small direct-mapped cache and
+ * hand out copies of it instead of running inet_ntop() again.
+ */
+#define NTOP_CACHE_BITS	8
+
+struct ntop_cache {
+	__u8	family;
+	__u8	slen;
+	__u8	addr[16];
+	char	str[INET6_ADDRSTRLEN];
+};
+
+static __thread struct ntop_cache ntop_cache[1 << NTOP_CACHE_BITS];
+
+static const char *inet_ntop_cached(int af, const void *addr,
+				    char *buf, int buflen)
+{
+	int i, alen = af == AF_INET ? 4 : 16;
+	struct ntop_cache *c;
+	__u32 w, hash = 0;
+	size_t slen;
+
+	for (i = 0; i < alen; i += 4) {
+		memcpy(&w, (const __u8 *)addr + i, 4);
+		hash = (hash ^ w) * 0x9e3779b1;
+	}
+	c = &ntop_cache[hash >> (32 - NTOP_CACHE_BITS)];
+
+	if (c->family == af && memcmp(c->addr, addr, alen) == 0) {
+		if (c->slen >= buflen) {
+			errno = ENOSPC;
+			return NULL;
+		}
+		memcpy(buf, c->str, c->slen + 1);
+		return buf;
+	}
+
+	if (inet_ntop(af, addr, buf, buflen) == NULL)
+		return NULL;
+
+	slen = strlen(buf);
+	if (slen < sizeof(c->str)) {
+		c->family = af;
+		c->slen = slen;
+		memcpy(c->addr, addr, alen);
+		memcpy(c->str, buf, slen + 1);
+	}
+	return buf;
+}
+
 const char *rt_addr_n2a_r(int af, int len,
 			  const void *addr, char *buf, int buflen)
 {
 	switch (af) {
 	case AF_INET:
 	case AF_INET6:
-		return inet_ntop(af, addr, buf, buflen);
+		return inet_ntop_cached(af, addr, buf, buflen);
 	case AF_MPLS:
 		return mpls_ntop(af, addr, buf, buflen);
 	case AF_IPX:
@@ -1032,11 +1322,11 @@ const char *rt_addr_n2a_r(int af, int len,
 
 		switch (sa->sa.sa_family) {
 		case AF_INET:
-			return inet_ntop(AF_INET, &sa->sin.sin_addr,
-					 buf, buflen);
+			return inet_ntop_cached(AF_INET, &sa->sin.sin_addr,
+						buf, buflen);
 		case AF_INET6:
-			return inet_ntop(AF_INET6, &sa->sin6.sin6_addr,
-					 buf, buflen);
+			return inet_ntop_cached(AF_INET6, &sa->sin6.sin6_addr,
+						buf, buflen);
 		}
 
 		/* fallthrough */
@@ -1048,7 +1338,7 @@ const char *rt_addr_n2a_r(int af, int len,
 
 const char *rt_addr_n2a(int af, int len, const void *addr)
 {
-	static char buf[256];
+	static __thread char buf[256];
 
 	return rt_addr_n2a_r(af, len, addr, buf, 256);
 }
@@ -1100,32 +1390,67 @@ struct namerec {
 	inet_prefix addr;
 };
 
-#define NHASH 257
-static struct namerec *nht[NHASH];
+/* grown as it fills, names of thousands of peers are remembered */
+static __thread struct namerec **nht;
+static __thread unsigned int nht_size, nht_count;
 
-static const char *resolve_address(const void *addr, int len, int af)
+static unsigned int namerec_hash(const void *addr, int len)
 {
-	struct namerec *n;
-	struct hostent *h_ent;
-	unsigned int hash;
-	static int notfirst;
+	const __u8 *p = addr;
+	__u32 h = 2166136261U;
+	int i;
 
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h & (nht_size - 1);
+}
 
-	if (af == AF_INET6 && ((__u32 *)addr)[0] == 0 &&
-	    ((__u32 *)addr)[1] == 0 && ((__u32 *)addr)[2] == htonl(0xffff)) {
-		af = AF_INET;
-		addr += 12;
-		len = 4;
-	}
+static struct namerec *namerec_find(const void *addr, int len, int af)
+{
+	struct namerec *n;
 
-	hash = *(__u32 *)(addr + len - 4) % NHASH;
+	if (!nht)
+		return NULL;
 
-	for (n = nht[hash]; n; n = n->next) {
+	for (n = nht[namerec_hash(addr, len)]; n; n = n->next) {
 		if (n->addr.family == af &&
 		    n->addr.bytelen == len &&
 		    memcmp(n->addr.data, addr, len) == 0)
-			return n->name;
+			return n;
 	}
+	return NULL;
+}
+
+static struct namerec *namerec_add(const void *addr, int len, int af)
+{
+	struct namerec *n;
+	unsigned int h;
+
+	if (nht_count >= nht_size) {
+		unsigned int i, size = nht_size;
+		struct namerec **old = nht;
+
+		nht_size = size ? 2 * size : 256;
+		nht = calloc(nht_size, sizeof(*nht));
+		if (!nht) {
+			nht = old;
+			nht_size = size;
+			if (!nht)
+				return NULL;
+		} else {
+			for (i = 0; i < size; i++) {
+				while ((n = old[i]) != NULL) {
+					old[i] = n->next;
+					h = namerec_hash(n->addr.data,
+							 n->addr.bytelen);
+					n->next = nht[h];
+					nht[h] = n;
+				}
+			}
+			free(old);
+		}
+	}
+
 	n = malloc(sizeof(*n));
 	if (n == NULL)
 		return NULL;
@@ -1133,19 +1458,283 @@ static const char *resolve_address(const void *addr, int len, int af)
 	n->addr.bytelen = len;
 	n->name = NULL;
 	memcpy(n->addr.data, addr, len);
-	n->next = nht[hash];
-	nht[hash] = n;
+	h = namerec_hash(addr, len);
+	n->next = nht[h];
+	nht[h] = n;
+	nht_count++;
+	return n;
+}
+
+/* IPv4 mapped into IPv6 is looked up as IPv4 */
+static const void *resolve_unmap(const void *addr, int *len, int *af)
+{
+	if (*af == AF_INET6 && ((__u32 *)addr)[0] == 0 &&
+	    ((__u32 *)addr)[1] == 0 && ((__u32 *)addr)[2] == htonl(0xffff)) {
+		*af = AF_INET;
+		*len = 4;
+		return addr + 12;
+	}
+	return addr;
+}
+
+static void resolve_one(struct namerec *r)
+{
+	struct hostent *h_ent;
+
+	h_ent = gethostbyaddr(r->addr.data, r->addr.bytelen, r->addr.family);
+	if (h_ent)
+		r->name = strdup(h_ent->h_name);
+}
+
+static const char *resolve_address(const void *addr, int len, int af)
+{
+	struct namerec *n;
+	static __thread int notfirst;
+
+	addr = resolve_unmap(addr, &len, &af);
+
+	n = namerec_find(addr, len, af);
+	if (n)
+		return n->name;
+	n = namerec_add(addr, len, af);
+	if (n == NULL)
+		return NULL;
 	if (++notfirst == 1)
 		sethostent(1);
 	fflush(stdout);
 
-	h_ent = gethostbyaddr(addr, len, af);
-	if (h_ent != NULL)
-		n->name = strdup(h_ent->h_name);
+	resolve_one(n);
 
 	/* Even if we fail, "negative" entry is remembered. */
 	return n->name;
 }
+
+/*
+ * The names of many addresses can be looked up at once, ahead of printing
+ * them: resolve_host_queue() takes those not cached yet, and
+ * resolve_host_flush() deals them round robin to up to RESOLVE_JOBS
+ * children, each doing its lookups in turn and writing the names back
+ * through a pipe. A child that has been silent for RESOLVE_TIMEOUT
+ * seconds is stuck on a server that does not answer, it is killed and
+ * the addresses left to it are remembered without name.
+ */
+#define RESOLVE_JOBS		32
+#define RESOLVE_PER_JOB		4
+#define RESOLVE_TIMEOUT		5
+
+struct resolve_rec {
+	unsigned int	idx;
+	unsigned int	len;	/* of the name following, 0 for none */
+};
+
+static __thread struct namerec **resolve_todo;
+static __thread unsigned int resolve_todo_len, resolve_todo_size;
+
+struct resolve_job {
+	pid_t		pid;
+	int		fd;
+	time_t		heard;
+	size_t		len;
+	char		buf[sizeof(struct resolve_rec) + NI_MAXHOST];
+};
+
+static void resolve_child(int out, struct namerec **todo, unsigned int n,
+			  unsigned int first, unsigned int step)
+{
+	unsigned int i;
+
+	for (i = first; i < n; i += step) {
+		const inet_prefix *a = &todo[i]->addr;
+		struct hostent *h_ent;
+		struct resolve_rec rec = { .idx = i };
+		struct iovec iov[2] = { { &rec, sizeof(rec) } };
+
+		h_ent = gethostbyaddr(a->data, a->bytelen, a->family);
+		if (h_ent) {
+			rec.len = strnlen(h_ent->h_name, NI_MAXHOST - 1);
+			iov[1].iov_base = h_ent->h_name;
+			iov[1].iov_len = rec.len;
+		}
+		/* no bigger than PIPE_BUF, it goes in one piece */
+		if (writev(out, iov, 2) < 0)
+			_exit(1);
+	}
+	_exit(0);
+}
+
+/* Take the names the job wrote */
+static void resolve_job_read(struct resolve_job *job, struct namerec **todo,
+			     unsigned int n)
+{
+	ssize_t r;
+
+	r = read(job->fd, job->buf + job->len, sizeof(job->buf) - job->len);
+	if (r < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (r <= 0) {
+		close(job->fd);
+		job->fd = -1;
+		return;
+	}
+	job->len += r;
+	job->heard = time(NULL);
+
+	while (job->len >= sizeof(struct resolve_rec)) {
+		struct resolve_rec rec;
+		size_t size;
+
+		memcpy(&rec, job->buf, sizeof(rec));
+		size = sizeof(rec) + rec.len;
+		if (job->len < size)
+			break;
+		if (rec.idx < n && rec.len)
+			todo[rec.idx]->name = strndup(job->buf + sizeof(rec),
+						     rec.len);
+		job->len -= size;
+		memmove(job->buf, job->buf + size, job->len);
+	}
+}
+
+void resolve_host_queue(int af, int len, const void *addr)
+{
+	struct namerec *n;
+
+	if (!resolve_hosts)
+		return;
+
+	len = len <= 0 ? af_byte_len(af) : len;
+	if (len <= 0)
+		return;
+	addr = resolve_unmap(addr, &len, &af);
+	if (namerec_find(addr, len, af))
+		return;
+
+	if (resolve_todo_len == resolve_todo_size) {
+		unsigned int size = resolve_todo_size ? 2 * resolve_todo_size
+						      : 1024;
+		struct namerec **p;
+
+		p = realloc(resolve_todo, size * sizeof(*p));
+		if (!p)
+			return;
+		resolve_todo = p;
+		resolve_todo_size = size;
+	}
+
+	/* format_host() takes it as it is, with no name, until the flush */
+	n = namerec_add(addr, len, af);
+	if (n)
+		resolve_todo[resolve_todo_len++] = n;
+}
+
+void resolve_host_flush(void)
+{
+	struct resolve_job jobs[RESOLVE_JOBS];
+	struct pollfd pfds[RESOLVE_JOBS];
+	struct namerec **todo = resolve_todo;
+	unsigned int n = resolve_todo_len, njobs, i, left;
+
+	resolve_todo = NULL;
+	resolve_todo_len = resolve_todo_size = 0;
+	if (!n) {
+		free(todo);
+		return;
+	}
+
+	njobs = (n + RESOLVE_PER_JOB - 1) / RESOLVE_PER_JOB;
+	if (njobs > RESOLVE_JOBS)
+		njobs = RESOLVE_JOBS;
+	if (njobs <= 1) {
+		/* one by one, as format_host() would */
+		for (i = 0; i < n; i++)
+			resolve_one(todo[i]);
+		free(todo);
+		return;
+	}
+
+	fflush(NULL);
+	for (i = 0; i < njobs; i++) {
+		unsigned int j;
+		int pfd[2];
+
+		jobs[i].fd = -1;
+		jobs[i].len = 0;
+		jobs[i].heard = time(NULL);
+		jobs[i].pid = -1;
+		if (pipe2(pfd, O_CLOEXEC) < 0)
+			continue;
+		jobs[i].pid = fork();
+		if (jobs[i].pid < 0) {
+			/* the parent does its share itself, after the others */
+			close(pfd[0]);
+			close(pfd[1]);
+			continue;
+		}
+		if (jobs[i].pid == 0) {
+			for (j = 0; j < i; j++)
+				if (jobs[j].fd >= 0)
+					close(jobs[j].fd);
+			close(pfd[0]);
+			resolve_child(pfd[1], todo, n, i, njobs);
+		}
+		close(pfd[1]);
+		jobs[i].fd = pfd[0];
+	}
+
+	for (;;) {
+		unsigned int nfds = 0;
+		time_t now = time(NULL);
+
+		for (i = 0, left = 0; i < njobs; i++) {
+			if (jobs[i].fd < 0)
+				continue;
+			if (now - jobs[i].heard >= RESOLVE_TIMEOUT) {
+				kill(jobs[i].pid, SIGKILL);
+				close(jobs[i].fd);
+				jobs[i].fd = -1;
+				continue;
+			}
+			pfds[nfds].fd = jobs[i].fd;
+			pfds[nfds++].events = POLLIN;
+			left++;
+		}
+		if (!left)
+			break;
+		if (poll(pfds, nfds, 1000) < 0 && errno != EINTR)
+			break;
+
+		for (i = 0, nfds = 0; i < njobs; i++) {
+			if (jobs[i].fd < 0)
+				continue;
+			if (pfds[nfds++].revents)
+				resolve_job_read(&jobs[i], todo, n);
+		}
+	}
+
+	for (i = 0; i < njobs; i++) {
+		unsigned int j;
+
+		if (jobs[i].pid < 0) {
+			for (j = i; j < n; j += njobs)
+				resolve_one(todo[j]);
+			continue;
+		}
+		if (jobs[i].fd >= 0) {
+			kill(jobs[i].pid, SIGKILL);
+			close(jobs[i].fd);
+		}
+		waitpid(jobs[i].pid, NULL, 0);
+	}
+	free(todo);
+}
+#else
+void resolve_host_queue(int af, int len, const void *addr)
+{
+}
+
+void resolve_host_flush(void)
+{
+}
 #endif
 
 const char *format_host_r(int af, int len, const void *addr,
@@ -1167,7 +1756,7 @@ const char *format_host_r(int af, int len, const void *addr,
 
 const char *format_host(int af, int len, const void *addr)
 {
-	static char buf[256];
+	static __thread char buf[256];
 
 	return format_host_r(af, len, addr, buf, 256);
 }
@@ -1347,7 +1936,7 @@ unsigned int print_name_and_link(const char *fmt,
 	return m_flag;
 }
 
-int cmdlineno;
+__thread int cmdlineno;
 
 /* Like glibc getline but handle continuation lines and comments */
 ssize_t getcmdline(char **linep, size_t *lenp, FILE *in)
@@ -1396,8 +1985,11 @@ ssize_t getcmdline(char **linep, size_t *lenp, FILE *in)
 	return cc;
 }
 
-/* split command line into argument vector */
-int makeargs(char *line, char *argv[], int maxargs)
+/*
+ * Split a command line into words, in place. The vector grows when
+ * there is room to grow it with, *maxp being what it holds.
+ */
+static int splitargs(char *line, char ***argvp, int *maxp, bool grow)
 {
 	static const char ws[] = " \t\r\n";
 	char *cp = line;
@@ -1410,16 +2002,26 @@ int makeargs(char *line, char *argv[], int maxargs)
 		if (*cp == '\0')
 			break;
 
-		if (argc >= (maxargs - 1)) {
-			fprintf(stderr, "Too many arguments to command\n");
-			iprt_exit(1);
+		if (argc >= (*maxp - 1)) {
+			char **argv = NULL;
+
+			if (grow)
+				argv = realloc(*argvp,
+					       2 * *maxp * sizeof(char *));
+			if (!argv) {
+				fprintf(stderr, grow ? "Out of memory\n" :
+					"Too many arguments to command\n");
+				iprt_exit(1);
+			}
+			*argvp = argv;
+			*maxp *= 2;
 		}
 
 		/* word begins with quote */
 		if (*cp == '\'' || *cp == '"') {
 			char quote = *cp++;
 
-			argv[argc++] = cp;
+			(*argvp)[argc++] = cp;
 			/* find ending quote */
 			cp = strchr(cp, quote);
 			if (cp == NULL) {
@@ -1427,7 +2029,7 @@ int makeargs(char *line, char *argv[], int maxargs)
 				iprt_exit(1);
 			}
 		} else {
-			argv[argc++] = cp;
+			(*argvp)[argc++] = cp;
 
 			/* find end of word */
 			cp += strcspn(cp, ws);
@@ -1438,11 +2040,189 @@ int makeargs(char *line, char *argv[], int maxargs)
 		/* seperate words */
 		*cp++ = 0;
 	}
-	argv[argc] = NULL;
+	(*argvp)[argc] = NULL;
 
 	return argc;
 }
 
+/* split command line into argument vector */
+int makeargs(char *line, char *argv[], int maxargs)
+{
+	return splitargs(line, &argv, &maxargs, false);
+}
+
+/*
+ * A batch file that can be mapped is read where it lies: words are cut
+ * in the mapping, which is private, and only continued lines are moved
+ * to join their pieces. Pages ahead of the line being run are asked for
+ * in advance so that reading them does not wait for the disk. Anything
+ * else, a pipe or a terminal, is read a line at a time with
+ * getcmdline().
+ */
+#define CMDFILE_AHEAD	(4 << 20)
+
+struct cmdfile {
+	FILE		*in;
+	char		*map;
+	size_t		size;
+	size_t		pos;
+	size_t		advised;
+	char		*line;
+	size_t		len;
+	char		**argv;
+	int		max;
+};
+
+static int cmdfile_map(struct cmdfile *cf, int fd)
+{
+	struct stat st;
+	off_t off;
+	char *res;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return -1;
+	off = lseek(fd, 0, SEEK_CUR);
+	if (off < 0 || off >= st.st_size)
+		return -1;
+
+	/* the byte past the end ends the last line, even on a page boundary */
+	res = mmap(NULL, st.st_size + 1, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED)
+		return -1;
+	if (mmap(res, st.st_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(res, st.st_size + 1);
+		return -1;
+	}
+	madvise(res, st.st_size, MADV_SEQUENTIAL);
+
+	cf->map = res;
+	cf->size = st.st_size;
+	cf->pos = off;
+	cf->advised = off;
+	return 0;
+}
+
+/* NULL or "-" is stdin */
+struct cmdfile *cmdfile_open(const char *name)
+{
+	struct cmdfile *cf;
+	int fd = STDIN_FILENO;
+
+	cf = calloc(1, sizeof(*cf));
+	if (!cf)
+		return NULL;
+	cf->max = 64;
+	cf->argv = malloc(cf->max * sizeof(char *));
+	if (!cf->argv)
+		goto err;
+
+	if (name && strcmp(name, "-") != 0) {
+		fd = open(name, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			goto err;
+		}
+	}
+
+	if (cmdfile_map(cf, fd) == 0) {
+		if (fd != STDIN_FILENO)
+			close(fd);
+		return cf;
+	}
+
+	cf->in = fd == STDIN_FILENO ? stdin : fdopen(fd, "r");
+	if (cf->in)
+		return cf;
+	close(fd);
+err:
+	free(cf->argv);
+	free(cf);
+	return NULL;
+}
+
+/* the next line, comments cut and continuation lines joined to it */
+static char *cmdfile_line(struct cmdfile *cf)
+{
+	char *start, *w, *p, *end, *nl, *hash;
+	bool cont;
+
+	if (cf->pos >= cf->size)
+		return NULL;
+
+	start = w = cf->map + cf->pos;
+	do {
+		if (cf->pos >= cf->size) {
+			fprintf(stderr, "Missing continuation line\n");
+			return NULL;
+		}
+		p = cf->map + cf->pos;
+		nl = memchr(p, '\n', cf->size - cf->pos);
+		end = nl ? nl : cf->map + cf->size;
+		cf->pos = end - cf->map + !!nl;
+		++cmdlineno;
+
+		hash = memchr(p, '#', end - p);
+		cont = !hash && nl && end > p && end[-1] == '\\';
+		if (hash)
+			end = hash;
+		else if (cont)
+			end--;
+
+		if (w != p)
+			memmove(w, p, end - p);
+		w += end - p;
+	} while (cont);
+	*w = '\0';
+
+	if (cf->pos + CMDFILE_AHEAD / 2 > cf->advised &&
+	    cf->advised < cf->size) {
+		size_t from = cf->advised & ~((size_t)getpagesize() - 1);
+
+		madvise(cf->map + from, CMDFILE_AHEAD, MADV_WILLNEED);
+		cf->advised = from + CMDFILE_AHEAD;
+	}
+	return start;
+}
+
+/*
+ * Words of the next line into *argvp, which stays valid until the next
+ * call; their number, 0 for a blank line, or -1 at the end.
+ */
+int cmdfile_next(struct cmdfile *cf, char ***argvp)
+{
+	char *line;
+	int argc;
+
+	if (cf->in) {
+		if (getcmdline(&cf->line, &cf->len, cf->in) == -1)
+			return -1;
+		line = cf->line;
+	} else {
+		line = cmdfile_line(cf);
+		if (!line)
+			return -1;
+	}
+
+	argc = splitargs(line, &cf->argv, &cf->max, true);
+	*argvp = cf->argv;
+	return argc;
+}
+
+void cmdfile_close(struct cmdfile *cf)
+{
+	if (cf->map)
+		munmap(cf->map, cf->size + 1);
+	if (cf->in && cf->in != stdin)
+		fclose(cf->in);
+	free(cf->line);
+	free(cf->argv);
+	free(cf);
+}
+
 void print_nlmsg_timestamp(FILE *fp, const struct nlmsghdr *n)
 {
 	char *tstr;
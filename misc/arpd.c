@@ -22,13 +22,16 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <signal.h>
 #include <linux/if.h>
 #include <linux/if_ether.h>
 #include <linux/if_arp.h>
+#include <linux/netdevice.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <linux/if_packet.h>
@@ -61,13 +64,15 @@ struct rtnl_handle rth;
 struct pollfd pset[2];
 int udp_sock = -1;
 
-volatile int do_iprt_exit;
+volatile int do_exit;
 volatile int do_sync;
 volatile int do_stats;
 
 struct {
 	unsigned long arp_new;
 	unsigned long arp_change;
+	unsigned long arp_drops;	/* by the ring, for want of room */
+	unsigned long arp_freezes;
 
 	unsigned long app_recv;
 	unsigned long app_success;
@@ -80,6 +85,7 @@ struct {
 	unsigned long kern_change;
 
 	unsigned long probes_sent;
+	unsigned long probes_delayed;
 	unsigned long probes_suppressed;
 } stats;
 
@@ -233,34 +239,7 @@ static int send_probe(int ifindex, __u32 addr)
 	return 0;
 }
 
-/* Be very tough on sending probes: 1 per second with burst of 3. */
-
-static int queue_active_probe(int ifindex, __u32 addr)
-{
-	static struct timeval prev;
-	static int buckets;
-	struct timeval now;
-
-	gettimeofday(&now, NULL);
-	if (prev.tv_sec) {
-		int diff = (now.tv_sec-prev.tv_sec)*1000+(now.tv_usec-prev.tv_usec)/1000;
-
-		buckets += diff;
-	} else {
-		buckets = broadcast_burst;
-	}
-	if (buckets > broadcast_burst)
-		buckets = broadcast_burst;
-	if (buckets >= broadcast_rate && !send_probe(ifindex, addr)) {
-		buckets -= broadcast_rate;
-		prev = now;
-		return 0;
-	}
-	stats.probes_suppressed++;
-	return -1;
-}
-
-static int respond_to_kernel(int ifindex, __u32 addr, char *lla, int llalen)
+static int respond_to_kernel(int ifindex, __u32 addr, const void *lla, int llalen)
 {
 	struct {
 		struct nlmsghdr	n;
@@ -292,17 +271,586 @@ static void prepare_neg_entry(__u8 *ndata, __u32 stamp)
 }
 
 
+/*
+ * arpd answers from this table, which holds everything the DB file
+ * does. The file is read into it once at start, and what changed since
+ * is written back by a child process at each sync, so no resolution
+ * ever waits for the disk. The table is open addressed with linear
+ * probing, and removing an entry moves up those after it.
+ */
+struct arp_ent {
+	struct dbkey	key;
+	__u8		used;
+	__u8		dirty;		/* changed since the last store */
+	__u8		stored;		/* probably in the DB file */
+	__u8		len;
+	__u8		data[MAX_ADDR_LEN];	/* lla or negative entry */
+};
+
+static struct arp_ent *arp_tab;
+static unsigned int arp_size;		/* a power of two */
+static unsigned int arp_used;
+static unsigned int arp_ndirty;
+
+/* removed from the table, but maybe still in the file */
+static struct dbkey *arp_gone;
+static unsigned int arp_ngone, arp_gone_size;
+
+static pid_t arp_writer;		/* child storing, if any */
+static unsigned int arp_writer_gone;	/* the arp_gone it does */
+
+static unsigned int arp_hash(const struct dbkey *key)
+{
+	__u32 h = key->addr * 0x9e3779b1 ^ key->iface * 0x85ebca6b;
+
+	h ^= h >> 16;
+	return h * 0x7feb352d;
+}
+
+static struct arp_ent *arp_slot(const struct dbkey *key)
+{
+	unsigned int i = arp_hash(key) & (arp_size - 1);
+
+	while (arp_tab[i].used &&
+	       (arp_tab[i].key.iface != key->iface ||
+		arp_tab[i].key.addr != key->addr))
+		i = (i + 1) & (arp_size - 1);
+	return &arp_tab[i];
+}
+
+static struct arp_ent *arp_find(const struct dbkey *key)
+{
+	struct arp_ent *e;
+
+	if (!arp_size)
+		return NULL;
+	e = arp_slot(key);
+	return e->used ? e : NULL;
+}
+
+static int arp_resize(unsigned int size)
+{
+	struct arp_ent *old = arp_tab;
+	unsigned int i, old_size = arp_size;
+
+	arp_tab = calloc(size, sizeof(*arp_tab));
+	if (!arp_tab) {
+		arp_tab = old;
+		return -1;
+	}
+	arp_size = size;
+	for (i = 0; i < old_size; i++)
+		if (old[i].used)
+			*arp_slot(&old[i].key) = old[i];
+	free(old);
+	return 0;
+}
+
+static void arp_dirty(struct arp_ent *e)
+{
+	if (!e->dirty)
+		arp_ndirty++;
+	e->dirty = 1;
+}
+
+static struct arp_ent *arp_put(const struct dbkey *key, const void *data,
+			       int len)
+{
+	struct arp_ent *e;
+
+	if (len > MAX_ADDR_LEN)
+		return NULL;
+	if (4 * (arp_used + 1) > 3 * arp_size &&
+	    arp_resize(arp_size ? 2 * arp_size : 1024) < 0) {
+		syslog(LOG_ERR, "cannot grow the table: %m");
+		return NULL;
+	}
+
+	e = arp_slot(key);
+	if (!e->used) {
+		memset(e, 0, sizeof(*e));
+		e->key = *key;
+		e->used = 1;
+		arp_used++;
+	}
+	memcpy(e->data, data, len);
+	e->len = len;
+	arp_dirty(e);
+	return e;
+}
+
+static void arp_del(struct arp_ent *e)
+{
+	unsigned int i = e - arp_tab, j = i;
+
+	if (e->stored) {
+		if (arp_ngone == arp_gone_size) {
+			unsigned int size = arp_gone_size ? 2 * arp_gone_size : 64;
+			struct dbkey *p = realloc(arp_gone, size * sizeof(*p));
+
+			if (!p) {
+				/* left in, so the file gets it right */
+				syslog(LOG_ERR, "cannot remove entry: %m");
+				return;
+			}
+			arp_gone = p;
+			arp_gone_size = size;
+		}
+		arp_gone[arp_ngone++] = e->key;
+	}
+	if (e->dirty)
+		arp_ndirty--;
+	arp_used--;
+
+	/* what probed past i moves up to it, unless it sits at home */
+	for (;;) {
+		unsigned int home;
+
+		arp_tab[i].used = 0;
+		do {
+			j = (j + 1) & (arp_size - 1);
+			if (!arp_tab[j].used)
+				return;
+			home = arp_hash(&arp_tab[j].key) & (arp_size - 1);
+		} while (i <= j ? (i < home && home <= j)
+				: (i < home || home <= j));
+		arp_tab[i] = arp_tab[j];
+		i = j;
+	}
+}
+
+/* Read the DB file into the table and close it */
+static int arp_load(void)
+{
+	DBT dbkey, dbdat;
+
+	while (dbase->seq(dbase, &dbkey, &dbdat, R_NEXT) == 0) {
+		struct arp_ent *e;
+
+		if (dbkey.size != sizeof(struct dbkey))
+			continue;
+		e = arp_put(dbkey.data, dbdat.data, dbdat.size);
+		if (!e)
+			continue;
+		e->dirty = 0;
+		e->stored = 1;
+	}
+	arp_ndirty = 0;
+	dbase->close(dbase);
+	dbase = NULL;
+	return 0;
+}
+
+/* Write what changed to the file, from a handle of its own */
+static int arp_store(void)
+{
+	DB *db = dbopen(dbname, O_CREAT|O_RDWR, 0644, DB_HASH, NULL);
+	unsigned int i;
+	int ret = 0;
+
+	if (!db)
+		return -1;
+	for (i = 0; i < arp_ngone; i++) {
+		DBT dbkey = { &arp_gone[i], sizeof(arp_gone[i]) };
+
+		if (db->del(db, &dbkey, 0) < 0)
+			ret = -1;
+	}
+	for (i = 0; i < arp_size; i++) {
+		struct arp_ent *e = &arp_tab[i];
+		DBT dbkey = { &e->key, sizeof(e->key) };
+		DBT dbdat = { e->data, e->len };
+
+		if (e->used && e->dirty && db->put(db, &dbkey, &dbdat, 0))
+			ret = -1;
+	}
+	if (db->sync(db, 0))
+		ret = -1;
+	if (db->close(db))
+		ret = -1;
+	return ret;
+}
+
+/* what is being stored is taken as stored */
+static void arp_stored(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < arp_size; i++) {
+		if (arp_tab[i].used && arp_tab[i].dirty) {
+			arp_tab[i].dirty = 0;
+			arp_tab[i].stored = 1;
+		}
+	}
+	arp_ndirty = 0;
+}
+
+static void arp_writer_done(int status)
+{
+	unsigned int i;
+
+	arp_writer = 0;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		arp_ngone -= arp_writer_gone;
+		memmove(arp_gone, arp_gone + arp_writer_gone,
+			arp_ngone * sizeof(*arp_gone));
+		return;
+	}
+
+	/* all goes again next time */
+	syslog(LOG_ERR, "cannot store the table in %s", dbname);
+	for (i = 0; i < arp_size; i++)
+		if (arp_tab[i].used)
+			arp_dirty(&arp_tab[i]);
+}
+
+/*
+ * Store what changed, in a child unless wait is set. Only one child
+ * runs at a time, while it does a sync is put off to the next one.
+ */
+static void arp_sync(int wait)
+{
+	int status;
+	pid_t pid;
+
+	if (arp_writer) {
+		pid = waitpid(arp_writer, &status, wait ? 0 : WNOHANG);
+		if (pid == 0)
+			return;
+		arp_writer_done(pid > 0 ? status : -1);
+	}
+	if (!arp_ndirty && !arp_ngone)
+		return;
+
+	if (wait) {
+		if (arp_store() == 0) {
+			arp_stored();
+			arp_ngone = 0;
+		} else {
+			syslog(LOG_ERR, "cannot store the table in %s", dbname);
+		}
+		return;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		syslog(LOG_ERR, "fork: %m");
+		return;
+	}
+	if (pid == 0)
+		_exit(arp_store() ? 1 : 0);
+	arp_writer = pid;
+	arp_writer_gone = arp_ngone;
+	arp_stored();
+}
+
+/*
+ * Probes are paced per interface, 1 per second with bursts of 3 unless
+ * told otherwise. One that finds the bucket of its interface empty
+ * waits on a timer for its turn, as long as no more than a burst is
+ * waiting, and is dropped only then. Negative entries are dropped on a
+ * timer once they time out.
+ *
+ * The timers are on a hierarchical wheel: ARP_WHEEL_LEVELS rings of
+ * ARP_WHEEL_SIZE slots, a slot of each ring spanning a whole turn of
+ * the ring below. A timer goes into the finest ring its delay fits in
+ * and drops a ring each time the ring below wraps around to its slot,
+ * so that adding and running one costs the same however many there
+ * are, and the next wakeup is read off the first busy slots.
+ */
+#define ARP_TICK		10		/* ms */
+#define ARP_WHEEL_BITS		6
+#define ARP_WHEEL_SIZE		(1 << ARP_WHEEL_BITS)
+#define ARP_WHEEL_MASK		(ARP_WHEEL_SIZE - 1)
+#define ARP_WHEEL_LEVELS	4
+#define ARP_WHEEL_SPAN		(1U << (ARP_WHEEL_BITS * ARP_WHEEL_LEVELS))
+
+enum {
+	ARP_TIMER_PROBE,
+	ARP_TIMER_NEG,
+};
+
+struct arp_timer {
+	struct arp_timer	*next;
+	__u32			expires;	/* tick */
+	int			kind;
+	struct dbkey		key;
+};
+
+static struct arp_timer *arp_wheel[ARP_WHEEL_LEVELS][ARP_WHEEL_SIZE];
+static struct arp_timer *arp_timer_pool;	/* unused ones */
+static unsigned int arp_ntimers;
+static __u32 arp_jiffies;			/* the next tick to run */
+static long long arp_epoch;			/* ms of tick 0 */
+
+struct arp_bucket {
+	int		ifindex;		/* 0 for a free slot */
+	int		credit;			/* ms, below 0 if owed */
+	long long	stamp;
+};
+
+static struct arp_bucket *arp_buckets;
+static unsigned int arp_bucket_size, arp_nbuckets;
+
+static long long arp_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static __u32 arp_ticks(long long ms)
+{
+	return (ms - arp_epoch) / ARP_TICK;
+}
+
+static void arp_timer_queue(struct arp_timer *t)
+{
+	__u32 delta = t->expires - arp_jiffies;
+	struct arp_timer **slot;
+	int lvl;
+
+	if ((__s32)delta < 0) {
+		t->expires = arp_jiffies;
+		delta = 0;
+	} else if (delta >= ARP_WHEEL_SPAN) {
+		t->expires = arp_jiffies + ARP_WHEEL_SPAN - 1;
+		delta = ARP_WHEEL_SPAN - 1;
+	}
+	for (lvl = 0; lvl < ARP_WHEEL_LEVELS - 1; lvl++)
+		if (delta < 1U << (ARP_WHEEL_BITS * (lvl + 1)))
+			break;
+
+	slot = &arp_wheel[lvl][(t->expires >> (ARP_WHEEL_BITS * lvl)) &
+			       ARP_WHEEL_MASK];
+	t->next = *slot;
+	*slot = t;
+}
+
+static int arp_timer_add(int kind, const struct dbkey *key, long long ms)
+{
+	struct arp_timer *t = arp_timer_pool;
+
+	if (t) {
+		arp_timer_pool = t->next;
+	} else {
+		t = malloc(sizeof(*t));
+		if (!t) {
+			syslog(LOG_ERR, "cannot add a timer: %m");
+			return -1;
+		}
+	}
+	t->kind = kind;
+	t->key = *key;
+	t->expires = arp_ticks(arp_now() + ms + ARP_TICK - 1);
+	arp_timer_queue(t);
+	arp_ntimers++;
+	return 0;
+}
+
+/* ms until the wheel has to be run again, -1 if it holds nothing */
+static long long arp_timer_wait(long long now)
+{
+	long long wait = -1;
+	int lvl, d;
+
+	if (!arp_ntimers)
+		return -1;
+
+	for (lvl = 0; lvl < ARP_WHEEL_LEVELS; lvl++) {
+		int shift = ARP_WHEEL_BITS * lvl;
+		__u32 pos = arp_jiffies >> shift, tick;
+
+		/* an upper ring is due when its slot is taken down */
+		for (d = !!lvl; d < ARP_WHEEL_SIZE + !!lvl; d++)
+			if (arp_wheel[lvl][(pos + d) & ARP_WHEEL_MASK])
+				break;
+		if (d == ARP_WHEEL_SIZE + !!lvl)
+			continue;
+		tick = (pos + d) << shift;
+		if (wait < 0 || arp_epoch + (long long)tick * ARP_TICK - now < wait)
+			wait = arp_epoch + (long long)tick * ARP_TICK - now;
+	}
+	return wait < 0 ? 0 : wait;
+}
+
+static struct arp_bucket *arp_bucket(int ifindex)
+{
+	struct arp_bucket *b;
+	unsigned int i;
+
+	if (4 * (arp_nbuckets + 1) > 3 * arp_bucket_size) {
+		struct arp_bucket *old = arp_buckets;
+		unsigned int size = arp_bucket_size, n;
+
+		b = calloc(size ? 2 * size : 16, sizeof(*b));
+		if (!b)
+			return NULL;
+		arp_buckets = b;
+		arp_bucket_size = size ? 2 * size : 16;
+		for (n = 0; n < size; n++) {
+			if (!old[n].ifindex)
+				continue;
+			i = old[n].ifindex * 0x9e3779b1U & (arp_bucket_size - 1);
+			while (arp_buckets[i].ifindex)
+				i = (i + 1) & (arp_bucket_size - 1);
+			arp_buckets[i] = old[n];
+		}
+		free(old);
+	}
+
+	i = ifindex * 0x9e3779b1U & (arp_bucket_size - 1);
+	while (arp_buckets[i].ifindex && arp_buckets[i].ifindex != ifindex)
+		i = (i + 1) & (arp_bucket_size - 1);
+	b = &arp_buckets[i];
+	if (!b->ifindex) {
+		b->ifindex = ifindex;
+		b->credit = broadcast_burst;
+		b->stamp = 0;
+		arp_nbuckets++;
+	}
+	return b;
+}
+
+static void arp_bucket_refill(struct arp_bucket *b, long long now, int ms)
+{
+	if (b->stamp)
+		ms += now - b->stamp;
+	b->stamp = now;
+	if (b->credit + (long long)ms > broadcast_burst)
+		b->credit = broadcast_burst;
+	else
+		b->credit += ms;
+}
+
+static int queue_active_probe(int ifindex, __u32 addr)
+{
+	struct dbkey key = { .iface = ifindex, .addr = addr };
+	struct arp_bucket *b = arp_bucket(ifindex);
+
+	if (!b)
+		goto suppress;
+	arp_bucket_refill(b, arp_now(), 0);
+
+	if (b->credit >= broadcast_rate) {
+		if (send_probe(ifindex, addr))
+			goto suppress;
+		b->credit -= broadcast_rate;
+		return 0;
+	}
+	/* its turn comes when the bucket is back to 0 */
+	if (b->credit - broadcast_rate >= -broadcast_burst &&
+	    arp_timer_add(ARP_TIMER_PROBE, &key,
+			  broadcast_rate - b->credit) == 0) {
+		b->credit -= broadcast_rate;
+		stats.probes_delayed++;
+		return 0;
+	}
+suppress:
+	stats.probes_suppressed++;
+	return -1;
+}
+
+static void arp_neg_timer(const struct arp_ent *e)
+{
+	long long left = negative_timeout - (long long)NEG_AGE(e->data) + 1;
+
+	arp_timer_add(ARP_TIMER_NEG, &e->key, left > 0 ? left * 1000 : 0);
+}
+
+static void arp_timer_fire(const struct arp_timer *t)
+{
+	struct arp_ent *e = arp_find(&t->key);
+	struct arp_bucket *b;
+
+	switch (t->kind) {
+	case ARP_TIMER_PROBE:
+		if (!e || IS_NEG(e->data)) {
+			if (send_probe(t->key.iface, t->key.addr) == 0)
+				break;
+			stats.probes_suppressed++;
+		}
+		/* answered while it waited, or not sent: the turn goes back */
+		b = arp_bucket(t->key.iface);
+		if (b)
+			arp_bucket_refill(b, arp_now(), broadcast_rate);
+		break;
+	case ARP_TIMER_NEG:
+		if (!e || !IS_NEG(e->data))
+			break;
+		if (!NEG_VALID(e->data))
+			arp_del(e);
+		else	/* further out than the wheel reaches */
+			arp_neg_timer(e);
+		break;
+	}
+}
+
+/* Run the wheel up to now */
+static void arp_timers_run(void)
+{
+	__u32 now = arp_ticks(arp_now());
+
+	if (!arp_ntimers) {
+		arp_jiffies = now + 1;
+		return;
+	}
+
+	while ((__s32)(now - arp_jiffies) >= 0) {
+		unsigned int idx = arp_jiffies & ARP_WHEEL_MASK;
+		struct arp_timer *t, *next;
+		int lvl;
+
+		/* take down the slot an upper ring is at, as the one below wraps */
+		for (lvl = 1; lvl < ARP_WHEEL_LEVELS &&
+		     !((arp_jiffies >> (ARP_WHEEL_BITS * (lvl - 1))) &
+		       ARP_WHEEL_MASK); lvl++) {
+			unsigned int up = (arp_jiffies >> (ARP_WHEEL_BITS * lvl)) &
+					  ARP_WHEEL_MASK;
+
+			t = arp_wheel[lvl][up];
+			arp_wheel[lvl][up] = NULL;
+			for (; t; t = next) {
+				next = t->next;
+				arp_timer_queue(t);
+			}
+		}
+
+		t = arp_wheel[0][idx];
+		arp_wheel[0][idx] = NULL;
+		arp_jiffies++;
+		for (; t; t = next) {
+			next = t->next;
+			arp_timer_fire(t);
+			t->next = arp_timer_pool;
+			arp_timer_pool = t;
+			arp_ntimers--;
+		}
+	}
+}
+
+/* Negative entries of the file are dropped in time as well */
+static void arp_neg_timers(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < arp_size; i++)
+		if (arp_tab[i].used && IS_NEG(arp_tab[i].data))
+			arp_neg_timer(&arp_tab[i]);
+}
+
 static int do_one_request(struct nlmsghdr *n)
 {
 	struct ndmsg *ndm = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 	struct rtattr *tb[NDA_MAX+1];
 	struct dbkey key;
-	DBT dbkey, dbdat;
+	struct arp_ent *e;
 	int do_acct = 0;
 
 	if (n->nlmsg_type == NLMSG_DONE) {
-		dbase->sync(dbase, 0);
+		arp_sync(0);
 
 		/* Now we have at least mirror of kernel db, so that
 		 * may start real resolution.
@@ -332,13 +880,8 @@ static int do_one_request(struct nlmsghdr *n)
 
 	key.iface = ndm->ndm_ifindex;
 	memcpy(&key.addr, RTA_DATA(tb[NDA_DST]), 4);
-	dbkey.data = &key;
-	dbkey.size = sizeof(key);
 
-	if (dbase->get(dbase, &dbkey, &dbdat, 0) != 0) {
-		dbdat.data = 0;
-		dbdat.size = 0;
-	}
+	e = arp_find(&key);
 
 	if (n->nlmsg_type == RTM_GETNEIGH) {
 		if (!(n->nlmsg_flags&NLM_F_REQUEST))
@@ -356,24 +899,26 @@ static int do_one_request(struct nlmsghdr *n)
 			 * Kernel is going to initiate broadcast resolution.
 			 * OK, we invalidate our information as well.
 			 */
-			if (dbdat.data && !IS_NEG(dbdat.data))
+			if (e && !IS_NEG(e->data))
 				stats.app_neg++;
 
-			dbase->del(dbase, &dbkey, 0);
+			if (e)
+				arp_del(e);
+			e = NULL;
 		} else {
 			/* If we get this kernel does not have any information.
 			 * If we have something tell this to kernel. */
 			stats.app_recv++;
-			if (dbdat.data && !IS_NEG(dbdat.data)) {
+			if (e && !IS_NEG(e->data)) {
 				stats.app_success++;
-				respond_to_kernel(key.iface, key.addr, dbdat.data, dbdat.size);
+				respond_to_kernel(key.iface, key.addr, e->data, e->len);
 				return 0;
 			}
 
 			/* Sheeit! We have nothing to tell. */
 			/* If we have recent negative entry, be silent. */
-			if (dbdat.data && NEG_VALID(dbdat.data)) {
-				if (NEG_CNT(dbdat.data) >= active_probing) {
+			if (e && NEG_VALID(e->data)) {
+				if (NEG_CNT(e->data) >= active_probing) {
 					stats.app_suppressed++;
 					return 0;
 				}
@@ -384,8 +929,8 @@ static int do_one_request(struct nlmsghdr *n)
 		if (active_probing &&
 		    queue_active_probe(ndm->ndm_ifindex, key.addr) == 0 &&
 		    do_acct) {
-			NEG_CNT(dbdat.data)++;
-			dbase->put(dbase, &dbkey, &dbdat, 0);
+			NEG_CNT(e->data)++;
+			arp_dirty(e);
 		}
 	} else if (n->nlmsg_type == RTM_NEWNEIGH) {
 		if (n->nlmsg_flags&NLM_F_REQUEST)
@@ -395,28 +940,25 @@ static int do_one_request(struct nlmsghdr *n)
 			/* Kernel was not able to resolve. Host is dead.
 			 * Create negative entry if it is not present
 			 * or renew it if it is too old. */
-			if (!dbdat.data ||
-			    !IS_NEG(dbdat.data) ||
-			    !NEG_VALID(dbdat.data)) {
+			if (!e || !IS_NEG(e->data) || !NEG_VALID(e->data)) {
 				__u8 ndata[6];
 
 				stats.kern_neg++;
 				prepare_neg_entry(ndata, time(NULL));
-				dbdat.data = ndata;
-				dbdat.size = sizeof(ndata);
-				dbase->put(dbase, &dbkey, &dbdat, 0);
+				e = arp_put(&key, ndata, sizeof(ndata));
+				if (e)
+					arp_neg_timer(e);
 			}
 		} else if (tb[NDA_LLADDR]) {
-			if (dbdat.data && !IS_NEG(dbdat.data)) {
-				if (memcmp(RTA_DATA(tb[NDA_LLADDR]), dbdat.data, dbdat.size) == 0)
+			if (e && !IS_NEG(e->data)) {
+				if (memcmp(RTA_DATA(tb[NDA_LLADDR]), e->data, e->len) == 0)
 					return 0;
 				stats.kern_change++;
 			} else {
 				stats.kern_new++;
 			}
-			dbdat.data = RTA_DATA(tb[NDA_LLADDR]);
-			dbdat.size = RTA_PAYLOAD(tb[NDA_LLADDR]);
-			dbase->put(dbase, &dbkey, &dbdat, 0);
+			arp_put(&key, RTA_DATA(tb[NDA_LLADDR]),
+				RTA_PAYLOAD(tb[NDA_LLADDR]));
 		}
 	}
 	return 0;
@@ -474,26 +1016,75 @@ static void get_kern_msg(void)
 	}
 }
 
-/* Receive gratuitous ARP messages and store them, that's all. */
-static void get_arp_pkt(void)
+/*
+ * ARP packets come in on a TPACKET_V3 ring, filtered in the kernel down
+ * to those arpd looks at. A block is handed over once full, or after
+ * ARP_RING_TOV ms, and all its packets are taken at once. Without the
+ * ring, arpd falls back to a recvfrom() per packet.
+ */
+#define ARP_RING_BLOCK		(1 << 16)
+#define ARP_RING_BLOCKS		16
+#define ARP_RING_FRAME		256
+#define ARP_RING_TOV		10
+
+static void *arp_ring;
+static unsigned int arp_ring_cur;
+
+/* requests and replies for IPv4 */
+static struct sock_filter arp_filter[] = {
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 2),		/* ar_pro */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 6),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 5),		/* ar_pln */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 4),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),		/* ar_op */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REQUEST, 1, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REPLY, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static void arp_ring_setup(int fd)
 {
-	unsigned char buf[1024];
-	struct sockaddr_ll sll;
-	socklen_t sll_len = sizeof(sll);
-	struct arphdr *a = (struct arphdr *)buf;
-	struct dbkey key;
-	DBT dbkey, dbdat;
-	int n;
+	struct sock_fprog fprog = {
+		.len = ARRAY_SIZE(arp_filter),
+		.filter = arp_filter,
+	};
+	struct tpacket_req3 req = {
+		.tp_block_size = ARP_RING_BLOCK,
+		.tp_block_nr = ARP_RING_BLOCKS,
+		.tp_frame_size = ARP_RING_FRAME,
+		.tp_frame_nr = ARP_RING_BLOCK / ARP_RING_FRAME * ARP_RING_BLOCKS,
+		.tp_retire_blk_tov = ARP_RING_TOV,
+	};
+	int version = TPACKET_V3;
+	void *ring;
 
-	n = recvfrom(pset[0].fd, buf, sizeof(buf), MSG_DONTWAIT,
-		     (struct sockaddr *)&sll, &sll_len);
-	if (n < 0) {
-		if (errno != EINTR && errno != EAGAIN)
-			syslog(LOG_ERR, "recvfrom: %m");
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+		perror("arpd: SO_ATTACH_FILTER");
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+	    setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		perror("arpd: PACKET_RX_RING, reading packets one by one");
 		return;
 	}
+	ring = mmap(NULL, (size_t)ARP_RING_BLOCK * ARP_RING_BLOCKS,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("arpd: mmap, reading packets one by one");
+		return;
+	}
+	arp_ring = ring;
+}
+
+/* Gratuitous ARP messages are stored, that's all. */
+static void arp_pkt(const struct sockaddr_ll *sll, const unsigned char *buf,
+		    int n)
+{
+	const struct arphdr *a = (const struct arphdr *)buf;
+	struct arp_ent *e;
+	struct dbkey key;
 
-	if (ifnum && !handle_if(sll.sll_ifindex))
+	if (ifnum && !handle_if(sll->sll_ifindex))
 		return;
 
 	/* Sanity checks */
@@ -503,31 +1094,90 @@ static void get_arp_pkt(void)
 	     a->ar_op != htons(ARPOP_REPLY)) ||
 	    a->ar_pln != 4 ||
 	    a->ar_pro != htons(ETH_P_IP) ||
-	    a->ar_hln != sll.sll_halen ||
+	    a->ar_hln != sll->sll_halen ||
 	    sizeof(*a) + 2*4 + 2*a->ar_hln > n)
 		return;
 
-	key.iface = sll.sll_ifindex;
+	key.iface = sll->sll_ifindex;
 	memcpy(&key.addr, (char *)(a+1) + a->ar_hln, 4);
 
 	/* DAD message, ignore. */
 	if (key.addr == 0)
 		return;
 
-	dbkey.data = &key;
-	dbkey.size = sizeof(key);
-
-	if (dbase->get(dbase, &dbkey, &dbdat, 0) == 0 && !IS_NEG(dbdat.data)) {
-		if (memcmp(dbdat.data, a+1, dbdat.size) == 0)
+	e = arp_find(&key);
+	if (e && !IS_NEG(e->data)) {
+		if (memcmp(e->data, a+1, e->len) == 0)
 			return;
 		stats.arp_change++;
 	} else {
 		stats.arp_new++;
 	}
 
-	dbdat.data = a+1;
-	dbdat.size = a->ar_hln;
-	dbase->put(dbase, &dbkey, &dbdat, 0);
+	arp_put(&key, a+1, a->ar_hln);
+}
+
+static void get_arp_ring(void)
+{
+	for (;;) {
+		struct tpacket_block_desc *bd = arp_ring +
+			(size_t)arp_ring_cur * ARP_RING_BLOCK;
+		struct tpacket3_hdr *h;
+		unsigned int i;
+
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status,
+				      __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			return;
+
+		h = (void *)bd + bd->hdr.bh1.offset_to_first_pkt;
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+			const struct sockaddr_ll *sll = (void *)h +
+				TPACKET_ALIGN(sizeof(*h));
+
+			arp_pkt(sll, (unsigned char *)h + h->tp_net,
+				h->tp_snaplen);
+			h = (void *)h + h->tp_next_offset;
+		}
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		arp_ring_cur = (arp_ring_cur + 1) % ARP_RING_BLOCKS;
+	}
+}
+
+static void get_arp_pkt(void)
+{
+	unsigned char buf[1024];
+	struct sockaddr_ll sll;
+	socklen_t sll_len = sizeof(sll);
+	int n;
+
+	if (arp_ring) {
+		get_arp_ring();
+		return;
+	}
+
+	n = recvfrom(pset[0].fd, buf, sizeof(buf), MSG_DONTWAIT,
+		     (struct sockaddr *)&sll, &sll_len);
+	if (n < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			syslog(LOG_ERR, "recvfrom: %m");
+		return;
+	}
+	arp_pkt(&sll, buf, n);
+}
+
+/* what the ring had no room for, since the last time */
+static void arp_ring_stats(void)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (!arp_ring ||
+	    getsockopt(pset[0].fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0)
+		return;
+	stats.arp_drops += st.tp_drops;
+	stats.arp_freezes += st.tp_freeze_q_cnt;
 }
 
 static void catch_signal(int sig, void (*handler)(int))
@@ -568,16 +1218,19 @@ static void sig_stats(int signo)
 
 static void send_stats(void)
 {
-	syslog(LOG_INFO, "arp_rcv: n%lu c%lu app_rcv: tot %lu hits %lu bad %lu neg %lu sup %lu",
+	arp_ring_stats();
+	syslog(LOG_INFO, "arp_rcv: n%lu c%lu drop %lu freeze %lu app_rcv: tot %lu hits %lu bad %lu neg %lu sup %lu",
 	       stats.arp_new, stats.arp_change,
+	       stats.arp_drops, stats.arp_freezes,
 
 	       stats.app_recv, stats.app_success,
 	       stats.app_bad, stats.app_neg, stats.app_suppressed
 	       );
-	syslog(LOG_INFO, "kern: n%lu c%lu neg %lu arp_send: %lu rlim %lu",
+	syslog(LOG_INFO, "kern: n%lu c%lu neg %lu arp_send: %lu delayed %lu rlim %lu",
 	       stats.kern_new, stats.kern_change, stats.kern_neg,
 
-	       stats.probes_sent, stats.probes_suppressed
+	       stats.probes_sent, stats.probes_delayed,
+	       stats.probes_suppressed
 	       );
 	do_stats = 0;
 }
@@ -588,6 +1241,7 @@ int main(int argc, char **argv)
 	int opt;
 	int do_list = 0;
 	char *do_load = NULL;
+	volatile long long idle;	/* kept across the siglongjmp() */
 
 	while ((opt = getopt(argc, argv, "h?b:lf:a:n:p:kR:B:")) != EOF) {
 		switch (opt) {
@@ -716,6 +1370,7 @@ int main(int argc, char **argv)
 
 			if (ll_addr_a2n((char *) b1, 6, macbuf) != 6)
 				goto do_abort;
+			dbdat.data = b1;
 			dbdat.size = 6;
 
 			if (dbase->put(dbase, &dbkey, &dbdat, 0)) {
@@ -761,6 +1416,7 @@ int main(int argc, char **argv)
 		perror("socket");
 		iprt_exit(-1);
 	}
+	arp_ring_setup(pset[0].fd);
 
 	if (1) {
 		struct sockaddr_ll sll = {
@@ -781,6 +1437,10 @@ int main(int argc, char **argv)
 	}
 	pset[1].fd = rth.fd;
 
+	arp_epoch = arp_now();
+	arp_load();
+	arp_neg_timers();
+
 	load_initial_table();
 
 	if (daemon(0, 0)) {
@@ -800,38 +1460,56 @@ int main(int argc, char **argv)
 	pset[1].events = EVENTS;
 	pset[1].revents = 0;
 
+	idle = arp_now();
 	sigsetjmp(env, 1);
 
 	for (;;) {
+		long long now, wait, next;
+
 		in_poll = 1;
 
 		if (do_exit)
 			break;
 		if (do_sync) {
 			in_poll = 0;
-			dbase->sync(dbase, 0);
+			arp_sync(0);
 			do_sync = 0;
 			in_poll = 1;
 		}
 		if (do_stats)
 			send_stats();
-		if (poll(pset, 2, poll_timeout) > 0) {
+
+		/* up to the next timer, or until it has been quiet long enough */
+		now = arp_now();
+		wait = idle + poll_timeout - now;
+		next = arp_timer_wait(now);
+		if (next >= 0 && next < wait)
+			wait = next;
+		if (poll(pset, 2, wait > 0 ? wait : 0) > 0) {
 			in_poll = 0;
 			if (pset[0].revents&EVENTS)
 				get_arp_pkt();
 			if (pset[1].revents&EVENTS)
 				get_kern_msg();
-		} else {
+			idle = arp_now();
+		}
+		in_poll = 0;
+		arp_timers_run();
+		if (arp_now() - idle >= poll_timeout) {
 			do_sync = 1;
+			idle = arp_now();
 		}
 	}
 
 	undo_sysctl_adjustments();
+	arp_sync(1);
 out:
-	dbase->close(dbase);
+	if (dbase)
+		dbase->close(dbase);
 	iprt_exit(0);
 
 do_abort:
-	dbase->close(dbase);
+	if (dbase)
+		dbase->close(dbase);
 	iprt_exit(-1);
 }
@@ -20,21 +20,24 @@
 #include <fnmatch.h>
 #include <sys/file.h>
 #include <sys/socket.h>
-#include <sys/un.h>
-#include <sys/poll.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
-#include <signal.h>
+#include <sys/mman.h>
+#include <sched.h>
 #include <math.h>
 #include <getopt.h>
+#include <limits.h>
 
 #include <linux/if.h>
 #include <linux/if_link.h>
 
 #include "libnetlink.h"
 #include "json_writer.h"
+#include "ifstat_shm.h"
 #include "SNAPSHOT.h"
 #include "utils.h"
+#include "arena.h"
+#include "ll_map.h"
+#include "namespace.h"
 
 int dump_zeros;
 int reset_history;
@@ -45,18 +48,30 @@ int no_update;
 int scan_interval;
 int time_constant;
 int show_errors;
-double W;
+static struct statsd_rate ewma;
 char **patterns;
 int npatterns;
+
+#define NO_SUB_TYPE 0xffff
+
 bool is_extended;
-int filter_type;
-int sub_type;
+int filter_type = IFLA_STATS_LINK_64;
+int sub_type = NO_SUB_TYPE;
+bool stats_getlink;
 
 char info_source[128];
 int source_mismatch;
 
+/*
+ * Of -N and -A, netns_list is NULL without them; netns is the namespace
+ * being read, NULL for that of ifstat.
+ */
+static char **netns_list;
+static unsigned int netns_count;
+static const char *netns;
+static json_writer_t *netns_jw;
+
 #define MAXS (sizeof(struct rtnl_link_stats)/sizeof(__u32))
-#define NO_SUB_TYPE 0xffff
 
 struct ifstat_ent {
 	struct ifstat_ent	*next;
@@ -94,7 +109,32 @@ static const char *stats[MAXS] = {
 };
 
 struct ifstat_ent *kern_db;
-struct ifstat_ent *hist_db;
+/* the entries of kern_db and their names; those of a scan of the daemon's */
+static struct arena kern_arena, scan_arena;
+static struct arena *ent_arena = &kern_arena;
+
+/*
+ * The history file is this header followed by count entries in the
+ * layout of the daemon's table, sorted by ifindex as kern_db is once
+ * loaded, so that each run only merges the two. It is mapped, and
+ * rewritten in place as long as the interfaces are the same.
+ */
+#define IFSTAT_HIST_MAGIC	0x48534649	/* "IFSH" */
+#define IFSTAT_HIST_VERSION	1
+
+struct ifstat_hist_hdr {
+	__u32		magic;
+	__u32		version;
+	__u32		count;
+	__u32		nstats;		/* IFSTAT_SHM_NSTATS */
+	char		info_source[128];
+	struct ifstat_shm_ent	ent[];
+};
+
+static struct ifstat_hist_hdr *hist;
+static size_t hist_len;
+static struct ifstat_shm_ent *hist_ent;
+static unsigned int hist_count;
 
 static int match(const char *id)
 {
@@ -117,6 +157,8 @@ static int get_nlmsg_extended(const struct sockaddr_nl *who,
 	struct rtattr *tb[IFLA_STATS_MAX+1];
 	int len = m->nlmsg_len;
 	struct ifstat_ent *n;
+	struct rtattr *attr;
+	int i;
 
 	if (m->nlmsg_type != RTM_NEWSTATS)
 		return 0;
@@ -125,29 +167,26 @@ static int get_nlmsg_extended(const struct sockaddr_nl *who,
 	if (len < 0)
 		return -1;
 
+	/* link stats as RTM_GETLINK would have them, only of those up */
+	if (!is_extended && !(ll_index_to_flags(ifsm->ifindex) & IFF_UP))
+		return 0;
+
 	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
-	if (tb[filter_type] == NULL)
+	attr = tb[filter_type];
+	if (attr && sub_type != NO_SUB_TYPE)
+		attr = parse_rtattr_one_nested(sub_type, attr);
+	if (attr == NULL)
 		return 0;
 
-	n = malloc(sizeof(*n));
+	n = arena_alloc(ent_arena, sizeof(*n));
 	if (!n)
 		abort();
 
 	n->ifindex = ifsm->ifindex;
-	n->name = strdup(ll_index_to_name(ifsm->ifindex));
-
-	if (sub_type == NO_SUB_TYPE) {
-		memcpy(&n->val, RTA_DATA(tb[filter_type]), sizeof(n->val));
-	} else {
-		struct rtattr *attr;
-
-		attr = parse_rtattr_one_nested(sub_type, tb[filter_type]);
-		if (attr == NULL) {
-			free(n);
-			return 0;
-		}
-		memcpy(&n->val, RTA_DATA(attr), sizeof(n->val));
-	}
+	n->name = arena_strdup(ent_arena, ll_index_to_name(ifsm->ifindex));
+	memcpy(&n->val, RTA_DATA(attr), sizeof(n->val));
+	for (i = 0; i < MAXS; i++)
+		n->ival[i] = n->val[i];
 	memset(&n->rate, 0, sizeof(n->rate));
 	n->next = kern_db;
 	kern_db = n;
@@ -177,11 +216,11 @@ static int get_nlmsg(const struct sockaddr_nl *who,
 	if (tb[IFLA_IFNAME] == NULL || tb[IFLA_STATS] == NULL)
 		return 0;
 
-	n = malloc(sizeof(*n));
+	n = arena_alloc(ent_arena, sizeof(*n));
 	if (!n)
 		abort();
 	n->ifindex = ifi->ifi_index;
-	n->name = strdup(RTA_DATA(tb[IFLA_IFNAME]));
+	n->name = arena_strdup(ent_arena, RTA_DATA(tb[IFLA_IFNAME]));
 	memcpy(&n->ival, RTA_DATA(tb[IFLA_STATS]), sizeof(n->ival));
 	memset(&n->rate, 0, sizeof(n->rate));
 	for (i = 0; i < MAXS; i++)
@@ -197,11 +236,23 @@ static int load_info(void)
 	struct rtnl_handle rth;
 	__u32 filter_mask;
 
-	if (rtnl_open(&rth, 0) < 0)
+	if (netns) {
+		/* gone since, for the daemon: its table stays as it was */
+		if (rtnl_open_netns(&rth, netns, 0, NETLINK_ROUTE) < 0)
+			return -1;
+	} else if (rtnl_open(&rth, 0) < 0)
 		iprt_exit(1);
 
-	if (is_extended) {
+	/*
+	 * RTM_GETSTATS asking for one attribute alone makes a much smaller
+	 * dump than RTM_GETLINK. The names and flags it lacks come from the
+	 * link cache, which the daemon keeps current from notifications.
+	 */
+	if (!stats_getlink) {
+		ll_watch_map();
 		ll_init_map(&rth);
+		ll_sync_map(&rth);
+
 		filter_mask = IFLA_STATS_FILTER_BIT(filter_type);
 		if (rtnl_wilddump_stats_req_filter(&rth, AF_UNSPEC, RTM_GETSTATS,
 						   filter_mask) < 0) {
@@ -210,10 +261,15 @@ static int load_info(void)
 		}
 
 		if (rtnl_dump_filter(&rth, get_nlmsg_extended, NULL) < 0) {
-			fprintf(stderr, "Dump terminated\n");
-			iprt_exit(1);
+			if (is_extended || kern_db) {
+				fprintf(stderr, "Dump terminated\n");
+				iprt_exit(1);
+			}
+			/* kernels before RTM_GETSTATS */
+			stats_getlink = true;
 		}
-	} else {
+	}
+	if (stats_getlink) {
 		if (rtnl_wilddump_request(&rth, AF_INET, RTM_GETLINK) < 0) {
 			perror("Cannot send dump request");
 			iprt_exit(1);
@@ -257,7 +313,7 @@ static void load_raw_table(FILE *fp)
 			strncpy(info_source, buf+1, sizeof(info_source)-1);
 			continue;
 		}
-		if ((n = malloc(sizeof(*n))) == NULL)
+		if ((n = arena_alloc(ent_arena, sizeof(*n))) == NULL)
 			abort();
 
 		if (!(p = strchr(buf, ' ')))
@@ -270,7 +326,7 @@ static void load_raw_table(FILE *fp)
 			abort();
 		*next++ = 0;
 
-		n->name = strdup(p);
+		n->name = arena_strdup(ent_arena, p);
 		p = next;
 
 		for (i = 0; i < MAXS; i++) {
@@ -303,18 +359,47 @@ static void load_raw_table(FILE *fp)
 	}
 }
 
-static void dump_raw_db(FILE *fp, int to_hist)
+/* with namespaces, their tables are the members of one object */
+static json_writer_t *dump_json_new(FILE *fp)
 {
-	json_writer_t *jw = json_output ? jsonw_new(fp) : NULL;
-	struct ifstat_ent *n, *h;
+	if (!json_output)
+		return NULL;
+	return netns_jw ? : jsonw_new(fp);
+}
 
-	h = hist_db;
-	if (jw) {
+static void dump_json_start(json_writer_t *jw)
+{
+	if (!netns_jw) {
 		jsonw_start_object(jw);
 		jsonw_pretty(jw, pretty);
-		jsonw_name(jw, info_source);
+	}
+	if (netns) {
+		jsonw_name(jw, netns);
 		jsonw_start_object(jw);
-	} else
+	}
+	jsonw_name(jw, info_source);
+	jsonw_start_object(jw);
+}
+
+static void dump_json_end(json_writer_t *jw)
+{
+	jsonw_end_object(jw);
+	if (netns)
+		jsonw_end_object(jw);
+	if (!netns_jw) {
+		jsonw_end_object(jw);
+		jsonw_destroy(&jw);
+	}
+}
+
+static void dump_raw_db(FILE *fp)
+{
+	json_writer_t *jw = dump_json_new(fp);
+	struct ifstat_ent *n;
+
+	if (jw)
+		dump_json_start(jw);
+	else
 		fprintf(fp, "#%s\n", info_source);
 
 	for (n = kern_db; n; n = n->next) {
@@ -322,20 +407,8 @@ static void dump_raw_db(FILE *fp, int to_hist)
 		unsigned long long *vals = n->val;
 		double *rates = n->rate;
 
-		if (!match(n->name)) {
-			struct ifstat_ent *h1;
-
-			if (!to_hist)
-				continue;
-			for (h1 = h; h1; h1 = h1->next) {
-				if (h1->ifindex == n->ifindex) {
-					vals = h1->val;
-					rates = h1->rate;
-					h = h1->next;
-					break;
-				}
-			}
-		}
+		if (!match(n->name))
+			continue;
 
 		if (jw) {
 			jsonw_name(jw, n->name);
@@ -352,12 +425,418 @@ static void dump_raw_db(FILE *fp, int to_hist)
 			fprintf(fp, "\n");
 		}
 	}
-	if (jw) {
-		jsonw_end_object(jw);
+	if (jw)
+		dump_json_end(jw);
+}
 
-		jsonw_end_object(jw);
-		jsonw_destroy(&jw);
+static size_t hist_bytes(unsigned int count)
+{
+	return sizeof(struct ifstat_hist_hdr) +
+	       (size_t)count * sizeof(struct ifstat_shm_ent);
+}
+
+static int cmp_ifindex(const void *a, const void *b)
+{
+	const struct ifstat_ent *na = *(struct ifstat_ent **)a;
+	const struct ifstat_ent *nb = *(struct ifstat_ent **)b;
+
+	return na->ifindex < nb->ifindex ? -1 : na->ifindex > nb->ifindex;
+}
+
+static void sort_kern_db(void)
+{
+	struct ifstat_ent **v, *n;
+	unsigned int count = 0, i;
+
+	for (n = kern_db; n; n = n->next)
+		count++;
+	if (count < 2)
+		return;
+	v = malloc(count * sizeof(*v));
+	if (!v)
+		abort();
+	for (n = kern_db, i = 0; n; n = n->next)
+		v[i++] = n;
+	qsort(v, count, sizeof(*v), cmp_ifindex);
+	for (i = 0; i < count - 1; i++)
+		v[i]->next = v[i + 1];
+	v[count - 1]->next = NULL;
+	kern_db = v[0];
+	free(v);
+}
+
+static void hist_ent_fill(struct ifstat_shm_ent *e, const struct ifstat_ent *n)
+{
+	int i;
+
+	e->ifindex = n->ifindex;
+	memset(e->name, 0, sizeof(e->name));
+	strncpy(e->name, n->name, sizeof(e->name) - 1);
+	for (i = 0; i < MAXS && i < IFSTAT_SHM_NSTATS; i++) {
+		e->val[i] = n->val[i];
+		e->rate[i] = n->rate[i];
+	}
+}
+
+/* The entry of ifindex, if any, for kern_db walked in ifindex order */
+static const struct ifstat_shm_ent *hist_next(unsigned int *pos, int ifindex)
+{
+	while (*pos < hist_count && hist_ent[*pos].ifindex < ifindex)
+		(*pos)++;
+	if (*pos < hist_count && hist_ent[*pos].ifindex == ifindex)
+		return &hist_ent[(*pos)++];
+	return NULL;
+}
+
+/* In a text history, as earlier versions have it: taken as an array */
+static void load_hist_text(int fd)
+{
+	struct ifstat_ent *n;
+	unsigned int i = 0;
+	FILE *fp;
+
+	fp = fdopen(dup(fd), "r");
+	if (!fp)
+		return;
+	load_raw_table(fp);
+	fclose(fp);
+
+	sort_kern_db();
+	for (n = kern_db; n; n = n->next)
+		hist_count++;
+	hist_ent = calloc(hist_count ? : 1, sizeof(*hist_ent));
+	if (!hist_ent)
+		abort();
+	for (n = kern_db; n; n = n->next)
+		hist_ent_fill(&hist_ent[i++], n);
+	arena_free(&kern_arena);
+	kern_db = NULL;
+}
+
+static void load_hist(int fd, const struct stat *st)
+{
+	struct ifstat_hist_hdr *h;
+	char source[128];
+
+	if (st->st_size < sizeof(*h)) {
+		if (st->st_size)
+			load_hist_text(fd);
+		return;
+	}
+
+	h = mmap(NULL, st->st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		perror("ifstat: mmap history file");
+		return;
+	}
+	if (h->magic != IFSTAT_HIST_MAGIC) {
+		munmap(h, st->st_size);
+		load_hist_text(fd);
+		return;
+	}
+	if (h->version != IFSTAT_HIST_VERSION ||
+	    h->nstats != IFSTAT_SHM_NSTATS ||
+	    hist_bytes(h->count) > st->st_size) {
+		fprintf(stderr, "ifstat: history file of another version, resetting\n");
+		munmap(h, st->st_size);
+		return;
+	}
+
+	hist = h;
+	hist_len = st->st_size;
+	hist_ent = h->ent;
+	hist_count = h->count;
+
+	memcpy(source, h->info_source, sizeof(source));
+	source[sizeof(source) - 1] = 0;
+	if (info_source[0] && strcmp(info_source, source))
+		source_mismatch = 1;
+	strcpy(info_source, source);
+}
+
+/*
+ * The entries of the interfaces left out by the patterns keep the values
+ * they had, so that what was not shown this time still is the next.
+ */
+static void save_hist(int fd)
+{
+	struct ifstat_hist_hdr *h;
+	const struct ifstat_shm_ent *old;
+	unsigned int count = 0, pos = 0, i;
+	struct ifstat_ent *n;
+	size_t len;
+
+	for (n = kern_db; n; n = n->next)
+		count++;
+
+	if (hist && hist->count == count) {
+		for (n = kern_db, i = 0; n; n = n->next, i++)
+			if (hist->ent[i].ifindex != n->ifindex)
+				break;
+		if (!n) {
+			for (n = kern_db, i = 0; n; n = n->next, i++)
+				if (match(n->name) || !hist_count)
+					hist_ent_fill(&hist->ent[i], n);
+			memcpy(hist->info_source, info_source,
+			       sizeof(hist->info_source));
+			/* stores to a mapping need not bump it right away */
+			if (futimens(fd, NULL))
+				perror("ifstat: futimens");
+			return;
+		}
+	}
+
+	len = hist_bytes(count);
+	h = calloc(1, len);
+	if (!h)
+		abort();
+	h->magic = IFSTAT_HIST_MAGIC;
+	h->version = IFSTAT_HIST_VERSION;
+	h->count = count;
+	h->nstats = IFSTAT_SHM_NSTATS;
+	memcpy(h->info_source, info_source, sizeof(h->info_source));
+
+	for (n = kern_db, i = 0; n; n = n->next, i++) {
+		old = match(n->name) ? NULL : hist_next(&pos, n->ifindex);
+		if (old)
+			h->ent[i] = *old;
+		else
+			hist_ent_fill(&h->ent[i], n);
+	}
+
+	if (ftruncate(fd, len) || pwrite(fd, h, len, 0) != len)
+		perror("ifstat: write history file");
+	free(h);
+}
+
+static struct ifstat_shm_hdr *shm;
+static size_t shm_len;
+static int shm_fd = -1;
+
+static size_t shm_bytes(unsigned int size)
+{
+	return sizeof(struct ifstat_shm_hdr) +
+	       (size_t)size * sizeof(struct ifstat_shm_ent);
+}
+
+static void shm_name(char *name, size_t len, uid_t uid)
+{
+	if (netns)
+		snprintf(name, len, IFSTAT_SHM_NETNS_NAME, uid, netns);
+	else
+		snprintf(name, len, IFSTAT_SHM_NAME, uid);
+}
+
+/* Made before daemon(), so that the user gets to see why it failed */
+static void shm_create(void)
+{
+	char name[NAME_MAX];
+
+	shm_name(name, sizeof(name), getuid());
+	shm_unlink(name);
+	shm_fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (shm_fd < 0)
+		perror("ifstat: shm_open, serving the socket only");
+}
+
+static void shm_destroy(void)
+{
+	char name[NAME_MAX];
+
+	if (shm)
+		munmap(shm, shm_len);
+	shm = NULL;
+	close(shm_fd);
+	shm_fd = -1;
+
+	/* readers go back to the socket */
+	shm_name(name, sizeof(name), getuid());
+	shm_unlink(name);
+}
+
+/* Copy the table out for the readers, see ifstat_shm.h */
+static void shm_update(void)
+{
+	unsigned int count = 0, size, i, k;
+	struct ifstat_ent *n;
+
+	if (shm_fd < 0)
+		return;
+
+	for (n = kern_db; n; n = n->next)
+		count++;
+
+	size = shm ? shm->size : 0;
+	if (!shm || count > size) {
+		void *p;
+
+		if (!size)
+			size = 1024;
+		while (size < count)
+			size *= 2;
+		/* extended before size tells the readers */
+		if (ftruncate(shm_fd, shm_bytes(size)) < 0) {
+			shm_destroy();
+			return;
+		}
+		p = mmap(NULL, shm_bytes(size), PROT_READ|PROT_WRITE,
+			 MAP_SHARED, shm_fd, 0);
+		if (p == MAP_FAILED) {
+			shm_destroy();
+			return;
+		}
+		if (shm) {
+			munmap(shm, shm_len);
+		} else {
+			struct ifstat_shm_hdr *hdr = p;
+
+			hdr->magic = IFSTAT_SHM_MAGIC;
+			hdr->version = IFSTAT_SHM_VERSION;
+			hdr->nstats = IFSTAT_SHM_NSTATS;
+			hdr->pid = getpid();
+		}
+		shm = p;
+		shm_len = shm_bytes(size);
+	}
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for (n = kern_db, i = 0; n; n = n->next, i++) {
+		struct ifstat_shm_ent *e = &shm->ent[i];
+
+		e->ifindex = n->ifindex;
+		memset(e->name, 0, sizeof(e->name));
+		strncpy(e->name, n->name, sizeof(e->name) - 1);
+		for (k = 0; k < MAXS && k < IFSTAT_SHM_NSTATS; k++) {
+			e->val[k] = n->val[k];
+			e->rate[k] = n->rate[k];
+		}
+	}
+	shm->count = count;
+	shm->size = size;
+	memcpy(shm->info_source, info_source, sizeof(shm->info_source));
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+static int shm_load_uid(uid_t uid)
+{
+	struct ifstat_shm_ent *ents = NULL;
+	const struct ifstat_shm_hdr *hdr;
+	unsigned int count = 0, room = 0, tries;
+	char name[NAME_MAX], source[128];
+	struct stat st;
+	int fd, ret = -1;
+	size_t len;
+	void *p;
+
+	shm_name(name, sizeof(name), uid);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+
+	/* the trust statsd_connect() gives the socket */
+	if (fstat(fd, &st) || (st.st_uid != getuid() && st.st_uid != 0) ||
+	    st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	len = st.st_size;
+	p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	hdr = p;
+
+	/* or left behind by a daemon gone */
+	if (hdr->magic != IFSTAT_SHM_MAGIC ||
+	    hdr->version != IFSTAT_SHM_VERSION ||
+	    hdr->nstats != IFSTAT_SHM_NSTATS ||
+	    (kill(hdr->pid, 0) && errno == ESRCH))
+		goto out;
+
+	for (tries = 0; tries < 1000 && ret < 0; tries++) {
+		__u32 seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		unsigned int size = hdr->size;
+
+		count = hdr->count;
+		if ((seq & 1) || count > size) {
+			sched_yield();
+			continue;
+		}
+
+		if (shm_bytes(size) > len) {
+			munmap(p, len);
+			len = shm_bytes(size);
+			p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+			if (p == MAP_FAILED) {
+				p = NULL;
+				goto out;
+			}
+			hdr = p;
+			continue;
+		}
+
+		if (count > room) {
+			free(ents);
+			ents = malloc(count * sizeof(*ents));
+			if (!ents)
+				goto out;
+			room = count;
+		}
+		memcpy(ents, hdr->ent, count * sizeof(*ents));
+		memcpy(source, hdr->info_source, sizeof(source));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == seq)
+			ret = 0;
 	}
+	if (ret < 0)
+		goto out;
+
+	source[sizeof(source) - 1] = 0;
+	if (info_source[0] && strcmp(info_source, source))
+		source_mismatch = 1;
+	strcpy(info_source, source);
+
+	while (count--) {
+		const struct ifstat_shm_ent *e = &ents[count];
+		struct ifstat_ent *n;
+		int i;
+
+		if ((n = arena_alloc(ent_arena, sizeof(*n))) == NULL)
+			abort();
+		n->ifindex = e->ifindex;
+		n->name = arena_alloc(ent_arena, sizeof(e->name));
+		if (!n->name)
+			abort();
+		memcpy(n->name, e->name, sizeof(e->name) - 1);
+		n->name[sizeof(e->name) - 1] = 0;
+		for (i = 0; i < MAXS && i < IFSTAT_SHM_NSTATS; i++) {
+			n->val[i] = e->val[i];
+			n->ival[i] = (__u32)n->val[i];
+			n->rate[i] = e->rate[i];
+		}
+		n->next = kern_db;
+		kern_db = n;
+	}
+out:
+	free(ents);
+	if (p)
+		munmap(p, len);
+	close(fd);
+	return ret;
+}
+
+/* The table of a daemon, as the socket would give it */
+static int shm_load_table(void)
+{
+	if (shm_load_uid(getuid()) == 0)
+		return 0;
+	return getuid() ? shm_load_uid(0) : -1;
 }
 
 /* use communication definitions of meg/kilo etc */
@@ -515,15 +994,12 @@ static void print_one_if(FILE *fp, const struct ifstat_ent *n,
 
 static void dump_kern_db(FILE *fp)
 {
-	json_writer_t *jw = json_output ? jsonw_new(fp) : NULL;
+	json_writer_t *jw = dump_json_new(fp);
 	struct ifstat_ent *n;
 
-	if (jw) {
-		jsonw_start_object(jw);
-		jsonw_pretty(jw, pretty);
-		jsonw_name(jw, info_source);
-		jsonw_start_object(jw);
-	} else
+	if (jw)
+		dump_json_start(jw);
+	else
 		print_head(fp);
 
 	for (n = kern_db; n; n = n->next) {
@@ -535,43 +1011,31 @@ static void dump_kern_db(FILE *fp)
 		else
 			print_one_if(fp, n, n->val);
 	}
-	if (jw) {
-		jsonw_end_object(jw);
-
-		jsonw_end_object(jw);
-		jsonw_destroy(&jw);
-	}
+	if (jw)
+		dump_json_end(jw);
 }
 
 static void dump_incr_db(FILE *fp)
 {
-	struct ifstat_ent *n, *h;
-	json_writer_t *jw = json_output ? jsonw_new(fp) : NULL;
+	json_writer_t *jw = dump_json_new(fp);
+	struct ifstat_ent *n;
+	unsigned int pos = 0;
 
-	h = hist_db;
-	if (jw) {
-		jsonw_start_object(jw);
-		jsonw_pretty(jw, pretty);
-		jsonw_name(jw, info_source);
-		jsonw_start_object(jw);
-	} else
+	if (jw)
+		dump_json_start(jw);
+	else
 		print_head(fp);
 
 	for (n = kern_db; n; n = n->next) {
 		int i;
 		unsigned long long vals[MAXS];
-		struct ifstat_ent *h1;
+		const struct ifstat_shm_ent *h;
 
 		memcpy(vals, n->val, sizeof(vals));
 
-		for (h1 = h; h1; h1 = h1->next) {
-			if (h1->ifindex == n->ifindex) {
-				for (i = 0; i < MAXS; i++)
-					vals[i] -= h1->val[i];
-				h = h1->next;
-				break;
-			}
-		}
+		h = hist_next(&pos, n->ifindex);
+		for (i = 0; h && i < MAXS && i < IFSTAT_SHM_NSTATS; i++)
+			vals[i] -= h->val[i];
 		if (!match(n->name))
 			continue;
 
@@ -581,18 +1045,8 @@ static void dump_incr_db(FILE *fp)
 			print_one_if(fp, n, vals);
 	}
 
-	if (jw) {
-		jsonw_end_object(jw);
-
-		jsonw_end_object(jw);
-		jsonw_destroy(&jw);
-	}
-}
-
-static int children;
-
-static void sigchild(int signo)
-{
+	if (jw)
+		dump_json_end(jw);
 }
 
 static int update_db(int interval)
@@ -602,8 +1056,14 @@ static int update_db(int interval)
 	n = kern_db;
 	kern_db = NULL;
 
-	if (load_info())
+	ent_arena = &scan_arena;
+	if (load_info()) {
+		ent_arena = &kern_arena;
+		arena_free(&scan_arena);
+		kern_db = n;
 		return -1;
+	}
+	ent_arena = &kern_arena;
 
 	h = kern_db;
 	kern_db = n;
@@ -622,10 +1082,9 @@ static int update_db(int interval)
 					}
 				}
 				for (i = 0; i < MAXS; i++) {
-					double sample;
 					__u64 incr;
 
-					if (is_extended) {
+					if (!stats_getlink) {
 						incr = h1->val[i] - n->val[i];
 						n->val[i] = h1->val[i];
 					} else {
@@ -633,109 +1092,164 @@ static int update_db(int interval)
 						n->val[i] += incr;
 						n->ival[i] = h1->ival[i];
 					}
-
-					sample = (double)(incr*1000)/interval;
-					if (interval >= scan_interval) {
-						n->rate[i] += W*(sample-n->rate[i]);
-					} else if (interval >= 1000) {
-						if (interval >= time_constant) {
-							n->rate[i] = sample;
-						} else {
-							double w = W*(double)interval/scan_interval;
-
-							n->rate[i] += w*(sample-n->rate[i]);
-						}
-					}
+					statsd_rate_update(&ewma, &n->rate[i], incr,
+							   interval);
 				}
 
-				while (h != h1) {
-					struct ifstat_ent *tmp = h;
-
-					h = h->next;
-					free(tmp->name);
-					free(tmp);
-				};
 				h = h1->next;
-				free(h1->name);
-				free(h1);
 				break;
 			}
 		}
 	}
+	arena_free(&scan_arena);
 	return 0;
 }
 
-#define T_DIFF(a, b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
+/*
+ * What the daemon and the exporter keep of each namespace between two
+ * samples. The one sampled is swapped into kern_db and the globals of
+ * the shared memory object, which the same code as for ifstat's own
+ * namespace then works on.
+ */
+struct ifstat_netns {
+	const char		*name;
+	struct ifstat_ent	*kern_db;
+	struct arena		arena;
+	struct ifstat_shm_hdr	*shm;
+	size_t			shm_len;
+	int			shm_fd;
+};
 
+static struct ifstat_netns *netns_tabs;
 
-static int server_loop(int fd)
+static void netns_swap(struct ifstat_netns *ns)
 {
-	struct timeval snaptime = { 0 };
-	struct pollfd p;
+	struct ifstat_ent *db = kern_db;
+	struct ifstat_shm_hdr *hdr = shm;
+	struct arena a = kern_arena;
+	size_t len = shm_len;
+	int fd = shm_fd;
+
+	kern_db = ns->kern_db;
+	kern_arena = ns->arena;
+	shm = ns->shm;
+	shm_len = ns->shm_len;
+	shm_fd = ns->shm_fd;
+	ns->kern_db = db;
+	ns->arena = a;
+	ns->shm = hdr;
+	ns->shm_len = len;
+	ns->shm_fd = fd;
+}
 
-	p.fd = fd;
-	p.events = p.revents = POLLIN;
+static void netns_enter(struct ifstat_netns *ns)
+{
+	netns_swap(ns);
+	netns = ns->name;
+}
 
-	sprintf(info_source, "%d.%lu sampling_interval=%d time_const=%d",
-		getpid(), (unsigned long)random(), scan_interval/1000, time_constant/1000);
+static void netns_leave(struct ifstat_netns *ns)
+{
+	netns_swap(ns);
+	netns = NULL;
+}
 
-	if (load_info())
-		return -1;
+static void netns_tabs_init(void)
+{
+	unsigned int i;
 
-	for (;;) {
-		int status;
-		time_t tdiff;
-		struct timeval now;
-
-		gettimeofday(&now, NULL);
-		tdiff = T_DIFF(now, snaptime);
-		if (tdiff >= scan_interval) {
-			if (update_db(tdiff))
-				return -1;
-			snaptime = now;
-			tdiff = 0;
-		}
+	netns_tabs = calloc(netns_count ? : 1, sizeof(*netns_tabs));
+	if (!netns_tabs)
+		abort();
+	for (i = 0; i < netns_count; i++) {
+		netns_tabs[i].name = netns_list[i];
+		netns_tabs[i].shm_fd = -1;
+	}
+}
 
-		if (poll(&p, 1, scan_interval - tdiff) > 0
-		    && (p.revents&POLLIN)) {
-			int clnt = accept(fd, NULL, NULL);
-
-			if (clnt >= 0) {
-				pid_t pid;
-
-				if (children >= 5) {
-					close(clnt);
-				} else if ((pid = fork()) != 0) {
-					if (pid > 0)
-						children++;
-					close(clnt);
-				} else {
-					FILE *fp = fdopen(clnt, "w");
-
-					if (fp)
-						dump_raw_db(fp, 0);
-					iprt_exit(0);
-				}
-			}
+/* so that a namespace not there at first comes once it is */
+static int ifstat_load(int interval)
+{
+	return interval && kern_db ? update_db(interval) : load_info();
+}
+
+static void ifstat_export_db(FILE *fp, const char *name, int i)
+{
+	const char *labels[] = { "netns", netns, "device", NULL, NULL };
+	const char *const *l = netns ? labels : labels + 2;
+	struct ifstat_ent *n;
+
+	for (n = kern_db; n; n = n->next) {
+		if (match(n->name)) {
+			labels[3] = n->name;
+			exporter_sample_labels(fp, name, "_total", l,
+					       n->val[i]);
 		}
-		while (children && waitpid(-1, &status, WNOHANG) > 0)
-			children--;
 	}
 }
 
-static int verify_forging(int fd)
+static void ifstat_export(FILE *fp, int interval)
 {
-	struct ucred cred;
-	socklen_t olen = sizeof(cred);
+	unsigned int k;
+	char name[64];
+	int i;
 
-	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, (void *)&cred, &olen) ||
-	    olen < sizeof(cred))
+	for (k = 0; k < netns_count; k++) {
+		netns_enter(&netns_tabs[k]);
+		ifstat_load(interval);
+		netns_leave(&netns_tabs[k]);
+	}
+	if (!netns_list)
+		ifstat_load(interval);
+
+	for (i = 0; i < MAXS; i++) {
+		exporter_name(name, sizeof(name), "ifstat_", stats[i]);
+		exporter_type(fp, name, "counter");
+		for (k = 0; k < netns_count; k++) {
+			netns_enter(&netns_tabs[k]);
+			ifstat_export_db(fp, name, i);
+			netns_leave(&netns_tabs[k]);
+		}
+		if (!netns_list)
+			ifstat_export_db(fp, name, i);
+	}
+}
+
+/* the socket is bound by then, so no daemon running has its table here */
+static int ifstat_sample_one(int interval)
+{
+	if (!interval)
+		shm_create();
+	if (ifstat_load(interval))
 		return -1;
-	if (cred.uid == getuid() || cred.uid == 0)
-		return 0;
-	return -1;
+	shm_update();
+	return 0;
+}
+
+/* a namespace that cannot be read keeps what it had */
+static int ifstat_sample(int interval)
+{
+	unsigned int k;
+
+	if (!netns_list)
+		return ifstat_sample_one(interval);
+
+	for (k = 0; k < netns_count; k++) {
+		netns_enter(&netns_tabs[k]);
+		ifstat_sample_one(interval);
+		netns_leave(&netns_tabs[k]);
+	}
+	return 0;
 }
 
+static struct statsd_collector ifstat_collector = {
+	.name		= "ifstat",
+	.source		= info_source,
+	.source_len	= sizeof(info_source),
+	.sample		= ifstat_sample,
+	.dump		= dump_raw_db,
+};
+
 static void xstat_usage(void)
 {
 	fprintf(stderr,
@@ -787,8 +1301,11 @@ static int usage(void)
 "   -a, --ignore         ignore history\n"
 "   -d, --scan=SECS      sample every statistics every SECS\n"
 "   -e, --errors         show errors\n"
+"   -E, --exporter=ADDR  serve the counters over HTTP on [HOST:]PORT\n"
 "   -j, --json           format output in JSON\n"
 "   -n, --nooutput       do history only\n"
+"   -N, --netns=NAME     read the namespace NAME, can be repeated\n"
+"   -A, --all-netns      read all the named namespaces\n"
 "   -p, --pretty         pretty print\n"
 "   -r, --reset          reset history\n"
 "   -s, --noupdate       don't update history\n"
@@ -805,7 +1322,10 @@ static const struct option longopts[] = {
 	{ "ignore",  0,  0, 'a' },
 	{ "scan", 1, 0, 'd'},
 	{ "errors", 0, 0, 'e' },
+	{ "exporter", 1, 0, 'E' },
 	{ "nooutput", 0, 0, 'n' },
+	{ "netns", 1, 0, 'N' },
+	{ "all-netns", 0, 0, 'A' },
 	{ "json", 0, 0, 'j' },
 	{ "reset", 0, 0, 'r' },
 	{ "pretty", 0, 0, 'p' },
@@ -817,17 +1337,131 @@ static const struct option longopts[] = {
 	{ 0 }
 };
 
+/* The table of netns, or of ifstat's namespace, against its history */
+static int ifstat_show(const char *hist_name)
+{
+	int hist_fd = -1;
+	int fd;
+
+	if (reset_history)
+		unlink(hist_name);
+
+	if (!ignore_history || !no_update) {
+		struct stat stb;
+
+		hist_fd = open(hist_name, O_RDWR|O_CREAT|O_NOFOLLOW, 0600);
+		if (hist_fd < 0) {
+			perror("ifstat: open history file");
+			iprt_exit(-1);
+		}
+		if (flock(hist_fd, LOCK_EX)) {
+			perror("ifstat: flock history file");
+			iprt_exit(-1);
+		}
+		if (fstat(hist_fd, &stb) != 0) {
+			perror("ifstat: fstat history file");
+			iprt_exit(-1);
+		}
+		if (stb.st_nlink != 1 || stb.st_uid != getuid()) {
+			fprintf(stderr, "ifstat: something is so wrong with history file, that I prefer not to proceed.\n");
+			iprt_exit(-1);
+		}
+		if (!ignore_history) {
+			FILE *tfp;
+			long uptime = -1;
+
+			if ((tfp = fopen("/proc/uptime", "r")) != NULL) {
+				if (fscanf(tfp, "%ld", &uptime) != 1)
+					uptime = -1;
+				fclose(tfp);
+			}
+			if (uptime >= 0 && time(NULL) >= stb.st_mtime+uptime) {
+				fprintf(stderr, "ifstat: history is aged out, resetting\n");
+				if (ftruncate(hist_fd, 0))
+					perror("ifstat: ftruncate");
+				stb.st_size = 0;
+			}
+		}
+
+		load_hist(hist_fd, &stb);
+	}
+
+	if (shm_load_table() == 0) {
+		if (hist_count && source_mismatch) {
+			fprintf(stderr, "ifstat: history is stale, ignoring it.\n");
+			hist_count = 0;
+		}
+	} else if (!netns && (fd = statsd_connect("ifstat")) >= 0) {
+		FILE *sfp = fdopen(fd, "r");
+
+		if (!sfp) {
+			fprintf(stderr, "ifstat: fdopen failed: %s\n",
+				strerror(errno));
+			close(fd);
+		} else  {
+			load_raw_table(sfp);
+			if (hist_count && source_mismatch) {
+				fprintf(stderr, "ifstat: history is stale, ignoring it.\n");
+				hist_count = 0;
+			}
+			fclose(sfp);
+		}
+	} else {
+		if (hist_count && info_source[0] && strcmp(info_source, "kernel")) {
+			fprintf(stderr, "ifstat: history is stale, ignoring it.\n");
+			hist_count = 0;
+			info_source[0] = 0;
+		}
+		if (load_info())
+			return -1;
+		if (info_source[0] == 0)
+			strcpy(info_source, "kernel");
+	}
+
+	sort_kern_db();
+
+	if (!no_output) {
+		if (ignore_history || !hist_count)
+			dump_kern_db(stdout);
+		else
+			dump_incr_db(stdout);
+	}
+
+	if (!no_update) {
+		save_hist(hist_fd);
+		close(hist_fd);
+	}
+		return 0;
+}
+
+/* for the next namespace, as if ifstat had just started */
+static void ifstat_reset(void)
+{
+	if (hist)
+		munmap(hist, hist_len);
+	else
+		free(hist_ent);
+	hist = NULL;
+	hist_ent = NULL;
+	hist_count = 0;
+	arena_free(&kern_arena);
+	kern_db = NULL;
+	info_source[0] = 0;
+	source_mismatch = 0;
+}
+
 int main(int argc, char *argv[])
 {
 	char hist_name[128];
-	struct sockaddr_un sun;
-	FILE *hist_fp = NULL;
 	const char *stats_type = NULL;
+	const char *exporter = NULL;
+	bool all_netns = false;
+	unsigned int i;
+	int ret = 0;
 	int ch;
-	int fd;
 
 	is_extended = false;
-	while ((ch = getopt_long(argc, argv, "hjpvVzrnasd:t:ex:",
+	while ((ch = getopt_long(argc, argv, "hjpvVzrnN:Aasd:t:eE:x:",
 			longopts, NULL)) != EOF) {
 		switch (ch) {
 		case 'z':
@@ -845,9 +1479,22 @@ int main(int argc, char *argv[])
 		case 'n':
 			no_output = 1;
 			break;
+		case 'N':
+			netns_list = realloc(netns_list, (netns_count + 1) *
+					     sizeof(*netns_list));
+			if (!netns_list)
+				abort();
+			netns_list[netns_count++] = optarg;
+			break;
+		case 'A':
+			all_netns = true;
+			break;
 		case 'e':
 			show_errors = 1;
 			break;
+		case 'E':
+			exporter = optarg;
+			break;
 		case 'j':
 			json_output = 1;
 			break;
@@ -892,35 +1539,48 @@ int main(int argc, char *argv[])
 			iprt_exit(-1);
 	}
 
-	sun.sun_family = AF_UNIX;
-	sun.sun_path[0] = 0;
-	sprintf(sun.sun_path+1, "ifstat%d", getuid());
+	if (all_netns) {
+		free(netns_list);
+		netns_count = 0;
+		netns_list = netns_names(&netns_count);
+		if (!netns_list && !(netns_list = calloc(1, sizeof(*netns_list))))
+			abort();
+	}
+	if (netns_list) {
+		/* the link cache has the names of one namespace only */
+		if (is_extended) {
+			fprintf(stderr, "ifstat: -x reads the namespace of ifstat only\n");
+			iprt_exit(-1);
+		}
+		stats_getlink = true;
+		netns_tabs_init();
+		ifstat_collector.name = "ifstat-netns";
+	}
+
+	if (exporter && scan_interval <= 0)
+		scan_interval = EXPORTER_INTERVAL * 1000;
 
 	if (scan_interval > 0) {
 		if (time_constant == 0)
 			time_constant = 60;
 		time_constant *= 1000;
-		W = 1 - 1/exp(log(10)*(double)scan_interval/time_constant);
-		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-			perror("ifstat: socket");
+		statsd_rate_init(&ewma, scan_interval, time_constant);
+		if (exporter) {
+			patterns = argv;
+			npatterns = argc;
+			exporter_run(exporter, scan_interval, ifstat_export);
 			iprt_exit(-1);
 		}
-		if (bind(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) < 0) {
-			perror("ifstat: bind");
-			iprt_exit(-1);
+		statsd_run(&ifstat_collector, 1, scan_interval, time_constant);
+		if (shm_fd >= 0)
+			shm_destroy();
+		for (i = 0; i < netns_count; i++) {
+			netns_enter(&netns_tabs[i]);
+			if (shm_fd >= 0)
+				shm_destroy();
+			netns_leave(&netns_tabs[i]);
 		}
-		if (listen(fd, 5) < 0) {
-			perror("ifstat: listen");
-			iprt_exit(-1);
-		}
-		if (daemon(0, 0)) {
-			perror("ifstat: daemon");
-			iprt_exit(-1);
-		}
-		signal(SIGPIPE, SIG_IGN);
-		signal(SIGCHLD, sigchild);
-		server_loop(fd);
-		iprt_exit(0);
+		iprt_exit(-1);
 	}
 
 	patterns = argv;
@@ -938,103 +1598,28 @@ int main(int argc, char *argv[])
 				 "%s/.%s_ifstat.u%d", P_tmpdir, stats_type,
 				 getuid());
 
-	if (reset_history)
-		unlink(hist_name);
-
-	if (!ignore_history || !no_update) {
-		struct stat stb;
+	if (!netns_list)
+		iprt_exit(ifstat_show(hist_name) ? -1 : 0);
 
-		fd = open(hist_name, O_RDWR|O_CREAT|O_NOFOLLOW, 0600);
-		if (fd < 0) {
-			perror("ifstat: open history file");
-			iprt_exit(-1);
-		}
-		if ((hist_fp = fdopen(fd, "r+")) == NULL) {
-			perror("ifstat: fdopen history file");
-			iprt_exit(-1);
-		}
-		if (flock(fileno(hist_fp), LOCK_EX)) {
-			perror("ifstat: flock history file");
-			iprt_exit(-1);
-		}
-		if (fstat(fileno(hist_fp), &stb) != 0) {
-			perror("ifstat: fstat history file");
-			iprt_exit(-1);
-		}
-		if (stb.st_nlink != 1 || stb.st_uid != getuid()) {
-			fprintf(stderr, "ifstat: something is so wrong with history file, that I prefer not to proceed.\n");
-			iprt_exit(-1);
-		}
-		if (!ignore_history) {
-			FILE *tfp;
-			long uptime = -1;
-
-			if ((tfp = fopen("/proc/uptime", "r")) != NULL) {
-				if (fscanf(tfp, "%ld", &uptime) != 1)
-					uptime = -1;
-				fclose(tfp);
-			}
-			if (uptime >= 0 && time(NULL) >= stb.st_mtime+uptime) {
-				fprintf(stderr, "ifstat: history is aged out, resetting\n");
-				if (ftruncate(fileno(hist_fp), 0))
-					perror("ifstat: ftruncate");
-			}
-		}
-
-		load_raw_table(hist_fp);
-
-		hist_db = kern_db;
-		kern_db = NULL;
-	}
-
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
-	    (connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0
-	     || (strcpy(sun.sun_path+1, "ifstat0"),
-		 connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
-	    && verify_forging(fd) == 0) {
-		FILE *sfp = fdopen(fd, "r");
-
-		if (!sfp) {
-			fprintf(stderr, "ifstat: fdopen failed: %s\n",
-				strerror(errno));
-			close(fd);
-		} else  {
-			load_raw_table(sfp);
-			if (hist_db && source_mismatch) {
-				fprintf(stderr, "ifstat: history is stale, ignoring it.\n");
-				hist_db = NULL;
-			}
-			fclose(sfp);
-		}
-	} else {
-		if (fd >= 0)
-			close(fd);
-		if (hist_db && info_source[0] && strcmp(info_source, "kernel")) {
-			fprintf(stderr, "ifstat: history is stale, ignoring it.\n");
-			hist_db = NULL;
-			info_source[0] = 0;
-		}
-		if (load_info())
-			return -1;
-		if (info_source[0] == 0)
-			strcpy(info_source, "kernel");
+	if (json_output) {
+		netns_jw = jsonw_new(stdout);
+		jsonw_start_object(netns_jw);
+		jsonw_pretty(netns_jw, pretty);
 	}
-
-	if (!no_output) {
-		if (ignore_history || hist_db == NULL)
-			dump_kern_db(stdout);
-		else
-			dump_incr_db(stdout);
+	for (i = 0; i < netns_count; i++) {
+		char ns_hist[PATH_MAX];
+
+		netns = netns_list[i];
+		snprintf(ns_hist, sizeof(ns_hist), "%s.%s", hist_name, netns);
+		if (!no_output && !json_output)
+			printf("\nnetns: %s\n", netns);
+		if (ifstat_show(ns_hist))
+			ret = -1;
+		ifstat_reset();
 	}
-
-	if (!no_update) {
-		if (ftruncate(fileno(hist_fp), 0))
-			perror("ifstat: ftruncate");
-		rewind(hist_fp);
-
-		json_output = 0;
-		dump_raw_db(hist_fp, 1);
-		fclose(hist_fp);
+	if (netns_jw) {
+		jsonw_end_object(netns_jw);
+		jsonw_destroy(&netns_jw);
 	}
-	iprt_exit(0);
+	iprt_exit(ret);
 }
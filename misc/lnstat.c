@@ -37,6 +37,7 @@
 #include <getopt.h>
 
 #include "iprt.h"
+#include "utils.h"
 #include <json_writer.h>
 #include "lnstat.h"
 
@@ -44,11 +45,13 @@ static struct option opts[] = {
 	{ "version", 0, NULL, 'V' },
 	{ "count", 1, NULL, 'c' },
 	{ "dump", 0, NULL, 'd' },
+	{ "exporter", 1, NULL, 'E' },
 	{ "json", 0, NULL, 'j' },
 	{ "file", 1, NULL, 'f' },
 	{ "help", 0, NULL, 'h' },
 	{ "interval", 1, NULL, 'i' },
 	{ "keys", 1, NULL, 'k' },
+	{ "percpu", 0, NULL, 'P' },
 	{ "subject", 1, NULL, 's' },
 	{ "width", 1, NULL, 'w' },
 	{ "oneline", 0, NULL, 0 },
@@ -65,6 +68,8 @@ static int usage(char *name, int exit_code)
 			"Print <count> number of intervals\n");
 	fprintf(stderr, "\t-d --dump\t\t"
 			"Dump list of available files/keys\n");
+	fprintf(stderr, "\t-E --exporter <addr>\t"
+			"Serve over HTTP on [host:]port\n");
 	fprintf(stderr, "\t-j --json\t\t"
 			"Display in JSON format\n");
 	fprintf(stderr, "\t-f --file <file>\tStatistics file to use\n");
@@ -72,6 +77,7 @@ static int usage(char *name, int exit_code)
 	fprintf(stderr, "\t-i --interval <intv>\t"
 			"Set interval to 'intv' seconds\n");
 	fprintf(stderr, "\t-k --keys k,k,k,...\tDisplay only keys specified\n");
+	fprintf(stderr, "\t-P --percpu\t\tOne line per CPU, not their sum\n");
 	fprintf(stderr, "\t-s --subject [0-2]\tControl header printing:\n");
 	fprintf(stderr, "\t\t\t\t0 = never\n");
 	fprintf(stderr, "\t\t\t\t1 = once\n");
@@ -108,6 +114,84 @@ static void print_line(FILE *of, const struct lnstat_file *lnstat_files,
 	fputc('\n', of);
 }
 
+/* the cpu of each line, in the order of /sys/devices/system/cpu/possible */
+static int *line_cpu;
+static unsigned int line_ncpu;
+
+static void read_possible_cpus(void)
+{
+	FILE *f = fopen("/sys/devices/system/cpu/possible", "r");
+	unsigned int lo, hi, size = 0;
+	char sep;
+
+	if (!f)
+		return;
+	while (fscanf(f, "%u", &lo) == 1) {
+		hi = lo;
+		sep = fgetc(f);
+		if (sep == '-') {
+			if (fscanf(f, "%u", &hi) != 1)
+				break;
+			sep = fgetc(f);
+		}
+		for (; lo <= hi; lo++) {
+			if (line_ncpu == size) {
+				int *p = realloc(line_cpu,
+						 (size + 64) * sizeof(*p));
+
+				if (!p)
+					goto out;
+				line_cpu = p;
+				size += 64;
+			}
+			line_cpu[line_ncpu++] = lo;
+		}
+		if (sep != ',')
+			break;
+	}
+out:
+	fclose(f);
+}
+
+static int cpu_of_line(unsigned int n)
+{
+	return n < line_ncpu ? line_cpu[n] : n;
+}
+
+static unsigned int cpu_lines(const struct field_params *fp)
+{
+	unsigned int i, num = 0;
+
+	for (i = 0; i < fp->num; i++) {
+		const struct lnstat_file *f = fp->params[i].lf->file;
+
+		if (f->cpu_alloc && f->num_lines > num)
+			num = f->num_lines;
+	}
+	return num;
+}
+
+static unsigned long cpu_result(const struct lnstat_field *lf, unsigned int n)
+{
+	if (!lf->file->cpu_alloc || n >= lf->file->num_lines)
+		return 0;
+	return lf->cpu_result[n];
+}
+
+static void print_cpu_lines(FILE *of, const struct field_params *fp)
+{
+	unsigned int n, num = cpu_lines(fp);
+	int i;
+
+	for (n = 0; n < num; n++) {
+		fprintf(of, "%3d|", cpu_of_line(n));
+		for (i = 0; i < fp->num; i++)
+			fprintf(of, "%*lu|", fp->params[i].print.width,
+				cpu_result(fp->params[i].lf, n));
+		fputc('\n', of);
+	}
+}
+
 static void print_json(FILE *of, const struct lnstat_file *lnstat_files,
 		       const struct field_params *fp)
 {
@@ -124,6 +208,61 @@ static void print_json(FILE *of, const struct lnstat_file *lnstat_files,
 	jsonw_destroy(&jw);
 }
 
+static void print_cpu_json(FILE *of, const struct field_params *fp)
+{
+	json_writer_t *jw = jsonw_new(of);
+	unsigned int n, num = cpu_lines(fp);
+	int i;
+
+	jsonw_start_array(jw);
+	for (n = 0; n < num; n++) {
+		jsonw_start_object(jw);
+		jsonw_int_field(jw, "cpu", cpu_of_line(n));
+		for (i = 0; i < fp->num; i++) {
+			const struct lnstat_field *lf = fp->params[i].lf;
+
+			jsonw_uint_field(jw, lf->name, cpu_result(lf, n));
+		}
+		jsonw_end_object(jw);
+	}
+	jsonw_end_array(jw);
+	jsonw_destroy(&jw);
+}
+
+static struct lnstat_file *export_files;
+static struct field_params *export_fp;
+
+/* The first field of a file is the absolute one, the others count */
+static void lnstat_export(FILE *of, int interval)
+{
+	char id[2 * NAME_MAX], name[2 * NAME_MAX];
+	unsigned int n;
+	int i;
+
+	lnstat_read(export_files);
+
+	for (i = 0; i < export_fp->num; i++) {
+		const struct lnstat_field *lf = export_fp->params[i].lf;
+		bool gauge = lf == &lf->file->fields[0];
+
+		snprintf(id, sizeof(id), "%s_%s", lf->file->basename, lf->name);
+		exporter_name(name, sizeof(name), "lnstat_", id);
+		exporter_type(of, name, gauge ? "gauge" : "counter");
+		if (gauge || !lnstat_percpu || !lf->file->cpu_alloc) {
+			exporter_sample(of, name, gauge ? "" : "_total",
+					NULL, NULL, lf->values[0]);
+			continue;
+		}
+		for (n = 0; n < lf->file->num_lines; n++) {
+			char cpu[16];
+
+			snprintf(cpu, sizeof(cpu), "%d", cpu_of_line(n));
+			exporter_sample(of, name, "_total", "cpu", cpu,
+					lf->cpu_values[0][n]);
+		}
+	}
+}
+
 /* find lnstat_field according to user specification */
 static int map_field_params(struct lnstat_file *lnstat_files,
 			    struct field_params *fps, int interval)
@@ -152,7 +291,7 @@ static int map_field_params(struct lnstat_file *lnstat_files,
 		}
 full:
 		fps->num = j;
-		return 1;
+		goto parse;
 	}
 
 	for (i = 0; i < fps->num; i++) {
@@ -167,6 +306,17 @@ full:
 		if (!fps->params[i].print.width)
 			fps->params[i].print.width = FIELD_WIDTH_DEFAULT;
 	}
+
+parse:
+	/* files are read only as far as the last field shown */
+	for (lf = lnstat_files; lf; lf = lf->next)
+		lf->num_parse = 0;
+	for (i = 0; i < fps->num; i++) {
+		const struct lnstat_field *f = fps->params[i].lf;
+
+		if (f->num >= f->file->num_parse)
+			f->file->num_parse = f->num + 1;
+	}
 	return 1;
 }
 
@@ -223,6 +373,8 @@ static int print_hdr(FILE *of, struct table_hdr *th)
 	int i;
 
 	for (i = 0; i < th->num_lines; i++) {
+		if (lnstat_percpu)
+			fputs(i ? "   |" : "cpu|", of);
 		fputs(th->hdr[i], of);
 		fputc('\n', of);
 	}
@@ -241,7 +393,9 @@ int main(int argc, char **argv)
 		MODE_DUMP,
 		MODE_JSON,
 		MODE_NORMAL,
+		MODE_EXPORTER,
 	} mode = MODE_NORMAL;
+	const char *exporter = NULL;
 	unsigned long count = 0;
 	struct table_hdr *header;
 	static struct field_params fp;
@@ -265,7 +419,7 @@ int main(int argc, char **argv)
 		num_req_files = 1;
 	}
 
-	while ((c = getopt_long(argc, argv, "Vc:djpf:h?i:k:s:w:",
+	while ((c = getopt_long(argc, argv, "Vc:dE:jpf:h?i:k:Ps:w:",
 				opts, NULL)) != -1) {
 		int len = 0;
 		char *tmp, *tok;
@@ -277,6 +431,10 @@ int main(int argc, char **argv)
 		case 'd':
 			mode = MODE_DUMP;
 			break;
+		case 'E':
+			mode = MODE_EXPORTER;
+			exporter = optarg;
+			break;
 		case 'j':
 			mode = MODE_JSON;
 			break;
@@ -306,6 +464,9 @@ int main(int argc, char **argv)
 				fp.params[fp.num++].name = tok;
 			}
 			break;
+		case 'P':
+			lnstat_percpu = 1;
+			break;
 		case 's':
 			sscanf(optarg, "%u", &hdr);
 			break;
@@ -336,12 +497,24 @@ int main(int argc, char **argv)
 
 	lnstat_files = lnstat_scan_dir(PROC_NET_STAT, num_req_files,
 				       (const char **) req_files);
+	if (lnstat_percpu)
+		read_possible_cpus();
 
 	switch (mode) {
 	case MODE_DUMP:
 		lnstat_dump(stdout, lnstat_files);
 		break;
 
+	case MODE_EXPORTER:
+		if (!map_field_params(lnstat_files, &fp, interval))
+			iprt_exit(1);
+		if (interval < 1)
+			interval = 1;
+		export_files = lnstat_files;
+		export_fp = &fp;
+		exporter_run(exporter, interval * 1000, lnstat_export);
+		iprt_exit(1);
+
 	case MODE_NORMAL:
 	case MODE_JSON:
 		if (!map_field_params(lnstat_files, &fp, interval))
@@ -356,13 +529,18 @@ int main(int argc, char **argv)
 
 		for (i = 0; i < count || !count; i++) {
 			lnstat_update(lnstat_files);
-			if (mode == MODE_JSON)
+			if (mode == MODE_JSON && lnstat_percpu)
+				print_cpu_json(stdout, &fp);
+			else if (mode == MODE_JSON)
 				print_json(stdout, lnstat_files, &fp);
 			else {
 				if  ((hdr > 1 && !(i % 20)) ||
 				     (hdr == 1 && i == 0))
 					print_hdr(stdout, header);
-				print_line(stdout, lnstat_files, &fp);
+				if (lnstat_percpu)
+					print_cpu_lines(stdout, &fp);
+				else
+					print_line(stdout, lnstat_files, &fp);
 			}
 			fflush(stdout);
 			if (i < count - 1 || !count)
@@ -21,6 +21,8 @@ struct lnstat_field {
 	char name[LNSTAT_MAX_FIELD_NAME_LEN+1];
 	unsigned long values[2];		/* two buffers for values */
 	unsigned long result;
+	unsigned long *cpu_values[2];		/* per line, in lnstat_percpu */
+	unsigned long *cpu_result;
 };
 
 struct lnstat_file {
@@ -30,15 +32,23 @@ struct lnstat_file {
 	struct timeval last_read;		/* last time of read */
 	struct timeval interval;		/* interval */
 	int compat;				/* 1 == backwards compat mode */
-	FILE *fp;
+	int fd;
+	char *buf;				/* what the last read returned */
+	size_t buf_size;
 	unsigned int num_fields;		/* number of fields */
+	unsigned int num_parse;			/* of the first fields to read */
+	unsigned int num_lines;			/* of values, one per cpu */
+	unsigned int cpu_alloc;			/* lines room is made for */
 	struct lnstat_field fields[LNSTAT_MAX_FIELDS_PER_LINE];
 };
 
 
+extern int lnstat_percpu;
+
 struct lnstat_file *lnstat_scan_dir(const char *path, const int num_req_files,
 				    const char **req_files);
 int lnstat_update(struct lnstat_file *lnstat_files);
+int lnstat_read(struct lnstat_file *lnstat_files);
 int lnstat_dump(FILE *outfd, struct lnstat_file *lnstat_files);
 struct lnstat_field *lnstat_find_field(struct lnstat_file *lnstat_files,
 				       const char *name);
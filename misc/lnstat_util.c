@@ -17,9 +17,12 @@
  */
 
 #include <unistd.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <limits.h>
 #include <time.h>
@@ -35,36 +38,147 @@
 
 #define RTSTAT_COMPAT_LINE "entries  in_hit in_slow_tot in_no_route in_brd in_martian_dst in_martian_src  out_hit out_slow_tot out_slow_mc  gc_total gc_ignored gc_goal_miss gc_dst_overflow in_hlist_search out_hlist_search\n"
 
-/* Read (and summarize for SMP) the different stats vars. */
+/* keep the values of every line, not just their sums */
+int lnstat_percpu;
+
+/* Read the whole file into lf->buf, which only ever grows */
+static ssize_t read_file(struct lnstat_file *lf)
+{
+	size_t len = 0;
+
+	for (;;) {
+		ssize_t n;
+
+		if (len + 1 >= lf->buf_size) {
+			size_t size = lf->buf_size ? 2 * lf->buf_size
+						   : 4 * FGETS_BUF_SIZE;
+			char *p = realloc(lf->buf, size);
+
+			if (!p)
+				return -1;
+			lf->buf = p;
+			lf->buf_size = size;
+		}
+
+		n = pread(lf->fd, lf->buf + len, lf->buf_size - 1 - len, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+	lf->buf[len] = '\0';
+	return len;
+}
+
+static unsigned long parse_hex(const char **ptr, const char *eol)
+{
+	const char *p = *ptr;
+	unsigned long f = 0;
+
+	while (p < eol && (*p == ' ' || *p == '\t'))
+		p++;
+	for (; p < eol; p++) {
+		unsigned int d;
+
+		if (*p >= '0' && *p <= '9')
+			d = *p - '0';
+		else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+			d = (*p | 0x20) - 'a' + 10;
+		else
+			break;
+		f = (f << 4) | d;
+	}
+	*ptr = p;
+	return f;
+}
+
+/* room for the values of at least num lines in every field */
+static int grow_cpus(struct lnstat_file *lf, unsigned int num)
+{
+	unsigned int alloc = lf->cpu_alloc ? lf->cpu_alloc : 64;
+	int j, k;
+
+	while (alloc < num)
+		alloc *= 2;
+
+	for (j = 0; j < lf->num_fields; j++) {
+		struct lnstat_field *lfi = &lf->fields[j];
+		unsigned long **bufs[] = {
+			&lfi->cpu_values[0], &lfi->cpu_values[1],
+			&lfi->cpu_result,
+		};
+
+		for (k = 0; k < 3; k++) {
+			unsigned long *p = realloc(*bufs[k],
+						   alloc * sizeof(*p));
+
+			if (!p)
+				return -1;
+			memset(p + lf->cpu_alloc, 0,
+			       (alloc - lf->cpu_alloc) * sizeof(*p));
+			*bufs[k] = p;
+		}
+	}
+	lf->cpu_alloc = alloc;
+	return 0;
+}
+
+/*
+ * Read (and summarize for SMP) the different stats vars. Only the
+ * first num_parse fields of a line are parsed, the rest is skipped.
+ */
 static int scan_lines(struct lnstat_file *lf, int i)
 {
-	char buf[FGETS_BUF_SIZE];
+	const char *p, *eol, *end;
 	int j, num_lines = 0;
+	ssize_t len;
 
 	for (j = 0; j < lf->num_fields; j++)
 		lf->fields[j].values[i] = 0;
 
-	rewind(lf->fp);
-	/* skip first line */
-	if (!lf->compat && !fgets(buf, sizeof(buf)-1, lf->fp))
+	len = read_file(lf);
+	if (len < 0)
 		return -1;
+	p = lf->buf;
+	end = p + len;
+
+	/* skip first line */
+	if (!lf->compat) {
+		p = memchr(p, '\n', len);
+		if (!p)
+			return -1;
+		p++;
+	}
+
+	gettimeofday(&lf->last_read, NULL);
 
-	while (!feof(lf->fp) && fgets(buf, sizeof(buf)-1, lf->fp)) {
-		char *ptr = buf;
+	for (; p < end; p = eol + 1, num_lines++) {
+		bool cpu = lnstat_percpu;
 
-		num_lines++;
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
 
-		gettimeofday(&lf->last_read, NULL);
+		if (cpu && num_lines >= lf->cpu_alloc &&
+		    grow_cpus(lf, num_lines + 1) < 0)
+			cpu = false;
 
-		for (j = 0; j < lf->num_fields; j++) {
-			unsigned long f = strtoul(ptr, &ptr, 16);
+		for (j = 0; j < lf->num_parse; j++) {
+			unsigned long f = parse_hex(&p, eol);
 
 			if (j == 0)
 				lf->fields[j].values[i] = f;
 			else
 				lf->fields[j].values[i] += f;
+			if (cpu)
+				lf->fields[j].cpu_values[i][num_lines] = f;
 		}
 	}
+	lf->num_lines = num_lines;
 	return num_lines;
 }
 
@@ -91,28 +205,53 @@ int lnstat_update(struct lnstat_file *lnstat_files)
 	gettimeofday(&tv, NULL);
 
 	for (lf = lnstat_files; lf; lf = lf->next) {
-		if (time_after(&lf->last_read, &lf->interval, &tv)) {
-			int i;
+		if (lf->num_parse && time_after(&lf->last_read, &lf->interval, &tv)) {
+			int i, n;
 			struct lnstat_field *lfi;
 
 			scan_lines(lf, 1);
 
 			for (i = 0, lfi = &lf->fields[i];
-			     i < lf->num_fields; i++, lfi = &lf->fields[i]) {
+			     i < lf->num_parse; i++, lfi = &lf->fields[i]) {
 				if (i == 0)
 					lfi->result = lfi->values[1];
 				else
 					lfi->result = (lfi->values[1]-lfi->values[0])
 							/ lf->interval.tv_sec;
+				lfi->values[0] = lfi->values[1];
+
+				if (!lnstat_percpu || !lf->cpu_alloc)
+					continue;
+				for (n = 0; n < lf->num_lines; n++) {
+					unsigned long *v0 = lfi->cpu_values[0];
+					unsigned long *v1 = lfi->cpu_values[1];
+
+					if (i == 0)
+						lfi->cpu_result[n] = v1[n];
+					else
+						lfi->cpu_result[n] = (v1[n] - v0[n])
+							/ lf->interval.tv_sec;
+					v0[n] = v1[n];
+				}
 			}
-
-			scan_lines(lf, 0);
 		}
 	}
 
 	return 0;
 }
 
+/* read the current values of all files into values[0], no rates */
+int lnstat_read(struct lnstat_file *lnstat_files)
+{
+	struct lnstat_file *lf;
+
+	for (lf = lnstat_files; lf; lf = lf->next)
+		if (lf->num_parse)
+			scan_lines(lf, 0);
+
+	return 0;
+}
+
 /* scan first template line and fill in per-field data structures */
 static int __lnstat_scan_fields(struct lnstat_file *lf, char *buf)
 {
@@ -122,15 +261,17 @@ static int __lnstat_scan_fields(struct lnstat_file *lf, char *buf)
 	tok = strtok(buf, " \t\n");
 	for (i = 0; i < LNSTAT_MAX_FIELDS_PER_LINE; i++) {
 		lf->fields[i].file = lf;
+		lf->fields[i].num = i;
 		strncpy(lf->fields[i].name, tok, LNSTAT_MAX_FIELD_NAME_LEN);
 		/* has to be null-terminate since we initialize to zero
 		 * and field size is NAME_LEN + 1 */
 		tok = strtok(NULL, " \t\n");
 		if (!tok) {
 			lf->num_fields = i+1;
-			return 0;
+			break;
 		}
 	}
+	lf->num_parse = lf->num_fields;
 	return 0;
 }
 
@@ -138,9 +279,10 @@ static int lnstat_scan_fields(struct lnstat_file *lf)
 {
 	char buf[FGETS_BUF_SIZE];
 
-	rewind(lf->fp);
-	if (!fgets(buf, sizeof(buf)-1, lf->fp))
+	if (read_file(lf) <= 0)
 		return -1;
+	snprintf(buf, sizeof(buf), "%.*s",
+		 (int)strcspn(lf->buf, "\n"), lf->buf);
 
 	return __lnstat_scan_fields(lf, buf);
 }
@@ -188,8 +330,8 @@ static struct lnstat_file *alloc_and_open(const char *path, const char *file)
 	lf->interval.tv_sec = 1;
 
 	/* open */
-	lf->fp = fopen(lf->path, "r");
-	if (!lf->fp) {
+	lf->fd = open(lf->path, O_RDONLY | O_CLOEXEC);
+	if (lf->fd < 0) {
 		perror(lf->path);
 		free(lf);
 		return NULL;
@@ -19,18 +19,16 @@
 #include <sys/time.h>
 #include <fnmatch.h>
 #include <sys/file.h>
-#include <sys/socket.h>
-#include <sys/un.h>
-#include <sys/poll.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
-#include <signal.h>
-#include <math.h>
+#include <sys/mman.h>
 #include <getopt.h>
+#include <limits.h>
 
 #include <json_writer.h>
 #include <SNAPSHOT.h>
 #include "utils.h"
+#include "arena.h"
+#include "namespace.h"
 
 int dump_zeros;
 int reset_history;
@@ -40,18 +38,31 @@ int json_output;
 int no_update;
 int scan_interval;
 int time_constant;
-double W;
+static struct statsd_rate ewma;
 char **patterns;
 int npatterns;
 
 char info_source[128];
 int source_mismatch;
 
+/*
+ * Of -N and -A, netns_list is NULL without them; netns is the namespace
+ * being read, NULL for that of nstat.
+ */
+static char **netns_list;
+static unsigned int netns_count;
+static const char *netns;
+static json_writer_t *netns_jw;
+
 static int generic_proc_open(const char *env, char *name)
 {
 	char store[128];
 	char *p = getenv(env);
 
+	/* what env points to is of nstat's namespace */
+	if (netns)
+		return netns_open_proc(netns, name, O_RDONLY);
+
 	if (!p) {
 		p = getenv("PROC_ROOT") ? : "/proc";
 		snprintf(store, sizeof(store)-1, "%s/%s", p, name);
@@ -88,7 +99,37 @@ struct nstat_ent {
 };
 
 struct nstat_ent *kern_db;
-struct nstat_ent *hist_db;
+static struct arena kern_arena;	/* the entries of kern_db and their names */
+
+/*
+ * The history file is this header followed by count entries sorted by
+ * the hash of their name, then the name, so that a counter is found in
+ * it without walking the list. It is mapped, and rewritten in place as
+ * long as the counters are the same.
+ */
+#define NSTAT_HIST_MAGIC	0x4854534e	/* "NSTH" */
+#define NSTAT_HIST_VERSION	1
+
+struct nstat_hist_ent {
+	__u32		hash;
+	char		id[60];
+	__u64		val;
+	double		rate;
+};
+
+struct nstat_hist_hdr {
+	__u32		magic;
+	__u32		version;
+	__u32		count;
+	__u32		pad;
+	char		info_source[128];
+	struct nstat_hist_ent	ent[];
+};
+
+static struct nstat_hist_hdr *hist;
+static size_t hist_len;
+static struct nstat_hist_ent *hist_ent;
+static unsigned int hist_count;
 
 static const char *useless_numbers[] = {
 	"IpForwarding", "IpDefaultTTL",
@@ -148,9 +189,10 @@ static void load_good_table(FILE *fp)
 			rate = 0;
 		if (useless_number(idbuf))
 			continue;
-		if ((n = malloc(sizeof(*n))) == NULL)
+		n = arena_alloc(&kern_arena, sizeof(*n));
+		if (!n)
 			abort();
-		n->id = strdup(idbuf);
+		n->id = arena_strdup(&kern_arena, idbuf);
 		n->val = val;
 		n->rate = rate;
 		n->next = db;
@@ -177,12 +219,13 @@ static int count_spaces(const char *line)
 
 static void load_ugly_table(FILE *fp)
 {
-	char buf[2048];
+	/* TcpExt has grown past 2048 */
+	char buf[8192];
 	struct nstat_ent *db = NULL;
 	struct nstat_ent *n;
 
 	while (fgets(buf, sizeof(buf), fp) != NULL) {
-		char idbuf[4096];
+		char idbuf[sizeof(buf)];
 		int  off;
 		char *p;
 		int count1, count2, skip = 0;
@@ -192,8 +235,7 @@ static void load_ugly_table(FILE *fp)
 			abort();
 		count1 = count_spaces(buf);
 		*p = 0;
-		idbuf[0] = 0;
-		strncat(idbuf, buf, sizeof(idbuf) - 1);
+		strcpy(idbuf, buf);
 		off = p - buf;
 		p += 2;
 
@@ -208,10 +250,10 @@ static void load_ugly_table(FILE *fp)
 				idbuf[off] = 0;
 				strncat(idbuf, p, sizeof(idbuf) - off - 1);
 			}
-			n = malloc(sizeof(*n));
+			n = arena_alloc(&kern_arena, sizeof(*n));
 			if (!n)
 				abort();
-			n->id = strdup(idbuf);
+			n->id = arena_strdup(&kern_arena, idbuf);
 			n->rate = 0;
 			n->next = db;
 			db = n;
@@ -241,10 +283,7 @@ static void load_ugly_table(FILE *fp)
 	while (db) {
 		n = db;
 		db = db->next;
-		if (useless_number(n->id)) {
-			free(n->id);
-			free(n);
-		} else {
+		if (!useless_number(n->id)) {
 			n->next = kern_db;
 			kern_db = n;
 		}
@@ -291,19 +330,47 @@ static void load_netstat(void)
 	}
 }
 
-
-static void dump_kern_db(FILE *fp, int to_hist)
+/* with namespaces, their tables are the members of one object */
+static json_writer_t *dump_json_new(FILE *fp)
 {
-	json_writer_t *jw = json_output ? jsonw_new(fp) : NULL;
-	struct nstat_ent *n, *h;
+	if (!json_output)
+		return NULL;
+	return netns_jw ? : jsonw_new(fp);
+}
 
-	h = hist_db;
-	if (jw) {
+static void dump_json_start(json_writer_t *jw)
+{
+	if (!netns_jw) {
 		jsonw_start_object(jw);
 		jsonw_pretty(jw, pretty);
-		jsonw_name(jw, info_source);
+	}
+	if (netns) {
+		jsonw_name(jw, netns);
 		jsonw_start_object(jw);
-	} else
+	}
+	jsonw_name(jw, info_source);
+	jsonw_start_object(jw);
+}
+
+static void dump_json_end(json_writer_t *jw)
+{
+	jsonw_end_object(jw);
+	if (netns)
+		jsonw_end_object(jw);
+	if (!netns_jw) {
+		jsonw_end_object(jw);
+		jsonw_destroy(&jw);
+	}
+}
+
+static void dump_kern_db(FILE *fp)
+{
+	json_writer_t *jw = dump_json_new(fp);
+	struct nstat_ent *n;
+
+	if (jw)
+		dump_json_start(jw);
+	else
 		fprintf(fp, "#%s\n", info_source);
 
 	for (n = kern_db; n; n = n->next) {
@@ -311,19 +378,8 @@ static void dump_kern_db(FILE *fp, int to_hist)
 
 		if (!dump_zeros && !val && !n->rate)
 			continue;
-		if (!match(n->id)) {
-			struct nstat_ent *h1;
-
-			if (!to_hist)
-				continue;
-			for (h1 = h; h1; h1 = h1->next) {
-				if (strcmp(h1->id, n->id) == 0) {
-					val = h1->val;
-					h = h1->next;
-					break;
-				}
-			}
-		}
+		if (!match(n->id))
+			continue;
 
 		if (jw)
 			jsonw_uint_field(jw, n->id, val);
@@ -331,43 +387,213 @@ static void dump_kern_db(FILE *fp, int to_hist)
 			fprintf(fp, "%-32s%-16llu%6.1f\n", n->id, val, n->rate);
 	}
 
-	if (jw) {
-		jsonw_end_object(jw);
+	if (jw)
+		dump_json_end(jw);
+}
 
-		jsonw_end_object(jw);
-		jsonw_destroy(&jw);
+static __u32 hist_hash(const char *id)
+{
+	__u32 hash = 2166136261u;
+
+	while (*id)
+		hash = (hash ^ (unsigned char)*id++) * 16777619u;
+	return hash;
+}
+
+static int hist_cmp(__u32 hash, const char *id, const struct nstat_hist_ent *e)
+{
+	if (hash != e->hash)
+		return hash < e->hash ? -1 : 1;
+	return strncmp(id, e->id, sizeof(e->id));
+}
+
+static const struct nstat_hist_ent *hist_find(const char *id)
+{
+	__u32 hash = hist_hash(id);
+	unsigned int lo = 0, hi = hist_count;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		int cmp = hist_cmp(hash, id, &hist_ent[mid]);
+
+		if (!cmp)
+			return &hist_ent[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+static int cmp_hist_ent(const void *a, const void *b)
+{
+	const struct nstat_hist_ent *ea = a, *eb = b;
+
+	return hist_cmp(ea->hash, ea->id, eb);
+}
+
+static size_t hist_bytes(unsigned int count)
+{
+	return sizeof(struct nstat_hist_hdr) +
+	       (size_t)count * sizeof(struct nstat_hist_ent);
+}
+
+/* kern_db as history entries, sorted; names too long to keep are left out */
+static struct nstat_hist_ent *hist_build(unsigned int *count)
+{
+	struct nstat_hist_ent *v, *e;
+	struct nstat_ent *n;
+	unsigned int i = 0;
+
+	for (n = kern_db; n; n = n->next)
+		i++;
+	v = calloc(i ? : 1, sizeof(*v));
+	if (!v)
+		abort();
+	for (n = kern_db, e = v; n; n = n->next) {
+		if (strlen(n->id) >= sizeof(e->id))
+			continue;
+		e->hash = hist_hash(n->id);
+		strcpy(e->id, n->id);
+		e->val = n->val;
+		e->rate = n->rate;
+		e++;
 	}
+	*count = e - v;
+	qsort(v, *count, sizeof(*v), cmp_hist_ent);
+	return v;
+}
+
+/* In a text history, as earlier versions have it: taken as an array */
+static void load_hist_text(int fd)
+{
+	FILE *fp;
+
+	fp = fdopen(dup(fd), "r");
+	if (!fp)
+		return;
+	load_good_table(fp);
+	fclose(fp);
+
+	hist_ent = hist_build(&hist_count);
+	arena_free(&kern_arena);
+	kern_db = NULL;
+}
+
+static void load_hist(int fd, const struct stat *st)
+{
+	struct nstat_hist_hdr *h;
+	char source[128];
+
+	if (st->st_size < sizeof(*h)) {
+		if (st->st_size)
+			load_hist_text(fd);
+		return;
+	}
+
+	h = mmap(NULL, st->st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		perror("nstat: mmap history file");
+		return;
+	}
+	if (h->magic != NSTAT_HIST_MAGIC) {
+		munmap(h, st->st_size);
+		load_hist_text(fd);
+		return;
+	}
+	if (h->version != NSTAT_HIST_VERSION ||
+	    hist_bytes(h->count) > st->st_size) {
+		fprintf(stderr, "nstat: history file of another version, resetting\n");
+		munmap(h, st->st_size);
+		return;
+	}
+
+	hist = h;
+	hist_len = st->st_size;
+	hist_ent = h->ent;
+	hist_count = h->count;
+
+	memcpy(source, h->info_source, sizeof(source));
+	source[sizeof(source) - 1] = 0;
+	if (info_source[0] && strcmp(info_source, source))
+		source_mismatch = 1;
+	strcpy(info_source, source);
+}
+
+/*
+ * The counters left out by the patterns keep the values they had, so
+ * that what was not shown this time still is the next.
+ */
+static void save_hist(int fd)
+{
+	struct nstat_hist_hdr *h;
+	struct nstat_hist_ent *v;
+	const struct nstat_hist_ent *old;
+	unsigned int count, i;
+	size_t len;
+
+	v = hist_build(&count);
+
+	if (hist && hist->count == count) {
+		for (i = 0; i < count; i++)
+			if (cmp_hist_ent(&v[i], &hist->ent[i]))
+				break;
+		if (i == count) {
+			for (i = 0; i < count; i++)
+				if (match(v[i].id) || !hist_count)
+					hist->ent[i] = v[i];
+			memcpy(hist->info_source, info_source,
+			       sizeof(hist->info_source));
+			/* stores to a mapping need not bump it right away */
+			if (futimens(fd, NULL))
+				perror("nstat: futimens");
+			free(v);
+			return;
+		}
+	}
+
+	len = hist_bytes(count);
+	h = calloc(1, len);
+	if (!h)
+		abort();
+	h->magic = NSTAT_HIST_MAGIC;
+	h->version = NSTAT_HIST_VERSION;
+	h->count = count;
+	memcpy(h->info_source, info_source, sizeof(h->info_source));
+
+	for (i = 0; i < count; i++) {
+		old = match(v[i].id) ? NULL : hist_find(v[i].id);
+		h->ent[i] = old ? *old : v[i];
+	}
+
+	if (ftruncate(fd, len) || pwrite(fd, h, len, 0) != len)
+		perror("nstat: write history file");
+	free(h);
+	free(v);
 }
 
 static void dump_incr_db(FILE *fp)
 {
-	json_writer_t *jw = json_output ? jsonw_new(fp) : NULL;
-	struct nstat_ent *n, *h;
+	json_writer_t *jw = dump_json_new(fp);
+	struct nstat_ent *n;
 
-	h = hist_db;
-	if (jw) {
-		jsonw_start_object(jw);
-		jsonw_pretty(jw, pretty);
-		jsonw_name(jw, info_source);
-		jsonw_start_object(jw);
-	} else
+	if (jw)
+		dump_json_start(jw);
+	else
 		fprintf(fp, "#%s\n", info_source);
 
 	for (n = kern_db; n; n = n->next) {
 		int ovfl = 0;
 		unsigned long long val = n->val;
-		struct nstat_ent *h1;
-
-		for (h1 = h; h1; h1 = h1->next) {
-			if (strcmp(h1->id, n->id) == 0) {
-				if (val < h1->val) {
-					ovfl = 1;
-					val = h1->val;
-				}
-				val -= h1->val;
-				h = h1->next;
-				break;
+		const struct nstat_hist_ent *h = hist_find(n->id);
+
+		if (h) {
+			if (val < h->val) {
+				ovfl = 1;
+				val = h->val;
 			}
+			val -= h->val;
 		}
 		if (!dump_zeros && !val && !n->rate)
 			continue;
@@ -381,145 +607,463 @@ static void dump_incr_db(FILE *fp)
 				n->rate, ovfl?" (overflow)":"");
 	}
 
-	if (jw) {
-		jsonw_end_object(jw);
+	if (jw)
+		dump_json_end(jw);
+}
 
-		jsonw_end_object(jw);
-		jsonw_destroy(&jw);
+/*
+ * The daemon keeps the proc files open and reads them with pread()
+ * into buffers of their own. Which counter is in which column is
+ * parsed once per file and later reads only check that the names are
+ * still the same, while taking the values into a flat array. Only if a
+ * file changes its layout are the columns built again.
+ */
+struct nstat_src {
+	const char	*env;
+	const char	*name;
+	bool		ugly;		/* lines of names over lines of values */
+	int		fd;
+	char		*buf;
+	size_t		size;
+	char		*layout;	/* header lines, or names one per line */
+	size_t		layout_len;
+	unsigned int	first;		/* its columns in nstat_tab */
+	unsigned int	ncols;
+};
+
+struct nstat_col {
+	char			*id;
+	unsigned long long	val;
+	double			rate;
+};
+
+/* in the order the loaders leave their entries on kern_db */
+static struct nstat_src nstat_srcs[] = {
+	{ "PROC_NET_SCTP_SNMP", "net/sctp/snmp",	false, -1 },
+	{ "PROC_NET_SNMP",	"net/snmp",		true,  -1 },
+	{ "PROC_NET_SNMP6",	"net/snmp6",		false, -1 },
+	{ "PROC_NET_NETSTAT",	"net/netstat",		true,  -1 },
+};
+
+static struct nstat_col *nstat_tab;
+static unsigned long long *nstat_cur;
+static unsigned int nstat_ncols;
+
+static void nstat_src_read(struct nstat_src *src)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	if (src->fd < 0)
+		src->fd = generic_proc_open(src->env, (char *)src->name);
+
+	for (n = 0; src->fd >= 0; ) {
+		if (len + 1 >= src->size) {
+			size_t size = src->size ? 2 * src->size : 16384;
+			char *buf = realloc(src->buf, size);
+
+			if (!buf)
+				abort();
+			src->buf = buf;
+			src->size = size;
+		}
+		n = pread(src->fd, src->buf + len, src->size - len - 1, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	if (!src->buf) {
+		src->buf = malloc(1);
+		if (!src->buf)
+			abort();
 	}
+	/* an error reads as no counters at all */
+	src->buf[n < 0 ? 0 : len] = 0;
 }
 
-static int children;
+static unsigned long long nstat_value(const char **p)
+{
+	char *end;
+	unsigned long long val;
+
+	while (**p == ' ' || **p == '\t')
+		(*p)++;
+	val = strtoull(*p, &end, 10);
+	*p = end;
+	return val;
+}
 
-static void sigchild(int signo)
+/* Names on a header line, after its "Prefix:" */
+static unsigned int nstat_fields(const char *p, const char *eol)
 {
+	unsigned int fields = 0;
+
+	for (p = strchr(p, ':') + 1; p < eol; ) {
+		int len;
+
+		p += strspn(p, " ");
+		len = strcspn(p, " \n");
+		fields += len > 0;
+		p += len;
+	}
+	return fields;
 }
 
-static void update_db(int interval)
+/* Take the values, -1 if the layout is not the one parsed last */
+static int nstat_src_values(const struct nstat_src *src,
+			    unsigned long long *cur)
 {
-	struct nstat_ent *n, *h;
+	const char *lay = src->layout, *lay_end = lay + src->layout_len;
+	const char *p = src->buf;
+	unsigned int col = 0;
+
+	if (!src->layout)
+		return *p ? -1 : 0;
+
+	while (*p) {
+		const char *eol = strchr(p, '\n');
+		size_t len;
+
+		if (!eol)
+			return -1;
+		len = src->ugly ? eol + 1 - p : strcspn(p, " \t\n");
+		if (lay + len + !src->ugly > lay_end ||
+		    memcmp(p, lay, len) || (!src->ugly && lay[len] != '\n'))
+			return -1;
+		lay += len + !src->ugly;
+
+		if (src->ugly) {
+			unsigned int fields = nstat_fields(p, eol);
+
+			p = eol + 1;
+			eol = strchr(p, '\n');
+			if (!eol || !(p = strchr(p, ':')) || p > eol)
+				return -1;
+			p++;
+			while (fields-- && p < eol) {
+				if (col >= src->ncols)
+					return -1;
+				cur[col++] = nstat_value(&p);
+			}
+		} else {
+			p += len;
+			if (col >= src->ncols)
+				return -1;
+			cur[col++] = nstat_value(&p);
+		}
+		p = eol + 1;
+	}
 
-	n = kern_db;
-	kern_db = NULL;
+	return lay == lay_end && col == src->ncols ? 0 : -1;
+}
 
-	load_netstat();
-	load_snmp6();
-	load_snmp();
-	load_sctp_snmp();
+static void nstat_add_col(struct nstat_col **cols, unsigned int *ncols,
+			  const char *prefix, int plen, const char *name,
+			  int nlen)
+{
+	struct nstat_col *col;
 
-	h = kern_db;
-	kern_db = n;
+	if (*ncols == 0 || (*ncols >= 256 && !(*ncols & (*ncols - 1)))) {
+		col = realloc(*cols, (*ncols ? 2 * *ncols : 256) *
+			      sizeof(*col));
+		if (!col)
+			abort();
+		*cols = col;
+	}
+	col = &(*cols)[(*ncols)++];
+	if (asprintf(&col->id, "%.*s%.*s", plen, prefix, nlen, name) < 0)
+		abort();
+	col->val = 0;
+	col->rate = 0;
+}
 
-	for (n = kern_db; n; n = n->next) {
-		struct nstat_ent *h1;
-
-		for (h1 = h; h1; h1 = h1->next) {
-			if (strcmp(h1->id, n->id) == 0) {
-				double sample;
-				unsigned long long incr = h1->val - n->val;
-
-				n->val = h1->val;
-				sample = (double)incr * 1000.0 / interval;
-				if (interval >= scan_interval) {
-					n->rate += W*(sample-n->rate);
-				} else if (interval >= 1000) {
-					if (interval >= time_constant) {
-						n->rate = sample;
-					} else {
-						double w = W*(double)interval/scan_interval;
-
-						n->rate += w*(sample-n->rate);
-					}
-				}
-
-				while (h != h1) {
-					struct nstat_ent *tmp = h;
-
-					h = h->next;
-					free(tmp->id);
-					free(tmp);
-				};
-				h = h1->next;
-				free(h1->id);
-				free(h1);
+/* Parse the names of a file, appending its columns to cols */
+static void nstat_src_layout(struct nstat_src *src, struct nstat_col **cols,
+			     unsigned int *ncols)
+{
+	const char *p = src->buf;
+	char *lay;
+
+	free(src->layout);
+	src->layout = lay = malloc(strlen(p) + 1);
+	if (!lay)
+		abort();
+	src->first = *ncols;
+
+	while (*p) {
+		const char *eol = strchr(p, '\n');
+
+		if (!eol)
+			break;
+		if (src->ugly) {
+			const char *colon = strchr(p, ':'), *f;
+
+			if (!colon || colon > eol)
 				break;
+			memcpy(lay, p, eol + 1 - p);
+			lay += eol + 1 - p;
+			for (f = colon + 1; f < eol; ) {
+				int len;
+
+				f += strspn(f, " ");
+				len = strcspn(f, " \n");
+				if (len)
+					nstat_add_col(cols, ncols, p, colon - p,
+						      f, len);
+				f += len;
 			}
+			/* the values */
+			eol = strchr(eol + 1, '\n');
+			if (!eol)
+				break;
+		} else {
+			int len = strcspn(p, " \t\n");
+
+			memcpy(lay, p, len);
+			lay += len;
+			*lay++ = '\n';
+			nstat_add_col(cols, ncols, NULL, 0, p, len);
 		}
+		p = eol + 1;
 	}
+
+	src->layout_len = lay - src->layout;
+	src->ncols = *ncols - src->first;
 }
 
-#define T_DIFF(a, b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
+/* Columns again, keeping the history of the counters still there */
+static void nstat_tab_build(void)
+{
+	struct nstat_col *cols = NULL;
+	unsigned int ncols = 0, i, j;
+	int k;
+
+	for (k = 0; k < ARRAY_SIZE(nstat_srcs); k++)
+		nstat_src_layout(&nstat_srcs[k], &cols, &ncols);
 
+	free(nstat_cur);
+	nstat_cur = calloc(ncols ? : 1, sizeof(*nstat_cur));
+	if (!nstat_cur)
+		abort();
+	for (k = 0; k < ARRAY_SIZE(nstat_srcs); k++) {
+		const struct nstat_src *src = &nstat_srcs[k];
 
-static int server_loop(int fd)
+		nstat_src_values(src, nstat_cur + src->first);
+	}
+
+	for (i = 0, j = 0; i < ncols; i++) {
+		unsigned int n;
+
+		cols[i].val = nstat_cur[i];
+		/* mostly in the same order as before */
+		for (n = 0; n < nstat_ncols; n++, j = (j + 1) % nstat_ncols) {
+			if (strcmp(nstat_tab[j].id, cols[i].id) == 0) {
+				cols[i].val = nstat_tab[j].val;
+				cols[i].rate = nstat_tab[j].rate;
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < nstat_ncols; i++)
+		free(nstat_tab[i].id);
+	free(nstat_tab);
+	nstat_tab = cols;
+	nstat_ncols = ncols;
+}
+
+static void update_db(int interval)
 {
-	struct timeval snaptime = { 0 };
-	struct pollfd p;
+	bool changed = false;
+	unsigned int i;
+	int k;
 
-	p.fd = fd;
-	p.events = p.revents = POLLIN;
+	for (k = 0; k < ARRAY_SIZE(nstat_srcs); k++) {
+		struct nstat_src *src = &nstat_srcs[k];
 
-	sprintf(info_source, "%d.%lu sampling_interval=%d time_const=%d",
-		getpid(), (unsigned long)random(), scan_interval/1000, time_constant/1000);
+		nstat_src_read(src);
+		if (!changed &&
+		    nstat_src_values(src, nstat_cur + src->first) < 0)
+			changed = true;
+	}
+	if (changed)
+		nstat_tab_build();
 
-	load_netstat();
-	load_snmp6();
-	load_snmp();
-	load_sctp_snmp();
+	for (i = 0; i < nstat_ncols; i++) {
+		struct nstat_col *col = &nstat_tab[i];
+		unsigned long long incr = nstat_cur[i] - col->val;
 
-	for (;;) {
-		int status;
-		time_t tdiff;
-		struct timeval now;
+		col->val = nstat_cur[i];
+		if (interval)
+			statsd_rate_update(&ewma, &col->rate, incr, interval);
+	}
+}
+
+/* The daemon's table as the loaders would have put it on kern_db */
+static void nstat_tab_to_db(void)
+{
+	struct nstat_ent *n;
+	unsigned int i = nstat_ncols;
+
+	while (i--) {
+		const struct nstat_col *col = &nstat_tab[i];
 
-		gettimeofday(&now, NULL);
-		tdiff = T_DIFF(now, snaptime);
-		if (tdiff >= scan_interval) {
-			update_db(tdiff);
-			snaptime = now;
-			tdiff = 0;
+		if (useless_number(col->id))
+			continue;
+		if ((n = arena_alloc(&kern_arena, sizeof(*n))) == NULL)
+			abort();
+		n->id = col->id;
+		n->val = col->val;
+		n->rate = col->rate;
+		n->next = kern_db;
+		kern_db = n;
+	}
+}
+
+/* but for these, what useless_numbers leaves are counters */
+static int gauge_number(const char *id)
+{
+	return strcmp(id, "SctpCurrEstab") == 0;
+}
+
+/*
+ * What the exporter keeps of each namespace between two samples. The
+ * one sampled is swapped into the globals of the daemon's table, which
+ * the same code as for nstat's own namespace then works on.
+ */
+struct nstat_netns {
+	const char		*name;
+	struct nstat_src	srcs[ARRAY_SIZE(nstat_srcs)];
+	struct nstat_col	*tab;
+	unsigned long long	*cur;
+	unsigned int		ncols;
+};
+
+static struct nstat_netns *netns_tabs;
+
+static void netns_swap(struct nstat_netns *ns)
+{
+	struct nstat_src srcs[ARRAY_SIZE(nstat_srcs)];
+	struct nstat_col *tab = nstat_tab;
+	unsigned long long *cur = nstat_cur;
+	unsigned int ncols = nstat_ncols;
+
+	memcpy(srcs, nstat_srcs, sizeof(srcs));
+	memcpy(nstat_srcs, ns->srcs, sizeof(srcs));
+	memcpy(ns->srcs, srcs, sizeof(srcs));
+	nstat_tab = ns->tab;
+	nstat_cur = ns->cur;
+	nstat_ncols = ns->ncols;
+	ns->tab = tab;
+	ns->cur = cur;
+	ns->ncols = ncols;
+}
+
+static void netns_tabs_init(void)
+{
+	unsigned int i;
+
+	netns_tabs = calloc(netns_count ? : 1, sizeof(*netns_tabs));
+	if (!netns_tabs)
+		abort();
+	for (i = 0; i < netns_count; i++) {
+		netns_tabs[i].name = netns_list[i];
+		memcpy(netns_tabs[i].srcs, nstat_srcs, sizeof(nstat_srcs));
+	}
+}
+
+/* the column of id in the table of ns, most likely where hint is */
+static const struct nstat_col *netns_col(const struct nstat_netns *ns,
+					 const char *id, unsigned int hint)
+{
+	unsigned int i;
+
+	if (hint < ns->ncols && strcmp(ns->tab[hint].id, id) == 0)
+		return &ns->tab[hint];
+	for (i = 0; i < ns->ncols; i++)
+		if (strcmp(ns->tab[i].id, id) == 0)
+			return &ns->tab[i];
+	return NULL;
+}
+
+/*
+ * Samples of a family go together, so with namespaces the counters are
+ * those of the first one, each followed by its value in all of them.
+ */
+static void nstat_export(FILE *fp, int interval)
+{
+	const char *labels[] = { "netns", NULL, NULL };
+	const struct nstat_col *tab;
+	unsigned int i, k, ncols;
+	char name[128];
+
+	if (netns_list) {
+		for (k = 0; k < netns_count; k++) {
+			netns_swap(&netns_tabs[k]);
+			netns = netns_tabs[k].name;
+			update_db(interval);
+			netns = NULL;
+			netns_swap(&netns_tabs[k]);
 		}
-		if (poll(&p, 1, scan_interval - tdiff) > 0
-		    && (p.revents&POLLIN)) {
-			int clnt = accept(fd, NULL, NULL);
-
-			if (clnt >= 0) {
-				pid_t pid;
-
-				if (children >= 5) {
-					close(clnt);
-				} else if ((pid = fork()) != 0) {
-					if (pid > 0)
-						children++;
-					close(clnt);
-				} else {
-					FILE *fp = fdopen(clnt, "w");
-
-					if (fp)
-						dump_kern_db(fp, 0);
-					iprt_exit(0);
-				}
-			}
+		tab = netns_count ? netns_tabs[0].tab : NULL;
+		ncols = netns_count ? netns_tabs[0].ncols : 0;
+	} else {
+		update_db(interval);
+		tab = nstat_tab;
+		ncols = nstat_ncols;
+	}
+
+	for (i = 0; i < ncols; i++) {
+		const struct nstat_col *col = &tab[i];
+		int gauge = gauge_number(col->id);
+		const char *suffix = gauge ? "" : "_total";
+
+		if (useless_number(col->id) || !match(col->id))
+			continue;
+		exporter_name(name, sizeof(name), "nstat_", col->id);
+		exporter_type(fp, name, gauge ? "gauge" : "counter");
+		if (!netns_list) {
+			exporter_sample(fp, name, suffix, NULL, NULL, col->val);
+			continue;
+		}
+		for (k = 0; k < netns_count; k++) {
+			const struct nstat_col *c;
+
+			c = netns_col(&netns_tabs[k], col->id, i);
+			if (!c)
+				continue;
+			labels[1] = netns_tabs[k].name;
+			exporter_sample_labels(fp, name, suffix, labels,
+					       c->val);
 		}
-		while (children && waitpid(-1, &status, WNOHANG) > 0)
-			children--;
 	}
-	return 0;
 }
 
-static int verify_forging(int fd)
+static int nstat_sample(int interval)
 {
-	struct ucred cred;
-	socklen_t olen = sizeof(cred);
+	update_db(interval);
+	return 0;
+}
 
-	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, (void *)&cred, &olen) ||
-	    olen < sizeof(cred))
-		return -1;
-	if (cred.uid == getuid() || cred.uid == 0)
-		return 0;
-	return -1;
+static void nstat_dump(FILE *fp)
+{
+	nstat_tab_to_db();
+	dump_kern_db(fp);
+	/* the names are those of nstat_tab */
+	arena_free(&kern_arena);
+	kern_db = NULL;
 }
 
+static struct statsd_collector nstat_collector = {
+	.name		= "nstat",
+	.source		= info_source,
+	.source_len	= sizeof(info_source),
+	.sample		= nstat_sample,
+	.dump		= nstat_dump,
+};
+
 static int usage(void)
 {
 	fprintf(stderr,
@@ -527,8 +1071,11 @@ static int usage(void)
 "   -h, --help           this message\n"
 "   -a, --ignore         ignore history\n"
 "   -d, --scan=SECS      sample every statistics every SECS\n"
+"   -E, --exporter=ADDR  serve the counters over HTTP on [HOST:]PORT\n"
 "   -j, --json           format output in JSON\n"
 "   -n, --nooutput       do history only\n"
+"   -N, --netns=NAME     read the namespace NAME, can be repeated\n"
+"   -A, --all-netns      read all the named namespaces\n"
 "   -p, --pretty         pretty print\n"
 "   -r, --reset          reset history\n"
 "   -s, --noupdate       don't update history\n"
@@ -542,7 +1089,10 @@ static const struct option longopts[] = {
 	{ "help", 0, 0, 'h' },
 	{ "ignore",  0,  0, 'a' },
 	{ "scan", 1, 0, 'd'},
+	{ "exporter", 1, 0, 'E' },
 	{ "nooutput", 0, 0, 'n' },
+	{ "netns", 1, 0, 'N' },
+	{ "all-netns", 0, 0, 'A' },
 	{ "json", 0, 0, 'j' },
 	{ "reset", 0, 0, 'r' },
 	{ "noupdate", 0, 0, 's' },
@@ -553,15 +1103,121 @@ static const struct option longopts[] = {
 	{ 0 }
 };
 
+/* The counters of netns, or of nstat's namespace, against their history */
+static void nstat_show(const char *hist_name)
+{
+	int hist_fd = -1;
+	int fd;
+
+	if (reset_history)
+		unlink(hist_name);
+
+	if (!ignore_history || !no_update) {
+		struct stat stb;
+
+		hist_fd = open(hist_name, O_RDWR|O_CREAT|O_NOFOLLOW, 0600);
+		if (hist_fd < 0) {
+			perror("nstat: open history file");
+			iprt_exit(-1);
+		}
+		if (flock(hist_fd, LOCK_EX)) {
+			perror("nstat: flock history file");
+			iprt_exit(-1);
+		}
+		if (fstat(hist_fd, &stb) != 0) {
+			perror("nstat: fstat history file");
+			iprt_exit(-1);
+		}
+		if (stb.st_nlink != 1 || stb.st_uid != getuid()) {
+			fprintf(stderr, "nstat: something is so wrong with history file, that I prefer not to proceed.\n");
+			iprt_exit(-1);
+		}
+		if (!ignore_history) {
+			FILE *tfp;
+			long uptime = -1;
+
+			if ((tfp = fopen("/proc/uptime", "r")) != NULL) {
+				if (fscanf(tfp, "%ld", &uptime) != 1)
+					uptime = -1;
+				fclose(tfp);
+			}
+			if (uptime >= 0 && time(NULL) >= stb.st_mtime+uptime) {
+				fprintf(stderr, "nstat: history is aged out, resetting\n");
+				if (ftruncate(hist_fd, 0) < 0)
+					perror("nstat: ftruncate");
+				stb.st_size = 0;
+			}
+		}
+
+		load_hist(hist_fd, &stb);
+	}
+
+	if (!netns && (fd = statsd_connect("nstat")) >= 0) {
+		FILE *sfp = fdopen(fd, "r");
+
+		if (!sfp) {
+			fprintf(stderr, "nstat: fdopen failed: %s\n",
+				strerror(errno));
+			close(fd);
+		} else {
+			load_good_table(sfp);
+			if (hist_count && source_mismatch) {
+				fprintf(stderr, "nstat: history is stale, ignoring it.\n");
+				hist_count = 0;
+			}
+			fclose(sfp);
+		}
+	} else {
+		if (hist_count && info_source[0] && strcmp(info_source, "kernel")) {
+			fprintf(stderr, "nstat: history is stale, ignoring it.\n");
+			hist_count = 0;
+			info_source[0] = 0;
+		}
+		load_netstat();
+		load_snmp6();
+		load_snmp();
+		load_sctp_snmp();
+		if (info_source[0] == 0)
+			strcpy(info_source, "kernel");
+	}
+
+	if (!no_output) {
+		if (ignore_history || !hist_count)
+			dump_kern_db(stdout);
+		else
+			dump_incr_db(stdout);
+	}
+	if (!no_update) {
+		save_hist(hist_fd);
+		close(hist_fd);
+	}
+}
+
+/* for the next namespace, as if nstat had just started */
+static void nstat_reset(void)
+{
+	if (hist)
+		munmap(hist, hist_len);
+	else
+		free(hist_ent);
+	hist = NULL;
+	hist_ent = NULL;
+	hist_count = 0;
+	arena_free(&kern_arena);
+	kern_db = NULL;
+	info_source[0] = 0;
+	source_mismatch = 0;
+}
+
 int main(int argc, char *argv[])
 {
+	const char *exporter = NULL;
+	bool all_netns = false;
 	char *hist_name;
-	struct sockaddr_un sun;
-	FILE *hist_fp = NULL;
+	unsigned int i;
 	int ch;
-	int fd;
 
-	while ((ch = getopt_long(argc, argv, "h?vVzrnasd:t:jp",
+	while ((ch = getopt_long(argc, argv, "h?vVzrnN:Aasd:E:t:jp",
 				 longopts, NULL)) != EOF) {
 		switch (ch) {
 		case 'z':
@@ -579,9 +1235,22 @@ int main(int argc, char *argv[])
 		case 'n':
 			no_output = 1;
 			break;
+		case 'N':
+			netns_list = realloc(netns_list, (netns_count + 1) *
+					     sizeof(*netns_list));
+			if (!netns_list)
+				abort();
+			netns_list[netns_count++] = optarg;
+			break;
+		case 'A':
+			all_netns = true;
+			break;
 		case 'd':
 			scan_interval = 1000*atoi(optarg);
 			break;
+		case 'E':
+			exporter = optarg;
+			break;
 		case 't':
 			if (sscanf(optarg, "%d", &time_constant) != 1 ||
 			    time_constant <= 0) {
@@ -609,35 +1278,38 @@ int main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	sun.sun_family = AF_UNIX;
-	sun.sun_path[0] = 0;
-	sprintf(sun.sun_path+1, "nstat%d", getuid());
+	if (all_netns) {
+		free(netns_list);
+		netns_count = 0;
+		netns_list = netns_names(&netns_count);
+		if (!netns_list && !(netns_list = calloc(1, sizeof(*netns_list))))
+			abort();
+	}
+	if (netns_list) {
+		/* its socket has room for the table of one namespace */
+		if (scan_interval > 0 && !exporter) {
+			fprintf(stderr, "nstat: -d reads the namespace of nstat only, -E reads others\n");
+			iprt_exit(-1);
+		}
+		netns_tabs_init();
+	}
+
+	if (exporter && scan_interval <= 0)
+		scan_interval = EXPORTER_INTERVAL * 1000;
 
 	if (scan_interval > 0) {
 		if (time_constant == 0)
 			time_constant = 60;
 		time_constant *= 1000;
-		W = 1 - 1/exp(log(10)*(double)scan_interval/time_constant);
-		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-			perror("nstat: socket");
-			iprt_exit(-1);
-		}
-		if (bind(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) < 0) {
-			perror("nstat: bind");
-			iprt_exit(-1);
-		}
-		if (listen(fd, 5) < 0) {
-			perror("nstat: listen");
+		statsd_rate_init(&ewma, scan_interval, time_constant);
+		if (exporter) {
+			patterns = argv;
+			npatterns = argc;
+			exporter_run(exporter, scan_interval, nstat_export);
 			iprt_exit(-1);
 		}
-		if (daemon(0, 0)) {
-			perror("nstat: daemon");
-			iprt_exit(-1);
-		}
-		signal(SIGPIPE, SIG_IGN);
-		signal(SIGCHLD, sigchild);
-		server_loop(fd);
-		iprt_exit(0);
+		statsd_run(&nstat_collector, 1, scan_interval, time_constant);
+		iprt_exit(-1);
 	}
 
 	patterns = argv;
@@ -648,104 +1320,29 @@ int main(int argc, char *argv[])
 		sprintf(hist_name, "/tmp/.nstat.u%d", getuid());
 	}
 
-	if (reset_history)
-		unlink(hist_name);
-
-	if (!ignore_history || !no_update) {
-		struct stat stb;
-
-		fd = open(hist_name, O_RDWR|O_CREAT|O_NOFOLLOW, 0600);
-		if (fd < 0) {
-			perror("nstat: open history file");
-			iprt_exit(-1);
-		}
-		if ((hist_fp = fdopen(fd, "r+")) == NULL) {
-			perror("nstat: fdopen history file");
-			iprt_exit(-1);
-		}
-		if (flock(fileno(hist_fp), LOCK_EX)) {
-			perror("nstat: flock history file");
-			iprt_exit(-1);
-		}
-		if (fstat(fileno(hist_fp), &stb) != 0) {
-			perror("nstat: fstat history file");
-			iprt_exit(-1);
-		}
-		if (stb.st_nlink != 1 || stb.st_uid != getuid()) {
-			fprintf(stderr, "nstat: something is so wrong with history file, that I prefer not to proceed.\n");
-			iprt_exit(-1);
-		}
-		if (!ignore_history) {
-			FILE *tfp;
-			long uptime = -1;
-
-			if ((tfp = fopen("/proc/uptime", "r")) != NULL) {
-				if (fscanf(tfp, "%ld", &uptime) != 1)
-					uptime = -1;
-				fclose(tfp);
-			}
-			if (uptime >= 0 && time(NULL) >= stb.st_mtime+uptime) {
-				fprintf(stderr, "nstat: history is aged out, resetting\n");
-				if (ftruncate(fileno(hist_fp), 0) < 0)
-					perror("nstat: ftruncate");
-			}
-		}
-
-		load_good_table(hist_fp);
-
-		hist_db = kern_db;
-		kern_db = NULL;
+	if (!netns_list) {
+		nstat_show(hist_name);
+		iprt_exit(0);
 	}
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
-	    (connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0
-	     || (strcpy(sun.sun_path+1, "nstat0"),
-		 connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
-	    && verify_forging(fd) == 0) {
-		FILE *sfp = fdopen(fd, "r");
-
-		if (!sfp) {
-			fprintf(stderr, "nstat: fdopen failed: %s\n",
-				strerror(errno));
-			close(fd);
-		} else {
-			load_good_table(sfp);
-			if (hist_db && source_mismatch) {
-				fprintf(stderr, "nstat: history is stale, ignoring it.\n");
-				hist_db = NULL;
-			}
-			fclose(sfp);
-		}
-	} else {
-		if (fd >= 0)
-			close(fd);
-		if (hist_db && info_source[0] && strcmp(info_source, "kernel")) {
-			fprintf(stderr, "nstat: history is stale, ignoring it.\n");
-			hist_db = NULL;
-			info_source[0] = 0;
-		}
-		load_netstat();
-		load_snmp6();
-		load_snmp();
-		load_sctp_snmp();
-		if (info_source[0] == 0)
-			strcpy(info_source, "kernel");
+	if (json_output) {
+		netns_jw = jsonw_new(stdout);
+		jsonw_start_object(netns_jw);
+		jsonw_pretty(netns_jw, pretty);
 	}
-
-	if (!no_output) {
-		if (ignore_history || hist_db == NULL)
-			dump_kern_db(stdout, 0);
-		else
-			dump_incr_db(stdout);
+	for (i = 0; i < netns_count; i++) {
+		char ns_hist[PATH_MAX];
+
+		netns = netns_list[i];
+		snprintf(ns_hist, sizeof(ns_hist), "%s.%s", hist_name, netns);
+		if (!no_output && !json_output)
+			printf("\nnetns: %s\n", netns);
+		nstat_show(ns_hist);
+		nstat_reset();
 	}
-	if (!no_update) {
-		if (ftruncate(fileno(hist_fp), 0) < 0)
-			perror("nstat: ftruncate");
-		rewind(hist_fp);
-
-		json_output = 0;
-		dump_kern_db(hist_fp, 1);
-		fclose(hist_fp);
+	if (netns_jw) {
+		jsonw_end_object(netns_jw);
+		jsonw_destroy(&netns_jw);
 	}
 	iprt_exit(0);
 }
@@ -21,15 +21,12 @@
 #include <fnmatch.h>
 #include <sys/file.h>
 #include <sys/socket.h>
-#include <sys/un.h>
-#include <sys/poll.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
-#include <signal.h>
 #include <math.h>
 
 #include "iprt.h"
+#include "utils.h"
 #include "rt_names.h"
 
 #include <SNAPSHOT.h>
@@ -42,7 +39,7 @@ int scan_interval;
 int time_constant;
 int dump_zeros;
 unsigned long magic_number;
-double W;
+static struct statsd_rate ewma;
 
 static int generic_proc_open(const char *env, const char *name)
 {
@@ -284,12 +281,6 @@ static void dump_incr_db(FILE *fp)
 }
 
 
-static int children;
-
-static void sigchild(int signo)
-{
-}
-
 /* Server side only: read kernel data, update tables, calculate rates. */
 
 static void update_db(int interval)
@@ -301,7 +292,6 @@ static void update_db(int interval)
 	ival = read_kern_table(_ival);
 
 	for (i = 0; i < 256*4; i++) {
-		double sample;
 		__u32 incr = ival[i] - kern_db->ival[i];
 
 		if (ival[i] == 0 && incr == 0 &&
@@ -310,42 +300,10 @@ static void update_db(int interval)
 
 		kern_db->val[i] += incr;
 		kern_db->ival[i] = ival[i];
-		sample = (double)(incr*1000)/interval;
-		if (interval >= scan_interval) {
-			kern_db->rate[i] += W*(sample-kern_db->rate[i]);
-		} else if (interval >= 1000) {
-			if (interval >= time_constant) {
-				kern_db->rate[i] = sample;
-			} else {
-				double w = W*(double)interval/scan_interval;
-
-				kern_db->rate[i] += w*(sample-kern_db->rate[i]);
-			}
-		}
-	}
-}
-
-static void send_db(int fd)
-{
-	int tot = 0;
-
-	while (tot < sizeof(*kern_db)) {
-		int n = write(fd, ((char *)kern_db) + tot, sizeof(*kern_db)-tot);
-
-		if (n < 0) {
-			if (errno == EINTR)
-				continue;
-			return;
-		}
-		tot += n;
+		statsd_rate_update(&ewma, &kern_db->rate[i], incr, interval);
 	}
 }
 
-
-
-#define T_DIFF(a, b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
-
-
 static void pad_kern_table(struct rtacct_data *dat, __u32 *ival)
 {
 	int i;
@@ -357,73 +315,28 @@ static void pad_kern_table(struct rtacct_data *dat, __u32 *ival)
 		dat->val[i] = ival[i];
 }
 
-static int server_loop(int fd)
+static int rtacct_sample(int interval)
 {
-	struct timeval snaptime = { 0 };
-	struct pollfd p;
-
-	p.fd = fd;
-	p.events = p.revents = POLLIN;
-
-	sprintf(kern_db->signature,
-		"%u.%lu sampling_interval=%d time_const=%d",
-		(unsigned int) getpid(), (unsigned long)random(),
-		scan_interval/1000, time_constant/1000);
-
-	pad_kern_table(kern_db, read_kern_table(kern_db->ival));
-
-	for (;;) {
-		int status;
-		int tdiff;
-		struct timeval now;
-
-		gettimeofday(&now, NULL);
-		tdiff = T_DIFF(now, snaptime);
-		if (tdiff >= scan_interval) {
-			update_db(tdiff);
-			snaptime = now;
-			tdiff = 0;
-		}
-		if (poll(&p, 1, tdiff + scan_interval) > 0
-		    && (p.revents&POLLIN)) {
-			int clnt = accept(fd, NULL, NULL);
-
-			if (clnt >= 0) {
-				pid_t pid;
-
-				if (children >= 5) {
-					close(clnt);
-				} else if ((pid = fork()) != 0) {
-					if (pid > 0)
-						children++;
-					close(clnt);
-				} else {
-					if (tdiff > 0)
-						update_db(tdiff);
-					send_db(clnt);
-					iprt_exit(0);
-				}
-			}
-		}
-		while (children && waitpid(-1, &status, WNOHANG) > 0)
-			children--;
-	}
+	if (interval)
+		update_db(interval);
+	else
+		pad_kern_table(kern_db, read_kern_table(kern_db->ival));
 	return 0;
 }
 
-static int verify_forging(int fd)
+static void rtacct_dump(FILE *fp)
 {
-	struct ucred cred;
-	socklen_t olen = sizeof(cred);
-
-	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, (void *)&cred, &olen) ||
-	    olen < sizeof(cred))
-		return -1;
-	if (cred.uid == getuid() || cred.uid == 0)
-		return 0;
-	return -1;
+	fwrite(kern_db, sizeof(*kern_db), 1, fp);
 }
 
+static struct statsd_collector rtacct_collector = {
+	.name		= "rtacct",
+	.source		= kern_db_static.signature,
+	.source_len	= sizeof(kern_db_static.signature),
+	.sample		= rtacct_sample,
+	.dump		= rtacct_dump,
+};
+
 static int usage(void)
 {
 	fprintf(stderr,
@@ -435,7 +348,6 @@ static int usage(void)
 int main(int argc, char *argv[])
 {
 	char hist_name[128];
-	struct sockaddr_un sun;
 	int ch;
 	int fd;
 	int ret;
@@ -504,35 +416,13 @@ int main(int argc, char *argv[])
 		dump_zeros = 0;
 	}
 
-	sun.sun_family = AF_UNIX;
-	sun.sun_path[0] = 0;
-	sprintf(sun.sun_path+1, "rtacct%d", getuid());
-
 	if (scan_interval > 0) {
 		if (time_constant == 0)
 			time_constant = 60;
 		time_constant *= 1000;
-		W = 1 - 1/exp(log(10)*(double)scan_interval/time_constant);
-		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-			perror("rtacct: socket");
-			iprt_exit(-1);
-		}
-		if (bind(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) < 0) {
-			perror("rtacct: bind");
-			iprt_exit(-1);
-		}
-		if (listen(fd, 5) < 0) {
-			perror("rtacct: listen");
-			iprt_exit(-1);
-		}
-		if (daemon(0, 0)) {
-			perror("rtacct: daemon");
-			iprt_exit(-1);
-		}
-		signal(SIGPIPE, SIG_IGN);
-		signal(SIGCHLD, sigchild);
-		server_loop(fd);
-		iprt_exit(0);
+		statsd_rate_init(&ewma, scan_interval, time_constant);
+		statsd_run(&rtacct_collector, 1, scan_interval, time_constant);
+		iprt_exit(-1);
 	}
 
 	if (getenv("RTACCT_HISTORY"))
@@ -598,11 +488,7 @@ int main(int argc, char *argv[])
 		close(fd);
 	}
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
-	    (connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0
-	     || (strcpy(sun.sun_path+1, "rtacct0"),
-		 connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
-	    && verify_forging(fd) == 0) {
+	if ((fd = statsd_connect("rtacct")) >= 0) {
 		ret = nread(fd, (char *)kern_db, sizeof(*kern_db));
 		if (ret) {
 			close(fd);
@@ -615,9 +501,6 @@ int main(int argc, char *argv[])
 		}
 		close(fd);
 	} else {
-		if (fd >= 0)
-			close(fd);
-
 		if (hist_db && hist_db->signature[0] &&
 		    strcmp(hist_db->signature, "kernel")) {
 			fprintf(stderr, "rtacct: history is stale, ignoring it.\n");
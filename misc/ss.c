@@ -13,9 +13,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <errno.h>
@@ -27,13 +31,18 @@
 #include <stdbool.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <ctype.h>
 
 #include "utils.h"
+#include "json_print.h"
+#include "arena.h"
 #include "rt_names.h"
 #include "ll_map.h"
 #include "libnetlink.h"
 #include "namespace.h"
+#include "jobs.h"
 #include "SNAPSHOT.h"
+#include "ss_sample.h"
 
 #include <linux/tcp.h>
 #include <linux/sock_diag.h>
@@ -96,9 +105,10 @@ static int security_get_initial_context(char *name,  char **context)
 #endif
 
 int resolve_services = 1;
-int preferred_family = AF_UNSPEC;
+__thread int preferred_family = AF_UNSPEC;
+__thread int json;
 int show_options;
-int show_details;
+__thread int show_details;
 int show_users;
 int show_mem;
 int show_tcpinfo;
@@ -111,6 +121,7 @@ int sctp_ino;
 int show_tipcinfo;
 
 enum col_id {
+	COL_NETNS,
 	COL_NETID,
 	COL_STATE,
 	COL_RECVQ,
@@ -136,18 +147,20 @@ struct column {
 	int disabled;
 	int width;	/* Calculated, including additional layout spacing */
 	int max_len;	/* Measured maximum field length in this column */
+	const char *key;	/* of its value with -j */
 };
 
 static struct column columns[] = {
-	{ ALIGN_LEFT,	"Netid",		"",	0, 0, 0 },
-	{ ALIGN_LEFT,	"State",		" ",	0, 0, 0 },
-	{ ALIGN_LEFT,	"Recv-Q",		" ",	0, 0, 0 },
-	{ ALIGN_LEFT,	"Send-Q",		" ",	0, 0, 0 },
-	{ ALIGN_RIGHT,	"Local Address:",	" ",	0, 0, 0 },
-	{ ALIGN_LEFT,	"Port",			"",	0, 0, 0 },
-	{ ALIGN_RIGHT,	"Peer Address:",	" ",	0, 0, 0 },
-	{ ALIGN_LEFT,	"Port",			"",	0, 0, 0 },
-	{ ALIGN_LEFT,	"",			"",	0, 0, 0 },
+	{ ALIGN_LEFT,	"Netns",		"",	1, 0, 0, "netns" },
+	{ ALIGN_LEFT,	"Netid",		" ",	0, 0, 0, "netid" },
+	{ ALIGN_LEFT,	"State",		" ",	0, 0, 0, "state" },
+	{ ALIGN_LEFT,	"Recv-Q",		" ",	0, 0, 0, "recv_q" },
+	{ ALIGN_LEFT,	"Send-Q",		" ",	0, 0, 0, "send_q" },
+	{ ALIGN_RIGHT,	"Local Address:",	" ",	0, 0, 0, "src" },
+	{ ALIGN_LEFT,	"Port",			"",	0, 0, 0, "sport" },
+	{ ALIGN_RIGHT,	"Peer Address:",	" ",	0, 0, 0, "dst" },
+	{ ALIGN_LEFT,	"Port",			"",	0, 0, 0, "dport" },
+	{ ALIGN_LEFT,	"",			"",	0, 0, 0, NULL },
 };
 
 static struct column *current_field = columns;
@@ -174,8 +187,40 @@ static struct {
 	struct buf_token *cur;	/* Position of current token in chunk */
 	struct buf_chunk *head;	/* First chunk */
 	struct buf_chunk *tail;	/* Current chunk */
+	unsigned int lines;	/* Complete lines held */
 } buffer;
 
+/* With --stream, output is rendered every stream_lines lines, in columns
+ * as wide as the first stream_lines needed.
+ */
+#define STREAM_LINES_DEFAULT	1024
+static unsigned int stream_lines;
+static int widths_fixed;
+
+/* A dump child sends its lines to the parent through ship_fd, in frames
+ * of up to SHIP_LINES lines, see show_all().
+ */
+#define SHIP_LINES		256
+static int ship_fd = -1;
+static int show_unordered;
+static int show_sequential;
+
+/* --all-netns: children dumping at once, the namespace of the lines */
+static unsigned int netns_jobs;
+static const char *ss_netns;
+/* the namespace whose /proc/net files generic_proc_open() opens */
+static const char *proc_netns;
+
+/* --watch: seconds between dumps */
+static unsigned int watch_interval;
+
+/* --sample: seconds between dumps, how many (0 for no end), the format */
+static struct {
+	double		interval;
+	unsigned int	count;
+	bool		binary;
+} sample;
+
 static const char *TCP_PROTO = "tcp";
 static const char *SCTP_PROTO = "sctp";
 static const char *UDP_PROTO = "udp";
@@ -455,6 +500,12 @@ static FILE *generic_proc_open(const char *env, const char *name)
 	const char *p = getenv(env);
 	char store[128];
 
+	if (proc_netns) {
+		int fd = netns_open_proc(proc_netns, name, O_RDONLY);
+
+		return fd < 0 ? NULL : fdopen(fd, "r");
+	}
+
 	if (!p) {
 		p = getenv("PROC_ROOT") ? : "/proc";
 		snprintf(store, sizeof(store)-1, "%s/%s", p, name);
@@ -492,70 +543,353 @@ struct user_ent {
 	char		*socket_ctx;
 };
 
-#define USER_ENT_HASH_SIZE	256
-struct user_ent *user_ent_hash[USER_ENT_HASH_SIZE];
+/* Sized by the number of sockets found, but never below this */
+#define USER_ENT_HASH_MIN	256
+static __thread struct user_ent **user_ent_hash;
+static __thread unsigned int user_ent_hash_size;
+static __thread struct arena user_ent_arena;	/* the entries, their strings */
+static __thread struct user_ent *user_ent_list;	/* before the hash */
+static __thread unsigned int user_ent_count;
 
-static int user_ent_hashfn(unsigned int ino)
+static unsigned int user_ent_hashfn(unsigned int ino)
 {
-	int val = (ino >> 24) ^ (ino >> 16) ^ (ino >> 8) ^ ino;
-
-	return val & (USER_ENT_HASH_SIZE - 1);
+	return (ino * 0x9e3779b1U) & (user_ent_hash_size - 1);
 }
 
-static void user_ent_add(unsigned int ino, char *process,
-					int pid, int fd,
-					char *proc_ctx,
-					char *sock_ctx)
+static void user_ent_add(unsigned int ino, const char *process,
+			 int pid, int fd,
+			 const char *proc_ctx,
+			 const char *sock_ctx)
 {
-	struct user_ent *p, **pp;
+	struct user_ent *p;
 
-	p = malloc(sizeof(struct user_ent));
-	if (!p) {
+	p = arena_alloc(&user_ent_arena, sizeof(struct user_ent));
+	if (p) {
+		p->process = arena_strdup(&user_ent_arena, process);
+		p->process_ctx = arena_strdup(&user_ent_arena, proc_ctx);
+		p->socket_ctx = arena_strdup(&user_ent_arena, sock_ctx);
+	}
+	if (!p || !p->process || !p->process_ctx || !p->socket_ctx) {
 		fprintf(stderr, "ss: failed to malloc buffer\n");
 		abort();
 	}
-	p->next = NULL;
 	p->ino = ino;
 	p->pid = pid;
 	p->fd = fd;
-	p->process = strdup(process);
-	p->process_ctx = strdup(proc_ctx);
-	p->socket_ctx = strdup(sock_ctx);
 
-	pp = &user_ent_hash[user_ent_hashfn(ino)];
-	p->next = *pp;
-	*pp = p;
+	p->next = user_ent_list;
+	user_ent_list = p;
+	user_ent_count++;
+}
+
+/* Hash what the scan found, later entries first in a chain as before */
+static void user_ent_hash_fill(void)
+{
+	struct user_ent *p, *next, *prev = NULL;
+
+	user_ent_hash_size = USER_ENT_HASH_MIN;
+	while (user_ent_hash_size < user_ent_count)
+		user_ent_hash_size *= 2;
+	user_ent_hash = calloc(user_ent_hash_size, sizeof(*user_ent_hash));
+	if (!user_ent_hash) {
+		fprintf(stderr, "ss: failed to malloc buffer\n");
+		abort();
+	}
+
+	for (p = user_ent_list; p; p = next) {
+		next = p->next;
+		p->next = prev;
+		prev = p;
+	}
+	for (p = prev; p; p = next) {
+		struct user_ent **pp = &user_ent_hash[user_ent_hashfn(p->ino)];
+
+		next = p->next;
+		p->next = *pp;
+		*pp = p;
+	}
+	user_ent_list = NULL;
 }
 
 static void user_ent_destroy(void)
 {
-	struct user_ent *p, *p_next;
-	int cnt = 0;
+	arena_free(&user_ent_arena);
+	free(user_ent_hash);
+	user_ent_hash = NULL;
+	user_ent_hash_size = 0;
+}
+
+/* An entry found by a scanning child, as it goes down the pipe */
+struct user_ent_rec {
+	unsigned int	ino;
+	int		pid;
+	int		fd;
+	unsigned short	len[3];		/* of the strings following */
+};
+
+static void user_ent_found(int out, unsigned int ino, const char *process,
+			   int pid, int fd, const char *proc_ctx,
+			   const char *sock_ctx)
+{
+	struct user_ent_rec rec = { ino, pid, fd };
+	const char *str[3] = { process, proc_ctx, sock_ctx };
+	struct iovec iov[4] = { { &rec, sizeof(rec) } };
+	int i;
+
+	if (out < 0) {
+		user_ent_add(ino, process, pid, fd, proc_ctx, sock_ctx);
+		return;
+	}
+
+	for (i = 0; i < 3; i++) {
+		rec.len[i] = strnlen(str[i], USHRT_MAX);
+		iov[i + 1].iov_base = (void *)str[i];
+		iov[i + 1].iov_len = rec.len[i];
+	}
+	/* a pipe takes it all at once when it takes it */
+	if (writev(out, iov, 4) < 0)
+		_iprt_exit(1);
+}
+
+/* Every socket that pid has open, to out or straight into the list */
+static void user_ent_scan_pid(int out, const char *root, int pid)
+{
+	const char *no_ctx = "unavailable";
+	char *pid_context = NULL;
+	char process[16] = "";
+	char name[1024];
+	struct dirent *d1;
+	DIR *dir1;
+	char crap;
+	int dfd;
 
-	while (cnt != USER_ENT_HASH_SIZE) {
-		p = user_ent_hash[cnt];
-		while (p) {
-			free(p->process);
-			free(p->process_ctx);
-			free(p->socket_ctx);
-			p_next = p->next;
-			free(p);
-			p = p_next;
+	snprintf(name, sizeof(name), "%s%d/fd/", root, pid);
+	if ((dir1 = opendir(name)) == NULL)
+		return;
+	dfd = dirfd(dir1);
+
+	while ((d1 = readdir(dir1)) != NULL) {
+		const char *pattern = "socket:[";
+		char *sock_context = NULL;
+		unsigned int ino;
+		char lnk[64];
+		int fd;
+		ssize_t link_len;
+		char tmp[1024];
+
+		if (sscanf(d1->d_name, "%d%c", &fd, &crap) != 1)
+			continue;
+
+		link_len = readlinkat(dfd, d1->d_name, lnk, sizeof(lnk)-1);
+		if (link_len == -1)
+			continue;
+		lnk[link_len] = '\0';
+
+		if (strncmp(lnk, pattern, strlen(pattern)))
+			continue;
+
+		sscanf(lnk, "socket:[%u]", &ino);
+
+		/* contexts are only looked up for who shows them */
+		if (show_sock_ctx) {
+			snprintf(tmp, sizeof(tmp), "%s/%d/fd/%s",
+				 root, pid, d1->d_name);
+			if (getfilecon(tmp, &sock_context) <= 0)
+				sock_context = NULL;
+		}
+		if (!pid_context) {
+			if (!show_proc_ctx ||
+			    getpidcon(pid, &pid_context) != 0 || !pid_context)
+				pid_context = strdup(no_ctx);
+		}
+
+		if (process[0] == '\0') {
+			FILE *fp;
+
+			snprintf(tmp, sizeof(tmp), "%s/%d/stat", root, pid);
+			if ((fp = fopen(tmp, "r")) != NULL) {
+				if (fscanf(fp, "%*d (%15[^)])", process) < 1)
+					; /* ignore */
+				fclose(fp);
+			}
+		}
+		user_ent_found(out, ino, process, pid, fd, pid_context,
+			       sock_context ? : no_ctx);
+		free(sock_context);
+	}
+	free(pid_context);
+	closedir(dir1);
+}
+
+/* Read what a scanning child wrote into the list */
+static void user_ent_parse(const char *buf, size_t len)
+{
+	const char *end = buf + len;
+
+	while (end - buf >= (ssize_t)sizeof(struct user_ent_rec)) {
+		struct user_ent_rec rec;
+		char *str[3];
+		int i;
+
+		memcpy(&rec, buf, sizeof(rec));
+		buf += sizeof(rec);
+		if (end - buf < rec.len[0] + rec.len[1] + rec.len[2])
+			break;
+		for (i = 0; i < 3; i++) {
+			str[i] = strndup(buf, rec.len[i]);
+			if (!str[i]) {
+				fprintf(stderr, "ss: failed to malloc buffer\n");
+				abort();
+			}
+			buf += rec.len[i];
+		}
+		user_ent_add(rec.ino, str[0], rec.pid, rec.fd, str[1], str[2]);
+		for (i = 0; i < 3; i++)
+			free(str[i]);
+	}
+}
+
+/* With fewer processes per child than this, /proc is read in one go */
+#define USER_ENT_JOB_PIDS	512
+#define USER_ENT_JOBS_MAX	16
+
+struct user_ent_job {
+	pid_t	pid;
+	int	fd;
+	char	*out;
+	size_t	len, size;
+};
+
+/*
+ * Scan the pids in as many children as jobs_limit() allows, each taking
+ * a run of them, and add what they found in the order of the runs, so
+ * the result is that of one scan.
+ */
+static void user_ent_scan(const char *root, const int *pids, unsigned int npids)
+{
+	unsigned int njobs, i, first, left;
+	struct user_ent_job *jobs;
+	struct pollfd *pfds;
+
+	njobs = jobs_limit(npids / USER_ENT_JOB_PIDS);
+	if (njobs > USER_ENT_JOBS_MAX)
+		njobs = USER_ENT_JOBS_MAX;
+
+	jobs = njobs > 1 ? calloc(njobs, sizeof(*jobs)) : NULL;
+	pfds = jobs ? calloc(njobs, sizeof(*pfds)) : NULL;
+	if (!pfds) {
+		free(jobs);
+		for (i = 0; i < npids; i++)
+			user_ent_scan_pid(-1, root, pids[i]);
+		return;
+	}
+
+	fflush(NULL);
+	for (i = 0, first = 0; i < njobs; i++) {
+		unsigned int last = (unsigned long)npids * (i + 1) / njobs;
+		int pfd[2];
+
+		jobs[i].fd = -1;
+		if (pipe2(pfd, O_CLOEXEC) < 0 || (jobs[i].pid = fork()) < 0) {
+			/* the parent takes this run itself, after the others */
+			perror("ss: cannot scan /proc in parallel");
+			jobs[i].pid = -1;
+			jobs[i].len = first;
+			jobs[i].size = last;
+			first = last;
+			continue;
+		}
+		if (jobs[i].pid == 0) {
+			while (i--)
+				if (jobs[i].fd >= 0)
+					close(jobs[i].fd);
+			close(pfd[0]);
+			jobs_pin(i);
+			for (; first < last; first++)
+				user_ent_scan_pid(pfd[1], root, pids[first]);
+			_iprt_exit(0);
+		}
+		close(pfd[1]);
+		jobs[i].fd = pfd[0];
+		first = last;
+	}
+
+	for (left = njobs; left; ) {
+		unsigned int n = 0;
+
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].fd < 0)
+				continue;
+			pfds[n].fd = jobs[i].fd;
+			pfds[n++].events = POLLIN;
+		}
+		left = n;
+		if (!n)
+			break;
+		if (poll(pfds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("ss: poll");
+			break;
+		}
+
+		for (i = 0, n = 0; i < njobs; i++) {
+			struct user_ent_job *job = &jobs[i];
+			ssize_t r;
+
+			if (job->fd < 0 || !pfds[n++].revents)
+				continue;
+			if (job->len == job->size) {
+				size_t size = job->size ? 2 * job->size : 65536;
+				char *p = realloc(job->out, size);
+
+				if (!p) {
+					fprintf(stderr, "ss: failed to malloc buffer\n");
+					abort();
+				}
+				job->out = p;
+				job->size = size;
+			}
+			r = read(job->fd, job->out + job->len,
+				 job->size - job->len);
+			if (r < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			if (r > 0) {
+				job->len += r;
+				continue;
+			}
+			close(job->fd);
+			job->fd = -1;
 		}
-		cnt++;
 	}
+
+	for (i = 0; i < njobs; i++) {
+		struct user_ent_job *job = &jobs[i];
+
+		if (job->pid < 0) {
+			/* len and size hold the run it failed to start */
+			for (first = job->len; first < job->size; first++)
+				user_ent_scan_pid(-1, root, pids[first]);
+			continue;
+		}
+		if (job->fd >= 0)
+			close(job->fd);
+		waitpid(job->pid, NULL, 0);
+		user_ent_parse(job->out, job->len);
+		free(job->out);
+	}
+	free(pfds);
+	free(jobs);
 }
 
 static void user_ent_hash_build(void)
 {
 	const char *root = getenv("PROC_ROOT") ? : "/proc/";
+	unsigned int npids = 0, size = 0;
 	struct dirent *d;
 	char name[1024];
-	int nameoff;
+	int *pids = NULL;
 	DIR *dir;
-	char *pid_context;
-	char *sock_context;
-	const char *no_ctx = "unavailable";
 	static int user_ent_hash_build_init;
 
 	/* If show_users & show_proc_ctx set only do this once */
@@ -569,84 +903,36 @@ static void user_ent_hash_build(void)
 	if (strlen(name) == 0 || name[strlen(name)-1] != '/')
 		strcat(name, "/");
 
-	nameoff = strlen(name);
-
 	dir = opendir(name);
 	if (!dir)
-		return;
+		goto out;
 
 	while ((d = readdir(dir)) != NULL) {
-		struct dirent *d1;
-		char process[16];
-		char *p;
-		int pid, pos;
-		DIR *dir1;
+		int pid;
 		char crap;
 
 		if (sscanf(d->d_name, "%d%c", &pid, &crap) != 1)
 			continue;
 
-		if (getpidcon(pid, &pid_context) != 0)
-			pid_context = strdup(no_ctx);
-
-		snprintf(name + nameoff, sizeof(name) - nameoff, "%d/fd/", pid);
-		pos = strlen(name);
-		if ((dir1 = opendir(name)) == NULL) {
-			free(pid_context);
-			continue;
-		}
-
-		process[0] = '\0';
-		p = process;
-
-		while ((d1 = readdir(dir1)) != NULL) {
-			const char *pattern = "socket:[";
-			unsigned int ino;
-			char lnk[64];
-			int fd;
-			ssize_t link_len;
-			char tmp[1024];
-
-			if (sscanf(d1->d_name, "%d%c", &fd, &crap) != 1)
-				continue;
-
-			snprintf(name+pos, sizeof(name) - pos, "%d", fd);
-
-			link_len = readlink(name, lnk, sizeof(lnk)-1);
-			if (link_len == -1)
-				continue;
-			lnk[link_len] = '\0';
-
-			if (strncmp(lnk, pattern, strlen(pattern)))
-				continue;
-
-			sscanf(lnk, "socket:[%u]", &ino);
-
-			snprintf(tmp, sizeof(tmp), "%s/%d/fd/%s",
-					root, pid, d1->d_name);
-
-			if (getfilecon(tmp, &sock_context) <= 0)
-				sock_context = strdup(no_ctx);
-
-			if (*p == '\0') {
-				FILE *fp;
+		if (npids == size) {
+			int *p;
 
-				snprintf(tmp, sizeof(tmp), "%s/%d/stat",
-					root, pid);
-				if ((fp = fopen(tmp, "r")) != NULL) {
-					if (fscanf(fp, "%*d (%[^)])", p) < 1)
-						; /* ignore */
-					fclose(fp);
-				}
+			size = size ? 2 * size : 1024;
+			p = realloc(pids, size * sizeof(*p));
+			if (!p) {
+				fprintf(stderr, "ss: failed to malloc buffer\n");
+				abort();
 			}
-			user_ent_add(ino, p, pid, fd,
-					pid_context, sock_context);
-			free(sock_context);
+			pids = p;
 		}
-		free(pid_context);
-		closedir(dir1);
+		pids[npids++] = pid;
 	}
 	closedir(dir);
+
+	user_ent_scan(name, pids, npids);
+	free(pids);
+out:
+	user_ent_hash_fill();
 }
 
 enum entry_types {
@@ -666,7 +952,7 @@ static int find_entry(unsigned int ino, char **buf, int type)
 	int buf_used = 0;
 	int buf_len = 0;
 
-	if (!ino)
+	if (!ino || !user_ent_hash)
 		return 0;
 
 	p = user_ent_hash[user_ent_hashfn(ino)];
@@ -772,6 +1058,9 @@ struct sockstat {
 	__u32		    mark;
 };
 
+/* When set, the sockets the dumps find are handed to it, not printed */
+static void (*sock_tally)(const struct sockstat *s, __u64 bytes_acked);
+
 struct dctcpstat {
 	unsigned int	ce_state;
 	unsigned int	alpha;
@@ -983,7 +1272,7 @@ static void out(const char *fmt, ...)
 	char *pos;
 	int len;
 
-	if (f->disabled)
+	if (f->disabled || json)
 		return;
 
 	if (!buffer.head)
@@ -1002,6 +1291,94 @@ again:	/* Append to buffer: if we have a new chunk, print again */
 		goto again;
 }
 
+/*
+ * With -j each socket is an object of its own, a line of NDJSON, and
+ * the values out() would format go in it under a key instead, as they
+ * are. What out() alone prints, separators and units, is left out.
+ */
+static bool json_sock_open;
+
+static void json_sock_begin(void)
+{
+	if (json_sock_open)
+		close_json_object();
+	open_json_object(NULL);
+	json_sock_open = true;
+}
+
+static void json_sock_end(void)
+{
+	if (json_sock_open)
+		close_json_object();
+	json_sock_open = false;
+}
+
+static void out_uint(const char *key, const char *fmt, unsigned int val)
+{
+	if (json)
+		print_uint(PRINT_JSON, key, NULL, val);
+	else
+		out(fmt, val);
+}
+
+static void out_int(const char *key, const char *fmt, int val)
+{
+	if (json)
+		print_int(PRINT_JSON, key, NULL, val);
+	else
+		out(fmt, val);
+}
+
+static void out_u64(const char *key, const char *fmt, unsigned long long val)
+{
+	if (json)
+		print_u64(PRINT_JSON, key, NULL, val);
+	else
+		out(fmt, val);
+}
+
+static void out_float(const char *key, const char *fmt, double val)
+{
+	if (json)
+		print_float(PRINT_JSON, key, NULL, val);
+	else
+		out(fmt, val);
+}
+
+static void out_str(const char *key, const char *fmt, const char *val)
+{
+	if (json)
+		print_string(PRINT_JSON, key, NULL, val);
+	else
+		out(fmt, val);
+}
+
+/* a flag printed as its name, true in JSON */
+static void out_flag(const char *key, const char *text)
+{
+	if (json)
+		print_bool(PRINT_JSON, key, NULL, true);
+	else
+		out("%s", text);
+}
+
+/* text opens a group of values, an object called key in JSON */
+static void out_open(const char *key, const char *text)
+{
+	if (json)
+		open_json_object(key);
+	else
+		out("%s", text);
+}
+
+static void out_close(const char *text)
+{
+	if (json)
+		close_json_object();
+	else
+		out("%s", text);
+}
+
 static int print_left_spacing(struct column *f, int stored, int printed)
 {
 	int s;
@@ -1041,7 +1418,7 @@ static void field_flush(struct column *f)
 	struct buf_chunk *chunk;
 	unsigned int pad;
 
-	if (f->disabled)
+	if (f->disabled || json)
 		return;
 
 	chunk = buffer.tail;
@@ -1071,8 +1448,19 @@ static int field_is_last(struct column *f)
 	return f - columns == COL_MAX - 1;
 }
 
+static void render(void);
+
 static void field_next(void)
 {
+	/* A line is complete: render before its last field is flushed, as
+	 * at the end of output, or the next line would start with a token.
+	 */
+	if (field_is_last(current_field) && stream_lines && !json &&
+	    ++buffer.lines >= stream_lines) {
+		render();
+		return;
+	}
+
 	field_flush(current_field);
 
 	if (field_is_last(current_field))
@@ -1123,6 +1511,7 @@ static void buf_free_all(void)
 		free(tmp);
 	}
 	buffer.head = NULL;
+	buffer.lines = 0;
 }
 
 /* Get current screen width, default to 80 columns if TIOCGWINSZ fails */
@@ -1231,6 +1620,82 @@ newline:
 	}
 }
 
+static void write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			_iprt_exit(1);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Send the buffered tokens as one frame: its length, then each token as its
+ * length and data, unaligned. They are whole lines, the last one's final
+ * field not flushed.
+ */
+static void render_ship(struct buf_token *token)
+{
+	char *frame = NULL;
+	size_t len = sizeof(uint32_t), size = 0;
+	uint32_t flen;
+
+	buffer.tail = buffer.head;
+	for (; token; token = buf_token_next(token)) {
+		size_t need = len + sizeof(token->len) + token->len;
+
+		if (need > size) {
+			size = need > 2 * size ? need + 65536 : 2 * size;
+			frame = realloc(frame, size);
+			if (!frame)
+				abort();
+		}
+		memcpy(frame + len, &token->len, sizeof(token->len));
+		memcpy(frame + len + sizeof(token->len), token->data,
+		       token->len);
+		len = need;
+	}
+	if (frame) {
+		flen = len - sizeof(flen);
+		memcpy(frame, &flen, sizeof(flen));
+		write_all(ship_fd, frame, len);
+		free(frame);
+	}
+
+	buf_free_all();
+	current_field = columns;
+}
+
+/* Take a frame from a dump child into the buffer, as if printed here */
+static void ship_replay(const char *p, size_t len)
+{
+	const char *end = p + len;
+
+	if (p == end)
+		return;
+
+	/* its first line starts a line here too */
+	field_set(COL_NETNS);
+	while (p < end) {
+		uint16_t tlen;
+
+		memcpy(&tlen, p, sizeof(tlen));
+		p += sizeof(tlen);
+		while (current_field->disabled)
+			field_next();
+		if (tlen)
+			out("%.*s", (int)tlen, p);
+		p += tlen;
+		if (p < end)
+			field_next();
+	}
+}
+
 /* Render buffered output with spacing and delimiters, then free up buffers */
 static void render(void)
 {
@@ -1238,6 +1703,11 @@ static void render(void)
 	int printed, line_started = 0;
 	struct column *f;
 
+	if (json) {
+		json_sock_end();
+		return;
+	}
+
 	if (!buffer.head)
 		return;
 
@@ -1246,7 +1716,16 @@ static void render(void)
 	/* Ensure end alignment of last token, it wasn't necessarily flushed */
 	buffer.tail->end += buffer.cur->len % 2;
 
-	render_calc_width();
+	if (ship_fd >= 0) {
+		render_ship(token);
+		return;
+	}
+
+	/* Streamed output keeps the widths its first lines got */
+	if (!widths_fixed) {
+		render_calc_width();
+		widths_fixed = !!stream_lines;
+	}
 
 	/* Rewind and replay */
 	buffer.tail = buffer.head;
@@ -1283,86 +1762,119 @@ static void render(void)
 
 	buf_free_all();
 	current_field = columns;
+	if (stream_lines)
+		fflush(stdout);
 }
 
-static void sock_state_print(struct sockstat *s)
-{
-	const char *sock_name;
-	static const char * const sstate_name[] = {
-		"UNKNOWN",
-		[SS_ESTABLISHED] = "ESTAB",
-		[SS_SYN_SENT] = "SYN-SENT",
-		[SS_SYN_RECV] = "SYN-RECV",
-		[SS_FIN_WAIT1] = "FIN-WAIT-1",
-		[SS_FIN_WAIT2] = "FIN-WAIT-2",
-		[SS_TIME_WAIT] = "TIME-WAIT",
-		[SS_CLOSE] = "UNCONN",
-		[SS_CLOSE_WAIT] = "CLOSE-WAIT",
-		[SS_LAST_ACK] = "LAST-ACK",
-		[SS_LISTEN] =	"LISTEN",
-		[SS_CLOSING] = "CLOSING",
-	};
+static const char * const sstate_name[] = {
+	"UNKNOWN",
+	[SS_ESTABLISHED] = "ESTAB",
+	[SS_SYN_SENT] = "SYN-SENT",
+	[SS_SYN_RECV] = "SYN-RECV",
+	[SS_FIN_WAIT1] = "FIN-WAIT-1",
+	[SS_FIN_WAIT2] = "FIN-WAIT-2",
+	[SS_TIME_WAIT] = "TIME-WAIT",
+	[SS_CLOSE] = "UNCONN",
+	[SS_CLOSE_WAIT] = "CLOSE-WAIT",
+	[SS_LAST_ACK] = "LAST-ACK",
+	[SS_LISTEN] =	"LISTEN",
+	[SS_CLOSING] = "CLOSING",
+};
 
-	switch (s->local.family) {
+static const char *sock_netid_name(int family, int type)
+{
+	switch (family) {
 	case AF_UNIX:
-		sock_name = unix_netid_name(s->type);
-		break;
+		return unix_netid_name(type);
 	case AF_INET:
 	case AF_INET6:
-		sock_name = proto_name(s->type);
-		break;
+		return proto_name(type);
 	case AF_PACKET:
-		sock_name = s->type == SOCK_RAW ? "p_raw" : "p_dgr";
-		break;
+		return type == SOCK_RAW ? "p_raw" : "p_dgr";
 	case AF_NETLINK:
-		sock_name = "nl";
-		break;
+		return "nl";
 	case AF_TIPC:
-		sock_name = tipc_netid_name(s->type);
-		break;
+		return tipc_netid_name(type);
 	case AF_VSOCK:
-		sock_name = vsock_netid_name(s->type);
-		break;
+		return vsock_netid_name(type);
 	default:
-		sock_name = "unknown";
+		return "unknown";
+	}
+}
+
+static void sock_state_print(struct sockstat *s)
+{
+	const char *sock_name = sock_netid_name(s->local.family, s->type);
+
+	if (json)
+		json_sock_begin();
+
+	if (ss_netns) {
+		field_set(COL_NETNS);
+		out_str("netns", "%s", ss_netns);
 	}
 
 	if (is_sctp_assoc(s, sock_name)) {
 		field_set(COL_STATE);		/* Empty Netid field */
-		out("`- %s", sctp_sstate_name[s->state]);
+		out_str("state", "`- %s", sctp_sstate_name[s->state]);
+		print_bool(PRINT_JSON, "assoc", NULL, true);
 	} else {
 		field_set(COL_NETID);
-		out("%s", sock_name);
+		out_str("netid", "%s", sock_name);
 		field_set(COL_STATE);
-		out("%s", sstate_name[s->state]);
+		out_str("state", "%s", sstate_name[s->state]);
 	}
 
 	field_set(COL_RECVQ);
-	out("%-6d", s->rq);
+	out_int("recv_q", "%-6d", s->rq);
 	field_set(COL_SENDQ);
-	out("%-6d", s->wq);
+	out_int("send_q", "%-6d", s->wq);
 	field_set(COL_ADDR);
 }
 
 static void sock_details_print(struct sockstat *s)
 {
 	if (s->uid)
-		out(" uid:%u", s->uid);
+		out_uint("uid", " uid:%u", s->uid);
 
-	out(" ino:%u", s->ino);
-	out(" sk:%llx", s->sk);
+	out_uint("ino", " ino:%u", s->ino);
+	out_u64("sk", " sk:%llx", s->sk);
 
 	if (s->mark)
-		out(" fwmark:0x%x", s->mark);
+		out_uint("fwmark", " fwmark:0x%x", s->mark);
+}
+
+/* the directions still open: <-> for both, --- for none */
+static void shutdown_print(unsigned char mask)
+{
+	if (json) {
+		print_bool(PRINT_JSON, "shut_rd", NULL, mask & 1);
+		print_bool(PRINT_JSON, "shut_wr", NULL, mask & 2);
+	} else {
+		out(" %c-%c", mask & 1 ? '-' : '<', mask & 2 ? '-' : '>');
+	}
 }
 
+/* the address and port columns of one end, as named by the column */
 static void sock_addr_print(const char *addr, char *delim, const char *port,
 		const char *ifname)
 {
-	if (ifname)
-		out("%s" "%%" "%s%s", addr, ifname, delim);
-	else
-		out("%s%s", addr, delim);
+	if (json) {
+		if (*addr)
+			print_string(PRINT_JSON, current_field->key, NULL, addr);
+		if (ifname)
+			print_string(PRINT_JSON, "dev", NULL, ifname);
+		field_next();
+		if (*port)
+			print_string(PRINT_JSON, current_field->key, NULL, port);
+		field_next();
+		return;
+	}
+
+	if (ifname)
+		out("%s" "%%" "%s%s", addr, ifname, delim);
+	else
+		out("%s%s", addr, delim);
 
 	field_next();
 	out("%s", port);
@@ -1404,13 +1916,22 @@ struct scache {
 
 struct scache *rlist;
 
+/* rpcinfo runs while the tables are read, its answer is taken after */
+static FILE *rpcinfo_fp;
+
 static void init_service_resolver(void)
+{
+	rpcinfo_fp = popen("/usr/sbin/rpcinfo -p 2>/dev/null", "r");
+}
+
+static void finish_service_resolver(void)
 {
 	char buf[128];
-	FILE *fp = popen("/usr/sbin/rpcinfo -p 2>/dev/null", "r");
+	FILE *fp = rpcinfo_fp;
 
 	if (!fp)
 		return;
+	rpcinfo_fp = NULL;
 
 	if (!fgets(buf, sizeof(buf), fp)) {
 		pclose(fp);
@@ -1549,6 +2070,21 @@ static void inet_addr_print(const inet_prefix *a, int port,
 	const char *ap = buf;
 	const char *ifname = NULL;
 
+	/* the address as it is, the port a number */
+	if (json) {
+		print_string(PRINT_JSON, current_field->key, NULL,
+			     format_host(a->family,
+					 a->family == AF_INET ? 4 : 16,
+					 a->data));
+		if (ifindex)
+			print_string(PRINT_JSON, "dev", NULL,
+				     ll_index_to_name(ifindex));
+		field_next();
+		print_uint(PRINT_JSON, current_field->key, NULL, port);
+		field_next();
+		return;
+	}
+
 	if (a->family == AF_INET) {
 		ap = format_host(AF_INET, 4, a->data);
 	} else {
@@ -1720,6 +2256,159 @@ static int run_ssfilter(struct ssfilter *f, struct sockstat *s)
 	}
 }
 
+static bool aafilter_equal(int type, const struct aafilter *a,
+			   const struct aafilter *b)
+{
+	switch (type) {
+	case SSF_DCOND:
+	case SSF_SCOND:
+		for (; a && b; a = a->next, b = b->next) {
+			int alen = a->addr.family == AF_INET6 ? 16 : 4;
+
+			/* unix patterns and the like are never merged */
+			if (a->addr.family != AF_INET &&
+			    a->addr.family != AF_INET6 &&
+			    a->addr.family != AF_UNSPEC)
+				return false;
+			if (a->addr.family != b->addr.family ||
+			    a->addr.bitlen != b->addr.bitlen ||
+			    a->port != b->port)
+				return false;
+			if (a->addr.bitlen &&
+			    memcmp(a->addr.data, b->addr.data, alen))
+				return false;
+		}
+		return !a && !b;
+	case SSF_D_GE:
+	case SSF_D_LE:
+	case SSF_S_GE:
+	case SSF_S_LE:
+		return a->port == b->port;
+	case SSF_DEVCOND:
+		return a->iface == b->iface;
+	case SSF_MARKMASK:
+		return a->mark == b->mark && a->mask == b->mask;
+	}
+	return false;
+}
+
+static bool ssfilter_equal(const struct ssfilter *a, const struct ssfilter *b)
+{
+	if (a->type != b->type)
+		return false;
+
+	switch (a->type) {
+	case SSF_AND:
+	case SSF_OR:
+		return ssfilter_equal(a->pred, b->pred) &&
+		       ssfilter_equal(a->post, b->post);
+	case SSF_NOT:
+		return ssfilter_equal(a->pred, b->pred);
+	case SSF_S_AUTO:
+		return true;
+	}
+	return aafilter_equal(a->type, (void *)a->pred, (void *)b->pred);
+}
+
+/*
+ * Rewrite the filter into an equivalent one that is cheaper to run here
+ * and compiles to less bytecode: double negations go, a negated port
+ * range becomes the opposite range, and chains of AND and OR lean right
+ * so that the first term of each is at hand, which lets repeated terms
+ * be dropped and a term common to both sides be taken out, as in
+ * "(dev X and mark Y) or (dev X and mark Z)" => "dev X and (mark Y or
+ * mark Z)". Nodes are reused, so f is not to be used afterwards.
+ */
+static struct ssfilter *ssfilter_optimize(struct ssfilter *f)
+{
+	struct ssfilter *p, *q;
+	int dual;
+
+	switch (f->type) {
+	case SSF_NOT:
+		p = ssfilter_optimize(f->pred);
+		if (p->type == SSF_NOT) {
+			free(f);
+			return p->pred;
+		}
+		if (p->type == SSF_D_LE || p->type == SSF_S_LE ||
+		    p->type == SSF_D_GE || p->type == SSF_S_GE) {
+			struct aafilter *a = (void *)p->pred;
+			bool le = p->type == SSF_D_LE || p->type == SSF_S_LE;
+			bool d = p->type == SSF_D_LE || p->type == SSF_D_GE;
+
+			/* ports are compared as 16 bits in the kernel */
+			if (le ? a->port < 65535 : a->port > 0) {
+				a->port += le ? 1 : -1;
+				if (le)
+					p->type = d ? SSF_D_GE : SSF_S_GE;
+				else
+					p->type = d ? SSF_D_LE : SSF_S_LE;
+				free(f);
+				return p;
+			}
+		}
+		f->pred = p;
+		return f;
+	case SSF_AND:
+	case SSF_OR:
+		break;
+	default:
+		return f;
+	}
+
+	dual = f->type == SSF_AND ? SSF_OR : SSF_AND;
+	f->pred = ssfilter_optimize(f->pred);
+	f->post = ssfilter_optimize(f->post);
+
+	/* (x . y) . z => x . (y . z) */
+	if (f->pred->type == f->type) {
+		p = f->pred;
+		f->pred = p->pred;
+		p->pred = p->post;
+		p->post = f->post;
+		f->post = ssfilter_optimize(p);
+	}
+
+	/* x . x => x and x . (x . z) => x . z */
+	if (ssfilter_equal(f->pred, f->post)) {
+		p = f->pred;
+		free(f);
+		return p;
+	}
+	if (f->post->type == f->type && ssfilter_equal(f->pred, f->post->pred)) {
+		p = f->post;
+		free(f);
+		return p;
+	}
+
+	/* (a ^ b) . ((a ^ c) . z) => (a ^ (b . c)) . z, also without z */
+	p = f->pred;
+	q = f->post->type == f->type ? f->post->pred : f->post;
+	if (p->type == dual && q->type == dual &&
+	    ssfilter_equal(p->pred, q->pred)) {
+		struct ssfilter *rest = q == f->post ? NULL : f->post;
+
+		p->type = f->type;
+		p->pred = p->post;
+		p->post = q->post;
+		f->type = dual;
+		f->pred = q->pred;
+		f->post = p;
+		free(q);
+		if (rest) {
+			q = rest;
+			rest = q->post;
+			q->pred = f;
+			q->post = rest;
+			return ssfilter_optimize(q);
+		}
+		return ssfilter_optimize(f);
+	}
+
+	return f;
+}
+
 /* Relocate external jumps by reloc. */
 static void ssfilter_patch(char *a, int len, int reloc)
 {
@@ -1754,8 +2443,13 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		int len = 0;
 
 		for (b = a; b; b = b->next) {
+			/* the kernel knows no other families, leave them here */
+			if (b->addr.family != AF_INET &&
+			    b->addr.family != AF_INET6 &&
+			    b->addr.family != AF_UNSPEC)
+				return 0;
 			len += 4 + sizeof(struct inet_diag_hostcond);
-			if (a->addr.family == AF_INET6)
+			if (b->addr.family == AF_INET6)
 				len += 16;
 			else
 				len += 4;
@@ -1766,15 +2460,15 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		*bytecode = ptr;
 		for (b = a; b; b = b->next) {
 			struct inet_diag_bc_op *op = (struct inet_diag_bc_op *)ptr;
-			int alen = (a->addr.family == AF_INET6 ? 16 : 4);
+			int alen = (b->addr.family == AF_INET6 ? 16 : 4);
 			int oplen = alen + 4 + sizeof(struct inet_diag_hostcond);
 			struct inet_diag_hostcond *cond = (struct inet_diag_hostcond *)(ptr+4);
 
 			*op = (struct inet_diag_bc_op){ code, oplen, oplen+4 };
-			cond->family = a->addr.family;
-			cond->port = a->port;
-			cond->prefix_len = a->addr.bitlen;
-			memcpy(cond->addr, a->addr.data, alen);
+			cond->family = b->addr.family;
+			cond->port = b->port;
+			cond->prefix_len = b->addr.bitlen;
+			memcpy(cond->addr, b->addr.data, alen);
 			ptr += oplen;
 			if (b->next) {
 				op = (struct inet_diag_bc_op *)ptr;
@@ -1828,10 +2522,14 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 
 		l1 = ssfilter_bytecompile(f->pred, &a1);
 		l2 = ssfilter_bytecompile(f->post, &a2);
+		/* what is left out is checked here, let the kernel do the rest */
 		if (!l1 || !l2) {
-			free(a1);
-			free(a2);
-			return 0;
+			if (!l1)
+				free(a1);
+			if (!l2)
+				free(a2);
+			*bytecode = l1 ? a1 : a2;
+			return l1 ? : l2;
 		}
 		if (!(a = malloc(l1+l2))) abort();
 		memcpy(a, a1, l1);
@@ -1880,8 +2578,14 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 	}
 		case SSF_DEVCOND:
 	{
-		/* bytecompile for SSF_DEVCOND not supported yet */
-		return 0;
+		struct aafilter *a = (void *)f->pred;
+		struct inet_diag_bc_op *op;
+
+		if (!(*bytecode = malloc(8))) abort();
+		op = (struct inet_diag_bc_op *)*bytecode;
+		op[0] = (struct inet_diag_bc_op){ INET_DIAG_BC_DEV_COND, 8, 12 };
+		memcpy(&op[1], &a->iface, 4);
+		return 8;
 	}
 		case SSF_MARKMASK:
 	{
@@ -1905,6 +2609,64 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 	}
 }
 
+/*
+ * Take every jump that lands on a JMP straight to where that one goes,
+ * then drop the JMPs left going to the next op. All ops step to the
+ * next on yes, as the kernel's audit of the program wants it.
+ */
+static int ssfilter_thread(char *bc, int len)
+{
+	struct inet_diag_bc_op *op, *to;
+	int pos, t, jmp;
+
+	for (pos = 0; pos < len; pos += op->yes) {
+		op = (struct inet_diag_bc_op *)(bc + pos);
+		for (t = pos + op->no; t < len; t += to->no) {
+			to = (struct inet_diag_bc_op *)(bc + t);
+			if (to->code != INET_DIAG_BC_JMP)
+				break;
+		}
+		op->no = t - pos;
+	}
+
+	for (jmp = 0; jmp < len; ) {
+		op = (struct inet_diag_bc_op *)(bc + jmp);
+		if (op->code != INET_DIAG_BC_JMP || op->no != 4) {
+			jmp += op->yes;
+			continue;
+		}
+		for (pos = 0; pos < jmp; pos += op->yes) {
+			op = (struct inet_diag_bc_op *)(bc + pos);
+			if (pos + op->no > jmp)
+				op->no -= 4;
+		}
+		memmove(bc + jmp, bc + jmp + 4, len - jmp - 4);
+		len -= 4;
+	}
+	return len;
+}
+
+/* The filter does not change once parsed, so repeated dumps (--watch,
+ * --sample) send the bytecode compiled for the first.
+ */
+static int ssfilter_compile(struct ssfilter *f, char **bytecode)
+{
+	static struct ssfilter *cached;
+	static char *cached_bc;
+	static int cached_len;
+	int len;
+
+	if (f != cached) {
+		free(cached_bc);
+		cached_bc = NULL;
+		len = ssfilter_bytecompile(f, &cached_bc);
+		cached_len = len ? ssfilter_thread(cached_bc, len) : 0;
+		cached = f;
+	}
+	*bytecode = cached_bc;
+	return cached_len;
+}
+
 static int remember_he(struct aafilter *a, struct hostent *he)
 {
 	char **ptr = he->h_addr_list;
@@ -2243,10 +3005,47 @@ void *parse_markmask(const char *markmask)
 	return res;
 }
 
+/* the processes find_entry() would format, as an array of objects */
+static void users_json_print(unsigned int ino)
+{
+	struct user_ent *p;
+	bool any = false;
+
+	if (!ino || !user_ent_hash)
+		return;
+
+	for (p = user_ent_hash[user_ent_hashfn(ino)]; p; p = p->next) {
+		if (p->ino != ino)
+			continue;
+		if (!any)
+			open_json_array(PRINT_JSON, "users");
+		any = true;
+		open_json_object(NULL);
+		print_string(PRINT_JSON, "name", NULL, p->process);
+		print_int(PRINT_JSON, "pid", NULL, p->pid);
+		print_int(PRINT_JSON, "fd", NULL, p->fd);
+		if (show_proc_ctx)
+			print_string(PRINT_JSON, "proc_ctx", NULL,
+				     p->process_ctx);
+		if (show_proc_ctx && show_sock_ctx)
+			print_string(PRINT_JSON, "sock_ctx", NULL,
+				     p->socket_ctx);
+		close_json_object();
+	}
+	if (any)
+		close_json_array(PRINT_JSON, NULL);
+}
+
 static void proc_ctx_print(struct sockstat *s)
 {
 	char *buf;
 
+	if (json) {
+		if (show_proc_ctx || show_sock_ctx || show_users)
+			users_json_print(s->ino);
+		return;
+	}
+
 	if (show_proc_ctx || show_sock_ctx) {
 		if (find_entry(s->ino, &buf,
 				(show_proc_ctx & show_sock_ctx) ?
@@ -2272,32 +3071,416 @@ static void inet_stats_print(struct sockstat *s, bool v6only)
 	proc_ctx_print(s);
 }
 
-static int proc_parse_inet_addr(char *loc, char *rem, int family, struct
-		sockstat * s)
+/*
+ * --group-by: instead of a line per socket, the sockets are counted in
+ * groups of those that agree on the keys given, and the groups printed
+ * at the end, largest first. Addresses may be cut to a prefix, dst/24.
+ */
+enum {
+	GROUP_NETID,
+	GROUP_STATE,
+	GROUP_SRC,
+	GROUP_DST,
+	GROUP_SPORT,
+	GROUP_DPORT,
+	GROUP_MAX
+};
+
+static const char * const group_key_name[GROUP_MAX] = {
+	[GROUP_NETID] = "netid",
+	[GROUP_STATE] = "state",
+	[GROUP_SRC] = "src",
+	[GROUP_DST] = "dst",
+	[GROUP_SPORT] = "sport",
+	[GROUP_DPORT] = "dport",
+};
+
+/* what is not grouped on stays zero, so a key compares as bytes */
+struct group_key {
+	__u16		family;
+	__u16		type;
+	__u16		sport;
+	__u16		dport;
+	int		state;
+	__u8		src[16];
+	__u8		dst[16];
+};
+
+struct group_ent {
+	struct group_ent	*next;
+	struct group_key	key;
+	unsigned long long	sockets;
+	unsigned long long	rq, wq;
+	unsigned long long	bytes_acked;
+};
+
+static struct {
+	unsigned int		keys[GROUP_MAX];	/* in the order given */
+	unsigned int		nkeys;
+	unsigned int		mask;
+	unsigned int		src_len, dst_len;	/* in bits */
+	unsigned int		top;
+	struct group_ent	**hash;
+	unsigned int		size;	/* a power of two */
+	unsigned int		count;
+	struct arena		arena;	/* the entries */
+} group = { .src_len = 128, .dst_len = 128 };
+
+static int group_parse(const char *arg)
 {
-	s->local.family = s->remote.family = family;
-	if (family == AF_INET) {
-		sscanf(loc, "%x:%x", s->local.data, (unsigned *)&s->lport);
-		sscanf(rem, "%x:%x", s->remote.data, (unsigned *)&s->rport);
-		s->local.bytelen = s->remote.bytelen = 4;
-		return 0;
-	} else {
-		sscanf(loc, "%08x%08x%08x%08x:%x",
-		       s->local.data,
-		       s->local.data + 1,
-		       s->local.data + 2,
-		       s->local.data + 3,
-		       &s->lport);
-		sscanf(rem, "%08x%08x%08x%08x:%x",
-		       s->remote.data,
-		       s->remote.data + 1,
-		       s->remote.data + 2,
-		       s->remote.data + 3,
-		       &s->rport);
-		s->local.bytelen = s->remote.bytelen = 16;
-		return 0;
+	char *keys = strdupa(arg);
+	char *key;
+
+	for (key = strtok(keys, ","); key; key = strtok(NULL, ",")) {
+		char *len = strchr(key, '/');
+		unsigned int i, bits = 128;
+
+		if (len) {
+			*len++ = 0;
+			if (get_unsigned(&bits, len, 0) || bits > 128)
+				return -1;
+		}
+		for (i = 0; i < GROUP_MAX; i++)
+			if (strcmp(key, group_key_name[i]) == 0)
+				break;
+		if (i == GROUP_MAX || (group.mask & (1 << i)) ||
+		    (len && i != GROUP_SRC && i != GROUP_DST))
+			return -1;
+
+		if (i == GROUP_SRC)
+			group.src_len = bits;
+		else if (i == GROUP_DST)
+			group.dst_len = bits;
+		group.keys[group.nkeys++] = i;
+		group.mask |= 1 << i;
 	}
-	return -1;
+	return group.nkeys ? 0 : -1;
+}
+
+static void group_addr(__u8 *dst, const inet_prefix *a, unsigned int bits)
+{
+	unsigned int len = a->family == AF_INET ? 4 : 16;
+
+	if (bits > 8 * len)
+		bits = 8 * len;
+	memcpy(dst, a->data, bits / 8);
+	if (bits % 8)
+		dst[bits / 8] = ((__u8 *)a->data)[bits / 8] &
+				(0xff00 >> (bits % 8));
+}
+
+static unsigned int group_hashfn(const struct group_key *key)
+{
+	const __u8 *p = (const __u8 *)key;
+	__u32 h = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h & (group.size - 1);
+}
+
+static struct group_ent **group_find(const struct group_key *key)
+{
+	struct group_ent **pp = &group.hash[group_hashfn(key)];
+
+	while (*pp && memcmp(&(*pp)->key, key, sizeof(*key)))
+		pp = &(*pp)->next;
+	return pp;
+}
+
+static void group_grow(void)
+{
+	struct group_ent **old = group.hash;
+	unsigned int i, size = group.size;
+
+	group.size = size ? 2 * size : 256;
+	group.hash = calloc(group.size, sizeof(*group.hash));
+	if (!group.hash)
+		abort();
+
+	for (i = 0; i < size; i++) {
+		while (old[i]) {
+			struct group_ent *e = old[i];
+			struct group_ent **pp = &group.hash[group_hashfn(&e->key)];
+
+			old[i] = e->next;
+			e->next = *pp;
+			*pp = e;
+		}
+	}
+	free(old);
+}
+
+/* Count an INET or Unix socket; addresses and ports are INET only */
+static void group_sock(const struct sockstat *s, __u64 bytes_acked)
+{
+	bool inet = s->local.family == AF_INET || s->local.family == AF_INET6;
+	struct group_key key = {};
+	struct group_ent *e, **pp;
+
+	/*
+	 * The family tells INET keys from Unix ones; unless addresses are
+	 * keyed it must not split a netid or port between IPv4 and IPv6.
+	 */
+	if (group.mask & ((1 << GROUP_SRC) | (1 << GROUP_DST)))
+		key.family = s->local.family;
+	else if (group.mask & ~(1 << GROUP_STATE))
+		key.family = inet ? AF_INET : s->local.family;
+	if (group.mask & (1 << GROUP_NETID))
+		key.type = s->type;
+	if (group.mask & (1 << GROUP_STATE))
+		key.state = s->state;
+	if (inet) {
+		if (group.mask & (1 << GROUP_SRC))
+			group_addr(key.src, &s->local, group.src_len);
+		if (group.mask & (1 << GROUP_DST))
+			group_addr(key.dst, &s->remote, group.dst_len);
+		if (group.mask & (1 << GROUP_SPORT))
+			key.sport = s->lport;
+		if (group.mask & (1 << GROUP_DPORT))
+			key.dport = s->rport;
+	}
+
+	if (!group.size)
+		group_grow();
+	pp = group_find(&key);
+	e = *pp;
+	if (!e) {
+		if (group.count >= group.size) {
+			group_grow();
+			pp = group_find(&key);
+		}
+		e = arena_zalloc(&group.arena, sizeof(*e));
+		if (!e)
+			abort();
+		e->key = key;
+		*pp = e;
+		group.count++;
+	}
+
+	e->sockets++;
+	e->rq += s->rq;
+	e->wq += s->wq;
+	e->bytes_acked += bytes_acked;
+}
+
+static int group_cmp(const void *a, const void *b)
+{
+	const struct group_ent *x = *(struct group_ent **)a;
+	const struct group_ent *y = *(struct group_ent **)b;
+
+	if (x->sockets != y->sockets)
+		return x->sockets < y->sockets ? 1 : -1;
+	return memcmp(&x->key, &y->key, sizeof(x->key));
+}
+
+static const char *group_key_str(const struct group_ent *e, unsigned int k,
+				 char *buf, size_t len)
+{
+	const struct group_key *key = &e->key;
+	unsigned int bits = k == GROUP_SRC ? group.src_len : group.dst_len;
+	bool inet = key->family == AF_INET || key->family == AF_INET6;
+
+	switch (k) {
+	case GROUP_NETID:
+		return sock_netid_name(key->family, key->type);
+	case GROUP_STATE:
+		return sstate_name[key->state];
+	case GROUP_SRC:
+	case GROUP_DST:
+		if (!inet)
+			return "*";
+		snprintf(buf, len, "%s",
+			 format_host(key->family, key->family == AF_INET ? 4 : 16,
+				     k == GROUP_SRC ? key->src : key->dst));
+		if (bits < (key->family == AF_INET ? 32 : 128))
+			snprintf(buf + strlen(buf), len - strlen(buf), "/%u",
+				 bits);
+		return buf;
+	case GROUP_SPORT:
+	case GROUP_DPORT:
+		if (!inet)
+			return "*";
+		snprintf(buf, len, "%u", k == GROUP_SPORT ? key->sport :
+			 key->dport);
+		return buf;
+	}
+	return "";
+}
+
+static void group_print(void)
+{
+	static const char * const hdr[] = {
+		"Sockets", "Recv-Q", "Send-Q", "Bytes-Acked"
+	};
+	int width[GROUP_MAX + ARRAY_SIZE(hdr)];
+	unsigned int n = 0, i, j, rows;
+	struct group_ent **ents;
+	char buf[256];
+
+	ents = malloc((group.count ? : 1) * sizeof(*ents));
+	if (!ents)
+		abort();
+	for (i = 0; i < group.size; i++) {
+		struct group_ent *e;
+
+		for (e = group.hash[i]; e; e = e->next)
+			ents[n++] = e;
+	}
+	qsort(ents, n, sizeof(*ents), group_cmp);
+	rows = group.top && group.top < n ? group.top : n;
+
+	for (j = 0; j < group.nkeys; j++)
+		width[j] = show_header ? strlen(group_key_name[group.keys[j]]) : 0;
+	for (j = 0; j < ARRAY_SIZE(hdr); j++)
+		width[group.nkeys + j] = show_header ? strlen(hdr[j]) : 0;
+	for (i = 0; i < rows; i++) {
+		unsigned long long val[] = {
+			ents[i]->sockets, ents[i]->rq, ents[i]->wq,
+			ents[i]->bytes_acked
+		};
+
+		for (j = 0; j < group.nkeys; j++) {
+			int len = strlen(group_key_str(ents[i], group.keys[j],
+						       buf, sizeof(buf)));
+
+			if (len > width[j])
+				width[j] = len;
+		}
+		for (j = 0; j < ARRAY_SIZE(val); j++) {
+			int len = snprintf(buf, sizeof(buf), "%llu", val[j]);
+
+			if (len > width[group.nkeys + j])
+				width[group.nkeys + j] = len;
+		}
+	}
+
+	if (show_header) {
+		for (j = 0; j < group.nkeys; j++)
+			printf("%-*s  ", width[j], group_key_name[group.keys[j]]);
+		for (j = 0; j < ARRAY_SIZE(hdr); j++)
+			printf("%*s%s", width[group.nkeys + j], hdr[j],
+			       j + 1 < ARRAY_SIZE(hdr) ? "  " : "\n");
+	}
+	for (i = 0; i < rows; i++) {
+		unsigned long long val[] = {
+			ents[i]->sockets, ents[i]->rq, ents[i]->wq,
+			ents[i]->bytes_acked
+		};
+
+		for (j = 0; j < group.nkeys; j++)
+			printf("%-*s  ", width[j],
+			       group_key_str(ents[i], group.keys[j], buf,
+					     sizeof(buf)));
+		for (j = 0; j < ARRAY_SIZE(val); j++)
+			printf("%*llu%s", width[group.nkeys + j], val[j],
+			       j + 1 < ARRAY_SIZE(val) ? "  " : "\n");
+	}
+	if (rows < n && show_header)
+		printf("(%u more groups)\n", n - rows);
+	free(ents);
+}
+
+/*
+ * /proc/net/{tcp,udp,raw}{,6} are read with these rather than sscanf(),
+ * which took most of the time there. proc_hex() takes up to max hex
+ * digits.
+ */
+static unsigned long long proc_hex(const char **pp, int max, bool *ok)
+{
+	unsigned long long v = 0;
+	const char *p = *pp;
+
+	for (; max && isxdigit((unsigned char)*p); max--, p++)
+		v = v << 4 | (*p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10);
+	*ok = p != *pp;
+	*pp = p;
+	return v;
+}
+
+/*
+ * Take the fields fmt tells after *pp: x is hex into an unsigned int,
+ * X hex into an unsigned long long, d decimal into an int, - a hex
+ * field to skip, and ':' must be there as it is. Fields are separated
+ * by blanks. Returns how many were stored, *pp is left after the last.
+ */
+static int proc_scan(const char **pp, const char *fmt, ...)
+{
+	const char *p = *pp;
+	va_list args;
+	int n = 0;
+
+	va_start(args, fmt);
+	for (; *fmt; fmt++) {
+		unsigned long long v;
+		bool ok, neg = false;
+
+		if (*fmt == ' ')
+			continue;
+		if (*fmt == ':') {
+			if (*p != ':')
+				break;
+			p++;
+			continue;
+		}
+
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*fmt == 'd') {
+			const char *start;
+
+			if (*p == '-') {
+				neg = true;
+				p++;
+			}
+			for (v = 0, start = p; isdigit((unsigned char)*p); p++)
+				v = v * 10 + *p - '0';
+			ok = p != start;
+		} else {
+			v = proc_hex(&p, -1, &ok);
+		}
+		if (!ok)
+			break;
+
+		switch (*fmt) {
+		case 'x':
+			*va_arg(args, unsigned int *) = v;
+			break;
+		case 'X':
+			*va_arg(args, unsigned long long *) = v;
+			break;
+		case 'd':
+			*va_arg(args, int *) = neg ? -v : v;
+			break;
+		default:
+			continue;
+		}
+		n++;
+	}
+	va_end(args);
+	*pp = p;
+	return n;
+}
+
+static int proc_parse_inet_addr(const char *loc, const char *rem, int family,
+				struct sockstat *s)
+{
+	int i, words = family == AF_INET ? 1 : 4;
+	bool ok;
+
+	s->local.family = s->remote.family = family;
+	s->local.bytelen = s->remote.bytelen = 4 * words;
+	/* the words are printed as the host sees them */
+	for (i = 0; i < words; i++) {
+		s->local.data[i] = proc_hex(&loc, 8, &ok);
+		s->remote.data[i] = proc_hex(&rem, 8, &ok);
+	}
+	if (*loc++ == ':')
+		s->lport = proc_hex(&loc, -1, &ok);
+	if (*rem++ == ':')
+		s->rport = proc_hex(&rem, -1, &ok);
+	return 0;
 }
 
 static int proc_inet_split_line(char *line, char **loc, char **rem, char **data)
@@ -2336,119 +3519,138 @@ static char *sprint_bw(char *buf, double bw)
 static void sctp_stats_print(struct sctp_info *s)
 {
 	if (s->sctpi_tag)
-		out(" tag:%x", s->sctpi_tag);
+		out_uint("tag", " tag:%x", s->sctpi_tag);
 	if (s->sctpi_state)
-		out(" state:%s", sctp_sstate_name[s->sctpi_state]);
+		out_str("sctp_state", " state:%s",
+			sctp_sstate_name[s->sctpi_state]);
 	if (s->sctpi_rwnd)
-		out(" rwnd:%d", s->sctpi_rwnd);
+		out_int("rwnd", " rwnd:%d", s->sctpi_rwnd);
 	if (s->sctpi_unackdata)
-		out(" unackdata:%d", s->sctpi_unackdata);
+		out_int("unackdata", " unackdata:%d", s->sctpi_unackdata);
 	if (s->sctpi_penddata)
-		out(" penddata:%d", s->sctpi_penddata);
+		out_int("penddata", " penddata:%d", s->sctpi_penddata);
 	if (s->sctpi_instrms)
-		out(" instrms:%d", s->sctpi_instrms);
+		out_int("instrms", " instrms:%d", s->sctpi_instrms);
 	if (s->sctpi_outstrms)
-		out(" outstrms:%d", s->sctpi_outstrms);
+		out_int("outstrms", " outstrms:%d", s->sctpi_outstrms);
 	if (s->sctpi_inqueue)
-		out(" inqueue:%d", s->sctpi_inqueue);
+		out_int("inqueue", " inqueue:%d", s->sctpi_inqueue);
 	if (s->sctpi_outqueue)
-		out(" outqueue:%d", s->sctpi_outqueue);
+		out_int("outqueue", " outqueue:%d", s->sctpi_outqueue);
 	if (s->sctpi_overall_error)
-		out(" overerr:%d", s->sctpi_overall_error);
+		out_int("overerr", " overerr:%d", s->sctpi_overall_error);
 	if (s->sctpi_max_burst)
-		out(" maxburst:%d", s->sctpi_max_burst);
+		out_int("maxburst", " maxburst:%d", s->sctpi_max_burst);
 	if (s->sctpi_maxseg)
-		out(" maxseg:%d", s->sctpi_maxseg);
+		out_int("maxseg", " maxseg:%d", s->sctpi_maxseg);
 	if (s->sctpi_peer_rwnd)
-		out(" prwnd:%d", s->sctpi_peer_rwnd);
+		out_int("prwnd", " prwnd:%d", s->sctpi_peer_rwnd);
 	if (s->sctpi_peer_tag)
-		out(" ptag:%x", s->sctpi_peer_tag);
+		out_uint("ptag", " ptag:%x", s->sctpi_peer_tag);
 	if (s->sctpi_peer_capable)
-		out(" pcapable:%d", s->sctpi_peer_capable);
+		out_int("pcapable", " pcapable:%d", s->sctpi_peer_capable);
 	if (s->sctpi_peer_sack)
-		out(" psack:%d", s->sctpi_peer_sack);
+		out_int("psack", " psack:%d", s->sctpi_peer_sack);
 	if (s->sctpi_s_autoclose)
-		out(" autoclose:%d", s->sctpi_s_autoclose);
+		out_int("autoclose", " autoclose:%d", s->sctpi_s_autoclose);
 	if (s->sctpi_s_adaptation_ind)
-		out(" adapind:%d", s->sctpi_s_adaptation_ind);
+		out_int("adapind", " adapind:%d", s->sctpi_s_adaptation_ind);
 	if (s->sctpi_s_pd_point)
-		out(" pdpoint:%d", s->sctpi_s_pd_point);
+		out_int("pdpoint", " pdpoint:%d", s->sctpi_s_pd_point);
 	if (s->sctpi_s_nodelay)
-		out(" nodealy:%d", s->sctpi_s_nodelay);
+		out_int("nodelay", " nodealy:%d", s->sctpi_s_nodelay);
 	if (s->sctpi_s_disable_fragments)
-		out(" nofrag:%d", s->sctpi_s_disable_fragments);
+		out_int("nofrag", " nofrag:%d", s->sctpi_s_disable_fragments);
 	if (s->sctpi_s_v4mapped)
-		out(" v4mapped:%d", s->sctpi_s_v4mapped);
+		out_int("v4mapped", " v4mapped:%d", s->sctpi_s_v4mapped);
 	if (s->sctpi_s_frag_interleave)
-		out(" fraginl:%d", s->sctpi_s_frag_interleave);
+		out_int("fraginl", " fraginl:%d", s->sctpi_s_frag_interleave);
 }
 
-static void tcp_stats_print(struct tcpstat *s)
+/* a rate in bits per second, the number itself in JSON */
+static void out_bw(const char *key, const char *fmt, double bw)
 {
 	char b1[64];
 
+	if (json)
+		print_u64(PRINT_JSON, key, NULL, bw);
+	else
+		out(fmt, sprint_bw(b1, bw));
+}
+
+static void tcp_stats_print(struct tcpstat *s)
+{
 	if (s->has_ts_opt)
-		out(" ts");
+		out_flag("ts", " ts");
 	if (s->has_sack_opt)
-		out(" sack");
+		out_flag("sack", " sack");
 	if (s->has_ecn_opt)
-		out(" ecn");
+		out_flag("ecn", " ecn");
 	if (s->has_ecnseen_opt)
-		out(" ecnseen");
+		out_flag("ecnseen", " ecnseen");
 	if (s->has_fastopen_opt)
-		out(" fastopen");
+		out_flag("fastopen", " fastopen");
 	if (s->cong_alg[0])
-		out(" %s", s->cong_alg);
-	if (s->has_wscale_opt)
-		out(" wscale:%d,%d", s->snd_wscale, s->rcv_wscale);
+		out_str("cong_alg", " %s", s->cong_alg);
+	if (s->has_wscale_opt) {
+		out_int("snd_wscale", " wscale:%d", s->snd_wscale);
+		out_int("rcv_wscale", ",%d", s->rcv_wscale);
+	}
 	if (s->rto)
-		out(" rto:%g", s->rto);
+		out_float("rto", " rto:%g", s->rto);
 	if (s->backoff)
-		out(" backoff:%u", s->backoff);
-	if (s->rtt)
-		out(" rtt:%g/%g", s->rtt, s->rttvar);
+		out_uint("backoff", " backoff:%u", s->backoff);
+	if (s->rtt) {
+		out_float("rtt", " rtt:%g", s->rtt);
+		out_float("rttvar", "/%g", s->rttvar);
+	}
 	if (s->ato)
-		out(" ato:%g", s->ato);
+		out_float("ato", " ato:%g", s->ato);
 
 	if (s->qack)
-		out(" qack:%d", s->qack);
+		out_int("qack", " qack:%d", s->qack);
 	if (s->qack & 1)
-		out(" bidir");
+		out_flag("bidir", " bidir");
 
 	if (s->mss)
-		out(" mss:%d", s->mss);
+		out_int("mss", " mss:%d", s->mss);
 	if (s->pmtu)
-		out(" pmtu:%u", s->pmtu);
+		out_uint("pmtu", " pmtu:%u", s->pmtu);
 	if (s->rcv_mss)
-		out(" rcvmss:%d", s->rcv_mss);
+		out_int("rcvmss", " rcvmss:%d", s->rcv_mss);
 	if (s->advmss)
-		out(" advmss:%d", s->advmss);
+		out_int("advmss", " advmss:%d", s->advmss);
 	if (s->cwnd)
-		out(" cwnd:%u", s->cwnd);
+		out_uint("cwnd", " cwnd:%u", s->cwnd);
 	if (s->ssthresh)
-		out(" ssthresh:%d", s->ssthresh);
+		out_int("ssthresh", " ssthresh:%d", s->ssthresh);
 
 	if (s->bytes_acked)
-		out(" bytes_acked:%llu", s->bytes_acked);
+		out_u64("bytes_acked", " bytes_acked:%llu", s->bytes_acked);
 	if (s->bytes_received)
-		out(" bytes_received:%llu", s->bytes_received);
+		out_u64("bytes_received", " bytes_received:%llu",
+			s->bytes_received);
 	if (s->segs_out)
-		out(" segs_out:%u", s->segs_out);
+		out_uint("segs_out", " segs_out:%u", s->segs_out);
 	if (s->segs_in)
-		out(" segs_in:%u", s->segs_in);
+		out_uint("segs_in", " segs_in:%u", s->segs_in);
 	if (s->data_segs_out)
-		out(" data_segs_out:%u", s->data_segs_out);
+		out_uint("data_segs_out", " data_segs_out:%u",
+			 s->data_segs_out);
 	if (s->data_segs_in)
-		out(" data_segs_in:%u", s->data_segs_in);
+		out_uint("data_segs_in", " data_segs_in:%u", s->data_segs_in);
 
 	if (s->dctcp && s->dctcp->enabled) {
 		struct dctcpstat *dctcp = s->dctcp;
 
-		out(" dctcp:(ce_state:%u,alpha:%u,ab_ecn:%u,ab_tot:%u)",
-			     dctcp->ce_state, dctcp->alpha, dctcp->ab_ecn,
-			     dctcp->ab_tot);
+		out_open("dctcp", " dctcp:(");
+		out_uint("ce_state", "ce_state:%u", dctcp->ce_state);
+		out_uint("alpha", ",alpha:%u", dctcp->alpha);
+		out_uint("ab_ecn", ",ab_ecn:%u", dctcp->ab_ecn);
+		out_uint("ab_tot", ",ab_tot:%u", dctcp->ab_tot);
+		out_close(")");
 	} else if (s->dctcp) {
-		out(" dctcp:fallback_mode");
+		out_str("dctcp", " dctcp:%s", "fallback_mode");
 	}
 
 	if (s->bbr_info) {
@@ -2458,72 +3660,95 @@ static void tcp_stats_print(struct tcpstat *s)
 		bw <<= 32;
 		bw |= s->bbr_info->bbr_bw_lo;
 
-		out(" bbr:(bw:%sbps,mrtt:%g",
-		    sprint_bw(b1, bw * 8.0),
-		    (double)s->bbr_info->bbr_min_rtt / 1000.0);
+		out_open("bbr", " bbr:(");
+		out_bw("bw", "bw:%sbps", bw * 8.0);
+		out_float("mrtt", ",mrtt:%g",
+			  (double)s->bbr_info->bbr_min_rtt / 1000.0);
 		if (s->bbr_info->bbr_pacing_gain)
-			out(",pacing_gain:%g",
-			    (double)s->bbr_info->bbr_pacing_gain / 256.0);
+			out_float("pacing_gain", ",pacing_gain:%g",
+				  (double)s->bbr_info->bbr_pacing_gain / 256.0);
 		if (s->bbr_info->bbr_cwnd_gain)
-			out(",cwnd_gain:%g",
-			    (double)s->bbr_info->bbr_cwnd_gain / 256.0);
-		out(")");
+			out_float("cwnd_gain", ",cwnd_gain:%g",
+				  (double)s->bbr_info->bbr_cwnd_gain / 256.0);
+		out_close(")");
 	}
 
 	if (s->send_bps)
-		out(" send %sbps", sprint_bw(b1, s->send_bps));
+		out_bw("send", " send %sbps", s->send_bps);
 	if (s->lastsnd)
-		out(" lastsnd:%u", s->lastsnd);
+		out_uint("lastsnd", " lastsnd:%u", s->lastsnd);
 	if (s->lastrcv)
-		out(" lastrcv:%u", s->lastrcv);
+		out_uint("lastrcv", " lastrcv:%u", s->lastrcv);
 	if (s->lastack)
-		out(" lastack:%u", s->lastack);
+		out_uint("lastack", " lastack:%u", s->lastack);
 
 	if (s->pacing_rate) {
-		out(" pacing_rate %sbps", sprint_bw(b1, s->pacing_rate));
+		out_bw("pacing_rate", " pacing_rate %sbps", s->pacing_rate);
 		if (s->pacing_rate_max)
-			out("/%sbps", sprint_bw(b1, s->pacing_rate_max));
+			out_bw("pacing_rate_max", "/%sbps",
+			       s->pacing_rate_max);
 	}
 
 	if (s->delivery_rate)
-		out(" delivery_rate %sbps", sprint_bw(b1, s->delivery_rate));
+		out_bw("delivery_rate", " delivery_rate %sbps",
+		       s->delivery_rate);
 	if (s->app_limited)
-		out(" app_limited");
+		out_flag("app_limited", " app_limited");
 
 	if (s->busy_time) {
-		out(" busy:%llums", s->busy_time / 1000);
-		if (s->rwnd_limited)
-			out(" rwnd_limited:%llums(%.1f%%)",
-			    s->rwnd_limited / 1000,
-			    100.0 * s->rwnd_limited / s->busy_time);
-		if (s->sndbuf_limited)
-			out(" sndbuf_limited:%llums(%.1f%%)",
-			    s->sndbuf_limited / 1000,
+		out_u64("busy", " busy:%llums", s->busy_time / 1000);
+		if (s->rwnd_limited) {
+			out_u64("rwnd_limited", " rwnd_limited:%llums",
+				s->rwnd_limited / 1000);
+			out("(%.1f%%)", 100.0 * s->rwnd_limited / s->busy_time);
+		}
+		if (s->sndbuf_limited) {
+			out_u64("sndbuf_limited", " sndbuf_limited:%llums",
+				s->sndbuf_limited / 1000);
+			out("(%.1f%%)",
 			    100.0 * s->sndbuf_limited / s->busy_time);
+		}
 	}
 
 	if (s->unacked)
-		out(" unacked:%u", s->unacked);
-	if (s->retrans || s->retrans_total)
-		out(" retrans:%u/%u", s->retrans, s->retrans_total);
+		out_uint("unacked", " unacked:%u", s->unacked);
+	if (s->retrans || s->retrans_total) {
+		out_uint("retrans", " retrans:%u", s->retrans);
+		out_uint("retrans_total", "/%u", s->retrans_total);
+	}
 	if (s->lost)
-		out(" lost:%u", s->lost);
+		out_uint("lost", " lost:%u", s->lost);
 	if (s->sacked && s->ss.state != SS_LISTEN)
-		out(" sacked:%u", s->sacked);
+		out_uint("sacked", " sacked:%u", s->sacked);
 	if (s->fackets)
-		out(" fackets:%u", s->fackets);
+		out_uint("fackets", " fackets:%u", s->fackets);
 	if (s->reordering != 3)
-		out(" reordering:%d", s->reordering);
+		out_int("reordering", " reordering:%d", s->reordering);
 	if (s->rcv_rtt)
-		out(" rcv_rtt:%g", s->rcv_rtt);
+		out_float("rcv_rtt", " rcv_rtt:%g", s->rcv_rtt);
 	if (s->rcv_space)
-		out(" rcv_space:%d", s->rcv_space);
+		out_int("rcv_space", " rcv_space:%d", s->rcv_space);
 	if (s->rcv_ssthresh)
-		out(" rcv_ssthresh:%u", s->rcv_ssthresh);
+		out_uint("rcv_ssthresh", " rcv_ssthresh:%u", s->rcv_ssthresh);
 	if (s->not_sent)
-		out(" notsent:%u", s->not_sent);
+		out_uint("notsent", " notsent:%u", s->not_sent);
 	if (s->min_rtt)
-		out(" minrtt:%g", s->min_rtt);
+		out_float("minrtt", " minrtt:%g", s->min_rtt);
+}
+
+/* a timer: which, when it expires, in ms in JSON, and the retransmits */
+static void out_timer(const char *name, unsigned int timeout, int retrans)
+{
+	if (json) {
+		open_json_object("timer");
+		print_string(PRINT_JSON, "name", NULL, name);
+		print_uint(PRINT_JSON, "expires", NULL, timeout);
+		print_int(PRINT_JSON, "retrans", NULL, retrans);
+		close_json_object();
+	} else {
+		out(" timer:(%s,%s,%d)", name, print_ms_timer(timeout),
+		    retrans);
+	}
 }
 
 static void tcp_timer_print(struct tcpstat *s)
@@ -2540,18 +3765,14 @@ static void tcp_timer_print(struct tcpstat *s)
 	if (s->timer) {
 		if (s->timer > 4)
 			s->timer = 5;
-		out(" timer:(%s,%s,%d)",
-			     tmr_name[s->timer],
-			     print_ms_timer(s->timeout),
-			     s->retrans);
+		out_timer(tmr_name[s->timer], s->timeout, s->retrans);
 	}
 }
 
 static void sctp_timer_print(struct tcpstat *s)
 {
 	if (s->timer)
-		out(" timer:(T3_RTX,%s,%d)",
-		    print_ms_timer(s->timeout), s->retrans);
+		out_timer("T3_RTX", s->timeout, s->retrans);
 }
 
 static int tcp_show_line(char *line, const struct filter *f, int family)
@@ -2559,12 +3780,14 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	int rto = 0, ato = 0;
 	struct tcpstat s = {};
 	char *loc, *rem, *data;
+	const char *p;
 	char opt[256];
 	int n;
 	int hz = get_user_hz();
 
 	if (proc_inet_split_line(line, &loc, &rem, &data))
 		return -1;
+	p = data;
 
 	int state = (data[1] >= 'A') ? (data[1] - 'A' + 10) : (data[1] - '0');
 
@@ -2577,14 +3800,17 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 		return 0;
 
 	opt[0] = 0;
-	n = sscanf(data, "%x %x:%x %x:%x %x %d %d %u %d %llx %d %d %d %u %d %[^\n]\n",
-		   &s.ss.state, &s.ss.wq, &s.ss.rq,
-		   &s.timer, &s.timeout, &s.retrans, &s.ss.uid, &s.probes,
-		   &s.ss.ino, &s.ss.refcnt, &s.ss.sk, &rto, &ato, &s.qack, &s.cwnd,
-		   &s.ssthresh, opt);
-
-	if (n < 17)
-		opt[0] = 0;
+	n = proc_scan(&p, "x x:x x:x x d d d d X d d d d d",
+		      &s.ss.state, &s.ss.wq, &s.ss.rq,
+		      &s.timer, &s.timeout, &s.retrans, &s.ss.uid, &s.probes,
+		      &s.ss.ino, &s.ss.refcnt, &s.ss.sk, &rto, &ato, &s.qack,
+		      &s.cwnd, &s.ssthresh);
+
+	if (n == 16) {
+		while (*p == ' ')
+			p++;
+		snprintf(opt, sizeof(opt), "%s", p);
+	}
 
 	if (n < 12) {
 		rto = 0;
@@ -2602,6 +3828,11 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	s.rto	    = s.rto != 3 * hz  ? s.rto / hz : 0;
 	s.ss.type   = IPPROTO_TCP;
 
+	if (sock_tally) {
+		sock_tally(&s.ss, 0);
+		return 0;
+	}
+
 	inet_stats_print(&s.ss, false);
 
 	if (show_options)
@@ -2610,7 +3841,7 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	if (show_details) {
 		sock_details_print(&s.ss);
 		if (opt[0])
-			out(" opt:\"%s\"", opt);
+			out_str("opt", " opt:\"%s\"", opt);
 	}
 
 	if (show_tcpinfo)
@@ -2619,31 +3850,69 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	return 0;
 }
 
+/*
+ * The file is read in large chunks, the kernel fills as many records
+ * in each as fit, and split in lines here.
+ */
+#define RECORD_CHUNK	(256 * 1024)
+
 static int generic_record_read(FILE *fp,
 			       int (*worker)(char*, const struct filter *, int),
 			       const struct filter *f, int fam)
 {
-	char line[256];
+	size_t len = 0;
+	bool header = true;
+	char *buf;
+	int err = 0;
 
-	/* skip header */
-	if (fgets(line, sizeof(line), fp) == NULL)
-		goto outerr;
+	buf = malloc(RECORD_CHUNK + 1);
+	if (!buf)
+		return -1;
 
-	while (fgets(line, sizeof(line), fp) != NULL) {
-		int n = strlen(line);
+	for (;;) {
+		char *line, *nl;
+		ssize_t n;
 
-		if (n == 0 || line[n-1] != '\n') {
-			errno = -EINVAL;
-			return -1;
+		n = read(fileno(fp), buf + len, RECORD_CHUNK - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			err = -1;
+			break;
+		}
+		if (n == 0) {
+			/* a last line without newline is not a record */
+			if (len) {
+				errno = -EINVAL;
+				err = -1;
+			}
+			break;
+		}
+		len += n;
+		buf[len] = 0;
+
+		for (line = buf; (nl = memchr(line, '\n', buf + len - line));
+		     line = nl + 1) {
+			*nl = 0;
+			if (header) {
+				header = false;
+				continue;
+			}
+			if (worker(line, f, fam) < 0)
+				goto out;
 		}
-		line[n-1] = 0;
 
-		if (worker(line, f, fam) < 0)
-			return 0;
+		len = buf + len - line;
+		if (len == RECORD_CHUNK) {
+			errno = -EINVAL;
+			err = -1;
+			break;
+		}
+		memmove(buf, line, len);
 	}
-outerr:
-
-	return ferror(fp) ? -1 : 0;
+out:
+	free(buf);
+	return err;
 }
 
 static void print_skmeminfo(struct rtattr *tb[], int attrtype)
@@ -2658,44 +3927,54 @@ static void print_skmeminfo(struct rtattr *tb[], int attrtype)
 			const struct inet_diag_meminfo *minfo =
 				RTA_DATA(tb[INET_DIAG_MEMINFO]);
 
-			out(" mem:(r%u,w%u,f%u,t%u)",
-				   minfo->idiag_rmem,
-				   minfo->idiag_wmem,
-				   minfo->idiag_fmem,
-				   minfo->idiag_tmem);
+			out_open("mem", " mem:(");
+			out_uint("r", "r%u", minfo->idiag_rmem);
+			out_uint("w", ",w%u", minfo->idiag_wmem);
+			out_uint("f", ",f%u", minfo->idiag_fmem);
+			out_uint("t", ",t%u", minfo->idiag_tmem);
+			out_close(")");
 		}
 		return;
 	}
 
 	skmeminfo = RTA_DATA(tb[attrtype]);
 
-	out(" skmem:(r%u,rb%u,t%u,tb%u,f%u,w%u,o%u",
-		     skmeminfo[SK_MEMINFO_RMEM_ALLOC],
-		     skmeminfo[SK_MEMINFO_RCVBUF],
-		     skmeminfo[SK_MEMINFO_WMEM_ALLOC],
-		     skmeminfo[SK_MEMINFO_SNDBUF],
-		     skmeminfo[SK_MEMINFO_FWD_ALLOC],
-		     skmeminfo[SK_MEMINFO_WMEM_QUEUED],
-		     skmeminfo[SK_MEMINFO_OPTMEM]);
+	out_open("skmem", " skmem:(");
+	out_uint("r", "r%u", skmeminfo[SK_MEMINFO_RMEM_ALLOC]);
+	out_uint("rb", ",rb%u", skmeminfo[SK_MEMINFO_RCVBUF]);
+	out_uint("t", ",t%u", skmeminfo[SK_MEMINFO_WMEM_ALLOC]);
+	out_uint("tb", ",tb%u", skmeminfo[SK_MEMINFO_SNDBUF]);
+	out_uint("f", ",f%u", skmeminfo[SK_MEMINFO_FWD_ALLOC]);
+	out_uint("w", ",w%u", skmeminfo[SK_MEMINFO_WMEM_QUEUED]);
+	out_uint("o", ",o%u", skmeminfo[SK_MEMINFO_OPTMEM]);
 
 	if (RTA_PAYLOAD(tb[attrtype]) >=
 		(SK_MEMINFO_BACKLOG + 1) * sizeof(__u32))
-		out(",bl%u", skmeminfo[SK_MEMINFO_BACKLOG]);
+		out_uint("bl", ",bl%u", skmeminfo[SK_MEMINFO_BACKLOG]);
 
 	if (RTA_PAYLOAD(tb[attrtype]) >=
 		(SK_MEMINFO_DROPS + 1) * sizeof(__u32))
-		out(",d%u", skmeminfo[SK_MEMINFO_DROPS]);
+		out_uint("d", ",d%u", skmeminfo[SK_MEMINFO_DROPS]);
 
-	out(")");
+	out_close(")");
 }
 
+/* JSON gives the peers that have a key, not the key */
 static void print_md5sig(struct tcp_diag_md5sig *sig)
 {
-	out("%s/%d=",
-	    format_host(sig->tcpm_family,
-			sig->tcpm_family == AF_INET6 ? 16 : 4,
-			&sig->tcpm_addr),
-	    sig->tcpm_prefixlen);
+	const char *addr = format_host(sig->tcpm_family,
+				       sig->tcpm_family == AF_INET6 ? 16 : 4,
+				       &sig->tcpm_addr);
+
+	if (json) {
+		open_json_object(NULL);
+		print_string(PRINT_JSON, "addr", NULL, addr);
+		print_uint(PRINT_JSON, "prefixlen", NULL, sig->tcpm_prefixlen);
+		close_json_object();
+		return;
+	}
+
+	out("%s/%d=", addr, sig->tcpm_prefixlen);
 	print_escape_buf(sig->tcpm_key, sig->tcpm_keylen, " ,");
 }
 
@@ -2841,12 +4120,14 @@ static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r,
 		struct tcp_diag_md5sig *sig = RTA_DATA(tb[INET_DIAG_MD5SIG]);
 		int len = RTA_PAYLOAD(tb[INET_DIAG_MD5SIG]);
 
+		open_json_array(PRINT_JSON, "md5keys");
 		out(" md5keys:");
 		print_md5sig(sig++);
 		for (len -= sizeof(*sig); len > 0; len -= sizeof(*sig)) {
 			out(",");
 			print_md5sig(sig++);
 		}
+		close_json_array(PRINT_JSON, NULL);
 	}
 }
 
@@ -2879,18 +4160,21 @@ static void sctp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r,
 		len = RTA_PAYLOAD(tb[INET_DIAG_LOCALS]);
 		sa = RTA_DATA(tb[INET_DIAG_LOCALS]);
 
-		out("locals:%s", format_host_sa(sa));
+		open_json_array(PRINT_JSON, "locals");
+		out_str(NULL, "locals:%s", format_host_sa(sa));
 		for (sa++, len -= sizeof(*sa); len > 0; sa++, len -= sizeof(*sa))
-			out(",%s", format_host_sa(sa));
-
+			out_str(NULL, ",%s", format_host_sa(sa));
+		close_json_array(PRINT_JSON, NULL);
 	}
 	if (tb[INET_DIAG_PEERS]) {
 		len = RTA_PAYLOAD(tb[INET_DIAG_PEERS]);
 		sa = RTA_DATA(tb[INET_DIAG_PEERS]);
 
-		out(" peers:%s", format_host_sa(sa));
+		open_json_array(PRINT_JSON, "peers");
+		out_str(NULL, " peers:%s", format_host_sa(sa));
 		for (sa++, len -= sizeof(*sa); len > 0; sa++, len -= sizeof(*sa))
-			out(",%s", format_host_sa(sa));
+			out_str(NULL, ",%s", format_host_sa(sa));
+		close_json_array(PRINT_JSON, NULL);
 	}
 	if (tb[INET_DIAG_INFO]) {
 		struct sctp_info *info;
@@ -2957,6 +4241,17 @@ static int inet_show_sock(struct nlmsghdr *nlh,
 	if (tb[INET_DIAG_PROTOCOL])
 		s->type = rta_getattr_u8(tb[INET_DIAG_PROTOCOL]);
 
+	if (sock_tally) {
+		struct tcp_info info = {};
+
+		if (s->type == IPPROTO_TCP && tb[INET_DIAG_INFO])
+			memcpy(&info, RTA_DATA(tb[INET_DIAG_INFO]),
+			       min(RTA_PAYLOAD(tb[INET_DIAG_INFO]),
+				   sizeof(info)));
+		sock_tally(s, info.tcpi_bytes_acked);
+		return 0;
+	}
+
 	if (s->local.family == AF_INET6 && tb[INET_DIAG_SKV6ONLY])
 		v6only = rta_getattr_u8(tb[INET_DIAG_SKV6ONLY]);
 
@@ -2977,15 +4272,10 @@ static int inet_show_sock(struct nlmsghdr *nlh,
 	if (show_details) {
 		sock_details_print(s);
 		if (s->local.family == AF_INET6 && tb[INET_DIAG_SKV6ONLY])
-			out(" v6only:%u", v6only);
-
-		if (tb[INET_DIAG_SHUTDOWN]) {
-			unsigned char mask;
+			out_uint("v6only", " v6only:%u", v6only);
 
-			mask = rta_getattr_u8(tb[INET_DIAG_SHUTDOWN]);
-			out(" %c-%c",
-			    mask & 1 ? '-' : '<', mask & 2 ? '-' : '>');
-		}
+		if (tb[INET_DIAG_SHUTDOWN])
+			shutdown_print(rta_getattr_u8(tb[INET_DIAG_SHUTDOWN]));
 	}
 
 	if (show_mem || (show_tcpinfo && s->type != IPPROTO_UDP)) {
@@ -3037,13 +4327,16 @@ static int tcpdiag_send(int fd, int protocol, struct filter *f)
 		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
 		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
 	}
+	/* --watch takes its deltas from tcp_info, --group-by bytes_acked */
+	if (watch_interval || group.nkeys || sample.interval)
+		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
 
 	iov[0] = (struct iovec){
 		.iov_base = &req,
 		.iov_len = sizeof(req)
 	};
 	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
+		bclen = ssfilter_compile(f->f, &bc);
 		if (bclen) {
 			rta.rta_type = INET_DIAG_REQ_BYTECODE;
 			rta.rta_len = RTA_LENGTH(bclen);
@@ -3097,13 +4390,16 @@ static int sockdiag_send(int family, int fd, int protocol, struct filter *f)
 		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
 		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
 	}
+	/* --watch takes its deltas from tcp_info, --group-by bytes_acked */
+	if (watch_interval || group.nkeys || sample.interval)
+		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
 
 	iov[0] = (struct iovec){
 		.iov_base = &req,
 		.iov_len = sizeof(req)
 	};
 	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
+		bclen = ssfilter_compile(f->f, &bc);
 		if (bclen) {
 			rta.rta_type = INET_DIAG_REQ_BYTECODE;
 			rta.rta_len = RTA_LENGTH(bclen);
@@ -3145,7 +4441,6 @@ static int kill_inet_sock(struct nlmsghdr *h, void *arg, struct sockstat *s)
 
 	req.nlh.nlmsg_type = SOCK_DESTROY;
 	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-	req.nlh.nlmsg_seq = ++rth->seq;
 	req.r.sdiag_family = d->idiag_family;
 	req.r.sdiag_protocol = diag_arg->protocol;
 	req.r.id = d->id;
@@ -3160,6 +4455,87 @@ static int kill_inet_sock(struct nlmsghdr *h, void *arg, struct sockstat *s)
 	return rtnl_talk(rth, &req.nlh, NULL);
 }
 
+/*
+ * With -K on a dump, the destroy requests are pipelined on the kill socket
+ * KILL_WINDOW at a time while the dump goes on. The sockets are held until
+ * their batch is acked, so only those that were closed get printed.
+ */
+#define KILL_WINDOW	256
+
+static struct {
+	struct nlmsghdr	*msgs[KILL_WINDOW];
+	int		err[KILL_WINDOW];
+	unsigned int	count;
+	unsigned int	killed;
+	unsigned int	failed;
+} kill_batch;
+
+static void kill_batch_err(__u32 cookie, int error, void *arg)
+{
+	if (cookie < KILL_WINDOW)
+		kill_batch.err[cookie] = error;
+}
+
+/* Wait for the batch's acks, then print what was closed */
+static int kill_batch_flush(struct inet_diag_arg *diag_arg)
+{
+	int ret = 0, err;
+	unsigned int i;
+
+	if (!kill_batch.count)
+		return 0;
+
+	if (rtnl_async_flush(diag_arg->rth) < 0) {
+		perror("SOCK_DESTROY answers");
+		ret = -1;
+	}
+
+	for (i = 0; i < kill_batch.count; i++) {
+		struct nlmsghdr *h = kill_batch.msgs[i];
+		struct sockstat s = {};
+
+		err = ret ? -EIO : kill_batch.err[i];
+		if (err) {
+			kill_batch.failed++;
+			/* Socket can't be closed, or is already closed. */
+			if (!ret && err != -EOPNOTSUPP && err != -ENOENT) {
+				errno = -err;
+				perror("SOCK_DESTROY answers");
+				ret = -1;
+			}
+		} else {
+			kill_batch.killed++;
+			parse_diag_msg(h, &s);
+			s.type = diag_arg->protocol;
+			inet_show_sock(h, &s);
+		}
+		free(h);
+	}
+	kill_batch.count = 0;
+	return ret;
+}
+
+static int kill_inet_queue(struct nlmsghdr *h, struct inet_diag_arg *diag_arg,
+			   struct sockstat *s)
+{
+	unsigned int slot = kill_batch.count;
+
+	kill_batch.msgs[slot] = malloc(h->nlmsg_len);
+	if (!kill_batch.msgs[slot])
+		abort();
+	memcpy(kill_batch.msgs[slot], h, h->nlmsg_len);
+	kill_batch.err[slot] = 0;
+	kill_batch.count++;
+
+	rtnl_async_cookie(diag_arg->rth, slot);
+	if (kill_inet_sock(h, diag_arg, s) < 0)
+		kill_batch.err[slot] = -errno;
+
+	if (kill_batch.count == KILL_WINDOW)
+		return kill_batch_flush(diag_arg);
+	return 0;
+}
+
 static int show_one_inet_sock(const struct sockaddr_nl *addr,
 		struct nlmsghdr *h, void *arg)
 {
@@ -3177,6 +4553,9 @@ static int show_one_inet_sock(const struct sockaddr_nl *addr,
 	if (diag_arg->f->f && run_ssfilter(diag_arg->f->f, &s) == 0)
 		return 0;
 
+	if (diag_arg->f->kill && diag_arg->rth->async)
+		return kill_inet_queue(h, diag_arg, &s);
+
 	if (diag_arg->f->kill && kill_inet_sock(h, arg, &s) != 0) {
 		if (errno == EOPNOTSUPP || errno == ENOENT) {
 			/* Socket can't be closed, or is already closed. */
@@ -3210,6 +4589,10 @@ static int inet_show_netlink(struct filter *f, FILE *dump_fp, int protocol)
 			return -1;
 		}
 		arg.rth = &rth2;
+		/* if not, one by one as they come */
+		if (rtnl_async_begin(&rth2, KILL_WINDOW, kill_batch_err,
+				     NULL) == 0)
+			rth2.flags |= RTNL_HANDLE_F_ASYNC;
 	}
 
 	rth.dump = MAGIC_SEQ;
@@ -3235,45 +4618,87 @@ again:
 
 Exit:
 	rtnl_close(&rth);
-	if (arg.rth)
+	if (arg.rth) {
+		if (kill_batch_flush(&arg) < 0)
+			err = -1;
 		rtnl_close(arg.rth);
+	}
 	return err;
 }
 
-static int tcp_show_netlink_file(struct filter *f)
+/* The whole of a file, mapped if it can be, read in otherwise */
+static void *file_load(int fd, size_t *len, bool *mapped)
 {
-	FILE	*fp;
-	char	buf[16384];
-	int	err = -1;
+	size_t size = 0;
+	struct stat st;
+	char *buf = NULL;
 
-	if ((fp = fopen(getenv("TCPDIAG_FILE"), "r")) == NULL) {
-		perror("fopen($TCPDIAG_FILE)");
-		return err;
+	*len = 0;
+	*mapped = false;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if (!st.st_size)
+			return NULL;
+		buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE, fd, 0);
+		if (buf != MAP_FAILED) {
+			*len = st.st_size;
+			*mapped = true;
+			return buf;
+		}
+		buf = NULL;
 	}
 
-	while (1) {
-		int status, err2;
-		struct nlmsghdr *h = (struct nlmsghdr *)buf;
-		struct sockstat s = {};
+	for (;;) {
+		ssize_t n;
 
-		status = fread(buf, 1, sizeof(*h), fp);
-		if (status < 0) {
-			perror("Reading header from $TCPDIAG_FILE");
-			break;
+		if (*len == size) {
+			char *p;
+
+			size = size ? 2 * size : 65536;
+			p = realloc(buf, size);
+			if (!p)
+				break;
+			buf = p;
 		}
-		if (status != sizeof(*h)) {
-			perror("Unexpected EOF reading $TCPDIAG_FILE");
+		n = read(fd, buf + *len, size - *len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
 			break;
-		}
+		*len += n;
+	}
+	return buf;
+}
+
+static int tcp_show_netlink_file(struct filter *f)
+{
+	struct nlmsghdr *h;
+	size_t len;
+	bool mapped;
+	char	*buf;
+	int	fd, err = -1;
 
-		status = fread(h+1, 1, NLMSG_ALIGN(h->nlmsg_len-sizeof(*h)), fp);
+	if ((fd = open(getenv("TCPDIAG_FILE"), O_RDONLY)) < 0) {
+		perror("fopen($TCPDIAG_FILE)");
+		return err;
+	}
 
-		if (status < 0) {
-			perror("Reading $TCPDIAG_FILE");
-			break;
-		}
-		if (status + sizeof(*h) < h->nlmsg_len) {
-			perror("Unexpected EOF reading $TCPDIAG_FILE");
+	buf = file_load(fd, &len, &mapped);
+	if (!buf && len) {
+		perror("Reading $TCPDIAG_FILE");
+		close(fd);
+		return err;
+	}
+
+	for (h = (struct nlmsghdr *)buf; ;
+	     h = (void *)h + NLMSG_ALIGN(h->nlmsg_len)) {
+		size_t left = buf + len - (char *)h;
+		struct sockstat s = {};
+		int err2;
+
+		if (left < sizeof(*h) || h->nlmsg_len < sizeof(*h) ||
+		    left < h->nlmsg_len) {
+			fprintf(stderr, "Unexpected EOF reading $TCPDIAG_FILE\n");
 			break;
 		}
 
@@ -3308,7 +4733,11 @@ static int tcp_show_netlink_file(struct filter *f)
 		}
 	}
 
-	fclose(fp);
+	if (mapped)
+		munmap(buf, len);
+	else
+		free(buf);
+	close(fd);
 	return err;
 }
 
@@ -3402,8 +4831,7 @@ static int dgram_show_line(char *line, const struct filter *f, int family)
 {
 	struct sockstat s = {};
 	char *loc, *rem, *data;
-	char opt[256];
-	int n;
+	const char *p;
 
 	if (proc_inet_split_line(line, &loc, &rem, &data))
 		return -1;
@@ -3418,21 +4846,17 @@ static int dgram_show_line(char *line, const struct filter *f, int family)
 	if (f->f && run_ssfilter(f->f, &s) == 0)
 		return 0;
 
-	opt[0] = 0;
-	n = sscanf(data, "%x %x:%x %*x:%*x %*x %d %*d %u %d %llx %[^\n]\n",
-	       &s.state, &s.wq, &s.rq,
-	       &s.uid, &s.ino,
-	       &s.refcnt, &s.sk, opt);
-
-	if (n < 9)
-		opt[0] = 0;
+	p = data;
+	proc_scan(&p, "x x:x -:- - d - d d X",
+		  &s.state, &s.wq, &s.rq, &s.uid, &s.ino, &s.refcnt, &s.sk);
 
 	s.type = dg_proto == UDP_PROTO ? IPPROTO_UDP : 0;
+	if (sock_tally) {
+		sock_tally(&s, 0);
+		return 0;
+	}
 	inet_stats_print(&s, false);
 
-	if (show_details && opt[0])
-		out(" opt:\"%s\"", opt);
-
 	return 0;
 }
 
@@ -3516,15 +4940,114 @@ outerr:
 	} while (0);
 }
 
-#define MAX_UNIX_REMEMBER (1024*1024/sizeof(struct sockstat))
+/*
+ * Unix sockets are indexed by inode to find the name of their peer. The
+ * entries, their names and the saved messages come from an arena that is
+ * freed all at once: there can be hundreds of thousands of them.
+ */
+struct unix_ent {
+	struct unix_ent	*hnext;
+	struct unix_ent	*next;		/* in the order read */
+	const char	*name;
+	unsigned int	ino;
+	int		rport;
+	unsigned int	type;
+	int		state;
+	int		rq, wq;
+	struct nlmsghdr	*nlh;		/* the message, if dumped */
+};
+
+struct unix_index {
+	struct arena	arena;
+	struct unix_ent	**hash;
+	unsigned int	hsize;
+	unsigned int	count;
+	struct unix_ent	*first, **last;
+};
+
+/* --unix-peers: the index of the sockets being dumped */
+static bool show_unix_peers;
+static struct unix_index *unix_peers;
+
+static struct unix_ent *unix_index_new(struct unix_index *ui,
+				       const char *name)
+{
+	struct unix_ent *e = arena_zalloc(&ui->arena, sizeof(*e));
+
+	if (!e)
+		return NULL;
+	if (name && name[0]) {
+		e->name = arena_strdup(&ui->arena, name);
+		if (!e->name)
+			return NULL;
+	}
+	return e;
+}
+
+static int unix_index_add(struct unix_index *ui, struct unix_ent *e)
+{
+	unsigned int i;
+
+	if (ui->count >= ui->hsize) {
+		unsigned int size = ui->hsize ? ui->hsize * 2 : 1024;
+		struct unix_ent **hash = calloc(size, sizeof(*hash));
+
+		if (!hash)
+			return -1;
+		for (i = 0; i < ui->hsize; i++) {
+			while (ui->hash[i]) {
+				struct unix_ent *h = ui->hash[i];
+
+				ui->hash[i] = h->hnext;
+				h->hnext = hash[h->ino & (size - 1)];
+				hash[h->ino & (size - 1)] = h;
+			}
+		}
+		free(ui->hash);
+		ui->hash = hash;
+		ui->hsize = size;
+	}
+
+	i = e->ino & (ui->hsize - 1);
+	e->hnext = ui->hash[i];
+	ui->hash[i] = e;
+	if (!ui->last)
+		ui->last = &ui->first;
+	*ui->last = e;
+	ui->last = &e->next;
+	ui->count++;
+	return 0;
+}
+
+/* the name to print for the peer: "?" if it is not known */
+static char *unix_peer_name(const struct unix_index *ui, unsigned int ino)
+{
+	const struct unix_ent *e;
+
+	if (ui->hsize)
+		for (e = ui->hash[ino & (ui->hsize - 1)]; e; e = e->hnext)
+			if (e->ino == ino)
+				return (char *)(e->name ?: "*");
+	return "?";
+}
+
+static void unix_index_free(struct unix_index *ui)
+{
+	arena_free(&ui->arena);
+	free(ui->hash);
+	memset(ui, 0, sizeof(*ui));
+}
 
-static void unix_list_drop_first(struct sockstat **list)
+static int unix_ent_cmp(const void *a, const void *b)
 {
-	struct sockstat *s = *list;
+	const struct unix_ent *x = *(const struct unix_ent **)a;
+	const struct unix_ent *y = *(const struct unix_ent **)b;
 
-	(*list) = (*list)->next;
-	free(s->name);
-	free(s);
+	if (x->type != y->type)
+		return x->type < y->type ? -1 : 1;
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+	return 0;
 }
 
 static bool unix_type_skip(struct sockstat *s, struct filter *f)
@@ -3552,6 +5075,26 @@ static void unix_stats_print(struct sockstat *s, struct filter *f)
 	proc_ctx_print(s);
 }
 
+/* the name of the socket, with the zeroes of an abstract one as '@' */
+static bool unix_diag_name(struct rtattr *tb[], char *name)
+{
+	int len;
+
+	if (!tb[UNIX_DIAG_NAME])
+		return false;
+
+	len = RTA_PAYLOAD(tb[UNIX_DIAG_NAME]);
+	memcpy(name, RTA_DATA(tb[UNIX_DIAG_NAME]), len);
+	name[len] = '\0';
+	if (name[0] == '\0') {
+		int i;
+		for (i = 0; i < len; i++)
+			if (name[i] == '\0')
+				name[i] = '@';
+	}
+	return true;
+}
+
 static int unix_show_sock(const struct sockaddr_nl *addr, struct nlmsghdr *nlh,
 		void *arg)
 {
@@ -3578,38 +5121,31 @@ static int unix_show_sock(const struct sockaddr_nl *addr, struct nlmsghdr *nlh,
 		stat.rq = rql->udiag_rqueue;
 		stat.wq = rql->udiag_wqueue;
 	}
-	if (tb[UNIX_DIAG_NAME]) {
-		int len = RTA_PAYLOAD(tb[UNIX_DIAG_NAME]);
-
-		memcpy(name, RTA_DATA(tb[UNIX_DIAG_NAME]), len);
-		name[len] = '\0';
-		if (name[0] == '\0') {
-			int i;
-			for (i = 0; i < len; i++)
-				if (name[i] == '\0')
-					name[i] = '@';
-		}
+	if (unix_diag_name(tb, name)) {
 		stat.name = &name[0];
 		memcpy(stat.local.data, &stat.name, sizeof(stat.name));
 	}
-	if (tb[UNIX_DIAG_PEER])
+	if (tb[UNIX_DIAG_PEER]) {
 		stat.rport = rta_getattr_u32(tb[UNIX_DIAG_PEER]);
+		if (unix_peers && stat.rport)
+			stat.peer_name = unix_peer_name(unix_peers, stat.rport);
+	}
 
 	if (f->f && run_ssfilter(f->f, &stat) == 0)
 		return 0;
 
+	if (sock_tally) {
+		sock_tally(&stat, 0);
+		return 0;
+	}
+
 	unix_stats_print(&stat, f);
 
 	if (show_mem)
 		print_skmeminfo(tb, UNIX_DIAG_MEMINFO);
 	if (show_details) {
-		if (tb[UNIX_DIAG_SHUTDOWN]) {
-			unsigned char mask;
-
-			mask = rta_getattr_u8(tb[UNIX_DIAG_SHUTDOWN]);
-			out(" %c-%c",
-			    mask & 1 ? '-' : '<', mask & 2 ? '-' : '>');
-		}
+		if (tb[UNIX_DIAG_SHUTDOWN])
+			shutdown_print(rta_getattr_u8(tb[UNIX_DIAG_SHUTDOWN]));
 	}
 
 	return 0;
@@ -3638,6 +5174,45 @@ Exit:
 	return ret;
 }
 
+/*
+ * The peer of a socket may come later in the dump, so with --unix-peers
+ * the messages are kept in the index and printed once all are in.
+ */
+static int unix_collect_sock(const struct sockaddr_nl *addr,
+			     struct nlmsghdr *nlh, void *arg)
+{
+	struct unix_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[UNIX_DIAG_MAX+1];
+	struct unix_ent *e;
+	char name[128];
+
+	parse_rtattr(tb, UNIX_DIAG_MAX, (struct rtattr *)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+
+	e = unix_index_new(unix_peers, unix_diag_name(tb, name) ? name : NULL);
+	if (!e || !(e->nlh = arena_alloc(&unix_peers->arena, nlh->nlmsg_len)))
+		return -1;
+	memcpy(e->nlh, nlh, nlh->nlmsg_len);
+	e->ino = r->udiag_ino;
+	return unix_index_add(unix_peers, e);
+}
+
+static int unix_show_peers(struct filter *f, struct nlmsghdr *req,
+			   size_t size)
+{
+	struct unix_index ui = {};
+	struct unix_ent *e;
+	int ret;
+
+	unix_peers = &ui;
+	ret = handle_netlink_request(f, req, size, unix_collect_sock);
+	for (e = ui.first; e && !ret; e = e->next)
+		ret = unix_show_sock(NULL, e->nlh, f);
+	unix_peers = NULL;
+	unix_index_free(&ui);
+	return ret;
+}
+
 static int unix_show_netlink(struct filter *f)
 {
 	DIAG_REQUEST(req, struct unix_diag_req r);
@@ -3648,7 +5223,10 @@ static int unix_show_netlink(struct filter *f)
 	if (show_mem)
 		req.r.udiag_show |= UDIAG_SHOW_MEMINFO;
 
-	return handle_netlink_request(f, &req.nlh, sizeof(req), unix_show_sock);
+	if (!show_unix_peers)
+		return handle_netlink_request(f, &req.nlh, sizeof(req),
+					      unix_show_sock);
+	return unix_show_peers(f, &req.nlh, sizeof(req));
 }
 
 static int unix_show(struct filter *f)
@@ -3657,8 +5235,10 @@ static int unix_show(struct filter *f)
 	char buf[256];
 	char name[128];
 	int  newformat = 0;
-	int  cnt;
-	struct sockstat *list = NULL;
+	unsigned int cnt = 0, i;
+	struct unix_index ui = {};
+	struct unix_ent *e, **list = NULL;
+	int ret = -1;
 	const int unix_state_map[] = { SS_CLOSE, SS_SYN_SENT,
 				       SS_ESTABLISHED, SS_CLOSING };
 
@@ -3678,63 +5258,66 @@ static int unix_show(struct filter *f)
 
 	if (memcmp(buf, "Peer", 4) == 0)
 		newformat = 1;
-	cnt = 0;
 
+	/*
+	 * All sockets go into the index, those that are not shown too:
+	 * they may still be the peer of some that are.
+	 */
 	while (fgets(buf, sizeof(buf), fp)) {
-		struct sockstat *u, **insp;
-		int flags;
+		unsigned int rport = 0, rq = 0, wq = 0, type = 0, state = 0;
+		unsigned int ino = 0;
+		int flags = 0;
 
-		if (!(u = calloc(1, sizeof(*u))))
-			break;
-
-		if (sscanf(buf, "%x: %x %x %x %x %x %d %s",
-			   &u->rport, &u->rq, &u->wq, &flags, &u->type,
-			   &u->state, &u->ino, name) < 8)
+		if (sscanf(buf, "%x: %x %x %x %x %x %u %s", &rport, &rq, &wq,
+			   &flags, &type, &state, &ino, name) < 8)
 			name[0] = 0;
 
-		u->lport = u->ino;
-		u->local.family = u->remote.family = AF_UNIX;
+		e = unix_index_new(&ui, name);
+		if (!e || unix_index_add(&ui, e))
+			goto out;
 
+		e->ino = ino;
+		e->type = type;
+		e->rport = newformat ? rport : 0;
+		e->rq = newformat ? rq : 0;
+		e->wq = newformat ? wq : 0;
+		e->state = state;
 		if (flags & (1 << 16)) {
-			u->state = SS_LISTEN;
-		} else if (u->state > 0 &&
-			   u->state <= ARRAY_SIZE(unix_state_map)) {
-			u->state = unix_state_map[u->state-1];
-			if (u->type == SOCK_DGRAM && u->state == SS_CLOSE && u->rport)
-				u->state = SS_ESTABLISHED;
-		}
-		if (unix_type_skip(u, f) ||
-		    !(f->states & (1 << u->state))) {
-			free(u);
-			continue;
-		}
-
-		if (!newformat) {
-			u->rport = 0;
-			u->rq = 0;
-			u->wq = 0;
-		}
-
-		if (name[0]) {
-			u->name = strdup(name);
-			if (!u->name) {
-				free(u);
-				break;
-			}
+			e->state = SS_LISTEN;
+		} else if (state > 0 && state <= ARRAY_SIZE(unix_state_map)) {
+			e->state = unix_state_map[state-1];
+			if (type == SOCK_DGRAM && e->state == SS_CLOSE && rport)
+				e->state = SS_ESTABLISHED;
 		}
+	}
 
-		if (u->rport) {
-			struct sockstat *p;
+	list = calloc(ui.count ?: 1, sizeof(*list));
+	if (!list)
+		goto out;
+	for (e = ui.first; e; e = e->next) {
+		struct sockstat st = { .type = e->type, .state = e->state };
+
+		if (!unix_type_skip(&st, f) && (f->states & (1 << e->state)))
+			list[cnt++] = e;
+	}
+	qsort(list, cnt, sizeof(*list), unix_ent_cmp);
+
+	for (i = 0; i < cnt; i++) {
+		struct sockstat u = {
+			.type		= list[i]->type,
+			.state		= list[i]->state,
+			.ino		= list[i]->ino,
+			.lport		= list[i]->ino,
+			.rport		= list[i]->rport,
+			.rq		= list[i]->rq,
+			.wq		= list[i]->wq,
+			.name		= (char *)list[i]->name,
+			.local.family	= AF_UNIX,
+			.remote.family	= AF_UNIX,
+		};
 
-			for (p = list; p; p = p->next) {
-				if (u->rport == p->lport)
-					break;
-			}
-			if (!p)
-				u->peer_name = "?";
-			else
-				u->peer_name = p->name ? : "*";
-		}
+		if (u.rport)
+			u.peer_name = unix_peer_name(&ui, u.rport);
 
 		if (f->f) {
 			struct sockstat st = {
@@ -3742,46 +5325,29 @@ static int unix_show(struct filter *f)
 				.remote.family = AF_UNIX,
 			};
 
-			memcpy(st.local.data, &u->name, sizeof(u->name));
+			memcpy(st.local.data, &u.name, sizeof(u.name));
 			/* when parsing the old format rport is set to 0 and
 			 * therefore peer_name remains NULL
 			 */
-			if (u->peer_name && strcmp(u->peer_name, "*"))
-				memcpy(st.remote.data, &u->peer_name,
-				       sizeof(u->peer_name));
-			if (run_ssfilter(f->f, &st) == 0) {
-				free(u->name);
-				free(u);
+			if (u.peer_name && strcmp(u.peer_name, "*"))
+				memcpy(st.remote.data, &u.peer_name,
+				       sizeof(u.peer_name));
+			if (run_ssfilter(f->f, &st) == 0)
 				continue;
-			}
-		}
-
-		insp = &list;
-		while (*insp) {
-			if (u->type < (*insp)->type ||
-			    (u->type == (*insp)->type &&
-			     u->ino < (*insp)->ino))
-				break;
-			insp = &(*insp)->next;
 		}
-		u->next = *insp;
-		*insp = u;
 
-		if (++cnt > MAX_UNIX_REMEMBER) {
-			while (list) {
-				unix_stats_print(list, f);
-				unix_list_drop_first(&list);
-			}
-			cnt = 0;
+		if (sock_tally) {
+			sock_tally(&u, 0);
+			continue;
 		}
+		unix_stats_print(&u, f);
 	}
+	ret = 0;
+out:
 	fclose(fp);
-	while (list) {
-		unix_stats_print(list, f);
-		unix_list_drop_first(&list);
-	}
-
-	return 0;
+	free(list);
+	unix_index_free(&ui);
+	return ret;
 }
 
 static int packet_stats_print(struct sockstat *s, const struct filter *f)
@@ -3822,12 +5388,12 @@ static int packet_stats_print(struct sockstat *s, const struct filter *f)
 
 static void packet_show_ring(struct packet_diag_ring *ring)
 {
-	out("blk_size:%d", ring->pdr_block_size);
-	out(",blk_nr:%d", ring->pdr_block_nr);
-	out(",frm_size:%d", ring->pdr_frame_size);
-	out(",frm_nr:%d", ring->pdr_frame_nr);
-	out(",tmo:%d", ring->pdr_retire_tmo);
-	out(",features:0x%x", ring->pdr_features);
+	out_uint("blk_size", "blk_size:%d", ring->pdr_block_size);
+	out_uint("blk_nr", ",blk_nr:%d", ring->pdr_block_nr);
+	out_uint("frm_size", ",frm_size:%d", ring->pdr_frame_size);
+	out_uint("frm_nr", ",frm_nr:%d", ring->pdr_frame_nr);
+	out_uint("tmo", ",tmo:%d", ring->pdr_retire_tmo);
+	out_uint("features", ",features:0x%x", ring->pdr_features);
 }
 
 static int packet_show_sock(const struct sockaddr_nl *addr,
@@ -3885,56 +5451,51 @@ static int packet_show_sock(const struct sockaddr_nl *addr,
 
 	if (show_details) {
 		if (pinfo) {
-			out("\n\tver:%d", pinfo->pdi_version);
-			out(" cpy_thresh:%d", pinfo->pdi_copy_thresh);
+			out_int("ver", "\n\tver:%d", pinfo->pdi_version);
+			out_int("cpy_thresh", " cpy_thresh:%d",
+				pinfo->pdi_copy_thresh);
+			open_json_array(PRINT_JSON, "flags");
 			out(" flags( ");
 			if (pinfo->pdi_flags & PDI_RUNNING)
-				out("running");
+				out_str(NULL, "%s", "running");
 			if (pinfo->pdi_flags & PDI_AUXDATA)
-				out(" auxdata");
+				out_str(NULL, " %s", "auxdata");
 			if (pinfo->pdi_flags & PDI_ORIGDEV)
-				out(" origdev");
+				out_str(NULL, " %s", "origdev");
 			if (pinfo->pdi_flags & PDI_VNETHDR)
-				out(" vnethdr");
+				out_str(NULL, " %s", "vnethdr");
 			if (pinfo->pdi_flags & PDI_LOSS)
-				out(" loss");
+				out_str(NULL, " %s", "loss");
 			if (!pinfo->pdi_flags)
 				out("0");
 			out(" )");
+			close_json_array(PRINT_JSON, NULL);
 		}
 		if (ring_rx) {
-			out("\n\tring_rx(");
+			out_open("ring_rx", "\n\tring_rx(");
 			packet_show_ring(ring_rx);
-			out(")");
+			out_close(")");
 		}
 		if (ring_tx) {
-			out("\n\tring_tx(");
+			out_open("ring_tx", "\n\tring_tx(");
 			packet_show_ring(ring_tx);
-			out(")");
+			out_close(")");
 		}
 		if (has_fanout) {
+			static const char * const fanout_type[] = {
+				"hash", "lb", "cpu", "roll", "random", "qm",
+			};
 			uint16_t type = (fanout >> 16) & 0xffff;
 
-			out("\n\tfanout(");
-			out("id:%d,", fanout & 0xffff);
-			out("type:");
-
-			if (type == 0)
-				out("hash");
-			else if (type == 1)
-				out("lb");
-			else if (type == 2)
-				out("cpu");
-			else if (type == 3)
-				out("roll");
-			else if (type == 4)
-				out("random");
-			else if (type == 5)
-				out("qm");
+			out_open("fanout", "\n\tfanout(");
+			out_uint("id", "id:%d,", fanout & 0xffff);
+
+			if (type < ARRAY_SIZE(fanout_type))
+				out_str("type", "type:%s", fanout_type[type]);
 			else
-				out("0x%x", type);
+				out_uint("type", "type:0x%x", type);
 
-			out(")");
+			out_close(")");
 		}
 	}
 
@@ -3944,13 +5505,23 @@ static int packet_show_sock(const struct sockaddr_nl *addr,
 		int num = RTA_PAYLOAD(tb[PACKET_DIAG_FILTER]) /
 			  sizeof(struct sock_filter);
 
+		open_json_array(PRINT_JSON, "bpf");
 		out("\n\tbpf filter (%d): ", num);
 		while (num) {
+			if (json) {
+				open_json_object(NULL);
+				print_hu(PRINT_JSON, "code", NULL, fil->code);
+				print_uint(PRINT_JSON, "jt", NULL, fil->jt);
+				print_uint(PRINT_JSON, "jf", NULL, fil->jf);
+				print_uint(PRINT_JSON, "k", NULL, fil->k);
+				close_json_object();
+			}
 			out(" 0x%02x %u %u %u,",
 			    fil->code, fil->jt, fil->jf, fil->k);
 			num--;
 			fil++;
 		}
+		close_json_array(PRINT_JSON, NULL);
 	}
 
 	if (show_mem)
@@ -4109,12 +5680,15 @@ static int netlink_show_one(struct filter *f,
 		else if (pid > 0)
 			getpidcon(pid, &pid_context);
 
-		out(" proc_ctx=%s", pid_context ? : "unavailable");
+		out_str("proc_ctx", " proc_ctx=%s",
+			pid_context ? : "unavailable");
 		free(pid_context);
 	}
 
 	if (show_details) {
-		out(" sk=%llx cb=%llx groups=0x%08x", sk, cb, groups);
+		out_u64("sk", " sk=%llx", sk);
+		out_u64("cb", " cb=%llx", cb);
+		out_uint("groups", " groups=0x%08x", groups);
 	}
 
 	return 0;
@@ -4353,20 +5927,24 @@ static int tipc_show_sock(const struct sockaddr_nl *addr, struct nlmsghdr *nlh,
 	proc_ctx_print(&ss);
 
 	if (show_tipcinfo) {
-		out("\n type:%s", stype_nameg[ss.type]);
-		out(" cong:%s ",
+		out_str("type", "\n type:%s", stype_nameg[ss.type]);
+		out_str("cong", " cong:%s ",
 		       stat[TIPC_NLA_SOCK_STAT_LINK_CONG] ? "link" :
 		       stat[TIPC_NLA_SOCK_STAT_CONN_CONG] ? "conn" : "none");
-		out(" drop:%d ",
+		out_uint("drop", " drop:%d ",
 		       rta_getattr_u32(stat[TIPC_NLA_SOCK_STAT_DROP]));
 
 		if (attrs[TIPC_NLA_SOCK_HAS_PUBL])
-			out(" publ");
-
-		if (con[TIPC_NLA_CON_FLAG])
-			out(" via {%u,%u} ",
-			       rta_getattr_u32(con[TIPC_NLA_CON_TYPE]),
-			       rta_getattr_u32(con[TIPC_NLA_CON_INST]));
+			out_flag("publ", " publ");
+
+		if (con[TIPC_NLA_CON_FLAG]) {
+			out_open("via", " via {");
+			out_uint("type", "%u",
+				 rta_getattr_u32(con[TIPC_NLA_CON_TYPE]));
+			out_uint("inst", ",%u} ",
+				 rta_getattr_u32(con[TIPC_NLA_CON_INST]));
+			out_close("");
+		}
 	}
 
 	return 0;
@@ -4383,63 +5961,454 @@ static int tipc_show(struct filter *f)
 	return handle_netlink_request(f, &req.nlh, sizeof(req), tipc_show_sock);
 }
 
-struct sock_diag_msg {
-	__u8 sdiag_family;
+/*
+ * Every socket table requested, and each inet family of it, is dumped
+ * by a child of its own, all of them at the same time, with their lines
+ * sent back through a pipe and taken in the usual order, or as they come
+ * with --unordered. The first unfinished dump is taken as it arrives, the
+ * others are held until their turn, unless --stream bounds the memory:
+ * then those are only read once it is their turn, and meanwhile they run
+ * until their pipe is full.
+ */
+/* Only the tables that get big are also split by family, in the others a
+ * missing protocol would just be complained about twice.
+ */
+struct show_job {
+	int		(*show)(struct filter *f);
+	int		family;	/* the only inet family dumped, or AF_UNSPEC */
+	const char	*netns;	/* all tables of it, see show_netns_all() */
+	pid_t		pid;
+	int		fd;	/* read end of its frames, -1 once closed */
+	char		*out;
+	size_t		len;
+	size_t		size;
+	bool		done;
 };
 
-static int generic_show_sock(const struct sockaddr_nl *addr,
-		struct nlmsghdr *nlh, void *arg)
+#define SHOW_JOBS_MAX	16
+
+static void show_job_add(struct show_job *jobs, unsigned int *n,
+			 struct filter *f, int (*show)(struct filter *f),
+			 bool split)
 {
-	struct sock_diag_msg *r = NLMSG_DATA(nlh);
-	struct inet_diag_arg inet_arg = { .f = arg, .protocol = IPPROTO_MAX };
-	int ret;
+	bool v4 = filter_af_get(f, AF_INET), v6 = filter_af_get(f, AF_INET6);
 
-	switch (r->sdiag_family) {
-	case AF_INET:
-	case AF_INET6:
-		inet_arg.rth = inet_arg.f->rth_for_killing;
-		ret = show_one_inet_sock(addr, nlh, &inet_arg);
-		break;
-	case AF_UNIX:
-		ret = unix_show_sock(addr, nlh, arg);
-		break;
-	case AF_PACKET:
-		ret = packet_show_sock(addr, nlh, arg);
-		break;
-	case AF_NETLINK:
-		ret = netlink_show_sock(addr, nlh, arg);
-		break;
-	case AF_VSOCK:
-		ret = vsock_show_sock(addr, nlh, arg);
-		break;
-	default:
-		ret = -1;
+	/* a saved dump is read whole, whatever the family */
+	if (split && v4 && v6 && !getenv("TCPDIAG_FILE")) {
+		jobs[(*n)++] = (struct show_job){ .show = show, .family = AF_INET };
+		jobs[(*n)++] = (struct show_job){ .show = show, .family = AF_INET6 };
+		return;
 	}
+	jobs[(*n)++] = (struct show_job){ .show = show, .family = AF_UNSPEC };
+}
 
-	render();
+static void show_job_run(struct show_job *job, struct filter *f)
+{
+	int families = f->families, family = preferred_family;
 
-	return ret;
+	if (job->family != AF_UNSPEC) {
+		f->families &= FAMILY_MASK(job->family);
+		preferred_family = job->family;
+	}
+	job->show(f);
+	f->families = families;
+	preferred_family = family;
 }
 
-static int handle_follow_request(struct filter *f)
+static void show_all(struct filter *f);
+
+/* In a child: only its network namespace is entered, not its mounts */
+static void netns_job_run(struct show_job *job, struct filter *f)
 {
-	int ret = 0;
-	int groups = 0;
-	struct rtnl_handle rth, rth2;
+	int fd = netns_get_fd(job->netns);
 
-	if (f->families & FAMILY_MASK(AF_INET) && f->dbs & (1 << TCP_DB))
-		groups |= 1 << (SKNLGRP_INET_TCP_DESTROY - 1);
-	if (f->families & FAMILY_MASK(AF_INET) && f->dbs & (1 << UDP_DB))
-		groups |= 1 << (SKNLGRP_INET_UDP_DESTROY - 1);
-	if (f->families & FAMILY_MASK(AF_INET6) && f->dbs & (1 << TCP_DB))
-		groups |= 1 << (SKNLGRP_INET6_TCP_DESTROY - 1);
-	if (f->families & FAMILY_MASK(AF_INET6) && f->dbs & (1 << UDP_DB))
-		groups |= 1 << (SKNLGRP_INET6_UDP_DESTROY - 1);
+	if (fd < 0 || setns(fd, CLONE_NEWNET) < 0) {
+		fprintf(stderr, "ss: cannot enter netns \"%s\": %s\n",
+			job->netns, strerror(errno));
+		return;
+	}
+	close(fd);
 
-	if (groups == 0)
-		return -1;
+	ss_netns = job->netns;
+	show_sequential = 1;
+	show_all(f);
+}
 
-	if (rtnl_open_byproto(&rth, groups, NETLINK_SOCK_DIAG))
+static int show_job_start(struct show_job *jobs, unsigned int n,
+			  struct filter *f)
+{
+	struct show_job *job = &jobs[n];
+	int pfd[2];
+
+	if (pipe2(pfd, O_CLOEXEC) < 0) {
+		perror("ss: pipe");
+		return -1;
+	}
+
+	fflush(NULL);
+	job->pid = fork();
+	if (job->pid < 0) {
+		perror("ss: fork");
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+
+	if (job->pid == 0) {
+		/* only the parent may read, or writers outlive it blocked */
+		while (n--)
+			if (jobs[n].fd >= 0)
+				close(jobs[n].fd);
+		close(pfd[0]);
+		/* by job number: for --all-netns those running are close */
+		jobs_pin(job - jobs);
+
+		ship_fd = pfd[1];
+		/* whole NDJSON lines need no frames */
+		if (json && dup2(ship_fd, STDOUT_FILENO) < 0)
+			_iprt_exit(1);
+		stream_lines = SHIP_LINES;
+		buffer.head = NULL;
+		buffer.lines = 0;
+		current_field = columns;
+
+		if (job->netns)
+			netns_job_run(job, f);
+		else
+			show_job_run(job, f);
+		render();
+		fflush(stdout);
+		_iprt_exit(0);
+	}
+
+	close(pfd[1]);
+	job->fd = pfd[0];
+	return 0;
+}
+
+/* Replay the complete frames read so far, or with -j the lines */
+static void show_job_replay(struct show_job *job)
+{
+	size_t pos = 0;
+
+	if (json) {
+		char *nl = memrchr(job->out, '\n', job->len);
+
+		if (nl)
+			pos = nl + 1 - job->out;
+		fwrite(job->out, 1, pos, stdout);
+		memmove(job->out, job->out + pos, job->len - pos);
+		job->len -= pos;
+		return;
+	}
+
+	while (job->len - pos >= sizeof(uint32_t)) {
+		uint32_t flen;
+
+		memcpy(&flen, job->out + pos, sizeof(flen));
+		if (job->len - pos - sizeof(flen) < flen)
+			break;
+		ship_replay(job->out + pos + sizeof(flen), flen);
+		pos += sizeof(flen) + flen;
+	}
+	memmove(job->out, job->out + pos, job->len - pos);
+	job->len -= pos;
+}
+
+/* read what there is, replaying it unless held */
+static void show_job_read(struct show_job *job, bool hold)
+{
+	ssize_t n;
+
+	if (job->len == job->size) {
+		size_t size = job->size ? 2 * job->size : 65536;
+		char *p = realloc(job->out, size);
+
+		if (!p)
+			abort();
+		job->out = p;
+		job->size = size;
+	}
+
+	n = read(job->fd, job->out + job->len, job->size - job->len);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (n > 0) {
+		job->len += n;
+		if (!hold)
+			show_job_replay(job);
+		return;
+	}
+
+	close(job->fd);
+	job->fd = -1;
+	while (waitpid(job->pid, NULL, 0) < 0 && errno == EINTR)
+		;
+	job->done = true;
+}
+
+static void show_all(struct filter *f)
+{
+	struct show_job jobs[SHOW_JOBS_MAX];
+	struct pollfd pfds[SHOW_JOBS_MAX];
+	unsigned int njobs = 0, started, emitted = 0, i;
+
+	if (f->dbs & (1<<NETLINK_DB))
+		show_job_add(jobs, &njobs, f, netlink_show, false);
+	if (f->dbs & PACKET_DBM)
+		show_job_add(jobs, &njobs, f, packet_show, false);
+	if (f->dbs & UNIX_DBM)
+		show_job_add(jobs, &njobs, f, unix_show, false);
+	if (f->dbs & (1<<RAW_DB))
+		show_job_add(jobs, &njobs, f, raw_show, false);
+	if (f->dbs & (1<<UDP_DB))
+		show_job_add(jobs, &njobs, f, udp_show, true);
+	if (f->dbs & (1<<TCP_DB))
+		show_job_add(jobs, &njobs, f, tcp_show, true);
+	if (f->dbs & (1<<DCCP_DB))
+		show_job_add(jobs, &njobs, f, dccp_show, false);
+	if (f->dbs & (1<<SCTP_DB))
+		show_job_add(jobs, &njobs, f, sctp_show, false);
+	if (f->dbs & VSOCK_DBM)
+		show_job_add(jobs, &njobs, f, vsock_show, false);
+	if (f->dbs & (1<<TIPC_DB))
+		show_job_add(jobs, &njobs, f, tipc_show, false);
+
+	/* the children's netlink counters would be lost to --stats-netlink
+	 * and --timing,
+	 * and their kill counts to -K
+	 */
+	if (njobs <= 1 || show_sequential || f->kill) {
+		for (i = 0; i < njobs; i++)
+			show_job_run(&jobs[i], f);
+		return;
+	}
+
+	for (started = 0; started < njobs; started++) {
+		jobs[started].fd = -1;
+		if (show_job_start(jobs, started, f) < 0)
+			break;
+	}
+
+	while (emitted < started) {
+		bool held = stream_lines && !show_unordered;
+		unsigned int npfd = 0;
+
+		for (i = emitted; i < started; i++) {
+			if (jobs[i].fd < 0 || (held && i != emitted))
+				continue;
+			pfds[npfd].fd = jobs[i].fd;
+			pfds[npfd++].events = POLLIN;
+		}
+		if (npfd && poll(pfds, npfd, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("ss: poll");
+			break;
+		}
+		for (i = emitted, npfd = 0; i < started; i++) {
+			if (jobs[i].fd < 0 || (held && i != emitted))
+				continue;
+			if (pfds[npfd++].revents)
+				show_job_read(&jobs[i],
+					      i != emitted && !show_unordered);
+		}
+
+		for (; emitted < started && jobs[emitted].done; emitted++) {
+			show_job_replay(&jobs[emitted]);
+			free(jobs[emitted].out);
+			jobs[emitted].out = NULL;
+			/* the next one was held, take what it has sent */
+			if (emitted + 1 < started)
+				show_job_replay(&jobs[emitted + 1]);
+		}
+	}
+
+	/* only left running if poll() failed */
+	for (i = emitted; i < started; i++) {
+		if (jobs[i].fd >= 0) {
+			close(jobs[i].fd);
+			waitpid(jobs[i].pid, NULL, 0);
+		}
+		free(jobs[i].out);
+	}
+
+	/* those that could not be started are dumped here */
+	for (i = started; i < njobs; i++)
+		show_job_run(&jobs[i], f);
+}
+
+/*
+ * --all-netns: each namespace is dumped by a child of its own, its tables
+ * one after the other, with at most netns_jobs of them running. Their
+ * lines come back as those of show_all()'s children do, in the order of
+ * the names of the namespaces, or as they come with --unordered; those
+ * of a child finished before its turn are held until then.
+ */
+static void show_netns_all(struct filter *f)
+{
+	unsigned int count = 0, started = 0, running = 0, emitted = 0, i;
+	struct show_job *jobs;
+	struct pollfd *pfds;
+	char **names;
+
+	names = netns_names(&count);
+	if (!names) {
+		fprintf(stderr, "ss: cannot list %s: %s\n", NETNS_RUN_DIR,
+			strerror(errno));
+		return;
+	}
+	jobs = calloc(count ? : 1, sizeof(*jobs));
+	pfds = calloc(netns_jobs, sizeof(*pfds));
+	if (!jobs || !pfds)
+		abort();
+	for (i = 0; i < count; i++)
+		jobs[i] = (struct show_job){ .netns = names[i], .fd = -1 };
+
+	while (emitted < count) {
+		unsigned int npfd = 0;
+
+		for (; running < netns_jobs && started < count; started++) {
+			if (show_job_start(jobs, started, f) < 0)
+				jobs[started].done = true;
+			else
+				running++;
+		}
+
+		for (i = emitted; i < started; i++) {
+			if (jobs[i].fd < 0)
+				continue;
+			pfds[npfd].fd = jobs[i].fd;
+			pfds[npfd++].events = POLLIN;
+		}
+		if (npfd && poll(pfds, npfd, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("ss: poll");
+			break;
+		}
+		for (i = emitted, npfd = 0; i < started; i++) {
+			if (jobs[i].fd < 0)
+				continue;
+			if (!pfds[npfd++].revents)
+				continue;
+			show_job_read(&jobs[i], i != emitted && !show_unordered);
+			if (jobs[i].done)
+				running--;
+		}
+
+		for (; emitted < started && jobs[emitted].done; emitted++) {
+			show_job_replay(&jobs[emitted]);
+			free(jobs[emitted].out);
+			jobs[emitted].out = NULL;
+			if (emitted + 1 < started)
+				show_job_replay(&jobs[emitted + 1]);
+		}
+	}
+
+	/* only left running if poll() failed */
+	for (i = emitted; i < started; i++) {
+		if (jobs[i].fd >= 0) {
+			close(jobs[i].fd);
+			waitpid(jobs[i].pid, NULL, 0);
+		}
+		free(jobs[i].out);
+	}
+	free(pfds);
+	free(jobs);
+	netns_names_free(names, count);
+}
+
+static void resolve_sock(const struct sockstat *s, __u64 bytes_acked)
+{
+	int len = s->local.family == AF_INET ? 4 : 16;
+
+	if (s->local.family != AF_INET && s->local.family != AF_INET6)
+		return;
+	resolve_host_queue(s->local.family, len, s->local.data);
+	resolve_host_queue(s->remote.family, len, s->remote.data);
+}
+
+/*
+ * With -r, a first pass over the TCP and UDP tables only takes their
+ * addresses, so that the names are looked up in parallel before the
+ * sockets are printed, not one at a time as they are. What turns up
+ * in between is looked up as it comes.
+ */
+static void resolve_prefetch(struct filter *f)
+{
+	int dbs = f->dbs, sequential = show_sequential;
+
+	f->dbs &= (1<<TCP_DB) | (1<<UDP_DB);
+	if (f->dbs) {
+		/* the children's queues would be lost */
+		show_sequential = 1;
+		sock_tally = resolve_sock;
+		show_all(f);
+		sock_tally = NULL;
+		show_sequential = sequential;
+		resolve_host_flush();
+	}
+	f->dbs = dbs;
+}
+
+struct sock_diag_msg {
+	__u8 sdiag_family;
+};
+
+static int generic_show_sock(const struct sockaddr_nl *addr,
+		struct nlmsghdr *nlh, void *arg)
+{
+	struct sock_diag_msg *r = NLMSG_DATA(nlh);
+	struct inet_diag_arg inet_arg = { .f = arg, .protocol = IPPROTO_MAX };
+	int ret;
+
+	switch (r->sdiag_family) {
+	case AF_INET:
+	case AF_INET6:
+		inet_arg.rth = inet_arg.f->rth_for_killing;
+		ret = show_one_inet_sock(addr, nlh, &inet_arg);
+		break;
+	case AF_UNIX:
+		ret = unix_show_sock(addr, nlh, arg);
+		break;
+	case AF_PACKET:
+		ret = packet_show_sock(addr, nlh, arg);
+		break;
+	case AF_NETLINK:
+		ret = netlink_show_sock(addr, nlh, arg);
+		break;
+	case AF_VSOCK:
+		ret = vsock_show_sock(addr, nlh, arg);
+		break;
+	default:
+		ret = -1;
+	}
+
+	render();
+
+	return ret;
+}
+
+static int handle_follow_request(struct filter *f)
+{
+	int ret = 0;
+	int groups = 0;
+	struct rtnl_handle rth, rth2;
+
+	if (f->families & FAMILY_MASK(AF_INET) && f->dbs & (1 << TCP_DB))
+		groups |= 1 << (SKNLGRP_INET_TCP_DESTROY - 1);
+	if (f->families & FAMILY_MASK(AF_INET) && f->dbs & (1 << UDP_DB))
+		groups |= 1 << (SKNLGRP_INET_UDP_DESTROY - 1);
+	if (f->families & FAMILY_MASK(AF_INET6) && f->dbs & (1 << TCP_DB))
+		groups |= 1 << (SKNLGRP_INET6_TCP_DESTROY - 1);
+	if (f->families & FAMILY_MASK(AF_INET6) && f->dbs & (1 << UDP_DB))
+		groups |= 1 << (SKNLGRP_INET6_UDP_DESTROY - 1);
+
+	if (groups == 0)
+		return -1;
+
+	if (rtnl_open_byproto(&rth, groups, NETLINK_SOCK_DIAG))
 		return -1;
 
 	rth.dump = 0;
@@ -4462,6 +6431,464 @@ static int handle_follow_request(struct filter *f)
 	return ret;
 }
 
+/*
+ * --watch keeps the TCP and UDP sockets the filter selects in a table
+ * keyed by their cookie. Destroy events take closed sockets out as they
+ * come; every interval a dump finds the new ones, state changes and how
+ * far the TCP counters went, and drops those it no longer sees, such as
+ * the ones whose destroy event was lost. Sockets that moved are printed
+ * with their deltas, under a line of counts.
+ */
+struct watch_ent {
+	struct watch_ent	*next;
+	unsigned long long	cookie;
+	__u64			bytes_acked;
+	__u64			bytes_received;
+	__u32			retrans;
+	unsigned int		gen;	/* of the last dump it was in */
+	int			state;
+};
+
+static struct {
+	struct watch_ent	**hash;
+	unsigned int		size;	/* a power of two */
+	unsigned int		count;
+	unsigned int		gen;
+	unsigned int		new, closed, changed, printed;
+} watch;
+
+
+static unsigned int watch_hashfn(unsigned long long cookie)
+{
+	return (cookie * 0x9e3779b97f4a7c15ULL >> 32) & (watch.size - 1);
+}
+
+static struct watch_ent **watch_find(unsigned long long cookie)
+{
+	struct watch_ent **pp = &watch.hash[watch_hashfn(cookie)];
+
+	while (*pp && (*pp)->cookie != cookie)
+		pp = &(*pp)->next;
+	return pp;
+}
+
+static void watch_grow(void)
+{
+	struct watch_ent **old = watch.hash;
+	unsigned int i, size = watch.size;
+
+	watch.size = size ? 2 * size : 1024;
+	watch.hash = calloc(watch.size, sizeof(*watch.hash));
+	if (!watch.hash)
+		abort();
+
+	for (i = 0; i < size; i++) {
+		while (old[i]) {
+			struct watch_ent *e = old[i];
+			struct watch_ent **pp = &watch.hash[watch_hashfn(e->cookie)];
+
+			old[i] = e->next;
+			e->next = *pp;
+			*pp = e;
+		}
+	}
+	free(old);
+}
+
+static int watch_inet_sock(const struct sockaddr_nl *addr,
+			   struct nlmsghdr *h, void *arg)
+{
+	struct inet_diag_arg *diag_arg = arg;
+	struct inet_diag_msg *r = NLMSG_DATA(h);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct tcp_info info = {};
+	struct watch_ent *e, **pp;
+	struct sockstat s = {};
+	__u64 acked, received;
+	__u32 retrans;
+
+	if (!(diag_arg->f->families & FAMILY_MASK(r->idiag_family)))
+		return 0;
+
+	parse_diag_msg(h, &s);
+	s.type = diag_arg->protocol;
+
+	if (diag_arg->f->f && run_ssfilter(diag_arg->f->f, &s) == 0)
+		return 0;
+
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
+		     h->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb[INET_DIAG_INFO])
+		memcpy(&info, RTA_DATA(tb[INET_DIAG_INFO]),
+		       min(RTA_PAYLOAD(tb[INET_DIAG_INFO]), sizeof(info)));
+
+	pp = watch_find(s.sk);
+	e = *pp;
+	if (!e) {
+		if (watch.count >= watch.size) {
+			watch_grow();
+			pp = watch_find(s.sk);
+		}
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			abort();
+		e->cookie = s.sk;
+		e->state = s.state;
+		e->bytes_acked = info.tcpi_bytes_acked;
+		e->bytes_received = info.tcpi_bytes_received;
+		e->retrans = info.tcpi_total_retrans;
+		e->gen = watch.gen;
+		*pp = e;
+		watch.count++;
+		/* the first dump only fills the table */
+		if (watch.gen > 1)
+			watch.new++;
+		return 0;
+	}
+
+	acked = info.tcpi_bytes_acked - e->bytes_acked;
+	received = info.tcpi_bytes_received - e->bytes_received;
+	retrans = info.tcpi_total_retrans - e->retrans;
+	e->bytes_acked = info.tcpi_bytes_acked;
+	e->bytes_received = info.tcpi_bytes_received;
+	e->retrans = info.tcpi_total_retrans;
+	e->gen = watch.gen;
+
+	if (e->state != s.state)
+		watch.changed++;
+	else if (!acked && !received && !retrans)
+		return 0;
+	e->state = s.state;
+
+	inet_show_sock(h, &s);
+	field_set(COL_EXT);
+	out("\n\t");
+	if (acked)
+		out(" +bytes_acked:%llu", acked);
+	if (received)
+		out(" +bytes_received:%llu", received);
+	if (retrans)
+		out(" +retrans:%u", retrans);
+	watch.printed++;
+	return 0;
+}
+
+/* Take out the sockets destroy events tell about, without blocking */
+static void watch_events(int fd)
+{
+	char buf[16384];
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0 ||
+	       (len < 0 && (errno == EINTR || errno == ENOBUFS))) {
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		int n = len;
+
+		for (; len > 0 && NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+			struct inet_diag_msg *r = NLMSG_DATA(h);
+			struct watch_ent *e, **pp;
+
+			if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+			    h->nlmsg_len < NLMSG_LENGTH(sizeof(*r)))
+				continue;
+			pp = watch_find(cookie_sk_get(&r->id.idiag_cookie[0]));
+			if (!(e = *pp))
+				continue;
+			*pp = e->next;
+			free(e);
+			watch.count--;
+			watch.closed++;
+		}
+	}
+}
+
+/* Drop what the last dump did not see */
+static void watch_sweep(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < watch.size; i++) {
+		struct watch_ent **pp = &watch.hash[i];
+
+		while (*pp) {
+			struct watch_ent *e = *pp;
+
+			if (e->gen == watch.gen) {
+				pp = &e->next;
+				continue;
+			}
+			*pp = e->next;
+			free(e);
+			watch.count--;
+			watch.closed++;
+		}
+	}
+}
+
+static int watch_dump(struct rtnl_handle *rth, struct filter *f)
+{
+	static const int protocols[] = { IPPROTO_TCP, IPPROTO_UDP };
+	static const int families[] = { AF_INET, AF_INET6 };
+	unsigned int i, j;
+
+	watch.gen++;
+	for (i = 0; i < ARRAY_SIZE(protocols); i++) {
+		struct inet_diag_arg arg = { .f = f, .protocol = protocols[i] };
+
+		if (!(f->dbs & (1 << (i ? UDP_DB : TCP_DB))))
+			continue;
+		dg_proto = i ? UDP_PROTO : TCP_PROTO;
+		for (j = 0; j < ARRAY_SIZE(families); j++) {
+			if (!filter_af_get(f, families[j]))
+				continue;
+			if (sockdiag_send(families[j], rth->fd, protocols[i], f) ||
+			    rtnl_dump_filter(rth, watch_inet_sock, &arg))
+				return -1;
+		}
+	}
+	watch_sweep();
+	return 0;
+}
+
+static int handle_watch_request(struct filter *f)
+{
+	struct rtnl_handle rth, ev;
+	int groups = 0, ret = 0;
+
+	if (f->families & FAMILY_MASK(AF_INET) && f->dbs & (1 << TCP_DB))
+		groups |= 1 << (SKNLGRP_INET_TCP_DESTROY - 1);
+	if (f->families & FAMILY_MASK(AF_INET) && f->dbs & (1 << UDP_DB))
+		groups |= 1 << (SKNLGRP_INET_UDP_DESTROY - 1);
+	if (f->families & FAMILY_MASK(AF_INET6) && f->dbs & (1 << TCP_DB))
+		groups |= 1 << (SKNLGRP_INET6_TCP_DESTROY - 1);
+	if (f->families & FAMILY_MASK(AF_INET6) && f->dbs & (1 << UDP_DB))
+		groups |= 1 << (SKNLGRP_INET6_UDP_DESTROY - 1);
+
+	if (groups == 0) {
+		fprintf(stderr, "ss: --watch follows TCP and UDP sockets only.\n");
+		return -1;
+	}
+
+	if (rtnl_open_byproto(&ev, groups, NETLINK_SOCK_DIAG))
+		return -1;
+	if (rtnl_open_byproto(&rth, 0, NETLINK_SOCK_DIAG)) {
+		rtnl_close(&ev);
+		return -1;
+	}
+	rth.dump = MAGIC_SEQ;
+
+	watch_grow();
+	if (watch_dump(&rth, f) < 0) {
+		ret = -1;
+		goto out;
+	}
+	printf("%u sockets\n", watch.count);
+	fflush(stdout);
+
+	for (;;) {
+		struct timespec now, next;
+		char stamp[32];
+		time_t t;
+
+		watch.new = watch.closed = watch.changed = watch.printed = 0;
+		clock_gettime(CLOCK_MONOTONIC, &next);
+		next.tv_sec += watch_interval;
+		for (;;) {
+			struct pollfd pfd = { .fd = ev.fd, .events = POLLIN };
+			long ms;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ms = (next.tv_sec - now.tv_sec) * 1000 +
+			     (next.tv_nsec - now.tv_nsec) / 1000000;
+			if (ms <= 0)
+				break;
+			if (poll(&pfd, 1, ms) > 0)
+				watch_events(ev.fd);
+		}
+		watch_events(ev.fd);
+
+		if (show_header)
+			print_header();
+		if (watch_dump(&rth, f) < 0) {
+			ret = -1;
+			break;
+		}
+
+		t = time(NULL);
+		strftime(stamp, sizeof(stamp), "%T", localtime(&t));
+		printf("%s %u sockets, %u new, %u closed, %u changed state\n",
+		       stamp, watch.count, watch.new, watch.closed,
+		       watch.changed);
+		if (watch.printed) {
+			render();
+		} else {
+			buf_free_all();
+			current_field = columns;
+		}
+		fflush(stdout);
+	}
+
+out:
+	rtnl_close(&rth);
+	rtnl_close(&ev);
+	return ret;
+}
+
+struct sample_arg {
+	struct filter	*f;
+	__u64		time_ns;
+};
+
+static void sample_print(const struct ss_sample_rec *rec)
+{
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	inet_ntop(rec->family, rec->src, src, sizeof(src));
+	inet_ntop(rec->family, rec->dst, dst, sizeof(dst));
+	printf("{\"cookie\":%llu,\"ts_ns\":%llu,\"src\":\"%s\",\"sport\":%u,"
+	       "\"dst\":\"%s\",\"dport\":%u,\"state\":\"%s\",\"ca_state\":%u,"
+	       "\"rtt_us\":%u,\"rttvar_us\":%u,\"min_rtt_us\":%u,"
+	       "\"snd_cwnd\":%u,\"snd_ssthresh\":%u,\"unacked\":%u,"
+	       "\"lost\":%u,\"total_retrans\":%u,\"segs_out\":%u,"
+	       "\"segs_in\":%u,\"pacing_rate\":%llu,\"delivery_rate\":%llu,"
+	       "\"bytes_acked\":%llu,\"bytes_received\":%llu}\n",
+	       (unsigned long long)rec->cookie,
+	       (unsigned long long)rec->time_ns, src, rec->sport, dst,
+	       rec->dport, sstate_name[rec->state], rec->ca_state,
+	       rec->rtt_us, rec->rttvar_us, rec->min_rtt_us, rec->snd_cwnd,
+	       rec->snd_ssthresh, rec->unacked, rec->lost, rec->total_retrans,
+	       rec->segs_out, rec->segs_in,
+	       (unsigned long long)rec->pacing_rate,
+	       (unsigned long long)rec->delivery_rate,
+	       (unsigned long long)rec->bytes_acked,
+	       (unsigned long long)rec->bytes_received);
+}
+
+static int sample_inet_sock(const struct sockaddr_nl *addr,
+			    struct nlmsghdr *h, void *arg)
+{
+	struct sample_arg *sa = arg;
+	struct inet_diag_msg *r = NLMSG_DATA(h);
+	struct ss_sample_rec rec = {};
+	struct tcp_info info = {};
+	struct rtattr *rta;
+	int len;
+
+	if (!(sa->f->families & FAMILY_MASK(r->idiag_family)) ||
+	    r->idiag_state >= SS_MAX)
+		return 0;
+
+	/* the kernel may have run only part of the filter */
+	if (sa->f->f) {
+		struct sockstat s = {};
+
+		parse_diag_msg(h, &s);
+		s.type = IPPROTO_TCP;
+		if (run_ssfilter(sa->f->f, &s) == 0)
+			return 0;
+	}
+
+	/* tcp_info is the only attribute wanted */
+	rta = (struct rtattr *)(r + 1);
+	len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == INET_DIAG_INFO) {
+			memcpy(&info, RTA_DATA(rta),
+			       min(RTA_PAYLOAD(rta), sizeof(info)));
+			break;
+		}
+	}
+
+	rec.cookie = cookie_sk_get(&r->id.idiag_cookie[0]);
+	rec.time_ns = sa->time_ns;
+	rec.family = r->idiag_family;
+	rec.state = r->idiag_state;
+	rec.ca_state = info.tcpi_ca_state;
+	rec.sport = ntohs(r->id.idiag_sport);
+	rec.dport = ntohs(r->id.idiag_dport);
+	len = r->idiag_family == AF_INET ? 4 : 16;
+	memcpy(rec.src, r->id.idiag_src, len);
+	memcpy(rec.dst, r->id.idiag_dst, len);
+	rec.rtt_us = info.tcpi_rtt;
+	rec.rttvar_us = info.tcpi_rttvar;
+	rec.min_rtt_us = info.tcpi_min_rtt;
+	rec.snd_cwnd = info.tcpi_snd_cwnd;
+	rec.snd_ssthresh = info.tcpi_snd_ssthresh;
+	rec.unacked = info.tcpi_unacked;
+	rec.lost = info.tcpi_lost;
+	rec.total_retrans = info.tcpi_total_retrans;
+	rec.segs_out = info.tcpi_segs_out;
+	rec.segs_in = info.tcpi_segs_in;
+	rec.pacing_rate = info.tcpi_pacing_rate;
+	rec.delivery_rate = info.tcpi_delivery_rate;
+	rec.bytes_acked = info.tcpi_bytes_acked;
+	rec.bytes_received = info.tcpi_bytes_received;
+
+	if (sample.binary)
+		fwrite(&rec, sizeof(rec), 1, stdout);
+	else
+		sample_print(&rec);
+	return 0;
+}
+
+/*
+ * --sample: dump the TCP sockets every sample.interval seconds over one
+ * diag socket, writing a record per socket, see ss_sample.h.
+ */
+static int handle_sample_request(struct filter *f)
+{
+	static const int families[] = { AF_INET, AF_INET6 };
+	struct sample_arg arg = { .f = f };
+	struct rtnl_handle rth;
+	struct timespec next, now;
+	unsigned int n = 0, i;
+	int ret = 0;
+
+	if (!(f->dbs & (1 << TCP_DB))) {
+		fprintf(stderr, "ss: --sample records TCP sockets only.\n");
+		return -1;
+	}
+	if (rtnl_open_byproto(&rth, 0, NETLINK_SOCK_DIAG))
+		return -1;
+	rth.dump = MAGIC_SEQ;
+
+	if (sample.binary) {
+		struct ss_sample_hdr hdr = {
+			.magic = SS_SAMPLE_MAGIC,
+			.version = SS_SAMPLE_VERSION,
+			.reclen = sizeof(struct ss_sample_rec),
+			.interval_ns = sample.interval * 1e9,
+		};
+
+		fwrite(&hdr, sizeof(hdr), 1, stdout);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		arg.time_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+		for (i = 0; i < ARRAY_SIZE(families); i++) {
+			if (!filter_af_get(f, families[i]))
+				continue;
+			if (sockdiag_send(families[i], rth.fd, IPPROTO_TCP, f) ||
+			    rtnl_dump_filter(&rth, sample_inet_sock, &arg)) {
+				ret = -1;
+				break;
+			}
+		}
+		if (fflush(stdout))
+			ret = -1;
+
+		if (ret < 0 || (sample.count && ++n >= sample.count))
+			break;
+
+		sample_wait(&next, sample.interval);
+	}
+
+	rtnl_close(&rth);
+	return ret;
+}
+
 static int get_snmp_int(char *proto, char *key, int *result)
 {
 	char buf[1024];
@@ -4579,15 +7006,47 @@ static int get_sockstat(struct ssummary *s)
 	return 0;
 }
 
+/* The sums over the namespaces of --all-netns, read from here */
+static unsigned int get_summary_netns_all(struct ssummary *sum,
+					  int *tcp_estab)
+{
+	unsigned int count = 0, n = 0, i, k;
+	char **names = netns_names(&count);
+
+	memset(sum, 0, sizeof(*sum));
+	*tcp_estab = 0;
+	for (i = 0; i < count; i++) {
+		struct ssummary s;
+		int estab;
+
+		proc_netns = names[i];
+		if (get_sockstat(&s) == 0 &&
+		    get_snmp_int("Tcp:", "CurrEstab", &estab) == 0) {
+			/* all of its members are ints */
+			for (k = 0; k < sizeof(s) / sizeof(int); k++)
+				((int *)sum)[k] += ((int *)&s)[k];
+			*tcp_estab += estab;
+			n++;
+		}
+		proc_netns = NULL;
+	}
+	netns_names_free(names, count);
+	return n;
+}
+
 static int print_summary(void)
 {
 	struct ssummary s;
 	int tcp_estab;
 
-	if (get_sockstat(&s) < 0)
-		perror("ss: get_sockstat");
-	if (get_snmp_int("Tcp:", "CurrEstab", &tcp_estab) < 0)
-		perror("ss: get_snmpstat");
+	if (netns_jobs) {
+		printf("Namespaces: %u\n", get_summary_netns_all(&s, &tcp_estab));
+	} else {
+		if (get_sockstat(&s) < 0)
+			perror("ss: get_sockstat");
+		if (get_snmp_int("Tcp:", "CurrEstab", &tcp_estab) < 0)
+			perror("ss: get_snmpstat");
+	}
 
 	printf("Total: %d\n", s.socks);
 
@@ -4636,6 +7095,8 @@ static void _usage(FILE *dest)
 "   -Z, --context       display process SELinux security contexts\n"
 "   -z, --contexts      display process and socket SELinux security contexts\n"
 "   -N, --net           switch to the specified network namespace name\n"
+"       --all-netns[=JOBS]  show the sockets of all named namespaces, JOBS\n"
+"                       of them read at a time\n"
 "\n"
 "   -4, --ipv4          display only IP version 4 sockets\n"
 "   -6, --ipv6          display only IP version 6 sockets\n"
@@ -4648,11 +7109,24 @@ static void _usage(FILE *dest)
 "   -x, --unix          display only Unix domain sockets\n"
 "       --tipc          display only TIPC sockets\n"
 "       --vsock         display only vsock sockets\n"
+"       --unix-peers    print the name of the peer of Unix sockets\n"
 "   -f, --family=FAMILY display sockets of type FAMILY\n"
 "       FAMILY := {inet|inet6|link|unix|netlink|vsock|tipc|help}\n"
 "\n"
 "   -K, --kill          forcibly close sockets, display what was closed\n"
 "   -H, --no-header     Suppress header line\n"
+"   -j, --json          print each socket as a line of JSON\n"
+"       --stats-netlink print netlink traffic counters on exit\n"
+"       --timing        print where the time went on exit\n"
+"       --stream[=N]    print every N lines, as wide as the first N need\n"
+"       --unordered     print the socket tables as they are read, mixed\n"
+"       --watch[=SECS]  print what changed in TCP and UDP sockets every SECS\n"
+"       --group-by=KEYS count INET and Unix sockets in groups, don't list them\n"
+"       KEYS := {netid|state|src[/LEN]|dst[/LEN]|sport|dport}[,KEYS]\n"
+"       --top=N         print only the N largest groups\n"
+"       --sample=SECS   write tcp_info of TCP sockets every SECS as NDJSON\n"
+"       --sample-count=N  stop after N samples\n"
+"       --sample-binary write struct ss_sample_rec records instead\n"
 "\n"
 "   -A, --query=QUERY, --socket=QUERY\n"
 "       QUERY := {all|inet|tcp|udp|raw|unix|unix_dgram|unix_stream|unix_seqpacket|packet|netlink|vsock_stream|vsock_dgram|tipc}[,QUERY]\n"
@@ -4733,6 +7207,19 @@ static int scan_state(const char *state)
 #define OPT_TIPCSOCK 257
 #define OPT_TIPCINFO 258
 
+#define OPT_NLSTATS 259
+#define OPT_STREAM 260
+#define OPT_UNORDERED 261
+#define OPT_WATCH 262
+#define OPT_GROUP_BY 263
+#define OPT_TOP 264
+#define OPT_SAMPLE 265
+#define OPT_SAMPLE_COUNT 266
+#define OPT_SAMPLE_BINARY 267
+#define OPT_UNIX_PEERS 268
+#define OPT_TIMING 269
+#define OPT_ALL_NETNS 270
+
 static const struct option long_opts[] = {
 	{ "numeric", 0, 0, 'n' },
 	{ "resolve", 0, 0, 'r' },
@@ -4770,6 +7257,19 @@ static const struct option long_opts[] = {
 	{ "tipcinfo", 0, 0, OPT_TIPCINFO},
 	{ "kill", 0, 0, 'K' },
 	{ "no-header", 0, 0, 'H' },
+	{ "json", 0, 0, 'j' },
+	{ "stats-netlink", 0, 0, OPT_NLSTATS },
+	{ "timing", 0, 0, OPT_TIMING },
+	{ "all-netns", 2, 0, OPT_ALL_NETNS },
+	{ "stream", 2, 0, OPT_STREAM },
+	{ "unordered", 0, 0, OPT_UNORDERED },
+	{ "watch", 2, 0, OPT_WATCH },
+	{ "group-by", 1, 0, OPT_GROUP_BY },
+	{ "top", 1, 0, OPT_TOP },
+	{ "sample", 1, 0, OPT_SAMPLE },
+	{ "sample-count", 1, 0, OPT_SAMPLE_COUNT },
+	{ "sample-binary", 0, 0, OPT_SAMPLE_BINARY },
+	{ "unix-peers", 0, 0, OPT_UNIX_PEERS },
 	{ 0 }
 
 };
@@ -4785,7 +7285,7 @@ int main(int argc, char *argv[])
 	int state_filter = 0;
 
 	while ((ch = getopt_long(argc, argv,
-				 "dhaletuwxnro460spbEf:miA:D:F:vVzZN:KHS",
+				 "dhaletuwxnro460spbEf:miA:D:F:vVzZN:KHSj",
 				 long_opts, NULL)) != EOF) {
 		switch (ch) {
 		case 'n':
@@ -4809,7 +7309,6 @@ int main(int argc, char *argv[])
 			break;
 		case 'p':
 			show_users++;
-			user_ent_hash_build();
 			break;
 		case 'b':
 			show_options = 1;
@@ -4936,7 +7435,6 @@ int main(int argc, char *argv[])
 				iprt_exit(1);
 			}
 			show_proc_ctx++;
-			user_ent_hash_build();
 			break;
 		case 'N':
 			if (netns_switch(optarg))
@@ -4945,12 +7443,88 @@ int main(int argc, char *argv[])
 		case OPT_TIPCINFO:
 			show_tipcinfo = 1;
 			break;
+		case OPT_ALL_NETNS:
+			netns_jobs = UINT_MAX;
+			if (optarg && (get_unsigned(&netns_jobs, optarg, 0) ||
+				       !netns_jobs)) {
+				fprintf(stderr, "ss: invalid --all-netns jobs \"%s\"\n",
+					optarg);
+				iprt_exit(-1);
+			}
+			netns_jobs = jobs_limit(netns_jobs);
+			break;
+		case OPT_NLSTATS:
+			rtnl_stats_enable();
+			show_sequential = 1;
+			break;
+		case OPT_TIMING:
+			rtnl_timing_enable();
+			show_sequential = 1;
+			break;
+		case OPT_UNORDERED:
+			show_unordered = 1;
+			break;
+		case OPT_WATCH:
+			watch_interval = 1;
+			if (optarg && (get_unsigned(&watch_interval, optarg, 0) ||
+				       !watch_interval)) {
+				fprintf(stderr, "ss: invalid --watch interval \"%s\"\n",
+					optarg);
+				iprt_exit(-1);
+			}
+			break;
+		case OPT_GROUP_BY:
+			if (group.nkeys || group_parse(optarg)) {
+				fprintf(stderr, "ss: invalid --group-by keys \"%s\"\n",
+					optarg);
+				iprt_exit(-1);
+			}
+			break;
+		case OPT_TOP:
+			if (get_unsigned(&group.top, optarg, 0)) {
+				fprintf(stderr, "ss: invalid --top count \"%s\"\n",
+					optarg);
+				iprt_exit(-1);
+			}
+			break;
+		case OPT_SAMPLE:
+			if (get_sample_interval(&sample.interval, optarg)) {
+				fprintf(stderr, "ss: invalid --sample interval \"%s\"\n",
+					optarg);
+				iprt_exit(-1);
+			}
+			break;
+		case OPT_SAMPLE_COUNT:
+			if (get_unsigned(&sample.count, optarg, 0)) {
+				fprintf(stderr, "ss: invalid --sample-count \"%s\"\n",
+					optarg);
+				iprt_exit(-1);
+			}
+			break;
+		case OPT_SAMPLE_BINARY:
+			sample.binary = true;
+			break;
+		case OPT_UNIX_PEERS:
+			show_unix_peers = true;
+			break;
+		case OPT_STREAM:
+			stream_lines = STREAM_LINES_DEFAULT;
+			if (optarg && (get_unsigned(&stream_lines, optarg, 0) ||
+				       !stream_lines)) {
+				fprintf(stderr, "ss: invalid --stream lines \"%s\"\n",
+					optarg);
+				iprt_exit(-1);
+			}
+			break;
 		case 'K':
 			current_filter.kill = 1;
 			break;
 		case 'H':
 			show_header = 0;
 			break;
+		case 'j':
+			json = 1;
+			break;
 		case 'h':
 			return help();
 		case '?':
@@ -4962,12 +7536,28 @@ int main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	/* NDJSON, a line per socket, however many there are */
+	if (json) {
+		if (do_summary || watch_interval || sample.interval ||
+		    group.nkeys) {
+			fprintf(stderr, "ss: -j goes with none of -s, --watch, --sample and --group-by.\n");
+			iprt_exit(-1);
+		}
+		ndjson = 1;
+		new_json_obj(json);
+		jsonw_lines_buffered(get_json_writer(), !follow_events);
+		show_header = 0;
+	}
+
 	if (do_summary) {
 		print_summary();
 		if (do_default && argc == 0)
 			iprt_exit(0);
 	}
 
+	if (show_users || show_proc_ctx || show_sock_ctx)
+		user_ent_hash_build();
+
 	while (argc > 0) {
 		if (strcmp(*argv, "state") == 0) {
 			NEXT_ARG();
@@ -4996,6 +7586,16 @@ int main(int argc, char *argv[])
 	filter_states_set(&current_filter, state_filter);
 	filter_merge_defaults(&current_filter);
 
+	/* the children's groups would be lost, the other tables ignored */
+	if (group.nkeys) {
+		if (follow_events || current_filter.kill || watch_interval) {
+			fprintf(stderr, "ss: --group-by goes with none of -E, -K and --watch.\n");
+			iprt_exit(-1);
+		}
+		current_filter.dbs &= INET_DBM | UNIX_DBM;
+		show_sequential = 1;
+	}
+
 	if (resolve_services && resolve_hosts &&
 	    (current_filter.dbs & (UNIX_DBM|INET_L4_DBM)))
 		init_service_resolver();
@@ -5034,13 +7634,58 @@ int main(int argc, char *argv[])
 
 	if (ssfilter_parse(&current_filter.f, argc, argv, filter_fp))
 		return usage();
+	if (current_filter.f)
+		current_filter.f = ssfilter_optimize(current_filter.f);
 
 	if (!(current_filter.dbs & (current_filter.dbs - 1)))
 		columns[COL_NETID].disabled = 1;
 
+	/* the kills, groups and changes would be counted by the children */
+	if (netns_jobs) {
+		if (follow_events || current_filter.kill || watch_interval ||
+		    sample.interval || group.nkeys) {
+			fprintf(stderr, "ss: --all-netns goes with none of -E, -K, --watch, --sample and --group-by.\n");
+			iprt_exit(-1);
+		}
+		columns[COL_NETNS].disabled = 0;
+	}
+
 	if (!(current_filter.states & (current_filter.states - 1)))
 		columns[COL_STATE].disabled = 1;
 
+	if (sample.interval) {
+		if (follow_events || current_filter.kill || watch_interval ||
+		    group.nkeys) {
+			fprintf(stderr, "ss: --sample goes with none of -E, -K, --watch and --group-by.\n");
+			iprt_exit(-1);
+		}
+		finish_service_resolver();
+		iprt_exit(handle_sample_request(&current_filter));
+	}
+
+	if (watch_interval) {
+		if (follow_events || current_filter.kill) {
+			fprintf(stderr, "ss: --watch goes with neither -E nor -K.\n");
+			iprt_exit(-1);
+		}
+		finish_service_resolver();
+		iprt_exit(handle_watch_request(&current_filter));
+	}
+
+	if (group.nkeys) {
+		finish_service_resolver();
+		sock_tally = group_sock;
+		show_all(&current_filter);
+		group_print();
+		iprt_exit(0);
+	}
+
+	/* the addresses are those of ss's namespace */
+	if (resolve_hosts && !current_filter.kill && !follow_events &&
+	    !netns_jobs)
+		resolve_prefetch(&current_filter);
+	finish_service_resolver();
+
 	if (show_header)
 		print_header();
 
@@ -5049,31 +7694,20 @@ int main(int argc, char *argv[])
 	if (follow_events)
 		iprt_exit(handle_follow_request(&current_filter));
 
-	if (current_filter.dbs & (1<<NETLINK_DB))
-		netlink_show(&current_filter);
-	if (current_filter.dbs & PACKET_DBM)
-		packet_show(&current_filter);
-	if (current_filter.dbs & UNIX_DBM)
-		unix_show(&current_filter);
-	if (current_filter.dbs & (1<<RAW_DB))
-		raw_show(&current_filter);
-	if (current_filter.dbs & (1<<UDP_DB))
-		udp_show(&current_filter);
-	if (current_filter.dbs & (1<<TCP_DB))
-		tcp_show(&current_filter);
-	if (current_filter.dbs & (1<<DCCP_DB))
-		dccp_show(&current_filter);
-	if (current_filter.dbs & (1<<SCTP_DB))
-		sctp_show(&current_filter);
-	if (current_filter.dbs & VSOCK_DBM)
-		vsock_show(&current_filter);
-	if (current_filter.dbs & (1<<TIPC_DB))
-		tipc_show(&current_filter);
+	if (netns_jobs)
+		show_netns_all(&current_filter);
+	else
+		show_all(&current_filter);
 
 	if (show_users || show_proc_ctx || show_sock_ctx)
 		user_ent_destroy();
 
+	if (current_filter.kill)
+		fprintf(stderr, "ss: %u sockets killed, %u failed\n",
+			kill_batch.killed, kill_batch.failed);
+
 	render();
+	delete_json_obj();
 
 	return 0;
 }
@@ -56,10 +56,6 @@ exprlist: expr
         {
                 $$ = alloc_node(SSF_NOT, $2);
         }
-        | '(' exprlist ')'
-        {
-                $$ = $2;
-        }
         | exprlist '|' expr
         {
                 $$ = alloc_node(SSF_OR, $1);
@@ -77,7 +73,11 @@ exprlist: expr
         }
         ;
 
-expr:	DCOND HOSTCOND
+expr:	'(' exprlist ')'
+        {
+                $$ = $2;
+        }
+        | DCOND HOSTCOND
         {
 		$$ = alloc_node(SSF_DCOND, $2);
         }
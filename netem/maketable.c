@@ -6,16 +6,24 @@
  * experimentally or generated from some probability distribution.
  * From this, create the inverse distribution table used to approximate
  * the distribution.
+ *
+ * The values can also be the gaps between the packets of a pcap capture,
+ * for a distribution that replays the delays seen on a real link, and
+ * the table can be written in the binary form tc maps without parsing.
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <malloc.h>
 #include <string.h>
+#include <unistd.h>
+#include <byteswap.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "iprt.h"
+#include "netem_dist.h"
 
 double *
 readdoubles(FILE *fp, int *number)
@@ -48,6 +56,120 @@ readdoubles(FILE *fp, int *number)
 	return x;
 }
 
+/* pcap file and record headers, as libpcap writes them */
+#define PCAP_MAGIC_USEC	0xa1b2c3d4
+#define PCAP_MAGIC_NSEC	0xa1b23c4d
+
+struct pcap_hdr {
+	uint32_t	magic;
+	uint16_t	version_major;
+	uint16_t	version_minor;
+	int32_t		thiszone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	network;
+};
+
+struct pcap_rec {
+	uint32_t	ts_sec;
+	uint32_t	ts_frac;	/* usec or nsec, as the magic says */
+	uint32_t	incl_len;
+	uint32_t	orig_len;
+};
+
+/* Read the gaps between the packets of a capture, in usec */
+double *
+readpcap(FILE *fp, int *number)
+{
+	struct pcap_hdr hdr;
+	struct pcap_rec rec;
+	double *x = NULL, last = 0, scale;
+	int n = 0, limit = 0, swap;
+
+	*number = 0;
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+		fprintf(stderr, "Not a pcap file\n");
+		iprt_exit(NULL);
+	}
+	swap = hdr.magic == bswap_32(PCAP_MAGIC_USEC) ||
+	       hdr.magic == bswap_32(PCAP_MAGIC_NSEC);
+	if (swap)
+		hdr.magic = bswap_32(hdr.magic);
+	if (hdr.magic == PCAP_MAGIC_USEC) {
+		scale = 1.0;
+	} else if (hdr.magic == PCAP_MAGIC_NSEC) {
+		scale = 0.001;
+	} else {
+		fprintf(stderr, "Not a pcap file (pcapng is not read)\n");
+		iprt_exit(NULL);
+	}
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		double t;
+
+		if (swap) {
+			rec.ts_sec = bswap_32(rec.ts_sec);
+			rec.ts_frac = bswap_32(rec.ts_frac);
+			rec.incl_len = bswap_32(rec.incl_len);
+		}
+		if (fseek(fp, rec.incl_len, SEEK_CUR) < 0)
+			break;
+
+		t = rec.ts_sec * 1e6 + rec.ts_frac * scale;
+		if (last != 0 || t == 0) {
+			if (n == limit) {
+				limit = limit ? 2 * limit : 10000;
+				x = realloc(x, limit * sizeof(double));
+				if (!x) {
+					perror("double alloc");
+					iprt_exit(NULL);
+				}
+			}
+			x[n++] = t - last;
+		}
+		last = t;
+	}
+	*number = n;
+	return x;
+}
+
+/* Read a table made before, to write it again as it is */
+short *
+readtable(FILE *fp, int *number)
+{
+	short *table;
+	char *line = NULL;
+	size_t len = 0;
+	int n = 0;
+
+	*number = 0;
+	table = calloc(NETEM_DIST_ENTRIES_MAX, sizeof(short));
+	if (!table) {
+		perror("table alloc");
+		iprt_exit(NULL);
+	}
+	while (getline(&line, &len, fp) != -1) {
+		char *p, *endp;
+
+		if (*line == '\n' || *line == '#')
+			continue;
+		for (p = line; ; p = endp) {
+			long v = strtol(p, &endp, 0);
+
+			if (endp == p)
+				break;
+			if (n == NETEM_DIST_ENTRIES_MAX) {
+				fprintf(stderr, "Too much data\n");
+				iprt_exit(NULL);
+			}
+			table[n++] = v;
+		}
+	}
+	free(line);
+	*number = n;
+	return table;
+}
+
 void
 arraystats(double *x, int limit, double *mu, double *sigma, double *rho)
 {
@@ -182,6 +304,24 @@ interpolatetable(short *table, int limit)
 	}
 }
 
+static int
+writetable(const short *table, int limit)
+{
+	struct netem_distb_hdr hdr = {
+		.magic		= NETEM_DISTB_MAGIC,
+		.version	= NETEM_DISTB_VERSION,
+		.entries	= limit,
+	};
+
+	if (fwrite(&hdr, sizeof(hdr), 1, stdout) != 1 ||
+	    fwrite(table, sizeof(short), limit, stdout) != limit ||
+	    fflush(stdout)) {
+		perror("write");
+		return -1;
+	}
+	return 0;
+}
+
 static void
 printtable(const short *table, int limit)
 {
@@ -195,6 +335,19 @@ printtable(const short *table, int limit)
 	}
 }
 
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: maketable [ -s SIZE ] [ -b ] [ -p ] [ FILE ]\n"
+		"       maketable -c [ FILE ]\n"
+		"  -s SIZE  entries in the table, %d by default, at most %d\n"
+		"  -b       write the table in binary, for TYPE.distb\n"
+		"  -p       FILE is a pcap capture, its packet gaps are the values\n"
+		"  -c       FILE is a text table, to be written again in binary\n",
+		TABLESIZE, NETEM_DIST_ENTRIES_MAX);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -205,16 +358,56 @@ main(int argc, char **argv)
 	int *table;
 	short *inverse;
 	int total;
+	int size = TABLESIZE, binary = 0, pcap = 0, convert = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:bpc")) != -1) {
+		switch (opt) {
+		case 's':
+			size = atoi(optarg);
+			if (size <= 0 || size > NETEM_DIST_ENTRIES_MAX) {
+				usage();
+				iprt_exit(1);
+			}
+			break;
+		case 'b':
+			binary = 1;
+			break;
+		case 'p':
+			pcap = 1;
+			break;
+		case 'c':
+			convert = binary = 1;
+			break;
+		default:
+			usage();
+			iprt_exit(1);
+		}
+	}
 
-	if (argc > 1) {
-		if (!(fp = fopen(argv[1], "r"))) {
-			perror(argv[1]);
+	if (optind < argc) {
+		if (!(fp = fopen(argv[optind], "r"))) {
+			perror(argv[optind]);
 			iprt_exit(1);
 		}
 	} else {
 		fp = stdin;
 	}
-	x = readdoubles(fp, &limit);
+
+	if (convert) {
+		inverse = readtable(fp, &limit);
+		if (limit <= 0) {
+			fprintf(stderr, "Nothing much read!\n");
+			iprt_exit(2);
+		}
+		size = limit;
+		goto out;
+	}
+
+	if (pcap)
+		x = readpcap(fp, &limit);
+	else
+		x = readdoubles(fp, &limit);
 	if (limit <= 0) {
 		fprintf(stderr, "Nothing much read!\n");
 		iprt_exit(2);
@@ -228,8 +421,14 @@ main(int argc, char **argv)
 	table = makedist(x, limit, mu, sigma);
 	free((void *) x);
 	cumulativedist(table, DISTTABLESIZE, &total);
-	inverse = inverttable(table, TABLESIZE, DISTTABLESIZE, total);
-	interpolatetable(inverse, TABLESIZE);
-	printtable(inverse, TABLESIZE);
+	inverse = inverttable(table, size, DISTTABLESIZE, total);
+	interpolatetable(inverse, size);
+out:
+	if (binary) {
+		if (writetable(inverse, size) < 0)
+			iprt_exit(3);
+	} else {
+		printtable(inverse, size);
+	}
 	return 0;
 }
@@ -12,12 +12,15 @@
 #include "rdma.h"
 #include "SNAPSHOT.h"
 
+#define RD_JOBS_MAX	1024
+
 static void help(char *name)
 {
 	pr_out("Usage: %s [ OPTIONS ] OBJECT { COMMAND | help }\n"
 	       "       %s [ -f[orce] ] -b[atch] filename\n"
 	       "where  OBJECT := { dev | link | resource | help }\n"
-	       "       OPTIONS := { -V[ersion] | -d[etails] | -j[son] | -p[retty]}\n", name, name);
+	       "       OPTIONS := { -V[ersion] | -d[etails] | -j[son] | -p[retty] |\n"
+	       "                    --jobs N }\n", name, name);
 }
 
 static int cmd_help(struct rd *rd)
@@ -39,6 +42,8 @@ static int rd_cmd(struct rd *rd, int argc, char **argv)
 
 	rd->argc = argc;
 	rd->argv = argv;
+	/* the devices may have changed since the last command */
+	rd->dev_map_fresh = false;
 
 	return rd_exec_cmd(rd, cmds, "object");
 }
@@ -79,11 +84,9 @@ static int rd_batch(struct rd *rd, const char *name, bool force)
 	return ret;
 }
 
+/* the device map is only dumped when needed, see rd_dev_map_load() */
 static int rd_init(struct rd *rd, char *filename)
 {
-	uint32_t seq;
-	int ret;
-
 	rd->filename = filename;
 	INIT_LIST_HEAD(&rd->dev_map_list);
 	INIT_LIST_HEAD(&rd->filter_list);
@@ -101,13 +104,7 @@ static int rd_init(struct rd *rd, char *filename)
 	if (!rd->buff)
 		return -ENOMEM;
 
-	rd_prepare_msg(rd, RDMA_NLDEV_CMD_GET,
-		       &seq, (NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP));
-	ret = rd_send_msg(rd);
-	if (ret)
-		return ret;
-
-	return rd_recv_msg(rd, rd_dev_init_cb, rd, seq);
+	return 0;
 }
 
 static void rd_cleanup(struct rd *rd)
@@ -127,6 +124,7 @@ int main(int argc, char **argv)
 		{ "details",		no_argument,		NULL, 'd' },
 		{ "force",		no_argument,		NULL, 'f' },
 		{ "batch",		required_argument,	NULL, 'b' },
+		{ "jobs",		required_argument,	NULL, 'J' },
 		{ NULL, 0, NULL, 0 }
 	};
 	const char *batch_file = NULL;
@@ -134,6 +132,7 @@ int main(int argc, char **argv)
 	bool show_details = false;
 	bool json_output = false;
 	bool force = false;
+	unsigned int jobs = 1;
 	char *filename;
 	struct rd rd = {};
 	int opt;
@@ -163,6 +162,13 @@ int main(int argc, char **argv)
 		case 'b':
 			batch_file = optarg;
 			break;
+		case 'J':
+			if (get_unsigned(&jobs, optarg, 0) || !jobs ||
+			    jobs > RD_JOBS_MAX) {
+				pr_err("Invalid jobs %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'h':
 			help(filename);
 			return EXIT_SUCCESS;
@@ -182,6 +188,7 @@ int main(int argc, char **argv)
 	rd.show_details = show_details;
 	rd.json_output = json_output;
 	rd.pretty_output = pretty_output;
+	rd.jobs = jobs;
 
 	err = rd_init(&rd, filename);
 	if (err)
@@ -23,6 +23,7 @@
 
 #include "list.h"
 #include "utils.h"
+#include "arena.h"
 #include "json_writer.h"
 
 #define pr_err(args...) fprintf(stderr, ##args)
@@ -37,14 +38,29 @@ struct filters {
 	bool is_number;
 };
 
+struct filter_range {
+	uint32_t lo;
+	uint32_t hi;
+};
+
+#define FILTER_HASH_SIZE 16
 struct filter_entry {
 	struct list_head list;
+	struct filter_entry *next;	/* in its filter_hash chain */
 	char *key;
 	char *value;
+	/* value parsed, as sorted disjoint ranges and as strings */
+	struct filter_range *ranges;
+	unsigned int nranges;
+	char **strs;
+	unsigned int nstrs;
+	char *strbuf;
 };
 
 struct dev_map {
 	struct list_head list;
+	struct dev_map *name_next;	/* in its dev_name_hash chain */
+	struct dev_map *idx_next;	/* in its dev_idx_hash chain */
 	char *dev_name;
 	uint32_t num_ports;
 	uint32_t idx;
@@ -56,6 +72,15 @@ struct rd {
 	char *filename;
 	bool show_details;
 	struct list_head dev_map_list;
+	/* the same devices by name and by index, see rd_dev_map_load() */
+	struct dev_map **dev_name_hash;
+	struct dev_map **dev_idx_hash;
+	unsigned int dev_hash_size;	/* a power of two */
+	unsigned int dev_count;
+	struct dev_map **dev_idx_old;	/* while dumped again, to reuse */
+	unsigned int dev_old_size;
+	bool dev_map_loaded;
+	bool dev_map_fresh;		/* dumped for the current command */
 	uint32_t dev_idx;
 	uint32_t port_idx;
 	struct mnl_socket *nl;
@@ -64,7 +89,10 @@ struct rd {
 	json_writer_t *jw;
 	bool json_output;
 	bool pretty_output;
+	unsigned int jobs;	/* processes to share out all-device dumps */
 	struct list_head filter_list;
+	struct filter_entry *filter_hash[FILTER_HASH_SIZE];
+	struct arena arena;	/* device maps and filters, until rd_free() */
 };
 
 struct rd_cmd {
@@ -98,6 +126,7 @@ int strcmpx(const char *str1, const char *str2);
 /*
  * Device manipulation
  */
+int rd_dev_map_load(struct rd *rd);
 struct dev_map *dev_map_lookup(struct rd *rd, bool allow_port_index);
 
 /*
@@ -23,6 +23,7 @@ static int res_help(struct rd *rd)
 	pr_out("          resource show cm_id link [DEV/PORT] [FILTER-NAME FILTER-VALUE]\n");
 	pr_out("          resource show cq link [DEV/PORT]\n");
 	pr_out("          resource show cq link [DEV/PORT] [FILTER-NAME FILTER-VALUE]\n");
+	pr_out("          resource sample [DEV] [interval MS] [count N] [top N]\n");
 	return 0;
 }
 
@@ -404,15 +405,15 @@ static int res_qp_parse_cb(const struct nlmsghdr *nlh, void *data)
 		if (rd_check_is_string_filtered(rd, "state", qp_states_to_str(state)))
 			continue;
 
-		if (nla_line[RDMA_NLDEV_ATTR_RES_PID]) {
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
 			pid = mnl_attr_get_u32(nla_line[RDMA_NLDEV_ATTR_RES_PID]);
-			comm = get_task_name(pid);
-		}
 
-		if (rd_check_is_filtered(rd, "pid", pid)) {
-			free(comm);
+		/* before the name, which takes a read of /proc per entry */
+		if (rd_check_is_filtered(rd, "pid", pid))
 			continue;
-		}
+
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			comm = get_task_name(pid);
 
 		if (nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME])
 			/* discard const from mnl_attr_get_str */
@@ -640,16 +641,14 @@ static int res_cm_id_parse_cb(const struct nlmsghdr *nlh, void *data)
 		if (rd_check_is_filtered(rd, "dst-port", dst_port))
 			continue;
 
-		if (nla_line[RDMA_NLDEV_ATTR_RES_PID]) {
-			pid = mnl_attr_get_u32(
-					nla_line[RDMA_NLDEV_ATTR_RES_PID]);
-			comm = get_task_name(pid);
-		}
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			pid = mnl_attr_get_u32(nla_line[RDMA_NLDEV_ATTR_RES_PID]);
 
-		if (rd_check_is_filtered(rd, "pid", pid)) {
-			free(comm);
+		if (rd_check_is_filtered(rd, "pid", pid))
 			continue;
-		}
+
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			comm = get_task_name(pid);
 
 		if (nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME]) {
 			/* discard const from mnl_attr_get_str */
@@ -774,16 +773,14 @@ static int res_cq_parse_cb(const struct nlmsghdr *nlh, void *data)
 				continue;
 		}
 
-		if (nla_line[RDMA_NLDEV_ATTR_RES_PID]) {
-			pid = mnl_attr_get_u32(
-					nla_line[RDMA_NLDEV_ATTR_RES_PID]);
-			comm = get_task_name(pid);
-		}
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			pid = mnl_attr_get_u32(nla_line[RDMA_NLDEV_ATTR_RES_PID]);
 
-		if (rd_check_is_filtered(rd, "pid", pid)) {
-			free(comm);
+		if (rd_check_is_filtered(rd, "pid", pid))
 			continue;
-		}
+
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			comm = get_task_name(pid);
 
 		if (nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME])
 			/* discard const from mnl_attr_get_str */
@@ -886,16 +883,14 @@ static int res_mr_parse_cb(const struct nlmsghdr *nlh, void *data)
 		if (rd_check_is_filtered(rd, "mrlen", mrlen))
 			continue;
 
-		if (nla_line[RDMA_NLDEV_ATTR_RES_PID]) {
-			pid = mnl_attr_get_u32(
-					nla_line[RDMA_NLDEV_ATTR_RES_PID]);
-			comm = get_task_name(pid);
-		}
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			pid = mnl_attr_get_u32(nla_line[RDMA_NLDEV_ATTR_RES_PID]);
 
-		if (rd_check_is_filtered(rd, "pid", pid)) {
-			free(comm);
+		if (rd_check_is_filtered(rd, "pid", pid))
 			continue;
-		}
+
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			comm = get_task_name(pid);
 
 		if (nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME])
 			/* discard const from mnl_attr_get_str */
@@ -975,15 +970,15 @@ static int res_pd_parse_cb(const struct nlmsghdr *nlh, void *data)
 			unsafe_global_rkey = mnl_attr_get_u32(
 			      nla_line[RDMA_NLDEV_ATTR_RES_UNSAFE_GLOBAL_RKEY]);
 
-		if (nla_line[RDMA_NLDEV_ATTR_RES_PID]) {
-			pid = mnl_attr_get_u32(
-				nla_line[RDMA_NLDEV_ATTR_RES_PID]);
-			comm = get_task_name(pid);
-		}
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			pid = mnl_attr_get_u32(nla_line[RDMA_NLDEV_ATTR_RES_PID]);
 
 		if (rd_check_is_filtered(rd, "pid", pid))
 			continue;
 
+		if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
+			comm = get_task_name(pid);
+
 		if (nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME])
 			/* discard const from mnl_attr_get_str */
 			comm = (char *)mnl_attr_get_str(
@@ -1105,12 +1100,515 @@ static int res_show(struct rd *rd)
 	return rd_exec_cmd(rd, cmds, "parameter");
 }
 
+/*
+ * rdma resource sample: the summary of every device, and the QPs of
+ * every process, polled each interval. Only the index and pid of a QP
+ * are read, QPs are told apart by device and lqpn, so a QP that went
+ * away and one that came counts as one destroyed and one created.
+ */
+#define RES_SAMPLE_MAX_SUMMARY	16
+#define RES_SAMPLE_HASH_SIZE	4096
+
+struct res_sample_summary {
+	char name[32];
+	uint64_t curr;
+	uint64_t prev;
+};
+
+struct res_sample_dev {
+	const struct dev_map *dev_map;
+	struct res_sample_summary summary[RES_SAMPLE_MAX_SUMMARY];
+	unsigned int nsummary;
+};
+
+struct res_sample_qp {
+	struct res_sample_qp *next;
+	uint32_t dev_idx;
+	uint32_t lqpn;
+	uint32_t pid;
+	unsigned int gen;
+};
+
+struct res_sample_pid {
+	struct res_sample_pid *next;
+	uint32_t pid;
+	unsigned int qps;
+	unsigned int created;
+	unsigned int destroyed;
+	unsigned int gen;
+};
+
+struct res_sample {
+	struct rd *rd;
+	struct res_sample_dev *devs;
+	unsigned int ndevs;
+	struct res_sample_dev *dev;	/* the one being dumped */
+	struct res_sample_qp **qp_hash;
+	struct res_sample_pid **pid_hash;
+	unsigned int npids;
+	unsigned int gen;
+	bool baseline;			/* first poll, nothing was created */
+};
+
+static unsigned int res_sample_hash(uint32_t a, uint32_t b)
+{
+	return ((a * 2654435761U) ^ (b * 2246822519U)) >> 20 &
+	       (RES_SAMPLE_HASH_SIZE - 1);
+}
+
+static struct res_sample_pid *res_sample_pid_get(struct res_sample *rs,
+						 uint32_t pid)
+{
+	unsigned int h = res_sample_hash(pid, 0);
+	struct res_sample_pid *p;
+
+	for (p = rs->pid_hash[h]; p; p = p->next)
+		if (p->pid == pid)
+			break;
+	if (!p) {
+		p = calloc(1, sizeof(*p));
+		if (!p)
+			return NULL;
+		p->pid = pid;
+		p->next = rs->pid_hash[h];
+		rs->pid_hash[h] = p;
+		rs->npids++;
+	}
+	if (p->gen != rs->gen) {
+		p->gen = rs->gen;
+		p->qps = p->created = p->destroyed = 0;
+	}
+	return p;
+}
+
+static int res_sample_summary_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *tb[RDMA_NLDEV_ATTR_MAX] = {};
+	struct res_sample *rs = data;
+	struct res_sample_dev *dev = rs->dev;
+	struct nlattr *nla_entry;
+	unsigned int i;
+
+	mnl_attr_parse(nlh, 0, rd_attr_cb, tb);
+	if (!tb[RDMA_NLDEV_ATTR_RES_SUMMARY])
+		return MNL_CB_ERROR;
+
+	mnl_attr_for_each_nested(nla_entry, tb[RDMA_NLDEV_ATTR_RES_SUMMARY]) {
+		struct nlattr *nla_line[RDMA_NLDEV_ATTR_MAX] = {};
+		const char *name;
+
+		if (mnl_attr_parse_nested(nla_entry, rd_attr_cb,
+					  nla_line) != MNL_CB_OK)
+			return MNL_CB_ERROR;
+		if (!nla_line[RDMA_NLDEV_ATTR_RES_SUMMARY_ENTRY_NAME] ||
+		    !nla_line[RDMA_NLDEV_ATTR_RES_SUMMARY_ENTRY_CURR])
+			return MNL_CB_ERROR;
+
+		name = mnl_attr_get_str(nla_line[RDMA_NLDEV_ATTR_RES_SUMMARY_ENTRY_NAME]);
+		for (i = 0; i < dev->nsummary; i++)
+			if (!strcmp(dev->summary[i].name, name))
+				break;
+		if (i == dev->nsummary) {
+			if (i == RES_SAMPLE_MAX_SUMMARY)
+				continue;
+			snprintf(dev->summary[i].name,
+				 sizeof(dev->summary[i].name), "%s", name);
+			dev->nsummary++;
+		}
+		dev->summary[i].curr = mnl_attr_get_u64(nla_line[RDMA_NLDEV_ATTR_RES_SUMMARY_ENTRY_CURR]);
+		if (rs->baseline)
+			dev->summary[i].prev = dev->summary[i].curr;
+	}
+	return MNL_CB_OK;
+}
+
+static int res_sample_qp_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *tb[RDMA_NLDEV_ATTR_MAX] = {};
+	struct res_sample *rs = data;
+	uint32_t dev_idx = rs->dev->dev_map->idx;
+	struct nlattr *nla_entry, *attr;
+
+	mnl_attr_parse(nlh, 0, rd_attr_cb, tb);
+	if (!tb[RDMA_NLDEV_ATTR_RES_QP])
+		return MNL_CB_ERROR;
+
+	mnl_attr_for_each_nested(nla_entry, tb[RDMA_NLDEV_ATTR_RES_QP]) {
+		bool has_lqpn = false;
+		struct res_sample_pid *p;
+		struct res_sample_qp *qp;
+		uint32_t lqpn = 0, pid = 0;
+		unsigned int h;
+
+		/* two attributes wanted, not worth a full parse */
+		mnl_attr_for_each_nested(attr, nla_entry) {
+			switch (mnl_attr_get_type(attr)) {
+			case RDMA_NLDEV_ATTR_RES_LQPN:
+				lqpn = mnl_attr_get_u32(attr);
+				has_lqpn = true;
+				break;
+			case RDMA_NLDEV_ATTR_RES_PID:
+				pid = mnl_attr_get_u32(attr);
+				break;
+			}
+		}
+		if (!has_lqpn)
+			return MNL_CB_ERROR;
+
+		p = res_sample_pid_get(rs, pid);
+		if (!p)
+			return MNL_CB_ERROR;
+		p->qps++;
+
+		h = res_sample_hash(dev_idx, lqpn);
+		for (qp = rs->qp_hash[h]; qp; qp = qp->next)
+			if (qp->dev_idx == dev_idx && qp->lqpn == lqpn)
+				break;
+		if (qp && qp->pid != pid) {
+			/* the number was taken again by another process */
+			struct res_sample_pid *old = res_sample_pid_get(rs,
+								qp->pid);
+
+			if (!old)
+				return MNL_CB_ERROR;
+			old->destroyed++;
+			p->created++;
+			qp->pid = pid;
+		} else if (!qp) {
+			qp = calloc(1, sizeof(*qp));
+			if (!qp)
+				return MNL_CB_ERROR;
+			qp->dev_idx = dev_idx;
+			qp->lqpn = lqpn;
+			qp->pid = pid;
+			qp->next = rs->qp_hash[h];
+			rs->qp_hash[h] = qp;
+			if (!rs->baseline)
+				p->created++;
+		}
+		qp->gen = rs->gen;
+	}
+	return MNL_CB_OK;
+}
+
+/* drop the QPs this poll didn't see, they were destroyed */
+static int res_sample_qp_sweep(struct res_sample *rs)
+{
+	struct res_sample_qp **pqp, *qp;
+	struct res_sample_pid *p;
+	unsigned int h;
+
+	for (h = 0; h < RES_SAMPLE_HASH_SIZE; h++) {
+		pqp = &rs->qp_hash[h];
+		while ((qp = *pqp)) {
+			if (qp->gen == rs->gen) {
+				pqp = &qp->next;
+				continue;
+			}
+			p = res_sample_pid_get(rs, qp->pid);
+			if (!p)
+				return -ENOMEM;
+			p->destroyed++;
+			*pqp = qp->next;
+			free(qp);
+		}
+	}
+
+	/* and the processes that have nothing left */
+	for (h = 0; h < RES_SAMPLE_HASH_SIZE; h++) {
+		struct res_sample_pid **pp = &rs->pid_hash[h];
+
+		while ((p = *pp)) {
+			if (p->gen == rs->gen) {
+				pp = &p->next;
+				continue;
+			}
+			*pp = p->next;
+			free(p);
+			rs->npids--;
+		}
+	}
+	return 0;
+}
+
+static int res_sample_poll(struct res_sample *rs, bool qps)
+{
+	struct rd *rd = rs->rd;
+	unsigned int i;
+	uint32_t seq;
+	int ret;
+
+	rs->gen++;
+	for (i = 0; i < rs->ndevs; i++) {
+		rs->dev = &rs->devs[i];
+
+		rd_prepare_msg(rd, RDMA_NLDEV_CMD_RES_GET, &seq,
+			       NLM_F_REQUEST | NLM_F_ACK);
+		mnl_attr_put_u32(rd->nlh, RDMA_NLDEV_ATTR_DEV_INDEX,
+				 rs->dev->dev_map->idx);
+		ret = rd_send_msg(rd);
+		if (!ret)
+			ret = rd_recv_msg(rd, res_sample_summary_cb, rs, seq);
+		if (ret)
+			return ret;
+
+		if (!qps)
+			continue;
+		/* all the ports of the device in one dump */
+		rd_prepare_msg(rd, RDMA_NLDEV_CMD_RES_QP_GET, &seq,
+			       NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP);
+		mnl_attr_put_u32(rd->nlh, RDMA_NLDEV_ATTR_DEV_INDEX,
+				 rs->dev->dev_map->idx);
+		ret = rd_send_msg(rd);
+		if (!ret)
+			ret = rd_recv_msg(rd, res_sample_qp_cb, rs, seq);
+		if (ret)
+			return ret;
+	}
+	return qps ? res_sample_qp_sweep(rs) : 0;
+}
+
+static int res_sample_pid_cmp(const void *a, const void *b)
+{
+	const struct res_sample_pid *pa = *(struct res_sample_pid **)a;
+	const struct res_sample_pid *pb = *(struct res_sample_pid **)b;
+	unsigned int ca = pa->created + pa->destroyed;
+	unsigned int cb = pb->created + pb->destroyed;
+
+	if (ca != cb)
+		return ca < cb ? 1 : -1;
+	if (pa->qps != pb->qps)
+		return pa->qps < pb->qps ? 1 : -1;
+	return pa->pid < pb->pid ? -1 : pa->pid > pb->pid;
+}
+
+static int res_sample_print(struct res_sample *rs, double secs,
+			    unsigned int top)
+{
+	struct rd *rd = rs->rd;
+	struct res_sample_pid **pids, *p;
+	unsigned int i, j, n = 0;
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (rd->json_output) {
+		jsonw_start_object(rd->jw);
+		jsonw_lluint_field(rd->jw, "time_ns",
+				   now.tv_sec * 1000000000ULL + now.tv_nsec);
+		jsonw_name(rd->jw, "devices");
+		jsonw_start_array(rd->jw);
+	} else {
+		pr_out("%ld.%06ld\n", (long)now.tv_sec, now.tv_nsec / 1000);
+	}
+
+	for (i = 0; i < rs->ndevs; i++) {
+		struct res_sample_dev *dev = &rs->devs[i];
+
+		if (rd->json_output) {
+			jsonw_start_object(rd->jw);
+			jsonw_uint_field(rd->jw, "ifindex", dev->dev_map->idx);
+			jsonw_string_field(rd->jw, "ifname",
+					   dev->dev_map->dev_name);
+		} else {
+			pr_out("%u: %s:", dev->dev_map->idx,
+			       dev->dev_map->dev_name);
+		}
+		for (j = 0; j < dev->nsummary; j++) {
+			struct res_sample_summary *e = &dev->summary[j];
+			double rate = ((double)e->curr - e->prev) / secs;
+
+			if (rd->json_output) {
+				jsonw_name(rd->jw, e->name);
+				jsonw_start_object(rd->jw);
+				jsonw_lluint_field(rd->jw, "curr", e->curr);
+				jsonw_float_field(rd->jw, "rate", rate);
+				jsonw_end_object(rd->jw);
+			} else {
+				pr_out(" %s %"PRIu64" (%+.1f/s)", e->name,
+				       e->curr, rate);
+			}
+			e->prev = e->curr;
+		}
+		if (rd->json_output)
+			jsonw_end_object(rd->jw);
+		else
+			pr_out("\n");
+	}
+	if (rd->json_output)
+		jsonw_end_array(rd->jw);
+
+	if (!top)
+		goto out;
+
+	pids = calloc(rs->npids + 1, sizeof(*pids));
+	if (!pids)
+		return -ENOMEM;
+	for (i = 0; i < RES_SAMPLE_HASH_SIZE; i++)
+		for (p = rs->pid_hash[i]; p; p = p->next)
+			if (p->gen == rs->gen &&
+			    (p->qps || p->created || p->destroyed))
+				pids[n++] = p;
+	qsort(pids, n, sizeof(*pids), res_sample_pid_cmp);
+	if (n > top)
+		n = top;
+
+	if (rd->json_output) {
+		jsonw_name(rd->jw, "pids");
+		jsonw_start_array(rd->jw);
+	}
+	for (i = 0; i < n; i++) {
+		char *comm = NULL;
+
+		p = pids[i];
+		if (p->pid)
+			comm = get_task_name(p->pid);
+		if (rd->json_output) {
+			jsonw_start_object(rd->jw);
+			jsonw_uint_field(rd->jw, "pid", p->pid);
+			if (comm)
+				jsonw_string_field(rd->jw, "comm", comm);
+			jsonw_uint_field(rd->jw, "qp", p->qps);
+			jsonw_float_field(rd->jw, "created",
+					  p->created / secs);
+			jsonw_float_field(rd->jw, "destroyed",
+					  p->destroyed / secs);
+			jsonw_end_object(rd->jw);
+		} else {
+			pr_out("    pid %u [%s] qp %u created %.1f/s destroyed %.1f/s\n",
+			       p->pid, comm ? comm : (p->pid ? "?" : "kernel"),
+			       p->qps, p->created / secs,
+			       p->destroyed / secs);
+		}
+		free(comm);
+	}
+	if (rd->json_output)
+		jsonw_end_array(rd->jw);
+	free(pids);
+
+out:
+	if (rd->json_output)
+		jsonw_end_object(rd->jw);
+	fflush(stdout);
+	return 0;
+}
+
+static void res_sample_free(struct res_sample *rs)
+{
+	struct res_sample_qp *qp;
+	struct res_sample_pid *p;
+	unsigned int h;
+
+	for (h = 0; rs->qp_hash && h < RES_SAMPLE_HASH_SIZE; h++) {
+		while ((qp = rs->qp_hash[h])) {
+			rs->qp_hash[h] = qp->next;
+			free(qp);
+		}
+	}
+	for (h = 0; rs->pid_hash && h < RES_SAMPLE_HASH_SIZE; h++) {
+		while ((p = rs->pid_hash[h])) {
+			rs->pid_hash[h] = p->next;
+			free(p);
+		}
+	}
+	free(rs->qp_hash);
+	free(rs->pid_hash);
+	free(rs->devs);
+}
+
+static int res_sample(struct rd *rd)
+{
+	uint32_t interval = 1000, count = 0, top = 10;
+	struct res_sample rs = { .rd = rd };
+	const struct dev_map *only = NULL;
+	struct dev_map *dev_map;
+	struct timespec next;
+	unsigned int n;
+	int ret = 0;
+
+	if (!rd_no_arg(rd) && strcmpx(rd_argv(rd), "interval") &&
+	    strcmpx(rd_argv(rd), "count") && strcmpx(rd_argv(rd), "top")) {
+		only = dev_map_lookup(rd, false);
+		if (!only) {
+			pr_err("Wrong device name - %s\n", rd_argv(rd));
+			return -ENOENT;
+		}
+		rd_arg_inc(rd);
+	}
+	while (!rd_no_arg(rd)) {
+		const char *arg = rd_argv(rd);
+		uint32_t *val;
+
+		if (!strcmpx(arg, "interval")) {
+			val = &interval;
+		} else if (!strcmpx(arg, "count")) {
+			val = &count;
+		} else if (!strcmpx(arg, "top")) {
+			val = &top;
+		} else {
+			pr_err("Unknown parameter '%s'\n", arg);
+			return -EINVAL;
+		}
+		rd_arg_inc(rd);
+		if (rd_no_arg(rd) || get_u32(val, rd_argv(rd), 0)) {
+			pr_err("Invalid %s value\n", arg);
+			return -EINVAL;
+		}
+		rd_arg_inc(rd);
+	}
+	if (!interval) {
+		pr_err("Sample interval must be positive.\n");
+		return -EINVAL;
+	}
+
+	ret = rd_dev_map_load(rd);
+	if (ret)
+		return ret;
+	list_for_each_entry(dev_map, &rd->dev_map_list, list)
+		rs.ndevs++;
+	rs.devs = calloc(rs.ndevs + 1, sizeof(*rs.devs));
+	rs.qp_hash = calloc(RES_SAMPLE_HASH_SIZE, sizeof(*rs.qp_hash));
+	rs.pid_hash = calloc(RES_SAMPLE_HASH_SIZE, sizeof(*rs.pid_hash));
+	if (!rs.devs || !rs.qp_hash || !rs.pid_hash) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	rs.ndevs = 0;
+	list_for_each_entry(dev_map, &rd->dev_map_list, list)
+		if (!only || dev_map == only)
+			rs.devs[rs.ndevs++].dev_map = dev_map;
+
+	if (rd->json_output)
+		jsonw_lines(rd->jw, true);
+
+	/* the first poll is what the rates of the second are taken from */
+	rs.baseline = true;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (n = 0; !count || n <= count; n++) {
+		if (n)
+			sample_wait(&next, interval / 1000.0);
+
+		ret = res_sample_poll(&rs, top);
+		if (ret)
+			break;
+		if (n)
+			ret = res_sample_print(&rs, interval / 1000.0, top);
+		if (ret)
+			break;
+		rs.baseline = false;
+	}
+
+out:
+	res_sample_free(&rs);
+	return ret;
+}
+
 int cmd_res(struct rd *rd)
 {
 	const struct rd_cmd cmds[] = {
 		{ NULL,		res_show },
 		{ "show",	res_show },
 		{ "list",	res_show },
+		{ "sample",	res_sample },
 		{ "help",	res_help },
 		{ 0 }
 	};
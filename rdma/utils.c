@@ -11,6 +11,10 @@
 
 #include "rdma.h"
 #include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 int rd_argc(struct rd *rd)
 {
@@ -90,32 +94,201 @@ static int get_port_from_argv(struct rd *rd, uint32_t *port,
 	return 0;
 }
 
-static struct dev_map *dev_map_alloc(const char *dev_name)
+/*
+ * The devices are looked up by name and by index in hash tables, whose
+ * size doubles as they fill. The map is only dumped once a command needs
+ * it, and then kept for the next commands of a batch. A name that is not
+ * in a map dumped for an earlier command has the map dumped again. The
+ * devices still there keep their entries, so the arena does not grow
+ * with every dump.
+ */
+#define DEV_HASH_MIN	64
+
+static unsigned int dev_name_hash(const char *name)
+{
+	unsigned int h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return h;
+}
+
+static void dev_map_hash(struct rd *rd, struct dev_map *dev_map)
 {
+	unsigned int mask = rd->dev_hash_size - 1;
+	struct dev_map **pp;
+
+	pp = &rd->dev_name_hash[dev_name_hash(dev_map->dev_name) & mask];
+	dev_map->name_next = *pp;
+	*pp = dev_map;
+
+	pp = &rd->dev_idx_hash[dev_map->idx & mask];
+	dev_map->idx_next = *pp;
+	*pp = dev_map;
+}
+
+/* new tables of size chains for the devices on the list */
+static int dev_map_rehash(struct rd *rd, unsigned int size)
+{
+	struct dev_map **names, **idxs;
 	struct dev_map *dev_map;
 
-	dev_map = calloc(1, sizeof(*dev_map));
-	if (!dev_map)
-		return NULL;
-	dev_map->dev_name = strdup(dev_name);
-	if (!dev_map->dev_name) {
-		free(dev_map);
+	names = calloc(size, sizeof(*names));
+	idxs = calloc(size, sizeof(*idxs));
+	if (!names || !idxs) {
+		free(names);
+		free(idxs);
+		return -ENOMEM;
+	}
+	free(rd->dev_name_hash);
+	free(rd->dev_idx_hash);
+	rd->dev_name_hash = names;
+	rd->dev_idx_hash = idxs;
+	rd->dev_hash_size = size;
+
+	list_for_each_entry(dev_map, &rd->dev_map_list, list)
+		dev_map_hash(rd, dev_map);
+	return 0;
+}
+
+/* the entry of device idx in the previous dump, taken off its chain */
+static struct dev_map *dev_map_reuse(struct rd *rd, uint32_t idx)
+{
+	struct dev_map **pp, *dev_map;
+
+	if (!rd->dev_idx_old)
 		return NULL;
+
+	pp = &rd->dev_idx_old[idx & (rd->dev_old_size - 1)];
+	for (; (dev_map = *pp); pp = &dev_map->idx_next) {
+		if (dev_map->idx == idx) {
+			*pp = dev_map->idx_next;
+			return dev_map;
+		}
+	}
+	return NULL;
+}
+
+static struct dev_map *dev_map_alloc(struct rd *rd, const char *dev_name,
+				     uint32_t idx)
+{
+	struct dev_map *dev_map = dev_map_reuse(rd, idx);
+
+	if (dev_map && strcmp(dev_map->dev_name, dev_name) == 0)
+		return dev_map;
+
+	if (!dev_map) {
+		dev_map = arena_zalloc(&rd->arena, sizeof(*dev_map));
+		if (!dev_map)
+			return NULL;
 	}
+	dev_map->dev_name = arena_strdup(&rd->arena, dev_name);
+	if (!dev_map->dev_name)
+		return NULL;
 
 	return dev_map;
 }
 
-static void dev_map_cleanup(struct rd *rd)
+static unsigned int filter_hash(const char *key)
 {
-	struct dev_map *dev_map, *tmp;
+	unsigned int h = 2166136261U;
+
+	while (*key)
+		h = (h ^ (unsigned char)*key++) * 16777619U;
+	return h & (FILTER_HASH_SIZE - 1);
+}
+
+static struct filter_entry *filter_find(struct rd *rd, const char *key)
+{
+	struct filter_entry *fe;
+
+	for (fe = rd->filter_hash[filter_hash(key)]; fe; fe = fe->next)
+		if (!strcmp(fe->key, key))
+			return fe;
+	return NULL;
+}
+
+static int filter_range_cmp(const void *a, const void *b)
+{
+	const struct filter_range *ra = a, *rb = b;
+
+	if (ra->lo != rb->lo)
+		return ra->lo < rb->lo ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Turn a numeric value into sorted, disjoint ranges. It can come in the
+ * following formats (and their permutations):
+ * numb
+ * numb1,numb2
+ * ,numb1,numb2
+ * numb1-numb2
+ * numb1,numb2-numb3,numb4-numb5
+ */
+static int filter_compile_number(struct rd *rd, struct filter_entry *fe)
+{
+	uint32_t left_val = 0, val;
+	bool range_check = false;
+	char *p = fe->value;
+	unsigned int i, n;
+
+	fe->ranges = arena_alloc(&rd->arena,
+				 (strlen(p) + 1) * sizeof(*fe->ranges));
+	if (!fe->ranges)
+		return -ENOMEM;
+
+	n = 0;
+	while (*p) {
+		if (isdigit(*p)) {
+			val = strtoul(p, &p, 10);
+			fe->ranges[n].lo = val;
+			if (range_check && left_val < val)
+				fe->ranges[n].lo = left_val + 1;
+			fe->ranges[n++].hi = val;
+			left_val = val;
+			range_check = false;
+		} else {
+			if (*p == '-')
+				range_check = true;
+			p++;
+		}
+	}
+
+	if (!n)
+		return 0;
 
-	list_for_each_entry_safe(dev_map, tmp,
-				 &rd->dev_map_list, list) {
-		list_del(&dev_map->list);
-		free(dev_map->dev_name);
-		free(dev_map);
+	/* merge what overlaps, so a lookup is a plain binary search */
+	qsort(fe->ranges, n, sizeof(*fe->ranges), filter_range_cmp);
+	fe->nranges = 1;
+	for (i = 1; i < n; i++) {
+		struct filter_range *last = &fe->ranges[fe->nranges - 1];
+
+		if (last->hi == UINT32_MAX)
+			break;
+		if (fe->ranges[i].lo > last->hi + 1)
+			fe->ranges[fe->nranges++] = fe->ranges[i];
+		else if (fe->ranges[i].hi > last->hi)
+			last->hi = fe->ranges[i].hi;
 	}
+	return 0;
+}
+
+/* str or str1,str2 */
+static int filter_compile_string(struct rd *rd, struct filter_entry *fe)
+{
+	char *str, *p;
+
+	fe->strbuf = arena_strdup(&rd->arena, fe->value);
+	fe->strs = arena_alloc(&rd->arena,
+			       (strlen(fe->value) + 1) * sizeof(*fe->strs));
+	if (!fe->strbuf || !fe->strs)
+		return -ENOMEM;
+
+	for (str = strtok_r(fe->strbuf, ",", &p); str;
+	     str = strtok_r(NULL, ",", &p))
+		fe->strs[fe->nstrs++] = str;
+	return 0;
 }
 
 static int add_filter(struct rd *rd, char *key, char *value,
@@ -124,10 +297,12 @@ static int add_filter(struct rd *rd, char *key, char *value,
 	char cset[] = "1234567890,-";
 	struct filter_entry *fe;
 	bool key_found = false;
+	unsigned int h;
 	int idx = 0;
 	int ret;
 
-	fe = calloc(1, sizeof(*fe));
+	/* all of it is the arena's, also on the way out on an error */
+	fe = arena_zalloc(&rd->arena, sizeof(*fe));
 	if (!fe)
 		return -ENOMEM;
 
@@ -140,8 +315,7 @@ static int add_filter(struct rd *rd, char *key, char *value,
 	}
 	if (!key_found) {
 		pr_err("Unsupported filter option: %s\n", key);
-		ret = -EINVAL;
-		goto err;
+		return -EINVAL;
 	}
 
 	/*
@@ -156,29 +330,36 @@ static int add_filter(struct rd *rd, char *key, char *value,
 	if (valid_filters[idx].is_number &&
 	    strspn(value, cset) != strlen(value)) {
 		pr_err("%s filter accepts \"%s\" characters only\n", key, cset);
-		ret = -EINVAL;
-		goto err;
+		return -EINVAL;
 	}
 
-	fe->key = strdup(key);
-	fe->value = strdup(value);
-	if (!fe->key || !fe->value) {
-		ret = -ENOMEM;
-		goto err_alloc;
-	}
+	/* by the full name, which is what the lookups use */
+	fe->key = arena_strdup(&rd->arena, valid_filters[idx].name);
+	fe->value = arena_strdup(&rd->arena, value);
+	if (!fe->key || !fe->value)
+		return -ENOMEM;
 
 	for (idx = 0; idx < strlen(fe->value); idx++)
 		fe->value[idx] = tolower(fe->value[idx]);
 
+	/*
+	 * The value is parsed once here rather than for every entry of
+	 * a dump, which can have hundreds of thousands of them.
+	 */
+	ret = filter_compile_number(rd, fe);
+	if (!ret)
+		ret = filter_compile_string(rd, fe);
+	if (ret)
+		return ret;
+
 	list_add_tail(&fe->list, &rd->filter_list);
+	/* as with the list walk before, the first of a key is the one used */
+	if (!filter_find(rd, fe->key)) {
+		h = filter_hash(fe->key);
+		fe->next = rd->filter_hash[h];
+		rd->filter_hash[h] = fe;
+	}
 	return 0;
-
-err_alloc:
-	free(fe->value);
-	free(fe->key);
-err:
-	free(fe);
-	return ret;
 }
 
 int rd_build_filter(struct rd *rd, const struct filters valid_filters[])
@@ -219,14 +400,7 @@ out:
 
 bool rd_check_is_key_exist(struct rd *rd, const char *key)
 {
-	struct filter_entry *fe;
-
-	list_for_each_entry(fe, &rd->filter_list, list) {
-		if (!strcmpx(fe->key, key))
-			return true;
-	}
-
-	return false;
+	return filter_find(rd, key);
 }
 
 /*
@@ -236,48 +410,16 @@ bool rd_check_is_key_exist(struct rd *rd, const char *key)
 bool rd_check_is_string_filtered(struct rd *rd,
 				 const char *key, const char *val)
 {
-	bool key_is_filtered = false;
-	struct filter_entry *fe;
-	char *p = NULL;
-	char *str;
-
-	list_for_each_entry(fe, &rd->filter_list, list) {
-		if (!strcmpx(fe->key, key)) {
-			/* We found the key */
-			p = strdup(fe->value);
-			key_is_filtered = true;
-			if (!p) {
-				/*
-				 * Something extremely wrong if we fail
-				 * to allocate small amount of bytes.
-				 */
-				pr_err("Found key, but failed to allocate memory to store value\n");
-				return key_is_filtered;
-			}
+	struct filter_entry *fe = filter_find(rd, key);
+	unsigned int i;
 
-			/*
-			 * Need to check if value in range
-			 * It can come in the following formats
-			 * and their permutations:
-			 * str
-			 * str1,str2
-			 */
-			str = strtok(p, ",");
-			while (str) {
-				if (strlen(str) == strlen(val) &&
-				    !strcasecmp(str, val)) {
-					key_is_filtered = false;
-					goto out;
-				}
-				str = strtok(NULL, ",");
-			}
-			goto out;
-		}
-	}
+	if (!fe)
+		return false;
 
-out:
-	free(p);
-	return key_is_filtered;
+	for (i = 0; i < fe->nstrs; i++)
+		if (!strcasecmp(fe->strs[i], val))
+			return false;
+	return true;
 }
 
 /*
@@ -286,64 +428,24 @@ out:
  */
 bool rd_check_is_filtered(struct rd *rd, const char *key, uint32_t val)
 {
-	bool key_is_filtered = false;
-	struct filter_entry *fe;
+	struct filter_entry *fe = filter_find(rd, key);
+	unsigned int lo = 0, hi;
 
-	list_for_each_entry(fe, &rd->filter_list, list) {
-		uint32_t left_val = 0, fe_value = 0;
-		bool range_check = false;
-		char *p = fe->value;
-
-		if (!strcmpx(fe->key, key)) {
-			/* We found the key */
-			key_is_filtered = true;
-			/*
-			 * Need to check if value in range
-			 * It can come in the following formats
-			 * (and their permutations):
-			 * numb
-			 * numb1,numb2
-			 * ,numb1,numb2
-			 * numb1-numb2
-			 * numb1,numb2-numb3,numb4-numb5
-			 */
-			while (*p) {
-				if (isdigit(*p)) {
-					fe_value = strtol(p, &p, 10);
-					if (fe_value == val ||
-					    (range_check && left_val < val &&
-					     val < fe_value)) {
-						key_is_filtered = false;
-						goto out;
-					}
-					range_check = false;
-				} else {
-					if (*p == '-') {
-						left_val = fe_value;
-						range_check = true;
-					}
-					p++;
-				}
-			}
-			goto out;
-		}
-	}
-
-out:
-	return key_is_filtered;
-}
+	if (!fe)
+		return false;
 
-static void filters_cleanup(struct rd *rd)
-{
-	struct filter_entry *fe, *tmp;
+	hi = fe->nranges;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
 
-	list_for_each_entry_safe(fe, tmp,
-				 &rd->filter_list, list) {
-		list_del(&fe->list);
-		free(fe->key);
-		free(fe->value);
-		free(fe);
+		if (val < fe->ranges[mid].lo)
+			hi = mid;
+		else if (val > fe->ranges[mid].hi)
+			lo = mid + 1;
+		else
+			return false;
 	}
+	return true;
 }
 
 static const enum mnl_attr_data_type nldev_policy[RDMA_NLDEV_ATTR_MAX] = {
@@ -428,24 +530,72 @@ int rd_dev_init_cb(const struct nlmsghdr *nlh, void *data)
 
 	dev_name = mnl_attr_get_str(tb[RDMA_NLDEV_ATTR_DEV_NAME]);
 
-	dev_map = dev_map_alloc(dev_name);
+	dev_map = dev_map_alloc(rd, dev_name,
+				mnl_attr_get_u32(tb[RDMA_NLDEV_ATTR_DEV_INDEX]));
 	if (!dev_map)
 		/* The main function will cleanup the allocations */
 		return MNL_CB_ERROR;
-	list_add_tail(&dev_map->list, &rd->dev_map_list);
 
 	dev_map->num_ports = mnl_attr_get_u32(tb[RDMA_NLDEV_ATTR_PORT_INDEX]);
 	dev_map->idx = mnl_attr_get_u32(tb[RDMA_NLDEV_ATTR_DEV_INDEX]);
+
+	if (++rd->dev_count > rd->dev_hash_size &&
+	    dev_map_rehash(rd, 2 * rd->dev_hash_size))
+		return MNL_CB_ERROR;
+	list_add_tail(&dev_map->list, &rd->dev_map_list);
+	dev_map_hash(rd, dev_map);
 	return MNL_CB_OK;
 }
 
+/* dump the devices into the map if the command is the first to need it */
+int rd_dev_map_load(struct rd *rd)
+{
+	unsigned int size = rd->dev_hash_size ? : DEV_HASH_MIN;
+	uint32_t seq;
+	int ret;
+
+	if (rd->dev_map_loaded)
+		return 0;
+
+	rd->dev_idx_old = rd->dev_idx_hash;
+	rd->dev_old_size = rd->dev_hash_size;
+	free(rd->dev_name_hash);
+	rd->dev_name_hash = rd->dev_idx_hash = NULL;
+	INIT_LIST_HEAD(&rd->dev_map_list);
+	rd->dev_count = 0;
+
+	/* the entries are hashed as they come */
+	ret = dev_map_rehash(rd, size);
+	if (ret)
+		goto out;
+
+	rd_prepare_msg(rd, RDMA_NLDEV_CMD_GET,
+		       &seq, (NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP));
+	ret = rd_send_msg(rd);
+	if (!ret)
+		ret = rd_recv_msg(rd, rd_dev_init_cb, rd, seq);
+	if (!ret)
+		rd->dev_map_loaded = rd->dev_map_fresh = true;
+out:
+	free(rd->dev_idx_old);
+	rd->dev_idx_old = NULL;
+	return ret;
+}
+
 void rd_free(struct rd *rd)
 {
 	if (!rd)
 		return;
 	free(rd->buff);
-	dev_map_cleanup(rd);
-	filters_cleanup(rd);
+	free(rd->dev_name_hash);
+	free(rd->dev_idx_hash);
+	rd->dev_name_hash = rd->dev_idx_hash = NULL;
+	rd->dev_hash_size = rd->dev_count = 0;
+	rd->dev_map_loaded = rd->dev_map_fresh = false;
+	arena_free(&rd->arena);
+	INIT_LIST_HEAD(&rd->dev_map_list);
+	INIT_LIST_HEAD(&rd->filter_list);
+	memset(rd->filter_hash, 0, sizeof(rd->filter_hash));
 }
 
 int rd_set_arg_to_devname(struct rd *rd)
@@ -467,6 +617,234 @@ out:
 	return ret;
 }
 
+/* the device and, from port on, each of its ports unless port is < 0 */
+static int rd_exec_one(struct rd *rd, const struct dev_map *dev_map,
+		       int (*cb)(struct rd *rd), int port)
+{
+	int ret;
+
+	rd->dev_idx = dev_map->idx;
+	if (port < 0)
+		return cb(rd);
+
+	for (; port < dev_map->num_ports + 1; port++) {
+		rd->port_idx = port;
+		ret = cb(rd);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int rd_exec_range(struct rd *rd, struct dev_map **devs,
+			 unsigned int count, int (*cb)(struct rd *rd), int port)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < count; i++) {
+		ret = rd_exec_one(rd, devs[i], cb, port);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+struct dev_job {
+	struct dev_map **devs;
+	unsigned int count;
+	pid_t pid;
+	int fd;		/* read end of its output, -1 once closed */
+	char *out;
+	size_t len;
+	size_t size;
+	int status;
+	bool done;
+};
+
+static int dev_job_start(struct rd *rd, struct dev_job *jobs, unsigned int n,
+			 int (*cb)(struct rd *rd), int port)
+{
+	struct dev_job *job = &jobs[n];
+	int pfd[2];
+
+	if (pipe2(pfd, O_CLOEXEC) < 0) {
+		pr_err("pipe: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	fflush(NULL);
+	job->pid = fork();
+	if (job->pid < 0) {
+		pr_err("fork: %s\n", strerror(errno));
+		close(pfd[0]);
+		close(pfd[1]);
+		return -errno;
+	}
+
+	if (job->pid == 0) {
+		int ret;
+
+		/* only the parent may read, or writers outlive it blocked */
+		while (n--)
+			close(jobs[n].fd);
+		close(pfd[0]);
+		dup2(pfd[1], STDOUT_FILENO);
+		close(pfd[1]);
+		/* every request opens a socket of its own, none is shared */
+		ret = rd_exec_range(rd, job->devs, job->count, cb, port);
+		fflush(stdout);
+		_exit(ret ? 1 : 0);
+	}
+
+	close(pfd[1]);
+	job->fd = pfd[0];
+	return 0;
+}
+
+/* read what there is, held in job->out while an earlier job still runs */
+static void dev_job_read(struct dev_job *job, bool hold)
+{
+	ssize_t n;
+
+	if (job->len == job->size) {
+		size_t size = job->size ? 2 * job->size : 65536;
+		char *p = realloc(job->out, size);
+
+		if (!p) {
+			pr_err("Cannot buffer dump output\n");
+			goto eof;
+		}
+		job->out = p;
+		job->size = size;
+	}
+
+	n = read(job->fd, job->out + job->len, job->size - job->len);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (n > 0) {
+		job->len += n;
+		if (!hold) {
+			if (write(STDOUT_FILENO, job->out, job->len) < 0)
+				job->status = 1;
+			job->len = 0;
+		}
+		return;
+	}
+
+eof:
+	close(job->fd);
+	job->fd = -1;
+	while (waitpid(job->pid, &job->status, 0) < 0 && errno == EINTR)
+		;
+	job->done = true;
+}
+
+/*
+ * Run cb for every device, with rd->jobs processes sharing them out in
+ * ranges when that is more than one. The output of a range is held
+ * until the ranges before it are done, so it reads as one pass.
+ */
+static int rd_exec_all(struct rd *rd, int (*cb)(struct rd *rd), int port)
+{
+	unsigned int count = 0, jobs, emitted = 0, i, first;
+	struct pollfd *pfds = NULL;
+	struct dev_job *job = NULL;
+	struct dev_map **devs;
+	struct dev_map *dev_map;
+	int ret = 0;
+
+	ret = rd_dev_map_load(rd);
+	if (ret)
+		return ret;
+	list_for_each_entry(dev_map, &rd->dev_map_list, list)
+		count++;
+	devs = calloc(count + 1, sizeof(*devs));
+	if (!devs)
+		return -ENOMEM;
+	count = 0;
+	list_for_each_entry(dev_map, &rd->dev_map_list, list)
+		devs[count++] = dev_map;
+
+	/* children can't share a JSON writer */
+	jobs = rd->jobs < count ? rd->jobs : count;
+	if (jobs <= 1 || rd->json_output) {
+		ret = rd_exec_range(rd, devs, count, cb, port);
+		goto out;
+	}
+
+	job = calloc(jobs, sizeof(*job));
+	pfds = calloc(jobs, sizeof(*pfds));
+	if (!job || !pfds) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0, first = 0; i < jobs; i++) {
+		unsigned int last = count * (i + 1) / jobs;
+
+		job[i].devs = devs + first;
+		job[i].count = last - first;
+		job[i].fd = -1;
+		first = last;
+	}
+
+	for (i = 0; i < jobs; i++) {
+		ret = dev_job_start(rd, job, i, cb, port);
+		if (ret) {
+			/* those started still run to the end */
+			jobs = i;
+			break;
+		}
+	}
+
+	while (emitted < jobs) {
+		unsigned int npfd = 0;
+
+		for (i = emitted; i < jobs; i++) {
+			if (job[i].fd < 0)
+				continue;
+			pfds[npfd].fd = job[i].fd;
+			pfds[npfd++].events = POLLIN;
+		}
+		if (npfd && poll(pfds, npfd, -1) < 0 && errno != EINTR) {
+			pr_err("poll: %s\n", strerror(errno));
+			ret = -errno;
+			break;
+		}
+		for (i = emitted, npfd = 0; i < jobs; i++) {
+			if (job[i].fd < 0)
+				continue;
+			if (pfds[npfd++].revents)
+				dev_job_read(&job[i], i != emitted);
+		}
+
+		for (; emitted < jobs && job[emitted].done; emitted++) {
+			if (job[emitted].len &&
+			    write(STDOUT_FILENO, job[emitted].out,
+				  job[emitted].len) < 0)
+				ret = -EIO;
+			if (job[emitted].status && !ret)
+				ret = -EINVAL;
+			free(job[emitted].out);
+			job[emitted].out = NULL;
+		}
+	}
+
+out:
+	/* only left running if poll() failed */
+	for (i = 0; job && i < jobs; i++) {
+		if (job[i].fd >= 0) {
+			close(job[i].fd);
+			waitpid(job[i].pid, NULL, 0);
+		}
+		free(job[i].out);
+	}
+	free(job);
+	free(pfds);
+	free(devs);
+	return ret;
+}
+
 int rd_exec_link(struct rd *rd, int (*cb)(struct rd *rd), bool strict_port)
 {
 	struct dev_map *dev_map;
@@ -476,17 +854,7 @@ int rd_exec_link(struct rd *rd, int (*cb)(struct rd *rd), bool strict_port)
 	if (rd->json_output)
 		jsonw_start_array(rd->jw);
 	if (rd_no_arg(rd)) {
-		list_for_each_entry(dev_map, &rd->dev_map_list, list) {
-			rd->dev_idx = dev_map->idx;
-			port = (strict_port) ? 1 : 0;
-			for (; port < dev_map->num_ports + 1; port++) {
-				rd->port_idx = port;
-				ret = cb(rd);
-				if (ret)
-					goto out;
-			}
-		}
-
+		ret = rd_exec_all(rd, cb, strict_port ? 1 : 0);
 	} else {
 		bool is_dump_all;
 
@@ -527,12 +895,7 @@ int rd_exec_dev(struct rd *rd, int (*cb)(struct rd *rd))
 	if (rd->json_output)
 		jsonw_start_array(rd->jw);
 	if (rd_no_arg(rd)) {
-		list_for_each_entry(dev_map, &rd->dev_map_list, list) {
-			rd->dev_idx = dev_map->idx;
-			ret = cb(rd);
-			if (ret)
-				goto out;
-		}
+		ret = rd_exec_all(rd, cb, -1);
 	} else {
 		dev_map = dev_map_lookup(rd, false);
 		if (!dev_map) {
@@ -631,10 +994,20 @@ static struct dev_map *_dev_map_lookup(struct rd *rd, const char *dev_name)
 {
 	struct dev_map *dev_map;
 
-	list_for_each_entry(dev_map, &rd->dev_map_list, list)
+	if (rd_dev_map_load(rd))
+		return NULL;
+
+	dev_map = rd->dev_name_hash[dev_name_hash(dev_name) &
+				    (rd->dev_hash_size - 1)];
+	for (; dev_map; dev_map = dev_map->name_next)
 		if (strcmp(dev_name, dev_map->dev_name) == 0)
 			return dev_map;
 
+	/* a device that came since an earlier command of the batch */
+	if (!rd->dev_map_fresh) {
+		rd->dev_map_loaded = false;
+		return _dev_map_lookup(rd, dev_name);
+	}
 	return NULL;
 }
 
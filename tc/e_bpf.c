@@ -22,15 +22,24 @@
 
 #define BPF_DEFAULT_CMD	"/bin/sh"
 
+#define BPF_MAP_BATCH_DEFAULT	1024
+#define BPF_MAP_BATCH_MAX	(1 << 20)
+
+#define BPF_PERF_PAGES_DEFAULT	64
+#define BPF_PERF_PAGES_MAX	(1 << 16)
+
 static char *argv_default[] = { BPF_DEFAULT_CMD, NULL };
 
 static void explain(void)
 {
 	fprintf(stderr, "Usage: ... bpf [ import UDS_FILE ] [ run CMD ]\n");
 	fprintf(stderr, "       ... bpf [ debug ]\n");
+	fprintf(stderr, "       ... bpf [ perf map MAP_FILE ] [ pages PAGES ] [ raw ]\n");
 	fprintf(stderr, "       ... bpf [ graft MAP_FILE ] [ key KEY ]\n");
 	fprintf(stderr, "          `... [ object-file OBJ_FILE ] [ type TYPE ] [ section NAME ] [ verbose ]\n");
 	fprintf(stderr, "          `... [ object-pinned PROG_FILE ]\n");
+	fprintf(stderr, "       ... bpf [ map update pinned MAP_FILE file RECORDS ]\n");
+	fprintf(stderr, "          `... [ batch N ] [ exist | noexist ] [ verbose ]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Where UDS_FILE provides the name of a unix domain socket file\n");
 	fprintf(stderr, "to import eBPF maps and the optional CMD denotes the command\n");
@@ -39,6 +48,98 @@ static void explain(void)
 	fprintf(stderr, "and PROG_FILE to a pinned program. TYPE can be {cls, act}, where\n");
 	fprintf(stderr, "\'cls\' is default. KEY is optional and can be inferred from the\n");
 	fprintf(stderr, "section name, otherwise it needs to be provided.\n");
+	fprintf(stderr, "Where RECORDS is a file (\'-\' for stdin) with a key and a value\n");
+	fprintf(stderr, "per line, given as fields of hex bytes or typed as u8:, u16:, u32:,\n");
+	fprintf(stderr, "u64:, be16:, be32:, be64:, ip: or mac:. N records go per update,\n");
+	fprintf(stderr, "%u if not given.\n", BPF_MAP_BATCH_DEFAULT);
+	fprintf(stderr, "Where MAP_FILE of perf is a pinned perf event array, which gets\n");
+	fprintf(stderr, "a ring of PAGES pages (a power of 2, %u if not given) per CPU.\n",
+		BPF_PERF_PAGES_DEFAULT);
+	fprintf(stderr, "Records are printed in hex, or written as a u32 size and the\n");
+	fprintf(stderr, "bytes with raw.\n");
+}
+
+static int parse_map(int argc, char **argv)
+{
+	const char *map_path = NULL, *file = NULL;
+	unsigned int batch = BPF_MAP_BATCH_DEFAULT;
+	uint64_t flags = BPF_ANY;
+	bool verbose = false;
+
+	if (argc == 0 || matches(*argv, "update") != 0) {
+		explain();
+		return -1;
+	}
+	NEXT_ARG_FWD();
+
+	while (argc > 0) {
+		if (matches(*argv, "pinned") == 0 ||
+		    matches(*argv, "object-pinned") == 0) {
+			NEXT_ARG();
+			if (map_path)
+				duparg("pinned", *argv);
+			map_path = *argv;
+		} else if (matches(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (file)
+				duparg("file", *argv);
+			file = *argv;
+		} else if (matches(*argv, "batch") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&batch, *argv, 0) || !batch ||
+			    batch > BPF_MAP_BATCH_MAX)
+				invarg("invalid batch", *argv);
+		} else if (strcmp(*argv, "exist") == 0) {
+			flags = BPF_EXIST;
+		} else if (strcmp(*argv, "noexist") == 0) {
+			flags = BPF_NOEXIST;
+		} else if (matches(*argv, "verbose") == 0) {
+			verbose = true;
+		} else {
+			explain();
+			return -1;
+		}
+		NEXT_ARG_FWD();
+	}
+
+	if (!map_path || !file) {
+		fprintf(stderr, "bpf: map update needs both pinned and file!\n");
+		return -1;
+	}
+
+	return bpf_map_update_file(map_path, file, batch, flags, verbose);
+}
+
+static int parse_perf(int argc, char **argv)
+{
+	unsigned int pages = BPF_PERF_PAGES_DEFAULT;
+	const char *map_path;
+	bool raw = false;
+
+	if (argc == 0 || matches(*argv, "map") != 0) {
+		explain();
+		return -1;
+	}
+	NEXT_ARG();
+	map_path = *argv;
+	NEXT_ARG_FWD();
+
+	while (argc > 0) {
+		if (matches(*argv, "pages") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&pages, *argv, 0) || !pages ||
+			    pages > BPF_PERF_PAGES_MAX || (pages & (pages - 1)))
+				invarg("invalid pages", *argv);
+		} else if (strcmp(*argv, "raw") == 0) {
+			raw = true;
+		} else {
+			explain();
+			return -1;
+		}
+		NEXT_ARG_FWD();
+	}
+
+	return bpf_perf_map(map_path, pages, raw);
 }
 
 static int bpf_num_env_entries(void)
@@ -95,6 +196,12 @@ static int parse_bpf(struct exec_util *eu, int argc, char **argv)
 			}
 			return bpf_graft_map(bpf_map_path, has_key ?
 					     &key : NULL, argc, argv);
+		} else if (matches(*argv, "map") == 0) {
+			NEXT_ARG_FWD();
+			return parse_map(argc, argv);
+		} else if (matches(*argv, "perf") == 0) {
+			NEXT_ARG_FWD();
+			return parse_perf(argc, argv);
 		} else {
 			explain();
 			return -1;
@@ -184,6 +184,7 @@ static int canid_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 struct ematch_util canid_ematch_util = {
 	.kind = "canid",
 	.kind_num = TCF_EM_CANID,
+	.cost = 2,
 	.parse_eopt = canid_parse_eopt,
 	.print_eopt = canid_print_eopt,
 	.print_usage = canid_print_usage
@@ -178,6 +178,7 @@ static int cmp_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 struct ematch_util cmp_ematch_util = {
 	.kind = "cmp",
 	.kind_num = TCF_EM_CMP,
+	.cost = 1,
 	.parse_eopt = cmp_parse_eopt,
 	.print_eopt = cmp_print_eopt,
 	.print_usage = cmp_print_usage
@@ -257,6 +257,7 @@ static int ipset_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 struct ematch_util ipset_ematch_util = {
 	.kind = "ipset",
 	.kind_num = TCF_EM_IPSET,
+	.cost = 8,
 	.parse_eopt = ipset_parse_eopt,
 	.print_eopt = ipset_print_eopt,
 	.print_usage = ipset_print_usage
@@ -204,6 +204,7 @@ static int em_ipt_print_epot(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 struct ematch_util ipt_ematch_util = {
 	.kind = "ipt",
 	.kind_num = TCF_EM_IPT,
+	.cost = 10,
 	.parse_eopt_argv = em_ipt_parse_eopt_argv,
 	.print_eopt = em_ipt_print_epot,
 	.print_usage = em_ipt_print_usage
@@ -539,6 +539,7 @@ static int meta_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 struct ematch_util meta_ematch_util = {
 	.kind = "meta",
 	.kind_num = TCF_EM_META,
+	.cost = 2,
 	.parse_eopt = meta_parse_eopt,
 	.print_eopt = meta_print_eopt,
 	.print_usage = meta_print_usage
@@ -134,6 +134,7 @@ static int nbyte_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 struct ematch_util nbyte_ematch_util = {
 	.kind = "nbyte",
 	.kind_num = TCF_EM_NBYTE,
+	.cost = 2,
 	.parse_eopt = nbyte_parse_eopt,
 	.print_eopt = nbyte_print_eopt,
 	.print_usage = nbyte_print_usage
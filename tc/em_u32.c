@@ -169,6 +169,7 @@ static int u32_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 struct ematch_util u32_ematch_util = {
 	.kind = "u32",
 	.kind_num = TCF_EM_U32,
+	.cost = 1,
 	.parse_eopt = u32_parse_eopt,
 	.print_eopt = u32_print_eopt,
 	.print_usage = u32_print_usage
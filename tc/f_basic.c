@@ -144,4 +144,5 @@ struct filter_util basic_filter_util = {
 	.id = "basic",
 	.parse_fopt = basic_parse_opt,
 	.print_fopt = basic_print_opt,
+	.act_attr = TCA_BASIC_ACT,
 };
@@ -31,7 +31,8 @@ static void explain(void)
 	fprintf(stderr, "\n");
 	fprintf(stderr, "eBPF use case:\n");
 	fprintf(stderr, " object-file FILE [ section CLS_NAME ] [ export UDS_FILE ]");
-	fprintf(stderr, " [ verbose ] [ direct-action ] [ skip_hw | skip_sw ]\n");
+	fprintf(stderr, " [ verbose ] [ timing ] [ log-size BYTES ]\n");
+	fprintf(stderr, "  [ direct-action ] [ skip_hw | skip_sw ]\n");
 	fprintf(stderr, " object-pinned FILE [ direct-action ] [ skip_hw | skip_sw ]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Common remaining options:\n");
@@ -51,6 +52,8 @@ static void explain(void)
 	fprintf(stderr, "Where UDS_FILE points to a unix domain socket file in order\n");
 	fprintf(stderr, "to hand off control of all created eBPF maps to an agent.\n");
 	fprintf(stderr, "\n");
+	fprintf(stderr, "Where BYTES is the size of the verifier log to load with.\n");
+	fprintf(stderr, "\n");
 	fprintf(stderr, "ACTION_SPEC := ... look at individual actions\n");
 	fprintf(stderr, "NOTE: CLASSID is parsed as hexadecimal input.\n");
 }
@@ -264,4 +267,5 @@ struct filter_util bpf_filter_util = {
 	.id		= "bpf",
 	.parse_fopt	= bpf_parse_opt,
 	.print_fopt	= bpf_print_opt,
+	.act_attr = TCA_BPF_ACT,
 };
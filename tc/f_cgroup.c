@@ -111,4 +111,5 @@ struct filter_util cgroup_filter_util = {
 	.id = "cgroup",
 	.parse_fopt = cgroup_parse_opt,
 	.print_fopt = cgroup_print_opt,
+	.act_attr = TCA_CGROUP_ACT,
 };
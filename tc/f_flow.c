@@ -355,4 +355,5 @@ struct filter_util flow_filter_util = {
 	.id		= "flow",
 	.parse_fopt	= flow_parse_opt,
 	.print_fopt	= flow_print_opt,
+	.act_attr = TCA_FLOW_ACT,
 };
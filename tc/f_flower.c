@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <net/if.h>
 #include <linux/if_arp.h>
 #include <linux/if_ether.h>
@@ -22,6 +23,7 @@
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_common.h"
 #include "rt_names.h"
 
 enum flower_matching_flags {
@@ -44,6 +46,7 @@ static void explain(void)
 		"Usage: ... flower [ MATCH-LIST ]\n"
 		"                  [ skip_sw | skip_hw ]\n"
 		"                  [ action ACTION-SPEC ] [ classid CLASSID ]\n"
+		"                  [ file FILE ]\n"
 		"\n"
 		"Where: MATCH-LIST := [ MATCH-LIST ] MATCH\n"
 		"       MATCH      := { indev DEV-NAME |\n"
@@ -79,6 +82,7 @@ static void explain(void)
 		"       FILTERID := X:Y:Z\n"
 		"       MASKED_LLADDR := { LLADDR | LLADDR/MASK | LLADDR/BITS }\n"
 		"       ACTION-SPEC := ... look at individual actions\n"
+		"       FILE := one MATCH-LIST per line, sharing the rest\n"
 		"\n"
 		"NOTE: CLASSID, IP-PROTO are parsed as hexadecimal input.\n"
 		"NOTE: There can be only used one mask per one prio. If user needs\n"
@@ -578,34 +582,22 @@ static int flower_parse_enc_port(char *str, int type, struct nlmsghdr *n)
 	return 0;
 }
 
-static int flower_parse_opt(struct filter_util *qu, char *handle,
-			    int argc, char **argv, struct nlmsghdr *n)
+/* What parsing a MATCH depends on from those before it */
+struct flower_opts {
+	__be16 eth_type;
+	__be16 vlan_ethtype;
+	__u8 ip_proto;
+	__u32 flags;
+	__u32 mtf;
+	__u32 mtf_mask;
+};
+
+/* Add the attributes of argv to the TCA_OPTIONS nest being filled in n */
+static int flower_parse_args(struct flower_opts *o, int argc, char **argv,
+			     struct nlmsghdr *n, char **file)
 {
-	int ret;
 	struct tcmsg *t = NLMSG_DATA(n);
-	struct rtattr *tail;
-	__be16 eth_type = TC_H_MIN(t->tcm_info);
-	__be16 vlan_ethtype = 0;
-	__u8 ip_proto = 0xff;
-	__u32 flags = 0;
-	__u32 mtf = 0;
-	__u32 mtf_mask = 0;
-
-	if (handle) {
-		ret = get_u32(&t->tcm_handle, handle, 0);
-		if (ret) {
-			fprintf(stderr, "Illegal \"handle\"\n");
-			return -1;
-		}
-	}
-
-	tail = (struct rtattr *) (((void *) n) + NLMSG_ALIGN(n->nlmsg_len));
-	addattr_l(n, MAX_MSG, TCA_OPTIONS, NULL, 0);
-
-	if (argc == 0) {
-		/*at minimal we will match all ethertype packets */
-		goto parse_done;
-	}
+	int ret;
 
 	while (argc > 0) {
 		if (matches(*argv, "classid") == 0 ||
@@ -642,16 +634,16 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			NEXT_ARG();
 			ret = flower_parse_matching_flags(*argv,
 							  FLOWER_IP_FLAGS,
-							  &mtf,
-							  &mtf_mask);
+							  &o->mtf,
+							  &o->mtf_mask);
 			if (ret < 0) {
 				fprintf(stderr, "Illegal \"ip_flags\"\n");
 				return -1;
 			}
 		} else if (matches(*argv, "skip_hw") == 0) {
-			flags |= TCA_CLS_FLAGS_SKIP_HW;
+			o->flags |= TCA_CLS_FLAGS_SKIP_HW;
 		} else if (matches(*argv, "skip_sw") == 0) {
-			flags |= TCA_CLS_FLAGS_SKIP_SW;
+			o->flags |= TCA_CLS_FLAGS_SKIP_SW;
 		} else if (matches(*argv, "indev") == 0) {
 			NEXT_ARG();
 			if (check_ifname(*argv))
@@ -661,7 +653,7 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			__u16 vid;
 
 			NEXT_ARG();
-			if (eth_type != htons(ETH_P_8021Q)) {
+			if (o->eth_type != htons(ETH_P_8021Q)) {
 				fprintf(stderr,
 					"Can't set \"vlan_id\" if ethertype isn't 802.1Q\n");
 				return -1;
@@ -676,7 +668,7 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			__u8 vlan_prio;
 
 			NEXT_ARG();
-			if (eth_type != htons(ETH_P_8021Q)) {
+			if (o->eth_type != htons(ETH_P_8021Q)) {
 				fprintf(stderr,
 					"Can't set \"vlan_prio\" if ethertype isn't 802.1Q\n");
 				return -1;
@@ -690,17 +682,17 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 				 TCA_FLOWER_KEY_VLAN_PRIO, vlan_prio);
 		} else if (matches(*argv, "vlan_ethtype") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_vlan_eth_type(*argv, eth_type,
+			ret = flower_parse_vlan_eth_type(*argv, o->eth_type,
 						 TCA_FLOWER_KEY_VLAN_ETH_TYPE,
-						 &vlan_ethtype, n);
+						 &o->vlan_ethtype, n);
 			if (ret < 0)
 				return -1;
 		} else if (matches(*argv, "mpls_label") == 0) {
 			__u32 label;
 
 			NEXT_ARG();
-			if (eth_type != htons(ETH_P_MPLS_UC) &&
-			    eth_type != htons(ETH_P_MPLS_MC)) {
+			if (o->eth_type != htons(ETH_P_MPLS_UC) &&
+			    o->eth_type != htons(ETH_P_MPLS_MC)) {
 				fprintf(stderr,
 					"Can't set \"mpls_label\" if ethertype isn't MPLS\n");
 				return -1;
@@ -715,8 +707,8 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			__u8 tc;
 
 			NEXT_ARG();
-			if (eth_type != htons(ETH_P_MPLS_UC) &&
-			    eth_type != htons(ETH_P_MPLS_MC)) {
+			if (o->eth_type != htons(ETH_P_MPLS_UC) &&
+			    o->eth_type != htons(ETH_P_MPLS_MC)) {
 				fprintf(stderr,
 					"Can't set \"mpls_tc\" if ethertype isn't MPLS\n");
 				return -1;
@@ -731,8 +723,8 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			__u8 bos;
 
 			NEXT_ARG();
-			if (eth_type != htons(ETH_P_MPLS_UC) &&
-			    eth_type != htons(ETH_P_MPLS_MC)) {
+			if (o->eth_type != htons(ETH_P_MPLS_UC) &&
+			    o->eth_type != htons(ETH_P_MPLS_MC)) {
 				fprintf(stderr,
 					"Can't set \"mpls_bos\" if ethertype isn't MPLS\n");
 				return -1;
@@ -747,8 +739,8 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			__u8 ttl;
 
 			NEXT_ARG();
-			if (eth_type != htons(ETH_P_MPLS_UC) &&
-			    eth_type != htons(ETH_P_MPLS_MC)) {
+			if (o->eth_type != htons(ETH_P_MPLS_UC) &&
+			    o->eth_type != htons(ETH_P_MPLS_MC)) {
 				fprintf(stderr,
 					"Can't set \"mpls_ttl\" if ethertype isn't MPLS\n");
 				return -1;
@@ -781,10 +773,10 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "ip_proto") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_ip_proto(*argv, vlan_ethtype ?
-						    vlan_ethtype : eth_type,
+			ret = flower_parse_ip_proto(*argv, o->vlan_ethtype ?
+						    o->vlan_ethtype : o->eth_type,
 						    TCA_FLOWER_KEY_IP_PROTO,
-						    &ip_proto, n);
+						    &o->ip_proto, n);
 			if (ret < 0) {
 				fprintf(stderr, "Illegal \"ip_proto\"\n");
 				return -1;
@@ -811,8 +803,8 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "dst_ip") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_ip_addr(*argv, vlan_ethtype ?
-						   vlan_ethtype : eth_type,
+			ret = flower_parse_ip_addr(*argv, o->vlan_ethtype ?
+						   o->vlan_ethtype : o->eth_type,
 						   TCA_FLOWER_KEY_IPV4_DST,
 						   TCA_FLOWER_KEY_IPV4_DST_MASK,
 						   TCA_FLOWER_KEY_IPV6_DST,
@@ -824,8 +816,8 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "src_ip") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_ip_addr(*argv, vlan_ethtype ?
-						   vlan_ethtype : eth_type,
+			ret = flower_parse_ip_addr(*argv, o->vlan_ethtype ?
+						   o->vlan_ethtype : o->eth_type,
 						   TCA_FLOWER_KEY_IPV4_SRC,
 						   TCA_FLOWER_KEY_IPV4_SRC_MASK,
 						   TCA_FLOWER_KEY_IPV6_SRC,
@@ -837,7 +829,7 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "dst_port") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_port(*argv, ip_proto,
+			ret = flower_parse_port(*argv, o->ip_proto,
 						FLOWER_ENDPOINT_DST, n);
 			if (ret < 0) {
 				fprintf(stderr, "Illegal \"dst_port\"\n");
@@ -845,7 +837,7 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "src_port") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_port(*argv, ip_proto,
+			ret = flower_parse_port(*argv, o->ip_proto,
 						FLOWER_ENDPOINT_SRC, n);
 			if (ret < 0) {
 				fprintf(stderr, "Illegal \"src_port\"\n");
@@ -863,7 +855,7 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "type") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_icmp(*argv, eth_type, ip_proto,
+			ret = flower_parse_icmp(*argv, o->eth_type, o->ip_proto,
 						FLOWER_ICMP_FIELD_TYPE, n);
 			if (ret < 0) {
 				fprintf(stderr, "Illegal \"icmp type\"\n");
@@ -871,7 +863,7 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "code") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_icmp(*argv, eth_type, ip_proto,
+			ret = flower_parse_icmp(*argv, o->eth_type, o->ip_proto,
 						FLOWER_ICMP_FIELD_CODE, n);
 			if (ret < 0) {
 				fprintf(stderr, "Illegal \"icmp code\"\n");
@@ -879,8 +871,8 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "arp_tip") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_arp_ip_addr(*argv, vlan_ethtype ?
-						       vlan_ethtype : eth_type,
+			ret = flower_parse_arp_ip_addr(*argv, o->vlan_ethtype ?
+						       o->vlan_ethtype : o->eth_type,
 						       TCA_FLOWER_KEY_ARP_TIP,
 						       TCA_FLOWER_KEY_ARP_TIP_MASK,
 						       n);
@@ -890,8 +882,8 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "arp_sip") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_arp_ip_addr(*argv, vlan_ethtype ?
-						       vlan_ethtype : eth_type,
+			ret = flower_parse_arp_ip_addr(*argv, o->vlan_ethtype ?
+						       o->vlan_ethtype : o->eth_type,
 						       TCA_FLOWER_KEY_ARP_SIP,
 						       TCA_FLOWER_KEY_ARP_SIP_MASK,
 						       n);
@@ -901,8 +893,8 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 			}
 		} else if (matches(*argv, "arp_op") == 0) {
 			NEXT_ARG();
-			ret = flower_parse_arp_op(*argv, vlan_ethtype ?
-						  vlan_ethtype : eth_type,
+			ret = flower_parse_arp_op(*argv, o->vlan_ethtype ?
+						  o->vlan_ethtype : o->eth_type,
 						  TCA_FLOWER_KEY_ARP_OP,
 						  TCA_FLOWER_KEY_ARP_OP_MASK,
 						  n);
@@ -970,6 +962,9 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 				fprintf(stderr, "Illegal \"enc_dst_port\"\n");
 				return -1;
 			}
+		} else if (file && strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			*file = *argv;
 		} else if (matches(*argv, "action") == 0) {
 			NEXT_ARG();
 			ret = parse_action(&argc, &argv, TCA_FLOWER_ACT, n);
@@ -989,23 +984,30 @@ static int flower_parse_opt(struct filter_util *qu, char *handle,
 		argc--; argv++;
 	}
 
-parse_done:
-	ret = addattr32(n, MAX_MSG, TCA_FLOWER_FLAGS, flags);
+	return 0;
+}
+
+static int flower_parse_done(const struct flower_opts *o, struct nlmsghdr *n,
+			     struct rtattr *tail)
+{
+	int ret;
+
+	ret = addattr32(n, MAX_MSG, TCA_FLOWER_FLAGS, o->flags);
 	if (ret)
 		return ret;
 
-	if (mtf_mask) {
-		ret = addattr32(n, MAX_MSG, TCA_FLOWER_KEY_FLAGS, htonl(mtf));
+	if (o->mtf_mask) {
+		ret = addattr32(n, MAX_MSG, TCA_FLOWER_KEY_FLAGS, htonl(o->mtf));
 		if (ret)
 			return ret;
 
-		ret = addattr32(n, MAX_MSG, TCA_FLOWER_KEY_FLAGS_MASK, htonl(mtf_mask));
+		ret = addattr32(n, MAX_MSG, TCA_FLOWER_KEY_FLAGS_MASK, htonl(o->mtf_mask));
 		if (ret)
 			return ret;
 	}
 
-	if (eth_type != htons(ETH_P_ALL)) {
-		ret = addattr16(n, MAX_MSG, TCA_FLOWER_KEY_ETH_TYPE, eth_type);
+	if (o->eth_type != htons(ETH_P_ALL)) {
+		ret = addattr16(n, MAX_MSG, TCA_FLOWER_KEY_ETH_TYPE, o->eth_type);
 		if (ret)
 			return ret;
 	}
@@ -1015,6 +1017,353 @@ parse_done:
 	return 0;
 }
 
+
+/*
+ * With "file FILE" the command line is a header shared by the filters
+ * of FILE, one per line, each line a MATCH-LIST of its own. The header
+ * is encoded once and every line added to a copy of it. Once the whole
+ * file is parsed the filters are installed grouped by the masks they
+ * use, the groups in the order of their first line: the kernel keeps
+ * one hash table per mask, in the order the masks appeared, so this
+ * only saves it going back and forth between them.
+ */
+static const bool flower_mask_attr[TCA_FLOWER_MAX + 1] = {
+	[TCA_FLOWER_KEY_ETH_DST_MASK]		= true,
+	[TCA_FLOWER_KEY_ETH_SRC_MASK]		= true,
+	[TCA_FLOWER_KEY_IPV4_SRC_MASK]		= true,
+	[TCA_FLOWER_KEY_IPV4_DST_MASK]		= true,
+	[TCA_FLOWER_KEY_IPV6_SRC_MASK]		= true,
+	[TCA_FLOWER_KEY_IPV6_DST_MASK]		= true,
+	[TCA_FLOWER_KEY_ENC_IPV4_SRC_MASK]	= true,
+	[TCA_FLOWER_KEY_ENC_IPV4_DST_MASK]	= true,
+	[TCA_FLOWER_KEY_ENC_IPV6_SRC_MASK]	= true,
+	[TCA_FLOWER_KEY_ENC_IPV6_DST_MASK]	= true,
+	[TCA_FLOWER_KEY_TCP_SRC_MASK]		= true,
+	[TCA_FLOWER_KEY_TCP_DST_MASK]		= true,
+	[TCA_FLOWER_KEY_UDP_SRC_MASK]		= true,
+	[TCA_FLOWER_KEY_UDP_DST_MASK]		= true,
+	[TCA_FLOWER_KEY_SCTP_SRC_MASK]		= true,
+	[TCA_FLOWER_KEY_SCTP_DST_MASK]		= true,
+	[TCA_FLOWER_KEY_ENC_UDP_SRC_PORT_MASK]	= true,
+	[TCA_FLOWER_KEY_ENC_UDP_DST_PORT_MASK]	= true,
+	[TCA_FLOWER_KEY_FLAGS_MASK]		= true,
+	[TCA_FLOWER_KEY_ICMPV4_CODE_MASK]	= true,
+	[TCA_FLOWER_KEY_ICMPV4_TYPE_MASK]	= true,
+	[TCA_FLOWER_KEY_ICMPV6_CODE_MASK]	= true,
+	[TCA_FLOWER_KEY_ICMPV6_TYPE_MASK]	= true,
+	[TCA_FLOWER_KEY_ARP_SIP_MASK]		= true,
+	[TCA_FLOWER_KEY_ARP_TIP_MASK]		= true,
+	[TCA_FLOWER_KEY_ARP_OP_MASK]		= true,
+	[TCA_FLOWER_KEY_ARP_SHA_MASK]		= true,
+	[TCA_FLOWER_KEY_ARP_THA_MASK]		= true,
+	[TCA_FLOWER_KEY_TCP_FLAGS_MASK]		= true,
+	[TCA_FLOWER_KEY_IP_TOS_MASK]		= true,
+	[TCA_FLOWER_KEY_IP_TTL_MASK]		= true,
+};
+
+#define FLOWER_SIG_MAX		1024
+#define FLOWER_BULK_HASH	1024
+
+struct flower_rule {
+	size_t		off;	/* of the request in bulk.msgs */
+	unsigned int	line;
+	unsigned int	group;
+};
+
+struct flower_group {
+	__u32		hash;
+	unsigned int	next;	/* hash chain, index + 1 */
+	size_t		sig_off;
+	unsigned int	sig_len;
+	unsigned int	count;
+};
+
+struct flower_bulk {
+	const char		*file;
+	char			*msgs;
+	size_t			msgs_len;
+	size_t			msgs_size;
+	struct flower_rule	*rules;
+	size_t			rules_size;
+	unsigned int		nrules;
+	struct flower_group	*groups;
+	size_t			groups_size;
+	unsigned int		ngroups;
+	char			*sigs;
+	size_t			sigs_len;
+	size_t			sigs_size;
+	unsigned int		hash[FLOWER_BULK_HASH];
+	int			failed;
+};
+
+/* Make room for len bytes in a buffer that doubles as it fills */
+static int flower_bulk_grow(void *bufp, size_t *size, size_t len)
+{
+	void **buf = bufp;
+	size_t new = *size ? *size : 4096;
+	void *p;
+
+	if (len <= *size)
+		return 0;
+	while (new < len)
+		new *= 2;
+	p = realloc(*buf, new);
+	if (!p)
+		return -1;
+	*buf = p;
+	*size = new;
+	return 0;
+}
+
+/*
+ * The masks a filter uses: the keys it has, with the value of those
+ * that come with a mask attribute. Keys without one are matched whole.
+ */
+static int flower_mask_sig(struct rtattr *opts, char *sig)
+{
+	struct rtattr *tb[TCA_FLOWER_MAX + 1];
+	int i, len = 0;
+
+	parse_rtattr_nested(tb, TCA_FLOWER_MAX, opts);
+	for (i = 1; i <= TCA_FLOWER_MAX; i++) {
+		__u16 type = i;
+		int alen;
+
+		if (!tb[i] || i == TCA_FLOWER_CLASSID ||
+		    i == TCA_FLOWER_ACT || i == TCA_FLOWER_FLAGS)
+			continue;
+
+		alen = flower_mask_attr[i] ? RTA_PAYLOAD(tb[i]) : 0;
+		if (len + sizeof(type) + alen > FLOWER_SIG_MAX)
+			return -1;
+		memcpy(sig + len, &type, sizeof(type));
+		len += sizeof(type);
+		memcpy(sig + len, RTA_DATA(tb[i]), alen);
+		len += alen;
+	}
+	return len;
+}
+
+static int flower_bulk_add(struct flower_bulk *b, struct nlmsghdr *n,
+			   struct rtattr *opts, unsigned int line)
+{
+	size_t len = NLMSG_ALIGN(n->nlmsg_len);
+	struct flower_group *g = NULL;
+	struct flower_rule *rule;
+	char sig[FLOWER_SIG_MAX];
+	unsigned int i;
+	__u32 hash = 2166136261U;
+	int sig_len;
+
+	sig_len = flower_mask_sig(opts, sig);
+	if (sig_len < 0)
+		return -1;
+	for (i = 0; i < sig_len; i++)
+		hash = (hash ^ (__u8)sig[i]) * 16777619U;
+
+	for (i = b->hash[hash % FLOWER_BULK_HASH]; i; i = g->next) {
+		g = &b->groups[i - 1];
+		if (g->hash == hash && g->sig_len == sig_len &&
+		    !memcmp(b->sigs + g->sig_off, sig, sig_len))
+			break;
+		g = NULL;
+	}
+	if (!g) {
+		if (flower_bulk_grow(&b->groups, &b->groups_size,
+				     (b->ngroups + 1) * sizeof(*g)) < 0 ||
+		    flower_bulk_grow(&b->sigs, &b->sigs_size,
+				     b->sigs_len + sig_len) < 0)
+			return -1;
+		g = &b->groups[b->ngroups++];
+		g->hash = hash;
+		g->next = b->hash[hash % FLOWER_BULK_HASH];
+		b->hash[hash % FLOWER_BULK_HASH] = b->ngroups;
+		g->sig_off = b->sigs_len;
+		g->sig_len = sig_len;
+		g->count = 0;
+		memcpy(b->sigs + b->sigs_len, sig, sig_len);
+		b->sigs_len += sig_len;
+	}
+
+	if (flower_bulk_grow(&b->rules, &b->rules_size,
+			     (b->nrules + 1) * sizeof(*rule)) < 0 ||
+	    flower_bulk_grow(&b->msgs, &b->msgs_size, b->msgs_len + len) < 0)
+		return -1;
+	rule = &b->rules[b->nrules++];
+	rule->off = b->msgs_len;
+	rule->line = line;
+	rule->group = g - b->groups;
+	g->count++;
+	memcpy(b->msgs + b->msgs_len, n, n->nlmsg_len);
+	b->msgs_len += len;
+	return 0;
+}
+
+static void flower_bulk_err(__u32 cookie, int error, void *arg)
+{
+	struct flower_bulk *b = arg;
+
+	fprintf(stderr, "Command failed %s:%u\n", b->file, cookie);
+	b->failed++;
+}
+
+/* Install the filters a group at a time, on a pipeline of their own */
+static void flower_bulk_send(struct flower_bulk *b, unsigned int *order)
+{
+	struct rtnl_async *async = rth.async;
+	int flags = rth.flags;
+	unsigned int i, off = 0;
+
+	for (i = 0; i < b->ngroups; i++) {
+		unsigned int count = b->groups[i].count;
+
+		b->groups[i].count = off;
+		off += count;
+	}
+	for (i = 0; i < b->nrules; i++)
+		order[b->groups[b->rules[i].group].count++] = i;
+
+	/* a batch this is part of has its own idea of lines */
+	if (async) {
+		rtnl_async_flush(&rth);
+		rth.async = NULL;
+	}
+	if (rtnl_async_begin(&rth, 0, flower_bulk_err, b) == 0)
+		rth.flags |= RTNL_HANDLE_F_ASYNC;
+
+	for (i = 0; i < b->nrules; i++) {
+		struct flower_rule *rule = &b->rules[order[i]];
+
+		rtnl_async_cookie(&rth, rule->line);
+		if (rtnl_talk(&rth, (struct nlmsghdr *)(b->msgs + rule->off),
+			      NULL) < 0)
+			flower_bulk_err(rule->line, -errno, b);
+	}
+
+	rtnl_async_end(&rth);
+	rth.async = async;
+	rth.flags = flags;
+}
+
+static int flower_bulk(struct nlmsghdr *n, struct rtattr *tail,
+		       const struct flower_opts *o, const char *file)
+{
+	struct flower_bulk *b;
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+		char		buf[MAX_MSG];
+	} req;
+	struct rtattr *opts = (void *)&req + ((void *)tail - (void *)n);
+	int lineno = cmdlineno, ret = -1;
+	unsigned int *order = NULL;
+	char *largv[100];
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	if (n->nlmsg_type != RTM_NEWTFILTER) {
+		fprintf(stderr, "\"file\" can only be used to add filters\n");
+		return -1;
+	}
+	if (((struct tcmsg *)NLMSG_DATA(n))->tcm_handle) {
+		fprintf(stderr, "\"handle\" cannot be shared by the filters of a file\n");
+		return -1;
+	}
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			file, strerror(errno));
+		return -1;
+	}
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		goto out;
+	b->file = file;
+
+	/* attributes leave their padding as it was, keep it zeroed */
+	memset(&req, 0, sizeof(req));
+	memcpy(&req, n, n->nlmsg_len);
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		struct flower_opts lo = *o;
+		int largc;
+
+		largc = makeargs(line, largv, 100);
+		if (largc == 0)
+			continue;
+
+		memset((void *)&req + n->nlmsg_len, 0,
+		       req.n.nlmsg_len - n->nlmsg_len);
+		memcpy(&req, n, n->nlmsg_len);
+		if (flower_parse_args(&lo, largc, largv, &req.n, NULL) ||
+		    flower_parse_done(&lo, &req.n, opts)) {
+			fprintf(stderr, "Command failed %s:%d\n", file,
+				cmdlineno);
+			goto out;
+		}
+		if (flower_bulk_add(b, &req.n, opts, cmdlineno) < 0) {
+			fprintf(stderr, "Cannot queue filter %s:%d: %s\n",
+				file, cmdlineno, strerror(errno));
+			goto out;
+		}
+	}
+
+	order = malloc((b->nrules ? : 1) * sizeof(*order));
+	if (!order)
+		goto out;
+	flower_bulk_send(b, order);
+	ret = b->failed ? 1 : TC_FOPT_SENT;
+out:
+	cmdlineno = lineno;
+	fclose(fp);
+	free(line);
+	free(order);
+	if (b) {
+		free(b->msgs);
+		free(b->rules);
+		free(b->groups);
+		free(b->sigs);
+		free(b);
+	}
+	return ret;
+}
+
+static int flower_parse_opt(struct filter_util *qu, char *handle,
+			    int argc, char **argv, struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct flower_opts o = {
+		.eth_type = TC_H_MIN(t->tcm_info),
+		.ip_proto = 0xff,
+	};
+	struct rtattr *tail;
+	char *file = NULL;
+	int ret;
+
+	if (handle) {
+		ret = get_u32(&t->tcm_handle, handle, 0);
+		if (ret) {
+			fprintf(stderr, "Illegal \"handle\"\n");
+			return -1;
+		}
+	}
+
+	tail = (struct rtattr *) (((void *) n) + NLMSG_ALIGN(n->nlmsg_len));
+	addattr_l(n, MAX_MSG, TCA_OPTIONS, NULL, 0);
+
+	/* at minimal we will match all ethertype packets */
+	ret = flower_parse_args(&o, argc, argv, n, &file);
+	if (ret)
+		return ret;
+
+	if (file)
+		return flower_bulk(n, tail, &o, file);
+
+	return flower_parse_done(&o, n, tail);
+}
+
 static int __mask_bits(char *addr, size_t len)
 {
 	int bits = 0;
@@ -1491,4 +1840,5 @@ struct filter_util flower_filter_util = {
 	.id = "flower",
 	.parse_fopt = flower_parse_opt,
 	.print_fopt = flower_print_opt,
+	.act_attr = TCA_FLOWER_ACT,
 };
@@ -167,4 +167,5 @@ struct filter_util fw_filter_util = {
 	.id = "fw",
 	.parse_fopt = fw_parse_opt,
 	.print_fopt = fw_print_opt,
+	.act_attr = TCA_FW_ACT,
 };
@@ -153,4 +153,5 @@ struct filter_util matchall_filter_util = {
 	.id = "matchall",
 	.parse_fopt = matchall_parse_opt,
 	.print_fopt = matchall_print_opt,
+	.act_attr = TCA_MATCHALL_ACT,
 };
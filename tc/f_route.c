@@ -79,7 +79,6 @@ static int route_parse_opt(struct filter_util *qu, char *handle, int argc, char
 			__u32 id;
 
 			NEXT_ARG();
-			ll_init_map(&rth);
 			if ((id = ll_name_to_index(*argv)) <= 0) {
 				fprintf(stderr, "Illegal \"fromif\"\n");
 				return -1;
@@ -174,4 +173,5 @@ struct filter_util route_filter_util = {
 	.id = "route",
 	.parse_fopt = route_parse_opt,
 	.print_fopt = route_print_opt,
+	.act_attr = TCA_ROUTE4_ACT,
 };
@@ -412,10 +412,12 @@ struct filter_util rsvp_filter_util = {
 	.id = "rsvp",
 	.parse_fopt = rsvp_parse_opt,
 	.print_fopt = rsvp_print_opt,
+	.act_attr = TCA_RSVP_ACT,
 };
 
 struct filter_util rsvp6_filter_util = {
 	.id = "rsvp6",
 	.parse_fopt = rsvp_parse_opt,
 	.print_fopt = rsvp_print_opt,
+	.act_attr = TCA_RSVP_ACT,
 };
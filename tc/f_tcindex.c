@@ -181,4 +181,5 @@ struct filter_util tcindex_filter_util = {
 	.id = "tcindex",
 	.parse_fopt = tcindex_parse_opt,
 	.print_fopt = tcindex_print_opt,
+	.act_attr = TCA_TCINDEX_ACT,
 };
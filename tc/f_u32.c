@@ -19,11 +19,14 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <linux/if.h>
 #include <linux/if_ether.h>
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_common.h"
 
 static void explain(void)
 {
@@ -33,11 +36,13 @@ static void explain(void)
 		"               [ ht HTID ] [ hashkey HASHKEY_SPEC ]\n"
 		"               [ sample SAMPLE ] [skip_hw | skip_sw]\n"
 		"or         u32 divisor DIVISOR\n"
+		"or         u32 compile FILE [ ht HTID ]\n"
 		"\n"
 		"Where: SELECTOR := SAMPLE SAMPLE ...\n"
 		"       SAMPLE := { ip | ip6 | udp | tcp | icmp | u{32|16|8} | mark }\n"
 		"                 SAMPLE_ARGS [ divisor DIVISOR ]\n"
 		"       FILTERID := X:Y:Z\n"
+		"       FILE := one u32 filter per line, without ht and link\n"
 		"\nNOTE: CLASSID is parsed at hexadecimal input.\n");
 }
 
@@ -978,6 +983,605 @@ show_k:
 	goto show_k;
 }
 
+static int u32_parse_opt(struct filter_util *qu, char *handle,
+			 int argc, char **argv, struct nlmsghdr *n);
+
+/*
+ * "compile FILE" turns a list of filters, one per line, into a tree of
+ * hash tables. Every table hashes on one byte of the packet that the
+ * filters it holds have full masks for, and a bucket that is still
+ * longer than U32_COMPILE_LEAF after that is split again on another
+ * byte. A filter that says nothing about the byte a table hashes on
+ * could match in any of its buckets. If it comes before or after all
+ * the filters the table is for, it stays in the bucket linking to the
+ * table, ahead of or behind the link; otherwise it is put into every
+ * bucket of the table. Each bucket so keeps the filters that can match
+ * there in the order of the file, and the first one that matches is
+ * still the first of the file. Tables are filled before they are
+ * linked to, the root last, so packets never see one half built.
+ */
+#define U32_COMPILE_LEAF	4	/* filters a bucket is left with */
+#define U32_COMPILE_DEPTH	4	/* tables below the root */
+#define U32_COMPILE_CANDS	64	/* bytes considered for a split */
+#define U32_COMPILE_HT		0x80000000	/* cookies of the tables */
+#define U32_COMPILE_LINK	0x40000000	/* and of the links to them */
+
+struct u32_crule {
+	size_t		sel_off;	/* struct tc_u32_sel in u32_compiler.data */
+	size_t		attr_off;	/* the attributes other than TCA_U32_SEL */
+	unsigned int	attr_len;
+	unsigned int	line;
+};
+
+struct u32_compiler {
+	const char		*file;
+	struct nlmsghdr		*n;		/* the header, without options */
+	struct u32_crule	*rules;
+	size_t			rules_size;
+	unsigned int		nrules;
+	char			*data;
+	size_t			data_len;
+	size_t			data_size;
+	char			*msgs;
+	size_t			msgs_len;
+	size_t			msgs_size;
+	__u32			*cookies;
+	size_t			cookies_size;
+	unsigned int		nmsgs;
+	unsigned int		root_link;	/* the request linking the root */
+	int			maxlen;		/* of the request started */
+	__u32			next_ht;
+	int			short_of_ht;
+	int			failed;
+};
+
+struct u32_split {
+	int		off;		/* of the word hashed on */
+	int		byte;		/* in network order */
+	unsigned int	from;		/* the filters that go into the table */
+	unsigned int	to;
+	unsigned int	divisor;
+	unsigned int	longest;	/* bucket */
+	unsigned int	total;		/* filters in all the buckets */
+};
+
+/* Make room for len bytes in a buffer that doubles as it fills */
+static int u32_compile_grow(void *bufp, size_t *size, size_t len)
+{
+	void **buf = bufp;
+	size_t new = *size ? *size : 4096;
+	void *p;
+
+	if (len <= *size)
+		return 0;
+	while (new < len)
+		new *= 2;
+	p = realloc(*buf, new);
+	if (!p)
+		return -1;
+	*buf = p;
+	*size = new;
+	return 0;
+}
+
+static const struct tc_u32_sel *u32_crule_sel(const struct u32_compiler *c,
+					      unsigned int i)
+{
+	return (const void *)(c->data + c->rules[i].sel_off);
+}
+
+/* The byte of a filter at off, if it is matched whole: -1 if not */
+static int u32_crule_byte(const struct u32_compiler *c, unsigned int i,
+			  int off, int byte)
+{
+	const struct tc_u32_sel *sel = u32_crule_sel(c, i);
+	int k;
+
+	for (k = 0; k < sel->nkeys; k++) {
+		const struct tc_u32_key *key = &sel->keys[k];
+
+		if (key->off != off || key->offmask)
+			continue;
+		if (((const __u8 *)&key->mask)[byte] != 0xff)
+			return -1;
+		return ((const __u8 *)&key->val)[byte];
+	}
+	return -1;
+}
+
+/* The best byte to split the filters of a bucket on, if any helps */
+static int u32_compile_choose(const struct u32_compiler *c,
+			      const unsigned int *set, unsigned int count,
+			      struct u32_split *best)
+{
+	struct { int off, byte; } cands[U32_COMPILE_CANDS];
+	unsigned int ncands = 0, i, j;
+	int k, b;
+
+	for (i = 0; i < count && ncands < U32_COMPILE_CANDS; i++) {
+		const struct tc_u32_sel *sel = u32_crule_sel(c, set[i]);
+
+		for (k = 0; k < sel->nkeys; k++) {
+			const struct tc_u32_key *key = &sel->keys[k];
+
+			if (key->offmask)
+				continue;
+			for (b = 0; b < 4; b++) {
+				if (((const __u8 *)&key->mask)[b] != 0xff)
+					continue;
+				for (j = 0; j < ncands; j++)
+					if (cands[j].off == key->off &&
+					    cands[j].byte == b)
+						break;
+				if (j == ncands && ncands < U32_COMPILE_CANDS) {
+					cands[ncands].off = key->off;
+					cands[ncands++].byte = b;
+				}
+			}
+		}
+	}
+
+	*best = (struct u32_split) { .longest = count };
+	for (j = 0; j < ncands; j++) {
+		unsigned int values[256] = {}, buckets[256] = {};
+		unsigned int distinct = 0, any = 0, divisor = 1, stay;
+		struct u32_split s = {
+			.off	= cands[j].off,
+			.byte	= cands[j].byte,
+			.from	= count,
+		};
+
+		for (i = 0; i < count; i++) {
+			int v = u32_crule_byte(c, set[i], s.off, s.byte);
+
+			if (v < 0) {
+				any++;
+				continue;
+			}
+			if (values[v]++ == 0)
+				distinct++;
+			if (s.from == count)
+				s.from = i;
+			s.to = i + 1;
+		}
+		if (distinct < 2)
+			continue;
+		while (divisor < distinct)
+			divisor *= 2;
+		for (i = 0; i < 256; i++)
+			buckets[i & (divisor - 1)] += values[i];
+
+		/* what comes before and after them stays in this bucket */
+		stay = s.from + count - s.to;
+		any -= stay;
+		s.divisor = divisor;
+		s.total = stay + (s.to - s.from - any) + any * divisor;
+		for (i = 0; i < divisor; i++)
+			if (stay + buckets[i] + any > s.longest)
+				s.longest = stay + buckets[i] + any;
+		/* filters that fit anywhere may not make up most of them */
+		if (s.total > 2 * count)
+			continue;
+		if (s.longest < best->longest ||
+		    (s.longest == best->longest && best->longest < count &&
+		     s.total < best->total))
+			*best = s;
+	}
+	return best->longest < count ? 0 : -1;
+}
+
+/*
+ * Start a request at the end of msgs, with room bytes of options: the
+ * header, the handle and the options nest, which u32_compile_end() closes.
+ */
+static struct nlmsghdr *u32_compile_start(struct u32_compiler *c,
+					  __u32 handle, __u32 cookie,
+					  size_t room, struct rtattr **tail)
+{
+	size_t size = NLMSG_ALIGN(c->n->nlmsg_len) + RTA_LENGTH(room);
+	struct nlmsghdr *n;
+
+	if (u32_compile_grow(&c->msgs, &c->msgs_size, c->msgs_len + size) < 0 ||
+	    u32_compile_grow(&c->cookies, &c->cookies_size,
+			     (c->nmsgs + 1) * sizeof(*c->cookies)) < 0)
+		return NULL;
+	n = (struct nlmsghdr *)(c->msgs + c->msgs_len);
+	memset(n, 0, size);
+	memcpy(n, c->n, c->n->nlmsg_len);
+	((struct tcmsg *)NLMSG_DATA(n))->tcm_handle = handle;
+	c->cookies[c->nmsgs] = cookie;
+	c->maxlen = size;
+	*tail = addattr_nest(n, size, TCA_OPTIONS);
+	return n;
+}
+
+static void u32_compile_end(struct u32_compiler *c, struct nlmsghdr *n,
+			    struct rtattr *tail)
+{
+	addattr_nest_end(n, tail);
+	c->msgs_len += NLMSG_ALIGN(n->nlmsg_len);
+	c->nmsgs++;
+}
+
+static int u32_compile_node(struct u32_compiler *c, __u32 ht, __u32 node,
+			    unsigned int i)
+{
+	const struct u32_crule *rule = &c->rules[i];
+	const struct tc_u32_sel *sel = u32_crule_sel(c, i);
+	int sel_len = sizeof(*sel) + sel->nkeys * sizeof(sel->keys[0]);
+	struct rtattr *tail;
+	struct nlmsghdr *n;
+	size_t room;
+
+	room = RTA_SPACE(sizeof(__u32)) + RTA_SPACE(sel_len) + rule->attr_len;
+	n = u32_compile_start(c, ht | node, rule->line, room, &tail);
+	if (!n)
+		return -1;
+	if (ht)
+		addattr32(n, c->maxlen, TCA_U32_HASH, ht);
+	addattr_l(n, c->maxlen, TCA_U32_SEL, sel, sel_len);
+	addraw_l(n, c->maxlen, c->data + rule->attr_off,
+		 rule->attr_len);
+	u32_compile_end(c, n, tail);
+	return 0;
+}
+
+/* A node matching everything, hashing it into table htid */
+static int u32_compile_link(struct u32_compiler *c, __u32 ht, __u32 node,
+			    __u32 htid, const struct u32_split *s)
+{
+	struct {
+		struct tc_u32_sel sel;
+		struct tc_u32_key keys[1];
+	} sel = {
+		.sel.nkeys	= 1,
+		.sel.hmask	= htonl(0xffU << (24 - 8 * s->byte)),
+		.sel.hoff	= s->off,
+	};
+	size_t room = 2 * RTA_SPACE(sizeof(__u32)) + RTA_SPACE(sizeof(sel));
+	struct rtattr *tail;
+	struct nlmsghdr *n;
+
+	n = u32_compile_start(c, ht | node, U32_COMPILE_LINK | htid >> 20,
+			      room, &tail);
+	if (!n)
+		return -1;
+	if (ht)
+		addattr32(n, c->maxlen, TCA_U32_HASH, ht);
+	addattr32(n, c->maxlen, TCA_U32_LINK, htid);
+	addattr_l(n, c->maxlen, TCA_U32_SEL, &sel, sizeof(sel));
+	u32_compile_end(c, n, tail);
+	return 0;
+}
+
+/* Add filters to bucket ht as they are, from node *node on */
+static int u32_compile_list(struct u32_compiler *c, const unsigned int *set,
+			    unsigned int count, __u32 ht, __u32 *node)
+{
+	unsigned int i;
+
+	if (ht && *node + count > 0xfff) {
+		fprintf(stderr, "%u filters of \"%s\" do not hash apart\n",
+			count, c->file);
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+		if (u32_compile_node(c, ht, ht ? (*node)++ : 0, set[i]) < 0)
+			return -1;
+	return 0;
+}
+
+/*
+ * Put the filters of set into bucket ht, a table's bucket or 0 for the
+ * root of the priority, splitting it into a table of its own if need be.
+ */
+static int u32_compile_bucket(struct u32_compiler *c, const unsigned int *set,
+			      unsigned int count, __u32 ht, int depth)
+{
+	unsigned int start[257] = {}, *sub, i;
+	struct rtattr *tail;
+	struct nlmsghdr *n;
+	struct u32_split s;
+	__u32 htid, node = 1;
+	int ret = -1;
+
+	if (count > U32_COMPILE_LEAF && depth < U32_COMPILE_DEPTH &&
+	    c->next_ht >= 0x800)
+		c->short_of_ht = 1;
+	if (count <= U32_COMPILE_LEAF || depth >= U32_COMPILE_DEPTH ||
+	    c->next_ht >= 0x800 || u32_compile_choose(c, set, count, &s) < 0)
+		return u32_compile_list(c, set, count, ht, &node);
+
+	if (u32_compile_list(c, set, s.from, ht, &node) < 0)
+		return -1;
+
+	htid = c->next_ht++ << 20;
+	n = u32_compile_start(c, htid, U32_COMPILE_HT | htid >> 20,
+			      RTA_SPACE(sizeof(__u32)), &tail);
+	if (!n)
+		return -1;
+	addattr32(n, c->maxlen, TCA_U32_DIVISOR, s.divisor);
+	u32_compile_end(c, n, tail);
+
+	/* the filters of each bucket, in the order of the file */
+	sub = malloc(s.total * sizeof(*sub));
+	if (!sub)
+		return -1;
+	for (i = s.from; i < s.to; i++) {
+		int v = u32_crule_byte(c, set[i], s.off, s.byte);
+		unsigned int b;
+
+		if (v >= 0) {
+			start[(v & (s.divisor - 1)) + 1]++;
+			continue;
+		}
+		for (b = 0; b < s.divisor; b++)
+			start[b + 1]++;
+	}
+	for (i = 0; i < s.divisor; i++)
+		start[i + 1] += start[i];
+	for (i = s.from; i < s.to; i++) {
+		int v = u32_crule_byte(c, set[i], s.off, s.byte);
+		unsigned int b;
+
+		if (v >= 0) {
+			sub[start[v & (s.divisor - 1)]++] = set[i];
+			continue;
+		}
+		for (b = 0; b < s.divisor; b++)
+			sub[start[b]++] = set[i];
+	}
+
+	/* start[b] is now where bucket b + 1 begins */
+	for (i = 0; i < s.divisor; i++) {
+		unsigned int from = i ? start[i - 1] : 0;
+
+		if (u32_compile_bucket(c, sub + from, start[i] - from,
+				       htid | i << 12, depth + 1) < 0)
+			goto out;
+	}
+	if (!ht)
+		c->root_link = c->nmsgs;
+	if (u32_compile_link(c, ht, ht ? node++ : 0, htid, &s) < 0 ||
+	    u32_compile_list(c, set + s.to, count - s.to, ht, &node) < 0)
+		goto out;
+	ret = 0;
+out:
+	free(sub);
+	return ret;
+}
+
+/* Add a line's filter, which has no hash table of its own to go to */
+static int u32_compile_add(struct u32_compiler *c, struct rtattr *opts,
+			   unsigned int line)
+{
+	struct rtattr *tb[TCA_U32_MAX + 1];
+	const struct tc_u32_sel *sel;
+	struct u32_crule *rule;
+	unsigned int sel_len, attr_len = 0;
+	struct rtattr *rta;
+	int len;
+
+	parse_rtattr_nested(tb, TCA_U32_MAX, opts);
+	if (tb[TCA_U32_HASH] || tb[TCA_U32_LINK] || tb[TCA_U32_DIVISOR]) {
+		fprintf(stderr, "\"ht\", \"sample\", \"link\" and \"divisor\" are chosen by \"compile\"\n");
+		return -1;
+	}
+	if (!tb[TCA_U32_SEL]) {
+		fprintf(stderr, "A filter to compile needs a \"match\"\n");
+		return -1;
+	}
+	sel = RTA_DATA(tb[TCA_U32_SEL]);
+	if (sel->flags & ~TC_U32_TERMINAL || sel->hmask) {
+		fprintf(stderr, "\"offset\" and \"hashkey\" are chosen by \"compile\"\n");
+		return -1;
+	}
+	sel_len = RTA_PAYLOAD(tb[TCA_U32_SEL]);
+
+	for (rta = RTA_DATA(opts), len = RTA_PAYLOAD(opts); RTA_OK(rta, len);
+	     rta = RTA_NEXT(rta, len))
+		if (rta->rta_type != TCA_U32_SEL)
+			attr_len += RTA_ALIGN(rta->rta_len);
+
+	if (u32_compile_grow(&c->rules, &c->rules_size,
+			     (c->nrules + 1) * sizeof(*rule)) < 0 ||
+	    u32_compile_grow(&c->data, &c->data_size,
+			     c->data_len + RTA_ALIGN(sel_len) + attr_len) < 0)
+		return -1;
+	rule = &c->rules[c->nrules++];
+	rule->line = line;
+	rule->sel_off = c->data_len;
+	memcpy(c->data + c->data_len, sel, sel_len);
+	c->data_len += RTA_ALIGN(sel_len);
+	rule->attr_off = c->data_len;
+	rule->attr_len = attr_len;
+	for (rta = RTA_DATA(opts), len = RTA_PAYLOAD(opts); RTA_OK(rta, len);
+	     rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == TCA_U32_SEL)
+			continue;
+		memcpy(c->data + c->data_len, rta, RTA_ALIGN(rta->rta_len));
+		c->data_len += RTA_ALIGN(rta->rta_len);
+	}
+	return 0;
+}
+
+static void u32_compile_err(__u32 cookie, int error, void *arg)
+{
+	struct u32_compiler *c = arg;
+
+	if (cookie & U32_COMPILE_HT)
+		fprintf(stderr, "Cannot create hash table %x: for %s\n",
+			cookie & 0xfff, c->file);
+	else if (cookie & U32_COMPILE_LINK)
+		fprintf(stderr, "Cannot link hash table %x: for %s\n",
+			cookie & 0xfff, c->file);
+	else
+		fprintf(stderr, "Command failed %s:%u\n", c->file, cookie);
+	c->failed++;
+}
+
+/*
+ * Send the requests on a pipeline of their own: the hash tables first,
+ * as the likeliest to clash with what is there, then the rest in the
+ * order queued. Nothing is sent after the first request that fails, and
+ * the root is linked only once all of the others are acked, so that the
+ * filters are not used before all of them are installed.
+ */
+static void u32_compile_send(struct u32_compiler *c)
+{
+	struct rtnl_async *async = rth.async;
+	int flags = rth.flags, tables;
+	unsigned int i;
+
+	/* a batch this is part of has its own idea of lines */
+	if (async) {
+		rtnl_async_flush(&rth);
+		rth.async = NULL;
+	}
+	if (rtnl_async_begin(&rth, 0, u32_compile_err, c) == 0)
+		rth.flags |= RTNL_HANDLE_F_ASYNC;
+
+	for (tables = 1; tables >= 0 && !c->failed; tables--) {
+		unsigned int sent = 0;
+		size_t off = 0;
+
+		for (i = 0; i < c->nmsgs && !c->failed; i++) {
+			struct nlmsghdr *n = (void *)(c->msgs + off);
+
+			off += NLMSG_ALIGN(n->nlmsg_len);
+			if (!(c->cookies[i] & U32_COMPILE_HT) != !tables)
+				continue;
+			if (i == c->root_link) {
+				rtnl_async_flush(&rth);
+				if (c->failed)
+					break;
+			}
+			rtnl_async_cookie(&rth, c->cookies[i]);
+			if (rtnl_talk(&rth, n, NULL) < 0)
+				u32_compile_err(c->cookies[i], -errno, c);
+			/* one failing is likely to fail all, find out early */
+			if (sent++ == 0)
+				rtnl_async_flush(&rth);
+		}
+		rtnl_async_flush(&rth);
+	}
+
+	if (c->failed)
+		rtnl_async_discard(&rth);
+	rtnl_async_end(&rth);
+	rth.async = async;
+	rth.flags = flags;
+}
+
+static int u32_compile(struct filter_util *qu, int argc, char **argv,
+		       struct nlmsghdr *n)
+{
+	struct u32_compiler c = {
+		.n		= n,
+		.root_link	= UINT_MAX,
+		.next_ht	= 0x100,
+	};
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+		char		buf[MAX_MSG];
+	} req;
+	struct rtattr *opts = (void *)&req + NLMSG_ALIGN(n->nlmsg_len);
+	int lineno = cmdlineno, ret = -1;
+	unsigned int *set = NULL, i;
+	char *largv[100];
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	if (n->nlmsg_type != RTM_NEWTFILTER) {
+		fprintf(stderr, "\"compile\" can only be used to add filters\n");
+		return -1;
+	}
+	if (((struct tcmsg *)NLMSG_DATA(n))->tcm_handle) {
+		fprintf(stderr, "\"handle\" cannot be used with \"compile\"\n");
+		return -1;
+	}
+	if (argc < 1) {
+		fprintf(stderr, "\"compile\" needs a file\n");
+		return -1;
+	}
+	c.file = *argv;
+	NEXT_ARG_FWD();
+	if (argc > 0 && strcmp(*argv, "ht") == 0) {
+		__u32 htid;
+
+		NEXT_ARG();
+		if (get_u32_handle(&htid, *argv) || !TC_U32_HTID(htid) ||
+		    TC_U32_KEY(htid) || TC_U32_USERHTID(htid) >= 0x800) {
+			fprintf(stderr, "Illegal \"ht\"\n");
+			return -1;
+		}
+		c.next_ht = TC_U32_USERHTID(htid);
+		NEXT_ARG_FWD();
+	}
+	if (argc > 0) {
+		fprintf(stderr, "What is \"%s\"?\n", *argv);
+		explain();
+		return -1;
+	}
+
+	fp = fopen(c.file, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			c.file, strerror(errno));
+		return -1;
+	}
+
+	/* attributes leave their padding as it was, keep it zeroed */
+	memset(&req, 0, sizeof(req));
+	memcpy(&req, n, n->nlmsg_len);
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		int largc;
+
+		largc = makeargs(line, largv, 100);
+		if (largc == 0)
+			continue;
+
+		memset((void *)&req + n->nlmsg_len, 0,
+		       req.n.nlmsg_len - n->nlmsg_len);
+		memcpy(&req, n, n->nlmsg_len);
+		if (strcmp(largv[0], "compile") == 0 ||
+		    u32_parse_opt(qu, NULL, largc, largv, &req.n) ||
+		    u32_compile_add(&c, opts, cmdlineno) < 0) {
+			fprintf(stderr, "Command failed %s:%d\n", c.file,
+				cmdlineno);
+			goto out;
+		}
+	}
+
+	set = malloc((c.nrules ? : 1) * sizeof(*set));
+	if (!set)
+		goto out;
+	for (i = 0; i < c.nrules; i++)
+		set[i] = i;
+	if (u32_compile_bucket(&c, set, c.nrules, 0, 0) < 0) {
+		fprintf(stderr, "Cannot compile \"%s\"\n", c.file);
+		goto out;
+	}
+	if (c.short_of_ht)
+		fprintf(stderr, "Warning: \"%s\" ran out of hash tables, some buckets are left long\n",
+			c.file);
+	u32_compile_send(&c);
+	ret = c.failed ? 1 : TC_FOPT_SENT;
+out:
+	cmdlineno = lineno;
+	fclose(fp);
+	free(line);
+	free(set);
+	free(c.rules);
+	free(c.data);
+	free(c.msgs);
+	free(c.cookies);
+	return ret;
+}
+
 static int u32_parse_opt(struct filter_util *qu, char *handle,
 			 int argc, char **argv, struct nlmsghdr *n)
 {
@@ -1001,6 +1605,9 @@ static int u32_parse_opt(struct filter_util *qu, char *handle,
 	if (argc == 0)
 		return 0;
 
+	if (strcmp(*argv, "compile") == 0)
+		return u32_compile(qu, argc - 1, argv + 1, n);
+
 	tail = addattr_nest(n, MAX_MSG, TCA_OPTIONS);
 
 	while (argc > 0) {
@@ -1341,4 +1948,5 @@ struct filter_util u32_filter_util = {
 	.id = "u32",
 	.parse_fopt = u32_parse_opt,
 	.print_fopt = u32_print_opt,
+	.act_attr = TCA_U32_ACT,
 };
@@ -25,15 +25,36 @@
 #include <dlfcn.h>
 
 #include "utils.h"
+#include "plugin.h"
 #include "tc_common.h"
 #include "tc_util.h"
 
-static struct action_util *action_list;
+static struct plugin_cache action_plugins = PLUGIN_CACHE_INIT;
 #ifdef CONFIG_GACT
 int gact_ld; /* f*ckin backward compatibility */
 #endif
 int tab_flush;
 
+/*
+ * Actions named with "tc actions add ... name NAME" are remembered with
+ * the index the kernel gave them, which comes back in the echo of the
+ * add. Later commands, typically the filter lines of the same batch,
+ * bind to such an action with "action KIND name NAME" instead of each
+ * carrying a copy of it.
+ */
+struct act_name {
+	struct act_name	*next;
+	char		kind[FILTER_NAMESZ];
+	__u32		index;
+	bool		known;	/* index is */
+	__u32		seq;	/* of the add waiting for its echo */
+	int		prio;	/* in that add */
+	char		name[];
+};
+
+static __thread struct act_name *act_names;
+static __thread bool act_naming;	/* parsing a "tc actions add" */
+
 static int act_usage(void)
 {
 	/*XXX: In the near future add a action->print_help to improve
@@ -45,14 +66,17 @@ static int act_usage(void)
 	 */
 	fprintf(stderr, "usage: tc actions <ACTSPECOP>*\n");
 	fprintf(stderr,
-		"Where: \tACTSPECOP := ACR | GD | FL\n"
+		"Where: \tACTSPECOP := ACR | GD | FL | SA\n"
 			"\tACR := add | change | replace <ACTSPEC>*\n"
 			"\tGD := get | delete | <ACTISPEC>*\n"
 			"\tFL := ls | list | flush | <ACTNAMESPEC>\n"
+			"\tSA := sample <ACTNAMESPEC> [ interval SECONDS ]\n"
+			"\t\t[ count COUNT ] [ top N ]\n"
 			"\tACTNAMESPEC :=  action <ACTNAME>\n"
 			"\tACTISPEC := <ACTNAMESPEC> <INDEXSPEC>\n"
-			"\tACTSPEC := action <ACTDETAIL> [INDEXSPEC]\n"
-			"\tINDEXSPEC := index <32 bit indexvalue>\n"
+			"\tACTSPEC := action <ACTDETAIL> [INDEXSPEC] [ cookie COOKIE ]\n"
+			"\t\t[ name NAME ]\n"
+			"\tINDEXSPEC := index <32 bit indexvalue> | name NAME\n"
 			"\tACTDETAIL := <ACTNAME> <ACTPARAMS>\n"
 			"\t\tExample ACTNAME is gact, mirred, bpf, etc\n"
 			"\t\tEach action has its own parameters (ACTPARAMS)\n"
@@ -85,23 +109,35 @@ static int parse_noaopt(struct action_util *au, int *argc_p,
 	return -1;
 }
 
-static struct action_util *get_action_kind(char *str)
+static struct action_util *__get_action_kind(char *str)
 {
 	static void *aBODY;
 	void *dlh;
-	char buf[256];
+	char buf[256], key[256];
 	struct action_util *a;
 #ifdef CONFIG_GACT
 	int looked4gact = 0;
-restart_s:
 #endif
-	for (a = action_list; a; a = a->next) {
-		if (strcmp(a->id, str) == 0)
-			return a;
+
+	if (plugin_find(&action_plugins, str, (void **)&a)) {
+#ifdef CONFIG_GACT
+		/* an unknown kind, which was looked up as gact before */
+		if (strcmp(a->id, str))
+			strcpy(str, "gact");
+#endif
+		return a;
 	}
+	strlcpy(key, str, sizeof(key));
 
-	snprintf(buf, sizeof(buf), "%s/m_%s.so", get_tc_lib(), str);
-	dlh = dlopen(buf, RTLD_LAZY | RTLD_GLOBAL);
+#ifdef CONFIG_GACT
+restart_s:
+#endif
+	dlh = NULL;
+	snprintf(buf, sizeof(buf), "m_%s.so", str);
+	if (plugin_dir_has(&action_plugins, get_tc_lib(), buf)) {
+		snprintf(buf, sizeof(buf), "%s/m_%s.so", get_tc_lib(), str);
+		dlh = dlopen(buf, RTLD_LAZY | RTLD_GLOBAL);
+	}
 	if (dlh == NULL) {
 		dlh = aBODY;
 		if (dlh == NULL) {
@@ -117,8 +153,7 @@ restart_s:
 		goto noexist;
 
 reg:
-	a->next = action_list;
-	action_list = a;
+	plugin_add(&action_plugins, key, a);
 	return a;
 
 noexist:
@@ -139,6 +174,189 @@ noexist:
 	return a;
 }
 
+static struct action_util *get_action_kind(char *str)
+{
+	struct action_util *a;
+
+	plugin_lock(&action_plugins);
+	a = __get_action_kind(str);
+	plugin_unlock(&action_plugins);
+	return a;
+}
+
+static struct act_name *act_name_find(const char *name)
+{
+	struct act_name *an;
+
+	for (an = act_names; an; an = an->next)
+		if (strcmp(an->name, name) == 0)
+			return an;
+	return NULL;
+}
+
+static int act_name_new(const char *name, const char *kind, int prio)
+{
+	struct act_name *an;
+
+	if (!act_naming) {
+		fprintf(stderr,
+			"Error: action names are given in \"tc actions add\"\n");
+		return -1;
+	}
+	an = act_name_find(name);
+	if (an && (an->known || an->seq)) {
+		fprintf(stderr, "Error: action name \"%s\" is already used\n",
+			name);
+		return -1;
+	}
+	if (!an) {
+		an = calloc(1, sizeof(*an) + strlen(name) + 1);
+		if (!an)
+			return -1;
+		strcpy(an->name, name);
+		an->next = act_names;
+		act_names = an;
+	}
+	strlcpy(an->kind, kind, sizeof(an->kind));
+	an->known = false;
+	an->seq = 0;
+	an->prio = prio;
+	return 0;
+}
+
+/* Take the indexes of the actions named in the add echoed by n */
+static void act_name_echo(__u32 cookie, struct nlmsghdr *n, void *arg)
+{
+	struct tcamsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_ROOT_MAX + 1];
+	struct rtattr *tba[TCA_ACT_MAX_PRIO + 1];
+	struct act_name *an;
+
+	if (n->nlmsg_type != RTM_NEWACTION || len < 0)
+		return;
+	parse_rtattr(tb, TCA_ROOT_MAX, TA_RTA(t), len);
+	if (!tb[TCA_ACT_TAB])
+		return;
+	parse_rtattr_nested(tba, TCA_ACT_MAX_PRIO, tb[TCA_ACT_TAB]);
+
+	for (an = act_names; an; an = an->next) {
+		struct rtattr *tbo[TCA_ACT_MAX + 1];
+
+		if (an->known || an->seq != n->nlmsg_seq ||
+		    an->prio > TCA_ACT_MAX_PRIO || !tba[an->prio])
+			continue;
+		parse_rtattr_nested(tbo, TCA_ACT_MAX, tba[an->prio]);
+		an->index = tc_action_index(tbo);
+		an->known = an->index != 0;
+		an->seq = 0;
+	}
+}
+
+/* The adds that were parsed but not sent, or that failed */
+static void act_name_forget(__u32 seq)
+{
+	struct act_name **pan = &act_names;
+
+	while (*pan) {
+		struct act_name *an = *pan;
+
+		if (an->known || an->seq != seq) {
+			pan = &an->next;
+			continue;
+		}
+		*pan = an->next;
+		free(an);
+	}
+}
+
+/* Whether the add being built names any of its actions */
+static bool act_name_named(void)
+{
+	struct act_name *an;
+
+	for (an = act_names; an; an = an->next)
+		if (!an->known && !an->seq)
+			return true;
+	return false;
+}
+
+static void act_name_sent(__u32 seq)
+{
+	struct act_name *an;
+
+	for (an = act_names; an; an = an->next)
+		if (!an->known && !an->seq)
+			an->seq = seq;
+}
+
+static int act_name_index(const char *name, const char *kind, __u32 *index)
+{
+	struct act_name *an = act_name_find(name);
+
+	/* its add may still be queued in the batch */
+	if (an && !an->known && an->seq && rth.async)
+		rtnl_async_flush(&rth);
+
+	if (!an || !an->known) {
+		fprintf(stderr, "Error: no action named \"%s\"\n", name);
+		return -1;
+	}
+	if (strcmp(an->kind, kind) != 0) {
+		fprintf(stderr, "Error: action \"%s\" is %s, not %s\n",
+			name, an->kind, kind);
+		return -1;
+	}
+	*index = an->index;
+	return 0;
+}
+
+/* "KIND name NAME" is what "KIND index INDEX" binds to */
+static int parse_action_name(struct action_util *a, char *kind,
+			     int *argc_p, char ***argv_p, struct nlmsghdr *n)
+{
+	int argc = *argc_p;
+	char **argv = *argv_p;
+	char ibuf[16];
+	char *largv[] = { kind, "index", ibuf, NULL };
+	char **lp = largv;
+	int largc = 3;
+	__u32 index;
+
+	NEXT_ARG();
+	NEXT_ARG();
+	if (act_name_index(*argv, kind, &index) < 0)
+		return -1;
+	snprintf(ibuf, sizeof(ibuf), "%u", index);
+	if (a->parse_aopt(a, &largc, &lp, TCA_ACT_OPTIONS, n) < 0)
+		return -1;
+
+	argc--;
+	argv++;
+	*argc_p = argc;
+	*argv_p = argv;
+	return 0;
+}
+
+/*
+ * Actions are not dumped with TCA_ACT_INDEX, but the parameters of every
+ * action start with the tc_gen fields and are the first of its options.
+ */
+__u32 tc_action_index(struct rtattr *tb[])
+{
+	struct rtattr *opt;
+
+	if (tb[TCA_ACT_INDEX])
+		return rta_getattr_u32(tb[TCA_ACT_INDEX]);
+	if (!tb[TCA_ACT_OPTIONS])
+		return 0;
+	opt = RTA_DATA(tb[TCA_ACT_OPTIONS]);
+	if (!RTA_OK(opt, RTA_PAYLOAD(tb[TCA_ACT_OPTIONS])) ||
+	    RTA_PAYLOAD(opt) < sizeof(__u32))
+		return 0;
+	return rta_getattr_u32(opt);
+}
+
 static bool
 new_cmd(char **argv)
 {
@@ -214,8 +432,11 @@ done0:
 			tail = addattr_nest(n, MAX_MSG, ++prio);
 			addattr_l(n, MAX_MSG, TCA_ACT_KIND, k, strlen(k) + 1);
 
-			ret = a->parse_aopt(a, &argc, &argv, TCA_ACT_OPTIONS,
-					    n);
+			if (argc > 1 && strcmp(argv[1], "name") == 0)
+				ret = parse_action_name(a, k, &argc, &argv, n);
+			else
+				ret = a->parse_aopt(a, &argc, &argv,
+						    TCA_ACT_OPTIONS, n);
 
 			if (ret < 0) {
 				fprintf(stderr, "bad action parsing\n");
@@ -249,6 +470,14 @@ done0:
 				addattr_l(n, MAX_MSG, TCA_ACT_COOKIE,
 					  &act_ck, act_ck_len);
 
+			if (*argv && strcmp(*argv, "name") == 0) {
+				NEXT_ARG();
+				if (act_name_new(*argv, k, prio) < 0)
+					return -1;
+				argc--;
+				argv++;
+			}
+
 			addattr_nest_end(n, tail);
 			ok++;
 		}
@@ -515,6 +744,14 @@ static int tc_action_gd(int cmd, unsigned int flags,
 			}
 			argc -= 1;
 			argv += 1;
+		} else if (strcmp(*argv, "name") == 0) {
+			NEXT_ARG();
+			if (act_name_index(*argv, k, &i) < 0) {
+				ret = -1;
+				goto bad_val;
+			}
+			argc -= 1;
+			argv += 1;
 		} else {
 			fprintf(stderr,
 				"Error: no index specified action: %s\n", k);
@@ -566,27 +803,17 @@ struct tc_action_req {
 };
 
 static int tc_action_modify(int cmd, unsigned int flags,
-			    int *argc_p, char ***argv_p,
-			    void *buf, size_t buflen)
+			    int *argc_p, char ***argv_p)
 {
-	struct tc_action_req *req, action_req;
+	struct tc_action_req action_req = {};
+	struct tc_action_req *req = &action_req;
 	char **argv = *argv_p;
 	struct rtattr *tail;
 	int argc = *argc_p;
 	struct iovec iov;
+	bool named;
 	int ret = 0;
 
-	if (buf) {
-		req = buf;
-		if (buflen < sizeof (struct tc_action_req)) {
-			fprintf(stderr, "buffer is too small: %zu\n", buflen);
-			return -1;
-		}
-	} else {
-		memset(&action_req, 0, sizeof (struct tc_action_req));
-		req = &action_req;
-	}
-
 	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcamsg));
 	req->n.nlmsg_flags = NLM_F_REQUEST | flags;
 	req->n.nlmsg_type = cmd;
@@ -595,7 +822,11 @@ static int tc_action_modify(int cmd, unsigned int flags,
 
 	argc -= 1;
 	argv += 1;
-	if (parse_action(&argc, &argv, TCA_ACT_TAB, &req->n)) {
+	act_naming = cmd == RTM_NEWACTION;
+	ret = parse_action(&argc, &argv, TCA_ACT_TAB, &req->n);
+	act_naming = false;
+	if (ret) {
+		act_name_forget(0);
 		fprintf(stderr, "Illegal \"action\"\n");
 		return -1;
 	}
@@ -604,8 +835,35 @@ static int tc_action_modify(int cmd, unsigned int flags,
 	*argc_p = argc;
 	*argv_p = argv;
 
-	if (buf)
+	named = act_name_named();
+	if (named)
+		req->n.nlmsg_flags |= NLM_F_ECHO;
+
+	/* queued in a batch, the echo is taken when the acks are read */
+	if (named && rth.async && (rth.flags & RTNL_HANDLE_F_ASYNC)) {
+		rtnl_async_replies(&rth, act_name_echo);
+		if (rtnl_talk(&rth, &req->n, NULL) < 0) {
+			act_name_forget(0);
+			return -1;
+		}
+		act_name_sent(req->n.nlmsg_seq);
+		return 0;
+	}
+
+	if (named) {
+		struct nlmsghdr *ans = NULL;
+
+		if (rtnl_talk(&rth, &req->n, &ans) < 0) {
+			fprintf(stderr, "We have an error talking to the kernel\n");
+			act_name_forget(0);
+			return -1;
+		}
+		act_name_sent(req->n.nlmsg_seq);
+		act_name_echo(0, ans, NULL);
+		act_name_forget(req->n.nlmsg_seq);
+		free(ans);
 		return 0;
+	}
 
 	iov.iov_base = &req->n;
 	iov.iov_len = req->n.nlmsg_len;
@@ -715,7 +973,7 @@ bad_val:
 	return ret;
 }
 
-int do_action(int argc, char **argv, void *buf, size_t buflen)
+int do_action(int argc, char **argv)
 {
 
 	int ret = 0;
@@ -725,12 +983,12 @@ int do_action(int argc, char **argv, void *buf, size_t buflen)
 		if (matches(*argv, "add") == 0) {
 			ret =  tc_action_modify(RTM_NEWACTION,
 						NLM_F_EXCL | NLM_F_CREATE,
-						&argc, &argv, buf, buflen);
+						&argc, &argv);
 		} else if (matches(*argv, "change") == 0 ||
 			  matches(*argv, "replace") == 0) {
 			ret = tc_action_modify(RTM_NEWACTION,
 					       NLM_F_CREATE | NLM_F_REPLACE,
-					       &argc, &argv, buf, buflen);
+					       &argc, &argv);
 		} else if (matches(*argv, "delete") == 0) {
 			argc -= 1;
 			argv += 1;
@@ -761,6 +1019,15 @@ int do_action(int argc, char **argv, void *buf, size_t buflen)
 			argv += 2;
 			return tc_act_list_or_flush(&argc, &argv,
 						    RTM_DELACTION);
+		} else if (matches(*argv, "sample") == 0) {
+			if (argc <= 2) {
+				act_usage();
+				return -1;
+			}
+
+			argc -= 2;
+			argv += 2;
+			return tc_sample(RTM_GETACTION, argc, argv);
 		} else if (matches(*argv, "help") == 0) {
 			act_usage();
 			return -1;
@@ -33,7 +33,7 @@ static void explain(void)
 	fprintf(stderr, "\n");
 	fprintf(stderr, "eBPF use case:\n");
 	fprintf(stderr, " object-file FILE [ section ACT_NAME ] [ export UDS_FILE ]");
-	fprintf(stderr, " [ verbose ]\n");
+	fprintf(stderr, " [ verbose ] [ timing ] [ log-size BYTES ]\n");
 	fprintf(stderr, " object-pinned FILE\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Where BPF_BYTECODE := \'s,c t f k,c t f k,c t f k,...\'\n");
@@ -49,6 +49,8 @@ static void explain(void)
 	fprintf(stderr, "Where UDS_FILE points to a unix domain socket file in order\n");
 	fprintf(stderr, "to hand off control of all created eBPF maps to an agent.\n");
 	fprintf(stderr, "\n");
+	fprintf(stderr, "Where BYTES is the size of the verifier log to load with.\n");
+	fprintf(stderr, "\n");
 	fprintf(stderr, "Where optionally INDEX points to an existing action, or\n");
 	fprintf(stderr, "explicitly specifies an action index upon creation.\n");
 }
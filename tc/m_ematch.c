@@ -20,6 +20,7 @@
 #include <dlfcn.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "utils.h"
 #include "tc_util.h"
@@ -27,7 +28,9 @@
 
 #define EMATCH_MAP "/etc/iproute2/ematch_map"
 
+/* shared by all threads, filled on first use under ematch_lock */
 static struct ematch_util *ematch_list;
+static pthread_mutex_t ematch_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* export to bison parser */
 int ematch_argc;
@@ -48,17 +51,30 @@ static inline void map_warning(int num, char *kind)
 	    kind, EMATCH_MAP, num, kind);
 }
 
-static int lookup_map(__u16 num, char *dst, int len, const char *file)
+/* the map is read once, for every ematch parsed or printed to look up */
+static struct em_map {
+	int	id;
+	char	*kind;
+} *em_map;
+static int em_map_len;
+static int em_map_err = 1;	/* not read yet */
+
+static int load_map(const char *file)
 {
-	int err = -EINVAL;
 	char buf[512];
-	FILE *fd = fopen(file, "r");
+	FILE *fd;
+
+	if (em_map_err <= 0)
+		return em_map_err;
 
+	fd = fopen(file, "r");
 	if (fd == NULL)
-		return -errno;
+		return em_map_err = -errno;
 
+	em_map_err = 0;
 	while (fgets(buf, sizeof(buf), fd)) {
 		char namebuf[512], *p = buf;
+		struct em_map *m;
 		int id;
 
 		while (*p == ' ' || *p == '\t')
@@ -69,63 +85,67 @@ static int lookup_map(__u16 num, char *dst, int len, const char *file)
 		if (sscanf(p, "%d %s", &id, namebuf) != 2) {
 			fprintf(stderr, "ematch map %s corrupted at %s\n",
 			    file, p);
-			goto out;
+			em_map_err = -EINVAL;
+			break;
 		}
 
-		if (id == num) {
-			if (dst)
-				strncpy(dst, namebuf, len - 1);
-			err = 0;
-			goto out;
+		m = realloc(em_map, (em_map_len + 1) * sizeof(*m));
+		if (m == NULL) {
+			em_map_err = -ENOMEM;
+			break;
+		}
+		em_map = m;
+		m = &em_map[em_map_len];
+		m->kind = strdup(namebuf);
+		if (m->kind == NULL) {
+			em_map_err = -ENOMEM;
+			break;
 		}
+		m->id = id;
+		em_map_len++;
 	}
 
-	err = -ENOENT;
-out:
 	fclose(fd);
-	return err;
+	return em_map_err;
 }
 
-static int lookup_map_id(char *kind, int *dst, const char *file)
+static int lookup_map(__u16 num, char *dst, int len, const char *file)
 {
-	int err = -EINVAL;
-	char buf[512];
-	FILE *fd = fopen(file, "r");
-
-	if (fd == NULL)
-		return -errno;
+	int i;
 
-	while (fgets(buf, sizeof(buf), fd)) {
-		char namebuf[512], *p = buf;
-		int id;
+	load_map(file);
+	for (i = 0; i < em_map_len; i++) {
+		if (em_map[i].id == num) {
+			if (dst)
+				strncpy(dst, em_map[i].kind, len - 1);
+			return 0;
+		}
+	}
 
-		while (*p == ' ' || *p == '\t')
-			p++;
-		if (*p == '#' || *p == '\n' || *p == 0)
-			continue;
+	/* the entries past a corrupted line are unknown, not missing */
+	return em_map_err < 0 ? em_map_err : -ENOENT;
+}
 
-		if (sscanf(p, "%d %s", &id, namebuf) != 2) {
-			fprintf(stderr, "ematch map %s corrupted at %s\n",
-			    file, p);
-			goto out;
-		}
+static int lookup_map_id(char *kind, int *dst, const char *file)
+{
+	int i;
 
-		if (!strcasecmp(namebuf, kind)) {
+	load_map(file);
+	for (i = 0; i < em_map_len; i++) {
+		if (!strcasecmp(em_map[i].kind, kind)) {
 			if (dst)
-				*dst = id;
-			err = 0;
-			goto out;
+				*dst = em_map[i].id;
+			return 0;
 		}
 	}
 
-	err = -ENOENT;
+	if (em_map_err < 0)
+		return em_map_err;
 	*dst = 0;
-out:
-	fclose(fd);
-	return err;
+	return -ENOENT;
 }
 
-static struct ematch_util *get_ematch_kind(char *kind)
+static struct ematch_util *__get_ematch_kind(char *kind)
 {
 	static void *body;
 	void *dlh;
@@ -159,6 +179,16 @@ static struct ematch_util *get_ematch_kind(char *kind)
 	return e;
 }
 
+static struct ematch_util *get_ematch_kind(char *kind)
+{
+	struct ematch_util *e;
+
+	pthread_mutex_lock(&ematch_lock);
+	e = __get_ematch_kind(kind);
+	pthread_mutex_unlock(&ematch_lock);
+	return e;
+}
+
 static struct ematch_util *get_ematch_kind_num(__u16 kind)
 {
 	char name[513];
@@ -277,6 +307,91 @@ static int flatten_tree(struct ematch *head, struct ematch *tree)
 	return count;
 }
 
+#define EM_COST_DEFAULT	4
+
+struct em_operand {
+	struct bstr	*args;
+	int		inverted;
+	struct ematch	*child;
+	int		cost;
+};
+
+static int optimize_tree(struct ematch *tree);
+
+static int em_cost(struct ematch *t)
+{
+	struct ematch_util *e;
+
+	if (t->child)
+		return optimize_tree(t->child);
+	if (t->args == NULL)
+		return EM_COST_DEFAULT;
+	e = get_ematch_kind(t->args->data);
+	return e && e->cost ? e->cost : EM_COST_DEFAULT;
+}
+
+static void sort_operands(struct ematch **m, struct em_operand *ops, int n)
+{
+	struct em_operand op;
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		ops[i].args = m[i]->args;
+		ops[i].inverted = m[i]->inverted;
+		ops[i].child = m[i]->child;
+	}
+
+	for (i = 1; i < n; i++) {
+		op = ops[i];
+		for (j = i; j > 0 && ops[j - 1].cost > op.cost; j--)
+			ops[j] = ops[j - 1];
+		ops[j] = op;
+	}
+
+	for (i = 0; i < n; i++) {
+		m[i]->args = ops[i].args;
+		m[i]->inverted = ops[i].inverted;
+		m[i]->child = ops[i].child;
+	}
+}
+
+/*
+ * The kernel evaluates "a and b or c" as "a and (b or c)": of a run of
+ * one relation, the last match goes with the rest of the list, unless
+ * it ends the list, and the others are the operands of that relation,
+ * sorted here cheapest first while the relations stay where they are.
+ * Returns what evaluating all of the list costs.
+ */
+static int optimize_tree(struct ematch *tree)
+{
+	struct em_operand *ops;
+	struct ematch **m, *t;
+	int n = 0, total = 0, i, j;
+
+	for (t = tree; t; t = t->relation ? t->next : NULL)
+		n++;
+	m = calloc(n, sizeof(*m));
+	ops = calloc(n, sizeof(*ops));
+	if (!m || !ops)
+		goto out;
+
+	for (i = 0, t = tree; i < n; i++, t = t->next) {
+		m[i] = t;
+		ops[i].cost = em_cost(t);
+		total += ops[i].cost;
+	}
+
+	for (i = 0; i < n - 1; i = j) {
+		for (j = i; j < n - 1 && m[j]->relation == m[i]->relation; j++)
+			;
+		sort_operands(m + i, ops + i, j == n - 1 ? n - i : j - i);
+	}
+out:
+	free(ops);
+	free(m);
+	return total;
+}
+
 int em_parse_error(int err, struct bstr *args, struct bstr *carg,
 		   struct ematch_util *e, char *fmt, ...)
 {
@@ -362,10 +477,12 @@ int parse_ematch(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
 		struct rtattr *tail, *tail_list;
 
 		struct tcf_ematch_tree_hdr hdr = {
-			.nmatches = flatten_tree(ematch_root, ematch_root),
 			.progid = TCF_EM_PROG_TC
 		};
 
+		optimize_tree(ematch_root);
+		hdr.nmatches = flatten_tree(ematch_root, ematch_root);
+
 		tail = addattr_nest(n, MAX_MSG, tca_id);
 		addattr_l(n, MAX_MSG, TCA_EMATCH_TREE_HDR, &hdr, sizeof(hdr));
 
@@ -86,6 +86,7 @@ struct ematch_util
 {
 	char			kind[EMATCHKINDSIZ];
 	int			kind_num;
+	int			cost;	/* relative time a match takes */
 	int	(*parse_eopt)(struct nlmsghdr *,struct tcf_ematch_hdr *,
 			      struct bstr *);
 	int	(*parse_eopt_argv)(struct nlmsghdr *, struct tcf_ematch_hdr *,
@@ -191,8 +191,6 @@ parse_direction(struct action_util *a, int *argc_p, char ***argv_p,
 	if (d[0])  {
 		int idx;
 
-		ll_init_map(&rth);
-
 		idx = ll_name_to_index(d);
 		if (!idx)
 			return nodev(d);
@@ -202,7 +200,8 @@ parse_direction(struct action_util *a, int *argc_p, char ***argv_p,
 
 
 	if (p.eaction == TCA_EGRESS_MIRROR || p.eaction == TCA_INGRESS_MIRROR)
-		parse_action_control(&argc, &argv, &p.action, false);
+		parse_action_control_dflt(&argc, &argv, &p.action, false,
+					  p.action);
 
 	if (argc) {
 		if (iok && matches(*argv, "index") == 0) {
@@ -612,6 +612,85 @@ static int pedit_keys_ex_addattr(struct m_pedit_sel *sel, struct nlmsghdr *n)
 	return 0;
 }
 
+/* Keys at a fixed offset from the same header base edit disjoint words
+ * when their offsets differ, so they can be reordered freely.
+ */
+static bool pedit_keys_commute(const struct m_pedit_sel *sel, int a, int b)
+{
+	const struct tc_pedit_key *ka = &sel->keys[a];
+	const struct tc_pedit_key *kb = &sel->keys[b];
+
+	return !ka->offmask && !kb->offmask &&
+	       sel->keys_ex[a].htype == sel->keys_ex[b].htype;
+}
+
+static bool pedit_keys_foldable(const struct m_pedit_sel *sel, int a, int b)
+{
+	return sel->keys_ex[a].cmd == TCA_PEDIT_KEY_EX_CMD_SET &&
+	       sel->keys_ex[b].cmd == TCA_PEDIT_KEY_EX_CMD_SET &&
+	       sel->keys[a].off == sel->keys[b].off &&
+	       pedit_keys_commute(sel, a, b);
+}
+
+static void pedit_keys_swap(struct m_pedit_sel *sel, int a, int b)
+{
+	struct tc_pedit_key k = sel->keys[a];
+	struct m_pedit_key_ex kx = sel->keys_ex[a];
+
+	sel->keys[a] = sel->keys[b];
+	sel->keys_ex[a] = sel->keys_ex[b];
+	sel->keys[b] = k;
+	sel->keys_ex[b] = kx;
+}
+
+/*
+ * Each key does word = (word & mask) ^ val, so two "set" keys on the
+ * same word are one key with mask m1 & m2 and value (v1 & m2) ^ v2.
+ * The field edits of a munge list are packed one key each: order every
+ * run of commuting keys by offset, keeping the order of the keys on one
+ * word, then fold the neighbouring "set" keys on the same word and drop
+ * the ones left changing nothing.
+ */
+static void pedit_keys_optimize(struct m_pedit_sel *sel)
+{
+	struct tc_pedit_key *keys = sel->keys;
+	struct m_pedit_key_ex *keys_ex = sel->keys_ex;
+	int nkeys = sel->sel.nkeys;
+	int i, j, n;
+
+	for (i = 1; i < nkeys; i++) {
+		for (j = i; j > 0 && pedit_keys_commute(sel, j - 1, j) &&
+			    keys[j - 1].off > keys[j].off; j--)
+			pedit_keys_swap(sel, j - 1, j);
+	}
+
+	for (i = 0, n = 0; i < nkeys; i++) {
+		keys[n] = keys[i];
+		keys_ex[n++] = keys_ex[i];
+		if (n > 1 && pedit_keys_foldable(sel, n - 2, n - 1)) {
+			keys[n - 2].val = (keys[n - 2].val & keys[n - 1].mask) ^
+					  keys[n - 1].val;
+			keys[n - 2].mask &= keys[n - 1].mask;
+			n--;
+		}
+	}
+
+	for (i = 0, nkeys = n, n = 0; i < nkeys; i++) {
+		/* the kernel wants at least one key */
+		if (keys_ex[i].cmd == TCA_PEDIT_KEY_EX_CMD_SET &&
+		    keys[i].mask == ~0U && !keys[i].val &&
+		    (n || i + 1 < nkeys))
+			continue;
+		keys[n] = keys[i];
+		keys_ex[n++] = keys_ex[i];
+	}
+
+	if (pedit_debug || show_details)
+		fprintf(stderr, "pedit: %d keys, %d after merging\n",
+			sel->sel.nkeys, n);
+	sel->sel.nkeys = n;
+}
+
 int parse_pedit(struct action_util *a, int *argc_p, char ***argv_p, int tca_id,
 		struct nlmsghdr *n)
 {
@@ -685,6 +764,8 @@ int parse_pedit(struct action_util *a, int *argc_p, char ***argv_p, int tca_id,
 		}
 	}
 
+	pedit_keys_optimize(&sel);
+
 	tail = addattr_nest(n, MAX_MSG, tca_id);
 	if (!sel.extended) {
 		addattr_l(n, MAX_MSG, TCA_PEDIT_PARMS, &sel,
@@ -58,8 +58,7 @@ int act_parse_police(struct action_util *a, int *argc_p, char ***argv_p,
 	int res = -1;
 	int ok = 0;
 	struct tc_police p = { .action = TC_POLICE_RECLASSIFY };
-	__u32 rtab[256];
-	__u32 ptab[256];
+	const __u32 *rtab = NULL, *ptab = NULL;
 	__u32 avrate = 0;
 	int presult = 0;
 	unsigned buffer = 0, mtu = 0, mpu = 0;
@@ -214,8 +213,8 @@ action_ctrl_ok:
 	if (p.rate.rate) {
 		p.rate.mpu = mpu;
 		p.rate.overhead = overhead;
-		if (tc_calc_rtable(&p.rate, rtab, Rcell_log, mtu,
-				   linklayer) < 0) {
+		rtab = tc_rtable(&p.rate, Rcell_log, mtu, linklayer);
+		if (!rtab) {
 			fprintf(stderr, "POLICE: failed to calculate rate table.\n");
 			return -1;
 		}
@@ -225,8 +224,8 @@ action_ctrl_ok:
 	if (p.peakrate.rate) {
 		p.peakrate.mpu = mpu;
 		p.peakrate.overhead = overhead;
-		if (tc_calc_rtable(&p.peakrate, ptab, Pcell_log, mtu,
-				   linklayer) < 0) {
+		ptab = tc_rtable(&p.peakrate, Pcell_log, mtu, linklayer);
+		if (!ptab) {
 			fprintf(stderr, "POLICE: failed to calculate peak rate table.\n");
 			return -1;
 		}
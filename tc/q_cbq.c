@@ -50,7 +50,7 @@ static int cbq_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 {
 	struct tc_ratespec r = {};
 	struct tc_cbq_lssopt lss = {};
-	__u32 rtab[256];
+	const __u32 *rtab = NULL;
 	unsigned mpu = 0, avpkt = 0, allot = 0;
 	unsigned short overhead = 0;
 	unsigned int linklayer = LINKLAYER_ETHERNET; /* Assume ethernet */
@@ -153,7 +153,8 @@ static int cbq_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 
 	r.mpu = mpu;
 	r.overhead = overhead;
-	if (tc_calc_rtable(&r, rtab, cell_log, allot, linklayer) < 0) {
+	rtab = tc_rtable(&r, cell_log, allot, linklayer);
+	if (!rtab) {
 		fprintf(stderr, "CBQ: failed to calculate rate table.\n");
 		return -1;
 	}
@@ -187,7 +188,7 @@ static int cbq_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 	struct tc_cbq_lssopt lss = {};
 	struct tc_cbq_wrropt wrr = {};
 	struct tc_cbq_fopt fopt = {};
-	__u32 rtab[256];
+	const __u32 *rtab = NULL;
 	unsigned mpu = 0;
 	int cell_log =  -1;
 	int ewma_log =  -1;
@@ -371,7 +372,8 @@ static int cbq_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 			wrr.allot = (lss.avpkt*3)/2;
 		r.mpu = mpu;
 		r.overhead = overhead;
-		if (tc_calc_rtable(&r, rtab, cell_log, pktsize, linklayer) < 0) {
+		rtab = tc_rtable(&r, cell_log, pktsize, linklayer);
+		if (!rtab) {
 			fprintf(stderr, "CBQ: failed to calculate rate table.\n");
 			return -1;
 		}
@@ -111,7 +111,7 @@ static int htb_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 {
 	int ok = 0;
 	struct tc_htb_opt opt = {};
-	__u32 rtab[256], ctab[256];
+	const __u32 *rtab, *ctab;
 	unsigned buffer = 0, cbuffer = 0;
 	int cell_log =  -1, ccell_log = -1;
 	unsigned int mtu = 1600; /* eth packet len */
@@ -241,13 +241,15 @@ static int htb_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 	opt.ceil.mpu = mpu;
 	opt.rate.mpu = mpu;
 
-	if (tc_calc_rtable(&opt.rate, rtab, cell_log, mtu, linklayer) < 0) {
+	rtab = tc_rtable(&opt.rate, cell_log, mtu, linklayer);
+	if (!rtab) {
 		fprintf(stderr, "htb: failed to calculate rate table.\n");
 		return -1;
 	}
 	opt.buffer = tc_calc_xmittime(rate64, buffer);
 
-	if (tc_calc_rtable(&opt.ceil, ctab, ccell_log, mtu, linklayer) < 0) {
+	ctab = tc_rtable(&opt.ceil, ccell_log, mtu, linklayer);
+	if (!ctab) {
 		fprintf(stderr, "htb: failed to calculate ceil rate table.\n");
 		return -1;
 	}
@@ -22,8 +22,11 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "utils.h"
+#include "netem_dist.h"
 #include "tc_util.h"
 #include "tc_common.h"
 
@@ -51,7 +54,7 @@ static void explain1(const char *arg)
 /* Upper bound on size of distribution
  *  really (TCA_BUF_MAX - other headers) / sizeof (__s16)
  */
-#define MAX_DIST	(16*1024)
+#define MAX_DIST	NETEM_DIST_ENTRIES_MAX
 
 /* scaled value used to percent of maximum. */
 static void set_percent(__u32 *percent, double per)
@@ -81,22 +84,33 @@ static char *sprint_percent(__u32 per, char *buf)
 	return buf;
 }
 
+/*
+ * The tables read, kept for as long as tc runs: netem on many devices
+ * usually asks for the same few, and a request refers to the table
+ * rather than carrying a copy until it is sent.
+ */
+static __thread struct netem_dist {
+	struct netem_dist	*next;
+	const __s16		*data;
+	int			size;
+	char			type[];
+} *netem_dists;
+
 /*
  * Simplistic file parser for distrbution data.
  * Format is:
  *	# comment line(s)
  *	data0 data1 ...
  */
-static int get_distribution(const char *type, __s16 *data, int maxdata)
+static int read_distribution(const char *type, const char *name,
+			     __s16 *data, int maxdata)
 {
 	FILE *f;
 	int n;
 	long x;
 	size_t len;
 	char *line = NULL;
-	char name[128];
 
-	snprintf(name, sizeof(name), "%s/%s.dist", get_tc_lib(), type);
 	if ((f = fopen(name, "r")) == NULL) {
 		fprintf(stderr, "No distribution data for %s (%s: %s)\n",
 			type, name, strerror(errno));
@@ -130,6 +144,97 @@ static int get_distribution(const char *type, __s16 *data, int maxdata)
 	return n;
 }
 
+/*
+ * A .distb file is mapped and its table used in place. Returns the
+ * number of entries, 0 if there is no such file or it is not a table
+ * this tc can use, so that the .dist text is read instead.
+ */
+static int map_distribution(const char *type, const char *name,
+			    const __s16 **data)
+{
+	const struct netem_distb_hdr *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		goto err;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		goto err;
+	}
+	if (st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		goto err;
+
+	hdr = map;
+	if (hdr->magic != NETEM_DISTB_MAGIC ||
+	    hdr->version != NETEM_DISTB_VERSION ||
+	    hdr->entries == 0 || hdr->entries > MAX_DIST ||
+	    st.st_size < sizeof(*hdr) + hdr->entries * sizeof(__s16)) {
+		/* made on a host of another byte order, or by another tc */
+		munmap(map, st.st_size);
+		return 0;
+	}
+	*data = (const __s16 *)(hdr + 1);
+	return hdr->entries;
+err:
+	fprintf(stderr, "No distribution data for %s (%s: %s)\n",
+		type, name, strerror(errno));
+	return -1;
+}
+
+static int get_distribution(const char *type, const __s16 **data)
+{
+	struct netem_dist *d;
+	char name[128];
+	__s16 *table;
+	int n;
+
+	for (d = netem_dists; d; d = d->next) {
+		if (strcmp(d->type, type) == 0) {
+			*data = d->data;
+			return d->size;
+		}
+	}
+
+	snprintf(name, sizeof(name), "%s/%s.distb", get_tc_lib(), type);
+	n = map_distribution(type, name, data);
+	if (n == 0) {
+		snprintf(name, sizeof(name), "%s/%s.dist", get_tc_lib(), type);
+		table = malloc(MAX_DIST * sizeof(*table));
+		if (!table)
+			return -1;
+		n = read_distribution(type, name, table, MAX_DIST);
+		if (n <= 0) {
+			free(table);
+			return -1;
+		}
+		*data = table;
+	}
+	if (n < 0)
+		return -1;
+
+	d = malloc(sizeof(*d) + strlen(type) + 1);
+	if (!d)
+		return -1;
+	strcpy(d->type, type);
+	d->data = *data;
+	d->size = n;
+	d->next = netem_dists;
+	netem_dists = d;
+	return n;
+}
+
 #define NEXT_IS_NUMBER() (NEXT_ARG_OK() && isdigit(argv[1][0]))
 #define NEXT_IS_SIGNED_NUMBER() \
 	(NEXT_ARG_OK() && (isdigit(argv[1][0]) || argv[1][0] == '-'))
@@ -164,7 +269,7 @@ static int netem_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 	struct tc_netem_gimodel gimodel;
 	struct tc_netem_gemodel gemodel;
 	struct tc_netem_rate rate = {};
-	__s16 *dist_data = NULL;
+	const __s16 *dist_data = NULL;
 	__u16 loss_type = NETEM_LOSS_UNSPEC;
 	int present[__TCA_NETEM_MAX] = {};
 	__u64 rate64 = 0;
@@ -373,12 +478,9 @@ static int netem_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 			}
 		} else if (matches(*argv, "distribution") == 0) {
 			NEXT_ARG();
-			dist_data = calloc(sizeof(dist_data[0]), MAX_DIST);
-			dist_size = get_distribution(*argv, dist_data, MAX_DIST);
-			if (dist_size <= 0) {
-				free(dist_data);
+			dist_size = get_distribution(*argv, &dist_data);
+			if (dist_size <= 0)
 				return -1;
-			}
 		} else if (matches(*argv, "rate") == 0) {
 			++present[TCA_NETEM_RATE];
 			NEXT_ARG();
@@ -503,11 +605,10 @@ static int netem_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 	}
 
 	if (dist_data) {
-		if (addattr_l(n, MAX_DIST * sizeof(dist_data[0]),
-			      TCA_NETEM_DELAY_DIST,
-			      dist_data, dist_size * sizeof(dist_data[0])) < 0)
+		if (addattr_ref(n, MAX_DIST * sizeof(dist_data[0]),
+				tc_qdisc_refs, TCA_NETEM_DELAY_DIST,
+				dist_data, dist_size * sizeof(dist_data[0])) < 0)
 			return -1;
-		free(dist_data);
 	}
 	addattr_nest_compat_end(n, tail);
 	return 0;
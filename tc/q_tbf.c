@@ -40,8 +40,7 @@ static int tbf_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 {
 	int ok = 0;
 	struct tc_tbf_qopt opt = {};
-	__u32 rtab[256];
-	__u32 ptab[256];
+	const __u32 *rtab, *ptab = NULL;
 	unsigned buffer = 0, mtu = 0, mpu = 0, latency = 0;
 	int Rcell_log =  -1, Pcell_log = -1;
 	unsigned short overhead = 0;
@@ -225,7 +224,8 @@ static int tbf_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 
 	opt.rate.mpu      = mpu;
 	opt.rate.overhead = overhead;
-	if (tc_calc_rtable(&opt.rate, rtab, Rcell_log, mtu, linklayer) < 0) {
+	rtab = tc_rtable(&opt.rate, Rcell_log, mtu, linklayer);
+	if (!rtab) {
 		fprintf(stderr, "tbf: failed to calculate rate table.\n");
 		return -1;
 	}
@@ -234,7 +234,8 @@ static int tbf_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 	if (opt.peakrate.rate) {
 		opt.peakrate.mpu      = mpu;
 		opt.peakrate.overhead = overhead;
-		if (tc_calc_rtable(&opt.peakrate, ptab, Pcell_log, mtu, linklayer) < 0) {
+		ptab = tc_rtable(&opt.peakrate, Pcell_log, mtu, linklayer);
+		if (!ptab) {
 			fprintf(stderr, "tbf: failed to calculate peak rate table.\n");
 			return -1;
 		}
@@ -26,32 +26,49 @@
 
 #include "SNAPSHOT.h"
 #include "utils.h"
+#include "plugin.h"
 #include "tc_util.h"
 #include "tc_common.h"
 #include "namespace.h"
-
-int show_stats;
-int show_details;
-int show_raw;
-int show_graph;
-int timestamp;
-
-int batch_mode;
-int use_iec;
+#include "rt_names.h"
+#include "probe.h"
+
+__thread int show_stats;
+__thread int show_details;
+__thread int show_raw;
+__thread int show_graph;
+__thread int brief;
+__thread int timestamp;
+
+__thread int batch_mode;
+__thread int use_iec;
 int force;
-bool use_names;
-int json;
+__thread bool use_names;
+__thread int json;
 int color;
-int oneline;
-const char *_SL_;
+__thread int oneline;
+__thread const char *_SL_ = "\n";
 
 static char *conf_file;
 
-struct rtnl_handle rth;
+/* requests a batch keeps in flight at once, 0 for the default window */
+#define TC_BATCHSIZE_MAX	1024
+static unsigned int batchsize;
+
+#define TC_JOBS_MAX	1024
+
+__thread struct rtnl_handle rth;
 
 static void *BODY;	/* cached handle dlopen(NULL) */
-static struct qdisc_util *qdisc_list;
-static struct filter_util *filter_list;
+static pthread_once_t body_once = PTHREAD_ONCE_INIT;
+static struct plugin_cache qdisc_plugins = PLUGIN_CACHE_INIT;
+static struct plugin_cache filter_plugins = PLUGIN_CACHE_INIT;
+
+/* qdisc and filter kinds both look in it, under locks of their own */
+static void body_open(void)
+{
+	BODY = dlopen(NULL, RTLD_LAZY);
+}
 
 static int print_noqopt(struct qdisc_util *qu, FILE *f,
 			struct rtattr *opt)
@@ -107,26 +124,27 @@ static int parse_nofopt(struct filter_util *qu, char *fhandle,
 	return 0;
 }
 
-struct qdisc_util *get_qdisc_kind(const char *str)
+static struct qdisc_util *__get_qdisc_kind(const char *str)
 {
 	void *dlh;
 	char buf[256];
 	struct qdisc_util *q;
 
-	for (q = qdisc_list; q; q = q->next)
-		if (strcmp(q->id, str) == 0)
-			return q;
+	if (plugin_find(&qdisc_plugins, str, (void **)&q))
+		return q;
 
-	snprintf(buf, sizeof(buf), "%s/q_%s.so", get_tc_lib(), str);
-	dlh = dlopen(buf, RTLD_LAZY);
+	dlh = NULL;
+	snprintf(buf, sizeof(buf), "q_%s.so", str);
+	if (plugin_dir_has(&qdisc_plugins, get_tc_lib(), buf)) {
+		snprintf(buf, sizeof(buf), "%s/q_%s.so", get_tc_lib(), str);
+		dlh = dlopen(buf, RTLD_LAZY);
+	}
 	if (!dlh) {
 		/* look in current binary, only open once */
+		pthread_once(&body_once, body_open);
 		dlh = BODY;
-		if (dlh == NULL) {
-			dlh = BODY = dlopen(NULL, RTLD_LAZY);
-			if (dlh == NULL)
-				goto noexist;
-		}
+		if (dlh == NULL)
+			goto noexist;
 	}
 
 	snprintf(buf, sizeof(buf), "%s_qdisc_util", str);
@@ -135,8 +153,7 @@ struct qdisc_util *get_qdisc_kind(const char *str)
 		goto noexist;
 
 reg:
-	q->next = qdisc_list;
-	qdisc_list = q;
+	plugin_add(&qdisc_plugins, str, q);
 	return q;
 
 noexist:
@@ -150,26 +167,37 @@ noexist:
 	return q;
 }
 
+struct qdisc_util *get_qdisc_kind(const char *str)
+{
+	struct qdisc_util *q;
+
+	plugin_lock(&qdisc_plugins);
+	q = __get_qdisc_kind(str);
+	plugin_unlock(&qdisc_plugins);
+	return q;
+}
+
 
-struct filter_util *get_filter_kind(const char *str)
+static struct filter_util *__get_filter_kind(const char *str)
 {
 	void *dlh;
 	char buf[256];
 	struct filter_util *q;
 
-	for (q = filter_list; q; q = q->next)
-		if (strcmp(q->id, str) == 0)
-			return q;
+	if (plugin_find(&filter_plugins, str, (void **)&q))
+		return q;
 
-	snprintf(buf, sizeof(buf), "%s/f_%s.so", get_tc_lib(), str);
-	dlh = dlopen(buf, RTLD_LAZY);
+	dlh = NULL;
+	snprintf(buf, sizeof(buf), "f_%s.so", str);
+	if (plugin_dir_has(&filter_plugins, get_tc_lib(), buf)) {
+		snprintf(buf, sizeof(buf), "%s/f_%s.so", get_tc_lib(), str);
+		dlh = dlopen(buf, RTLD_LAZY);
+	}
 	if (dlh == NULL) {
+		pthread_once(&body_once, body_open);
 		dlh = BODY;
-		if (dlh == NULL) {
-			dlh = BODY = dlopen(NULL, RTLD_LAZY);
-			if (dlh == NULL)
-				goto noexist;
-		}
+		if (dlh == NULL)
+			goto noexist;
 	}
 
 	snprintf(buf, sizeof(buf), "%s_filter_util", str);
@@ -178,8 +206,7 @@ struct filter_util *get_filter_kind(const char *str)
 		goto noexist;
 
 reg:
-	q->next = filter_list;
-	filter_list = q;
+	plugin_add(&filter_plugins, str, q);
 	return q;
 noexist:
 	q = calloc(1, sizeof(*q));
@@ -192,28 +219,41 @@ noexist:
 	return q;
 }
 
+struct filter_util *get_filter_kind(const char *str)
+{
+	struct filter_util *q;
+
+	plugin_lock(&filter_plugins);
+	q = __get_filter_kind(str);
+	plugin_unlock(&filter_plugins);
+	return q;
+}
+
 static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: tc [ OPTIONS ] OBJECT { COMMAND | help }\n"
-		"       tc [-force] -batch filename\n"
-		"where  OBJECT := { qdisc | class | filter | action | monitor | exec }\n"
+		"       tc [-force] [-batchsize N] -batch filename\n"
+		"where  OBJECT := { qdisc | class | filter | chain | action | monitor | exec }\n"
 		"       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] | -r[aw] |\n"
-		"                    -o[neline] | -j[son] | -p[retty] | -c[olor]\n"
-		"                    -b[atch] [filename] | -n[etns] name |\n"
-		"                    -nm | -nam[es] | { -cf | -conf } path }\n");
+		"                    -o[neline] | -j[son] | -ndjson | -cbor | -p[retty] | -c[olor]\n"
+		"                    -b[atch] [filename] | -br[ief] | -n[etns] name |\n"
+		"                    -nm | -nam[es] | { -cf | -conf } path |\n"
+		"                    -daemon socket | -stats-netlink | -timing | -jobs N }\n");
 }
 
-static int do_cmd(int argc, char **argv, void *buf, size_t buflen)
+static int do_cmd(int argc, char **argv)
 {
 	if (matches(*argv, "qdisc") == 0)
 		return do_qdisc(argc-1, argv+1);
 	if (matches(*argv, "class") == 0)
 		return do_class(argc-1, argv+1);
 	if (matches(*argv, "filter") == 0)
-		return do_filter(argc-1, argv+1, buf, buflen);
+		return do_filter(argc-1, argv+1);
+	if (matches(*argv, "chain") == 0)
+		return do_chain(argc-1, argv+1);
 	if (matches(*argv, "actions") == 0)
-		return do_action(argc-1, argv+1, buf, buflen);
+		return do_action(argc-1, argv+1);
 	if (matches(*argv, "monitor") == 0)
 		return do_tcmonitor(argc-1, argv+1);
 	if (matches(*argv, "exec") == 0)
@@ -229,230 +269,174 @@ static int do_cmd(int argc, char **argv, void *buf, size_t buflen)
 }
 
 #define TC_MAX_SUBC	10
-static bool batchsize_enabled(int argc, char *argv[])
+
+/* Commands that only wait for an ack, pipelined in a batch */
+static bool batch_pipelined(int argc, char *argv[])
 {
-	struct {
-		char *c;
-		char *subc[TC_MAX_SUBC];
-	} table[] = {
-		{ "filter", { "add", "delete", "change", "replace", NULL} },
-		{ "actions", { "add", "change", "replace", NULL} },
-		{ NULL },
-	}, *iter;
-	char *s;
-	int i;
+	static const char * const objs[] = {
+		"qdisc", "class", "filter", "chain", "actions", NULL,
+	};
+	static const char * const subc[TC_MAX_SUBC] = {
+		"add", "delete", "change", "replace", "link", NULL,
+	};
+	int i, j;
 
 	if (argc < 2)
 		return false;
 
-	for (iter = table; iter->c; iter++) {
-		if (matches(argv[0], iter->c))
+	for (i = 0; objs[i]; i++) {
+		if (matches(argv[0], objs[i]))
 			continue;
-		for (i = 0; i < TC_MAX_SUBC; i++) {
-			s = iter->subc[i];
-			if (s && matches(argv[1], s) == 0)
+		for (j = 0; subc[j]; j++)
+			if (matches(argv[1], subc[j]) == 0)
 				return true;
-		}
 	}
 
 	return false;
 }
 
-struct batch_buf {
-	struct batch_buf	*next;
-	char			buf[16420];	/* sizeof (struct nlmsghdr) +
-						   max(sizeof (struct tcmsg) +
-						   sizeof (struct tcamsg)) +
-						   MAX_MSG */
+struct batch_async_ctx {
+	const char	*name;
+	int		ret;
 };
 
-static struct batch_buf *get_batch_buf(struct batch_buf **pool,
-				       struct batch_buf **head,
-				       struct batch_buf **tail)
-{
-	struct batch_buf *buf;
-
-	if (*pool == NULL)
-		buf = calloc(1, sizeof(struct batch_buf));
-	else {
-		buf = *pool;
-		*pool = (*pool)->next;
-		memset(buf, 0, sizeof(struct batch_buf));
-	}
-
-	if (*head == NULL)
-		*head = *tail = buf;
-	else {
-		(*tail)->next = buf;
-		(*tail) = buf;
-	}
-
-	return buf;
-}
-
-static void put_batch_bufs(struct batch_buf **pool,
-			   struct batch_buf **head,
-			   struct batch_buf **tail)
+static void batch_async_err(__u32 cookie, int error, void *arg)
 {
-	if (*head == NULL || *tail == NULL)
-		return;
-
-	if (*pool == NULL)
-		*pool = *head;
-	else {
-		(*tail)->next = *pool;
-		*pool = *head;
-	}
-	*head = NULL;
-	*tail = NULL;
-}
+	struct batch_async_ctx *ctx = arg;
 
-static void free_batch_bufs(struct batch_buf **pool)
-{
-	struct batch_buf *buf;
-
-	for (buf = *pool; buf != NULL; buf = *pool) {
-		*pool = buf->next;
-		free(buf);
-	}
-	*pool = NULL;
+	fprintf(stderr, "Command failed %s:%u\n", ctx->name, cookie);
+	ctx->ret = 1;
 }
 
 static int batch(const char *name)
 {
-	struct batch_buf *head = NULL, *tail = NULL, *buf_pool = NULL;
-	char *largv[100], *largv_next[100];
-	char *line, *line_next = NULL;
-	bool bs_enabled_next = false;
-	bool bs_enabled = false;
-	bool lastline = false;
-	int largc, largc_next;
-	bool bs_enabled_saved;
-	int batchsize = 0;
-	size_t len = 0;
+	struct batch_async_ctx async = { .name = name };
+	struct cmdfile *cf;
+	char **largv;
+	int largc;
 	int ret = 0;
-	bool send;
 
 	batch_mode = 1;
-	if (name && strcmp(name, "-") != 0) {
-		if (freopen(name, "r", stdin) == NULL) {
-			fprintf(stderr,
-				"Cannot open file \"%s\" for reading: %s\n",
-				name, strerror(errno));
-			return -1;
-		}
-	}
-
-	tc_core_init();
+	cf = cmdfile_open(name);
+	if (!cf)
+		return -1;
 
 	if (rtnl_open(&rth, 0) < 0) {
 		fprintf(stderr, "Cannot open rtnetlink\n");
+		cmdfile_close(cf);
 		return -1;
 	}
 
+	/* keep the link cache in step with what earlier lines changed */
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, cache may go stale\n");
+
+	/*
+	 * Up to batchsize requests are in flight at once; without -force
+	 * those queued behind the first to fail have been applied too.
+	 */
+	if (batchsize != 1 &&
+	    rtnl_async_begin(&rth, batchsize, batch_async_err, &async) < 0)
+		fprintf(stderr, "Cannot pipeline batch, continuing without\n");
+
 	cmdlineno = 0;
-	if (getcmdline(&line, &len, stdin) == -1)
-		goto Exit;
-	largc = makeargs(line, largv, 100);
-	bs_enabled = batchsize_enabled(largc, largv);
-	bs_enabled_saved = bs_enabled;
-	do {
-		if (getcmdline(&line_next, &len, stdin) == -1)
-			lastline = true;
-
-		largc_next = makeargs(line_next, largv_next, 100);
-		bs_enabled_next = batchsize_enabled(largc_next, largv_next);
-		if (bs_enabled) {
-			struct batch_buf *buf;
-
-			buf = get_batch_buf(&buf_pool, &head, &tail);
-			if (!buf) {
-				fprintf(stderr,
-					"failed to allocate batch_buf\n");
-				return -1;
-			}
-			++batchsize;
-		}
+	while ((largc = cmdfile_next(cf, &largv)) != -1) {
+		ll_sync_map(&rth);
 
-		/*
-		 * In batch mode, if we haven't accumulated enough commands
-		 * and this is not the last command and this command & next
-		 * command both support the batchsize feature, don't send the
-		 * message immediately.
-		 */
-		if (!lastline && bs_enabled && bs_enabled_next
-		    && batchsize != MSG_IOV_MAX)
-			send = false;
-		else
-			send = true;
-
-		line = line_next;
-		line_next = NULL;
-		len = 0;
-		bs_enabled_saved = bs_enabled;
-		bs_enabled = bs_enabled_next;
-		bs_enabled_next = false;
-
-		if (largc == 0) {
-			largc = largc_next;
-			memcpy(largv, largv_next, largc * sizeof(char *));
+		if (largc == 0)
 			continue;	/* blank line */
+
+		if (rth.async && batch_pipelined(largc, largv)) {
+			rtnl_async_cookie(&rth, cmdlineno);
+			rth.flags |= RTNL_HANDLE_F_ASYNC;
+		} else if (rth.async) {
+			rtnl_async_flush(&rth);
+			rth.flags &= ~RTNL_HANDLE_F_ASYNC;
+		}
+
+		if (!force && async.ret) {
+			ret = async.ret;
+			break;
 		}
 
-		ret = do_cmd(largc, largv, tail == NULL ? NULL : tail->buf,
-			     tail == NULL ? 0 : sizeof(tail->buf));
+		PROBE2(batch_line_start, cmdlineno, largv[0]);
+		ret = do_cmd(largc, largv);
+		PROBE2(batch_line_end, cmdlineno, ret);
 		if (ret != 0) {
 			fprintf(stderr, "Command failed %s:%d\n", name,
-				cmdlineno - 1);
+				cmdlineno);
 			ret = 1;
 			if (!force)
 				break;
 		}
-		largc = largc_next;
-		memcpy(largv, largv_next, largc * sizeof(char *));
-
-		if (send && bs_enabled_saved) {
-			struct iovec *iov, *iovs;
-			struct batch_buf *buf;
-			struct nlmsghdr *n;
-
-			iov = iovs = malloc(batchsize * sizeof(struct iovec));
-			for (buf = head; buf != NULL; buf = buf->next, ++iov) {
-				n = (struct nlmsghdr *)&buf->buf;
-				iov->iov_base = n;
-				iov->iov_len = n->nlmsg_len;
-			}
-
-			ret = rtnl_talk_iov(&rth, iovs, batchsize, NULL);
-			if (ret < 0) {
-				fprintf(stderr, "Command failed %s:%d\n", name,
-					cmdlineno - (batchsize + ret) - 1);
-				return 2;
-			}
-			put_batch_bufs(&buf_pool, &head, &tail);
-			batchsize = 0;
-			free(iovs);
+
+		/* a request queued earlier failed while this one was added */
+		if (!force && async.ret) {
+			ret = async.ret;
+			break;
 		}
-	} while (!lastline);
+	}
 
-	free_batch_bufs(&buf_pool);
-Exit:
-	free(line);
+	/* what is still queued comes after the request that failed */
+	if (!force && async.ret)
+		rtnl_async_discard(&rth);
+	cmdfile_close(cf);
+	rtnl_async_end(&rth);
+	if (async.ret)
+		ret = async.ret;
 	rtnl_close(&rth);
 
 	return ret;
 }
 
+static int serve_cmd(int argc, char **argv)
+{
+	return do_cmd(argc, argv);
+}
+
+static void serve_sync(void)
+{
+	ll_sync_map(&rth);
+	/* replies to a command that was killed halfway must not match */
+	rth.seq += 1 << 16;
+}
+
+static int serve(const char *path)
+{
+	batch_mode = 1;
+
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+
+	if (ll_watch_map() < 0)
+		fprintf(stderr, "Cannot watch links, cache may go stale\n");
+	ll_init_map(&rth);
+	rtnl_names_preload();
+
+	if (!use_names || cls_names_init(conf_file) == 0)
+		serve_cmdlines(path, serve_cmd, serve_sync);
+
+	rtnl_close(&rth);
+	return -1;
+}
+
 
 int main(int argc, char **argv)
 {
 	int ret;
 	char *batch_file = NULL;
+	char *serve_path = NULL;
 
 	while (argc > 1) {
 		if (argv[1][0] != '-')
 			break;
-		if (matches(argv[1], "-stats") == 0 ||
+		if (strcmp(argv[1], "-stats-netlink") == 0) {
+			rtnl_stats_enable();
+		} else if (strcmp(argv[1], "-timing") == 0) {
+			rtnl_timing_enable();
+		} else if (matches(argv[1], "-stats") == 0 ||
 			 matches(argv[1], "-statistics") == 0) {
 			++show_stats;
 		} else if (matches(argv[1], "-details") == 0) {
@@ -473,11 +457,28 @@ int main(int argc, char **argv)
 			return 0;
 		} else if (matches(argv[1], "-force") == 0) {
 			++force;
+		} else if (strcmp(argv[1], "-batchsize") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&batchsize, argv[1], 0) ||
+			    !batchsize || batchsize > TC_BATCHSIZE_MAX)
+				invarg("invalid batch size", argv[1]);
+		} else if (strcmp(argv[1], "-jobs") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&tc_jobs, argv[1], 0) ||
+			    !tc_jobs || tc_jobs > TC_JOBS_MAX)
+				invarg("invalid jobs", argv[1]);
 		} else if (matches(argv[1], "-batch") == 0) {
 			argc--;	argv++;
 			if (argc <= 1)
 				usage();
 			batch_file = argv[1];
+		} else if (matches(argv[1], "-brief") == 0) {
+			++brief;
+		} else if (matches(argv[1], "-daemon") == 0) {
+			argc--;	argv++;
+			if (argc <= 1)
+				usage();
+			serve_path = argv[1];
 		} else if (matches(argv[1], "-netns") == 0) {
 			NEXT_ARG();
 			if (netns_switch(argv[1]))
@@ -498,6 +499,12 @@ int main(int argc, char **argv)
 			++timestamp_short;
 		} else if (matches(argv[1], "-json") == 0) {
 			++json;
+		} else if (strcmp(argv[1], "-ndjson") == 0) {
+			++json;
+			++ndjson;
+		} else if (strcmp(argv[1], "-cbor") == 0) {
+			++json;
+			++cbor;
 		} else if (matches(argv[1], "-oneline") == 0) {
 			++oneline;
 		} else {
@@ -517,12 +524,14 @@ int main(int argc, char **argv)
 	if (batch_file)
 		return batch(batch_file);
 
+	if (serve_path)
+		return serve(serve_path);
+
 	if (argc <= 1) {
 		usage();
 		return 0;
 	}
 
-	tc_core_init();
 	if (rtnl_open(&rth, 0) < 0) {
 		fprintf(stderr, "Cannot open rtnetlink\n");
 		iprt_exit(1);
@@ -533,7 +542,7 @@ int main(int argc, char **argv)
 		goto Exit;
 	}
 
-	ret = do_cmd(argc-1, argv+1, NULL, 0);
+	ret = do_cmd(argc-1, argv+1);
 Exit:
 	rtnl_close(&rth);
 
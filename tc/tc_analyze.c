@@ -0,0 +1,456 @@
+/*
+ * tc_analyze.c		"tc filter analyze", the flower masks of each chain.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * A flower classifier keeps a hash table per distinct mask, and looks a
+ * packet up in every one of them. The mask of a filter is what each of
+ * its keys is masked with, all ones for keys that take no mask, so the
+ * signature of a filter here is the list of its keys with their masks.
+ * The filters of a dump are sorted by chain, priority, protocol and
+ * signature, and every run of one signature is a mask table of the
+ * classifier instance it is in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/if_ether.h>
+
+#include "rt_names.h"
+#include "utils.h"
+#include "tc_util.h"
+#include "tc_common.h"
+
+/* flower keys, the masks that go with them (0 for none) and their names */
+static const struct {
+	int		key;
+	int		mask;
+	const char	*name;
+} ta_keys[] = {
+	{ TCA_FLOWER_INDEV, 0, "indev" },
+	{ TCA_FLOWER_KEY_ETH_DST, TCA_FLOWER_KEY_ETH_DST_MASK, "dst_mac" },
+	{ TCA_FLOWER_KEY_ETH_SRC, TCA_FLOWER_KEY_ETH_SRC_MASK, "src_mac" },
+	{ TCA_FLOWER_KEY_ETH_TYPE, 0, "eth_type" },
+	{ TCA_FLOWER_KEY_VLAN_ID, 0, "vlan_id" },
+	{ TCA_FLOWER_KEY_VLAN_PRIO, 0, "vlan_prio" },
+	{ TCA_FLOWER_KEY_VLAN_ETH_TYPE, 0, "vlan_ethtype" },
+	{ TCA_FLOWER_KEY_MPLS_LABEL, 0, "mpls_label" },
+	{ TCA_FLOWER_KEY_MPLS_TC, 0, "mpls_tc" },
+	{ TCA_FLOWER_KEY_MPLS_BOS, 0, "mpls_bos" },
+	{ TCA_FLOWER_KEY_MPLS_TTL, 0, "mpls_ttl" },
+	{ TCA_FLOWER_KEY_IP_PROTO, 0, "ip_proto" },
+	{ TCA_FLOWER_KEY_IP_TOS, TCA_FLOWER_KEY_IP_TOS_MASK, "ip_tos" },
+	{ TCA_FLOWER_KEY_IP_TTL, TCA_FLOWER_KEY_IP_TTL_MASK, "ip_ttl" },
+	{ TCA_FLOWER_KEY_FLAGS, TCA_FLOWER_KEY_FLAGS_MASK, "ip_flags" },
+	{ TCA_FLOWER_KEY_IPV4_SRC, TCA_FLOWER_KEY_IPV4_SRC_MASK, "src_ip" },
+	{ TCA_FLOWER_KEY_IPV4_DST, TCA_FLOWER_KEY_IPV4_DST_MASK, "dst_ip" },
+	{ TCA_FLOWER_KEY_IPV6_SRC, TCA_FLOWER_KEY_IPV6_SRC_MASK, "src_ip" },
+	{ TCA_FLOWER_KEY_IPV6_DST, TCA_FLOWER_KEY_IPV6_DST_MASK, "dst_ip" },
+	{ TCA_FLOWER_KEY_ARP_SIP, TCA_FLOWER_KEY_ARP_SIP_MASK, "arp_sip" },
+	{ TCA_FLOWER_KEY_ARP_TIP, TCA_FLOWER_KEY_ARP_TIP_MASK, "arp_tip" },
+	{ TCA_FLOWER_KEY_ARP_OP, TCA_FLOWER_KEY_ARP_OP_MASK, "arp_op" },
+	{ TCA_FLOWER_KEY_ARP_SHA, TCA_FLOWER_KEY_ARP_SHA_MASK, "arp_sha" },
+	{ TCA_FLOWER_KEY_ARP_THA, TCA_FLOWER_KEY_ARP_THA_MASK, "arp_tha" },
+	{ TCA_FLOWER_KEY_TCP_SRC, TCA_FLOWER_KEY_TCP_SRC_MASK, "src_port" },
+	{ TCA_FLOWER_KEY_TCP_DST, TCA_FLOWER_KEY_TCP_DST_MASK, "dst_port" },
+	{ TCA_FLOWER_KEY_UDP_SRC, TCA_FLOWER_KEY_UDP_SRC_MASK, "src_port" },
+	{ TCA_FLOWER_KEY_UDP_DST, TCA_FLOWER_KEY_UDP_DST_MASK, "dst_port" },
+	{ TCA_FLOWER_KEY_SCTP_SRC, TCA_FLOWER_KEY_SCTP_SRC_MASK, "src_port" },
+	{ TCA_FLOWER_KEY_SCTP_DST, TCA_FLOWER_KEY_SCTP_DST_MASK, "dst_port" },
+	{ TCA_FLOWER_KEY_TCP_FLAGS, TCA_FLOWER_KEY_TCP_FLAGS_MASK, "tcp_flags" },
+	{ TCA_FLOWER_KEY_ICMPV4_TYPE, TCA_FLOWER_KEY_ICMPV4_TYPE_MASK, "type" },
+	{ TCA_FLOWER_KEY_ICMPV4_CODE, TCA_FLOWER_KEY_ICMPV4_CODE_MASK, "code" },
+	{ TCA_FLOWER_KEY_ICMPV6_TYPE, TCA_FLOWER_KEY_ICMPV6_TYPE_MASK, "type" },
+	{ TCA_FLOWER_KEY_ICMPV6_CODE, TCA_FLOWER_KEY_ICMPV6_CODE_MASK, "code" },
+	{ TCA_FLOWER_KEY_ENC_KEY_ID, 0, "enc_key_id" },
+	{ TCA_FLOWER_KEY_ENC_IPV4_SRC, TCA_FLOWER_KEY_ENC_IPV4_SRC_MASK,
+	  "enc_src_ip" },
+	{ TCA_FLOWER_KEY_ENC_IPV4_DST, TCA_FLOWER_KEY_ENC_IPV4_DST_MASK,
+	  "enc_dst_ip" },
+	{ TCA_FLOWER_KEY_ENC_IPV6_SRC, TCA_FLOWER_KEY_ENC_IPV6_SRC_MASK,
+	  "enc_src_ip" },
+	{ TCA_FLOWER_KEY_ENC_IPV6_DST, TCA_FLOWER_KEY_ENC_IPV6_DST_MASK,
+	  "enc_dst_ip" },
+	{ TCA_FLOWER_KEY_ENC_UDP_SRC_PORT, TCA_FLOWER_KEY_ENC_UDP_SRC_PORT_MASK,
+	  "enc_src_port" },
+	{ TCA_FLOWER_KEY_ENC_UDP_DST_PORT, TCA_FLOWER_KEY_ENC_UDP_DST_PORT_MASK,
+	  "enc_dst_port" },
+};
+
+/*
+ * The signature: for each key in the order of ta_keys, its index, the
+ * length of its mask and the mask, one byte each for the first two.
+ */
+#define TA_SIG_MAX	512
+
+struct ta_filter {
+	__u32		chain;
+	__u32		prio;
+	__u16		proto;
+	bool		flower;
+	unsigned int	siglen;
+	__u8		*sig;
+};
+
+struct ta_dump {
+	struct ta_filter	*f;
+	unsigned int		n;
+	unsigned int		size;
+};
+
+static void print_explain(FILE *f)
+{
+	fprintf(f,
+		"Usage: tc filter analyze [ dev STRING | block BLOCK_INDEX ]\n"
+		"       [ root | ingress | egress | parent CLASSID ] [ chain CHAIN_INDEX ]\n");
+}
+
+static unsigned int ta_sig(struct rtattr *opts, __u8 *sig)
+{
+	struct rtattr *tb[TCA_FLOWER_MAX + 1];
+	unsigned int i, len = 0;
+
+	parse_rtattr_nested(tb, TCA_FLOWER_MAX, opts);
+	for (i = 0; i < ARRAY_SIZE(ta_keys); i++) {
+		struct rtattr *k = tb[ta_keys[i].key];
+		struct rtattr *m = ta_keys[i].mask ? tb[ta_keys[i].mask] : NULL;
+		int klen;
+
+		if (!k)
+			continue;
+		klen = RTA_PAYLOAD(k);
+		if (klen > 255 || len + 2 + klen > TA_SIG_MAX)
+			break;
+		sig[len++] = i;
+		sig[len++] = klen;
+		if (m && RTA_PAYLOAD(m) == klen)
+			memcpy(sig + len, RTA_DATA(m), klen);
+		else
+			memset(sig + len, 0xff, klen);
+		len += klen;
+	}
+	return len;
+}
+
+static int ta_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		    void *arg)
+{
+	struct ta_dump *d = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+	__u8 sig[TA_SIG_MAX];
+	struct ta_filter *f;
+
+	if (n->nlmsg_type != RTM_NEWTFILTER || len < 0)
+		return 0;
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	/* the classifier instance itself, or an u32 hash table */
+	if (!tb[TCA_KIND] || !tb[TCA_OPTIONS] || !t->tcm_handle)
+		return 0;
+	if (strcmp(rta_getattr_str(tb[TCA_KIND]), "u32") == 0 &&
+	    !TC_U32_KEY(t->tcm_handle))
+		return 0;
+
+	if (d->n == d->size) {
+		unsigned int size = d->size ? 2 * d->size : 1024;
+
+		f = realloc(d->f, size * sizeof(*f));
+		if (!f)
+			return -1;
+		d->f = f;
+		d->size = size;
+	}
+	f = &d->f[d->n];
+	memset(f, 0, sizeof(*f));
+	f->chain = tb[TCA_CHAIN] ? rta_getattr_u32(tb[TCA_CHAIN]) : 0;
+	f->prio = TC_H_MAJ(t->tcm_info) >> 16;
+	f->proto = TC_H_MIN(t->tcm_info);
+	f->flower = strcmp(rta_getattr_str(tb[TCA_KIND]), "flower") == 0;
+	if (f->flower) {
+		f->siglen = ta_sig(tb[TCA_OPTIONS], sig);
+		f->sig = malloc(f->siglen ? f->siglen : 1);
+		if (!f->sig)
+			return -1;
+		memcpy(f->sig, sig, f->siglen);
+	}
+	d->n++;
+	return 0;
+}
+
+static int ta_filter_cmp(const void *a, const void *b)
+{
+	const struct ta_filter *fa = a, *fb = b;
+
+	if (fa->chain != fb->chain)
+		return fa->chain < fb->chain ? -1 : 1;
+	if (fa->prio != fb->prio)
+		return fa->prio < fb->prio ? -1 : 1;
+	if (fa->proto != fb->proto)
+		return fa->proto < fb->proto ? -1 : 1;
+	if (fa->flower != fb->flower)
+		return fa->flower ? -1 : 1;
+	if (fa->siglen != fb->siglen)
+		return fa->siglen < fb->siglen ? -1 : 1;
+	return fa->siglen ? memcmp(fa->sig, fb->sig, fa->siglen) : 0;
+}
+
+static bool ta_same_mask(const struct ta_filter *a, const struct ta_filter *b)
+{
+	return a->chain == b->chain && a->prio == b->prio &&
+	       a->proto == b->proto && a->flower && b->flower &&
+	       a->siglen == b->siglen && !memcmp(a->sig, b->sig, a->siglen);
+}
+
+/* bits of a mask made of leading ones, or -1 */
+static int ta_prefix(const __u8 *m, int len)
+{
+	int i, bits = 0;
+
+	for (i = 0; i < len && m[i] == 0xff; i++)
+		bits += 8;
+	if (i == len)
+		return bits;
+	bits += __builtin_popcount(m[i]);
+	if (m[i] != (__u8)(0xff << (8 - bits % 8)))
+		return -1;
+	while (++i < len)
+		if (m[i])
+			return -1;
+	return bits;
+}
+
+static void ta_print_mask(const struct ta_filter *f, unsigned int count)
+{
+	unsigned int i = 0;
+
+	open_json_object(NULL);
+	print_uint(PRINT_ANY, "filters", "    %u filters:", count);
+	open_json_array(PRINT_JSON, "keys");
+	while (i < f->siglen) {
+		const char *name = ta_keys[f->sig[i]].name;
+		int len = f->sig[i + 1], bits, j;
+		const __u8 *m = f->sig + i + 2;
+		SPRINT_BUF(b1);
+
+		bits = ta_prefix(m, len);
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "key", " %s", name);
+		if (bits >= 0 && bits < len * 8) {
+			print_int(PRINT_ANY, "prefix_len", "/%d", bits);
+		} else if (bits < 0) {
+			strcpy(b1, "0x");
+			for (j = 0; j < len && j < (SPRINT_BSIZE - 3) / 2; j++)
+				sprintf(b1 + 2 + 2 * j, "%02x", m[j]);
+			print_string(PRINT_ANY, "mask", "/%s", b1);
+		}
+		close_json_object();
+		i += 2 + len;
+	}
+	close_json_array(PRINT_JSON, NULL);
+	print_string(PRINT_FP, NULL, "%s", "\n");
+	close_json_object();
+}
+
+struct ta_run {
+	unsigned int	first;
+	unsigned int	count;
+};
+
+static int ta_run_cmp(const void *a, const void *b)
+{
+	const struct ta_run *ra = a, *rb = b;
+
+	if (ra->count != rb->count)
+		return ra->count > rb->count ? -1 : 1;
+	return ra->first < rb->first ? -1 : 1;
+}
+
+/* Prints the classifier instance at d->f[*i] and moves *i past it */
+static unsigned int ta_print_prio(const struct ta_dump *d, unsigned int *i)
+{
+	const struct ta_filter *first = &d->f[*i];
+	unsigned int end = *i, masks = 0, single = 0, j;
+	struct ta_run *runs;
+	SPRINT_BUF(b1);
+
+	while (end < d->n && d->f[end].chain == first->chain &&
+	       d->f[end].prio == first->prio &&
+	       d->f[end].proto == first->proto)
+		end++;
+	for (j = *i; j < end; j++)
+		if (first->flower && (j == *i || !ta_same_mask(&d->f[j - 1],
+							      &d->f[j]))) {
+			masks++;
+			if (j + 1 == end || !ta_same_mask(&d->f[j], &d->f[j + 1]))
+				single++;
+		}
+
+	open_json_object(NULL);
+	print_uint(PRINT_ANY, "pref", "  pref %u", first->prio);
+	print_string(PRINT_ANY, "protocol", " protocol %s",
+		     ll_proto_n2a(first->proto, b1, sizeof(b1)));
+	print_uint(PRINT_ANY, "filters", ": %u filters", end - *i);
+	if (first->flower) {
+		print_uint(PRINT_ANY, "masks", ", %u masks", masks);
+		print_uint(PRINT_ANY, "single_filter_masks",
+			   ", %u with a single filter", single);
+	} else {
+		print_bool(PRINT_ANY, "flower", ", not flower", false);
+	}
+	print_string(PRINT_FP, NULL, "%s", "\n");
+
+	/* the masks most filters share first */
+	runs = first->flower ? calloc(masks, sizeof(*runs)) : NULL;
+	if (runs) {
+		unsigned int r = 0;
+
+		for (j = *i; j < end; r++) {
+			runs[r].first = j;
+			while (++j < end && ta_same_mask(&d->f[j - 1], &d->f[j]))
+				;
+			runs[r].count = j - runs[r].first;
+		}
+		qsort(runs, masks, sizeof(*runs), ta_run_cmp);
+		open_json_array(PRINT_JSON, "masks_by_filters");
+		for (r = 0; r < masks; r++)
+			ta_print_mask(&d->f[runs[r].first], runs[r].count);
+		close_json_array(PRINT_JSON, NULL);
+		free(runs);
+	}
+	close_json_object();
+
+	*i = end;
+	return masks;
+}
+
+static void ta_print(const struct ta_dump *d)
+{
+	unsigned int i = 0;
+
+	open_json_array(PRINT_JSON, "chains");
+	while (i < d->n) {
+		__u32 chain = d->f[i].chain;
+		unsigned int end = i, prios = 0, masks = 0;
+
+		while (end < d->n && d->f[end].chain == chain)
+			end++;
+
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "chain", "chain %u:", chain);
+		print_uint(PRINT_ANY, "filters", " %u filters\n", end - i);
+		open_json_array(PRINT_JSON, "prios");
+		while (i < end) {
+			masks += ta_print_prio(d, &i);
+			prios++;
+		}
+		close_json_array(PRINT_JSON, NULL);
+		print_uint(PRINT_FP, NULL, "  %u priorities", prios);
+		print_uint(PRINT_ANY, "masks", ", %u flower masks in all\n",
+			   masks);
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+}
+
+int tc_filter_analyze(int argc, char **argv)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+		char		buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_GETTFILTER,
+		.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		.t.tcm_family = AF_UNSPEC,
+	};
+	struct ta_dump d = {};
+	const char *dev = NULL;
+	__u32 block = 0, chain;
+	bool chain_set = false;
+	unsigned int i;
+	int ret = -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (dev || block)
+				duparg("dev", *argv);
+			dev = *argv;
+		} else if (strcmp(*argv, "block") == 0) {
+			NEXT_ARG();
+			if (dev || block)
+				duparg("block", *argv);
+			if (get_u32(&block, *argv, 0) || !block)
+				invarg("invalid block index value", *argv);
+		} else if (strcmp(*argv, "root") == 0) {
+			req.t.tcm_parent = TC_H_ROOT;
+		} else if (strcmp(*argv, "ingress") == 0) {
+			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+						     TC_H_MIN_INGRESS);
+		} else if (strcmp(*argv, "egress") == 0) {
+			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+						     TC_H_MIN_EGRESS);
+		} else if (strcmp(*argv, "parent") == 0) {
+			NEXT_ARG();
+			if (get_tc_classid(&req.t.tcm_parent, *argv))
+				invarg("invalid parent ID", *argv);
+		} else if (strcmp(*argv, "chain") == 0) {
+			NEXT_ARG();
+			if (get_u32(&chain, *argv, 0))
+				invarg("invalid chain index value", *argv);
+			chain_set = true;
+		} else if (matches(*argv, "help") == 0) {
+			print_explain(stderr);
+			return -1;
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			print_explain(stderr);
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	if (dev) {
+		req.t.tcm_ifindex = ll_name_to_index(dev);
+		if (!req.t.tcm_ifindex)
+			return -nodev(dev);
+	} else if (block) {
+		req.t.tcm_ifindex = TCM_IFINDEX_MAGIC_BLOCK;
+		req.t.tcm_block_index = block;
+	} else {
+		fprintf(stderr, "\"dev\" or \"block\" is required\n");
+		return -1;
+	}
+	/* all the chains without one */
+	if (chain_set)
+		addattr32(&req.n, sizeof(req), TCA_CHAIN, chain);
+
+	if (rtnl_dump_request_n(&rth, &req.n) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, ta_nlmsg, &d) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	if (d.n)
+		qsort(d.f, d.n, sizeof(*d.f), ta_filter_cmp);
+	new_json_obj(json);
+	open_json_object(NULL);
+	ta_print(&d);
+	close_json_object();
+	delete_json_obj();
+	ret = 0;
+out:
+	for (i = 0; i < d.n; i++)
+		free(d.f[i].sig);
+	free(d.f);
+	return ret;
+}
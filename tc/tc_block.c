@@ -0,0 +1,357 @@
+/*
+ * tc_block.c		"tc qdisc setup-block", ports bound to one shared block.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The first port gets a clsact qdisc bound to the block, which creates
+ * it, and the filters of the file are added to the block, pipelined, as
+ * "tc filter add block BLOCK" lines. The other ports are bound after
+ * that, so none of them ever sees the block half loaded. With migrate,
+ * the ingress or clsact qdisc a port had, and its own filters, are
+ * deleted right before it is bound. What loading the filters took, in
+ * time and in kernel slab memory, is what each extra port would have
+ * cost with a copy of its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "utils.h"
+#include "tc_util.h"
+#include "tc_common.h"
+
+struct block_setup {
+	__u32		block;
+	bool		egress;
+	bool		migrate;
+	const char	**ports;
+	unsigned int	count;
+	const char	*file;
+	unsigned int	failed;
+	unsigned int	unbound;
+};
+
+static int block_usage(void)
+{
+	fprintf(stderr,
+		"Usage: tc qdisc setup-block BLOCK_INDEX [ ingress | egress ] [ migrate ]\n"
+		"                            dev STRING [ dev STRING ... ] [ filters FILE ]\n"
+		"FILE holds the arguments of \"tc filter add block BLOCK_INDEX\", one line per filter\n");
+	return -1;
+}
+
+/* even cookies delete the qdisc of a port, odd ones bind it */
+static void block_port_err(__u32 cookie, int error, void *arg)
+{
+	struct block_setup *b = arg;
+	const char *port = b->ports[cookie >> 1];
+
+	/* nothing to migrate from */
+	if (!(cookie & 1) && (error == -ENOENT || error == -EINVAL))
+		return;
+	if (cookie & 1)
+		fprintf(stderr, "Cannot bind %s to block %u: %s\n",
+			port, b->block, strerror(-error));
+	else
+		fprintf(stderr, "Cannot delete the qdisc of %s: %s\n",
+			port, strerror(-error));
+	b->failed++;
+	if (cookie & 1)
+		b->unbound++;
+}
+
+static int block_ports(struct block_setup *b, unsigned int from,
+		       unsigned int to)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+		char		buf[64];
+	} del = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_DELQDISC,
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.t.tcm_family = AF_UNSPEC,
+		.t.tcm_parent = TC_H_INGRESS,
+	}, add = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_NEWQDISC,
+		.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL,
+		.t.tcm_family = AF_UNSPEC,
+		.t.tcm_parent = TC_H_CLSACT,
+		.t.tcm_handle = TC_H_MAKE(TC_H_CLSACT, 0),
+	};
+	unsigned int failed = b->failed, i;
+	int flags = rth.flags;
+
+	addattr_l(&add.n, sizeof(add), TCA_KIND, "clsact", 7);
+	addattr32(&add.n, sizeof(add),
+		  b->egress ? TCA_EGRESS_BLOCK : TCA_INGRESS_BLOCK, b->block);
+
+	if (rtnl_async_begin(&rth, 0, block_port_err, b) == 0)
+		rth.flags |= RTNL_HANDLE_F_ASYNC | RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	for (i = from; i < to; i++) {
+		int ifindex = ll_name_to_index(b->ports[i]);
+
+		if (!ifindex) {
+			nodev(b->ports[i]);
+			b->failed++;
+			b->unbound++;
+			continue;
+		}
+		if (b->migrate) {
+			del.t.tcm_ifindex = ifindex;
+			rtnl_async_cookie(&rth, i << 1);
+			if (rtnl_talk(&rth, &del.n, NULL) < 0)
+				block_port_err(i << 1, -errno, b);
+		}
+		add.t.tcm_ifindex = ifindex;
+		rtnl_async_cookie(&rth, i << 1 | 1);
+		if (rtnl_talk(&rth, &add.n, NULL) < 0)
+			block_port_err(i << 1 | 1, -errno, b);
+	}
+
+	rtnl_async_end(&rth);
+	rth.flags = flags;
+	return b->failed == failed ? 0 : -1;
+}
+
+static void block_filter_err(__u32 cookie, int error, void *arg)
+{
+	struct block_setup *b = arg;
+
+	fprintf(stderr, "Command failed %s:%u\n", b->file, cookie);
+	b->failed++;
+}
+
+static int block_filters(struct block_setup *b)
+{
+	int lineno = cmdlineno, flags = rth.flags;
+	char *largv[100];
+	char *line = NULL;
+	char block[16];
+	size_t len = 0;
+	FILE *fp;
+
+	fp = fopen(b->file, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n",
+			b->file, strerror(errno));
+		return -1;
+	}
+
+	snprintf(block, sizeof(block), "%u", b->block);
+	largv[0] = "add";
+	largv[1] = "block";
+	largv[2] = block;
+
+	if (rtnl_async_begin(&rth, 0, block_filter_err, b) == 0)
+		rth.flags |= RTNL_HANDLE_F_ASYNC;
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		int largc = makeargs(line, largv + 3, ARRAY_SIZE(largv) - 3);
+
+		if (!largc)
+			continue;
+		rtnl_async_cookie(&rth, cmdlineno);
+		if (do_filter(largc + 3, largv)) {
+			fprintf(stderr, "Command failed %s:%d\n",
+				b->file, cmdlineno);
+			b->failed++;
+		}
+	}
+
+	rtnl_async_end(&rth);
+	rth.flags = flags;
+	cmdlineno = lineno;
+	free(line);
+	fclose(fp);
+	return 0;
+}
+
+static int block_count_filter(const struct sockaddr_nl *who,
+			      struct nlmsghdr *n, void *arg)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+
+	/* nor are priorities with no handle, or u32 hash tables, filters */
+	if (n->nlmsg_type != RTM_NEWTFILTER || len < 0 || !t->tcm_handle)
+		return 0;
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	if (tb[TCA_KIND] && strcmp(rta_getattr_str(tb[TCA_KIND]), "u32") == 0 &&
+	    !TC_U32_KEY(t->tcm_handle))
+		return 0;
+	(*(unsigned int *)arg)++;
+	return 0;
+}
+
+static int block_count(const struct block_setup *b, unsigned int *count)
+{
+	struct tcmsg t = {
+		.tcm_family = AF_UNSPEC,
+		.tcm_ifindex = TCM_IFINDEX_MAGIC_BLOCK,
+		.tcm_block_index = b->block,
+	};
+
+	*count = 0;
+	if (rtnl_dump_request(&rth, RTM_GETTFILTER, &t, sizeof(t)) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, block_count_filter, count) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* kB of kernel slab memory in use, or -1 if unknown */
+static long block_slab(void)
+{
+	char line[128];
+	long kb = -1;
+	FILE *fp;
+
+	fp = fopen("/proc/meminfo", "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "Slab: %ld kB", &kb) == 1)
+			break;
+	fclose(fp);
+	return kb;
+}
+
+static double block_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void block_report(const struct block_setup *b, unsigned int filters,
+			 double secs, long kb)
+{
+	unsigned int ports = b->count - b->unbound;
+	unsigned int extra = ports ? ports - 1 : 0;
+
+	open_json_object(NULL);
+	print_uint(PRINT_ANY, "block", "block %u:", b->block);
+	print_uint(PRINT_ANY, "ports", " %u ports,", ports);
+	print_uint(PRINT_ANY, "filters", " %u filters", filters);
+	print_float(PRINT_ANY, "install_seconds", " installed in %.3fs",
+		    secs);
+	if (kb >= 0)
+		print_lluint(PRINT_ANY, "slab_kb", ", %llu kB of slab",
+			     (unsigned long long)kb);
+	print_string(PRINT_FP, NULL, "%s", "\n");
+
+	open_json_object("saved");
+	print_float(PRINT_ANY, "seconds",
+		    "saved over a copy per port: %.3fs", secs * extra);
+	if (kb >= 0)
+		print_lluint(PRINT_ANY, "slab_kb", ", %llu kB of slab",
+			     (unsigned long long)kb * extra);
+	print_string(PRINT_FP, NULL, "%s", "\n");
+	close_json_object();
+	close_json_object();
+}
+
+int tc_qdisc_setup_block(int argc, char **argv)
+{
+	struct block_setup b = {};
+	unsigned int filters = 0;
+	double start, secs = 0;
+	long slab, kb = -1;
+	struct rtnl_async *async;
+	int ret = -1;
+
+	if (argc < 1 || matches(*argv, "help") == 0)
+		return block_usage();
+	if (get_u32(&b.block, *argv, 0) || !b.block)
+		invarg("invalid block index value", *argv);
+	NEXT_ARG_FWD();
+
+	b.ports = calloc(argc ? argc : 1, sizeof(*b.ports));
+	if (!b.ports)
+		return -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			b.ports[b.count++] = *argv;
+		} else if (strcmp(*argv, "ingress") == 0) {
+			b.egress = false;
+		} else if (strcmp(*argv, "egress") == 0) {
+			b.egress = true;
+		} else if (strcmp(*argv, "migrate") == 0) {
+			b.migrate = true;
+		} else if (strcmp(*argv, "filters") == 0) {
+			NEXT_ARG();
+			if (b.file)
+				duparg("filters", *argv);
+			b.file = *argv;
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			block_usage();
+			goto out;
+		}
+		argc--; argv++;
+	}
+	if (!b.count) {
+		fprintf(stderr, "At least one \"dev\" is required\n");
+		goto out;
+	}
+	if (tc_qdisc_block_exists(b.block)) {
+		fprintf(stderr, "Block %u is in use, its filters would be shared\n",
+			b.block);
+		goto out;
+	}
+
+	/* a batch this is part of has its own idea of lines */
+	async = rth.async;
+	if (async) {
+		rtnl_async_flush(&rth);
+		rth.async = NULL;
+	}
+
+	if (block_ports(&b, 0, 1) < 0)
+		goto restore;
+
+	if (b.file) {
+		slab = block_slab();
+		start = block_now();
+		block_filters(&b);
+		secs = block_now() - start;
+		if (slab >= 0) {
+			kb = block_slab() - slab;
+			if (kb < 0)
+				kb = 0;
+		}
+	}
+
+	block_ports(&b, 1, b.count);
+
+	if (b.file && !block_count(&b, &filters)) {
+		new_json_obj(json);
+		block_report(&b, filters, secs, kb);
+		delete_json_obj();
+	}
+	ret = b.failed ? 2 : 0;
+restore:
+	rth.async = async;
+out:
+	free(b.ports);
+	return ret;
+}
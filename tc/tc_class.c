@@ -21,23 +21,50 @@
 #include <math.h>
 
 #include "utils.h"
+#include "arena.h"
 #include "tc_util.h"
 #include "tc_common.h"
-#include "list.h"
 
+/*
+ * With "-g" the classes of a dump are kept in an arena and linked into
+ * a tree only once the dump is complete: a node's children are the
+ * classes naming its classid as their parent, in dump order, found
+ * through a hash of the parent IDs seen. The tree is then printed from
+ * an explicit stack, roots last dumped first.
+ */
 struct graph_node {
-	struct hlist_node hlist;
 	__u32 id;
 	__u32 parent_id;
 	struct graph_node *parent_node;
 	struct graph_node *right_node;
-	void *data;
+	struct graph_node *next;	/* next sibling */
+	struct graph_node *dump_next;	/* next dumped */
+	struct graph_node **children;
+	unsigned int group;
 	int data_len;
 	int nodes_count;
+	struct rtattr data[];
 };
 
-static struct hlist_head cls_list = {};
-static struct hlist_head root_cls_list = {};
+/* the classes with one parent ID, a run of graph.kids */
+struct graph_group {
+	__u32 id;
+	unsigned int next;	/* hash chain, index + 1 */
+	unsigned int off;
+	unsigned int count;
+	int claimed;
+};
+
+static __thread struct graph {
+	struct arena arena;
+	struct graph_node *first;
+	struct graph_node **last;
+	unsigned int count;
+	struct graph_node **kids;
+	struct graph_group *groups;
+	unsigned int *hash;
+	unsigned int hash_mask;
+} graph;
 
 static void usage(void);
 
@@ -48,6 +75,8 @@ static void usage(void)
 	fprintf(stderr, "       [ [ QDISC_KIND ] [ help | OPTIONS ] ]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "       tc class show [ dev STRING ] [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       tc class sample dev STRING [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       [ interval SECONDS ] [ count COUNT ] [ top N ]\n");
 	fprintf(stderr, "Where:\n");
 	fprintf(stderr, "QDISC_KIND := { prio | cbq | etc. }\n");
 	fprintf(stderr, "OPTIONS := ... try tc class add <desired QDISC_KIND> help\n");
@@ -140,8 +169,6 @@ static int tc_class_modify(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (d[0])  {
-		ll_init_map(&rth);
-
 		req.t.tcm_ifindex = ll_name_to_index(d);
 		if (!req.t.tcm_ifindex)
 			return -nodev(d);
@@ -157,24 +184,107 @@ int filter_ifindex;
 __u32 filter_qdisc;
 __u32 filter_classid;
 
-static void graph_node_add(__u32 parent_id, __u32 id, void *data,
+static int graph_node_add(__u32 parent_id, __u32 id, void *data,
 		int len)
 {
-	struct graph_node *node = calloc(1, sizeof(struct graph_node));
+	struct graph_node *node;
 
+	node = arena_alloc(&graph.arena, sizeof(*node) + len);
+	if (!node)
+		return -1;
+	memset(node, 0, sizeof(*node));
 	node->id         = id;
 	node->parent_id  = parent_id;
-
-	if (data && len) {
-		node->data       = malloc(len);
-		node->data_len   = len;
+	node->data_len   = len;
+	if (len > 0)
 		memcpy(node->data, data, len);
+
+	if (!graph.last)
+		graph.last = &graph.first;
+	*graph.last = node;
+	graph.last = &node->dump_next;
+	graph.count++;
+	return 0;
+}
+
+static __u32 graph_hash(__u32 id)
+{
+	return (id * 2654435761U) >> 8;
+}
+
+static struct graph_group *graph_group_find(__u32 id)
+{
+	unsigned int i;
+
+	for (i = graph.hash[graph_hash(id) & graph.hash_mask]; i;
+	     i = graph.groups[i - 1].next) {
+		if (graph.groups[i - 1].id == id)
+			return &graph.groups[i - 1];
 	}
+	return NULL;
+}
 
-	if (parent_id == TC_H_ROOT)
-		hlist_add_head(&node->hlist, &root_cls_list);
-	else
-		hlist_add_head(&node->hlist, &cls_list);
+/*
+ * Group the non-root classes by parent ID and lay the groups out in
+ * graph.kids, each in dump order. The @nroots roots are put at the end
+ * of graph.kids, last dumped first.
+ */
+static int graph_build(unsigned int *nroots)
+{
+	unsigned int ngroups = 0, off = 0, size = 1, root, i;
+	struct graph_node *node;
+
+	while (size < 2 * graph.count)
+		size *= 2;
+	graph.hash = arena_zalloc(&graph.arena, size * sizeof(*graph.hash));
+	graph.groups = arena_zalloc(&graph.arena,
+				    graph.count * sizeof(*graph.groups));
+	graph.kids = arena_alloc(&graph.arena,
+				 graph.count * sizeof(*graph.kids));
+	if (!graph.hash || !graph.groups || !graph.kids)
+		return -1;
+	graph.hash_mask = size - 1;
+
+	*nroots = 0;
+	for (node = graph.first; node; node = node->dump_next) {
+		struct graph_group *g;
+
+		if (node->parent_id == TC_H_ROOT) {
+			(*nroots)++;
+			continue;
+		}
+		g = graph_group_find(node->parent_id);
+		if (!g) {
+			unsigned int *head;
+
+			g = &graph.groups[ngroups++];
+			head = &graph.hash[graph_hash(node->parent_id) &
+					   graph.hash_mask];
+			g->id = node->parent_id;
+			g->next = *head;
+			*head = ngroups;
+		}
+		node->group = g - graph.groups;
+		g->count++;
+	}
+
+	for (i = 0; i < ngroups; i++) {
+		graph.groups[i].off = off;
+		off += graph.groups[i].count;
+		graph.groups[i].count = 0;
+	}
+	root = graph.count;
+	for (node = graph.first; node; node = node->dump_next) {
+		struct graph_group *g;
+
+		if (node->parent_id == TC_H_ROOT) {
+			graph.kids[--root] = node;
+			continue;
+		}
+		g = &graph.groups[node->group];
+		graph.kids[g->off + g->count++] = node;
+	}
+	return 0;
 }
 
 static void graph_indent(char *buf, struct graph_node *node, int is_newline,
@@ -187,7 +297,7 @@ static void graph_indent(char *buf, struct graph_node *node, int is_newline,
 		node = node->parent_node;
 	}
 	while (node && node->right_node) {
-		if (node->hlist.next)
+		if (node->next)
 			strcat(buf, "|    ");
 		else
 			strcat(buf, "     ");
@@ -196,13 +306,13 @@ static void graph_indent(char *buf, struct graph_node *node, int is_newline,
 	}
 
 	if (is_newline) {
-		if (node->hlist.next && node->nodes_count)
+		if (node->next && node->nodes_count)
 			strcat(buf, "|    |");
-		else if (node->hlist.next)
+		else if (node->next)
 			strcat(buf, "|     ");
 		else if (node->nodes_count)
 			strcat(buf, "     |");
-		else if (!node->hlist.next)
+		else if (!node->next)
 			strcat(buf, "      ");
 	}
 	if (add_spaces > 0) {
@@ -211,89 +321,153 @@ static void graph_indent(char *buf, struct graph_node *node, int is_newline,
 	}
 }
 
-static void graph_cls_show(FILE *fp, char *buf, struct hlist_head *root_list,
-		int level)
+/* Take the classes naming @cls as parent, unless a class of the same ID did */
+static void graph_claim(struct graph_node *cls)
+{
+	struct graph_group *g = graph_group_find(cls->id);
+	int i;
+
+	if (!g || g->claimed)
+		return;
+	g->claimed = 1;
+	cls->children = &graph.kids[g->off];
+	cls->nodes_count = g->count;
+	for (i = 0; i < cls->nodes_count; i++) {
+		cls->children[i]->parent_node = cls;
+		if (i + 1 < cls->nodes_count)
+			cls->children[i]->next = cls->children[i + 1];
+	}
+}
+
+static void graph_cls_print(FILE *fp, char *buf, struct graph_node *cls)
 {
-	struct hlist_node *n, *tmp_cls;
 	char cls_id_str[256] = {};
 	struct rtattr *tb[TCA_MAX + 1];
 	struct qdisc_util *q;
 	char str[300] = {};
 
-	hlist_for_each_safe(n, tmp_cls, root_list) {
-		struct hlist_node *c, *tmp_chld;
-		struct hlist_head children = {};
-		struct graph_node *cls = container_of(n, struct graph_node,
-				hlist);
-
-		hlist_for_each_safe(c, tmp_chld, &cls_list) {
-			struct graph_node *child = container_of(c,
-					struct graph_node, hlist);
-
-			if (cls->id == child->parent_id) {
-				hlist_del(c);
-				hlist_add_head(c, &children);
-				cls->nodes_count++;
-				child->parent_node = cls;
-			}
-		}
+	graph_indent(buf, cls, 0, 0);
 
-		graph_indent(buf, cls, 0, 0);
+	print_tc_classid(cls_id_str, sizeof(cls_id_str), cls->id);
+	snprintf(str, sizeof(str),
+		 "+---(%s)", cls_id_str);
+	strcat(buf, str);
 
-		print_tc_classid(cls_id_str, sizeof(cls_id_str), cls->id);
-		snprintf(str, sizeof(str),
-			 "+---(%s)", cls_id_str);
-		strcat(buf, str);
+	parse_rtattr(tb, TCA_MAX, cls->data, cls->data_len);
 
-		parse_rtattr(tb, TCA_MAX, (struct rtattr *)cls->data,
-				cls->data_len);
+	if (tb[TCA_KIND] == NULL) {
+		strcat(buf, " [unknown qdisc kind] ");
+	} else {
+		const char *kind = rta_getattr_str(tb[TCA_KIND]);
 
-		if (tb[TCA_KIND] == NULL) {
-			strcat(buf, " [unknown qdisc kind] ");
-		} else {
-			const char *kind = rta_getattr_str(tb[TCA_KIND]);
+		sprintf(str, " %s ", kind);
+		strcat(buf, str);
+		fprintf(fp, "%s", buf);
+		buf[0] = '\0';
+
+		q = get_qdisc_kind(kind);
+		if (q && q->print_copt) {
+			q->print_copt(q, fp, tb[TCA_OPTIONS]);
+		}
+		if (q && show_stats) {
+			int cls_indent = strlen(q->id) - 2 +
+				strlen(cls_id_str);
+			struct rtattr *stats = NULL;
 
-			sprintf(str, " %s ", kind);
-			strcat(buf, str);
-			fprintf(fp, "%s", buf);
-			buf[0] = '\0';
+			graph_indent(buf, cls, 1, cls_indent);
 
-			q = get_qdisc_kind(kind);
-			if (q && q->print_copt) {
-				q->print_copt(q, fp, tb[TCA_OPTIONS]);
+			if (tb[TCA_STATS] || tb[TCA_STATS2]) {
+				fprintf(fp, "\n");
+				print_tcstats_attr(fp, tb, buf, &stats);
+				buf[0] = '\0';
 			}
-			if (q && show_stats) {
-				int cls_indent = strlen(q->id) - 2 +
-					strlen(cls_id_str);
-				struct rtattr *stats = NULL;
-
-				graph_indent(buf, cls, 1, cls_indent);
-
-				if (tb[TCA_STATS] || tb[TCA_STATS2]) {
-					fprintf(fp, "\n");
-					print_tcstats_attr(fp, tb, buf, &stats);
-					buf[0] = '\0';
-				}
-				if (cls->hlist.next || cls->nodes_count) {
-					strcat(buf, "\n");
-					graph_indent(buf, cls, 1, 0);
-				}
+			if (cls->next || cls->nodes_count) {
+				strcat(buf, "\n");
+				graph_indent(buf, cls, 1, 0);
 			}
 		}
-		free(cls->data);
-		fprintf(fp, "%s\n", buf);
-		buf[0] = '\0';
+	}
+	fprintf(fp, "%s\n", buf);
+	buf[0] = '\0';
+}
 
-		graph_cls_show(fp, buf, &children, level + 1);
-		if (!cls->hlist.next) {
-			graph_indent(buf, cls, 0, 0);
-			strcat(buf, "\n");
+/* After the subtree of @cls */
+static void graph_cls_done(FILE *fp, char *buf, struct graph_node *cls)
+{
+	if (!cls->next) {
+		graph_indent(buf, cls, 0, 0);
+		strcat(buf, "\n");
+	}
+
+	fprintf(fp, "%s", buf);
+	buf[0] = '\0';
+}
+
+struct graph_frame {
+	struct graph_node **list;
+	int n;
+	int i;
+};
+
+static void graph_cls_show(FILE *fp, char *buf)
+{
+	struct graph_frame *stack = NULL, *f;
+	unsigned int nroots, depth = 0, size = 0, i;
+	struct graph_node **roots;
+
+	if (!graph.count)
+		goto out;
+	if (graph_build(&nroots) < 0)
+		goto oom;
+
+	roots = &graph.kids[graph.count - nroots];
+	for (i = 0; i + 1 < nroots; i++)
+		roots[i]->next = roots[i + 1];
+
+	if (nroots) {
+		stack = malloc(sizeof(*stack));
+		if (!stack)
+			goto oom;
+		stack[0] = (struct graph_frame) { roots, nroots, 0 };
+		depth = size = 1;
+	}
+	while (depth) {
+		struct graph_node *cls;
+
+		f = &stack[depth - 1];
+		if (f->i == f->n) {
+			if (--depth)
+				graph_cls_done(fp, buf,
+					       stack[depth - 1].list[stack[depth - 1].i - 1]);
+			continue;
 		}
 
-		fprintf(fp, "%s", buf);
-		buf[0] = '\0';
-		free(cls);
+		cls = f->list[f->i++];
+		graph_claim(cls);
+		graph_cls_print(fp, buf, cls);
+		if (!cls->nodes_count) {
+			graph_cls_done(fp, buf, cls);
+			continue;
+		}
+
+		if (depth == size) {
+			f = realloc(stack, 2 * size * sizeof(*stack));
+			if (!f)
+				goto oom;
+			stack = f;
+			size *= 2;
+		}
+		stack[depth++] = (struct graph_frame) {
+			cls->children, cls->nodes_count, 0
+		};
 	}
+	goto out;
+oom:
+	fprintf(stderr, "Cannot build class graph: out of memory\n");
+out:
+	free(stack);
+	arena_free(&graph.arena);
+	memset(&graph, 0, sizeof(graph));
 }
 
 int print_class(const struct sockaddr_nl *who,
@@ -317,7 +491,11 @@ int print_class(const struct sockaddr_nl *who,
 	}
 
 	if (show_graph) {
-		graph_node_add(t->tcm_parent, t->tcm_handle, TCA_RTA(t), len);
+		if (graph_node_add(t->tcm_parent, t->tcm_handle, TCA_RTA(t),
+				   len) < 0) {
+			fprintf(stderr, "Cannot build class graph: out of memory\n");
+			return -1;
+		}
 		return 0;
 	}
 
@@ -385,11 +563,38 @@ int print_class(const struct sockaddr_nl *who,
 }
 
 
+static int tc_class_dump(struct tcmsg *t)
+{
+	char buf[1024] = {0};
+
+	if (rtnl_dump_request(&rth, RTM_GETTCLASS, t, sizeof(*t)) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+
+	if (rtnl_dump_filter(&rth, print_class, stdout) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+
+	if (show_graph)
+		graph_cls_show(stdout, &buf[0]);
+
+	return 0;
+}
+
+static int tc_class_dump_dev(int ifindex, void *arg)
+{
+	struct tcmsg t = *(struct tcmsg *)arg;
+
+	t.tcm_ifindex = ifindex;
+	return tc_class_dump(&t);
+}
+
 static int tc_class_list(int argc, char **argv)
 {
 	struct tcmsg t = { .tcm_family = AF_UNSPEC };
 	char d[IFNAMSIZ] = {};
-	char buf[1024] = {0};
 
 	filter_qdisc = 0;
 	filter_classid = 0;
@@ -446,20 +651,11 @@ static int tc_class_list(int argc, char **argv)
 		filter_ifindex = t.tcm_ifindex;
 	}
 
-	if (rtnl_dump_request(&rth, RTM_GETTCLASS, &t, sizeof(t)) < 0) {
-		perror("Cannot send dump request");
-		return 1;
-	}
-
-	if (rtnl_dump_filter(&rth, print_class, stdout) < 0) {
-		fprintf(stderr, "Dump terminated\n");
-		return 1;
-	}
+	/* the kernel only dumps the classes of one device at a time */
+	if (!t.tcm_ifindex)
+		return tc_dump_devs(tc_class_dump_dev, &t) < 0 ? 1 : 0;
 
-	if (show_graph)
-		graph_cls_show(stdout, &buf[0], &root_cls_list, 0);
-
-	return 0;
+	return tc_class_dump(&t) < 0 ? 1 : 0;
 }
 
 int do_class(int argc, char **argv)
@@ -481,6 +677,8 @@ int do_class(int argc, char **argv)
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
 		return tc_class_list(argc-1, argv+1);
+	if (matches(*argv, "sample") == 0)
+		return tc_sample(RTM_GETTCLASS, argc-1, argv+1);
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
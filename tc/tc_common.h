@@ -5,14 +5,23 @@
 #define TCA_BUF_MAX	(64*1024)
 #define MSG_IOV_MAX	128
 
-extern struct rtnl_handle rth;
+extern __thread struct rtnl_handle rth;
 
 extern int do_qdisc(int argc, char **argv);
 extern int do_class(int argc, char **argv);
-extern int do_filter(int argc, char **argv, void *buf, size_t buflen);
-extern int do_action(int argc, char **argv, void *buf, size_t buflen);
+extern int do_filter(int argc, char **argv);
+extern int do_chain(int argc, char **argv);
+extern int do_action(int argc, char **argv);
 extern int do_tcmonitor(int argc, char **argv);
 extern int do_exec(int argc, char **argv);
+extern int tc_sample(int type, int argc, char **argv);
+extern int tc_filter_optimize(int argc, char **argv);
+extern int tc_filter_analyze(int argc, char **argv);
+extern int tc_qdisc_setup_mq(int argc, char **argv);
+extern int tc_qdisc_setup_block(int argc, char **argv);
+
+extern unsigned int tc_jobs;
+extern int tc_dump_devs(int (*dump)(int ifindex, void *arg), void *arg);
 
 extern int print_action(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg);
 extern int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg);
@@ -27,5 +36,7 @@ struct tc_sizespec;
 extern int parse_size_table(int *p_argc, char ***p_argv, struct tc_sizespec *s);
 extern int check_size_table_opts(struct tc_sizespec *s);
 
-extern int show_graph;
-extern bool use_names;
+extern struct nlmsg_refs *tc_qdisc_refs;
+
+extern __thread int show_graph;
+extern __thread bool use_names;
@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <math.h>
@@ -26,11 +27,20 @@
 
 static double tick_in_usec = 1;
 static double clock_factor = 1;
+static bool tc_core_loaded;
+
+/* /proc/net/psched is read on the first conversion that needs it */
+static void tc_core_load(void)
+{
+	if (!tc_core_loaded)
+		tc_core_init();
+}
 
 int tc_core_time2big(unsigned int time)
 {
 	__u64 t = time;
 
+	tc_core_load();
 	t *= tick_in_usec;
 	return (t >> 32) != 0;
 }
@@ -38,21 +48,25 @@ int tc_core_time2big(unsigned int time)
 
 unsigned int tc_core_time2tick(unsigned int time)
 {
+	tc_core_load();
 	return time*tick_in_usec;
 }
 
 unsigned int tc_core_tick2time(unsigned int tick)
 {
+	tc_core_load();
 	return tick/tick_in_usec;
 }
 
 unsigned int tc_core_time2ktime(unsigned int time)
 {
+	tc_core_load();
 	return time * clock_factor;
 }
 
 unsigned int tc_core_ktime2time(unsigned int ktime)
 {
+	tc_core_load();
 	return ktime / clock_factor;
 }
 
@@ -122,14 +136,34 @@ static unsigned int tc_adjust_size(unsigned int sz, unsigned int mpu, enum link_
    rtab[pkt_len>>cell_log] = pkt_xmit_time
  */
 
-int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
-		   int cell_log, unsigned int mtu,
-		   enum link_layer linklayer)
+/*
+ * Rate tables are cached, two to a set so that the last two asked for
+ * (rate and ceil, or rate and peakrate) are never evicted by each
+ * other: a batch of classes sharing a few rates computes each once.
+ * Batch workers each have a cache of their own.
+ */
+#define TC_RTAB_SETS	128
+
+struct tc_rtab {
+	__u32		rate;
+	unsigned int	mpu;
+	int		cell_log;
+	enum link_layer	linklayer;
+	unsigned int	used;		/* 0 for an empty slot */
+	__u32		rtab[256];
+};
+
+static __thread struct tc_rtab (*tc_rtabs)[2];
+static __thread unsigned int tc_rtabs_used;
+
+const __u32 *tc_rtable(struct tc_ratespec *r, int cell_log, unsigned int mtu,
+		       enum link_layer linklayer)
 {
-	int i;
-	unsigned int sz;
 	unsigned int bps = r->rate;
 	unsigned int mpu = r->mpu;
+	struct tc_rtab *set, *e;
+	unsigned int h;
+	int i;
 
 	if (mtu == 0)
 		mtu = 2047;
@@ -140,23 +174,68 @@ int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
 			cell_log++;
 	}
 
+	if (!tc_rtabs) {
+		tc_rtabs = calloc(TC_RTAB_SETS, sizeof(*tc_rtabs));
+		if (!tc_rtabs)
+			return NULL;
+	}
+
+	h = (bps * 2654435761U) ^ (mpu * 40503U) ^ (cell_log << 8) ^ linklayer;
+	set = tc_rtabs[(h ^ (h >> 16)) & (TC_RTAB_SETS - 1)];
+	for (i = 0; i < 2; i++) {
+		e = &set[i];
+		if (e->used && e->rate == bps && e->mpu == mpu &&
+		    e->cell_log == cell_log && e->linklayer == linklayer)
+			goto found;
+	}
+
+	e = set[0].used <= set[1].used ? &set[0] : &set[1];
+	e->rate = bps;
+	e->mpu = mpu;
+	e->cell_log = cell_log;
+	e->linklayer = linklayer;
 	for (i = 0; i < 256; i++) {
+		unsigned int sz;
+
 		sz = tc_adjust_size((i + 1) << cell_log, mpu, linklayer);
-		rtab[i] = tc_calc_xmittime(bps, sz);
+		e->rtab[i] = tc_calc_xmittime(bps, sz);
 	}
+found:
+	e->used = ++tc_rtabs_used;
 
 	r->cell_align =  -1;
 	r->cell_log = cell_log;
 	r->linklayer = (linklayer & TC_LINKLAYER_MASK);
-	return cell_log;
+	return e->rtab;
+}
+
+int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
+		   int cell_log, unsigned int mtu,
+		   enum link_layer linklayer)
+{
+	const __u32 *tab = tc_rtable(r, cell_log, mtu, linklayer);
+
+	if (!tab)
+		return -1;
+	memcpy(rtab, tab, 256 * sizeof(*rtab));
+	return r->cell_log;
 }
 
 /*
    stab[pkt_len>>cell_log] = pkt_xmit_size>>size_log
  */
 
+/* The last size table, and the sizespec it was asked for with */
+static __thread struct {
+	struct tc_sizespec	in;
+	struct tc_sizespec	out;
+	__u16			*data;
+	unsigned int		size;
+} tc_stab;
+
 int tc_calc_size_table(struct tc_sizespec *s, __u16 **stab)
 {
+	struct tc_sizespec in = *s;
 	int i;
 	enum link_layer linklayer = s->linklayer;
 	unsigned int sz;
@@ -171,6 +250,12 @@ int tc_calc_size_table(struct tc_sizespec *s, __u16 **stab)
 		return 0;
 	}
 
+	if (tc_stab.data && !memcmp(&tc_stab.in, &in, sizeof(in))) {
+		*s = tc_stab.out;
+		*stab = tc_stab.data;
+		return 0;
+	}
+
 	if (s->mtu == 0)
 		s->mtu = 2047;
 	if (s->tsize == 0)
@@ -180,9 +265,15 @@ int tc_calc_size_table(struct tc_sizespec *s, __u16 **stab)
 	while ((s->mtu >> s->cell_log) > s->tsize - 1)
 		s->cell_log++;
 
-	*stab = malloc(s->tsize * sizeof(__u16));
-	if (!*stab)
-		return -1;
+	if (s->tsize > tc_stab.size) {
+		__u16 *data = realloc(tc_stab.data, s->tsize * sizeof(__u16));
+
+		if (!data)
+			return -1;
+		tc_stab.data = data;
+		tc_stab.size = s->tsize;
+	}
+	*stab = tc_stab.data;
 
 again:
 	for (i = s->tsize - 1; i >= 0; i--) {
@@ -195,6 +286,8 @@ again:
 	}
 
 	s->cell_align = -1; /* Due to the sz calc */
+	tc_stab.in = in;
+	tc_stab.out = *s;
 	return 0;
 }
 
@@ -205,6 +298,7 @@ int tc_core_init(void)
 	__u32 t2us;
 	__u32 us2t;
 
+	tc_core_loaded = true;
 	fp = fopen("/proc/net/psched", "r");
 	if (fp == NULL)
 		return -1;
@@ -23,6 +23,10 @@ unsigned tc_calc_xmittime(__u64 rate, unsigned size);
 unsigned tc_calc_xmitsize(__u64 rate, unsigned ticks);
 int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
 		   int cell_log, unsigned mtu, enum link_layer link_layer);
+/* the table returned stays valid until two others have been asked for */
+const __u32 *tc_rtable(struct tc_ratespec *r, int cell_log, unsigned mtu,
+		       enum link_layer link_layer);
+/* *stab is not to be freed, it stays valid until the next call */
 int tc_calc_size_table(struct tc_sizespec *s, __u16 **stab);
 
 int tc_setup_estimator(unsigned A, unsigned time_const, struct tc_estimator *est);
@@ -18,6 +18,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
 #include <linux/if_ether.h>
 
 #include "rt_names.h"
@@ -32,6 +33,7 @@ static void usage(void)
 		"       tc filter [ add | del | change | replace | show ] [ block BLOCK_INDEX ]\n"
 		"       tc filter get dev STRING parent CLASSID protocol PROTO handle FILTERID pref PRIO FILTER_TYPE\n"
 		"       tc filter get block BLOCK_INDEX protocol PROTO handle FILTERID pref PRIO FILTER_TYPE\n"
+		"       tc filter get ... { handle FILTERID ... | handles FILE } ... FILTER_TYPE\n"
 		"       [ pref PRIO ] protocol PROTO [ chain CHAIN_INDEX ]\n"
 		"       [ estimator INTERVAL TIME_CONSTANT ]\n"
 		"       [ root | ingress | egress | parent CLASSID ]\n"
@@ -39,6 +41,16 @@ static void usage(void)
 		"\n"
 		"       tc filter show [ dev STRING ] [ root | ingress | egress | parent CLASSID ]\n"
 		"       tc filter show [ block BLOCK_INDEX ]\n"
+		"       [ pref PRIO ] [ protocol PROTO ] [ chain CHAIN_INDEX ] [ handle FILTERID ]\n"
+		"       tc filter optimize dev STRING [ root | ingress | egress | parent CLASSID ]\n"
+		"       [ chain CHAIN_INDEX ] [ interval SECONDS ] [ apply ]\n"
+		"       tc filter analyze [ dev STRING | block BLOCK_INDEX ]\n"
+		"       [ root | ingress | egress | parent CLASSID ] [ chain CHAIN_INDEX ]\n"
+		"\n"
+		"       tc chain [ add | del ] [ dev STRING | block BLOCK_INDEX ]\n"
+		"       [ root | ingress | egress | parent CLASSID ] chain CHAIN_INDEX\n"
+		"       [ [ template ] FILTER_TYPE [ OPTIONS ] ]\n"
+		"       tc chain show [ dev STRING | block BLOCK_INDEX ] [ chain CHAIN_INDEX ]\n"
 		"Where:\n"
 		"FILTER_TYPE := { rsvp | u32 | bpf | fw | route | etc. }\n"
 		"FILTERID := ... format depends on classifier, see there\n"
@@ -51,10 +63,10 @@ struct tc_filter_req {
 	char			buf[MAX_MSG];
 };
 
-static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv,
-			    void *buf, size_t buflen)
+static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
 {
-	struct tc_filter_req *req, filter_req;
+	struct tc_filter_req filter_req = {};
+	struct tc_filter_req *req = &filter_req;
 	struct filter_util *q = NULL;
 	struct tc_estimator est = {};
 	char k[FILTER_NAMESZ] = {};
@@ -69,23 +81,13 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv,
 	__u32 prio = 0;
 	int ret;
 
-	if (buf) {
-		req = buf;
-		if (buflen < sizeof (struct tc_filter_req)) {
-			fprintf(stderr, "buffer is too small: %zu\n", buflen);
-			return -1;
-		}
-	} else {
-		memset(&filter_req, 0, sizeof (struct tc_filter_req));
-		req = &filter_req;
-	}
-
 	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
 	req->n.nlmsg_flags = NLM_F_REQUEST | flags;
 	req->n.nlmsg_type = cmd;
 	req->t.tcm_family = AF_UNSPEC;
 
-	if (cmd == RTM_NEWTFILTER && flags & NLM_F_CREATE)
+	if ((cmd == RTM_NEWTFILTER || cmd == RTM_NEWCHAIN) &&
+	    flags & NLM_F_CREATE)
 		protocol = htons(ETH_P_ALL);
 
 	while (argc > 0) {
@@ -172,6 +174,9 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv,
 		} else if (matches(*argv, "estimator") == 0) {
 			if (parse_estimator(&argc, &argv, &est) < 0)
 				return -1;
+		} else if (cmd == RTM_NEWCHAIN &&
+			   strcmp(*argv, "template") == 0) {
+			/* what follows is the template anyway */
 		} else if (matches(*argv, "help") == 0) {
 			usage();
 			return 0;
@@ -188,6 +193,11 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv,
 
 	req->t.tcm_info = TC_H_MAKE(prio<<16, protocol);
 
+	if ((cmd == RTM_NEWCHAIN || cmd == RTM_DELCHAIN) && !chain_index_set) {
+		fprintf(stderr, "\"chain\" is required\n");
+		return -1;
+	}
+
 	if (chain_index_set)
 		addattr32(&req->n, sizeof(*req), TCA_CHAIN, chain_index);
 
@@ -195,8 +205,6 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv,
 		addattr_l(&req->n, sizeof(*req), TCA_KIND, k, strlen(k)+1);
 
 	if (d[0])  {
-		ll_init_map(&rth);
-
 		req->t.tcm_ifindex = ll_name_to_index(d);
 		if (!req->t.tcm_ifindex)
 			return -nodev(d);
@@ -205,8 +213,14 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv,
 		req->t.tcm_block_index = block_index;
 	}
 
+	if (est.ewma_log)
+		addattr_l(&req->n, sizeof(*req), TCA_RATE, &est, sizeof(est));
+
 	if (q) {
-		if (q->parse_fopt(q, fhandle, argc, argv, &req->n))
+		ret = q->parse_fopt(q, fhandle, argc, argv, &req->n);
+		if (ret == TC_FOPT_SENT)
+			return 0;
+		if (ret)
 			return 1;
 	} else {
 		if (fhandle) {
@@ -224,12 +238,6 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv,
 		}
 	}
 
-	if (est.ewma_log)
-		addattr_l(&req->n, sizeof(*req), TCA_RATE, &est, sizeof(est));
-
-	if (buf)
-		return 0;
-
 	iov.iov_base = &req->n;
 	iov.iov_len = req->n.nlmsg_len;
 	ret = rtnl_talk_iov(&rth, &iov, 1, NULL);
@@ -241,14 +249,91 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv,
 	return 0;
 }
 
-static __u32 filter_parent;
-static int filter_ifindex;
-static __u32 filter_prio;
-static __u32 filter_protocol;
-static __u32 filter_chain_index;
-static int filter_chain_index_set;
-static __u32 filter_block_index;
-__u16 f_proto;
+static __thread __u32 filter_parent;
+static __thread int filter_ifindex;
+static __thread __u32 filter_prio;
+static __thread __u32 filter_protocol;
+static __thread __u32 filter_chain_index;
+static __thread int filter_chain_index_set;
+static __thread __u32 filter_block_index;
+static __thread char *filter_handle;
+__thread __u16 f_proto;
+
+#define FILTER_HANDLE_KINDS	8
+
+/* The handle shown, as read by each kind of filter the dump has */
+static __thread struct {
+	struct filter_util	*q;
+	__u32			handle;
+	int			ok;
+} filter_handles[FILTER_HANDLE_KINDS];
+static __thread unsigned int filter_handles_count;
+
+static int filter_handle_match(struct filter_util *q, const struct tcmsg *t)
+{
+	struct tc_filter_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.t = *t,
+	};
+	unsigned int i;
+	int ok;
+
+	for (i = 0; i < filter_handles_count; i++)
+		if (filter_handles[i].q == q)
+			return filter_handles[i].ok &&
+			       filter_handles[i].handle == t->tcm_handle;
+
+	req.t.tcm_handle = 0;
+	ok = q && q->parse_fopt(q, filter_handle, 0, NULL, &req.n) == 0;
+	if (filter_handles_count < FILTER_HANDLE_KINDS) {
+		filter_handles[i].q = q;
+		filter_handles[i].handle = req.t.tcm_handle;
+		filter_handles[i].ok = ok;
+		filter_handles_count++;
+	}
+	return ok && req.t.tcm_handle == t->tcm_handle;
+}
+
+/*
+ * The counters of a filter in brief: those of its first action, which
+ * sees every packet the filter matched. Of the options only the one
+ * with the actions is looked for, nothing else of them is decoded.
+ */
+static void print_filter_hits(const struct filter_util *q, struct rtattr *tb[])
+{
+	struct rtattr *act = NULL, *atb[TCA_ACT_MAX + 1];
+	struct rtattr *stb[TCA_STATS_MAX + 1];
+	struct gnet_stats_basic bs = {};
+	struct rtattr *rta;
+	int len;
+
+	if (!q || !q->act_attr || !tb[TCA_OPTIONS])
+		return;
+
+	len = RTA_PAYLOAD(tb[TCA_OPTIONS]);
+	for (rta = RTA_DATA(tb[TCA_OPTIONS]); RTA_OK(rta, len);
+	     rta = RTA_NEXT(rta, len)) {
+		if ((rta->rta_type & ~NLA_F_NESTED) == q->act_attr) {
+			act = rta;
+			break;
+		}
+	}
+	if (!act || RTA_PAYLOAD(act) < sizeof(struct rtattr))
+		return;
+
+	/* the actions are nested by their order, the first one first */
+	parse_rtattr_nested(atb, TCA_ACT_MAX, (struct rtattr *)RTA_DATA(act));
+	if (!atb[TCA_ACT_STATS])
+		return;
+	parse_rtattr_nested(stb, TCA_STATS_MAX, atb[TCA_ACT_STATS]);
+	if (!stb[TCA_STATS_BASIC])
+		return;
+
+	memcpy(&bs, RTA_DATA(stb[TCA_STATS_BASIC]),
+	       MIN(RTA_PAYLOAD(stb[TCA_STATS_BASIC]), sizeof(bs)));
+	print_uint(PRINT_ANY, "packets", "hits %u ", bs.packets);
+	print_lluint(PRINT_ANY, "bytes", "bytes %llu ", bs.bytes);
+}
 
 int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
@@ -256,12 +341,21 @@ int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	struct tcmsg *t = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 	struct rtattr *tb[TCA_MAX+1];
-	struct filter_util *q;
+	struct filter_util *q = NULL;
+	bool chain = false;
 	char abuf[256];
 
-	if (n->nlmsg_type != RTM_NEWTFILTER &&
-	    n->nlmsg_type != RTM_GETTFILTER &&
-	    n->nlmsg_type != RTM_DELTFILTER) {
+	switch (n->nlmsg_type) {
+	case RTM_NEWCHAIN:
+	case RTM_DELCHAIN:
+	case RTM_GETCHAIN:
+		chain = true;
+		/* fall through */
+	case RTM_NEWTFILTER:
+	case RTM_GETTFILTER:
+	case RTM_DELTFILTER:
+		break;
+	default:
 		fprintf(stderr, "Not a filter(cmd %d)\n", n->nlmsg_type);
 		return 0;
 	}
@@ -273,14 +367,27 @@ int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 
 	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
 
-	if (tb[TCA_KIND] == NULL) {
+	/* a chain without a template has no kind */
+	if (tb[TCA_KIND] == NULL && !chain) {
 		fprintf(stderr, "print_filter: NULL kind\n");
 		return -1;
 	}
 
+	/* nor is it asked for by index in a dump */
+	if (chain && filter_chain_index_set &&
+	    (!tb[TCA_CHAIN] ||
+	     rta_getattr_u32(tb[TCA_CHAIN]) != filter_chain_index))
+		return 0;
+
+	if (tb[TCA_KIND])
+		q = get_filter_kind(RTA_DATA(tb[TCA_KIND]));
+	/* the kernel has no way of being asked for one handle in a dump */
+	if (filter_handle && !filter_handle_match(q, t))
+		return 0;
+
 	open_json_object(NULL);
 
-	if (n->nlmsg_type == RTM_DELTFILTER)
+	if (n->nlmsg_type == RTM_DELTFILTER || n->nlmsg_type == RTM_DELCHAIN)
 		print_bool(PRINT_ANY, "deleted", "deleted ", true);
 
 	if (n->nlmsg_type == RTM_NEWTFILTER &&
@@ -293,7 +400,7 @@ int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 			(n->nlmsg_flags & NLM_F_EXCL))
 		print_bool(PRINT_ANY, "added", "added ", true);
 
-	print_string(PRINT_FP, NULL, "filter ", NULL);
+	print_string(PRINT_FP, NULL, chain ? "chain " : "filter ", NULL);
 	if (t->tcm_ifindex == TCM_IFINDEX_MAGIC_BLOCK) {
 		if (!filter_block_index ||
 		    filter_block_index != t->tcm_block_index)
@@ -317,6 +424,16 @@ int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		}
 	}
 
+	if (chain) {
+		if (tb[TCA_CHAIN])
+			print_uint(PRINT_ANY, "chain", "chain %u ",
+				   rta_getattr_u32(tb[TCA_CHAIN]));
+		if (tb[TCA_KIND])
+			print_string(PRINT_ANY, "template", "template %s ",
+				     rta_getattr_str(tb[TCA_KIND]));
+		goto options;
+	}
+
 	if (t->tcm_info) {
 		f_proto = TC_H_MIN(t->tcm_info);
 		__u32 prio = TC_H_MAJ(t->tcm_info)>>16;
@@ -345,7 +462,19 @@ int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 				   chain_index);
 	}
 
-	q = get_filter_kind(RTA_DATA(tb[TCA_KIND]));
+	/* neither the options nor the actions, but for the counters */
+	if (brief) {
+		if (t->tcm_handle)
+			print_uint(PRINT_ANY, "handle", "handle 0x%x ",
+				   t->tcm_handle);
+		if (show_stats)
+			print_filter_hits(q, tb);
+		print_string(PRINT_FP, NULL, "\n", NULL);
+		close_json_object();
+		return 0;
+	}
+
+options:
 	if (tb[TCA_OPTIONS]) {
 		open_json_object("options");
 		if (q)
@@ -367,13 +496,183 @@ int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+#define FILTER_GET_HASH		1024
+
+struct filter_get_bulk {
+	const char	*file;
+	char		**handles;	/* without a file */
+	__u32		*seen;		/* the handles asked for so far */
+	unsigned int	*next;		/* hash chains, index + 1 */
+	size_t		seen_size;
+	size_t		next_size;
+	unsigned int	nseen;
+	unsigned int	hash[FILTER_GET_HASH];
+	int		failed;
+};
+
+/* Make room for len bytes in a buffer that doubles as it fills */
+static int filter_get_grow(void *bufp, size_t *size, size_t len)
+{
+	void **buf = bufp;
+	size_t new = *size ? *size : 4096;
+	void *p;
+
+	if (len <= *size)
+		return 0;
+	while (new < len)
+		new *= 2;
+	p = realloc(*buf, new);
+	if (!p)
+		return -1;
+	*buf = p;
+	*size = new;
+	return 0;
+}
+
+/* Whether handle was asked for already, remembering it if not */
+static int filter_get_seen(struct filter_get_bulk *b, __u32 handle)
+{
+	unsigned int h = (handle * 2654435761U) % FILTER_GET_HASH, i;
+
+	for (i = b->hash[h]; i; i = b->next[i - 1])
+		if (b->seen[i - 1] == handle)
+			return 1;
+
+	if (filter_get_grow(&b->seen, &b->seen_size,
+			    (b->nseen + 1) * sizeof(*b->seen)) < 0 ||
+	    filter_get_grow(&b->next, &b->next_size,
+			    (b->nseen + 1) * sizeof(*b->next)) < 0)
+		return 0;
+	b->seen[b->nseen] = handle;
+	b->next[b->nseen] = b->hash[h];
+	b->hash[h] = ++b->nseen;
+	return 0;
+}
+
+static void filter_get_err(__u32 cookie, int error, void *arg)
+{
+	struct filter_get_bulk *b = arg;
+
+	if (b->file)
+		fprintf(stderr, "Cannot get filter %s:%u\n", b->file, cookie);
+	else
+		fprintf(stderr, "Cannot get filter \"%s\"\n",
+			b->handles[cookie]);
+	b->failed++;
+}
+
+static void filter_get_reply(__u32 cookie, struct nlmsghdr *n, void *arg)
+{
+	print_filter(NULL, n, stdout);
+}
+
+static int filter_get_one(struct filter_get_bulk *b, struct filter_util *q,
+			  const struct tc_filter_req *req, char *handle,
+			  __u32 cookie)
+{
+	struct tc_filter_req get;
+
+	memcpy(&get, req, req->n.nlmsg_len);
+	if (q->parse_fopt(q, handle, 0, NULL, &get.n))
+		return -1;
+	if (filter_get_seen(b, get.t.tcm_handle))
+		return 0;
+
+	rtnl_async_cookie(&rth, cookie);
+	if (rtnl_talk(&rth, &get.n, NULL) < 0)
+		filter_get_err(cookie, -errno, b);
+	return 0;
+}
+
+/*
+ * Get the filters of many handles, those of the command line or one per
+ * line of file, pipelined and printed in the order they were asked for.
+ * A handle that is given twice is only asked for once.
+ */
+static int filter_get_bulk(struct filter_util *q,
+			   const struct tc_filter_req *req, char **handles,
+			   unsigned int nhandles, const char *file)
+{
+	struct rtnl_async *async = rth.async;
+	int flags = rth.flags, lineno = cmdlineno, ret;
+	struct filter_get_bulk *b;
+	char *line = NULL;
+	FILE *fp = NULL;
+	size_t len = 0;
+	unsigned int i;
+
+	if (file) {
+		fp = fopen(file, "r");
+		if (!fp) {
+			fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+				file, strerror(errno));
+			return -1;
+		}
+	}
+	b = calloc(1, sizeof(*b));
+	if (!b) {
+		if (fp)
+			fclose(fp);
+		return -1;
+	}
+	b->file = file;
+	b->handles = handles;
+
+	/* a batch this is part of has its own idea of lines */
+	if (async) {
+		rtnl_async_flush(&rth);
+		rth.async = NULL;
+	}
+	if (rtnl_async_begin(&rth, 0, filter_get_err, b) == 0) {
+		rtnl_async_replies(&rth, filter_get_reply);
+		rth.flags |= RTNL_HANDLE_F_ASYNC;
+	}
+
+	ret = new_json_obj(json);
+	if (ret == 0 && fp) {
+		cmdlineno = 0;
+		while (getcmdline(&line, &len, fp) != -1) {
+			char *largv[2];
+
+			if (makeargs(line, largv, 2) == 0)
+				continue;
+			if (filter_get_one(b, q, req, largv[0], cmdlineno) < 0) {
+				fprintf(stderr, "Illegal handle %s:%d\n", file,
+					cmdlineno);
+				ret = -1;
+				break;
+			}
+		}
+	} else if (ret == 0) {
+		for (i = 0; i < nhandles; i++) {
+			if (filter_get_one(b, q, req, handles[i], i) < 0) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+	if (ret < 0)
+		rtnl_async_discard(&rth);
+	rtnl_async_end(&rth);
+	delete_json_obj();
+	if (ret == 0 && b->failed)
+		ret = 2;
+
+	rth.async = async;
+	rth.flags = flags;
+	cmdlineno = lineno;
+	if (fp)
+		fclose(fp);
+	free(line);
+	free(b->seen);
+	free(b->next);
+	free(b);
+	return ret;
+}
+
 static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 {
-	struct {
-		struct nlmsghdr	n;
-		struct tcmsg		t;
-		char			buf[MAX_MSG];
-	} req = {
+	struct tc_filter_req req = {
 		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
 		/* NLM_F_ECHO is for backward compatibility. old kernels never
 		 * respond without it and newer kernels will ignore it.
@@ -396,6 +695,9 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 	__u32 block_index = 0;
 	__u32 parent_handle = 0;
 	char *fhandle = NULL;
+	char **fhandles = argv;
+	unsigned int nhandles = 0;
+	char *hfile = NULL;
 	char  d[IFNAMSIZ] = {};
 	char  k[FILTER_NAMESZ] = {};
 
@@ -452,9 +754,15 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 			req.t.tcm_parent = parent_handle;
 		} else if (strcmp(*argv, "handle") == 0) {
 			NEXT_ARG();
-			if (fhandle)
+			if (hfile)
 				return duparg("handle", *argv);
-			fhandle = *argv;
+			/* gathered over the words already parsed */
+			fhandle = fhandles[nhandles++] = *argv;
+		} else if (strcmp(*argv, "handles") == 0) {
+			NEXT_ARG();
+			if (hfile || fhandle)
+				return duparg("handles", *argv);
+			fhandle = hfile = *argv;
 		} else if (matches(*argv, "preference") == 0 ||
 			   matches(*argv, "priority") == 0) {
 			NEXT_ARG();
@@ -524,8 +832,6 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (d[0])  {
-		ll_init_map(&rth);
-
 		req.t.tcm_ifindex = ll_name_to_index(d);
 		if (!req.t.tcm_ifindex)
 			return -nodev(d);
@@ -539,6 +845,14 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 		return -1;
 	}
 
+	if (hfile || nhandles > 1) {
+		if (argc) {
+			fprintf(stderr, "Options cannot be given to get several filters\n");
+			return -1;
+		}
+		return filter_get_bulk(q, &req, fhandles, nhandles, hfile);
+	}
+
 	if (q->parse_fopt(q, fhandle, argc, argv, &req.n))
 		return 1;
 
@@ -570,7 +884,7 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 	return 0;
 }
 
-static int tc_filter_list(int argc, char **argv)
+static int tc_filter_list(int cmd, int argc, char **argv)
 {
 	struct {
 		struct nlmsghdr n;
@@ -578,7 +892,7 @@ static int tc_filter_list(int argc, char **argv)
 		char buf[MAX_MSG];
 	} req = {
 		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
-		.n.nlmsg_type = RTM_GETTFILTER,
+		.n.nlmsg_type = cmd,
 		.t.tcm_parent = TC_H_UNSPEC,
 		.t.tcm_family = AF_UNSPEC,
 	};
@@ -687,6 +1001,8 @@ static int tc_filter_list(int argc, char **argv)
 	}
 
 	req.t.tcm_info = TC_H_MAKE(prio<<16, protocol);
+	filter_handle = fhandle;
+	filter_handles_count = 0;
 
 	ll_init_map(&rth);
 
@@ -705,7 +1021,7 @@ static int tc_filter_list(int argc, char **argv)
 		filter_block_index = block_index;
 	}
 
-	if (filter_chain_index_set)
+	if (filter_chain_index_set && cmd == RTM_GETTFILTER)
 		addattr32(&req.n, sizeof(req), TCA_CHAIN, chain_index);
 
 	if (rtnl_dump_request_n(&rth, &req.n) < 0) {
@@ -724,27 +1040,29 @@ static int tc_filter_list(int argc, char **argv)
 	return 0;
 }
 
-int do_filter(int argc, char **argv, void *buf, size_t buflen)
+int do_filter(int argc, char **argv)
 {
 	if (argc < 1)
-		return tc_filter_list(0, NULL);
+		return tc_filter_list(RTM_GETTFILTER, 0, NULL);
 	if (matches(*argv, "add") == 0)
 		return tc_filter_modify(RTM_NEWTFILTER, NLM_F_EXCL|NLM_F_CREATE,
-					argc-1, argv+1, buf, buflen);
+					argc-1, argv+1);
 	if (matches(*argv, "change") == 0)
-		return tc_filter_modify(RTM_NEWTFILTER, 0, argc-1, argv+1,
-					buf, buflen);
+		return tc_filter_modify(RTM_NEWTFILTER, 0, argc-1, argv+1);
 	if (matches(*argv, "replace") == 0)
 		return tc_filter_modify(RTM_NEWTFILTER, NLM_F_CREATE, argc-1,
-					argv+1, buf, buflen);
+					argv+1);
 	if (matches(*argv, "delete") == 0)
-		return tc_filter_modify(RTM_DELTFILTER, 0, argc-1, argv+1,
-					buf, buflen);
+		return tc_filter_modify(RTM_DELTFILTER, 0, argc-1, argv+1);
 	if (matches(*argv, "get") == 0)
 		return tc_filter_get(RTM_GETTFILTER, 0,  argc-1, argv+1);
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
-		return tc_filter_list(argc-1, argv+1);
+		return tc_filter_list(RTM_GETTFILTER, argc-1, argv+1);
+	if (strcmp(*argv, "optimize") == 0)
+		return tc_filter_optimize(argc-1, argv+1);
+	if (strcmp(*argv, "analyze") == 0)
+		return tc_filter_analyze(argc-1, argv+1);
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
@@ -753,3 +1071,24 @@ int do_filter(int argc, char **argv, void *buf, size_t buflen)
 		*argv);
 	return -1;
 }
+
+int do_chain(int argc, char **argv)
+{
+	if (argc < 1)
+		return tc_filter_list(RTM_GETCHAIN, 0, NULL);
+	if (matches(*argv, "add") == 0)
+		return tc_filter_modify(RTM_NEWCHAIN, NLM_F_EXCL|NLM_F_CREATE,
+					argc-1, argv+1);
+	if (matches(*argv, "delete") == 0)
+		return tc_filter_modify(RTM_DELCHAIN, 0, argc-1, argv+1);
+	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
+	    || matches(*argv, "lst") == 0)
+		return tc_filter_list(RTM_GETCHAIN, argc-1, argv+1);
+	if (matches(*argv, "help") == 0) {
+		usage();
+		return 0;
+	}
+	fprintf(stderr, "Command \"%s\" is unknown, try \"tc chain help\".\n",
+		*argv);
+	return -1;
+}
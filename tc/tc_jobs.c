@@ -0,0 +1,89 @@
+/*
+ * tc_jobs.c		Per-device dumps split across parallel children.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The links are taken in ifindex order and cut in up to tc_jobs ranges
+ * of about the same number of links, each dumped by a child of
+ * jobs_run() with a netlink socket of its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+#include "ll_map.h"
+#include "jobs.h"
+#include "tc_common.h"
+
+unsigned int tc_jobs = 1;
+
+struct dev_jobs {
+	const unsigned int	*ifindex;
+	int			(*dump)(int ifindex, void *arg);
+	void			*arg;
+};
+
+static int dev_range(const unsigned int *ifindex, unsigned int count,
+		     int (*dump)(int ifindex, void *arg), void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		if (dump(ifindex[i], arg) < 0)
+			return 1;
+	return 0;
+}
+
+static int dev_job_setup(unsigned int first, void *arg)
+{
+	if (rtnl_reopen(&rth) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int dev_job_run(unsigned int first, unsigned int count, void *arg)
+{
+	struct dev_jobs *d = arg;
+
+	return dev_range(d->ifindex + first, count, d->dump, d->arg);
+}
+
+static const struct jobs_ops dev_jobs_ops = {
+	.setup	= dev_job_setup,
+	.run	= dev_job_run,
+};
+
+/*
+ * Call dump() for every link in ifindex order, with tc_jobs children
+ * sharing the links between them when that is more than one. dump()
+ * prints what it gets and returns < 0 to stop its range.
+ */
+int tc_dump_devs(int (*dump)(int ifindex, void *arg), void *arg)
+{
+	struct dev_jobs d = { .dump = dump, .arg = arg };
+	unsigned int count;
+	unsigned int *ifindex;
+	int ret;
+
+	ll_init_map(&rth);
+	ifindex = ll_index_list(&count);
+	if (!ifindex)
+		return -1;
+
+	/* children can neither share a JSON array nor take part in a batch */
+	if (tc_jobs <= 1 || count <= 1 || (json && !ndjson) || batch_mode) {
+		ret = dev_range(ifindex, count, dump, arg);
+	} else {
+		d.ifindex = ifindex;
+		ret = jobs_run(count, 0, tc_jobs, &dev_jobs_ops, &d, 0);
+	}
+
+	free(ifindex);
+	return ret ? -1 : 0;
+}
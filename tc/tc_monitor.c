@@ -18,6 +18,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <inttypes.h>
+#include <errno.h>
 #include <time.h>
 #include "rt_names.h"
 #include "utils.h"
@@ -27,10 +29,299 @@
 
 static int usage(void)
 {
-	fprintf(stderr, "Usage: tc [-timestamp [-tshort] monitor\n");
+	fprintf(stderr,
+		"Usage: tc [-timestamp [-tshort] monitor [ file FILE ]\n"
+		"       [ dev STRING ] [ kind NAME ] [ chain CHAIN ]\n"
+		"       [ summary [ interval SECONDS ] ] [ lag SECONDS ]\n");
 	iprt_exit(-1);
 }
 
+/*
+ * Events are selected on their header and a scan for their kind and
+ * chain, before anything else is parsed. Action events belong to no
+ * device or chain, so only the kind can select them.
+ */
+static struct {
+	int		ifindex;
+	const char	*kind;
+	__u32		chain;
+	bool		want_chain;
+} mon_filter;
+
+static bool tcmsg_match(struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	bool kind_ok = !mon_filter.kind, chain_ok = !mon_filter.want_chain;
+	__u32 chain = 0;
+	struct rtattr *rta;
+
+	if (len < 0)
+		return true;	/* for print_*() to complain about */
+	if (mon_filter.ifindex && t->tcm_ifindex != mon_filter.ifindex)
+		return false;
+	if (kind_ok && chain_ok)
+		return true;
+	if (mon_filter.want_chain && n->nlmsg_type != RTM_NEWTFILTER &&
+	    n->nlmsg_type != RTM_DELTFILTER && n->nlmsg_type != RTM_NEWCHAIN &&
+	    n->nlmsg_type != RTM_DELCHAIN)
+		return false;
+
+	for (rta = TCA_RTA(t); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == TCA_KIND && !kind_ok)
+			kind_ok = !strcmp(rta_getattr_str(rta), mon_filter.kind);
+		else if (rta->rta_type == TCA_CHAIN &&
+			 RTA_PAYLOAD(rta) >= sizeof(__u32))
+			chain = rta_getattr_u32(rta);
+	}
+	if (!chain_ok)
+		chain_ok = chain == mon_filter.chain;
+	return kind_ok && chain_ok;
+}
+
+static bool tcamsg_match(struct nlmsghdr *n)
+{
+	struct tcamsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *rta, *act;
+
+	if (mon_filter.ifindex || mon_filter.want_chain)
+		return false;
+	if (!mon_filter.kind || len < 0)
+		return true;
+
+	for (rta = TA_RTA(t); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		int rem = RTA_PAYLOAD(rta);
+
+		if (rta->rta_type != TCA_ACT_TAB)
+			continue;
+		for (act = RTA_DATA(rta); RTA_OK(act, rem);
+		     act = RTA_NEXT(act, rem)) {
+			struct rtattr *tb[TCA_ACT_MAX + 1];
+
+			parse_rtattr_nested(tb, TCA_ACT_MAX, act);
+			if (tb[TCA_ACT_KIND] &&
+			    !strcmp(rta_getattr_str(tb[TCA_ACT_KIND]),
+				    mon_filter.kind))
+				return true;
+		}
+	}
+	return false;
+}
+
+static bool tcmon_match(struct nlmsghdr *n)
+{
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+	case RTM_DELQDISC:
+	case RTM_NEWTCLASS:
+	case RTM_DELTCLASS:
+	case RTM_NEWTFILTER:
+	case RTM_DELTFILTER:
+	case RTM_NEWCHAIN:
+	case RTM_DELCHAIN:
+		return tcmsg_match(n);
+	case RTM_GETACTION:
+	case RTM_NEWACTION:
+	case RTM_DELACTION:
+		return tcamsg_match(n);
+	}
+	/* nothing else can be told to match */
+	return !mon_filter.ifindex && !mon_filter.kind &&
+	       !mon_filter.want_chain;
+}
+
+/*
+ * "summary" counts the events of each type per device, and prints
+ * and clears the counters every interval instead of the events.
+ */
+enum {
+	TCMON_QDISC,
+	TCMON_CLASS,
+	TCMON_FILTER,
+	TCMON_ACTION,
+	TCMON_OBJECTS
+};
+
+static const char *tcmon_names[TCMON_OBJECTS] = {
+	"qdisc", "class", "filter", "action",
+};
+
+struct tcmon_counts {
+	__u64		add[TCMON_OBJECTS];
+	__u64		del[TCMON_OBJECTS];
+};
+
+struct tcmon_summary {
+	struct tcmon_counts	total;
+	struct tcmon_counts	*links;	/* by ifindex */
+	unsigned int		size;
+	unsigned int		overflows;
+	double			interval;
+	struct timespec		last;
+	struct timespec		next;
+};
+
+static int tcmon_count(struct tcmon_summary *ts, struct nlmsghdr *n)
+{
+	struct tcmon_counts *l = NULL;
+	int obj, del = 0, ifindex = 0;
+
+	switch (n->nlmsg_type) {
+	case RTM_DELQDISC:
+		del = 1;
+		/* fall through */
+	case RTM_NEWQDISC:
+		obj = TCMON_QDISC;
+		break;
+	case RTM_DELTCLASS:
+		del = 1;
+		/* fall through */
+	case RTM_NEWTCLASS:
+		obj = TCMON_CLASS;
+		break;
+	case RTM_DELTFILTER:
+		del = 1;
+		/* fall through */
+	case RTM_NEWTFILTER:
+		obj = TCMON_FILTER;
+		break;
+	case RTM_DELACTION:
+		del = 1;
+		/* fall through */
+	case RTM_NEWACTION:
+		obj = TCMON_ACTION;
+		break;
+	default:
+		return 0;
+	}
+
+	if (obj != TCMON_ACTION &&
+	    n->nlmsg_len >= NLMSG_LENGTH(sizeof(struct tcmsg)))
+		ifindex = ((struct tcmsg *)NLMSG_DATA(n))->tcm_ifindex;
+
+	if (ifindex > 0) {
+		if (ifindex >= ts->size) {
+			unsigned int size = ts->size ? ts->size : 1024;
+			struct tcmon_counts *links;
+
+			while (size <= ifindex)
+				size *= 2;
+			links = realloc(ts->links, size * sizeof(*links));
+			if (!links) {
+				perror("Cannot count tc events");
+				return -1;
+			}
+			memset(links + ts->size, 0,
+			       (size - ts->size) * sizeof(*links));
+			ts->links = links;
+			ts->size = size;
+		}
+		l = &ts->links[ifindex];
+	}
+
+	if (del) {
+		ts->total.del[obj]++;
+		if (l)
+			l->del[obj]++;
+	} else {
+		ts->total.add[obj]++;
+		if (l)
+			l->add[obj]++;
+	}
+	return 0;
+}
+
+static void tcmon_print_counts(const struct tcmon_counts *c)
+{
+	int i;
+
+	for (i = 0; i < TCMON_OBJECTS; i++) {
+		if (!c->add[i] && !c->del[i])
+			continue;
+		open_json_object(tcmon_names[i]);
+		print_string(PRINT_FP, NULL, " %s", tcmon_names[i]);
+		print_u64(PRINT_ANY, "add", " add %" PRIu64, c->add[i]);
+		print_u64(PRINT_ANY, "del", " del %" PRIu64, c->del[i]);
+		close_json_object();
+	}
+}
+
+static void tcmon_print(struct tcmon_summary *ts, double elapsed)
+{
+	unsigned int i;
+
+	open_json_object(NULL);
+	if (timestamp && !is_json_context())
+		print_timestamp(stdout);
+	print_float(PRINT_ANY, "interval", "tc summary %.2fs:", elapsed);
+	tcmon_print_counts(&ts->total);
+	print_uint(PRINT_ANY, "overflows", " overflows %u\n", ts->overflows);
+
+	open_json_array(PRINT_JSON, "links");
+	for (i = 0; i < ts->size; i++) {
+		const struct tcmon_counts *l = &ts->links[i];
+		int j;
+
+		for (j = 0; j < TCMON_OBJECTS; j++)
+			if (l->add[j] || l->del[j])
+				break;
+		if (j == TCMON_OBJECTS)
+			continue;
+		open_json_object(NULL);
+		print_uint(PRINT_JSON, "ifindex", NULL, i);
+		print_string(PRINT_ANY, "ifname", "  %s:", ll_index_to_name(i));
+		tcmon_print_counts(l);
+		print_string(PRINT_FP, NULL, "%s", "\n");
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+	if (!is_json_context())
+		printf("\n");
+	fflush(stdout);
+
+	memset(&ts->total, 0, sizeof(ts->total));
+	if (ts->links)
+		memset(ts->links, 0, ts->size * sizeof(*ts->links));
+	ts->overflows = 0;
+}
+
+static int tcmon_tick(struct rtnl_handle *rth, void *arg)
+{
+	struct tcmon_summary *ts = arg;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_diff(&now, &ts->next) < 0)
+		return 0;
+
+	tcmon_print(ts, timespec_diff(&now, &ts->last));
+	ts->last = now;
+	/* a summary that ran late doesn't make the next ones come sooner */
+	while (timespec_diff(&now, &ts->next) >= 0)
+		timespec_add(&ts->next, ts->interval);
+	return 0;
+}
+
+static int tcmon_overflow(struct rtnl_handle *rth, void *arg)
+{
+	struct tcmon_summary *ts = arg;
+
+	ts->overflows++;
+	return 0;
+}
+
+static int accept_summary(const struct sockaddr_nl *who,
+			  struct rtnl_ctrl_data *ctrl,
+			  struct nlmsghdr *n, void *arg)
+{
+	if (n->nlmsg_type == RTM_NEWLINK || n->nlmsg_type == RTM_DELLINK)
+		return ll_remember_index(who, n, NULL);
+	if (!tcmon_match(n))
+		return 0;
+	return tcmon_count(arg, n);
+}
 
 static int accept_tcmsg(const struct sockaddr_nl *who,
 			struct rtnl_ctrl_data *ctrl,
@@ -38,15 +329,21 @@ static int accept_tcmsg(const struct sockaddr_nl *who,
 {
 	FILE *fp = (FILE *)arg;
 
-	if (timestamp)
+	if (!tcmon_match(n))
+		return 0;
+
+	if (timestamp && !is_json_context())
 		print_timestamp(fp);
 
-	if (n->nlmsg_type == RTM_NEWTFILTER || n->nlmsg_type == RTM_DELTFILTER) {
+	if (n->nlmsg_type == RTM_NEWTFILTER || n->nlmsg_type == RTM_DELTFILTER ||
+	    n->nlmsg_type == RTM_NEWCHAIN || n->nlmsg_type == RTM_DELCHAIN) {
 		print_filter(who, n, arg);
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWTCLASS || n->nlmsg_type == RTM_DELTCLASS) {
-		print_class(who, n, arg);
+		/* classes have no JSON output yet */
+		if (!is_json_context())
+			print_class(who, n, arg);
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWQDISC || n->nlmsg_type == RTM_DELQDISC) {
@@ -59,7 +356,7 @@ static int accept_tcmsg(const struct sockaddr_nl *who,
 		return 0;
 	}
 	if (n->nlmsg_type != NLMSG_ERROR && n->nlmsg_type != NLMSG_NOOP &&
-	    n->nlmsg_type != NLMSG_DONE) {
+	    n->nlmsg_type != NLMSG_DONE && !is_json_context()) {
 		fprintf(fp, "Unknown message: length %08d type %08x flags %08x\n",
 			n->nlmsg_len, n->nlmsg_type, n->nlmsg_flags);
 	}
@@ -68,14 +365,45 @@ static int accept_tcmsg(const struct sockaddr_nl *who,
 
 int do_tcmonitor(int argc, char **argv)
 {
+	struct tcmon_summary ts = { .interval = 1 };
 	struct rtnl_handle rth;
-	char *file = NULL;
+	char *file = NULL, *dev = NULL;
 	unsigned int groups = nl_mgrp(RTNLGRP_TC);
+	int summary = 0;
+	double lag = 0;
+	int ret;
 
 	while (argc > 0) {
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (dev)
+				return duparg("dev", *argv);
+			dev = *argv;
+		} else if (strcmp(*argv, "kind") == 0) {
+			NEXT_ARG();
+			if (mon_filter.kind)
+				return duparg("kind", *argv);
+			mon_filter.kind = *argv;
+		} else if (strcmp(*argv, "chain") == 0) {
+			NEXT_ARG();
+			if (mon_filter.want_chain)
+				return duparg("chain", *argv);
+			if (get_u32(&mon_filter.chain, *argv, 0))
+				return invarg("invalid chain index value", *argv);
+			mon_filter.want_chain = true;
+		} else if (strcmp(*argv, "summary") == 0) {
+			summary = 1;
+		} else if (summary && matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&ts.interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (strcmp(*argv, "lag") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&lag, *argv))
+				return invarg("invalid lag interval", *argv);
 		} else {
 			if (matches(*argv, "help") == 0) {
 				return usage();
@@ -87,26 +415,87 @@ int do_tcmonitor(int argc, char **argv)
 		argc--;	argv++;
 	}
 
+	/* Events never end, so don't wrap them in an array */
+	if (json)
+		ndjson = 1;
+	new_json_obj(json);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts.last);
+
 	if (file) {
-		FILE *fp = fopen(file, "r");
-		int ret;
+		FILE *fp;
 
+		if (lag) {
+			fprintf(stderr, "\"lag\" only applies to live events.\n");
+			iprt_exit(-1);
+		}
+		fp = fopen(file, "r");
 		if (fp == NULL) {
 			perror("Cannot fopen");
 			iprt_exit(-1);
 		}
+		if (dev) {
+			mon_filter.ifindex = ll_name_to_index(dev);
+			if (!mon_filter.ifindex)
+				iprt_exit(-nodev(dev));
+		}
+
+		/* a saved stream is summed up as one interval */
+		if (summary) {
+			struct timespec now;
 
-		ret = rtnl_from_file(fp, accept_tcmsg, stdout);
+			ret = rtnl_from_file(fp, accept_summary, &ts);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (ret == 0)
+				tcmon_print(&ts, timespec_diff(&now, &ts.last));
+		} else {
+			ret = rtnl_from_file(fp, accept_tcmsg, stdout);
+		}
 		fclose(fp);
+		delete_json_obj();
+		free(ts.links);
 		return ret;
 	}
 
+	/* links only to keep device names current */
+	if (summary)
+		groups |= nl_mgrp(RTNLGRP_LINK);
+
 	if (rtnl_open(&rth, groups) < 0)
 		iprt_exit(1);
 
 	ll_init_map(&rth);
+	if (dev) {
+		mon_filter.ifindex = ll_name_to_index(dev);
+		if (!mon_filter.ifindex)
+			iprt_exit(-nodev(dev));
+	}
+	if (lag && rtnl_lag_enable(&rth, lag * 1000, stdout, json) < 0)
+		iprt_exit(1);
+
+	if (summary) {
+		struct timeval tv;
+		double wake;
+
+		ts.next = ts.last;
+		timespec_add(&ts.next, ts.interval);
 
-	if (rtnl_listen(&rth, accept_tcmsg, (void *)stdout) < 0) {
+		/* wake up often enough to be on time when nothing happens */
+		wake = ts.interval < 0.1 ? ts.interval : 0.1;
+		tv.tv_sec = 0;
+		tv.tv_usec = wake * 1000000;
+		if (setsockopt(rth.fd, SOL_SOCKET, SO_RCVTIMEO,
+			       &tv, sizeof(tv)) < 0) {
+			perror("SO_RCVTIMEO");
+			iprt_exit(1);
+		}
+		rth.tick = tcmon_tick;
+		rth.resync = tcmon_overflow;
+		ret = rtnl_listen(&rth, accept_summary, &ts);
+	} else {
+		ret = rtnl_listen(&rth, accept_tcmsg, (void *)stdout);
+	}
+	if (ret < 0) {
 		rtnl_close(&rth);
 		iprt_exit(2);
 	}
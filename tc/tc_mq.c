@@ -0,0 +1,277 @@
+/*
+ * tc_mq.c		"tc qdisc setup-mq", mq and a child on every TX queue.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The devices and their TX queue counts come from one link request, or
+ * one dump for a group. The options of the child are parsed once into a
+ * request that only has its device and parent patched for each queue,
+ * and the mq qdiscs and all their children are sent pipelined, each mq
+ * ahead of its own children.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "rt_names.h"
+#include "tc_util.h"
+#include "tc_common.h"
+
+struct mq_dev {
+	int		ifindex;
+	unsigned int	txqs;
+	char		name[IFNAMSIZ];
+};
+
+struct mq_setup {
+	struct mq_dev	*devs;
+	unsigned int	count;
+	int		group;
+	unsigned int	failed;
+};
+
+static int mq_usage(void)
+{
+	fprintf(stderr,
+		"Usage: tc qdisc setup-mq { dev STRING | group GROUP } [ handle QHANDLE ]\n"
+		"                         [ replace ] child QDISC_KIND [ OPTIONS ]\n");
+	return -1;
+}
+
+static int mq_add_dev(struct mq_setup *s, struct nlmsghdr *n)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct mq_dev *d;
+
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	if (!tb[IFLA_IFNAME])
+		return 0;
+	if (s->group >= 0 &&
+	    (!tb[IFLA_GROUP] || rta_getattr_u32(tb[IFLA_GROUP]) != s->group))
+		return 0;
+
+	d = realloc(s->devs, (s->count + 1) * sizeof(*d));
+	if (!d)
+		return -1;
+	s->devs = d;
+	d = &s->devs[s->count++];
+	d->ifindex = ifi->ifi_index;
+	d->txqs = tb[IFLA_NUM_TX_QUEUES] ?
+		  rta_getattr_u32(tb[IFLA_NUM_TX_QUEUES]) : 1;
+	strncpy(d->name, rta_getattr_str(tb[IFLA_IFNAME]), IFNAMSIZ - 1);
+	d->name[IFNAMSIZ - 1] = '\0';
+	return 0;
+}
+
+static int mq_dump_dev(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		       void *arg)
+{
+	return mq_add_dev(arg, n);
+}
+
+static int mq_find_devs(struct mq_setup *s, const char *dev)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	ifi;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETLINK,
+		.ifi.ifi_family = AF_UNSPEC,
+	};
+	struct nlmsghdr *answer;
+	int ret;
+
+	if (!dev) {
+		if (rtnl_wilddump_request(&rth, AF_UNSPEC, RTM_GETLINK) < 0) {
+			perror("Cannot send dump request");
+			return -1;
+		}
+		if (rtnl_dump_filter(&rth, mq_dump_dev, s) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			return -1;
+		}
+		if (!s->count) {
+			fprintf(stderr, "No device in group %d\n", s->group);
+			return -1;
+		}
+		return 0;
+	}
+
+	req.ifi.ifi_index = ll_name_to_index(dev);
+	if (!req.ifi.ifi_index)
+		return -nodev(dev);
+	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK, RTEXT_FILTER_SKIP_STATS);
+	if (rtnl_talk(&rth, &req.n, &answer) < 0)
+		return -1;
+	ret = mq_add_dev(s, answer);
+	free(answer);
+	return ret;
+}
+
+static void mq_setup_err(__u32 cookie, int error, void *arg)
+{
+	struct mq_setup *s = arg;
+	const struct mq_dev *d = &s->devs[cookie >> 16];
+
+	if (cookie & 0xffff)
+		fprintf(stderr, "Cannot set up queue %u of %s\n",
+			cookie & 0xffff, d->name);
+	else
+		fprintf(stderr, "Cannot set up mq on %s\n", d->name);
+	s->failed++;
+}
+
+static void mq_setup_send(struct mq_setup *s, struct nlmsghdr *mq,
+			  struct nlmsghdr *child, __u32 handle)
+{
+	struct rtnl_async *async = rth.async;
+	struct tcmsg *mt = NLMSG_DATA(mq), *ct = NLMSG_DATA(child);
+	int flags = rth.flags;
+	unsigned int i, q;
+
+	/* a batch this is part of has its own idea of lines */
+	if (async) {
+		rtnl_async_flush(&rth);
+		rth.async = NULL;
+	}
+	if (rtnl_async_begin(&rth, 0, mq_setup_err, s) == 0)
+		rth.flags |= RTNL_HANDLE_F_ASYNC;
+
+	for (i = 0; i < s->count; i++) {
+		const struct mq_dev *d = &s->devs[i];
+
+		mt->tcm_ifindex = ct->tcm_ifindex = d->ifindex;
+		rtnl_async_cookie(&rth, i << 16);
+		if (rtnl_talk(&rth, mq, NULL) < 0)
+			mq_setup_err(i << 16, -errno, s);
+		for (q = 1; q <= d->txqs; q++) {
+			ct->tcm_parent = TC_H_MAKE(handle, q);
+			rtnl_async_cookie(&rth, i << 16 | q);
+			if (rtnl_talk(&rth, child, NULL) < 0)
+				mq_setup_err(i << 16 | q, -errno, s);
+		}
+	}
+
+	rtnl_async_end(&rth);
+	rth.async = async;
+	rth.flags = flags;
+}
+
+int tc_qdisc_setup_mq(int argc, char **argv)
+{
+	struct mq_setup s = { .group = -1 };
+	unsigned int flags = NLM_F_CREATE | NLM_F_EXCL;
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+		char		buf[TCA_BUF_MAX];
+	} mq = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_NEWQDISC,
+		.t.tcm_family = AF_UNSPEC,
+		.t.tcm_parent = TC_H_ROOT,
+	}, child;
+	struct qdisc_util *q = NULL;
+	const char *dev = NULL;
+	__u32 handle = 0;
+	unsigned int i;
+	int ret = -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (dev)
+				duparg("dev", *argv);
+			dev = *argv;
+		} else if (strcmp(*argv, "group") == 0) {
+			NEXT_ARG();
+			if (s.group >= 0)
+				duparg("group", *argv);
+			if (rtnl_group_a2n(&s.group, *argv))
+				invarg("Invalid \"group\" value\n", *argv);
+		} else if (strcmp(*argv, "handle") == 0) {
+			NEXT_ARG();
+			if (handle)
+				duparg("handle", *argv);
+			if (get_qdisc_handle(&handle, *argv))
+				invarg("invalid qdisc ID", *argv);
+		} else if (strcmp(*argv, "replace") == 0) {
+			flags = NLM_F_CREATE | NLM_F_REPLACE;
+		} else if (strcmp(*argv, "child") == 0) {
+			NEXT_ARG();
+			q = get_qdisc_kind(*argv);
+			if (!q)
+				return -1;
+			argc--; argv++;
+			break;
+		} else if (matches(*argv, "help") == 0) {
+			return mq_usage();
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			return mq_usage();
+		}
+		argc--; argv++;
+	}
+
+	if (!dev == (s.group < 0)) {
+		fprintf(stderr, "Either \"dev\" or \"group\" is required\n");
+		return -1;
+	}
+	if (!q) {
+		fprintf(stderr, "\"child\" is required\n");
+		return -1;
+	}
+	if (!handle)
+		handle = 1 << 16;
+
+	if (mq_find_devs(&s, dev) < 0)
+		goto out;
+
+	mq.n.nlmsg_flags = NLM_F_REQUEST | flags;
+	mq.t.tcm_handle = handle;
+	addattr_l(&mq.n, sizeof(mq), TCA_KIND, "mq", 3);
+
+	child = mq;
+	child.t.tcm_handle = 0;
+	child.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	addattr_l(&child.n, sizeof(child), TCA_KIND, q->id, strlen(q->id) + 1);
+	if (q->parse_qopt) {
+		if (q->parse_qopt(q, argc, argv, &child.n, s.devs[0].name))
+			goto out;
+	} else if (argc) {
+		fprintf(stderr, "qdisc '%s' does not support option parsing\n",
+			q->id);
+		goto out;
+	}
+
+	/* mq itself refuses a single queue, better said once per device */
+	for (i = 0; i < s.count; ) {
+		if (s.devs[i].txqs > 1) {
+			i++;
+			continue;
+		}
+		fprintf(stderr, "%s has a single TX queue, skipped\n",
+			s.devs[i].name);
+		s.failed++;
+		s.devs[i] = s.devs[--s.count];
+	}
+
+	mq_setup_send(&s, &mq.n, &child.n, handle);
+	ret = s.failed ? 2 : 0;
+out:
+	free(s.devs);
+	return ret;
+}
@@ -0,0 +1,731 @@
+/*
+ * tc_optimize.c	"tc filter optimize", hot priorities first.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * The filters of a chain are dumped twice, an interval apart, and the
+ * packets the first action of each filter saw in between (for u32 the
+ * hits the kernel counts itself, when it does) are its hits. The unit
+ * that is moved is a priority, that is a classifier instance with all
+ * its filters, as within one the kernel does not go in order anyway.
+ *
+ * Two priorities may only swap when no packet can match both. That is
+ * known for flower filters when both match a key on bits they both care
+ * about and the values differ there, and for u32 filters the same way
+ * with keys at the same fixed offset. Filters of different protocols
+ * never overlap, anything else is taken to overlap everything. Among
+ * the priorities that nothing still to be placed must precede, the one
+ * with the most hits goes next.
+ *
+ * With "apply" copies of the filters are added in the new order at
+ * priorities above all those in use, then the old priorities are deleted
+ * from the last one to the first. Every packet is classified as before
+ * at every step of that: the old filters left are always the first
+ * ones of the old order, and ahead of them all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/if_ether.h>
+
+#include "utils.h"
+#include "tc_util.h"
+#include "tc_common.h"
+
+struct to_filter {
+	struct nlmsghdr		*n;	/* as dumped */
+	__u32			prio;
+	__u32			handle;
+	__u16			proto;
+	const char		*kind;
+	struct rtattr		*opts;
+	bool			table;	/* an u32 hash table */
+	__u64			hits;
+};
+
+struct to_prio {
+	__u32			prio;
+	__u16			proto;
+	const char		*kind;
+	unsigned int		first;
+	unsigned int		count;
+	unsigned int		tables;
+	__u64			hits;
+	bool			pinned;	/* overlaps anything, cannot move */
+	unsigned int		deps;	/* earlier overlapping ones unplaced */
+	unsigned int		pos;	/* in the new order */
+};
+
+struct to_dump {
+	struct to_filter	*f;
+	unsigned int		n;
+	unsigned int		size;
+};
+
+static void print_explain(FILE *f)
+{
+	fprintf(f,
+		"Usage: tc filter optimize dev STRING [ root | ingress | egress | parent CLASSID ]\n"
+		"       [ chain CHAIN_INDEX ] [ interval SECONDS ] [ apply ]\n");
+}
+
+static __u64 to_first_action_packets(struct rtattr *act)
+{
+	struct rtattr *prios[TCA_ACT_MAX_PRIO + 1];
+	int i;
+
+	if (!act)
+		return 0;
+	parse_rtattr_nested(prios, TCA_ACT_MAX_PRIO, act);
+	for (i = 0; i <= TCA_ACT_MAX_PRIO; i++) {
+		struct rtattr *tb[TCA_ACT_MAX + 1], *st[TCA_STATS_MAX + 1];
+		struct gnet_stats_basic bs = {};
+		int len;
+
+		if (!prios[i])
+			continue;
+		parse_rtattr_nested(tb, TCA_ACT_MAX, prios[i]);
+		if (!tb[TCA_ACT_STATS])
+			return 0;
+		parse_rtattr_nested(st, TCA_STATS_MAX, tb[TCA_ACT_STATS]);
+		if (!st[TCA_STATS_BASIC])
+			return 0;
+		len = RTA_PAYLOAD(st[TCA_STATS_BASIC]);
+		memcpy(&bs, RTA_DATA(st[TCA_STATS_BASIC]),
+		       len < sizeof(bs) ? len : sizeof(bs));
+		return bs.packets;
+	}
+	return 0;
+}
+
+static __u64 to_hits(const struct to_filter *f)
+{
+	if (strcmp(f->kind, "flower") == 0) {
+		struct rtattr *tb[TCA_FLOWER_MAX + 1];
+
+		parse_rtattr_nested(tb, TCA_FLOWER_MAX, f->opts);
+		return to_first_action_packets(tb[TCA_FLOWER_ACT]);
+	}
+	if (strcmp(f->kind, "u32") == 0) {
+		struct rtattr *tb[TCA_U32_MAX + 1];
+
+		parse_rtattr_nested(tb, TCA_U32_MAX, f->opts);
+		if (tb[TCA_U32_PCNT] &&
+		    RTA_PAYLOAD(tb[TCA_U32_PCNT]) >= sizeof(struct tc_u32_pcnt)) {
+			struct tc_u32_pcnt *pc = RTA_DATA(tb[TCA_U32_PCNT]);
+
+			return pc->rhit;
+		}
+		return to_first_action_packets(tb[TCA_U32_ACT]);
+	}
+	return 0;
+}
+
+static int to_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		    void *arg)
+{
+	struct to_dump *d = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *tb[TCA_MAX + 1];
+	struct to_filter *f;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+
+	if (n->nlmsg_type != RTM_NEWTFILTER || len < 0)
+		return 0;
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	/* a classifier without filters comes without options */
+	if (!tb[TCA_KIND] || !tb[TCA_OPTIONS])
+		return 0;
+
+	if (d->n == d->size) {
+		unsigned int size = d->size ? 2 * d->size : 256;
+		struct to_filter *nf = realloc(d->f, size * sizeof(*nf));
+
+		if (!nf)
+			return -1;
+		d->f = nf;
+		d->size = size;
+	}
+	f = &d->f[d->n];
+	memset(f, 0, sizeof(*f));
+	f->n = malloc(n->nlmsg_len);
+	if (!f->n)
+		return -1;
+	memcpy(f->n, n, n->nlmsg_len);
+	d->n++;
+
+	t = NLMSG_DATA(f->n);
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	f->prio = TC_H_MAJ(t->tcm_info) >> 16;
+	f->proto = TC_H_MIN(t->tcm_info);
+	f->handle = t->tcm_handle;
+	f->kind = RTA_DATA(tb[TCA_KIND]);
+	f->opts = tb[TCA_OPTIONS];
+	if (strcmp(f->kind, "u32") == 0 && !TC_U32_KEY(f->handle))
+		f->table = true;
+	f->hits = to_hits(f);
+	return 0;
+}
+
+static void to_dump_free(struct to_dump *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->n; i++)
+		free(d->f[i].n);
+	free(d->f);
+	memset(d, 0, sizeof(*d));
+}
+
+static int to_dump(struct nlmsghdr *req, struct to_dump *d)
+{
+	if (rtnl_dump_request_n(&rth, req) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, to_nlmsg, d) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int to_filter_cmp(const void *a, const void *b)
+{
+	const struct to_filter *fa = a, *fb = b;
+
+	if (fa->prio != fb->prio)
+		return fa->prio < fb->prio ? -1 : 1;
+	if (fa->handle != fb->handle)
+		return fa->handle < fb->handle ? -1 : 1;
+	return 0;
+}
+
+/* flower keys and the masks that go with them, 0 for an exact match */
+static const struct {
+	int	key;
+	int	mask;
+} to_flower_keys[] = {
+	{ TCA_FLOWER_KEY_ETH_DST, TCA_FLOWER_KEY_ETH_DST_MASK },
+	{ TCA_FLOWER_KEY_ETH_SRC, TCA_FLOWER_KEY_ETH_SRC_MASK },
+	{ TCA_FLOWER_KEY_ETH_TYPE, 0 },
+	{ TCA_FLOWER_KEY_IP_PROTO, 0 },
+	{ TCA_FLOWER_KEY_IPV4_SRC, TCA_FLOWER_KEY_IPV4_SRC_MASK },
+	{ TCA_FLOWER_KEY_IPV4_DST, TCA_FLOWER_KEY_IPV4_DST_MASK },
+	{ TCA_FLOWER_KEY_IPV6_SRC, TCA_FLOWER_KEY_IPV6_SRC_MASK },
+	{ TCA_FLOWER_KEY_IPV6_DST, TCA_FLOWER_KEY_IPV6_DST_MASK },
+	{ TCA_FLOWER_KEY_TCP_SRC, TCA_FLOWER_KEY_TCP_SRC_MASK },
+	{ TCA_FLOWER_KEY_TCP_DST, TCA_FLOWER_KEY_TCP_DST_MASK },
+	{ TCA_FLOWER_KEY_UDP_SRC, TCA_FLOWER_KEY_UDP_SRC_MASK },
+	{ TCA_FLOWER_KEY_UDP_DST, TCA_FLOWER_KEY_UDP_DST_MASK },
+	{ TCA_FLOWER_KEY_SCTP_SRC, TCA_FLOWER_KEY_SCTP_SRC_MASK },
+	{ TCA_FLOWER_KEY_SCTP_DST, TCA_FLOWER_KEY_SCTP_DST_MASK },
+	{ TCA_FLOWER_KEY_VLAN_ID, 0 },
+	{ TCA_FLOWER_KEY_IP_TOS, TCA_FLOWER_KEY_IP_TOS_MASK },
+};
+
+/* Do the values differ on bits both masks care about? */
+static bool to_disjoint_bytes(const __u8 *va, const __u8 *ma,
+			      const __u8 *vb, const __u8 *mb, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		__u8 m = (ma ? ma[i] : 0xff) & (mb ? mb[i] : 0xff);
+
+		if ((va[i] ^ vb[i]) & m)
+			return true;
+	}
+	return false;
+}
+
+static bool to_flower_disjoint(const struct to_filter *a,
+			       const struct to_filter *b)
+{
+	struct rtattr *ta[TCA_FLOWER_MAX + 1], *tb[TCA_FLOWER_MAX + 1];
+	unsigned int i;
+
+	parse_rtattr_nested(ta, TCA_FLOWER_MAX, a->opts);
+	parse_rtattr_nested(tb, TCA_FLOWER_MAX, b->opts);
+	for (i = 0; i < ARRAY_SIZE(to_flower_keys); i++) {
+		int k = to_flower_keys[i].key, m = to_flower_keys[i].mask;
+		struct rtattr *ma = m ? ta[m] : NULL, *mb = m ? tb[m] : NULL;
+		int len;
+
+		if (!ta[k] || !tb[k])
+			continue;
+		len = RTA_PAYLOAD(ta[k]);
+		if (RTA_PAYLOAD(tb[k]) != len ||
+		    (ma && RTA_PAYLOAD(ma) != len) ||
+		    (mb && RTA_PAYLOAD(mb) != len))
+			continue;
+		if (to_disjoint_bytes(RTA_DATA(ta[k]), ma ? RTA_DATA(ma) : NULL,
+				      RTA_DATA(tb[k]), mb ? RTA_DATA(mb) : NULL,
+				      len))
+			return true;
+	}
+	return false;
+}
+
+static struct tc_u32_sel *to_u32_sel(const struct to_filter *f)
+{
+	struct rtattr *tb[TCA_U32_MAX + 1];
+	struct tc_u32_sel *sel;
+
+	parse_rtattr_nested(tb, TCA_U32_MAX, f->opts);
+	if (!tb[TCA_U32_SEL] || RTA_PAYLOAD(tb[TCA_U32_SEL]) < sizeof(*sel))
+		return NULL;
+	sel = RTA_DATA(tb[TCA_U32_SEL]);
+	if (RTA_PAYLOAD(tb[TCA_U32_SEL]) <
+	    sizeof(*sel) + sel->nkeys * sizeof(sel->keys[0]))
+		return NULL;
+	return sel;
+}
+
+static bool to_u32_disjoint(const struct to_filter *a,
+			    const struct to_filter *b)
+{
+	struct tc_u32_sel *sa = to_u32_sel(a), *sb = to_u32_sel(b);
+	int i, j;
+
+	if (!sa || !sb)
+		return false;
+	for (i = 0; i < sa->nkeys; i++) {
+		const struct tc_u32_key *ka = &sa->keys[i];
+
+		if (ka->offmask)
+			continue;
+		for (j = 0; j < sb->nkeys; j++) {
+			const struct tc_u32_key *kb = &sb->keys[j];
+
+			if (kb->offmask || kb->off != ka->off)
+				continue;
+			if ((ka->val ^ kb->val) & ka->mask & kb->mask)
+				return true;
+		}
+	}
+	return false;
+}
+
+static bool to_filters_overlap(const struct to_filter *a,
+			       const struct to_filter *b)
+{
+	if (a->proto != b->proto &&
+	    a->proto != htons(ETH_P_ALL) && b->proto != htons(ETH_P_ALL))
+		return false;
+	if (strcmp(a->kind, b->kind))
+		return true;
+	if (strcmp(a->kind, "flower") == 0)
+		return !to_flower_disjoint(a, b);
+	if (strcmp(a->kind, "u32") == 0)
+		return !to_u32_disjoint(a, b);
+	return true;
+}
+
+static bool to_prios_overlap(const struct to_dump *d,
+			     const struct to_prio *a, const struct to_prio *b)
+{
+	unsigned int i, j;
+
+	if (a->pinned || b->pinned)
+		return true;
+	for (i = a->first; i < a->first + a->count; i++) {
+		if (d->f[i].table)
+			continue;
+		for (j = b->first; j < b->first + b->count; j++)
+			if (!d->f[j].table &&
+			    to_filters_overlap(&d->f[i], &d->f[j]))
+				return true;
+	}
+	return false;
+}
+
+/* Can the filters of a priority be told apart from others and be moved? */
+static bool to_prio_pinned(const struct to_dump *d, const struct to_prio *p)
+{
+	unsigned int i;
+
+	if (strcmp(p->kind, "u32") == 0) {
+		if (p->tables > 1)
+			return true;
+		for (i = p->first; i < p->first + p->count; i++) {
+			struct rtattr *tb[TCA_U32_MAX + 1];
+
+			if (d->f[i].table)
+				continue;
+			parse_rtattr_nested(tb, TCA_U32_MAX, d->f[i].opts);
+			if (tb[TCA_U32_LINK] || !to_u32_sel(&d->f[i]))
+				return true;
+		}
+		return false;
+	}
+	return strcmp(p->kind, "flower") != 0;
+}
+
+static struct to_prio *to_prios(struct to_dump *d, const struct to_dump *old,
+				unsigned int *count)
+{
+	struct to_prio *p;
+	unsigned int i, n = 0;
+
+	p = calloc(d->n ? d->n : 1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	for (i = 0; i < d->n; i++) {
+		struct to_filter *f = &d->f[i], *was;
+
+		if (!n || p[n - 1].prio != f->prio) {
+			p[n].prio = f->prio;
+			p[n].proto = f->proto;
+			p[n].kind = f->kind;
+			p[n].first = i;
+			n++;
+		}
+		p[n - 1].count++;
+		if (f->table) {
+			p[n - 1].tables++;
+			continue;
+		}
+		/* counted from zero if it was added in between */
+		was = bsearch(f, old->f, old->n, sizeof(*f), to_filter_cmp);
+		p[n - 1].hits += f->hits - (was && was->hits <= f->hits ?
+					   was->hits : 0);
+	}
+	for (i = 0; i < n; i++)
+		p[i].pinned = to_prio_pinned(d, &p[i]);
+	*count = n;
+	return p;
+}
+
+/* Fills @order with the indexes of @p in the new order */
+static void to_reorder(const struct to_dump *d, struct to_prio *p,
+		       unsigned int n, unsigned int *order)
+{
+	unsigned int i, j, k;
+
+	for (i = 0; i < n; i++)
+		for (j = i + 1; j < n; j++)
+			if (to_prios_overlap(d, &p[i], &p[j]))
+				p[j].deps++;
+
+	for (k = 0; k < n; k++) {
+		unsigned int best = n;
+
+		for (i = 0; i < n; i++) {
+			if (p[i].pos || p[i].deps)
+				continue;
+			if (best == n || p[i].hits > p[best].hits)
+				best = i;
+		}
+		order[k] = best;
+		p[best].pos = k + 1;
+		for (j = best + 1; j < n; j++)
+			if (!p[j].pos && to_prios_overlap(d, &p[best], &p[j]))
+				p[j].deps--;
+	}
+}
+
+/* Priorities a matched packet goes through on average */
+static double to_cost(const struct to_prio *p, const unsigned int *order,
+		      unsigned int n)
+{
+	__u64 total = 0;
+	double cost = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		const struct to_prio *q = &p[order ? order[i] : i];
+
+		cost += (double)q->hits * (i + 1);
+		total += q->hits;
+	}
+	return total ? cost / total : 0;
+}
+
+static void to_print(const struct to_prio *p, const unsigned int *order,
+		     unsigned int n, double interval)
+{
+	unsigned int i;
+
+	open_json_object(NULL);
+	open_json_array(PRINT_JSON, "order");
+	for (i = 0; i < n; i++) {
+		const struct to_prio *q = &p[order[i]];
+
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "prio", "prio %u", q->prio);
+		print_string(PRINT_ANY, "kind", " %s", q->kind);
+		print_uint(PRINT_ANY, "filters", " %u filters",
+			   q->count - q->tables);
+		print_float(PRINT_ANY, "hits_per_sec", " %.1f hits/s",
+			    q->hits / interval);
+		if (order[i] != i)
+			print_uint(PRINT_ANY, "was", " (was %u.)", order[i] + 1);
+		if (q->pinned)
+			print_bool(PRINT_ANY, "pinned", " pinned", true);
+		print_string(PRINT_FP, NULL, "%s", "\n");
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	print_float(PRINT_ANY, "cost_before",
+		    "priorities per matched packet: %.2f now", to_cost(p, NULL, n));
+	print_float(PRINT_ANY, "cost_after", ", %.2f reordered\n",
+		    to_cost(p, order, n));
+	close_json_object();
+}
+
+static int to_copy(const struct to_filter *f, __u32 prio)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct tcmsg		t;
+		char			buf[MAX_MSG];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_NEWTFILTER,
+		.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL,
+	};
+	struct tcmsg *t = NLMSG_DATA(f->n);
+	int len = f->n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1], *opt, *rta;
+	bool u32 = strcmp(f->kind, "u32") == 0;
+
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	req.t = *t;
+	req.t.tcm_info = TC_H_MAKE(prio << 16, f->proto);
+	/* an u32 handle names a table of the old priority */
+	if (u32)
+		req.t.tcm_handle = 0;
+	addattr_l(&req.n, sizeof(req), TCA_KIND, f->kind, strlen(f->kind) + 1);
+	if (tb[TCA_CHAIN])
+		addattr32(&req.n, sizeof(req), TCA_CHAIN,
+			  rta_getattr_u32(tb[TCA_CHAIN]));
+
+	opt = addattr_nest(&req.n, sizeof(req), TCA_OPTIONS);
+	len = RTA_PAYLOAD(f->opts);
+	for (rta = RTA_DATA(f->opts); RTA_OK(rta, len);
+	     rta = RTA_NEXT(rta, len)) {
+		if (u32 && (rta->rta_type == TCA_U32_PCNT ||
+			    rta->rta_type == TCA_U32_HASH))
+			continue;
+		/* the kernel adds in_hw and not_in_hw, and refuses them back */
+		if (rta->rta_type == (u32 ? TCA_U32_FLAGS : TCA_FLOWER_FLAGS)) {
+			__u32 flags = rta_getattr_u32(rta) &
+				      (TCA_CLS_FLAGS_SKIP_HW |
+				       TCA_CLS_FLAGS_SKIP_SW);
+
+			if (flags)
+				addattr32(&req.n, sizeof(req), rta->rta_type,
+					  flags);
+			continue;
+		}
+		if (addattr_l(&req.n, sizeof(req), rta->rta_type,
+			      RTA_DATA(rta), RTA_PAYLOAD(rta)) < 0)
+			return -1;
+	}
+	addattr_nest_end(&req.n, opt);
+
+	return rtnl_talk(&rth, &req.n, NULL) < 0 ? -1 : 0;
+}
+
+static int to_delete(const struct to_dump *d, const struct to_prio *p)
+{
+	const struct to_filter *f = &d->f[p->first];
+	struct tcmsg *ft = NLMSG_DATA(f->n);
+	struct rtattr *tb[TCA_MAX + 1];
+	struct {
+		struct nlmsghdr		n;
+		struct tcmsg		t;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_DELTFILTER,
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.t.tcm_family = AF_UNSPEC,
+		.t.tcm_ifindex = ft->tcm_ifindex,
+		.t.tcm_parent = ft->tcm_parent,
+		.t.tcm_info = TC_H_MAKE(p->prio << 16, p->proto),
+	};
+
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(ft),
+		     f->n->nlmsg_len - NLMSG_LENGTH(sizeof(*ft)));
+	addattr_l(&req.n, sizeof(req), TCA_KIND, p->kind, strlen(p->kind) + 1);
+	if (tb[TCA_CHAIN])
+		addattr32(&req.n, sizeof(req), TCA_CHAIN,
+			  rta_getattr_u32(tb[TCA_CHAIN]));
+	return rtnl_talk(&rth, &req.n, NULL) < 0 ? -1 : 0;
+}
+
+static int to_apply(const struct to_dump *d, const struct to_prio *p,
+		    const unsigned int *order, unsigned int n)
+{
+	unsigned int i, j, base = 0;
+
+	for (i = 0; i < n; i++) {
+		if (p[i].pinned) {
+			fprintf(stderr,
+				"prio %u cannot be moved, not applying\n",
+				p[i].prio);
+			return -1;
+		}
+		if (p[i].prio > base)
+			base = p[i].prio;
+	}
+	base++;
+	if (base + n - 1 > 0xffff) {
+		fprintf(stderr,
+			"No room for %u priorities above %u, not applying\n",
+			n, base - 1);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		const struct to_prio *q = &p[order[i]];
+
+		for (j = q->first; j < q->first + q->count; j++) {
+			if (d->f[j].table)
+				continue;
+			if (to_copy(&d->f[j], base + i) < 0) {
+				fprintf(stderr,
+					"Cannot copy prio %u to prio %u, the old filters are still in place\n",
+					q->prio, base + i);
+				return -1;
+			}
+		}
+	}
+	/* the old filters left are the first of the old order */
+	for (i = n; i-- > 0; ) {
+		if (to_delete(d, &p[i]) < 0) {
+			fprintf(stderr, "Cannot delete prio %u\n", p[i].prio);
+			return -1;
+		}
+	}
+	if (!json)
+		printf("Moved to prio %u to %u\n", base, base + n - 1);
+	return 0;
+}
+
+int tc_filter_optimize(int argc, char **argv)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct tcmsg		t;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_GETTFILTER,
+		.t.tcm_parent = TC_H_UNSPEC,
+		.t.tcm_family = AF_UNSPEC,
+	};
+	struct to_dump before = {}, after = {};
+	struct timespec ts;
+	struct to_prio *p = NULL;
+	unsigned int *order = NULL, n = 0, i;
+	double interval = 10;
+	char d[IFNAMSIZ] = {};
+	__u32 chain = 0;
+	bool chain_set = false, apply = false, moved = false;
+	int ret = -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (d[0])
+				return duparg("dev", *argv);
+			strncpy(d, *argv, sizeof(d) - 1);
+		} else if (strcmp(*argv, "root") == 0) {
+			if (req.t.tcm_parent)
+				return duparg("root", *argv);
+			req.t.tcm_parent = TC_H_ROOT;
+		} else if (strcmp(*argv, "ingress") == 0) {
+			if (req.t.tcm_parent)
+				return duparg("ingress", *argv);
+			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+						     TC_H_MIN_INGRESS);
+		} else if (strcmp(*argv, "egress") == 0) {
+			if (req.t.tcm_parent)
+				return duparg("egress", *argv);
+			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+						     TC_H_MIN_EGRESS);
+		} else if (strcmp(*argv, "parent") == 0) {
+			__u32 handle;
+
+			NEXT_ARG();
+			if (req.t.tcm_parent)
+				return duparg("parent", *argv);
+			if (get_tc_classid(&handle, *argv))
+				return invarg("invalid parent ID", *argv);
+			req.t.tcm_parent = handle;
+		} else if (matches(*argv, "chain") == 0) {
+			NEXT_ARG();
+			if (chain_set)
+				return duparg("chain", *argv);
+			if (get_u32(&chain, *argv, 0))
+				return invarg("invalid chain index value", *argv);
+			chain_set = true;
+		} else if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (strcmp(*argv, "apply") == 0) {
+			apply = true;
+		} else if (matches(*argv, "help") == 0) {
+			print_explain(stdout);
+			return 0;
+		} else {
+			fprintf(stderr, "What is \"%s\"? Try \"tc filter optimize help\".\n",
+				*argv);
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	if (!d[0]) {
+		fprintf(stderr, "Error: \"dev\" is required\n");
+		return -1;
+	}
+	ll_init_map(&rth);
+	req.t.tcm_ifindex = ll_name_to_index(d);
+	if (!req.t.tcm_ifindex)
+		return -nodev(d);
+	addattr32(&req.n, sizeof(req), TCA_CHAIN, chain);
+
+	if (to_dump(&req.n, &before) < 0)
+		goto out;
+	ts.tv_sec = interval;
+	ts.tv_nsec = (interval - ts.tv_sec) * 1e9;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+	if (to_dump(&req.n, &after) < 0)
+		goto out;
+	qsort(before.f, before.n, sizeof(*before.f), to_filter_cmp);
+
+	p = to_prios(&after, &before, &n);
+	order = calloc(n ? n : 1, sizeof(*order));
+	if (!p || !order)
+		goto out;
+	to_reorder(&after, p, n, order);
+	for (i = 0; i < n; i++)
+		moved |= order[i] != i;
+
+	new_json_obj(json);
+	to_print(p, order, n, interval);
+	if (apply && moved)
+		ret = to_apply(&after, p, order, n);
+	else
+		ret = 0;
+	delete_json_obj();
+out:
+	free(order);
+	free(p);
+	to_dump_free(&before);
+	to_dump_free(&after);
+	return ret;
+}
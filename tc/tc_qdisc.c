@@ -35,6 +35,11 @@ static int usage(void)
 	fprintf(stderr, "       [ [ QDISC_KIND ] [ help | OPTIONS ] ]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "       tc qdisc show [ dev STRING ] [ ingress | clsact ] [ invisible ]\n");
+	fprintf(stderr, "       tc qdisc sample [ dev STRING ] [ interval SECONDS ] [ count COUNT ] [ top N ]\n");
+	fprintf(stderr, "       tc qdisc setup-mq { dev STRING | group GROUP } [ handle QHANDLE ]\n");
+	fprintf(stderr, "       [ replace ] child QDISC_KIND [ OPTIONS ]\n");
+	fprintf(stderr, "       tc qdisc setup-block BLOCK_INDEX [ ingress | egress ] [ migrate ]\n");
+	fprintf(stderr, "       dev STRING [ dev STRING ... ] [ filters FILE ]\n");
 	fprintf(stderr, "Where:\n");
 	fprintf(stderr, "QDISC_KIND := { [p|b]fifo | tbf | prio | cbq | red | etc. }\n");
 	fprintf(stderr, "OPTIONS := ... try tc qdisc add <desired QDISC_KIND> help\n");
@@ -42,8 +47,12 @@ static int usage(void)
 	return -1;
 }
 
+/* lets parse_qopt() reference large payloads instead of copying them */
+struct nlmsg_refs *tc_qdisc_refs;
+
 static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 {
+	struct nlmsg_refs refs = {};
 	struct qdisc_util *q = NULL;
 	struct tc_estimator est = {};
 	struct {
@@ -158,7 +167,12 @@ static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 
 	if (q) {
 		if (q->parse_qopt) {
-			if (q->parse_qopt(q, argc, argv, &req.n, d))
+			int err;
+
+			tc_qdisc_refs = &refs;
+			err = q->parse_qopt(q, argc, argv, &req.n, d);
+			tc_qdisc_refs = NULL;
+			if (err)
 				return 1;
 		} else if (argc) {
 			fprintf(stderr, "qdisc '%s' does not support option parsing\n", k);
@@ -189,22 +203,18 @@ static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 			addattr_l(&req.n, sizeof(req), TCA_STAB_DATA, stab.data,
 				  stab.szopts.tsize * sizeof(__u16));
 		addattr_nest_end(&req.n, tail);
-		if (stab.data)
-			free(stab.data);
 	}
 
 	if (d[0])  {
 		int idx;
 
-		ll_init_map(&rth);
-
 		idx = ll_name_to_index(d);
 		if (!idx)
 			return -nodev(d);
 		req.t.tcm_ifindex = idx;
 	}
 
-	if (rtnl_talk(&rth, &req.n, NULL) < 0)
+	if (rtnl_talk_refs(&rth, &req.n, &refs, NULL) < 0)
 		return 2;
 
 	return 0;
@@ -436,6 +446,12 @@ int do_qdisc(int argc, char **argv)
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
 		return tc_qdisc_list(argc-1, argv+1);
+	if (matches(*argv, "sample") == 0)
+		return tc_sample(RTM_GETQDISC, argc-1, argv+1);
+	if (strcmp(*argv, "setup-mq") == 0)
+		return tc_qdisc_setup_mq(argc-1, argv+1);
+	if (strcmp(*argv, "setup-block") == 0)
+		return tc_qdisc_setup_block(argc-1, argv+1);
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
@@ -0,0 +1,546 @@
+/*
+ * tc_sample.c		"tc qdisc|class|actions sample", periodic counter deltas.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Each sample dumps the qdiscs, the classes of a device or the actions
+ * of a kind and takes only the basic and queue counters of every object,
+ * leaving its options unparsed. The counters of the last sample are kept
+ * in a hash table keyed by device, handle, parent and kind, and the
+ * objects seen in two samples in a row are printed by byte rate, busiest
+ * first, with their drop and overlimit rates and how much their backlog
+ * moved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "utils.h"
+#include "tc_util.h"
+#include "tc_common.h"
+
+struct ts_key {
+	int		ifindex;
+	__u32		handle;	/* the index of an action */
+	__u32		parent;
+	char		kind[FILTER_NAMESZ];
+};
+
+struct ts_counters {
+	__u64		bytes;
+	__u32		packets;
+	__u32		drops;
+	__u32		overlimits;
+	__u32		backlog;
+	__u32		qlen;
+};
+
+struct ts_sample {
+	struct ts_sample	*next;
+	struct ts_key		key;
+	__u32			hash;
+	struct ts_counters	c;
+	unsigned int		round;	/* sample it was last seen in */
+};
+
+struct ts_rate {
+	const struct ts_sample	*e;
+	__u64			bytes;
+	__u32			packets;
+	__u32			drops;
+	__u32			overlimits;
+	int			backlog;
+	int			qlen;
+};
+
+struct ts_sampler {
+	struct ts_sample	**hash;
+	unsigned int		size;	/* buckets, a power of two */
+	unsigned int		count;
+	unsigned int		round;
+	struct ts_rate		*rates;
+	unsigned int		nrates;
+	unsigned int		rates_size;
+	double			elapsed;
+	int			type;	/* RTM_GETQDISC, _GETTCLASS, _GETACTION */
+	int			ifindex;
+};
+
+static void print_explain(FILE *f)
+{
+	fprintf(f,
+		"Usage: tc qdisc sample [ dev STRING ] [ SAMPLE_OPTS ]\n"
+		"       tc class sample dev STRING [ root | parent CLASSID ] [ SAMPLE_OPTS ]\n"
+		"       tc actions sample action ACTNAME [ SAMPLE_OPTS ]\n"
+		"SAMPLE_OPTS := [ interval SECONDS ] [ count COUNT ] [ top N ]\n");
+}
+
+static __u32 ts_hash(const struct ts_key *key)
+{
+	const __u8 *p = (const __u8 *)key;
+	__u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+static int sampler_grow(struct ts_sampler *s)
+{
+	unsigned int size = s->size ? 2 * s->size : 1024, i;
+	struct ts_sample **hash;
+
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+	for (i = 0; i < s->size; i++) {
+		struct ts_sample *e, *next;
+
+		for (e = s->hash[i]; e; e = next) {
+			next = e->next;
+			e->next = hash[e->hash & (size - 1)];
+			hash[e->hash & (size - 1)] = e;
+		}
+	}
+	free(s->hash);
+	s->hash = hash;
+	s->size = size;
+	return 0;
+}
+
+static int sampler_rate(struct ts_sampler *s, const struct ts_sample *e,
+			const struct ts_counters *c)
+{
+	if (s->nrates == s->rates_size) {
+		unsigned int size = s->rates_size ? 2 * s->rates_size : 1024;
+		struct ts_rate *rates;
+
+		rates = realloc(s->rates, size * sizeof(*rates));
+		if (!rates)
+			return -1;
+		s->rates = rates;
+		s->rates_size = size;
+	}
+	/* the 32 bit counters may wrap between two samples */
+	s->rates[s->nrates++] = (struct ts_rate) {
+		.e		= e,
+		.bytes		= c->bytes - e->c.bytes,
+		.packets	= c->packets - e->c.packets,
+		.drops		= c->drops - e->c.drops,
+		.overlimits	= c->overlimits - e->c.overlimits,
+		.backlog	= (int)(c->backlog - e->c.backlog),
+		.qlen		= (int)(c->qlen - e->c.qlen),
+	};
+	return 0;
+}
+
+static int sampler_update(struct ts_sampler *s, const struct ts_key *key,
+			  const struct ts_counters *c)
+{
+	__u32 hash = ts_hash(key);
+	struct ts_sample *e = NULL;
+
+	if (s->size) {
+		for (e = s->hash[hash & (s->size - 1)]; e; e = e->next) {
+			if (e->hash == hash && !memcmp(&e->key, key, sizeof(*key)))
+				break;
+		}
+	}
+
+	if (!e) {
+		if (s->count >= s->size && sampler_grow(s) < 0)
+			return -1;
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			return -1;
+		e->key = *key;
+		e->hash = hash;
+		e->next = s->hash[hash & (s->size - 1)];
+		s->hash[hash & (s->size - 1)] = e;
+		s->count++;
+	} else if (e->round + 1 == s->round && c->bytes >= e->c.bytes) {
+		/* the bytes going back would be a new object on the same key */
+		if (sampler_rate(s, e, c) < 0)
+			return -1;
+	}
+
+	e->c = *c;
+	e->round = s->round;
+	return 0;
+}
+
+static void parse_stats2(struct ts_counters *c, struct rtattr *rta)
+{
+	struct rtattr *tbs[TCA_STATS_MAX + 1];
+
+	parse_rtattr_nested(tbs, TCA_STATS_MAX, rta);
+
+	if (tbs[TCA_STATS_BASIC]) {
+		struct gnet_stats_basic bs = {};
+
+		memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]), sizeof(bs)));
+		c->bytes = bs.bytes;
+		c->packets = bs.packets;
+	}
+	if (tbs[TCA_STATS_QUEUE]) {
+		struct gnet_stats_queue q = {};
+
+		memcpy(&q, RTA_DATA(tbs[TCA_STATS_QUEUE]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_QUEUE]), sizeof(q)));
+		c->drops = q.drops;
+		c->overlimits = q.overlimits;
+		c->backlog = q.backlog;
+		c->qlen = q.qlen;
+	}
+}
+
+static int sample_tcmsg(struct ts_sampler *s, struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+	struct ts_counters c = {};
+	struct ts_key key = {};
+
+	if (len < 0)
+		return -1;
+	if (s->ifindex && t->tcm_ifindex != s->ifindex)
+		return 0;
+
+	parse_rtattr_want(tb, TCA_MAX,
+			  RTA_WANT(TCA_KIND) | RTA_WANT(TCA_STATS) |
+			  RTA_WANT(TCA_STATS2),
+			  TCA_RTA(t), len);
+	if (!tb[TCA_KIND])
+		return 0;
+
+	if (tb[TCA_STATS2]) {
+		parse_stats2(&c, tb[TCA_STATS2]);
+	} else if (tb[TCA_STATS]) {
+		struct tc_stats st = {};
+
+		memcpy(&st, RTA_DATA(tb[TCA_STATS]),
+		       MIN(RTA_PAYLOAD(tb[TCA_STATS]), sizeof(st)));
+		c.bytes = st.bytes;
+		c.packets = st.packets;
+		c.drops = st.drops;
+		c.overlimits = st.overlimits;
+		c.backlog = st.backlog;
+		c.qlen = st.qlen;
+	} else {
+		return 0;
+	}
+
+	key.ifindex = t->tcm_ifindex;
+	key.handle = t->tcm_handle;
+	key.parent = t->tcm_parent;
+	strncpy(key.kind, rta_getattr_str(tb[TCA_KIND]), sizeof(key.kind) - 1);
+	return sampler_update(s, &key, &c);
+}
+
+static int sample_tcamsg(struct ts_sampler *s, struct nlmsghdr *n)
+{
+	struct tcamsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_ROOT_MAX + 1];
+	struct rtattr *act;
+	int rem;
+
+	if (len < 0)
+		return -1;
+
+	parse_rtattr(tb, TCA_ROOT_MAX, TA_RTA(t), len);
+	if (!tb[TCA_ACT_TAB])
+		return 0;
+
+	rem = RTA_PAYLOAD(tb[TCA_ACT_TAB]);
+	for (act = RTA_DATA(tb[TCA_ACT_TAB]); RTA_OK(act, rem);
+	     act = RTA_NEXT(act, rem)) {
+		struct rtattr *tba[TCA_ACT_MAX + 1];
+		struct ts_counters c = {};
+		struct ts_key key = {};
+
+		parse_rtattr_nested(tba, TCA_ACT_MAX, act);
+		if (!tba[TCA_ACT_KIND] || !tba[TCA_ACT_STATS])
+			continue;
+
+		parse_stats2(&c, tba[TCA_ACT_STATS]);
+		key.handle = tc_action_index(tba);
+		strncpy(key.kind, rta_getattr_str(tba[TCA_ACT_KIND]),
+			sizeof(key.kind) - 1);
+		if (sampler_update(s, &key, &c) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int sample_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	struct ts_sampler *s = arg;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+	case RTM_NEWTCLASS:
+		return sample_tcmsg(s, n);
+	case RTM_NEWACTION:
+	case RTM_GETACTION:	/* what action dumps are answered with */
+		return sample_tcamsg(s, n);
+	}
+	return 0;
+}
+
+/* Forget the objects that were not in the last sample */
+static void sampler_expire(struct ts_sampler *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->size; i++) {
+		struct ts_sample **pe = &s->hash[i];
+
+		while (*pe) {
+			struct ts_sample *e = *pe;
+
+			if (e->round == s->round) {
+				pe = &e->next;
+				continue;
+			}
+			*pe = e->next;
+			free(e);
+			s->count--;
+		}
+	}
+}
+
+static int rate_cmp(const void *a, const void *b)
+{
+	const struct ts_rate *ra = a, *rb = b;
+
+	if (ra->bytes != rb->bytes)
+		return ra->bytes < rb->bytes ? 1 : -1;
+	if (ra->packets != rb->packets)
+		return ra->packets < rb->packets ? 1 : -1;
+	if (ra->drops != rb->drops)
+		return ra->drops < rb->drops ? 1 : -1;
+	return 0;
+}
+
+static void print_sample_rate(const struct ts_sampler *s,
+			      const struct ts_rate *r)
+{
+	const struct ts_sample *e = r->e;
+	double elapsed = s->elapsed;
+	SPRINT_BUF(b1);
+
+	open_json_object(NULL);
+	if (s->type == RTM_GETACTION) {
+		print_string(PRINT_ANY, "kind", "action %s", e->key.kind);
+		print_uint(PRINT_ANY, "index", " index %u", e->key.handle);
+	} else {
+		print_string(PRINT_FP, NULL, "%s ",
+			     s->type == RTM_GETQDISC ? "qdisc" : "class");
+		print_string(PRINT_ANY, "kind", "%s", e->key.kind);
+		print_string(PRINT_ANY, "handle", " %s",
+			     sprint_tc_classid(e->key.handle, b1));
+		print_string(PRINT_ANY, "dev", " dev %s",
+			     ll_index_to_name(e->key.ifindex));
+		if (e->key.parent == TC_H_ROOT)
+			print_bool(PRINT_ANY, "root", " root", true);
+		else if (e->key.parent)
+			print_string(PRINT_ANY, "parent", " parent %s",
+				     sprint_tc_classid(e->key.parent, b1));
+	}
+	print_float(PRINT_JSON, "interval", NULL, elapsed);
+	print_u64(PRINT_ANY, "bytes", " bytes %" PRIu64, r->bytes);
+	print_uint(PRINT_ANY, "packets", " packets %u", r->packets);
+	print_float(PRINT_JSON, "bytes_rate", NULL, r->bytes / elapsed);
+	print_string(PRINT_FP, NULL, " rate %s",
+		     sprint_rate(r->bytes * 8 / elapsed, b1));
+	print_float(PRINT_ANY, "packets_rate", " %.0fpps",
+		    r->packets / elapsed);
+	print_float(PRINT_ANY, "drops_rate", " drops %.0f/s",
+		    r->drops / elapsed);
+	print_float(PRINT_ANY, "overlimits_rate", " overlimits %.0f/s",
+		    r->overlimits / elapsed);
+	if (s->type != RTM_GETACTION) {
+		print_uint(PRINT_JSON, "backlog", NULL, e->c.backlog);
+		print_string(PRINT_FP, NULL, " backlog %s",
+			     sprint_size(e->c.backlog, b1));
+		print_int(PRINT_ANY, "backlog_delta", " (%+db)", r->backlog);
+		print_uint(PRINT_ANY, "qlen", " %up", e->c.qlen);
+		print_int(PRINT_ANY, "qlen_delta", " (%+dp)", r->qlen);
+	}
+	print_string(PRINT_FP, NULL, "%s", "\n");
+	close_json_object();
+}
+
+static int sample_one(struct ts_sampler *s, struct tcmsg *t,
+		      struct nlmsghdr *areq, unsigned int top)
+{
+	unsigned int i;
+	int ret;
+
+	s->nrates = 0;
+	if (areq)
+		ret = rtnl_dump_request(&rth, RTM_GETACTION, NLMSG_DATA(areq),
+					areq->nlmsg_len - NLMSG_HDRLEN);
+	else
+		ret = rtnl_dump_request(&rth, s->type, t, sizeof(*t));
+	if (ret < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, sample_nlmsg, s) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	sampler_expire(s);
+
+	qsort(s->rates, s->nrates, sizeof(*s->rates), rate_cmp);
+	if (top && top < s->nrates)
+		s->nrates = top;
+	for (i = 0; i < s->nrates; i++)
+		print_sample_rate(s, &s->rates[i]);
+	return 0;
+}
+
+int tc_sample(int type, int argc, char **argv)
+{
+	struct ts_sampler s = { .type = type };
+	struct tcmsg t = { .tcm_family = AF_UNSPEC };
+	struct timespec next, now, last;
+	unsigned int count = 0, top = 0, i;
+	double interval = 1;
+	char d[IFNAMSIZ] = {};
+	struct {
+		struct nlmsghdr		n;
+		struct tcamsg		t;
+		char			buf[256];
+	} areq = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcamsg)),
+		.t.tca_family = AF_UNSPEC,
+	};
+	int ret = 0;
+
+	if (type == RTM_GETACTION) {
+		struct nla_bitfield32 flags = {
+			.value		= TCA_FLAG_LARGE_DUMP_ON,
+			.selector	= TCA_FLAG_LARGE_DUMP_ON,
+		};
+		struct rtattr *tab, *prio;
+
+		if (argc < 1) {
+			print_explain(stderr);
+			return -1;
+		}
+		tab = addattr_nest(&areq.n, sizeof(areq), TCA_ACT_TAB);
+		prio = addattr_nest(&areq.n, sizeof(areq), 1);
+		addattr_l(&areq.n, sizeof(areq), TCA_ACT_KIND, *argv,
+			  strlen(*argv) + 1);
+		addattr_nest_end(&areq.n, prio);
+		addattr_nest_end(&areq.n, tab);
+		addattr_l(&areq.n, sizeof(areq), TCA_ROOT_FLAGS, &flags,
+			  sizeof(flags));
+		argc--; argv++;
+	}
+
+	while (argc > 0) {
+		if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_sample_interval(&interval, *argv))
+				return invarg("invalid interval", *argv);
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				return invarg("invalid count", *argv);
+		} else if (strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&top, *argv, 0))
+				return invarg("invalid top", *argv);
+		} else if (type != RTM_GETACTION && strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (d[0])
+				return duparg("dev", *argv);
+			strncpy(d, *argv, sizeof(d) - 1);
+		} else if (type == RTM_GETTCLASS && strcmp(*argv, "root") == 0) {
+			if (t.tcm_parent)
+				return duparg("root", *argv);
+			t.tcm_parent = TC_H_ROOT;
+		} else if (type == RTM_GETTCLASS && strcmp(*argv, "parent") == 0) {
+			__u32 handle;
+
+			NEXT_ARG();
+			if (t.tcm_parent)
+				return duparg("parent", *argv);
+			if (get_tc_classid(&handle, *argv))
+				return invarg("invalid parent ID", *argv);
+			t.tcm_parent = handle;
+		} else if (matches(*argv, "help") == 0) {
+			print_explain(stdout);
+			return 0;
+		} else {
+			fprintf(stderr, "What is \"%s\"? Try \"tc %s sample help\".\n",
+				*argv, type == RTM_GETQDISC ? "qdisc" :
+				type == RTM_GETTCLASS ? "class" : "actions");
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	ll_init_map(&rth);
+
+	if (d[0]) {
+		t.tcm_ifindex = ll_name_to_index(d);
+		if (!t.tcm_ifindex)
+			return -nodev(d);
+		s.ifindex = t.tcm_ifindex;
+	} else if (type == RTM_GETTCLASS) {
+		fprintf(stderr, "Error: \"dev\" is required to sample classes\n");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last = next;
+	for (s.round = 1; ; s.round++) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		s.elapsed = timespec_diff(&now, &last);
+		last = now;
+
+		/* the first sample only primes the counters */
+		if (s.round > 1)
+			new_json_obj(json);
+		ret = sample_one(&s, &t, type == RTM_GETACTION ? &areq.n : NULL,
+				 top);
+		delete_json_obj();
+		if (s.round > 1 && !json)
+			printf("\n");
+		fflush(stdout);
+
+		/* count samples after the one the first rates are taken to */
+		if (ret < 0 || (count && s.round > count))
+			break;
+
+		sample_wait(&next, interval);
+	}
+
+	for (i = 0; i < s.size; i++) {
+		while (s.hash[i]) {
+			struct ts_sample *e = s.hash[i];
+
+			s.hash[i] = e->next;
+			free(e);
+		}
+	}
+	free(s.hash);
+	free(s.rates);
+	return ret < 0 ? 1 : 0;
+}
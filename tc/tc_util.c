@@ -309,7 +309,6 @@ int get_rate64(__u64 *rate, const char *str)
 
 void print_rate(char *buf, int len, __u64 rate)
 {
-	extern int use_iec;
 	unsigned long kilo = use_iec ? 1024 : 1000;
 	const char *str = use_iec ? "i" : "";
 	static char *units[5] = {"", "K", "M", "G", "T"};
@@ -486,7 +485,7 @@ char *sprint_qdisc_handle(__u32 h, char *buf)
 
 static const char *action_n2a(int action)
 {
-	static char buf[64];
+	static __thread char buf[64];
 
 	if (TC_ACT_EXT_CMP(action, TC_ACT_GOTO_CHAIN))
 		return "goto";
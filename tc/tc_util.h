@@ -42,7 +42,10 @@ struct qdisc_util {
 	int (*print_copt)(struct qdisc_util *qu, FILE *f, struct rtattr *opt);
 };
 
-extern __u16 f_proto;
+extern __thread __u16 f_proto;
+/* parse_fopt() returns this when it sent the requests itself */
+#define TC_FOPT_SENT	2
+
 struct filter_util {
 	struct filter_util *next;
 	char id[FILTER_NAMESZ];
@@ -50,6 +53,8 @@ struct filter_util {
 			  int argc, char **argv, struct nlmsghdr *n);
 	int (*print_fopt)(struct filter_util *qu,
 			  FILE *f, struct rtattr *opt, __u32 fhandle);
+	/* the option that holds the actions, for their counters in brief */
+	int act_attr;
 };
 
 struct action_util {
@@ -127,6 +132,7 @@ int police_print_xstats(struct action_util *a, FILE *f, struct rtattr *tb);
 int tc_print_action(FILE *f, const struct rtattr *tb, unsigned short tot_acts);
 int tc_print_ipt(FILE *f, const struct rtattr *tb);
 int parse_action(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n);
+__u32 tc_action_index(struct rtattr *tb[]);
 void print_tm(FILE *f, const struct tcf_t *tm);
 int prio_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt);
 
@@ -0,0 +1,31 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing batch jobs with routes through gateways]"
+
+DEV="$(rand_dev)"
+BATCH="$(mktemp)"
+export RTNL_JOBS_MAX=8
+
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_ip "$0" "Set $DEV into UP state" link set up dev $DEV
+
+# each gateway is reachable through a route of the batch alone
+for i in $(seq 1 40); do
+	echo "route add 10.$i.0.0/16 dev $DEV"
+	echo "route add 172.16.$i.0/24 via 10.$i.0.2"
+done > $BATCH
+echo "route add 192.168.0.0/24 nexthop via 10.1.0.2 nexthop via 10.2.0.2" >> $BATCH
+
+ts_ip "$0" "Add routes with 8 jobs" -batch-jobs 8 -batch $BATCH
+
+ts_ip "$0" "Show routes through gateways" route show dev $DEV via 10.1.0.2
+test_on "^172.16.1.0/24"
+ts_ip "$0" "Show the last route through a gateway" route show 172.16.40.0/24
+test_on "^172.16.40.0/24 via 10.40.0.2 dev $DEV"
+ts_ip "$0" "Show the multipath route" route show 192.168.0.0/24
+test_on "nexthop via 10.2.0.2 dev $DEV"
+
+rm -f $BATCH
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
@@ -0,0 +1,37 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing route get with prefixes and fibmatch]"
+
+DEV="$(rand_dev)"
+
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_ip "$0" "Set $DEV into UP state" link set up dev $DEV
+ts_ip "$0" "Add 10.10.0.1/16 addr on $DEV" addr add 10.10.0.1/16 dev $DEV
+ts_ip "$0" "Add 2001:db8::1/64 addr on $DEV" -6 addr add 2001:db8::1/64 dev $DEV nodad
+ts_ip "$0" "Add route 10.0.0.0/24 via 10.10.0.2" route add 10.0.0.0/24 via 10.10.0.2
+
+ts_ip "$0" "Get IPv4 route to a prefix" route get 10.0.0.0/24
+test_on "^10.0.0.0 via 10.10.0.2 dev $DEV"
+
+ts_ip "$0" "Get IPv4 route from a prefix" route get 10.0.0.5 from 10.10.0.1/16
+test_on "^10.0.0.5 from 10.10.0.1 via 10.10.0.2 dev $DEV"
+
+ts_ip "$0" "Get IPv4 fibmatch route" route get fibmatch 10.10.0.0/16
+test_on "^10.10.0.0/16 dev $DEV"
+
+ts_ip "$0" "Get IPv6 route" -6 route get 2001:db8::7
+test_on "^2001:db8::7 from :: dev $DEV"
+
+ts_ip "$0" "Get IPv6 fibmatch route" -6 route get fibmatch 2001:db8::/64
+test_on "^2001:db8::/64 dev $DEV"
+
+BATCH="$(mktemp)"
+printf '2001:db8::7\nfibmatch 2001:db8::/64\n10.0.0.0/24\n' > $BATCH
+ts_ip "$0" "Get routes of both families in a batch" route get -batch $BATCH
+test_on "^fibmatch 2001:db8::/64 -> table main dev $DEV"
+test_lines_count 3
+rm -f $BATCH
+
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing route sync keeps to the families of the file]"
+
+DEV="$(rand_dev)"
+FILE="$(mktemp)"
+
+ts_ip "$0" "Add $DEV dummy interface" link add dev $DEV type dummy
+ts_ip "$0" "Set $DEV into UP state" link set up dev $DEV
+ts_ip "$0" "Add 10.10.0.1/16 addr on $DEV" addr add 10.10.0.1/16 dev $DEV
+ts_ip "$0" "Add 2001:db8::1/64 addr on $DEV" -6 addr add 2001:db8::1/64 dev $DEV nodad
+ts_ip "$0" "Add route 10.5.0.0/24" route add 10.5.0.0/24 via 10.10.0.2
+ts_ip "$0" "Add route 10.6.0.0/24" route add 10.6.0.0/24 via 10.10.0.2
+ts_ip "$0" "Add route 2001:db8:5::/48" -6 route add 2001:db8:5::/48 via 2001:db8::2
+
+echo "10.5.0.0/24 via 10.10.0.2" > $FILE
+ts_ip "$0" "Sync IPv4 routes" -s route sync file $FILE
+test_on "^0 added, 0 changed, 1 deleted, 1 unchanged"
+
+ts_ip "$0" "Show IPv6 routes" -6 route show dev $DEV
+test_on "^2001:db8:5::/48 via 2001:db8::2"
+
+: > $FILE
+ts_ip "$0" "Sync an empty file" -s route sync file $FILE
+test_on "^0 added, 0 changed, 0 deleted, 0 unchanged"
+
+ts_ip "$0" "Sync IPv6 routes with -6" -s -6 route sync file $FILE
+test_on "^0 added, 0 changed, 1 deleted, 0 unchanged"
+
+ts_ip "$0" "Show IPv4 routes" route show dev $DEV
+test_on "^10.5.0.0/24 via 10.10.0.2"
+
+rm -f $FILE
+ts_ip "$0" "Del $DEV dummy interface" link del dev $DEV
@@ -0,0 +1,35 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing rule sync against the rules already there]"
+
+FILE="$(mktemp)"
+
+ts_ip "$0" "Add rule pref 1100" rule add pref 1100 from 10.11.0.0/16 lookup 1100
+ts_ip "$0" "Add rule pref 1200" rule add pref 1200 from 10.12.0.0/16 lookup 1200
+
+cat > $FILE <<EOT
+pref 1100 from 10.11.0.0/16 lookup 1100
+pref 1300 from 10.13.0.0/16 lookup 1300
+EOT
+ts_ip "$0" "Sync rules" -s rule sync file $FILE pref 1000-1999
+test_on "^1 added, 1 deleted, 1 unchanged"
+
+ts_ip "$0" "Show rules" rule show
+test_on "^1100:	from 10.11.0.0/16 lookup 1100"
+test_on_not "^1200:"
+test_on "^1300:	from 10.13.0.0/16 lookup 1300"
+test_on "^32766:	from all lookup main"
+
+ts_ip "$0" "Sync the same rules again" -s rule sync file $FILE pref 1000-1999
+test_on "^0 added, 0 deleted, 2 unchanged"
+
+: > $FILE
+ts_ip "$0" "Sync an empty file" -s rule sync file $FILE pref 1000-1999
+test_on "^0 added, 2 deleted, 0 unchanged"
+
+ts_ip "$0" "Show rules" rule show
+test_on_not "^1[0-9][0-9][0-9]:"
+
+rm -f $FILE
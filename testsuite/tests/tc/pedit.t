@@ -21,6 +21,19 @@ do_pedit() {
 		filter show dev $DEV parent ffff:
 }
 
+do_pedit_ex() {
+	ts_tc "pedit" "Drop ingress qdisc" \
+		qdisc del dev $DEV ingress
+	ts_tc "pedit" "Add ingress qdisc" \
+		qdisc add dev $DEV ingress
+	ts_tc "pedit" "Add pedit action ex $*" \
+		filter add dev $DEV parent ffff: \
+		u32 match u32 0 0 \
+		action pedit ex munge $@
+	ts_tc "pedit" "Show ingress filters" \
+		filter show dev $DEV parent ffff:
+}
+
 do_pedit offset 12 u32 set 0x12345678
 test_on "key #0  at 12: val 12345678 mask 00000000"
 do_pedit offset 12 u16 set 0x1234
@@ -43,6 +56,26 @@ test_on "key #0  at 12: val 00000000 mask ff00ffff"
 do_pedit offset 13 u8 preserve
 test_on "key #0  at 12: val 00000000 mask ffffffff"
 
+# "set" munges of one word are folded into one key, and keys left
+# changing nothing are dropped unless they are the only one
+do_pedit offset 12 u16 set 0x1234 munge offset 14 u16 set 0x5678
+test_on "keys 1"
+test_on "key #0  at 12: val 12345678 mask 00000000"
+do_pedit offset 16 u32 set 0x1 munge offset 12 u8 set 0x23 \
+	munge offset 13 u8 set 0x45
+test_on "keys 2"
+test_on "key #0  at 12: val 23450000 mask 0000ffff"
+test_on "key #1  at 16: val 00000001 mask 00000000"
+do_pedit offset 12 u8 preserve munge offset 16 u32 set 0x1
+test_on "keys 1"
+test_on "key #0  at 16: val 00000001 mask 00000000"
+# and neither "at" keys nor "add" ones are
+do_pedit offset 12 u16 set 0x1234 munge offset 12 u16 at 0 f 2 set 0x5678
+test_on "keys 2"
+do_pedit_ex ip ttl add 1 munge ip ttl add 1
+test_on "keys 2"
+test_on "key #1  at ipv4\+8: add"
+
 # the following set of tests has been auto-generated by running this little
 # shell script:
 #
@@ -0,0 +1,329 @@
+/*
+ * generate_corpus.c	Netlink message corpora for the print benchmarks
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Writes COUNT messages of one kind to stdout, the way a dump comes off
+ * the socket: routes and links as "ip monitor file" reads them, sockets
+ * as ss reads $TCPDIAG_FILE (ending in NLMSG_DONE), and flower filters
+ * as "tc monitor file" reads them. The corpus only depends on the kind,
+ * the count and the seed, so two runs compare like with like.
+ *
+ * "count FILE" tells how many messages a corpus holds, one written by
+ * "ss -D" or rtmon on a live system too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/if.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/inet_diag.h>
+#include <linux/pkt_cls.h>
+#include <linux/tc_act/tc_gact.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+
+#include "libnetlink.h"
+
+#define BUFLEN	4096
+
+/* socket states, as in linux/tcp_states.h */
+#define SK_ESTABLISHED	1
+#define SK_TIME_WAIT	6
+
+static unsigned int seed = 1;
+
+/* its own generator, so the corpus is the same with any libc */
+static unsigned int rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static int fill_route(struct nlmsghdr *n, unsigned int i)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int six = i % 8 == 7;
+	unsigned char dst[16] = {}, gw[16] = {};
+
+	n->nlmsg_type = RTM_NEWROUTE;
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*r));
+	r->rtm_family = six ? AF_INET6 : AF_INET;
+	r->rtm_table = RT_TABLE_MAIN;
+	r->rtm_protocol = i % 3 ? RTPROT_ZEBRA : RTPROT_STATIC;
+	r->rtm_scope = RT_SCOPE_UNIVERSE;
+	r->rtm_type = RTN_UNICAST;
+
+	if (six) {
+		dst[0] = 0x20;
+		dst[1] = 0x01;
+		dst[2] = 0x0d;
+		dst[3] = 0xb8;
+		memcpy(dst + 4, &i, sizeof(i));
+		gw[0] = 0xfe;
+		gw[1] = 0x80;
+		gw[15] = 1 + rnd() % 254;
+		r->rtm_dst_len = 64;
+	} else {
+		dst[0] = 10 + (i >> 16);
+		dst[1] = i >> 8;
+		dst[2] = i;
+		gw[0] = 192;
+		gw[1] = 0;
+		gw[2] = 2;
+		gw[3] = 1 + rnd() % 254;
+		r->rtm_dst_len = 24;
+	}
+
+	addattr32(n, BUFLEN, RTA_TABLE, RT_TABLE_MAIN);
+	addattr_l(n, BUFLEN, RTA_DST, dst, six ? 16 : 4);
+	addattr_l(n, BUFLEN, RTA_GATEWAY, gw, six ? 16 : 4);
+	addattr32(n, BUFLEN, RTA_OIF, 1);
+	if (i % 2)
+		addattr32(n, BUFLEN, RTA_PRIORITY, 20 + rnd() % 200);
+	return 0;
+}
+
+static int fill_link(struct nlmsghdr *n, unsigned int i)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtnl_link_stats64 s64 = {};
+	struct rtnl_link_stats s = {};
+	unsigned char mac[ETH_ALEN] = { 0x02 };
+	unsigned char bc[ETH_ALEN];
+	char name[IFNAMSIZ];
+
+	n->nlmsg_type = RTM_NEWLINK;
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+	ifi->ifi_type = ARPHRD_ETHER;
+	ifi->ifi_index = 1000 + i;
+	ifi->ifi_flags = IFF_UP | IFF_RUNNING | IFF_LOWER_UP |
+			 IFF_BROADCAST | IFF_MULTICAST;
+
+	snprintf(name, sizeof(name), "bench%u", i);
+	memcpy(mac + 2, &i, sizeof(i));
+	memset(bc, 0xff, sizeof(bc));
+
+	s64.rx_packets = rnd();
+	s64.tx_packets = rnd();
+	s64.rx_bytes = s64.rx_packets * (64 + rnd() % 1400);
+	s64.tx_bytes = s64.tx_packets * (64 + rnd() % 1400);
+	s64.rx_dropped = rnd() % 1000;
+	s64.tx_errors = rnd() % 10;
+	s64.multicast = rnd() % 100000;
+	s.rx_packets = s64.rx_packets;
+	s.tx_packets = s64.tx_packets;
+	s.rx_bytes = s64.rx_bytes;
+	s.tx_bytes = s64.tx_bytes;
+	s.rx_dropped = s64.rx_dropped;
+	s.tx_errors = s64.tx_errors;
+	s.multicast = s64.multicast;
+
+	addattrstrz(n, BUFLEN, IFLA_IFNAME, name);
+	addattr32(n, BUFLEN, IFLA_TXQLEN, 1000);
+	addattr8(n, BUFLEN, IFLA_OPERSTATE, IF_OPER_UP);
+	addattr8(n, BUFLEN, IFLA_LINKMODE, 0);
+	addattr32(n, BUFLEN, IFLA_MTU, 1500);
+	addattr32(n, BUFLEN, IFLA_GROUP, 0);
+	addattr32(n, BUFLEN, IFLA_NUM_TX_QUEUES, 1 + i % 8);
+	addattr32(n, BUFLEN, IFLA_NUM_RX_QUEUES, 1 + i % 8);
+	addattrstrz(n, BUFLEN, IFLA_QDISC, i % 4 ? "fq_codel" : "mq");
+	addattr_l(n, BUFLEN, IFLA_ADDRESS, mac, sizeof(mac));
+	addattr_l(n, BUFLEN, IFLA_BROADCAST, bc, sizeof(bc));
+	addattr_l(n, BUFLEN, IFLA_STATS64, &s64, sizeof(s64));
+	addattr_l(n, BUFLEN, IFLA_STATS, &s, sizeof(s));
+	return 0;
+}
+
+static int fill_sock(struct nlmsghdr *n, unsigned int i)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(n);
+	struct inet_diag_meminfo m = {};
+	struct tcp_info ti = {};
+	int six = i % 4 == 3;
+
+	n->nlmsg_type = TCPDIAG_GETSOCK;
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*r));
+	r->idiag_family = six ? AF_INET6 : AF_INET;
+	r->idiag_state = i % 16 ? SK_ESTABLISHED : SK_TIME_WAIT;
+	r->id.idiag_sport = htons(i % 10 ? 443 : 22);
+	r->id.idiag_dport = htons(1024 + rnd() % 60000);
+	if (six) {
+		r->id.idiag_src[0] = htonl(0x20010db8);
+		r->id.idiag_src[3] = htonl(1);
+		r->id.idiag_dst[0] = htonl(0x20010db8);
+		r->id.idiag_dst[3] = htonl(i);
+	} else {
+		r->id.idiag_src[0] = htonl(0xc0000201);
+		r->id.idiag_dst[0] = htonl(0x0a000000 + i);
+	}
+	r->id.idiag_cookie[0] = i;
+	r->idiag_rqueue = rnd() % 4096;
+	r->idiag_wqueue = rnd() % 65536;
+	r->idiag_uid = 1000;
+	r->idiag_inode = 100000 + i;
+	if (r->idiag_state == SK_TIME_WAIT)
+		return 0;
+
+	ti.tcpi_state = r->idiag_state;
+	ti.tcpi_options = TCPI_OPT_TIMESTAMPS | TCPI_OPT_SACK |
+			  TCPI_OPT_WSCALE;
+	ti.tcpi_snd_wscale = 7;
+	ti.tcpi_rcv_wscale = 7;
+	ti.tcpi_rto = 204000;
+	ti.tcpi_ato = 40000;
+	ti.tcpi_snd_mss = 1448;
+	ti.tcpi_rcv_mss = 1448;
+	ti.tcpi_rtt = 1000 + rnd() % 100000;
+	ti.tcpi_rttvar = ti.tcpi_rtt / 4;
+	ti.tcpi_snd_ssthresh = 0x7fffffff;
+	ti.tcpi_snd_cwnd = 10 + rnd() % 100;
+	ti.tcpi_rcv_space = 14480;
+	ti.tcpi_total_retrans = rnd() % 10;
+	ti.tcpi_pacing_rate = rnd();
+	ti.tcpi_max_pacing_rate = ~0ULL;
+	ti.tcpi_bytes_acked = rnd();
+	ti.tcpi_bytes_received = rnd();
+	ti.tcpi_segs_out = rnd() % 100000;
+	ti.tcpi_segs_in = rnd() % 100000;
+	ti.tcpi_min_rtt = ti.tcpi_rtt / 2;
+	ti.tcpi_delivery_rate = rnd();
+
+	m.idiag_rmem = rnd() % 65536;
+	m.idiag_wmem = rnd() % 65536;
+	m.idiag_fmem = 4096;
+	m.idiag_tmem = m.idiag_wmem;
+
+	addattr_l(n, BUFLEN, INET_DIAG_MEMINFO, &m, sizeof(m));
+	addattr_l(n, BUFLEN, INET_DIAG_INFO, &ti, sizeof(ti));
+	addattrstrz(n, BUFLEN, INET_DIAG_CONG, i % 8 ? "cubic" : "bbr");
+	return 0;
+}
+
+static int fill_flower(struct nlmsghdr *n, unsigned int i)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct tc_gact gact = { .action = TC_ACT_SHOT };
+	struct rtattr *opts, *acts, *act, *aopts;
+	__u32 dst = htonl(0x0a000000 + i), mask = htonl(~0U);
+	__u16 port = htons(i % 65535 + 1), pmask = 0xffff;
+
+	n->nlmsg_type = RTM_NEWTFILTER;
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*t));
+	t->tcm_family = AF_UNSPEC;
+	t->tcm_ifindex = 1;
+	t->tcm_parent = TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS);
+	t->tcm_handle = i + 1;
+	t->tcm_info = TC_H_MAKE((1 + i % 16) << 16, htons(ETH_P_IP));
+
+	addattrstrz(n, BUFLEN, TCA_KIND, "flower");
+	addattr32(n, BUFLEN, TCA_CHAIN, 0);
+	opts = addattr_nest(n, BUFLEN, TCA_OPTIONS);
+	addattr16(n, BUFLEN, TCA_FLOWER_KEY_ETH_TYPE, htons(ETH_P_IP));
+	addattr8(n, BUFLEN, TCA_FLOWER_KEY_IP_PROTO, IPPROTO_TCP);
+	addattr_l(n, BUFLEN, TCA_FLOWER_KEY_IPV4_DST, &dst, sizeof(dst));
+	addattr_l(n, BUFLEN, TCA_FLOWER_KEY_IPV4_DST_MASK, &mask,
+		  sizeof(mask));
+	addattr16(n, BUFLEN, TCA_FLOWER_KEY_TCP_DST, port);
+	addattr16(n, BUFLEN, TCA_FLOWER_KEY_TCP_DST_MASK, pmask);
+	addattr32(n, BUFLEN, TCA_FLOWER_FLAGS, TCA_CLS_FLAGS_NOT_IN_HW);
+
+	acts = addattr_nest(n, BUFLEN, TCA_FLOWER_ACT);
+	act = addattr_nest(n, BUFLEN, 1);
+	addattrstrz(n, BUFLEN, TCA_ACT_KIND, "gact");
+	aopts = addattr_nest(n, BUFLEN, TCA_ACT_OPTIONS);
+	gact.index = i + 1;
+	gact.refcnt = 1;
+	gact.bindcnt = 1;
+	addattr_l(n, BUFLEN, TCA_GACT_PARMS, &gact, sizeof(gact));
+	addattr_nest_end(n, aopts);
+	addattr_nest_end(n, act);
+	addattr_nest_end(n, acts);
+	addattr_nest_end(n, opts);
+	return 0;
+}
+
+static const struct {
+	const char	*kind;
+	int		(*fill)(struct nlmsghdr *n, unsigned int i);
+	int		done;	/* ends in NLMSG_DONE */
+} kinds[] = {
+	{ "route",	fill_route },
+	{ "link",	fill_link },
+	{ "sock",	fill_sock,	1 },
+	{ "flower",	fill_flower },
+};
+
+static int count(const char *file)
+{
+	struct nlmsghdr n;
+	unsigned long msgs = 0;
+	FILE *f = fopen(file, "r");
+
+	if (!f) {
+		perror(file);
+		return 1;
+	}
+	while (fread(&n, sizeof(n), 1, f) == 1) {
+		if (n.nlmsg_len < sizeof(n) ||
+		    fseek(f, NLMSG_ALIGN(n.nlmsg_len) - sizeof(n), SEEK_CUR))
+			break;
+		if (n.nlmsg_type == NLMSG_DONE)
+			break;
+		msgs++;
+	}
+	fclose(f);
+	printf("%lu\n", msgs);
+	return 0;
+}
+
+static int usage(void)
+{
+	fprintf(stderr,
+		"Usage: generate_corpus { route | link | sock | flower } COUNT [ SEED ]\n"
+		"       generate_corpus count FILE\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	char buf[BUFLEN] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *n = (struct nlmsghdr *)buf;
+	unsigned int i, k, msgs;
+
+	if (argc < 3)
+		return usage();
+	if (strcmp(argv[1], "count") == 0)
+		return count(argv[2]);
+
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+		if (strcmp(argv[1], kinds[k].kind) == 0)
+			break;
+	if (k == sizeof(kinds) / sizeof(kinds[0]))
+		return usage();
+	msgs = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		seed = strtoul(argv[3], NULL, 0);
+
+	for (i = 0; i < msgs; i++) {
+		memset(buf, 0, sizeof(buf));
+		if (kinds[k].fill(n, i) < 0)
+			return 1;
+		n->nlmsg_flags = NLM_F_MULTI;
+		n->nlmsg_seq = i + 1;
+		fwrite(buf, NLMSG_ALIGN(n->nlmsg_len), 1, stdout);
+	}
+	if (kinds[k].done) {
+		memset(buf, 0, sizeof(buf));
+		n->nlmsg_type = NLMSG_DONE;
+		n->nlmsg_len = NLMSG_LENGTH(sizeof(int));
+		fwrite(buf, n->nlmsg_len, 1, stdout);
+	}
+	return fflush(stdout) ? 1 : 0;
+}
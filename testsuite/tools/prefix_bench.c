@@ -0,0 +1,101 @@
+/*
+ * prefix_bench.c	Microbenchmark of the address and prefix parsers
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Build against an older lib/ to compare, e.g. before and after a change
+ * to get_prefix_1(). Results are checked against inet_pton().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "utils.h"
+
+#define NPREFIX	(1 << 16)
+#define ROUNDS	64
+
+static char prefix[NPREFIX][INET6_ADDRSTRLEN + 4];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(int family)
+{
+	unsigned char a[16];
+	int i, j, len;
+
+	srandom(1);
+	for (i = 0; i < NPREFIX; i++) {
+		for (j = 0; j < 16; j++)
+			a[j] = random();
+		inet_ntop(family, a, prefix[i], INET6_ADDRSTRLEN);
+		len = strlen(prefix[i]);
+		snprintf(prefix[i] + len, sizeof(prefix[i]) - len, "/%ld",
+			 random() % (family == AF_INET ? 33 : 129));
+	}
+}
+
+static int check(int family)
+{
+	unsigned char a[16];
+	inet_prefix p;
+	int i;
+
+	for (i = 0; i < NPREFIX; i++) {
+		char *slash;
+
+		if (get_prefix_1(&p, prefix[i], family)) {
+			fprintf(stderr, "failed to parse %s\n", prefix[i]);
+			return -1;
+		}
+		slash = strchr(prefix[i], '/');
+		*slash = 0;
+		inet_pton(family, prefix[i], a);
+		*slash = '/';
+		if (p.family != family || memcmp(p.data, a, p.bytelen) ||
+		    p.bitlen != atoi(slash + 1)) {
+			fprintf(stderr, "bad result for %s\n", prefix[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void bench(const char *what, int family)
+{
+	inet_prefix p;
+	double t;
+	int i, r;
+
+	fill(family);
+	if (check(family))
+		exit(1);
+
+	t = now();
+	for (r = 0; r < ROUNDS; r++)
+		for (i = 0; i < NPREFIX; i++)
+			get_prefix_1(&p, prefix[i], AF_UNSPEC);
+	t = now() - t;
+
+	printf("%-12s %8.1f ns/prefix\n", what,
+	       t * 1e9 / ((double)ROUNDS * NPREFIX));
+}
+
+int main(void)
+{
+	bench("ipv4", AF_INET);
+	bench("ipv6", AF_INET6);
+	return 0;
+}
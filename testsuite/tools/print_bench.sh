@@ -0,0 +1,83 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# Replays netlink corpora through the printers of ip, ss and tc with the
+# output going to /dev/null, and tells messages/s, ns/msg and heap
+# allocations per message for each.
+#
+#	print_bench.sh			generate and time all corpora
+#	print_bench.sh KIND FILE	time one corpus, e.g. one recorded
+#					with "ss -D FILE" or rtmon
+#
+# KIND is route, link, sock or flower. ROUTES, LINKS, SOCKS and FLOWERS
+# set the size of the generated corpora, CORPUS where they are kept,
+# IP, SS and TC the binaries to time.
+
+cd "$(dirname "$0")" || exit 1
+top=../..
+
+: ${ROUTES:=1000000}
+: ${LINKS:=100000}
+: ${SOCKS:=2000000}
+: ${FLOWERS:=200000}
+: ${CORPUS:=corpus}
+: ${IP:=$top/ip/ip}
+: ${SS:=$top/misc/ss}
+: ${TC:=$top/tc/tc}
+
+now()
+{
+	date +%s%N
+}
+
+replay()
+{
+	case $1 in
+	route)	$IP monitor route file "$2" ;;
+	link)	$IP -s -d monitor link file "$2" ;;
+	sock)	TCPDIAG_FILE="$2" $SS -tanmie ;;
+	flower)	$TC -s monitor file "$2" ;;
+	*)	echo "unknown corpus kind $1" >&2; return 1 ;;
+	esac
+}
+
+bench()
+{
+	kind=$1
+	file=$2
+	msgs=$(./generate_corpus count "$file") || return 1
+	allocs=$(mktemp) || return 1
+
+	start=$(now)
+	ALLOC_COUNT_FILE=$allocs LD_PRELOAD=./alloc_count.so \
+		replay "$kind" "$file" >/dev/null || echo "$kind: replay failed" >&2
+	end=$(now)
+
+	awk -v kind="$kind" -v msgs="$msgs" -v ns=$((end - start)) '
+		$1 == "allocs" {
+			if (!msgs)
+				msgs = 1
+			printf "%-8s %10d msgs %12.0f msgs/s %9.1f ns/msg %7.2f allocs/msg\n",
+			       kind, msgs, msgs * 1e9 / ns, ns / msgs, $2 / msgs
+		}' "$allocs"
+	rm -f "$allocs"
+}
+
+if [ $# -eq 2 ]; then
+	bench "$1" "$2"
+	exit
+fi
+
+mkdir -p "$CORPUS" || exit 1
+for c in route:$ROUTES link:$LINKS sock:$SOCKS flower:$FLOWERS; do
+	kind=${c%%:*}
+	count=${c#*:}
+	file=$CORPUS/$kind-$count.nl
+
+	# generated corpora are the same for the same count, keep them
+	if [ ! -s "$file" ]; then
+		./generate_corpus "$kind" "$count" >"$file.tmp" &&
+			mv "$file.tmp" "$file" || exit 1
+	fi
+	bench "$kind" "$file"
+done
@@ -0,0 +1,64 @@
+/*
+ * run_stats.c	Run a command, tell how long it took and its peak RSS
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * run_stats FILE COMMAND [ ARGS ]... writes "SECONDS MAXRSS_KB STATUS"
+ * to FILE once COMMAND is done, the peak RSS being the largest of the
+ * command and of the children it waited for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+int main(int argc, char **argv)
+{
+	struct timespec start, end;
+	struct rusage ru;
+	int status;
+	pid_t pid;
+	FILE *f;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: run_stats FILE COMMAND [ ARGS ]...\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		execvp(argv[2], argv + 2);
+		perror(argv[2]);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("wait4");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	f = fopen(argv[1], "w");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+	fprintf(f, "%.6f %ld %d\n",
+		end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9,
+		ru.ru_maxrss,
+		WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,133 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# Installs routes, addresses, neighbours, flower and u32 filters and
+# bridge FDB entries by batch into throwaway network namespaces, then
+# dumps them again, and prints one JSON object per phase:
+#
+#	{"test":"route","scale":10000,"phase":"install","seconds":0.08,
+#	 "objects_per_sec":125000,"max_rss_kb":3120,"status":0}
+#
+# Needs root. SCALES sets the object counts, TESTS the tests out of
+# route, addr, neigh, flower, u32 and fdb, IP, TC and BRIDGE the
+# binaries to measure. Progress and errors go to stderr.
+
+cd "$(dirname "$0")" || exit 1
+top=../..
+
+: ${SCALES:="1000 10000 100000 1000000"}
+: ${TESTS:="route addr neigh flower u32 fdb"}
+: ${IP:=$top/ip/ip}
+: ${TC:=$top/tc/tc}
+: ${BRIDGE:=$top/bridge/bridge}
+
+ns=scale_bench$$
+tmp=$(mktemp -d) || exit 1
+trap '$IP netns del $ns 2>/dev/null; rm -rf "$tmp"' EXIT
+
+# the objects to install are numbered from 0, this is the n-th of them
+lines()
+{
+	awk -v n="$1" -v fmt="$2" 'BEGIN {
+		for (i = 0; i < n; i++) {
+			a = sprintf("11.%d.%d.%d", int(i / 65536) % 256,
+				    int(i / 256) % 256, i % 256)
+			m = sprintf("02:00:%02x:%02x:%02x:%02x",
+				    int(i / 16777216) % 256, int(i / 65536) % 256,
+				    int(i / 256) % 256, i % 256)
+			line = fmt
+			gsub("ADDR", a, line)
+			gsub("MAC", m, line)
+			gsub("PRIO", 1 + int(i / 4000), line)
+			print line
+		}
+	}'
+}
+
+# a device to put things on: dummy where there is one, veth otherwise
+setup_dev()
+{
+	$IP netns add $ns || return 1
+	$IP -n $ns link add d0 type dummy 2>/dev/null ||
+		$IP -n $ns link add d0 type veth peer name d1 || return 1
+	$IP -n $ns link set d1 up 2>/dev/null
+	$IP -n $ns link set d0 up
+}
+
+setup()
+{
+	setup_dev || return 1
+	case $1 in
+	flower|u32)
+		$TC -netns $ns qdisc add dev d0 clsact ;;
+	fdb)
+		$IP -n $ns link add br0 type bridge &&
+		$IP -n $ns link set d0 master br0 &&
+		$IP -n $ns link set br0 up ;;
+	esac
+}
+
+# the batch of a test, and how the result is dumped
+batch()
+{
+	case $1 in
+	route)	lines $2 "route add ADDR/32 dev d0" ;;
+	addr)	lines $2 "addr add ADDR/32 dev d0" ;;
+	neigh)	lines $2 "neigh add ADDR lladdr MAC dev d0 nud permanent" ;;
+	flower)	lines $2 "filter add dev d0 ingress protocol ip prio 1 flower dst_ip ADDR action drop" ;;
+	# a u32 hash table holds up to 4095 nodes, so a prio per 4000
+	u32)	lines $2 "filter add dev d0 ingress protocol ip prio PRIO u32 match ip dst ADDR/32 action drop" ;;
+	fdb)	lines $2 "fdb add MAC dev d0 master static" ;;
+	esac
+}
+
+install_cmd()
+{
+	case $1 in
+	route|addr|neigh)	echo "$IP -n $ns -batch $2" ;;
+	flower|u32)		echo "$TC -netns $ns -batch $2" ;;
+	fdb)			echo "$BRIDGE -netns $ns -batch $2" ;;
+	esac
+}
+
+dump_cmd()
+{
+	case $1 in
+	route)	echo "$IP -n $ns route show dev d0" ;;
+	addr)	echo "$IP -n $ns addr show dev d0" ;;
+	neigh)	echo "$IP -n $ns neigh show dev d0" ;;
+	flower|u32) echo "$TC -netns $ns filter show dev d0 ingress" ;;
+	fdb)	echo "$BRIDGE -netns $ns fdb show br br0" ;;
+	esac
+}
+
+report()
+{
+	read seconds rss status <"$tmp/stats" || return 1
+	awk -v t="$1" -v n="$2" -v p="$3" -v s="$seconds" -v r="$rss" \
+	    -v st="$status" 'BEGIN {
+		printf "{\"test\":\"%s\",\"scale\":%d,\"phase\":\"%s\",", t, n, p
+		printf "\"seconds\":%.6f,\"objects_per_sec\":%.0f,", s, (s > 0 ? n / s : 0)
+		printf "\"max_rss_kb\":%d,\"status\":%d}\n", r, st
+	}'
+}
+
+make -s run_stats >&2 || exit 1
+for t in $TESTS; do
+	for n in $SCALES; do
+		echo "$t $n" >&2
+		if ! setup $t >&2; then
+			echo "$t: setup failed" >&2
+			$IP netns del $ns 2>/dev/null
+			continue
+		fi
+		batch $t $n >"$tmp/batch"
+
+		./run_stats "$tmp/stats" $(install_cmd $t "$tmp/batch") >&2 &&
+			report $t $n install
+		./run_stats "$tmp/stats" $(dump_cmd $t) >/dev/null &&
+			report $t $n dump
+
+		$IP netns del $ns
+	done
+done
@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <time.h>
 #include <errno.h>
 
 #include <linux/tipc_netlink.h>
@@ -19,6 +21,7 @@
 #include <linux/genetlink.h>
 #include <libmnl/libmnl.h>
 
+#include "utils.h"
 #include "cmdl.h"
 #include "msg.h"
 #include "link.h"
@@ -397,11 +400,246 @@ static int cmd_link_stat_show(struct nlmsghdr *nlh, const struct cmd *cmd,
 	return msg_dumpit(nlh, link_stat_show_cb, link);
 }
 
+/*
+ * "stat sample" keeps the counters of the previous dump per link, by
+ * name, and prints what changed per second. It leaves the counters
+ * alone, unlike "stat reset". Counters of the stats nest that went back
+ * were reset meanwhile, the link is primed again then.
+ */
+#define LINK_SAMPLE_HASH_SIZE	256
+
+enum {
+	LS_RX,
+	LS_TX,
+	LS_RETRANS,
+	LS_RX_NAKS,
+	LS_TX_NAKS,
+	LS_CONGS,
+	LS_MAX
+};
+
+struct link_sample {
+	struct link_sample	*next;
+	unsigned int		round;	/* last seen in */
+	uint32_t		val[LS_MAX];
+	char			name[TIPC_MAX_LINK_NAME];
+};
+
+struct link_sampler {
+	struct link_sample	*hash[LINK_SAMPLE_HASH_SIZE];
+	const char		*link;
+	unsigned int		round;
+	double			elapsed;
+};
+
+static unsigned int link_sample_hash(const char *name)
+{
+	unsigned int h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return h & (LINK_SAMPLE_HASH_SIZE - 1);
+}
+
+static struct link_sample *link_sample_get(struct link_sampler *s,
+					   const char *name, bool *created)
+{
+	unsigned int h = link_sample_hash(name);
+	struct link_sample *ls;
+
+	*created = false;
+	for (ls = s->hash[h]; ls; ls = ls->next)
+		if (strcmp(ls->name, name) == 0)
+			return ls;
+
+	ls = calloc(1, sizeof(*ls));
+	if (!ls)
+		return NULL;
+	strncpy(ls->name, name, sizeof(ls->name) - 1);
+	ls->next = s->hash[h];
+	s->hash[h] = ls;
+	*created = true;
+	return ls;
+}
+
+/* forget the links that were not in the last dump */
+static void link_sample_prune(struct link_sampler *s, bool all)
+{
+	struct link_sample **pp, *ls;
+	unsigned int i;
+
+	for (i = 0; i < LINK_SAMPLE_HASH_SIZE; i++) {
+		pp = &s->hash[i];
+		while ((ls = *pp)) {
+			if (all || ls->round != s->round) {
+				*pp = ls->next;
+				free(ls);
+			} else {
+				pp = &ls->next;
+			}
+		}
+	}
+}
+
+static uint32_t attr_u32(const struct nlattr *attr)
+{
+	return attr ? mnl_attr_get_u32(attr) : 0;
+}
+
+static int link_stat_sample_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct link_sampler *s = data;
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *info[TIPC_NLA_MAX + 1] = {};
+	struct nlattr *attrs[TIPC_NLA_LINK_MAX + 1] = {};
+	struct nlattr *stats[TIPC_NLA_STATS_MAX + 1] = {};
+	uint32_t val[LS_MAX], d[LS_MAX];
+	struct link_sample *ls;
+	const char *name;
+	bool created;
+	bool reset = false;
+	int i;
+
+	mnl_attr_parse(nlh, sizeof(*genl), parse_attrs, info);
+	if (!info[TIPC_NLA_LINK])
+		return MNL_CB_ERROR;
+
+	mnl_attr_parse_nested(info[TIPC_NLA_LINK], parse_attrs, attrs);
+	if (!attrs[TIPC_NLA_LINK_NAME] || !attrs[TIPC_NLA_LINK_STATS])
+		return MNL_CB_ERROR;
+
+	name = mnl_attr_get_str(attrs[TIPC_NLA_LINK_NAME]);
+	if (s->link && strcmp(name, s->link) != 0)
+		return MNL_CB_OK;
+
+	mnl_attr_parse_nested(attrs[TIPC_NLA_LINK_STATS], parse_attrs, stats);
+
+	/* packets counted as "stat show" has them */
+	val[LS_RX] = attr_u32(stats[TIPC_NLA_STATS_RX_INFO]);
+	val[LS_TX] = attr_u32(stats[TIPC_NLA_STATS_TX_INFO]);
+	if (!attrs[TIPC_NLA_LINK_BROADCAST]) {
+		val[LS_RX] = attr_u32(attrs[TIPC_NLA_LINK_RX]) - val[LS_RX];
+		val[LS_TX] = attr_u32(attrs[TIPC_NLA_LINK_TX]) - val[LS_TX];
+	}
+	val[LS_RETRANS] = attr_u32(stats[TIPC_NLA_STATS_RETRANSMITTED]);
+	val[LS_RX_NAKS] = attr_u32(stats[TIPC_NLA_STATS_RX_NACKS]);
+	val[LS_TX_NAKS] = attr_u32(stats[TIPC_NLA_STATS_TX_NACKS]);
+	val[LS_CONGS] = attr_u32(stats[TIPC_NLA_STATS_LINK_CONGS]);
+
+	ls = link_sample_get(s, name, &created);
+	if (!ls)
+		return MNL_CB_ERROR;
+
+	for (i = LS_RETRANS; i < LS_MAX; i++)
+		if (val[i] < ls->val[i])
+			reset = true;
+	for (i = 0; i < LS_MAX; i++) {
+		d[i] = val[i] - ls->val[i];
+		ls->val[i] = val[i];
+	}
+	ls->round = s->round;
+	if (created || reset || s->round == 1)
+		return MNL_CB_OK;
+
+	printf("Link <%s>\n", name);
+	printf("  RX packets:%.1f/s naks:%.1f/s\n",
+	       d[LS_RX] / s->elapsed, d[LS_RX_NAKS] / s->elapsed);
+	printf("  TX packets:%.1f/s naks:%.1f/s retransmitted:%.1f/s (%.2f%%)\n",
+	       d[LS_TX] / s->elapsed, d[LS_TX_NAKS] / s->elapsed,
+	       d[LS_RETRANS] / s->elapsed,
+	       d[LS_TX] ? 100.0 * d[LS_RETRANS] / d[LS_TX] : 0.0);
+	printf("  Congestion link:%.1f/s\n", d[LS_CONGS] / s->elapsed);
+
+	return MNL_CB_OK;
+}
+
+static void cmd_link_stat_sample_help(struct cmdl *cmdl)
+{
+	fprintf(stderr,
+		"Usage: %s link stat sample [ link LINK ] [ interval SECONDS ] [ count COUNT ]\n",
+		cmdl->argv[0]);
+}
+
+static int cmd_link_stat_sample(struct nlmsghdr *nlh, const struct cmd *cmd,
+				struct cmdl *cmdl, void *data)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct link_sampler s = {};
+	struct timespec next, now, last;
+	unsigned int count = 0;
+	double interval = 1;
+	struct opt *opt;
+	int err = 0;
+	struct opt opts[] = {
+		{ "link",		OPT_KEYVAL,	NULL },
+		{ "interval",		OPT_KEYVAL,	NULL },
+		{ "count",		OPT_KEYVAL,	NULL },
+		{ NULL }
+	};
+
+	if (help_flag) {
+		(cmd->help)(cmdl);
+		return -EINVAL;
+	}
+
+	if (parse_opts(opts, cmdl) < 0)
+		return -EINVAL;
+
+	opt = get_opt(opts, "link");
+	if (opt)
+		s.link = opt->val;
+
+	opt = get_opt(opts, "interval");
+	if (opt && get_sample_interval(&interval, opt->val)) {
+		fprintf(stderr, "error, invalid interval \"%s\"\n", opt->val);
+		return -EINVAL;
+	}
+
+	opt = get_opt(opts, "count");
+	if (opt && get_unsigned(&count, opt->val, 0)) {
+		fprintf(stderr, "error, invalid count \"%s\"\n", opt->val);
+		return -EINVAL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last = next;
+	for (s.round = 1; ; s.round++) {
+		nlh = msg_init(buf, TIPC_NL_LINK_GET);
+		if (!nlh) {
+			fprintf(stderr, "error, message initialisation failed\n");
+			err = -1;
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		s.elapsed = timespec_diff(&now, &last);
+		last = now;
+
+		err = msg_dumpit(nlh, link_stat_sample_cb, &s);
+		if (err)
+			break;
+		link_sample_prune(&s, false);
+		if (s.round > 1)
+			printf("\n");
+		fflush(stdout);
+
+		/* count samples after the one the first rates are taken to */
+		if (count && s.round > count)
+			break;
+
+		sample_wait(&next, interval);
+	}
+
+	link_sample_prune(&s, true);
+	return err;
+}
+
 static void cmd_link_stat_help(struct cmdl *cmdl)
 {
 	fprintf(stderr, "Usage: %s link stat COMMAND [ARGS]\n\n"
 		"COMMANDS:\n"
 		" reset                 - Reset link statistics for link\n"
+		" sample                - Show link statistics rates\n"
 		" show                  - Get link priority\n",
 		cmdl->argv[0]);
 }
@@ -411,6 +649,7 @@ static int cmd_link_stat(struct nlmsghdr *nlh, const struct cmd *cmd,
 {
 	const struct cmd cmds[] = {
 		{ "reset",	cmd_link_stat_reset,	cmd_link_stat_reset_help },
+		{ "sample",	cmd_link_stat_sample,	cmd_link_stat_sample_help },
 		{ "show",	cmd_link_stat_show,	cmd_link_stat_show_help },
 		{ NULL }
 	};
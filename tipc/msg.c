@@ -18,6 +18,7 @@
 #include <linux/genetlink.h>
 #include <libmnl/libmnl.h>
 
+#include "libgenl.h"
 #include "msg.h"
 
 int parse_attrs(const struct nlattr *attr, void *data)
@@ -41,6 +42,7 @@ static int family_id_cb(const struct nlmsghdr *nlh, void *data)
 		return MNL_CB_ERROR;
 
 	*id = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	genl_cache_add(nlh);
 
 	return MNL_CB_OK;
 }
@@ -109,14 +111,19 @@ static int msg_query(struct nlmsghdr *nlh, mnl_cb_t callback, void *data)
 	return msg_recv(nl, callback, data, seq);
 }
 
+/* every request needs the family, only the first one asks for it */
 static int get_family(void)
 {
+	const struct genl_family *f = genl_cache_find(TIPC_GENL_V2_NAME);
 	int err;
 	int nl_family;
 	struct nlmsghdr *nlh;
 	struct genlmsghdr *genl;
 	char buf[MNL_SOCKET_BUFFER_SIZE];
 
+	if (f)
+		return f->id;
+
 	nlh = mnl_nlmsg_put_header(buf);
 	nlh->nlmsg_type	= GENL_ID_CTRL;
 	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
@@ -10,6 +10,7 @@
  */
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 
 #include <linux/tipc_netlink.h>
@@ -17,15 +18,24 @@
 #include <linux/genetlink.h>
 #include <libmnl/libmnl.h>
 
+#include "utils.h"
 #include "cmdl.h"
 #include "msg.h"
 #include "nametable.h"
 
 #define PORTID_STR_LEN 45 /* Four u32 and five delimiter chars */
 
+struct nametable_show {
+	int		iteration;
+	bool		has_type;
+	uint32_t	type;
+	bool		has_inst;
+	uint32_t	inst;
+};
+
 static int nametable_show_cb(const struct nlmsghdr *nlh, void *data)
 {
-	int *iteration = data;
+	struct nametable_show *ns = data;
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
 	struct nlattr *info[TIPC_NLA_MAX + 1] = {};
 	struct nlattr *attrs[TIPC_NLA_NAME_TABLE_MAX + 1] = {};
@@ -44,11 +54,19 @@ static int nametable_show_cb(const struct nlmsghdr *nlh, void *data)
 	if (!publ[TIPC_NLA_NAME_TABLE_PUBL])
 		return MNL_CB_ERROR;
 
-	if (!*iteration)
+	if (ns->has_type &&
+	    mnl_attr_get_u32(publ[TIPC_NLA_PUBL_TYPE]) != ns->type)
+		return MNL_CB_OK;
+	if (ns->has_inst &&
+	    (ns->inst < mnl_attr_get_u32(publ[TIPC_NLA_PUBL_LOWER]) ||
+	     ns->inst > mnl_attr_get_u32(publ[TIPC_NLA_PUBL_UPPER])))
+		return MNL_CB_OK;
+
+	if (!ns->iteration)
 		printf("%-10s %-10s %-10s %-10s %-10s %-10s\n",
 		       "Type", "Lower", "Upper", "Node", "Port",
 		       "Publication Scope");
-	(*iteration)++;
+	ns->iteration++;
 
 	printf("%-10u %-10u %-10u %-10x %-10u %-12u",
 	       mnl_attr_get_u32(publ[TIPC_NLA_PUBL_TYPE]),
@@ -66,20 +84,48 @@ static int nametable_show_cb(const struct nlmsghdr *nlh, void *data)
 static int cmd_nametable_show(struct nlmsghdr *nlh, const struct cmd *cmd,
 			      struct cmdl *cmdl, void *data)
 {
-	int iteration = 0;
+	struct nametable_show ns = {};
 	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct opt opts[] = {
+		{ "type",		OPT_KEYVAL,	NULL },
+		{ "instance",		OPT_KEYVAL,	NULL },
+		{ NULL }
+	};
+	struct opt *opt;
 
 	if (help_flag) {
-		fprintf(stderr, "Usage: %s nametable show\n", cmdl->argv[0]);
+		fprintf(stderr,
+			"Usage: %s nametable show [type TYPE] [instance INSTANCE]\n",
+			cmdl->argv[0]);
 		return -EINVAL;
 	}
 
+	if (parse_opts(opts, cmdl) < 0)
+		return -EINVAL;
+
+	if ((opt = get_opt(opts, "type"))) {
+		if (get_u32(&ns.type, opt->val, 0)) {
+			fprintf(stderr, "error, invalid type \"%s\"\n",
+				opt->val);
+			return -EINVAL;
+		}
+		ns.has_type = true;
+	}
+	if ((opt = get_opt(opts, "instance"))) {
+		if (get_u32(&ns.inst, opt->val, 0)) {
+			fprintf(stderr, "error, invalid instance \"%s\"\n",
+				opt->val);
+			return -EINVAL;
+		}
+		ns.has_inst = true;
+	}
+
 	if (!(nlh = msg_init(buf, TIPC_NL_NAME_TABLE_GET))) {
 		fprintf(stderr, "error, message initialisation failed\n");
 		return -1;
 	}
 
-	return msg_dumpit(nlh, nametable_show_cb, &iteration);
+	return msg_dumpit(nlh, nametable_show_cb, &ns);
 }
 
 void cmd_nametable_help(struct cmdl *cmdl)
@@ -87,7 +133,8 @@ void cmd_nametable_help(struct cmdl *cmdl)
 	fprintf(stderr,
 		"Usage: %s nametable COMMAND\n\n"
 		"COMMANDS\n"
-		" show                  - Show nametable\n",
+		" show [type TYPE] [instance INSTANCE]\n"
+		"                       - Show nametable\n",
 		cmdl->argv[0]);
 }
 
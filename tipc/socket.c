@@ -10,6 +10,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 
 #include <linux/tipc.h>
@@ -17,12 +19,111 @@
 #include <linux/genetlink.h>
 #include <libmnl/libmnl.h>
 
+#include "utils.h"
 #include "cmdl.h"
 #include "msg.h"
 #include "socket.h"
 
 #define PORTID_STR_LEN 45 /* Four u32 and five delimiter chars */
 
+/*
+ * The publications of all sockets come from one name table dump, taken
+ * before the sockets are listed, instead of a dump per socket. Only the
+ * five numbers a socket line needs are kept, chained by (node, ref).
+ */
+#define PUBL_HASH_SIZE	4096
+
+struct publ {
+	struct publ	*next;
+	uint32_t	node;
+	uint32_t	ref;
+	uint32_t	type;
+	uint32_t	lower;
+	uint32_t	upper;
+};
+
+struct publ_filter {
+	bool		has_type;
+	uint32_t	type;
+	bool		has_inst;
+	uint32_t	inst;
+};
+
+struct sock_list {
+	struct publ		*hash[PUBL_HASH_SIZE];
+	struct publ_filter	filter;
+	bool			joined;	/* the name table dump succeeded */
+};
+
+static unsigned int publ_hash(uint32_t node, uint32_t ref)
+{
+	return (node * 2654435761U ^ ref) & (PUBL_HASH_SIZE - 1);
+}
+
+static bool publ_match(const struct publ_filter *f, uint32_t type,
+		       uint32_t lower, uint32_t upper)
+{
+	if (f->has_type && type != f->type)
+		return false;
+	if (f->has_inst && (f->inst < lower || f->inst > upper))
+		return false;
+	return true;
+}
+
+static int publ_collect_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct sock_list *sl = data;
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *info[TIPC_NLA_MAX + 1] = {};
+	struct nlattr *attrs[TIPC_NLA_NAME_TABLE_MAX + 1] = {};
+	struct nlattr *publ[TIPC_NLA_PUBL_MAX + 1] = {};
+	struct publ *p;
+	unsigned int h;
+
+	mnl_attr_parse(nlh, sizeof(*genl), parse_attrs, info);
+	if (!info[TIPC_NLA_NAME_TABLE])
+		return MNL_CB_ERROR;
+
+	mnl_attr_parse_nested(info[TIPC_NLA_NAME_TABLE], parse_attrs, attrs);
+	if (!attrs[TIPC_NLA_NAME_TABLE_PUBL])
+		return MNL_CB_ERROR;
+
+	mnl_attr_parse_nested(attrs[TIPC_NLA_NAME_TABLE_PUBL], parse_attrs,
+			      publ);
+	if (!publ[TIPC_NLA_PUBL_NODE] || !publ[TIPC_NLA_PUBL_REF] ||
+	    !publ[TIPC_NLA_PUBL_TYPE] || !publ[TIPC_NLA_PUBL_LOWER] ||
+	    !publ[TIPC_NLA_PUBL_UPPER])
+		return MNL_CB_OK;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return MNL_CB_ERROR;
+	p->node = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_NODE]);
+	p->ref = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_REF]);
+	p->type = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_TYPE]);
+	p->lower = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_LOWER]);
+	p->upper = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_UPPER]);
+
+	h = publ_hash(p->node, p->ref);
+	p->next = sl->hash[h];
+	sl->hash[h] = p;
+
+	return MNL_CB_OK;
+}
+
+static void publ_free(struct sock_list *sl)
+{
+	struct publ *p;
+	unsigned int i;
+
+	for (i = 0; i < PUBL_HASH_SIZE; i++) {
+		while ((p = sl->hash[i])) {
+			sl->hash[i] = p->next;
+			free(p);
+		}
+	}
+}
+
 static int publ_list_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
@@ -43,6 +144,7 @@ static int publ_list_cb(const struct nlmsghdr *nlh, void *data)
 	return MNL_CB_OK;
 }
 
+/* for kernels that don't report the node of a socket */
 static int publ_list(uint32_t sock)
 {
 	struct nlmsghdr *nlh;
@@ -61,11 +163,29 @@ static int publ_list(uint32_t sock)
 	return msg_dumpit(nlh, publ_list_cb, NULL);
 }
 
+/* whether the socket is bound to a name the filter takes */
+static bool sock_bound_match(const struct sock_list *sl, uint32_t node,
+			     uint32_t ref)
+{
+	const struct publ *p;
+
+	for (p = sl->hash[publ_hash(node, ref)]; p; p = p->next)
+		if (p->node == node && p->ref == ref &&
+		    publ_match(&sl->filter, p->type, p->lower, p->upper))
+			return true;
+	return false;
+}
+
 static int sock_list_cb(const struct nlmsghdr *nlh, void *data)
 {
+	struct sock_list *sl = data;
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
 	struct nlattr *info[TIPC_NLA_MAX + 1] = {};
 	struct nlattr *attrs[TIPC_NLA_SOCK_MAX + 1] = {};
+	struct nlattr *con[TIPC_NLA_CON_MAX + 1] = {};
+	bool filtered = sl->filter.has_type || sl->filter.has_inst;
+	bool joined;
+	uint32_t ref, node = 0;
 
 	mnl_attr_parse(nlh, sizeof(*genl), parse_attrs, info);
 	if (!info[TIPC_NLA_SOCK])
@@ -75,17 +195,35 @@ static int sock_list_cb(const struct nlmsghdr *nlh, void *data)
 	if (!attrs[TIPC_NLA_SOCK_REF])
 		return MNL_CB_ERROR;
 
-	printf("socket %u\n", mnl_attr_get_u32(attrs[TIPC_NLA_SOCK_REF]));
+	ref = mnl_attr_get_u32(attrs[TIPC_NLA_SOCK_REF]);
+	joined = sl->joined && attrs[TIPC_NLA_SOCK_ADDR];
+	if (joined)
+		node = mnl_attr_get_u32(attrs[TIPC_NLA_SOCK_ADDR]);
+	if (attrs[TIPC_NLA_SOCK_CON])
+		mnl_attr_parse_nested(attrs[TIPC_NLA_SOCK_CON], parse_attrs,
+				      con);
 
-	if (attrs[TIPC_NLA_SOCK_CON]) {
-		uint32_t node;
-		struct nlattr *con[TIPC_NLA_CON_MAX + 1] = {};
+	if (filtered) {
+		bool match;
 
-		mnl_attr_parse_nested(attrs[TIPC_NLA_SOCK_CON], parse_attrs, con);
-		node = mnl_attr_get_u32(con[TIPC_NLA_CON_NODE]);
+		if (attrs[TIPC_NLA_SOCK_CON])
+			match = con[TIPC_NLA_CON_FLAG] &&
+				publ_match(&sl->filter,
+					   mnl_attr_get_u32(con[TIPC_NLA_CON_TYPE]),
+					   mnl_attr_get_u32(con[TIPC_NLA_CON_INST]),
+					   mnl_attr_get_u32(con[TIPC_NLA_CON_INST]));
+		else
+			match = joined && sock_bound_match(sl, node, ref);
+		if (!match)
+			return MNL_CB_OK;
+	}
 
-		printf("  connected to %x:%u", node,
-			mnl_attr_get_u32(con[TIPC_NLA_CON_SOCK]));
+	printf("socket %u\n", ref);
+
+	if (attrs[TIPC_NLA_SOCK_CON]) {
+		printf("  connected to %x:%u",
+		       mnl_attr_get_u32(con[TIPC_NLA_CON_NODE]),
+		       mnl_attr_get_u32(con[TIPC_NLA_CON_SOCK]));
 
 		if (con[TIPC_NLA_CON_FLAG])
 			printf(" via {%u,%u}\n",
@@ -94,28 +232,89 @@ static int sock_list_cb(const struct nlmsghdr *nlh, void *data)
 		else
 			printf("\n");
 	} else if (attrs[TIPC_NLA_SOCK_HAS_PUBL]) {
-		publ_list(mnl_attr_get_u32(attrs[TIPC_NLA_SOCK_REF]));
+		const struct publ *p;
+
+		if (!joined)
+			return publ_list(ref) < 0 ? MNL_CB_ERROR : MNL_CB_OK;
+		for (p = sl->hash[publ_hash(node, ref)]; p; p = p->next)
+			if (p->node == node && p->ref == ref)
+				printf("  bound to {%u,%u,%u}\n",
+				       p->type, p->lower, p->upper);
 	}
 
 	return MNL_CB_OK;
 }
 
+static int parse_publ_filter(struct opt *opts, struct publ_filter *f)
+{
+	struct opt *opt;
+
+	if ((opt = get_opt(opts, "type"))) {
+		if (get_u32(&f->type, opt->val, 0)) {
+			fprintf(stderr, "error, invalid type \"%s\"\n",
+				opt->val);
+			return -EINVAL;
+		}
+		f->has_type = true;
+	}
+	if ((opt = get_opt(opts, "instance"))) {
+		if (get_u32(&f->inst, opt->val, 0)) {
+			fprintf(stderr, "error, invalid instance \"%s\"\n",
+				opt->val);
+			return -EINVAL;
+		}
+		f->has_inst = true;
+	}
+	return 0;
+}
+
 static int cmd_socket_list(struct nlmsghdr *nlh, const struct cmd *cmd,
 			   struct cmdl *cmdl, void *data)
 {
 	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct opt opts[] = {
+		{ "type",		OPT_KEYVAL,	NULL },
+		{ "instance",		OPT_KEYVAL,	NULL },
+		{ NULL }
+	};
+	struct sock_list *sl;
+	int err;
 
 	if (help_flag) {
-		fprintf(stderr, "Usage: %s socket list\n", cmdl->argv[0]);
+		fprintf(stderr,
+			"Usage: %s socket list [type TYPE] [instance INSTANCE]\n",
+			cmdl->argv[0]);
 		return -EINVAL;
 	}
 
+	if (parse_opts(opts, cmdl) < 0)
+		return -EINVAL;
+
+	sl = calloc(1, sizeof(*sl));
+	if (!sl)
+		return -ENOMEM;
+	err = parse_publ_filter(opts, &sl->filter);
+	if (err)
+		goto out;
+
+	if (!(nlh = msg_init(buf, TIPC_NL_NAME_TABLE_GET))) {
+		fprintf(stderr, "error, message initialisation failed\n");
+		err = -1;
+		goto out;
+	}
+	sl->joined = msg_dumpit(nlh, publ_collect_cb, sl) >= 0;
+
 	if (!(nlh = msg_init(buf, TIPC_NL_SOCK_GET))) {
 		fprintf(stderr, "error, message initialisation failed\n");
-		return -1;
+		err = -1;
+		goto out;
 	}
 
-	return msg_dumpit(nlh, sock_list_cb, NULL);
+	err = msg_dumpit(nlh, sock_list_cb, sl);
+out:
+	publ_free(sl);
+	free(sl);
+	return err;
 }
 
 void cmd_socket_help(struct cmdl *cmdl)
@@ -123,7 +322,8 @@ void cmd_socket_help(struct cmdl *cmdl)
 	fprintf(stderr,
 		"Usage: %s socket COMMAND\n\n"
 		"Commands:\n"
-		" list                  - List sockets (ports)\n",
+		" list [type TYPE] [instance INSTANCE]\n"
+		"                       - List sockets (ports)\n",
 		cmdl->argv[0]);
 }
 